@@ -42,4 +42,53 @@
 #endif
 
 
+/*-----------------------------------------------------------------------
+ * Cache lines
+ */
+
+/* The size of a cache line, or more precisely, the granularity at which
+ * separate CPUs contend for memory.  You can define this yourself if you know
+ * better for your target CPU. */
+#if !defined(CORK_CONFIG_CACHELINE_SIZE)
+#if CORK_CONFIG_ARCH_PPC || (defined(__aarch64__) && defined(__APPLE__))
+#define CORK_CONFIG_CACHELINE_SIZE  128
+#else
+#define CORK_CONFIG_CACHELINE_SIZE  64
+#endif
+#endif
+
+
+/*-----------------------------------------------------------------------
+ * SIMD instruction sets
+ */
+
+/* We only use these if the compiler has been told that it can generate code
+ * for them, so that your chosen -march settings are respected. */
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CORK_CONFIG_HAVE_SSE2  1
+#else
+#define CORK_CONFIG_HAVE_SSE2  0
+#endif
+
+#if defined(__SSSE3__)
+#define CORK_CONFIG_HAVE_SSSE3  1
+#else
+#define CORK_CONFIG_HAVE_SSSE3  0
+#endif
+
+#if defined(__AVX2__)
+#define CORK_CONFIG_HAVE_AVX2  1
+#else
+#define CORK_CONFIG_HAVE_AVX2  0
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CORK_CONFIG_HAVE_NEON  1
+#else
+#define CORK_CONFIG_HAVE_NEON  0
+#endif
+
+
 #endif /* LIBCORK_CONFIG_ARCH_H */
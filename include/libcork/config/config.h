@@ -71,4 +71,28 @@
 #endif  /* autodetect or not */
 
 
+/**** FALLBACKS ****/
+
+/* Any C11 compiler has a thread-local storage class, even if we don't know
+ * anything else about it. */
+
+#if !defined(CORK_CONFIG_HAVE_THREAD_STORAGE_CLASS)
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define CORK_CONFIG_HAVE_THREAD_STORAGE_CLASS  1
+#define CORK_CONFIG_THREAD_STORAGE_CLASS  _Thread_local
+#else
+#define CORK_CONFIG_HAVE_THREAD_STORAGE_CLASS  0
+#endif
+#endif
+
+#if CORK_CONFIG_HAVE_THREAD_STORAGE_CLASS && \
+    !defined(CORK_CONFIG_THREAD_STORAGE_CLASS)
+#define CORK_CONFIG_THREAD_STORAGE_CLASS  __thread
+#endif
+
+#if !defined(CORK_CONFIG_TLS_INITIAL_EXEC)
+#define CORK_CONFIG_TLS_INITIAL_EXEC  0
+#endif
+
+
 #endif /* LIBCORK_CONFIG_CONFIG_H */
@@ -75,9 +75,16 @@
 #endif
 
 /* Thread-local storage has been available since GCC 3.3, but not on Mac
- * OS X. */
+ * OS X.  clang tells us directly whether the target supports it, which
+ * includes Mac OS X since Xcode 8. */
 
-#if !(defined(__APPLE__) && defined(__MACH__))
+#if defined(__clang__) && defined(__has_feature)
+#if __has_feature(tls)
+#define CORK_CONFIG_HAVE_THREAD_STORAGE_CLASS  1
+#else
+#define CORK_CONFIG_HAVE_THREAD_STORAGE_CLASS  0
+#endif
+#elif !(defined(__APPLE__) && defined(__MACH__))
 #if CORK_CONFIG_GCC_VERSION >= 30300
 #define CORK_CONFIG_HAVE_THREAD_STORAGE_CLASS  1
 #else
@@ -87,5 +94,24 @@
 #define CORK_CONFIG_HAVE_THREAD_STORAGE_CLASS  0
 #endif
 
+#if CORK_CONFIG_HAVE_THREAD_STORAGE_CLASS
+#define CORK_CONFIG_THREAD_STORAGE_CLASS  __thread
+#endif
+
+/* On ELF platforms we can ask for the initial-exec TLS model, which turns
+ * each access to a thread-local variable into a single load relative to the
+ * thread pointer.  Those variables come out of the static TLS block that the
+ * dynamic linker reserves for each thread, which is limited if libcork is
+ * loaded with dlopen; you can define CORK_CONFIG_TLS_INITIAL_EXEC to 0 if
+ * that's a problem. */
+
+#if !defined(CORK_CONFIG_TLS_INITIAL_EXEC)
+#if CORK_CONFIG_HAVE_THREAD_STORAGE_CLASS && defined(__ELF__)
+#define CORK_CONFIG_TLS_INITIAL_EXEC  1
+#else
+#define CORK_CONFIG_TLS_INITIAL_EXEC  0
+#endif
+#endif
+
 
 #endif /* LIBCORK_CONFIG_GCC_H */
@@ -30,5 +30,45 @@
 #define CORK_HAVE_REALLOCF  0
 #define CORK_HAVE_PTHREADS  1
 
+/* The io_uring interface was added in Linux 5.1; we only need the kernel
+ * headers to use it, and fall back at runtime if the kernel doesn't support
+ * it. */
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define CORK_HAVE_IO_URING  1
+#endif
+#endif
+#if !defined(CORK_HAVE_IO_URING)
+#define CORK_HAVE_IO_URING  0
+#endif
+
+/* USDT tracepoints need <sys/sdt.h>, from systemtap's SDT development
+ * package.  It's only a header; the tracepoints are nops unless something like
+ * perf or bpftrace attaches to them.  Define CORK_HAVE_USDT to 0 to compile
+ * them out completely. */
+#if !defined(CORK_HAVE_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define CORK_HAVE_USDT  1
+#endif
+#endif
+#if !defined(CORK_HAVE_USDT)
+#define CORK_HAVE_USDT  0
+#endif
+
+/* kFreeBSD and GNU/Hurd use this file too, but only Linux has inotify, epoll,
+ * and eventfd */
+#if defined(__linux)
+#define CORK_HAVE_INOTIFY  1
+#define CORK_HAVE_EPOLL  1
+#else
+#define CORK_HAVE_INOTIFY  0
+#define CORK_HAVE_EPOLL  0
+#endif
+#if defined(__FreeBSD_kernel__)
+#define CORK_HAVE_KQUEUE  1
+#else
+#define CORK_HAVE_KQUEUE  0
+#endif
+
 
 #endif /* LIBCORK_CONFIG_LINUX_H */
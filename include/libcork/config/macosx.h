@@ -29,6 +29,11 @@
 
 #define CORK_HAVE_REALLOCF  1
 #define CORK_HAVE_PTHREADS  1
+#define CORK_HAVE_IO_URING  0
+#define CORK_HAVE_USDT  0
+#define CORK_HAVE_INOTIFY  0
+#define CORK_HAVE_EPOLL  0
+#define CORK_HAVE_KQUEUE  1
 
 
 #endif /* LIBCORK_CONFIG_MACOSX_H */
@@ -188,6 +188,31 @@ cork_alloc_cfree(const struct cork_alloc *alloc, void *ptr,
 #define cork_alloc_delete(alloc, type, ptr) \
     cork_alloc_free((alloc), (ptr), sizeof(type))
 
+/* Allocations whose address is a multiple of alignment, which must be a power
+ * of two.  You must free them with cork_alloc_aligned_free, passing in the
+ * same size and alignment.  These work with any allocator, since we
+ * over-allocate from the underlying malloc function and align the result
+ * ourselves. */
+
+CORK_ATTR_MALLOC
+CORK_API void *
+cork_alloc_aligned_malloc(const struct cork_alloc *alloc,
+                          size_t size, size_t alignment);
+
+CORK_ATTR_MALLOC
+CORK_API void *
+cork_alloc_aligned_xmalloc(const struct cork_alloc *alloc,
+                           size_t size, size_t alignment);
+
+CORK_ATTR_MALLOC
+CORK_API void *
+cork_alloc_aligned_calloc(const struct cork_alloc *alloc,
+                          size_t count, size_t size, size_t alignment);
+
+CORK_API void
+cork_alloc_aligned_free(const struct cork_alloc *alloc, void *ptr,
+                        size_t size, size_t alignment);
+
 /* string-related helper functions */
 
 CORK_ATTR_MALLOC
@@ -343,6 +368,58 @@ cork_cfree(void *ptr, size_t count, size_t size)
 #define cork_delete(type, ptr)  cork_free((ptr), sizeof(type))
 
 
+/* aligned allocations */
+
+CORK_ATTR_MALLOC
+CORK_ATTR_UNUSED
+static void *
+cork_aligned_malloc(size_t size, size_t alignment)
+{
+    const struct cork_alloc  *alloc = cork_current_allocator();
+    return cork_alloc_aligned_malloc(alloc, size, alignment);
+}
+
+CORK_ATTR_MALLOC
+CORK_ATTR_UNUSED
+static void *
+cork_aligned_xmalloc(size_t size, size_t alignment)
+{
+    const struct cork_alloc  *alloc = cork_current_allocator();
+    return cork_alloc_aligned_xmalloc(alloc, size, alignment);
+}
+
+CORK_ATTR_MALLOC
+CORK_ATTR_UNUSED
+static void *
+cork_aligned_calloc(size_t count, size_t size, size_t alignment)
+{
+    const struct cork_alloc  *alloc = cork_current_allocator();
+    return cork_alloc_aligned_calloc(alloc, count, size, alignment);
+}
+
+CORK_ATTR_UNUSED
+static void
+cork_aligned_free(void *ptr, size_t size, size_t alignment)
+{
+    const struct cork_alloc  *alloc = cork_current_allocator();
+    cork_alloc_aligned_free(alloc, ptr, size, alignment);
+}
+
+#define cork_aligned_new(type, alignment) \
+    cork_aligned_malloc(sizeof(type), (alignment))
+#define cork_aligned_delete(type, alignment, ptr) \
+    cork_aligned_free((ptr), sizeof(type), (alignment))
+
+/* Allocate a single instance of type in its own cache line(s), so that it
+ * doesn't share a cache line with anything else. */
+#define cork_cacheline_new(type) \
+    cork_aligned_calloc(1, CORK_CACHELINE_ROUND(sizeof(type)), \
+                        CORK_CACHELINE_SIZE)
+#define cork_cacheline_delete(type, ptr) \
+    cork_aligned_free((ptr), CORK_CACHELINE_ROUND(sizeof(type)), \
+                      CORK_CACHELINE_SIZE)
+
+
 /* string-related helper functions */
 
 CORK_ATTR_MALLOC
@@ -406,4 +483,128 @@ struct cork_alloc *
 cork_debug_alloc_new(const struct cork_alloc *parent);
 
 
+/*-----------------------------------------------------------------------
+ * Arena allocator
+ */
+
+/* An allocator that carves allocations out of large chunks of memory, which
+ * are all freed at once when the arena is reset or freed.  Freeing an
+ * individual allocation doesn't do anything (except for the most recent
+ * allocation, whose space can be reused).  Arenas are not thread-safe. */
+
+#define CORK_ARENA_DEFAULT_CHUNK_SIZE  65536
+
+struct cork_arena;
+
+/* Chunks are allocated from `parent`.  Use 0 for the default chunk size. */
+CORK_API struct cork_arena *
+cork_arena_new(const struct cork_alloc *parent, size_t chunk_size);
+
+/* Frees every chunk in the arena, along with the arena itself. */
+CORK_API void
+cork_arena_free(struct cork_arena *arena);
+
+/* The allocator interface for the arena, which you can pass in to any function
+ * that takes in a cork_alloc.  It's only valid until the arena is freed. */
+CORK_API const struct cork_alloc *
+cork_arena_alloc(struct cork_arena *arena);
+
+/* Invalidates everything that has been allocated from the arena, so that its
+ * memory can be reused. */
+CORK_API void
+cork_arena_reset(struct cork_arena *arena);
+
+
+/*-----------------------------------------------------------------------
+ * Slab allocator
+ */
+
+/* An allocator that rounds small allocations up to one of a fixed set of size
+ * classes, and serves them from slabs of memory obtained from `parent`.  Each
+ * thread keeps a private cache of free objects for each size class, so most
+ * allocations and frees don't need any synchronization.  Since libcork always
+ * tells us the size of an allocation when freeing it, objects don't need any
+ * header.  Allocations larger than CORK_SLAB_ALLOC_MAX_SIZE are passed through
+ * to `parent`.
+ *
+ * Slab memory is only returned to `parent` when the allocator itself is freed
+ * at process exit.  This allocator is thread-safe as long as `parent` is. */
+
+#define CORK_SLAB_ALLOC_MAX_SIZE  1024
+
+CORK_API struct cork_alloc *
+cork_slab_alloc_new(const struct cork_alloc *parent);
+
+
+/*-----------------------------------------------------------------------
+ * Statistics allocator
+ */
+
+/* An allocator that passes every request through to `parent`, keeping track
+ * of how much memory is allocated in each of a set of power-of-two size
+ * classes.  It also records the call site of one out of every `sample_rate`
+ * allocations, so that you can see which code allocates the most memory.  Use
+ * 0 for the default sample rate (CORK_STATS_ALLOC_DEFAULT_SAMPLE_RATE), or 1
+ * to record every allocation's call site.  (A call site is the innermost
+ * caller that wasn't inlined, so per-site attribution through the static
+ * wrappers like cork_malloc needs those wrappers to be inlined.)  Failed
+ * allocations aren't counted.  Thread-safe as long as `parent` is. */
+
+#define CORK_STATS_ALLOC_DEFAULT_SAMPLE_RATE  64
+
+struct cork_buffer;
+
+struct cork_alloc_stats {
+    size_t  live_bytes;
+    size_t  peak_bytes;
+    size_t  alloc_count;
+    size_t  free_count;
+    size_t  realloc_count;
+    /* The number of bytes that reallocations had to copy to a new location */
+    size_t  realloc_copy_bytes;
+};
+
+CORK_API struct cork_alloc *
+cork_stats_alloc_new(const struct cork_alloc *parent,
+                     unsigned int sample_rate);
+
+/* `alloc` must have been created by cork_stats_alloc_new. */
+CORK_API void
+cork_stats_alloc_get(const struct cork_alloc *alloc,
+                     struct cork_alloc_stats *dest);
+
+/* Appends a human-readable summary of the allocator's statistics to `dest`. */
+CORK_API void
+cork_stats_alloc_snapshot(const struct cork_alloc *alloc,
+                          struct cork_buffer *dest);
+
+
+/*-----------------------------------------------------------------------
+ * Page allocator
+ */
+
+/* An allocator that maps large allocations (at least `threshold` bytes)
+ * directly from the operating system, passing smaller ones through to
+ * `parent`.  Use 0 for the default threshold. */
+
+#define CORK_PAGE_ALLOC_DEFAULT_THRESHOLD  (1024 * 1024)
+
+/* Align large allocations to huge page boundaries, and ask the kernel to back
+ * them with transparent huge pages. */
+#define CORK_PAGE_ALLOC_HUGE_PAGES  0x0001
+
+/* Try to map large allocations from the system's pool of explicitly reserved
+ * huge pages, falling back on transparent huge pages if there aren't enough
+ * available. */
+#define CORK_PAGE_ALLOC_EXPLICIT_HUGE_PAGES  0x0002
+
+/* Prefer to place large allocations on the NUMA node of the thread that
+ * allocates them. */
+#define CORK_PAGE_ALLOC_LOCAL_NODE  0x0004
+
+CORK_API struct cork_alloc *
+cork_page_alloc_new(const struct cork_alloc *parent, size_t threshold,
+                    unsigned int flags);
+
+
 #endif /* LIBCORK_CORE_ALLOCATOR_H */
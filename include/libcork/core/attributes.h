@@ -132,6 +132,16 @@
 #define CORK_UNLIKELY(expr)  (expr)
 #endif
 
+/*
+ * Hint that the memory at the given address will be read soon.
+ */
+
+#if CORK_CONFIG_HAVE_GCC_ATTRIBUTES
+#define CORK_PREFETCH(addr)  __builtin_prefetch((addr))
+#else
+#define CORK_PREFETCH(addr)  ((void) (addr))
+#endif
+
 /*
  * Declare that a function is part of the current library's public API, or that
  * it's internal to the current library.
@@ -148,6 +158,43 @@
 #endif
 
 
+/*
+ * Declare that a type or variable must be aligned to a multiple of the given
+ * number of bytes, which must be a power of two.
+ */
+
+#if CORK_CONFIG_HAVE_GCC_ATTRIBUTES
+#define CORK_ATTR_ALIGNED(alignment)  __attribute__((aligned(alignment)))
+#else
+#define CORK_ATTR_ALIGNED(alignment)
+#endif
+
+/*
+ * Cache lines.  Data that's written by one thread shouldn't share a cache line
+ * with data that's used by other threads, since otherwise the CPUs will fight
+ * over the cache line even though the threads don't share any data ("false
+ * sharing").  CORK_ATTR_CACHELINE_ALIGNED makes a type or variable start on a
+ * new cache line; if it's a type, its size will also be rounded up to a
+ * multiple of the cache line size.  CORK_CACHELINE_PAD declares a padding
+ * field that fills up the rest of the cache line, for a struct whose earlier
+ * fields take up used bytes.
+ */
+
+#if !defined(CORK_CONFIG_CACHELINE_SIZE)
+#define CORK_CONFIG_CACHELINE_SIZE  64
+#endif
+
+#define CORK_CACHELINE_SIZE  CORK_CONFIG_CACHELINE_SIZE
+
+#define CORK_CACHELINE_ROUND(size) \
+    (((size) + CORK_CACHELINE_SIZE - 1) & ~((size_t) CORK_CACHELINE_SIZE - 1))
+
+#define CORK_ATTR_CACHELINE_ALIGNED  CORK_ATTR_ALIGNED(CORK_CACHELINE_SIZE)
+
+#define CORK_CACHELINE_PAD(name, used) \
+    char  name[CORK_CACHELINE_SIZE - ((used) % CORK_CACHELINE_SIZE)]
+
+
 /*
  * Declare a static function that should automatically be called at program
  * startup.
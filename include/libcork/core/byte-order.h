@@ -12,7 +12,11 @@
 #define LIBCORK_CORE_BYTE_ORDER_H
 
 
+#include <string.h>
+
 #include <libcork/config.h>
+#include <libcork/core/api.h>
+#include <libcork/core/attributes.h>
 #include <libcork/core/types.h>
 
 
@@ -183,4 +187,115 @@
 #define CORK_UINT64_HOST_TO_LITTLE_IN_PLACE(__u64)  CORK_UINT64_LITTLE_TO_HOST_IN_PLACE(__u64)
 
 
+
+/*-----------------------------------------------------------------------
+ * Unaligned loads and stores
+ */
+
+/* Reads or writes an integer with a particular endianness at an arbitrary
+ * (possibly unaligned) address.  The memcpy compiles into a single load or
+ * store on platforms that allow unaligned access. */
+
+#define cork_byte_order_define_load_store(bits, name, TO_HOST, FROM_HOST) \
+CORK_ATTR_UNUSED \
+static inline uint##bits##_t \
+cork_load_##name##bits(const void *src) \
+{ \
+    uint##bits##_t  value; \
+    memcpy(&value, src, sizeof(value)); \
+    return TO_HOST(value); \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+cork_store_##name##bits(void *dest, uint##bits##_t value) \
+{ \
+    value = FROM_HOST(value); \
+    memcpy(dest, &value, sizeof(value)); \
+}
+
+cork_byte_order_define_load_store(16, be, CORK_UINT16_BIG_TO_HOST,
+                                  CORK_UINT16_HOST_TO_BIG)
+cork_byte_order_define_load_store(32, be, CORK_UINT32_BIG_TO_HOST,
+                                  CORK_UINT32_HOST_TO_BIG)
+cork_byte_order_define_load_store(64, be, CORK_UINT64_BIG_TO_HOST,
+                                  CORK_UINT64_HOST_TO_BIG)
+cork_byte_order_define_load_store(16, le, CORK_UINT16_LITTLE_TO_HOST,
+                                  CORK_UINT16_HOST_TO_LITTLE)
+cork_byte_order_define_load_store(32, le, CORK_UINT32_LITTLE_TO_HOST,
+                                  CORK_UINT32_HOST_TO_LITTLE)
+cork_byte_order_define_load_store(64, le, CORK_UINT64_LITTLE_TO_HOST,
+                                  CORK_UINT64_HOST_TO_LITTLE)
+
+#undef cork_byte_order_define_load_store
+
+
+/*-----------------------------------------------------------------------
+ * Swapping arrays
+ */
+
+/* Byte-swaps each of the count integers in src, storing the results in dest.
+ * Neither array needs to be aligned, and dest can be the same as src (but the
+ * arrays can't otherwise overlap).  These use SSSE3, AVX2, or NEON byte
+ * shuffles if you compile libcork with support for them. */
+
+CORK_API void
+cork_bswap16_array(void *dest, const void *src, size_t count);
+
+CORK_API void
+cork_bswap32_array(void *dest, const void *src, size_t count);
+
+CORK_API void
+cork_bswap64_array(void *dest, const void *src, size_t count);
+
+#define cork_bswap16_array_in_place(values, count) \
+    (cork_bswap16_array((values), (values), (count)))
+#define cork_bswap32_array_in_place(values, count) \
+    (cork_bswap32_array((values), (values), (count)))
+#define cork_bswap64_array_in_place(values, count) \
+    (cork_bswap64_array((values), (values), (count)))
+
+/* Converts an array of big-endian integers into host endianness, or vice
+ * versa.  On a big-endian host, this copies the array (if dest and src are
+ * different) instead of swapping it. */
+
+#define cork_byte_order_copy_array(dest, src, count, size) \
+    ((const void *) (dest) == (const void *) (src)? (void) 0: \
+     (void) memmove((dest), (src), (count) * (size)))
+
+#if CORK_HOST_ENDIANNESS == CORK_BIG_ENDIAN
+#define CORK_UINT16_BIG_TO_HOST_ARRAY(dest, src, count) \
+    cork_byte_order_copy_array(dest, src, count, 2)
+#define CORK_UINT32_BIG_TO_HOST_ARRAY(dest, src, count) \
+    cork_byte_order_copy_array(dest, src, count, 4)
+#define CORK_UINT64_BIG_TO_HOST_ARRAY(dest, src, count) \
+    cork_byte_order_copy_array(dest, src, count, 8)
+#define CORK_UINT16_LITTLE_TO_HOST_ARRAY(dest, src, count) \
+    cork_bswap16_array(dest, src, count)
+#define CORK_UINT32_LITTLE_TO_HOST_ARRAY(dest, src, count) \
+    cork_bswap32_array(dest, src, count)
+#define CORK_UINT64_LITTLE_TO_HOST_ARRAY(dest, src, count) \
+    cork_bswap64_array(dest, src, count)
+#else
+#define CORK_UINT16_BIG_TO_HOST_ARRAY(dest, src, count) \
+    cork_bswap16_array(dest, src, count)
+#define CORK_UINT32_BIG_TO_HOST_ARRAY(dest, src, count) \
+    cork_bswap32_array(dest, src, count)
+#define CORK_UINT64_BIG_TO_HOST_ARRAY(dest, src, count) \
+    cork_bswap64_array(dest, src, count)
+#define CORK_UINT16_LITTLE_TO_HOST_ARRAY(dest, src, count) \
+    cork_byte_order_copy_array(dest, src, count, 2)
+#define CORK_UINT32_LITTLE_TO_HOST_ARRAY(dest, src, count) \
+    cork_byte_order_copy_array(dest, src, count, 4)
+#define CORK_UINT64_LITTLE_TO_HOST_ARRAY(dest, src, count) \
+    cork_byte_order_copy_array(dest, src, count, 8)
+#endif
+
+#define CORK_UINT16_HOST_TO_BIG_ARRAY  CORK_UINT16_BIG_TO_HOST_ARRAY
+#define CORK_UINT32_HOST_TO_BIG_ARRAY  CORK_UINT32_BIG_TO_HOST_ARRAY
+#define CORK_UINT64_HOST_TO_BIG_ARRAY  CORK_UINT64_BIG_TO_HOST_ARRAY
+#define CORK_UINT16_HOST_TO_LITTLE_ARRAY  CORK_UINT16_LITTLE_TO_HOST_ARRAY
+#define CORK_UINT32_HOST_TO_LITTLE_ARRAY  CORK_UINT32_LITTLE_TO_HOST_ARRAY
+#define CORK_UINT64_HOST_TO_LITTLE_ARRAY  CORK_UINT64_LITTLE_TO_HOST_ARRAY
+
 #endif /* LIBCORK_CORE_BYTE_ORDER_H */
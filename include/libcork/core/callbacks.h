@@ -14,6 +14,9 @@
 #include <libcork/core/hash.h>
 
 
+typedef int
+(*cork_compare_f)(void *user_data, const void *value1, const void *value2);
+
 typedef int
 (*cork_copy_f)(void *user_data, void *dest, const void *src);
 
@@ -26,6 +29,9 @@ typedef void
 typedef cork_hash
 (*cork_hash_f)(void *user_data, const void *value);
 
+typedef cork_hash64
+(*cork_hash64_f)(void *user_data, const void *value);
+
 typedef bool
 (*cork_equals_f)(void *user_data, const void *value1, const void *value2);
 
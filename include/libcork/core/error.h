@@ -46,6 +46,11 @@ cork_error_set_printf(cork_error code, const char *format, ...)
 CORK_API void
 cork_error_set_string(cork_error code, const char *str);
 
+/* Like cork_error_set_string, but doesn't copy str, which must stay valid
+ * until the error is cleared or replaced.  (A string literal, say.) */
+CORK_API void
+cork_error_set_static(cork_error code, const char *str);
+
 CORK_API void
 cork_error_set_vprintf(cork_error code, const char *format, va_list args)
     CORK_ATTR_PRINTF(2,0);
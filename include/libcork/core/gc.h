@@ -17,6 +17,7 @@
 
 
 struct cork_gc;
+struct cork_mempool;
 
 /* A callback for recursing through the children of a garbage-collected
  * object. */
@@ -36,6 +37,12 @@ struct cork_gc_obj_iface {
      * object itself, or release any child references */
     cork_gc_free_func  free;
     cork_gc_recurse_func  recurse;
+    /* If not NULL, objects of this type are allocated from this pool instead
+     * of from the current allocator.  The pool must be created with
+     * cork_gc_mempool_new_size (or cork_gc_mempool_new).  This field is new
+     * in version 17 of the shared library, so anything that defines its own
+     * interfaces must be recompiled against this header. */
+    struct cork_mempool  *pool;
 };
 
 
@@ -57,6 +64,15 @@ cork_gc_alloc(size_t instance_size, struct cork_gc_obj_iface *iface);
     (cork_gc_new_iface(struct struct_name, &struct_name##__gc))
 
 
+/* Create a memory pool that can hold garbage-collected objects of the given
+ * size, including their garbage collection headers. */
+CORK_API struct cork_mempool *
+cork_gc_mempool_new_size(size_t instance_size);
+
+#define cork_gc_mempool_new(obj_type) \
+    (cork_gc_mempool_new_size(sizeof(obj_type)))
+
+
 CORK_API void *
 cork_gc_incref(void *obj);
 
@@ -64,4 +80,57 @@ CORK_API void
 cork_gc_decref(void *obj);
 
 
+/* Between these calls, an object whose reference count drops to zero isn't
+ * freed until we leave the outermost deferral scope.  Code that only holds
+ * temporary references to objects can borrow them without calling
+ * cork_gc_incref and cork_gc_decref, as long as those references don't
+ * outlive the scope.  Scopes can be nested. */
+
+CORK_API void
+cork_gc_defer_begin(void);
+
+CORK_API void
+cork_gc_defer_end(void);
+
+
+/* Cycle collection */
+
+/* We automatically look for garbage cycles once this many objects have been
+ * buffered as possible cycle roots. */
+#define CORK_GC_DEFAULT_ROOT_THRESHOLD  1024
+
+struct cork_gc_stats {
+    /* The number of times that we've looked for garbage cycles */
+    size_t  collections;
+    /* The number of objects that we've examined while looking for cycles */
+    size_t  objects_scanned;
+    /* The number of objects that were freed because they were part of a
+     * garbage cycle */
+    size_t  objects_freed;
+    /* The total time spent looking for cycles */
+    uint64_t  collection_ns;
+    /* The number of possible cycle roots that are currently buffered */
+    size_t  possible_roots;
+};
+
+/* Look for garbage cycles right now. */
+CORK_API void
+cork_gc_collect(void);
+
+/* Look for garbage cycles for roughly `budget_ns` nanoseconds, examining a
+ * small batch of possible roots at a time.  Returns whether there are still
+ * possible roots left to examine. */
+CORK_API bool
+cork_gc_step(uint64_t budget_ns);
+
+/* Use 0 to only look for garbage cycles when you call cork_gc_collect or
+ * cork_gc_step. */
+CORK_API void
+cork_gc_set_root_threshold(size_t threshold);
+
+/* Statistics for the current thread's garbage collector */
+CORK_API void
+cork_gc_get_stats(struct cork_gc_stats *dest);
+
+
 #endif /* LIBCORK_GC_REFCOUNT_H */
@@ -11,6 +11,8 @@
 #define LIBCORK_CORE_HASH_H
 
 
+#include <string.h>
+
 #include <libcork/core/api.h>
 #include <libcork/core/attributes.h>
 #include <libcork/core/byte-order.h>
@@ -25,6 +27,10 @@
 
 typedef uint32_t  cork_hash;
 
+/* A wider hash value, for tables that are big enough that 32 bits would cause
+ * too many collisions. */
+typedef uint64_t  cork_hash64;
+
 typedef struct {
     cork_u128  u128;
 } cork_big_hash;
@@ -345,6 +351,292 @@ cork_big_hash_buffer(cork_big_hash seed, const void *src, size_t len)
 }
 
 
+/*-----------------------------------------------------------------------
+ * Fast 64-bit hashing
+ */
+
+/* cork_wyhash is wyhash [1] (final version 4), which is public domain.  It's
+ * built around a single 64x64->128-bit multiply, which makes it much faster
+ * than MurmurHash3 on 64-bit platforms, especially for short keys.  Inputs
+ * longer than 48 bytes are consumed by three independent multiply chains, so
+ * that the CPU can overlap them.  We always read the input as little-endian,
+ * so its results are the same on every platform.
+ *
+ * [1] https://github.com/wangyi-fudan/wyhash
+ */
+
+#define CORK_WYHASH_SECRET0  UINT64_C(0xa0761d6478bd642f)
+#define CORK_WYHASH_SECRET1  UINT64_C(0xe7037ed1a0b428db)
+#define CORK_WYHASH_SECRET2  UINT64_C(0x8ebc6af09c88c6e3)
+#define CORK_WYHASH_SECRET3  UINT64_C(0x589965cc75374cc3)
+
+/* Replaces *a and *b with the low and high halves of their 128-bit product. */
+CORK_ATTR_UNUSED
+static inline
+void cork_wymum(uint64_t *a, uint64_t *b)
+{
+#if CORK_CONFIG_HAVE_GCC_INT128
+    unsigned __int128  r = *a;
+    r *= *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#else
+    uint64_t  ha = *a >> 32;
+    uint64_t  hb = *b >> 32;
+    uint64_t  la = (uint32_t) *a;
+    uint64_t  lb = (uint32_t) *b;
+    uint64_t  rh = ha * hb;
+    uint64_t  rm0 = ha * lb;
+    uint64_t  rm1 = hb * la;
+    uint64_t  rl = la * lb;
+    uint64_t  t = rl + (rm0 << 32);
+    uint64_t  c = t < rl;
+    uint64_t  lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+CORK_ATTR_UNUSED
+static inline
+uint64_t cork_wymix(uint64_t a, uint64_t b)
+{
+    cork_wymum(&a, &b);
+    return a ^ b;
+}
+
+CORK_ATTR_UNUSED
+static inline
+uint64_t cork_wyr8(const uint8_t *p)
+{
+    uint64_t  v;
+    memcpy(&v, p, sizeof(uint64_t));
+    return CORK_UINT64_LITTLE_TO_HOST(v);
+}
+
+CORK_ATTR_UNUSED
+static inline
+uint64_t cork_wyr4(const uint8_t *p)
+{
+    uint32_t  v;
+    memcpy(&v, p, sizeof(uint32_t));
+    return CORK_UINT32_LITTLE_TO_HOST(v);
+}
+
+/* Every input length funnels into this final step, once the input has been
+ * reduced to two words. */
+CORK_ATTR_UNUSED
+static inline
+uint64_t cork_wyhash_final(uint64_t seed, uint64_t a, uint64_t b, size_t len)
+{
+    a ^= CORK_WYHASH_SECRET1;
+    b ^= seed;
+    cork_wymum(&a, &b);
+    return cork_wymix(a ^ CORK_WYHASH_SECRET0 ^ len, b ^ CORK_WYHASH_SECRET1);
+}
+
+#define cork_wyhash_seed(seed) \
+    ((seed) ^ cork_wymix((seed) ^ CORK_WYHASH_SECRET0, CORK_WYHASH_SECRET1))
+
+CORK_HASH_ATTRIBUTES
+uint64_t
+cork_wyhash(uint64_t seed, const void *src, size_t len)
+{
+    const uint8_t  *p = (const uint8_t *) src;
+    uint64_t  a;
+    uint64_t  b;
+
+    seed = cork_wyhash_seed(seed);
+    if (CORK_LIKELY(len <= 16)) {
+        if (CORK_LIKELY(len >= 4)) {
+            size_t  offset = (len >> 3) << 2;
+            a = (cork_wyr4(p) << 32) | cork_wyr4(p + offset);
+            b = (cork_wyr4(p + len - 4) << 32) |
+                cork_wyr4(p + len - 4 - offset);
+        } else if (CORK_LIKELY(len > 0)) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) |
+                p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t  i = len;
+        if (CORK_UNLIKELY(i > 48)) {
+            uint64_t  see1 = seed;
+            uint64_t  see2 = seed;
+            do {
+                seed = cork_wymix(cork_wyr8(p) ^ CORK_WYHASH_SECRET1,
+                                  cork_wyr8(p + 8) ^ seed);
+                see1 = cork_wymix(cork_wyr8(p + 16) ^ CORK_WYHASH_SECRET2,
+                                  cork_wyr8(p + 24) ^ see1);
+                see2 = cork_wymix(cork_wyr8(p + 32) ^ CORK_WYHASH_SECRET3,
+                                  cork_wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (CORK_LIKELY(i > 48));
+            seed ^= see1 ^ see2;
+        }
+        while (CORK_UNLIKELY(i > 16)) {
+            seed = cork_wymix(cork_wyr8(p) ^ CORK_WYHASH_SECRET1,
+                              cork_wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = cork_wyr8(p + i - 16);
+        b = cork_wyr8(p + i - 8);
+    }
+    return cork_wyhash_final(seed, a, b, len);
+}
+
+/* Dedicated versions of cork_wyhash for fixed-size keys.  Each gives the same
+ * result as calling cork_wyhash on the in-memory representation of val, but
+ * without any length checks or loads from memory. */
+
+CORK_HASH_ATTRIBUTES
+uint64_t
+cork_wyhash_u32(uint64_t seed, uint32_t val)
+{
+    uint64_t  x = CORK_UINT32_HOST_TO_LITTLE(val);
+    uint64_t  ab = (x << 32) | x;
+    return cork_wyhash_final(cork_wyhash_seed(seed), ab, ab, 4);
+}
+
+CORK_HASH_ATTRIBUTES
+uint64_t
+cork_wyhash_u64(uint64_t seed, uint64_t val)
+{
+    uint64_t  x = CORK_UINT64_HOST_TO_LITTLE(val);
+    uint64_t  lo = (uint32_t) x;
+    uint64_t  hi = x >> 32;
+    return cork_wyhash_final
+        (cork_wyhash_seed(seed), (lo << 32) | hi, (hi << 32) | lo, 8);
+}
+
+CORK_HASH_ATTRIBUTES
+uint64_t
+cork_wyhash_u128(uint64_t seed, cork_u128 val)
+{
+    uint64_t  w0 = CORK_UINT32_HOST_TO_LITTLE(val._.u32[0]);
+    uint64_t  w1 = CORK_UINT32_HOST_TO_LITTLE(val._.u32[1]);
+    uint64_t  w2 = CORK_UINT32_HOST_TO_LITTLE(val._.u32[2]);
+    uint64_t  w3 = CORK_UINT32_HOST_TO_LITTLE(val._.u32[3]);
+    return cork_wyhash_final
+        (cork_wyhash_seed(seed), (w0 << 32) | w2, (w3 << 32) | w1, 16);
+}
+
+/* cork_hash-sized versions of the above, which you can use anywhere that you
+ * would use cork_hash_buffer.  Like cork_hash_buffer, the values they produce
+ * might change in future versions of libcork. */
+
+#define cork_fast_hash_buffer(seed, src, len) \
+    ((cork_hash) cork_wyhash((seed), (src), (len)))
+#define cork_fast_hash_variable(seed, val) \
+    (cork_fast_hash_buffer((seed), &(val), sizeof((val))))
+#define cork_fast_hash_u32(seed, val) \
+    ((cork_hash) cork_wyhash_u32((seed), (val)))
+#define cork_fast_hash_u64(seed, val) \
+    ((cork_hash) cork_wyhash_u64((seed), (val)))
+#define cork_fast_hash_u128(seed, val) \
+    ((cork_hash) cork_wyhash_u128((seed), (val)))
+
+/* cork_hash64 versions of the above. */
+
+#define cork_hash64_buffer(seed, src, len) \
+    ((cork_hash64) cork_wyhash((seed), (src), (len)))
+#define cork_hash64_variable(seed, val) \
+    (cork_hash64_buffer((seed), &(val), sizeof((val))))
+
+
+/*-----------------------------------------------------------------------
+ * Incremental hashing
+ */
+
+/* These let you hash a buffer that arrives in several pieces.  Calling
+ * _update for each piece and then _final produces exactly the same value as
+ * calling the corresponding _buffer function on the concatenation of the
+ * pieces.  _final doesn't modify the state, so you can keep updating it
+ * afterwards. */
+
+struct cork_stable_hash_state {
+    uint32_t  h1;
+    /* The total number of bytes hashed so far */
+    size_t  len;
+    /* Any bytes that don't yet make up a full block */
+    uint8_t  tail[4];
+};
+
+struct cork_big_hash_state {
+    union {
+        uint64_t  u64[2];
+        uint32_t  u32[4];
+    } h;
+    size_t  len;
+    uint8_t  tail[16];
+};
+
+struct cork_hash_state {
+#if CORK_SIZEOF_POINTER == 8
+    struct cork_big_hash_state  big;
+#else
+    struct cork_stable_hash_state  small;
+#endif
+};
+
+CORK_API void
+cork_hash_state_init(struct cork_hash_state *state, cork_hash seed);
+
+CORK_API void
+cork_hash_state_update(struct cork_hash_state *state,
+                       const void *src, size_t len);
+
+CORK_API cork_hash
+cork_hash_state_final(const struct cork_hash_state *state);
+
+CORK_API void
+cork_stable_hash_state_init(struct cork_stable_hash_state *state,
+                            cork_hash seed);
+
+CORK_API void
+cork_stable_hash_state_update(struct cork_stable_hash_state *state,
+                              const void *src, size_t len);
+
+CORK_API cork_hash
+cork_stable_hash_state_final(const struct cork_stable_hash_state *state);
+
+CORK_API void
+cork_big_hash_state_init(struct cork_big_hash_state *state,
+                         cork_big_hash seed);
+
+CORK_API void
+cork_big_hash_state_update(struct cork_big_hash_state *state,
+                           const void *src, size_t len);
+
+CORK_API cork_big_hash
+cork_big_hash_state_final(const struct cork_big_hash_state *state);
+
+
+/*-----------------------------------------------------------------------
+ * Hashing several buffers at once
+ */
+
+/* Hash count separate buffers, storing the hash of srcs[i] (which is lens[i]
+ * bytes long) into out[i].  The results are exactly the same as calling
+ * cork_hash_buffer or cork_stable_hash_buffer on each buffer in turn, but we
+ * interleave the work for several buffers, which is much faster when you
+ * have a large batch of short keys to hash. */
+
+CORK_API void
+cork_hash_buffers(cork_hash seed, const void * const *srcs,
+                  const size_t *lens, size_t count, cork_hash *out);
+
+CORK_API void
+cork_stable_hash_buffers(cork_hash seed, const void * const *srcs,
+                         const size_t *lens, size_t count, cork_hash *out);
+
+
+
 #define cork_hash_variable(seed, val) \
     (cork_hash_buffer((seed), &(val), sizeof((val))))
 #define cork_stable_hash_variable(seed, val) \
@@ -12,6 +12,7 @@
 
 
 #include <libcork/config.h>
+#include <libcork/core/allocator.h>
 #include <libcork/core/api.h>
 #include <libcork/core/attributes.h>
 #include <libcork/core/callbacks.h>
@@ -19,6 +20,7 @@
 
 
 #define CORK_MEMPOOL_DEFAULT_BLOCK_SIZE  4096
+#define CORK_MEMPOOL_DEFAULT_MAGAZINE_SIZE  64
 
 
 struct cork_mempool;
@@ -27,6 +29,12 @@ struct cork_mempool;
 CORK_API struct cork_mempool *
 cork_mempool_new_size_ex(size_t element_size, size_t block_size);
 
+/* Allocates the pool itself, as well as its blocks, from `alloc` (which must
+ * outlive the pool) instead of from cork_allocator. */
+CORK_API struct cork_mempool *
+cork_mempool_new_size_alloc(size_t element_size, size_t block_size,
+                            const struct cork_alloc *alloc);
+
 #define cork_mempool_new_size(element_size) \
     (cork_mempool_new_size_ex \
      ((element_size), CORK_MEMPOOL_DEFAULT_BLOCK_SIZE))
@@ -51,6 +59,13 @@ cork_mempool_set_init_object(struct cork_mempool *mp, cork_init_f init_object);
 CORK_API void
 cork_mempool_set_done_object(struct cork_mempool *mp, cork_done_f done_object);
 
+/* Allocate the pool's blocks from `alloc` (which must outlive the pool)
+ * instead of from cork_allocator.  Must be called before you allocate any
+ * objects. */
+CORK_API void
+cork_mempool_set_allocator(struct cork_mempool *mp,
+                           const struct cork_alloc *alloc);
+
 /* Deprecated; you should now use separate calls to cork_mempool_set_user_data,
  * cork_mempool_set_init_object, and cork_mempool_set_done_object. */
 CORK_API void
@@ -59,6 +74,19 @@ cork_mempool_set_callbacks(struct cork_mempool *mp,
                            cork_init_f init_object,
                            cork_done_f done_object);
 
+/* Makes the pool safe to use from multiple threads at once.  Each thread caches
+ * up to `magazine_size` free objects, and exchanges them with a shared depot in
+ * batches.  Must be called before you allocate any objects. */
+CORK_API void
+cork_mempool_set_thread_cache(struct cork_mempool *mp, size_t magazine_size);
+
+/* Returns the current thread's cached free objects to the shared depot, and
+ * releases its magazine.  A thread should call this for each thread-cached
+ * pool it used before it exits; otherwise its cached objects are stranded
+ * until the pool is freed.  Does nothing for other pools. */
+CORK_API void
+cork_mempool_thread_flush(struct cork_mempool *mp);
+
 
 CORK_API void *
 cork_mempool_new_object(struct cork_mempool *mp);
@@ -67,5 +95,24 @@ cork_mempool_new_object(struct cork_mempool *mp);
 CORK_API void
 cork_mempool_free_object(struct cork_mempool *mp, void *ptr);
 
+/* Allocate or free `count` objects at once. */
+
+CORK_API void
+cork_mempool_new_objects(struct cork_mempool *mp, void **ptrs, size_t count);
+
+CORK_API void
+cork_mempool_free_objects(struct cork_mempool *mp, void **ptrs, size_t count);
+
+
+/* Frees any blocks that don't contain any allocated objects, returning how many
+ * blocks were freed. */
+CORK_API size_t
+cork_mempool_trim(struct cork_mempool *mp);
+
+/* Automatically trim the pool whenever it has more than `max_free_count` free
+ * objects.  Pass in 0 to turn this off. */
+CORK_API void
+cork_mempool_set_max_free(struct cork_mempool *mp, size_t max_free_count);
+
 
 #endif /* LIBCORK_CORK_MEMPOOL_H */
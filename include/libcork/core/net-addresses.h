@@ -16,6 +16,7 @@
 #include <libcork/core/api.h>
 #include <libcork/core/error.h>
 #include <libcork/core/types.h>
+#include <libcork/ds/buffer.h>
 
 
 /*-----------------------------------------------------------------------
@@ -67,12 +68,20 @@ struct cork_ip {
 CORK_API int
 cork_ipv4_init(struct cork_ipv4 *addr, const char *str);
 
+/* Parses the len bytes at str, which don't need to be NUL-terminated. */
+CORK_API int
+cork_ipv4_init_n(struct cork_ipv4 *addr, const char *str, size_t len);
+
 CORK_API bool
 cork_ipv4_equal_(const struct cork_ipv4 *addr1, const struct cork_ipv4 *addr2);
 
 CORK_API void
 cork_ipv4_to_raw_string(const struct cork_ipv4 *addr, char *dest);
 
+/* Like cork_ipv4_to_raw_string, but returns the length of the string. */
+CORK_API size_t
+cork_ipv4_format(const struct cork_ipv4 *addr, char *dest);
+
 CORK_API bool
 cork_ipv4_is_valid_network(const struct cork_ipv4 *addr,
                            unsigned int cidr_prefix);
@@ -91,12 +100,20 @@ cork_ipv4_is_valid_network(const struct cork_ipv4 *addr,
 CORK_API int
 cork_ipv6_init(struct cork_ipv6 *addr, const char *str);
 
+/* Parses the len bytes at str, which don't need to be NUL-terminated. */
+CORK_API int
+cork_ipv6_init_n(struct cork_ipv6 *addr, const char *str, size_t len);
+
 CORK_API bool
 cork_ipv6_equal_(const struct cork_ipv6 *addr1, const struct cork_ipv6 *addr2);
 
 CORK_API void
 cork_ipv6_to_raw_string(const struct cork_ipv6 *addr, char *dest);
 
+/* Like cork_ipv6_to_raw_string, but returns the length of the string. */
+CORK_API size_t
+cork_ipv6_format(const struct cork_ipv6 *addr, char *dest);
+
 CORK_API bool
 cork_ipv6_is_valid_network(const struct cork_ipv6 *addr,
                            unsigned int cidr_prefix);
@@ -134,14 +151,46 @@ cork_ip_from_ipv6_(struct cork_ip *addr, const void *src);
 CORK_API int
 cork_ip_init(struct cork_ip *addr, const char *str);
 
+/* Parses the len bytes at str, which don't need to be NUL-terminated. */
+CORK_API int
+cork_ip_init_n(struct cork_ip *addr, const char *str, size_t len);
+
+/* Parses count addresses, one from each slice.  Any slice that doesn't
+ * contain a valid address produces an address whose version is 0; if there
+ * are any, we return -1, with an error condition that describes the first
+ * one. */
+CORK_API int
+cork_ip_init_slices(struct cork_ip *addrs, const struct cork_slice *srcs,
+                    size_t count);
+
 CORK_API bool
 cork_ip_equal_(const struct cork_ip *addr1, const struct cork_ip *addr2);
 
 CORK_API void
 cork_ip_to_raw_string(const struct cork_ip *addr, char *dest);
 
+/* Like cork_ip_to_raw_string, but returns the length of the string. */
+CORK_API size_t
+cork_ip_format(const struct cork_ip *addr, char *dest);
+
 CORK_API bool
 cork_ip_is_valid_network(const struct cork_ip *addr, unsigned int cidr_prefix);
 
 
+/*-----------------------------------------------------------------------
+ * Appending addresses to buffers
+ */
+
+CORK_API void
+cork_buffer_append_ipv4(struct cork_buffer *buffer,
+                        const struct cork_ipv4 *addr);
+
+CORK_API void
+cork_buffer_append_ipv6(struct cork_buffer *buffer,
+                        const struct cork_ipv6 *addr);
+
+CORK_API void
+cork_buffer_append_ip(struct cork_buffer *buffer, const struct cork_ip *addr);
+
+
 #endif /* LIBCORK_CORE_NET_ADDRESSES_H */
@@ -12,7 +12,9 @@
 #define LIBCORK_CORE_TIMESTAMP_H
 
 
+#include <libcork/config.h>
 #include <libcork/core/api.h>
+#include <libcork/core/attributes.h>
 #include <libcork/core/error.h>
 #include <libcork/core/types.h>
 #include <libcork/ds/buffer.h>
@@ -54,6 +56,21 @@ typedef uint64_t  cork_timestamp;
 CORK_API void
 cork_timestamp_init_now(cork_timestamp *ts);
 
+/* Like cork_timestamp_init_now, but using a monotonic clock, which never jumps
+ * when the system time is changed.  Its starting point is unspecified
+ * (usually when the system booted), so it's only useful for measuring
+ * intervals.  The coarse variant is much cheaper, but only has the resolution
+ * of the kernel's timer tick, which is typically a few milliseconds. */
+CORK_API void
+cork_timestamp_init_monotonic(cork_timestamp *ts);
+
+CORK_API void
+cork_timestamp_init_monotonic_coarse(cork_timestamp *ts);
+
+/* The monotonic clock as a number of nanoseconds */
+CORK_API uint64_t
+cork_monotonic_nsec(void);
+
 
 #define cork_timestamp_sec(ts)  ((uint32_t) ((ts) >> 32))
 #define cork_timestamp_gsec(ts)  ((uint32_t) ((ts) & 0xffffffff))
@@ -75,6 +92,62 @@ cork_timestamp_gsec_to_units(const cork_timestamp ts, uint64_t denom)
 #define cork_timestamp_nsec(ts)  cork_timestamp_gsec_to_units(ts, 1000000000)
 
 
+/*-----------------------------------------------------------------------
+ * Cycle counters
+ */
+
+/* cork_cycles_now reads the CPU's cycle counter (the TSC on x86, the virtual
+ * counter on ARMv8), which only takes a few nanoseconds.  On other platforms
+ * it falls back on the monotonic clock, and counts nanoseconds.  Either way,
+ * use the difference between two readings to measure short intervals; we
+ * assume that the counter ticks at a constant rate and is synchronized
+ * across CPUs, which is true of the invariant TSC on any recent x86 CPU. */
+
+#if defined(__GNUC__) && (CORK_CONFIG_ARCH_X86 || CORK_CONFIG_ARCH_X64)
+#define CORK_HAVE_CYCLE_COUNTER  1
+
+CORK_ATTR_UNUSED
+static inline uint64_t
+cork_cycles_now(void)
+{
+    uint32_t  lo;
+    uint32_t  hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return (((uint64_t) hi) << 32) | lo;
+}
+
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define CORK_HAVE_CYCLE_COUNTER  1
+
+CORK_ATTR_UNUSED
+static inline uint64_t
+cork_cycles_now(void)
+{
+    uint64_t  value;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (value));
+    return value;
+}
+
+#else
+#define CORK_HAVE_CYCLE_COUNTER  0
+#define cork_cycles_now()  (cork_monotonic_nsec())
+
+#endif
+
+/* The rate at which cork_cycles_now ticks.  On x86, the first call measures
+ * the TSC against the monotonic clock, which takes about 10ms. */
+CORK_API uint64_t
+cork_cycles_per_sec(void);
+
+/* Convert a number of cycles (usually the difference between two calls to
+ * cork_cycles_now) into a cork_timestamp or a number of nanoseconds. */
+CORK_API void
+cork_timestamp_init_cycles(cork_timestamp *ts, uint64_t cycles);
+
+CORK_API uint64_t
+cork_cycles_to_nsec(uint64_t cycles);
+
+
 CORK_API int
 cork_timestamp_format_utc(const cork_timestamp ts, const char *format,
                           struct cork_buffer *dest);
@@ -83,5 +156,12 @@ CORK_API int
 cork_timestamp_format_local(const cork_timestamp ts, const char *format,
                             struct cork_buffer *dest);
 
+/* Appends an RFC 3339 UTC timestamp (2011-09-14T20:12:40.123Z), with
+ * frac_width (0-9) digits of fractional seconds. */
+CORK_API void
+cork_buffer_append_timestamp_utc(struct cork_buffer *dest,
+                                 const cork_timestamp ts,
+                                 unsigned int frac_width);
+
 
 #endif /* LIBCORK_CORE_TIMESTAMP_H */
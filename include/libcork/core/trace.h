@@ -0,0 +1,120 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_CORE_TRACE_H
+#define LIBCORK_CORE_TRACE_H
+
+#include <libcork/config.h>
+#include <libcork/core/attributes.h>
+#include <libcork/core/timestamp.h>
+#include <libcork/core/types.h>
+
+
+/*-----------------------------------------------------------------------
+ * Tracepoints
+ */
+
+/* Static tracepoints in libcork's slow paths, which show up as USDT probes
+ * with a provider of "libcork", so that you can attach perf or bpftrace to a
+ * running program.  Each tracepoint has a semaphore, which a tracer increments
+ * when it attaches; until then, a tracepoint is a single predictable branch,
+ * and we don't evaluate its arguments (which often need extra clock reads).
+ * Without <sys/sdt.h>, the tracepoints are compiled out completely.
+ *
+ * libcork/core.h doesn't include this header, since we have to ask
+ * <sys/sdt.h> for semaphores before anything else includes it.
+ *
+ * Declare each tracepoint once, at file scope, in the file that uses it:
+ *
+ *     cork_tracepoint(buffer_grow);
+ *
+ * and then time and fire it:
+ *
+ *     uint64_t  start = cork_trace_start(buffer_grow);
+ *     ...
+ *     cork_trace3(buffer_grow, buffer, new_size,
+ *                 cork_trace_elapsed(start));
+ */
+
+#if defined(CORK_HAVE_USDT) && CORK_HAVE_USDT
+
+#define _SDT_HAS_SEMAPHORES  1
+#include <sys/sdt.h>
+
+#define cork_tracepoint(name) \
+    CORK_ATTR_UNUSED \
+    static volatile unsigned short  libcork_##name##_semaphore \
+        __attribute__((section(".probes")))
+
+#define cork_trace_enabled(name) \
+    CORK_UNLIKELY(libcork_##name##_semaphore != 0)
+
+#define cork_trace1(name, a1) \
+    do { \
+        if (cork_trace_enabled(name)) { \
+            DTRACE_PROBE1(libcork, name, a1); \
+        } \
+    } while (0)
+
+#define cork_trace2(name, a1, a2) \
+    do { \
+        if (cork_trace_enabled(name)) { \
+            DTRACE_PROBE2(libcork, name, a1, a2); \
+        } \
+    } while (0)
+
+#define cork_trace3(name, a1, a2, a3) \
+    do { \
+        if (cork_trace_enabled(name)) { \
+            DTRACE_PROBE3(libcork, name, a1, a2, a3); \
+        } \
+    } while (0)
+
+#define cork_trace4(name, a1, a2, a3, a4) \
+    do { \
+        if (cork_trace_enabled(name)) { \
+            DTRACE_PROBE4(libcork, name, a1, a2, a3, a4); \
+        } \
+    } while (0)
+
+#else /* !CORK_HAVE_USDT */
+
+/* An unused declaration, so that the trailing semicolon is still valid */
+#define cork_tracepoint(name) \
+    extern int  libcork_##name##_tracepoint
+
+#define cork_trace_enabled(name)  0
+
+/* We still refer to the arguments, so that variables that are only used for
+ * tracing don't cause unused variable warnings. */
+#define cork_trace1(name, a1) \
+    do { if (0) { (void) (a1); } } while (0)
+#define cork_trace2(name, a1, a2) \
+    do { if (0) { (void) (a1); (void) (a2); } } while (0)
+#define cork_trace3(name, a1, a2, a3) \
+    do { if (0) { (void) (a1); (void) (a2); (void) (a3); } } while (0)
+#define cork_trace4(name, a1, a2, a3, a4) \
+    do { \
+        if (0) { (void) (a1); (void) (a2); (void) (a3); (void) (a4); } \
+    } while (0)
+
+#endif /* CORK_HAVE_USDT */
+
+/* The start time for a tracepoint's duration argument.  We only read the clock
+ * if a tracer is attached; otherwise this is 0. */
+#define cork_trace_start(name) \
+    (cork_trace_enabled(name)? cork_monotonic_nsec(): (uint64_t) 0)
+
+/* The number of nanoseconds since a cork_trace_start.  This is 0 if the tracer
+ * attached after we called cork_trace_start. */
+#define cork_trace_elapsed(start) \
+    ((start) == 0? (uint64_t) 0: cork_monotonic_nsec() - (start))
+
+
+#endif /* LIBCORK_CORE_TRACE_H */
@@ -15,12 +15,28 @@
 
 #include <libcork/ds/array.h>
 #include <libcork/ds/bitset.h>
+#include <libcork/ds/btree.h>
 #include <libcork/ds/buffer.h>
+#include <libcork/ds/cache.h>
+#include <libcork/ds/chunked-buffer.h>
+#include <libcork/ds/compressed-stream.h>
+#include <libcork/ds/concurrent-hash-table.h>
+#include <libcork/ds/concurrent-list.h>
 #include <libcork/ds/dllist.h>
+#include <libcork/ds/frozen-hash-table.h>
+#include <libcork/ds/hash-map.h>
 #include <libcork/ds/hash-table.h>
+#include <libcork/ds/ip-set.h>
+#include <libcork/ds/lpm-table.h>
 #include <libcork/ds/managed-buffer.h>
 #include <libcork/ds/ring-buffer.h>
+#include <libcork/ds/roaring-bitmap.h>
+#include <libcork/ds/sharded-hash-table.h>
+#include <libcork/ds/sketch.h>
 #include <libcork/ds/slice.h>
+#include <libcork/ds/sort.h>
 #include <libcork/ds/stream.h>
+#include <libcork/ds/string-pool.h>
+#include <libcork/ds/timer-wheel.h>
 
 #endif /* LIBCORK_DS_H */
@@ -74,12 +74,57 @@ cork_raw_array_ensure_size(struct cork_raw_array *array, size_t count);
 CORK_API void *
 cork_raw_array_append(struct cork_raw_array *array);
 
+/* Append count elements, and return a pointer to the first of them.  If src
+ * isn't NULL, we copy the new elements' contents from it with a single
+ * memcpy. */
+CORK_API void *
+cork_raw_array_append_n(struct cork_raw_array *array, const void *src,
+                        size_t count);
+
+/* Insert a new element at index, shifting later elements up by one, and
+ * return a pointer to it. */
+CORK_API void *
+cork_raw_array_insert_at(struct cork_raw_array *array, size_t index);
+
+/* Remove the element at index, shifting later elements down by one. */
+CORK_API void
+cork_raw_array_remove_at(struct cork_raw_array *array, size_t index);
+
+/* Remove the element at index, replacing it with the last element.  This
+ * doesn't preserve the order of the elements, but doesn't have to shift
+ * them, either. */
+CORK_API void
+cork_raw_array_swap_remove(struct cork_raw_array *array, size_t index);
+
 CORK_API int
 cork_raw_array_copy(struct cork_raw_array *dest,
                     const struct cork_raw_array *src,
                     cork_copy_f copy, void *user_data);
 
 
+/*-----------------------------------------------------------------------
+ * Small arrays
+ */
+
+/* A small array starts out with room for a fixed number of elements in the
+ * struct itself, and only allocates heap storage (and its priv block) once it
+ * outgrows that, or once you give it callbacks.  The inline storage
+ * immediately follows these fields.  You can pass a small array to any of the
+ * cork_raw_array functions.  Since items can point into the struct, you can't
+ * move a small array to a different address once it's initialized. */
+struct cork_raw_small_array {
+    void  *items;
+    size_t  size;
+    struct cork_array_priv  *priv;
+    unsigned int  element_size;
+    unsigned int  inline_count;
+};
+
+CORK_API void
+cork_raw_small_array_init(struct cork_raw_array *array, size_t element_size,
+                          size_t inline_count, void *inline_items);
+
+
 /*-----------------------------------------------------------------------
  * Type-checked resizable arrays
  */
@@ -130,6 +175,43 @@ cork_raw_array_copy(struct cork_raw_array *dest,
     (cork_raw_array_append(cork_array_to_raw(arr)), \
      &(arr)->items[(arr)->size - 1])
 
+#define cork_array_append_n(arr, src, count) \
+    (cork_raw_array_append_n(cork_array_to_raw(arr), (src), (count)), \
+     (void) 0)
+
+#define cork_array_insert_at(arr, index, element) \
+    (cork_raw_array_insert_at(cork_array_to_raw(arr), (index)), \
+     ((arr)->items[(index)] = (element), (void) 0))
+
+#define cork_array_insert_at_get(arr, index) \
+    (cork_raw_array_insert_at(cork_array_to_raw(arr), (index)), \
+     &(arr)->items[(index)])
+
+#define cork_array_remove_at(arr, index) \
+    (cork_raw_array_remove_at(cork_array_to_raw(arr), (index)))
+#define cork_array_swap_remove(arr, index) \
+    (cork_raw_array_swap_remove(cork_array_to_raw(arr), (index)))
+
+/* A small array of T with room for N inline elements.  All of the other
+ * cork_array macros work with small arrays, too. */
+#define cork_small_array(T, N) \
+    struct { \
+        T  *items; \
+        size_t  size; \
+        struct cork_array_priv  *priv; \
+        unsigned int  element_size; \
+        unsigned int  inline_count; \
+        T  inline_items[N]; \
+    }
+
+#define cork_small_array_inline_count(arr) \
+    (sizeof((arr)->inline_items) / cork_array_element_size(arr))
+
+#define cork_small_array_init(arr) \
+    (cork_raw_small_array_init \
+     (cork_array_to_raw(arr), cork_array_element_size(arr), \
+      cork_small_array_inline_count(arr), (arr)->inline_items))
+
 
 /*-----------------------------------------------------------------------
  * Builtin array types
@@ -19,12 +19,17 @@
  * Bit sets
  */
 
+/* The bits are stored in a byte array, but we always allocate a whole number of
+ * 64-bit words, so that the bulk operations below can work a word (or a SIMD
+ * vector) at a time.  Any bits past bit_count are always 0. */
 struct cork_bitset {
     uint8_t  *bits;
     size_t  bit_count;
     size_t  byte_count;
 };
 
+#define CORK_BITSET_WORD_BITS  64
+
 CORK_API struct cork_bitset *
 cork_bitset_new(size_t bit_count);
 
@@ -67,4 +72,44 @@ cork_bitset_clear(struct cork_bitset *set);
      | ((val)? cork_bitset_pos_mask_for_bit(i): 0))
 
 
+
+/*-----------------------------------------------------------------------
+ * Bulk operations
+ */
+
+/* Set (or unset) every bit from start (inclusive) to end (exclusive). */
+CORK_API void
+cork_bitset_set_range(struct cork_bitset *set, size_t start, size_t end,
+                      bool value);
+
+/* Return the number of bits that are set. */
+CORK_API size_t
+cork_bitset_count(const struct cork_bitset *set);
+
+/* Return the index of the first set bit at or after start, or set->bit_count if
+ * there aren't any. */
+CORK_API size_t
+cork_bitset_find_next(const struct cork_bitset *set, size_t start);
+
+#define cork_bitset_find_first(set)  (cork_bitset_find_next((set), 0))
+
+#define cork_bitset_foreach(set, i) \
+    for ((i) = cork_bitset_find_first(set); (i) < (set)->bit_count; \
+         (i) = cork_bitset_find_next((set), (i) + 1))
+
+/* Update dest in place.  Both sets must have the same bit_count.  andnot
+ * removes every bit in src from dest. */
+CORK_API void
+cork_bitset_and(struct cork_bitset *dest, const struct cork_bitset *src);
+
+CORK_API void
+cork_bitset_or(struct cork_bitset *dest, const struct cork_bitset *src);
+
+CORK_API void
+cork_bitset_xor(struct cork_bitset *dest, const struct cork_bitset *src);
+
+CORK_API void
+cork_bitset_andnot(struct cork_bitset *dest, const struct cork_bitset *src);
+
+
 #endif /* LIBCORK_DS_BITS_H */
@@ -0,0 +1,499 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_BTREE_H
+#define LIBCORK_DS_BTREE_H
+
+#include <string.h>
+
+#include <libcork/core/api.h>
+#include <libcork/core/attributes.h>
+#include <libcork/core/error.h>
+#include <libcork/core/mempool.h>
+#include <libcork/core/timestamp.h>
+#include <libcork/core/types.h>
+#include <libcork/core/u128.h>
+
+
+/*-----------------------------------------------------------------------
+ * Error handling
+ */
+
+/* The entries passed to a bulk load aren't sorted */
+#define CORK_BTREE_UNSORTED  0x2a6c1f4e
+
+
+/*-----------------------------------------------------------------------
+ * Raw B+trees
+ */
+
+/* The untyped part of a B+tree, which knows the size of each key and value
+ * but never compares them.  The type-specialized functions generated by
+ * CORK_BTREE_DEFINE find an entry's position, recording the path from the
+ * root down to it, and the raw functions use that path to add or remove the
+ * entry, splitting, merging, or rebalancing nodes as needed.
+ *
+ * Every node is CORK_RAW_BTREE_NODE_SIZE bytes (or larger, if that wouldn't
+ * leave room for at least 8 entries), and comes from a memory pool.  Leaves
+ * are linked together in key order, so range scans never have to go back up
+ * the tree. */
+
+#define CORK_RAW_BTREE_NODE_SIZE  512
+#define CORK_RAW_BTREE_MAX_HEIGHT  32
+
+struct cork_raw_btree_node {
+    struct cork_raw_btree_node  *prev;
+    struct cork_raw_btree_node  *next;
+    uint32_t  count;
+    uint32_t  is_leaf;
+};
+
+/* The keys of every node start right after its header.  A leaf's values, or
+ * an internal node's children, follow its keys. */
+#define CORK_RAW_BTREE_HEADER_SIZE  (sizeof(struct cork_raw_btree_node))
+
+struct cork_raw_btree {
+    struct cork_raw_btree_node  *root;
+    struct cork_raw_btree_node  *first;
+    struct cork_raw_btree_node  *last;
+    size_t  size;
+    unsigned int  height;
+    size_t  key_size;
+    size_t  value_size;
+    size_t  leaf_capacity;
+    size_t  internal_capacity;
+    size_t  values_offset;
+    size_t  children_offset;
+    struct cork_mempool  *nodes;
+};
+
+/* The nodes from the root down to an entry (or to where an entry belongs),
+ * and the index of the child (or, in the leaf, the entry) at each level. */
+struct cork_raw_btree_path {
+    unsigned int  height;
+    struct cork_raw_btree_node  *nodes[CORK_RAW_BTREE_MAX_HEIGHT];
+    size_t  indexes[CORK_RAW_BTREE_MAX_HEIGHT];
+};
+
+#define cork_raw_btree_key(tree, node, i) \
+    ((char *) (node) + CORK_RAW_BTREE_HEADER_SIZE + (i) * (tree)->key_size)
+
+#define cork_raw_btree_value(tree, node, i) \
+    ((char *) (node) + (tree)->values_offset + (i) * (tree)->value_size)
+
+#define cork_raw_btree_child(tree, node, i) \
+    (((struct cork_raw_btree_node **) \
+      (void *) ((char *) (node) + (tree)->children_offset))[(i)])
+
+CORK_API void
+cork_raw_btree_init(struct cork_raw_btree *tree, size_t key_size,
+                    size_t value_size);
+
+CORK_API void
+cork_raw_btree_done(struct cork_raw_btree *tree);
+
+CORK_API void
+cork_raw_btree_clear(struct cork_raw_btree *tree);
+
+/* Adds a new entry with the given key at the position described by path, and
+ * returns a pointer to its (uninitialized) value.  path is invalid
+ * afterwards. */
+CORK_API void *
+cork_raw_btree_insert(struct cork_raw_btree *tree,
+                      struct cork_raw_btree_path *path, const void *key);
+
+/* Removes the entry at the position described by path, which must exist.
+ * path is invalid afterwards. */
+CORK_API void
+cork_raw_btree_remove(struct cork_raw_btree *tree,
+                      struct cork_raw_btree_path *path);
+
+/* Replaces the contents of the tree with count entries, which must already be
+ * sorted by key.  Each entry is entry_size bytes, with its key and value at
+ * the given offsets.  The leaves are packed full, which makes this a good way
+ * to build a tree that's mostly read from. */
+CORK_API void
+cork_raw_btree_bulk_load(struct cork_raw_btree *tree, const void *entries,
+                         size_t count, size_t entry_size, size_t key_offset,
+                         size_t value_offset);
+
+
+/*-----------------------------------------------------------------------
+ * Iterators
+ */
+
+/* An iterator is a cursor that sits between two entries of a tree.  _next
+ * returns the entry after the cursor and moves past it; _prev returns the
+ * entry before the cursor and moves back over it.  Adding or removing any
+ * entry invalidates every iterator. */
+struct cork_btree_iterator {
+    struct cork_raw_btree_node  *leaf;
+    size_t  index;
+};
+
+
+/*-----------------------------------------------------------------------
+ * Type-specialized B+trees
+ */
+
+/* An ordered map whose key and value types, and comparison function, are
+ * fixed at compile time.  Keys and values are stored directly in the tree's
+ * nodes, and the comparison function is inlined into every search.
+ * CORK_BTREE_DEFINE generates a struct and a family of static functions for a
+ * particular tree type:
+ *
+ *   CORK_BTREE_DEFINE(flow_index, cork_timestamp, struct flow *,
+ *                     cork_btree_timestamp_lt)
+ *
+ *   struct flow_index  index;
+ *   struct cork_btree_iterator  iter;
+ *   cork_timestamp  ts;
+ *   struct flow  **flow;
+ *   flow_index_init(&index);
+ *   flow_index_put(&index, ts, flow);
+ *   flow_index_lower_bound(&index, start, &iter);
+ *   while (flow_index_next(&index, &iter, &ts, &flow) && ts < end) {
+ *       ...
+ *   }
+ *   flow_index_done(&index);
+ *
+ * lt is called as lt(key1, key2), receives keys by value, and must return
+ * whether key1 sorts before key2; it can be a function or a macro.  Pointers
+ * to values are only valid until the next time you add or remove an entry,
+ * and are only guaranteed to be 8-byte aligned. */
+
+#define cork_btree_to_raw(tree) \
+    ((struct cork_raw_btree *) (void *) (tree))
+
+#define CORK_BTREE_DEFINE(name, K, V, lt) \
+struct name##_entry { \
+    K  key; \
+    V  value; \
+}; \
+\
+struct name { \
+    struct cork_raw_btree  raw; \
+}; \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+name##_init(struct name *tree) \
+{ \
+    cork_raw_btree_init(&tree->raw, sizeof(K), sizeof(V)); \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+name##_done(struct name *tree) \
+{ \
+    cork_raw_btree_done(&tree->raw); \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+name##_clear(struct name *tree) \
+{ \
+    cork_raw_btree_clear(&tree->raw); \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline size_t \
+name##_size(const struct name *tree) \
+{ \
+    return tree->raw.size; \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline K \
+name##_key_at(const struct name *tree, \
+              const struct cork_raw_btree_node *node, size_t i) \
+{ \
+    K  key; \
+    memcpy(&key, cork_raw_btree_key(&tree->raw, node, i), sizeof(K)); \
+    return key; \
+} \
+\
+/* Returns the number of keys in node that sort before key (if upper is \
+ * false) or that don't sort after it (if upper is true). */ \
+CORK_ATTR_UNUSED \
+static inline size_t \
+name##_search(const struct name *tree, \
+              const struct cork_raw_btree_node *node, K key, bool upper) \
+{ \
+    size_t  lo = 0; \
+    size_t  hi = node->count; \
+    while (lo < hi) { \
+        size_t  mid = lo + (hi - lo) / 2; \
+        K  mid_key = name##_key_at(tree, node, mid); \
+        if (upper? !lt(key, mid_key): lt(mid_key, key)) { \
+            lo = mid + 1; \
+        } else { \
+            hi = mid; \
+        } \
+    } \
+    return lo; \
+} \
+\
+/* Fills in the path to the first entry whose key doesn't sort before key, \
+ * and returns whether that entry's key is equal to key. */ \
+CORK_ATTR_UNUSED \
+static inline bool \
+name##_find_path(const struct name *tree, K key, \
+                 struct cork_raw_btree_path *path) \
+{ \
+    struct cork_raw_btree_node  *node = tree->raw.root; \
+    unsigned int  level; \
+    size_t  index; \
+    path->height = tree->raw.height; \
+    if (CORK_UNLIKELY(node == NULL)) { \
+        return false; \
+    } \
+    for (level = 0; level + 1 < tree->raw.height; level++) { \
+        index = name##_search(tree, node, key, true); \
+        path->nodes[level] = node; \
+        path->indexes[level] = index; \
+        node = cork_raw_btree_child(&tree->raw, node, index); \
+    } \
+    index = name##_search(tree, node, key, false); \
+    path->nodes[level] = node; \
+    path->indexes[level] = index; \
+    return index < node->count && \
+        !lt(key, name##_key_at(tree, node, index)); \
+} \
+\
+/* Points iter at the first entry whose key doesn't sort before key (if upper \
+ * is false), or that sorts after key (if upper is true). */ \
+CORK_ATTR_UNUSED \
+static inline void \
+name##_seek(const struct name *tree, K key, bool upper, \
+            struct cork_btree_iterator *iter) \
+{ \
+    struct cork_raw_btree_node  *node = tree->raw.root; \
+    unsigned int  level; \
+    if (CORK_UNLIKELY(node == NULL)) { \
+        iter->leaf = NULL; \
+        iter->index = 0; \
+        return; \
+    } \
+    for (level = 0; level + 1 < tree->raw.height; level++) { \
+        node = cork_raw_btree_child \
+            (&tree->raw, node, name##_search(tree, node, key, true)); \
+    } \
+    iter->leaf = node; \
+    iter->index = name##_search(tree, node, key, upper); \
+} \
+\
+/* Returns a pointer to key's value, or NULL if it isn't in the tree. */ \
+CORK_ATTR_UNUSED \
+static inline V * \
+name##_get(const struct name *tree, K key) \
+{ \
+    struct cork_btree_iterator  iter; \
+    name##_seek(tree, key, false, &iter); \
+    if (iter.leaf != NULL && iter.index < iter.leaf->count && \
+        !lt(key, name##_key_at(tree, iter.leaf, iter.index))) { \
+        return (V *) (void *) \
+            cork_raw_btree_value(&tree->raw, iter.leaf, iter.index); \
+    } \
+    return NULL; \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline bool \
+name##_contains(const struct name *tree, K key) \
+{ \
+    return name##_get(tree, key) != NULL; \
+} \
+\
+/* Returns a pointer to key's value, adding a new entry if needed.  A new \
+ * entry's value is uninitialized; *is_new tells you whether you need to fill \
+ * it in. */ \
+CORK_ATTR_UNUSED \
+static inline V * \
+name##_get_or_create(struct name *tree, K key, bool *is_new) \
+{ \
+    struct cork_raw_btree_path  path; \
+    if (name##_find_path(tree, key, &path)) { \
+        struct cork_raw_btree_node  *leaf = path.nodes[path.height - 1]; \
+        *is_new = false; \
+        return (V *) (void *) cork_raw_btree_value \
+            (&tree->raw, leaf, path.indexes[path.height - 1]); \
+    } \
+    *is_new = true; \
+    return (V *) cork_raw_btree_insert(&tree->raw, &path, &key); \
+} \
+\
+/* Adds or replaces key's entry. */ \
+CORK_ATTR_UNUSED \
+static inline void \
+name##_put(struct name *tree, K key, V value) \
+{ \
+    bool  is_new; \
+    V  *slot = name##_get_or_create(tree, key, &is_new); \
+    memcpy(slot, &value, sizeof(V)); \
+} \
+\
+/* Removes key's entry, returning whether there was one.  If value isn't \
+ * NULL, the removed value is copied into it. */ \
+CORK_ATTR_UNUSED \
+static inline bool \
+name##_delete(struct name *tree, K key, V *value) \
+{ \
+    struct cork_raw_btree_path  path; \
+    if (!name##_find_path(tree, key, &path)) { \
+        return false; \
+    } \
+    if (value != NULL) { \
+        struct cork_raw_btree_node  *leaf = path.nodes[path.height - 1]; \
+        memcpy(value, cork_raw_btree_value \
+               (&tree->raw, leaf, path.indexes[path.height - 1]), \
+               sizeof(V)); \
+    } \
+    cork_raw_btree_remove(&tree->raw, &path); \
+    return true; \
+} \
+\
+/* Replaces the contents of the tree with count entries, which must be sorted \
+ * by key, with no duplicates.  (For a cork_array of entries, pass in \
+ * cork_array_elements and cork_array_size.)  Returns an error, leaving the \
+ * tree unchanged, if they aren't. */ \
+CORK_ATTR_UNUSED \
+static int \
+name##_bulk_load(struct name *tree, const struct name##_entry *entries, \
+                 size_t count) \
+{ \
+    size_t  i; \
+    for (i = 1; i < count; i++) { \
+        if (CORK_UNLIKELY(!lt(entries[i - 1].key, entries[i].key))) { \
+            cork_error_set_printf \
+                (CORK_BTREE_UNSORTED, \
+                 "B+tree entries must be sorted, with no duplicates"); \
+            return -1; \
+        } \
+    } \
+    cork_raw_btree_bulk_load \
+        (&tree->raw, entries, count, sizeof(struct name##_entry), \
+         offsetof(struct name##_entry, key), \
+         offsetof(struct name##_entry, value)); \
+    return 0; \
+} \
+\
+/* Point iter before the first entry, or after the last one. */ \
+CORK_ATTR_UNUSED \
+static inline void \
+name##_first(const struct name *tree, struct cork_btree_iterator *iter) \
+{ \
+    iter->leaf = tree->raw.first; \
+    iter->index = 0; \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+name##_last(const struct name *tree, struct cork_btree_iterator *iter) \
+{ \
+    iter->leaf = tree->raw.last; \
+    iter->index = (iter->leaf == NULL)? 0: iter->leaf->count; \
+} \
+\
+/* Point iter before the first entry whose key doesn't sort before key \
+ * (lower_bound), or that sorts after key (upper_bound). */ \
+CORK_ATTR_UNUSED \
+static inline void \
+name##_lower_bound(const struct name *tree, K key, \
+                   struct cork_btree_iterator *iter) \
+{ \
+    name##_seek(tree, key, false, iter); \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+name##_upper_bound(const struct name *tree, K key, \
+                   struct cork_btree_iterator *iter) \
+{ \
+    name##_seek(tree, key, true, iter); \
+} \
+\
+/* Return the entry after (next) or before (prev) iter, and move iter past \
+ * it.  Either of key and value can be NULL.  Return false, without moving \
+ * iter, if there are no more entries in that direction. */ \
+CORK_ATTR_UNUSED \
+static inline bool \
+name##_next(const struct name *tree, struct cork_btree_iterator *iter, \
+            K *key, V **value) \
+{ \
+    if (iter->leaf == NULL) { \
+        return false; \
+    } \
+    if (iter->index == iter->leaf->count) { \
+        if (iter->leaf->next == NULL) { \
+            return false; \
+        } \
+        iter->leaf = iter->leaf->next; \
+        iter->index = 0; \
+    } \
+    if (key != NULL) { \
+        *key = name##_key_at(tree, iter->leaf, iter->index); \
+    } \
+    if (value != NULL) { \
+        *value = (V *) (void *) \
+            cork_raw_btree_value(&tree->raw, iter->leaf, iter->index); \
+    } \
+    iter->index++; \
+    return true; \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline bool \
+name##_prev(const struct name *tree, struct cork_btree_iterator *iter, \
+            K *key, V **value) \
+{ \
+    if (iter->leaf == NULL) { \
+        return false; \
+    } \
+    if (iter->index == 0) { \
+        if (iter->leaf->prev == NULL) { \
+            return false; \
+        } \
+        iter->leaf = iter->leaf->prev; \
+        iter->index = iter->leaf->count; \
+    } \
+    iter->index--; \
+    if (key != NULL) { \
+        *key = name##_key_at(tree, iter->leaf, iter->index); \
+    } \
+    if (value != NULL) { \
+        *value = (V *) (void *) \
+            cork_raw_btree_value(&tree->raw, iter->leaf, iter->index); \
+    } \
+    return true; \
+} \
+/* Swallow the trailing semicolon */ \
+struct name##_entry
+
+
+/*-----------------------------------------------------------------------
+ * Built-in key types
+ */
+
+/* Comparison functions for some common key types, which take their keys by
+ * value, for use with CORK_BTREE_DEFINE. */
+
+#define cork_btree_uint32_lt(k1, k2)  ((k1) < (k2))
+#define cork_btree_uint64_lt(k1, k2)  ((k1) < (k2))
+#define cork_btree_u128_lt(k1, k2)  (cork_u128_lt((k1), (k2)))
+#define cork_btree_timestamp_lt(k1, k2)  ((k1) < (k2))
+
+/* Ready-made trees for those key types, whose values are pointers. */
+CORK_BTREE_DEFINE(cork_uint64_btree, uint64_t, void *, cork_btree_uint64_lt);
+CORK_BTREE_DEFINE(cork_u128_btree, cork_u128, void *, cork_btree_u128_lt);
+CORK_BTREE_DEFINE(cork_timestamp_btree, cork_timestamp, void *,
+                  cork_btree_timestamp_lt);
+
+
+#endif /* LIBCORK_DS_BTREE_H */
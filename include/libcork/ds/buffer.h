@@ -52,6 +52,21 @@ cork_buffer_equal(const struct cork_buffer *buffer1,
 CORK_API void
 cork_buffer_ensure_size(struct cork_buffer *buffer, size_t desired_size);
 
+/* Return a pointer to at least length bytes of writable space at the end of
+ * the buffer's current contents.  Once you've written into that space, call
+ * cork_buffer_commit to add the bytes that you wrote to the buffer.  The
+ * pointer is invalidated by any other call that modifies the buffer. */
+CORK_API void *
+cork_buffer_reserve(struct cork_buffer *buffer, size_t length);
+
+CORK_API void
+cork_buffer_commit(struct cork_buffer *buffer, size_t written);
+
+/* Read from fd until EOF, appending everything that we read directly onto
+ * the end of the buffer. */
+CORK_API int
+cork_buffer_append_fd(struct cork_buffer *buffer, int fd);
+
 
 CORK_API void
 cork_buffer_clear(struct cork_buffer *buffer);
@@ -59,6 +74,20 @@ cork_buffer_clear(struct cork_buffer *buffer);
 CORK_API void
 cork_buffer_truncate(struct cork_buffer *buffer, size_t length);
 
+
+/* Take ownership of buf, which must have been allocated with cork_malloc (or
+ * one of its variants), and must be larger than size so that the contents
+ * can be NUL-terminated. */
+CORK_API void
+cork_buffer_adopt(struct cork_buffer *buffer, void *buf, size_t size,
+                  size_t allocated_size);
+
+/* Give up ownership of the buffer's contents, leaving the buffer empty.  You
+ * must free the result with cork_free, passing in allocated_size. */
+CORK_API void *
+cork_buffer_steal(struct cork_buffer *buffer, size_t *size,
+                  size_t *allocated_size);
+
 #define cork_buffer_byte(buffer, i)  (((const uint8_t *) (buffer)->buf)[(i)])
 #define cork_buffer_char(buffer, i)  (((const char *) (buffer)->buf)[(i)])
 
@@ -112,6 +141,69 @@ cork_buffer_append_vprintf(struct cork_buffer *buffer, const char *format,
     CORK_ATTR_PRINTF(2,0);
 
 
+/*-----------------------------------------------------------------------
+ * Formatting values without a format string
+ */
+
+CORK_API void
+cork_buffer_append_u64(struct cork_buffer *buffer, uint64_t value);
+
+/* Pads the result with leading zeroes to at least width digits. */
+CORK_API void
+cork_buffer_append_u64_width(struct cork_buffer *buffer, uint64_t value,
+                             unsigned int width);
+
+CORK_API void
+cork_buffer_append_i64(struct cork_buffer *buffer, int64_t value);
+
+/* Lowercase hex digits, with no "0x" prefix, padded with leading zeroes to at
+ * least width digits. */
+CORK_API void
+cork_buffer_append_hex(struct cork_buffer *buffer, uint64_t value,
+                       unsigned int width);
+
+/* A decimal representation that reads back in as exactly the same value.
+ * It's the shortest such representation for all but a tiny fraction of
+ * values. */
+CORK_API void
+cork_buffer_append_double(struct cork_buffer *buffer, double value);
+
+
+/*-----------------------------------------------------------------------
+ * Binary values
+ */
+
+/* Append a fixed-width integer in big- or little-endian order.  These are the
+ * encoders that match cork_slice_reader's decoders. */
+
+CORK_API void
+cork_buffer_append_be16(struct cork_buffer *buffer, uint16_t value);
+
+CORK_API void
+cork_buffer_append_be32(struct cork_buffer *buffer, uint32_t value);
+
+CORK_API void
+cork_buffer_append_be64(struct cork_buffer *buffer, uint64_t value);
+
+CORK_API void
+cork_buffer_append_le16(struct cork_buffer *buffer, uint16_t value);
+
+CORK_API void
+cork_buffer_append_le32(struct cork_buffer *buffer, uint32_t value);
+
+CORK_API void
+cork_buffer_append_le64(struct cork_buffer *buffer, uint64_t value);
+
+/* An unsigned LEB128 varint, which takes between 1 and 10 bytes. */
+CORK_API void
+cork_buffer_append_varint(struct cork_buffer *buffer, uint64_t value);
+
+/* Append length, as a varint, followed by length bytes from src. */
+CORK_API void
+cork_buffer_append_prefixed_varint(struct cork_buffer *buffer,
+                                   const void *src, size_t length);
+
+
 /*-----------------------------------------------------------------------
  * Some helpers for pretty-printing data
  */
@@ -149,6 +241,17 @@ cork_buffer_to_managed_buffer(struct cork_buffer *buffer);
 CORK_API int
 cork_buffer_to_slice(struct cork_buffer *buffer, struct cork_slice *slice);
 
+/* These take over src (which is freed or finished for you), and replace the
+ * contents of dest with its contents.  They return whether we could reuse
+ * src's memory without copying it. */
+
+CORK_API bool
+cork_buffer_from_managed_buffer(struct cork_buffer *dest,
+                                struct cork_managed_buffer *src);
+
+CORK_API bool
+cork_buffer_from_slice(struct cork_buffer *dest, struct cork_slice *src);
+
 
 /*-----------------------------------------------------------------------
  * Buffer's stream consumer implementation
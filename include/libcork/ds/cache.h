@@ -0,0 +1,224 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_CACHE_H
+#define LIBCORK_DS_CACHE_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/callbacks.h>
+#include <libcork/core/hash.h>
+#include <libcork/core/timestamp.h>
+#include <libcork/core/types.h>
+
+
+/*-----------------------------------------------------------------------
+ * Bounded caches
+ */
+
+/* A map that holds at most a fixed number of entries.  When it's full, adding
+ * a new entry evicts an old one, chosen using the CLOCK algorithm: each entry
+ * has a "referenced" bit that's set whenever it's looked up, and a clock hand
+ * sweeps through the entries, clearing those bits, until it finds an entry
+ * that hasn't been used since the hand last passed it.  Unlike an LRU list,
+ * a cache hit never has to move anything around.
+ *
+ * Entries can also have a time-to-live, after which they're treated as
+ * missing.  All of the memory for the entries is allocated up front. */
+
+struct cork_cache;
+
+enum cork_cache_evict_reason {
+    /* Evicted to make room for a new entry */
+    CORK_CACHE_EVICTED,
+    /* Its time-to-live ran out */
+    CORK_CACHE_EXPIRED,
+    /* Overwritten by cork_cache_put */
+    CORK_CACHE_REPLACED,
+    /* Removed by cork_cache_delete, cork_cache_clear, or cork_cache_free */
+    CORK_CACHE_DELETED
+};
+
+/* Called whenever the cache gives up an entry's key and value. */
+typedef void
+(*cork_cache_evict_f)(void *user_data, void *key, void *value,
+                      enum cork_cache_evict_reason reason);
+
+/* Fills in the current time; used to check time-to-live values.  The default
+ * uses cork_timestamp_init_monotonic_coarse. */
+typedef void
+(*cork_cache_clock_f)(void *user_data, cork_timestamp *now);
+
+struct cork_cache_stats {
+    uint64_t  hits;
+    uint64_t  misses;
+    uint64_t  evictions;
+    uint64_t  expirations;
+};
+
+
+CORK_API struct cork_cache *
+cork_cache_new(size_t capacity);
+
+CORK_API void
+cork_cache_free(struct cork_cache *cache);
+
+CORK_API void
+cork_cache_set_user_data(struct cork_cache *cache,
+                         void *user_data, cork_free_f free_user_data);
+
+CORK_API void
+cork_cache_set_equals(struct cork_cache *cache, cork_equals_f equals);
+
+CORK_API void
+cork_cache_set_hash(struct cork_cache *cache, cork_hash_f hash);
+
+CORK_API void
+cork_cache_set_hash64(struct cork_cache *cache, cork_hash64_f hash);
+
+CORK_API void
+cork_cache_set_evict(struct cork_cache *cache, cork_cache_evict_f evict);
+
+CORK_API void
+cork_cache_set_clock(struct cork_cache *cache, cork_cache_clock_f clock);
+
+
+CORK_API size_t
+cork_cache_size(const struct cork_cache *cache);
+
+CORK_API size_t
+cork_cache_capacity(const struct cork_cache *cache);
+
+/* Returns NULL if the key isn't in the cache, or if it has expired. */
+CORK_API void *
+cork_cache_get(struct cork_cache *cache, const void *key);
+
+CORK_API void *
+cork_cache_get_hash64(struct cork_cache *cache, cork_hash64 hash,
+                      const void *key);
+
+/* A ttl of 0 means that the entry never expires. */
+CORK_API void
+cork_cache_put(struct cork_cache *cache, void *key, void *value,
+               cork_timestamp ttl);
+
+CORK_API void
+cork_cache_put_hash64(struct cork_cache *cache, cork_hash64 hash,
+                      void *key, void *value, cork_timestamp ttl);
+
+CORK_API bool
+cork_cache_delete(struct cork_cache *cache, const void *key);
+
+CORK_API bool
+cork_cache_delete_hash64(struct cork_cache *cache, cork_hash64 hash,
+                         const void *key);
+
+CORK_API void
+cork_cache_clear(struct cork_cache *cache);
+
+/* Removes every entry whose time-to-live has run out.  (Expired entries are
+ * otherwise only removed when you look them up, or when the clock hand
+ * reaches them.)  Returns the number of entries removed. */
+CORK_API size_t
+cork_cache_remove_expired(struct cork_cache *cache);
+
+CORK_API void
+cork_cache_get_stats(const struct cork_cache *cache,
+                     struct cork_cache_stats *stats);
+
+CORK_API void
+cork_cache_reset_stats(struct cork_cache *cache);
+
+
+/*-----------------------------------------------------------------------
+ * Sharded caches
+ */
+
+/* A bounded cache that any number of threads can use at once.  The capacity is
+ * split evenly across several independent cork_cache shards, chosen by the
+ * high bits of each key's hash, each with its own lock.  Since a CLOCK cache
+ * hit only sets a bit in the entry, threads never have to touch any shared
+ * eviction state on a hit.
+ *
+ * The evict callback is called with the entry's shard locked, so it must not
+ * call back into the cache.  Another thread might evict an entry as soon as
+ * get returns, so you have to coordinate the lifetime of the values that you
+ * retrieve yourself (for instance, with a reference count that you drop in the
+ * evict callback). */
+
+struct cork_sharded_cache;
+
+/* shard_count is rounded up to a power of two; pass in 0 to use
+ * CORK_SHARDED_CACHE_DEFAULT_SHARD_COUNT. */
+#define CORK_SHARDED_CACHE_DEFAULT_SHARD_COUNT  16
+
+CORK_API struct cork_sharded_cache *
+cork_sharded_cache_new(size_t shard_count, size_t capacity);
+
+CORK_API void
+cork_sharded_cache_free(struct cork_sharded_cache *cache);
+
+/* These must be called before the cache is shared with any other threads. */
+
+CORK_API void
+cork_sharded_cache_set_user_data(struct cork_sharded_cache *cache,
+                                 void *user_data, cork_free_f free_user_data);
+
+CORK_API void
+cork_sharded_cache_set_equals(struct cork_sharded_cache *cache,
+                              cork_equals_f equals);
+
+CORK_API void
+cork_sharded_cache_set_hash(struct cork_sharded_cache *cache,
+                            cork_hash_f hash);
+
+CORK_API void
+cork_sharded_cache_set_hash64(struct cork_sharded_cache *cache,
+                              cork_hash64_f hash);
+
+CORK_API void
+cork_sharded_cache_set_evict(struct cork_sharded_cache *cache,
+                             cork_cache_evict_f evict);
+
+CORK_API void
+cork_sharded_cache_set_clock(struct cork_sharded_cache *cache,
+                             cork_cache_clock_f clock);
+
+
+CORK_API size_t
+cork_sharded_cache_size(struct cork_sharded_cache *cache);
+
+CORK_API size_t
+cork_sharded_cache_capacity(struct cork_sharded_cache *cache);
+
+CORK_API void *
+cork_sharded_cache_get(struct cork_sharded_cache *cache, const void *key);
+
+CORK_API void
+cork_sharded_cache_put(struct cork_sharded_cache *cache,
+                       void *key, void *value, cork_timestamp ttl);
+
+CORK_API bool
+cork_sharded_cache_delete(struct cork_sharded_cache *cache, const void *key);
+
+CORK_API void
+cork_sharded_cache_clear(struct cork_sharded_cache *cache);
+
+CORK_API size_t
+cork_sharded_cache_remove_expired(struct cork_sharded_cache *cache);
+
+/* Adds up the statistics of every shard. */
+CORK_API void
+cork_sharded_cache_get_stats(struct cork_sharded_cache *cache,
+                             struct cork_cache_stats *stats);
+
+CORK_API void
+cork_sharded_cache_reset_stats(struct cork_sharded_cache *cache);
+
+
+#endif /* LIBCORK_DS_CACHE_H */
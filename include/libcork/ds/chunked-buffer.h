@@ -0,0 +1,152 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2011-2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_CHUNKED_BUFFER_H
+#define LIBCORK_DS_CHUNKED_BUFFER_H
+
+
+#include <stdarg.h>
+#include <sys/uio.h>
+
+#include <libcork/core/api.h>
+#include <libcork/core/attributes.h>
+#include <libcork/core/types.h>
+#include <libcork/ds/buffer.h>
+#include <libcork/ds/slice.h>
+#include <libcork/ds/stream.h>
+
+
+/* A buffer that stores its contents in a list of separately allocated
+ * chunks, so that appending to it never has to copy any existing data. */
+
+#define CORK_CHUNKED_BUFFER_DEFAULT_CHUNK_SIZE  4096
+
+struct cork_chunked_buffer_chunk;
+
+struct cork_chunked_buffer {
+    /* The chunks holding the buffer's contents, in order. */
+    struct cork_chunked_buffer_chunk  *head;
+    struct cork_chunked_buffer_chunk  *tail;
+    /* The total size of the buffer's contents. */
+    size_t  size;
+    /* The number of chunks in the buffer. */
+    size_t  chunk_count;
+    /* The minimum size of each new chunk that we allocate. */
+    size_t  chunk_size;
+};
+
+
+CORK_API void
+cork_chunked_buffer_init(struct cork_chunked_buffer *buffer);
+
+#define CORK_CHUNKED_BUFFER_INIT() \
+    { NULL, NULL, 0, 0, CORK_CHUNKED_BUFFER_DEFAULT_CHUNK_SIZE }
+
+CORK_API struct cork_chunked_buffer *
+cork_chunked_buffer_new(void);
+
+CORK_API void
+cork_chunked_buffer_done(struct cork_chunked_buffer *buffer);
+
+CORK_API void
+cork_chunked_buffer_free(struct cork_chunked_buffer *buffer);
+
+CORK_API void
+cork_chunked_buffer_set_chunk_size(struct cork_chunked_buffer *buffer,
+                                   size_t chunk_size);
+
+
+CORK_API bool
+cork_chunked_buffer_equal(const struct cork_chunked_buffer *buffer1,
+                          const struct cork_chunked_buffer *buffer2);
+
+CORK_API void
+cork_chunked_buffer_clear(struct cork_chunked_buffer *buffer);
+
+
+/*-----------------------------------------------------------------------
+ * Adding data
+ */
+
+CORK_API void
+cork_chunked_buffer_append(struct cork_chunked_buffer *buffer,
+                           const void *src, size_t length);
+
+#define cork_chunked_buffer_append_copy(dest, src) \
+    (cork_chunked_buffer_append((dest), (src)->buf, (src)->size))
+
+CORK_API void
+cork_chunked_buffer_append_string(struct cork_chunked_buffer *buffer,
+                                  const char *str);
+
+#define cork_chunked_buffer_append_literal(buffer, str) \
+    (cork_chunked_buffer_append((buffer), (str), sizeof((str)) - 1))
+
+CORK_API void
+cork_chunked_buffer_append_printf(struct cork_chunked_buffer *buffer,
+                                  const char *format, ...)
+    CORK_ATTR_PRINTF(2,3);
+
+CORK_API void
+cork_chunked_buffer_append_vprintf(struct cork_chunked_buffer *buffer,
+                                   const char *format, va_list args)
+    CORK_ATTR_PRINTF(2,0);
+
+CORK_API void
+cork_chunked_buffer_append_indent(struct cork_chunked_buffer *buffer,
+                                  size_t indent);
+
+
+/*-----------------------------------------------------------------------
+ * Reading data
+ */
+
+struct cork_chunked_buffer_iterator {
+    struct cork_chunked_buffer_chunk  *curr;
+};
+
+CORK_API void
+cork_chunked_buffer_iterator_init(const struct cork_chunked_buffer *buffer,
+                                  struct cork_chunked_buffer_iterator *iter);
+
+/* Fills in dest with a slice of the next chunk, and returns false if there
+ * aren't any chunks left.  The slice is only valid until the buffer is next
+ * modified. */
+CORK_API bool
+cork_chunked_buffer_iterator_next(struct cork_chunked_buffer_iterator *iter,
+                                  struct cork_slice *dest);
+
+/* Fills in up to count iovecs with the next chunks of the buffer, returning
+ * the number of iovecs that were filled in. */
+CORK_API size_t
+cork_chunked_buffer_iterator_iovec(struct cork_chunked_buffer_iterator *iter,
+                                   struct iovec *iov, size_t count);
+
+CORK_API int
+cork_chunked_buffer_write_fd(const struct cork_chunked_buffer *buffer,
+                             int fd);
+
+CORK_API void
+cork_chunked_buffer_to_buffer(const struct cork_chunked_buffer *src,
+                              struct cork_buffer *dest);
+
+CORK_API int
+cork_chunked_buffer_to_consumer(const struct cork_chunked_buffer *buffer,
+                                struct cork_stream_consumer *consumer);
+
+
+/*-----------------------------------------------------------------------
+ * Chunked buffer's stream consumer implementation
+ */
+
+CORK_API struct cork_stream_consumer *
+cork_chunked_buffer_to_stream_consumer(struct cork_chunked_buffer *buffer);
+
+
+#endif /* LIBCORK_DS_CHUNKED_BUFFER_H */
@@ -0,0 +1,57 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2012-2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_COMPRESSED_STREAM_H
+#define LIBCORK_DS_COMPRESSED_STREAM_H
+
+
+#include <libcork/core/api.h>
+#include <libcork/core/types.h>
+#include <libcork/ds/stream.h>
+
+
+/*-----------------------------------------------------------------------
+ * Error handling
+ */
+
+/* libcork was built without support for the requested format */
+#define CORK_COMPRESSION_UNSUPPORTED  0x7ef70928
+/* The compression library reported an error */
+#define CORK_COMPRESSION_FAILED       0xff2cf89a
+/* A compressed stream ended in the middle of a frame */
+#define CORK_COMPRESSION_TRUNCATED    0x41b46165
+
+
+/*-----------------------------------------------------------------------
+ * Compressing consumers
+ */
+
+/* Each of these consumers compresses or decompresses the data that it
+ * receives, and passes the result on to next.  The new consumer takes
+ * control of next, and will free it when it's freed.  zstd and LZ4 are
+ * optional dependencies; if libcork was built without one of them, its
+ * constructors free next and return NULL with a CORK_COMPRESSION_UNSUPPORTED
+ * error. */
+
+/* Use a level of 0 to get each library's default compression level. */
+
+CORK_API struct cork_stream_consumer *
+cork_zstd_compress_consumer_new(struct cork_stream_consumer *next, int level);
+
+CORK_API struct cork_stream_consumer *
+cork_zstd_decompress_consumer_new(struct cork_stream_consumer *next);
+
+CORK_API struct cork_stream_consumer *
+cork_lz4_compress_consumer_new(struct cork_stream_consumer *next, int level);
+
+CORK_API struct cork_stream_consumer *
+cork_lz4_decompress_consumer_new(struct cork_stream_consumer *next);
+
+
+#endif /* LIBCORK_DS_COMPRESSED_STREAM_H */
@@ -0,0 +1,126 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_CONCURRENT_HASH_TABLE_H
+#define LIBCORK_DS_CONCURRENT_HASH_TABLE_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/callbacks.h>
+#include <libcork/core/hash.h>
+#include <libcork/core/types.h>
+
+
+/*-----------------------------------------------------------------------
+ * Concurrent hash tables
+ */
+
+/* A hash table that can be read from any number of threads without taking a
+ * lock.  Writers are serialized with each other, and never block readers.
+ * Memory for deleted or replaced entries is only reclaimed once every reader
+ * that might still be looking at it has finished. */
+
+struct cork_concurrent_hash_table;
+
+CORK_API struct cork_concurrent_hash_table *
+cork_concurrent_hash_table_new(size_t initial_size, unsigned int flags);
+
+CORK_API void
+cork_concurrent_hash_table_free(struct cork_concurrent_hash_table *table);
+
+
+/* These must be called before the table is shared with any other threads. */
+
+CORK_API void
+cork_concurrent_hash_table_set_user_data
+(struct cork_concurrent_hash_table *table,
+ void *user_data, cork_free_f free_user_data);
+
+CORK_API void
+cork_concurrent_hash_table_set_equals(struct cork_concurrent_hash_table *table,
+                                      cork_equals_f equals);
+
+CORK_API void
+cork_concurrent_hash_table_set_free_key
+(struct cork_concurrent_hash_table *table, cork_free_f free);
+
+CORK_API void
+cork_concurrent_hash_table_set_free_value
+(struct cork_concurrent_hash_table *table, cork_free_f free);
+
+CORK_API void
+cork_concurrent_hash_table_set_hash(struct cork_concurrent_hash_table *table,
+                                    cork_hash_f hash);
+
+
+/* Readers */
+
+/* Every lookup must happen inside of a read-side critical section, and you can
+ * only use the values that you retrieve until you end the critical section.
+ * Critical sections don't nest, and you can't call any of the writer functions
+ * from inside of one. */
+
+CORK_API unsigned int
+cork_concurrent_hash_table_read_begin
+(struct cork_concurrent_hash_table *table);
+
+CORK_API void
+cork_concurrent_hash_table_read_end(struct cork_concurrent_hash_table *table,
+                                    unsigned int ticket);
+
+CORK_API void *
+cork_concurrent_hash_table_get(struct cork_concurrent_hash_table *table,
+                               const void *key);
+
+CORK_API void *
+cork_concurrent_hash_table_get_hash(struct cork_concurrent_hash_table *table,
+                                    cork_hash hash, const void *key);
+
+CORK_API bool
+cork_concurrent_hash_table_contains(struct cork_concurrent_hash_table *table,
+                                    const void *key);
+
+CORK_API size_t
+cork_concurrent_hash_table_size(struct cork_concurrent_hash_table *table);
+
+
+/* Writers */
+
+/* If you ask for the old key or value of an overwritten or deleted entry,
+ * other threads might still be using them.  You must call
+ * cork_concurrent_hash_table_synchronize before freeing them. */
+
+CORK_API void
+cork_concurrent_hash_table_put(struct cork_concurrent_hash_table *table,
+                               void *key, void *value,
+                               bool *is_new, void **old_key, void **old_value);
+
+CORK_API void
+cork_concurrent_hash_table_put_hash(struct cork_concurrent_hash_table *table,
+                                    cork_hash hash, void *key, void *value,
+                                    bool *is_new,
+                                    void **old_key, void **old_value);
+
+CORK_API bool
+cork_concurrent_hash_table_delete(struct cork_concurrent_hash_table *table,
+                                  const void *key,
+                                  void **deleted_key, void **deleted_value);
+
+CORK_API bool
+cork_concurrent_hash_table_delete_hash
+(struct cork_concurrent_hash_table *table, cork_hash hash, const void *key,
+ void **deleted_key, void **deleted_value);
+
+/* Waits until every read-side critical section that was active when this
+ * function was called has finished, and then reclaims any retired entries. */
+CORK_API void
+cork_concurrent_hash_table_synchronize
+(struct cork_concurrent_hash_table *table);
+
+
+#endif /* LIBCORK_DS_CONCURRENT_HASH_TABLE_H */
@@ -0,0 +1,131 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_CONCURRENT_LIST_H
+#define LIBCORK_DS_CONCURRENT_LIST_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/attributes.h>
+#include <libcork/core/types.h>
+#include <libcork/threads/atomics.h>
+#include <libcork/threads/locks.h>
+
+
+/* Like cork_dllist, these are intrusive: you embed a link item into the type
+ * whose instances you want to store, and use cork_container_of to get back to
+ * the instance.  Nothing here ever allocates memory. */
+
+
+/*-----------------------------------------------------------------------
+ * Concurrent stacks
+ */
+
+/* A lock-free LIFO stack that any number of threads can push to and pop from
+ * (a Treiber stack).  The top of the stack is paired with a version counter
+ * that every pop increments, so that a pop can't be fooled by an item that's
+ * popped and pushed again while it's looking at it (the ABA problem).  A pop
+ * might still read the link of an item that another thread has just popped, so
+ * you can't release an item's memory back to the OS while other threads might
+ * be popping; it's fine to free items into a memory pool, or to use epochs.
+ * On platforms without a double-width compare-and-swap, the stack is protected
+ * by a mutex instead. */
+
+struct cork_stack_item {
+    struct cork_stack_item * volatile  next;
+};
+
+struct cork_stack {
+#if CORK_HAVE_ATOMIC_PAIR_CAS
+    /* first is the top item, second is the version */
+    volatile struct cork_atomic_pair  top;
+#else
+    struct cork_stack_item  *top;
+    struct cork_mutex  lock;
+#endif
+};
+
+#if CORK_HAVE_ATOMIC_PAIR_CAS
+#define CORK_STACK_INIT  { { 0, 0 } }
+#define cork_stack_init(stack) \
+    ((stack)->top.first = 0, (stack)->top.second = 0)
+#else
+#define CORK_STACK_INIT  { NULL, CORK_MUTEX_INIT }
+#define cork_stack_init(stack) \
+    ((stack)->top = NULL, cork_mutex_init(&(stack)->lock))
+#endif
+
+#define cork_stack_done(stack)  ((void) (stack))
+
+CORK_API void
+cork_stack_push(struct cork_stack *stack, struct cork_stack_item *item);
+
+/* Returns NULL if the stack is empty. */
+CORK_API struct cork_stack_item *
+cork_stack_pop(struct cork_stack *stack);
+
+/* Removes every item from the stack at once, returning the old top of the
+ * stack.  You can follow each item's next link to get to the rest of the items,
+ * in LIFO order; the last item's next link is NULL. */
+CORK_API struct cork_stack_item *
+cork_stack_pop_all(struct cork_stack *stack);
+
+CORK_API bool
+cork_stack_is_empty(struct cork_stack *stack);
+
+
+/*-----------------------------------------------------------------------
+ * Multi-producer, single-consumer queues
+ */
+
+/* A FIFO queue that any number of threads can push to, but that only one
+ * thread at a time can pop from (Vyukov's intrusive MPSC queue).  A push is a
+ * single atomic exchange, and never waits for any other thread.  A pop never
+ * waits either, but that means that it can return NULL if it overtakes a push
+ * that is still in progress, even though the queue isn't empty; the pushing
+ * thread will finish in a moment, so the consumer should treat this like an
+ * empty queue that is about to become non-empty (for instance, by having the
+ * producer wake it up after every push).
+ *
+ * The queue contains an embedded stub item, so it can't be moved or copied
+ * once it's initialized. */
+
+struct cork_mpsc_item {
+    struct cork_mpsc_item * volatile  next;
+};
+
+struct cork_mpsc_queue {
+    /* The most recently pushed item, which producers fight over */
+    struct cork_mpsc_item * volatile  head;
+    CORK_CACHELINE_PAD(pad, sizeof(struct cork_mpsc_item *));
+    /* The next item to pop, which only the consumer touches */
+    struct cork_mpsc_item  *tail;
+    struct cork_mpsc_item  stub;
+};
+
+CORK_API void
+cork_mpsc_queue_init(struct cork_mpsc_queue *queue);
+
+#define cork_mpsc_queue_done(queue)  ((void) (queue))
+
+CORK_API void
+cork_mpsc_queue_push(struct cork_mpsc_queue *queue,
+                     struct cork_mpsc_item *item);
+
+/* Returns the oldest item in the queue, or NULL if the queue is empty (or a
+ * producer is in the middle of a push).  Must only be called from the
+ * consumer thread. */
+CORK_API struct cork_mpsc_item *
+cork_mpsc_queue_pop(struct cork_mpsc_queue *queue);
+
+/* Must only be called from the consumer thread. */
+CORK_API bool
+cork_mpsc_queue_is_empty(struct cork_mpsc_queue *queue);
+
+
+#endif /* LIBCORK_DS_CONCURRENT_LIST_H */
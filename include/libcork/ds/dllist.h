@@ -120,6 +120,25 @@ cork_dllist_size(const struct cork_dllist *list);
         cork_dllist_init(src); \
     } while (0)
 
+/* Moves all of the elements of src into the same list as pred, immediately
+ * after it.  src is empty afterwards. */
+#define cork_dllist_splice_after(pred, src) \
+    do { \
+        if (!cork_dllist_is_empty(src)) { \
+            struct cork_dllist_item  *splice_pred = (pred); \
+            struct cork_dllist_item  *splice_first = cork_dllist_start(src); \
+            struct cork_dllist_item  *splice_last = cork_dllist_end(src); \
+            splice_first->prev = splice_pred; \
+            splice_last->next = splice_pred->next; \
+            splice_pred->next->prev = splice_last; \
+            splice_pred->next = splice_first; \
+            cork_dllist_init(src); \
+        } \
+    } while (0)
+
+#define cork_dllist_splice_before(succ, src) \
+    cork_dllist_splice_after((succ)->prev, (src))
+
 
 #define cork_dllist_remove(element) \
     do { \
@@ -148,4 +167,89 @@ cork_dllist_size(const struct cork_dllist *list);
     ((element) == &(list)->head)
 
 
+/*-----------------------------------------------------------------------
+ * Counted lists
+ */
+
+/* A list that keeps track of how many elements it has, so that
+ * cork_counted_dllist_size is O(1).  Use the cork_counted_dllist macros for
+ * anything that adds or removes elements; you can use the read-only
+ * cork_dllist macros (cork_dllist_foreach, cork_dllist_head, etc.) on the list
+ * field directly. */
+struct cork_counted_dllist {
+    struct cork_dllist  list;
+    size_t  size;
+};
+
+#define CORK_COUNTED_DLLIST_INIT(clist) \
+    { CORK_DLLIST_INIT((clist).list), 0 }
+
+#define cork_counted_dllist_init(clist) \
+    do { \
+        cork_dllist_init(&(clist)->list); \
+        (clist)->size = 0; \
+    } while (0)
+
+#define cork_counted_dllist_size(clist)  ((clist)->size)
+#define cork_counted_dllist_is_empty(clist)  ((clist)->size == 0)
+
+#define cork_counted_dllist_add_after(clist, pred, element) \
+    do { \
+        cork_dllist_add_after((pred), (element)); \
+        (clist)->size++; \
+    } while (0)
+
+#define cork_counted_dllist_add_before(clist, succ, element) \
+    do { \
+        cork_dllist_add_before((succ), (element)); \
+        (clist)->size++; \
+    } while (0)
+
+#define cork_counted_dllist_add_to_head(clist, element) \
+    cork_counted_dllist_add_after((clist), &(clist)->list.head, (element))
+
+#define cork_counted_dllist_add_to_tail(clist, element) \
+    cork_counted_dllist_add_before((clist), &(clist)->list.head, (element))
+
+#define cork_counted_dllist_add  cork_counted_dllist_add_to_tail
+
+/* element must be in clist. */
+#define cork_counted_dllist_remove(clist, element) \
+    do { \
+        cork_dllist_remove((element)); \
+        (clist)->size--; \
+    } while (0)
+
+/* Moves all of the elements of src (which must also be a counted list) into
+ * dest. */
+#define cork_counted_dllist_add_list_to_head(dest, src) \
+    do { \
+        cork_dllist_splice_after(&(dest)->list.head, &(src)->list); \
+        (dest)->size += (src)->size; \
+        (src)->size = 0; \
+    } while (0)
+
+#define cork_counted_dllist_add_list_to_tail(dest, src) \
+    do { \
+        cork_dllist_splice_before(&(dest)->list.head, &(src)->list); \
+        (dest)->size += (src)->size; \
+        (src)->size = 0; \
+    } while (0)
+
+/* pred must be in dest (or be its sentinel). */
+#define cork_counted_dllist_splice_after(dest, pred, src) \
+    do { \
+        cork_dllist_splice_after((pred), &(src)->list); \
+        (dest)->size += (src)->size; \
+        (src)->size = 0; \
+    } while (0)
+
+#define cork_counted_dllist_splice_before(dest, succ, src) \
+    do { \
+        cork_dllist_splice_before((succ), &(src)->list); \
+        (dest)->size += (src)->size; \
+        (src)->size = 0; \
+    } while (0)
+
+
 #endif /* LIBCORK_DS_DLLIST_H */
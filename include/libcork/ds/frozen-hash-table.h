@@ -0,0 +1,122 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_FROZEN_HASH_TABLE_H
+#define LIBCORK_DS_FROZEN_HASH_TABLE_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/types.h>
+#include <libcork/ds/buffer.h>
+#include <libcork/ds/hash-table.h>
+#include <libcork/ds/slice.h>
+#include <libcork/ds/stream.h>
+
+
+/*-----------------------------------------------------------------------
+ * Error handling
+ */
+
+/* Two keys serialized to the same bytes while freezing a hash table */
+#define CORK_FROZEN_HASH_TABLE_DUPLICATE_KEY  0x6b1fd0e3
+
+
+/*-----------------------------------------------------------------------
+ * Freezing a hash table
+ */
+
+/* A frozen hash table is a read-only snapshot of a cork_hash_table, stored in
+ * a single position-independent image.  Keys and values are copied into the
+ * image as plain bytes, and every reference within the image is an offset
+ * from its start, so you can write the image to a file, memory-map it from any
+ * number of processes, and look up keys directly in the mapped pages without
+ * parsing or copying anything.
+ *
+ * All of the integers in the image are little-endian, and keys are hashed with
+ * cork_stable_hash_buffer, so an image can be read on any platform. */
+
+/* Appends the serialized form of item (a key or value from the table) to
+ * dest. */
+typedef int
+(*cork_hash_table_freeze_f)(void *user_data, const void *item,
+                            struct cork_buffer *dest);
+
+/* A freeze function for NUL-terminated C strings.  The terminating NUL is not
+ * included in the image, so you should look up keys using their strlen. */
+CORK_API int
+cork_hash_table_freeze_string(void *user_data, const void *item,
+                              struct cork_buffer *dest);
+
+/* Writes a frozen image of table to dest, and then signals EOF.  If
+ * freeze_value is NULL, every value in the image is empty.  Returns an error
+ * if any of the freeze functions do, or if two keys serialize to the same
+ * bytes. */
+CORK_API int
+cork_hash_table_freeze(struct cork_hash_table *table, void *user_data,
+                       cork_hash_table_freeze_f freeze_key,
+                       cork_hash_table_freeze_f freeze_value,
+                       struct cork_stream_consumer *dest);
+
+
+/*-----------------------------------------------------------------------
+ * Reading a frozen hash table
+ */
+
+struct cork_frozen_hash_table;
+
+/* Opens a frozen image.  We keep our own copy of src, so the caller can
+ * finish it right away; with a memory-mapped slice, the mapping is kept alive
+ * until the table is freed.  The image is not copied.  Returns NULL and fills
+ * in a parse error if src isn't a valid image. */
+CORK_API struct cork_frozen_hash_table *
+cork_frozen_hash_table_open(const struct cork_slice *src);
+
+CORK_API void
+cork_frozen_hash_table_free(struct cork_frozen_hash_table *table);
+
+CORK_API size_t
+cork_frozen_hash_table_size(const struct cork_frozen_hash_table *table);
+
+/* Returns a pointer to the value for key within the image, or NULL if the key
+ * isn't in the table.  If value_len isn't NULL, it's filled in with the
+ * length of the value.  Values are aligned to 8 bytes within the image. */
+CORK_API const void *
+cork_frozen_hash_table_get(const struct cork_frozen_hash_table *table,
+                           const void *key, size_t key_len,
+                           size_t *value_len);
+
+CORK_API bool
+cork_frozen_hash_table_contains(const struct cork_frozen_hash_table *table,
+                                const void *key, size_t key_len);
+
+struct cork_frozen_hash_table_entry {
+    const void  *key;
+    size_t  key_len;
+    const void  *value;
+    size_t  value_len;
+};
+
+struct cork_frozen_hash_table_iterator {
+    const struct cork_frozen_hash_table  *table;
+    size_t  index;
+};
+
+CORK_API void
+cork_frozen_hash_table_iterator_init
+(const struct cork_frozen_hash_table *table,
+ struct cork_frozen_hash_table_iterator *iterator);
+
+/* Fills in entry and returns true, or returns false once every entry has been
+ * visited.  The entries are not visited in any particular order. */
+CORK_API bool
+cork_frozen_hash_table_iterator_next
+(struct cork_frozen_hash_table_iterator *iterator,
+ struct cork_frozen_hash_table_entry *entry);
+
+
+#endif /* LIBCORK_DS_FROZEN_HASH_TABLE_H */
@@ -0,0 +1,352 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_HASH_MAP_H
+#define LIBCORK_DS_HASH_MAP_H
+
+#include <string.h>
+
+#include <libcork/core/api.h>
+#include <libcork/core/attributes.h>
+#include <libcork/core/hash.h>
+#include <libcork/core/net-addresses.h>
+#include <libcork/core/types.h>
+
+
+/*-----------------------------------------------------------------------
+ * Type-specialized hash maps
+ */
+
+/* A hash map whose key and value types, and hash and equality functions, are
+ * fixed at compile time.  Keys and values are stored directly in the map's
+ * slots, and the hash and equality functions are inlined into every lookup,
+ * so a map of (for instance) uint64_t keys never boxes a key or makes an
+ * indirect call.  CORK_HASH_MAP_DEFINE generates a struct and a family of
+ * static functions for a particular map type:
+ *
+ *   CORK_HASH_MAP_DEFINE(conn_map, uint64_t, struct conn *,
+ *                        cork_hash_map_uint64_hash, cork_hash_map_uint64_equals)
+ *
+ *   struct conn_map  map;
+ *   conn_map_init(&map);
+ *   conn_map_put(&map, id, conn);
+ *   struct conn  **conn = conn_map_get(&map, id);
+ *   conn_map_done(&map);
+ *
+ * hash is called as hash(key) and must return a cork_hash64; equals is called
+ * as equals(key1, key2).  Both receive keys by value, and can be functions or
+ * macros.  The map uses open addressing with linear probing; each slot has a
+ * one-byte control value that holds the top 7 bits of its key's hash, so most
+ * non-matching slots are ruled out without calling equals.  Pointers to
+ * values are only valid until the next time you add an entry to the map. */
+
+struct cork_raw_hash_map {
+    uint8_t  *ctrl;
+    void  *entries;
+    size_t  size;
+    size_t  slot_count;
+    /* How many more empty slots we can fill before we have to grow */
+    size_t  growth_left;
+};
+
+#define CORK_HASH_MAP_CTRL_EMPTY    ((uint8_t) 0x80)
+#define CORK_HASH_MAP_CTRL_DELETED  ((uint8_t) 0xfe)
+
+#define cork_hash_map_ctrl_is_full(c)  (((c) & 0x80) == 0)
+#define cork_hash_map_h2(hash)  ((uint8_t) ((hash) >> 57))
+
+CORK_API void
+cork_raw_hash_map_init(struct cork_raw_hash_map *map);
+
+CORK_API void
+cork_raw_hash_map_done(struct cork_raw_hash_map *map, size_t entry_size);
+
+CORK_API void
+cork_raw_hash_map_clear(struct cork_raw_hash_map *map);
+
+/* Replaces the map's slots with a set of empty ones that can hold at least
+ * desired_count entries.  The caller is responsible for reinserting the
+ * entries from the old slots, and then freeing them with
+ * cork_raw_hash_map_free_slots. */
+CORK_API void
+cork_raw_hash_map_allocate(struct cork_raw_hash_map *map, size_t entry_size,
+                           size_t desired_count);
+
+CORK_API void
+cork_raw_hash_map_free_slots(uint8_t *ctrl, void *entries, size_t slot_count,
+                             size_t entry_size);
+
+/* Marks a full slot as unused.  If the next slot is empty, no probe sequence
+ * can continue past this one, so we don't need to leave a tombstone. */
+CORK_ATTR_UNUSED
+static inline void
+cork_raw_hash_map_remove(struct cork_raw_hash_map *map, size_t index)
+{
+    size_t  next = (index + 1) & (map->slot_count - 1);
+    if (map->ctrl[next] == CORK_HASH_MAP_CTRL_EMPTY) {
+        map->ctrl[index] = CORK_HASH_MAP_CTRL_EMPTY;
+        map->growth_left++;
+    } else {
+        map->ctrl[index] = CORK_HASH_MAP_CTRL_DELETED;
+    }
+    map->size--;
+}
+
+#define cork_hash_map_to_raw(map) \
+    ((struct cork_raw_hash_map *) (void *) (map))
+
+#define cork_hash_map_size(map)  ((map)->size)
+
+#define CORK_HASH_MAP_DEFINE(name, K, V, hash, equals) \
+struct name##_entry { \
+    K  key; \
+    V  value; \
+}; \
+\
+struct name { \
+    uint8_t  *ctrl; \
+    struct name##_entry  *entries; \
+    size_t  size; \
+    size_t  slot_count; \
+    size_t  growth_left; \
+}; \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+name##_init(struct name *map) \
+{ \
+    cork_raw_hash_map_init(cork_hash_map_to_raw(map)); \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+name##_done(struct name *map) \
+{ \
+    cork_raw_hash_map_done(cork_hash_map_to_raw(map), \
+                           sizeof(struct name##_entry)); \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+name##_clear(struct name *map) \
+{ \
+    cork_raw_hash_map_clear(cork_hash_map_to_raw(map)); \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline size_t \
+name##_size(const struct name *map) \
+{ \
+    return map->size; \
+} \
+\
+/* Returns the index of key's slot, or SIZE_MAX if it isn't in the map. */ \
+CORK_ATTR_UNUSED \
+static inline size_t \
+name##_find(const struct name *map, K key, cork_hash64 h) \
+{ \
+    size_t  mask = map->slot_count - 1; \
+    size_t  index = (size_t) h & mask; \
+    uint8_t  h2 = cork_hash_map_h2(h); \
+    if (CORK_UNLIKELY(map->slot_count == 0)) { \
+        return SIZE_MAX; \
+    } \
+    while (true) { \
+        uint8_t  c = map->ctrl[index]; \
+        if (c == h2 && equals(key, map->entries[index].key)) { \
+            return index; \
+        } \
+        if (c == CORK_HASH_MAP_CTRL_EMPTY) { \
+            return SIZE_MAX; \
+        } \
+        index = (index + 1) & mask; \
+    } \
+} \
+\
+/* Returns the index of the first empty or deleted slot in h's probe \
+ * sequence.  The map must have at least one. */ \
+CORK_ATTR_UNUSED \
+static inline size_t \
+name##_find_available(const struct name *map, cork_hash64 h) \
+{ \
+    size_t  mask = map->slot_count - 1; \
+    size_t  index = (size_t) h & mask; \
+    while (cork_hash_map_ctrl_is_full(map->ctrl[index])) { \
+        index = (index + 1) & mask; \
+    } \
+    return index; \
+} \
+\
+CORK_ATTR_UNUSED \
+static void \
+name##_resize(struct name *map, size_t desired_count) \
+{ \
+    uint8_t  *old_ctrl = map->ctrl; \
+    struct name##_entry  *old_entries = map->entries; \
+    size_t  old_slot_count = map->slot_count; \
+    size_t  i; \
+    cork_raw_hash_map_allocate(cork_hash_map_to_raw(map), \
+                               sizeof(struct name##_entry), desired_count); \
+    for (i = 0; i < old_slot_count; i++) { \
+        if (cork_hash_map_ctrl_is_full(old_ctrl[i])) { \
+            cork_hash64  h = hash(old_entries[i].key); \
+            size_t  index = name##_find_available(map, h); \
+            map->ctrl[index] = old_ctrl[i]; \
+            map->entries[index] = old_entries[i]; \
+        } \
+    } \
+    map->growth_left -= map->size; \
+    cork_raw_hash_map_free_slots(old_ctrl, old_entries, old_slot_count, \
+                                 sizeof(struct name##_entry)); \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+name##_ensure_size(struct name *map, size_t desired_count) \
+{ \
+    if (desired_count > map->size + map->growth_left) { \
+        name##_resize(map, desired_count); \
+    } \
+} \
+\
+/* Returns a pointer to key's value, or NULL if it isn't in the map. */ \
+CORK_ATTR_UNUSED \
+static inline V * \
+name##_get(const struct name *map, K key) \
+{ \
+    size_t  index = name##_find(map, key, hash(key)); \
+    return (index == SIZE_MAX)? NULL: &map->entries[index].value; \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline bool \
+name##_contains(const struct name *map, K key) \
+{ \
+    return name##_find(map, key, hash(key)) != SIZE_MAX; \
+} \
+\
+/* Returns a pointer to key's value, adding a new entry if needed.  A new \
+ * entry's value is uninitialized; *is_new tells you whether you need to fill \
+ * it in. */ \
+CORK_ATTR_UNUSED \
+static inline V * \
+name##_get_or_create(struct name *map, K key, bool *is_new) \
+{ \
+    cork_hash64  h = hash(key); \
+    size_t  index = name##_find(map, key, h); \
+    if (index != SIZE_MAX) { \
+        *is_new = false; \
+        return &map->entries[index].value; \
+    } \
+    if (CORK_UNLIKELY(map->growth_left == 0)) { \
+        /* Reuse any tombstones first, and only grow if that won't leave us \
+         * with enough room. */ \
+        size_t  desired_count = map->slot_count - map->slot_count / 8; \
+        if (map->size >= map->slot_count / 2) { \
+            desired_count++; \
+        } \
+        name##_resize(map, desired_count); \
+    } \
+    index = name##_find_available(map, h); \
+    if (map->ctrl[index] == CORK_HASH_MAP_CTRL_EMPTY) { \
+        map->growth_left--; \
+    } \
+    map->ctrl[index] = cork_hash_map_h2(h); \
+    map->entries[index].key = key; \
+    map->size++; \
+    *is_new = true; \
+    return &map->entries[index].value; \
+} \
+\
+/* Adds or replaces key's entry. */ \
+CORK_ATTR_UNUSED \
+static inline void \
+name##_put(struct name *map, K key, V value) \
+{ \
+    bool  is_new; \
+    *name##_get_or_create(map, key, &is_new) = value; \
+} \
+\
+/* Removes key's entry, returning whether there was one.  If value isn't \
+ * NULL, the removed value is copied into it. */ \
+CORK_ATTR_UNUSED \
+static inline bool \
+name##_delete(struct name *map, K key, V *value) \
+{ \
+    size_t  index = name##_find(map, key, hash(key)); \
+    if (index == SIZE_MAX) { \
+        return false; \
+    } \
+    if (value != NULL) { \
+        *value = map->entries[index].value; \
+    } \
+    cork_raw_hash_map_remove(cork_hash_map_to_raw(map), index); \
+    return true; \
+} \
+\
+/* Iterates through the map's entries, in no particular order.  Set *iter to \
+ * 0 before the first call.  Returns NULL once there are no more entries.  You \
+ * can delete the entry that was just returned, but can't add any entries \
+ * while iterating. */ \
+CORK_ATTR_UNUSED \
+static inline struct name##_entry * \
+name##_next(const struct name *map, size_t *iter) \
+{ \
+    size_t  i; \
+    for (i = *iter; i < map->slot_count; i++) { \
+        if (cork_hash_map_ctrl_is_full(map->ctrl[i])) { \
+            *iter = i + 1; \
+            return &map->entries[i]; \
+        } \
+    } \
+    *iter = map->slot_count; \
+    return NULL; \
+} \
+/* Swallow the trailing semicolon */ \
+struct name##_entry
+
+
+/*-----------------------------------------------------------------------
+ * Built-in key types
+ */
+
+/* Hash and equality functions for some common key types, which take their
+ * keys by value, for use with CORK_HASH_MAP_DEFINE. */
+
+#define cork_hash_map_uint32_hash(key)  ((cork_hash64) cork_wyhash_u32(0, (key)))
+#define cork_hash_map_uint32_equals(k1, k2)  ((k1) == (k2))
+
+#define cork_hash_map_uint64_hash(key)  ((cork_hash64) cork_wyhash_u64(0, (key)))
+#define cork_hash_map_uint64_equals(k1, k2)  ((k1) == (k2))
+
+#define cork_hash_map_u128_hash(key) \
+    ((cork_hash64) cork_wyhash_u128(0, (key)))
+#define cork_hash_map_u128_equals(k1, k2)  (cork_u128_eq((k1), (k2)))
+
+#define cork_hash_map_pointer_hash(key) \
+    ((cork_hash64) cork_wyhash_u64(0, (uint64_t) (uintptr_t) (key)))
+#define cork_hash_map_pointer_equals(k1, k2)  ((k1) == (k2))
+
+#define cork_hash_map_ipv4_hash(key) \
+    ((cork_hash64) cork_wyhash_u32(0, (key)._.u32))
+#define cork_hash_map_ipv4_equals(k1, k2)  ((k1)._.u32 == (k2)._.u32)
+
+#define cork_hash_map_ipv6_hash(key) \
+    ((cork_hash64) cork_wyhash(0, (key)._.u8, 16))
+#define cork_hash_map_ipv6_equals(k1, k2) \
+    ((k1)._.u64[0] == (k2)._.u64[0] && (k1)._.u64[1] == (k2)._.u64[1])
+
+/* The strings aren't copied into the map, so they must outlive their
+ * entries. */
+#define cork_hash_map_string_hash(key) \
+    ((cork_hash64) cork_wyhash(0, (key), strlen((key))))
+#define cork_hash_map_string_equals(k1, k2)  (strcmp((k1), (k2)) == 0)
+
+
+#endif /* LIBCORK_DS_HASH_MAP_H */
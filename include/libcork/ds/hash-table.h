@@ -10,6 +10,7 @@
 #ifndef LIBCORK_DS_HASH_TABLE_H
 #define LIBCORK_DS_HASH_TABLE_H
 
+#include <libcork/core/allocator.h>
 #include <libcork/core/api.h>
 #include <libcork/core/callbacks.h>
 #include <libcork/core/hash.h>
@@ -22,18 +23,64 @@
  * Hash tables
  */
 
+/* Tables keep a 64-bit hash for each entry.  `hash` holds its low 32 bits,
+ * so that code written against the 32-bit API keeps working; `hash_high`
+ * holds the rest.  On LP64 targets `hash_high` fits into what would otherwise
+ * be padding, but on 32-bit targets it moves `key` and `value`, so this
+ * struct's layout changed in version 17 of the shared library. */
 struct cork_hash_table_entry {
     cork_hash  hash;
+    cork_hash  hash_high;
     void  *key;
     void  *value;
 };
 
+#define cork_hash_table_entry_hash64(entry) \
+    (((cork_hash64) (entry)->hash_high << 32) | (entry)->hash)
+
 
 struct cork_hash_table;
 
+/* Store entries inline in an open-addressed array of slots, rather than in
+ * separately allocated per-bin lists.  Entry pointers are only valid until the
+ * next insertion, and iteration doesn't follow insertion order. */
+#define CORK_HASH_TABLE_OPEN_ADDRESSING  0x0001
+
+/* Spread the cost of growing the table across subsequent operations, instead
+ * of rehashing every entry at once.  Ignored for open-addressed tables. */
+#define CORK_HASH_TABLE_INCREMENTAL_RESIZE  0x0002
+
+/* Allocate chained entries from a memory pool owned by the table, rather than
+ * individually.  Ignored for open-addressed tables. */
+#define CORK_HASH_TABLE_POOLED_ENTRIES  0x0004
+
+/* Hash the keys of the built-in key types (see below) with
+ * cork_fast_hash_buffer, rather than cork_hash_buffer.  This has no effect on
+ * tables that use your own hash function. */
+#define CORK_HASH_TABLE_FAST_HASH  0x0008
+
+/* Don't keep track of the order that entries were added in.  Each entry is
+ * smaller, and adding and removing entries touches less memory, but
+ * cork_hash_table_map and iterators visit entries in an unspecified order.
+ * (Open-addressed tables never keep track of insertion order.) */
+#define CORK_HASH_TABLE_UNORDERED  0x0010
+
+/* Shrink the table when it's mostly empty.  We check this each time that you
+ * add an entry (but never when you delete one, since you can delete entries
+ * while iterating), and when you clear the table.  Shrinking doesn't move any
+ * entries, except in open-addressed tables, whose entries are already allowed
+ * to move whenever you add an entry. */
+#define CORK_HASH_TABLE_AUTO_SHRINK  0x0020
+
 CORK_API struct cork_hash_table *
 cork_hash_table_new(size_t initial_size, unsigned int flags);
 
+/* All of the table's memory will be allocated from `alloc`, which must outlive
+ * the table. */
+CORK_API struct cork_hash_table *
+cork_hash_table_new_ex(size_t initial_size, unsigned int flags,
+                       const struct cork_alloc *alloc);
+
 CORK_API void
 cork_hash_table_free(struct cork_hash_table *table);
 
@@ -54,6 +101,17 @@ cork_hash_table_set_free_value(struct cork_hash_table *table, cork_free_f free);
 CORK_API void
 cork_hash_table_set_hash(struct cork_hash_table *table, cork_hash_f hash);
 
+/* Use a function that produces 64-bit hashes, which keeps probe sequences
+ * short even for tables with billions of entries.  This replaces any function
+ * given to cork_hash_table_set_hash, and vice versa.
+ *
+ * Internally, a table always works with 64-bit hashes; a 32-bit hash h is
+ * widened to (h << 32) | h.  If you pass in precomputed hashes, use the
+ * _hash64 functions with a table that has a 64-bit hash function, and either
+ * set of functions with a table that has a 32-bit one. */
+CORK_API void
+cork_hash_table_set_hash64(struct cork_hash_table *table, cork_hash64_f hash);
+
 
 CORK_API void
 cork_hash_table_clear(struct cork_hash_table *table);
@@ -63,6 +121,14 @@ CORK_API void
 cork_hash_table_ensure_size(struct cork_hash_table *table,
                             size_t desired_count);
 
+/* Shrinks the table's bins or slots to fit the entries that it currently
+ * holds (but never below its initial size).  The entries of a
+ * CORK_HASH_TABLE_POOLED_ENTRIES table are also moved into a new pool, so that
+ * the old pool's memory can be freed; like with an open-addressed table, that
+ * means that any entry pointers you were holding onto are no longer valid. */
+CORK_API void
+cork_hash_table_shrink_to_fit(struct cork_hash_table *table);
+
 CORK_API size_t
 cork_hash_table_size(const struct cork_hash_table *table);
 
@@ -74,6 +140,23 @@ CORK_API void *
 cork_hash_table_get_hash(const struct cork_hash_table *table,
                          cork_hash hash, const void *key);
 
+CORK_API void *
+cork_hash_table_get_hash64(const struct cork_hash_table *table,
+                           cork_hash64 hash, const void *key);
+
+/* Looks up `count` keys at once, storing each value (or NULL) into `results`.
+ * If `hashes` isn't NULL, it must contain the hash of each key. */
+CORK_API void
+cork_hash_table_get_batch(const struct cork_hash_table *table,
+                          const void * const *keys, const cork_hash *hashes,
+                          size_t count, void **results);
+
+CORK_API void
+cork_hash_table_get_batch_hash64(const struct cork_hash_table *table,
+                                 const void * const *keys,
+                                 const cork_hash64 *hashes,
+                                 size_t count, void **results);
+
 CORK_API struct cork_hash_table_entry *
 cork_hash_table_get_entry(const struct cork_hash_table *table,
                           const void *key);
@@ -82,6 +165,10 @@ CORK_API struct cork_hash_table_entry *
 cork_hash_table_get_entry_hash(const struct cork_hash_table *table,
                                cork_hash hash, const void *key);
 
+CORK_API struct cork_hash_table_entry *
+cork_hash_table_get_entry_hash64(const struct cork_hash_table *table,
+                                 cork_hash64 hash, const void *key);
+
 CORK_API struct cork_hash_table_entry *
 cork_hash_table_get_or_create(struct cork_hash_table *table,
                               void *key, bool *is_new);
@@ -90,6 +177,11 @@ CORK_API struct cork_hash_table_entry *
 cork_hash_table_get_or_create_hash(struct cork_hash_table *table,
                                    cork_hash hash, void *key, bool *is_new);
 
+CORK_API struct cork_hash_table_entry *
+cork_hash_table_get_or_create_hash64(struct cork_hash_table *table,
+                                     cork_hash64 hash, void *key,
+                                     bool *is_new);
+
 CORK_API void
 cork_hash_table_put(struct cork_hash_table *table,
                     void *key, void *value,
@@ -100,6 +192,11 @@ cork_hash_table_put_hash(struct cork_hash_table *table,
                          cork_hash hash, void *key, void *value,
                          bool *is_new, void **old_key, void **old_value);
 
+CORK_API void
+cork_hash_table_put_hash64(struct cork_hash_table *table,
+                           cork_hash64 hash, void *key, void *value,
+                           bool *is_new, void **old_key, void **old_value);
+
 CORK_API void
 cork_hash_table_delete_entry(struct cork_hash_table *table,
                              struct cork_hash_table_entry *entry);
@@ -113,6 +210,11 @@ cork_hash_table_delete_hash(struct cork_hash_table *table,
                             cork_hash hash, const void *key,
                             void **deleted_key, void **deleted_value);
 
+CORK_API bool
+cork_hash_table_delete_hash64(struct cork_hash_table *table,
+                              cork_hash64 hash, const void *key,
+                              void **deleted_key, void **deleted_value);
+
 
 enum cork_hash_table_map_result {
     /* Abort the current @ref cork_hash_table_map operation. */
@@ -155,5 +257,52 @@ cork_string_hash_table_new(size_t initial_size, unsigned int flags);
 CORK_API struct cork_hash_table *
 cork_pointer_hash_table_new(size_t initial_size, unsigned int flags);
 
+/* Hash and equality functions for some common kinds of keys, which you can
+ * pass to cork_hash_table_set_hash and cork_hash_table_set_equals (or their
+ * cork_concurrent_hash_table counterparts), or, for the _hash64 variants, to
+ * cork_hash_table_set_hash64.  For the integer types, each key is a pointer
+ * to the integer, rather than the integer itself.  The _fast_hash and _hash64
+ * variants use the cork_fast_hash and cork_hash64 functions from
+ * libcork/core/hash.h. */
+
+CORK_API cork_hash
+cork_string_hash(void *user_data, const void *key);
+
+CORK_API cork_hash
+cork_string_fast_hash(void *user_data, const void *key);
+
+CORK_API bool
+cork_string_equals(void *user_data, const void *key1, const void *key2);
+
+CORK_API cork_hash64
+cork_string_hash64(void *user_data, const void *key);
+
+CORK_API cork_hash
+cork_uint32_fast_hash(void *user_data, const void *key);
+
+CORK_API cork_hash64
+cork_uint32_hash64(void *user_data, const void *key);
+
+CORK_API bool
+cork_uint32_equals(void *user_data, const void *key1, const void *key2);
+
+CORK_API cork_hash
+cork_uint64_fast_hash(void *user_data, const void *key);
+
+CORK_API cork_hash64
+cork_uint64_hash64(void *user_data, const void *key);
+
+CORK_API bool
+cork_uint64_equals(void *user_data, const void *key1, const void *key2);
+
+CORK_API cork_hash
+cork_u128_fast_hash(void *user_data, const void *key);
+
+CORK_API cork_hash64
+cork_u128_hash64(void *user_data, const void *key);
+
+CORK_API bool
+cork_u128_equals(void *user_data, const void *key1, const void *key2);
+
 
 #endif /* LIBCORK_DS_HASH_TABLE_H */
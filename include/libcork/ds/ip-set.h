@@ -0,0 +1,102 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_IP_SET_H
+#define LIBCORK_DS_IP_SET_H
+
+
+#include <libcork/core/api.h>
+#include <libcork/core/net-addresses.h>
+#include <libcork/core/types.h>
+#include <libcork/ds/buffer.h>
+#include <libcork/ds/slice.h>
+
+
+/*-----------------------------------------------------------------------
+ * Error handling
+ */
+
+/* A range's endpoints are out of order or have different IP versions, or a
+ * network prefix is invalid */
+#define CORK_IP_SET_INVALID_RANGE   0xe675d4d3
+/* A serialized IP set is truncated or corrupt */
+#define CORK_IP_SET_INVALID_FORMAT  0x44ba80e7
+
+
+/*-----------------------------------------------------------------------
+ * IP address sets
+ */
+
+/* A set of IPv4 and IPv6 addresses, stored as a sorted list of disjoint
+ * ranges.  Like an LPM table, you add addresses, networks, and ranges first,
+ * and then call cork_ip_set_build to sort them and merge any ranges that
+ * overlap or are adjacent.  Membership tests only see the ranges that were
+ * present at the last build. */
+struct cork_ip_set;
+
+CORK_API struct cork_ip_set *
+cork_ip_set_new(void);
+
+CORK_API void
+cork_ip_set_free(struct cork_ip_set *set);
+
+CORK_API void
+cork_ip_set_add(struct cork_ip_set *set, const struct cork_ip *addr);
+
+CORK_API int
+cork_ip_set_add_network(struct cork_ip_set *set, const struct cork_ip *network,
+                        unsigned int prefix_len);
+
+/* Adds every address from first to last, inclusive. */
+CORK_API int
+cork_ip_set_add_range(struct cork_ip_set *set, const struct cork_ip *first,
+                      const struct cork_ip *last);
+
+CORK_API void
+cork_ip_set_build(struct cork_ip_set *set);
+
+CORK_API bool
+cork_ip_set_contains(const struct cork_ip_set *set, const struct cork_ip *addr);
+
+/* Returns the number of disjoint ranges in the set as of the last build. */
+CORK_API size_t
+cork_ip_set_range_count(const struct cork_ip_set *set);
+
+
+/*-----------------------------------------------------------------------
+ * Serialized IP sets
+ */
+
+/* Appends the set's ranges as of the last build to dest, in a format that you
+ * can test membership against directly, without copying it into a new set.
+ * All of the values are big-endian, so a serialized set can be read on any
+ * platform. */
+CORK_API void
+cork_ip_set_save(const struct cork_ip_set *set, struct cork_buffer *dest);
+
+/* A read-only view of a serialized set.  It points into the slice that you
+ * initialize it from (which could, for instance, be an mmap-ed file), which
+ * must stay valid for as long as you use the view. */
+struct cork_ip_set_view {
+    const uint8_t  *v4;
+    size_t  v4_count;
+    const uint8_t  *v6;
+    size_t  v6_count;
+};
+
+CORK_API int
+cork_ip_set_view_init(struct cork_ip_set_view *view,
+                      const struct cork_slice *src);
+
+CORK_API bool
+cork_ip_set_view_contains(const struct cork_ip_set_view *view,
+                          const struct cork_ip *addr);
+
+
+#endif /* LIBCORK_DS_IP_SET_H */
@@ -0,0 +1,84 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_LPM_TABLE_H
+#define LIBCORK_DS_LPM_TABLE_H
+
+
+#include <libcork/core/api.h>
+#include <libcork/core/net-addresses.h>
+#include <libcork/core/types.h>
+
+
+/*-----------------------------------------------------------------------
+ * Error handling
+ */
+
+/* A network prefix is too long, or has host bits set */
+#define CORK_LPM_TABLE_INVALID_NETWORK  0x514d4c70
+
+
+/*-----------------------------------------------------------------------
+ * Longest-prefix-match tables
+ */
+
+/* An LPM table maps IPv4 and IPv6 networks to values, and finds the value of
+ * the most specific network that contains a given address.  You add all of
+ * the networks first, and then call cork_lpm_table_build to compile them into
+ * a multibit trie: a 65536-entry root table indexed by the first 16 bits of
+ * the address, and 256-entry tables for each byte after that.  A lookup is
+ * one memory access for every level, so at most 3 for an IPv4 address, and
+ * usually only one or two. */
+
+struct cork_lpm_table;
+
+CORK_API struct cork_lpm_table *
+cork_lpm_table_new(void);
+
+CORK_API void
+cork_lpm_table_free(struct cork_lpm_table *table);
+
+/* Add a network to the table.  If the table already contains the same
+ * network, the new value replaces the old one.  Lookups won't see the new
+ * network until you call cork_lpm_table_build. */
+CORK_API int
+cork_lpm_table_add(struct cork_lpm_table *table, const struct cork_ip *network,
+                   unsigned int prefix_len, void *value);
+
+/* Rebuild the table's lookup structures from all of the networks that have
+ * been added to it. */
+CORK_API void
+cork_lpm_table_build(struct cork_lpm_table *table);
+
+/* Returns the number of networks that have been added to the table. */
+CORK_API size_t
+cork_lpm_table_size(const struct cork_lpm_table *table);
+
+/* Return the value of the most specific network that contains addr, or NULL
+ * if there isn't one. */
+CORK_API void *
+cork_lpm_table_lookup(const struct cork_lpm_table *table,
+                      const struct cork_ip *addr);
+
+CORK_API void *
+cork_lpm_table_lookup_ipv4(const struct cork_lpm_table *table,
+                           const struct cork_ipv4 *addr);
+
+CORK_API void *
+cork_lpm_table_lookup_ipv6(const struct cork_lpm_table *table,
+                           const struct cork_ipv6 *addr);
+
+/* Look up count addresses, storing the result for addrs[i] in results[i]. */
+CORK_API void
+cork_lpm_table_lookup_batch(const struct cork_lpm_table *table,
+                            const struct cork_ip *addrs, size_t count,
+                            void **results);
+
+
+#endif /* LIBCORK_DS_LPM_TABLE_H */
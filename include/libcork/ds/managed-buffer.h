@@ -20,6 +20,7 @@
  * Managed buffers
  */
 
+struct cork_buffer;
 struct cork_managed_buffer;
 
 struct cork_managed_buffer_iface {
@@ -27,6 +28,13 @@ struct cork_managed_buffer_iface {
      * object itself. */
     void
     (*free)(struct cork_managed_buffer *buf);
+
+    /* Move the contents of a managed buffer into dest without copying them,
+     * and free the managed buffer object itself.  dest will be empty, and
+     * we'll only call this when there's a single reference to the managed
+     * buffer.  Can be NULL if the contents can't be moved. */
+    void
+    (*steal)(struct cork_managed_buffer *buf, struct cork_buffer *dest);
 };
 
 
@@ -55,12 +63,52 @@ cork_managed_buffer_new(const void *buf, size_t size,
                         cork_managed_buffer_freer free);
 
 
+/*-----------------------------------------------------------------------
+ * Pooled managed buffers
+ */
+
+/* Hands out fixed-size, writable managed buffers for receive paths.  Each
+ * buffer's header lives inline in front of its payload, in a single object
+ * from a thread-caching cork_mempool, and goes back to the pool when its last
+ * reference is released.  Allocating a buffer, slicing it, and releasing it
+ * never touches malloc once the pool has warmed up.  Safe to use from multiple
+ * threads at once; you must release every buffer before freeing the pool. */
+struct cork_managed_buffer_pool;
+
+CORK_API struct cork_managed_buffer_pool *
+cork_managed_buffer_pool_new(size_t buffer_size);
+
+CORK_API void
+cork_managed_buffer_pool_free(struct cork_managed_buffer_pool *pool);
+
+CORK_API size_t
+cork_managed_buffer_pool_buffer_size(struct cork_managed_buffer_pool *pool);
+
+/* The new buffer's size is the pool's buffer size, and its contents are
+ * uninitialized.  Fill it in via `data`, and then (before you share it) you
+ * can shrink its size to however much you actually received. */
+CORK_API struct cork_managed_buffer *
+cork_managed_buffer_pool_new_buffer(struct cork_managed_buffer_pool *pool,
+                                    void **data);
+
+
+/* Map the contents of a file into memory.  Returns NULL if the file can't be
+ * opened or mapped, or isn't a regular file.  Regular files that report a size
+ * of 0 (like the ones in /proc) are read into a copy instead. */
+CORK_API struct cork_managed_buffer *
+cork_managed_buffer_new_mmap(const char *path);
+
+
 CORK_API struct cork_managed_buffer *
 cork_managed_buffer_ref(struct cork_managed_buffer *buf);
 
 CORK_API void
 cork_managed_buffer_unref(struct cork_managed_buffer *buf);
 
+/* Whether anyone else holds a reference to this managed buffer.  If not, the
+ * holder of the only reference can safely take over its contents. */
+#define cork_managed_buffer_is_shared(buf)  ((buf)->ref_count > 1)
+
 
 CORK_API int
 cork_managed_buffer_slice(struct cork_slice *dest,
@@ -72,5 +120,45 @@ cork_managed_buffer_slice_offset(struct cork_slice *dest,
                                  struct cork_managed_buffer *buffer,
                                  size_t offset);
 
+/* A borrowed slice doesn't hold a reference to the managed buffer, so it must
+ * not outlive whatever reference you're borrowing.  Full copies of it take out
+ * their own reference, and so can outlive it. */
+CORK_API int
+cork_managed_buffer_slice_borrowed(struct cork_slice *dest,
+                                   struct cork_managed_buffer *buffer,
+                                   size_t offset, size_t length);
+
+/* Returns the managed buffer that a slice (including a borrowed one) refers
+ * to, or NULL if the slice wasn't created from a managed buffer. */
+CORK_API struct cork_managed_buffer *
+cork_slice_get_managed_buffer(const struct cork_slice *slice);
+
+
+
+/*-----------------------------------------------------------------------
+ * Memory-mapped files
+ */
+
+/* Initialize a slice that covers the entire contents of a memory-mapped
+ * file.  Copies and sub-slices share the same mapping, which is unmapped
+ * once the last of them is finished. */
+CORK_API int
+cork_mmap_file_slice(const char *path, struct cork_slice *dest);
+
+enum cork_mmap_advice {
+    CORK_MMAP_NORMAL,
+    CORK_MMAP_SEQUENTIAL,
+    CORK_MMAP_RANDOM,
+    CORK_MMAP_WILLNEED,
+    CORK_MMAP_DONTNEED
+};
+
+/* Tell the kernel how we expect to access the part of a memory-mapped file
+ * that a slice covers.  Does nothing if the slice doesn't refer to a
+ * memory-mapped file. */
+CORK_API int
+cork_mmap_slice_advise(const struct cork_slice *slice,
+                       enum cork_mmap_advice advice);
+
 
 #endif /* LIBCORK_DS_MANAGED_BUFFER_H */
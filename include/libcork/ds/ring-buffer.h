@@ -12,6 +12,7 @@
 #define LIBCORK_DS_RING_BUFFER_H
 
 #include <libcork/core/api.h>
+#include <libcork/core/attributes.h>
 #include <libcork/core/types.h>
 
 
@@ -27,6 +28,9 @@ struct cork_ring_buffer {
     size_t  read_index;
     /* The index of the next element to write into the buffer */
     size_t  write_index;
+    /* If allocated_size is a power of two, we wrap the indices around by
+     * masking them with this.  Otherwise it's 0. */
+    size_t  mask;
 };
 
 
@@ -56,5 +60,204 @@ cork_ring_buffer_pop(struct cork_ring_buffer *buf);
 CORK_API void *
 cork_ring_buffer_peek(struct cork_ring_buffer *buf);
 
+/* Add as many of the count elements as will fit, returning the number that
+ * were added. */
+CORK_API size_t
+cork_ring_buffer_add_many(struct cork_ring_buffer *buf,
+                          void * const *elements, size_t count);
+
+/* Pop up to count elements into dest, returning the number that were
+ * popped. */
+CORK_API size_t
+cork_ring_buffer_pop_many(struct cork_ring_buffer *buf,
+                          void **dest, size_t count);
+
+
+/*-----------------------------------------------------------------------
+ * Type-checked ring buffers
+ */
+
+/* A ring buffer that stores its elements inline, rather than as pointers.
+ * Its capacity is rounded up to the next power of two.  The add, pop, and
+ * peek operations are all macros that work directly on the items array. */
+
+struct cork_raw_ring {
+    void  *items;
+    /* The actual number of elements currently in the ring buffer. */
+    size_t  size;
+    size_t  allocated_size;
+    size_t  mask;
+    size_t  read_index;
+    size_t  write_index;
+};
+
+CORK_API void
+cork_raw_ring_init(struct cork_raw_ring *ring, size_t element_size,
+                   size_t size);
+
+CORK_API void
+cork_raw_ring_done(struct cork_raw_ring *ring, size_t element_size);
+
+#define cork_ring(T) \
+    struct { \
+        T  *items; \
+        size_t  size; \
+        size_t  allocated_size; \
+        size_t  mask; \
+        size_t  read_index; \
+        size_t  write_index; \
+    }
+
+#define cork_ring_element_size(ring)  (sizeof((ring)->items[0]))
+#define cork_ring_size(ring)      ((ring)->size)
+#define cork_ring_is_empty(ring)  ((ring)->size == 0)
+#define cork_ring_is_full(ring)   ((ring)->size == (ring)->allocated_size)
+#define cork_ring_to_raw(ring)    ((struct cork_raw_ring *) (void *) (ring))
+
+#define cork_ring_init(ring, sz) \
+    (cork_raw_ring_init(cork_ring_to_raw(ring), \
+                        cork_ring_element_size(ring), (sz)))
+#define cork_ring_done(ring) \
+    (cork_raw_ring_done(cork_ring_to_raw(ring), cork_ring_element_size(ring)))
+
+#define cork_ring_clear(ring) \
+    ((ring)->size = 0, (ring)->read_index = 0, (ring)->write_index = 0, \
+     (void) 0)
+
+/* Returns a pointer to the slot for a new element at the end of the ring
+ * buffer, or NULL if it's full. */
+#define cork_ring_add_get(ring) \
+    (cork_ring_is_full(ring)? NULL: \
+     &(ring)->items[((ring)->size++, \
+                     (ring)->write_index = \
+                        ((ring)->write_index + 1) & (ring)->mask, \
+                     ((ring)->write_index - 1) & (ring)->mask)])
+
+/* Copies element into the ring buffer.  Returns -1 if it's full. */
+#define cork_ring_add(ring, element) \
+    (cork_ring_is_full(ring)? -1: \
+     ((ring)->items[(ring)->write_index] = (element), \
+      (ring)->write_index = ((ring)->write_index + 1) & (ring)->mask, \
+      (ring)->size++, 0))
+
+/* Returns a pointer to the element at the head of the ring buffer, or NULL
+ * if it's empty. */
+#define cork_ring_peek(ring) \
+    (cork_ring_is_empty(ring)? NULL: &(ring)->items[(ring)->read_index])
+
+/* Copies the element at the head of the ring buffer into *dest, and removes
+ * it.  Returns -1 if the ring buffer is empty. */
+#define cork_ring_pop(ring, dest) \
+    (cork_ring_is_empty(ring)? -1: \
+     (*(dest) = (ring)->items[(ring)->read_index], \
+      (ring)->read_index = ((ring)->read_index + 1) & (ring)->mask, \
+      (ring)->size--, 0))
+
+/* Removes the element at the head of the ring buffer without copying it
+ * anywhere.  The ring buffer must not be empty. */
+#define cork_ring_skip(ring) \
+    ((ring)->read_index = ((ring)->read_index + 1) & (ring)->mask, \
+     (ring)->size--, (void) 0)
+
+
+/*-----------------------------------------------------------------------
+ * Concurrent ring buffers
+ */
+
+/* These can be shared between threads without any external locking.  Their
+ * sizes are rounded up to the next power of two.  Like the regular ring
+ * buffer, you can't store NULL in them, since that's how pop and peek tell
+ * you that the buffer is empty. */
+
+#define CORK_RING_BUFFER_CACHE_LINE  CORK_CACHELINE_SIZE
+
+/* A ring buffer with exactly one producer thread (which calls add) and one
+ * consumer thread (which calls pop and peek).  Neither side ever waits for
+ * the other.  Each side keeps its own index, along with a cached copy of the
+ * other side's, in its own cache line. */
+struct cork_spsc_ring_buffer {
+    void  **elements;
+    size_t  allocated_size;
+    size_t  mask;
+    char  padding0[CORK_RING_BUFFER_CACHE_LINE -
+                   sizeof(void **) - 2 * sizeof(size_t)];
+    /* Only written by the producer */
+    volatile size_t  write_index;
+    size_t  cached_read_index;
+    char  padding1[CORK_RING_BUFFER_CACHE_LINE - 2 * sizeof(size_t)];
+    /* Only written by the consumer */
+    volatile size_t  read_index;
+    size_t  cached_write_index;
+    char  padding2[CORK_RING_BUFFER_CACHE_LINE - 2 * sizeof(size_t)];
+};
+
+CORK_API int
+cork_spsc_ring_buffer_init(struct cork_spsc_ring_buffer *buf, size_t size);
+
+CORK_API struct cork_spsc_ring_buffer *
+cork_spsc_ring_buffer_new(size_t size);
+
+CORK_API void
+cork_spsc_ring_buffer_done(struct cork_spsc_ring_buffer *buf);
+
+CORK_API void
+cork_spsc_ring_buffer_free(struct cork_spsc_ring_buffer *buf);
+
+CORK_API int
+cork_spsc_ring_buffer_add(struct cork_spsc_ring_buffer *buf, void *element);
+
+CORK_API void *
+cork_spsc_ring_buffer_pop(struct cork_spsc_ring_buffer *buf);
+
+CORK_API void *
+cork_spsc_ring_buffer_peek(struct cork_spsc_ring_buffer *buf);
+
+
+/* A bounded ring buffer that any number of producers and consumers can use at
+ * the same time.  Each slot has a sequence number that tells threads whether
+ * it's ready to be written or read, so producers and consumers only contend
+ * with each other on their own index. */
+struct cork_mpmc_ring_buffer_cell {
+    volatile size_t  sequence;
+    void  *element;
+};
+
+struct cork_mpmc_ring_buffer {
+    struct cork_mpmc_ring_buffer_cell  *cells;
+    size_t  allocated_size;
+    size_t  mask;
+    char  padding0[CORK_RING_BUFFER_CACHE_LINE -
+                   sizeof(void *) - 2 * sizeof(size_t)];
+    volatile size_t  write_index;
+    char  padding1[CORK_RING_BUFFER_CACHE_LINE - sizeof(size_t)];
+    volatile size_t  read_index;
+    char  padding2[CORK_RING_BUFFER_CACHE_LINE - sizeof(size_t)];
+};
+
+CORK_API int
+cork_mpmc_ring_buffer_init(struct cork_mpmc_ring_buffer *buf, size_t size);
+
+CORK_API struct cork_mpmc_ring_buffer *
+cork_mpmc_ring_buffer_new(size_t size);
+
+CORK_API void
+cork_mpmc_ring_buffer_done(struct cork_mpmc_ring_buffer *buf);
+
+CORK_API void
+cork_mpmc_ring_buffer_free(struct cork_mpmc_ring_buffer *buf);
+
+/* Returns -1 if the buffer is full. */
+CORK_API int
+cork_mpmc_ring_buffer_add(struct cork_mpmc_ring_buffer *buf, void *element);
+
+/* Returns NULL if the buffer is empty. */
+CORK_API void *
+cork_mpmc_ring_buffer_pop(struct cork_mpmc_ring_buffer *buf);
+
+/* Returns the element that the next pop would return.  If there are other
+ * consumers, they might pop it out from under you, so this is only a hint. */
+CORK_API void *
+cork_mpmc_ring_buffer_peek(struct cork_mpmc_ring_buffer *buf);
+
 
 #endif /* LIBCORK_DS_RING_BUFFER_H */
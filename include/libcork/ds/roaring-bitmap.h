@@ -0,0 +1,117 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_ROARING_BITMAP_H
+#define LIBCORK_DS_ROARING_BITMAP_H
+
+
+#include <libcork/core/api.h>
+#include <libcork/core/types.h>
+#include <libcork/ds/buffer.h>
+#include <libcork/ds/slice.h>
+
+
+/*-----------------------------------------------------------------------
+ * Compressed bitmaps
+ */
+
+/* A set of 32-bit integers, stored as a "Roaring" bitmap.  We split the
+ * integers into chunks that share the same upper 16 bits, and store each chunk
+ * in whichever container is smallest: a sorted array of the lower 16 bits, a
+ * 65536-bit bitmap, or a list of runs.  Sparse sets take up a small fraction of
+ * the space of a cork_bitset, while dense sets take up hardly any more. */
+struct cork_roaring_bitmap;
+
+CORK_API struct cork_roaring_bitmap *
+cork_roaring_bitmap_new(void);
+
+CORK_API void
+cork_roaring_bitmap_free(struct cork_roaring_bitmap *bitmap);
+
+CORK_API void
+cork_roaring_bitmap_clear(struct cork_roaring_bitmap *bitmap);
+
+/* Return whether value was newly added (or removed). */
+CORK_API bool
+cork_roaring_bitmap_add(struct cork_roaring_bitmap *bitmap, uint32_t value);
+
+CORK_API bool
+cork_roaring_bitmap_remove(struct cork_roaring_bitmap *bitmap, uint32_t value);
+
+/* Add every value from start (inclusive) to end (exclusive).  end can be as
+ * large as 2^32. */
+CORK_API void
+cork_roaring_bitmap_add_range(struct cork_roaring_bitmap *bitmap,
+                              uint64_t start, uint64_t end);
+
+CORK_API bool
+cork_roaring_bitmap_contains(const struct cork_roaring_bitmap *bitmap,
+                             uint32_t value);
+
+/* Return the number of values in the set. */
+CORK_API uint64_t
+cork_roaring_bitmap_count(const struct cork_roaring_bitmap *bitmap);
+
+/* Find the smallest value in the set that is at least start.  Returns false if
+ * there isn't one. */
+CORK_API bool
+cork_roaring_bitmap_find_next(const struct cork_roaring_bitmap *bitmap,
+                              uint64_t start, uint32_t *dest);
+
+#define cork_roaring_bitmap_foreach(bitmap, value) \
+    for (bool cork_roaring_bitmap__found = \
+             cork_roaring_bitmap_find_next((bitmap), 0, &(value)); \
+         cork_roaring_bitmap__found; \
+         cork_roaring_bitmap__found = cork_roaring_bitmap_find_next \
+             ((bitmap), (uint64_t) (value) + 1, &(value)))
+
+/* Update dest to be its union (or intersection) with src. */
+CORK_API void
+cork_roaring_bitmap_or(struct cork_roaring_bitmap *dest,
+                       const struct cork_roaring_bitmap *src);
+
+CORK_API void
+cork_roaring_bitmap_and(struct cork_roaring_bitmap *dest,
+                        const struct cork_roaring_bitmap *src);
+
+/* Convert each container into a list of runs if that would be smaller. */
+CORK_API void
+cork_roaring_bitmap_run_optimize(struct cork_roaring_bitmap *bitmap);
+
+/* The number of bytes of memory that the containers use */
+CORK_API size_t
+cork_roaring_bitmap_memory_size(const struct cork_roaring_bitmap *bitmap);
+
+
+/*-----------------------------------------------------------------------
+ * Serialization
+ */
+
+/* The serialized form is a small header and a fixed-size descriptor for each
+ * container, followed by each container's contents, all in little-endian
+ * order, and with each container aligned to 8 bytes. */
+
+CORK_API size_t
+cork_roaring_bitmap_serialized_size(const struct cork_roaring_bitmap *bitmap);
+
+CORK_API void
+cork_roaring_bitmap_serialize(const struct cork_roaring_bitmap *bitmap,
+                              struct cork_buffer *dest);
+
+/* Create a bitmap from its serialized form.  If src is 8-byte aligned and we're
+ * on a little-endian machine, the bitmap's containers point directly into
+ * src's content, so this doesn't copy any data, and works well with a slice
+ * that points into an mmap-ed file.  (We keep our own reference to src, and we
+ * only copy a container when you modify it.)  Returns NULL with an error
+ * condition if src isn't a valid serialized bitmap. */
+CORK_API struct cork_roaring_bitmap *
+cork_roaring_bitmap_deserialize(const struct cork_slice *src);
+
+
+#endif /* LIBCORK_DS_ROARING_BITMAP_H */
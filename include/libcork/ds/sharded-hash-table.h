@@ -0,0 +1,178 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_SHARDED_HASH_TABLE_H
+#define LIBCORK_DS_SHARDED_HASH_TABLE_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/callbacks.h>
+#include <libcork/core/hash.h>
+#include <libcork/core/types.h>
+#include <libcork/ds/hash-table.h>
+
+
+/*-----------------------------------------------------------------------
+ * Sharded hash tables
+ */
+
+/* A hash table that any number of threads can read from and write to.  The
+ * entries are split across several independent cork_hash_table shards, chosen
+ * by the high bits of each key's hash, and each shard has its own lock and its
+ * own pool of entries.  Threads only contend with each other when they touch
+ * keys in the same shard, so write throughput scales with the number of
+ * shards, rather than being limited by a single lock.  The flags are the same
+ * as for cork_hash_table_new, and apply to each shard. */
+
+struct cork_sharded_hash_table;
+
+/* shard_count is rounded up to a power of two; pass in 0 to use
+ * CORK_SHARDED_HASH_TABLE_DEFAULT_SHARD_COUNT.  initial_size is the initial
+ * size of the entire table, not of each shard. */
+#define CORK_SHARDED_HASH_TABLE_DEFAULT_SHARD_COUNT  64
+
+CORK_API struct cork_sharded_hash_table *
+cork_sharded_hash_table_new(size_t shard_count, size_t initial_size,
+                            unsigned int flags);
+
+CORK_API void
+cork_sharded_hash_table_free(struct cork_sharded_hash_table *table);
+
+CORK_API size_t
+cork_sharded_hash_table_shard_count(struct cork_sharded_hash_table *table);
+
+
+/* These must be called before the table is shared with any other threads. */
+
+CORK_API void
+cork_sharded_hash_table_set_user_data(struct cork_sharded_hash_table *table,
+                                      void *user_data,
+                                      cork_free_f free_user_data);
+
+CORK_API void
+cork_sharded_hash_table_set_equals(struct cork_sharded_hash_table *table,
+                                   cork_equals_f equals);
+
+CORK_API void
+cork_sharded_hash_table_set_free_key(struct cork_sharded_hash_table *table,
+                                     cork_free_f free);
+
+CORK_API void
+cork_sharded_hash_table_set_free_value(struct cork_sharded_hash_table *table,
+                                       cork_free_f free);
+
+CORK_API void
+cork_sharded_hash_table_set_hash(struct cork_sharded_hash_table *table,
+                                 cork_hash_f hash);
+
+CORK_API void
+cork_sharded_hash_table_set_hash64(struct cork_sharded_hash_table *table,
+                                   cork_hash64_f hash);
+
+
+/* Each of these locks the key's shard for the duration of the call.  Since
+ * another thread might delete or replace an entry as soon as the shard is
+ * unlocked, you need to coordinate the lifetime of the values that you
+ * retrieve yourself (or use the _lock_entry functions below). */
+
+CORK_API void *
+cork_sharded_hash_table_get(struct cork_sharded_hash_table *table,
+                            const void *key);
+
+CORK_API void *
+cork_sharded_hash_table_get_hash64(struct cork_sharded_hash_table *table,
+                                   cork_hash64 hash, const void *key);
+
+CORK_API bool
+cork_sharded_hash_table_contains(struct cork_sharded_hash_table *table,
+                                 const void *key);
+
+CORK_API void
+cork_sharded_hash_table_put(struct cork_sharded_hash_table *table,
+                            void *key, void *value,
+                            bool *is_new, void **old_key, void **old_value);
+
+CORK_API void
+cork_sharded_hash_table_put_hash64(struct cork_sharded_hash_table *table,
+                                   cork_hash64 hash, void *key, void *value,
+                                   bool *is_new,
+                                   void **old_key, void **old_value);
+
+CORK_API bool
+cork_sharded_hash_table_delete(struct cork_sharded_hash_table *table,
+                               const void *key,
+                               void **deleted_key, void **deleted_value);
+
+CORK_API bool
+cork_sharded_hash_table_delete_hash64(struct cork_sharded_hash_table *table,
+                                      cork_hash64 hash, const void *key,
+                                      void **deleted_key, void **deleted_value);
+
+/* Returns the number of entries in the table.  If other threads are modifying
+ * the table, this might already be out of date. */
+CORK_API size_t
+cork_sharded_hash_table_size(struct cork_sharded_hash_table *table);
+
+CORK_API void
+cork_sharded_hash_table_clear(struct cork_sharded_hash_table *table);
+
+
+/* Looks up (and if necessary creates) the entry for key, and returns it with
+ * its shard still locked, so that you can safely read and update the entry's
+ * value.  You must call cork_sharded_hash_table_unlock_entry when you're done
+ * with the entry, and must not call any other function on this table in
+ * between. */
+
+CORK_API struct cork_hash_table_entry *
+cork_sharded_hash_table_lock_entry(struct cork_sharded_hash_table *table,
+                                   void *key, bool *is_new);
+
+CORK_API struct cork_hash_table_entry *
+cork_sharded_hash_table_lock_entry_hash64
+(struct cork_sharded_hash_table *table, cork_hash64 hash, void *key,
+ bool *is_new);
+
+CORK_API void
+cork_sharded_hash_table_unlock_entry(struct cork_sharded_hash_table *table,
+                                     struct cork_hash_table_entry *entry);
+
+
+/* Visits every entry in every shard.  Each shard is locked while its entries
+ * are visited, so the callback must not call any other function on this
+ * table.  There's no guarantee about the order that the entries are visited
+ * in, or about whether an entry added or removed in another thread during the
+ * map is visited. */
+CORK_API void
+cork_sharded_hash_table_map(struct cork_sharded_hash_table *table,
+                            void *user_data, cork_hash_table_map_f mapper);
+
+/* Iterators hold onto the lock of the shard that they're currently visiting,
+ * which they release automatically once you reach the end of the table.  If
+ * you stop early, you must call cork_sharded_hash_table_iterator_done.  (It's
+ * always safe to call it.) */
+struct cork_sharded_hash_table_iterator {
+    struct cork_sharded_hash_table  *table;
+    size_t  shard_index;
+    struct cork_hash_table_iterator  shard_iterator;
+};
+
+CORK_API void
+cork_sharded_hash_table_iterator_init
+(struct cork_sharded_hash_table *table,
+ struct cork_sharded_hash_table_iterator *iterator);
+
+CORK_API struct cork_hash_table_entry *
+cork_sharded_hash_table_iterator_next
+(struct cork_sharded_hash_table_iterator *iterator);
+
+CORK_API void
+cork_sharded_hash_table_iterator_done
+(struct cork_sharded_hash_table_iterator *iterator);
+
+
+#endif /* LIBCORK_DS_SHARDED_HASH_TABLE_H */
@@ -0,0 +1,162 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_SKETCH_H
+#define LIBCORK_DS_SKETCH_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/hash.h>
+#include <libcork/core/types.h>
+#include <libcork/ds/buffer.h>
+#include <libcork/ds/slice.h>
+
+
+/*-----------------------------------------------------------------------
+ * Error handling
+ */
+
+/* Two sketches can't be merged because they have different shapes or
+ * seeds */
+#define CORK_SKETCH_MISMATCH  0x5cb1d5a8
+
+
+/*-----------------------------------------------------------------------
+ * Blocked Bloom filters
+ */
+
+/* A Bloom filter whose bits are divided into 512-bit blocks, each one cache
+ * line long.  Each key sets one bit in each of the 8 64-bit words of a single
+ * block, so adding or testing a key touches exactly one cache line, and the
+ * membership test is a single vector comparison on platforms that support
+ * it.
+ *
+ * Keys are hashed with cork_hash64_buffer using the filter's seed.  If you
+ * already have a good 64-bit hash of a key, you can use the _hash variants
+ * instead; the block is chosen by the high 32 bits of the hash, and the bits
+ * within the block by the low 32 bits. */
+
+struct cork_bloom_filter;
+
+/* Sizes the filter to hold expected_count keys with bits_per_key bits each.
+ * With 8 bits per key, you can expect a false positive rate of about 3%; with
+ * 10, about 1%; with 16, about 0.1%. */
+CORK_API struct cork_bloom_filter *
+cork_bloom_filter_new(size_t expected_count, unsigned int bits_per_key,
+                      cork_hash seed);
+
+CORK_API void
+cork_bloom_filter_free(struct cork_bloom_filter *filter);
+
+CORK_API void
+cork_bloom_filter_clear(struct cork_bloom_filter *filter);
+
+/* Returns the size of the filter's bit array, in bytes. */
+CORK_API size_t
+cork_bloom_filter_byte_size(const struct cork_bloom_filter *filter);
+
+CORK_API void
+cork_bloom_filter_add_hash(struct cork_bloom_filter *filter, cork_hash64 hash);
+
+CORK_API bool
+cork_bloom_filter_contains_hash(const struct cork_bloom_filter *filter,
+                                cork_hash64 hash);
+
+CORK_API void
+cork_bloom_filter_add(struct cork_bloom_filter *filter,
+                      const void *src, size_t len);
+
+CORK_API bool
+cork_bloom_filter_contains(const struct cork_bloom_filter *filter,
+                           const void *src, size_t len);
+
+/* Adds every key from src into dest.  Both filters must have the same size and
+ * seed. */
+CORK_API int
+cork_bloom_filter_merge(struct cork_bloom_filter *dest,
+                        const struct cork_bloom_filter *src);
+
+/* All of the values are big-endian, so a serialized filter can be read on any
+ * platform. */
+CORK_API void
+cork_bloom_filter_save(const struct cork_bloom_filter *filter,
+                       struct cork_buffer *dest);
+
+/* Returns NULL and fills in a parse error if src isn't a valid serialized
+ * filter. */
+CORK_API struct cork_bloom_filter *
+cork_bloom_filter_load(const struct cork_slice *src);
+
+
+/*-----------------------------------------------------------------------
+ * Count-min sketches
+ */
+
+/* Estimates how many times each key has been added, in a fixed amount of
+ * memory.  The sketch has depth rows of width counters each; each key maps to
+ * one counter in each row, and its estimate is the smallest of them.  An
+ * estimate is never smaller than the true count, and with a total of N
+ * additions, exceeds it by more than 2N/width with probability at most
+ * 2^-depth.
+ *
+ * We use conservative update: adding a key only raises the counters that are
+ * below the key's new estimate, which makes estimates noticeably tighter for
+ * skewed (heavy-hitter) workloads.  Counters saturate at UINT32_MAX. */
+
+struct cork_count_min_sketch;
+
+/* width is rounded up to a power of two.  depth must be between 1 and
+ * CORK_COUNT_MIN_SKETCH_MAX_DEPTH. */
+#define CORK_COUNT_MIN_SKETCH_MAX_DEPTH  16
+
+CORK_API struct cork_count_min_sketch *
+cork_count_min_sketch_new(size_t width, unsigned int depth, cork_hash seed);
+
+CORK_API void
+cork_count_min_sketch_free(struct cork_count_min_sketch *sketch);
+
+CORK_API void
+cork_count_min_sketch_clear(struct cork_count_min_sketch *sketch);
+
+/* Returns the sum of every count that has been added to the sketch. */
+CORK_API uint64_t
+cork_count_min_sketch_total(const struct cork_count_min_sketch *sketch);
+
+/* Adds count occurrences of the key, and returns its new estimate. */
+CORK_API uint32_t
+cork_count_min_sketch_add_hash(struct cork_count_min_sketch *sketch,
+                               cork_hash64 hash, uint32_t count);
+
+CORK_API uint32_t
+cork_count_min_sketch_estimate_hash(const struct cork_count_min_sketch *sketch,
+                                    cork_hash64 hash);
+
+CORK_API uint32_t
+cork_count_min_sketch_add(struct cork_count_min_sketch *sketch,
+                          const void *src, size_t len, uint32_t count);
+
+CORK_API uint32_t
+cork_count_min_sketch_estimate(const struct cork_count_min_sketch *sketch,
+                               const void *src, size_t len);
+
+/* Adds every count from src into dest.  Both sketches must have the same
+ * shape and seed.  The merged estimates are still never too small, but are
+ * no longer as tight as conservative update would have made them. */
+CORK_API int
+cork_count_min_sketch_merge(struct cork_count_min_sketch *dest,
+                            const struct cork_count_min_sketch *src);
+
+CORK_API void
+cork_count_min_sketch_save(const struct cork_count_min_sketch *sketch,
+                           struct cork_buffer *dest);
+
+CORK_API struct cork_count_min_sketch *
+cork_count_min_sketch_load(const struct cork_slice *src);
+
+
+#endif /* LIBCORK_DS_SKETCH_H */
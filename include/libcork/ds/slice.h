@@ -11,7 +11,11 @@
 #ifndef LIBCORK_DS_SLICE_H
 #define LIBCORK_DS_SLICE_H
 
+#include <sys/uio.h>
+
 #include <libcork/core/api.h>
+#include <libcork/core/attributes.h>
+#include <libcork/core/byte-order.h>
 #include <libcork/core/types.h>
 
 
@@ -24,7 +28,11 @@
 
 enum cork_slice_error {
     /* Trying to slice a nonexistent subset of a buffer */
-    CORK_SLICE_INVALID_SLICE
+    CORK_SLICE_INVALID_SLICE,
+    /* Trying to read past the end of a slice */
+    CORK_SLICE_TRUNCATED,
+    /* A varint that's longer than 64 bits */
+    CORK_SLICE_INVALID_VARINT
 };
 
 
@@ -77,6 +85,64 @@ struct cork_slice {
 };
 
 
+/* The built-in slice implementations.  The inline fast paths below recognize
+ * these directly, so that copying the most common kinds of slice doesn't need
+ * any indirect calls.  A borrowed slice points into a managed buffer without
+ * holding a reference to it.  Light copies of managed-buffer slices are
+ * borrowed; full copies of borrowed slices take out their own reference. */
+CORK_API extern struct cork_slice_iface  cork_slice__static;
+CORK_API extern struct cork_slice_iface  cork_slice__managed;
+CORK_API extern struct cork_slice_iface  cork_slice__borrowed;
+
+/* Also declared in libcork/ds/managed-buffer.h */
+struct cork_managed_buffer;
+
+CORK_API struct cork_managed_buffer *
+cork_managed_buffer_ref(struct cork_managed_buffer *buf);
+
+CORK_ATTR_UNUSED
+static inline int
+cork_slice__copy(struct cork_slice *dest, const struct cork_slice *src,
+                 size_t offset, size_t length)
+{
+    struct cork_slice_iface  *iface = src->iface;
+    const void  *buf = src->buf + offset;
+    if (CORK_LIKELY(iface == &cork_slice__managed ||
+                    iface == &cork_slice__borrowed)) {
+        dest->iface = &cork_slice__managed;
+        dest->user_data = cork_managed_buffer_ref(src->user_data);
+    } else if (iface == &cork_slice__static) {
+        dest->iface = iface;
+        dest->user_data = NULL;
+    } else {
+        return iface->copy(dest, src, offset, length);
+    }
+    dest->buf = buf;
+    dest->size = length;
+    return 0;
+}
+
+CORK_ATTR_UNUSED
+static inline int
+cork_slice__light_copy(struct cork_slice *dest, const struct cork_slice *src,
+                       size_t offset, size_t length)
+{
+    struct cork_slice_iface  *iface = src->iface;
+    if (CORK_LIKELY(iface == &cork_slice__managed ||
+                    iface == &cork_slice__borrowed)) {
+        dest->iface = &cork_slice__borrowed;
+    } else if (iface == &cork_slice__static) {
+        dest->iface = iface;
+    } else {
+        return iface->light_copy(dest, src, offset, length);
+    }
+    dest->buf = src->buf + offset;
+    dest->size = length;
+    dest->user_data = src->user_data;
+    return 0;
+}
+
+
 CORK_API void
 cork_slice_clear(struct cork_slice *slice);
 
@@ -88,14 +154,14 @@ cork_slice_copy(struct cork_slice *dest, const struct cork_slice *slice,
                 size_t offset, size_t length);
 
 #define cork_slice_copy_fast(dest, slice, offset, length) \
-    ((slice)->iface->copy((dest), (slice), (offset), (length)))
+    (cork_slice__copy((dest), (slice), (offset), (length)))
 
 CORK_API int
 cork_slice_copy_offset(struct cork_slice *dest, const struct cork_slice *slice,
                        size_t offset);
 
 #define cork_slice_copy_offset_fast(dest, slice, offset) \
-    ((slice)->iface->copy \
+    (cork_slice__copy \
      ((dest), (slice), (offset), (slice)->size - (offset)))
 
 
@@ -104,14 +170,14 @@ cork_slice_light_copy(struct cork_slice *dest, const struct cork_slice *slice,
                       size_t offset, size_t length);
 
 #define cork_slice_light_copy_fast(dest, slice, offset, length) \
-    ((slice)->iface->light_copy((dest), (slice), (offset), (length)))
+    (cork_slice__light_copy((dest), (slice), (offset), (length)))
 
 CORK_API int
 cork_slice_light_copy_offset(struct cork_slice *dest,
                              const struct cork_slice *slice, size_t offset);
 
 #define cork_slice_light_copy_offset_fast(dest, slice, offset) \
-    ((slice)->iface->light_copy \
+    (cork_slice__light_copy \
      ((dest), (slice), (offset), (slice)->size - (offset)))
 
 
@@ -148,4 +214,168 @@ cork_slice_init_copy_once(struct cork_slice *dest, const void *buf,
                           size_t size);
 
 
+
+/*-----------------------------------------------------------------------
+ * Slice vectors
+ */
+
+/* A list of slices, which can be written out together with a single vectored
+ * I/O call, without copying them into a contiguous buffer first. */
+
+struct cork_slice_vec {
+    /* The slices in the vector.  Each one is a separate copy, and so holds
+     * its own reference to its underlying buffer. */
+    struct cork_slice  *slices;
+    /* The number of slices in the vector. */
+    size_t  count;
+    /* The number of slices that we've allocated space for. */
+    size_t  allocated_count;
+    /* The total size of all of the slices. */
+    size_t  size;
+};
+
+#define CORK_SLICE_VEC_INIT()  { NULL, 0, 0, 0 }
+
+CORK_API void
+cork_slice_vec_init(struct cork_slice_vec *vec);
+
+CORK_API void
+cork_slice_vec_done(struct cork_slice_vec *vec);
+
+/* Finish all of the slices in the vector, leaving it empty. */
+CORK_API void
+cork_slice_vec_clear(struct cork_slice_vec *vec);
+
+/* Add a copy of slice to the end of the vector. */
+CORK_API int
+cork_slice_vec_append(struct cork_slice_vec *vec,
+                      const struct cork_slice *slice);
+
+/* Move slice to the end of the vector.  slice will be cleared, and you
+ * don't need to finish it yourself. */
+CORK_API void
+cork_slice_vec_append_move(struct cork_slice_vec *vec,
+                           struct cork_slice *slice);
+
+/* Fills in up to count iovecs with the vector's slices, starting with the
+ * one at index start.  Returns the number of iovecs that were filled in. */
+CORK_API size_t
+cork_slice_vec_iovec(const struct cork_slice_vec *vec, size_t start,
+                     struct iovec *iov, size_t count);
+
+/* Write all of the slices in the vector to fd, using as few writev calls as
+ * possible. */
+CORK_API int
+cork_slice_vec_write_fd(const struct cork_slice_vec *vec, int fd);
+
+/* Send all of the slices in the vector to a socket, using as few sendmsg
+ * calls as possible. */
+CORK_API int
+cork_slice_vec_sendmsg(const struct cork_slice_vec *vec, int fd, int flags);
+
+
+/*-----------------------------------------------------------------------
+ * Slice readers
+ */
+
+/* A cursor that decodes binary values from a slice, in order.  The checked
+ * functions return -1 (and leave the reader where it was) if there isn't
+ * enough data left.  If you're about to read a batch of fixed-width values,
+ * you can instead check once with cork_slice_reader_require, and then use
+ * the _fast variants, which don't check anything. */
+
+struct cork_slice_reader {
+    /* The slice that we're reading from */
+    const struct cork_slice  *slice;
+    /* The next byte to read */
+    const uint8_t  *pos;
+    /* The end of the slice */
+    const uint8_t  *end;
+};
+
+CORK_API void
+cork_slice_reader_init(struct cork_slice_reader *reader,
+                       const struct cork_slice *slice);
+
+#define cork_slice_reader_remaining(reader) \
+    ((size_t) ((reader)->end - (reader)->pos))
+
+#define cork_slice_reader_offset(reader) \
+    ((size_t) ((reader)->pos - (const uint8_t *) (reader)->slice->buf))
+
+#define cork_slice_reader_is_empty(reader)  ((reader)->pos == (reader)->end)
+
+/* Fills in an error and returns -1. */
+CORK_API int
+cork_slice_reader_truncated(const struct cork_slice_reader *reader,
+                            size_t length);
+
+/* Make sure that there are at least length bytes left. */
+#define cork_slice_reader_require(reader, length) \
+    (CORK_LIKELY(cork_slice_reader_remaining(reader) >= (length))? 0: \
+     cork_slice_reader_truncated((reader), (length)))
+
+#define cork_slice_reader_define_int(bits, name, load) \
+CORK_ATTR_UNUSED \
+static inline uint##bits##_t \
+cork_slice_reader_##name##_fast(struct cork_slice_reader *reader) \
+{ \
+    uint##bits##_t  value = load(reader->pos); \
+    reader->pos += bits / 8; \
+    return value; \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline int \
+cork_slice_reader_##name(struct cork_slice_reader *reader, \
+                         uint##bits##_t *dest) \
+{ \
+    if (CORK_UNLIKELY(cork_slice_reader_remaining(reader) < bits / 8)) { \
+        return cork_slice_reader_truncated(reader, bits / 8); \
+    } \
+    *dest = cork_slice_reader_##name##_fast(reader); \
+    return 0; \
+}
+
+#define cork_slice_reader_load_u8(src)  (*(const uint8_t *) (src))
+
+cork_slice_reader_define_int(8, u8, cork_slice_reader_load_u8)
+cork_slice_reader_define_int(16, be16, cork_load_be16)
+cork_slice_reader_define_int(32, be32, cork_load_be32)
+cork_slice_reader_define_int(64, be64, cork_load_be64)
+cork_slice_reader_define_int(16, le16, cork_load_le16)
+cork_slice_reader_define_int(32, le32, cork_load_le32)
+cork_slice_reader_define_int(64, le64, cork_load_le64)
+
+#undef cork_slice_reader_define_int
+
+/* An unsigned LEB128 varint: 7 bits per byte, least significant group first,
+ * with the high bit set on every byte but the last. */
+CORK_API int
+cork_slice_reader_varint(struct cork_slice_reader *reader, uint64_t *dest);
+
+CORK_API int
+cork_slice_reader_skip(struct cork_slice_reader *reader, size_t length);
+
+/* Reads the next length bytes as a light copy of the underlying slice, so
+ * nothing is copied, but dest can't outlive the slice we're reading. */
+CORK_API int
+cork_slice_reader_slice(struct cork_slice_reader *reader, size_t length,
+                        struct cork_slice *dest);
+
+/* Reads a length (as a big-endian or varint integer), followed by that many
+ * bytes, which are returned as a light copy. */
+CORK_API int
+cork_slice_reader_prefixed_be16(struct cork_slice_reader *reader,
+                                struct cork_slice *dest);
+
+CORK_API int
+cork_slice_reader_prefixed_be32(struct cork_slice_reader *reader,
+                                struct cork_slice *dest);
+
+CORK_API int
+cork_slice_reader_prefixed_varint(struct cork_slice_reader *reader,
+                                  struct cork_slice *dest);
+
+
 #endif /* LIBCORK_DS_SLICE_H */
@@ -0,0 +1,257 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_SORT_H
+#define LIBCORK_DS_SORT_H
+
+
+#include <libcork/core/api.h>
+#include <libcork/core/attributes.h>
+#include <libcork/core/callbacks.h>
+#include <libcork/core/types.h>
+#include <libcork/ds/array.h>
+
+
+/*-----------------------------------------------------------------------
+ * Type-specialized sorting
+ */
+
+/* Arrays shorter than this are sorted with an insertion sort. */
+#define CORK_SORT_INSERTION_THRESHOLD  16
+
+#define CORK_SORT_LESS(a, b)  ((a) < (b))
+
+/* Defines a family of static functions that sort and search arrays of TYPE,
+ * using LESS(a, b) (an expression that's true if a should sort before b) to
+ * compare elements.  Since LESS is expanded inline, these are much faster
+ * than a qsort-style comparison callback.
+ *
+ *   void NAME(TYPE *items, size_t count);
+ *   size_t NAME_lower_bound(const TYPE *items, size_t count, TYPE key);
+ *   bool NAME_contains(const TYPE *items, size_t count, TYPE key);
+ *
+ * NAME is an introsort: a quicksort with median-of-three pivots (and Tukey's
+ * ninther for large arrays), which falls back on a heapsort if it recurses
+ * too deeply, and on an insertion sort for small subarrays.  It isn't stable.
+ * NAME_lower_bound is a branchless binary search, which returns the index of
+ * the first element that doesn't sort before key. */
+#define cork_sort_define(TYPE, NAME, LESS) \
+CORK_ATTR_UNUSED \
+static inline void \
+NAME##__insertion(TYPE *items, size_t count) \
+{ \
+    size_t  i; \
+    for (i = 1; i < count; i++) { \
+        TYPE  value = items[i]; \
+        size_t  j = i; \
+        while (j > 0 && LESS(value, items[j - 1])) { \
+            items[j] = items[j - 1]; \
+            j--; \
+        } \
+        items[j] = value; \
+    } \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+NAME##__sift_down(TYPE *items, size_t start, size_t count) \
+{ \
+    TYPE  value = items[start]; \
+    size_t  child; \
+    while ((child = 2 * start + 1) < count) { \
+        if (child + 1 < count && LESS(items[child], items[child + 1])) { \
+            child++; \
+        } \
+        if (!LESS(value, items[child])) { \
+            break; \
+        } \
+        items[start] = items[child]; \
+        start = child; \
+    } \
+    items[start] = value; \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+NAME##__heapsort(TYPE *items, size_t count) \
+{ \
+    size_t  i; \
+    for (i = count / 2; i > 0; i--) { \
+        NAME##__sift_down(items, i - 1, count); \
+    } \
+    for (i = count - 1; i > 0; i--) { \
+        TYPE  tmp = items[0]; \
+        items[0] = items[i]; \
+        items[i] = tmp; \
+        NAME##__sift_down(items, 0, i); \
+    } \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+NAME##__sort3(TYPE *items, size_t a, size_t b, size_t c) \
+{ \
+    TYPE  tmp; \
+    if (LESS(items[b], items[a])) { \
+        tmp = items[a]; items[a] = items[b]; items[b] = tmp; \
+    } \
+    if (LESS(items[c], items[b])) { \
+        tmp = items[b]; items[b] = items[c]; items[c] = tmp; \
+        if (LESS(items[b], items[a])) { \
+            tmp = items[a]; items[a] = items[b]; items[b] = tmp; \
+        } \
+    } \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+NAME##__introsort(TYPE *items, size_t count, unsigned int depth) \
+{ \
+    while (count > CORK_SORT_INSERTION_THRESHOLD) { \
+        size_t  mid = count / 2; \
+        size_t  i; \
+        size_t  j; \
+        TYPE  pivot; \
+        TYPE  tmp; \
+        if (depth == 0) { \
+            NAME##__heapsort(items, count); \
+            return; \
+        } \
+        depth--; \
+        \
+        /* Move the pivot to the middle. */ \
+        if (count > 128) { \
+            size_t  step = count / 8; \
+            NAME##__sort3(items, 0, step, 2 * step); \
+            NAME##__sort3(items, mid - step, mid, mid + step); \
+            NAME##__sort3(items, count - 1 - 2 * step, count - 1 - step, \
+                          count - 1); \
+            NAME##__sort3(items, step, mid, count - 1 - step); \
+        } else { \
+            NAME##__sort3(items, 0, mid, count - 1); \
+        } \
+        pivot = items[mid]; \
+        \
+        /* Hoare partition */ \
+        i = 0; \
+        j = count - 1; \
+        for (;;) { \
+            while (LESS(items[i], pivot)) { \
+                i++; \
+            } \
+            while (LESS(pivot, items[j])) { \
+                j--; \
+            } \
+            if (i >= j) { \
+                break; \
+            } \
+            tmp = items[i]; items[i] = items[j]; items[j] = tmp; \
+            i++; \
+            j--; \
+        } \
+        \
+        /* Recurse into the smaller half, and loop on the larger one. */ \
+        j++; \
+        if (j < count - j) { \
+            NAME##__introsort(items, j, depth); \
+            items += j; \
+            count -= j; \
+        } else { \
+            NAME##__introsort(items + j, count - j, depth); \
+            count = j; \
+        } \
+    } \
+    NAME##__insertion(items, count); \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline void \
+NAME(TYPE *items, size_t count) \
+{ \
+    unsigned int  depth = 0; \
+    size_t  n; \
+    for (n = count; n > 1; n >>= 1) { \
+        depth += 2; \
+    } \
+    NAME##__introsort(items, count, depth); \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline size_t \
+NAME##_lower_bound(const TYPE *items, size_t count, TYPE key) \
+{ \
+    const TYPE  *base = items; \
+    if (count == 0) { \
+        return 0; \
+    } \
+    while (count > 1) { \
+        size_t  half = count / 2; \
+        base = LESS(base[half], key)? base + half: base; \
+        count -= half; \
+    } \
+    return (base - items) + LESS(*base, key); \
+} \
+\
+CORK_ATTR_UNUSED \
+static inline bool \
+NAME##_contains(const TYPE *items, size_t count, TYPE key) \
+{ \
+    size_t  index = NAME##_lower_bound(items, count, key); \
+    return index < count && !LESS(key, items[index]); \
+}
+
+/* Sort or search a cork_array using functions defined by cork_sort_define. */
+#define cork_array_sort(arr, NAME) \
+    (NAME((arr)->items, (arr)->size))
+#define cork_array_lower_bound(arr, NAME, key) \
+    (NAME##_lower_bound((arr)->items, (arr)->size, (key)))
+#define cork_array_contains(arr, NAME, key) \
+    (NAME##_contains((arr)->items, (arr)->size, (key)))
+
+
+/*-----------------------------------------------------------------------
+ * Integer sorting
+ */
+
+/* Sort an array of unsigned integers with an LSD radix sort, which needs
+ * count elements of temporary space, but doesn't compare any elements.  We
+ * skip any byte that's the same in every element, so small keys are cheap. */
+CORK_API void
+cork_sort_uint32(uint32_t *items, size_t count);
+
+CORK_API void
+cork_sort_uint64(uint64_t *items, size_t count);
+
+
+/*-----------------------------------------------------------------------
+ * Generic sorting
+ */
+
+/* These work on any kind of element, but call compare for every comparison. */
+
+CORK_API void
+cork_sort(void *items, size_t count, size_t element_size,
+          void *user_data, cork_compare_f compare);
+
+/* Returns the index of the first element that compares greater than or equal
+ * to key. */
+CORK_API size_t
+cork_lower_bound(const void *items, size_t count, size_t element_size,
+                 const void *key, void *user_data, cork_compare_f compare);
+
+#define cork_raw_array_sort(array, ud, compare) \
+    (cork_sort((array)->items, (array)->size, \
+               cork_raw_array_element_size((array)), (ud), (compare)))
+#define cork_raw_array_lower_bound(array, key, ud, compare) \
+    (cork_lower_bound((array)->items, (array)->size, \
+                      cork_raw_array_element_size((array)), \
+                      (key), (ud), (compare)))
+
+
+#endif /* LIBCORK_DS_SORT_H */
@@ -14,7 +14,9 @@
 #include <stdio.h>
 
 #include <libcork/core/api.h>
+#include <libcork/core/hash.h>
 #include <libcork/core/types.h>
+#include <libcork/ds/slice.h>
 
 
 struct cork_stream_consumer {
@@ -27,12 +29,40 @@ struct cork_stream_consumer {
 
     void
     (*free)(struct cork_stream_consumer *consumer);
+
+    /* Process several chunks of data at once.  is_first_chunk applies to
+     * the first slice.  The slices are only valid for the duration of the
+     * call.  This method is opt-in: we only look at it if data is
+     * cork_stream_consumer_data_via_vec.  Consumers that were written before
+     * this field existed don't have to fill it in. */
+    int
+    (*data_vec)(struct cork_stream_consumer *consumer,
+                const struct cork_slice *slices, size_t count,
+                bool is_first_chunk);
 };
 
 
 #define cork_stream_consumer_data(consumer, buf, size, is_first) \
     ((consumer)->data((consumer), (buf), (size), (is_first)))
 
+/* Pass several chunks of data to a consumer, using its data_vec method if
+ * it has opted into one, and calling data once for each slice otherwise. */
+CORK_API int
+cork_stream_consumer_data_vec(struct cork_stream_consumer *consumer,
+                              const struct cork_slice *slices, size_t count,
+                              bool is_first_chunk);
+
+/* A consumer opts into vectored dispatch by using this as its data method,
+ * and filling in data_vec.  It passes each chunk to data_vec as a single
+ * slice. */
+CORK_API int
+cork_stream_consumer_data_via_vec(struct cork_stream_consumer *consumer,
+                                  const void *buf, size_t size,
+                                  bool is_first_chunk);
+
+#define cork_stream_consumer_has_data_vec(consumer) \
+    ((consumer)->data == cork_stream_consumer_data_via_vec)
+
 #define cork_stream_consumer_eof(consumer) \
     ((consumer)->eof((consumer)))
 
@@ -46,6 +76,31 @@ cork_consume_fd(struct cork_stream_consumer *consumer, int fd);
 CORK_API int
 cork_consume_file(struct cork_stream_consumer *consumer, FILE *fp);
 
+#define CORK_CONSUME_DEFAULT_BUFFER_SIZE  65536
+#define CORK_CONSUME_DEFAULT_MAX_BUFFER_SIZE  (1024 * 1024)
+
+/* Read into a heap-allocated buffer of buffer_size bytes.  Each time a read
+ * fills the buffer completely, we double its size, up to max_buffer_size.
+ * We also tell the kernel that we'll be reading the file sequentially. */
+CORK_API int
+cork_consume_fd_ex(struct cork_stream_consumer *consumer, int fd,
+                   size_t buffer_size, size_t max_buffer_size);
+
+CORK_API int
+cork_consume_file_ex(struct cork_stream_consumer *consumer, FILE *fp,
+                     size_t buffer_size, size_t max_buffer_size);
+
+#define CORK_CONSUME_ASYNC_DEFAULT_CHUNK_SIZE  (128 * 1024)
+#define CORK_CONSUME_ASYNC_DEFAULT_DEPTH  4
+
+/* Keep up to depth reads of chunk_size bytes outstanding at once, handing
+ * each chunk to the consumer in order as soon as it arrives.  Uses io_uring
+ * where it's available; otherwise (or if fd isn't a regular file) we fall
+ * back on cork_consume_fd_ex.  Pass 0 to use the default sizes. */
+CORK_API int
+cork_consume_fd_async(struct cork_stream_consumer *consumer, int fd,
+                      size_t chunk_size, size_t depth);
+
 CORK_API int
 cork_consume_file_from_path(struct cork_stream_consumer *consumer,
                             const char *path, int flags);
@@ -61,4 +116,54 @@ CORK_API struct cork_stream_consumer *
 cork_file_from_path_consumer_new(const char *path, int flags);
 
 
+/* When a buffered fd consumer should ask the kernel to write its data out to
+ * disk. */
+enum cork_fd_sync_policy {
+    /* Never; leave it up to the kernel. */
+    CORK_FD_SYNC_NONE,
+    /* At the end of the stream. */
+    CORK_FD_SYNC_ON_EOF,
+    /* Whenever you call cork_buffered_fd_consumer_flush, and at the end of
+     * the stream. */
+    CORK_FD_SYNC_ON_FLUSH
+};
+
+#define CORK_BUFFERED_FD_CONSUMER_DEFAULT_SIZE  65536
+
+/* A consumer that collects small chunks in a buffer of buffer_size bytes, and
+ * writes them to fd together.  Like cork_fd_consumer_new, it doesn't close
+ * fd.  Pass 0 for buffer_size to use the default. */
+CORK_API struct cork_stream_consumer *
+cork_buffered_fd_consumer_new(int fd, size_t buffer_size,
+                              enum cork_fd_sync_policy sync_policy);
+
+/* Write out everything that has been buffered so far.  consumer must have
+ * been created by cork_buffered_fd_consumer_new. */
+CORK_API int
+cork_buffered_fd_consumer_flush(struct cork_stream_consumer *consumer);
+
+
+/* The maximum number of chunks that can be waiting for a threaded tee
+ * branch before the producer has to wait for it to catch up. */
+#define CORK_TEE_CONSUMER_QUEUE_DEPTH  64
+
+/* A consumer that passes each chunk it receives to several other
+ * consumers. */
+CORK_API struct cork_stream_consumer *
+cork_tee_consumer_new(void);
+
+/* Add a new branch to a tee consumer, which takes control of consumer.  If
+ * threaded is true, the branch processes chunks in its own thread. */
+CORK_API int
+cork_tee_consumer_add(struct cork_stream_consumer *tee,
+                      struct cork_stream_consumer *consumer, bool threaded);
+
+
+/* A consumer that computes the big hash of the stream's contents, as
+ * cork_big_hash_buffer would, starting from seed.  The result is stored into
+ * dest at the end of the stream. */
+CORK_API struct cork_stream_consumer *
+cork_big_hash_consumer_new(cork_big_hash seed, cork_big_hash *dest);
+
+
 #endif /* LIBCORK_DS_STREAM_H */
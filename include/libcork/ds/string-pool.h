@@ -0,0 +1,70 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_STRING_POOL_H
+#define LIBCORK_DS_STRING_POOL_H
+
+
+#include <libcork/core/api.h>
+#include <libcork/core/hash.h>
+#include <libcork/core/types.h>
+
+
+/*-----------------------------------------------------------------------
+ * String pools
+ */
+
+/* A string pool stores exactly one copy of each distinct string that you
+ * intern into it, so two interned strings are equal if and only if their
+ * pointers are.  The copies are packed into large arena chunks, and stay valid
+ * (and never move) until the pool is freed.  Each interned string is
+ * NUL-terminated, so you can use it anywhere that expects a C string.
+ *
+ * Any number of threads can intern strings into the same pool.  Lookups of
+ * strings that are already in the pool don't take any locks; only adding a
+ * new string does. */
+
+struct cork_string_pool;
+
+CORK_API struct cork_string_pool *
+cork_string_pool_new(void);
+
+CORK_API void
+cork_string_pool_free(struct cork_string_pool *pool);
+
+/* Returns the pool's copy of str, adding it if needed. */
+CORK_API const char *
+cork_string_pool_intern(struct cork_string_pool *pool, const char *str);
+
+/* Returns the pool's copy of the len bytes at buf (which don't need to be
+ * NUL-terminated, and can contain NULs), adding it if needed. */
+CORK_API const char *
+cork_string_pool_intern_n(struct cork_string_pool *pool,
+                          const void *buf, size_t len);
+
+/* Returns the pool's copy of the len bytes at buf, or NULL if it hasn't been
+ * interned yet. */
+CORK_API const char *
+cork_string_pool_find(struct cork_string_pool *pool,
+                      const void *buf, size_t len);
+
+/* Returns the number of distinct strings in the pool. */
+CORK_API size_t
+cork_string_pool_size(struct cork_string_pool *pool);
+
+/* These only work on strings returned by a string pool, and are O(1). */
+
+CORK_API size_t
+cork_interned_length(const char *str);
+
+CORK_API cork_hash
+cork_interned_hash(const char *str);
+
+
+#endif /* LIBCORK_DS_STRING_POOL_H */
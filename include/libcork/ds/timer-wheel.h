@@ -0,0 +1,143 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_DS_TIMER_WHEEL_H
+#define LIBCORK_DS_TIMER_WHEEL_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/attributes.h>
+#include <libcork/core/callbacks.h>
+#include <libcork/core/timestamp.h>
+#include <libcork/core/types.h>
+#include <libcork/ds/dllist.h>
+
+
+/*-----------------------------------------------------------------------
+ * Timers
+ */
+
+/* A timer that you embed in your own struct, in the same way as a
+ * cork_dllist_item.  (Use cork_container_of to get from the timer back to
+ * your struct when it fires.)  A timer can be in at most one wheel at a
+ * time. */
+struct cork_timer {
+    struct cork_dllist_item  item;
+    /* The time that the timer was scheduled to expire.  Read-only. */
+    cork_timestamp  expires;
+    /* The tick that the timer expires on.  Internal. */
+    uint64_t  tick;
+};
+
+/* You must initialize a timer before scheduling it for the first time. */
+#define cork_timer_init(timer) \
+    do { \
+        (timer)->item.next = NULL; \
+        (timer)->item.prev = NULL; \
+        (timer)->expires = 0; \
+        (timer)->tick = 0; \
+    } while (0)
+
+#define cork_timer_is_scheduled(timer)  ((timer)->item.next != NULL)
+
+
+/*-----------------------------------------------------------------------
+ * Hierarchical timer wheels
+ */
+
+/* Keeps track of any number of timers, each of which fires once its
+ * expiration time has passed.  Time is divided into ticks of a fixed
+ * resolution, and the wheel has several levels of 64 slots each: level 0
+ * covers the next 64 ticks, level 1 the next 64 * 64, and so on, with enough
+ * levels to cover any tick.  Scheduling and cancelling a timer are O(1), and
+ * don't allocate any memory.  As time advances, the timers in each slot that
+ * comes due are either fired, or moved down to a lower level, so each timer
+ * is touched at most once per level.  Empty slots are skipped using a bitmap
+ * per level, so advancing across a long idle period is cheap, too.
+ *
+ * A timer fires on the first call to cork_timer_wheel_advance whose time is
+ * at or after the timer's expiration time; it might fire up to one tick late,
+ * but never early.  The wheel isn't thread-safe. */
+
+struct cork_timer_wheel;
+
+/* Called for each timer that expires.  The timer has already been removed
+ * from the wheel, so you can reschedule it, or free the struct that contains
+ * it.  You can also schedule and cancel other timers. */
+typedef void
+(*cork_timer_wheel_fire_f)(void *user_data, struct cork_timer *timer);
+
+/* Fills in the current time; used by cork_timer_wheel_poll.  The default
+ * uses cork_timestamp_init_monotonic_coarse. */
+typedef void
+(*cork_timer_wheel_clock_f)(void *user_data, cork_timestamp *now);
+
+/* resolution is the length of each tick; pass in 0 to use
+ * CORK_TIMER_WHEEL_DEFAULT_RESOLUTION (1ms). */
+#define CORK_TIMER_WHEEL_DEFAULT_RESOLUTION \
+    ((cork_timestamp) ((UINT64_C(1) << 32) / 1000))
+
+CORK_API struct cork_timer_wheel *
+cork_timer_wheel_new(cork_timestamp resolution);
+
+/* Any timers that are still scheduled are removed from the wheel, without
+ * being fired. */
+CORK_API void
+cork_timer_wheel_free(struct cork_timer_wheel *wheel);
+
+CORK_API void
+cork_timer_wheel_set_user_data(struct cork_timer_wheel *wheel,
+                               void *user_data, cork_free_f free_user_data);
+
+CORK_API void
+cork_timer_wheel_set_clock(struct cork_timer_wheel *wheel,
+                           cork_timer_wheel_clock_f clock);
+
+/* Returns the number of scheduled timers. */
+CORK_API size_t
+cork_timer_wheel_size(const struct cork_timer_wheel *wheel);
+
+/* Schedules timer to fire once expires has passed.  If the timer is already
+ * scheduled, it's moved to its new expiration time.  If expires has already
+ * passed, the timer fires on the next call to cork_timer_wheel_advance. */
+CORK_API void
+cork_timer_wheel_schedule(struct cork_timer_wheel *wheel,
+                          struct cork_timer *timer, cork_timestamp expires);
+
+/* Returns whether the timer was scheduled. */
+CORK_API bool
+cork_timer_wheel_cancel(struct cork_timer_wheel *wheel,
+                        struct cork_timer *timer);
+
+/* Fires every timer that expires at or before now, in no particular order,
+ * and returns how many there were.  We first collect every expired timer into
+ * a single batch, so any timers that fire schedules for now or earlier will
+ * fire on the next call, not this one.  now must never go backwards. */
+CORK_API size_t
+cork_timer_wheel_advance(struct cork_timer_wheel *wheel, cork_timestamp now,
+                         cork_timer_wheel_fire_f fire);
+
+/* Like cork_timer_wheel_advance, using the wheel's clock. */
+CORK_API size_t
+cork_timer_wheel_poll(struct cork_timer_wheel *wheel,
+                      cork_timer_wheel_fire_f fire);
+
+/* Fills in a time that's no later than the end of the tick containing the
+ * earliest scheduled expiration, which you can use to decide how long to
+ * sleep.  Since timers only fire on tick boundaries, that's the earliest time
+ * an advance could fire anything, but it can be up to one tick after the
+ * expiration time itself.  It can also be up to one slot early at the level
+ * of the earliest timer, in which case the next advance just moves some
+ * timers to a lower level.  Returns false if there aren't any timers
+ * scheduled. */
+CORK_API bool
+cork_timer_wheel_next_expiration(const struct cork_timer_wheel *wheel,
+                                 cork_timestamp *when);
+
+
+#endif /* LIBCORK_DS_TIMER_WHEEL_H */
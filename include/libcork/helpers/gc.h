@@ -29,22 +29,22 @@ name##__recurse(struct cork_gc *gc, void *obj, \
 
 #define _gc_(name) \
 static struct cork_gc_obj_iface  name##__gc = { \
-    name##__free, name##__recurse \
+    name##__free, name##__recurse, NULL \
 };
 
 #define _gc_no_free_(name) \
 static struct cork_gc_obj_iface  name##__gc = { \
-    NULL, name##__recurse \
+    NULL, name##__recurse, NULL \
 };
 
 #define _gc_no_recurse_(name) \
 static struct cork_gc_obj_iface  name##__gc = { \
-    name##__free, NULL \
+    name##__free, NULL, NULL \
 };
 
 #define _gc_leaf_(name) \
 static struct cork_gc_obj_iface  name##__gc = { \
-    NULL, NULL \
+    NULL, NULL, NULL \
 };
 
 
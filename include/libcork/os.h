@@ -13,6 +13,7 @@
 
 /*** include all of the parts ***/
 
+#include <libcork/os/event-loop.h>
 #include <libcork/os/files.h>
 #include <libcork/os/process.h>
 #include <libcork/os/subprocess.h>
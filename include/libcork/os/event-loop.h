@@ -0,0 +1,194 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_OS_EVENT_LOOP_H
+#define LIBCORK_OS_EVENT_LOOP_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/callbacks.h>
+#include <libcork/core/timestamp.h>
+#include <libcork/core/types.h>
+#include <libcork/ds/timer-wheel.h>
+
+
+/*-----------------------------------------------------------------------
+ * Event loops
+ */
+
+/* A single-threaded reactor that waits for file descriptors to become ready,
+ * for timers to expire, and for tasks that other threads post to it.  Uses
+ * epoll on Linux and kqueue on BSD and Mac OS X.  On any other platform,
+ * cork_event_loop_new returns an error.
+ *
+ * Each call to cork_event_loop_run_once waits for something to happen, and
+ * then runs one batch of callbacks to completion: first for every file
+ * descriptor that's ready, then for every timer that has expired, and then
+ * for every task that has been posted.  Anything that those callbacks
+ * schedule or post is handled in the next batch.  If a callback returns an
+ * error, we stop the batch, and return that error from run_once; the rest of
+ * the batch is handled the next time you run the loop.
+ *
+ * Apart from cork_event_loop_post and cork_event_loop_stop, which you can
+ * call from any thread, you must only use a loop from the thread that runs
+ * it. */
+struct cork_event_loop;
+
+CORK_API struct cork_event_loop *
+cork_event_loop_new(void);
+
+/* Any tasks that are still pending are freed without being run.  You must
+ * remove any file descriptors yourself; any timers that are still scheduled
+ * are cancelled, without being fired. */
+CORK_API void
+cork_event_loop_free(struct cork_event_loop *loop);
+
+CORK_API void
+cork_event_loop_set_user_data(struct cork_event_loop *loop,
+                              void *user_data, cork_free_f free_user_data);
+
+CORK_API void *
+cork_event_loop_user_data(struct cork_event_loop *loop);
+
+/* The monotonic time at which the current batch started. */
+CORK_API cork_timestamp
+cork_event_loop_now(struct cork_event_loop *loop);
+
+
+/*-----------------------------------------------------------------------
+ * File descriptors
+ */
+
+#define CORK_LOOP_READABLE  0x01
+#define CORK_LOOP_WRITABLE  0x02
+/* The fd has an error or has been hung up.  This is only ever reported, and
+ * is reported whether you asked for it or not. */
+#define CORK_LOOP_HANGUP  0x04
+
+struct cork_loop_fd;
+
+/* events is the set of events that are ready. */
+typedef int
+(*cork_loop_fd_f)(struct cork_event_loop *loop, struct cork_loop_fd *watch,
+                  unsigned int events);
+
+/* Watches a file descriptor.  Embed this in your own struct; use
+ * cork_container_of to get back to it in the callback.  Watches are
+ * level-triggered, so the callback is called in every batch for as long as
+ * the fd is ready. */
+struct cork_loop_fd {
+    int  fd;
+    /* The events that we're waiting for.  Read-only. */
+    unsigned int  events;
+    cork_loop_fd_f  callback;
+};
+
+#define cork_loop_fd_init(watch, fd_, callback_) \
+    do { \
+        (watch)->fd = (fd_); \
+        (watch)->events = 0; \
+        (watch)->callback = (callback_); \
+    } while (0)
+
+/* events is a combination of CORK_LOOP_READABLE and CORK_LOOP_WRITABLE. */
+CORK_API int
+cork_event_loop_add_fd(struct cork_event_loop *loop,
+                       struct cork_loop_fd *watch, unsigned int events);
+
+CORK_API int
+cork_event_loop_modify_fd(struct cork_event_loop *loop,
+                          struct cork_loop_fd *watch, unsigned int events);
+
+/* You must remove a watch before closing its fd.  You can remove a watch from
+ * any callback, including its own, and it won't fire again, even if the
+ * current batch had already seen that it was ready. */
+CORK_API int
+cork_event_loop_remove_fd(struct cork_event_loop *loop,
+                          struct cork_loop_fd *watch);
+
+
+/*-----------------------------------------------------------------------
+ * Timers
+ */
+
+struct cork_loop_timer;
+
+typedef int
+(*cork_loop_timer_f)(struct cork_event_loop *loop,
+                     struct cork_loop_timer *timer);
+
+/* A timer in the loop's timer wheel, which has a 1ms resolution.  Embed this
+ * in your own struct.  The timer is no longer scheduled when its callback is
+ * called, so the callback can reschedule it. */
+struct cork_loop_timer {
+    struct cork_timer  timer;
+    cork_loop_timer_f  callback;
+};
+
+#define cork_loop_timer_init(t, callback_) \
+    do { \
+        cork_timer_init(&(t)->timer); \
+        (t)->callback = (callback_); \
+    } while (0)
+
+#define cork_loop_timer_is_scheduled(t) \
+    (cork_timer_is_scheduled(&(t)->timer))
+
+/* expires is a monotonic time, like cork_event_loop_now.  If the timer is
+ * already scheduled, it's moved to its new expiration time. */
+CORK_API void
+cork_event_loop_schedule(struct cork_event_loop *loop,
+                         struct cork_loop_timer *timer,
+                         cork_timestamp expires);
+
+/* Schedules the timer for delay after cork_event_loop_now. */
+CORK_API void
+cork_event_loop_schedule_after(struct cork_event_loop *loop,
+                               struct cork_loop_timer *timer,
+                               cork_timestamp delay);
+
+/* Returns whether the timer was scheduled. */
+CORK_API bool
+cork_event_loop_cancel(struct cork_event_loop *loop,
+                       struct cork_loop_timer *timer);
+
+
+/*-----------------------------------------------------------------------
+ * Tasks
+ */
+
+/* Runs a task in the loop's thread, in the next batch.  Safe to call from any
+ * thread; wakes up the loop if it's waiting.  Once the task has run (or if the
+ * loop is freed first), we free user_data with free_user_data. */
+CORK_API void
+cork_event_loop_post(struct cork_event_loop *loop, void *user_data,
+                     cork_free_f free_user_data, cork_run_f run);
+
+
+/*-----------------------------------------------------------------------
+ * Running the loop
+ */
+
+/* Waits up to timeout_ms milliseconds (or until the next timer expires, or
+ * forever, if it's -1 and there aren't any timers) for something to happen,
+ * and then handles one batch. */
+CORK_API int
+cork_event_loop_run_once(struct cork_event_loop *loop, int timeout_ms);
+
+/* Handles batches until someone calls cork_event_loop_stop, or until a
+ * callback returns an error. */
+CORK_API int
+cork_event_loop_run(struct cork_event_loop *loop);
+
+/* Makes cork_event_loop_run return after its current batch.  Safe to call from
+ * any thread. */
+CORK_API void
+cork_event_loop_stop(struct cork_event_loop *loop);
+
+
+#endif /* LIBCORK_OS_EVENT_LOOP_H */
@@ -13,6 +13,7 @@
 
 #include <libcork/core/api.h>
 #include <libcork/core/types.h>
+#include <libcork/ds/slice.h>
 
 
 /*-----------------------------------------------------------------------
@@ -80,6 +81,70 @@ cork_path_set_dirname(struct cork_path *path);
 CORK_API struct cork_path *
 cork_path_dirname(const struct cork_path *other);
 
+/* Fill in dest with a view of the basename or dirname of path.  The slice
+ * points into path's own content, so it's only valid until you next modify
+ * path. */
+CORK_API void
+cork_path_basename_slice(const struct cork_path *path, struct cork_slice *dest);
+
+CORK_API void
+cork_path_dirname_slice(const struct cork_path *path, struct cork_slice *dest);
+
+
+/*-----------------------------------------------------------------------
+ * Path builders
+ */
+
+/* A path that you build up and tear down one component at a time, such as
+ * while walking a directory tree.  Short paths live in the builder itself, so
+ * a builder on the stack doesn't allocate anything unless its path gets
+ * longer than CORK_PATH_BUILDER_INLINE_SIZE. */
+
+#define CORK_PATH_BUILDER_INLINE_SIZE  256
+
+struct cork_path_builder {
+    /* The current content of the path, which is always NUL-terminated */
+    char  *buf;
+    size_t  size;
+    size_t  allocated_size;
+    char  inline_buf[CORK_PATH_BUILDER_INLINE_SIZE];
+};
+
+/* path can be NULL to start with an empty path. */
+CORK_API void
+cork_path_builder_init(struct cork_path_builder *builder, const char *path);
+
+CORK_API void
+cork_path_builder_done(struct cork_path_builder *builder);
+
+#define cork_path_builder_get(builder)  ((const char *) (builder)->buf)
+#define cork_path_builder_size(builder)  ((builder)->size)
+
+/* Appends more to the path, using the same rules as cork_path_append.
+ * Returns a mark that you can pass to cork_path_builder_restore to remove
+ * what you appended. */
+CORK_API size_t
+cork_path_builder_push(struct cork_path_builder *builder, const char *more);
+
+CORK_API size_t
+cork_path_builder_push_n(struct cork_path_builder *builder,
+                         const char *more, size_t length);
+
+CORK_API void
+cork_path_builder_restore(struct cork_path_builder *builder, size_t mark);
+
+CORK_API void
+cork_path_builder_basename_slice(const struct cork_path_builder *builder,
+                                 struct cork_slice *dest);
+
+CORK_API void
+cork_path_builder_dirname_slice(const struct cork_path_builder *builder,
+                                struct cork_slice *dest);
+
+/* Allocates a new path with a copy of the builder's current content. */
+CORK_API struct cork_path *
+cork_path_builder_to_path(const struct cork_path_builder *builder);
+
 
 /*-----------------------------------------------------------------------
  * Lists of paths
@@ -151,6 +216,12 @@ cork_file_exists(struct cork_file *file, bool *exists);
 CORK_API int
 cork_file_type(struct cork_file *file, enum cork_file_type *type);
 
+/* We look up a file's metadata the first time you need it, and cache it
+ * until you call this function.  (cork_file_mkdir and cork_file_remove keep
+ * the cache up to date themselves.) */
+CORK_API void
+cork_file_invalidate(struct cork_file *file);
+
 
 typedef int
 (*cork_file_directory_iterator)(struct cork_file *child, const char *rel_name,
@@ -170,10 +241,31 @@ cork_file_mkdir(struct cork_file *file, cork_file_mode mode,
 
 /* Removes a file or directory.  If file is a directory, and flags contains
  * CORK_FILE_RECURSIVE, then all of the directory's contents are removed, too.
- * Otherwise, the directory must already be empty. */
+ * Otherwise, the directory must already be empty.  We never follow symlinks
+ * inside of the directory. */
 CORK_API int
 cork_file_remove(struct cork_file *file, unsigned int flags);
 
+/* Copies a file, or, if flags contains CORK_FILE_RECURSIVE, a directory and
+ * all of its contents.  Symlinks inside of a directory are copied as symlinks.
+ * If flags doesn't contain CORK_FILE_PERMISSIVE, it's an error if any of the
+ * copies already exist. */
+CORK_API int
+cork_file_copy(struct cork_file *src, struct cork_file *dest,
+               unsigned int flags);
+
+/* The same, but handling subdirectories in parallel on the workers of a
+ * started thread pool. */
+struct cork_thread_pool;
+
+CORK_API int
+cork_file_remove_parallel(struct cork_file *file, unsigned int flags,
+                          struct cork_thread_pool *pool);
+
+CORK_API int
+cork_file_copy_parallel(struct cork_file *src, struct cork_file *dest,
+                        unsigned int flags, struct cork_thread_pool *pool);
+
 
 CORK_API struct cork_file *
 cork_path_list_find_file(const struct cork_path_list *list,
@@ -207,12 +299,50 @@ cork_file_list_size(struct cork_file_list *list);
 CORK_API struct cork_file *
 cork_file_list_get(struct cork_file_list *list, size_t index);
 
+/* Look up the metadata of every file in the list that doesn't have any cached
+ * yet. */
+CORK_API int
+cork_file_list_stat(struct cork_file_list *list);
+
 
 CORK_API struct cork_file_list *
 cork_path_list_find_files(const struct cork_path_list *list,
                           const char *rel_path);
 
 
+/*-----------------------------------------------------------------------
+ * File caches
+ */
+
+/* A set of files, keyed by path, whose metadata is shared by everyone who
+ * looks up the same path.  The cache owns all of its files; they stay valid
+ * until you free the cache. */
+struct cork_file_cache;
+
+CORK_API struct cork_file_cache *
+cork_file_cache_new(void);
+
+CORK_API void
+cork_file_cache_free(struct cork_file_cache *cache);
+
+/* Cache owns the result; you should not free it */
+CORK_API struct cork_file *
+cork_file_cache_get(struct cork_file_cache *cache, const char *path);
+
+/* Forget the cached metadata for one path, or for every path in the cache. */
+CORK_API void
+cork_file_cache_invalidate(struct cork_file_cache *cache, const char *path);
+
+CORK_API void
+cork_file_cache_invalidate_all(struct cork_file_cache *cache);
+
+/* Like cork_path_list_find_file, but the cache owns the result. */
+CORK_API struct cork_file *
+cork_file_cache_find_file(struct cork_file_cache *cache,
+                          const struct cork_path_list *list,
+                          const char *rel_path);
+
+
 /*-----------------------------------------------------------------------
  * Walking a directory tree
  */
@@ -246,6 +376,73 @@ struct cork_dir_walker {
 CORK_API int
 cork_walk_directory(const char *path, struct cork_dir_walker *walker);
 
+struct cork_thread_pool;
+
+/* Walk the directory using the workers of a started thread pool, with each
+ * subdirectory handled as a separate task.  The walker's callbacks can be
+ * called from several threads at once.  A directory's enter_directory callback
+ * is still called before anything inside of it, and its leave_directory
+ * callback after everything inside of it, but there's no ordering between
+ * sibling subdirectories. */
+CORK_API int
+cork_walk_directory_parallel(const char *path, struct cork_dir_walker *walker,
+                             struct cork_thread_pool *pool);
+
+
+/*-----------------------------------------------------------------------
+ * File watchers
+ */
+
+enum cork_file_event_type {
+    CORK_FILE_CREATED,
+    CORK_FILE_MODIFIED,
+    CORK_FILE_DELETED,
+    /* The kernel couldn't keep up, and we've lost some events; you'll need to
+     * rescan everything that you're watching. */
+    CORK_FILE_EVENTS_LOST
+};
+
+struct cork_file_event {
+    enum cork_file_event_type  type;
+    /* Both paths are NULL for CORK_FILE_EVENTS_LOST.  rel_path is relative to
+     * the path that you passed to cork_file_watcher_add, and is empty for
+     * events about that path itself. */
+    const char  *full_path;
+    const char  *rel_path;
+};
+
+typedef int
+(*cork_file_event_f)(void *user_data, const struct cork_file_event *event);
+
+/* Uses inotify on Linux and kqueue on BSD and Mac OS X.  On any other
+ * platform, cork_file_watcher_new returns an error. */
+struct cork_file_watcher;
+
+CORK_API struct cork_file_watcher *
+cork_file_watcher_new(void);
+
+CORK_API void
+cork_file_watcher_free(struct cork_file_watcher *watcher);
+
+/* Watch a file, or the entries of a directory.  If flags includes
+ * CORK_FILE_RECURSIVE, we also watch every subdirectory of a directory,
+ * including ones that are created later. */
+CORK_API int
+cork_file_watcher_add(struct cork_file_watcher *watcher, const char *path,
+                      unsigned int flags);
+
+/* A file descriptor that's readable whenever there are events to process, if
+ * you want to wait for events in your own poll or event loop. */
+CORK_API int
+cork_file_watcher_fd(struct cork_file_watcher *watcher);
+
+/* Wait up to timeout_ms milliseconds (or forever, if it's -1) for events, and
+ * pass all of the available ones to callback.  If callback returns an error,
+ * we stop processing events and return that error. */
+CORK_API int
+cork_file_watcher_process(struct cork_file_watcher *watcher, int timeout_ms,
+                          void *user_data, cork_file_event_f callback);
+
 
 /*-----------------------------------------------------------------------
  * Standard paths and path lists
@@ -15,6 +15,7 @@
 #include <libcork/core/api.h>
 #include <libcork/core/callbacks.h>
 #include <libcork/core/types.h>
+#include <libcork/ds/array.h>
 #include <libcork/ds/stream.h>
 #include <libcork/threads/basics.h>
 
@@ -38,6 +39,21 @@ cork_env_free(struct cork_env *env);
 CORK_API void
 cork_env_replace_current(struct cork_env *env);
 
+/* Appends a "NAME=value" string to dest for each variable in env, in the
+ * format that execve expects for its envp parameter.  (We don't add the NULL
+ * terminator.) */
+CORK_API void
+cork_env_to_string_array(struct cork_env *env, struct cork_string_array *dest);
+
+/* Returns a NULL-terminated array of "NAME=value" strings for each variable
+ * in env, which you can pass as execve's envp parameter.  We cache the array
+ * (in a single allocation, along with all of its strings), so you can spawn
+ * any number of processes with the same environment without rebuilding it.
+ * The array is only valid until you next modify or free env.  If env is NULL,
+ * we return the environment of the current process. */
+CORK_API char * const *
+cork_env_envp(struct cork_env *env);
+
 
 /* For all of the following, if env is NULL, these functions access or update
  * the actual environment of the current process.  Otherwise, they act on the
@@ -97,6 +113,12 @@ cork_exec_param(struct cork_exec *exec, size_t index);
 CORK_API void
 cork_exec_add_param(struct cork_exec *exec, const char *param);
 
+/* Returns the parameters as a NULL-terminated array, which you can pass as
+ * execve's argv parameter.  The array is only valid until you next add a
+ * parameter or free exec. */
+CORK_API char * const *
+cork_exec_params(struct cork_exec *exec);
+
 /* Can return NULL */
 CORK_API struct cork_env *
 cork_exec_env(struct cork_exec *exec);
@@ -145,6 +167,16 @@ cork_subprocess_free(struct cork_subprocess *sub);
 CORK_API struct cork_stream_consumer *
 cork_subprocess_stdin(struct cork_subprocess *sub);
 
+/* Have the subprocess write its stdout (or stderr) directly to fd, instead of
+ * into a pipe that we copy into a stream consumer.  Must be called before the
+ * subprocess starts; the consumer (if any) won't be used.  We don't take
+ * control of fd. */
+CORK_API void
+cork_subprocess_set_stdout_fd(struct cork_subprocess *sub, int fd);
+
+CORK_API void
+cork_subprocess_set_stderr_fd(struct cork_subprocess *sub, int fd);
+
 CORK_API int
 cork_subprocess_start(struct cork_subprocess *sub);
 
@@ -193,5 +225,23 @@ cork_subprocess_group_drain(struct cork_subprocess_group *group);
 CORK_API int
 cork_subprocess_group_wait(struct cork_subprocess_group *group);
 
+struct cork_event_loop;
+
+typedef int
+(*cork_subprocess_group_done_f)(void *user_data,
+                                struct cork_subprocess_group *group);
+
+/* Lets an event loop read the output of a group that you've already started,
+ * and wait for its subprocesses to exit, without blocking.  Once every
+ * subprocess has finished, the group is detached from the loop, and we call
+ * done from the loop; you can free the group from within done.  If you free
+ * the group before then, it's detached first.  Don't call
+ * cork_subprocess_group_drain or cork_subprocess_group_wait on an attached
+ * group. */
+CORK_API int
+cork_subprocess_group_attach(struct cork_subprocess_group *group,
+                             struct cork_event_loop *loop, void *user_data,
+                             cork_subprocess_group_done_f done);
+
 
 #endif /* LIBCORK_OS_SUBPROCESS_H */
@@ -15,5 +15,10 @@
 
 #include <libcork/threads/atomics.h>
 #include <libcork/threads/basics.h>
+#include <libcork/threads/coarse-clock.h>
+#include <libcork/threads/epoch.h>
+#include <libcork/threads/locks.h>
+#include <libcork/threads/metrics.h>
+#include <libcork/threads/pool.h>
 
 #endif /* LIBCORK_THREADS_H */
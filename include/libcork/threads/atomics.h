@@ -12,6 +12,7 @@
 #define LIBCORK_THREADS_ATOMICS_H
 
 #include <libcork/config.h>
+#include <libcork/core/attributes.h>
 #include <libcork/core/types.h>
 
 /*-----------------------------------------------------------------------
@@ -38,6 +39,186 @@
 #define cork_size_cas              __sync_val_compare_and_swap
 #define cork_ptr_cas               __sync_val_compare_and_swap
 
+#define cork_int64_atomic_add       __sync_add_and_fetch
+#define cork_uint64_atomic_add      __sync_add_and_fetch
+#define cork_int64_atomic_pre_add   __sync_fetch_and_add
+#define cork_uint64_atomic_pre_add  __sync_fetch_and_add
+#define cork_int64_atomic_sub       __sync_sub_and_fetch
+#define cork_uint64_atomic_sub      __sync_sub_and_fetch
+#define cork_int64_atomic_pre_sub   __sync_fetch_and_sub
+#define cork_uint64_atomic_pre_sub  __sync_fetch_and_sub
+#define cork_int64_cas              __sync_val_compare_and_swap
+#define cork_uint64_cas             __sync_val_compare_and_swap
+
+
+/*-----------------------------------------------------------------------
+ * Explicit memory orderings
+ */
+
+/* Each of the operations in this section takes an ordering parameter, which
+ * has the same meaning as the corresponding C11 memory_order value.  The
+ * operations work on any integer or pointer type.  Older compilers don't have
+ * the __atomic builtins, so we fall back on full barriers for them, regardless
+ * of which ordering you ask for. */
+#if defined(__ATOMIC_ACQUIRE)
+
+#define CORK_ATOMIC_RELAXED  __ATOMIC_RELAXED
+#define CORK_ATOMIC_ACQUIRE  __ATOMIC_ACQUIRE
+#define CORK_ATOMIC_RELEASE  __ATOMIC_RELEASE
+#define CORK_ATOMIC_ACQ_REL  __ATOMIC_ACQ_REL
+#define CORK_ATOMIC_SEQ_CST  __ATOMIC_SEQ_CST
+
+#define cork_atomic_load(ptr, order) \
+    (__atomic_load_n((ptr), (order)))
+#define cork_atomic_store(ptr, val, order) \
+    (__atomic_store_n((ptr), (val), (order)))
+#define cork_atomic_exchange(ptr, val, order) \
+    (__atomic_exchange_n((ptr), (val), (order)))
+
+/* These return the value from before the operation. */
+#define cork_atomic_fetch_add(ptr, val, order) \
+    (__atomic_fetch_add((ptr), (val), (order)))
+#define cork_atomic_fetch_sub(ptr, val, order) \
+    (__atomic_fetch_sub((ptr), (val), (order)))
+#define cork_atomic_fetch_or(ptr, val, order) \
+    (__atomic_fetch_or((ptr), (val), (order)))
+#define cork_atomic_fetch_and(ptr, val, order) \
+    (__atomic_fetch_and((ptr), (val), (order)))
+#define cork_atomic_fetch_xor(ptr, val, order) \
+    (__atomic_fetch_xor((ptr), (val), (order)))
+
+/* Returns whether the swap succeeded.  If it didn't, the current value is
+ * stored into *expected. */
+#define cork_atomic_cas(ptr, expected, desired, success_order, failure_order) \
+    (__atomic_compare_exchange_n \
+     ((ptr), (expected), (desired), false, (success_order), (failure_order)))
+
+#define cork_atomic_fence(order) \
+    (__atomic_thread_fence((order)))
+
+#else
+
+#define CORK_ATOMIC_RELAXED  0
+#define CORK_ATOMIC_ACQUIRE  2
+#define CORK_ATOMIC_RELEASE  3
+#define CORK_ATOMIC_ACQ_REL  4
+#define CORK_ATOMIC_SEQ_CST  5
+
+#define cork_atomic_load(ptr, order) \
+    (__extension__ ({ \
+        __typeof__(*(ptr))  __value; \
+        __sync_synchronize(); \
+        __value = *(volatile __typeof__(*(ptr)) *) (ptr); \
+        __sync_synchronize(); \
+        __value; \
+    }))
+#define cork_atomic_store(ptr, val, order) \
+    (__extension__ ({ \
+        __sync_synchronize(); \
+        *(volatile __typeof__(*(ptr)) *) (ptr) = (val); \
+        __sync_synchronize(); \
+    }))
+/* __sync_lock_test_and_set is only an acquire barrier. */
+#define cork_atomic_exchange(ptr, val, order) \
+    (__extension__ ({ \
+        __sync_synchronize(); \
+        __sync_lock_test_and_set((ptr), (val)); \
+    }))
+
+#define cork_atomic_fetch_add(ptr, val, order) \
+    (__sync_fetch_and_add((ptr), (val)))
+#define cork_atomic_fetch_sub(ptr, val, order) \
+    (__sync_fetch_and_sub((ptr), (val)))
+#define cork_atomic_fetch_or(ptr, val, order) \
+    (__sync_fetch_and_or((ptr), (val)))
+#define cork_atomic_fetch_and(ptr, val, order) \
+    (__sync_fetch_and_and((ptr), (val)))
+#define cork_atomic_fetch_xor(ptr, val, order) \
+    (__sync_fetch_and_xor((ptr), (val)))
+
+#define cork_atomic_cas(ptr, expected, desired, success_order, failure_order) \
+    (__extension__ ({ \
+        __typeof__(*(ptr))  __old = *(expected); \
+        __typeof__(*(ptr))  __actual = \
+            __sync_val_compare_and_swap((ptr), __old, (desired)); \
+        *(expected) = __actual; \
+        __actual == __old; \
+    }))
+
+#define cork_atomic_fence(order) \
+    (__sync_synchronize())
+
+#endif
+
+/* Loads and stores that only order the memory accesses around them in one
+ * direction.  These are much cheaper than a full barrier on most platforms. */
+#define cork_atomic_load_acquire(ptr) \
+    cork_atomic_load((ptr), CORK_ATOMIC_ACQUIRE)
+#define cork_atomic_store_release(ptr, val) \
+    cork_atomic_store((ptr), (val), CORK_ATOMIC_RELEASE)
+
+
+/*-----------------------------------------------------------------------
+ * Double-width compare-and-swap
+ */
+
+/* A pair of pointer-sized words that can be swapped together, which is
+ * usually used to pair a pointer with a version counter to avoid ABA
+ * problems.  CORK_HAVE_ATOMIC_PAIR_CAS is defined to 1 if the current
+ * platform supports cork_atomic_pair_cas. */
+struct cork_atomic_pair {
+    uintptr_t  first;
+    uintptr_t  second;
+} __attribute__((aligned(2 * CORK_SIZEOF_POINTER)));
+
+/* Returns whether the swap succeeded.  If it didn't, the current value is
+ * stored into *expected.  This is always a full barrier. */
+#if CORK_SIZEOF_POINTER == 4 || \
+    defined(__x86_64__) || defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+#define CORK_HAVE_ATOMIC_PAIR_CAS  1
+
+CORK_ATTR_UNUSED
+static inline bool
+cork_atomic_pair_cas(volatile struct cork_atomic_pair *ptr,
+                     struct cork_atomic_pair *expected,
+                     struct cork_atomic_pair desired)
+{
+#if CORK_SIZEOF_POINTER == 4
+    union { struct cork_atomic_pair  pair; uint64_t  value; }  old, new, actual;
+    old.pair = *expected;
+    new.pair = desired;
+    actual.value = __sync_val_compare_and_swap
+        ((volatile uint64_t *) ptr, old.value, new.value);
+    *expected = actual.pair;
+    return actual.value == old.value;
+#elif defined(__x86_64__)
+    /* Compilers only inline cmpxchg16b with -mcx16, and otherwise call out to
+     * libatomic. */
+    bool  result;
+    __asm__ __volatile__
+        ("lock; cmpxchg16b %1\n\t"
+         "sete %0"
+         : "=q" (result), "+m" (*ptr),
+           "+a" (expected->first), "+d" (expected->second)
+         : "b" (desired.first), "c" (desired.second)
+         : "memory", "cc");
+    return result;
+#else
+    union { struct cork_atomic_pair  pair; unsigned __int128  value; }
+        old, new, actual;
+    old.pair = *expected;
+    new.pair = desired;
+    actual.value = __sync_val_compare_and_swap
+        ((volatile unsigned __int128 *) ptr, old.value, new.value);
+    *expected = actual.pair;
+    return actual.value == old.value;
+#endif
+}
+
+#else
+#define CORK_HAVE_ATOMIC_PAIR_CAS  0
+#endif
+
 
 /*-----------------------------------------------------------------------
  * End of atomic implementations
@@ -58,6 +58,34 @@ cork_thread_get_name(struct cork_thread *thread);
 CORK_API cork_thread_id
 cork_thread_get_id(struct cork_thread *thread);
 
+/* Attributes of a thread, which you can only set before starting it.  A stack
+ * size of 0 means to use the system default.  cork_thread_set_affinity
+ * restricts the thread to the given CPUs; cork_thread_set_numa_node restricts
+ * it to the CPUs of one NUMA node, and has it prefer memory from that node.
+ * Real-time scheduling policies usually need extra privileges, in which case
+ * cork_thread_start will fail. */
+
+enum cork_thread_sched_policy {
+    CORK_THREAD_SCHED_DEFAULT,
+    CORK_THREAD_SCHED_OTHER,
+    CORK_THREAD_SCHED_FIFO,
+    CORK_THREAD_SCHED_RR
+};
+
+CORK_API void
+cork_thread_set_stack_size(struct cork_thread *thread, size_t stack_size);
+
+CORK_API void
+cork_thread_set_affinity(struct cork_thread *thread,
+                         const unsigned int *cpus, size_t cpu_count);
+
+CORK_API int
+cork_thread_set_numa_node(struct cork_thread *thread, unsigned int node);
+
+CORK_API void
+cork_thread_set_scheduling(struct cork_thread *thread,
+                           enum cork_thread_sched_policy policy, int priority);
+
 /* Can only be called once per thread.  Thread will automatically be freed when
  * its done. */
 CORK_API int
@@ -143,23 +171,44 @@ cork_thread_join(struct cork_thread *thread);
 
 /* Prefer, in order:
  *
- * 1) __thread storage class
+ * 1) __thread or _Thread_local storage class
  * 2) pthread_key_t
+ *
+ * cork_tls_fast is for small variables that are accessed constantly, such as
+ * per-thread caches.  Where we can, it uses the initial-exec TLS model, so
+ * that NAME_get compiles to a single load from the thread pointer.  Otherwise
+ * it's the same as cork_tls.
  */
 
 #if CORK_CONFIG_HAVE_THREAD_STORAGE_CLASS
-#define cork_tls(TYPE, NAME) \
-static __thread TYPE  NAME##__tls; \
+
+#if CORK_CONFIG_TLS_INITIAL_EXEC
+#define CORK_ATTR_TLS_INITIAL_EXEC  __attribute__((tls_model("initial-exec")))
+#else
+#define CORK_ATTR_TLS_INITIAL_EXEC
+#endif
+
+#define cork_tls_(TYPE, NAME, attrs) \
+static CORK_CONFIG_THREAD_STORAGE_CLASS TYPE  NAME##__tls attrs; \
 \
-static TYPE * \
+static inline TYPE * \
 NAME##_get(void) \
 { \
     return &NAME##__tls; \
 }
 
+#define cork_tls(TYPE, NAME) \
+    cork_tls_(TYPE, NAME, )
+
 #define cork_tls_with_alloc(TYPE, NAME, allocate, deallocate) \
     cork_tls(TYPE, NAME)
 
+#define cork_tls_fast(TYPE, NAME) \
+    cork_tls_(TYPE, NAME, CORK_ATTR_TLS_INITIAL_EXEC)
+
+#define cork_tls_fast_with_alloc(TYPE, NAME, allocate, deallocate) \
+    cork_tls_fast(TYPE, NAME)
+
 #elif CORK_HAVE_PTHREADS
 #include <stdlib.h>
 #include <pthread.h>
@@ -213,6 +262,12 @@ NAME##__tls_deallocate(void *vself) \
 \
 cork_tls_with_alloc(TYPE, NAME, NAME##__tls_allocate, NAME##__tls_deallocate);
 
+#define cork_tls_fast(TYPE, NAME) \
+    cork_tls(TYPE, NAME)
+
+#define cork_tls_fast_with_alloc(TYPE, NAME, allocate, deallocate) \
+    cork_tls_with_alloc(TYPE, NAME, allocate, deallocate)
+
 #else
 #error "No thread-local storage implementation!"
 #endif
@@ -0,0 +1,88 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_THREADS_COARSE_CLOCK_H
+#define LIBCORK_THREADS_COARSE_CLOCK_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/attributes.h>
+#include <libcork/core/timestamp.h>
+#include <libcork/core/types.h>
+#include <libcork/ds/buffer.h>
+#include <libcork/threads/atomics.h>
+#include <libcork/threads/basics.h>
+
+
+/*-----------------------------------------------------------------------
+ * Coarse clocks
+ */
+
+/* A coarse clock is a pair of timestamps that a background thread updates
+ * every interval_msec milliseconds.  Reading the clock is a single load from a
+ * cache line that only changes once per tick, which is much cheaper than
+ * asking the kernel for the time.
+ *
+ * You should treat the fields of this struct as private, and only use the
+ * functions below. */
+struct cork_coarse_clock {
+    /* Only the ticker thread writes to these, once per tick. */
+    volatile cork_timestamp  now;
+    volatile cork_timestamp  monotonic;
+    CORK_CACHELINE_PAD(pad, 2 * sizeof(cork_timestamp));
+
+    unsigned int  interval_msec;
+    const char  *format;
+    size_t  id;
+    volatile int  stopping;
+    struct cork_thread  *ticker;
+};
+
+/* format is the cork_timestamp_format_utc format string that
+ * cork_coarse_clock_format_utc uses.  We make our own copy of it.  The clock
+ * is valid as soon as it's created, but it won't advance until you start it.
+ * Once it has started, you must free the clock (which stops its thread)
+ * before the program exits. */
+CORK_API struct cork_coarse_clock *
+cork_coarse_clock_new(unsigned int interval_msec, const char *format);
+
+CORK_API int
+cork_coarse_clock_start(struct cork_coarse_clock *clock);
+
+CORK_API void
+cork_coarse_clock_free(struct cork_coarse_clock *clock);
+
+/* Reads the clock manually, instead of waiting for the next tick. */
+CORK_API void
+cork_coarse_clock_tick(struct cork_coarse_clock *clock);
+
+/* The time of day (as cork_timestamp_init_now) and monotonic time (as
+ * cork_timestamp_init_monotonic) as of the most recent tick */
+CORK_ATTR_UNUSED
+static inline cork_timestamp
+cork_coarse_clock_now(struct cork_coarse_clock *clock)
+{
+    return cork_atomic_load(&clock->now, CORK_ATOMIC_RELAXED);
+}
+
+CORK_ATTR_UNUSED
+static inline cork_timestamp
+cork_coarse_clock_monotonic(struct cork_coarse_clock *clock)
+{
+    return cork_atomic_load(&clock->monotonic, CORK_ATOMIC_RELAXED);
+}
+
+/* Appends cork_coarse_clock_now, formatted with the clock's format string, to
+ * dest.  Each thread caches the most recent result, so we only reformat the
+ * timestamp when the clock has ticked since the thread's last call. */
+CORK_API int
+cork_coarse_clock_format_utc(struct cork_coarse_clock *clock,
+                             struct cork_buffer *dest);
+
+
+#endif /* LIBCORK_THREADS_COARSE_CLOCK_H */
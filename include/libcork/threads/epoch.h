@@ -0,0 +1,78 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_THREADS_EPOCH_H
+#define LIBCORK_THREADS_EPOCH_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/callbacks.h>
+#include <libcork/core/types.h>
+
+
+/*-----------------------------------------------------------------------
+ * Epoch-based reclamation
+ */
+
+/* An epoch domain lets lock-free data structures free memory that other
+ * threads might still be reading.  Readers bracket their accesses with
+ * cork_epoch_enter and cork_epoch_exit.  Once a writer has unlinked an object,
+ * so that no new reader can find it, it hands the object to cork_epoch_defer.
+ * We free the object once every thread that might have seen it has left its
+ * critical section.
+ *
+ * Each thread that uses a domain gets its own participation record, which is
+ * cached in thread-local storage.  A thread should call
+ * cork_epoch_thread_done before it exits, so that its record can be reused. */
+struct cork_epoch;
+
+/* The number of objects that a thread can defer before it tries to free
+ * some of them. */
+#define CORK_EPOCH_RECLAIM_THRESHOLD  64
+
+CORK_API struct cork_epoch *
+cork_epoch_new(void);
+
+/* Free a domain, along with any objects that are still waiting to be freed.
+ * No thread can be in a critical section when you call this. */
+CORK_API void
+cork_epoch_free(struct cork_epoch *epoch);
+
+/* Critical sections can be nested. */
+CORK_API void
+cork_epoch_enter(struct cork_epoch *epoch);
+
+CORK_API void
+cork_epoch_exit(struct cork_epoch *epoch);
+
+/* Free ptr using free_ptr once it's safe to do so. */
+CORK_API void
+cork_epoch_defer(struct cork_epoch *epoch, void *ptr, cork_free_f free_ptr);
+
+/* Free ptr with cork_free once it's safe to do so. */
+CORK_API void
+cork_epoch_defer_free(struct cork_epoch *epoch, void *ptr, size_t size);
+
+/* Try to advance the domain's epoch, and free any of the current thread's
+ * deferred objects that are now safe to free.  This never blocks. */
+CORK_API void
+cork_epoch_reclaim(struct cork_epoch *epoch);
+
+/* Wait until every object that the current thread has deferred so far has
+ * been freed.  You can't call this from inside of a critical section. */
+CORK_API void
+cork_epoch_synchronize(struct cork_epoch *epoch);
+
+/* Release the current thread's participation record.  Anything that the
+ * thread deferred will be freed later by some other thread.  You can't call
+ * this from inside of a critical section. */
+CORK_API void
+cork_epoch_thread_done(struct cork_epoch *epoch);
+
+
+#endif /* LIBCORK_THREADS_EPOCH_H */
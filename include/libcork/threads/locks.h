@@ -0,0 +1,203 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_THREADS_LOCKS_H
+#define LIBCORK_THREADS_LOCKS_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/attributes.h>
+#include <libcork/core/types.h>
+
+
+/*-----------------------------------------------------------------------
+ * Mutexes
+ */
+
+/* The number of times we spin on a contended mutex before going to sleep */
+#define CORK_MUTEX_SPIN_COUNT  100
+
+/* A mutex that's a single word.  When the mutex is contended, we spin for a
+ * bit, and then go to sleep on a futex (on Linux) or yield the CPU (elsewhere).
+ * Mutexes aren't recursive. */
+struct cork_mutex {
+    /* 0 if unlocked, 1 if locked, 2 if locked and someone might be asleep */
+    volatile int  state;
+};
+
+#define CORK_MUTEX_INIT  { 0 }
+
+#define cork_mutex_init(mutex)  ((mutex)->state = 0)
+#define cork_mutex_done(mutex)  ((void) (mutex))
+
+CORK_API void
+cork_mutex_lock(struct cork_mutex *mutex);
+
+/* Returns whether we acquired the mutex. */
+CORK_API bool
+cork_mutex_try_lock(struct cork_mutex *mutex);
+
+CORK_API void
+cork_mutex_unlock(struct cork_mutex *mutex);
+
+
+/*-----------------------------------------------------------------------
+ * Reader-writer locks
+ */
+
+#define CORK_RWLOCK_READER_STRIPES  16
+
+/* Readers are spread across several counters, each in its own cache line, so
+ * that readers in different threads don't contend with each other.  That
+ * makes read locks very cheap, at the cost of write locks, which have to
+ * check every counter.  Writers take priority: once a writer is waiting, new
+ * readers wait for it to finish. */
+struct cork_rwlock_stripe {
+    volatile unsigned int  count;
+    CORK_CACHELINE_PAD(pad, sizeof(unsigned int));
+};
+
+struct cork_rwlock {
+    struct cork_rwlock_stripe  readers[CORK_RWLOCK_READER_STRIPES];
+    /* 1 while a writer holds (or is waiting for) the lock, 2 if there might
+     * also be readers asleep waiting for it */
+    volatile int  writer;
+    /* Serializes writers with each other */
+    struct cork_mutex  writer_mutex;
+};
+
+#define CORK_RWLOCK_INIT  { { { 0 } }, 0, CORK_MUTEX_INIT }
+
+CORK_API void
+cork_rwlock_init(struct cork_rwlock *lock);
+
+#define cork_rwlock_done(lock)  ((void) (lock))
+
+CORK_API void
+cork_rwlock_read_lock(struct cork_rwlock *lock);
+
+CORK_API void
+cork_rwlock_read_unlock(struct cork_rwlock *lock);
+
+CORK_API void
+cork_rwlock_write_lock(struct cork_rwlock *lock);
+
+CORK_API void
+cork_rwlock_write_unlock(struct cork_rwlock *lock);
+
+
+/*-----------------------------------------------------------------------
+ * Events
+ */
+
+/* An event that threads can wait for.  Setting a manual-reset event wakes up
+ * every waiter, and it stays set until you reset it.  Setting an auto-reset
+ * event wakes up a single waiter, which resets the event as it returns.
+ * Like mutexes, waiters spin for a bit before going to sleep, and setting an
+ * event only makes a system call if someone is asleep. */
+struct cork_event {
+    /* 0 if unset, 1 if set, 2 if unset and someone might be asleep */
+    volatile int  state;
+    bool  manual_reset;
+};
+
+#define CORK_EVENT_INIT(manual_reset)  { 0, (manual_reset) }
+
+CORK_API void
+cork_event_init(struct cork_event *event, bool manual_reset);
+
+#define cork_event_done(event)  ((void) (event))
+
+CORK_API void
+cork_event_set(struct cork_event *event);
+
+CORK_API void
+cork_event_reset(struct cork_event *event);
+
+CORK_API bool
+cork_event_is_set(struct cork_event *event);
+
+CORK_API void
+cork_event_wait(struct cork_event *event);
+
+/* These return whether the event was set, either immediately or before the
+ * timeout expired. */
+CORK_API bool
+cork_event_try_wait(struct cork_event *event);
+
+CORK_API bool
+cork_event_timed_wait(struct cork_event *event, unsigned int timeout_ms);
+
+
+/*-----------------------------------------------------------------------
+ * Semaphores
+ */
+
+struct cork_semaphore {
+    volatile int  count;
+    /* The number of threads that might be asleep */
+    volatile int  waiters;
+};
+
+#define CORK_SEMAPHORE_INIT(count)  { (count), 0 }
+
+CORK_API void
+cork_semaphore_init(struct cork_semaphore *sem, unsigned int count);
+
+#define cork_semaphore_done(sem)  ((void) (sem))
+
+CORK_API void
+cork_semaphore_post(struct cork_semaphore *sem, unsigned int count);
+
+CORK_API void
+cork_semaphore_wait(struct cork_semaphore *sem);
+
+/* These return whether we were able to decrement the semaphore, either
+ * immediately or before the timeout expired. */
+CORK_API bool
+cork_semaphore_try_wait(struct cork_semaphore *sem);
+
+CORK_API bool
+cork_semaphore_timed_wait(struct cork_semaphore *sem, unsigned int timeout_ms);
+
+
+/*-----------------------------------------------------------------------
+ * Parking threads
+ */
+
+/* A permit that one thread — its owner — waits for, and that any other
+ * thread can hand it.  If the permit is handed over before the owner starts
+ * waiting, the owner doesn't wait at all; permits don't accumulate.  This is
+ * a good way for a thread to sleep while a lock-free queue is empty. */
+struct cork_parker {
+    /* 0 if there's no permit, 1 if there is, -1 if the owner is asleep */
+    volatile int  state;
+};
+
+#define CORK_PARKER_INIT  { 0 }
+
+#define cork_parker_init(parker)  ((parker)->state = 0)
+#define cork_parker_done(parker)  ((void) (parker))
+
+/* Each thread has its own parker.  The result is only valid while the
+ * thread is running. */
+CORK_API struct cork_parker *
+cork_parker_current(void);
+
+CORK_API void
+cork_parker_park(struct cork_parker *parker);
+
+/* Returns whether we got a permit before we gave up. */
+CORK_API bool
+cork_parker_timed_park(struct cork_parker *parker, unsigned int timeout_ms);
+
+CORK_API void
+cork_parker_unpark(struct cork_parker *parker);
+
+
+#endif /* LIBCORK_THREADS_LOCKS_H */
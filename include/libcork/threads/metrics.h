@@ -0,0 +1,130 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_THREADS_METRICS_H
+#define LIBCORK_THREADS_METRICS_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/types.h>
+#include <libcork/ds/buffer.h>
+
+
+/*-----------------------------------------------------------------------
+ * Metrics registries
+ */
+
+/* A registry holds a set of counters and histograms.  Each thread that updates
+ * a registry's metrics gets its own shard, which is cached in thread-local
+ * storage, so updating a metric never touches memory that other threads are
+ * writing to.  Reading a metric merges together the values from every shard.
+ *
+ * A thread should call cork_metrics_thread_done before it exits, so that its
+ * shard can be reused by some other thread.  The values that it recorded are
+ * kept. */
+struct cork_metrics;
+
+CORK_API struct cork_metrics *
+cork_metrics_new(void);
+
+/* Frees the registry and all of its metrics.  No other thread can be using
+ * any of them when you call this. */
+CORK_API void
+cork_metrics_free(struct cork_metrics *metrics);
+
+CORK_API void
+cork_metrics_thread_done(struct cork_metrics *metrics);
+
+/* Append the current value of every metric to dest, either as one line per
+ * metric, or in the Prometheus text exposition format. */
+CORK_API void
+cork_metrics_export_text(struct cork_metrics *metrics,
+                         struct cork_buffer *dest);
+
+CORK_API void
+cork_metrics_export_prometheus(struct cork_metrics *metrics,
+                               struct cork_buffer *dest);
+
+
+/*-----------------------------------------------------------------------
+ * Counters
+ */
+
+struct cork_counter;
+
+/* name should be a valid Prometheus metric name, and shouldn't be used by any
+ * other metric in the registry.  We make our own copies of name and help.
+ * The counter is freed along with the registry. */
+CORK_API struct cork_counter *
+cork_metrics_add_counter(struct cork_metrics *metrics,
+                         const char *name, const char *help);
+
+CORK_API void
+cork_counter_add(struct cork_counter *counter, uint64_t delta);
+
+#define cork_counter_inc(counter)  (cork_counter_add((counter), 1))
+
+CORK_API uint64_t
+cork_counter_get(struct cork_counter *counter);
+
+
+/*-----------------------------------------------------------------------
+ * Histograms
+ */
+
+/* A histogram with log-linear buckets, in the style of HdrHistogram.  Each
+ * power of two is divided into 2^precision equal buckets, so a recorded value
+ * is known to within a relative error of 2^-precision.  Values up to
+ * 2^precision are recorded exactly.  The number of buckets only depends on
+ * max_value and precision; values larger than max_value are recorded as
+ * max_value. */
+struct cork_histogram;
+
+#define CORK_HISTOGRAM_MAX_PRECISION  10
+
+CORK_API struct cork_histogram *
+cork_metrics_add_histogram(struct cork_metrics *metrics,
+                           const char *name, const char *help,
+                           uint64_t max_value, unsigned int precision);
+
+CORK_API void
+cork_histogram_record(struct cork_histogram *histogram, uint64_t value);
+
+/* A merged copy of a histogram's contents.  min and max are 0 if the
+ * histogram is empty.  sum is the sum of the values that were actually
+ * recorded, before clamping them to max_value. */
+struct cork_histogram_snapshot {
+    uint64_t  count;
+    uint64_t  sum;
+    uint64_t  min;
+    uint64_t  max;
+    unsigned int  precision;
+    size_t  bucket_count;
+    uint64_t  *buckets;
+};
+
+CORK_API void
+cork_histogram_snapshot_init(struct cork_histogram_snapshot *snapshot);
+
+CORK_API void
+cork_histogram_snapshot_done(struct cork_histogram_snapshot *snapshot);
+
+/* Overwrites any previous contents of snapshot. */
+CORK_API void
+cork_histogram_get_snapshot(struct cork_histogram *histogram,
+                            struct cork_histogram_snapshot *snapshot);
+
+/* Returns the smallest value such that at least percentile percent of the
+ * recorded values are less than or equal to it (to within the histogram's
+ * precision).  percentile must be between 0 and 100. */
+CORK_API uint64_t
+cork_histogram_snapshot_percentile
+(const struct cork_histogram_snapshot *snapshot, double percentile);
+
+
+#endif /* LIBCORK_THREADS_METRICS_H */
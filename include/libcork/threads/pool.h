@@ -0,0 +1,126 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef LIBCORK_THREADS_POOL_H
+#define LIBCORK_THREADS_POOL_H
+
+#include <libcork/core/api.h>
+#include <libcork/core/callbacks.h>
+#include <libcork/core/types.h>
+
+
+/*-----------------------------------------------------------------------
+ * Tasks
+ */
+
+struct cork_task;
+
+/* Create a new task that will execute run.  The task doesn't do anything
+ * until you submit it to a thread pool (or attach it as a continuation of
+ * some other task).  Once the task has run, we free it, and use
+ * free_user_data to free user_data. */
+CORK_API struct cork_task *
+cork_task_new(void *user_data, cork_free_f free_user_data, cork_run_f run);
+
+/* Free a task that you haven't submitted to a pool.  You don't need to (and
+ * must not) free a task once it's been submitted. */
+CORK_API void
+cork_task_free(struct cork_task *task);
+
+/* Arrange for continuation to run once task has finished.  You can attach the
+ * same continuation to several tasks; it will run once all of them have
+ * finished.  You must attach every continuation before submitting any of the
+ * tasks that it waits for.  You don't submit the continuation yourself; it's
+ * submitted to the same pool as soon as it's ready. */
+CORK_API void
+cork_task_then(struct cork_task *task, struct cork_task *continuation);
+
+
+/*-----------------------------------------------------------------------
+ * Thread pools
+ */
+
+struct cork_thread_pool;
+
+/* Create a new thread pool with worker_count worker threads.  Pass 0 to use
+ * one worker for each online CPU.  The workers aren't started until you call
+ * cork_thread_pool_start. */
+CORK_API struct cork_thread_pool *
+cork_thread_pool_new(size_t worker_count);
+
+/* Wait for any outstanding tasks to finish, then stop the pool's workers and
+ * free the pool. */
+CORK_API void
+cork_thread_pool_free(struct cork_thread_pool *pool);
+
+CORK_API size_t
+cork_thread_pool_worker_count(struct cork_thread_pool *pool);
+
+/* Pin each worker to one CPU, assigning the given CPUs to the workers in
+ * turn.  You must call this before starting the pool. */
+CORK_API void
+cork_thread_pool_set_affinity(struct cork_thread_pool *pool,
+                              const unsigned int *cpus, size_t cpu_count);
+
+CORK_API int
+cork_thread_pool_start(struct cork_thread_pool *pool);
+
+/* Schedule task to run on one of the pool's workers.  When called from
+ * within one of the pool's workers, the task is pushed onto that worker's own
+ * deque; idle workers will steal it if the current worker doesn't get to it
+ * first.  The pool takes control of task. */
+CORK_API void
+cork_thread_pool_submit(struct cork_thread_pool *pool, struct cork_task *task);
+
+/* Wait until every task that has been submitted to the pool (including any
+ * continuations) has finished.  The calling thread helps run tasks while it
+ * waits.  If any of the tasks failed, we return the first of their errors.
+ * You must not call this from within a task. */
+CORK_API int
+cork_thread_pool_wait(struct cork_thread_pool *pool);
+
+
+/*-----------------------------------------------------------------------
+ * Parallel loops
+ */
+
+typedef int
+(*cork_parallel_for_f)(void *user_data, size_t start, size_t end);
+
+/* Call body for every index in [start, end), split into subranges of at most
+ * grain_size indices, which are spread across the pool's workers.  The calling
+ * thread helps run subranges, and we don't return until all of them have
+ * finished.  Unlike cork_thread_pool_wait, it's safe to call this from within
+ * a task.  If any call to body fails, we return the first of their errors;
+ * subranges that haven't started yet are skipped.  A grain_size of 0 means 1. */
+CORK_API int
+cork_thread_pool_parallel_for(struct cork_thread_pool *pool,
+                              size_t start, size_t end, size_t grain_size,
+                              void *user_data, cork_parallel_for_f body);
+
+
+
+/*-----------------------------------------------------------------------
+ * Parallel sorting
+ */
+
+/* Arrays shorter than this are sorted on the calling thread. */
+#define CORK_PARALLEL_SORT_THRESHOLD  16384
+
+/* Sort an array using the pool's workers, in the same way as cork_sort.  We
+ * sort a chunk of the array on each worker, and then merge the chunks
+ * together in parallel, which needs count elements of temporary space.  Like
+ * cork_thread_pool_parallel_for, it's safe to call this from within a task. */
+CORK_API int
+cork_thread_pool_parallel_sort(struct cork_thread_pool *pool,
+                               void *items, size_t count, size_t element_size,
+                               void *user_data, cork_compare_f compare);
+
+
+#endif /* LIBCORK_THREADS_POOL_H */
@@ -0,0 +1,1423 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libcork/core.h>
+#include <libcork/ds.h>
+#include <libcork/threads.h>
+
+
+/*-----------------------------------------------------------------------
+ * Options
+ */
+
+/* Each benchmark runs for at least this long, so that its per-operation
+ * timing is stable. */
+static uint64_t  min_time_ns = 200 * 1000 * 1000;
+static uint64_t  seed = 0x5eed;
+static bool  json_output = false;
+static bool  list_only = false;
+static char  **patterns = NULL;
+static int  pattern_count = 0;
+/* The largest number of threads to run the contention benchmarks with; 0
+ * means the number of online CPUs. */
+static size_t  max_threads = 0;
+
+#define OPT_VERSION 1000
+
+static struct option  opts[] = {
+    { "json", no_argument, NULL, 'j' },
+    { "list", no_argument, NULL, 'l' },
+    { "min-time", required_argument, NULL, 't' },
+    { "seed", required_argument, NULL, 's' },
+    { "threads", required_argument, NULL, 'T' },
+    { "version", no_argument, NULL, OPT_VERSION },
+    { NULL, 0, NULL, 0 }
+};
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "Usage: cork-bench [<options>] [<pattern>...]\n"
+            "\n"
+            "Runs every benchmark whose name contains any of the patterns\n"
+            "(or all of them, if you don't give any).\n"
+            "\n"
+            "Options:\n"
+            "  -j, --json          One JSON object per line\n"
+            "  -l, --list          List the benchmarks without running them\n"
+            "  -t, --min-time=<ms> Run each benchmark for at least this long\n"
+            "                      (default 200)\n"
+            "  -s, --seed=<n>      Seed for the generated keys and data\n"
+            "  -T, --threads=<n>   Run the contention benchmarks with up to\n"
+            "                      this many threads (default: #CPUs)\n");
+}
+
+static void
+print_version(void)
+{
+    const char  *version = cork_version_string();
+    const char  *revision = cork_revision_string();
+
+    printf("cork-bench %s\n", version);
+    if (strcmp(version, revision) != 0) {
+        printf("Revision %s\n", revision);
+    }
+}
+
+static void
+parse_options(int argc, char **argv)
+{
+    int  ch;
+    while ((ch = getopt_long(argc, argv, "+jlt:s:T:", opts, NULL)) != -1) {
+        switch (ch) {
+            case 'j':
+                json_output = true;
+                break;
+            case 'l':
+                list_only = true;
+                break;
+            case 't':
+                min_time_ns = strtoull(optarg, NULL, 0) * 1000 * 1000;
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'T':
+                max_threads = strtoull(optarg, NULL, 0);
+                break;
+            case OPT_VERSION:
+                print_version();
+                exit(EXIT_SUCCESS);
+            default:
+                usage();
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    patterns = argv + optind;
+    pattern_count = argc - optind;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Benchmark harness
+ */
+
+/* Each benchmark must perform exactly n operations, and may call
+ * bench_start and bench_stop as often as it likes, so that it can keep any
+ * setup and teardown out of the measured time. */
+struct bench {
+    uint64_t  elapsed_ns;
+    uint64_t  started_ns;
+    /* The number of bytes that each operation processes, if that's a useful
+     * thing to report. */
+    size_t  bytes_per_op;
+};
+
+typedef void
+(*bench_f)(struct bench *b, void *params, size_t n);
+
+/* Benchmarks store results here so that the compiler can't optimize away the
+ * work that produces them. */
+static volatile uintptr_t  sink;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+bench_start(struct bench *b)
+{
+    b->started_ns = now_ns();
+}
+
+static void
+bench_stop(struct bench *b)
+{
+    b->elapsed_ns += now_ns() - b->started_ns;
+}
+
+static bool
+bench_selected(const char *name)
+{
+    int  i;
+    if (pattern_count == 0) {
+        return true;
+    }
+    for (i = 0; i < pattern_count; i++) {
+        if (strstr(name, patterns[i]) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* The largest factor that we'll grow n by between attempts, in case the
+ * first few attempts are too short to time accurately. */
+#define BENCH_MAX_GROWTH  100
+
+static void
+bench_run(const char *name, bench_f run, void *params, size_t bytes_per_op)
+{
+    struct bench  b;
+    size_t  n = 1;
+    double  ns_per_op;
+
+    if (!bench_selected(name)) {
+        return;
+    }
+    if (list_only) {
+        printf("%s\n", name);
+        return;
+    }
+
+    for (;;) {
+        size_t  next;
+        b.elapsed_ns = 0;
+        b.bytes_per_op = bytes_per_op;
+        run(&b, params, n);
+        if (b.elapsed_ns >= min_time_ns) {
+            break;
+        }
+        /* Aim 20% past the minimum, based on how long this attempt took. */
+        if (b.elapsed_ns == 0) {
+            next = n * BENCH_MAX_GROWTH;
+        } else {
+            next = (size_t)
+                ((double) n * min_time_ns * 1.2 / b.elapsed_ns) + 1;
+            if (next > n * BENCH_MAX_GROWTH) {
+                next = n * BENCH_MAX_GROWTH;
+            }
+        }
+        n = next;
+    }
+
+    ns_per_op = (double) b.elapsed_ns / n;
+    if (json_output) {
+        printf("{\"name\":\"%s\",\"iterations\":%zu,\"ns_per_op\":%.3f",
+               name, n, ns_per_op);
+        if (bytes_per_op > 0) {
+            printf(",\"mb_per_sec\":%.3f",
+                   bytes_per_op * 1000.0 / ns_per_op);
+        }
+        printf("}\n");
+    } else {
+        printf("%s\t%zu\t%.3f", name, n, ns_per_op);
+        if (bytes_per_op > 0) {
+            printf("\t%.3f", bytes_per_op * 1000.0 / ns_per_op);
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Reproducible data
+ */
+
+static uint64_t  rng_state;
+
+static void
+rng_reset(void)
+{
+    /* xorshift gets stuck at 0 */
+    rng_state = (seed == 0)? 1: seed;
+}
+
+static uint64_t
+rng_next(void)
+{
+    /* xorshift64* */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * UINT64_C(2685821657736338717);
+}
+
+enum key_distribution {
+    /* 1, 2, 3, ... */
+    KEYS_SEQUENTIAL,
+    /* Uniformly random 64-bit values */
+    KEYS_UNIFORM,
+    /* Multiples of 4096, like page-aligned pointers; the low bits carry no
+     * information at all. */
+    KEYS_CLUSTERED
+};
+
+static const char  *key_distribution_names[] = {
+    "sequential", "uniform", "clustered"
+};
+
+static uintptr_t *
+keys_new(enum key_distribution dist, size_t count)
+{
+    uintptr_t  *keys = cork_calloc(count, sizeof(uintptr_t));
+    size_t  i;
+    rng_reset();
+    for (i = 0; i < count; i++) {
+        switch (dist) {
+            case KEYS_SEQUENTIAL:
+                keys[i] = i + 1;
+                break;
+            case KEYS_UNIFORM:
+                /* Skip the NULL key */
+                keys[i] = (uintptr_t) (rng_next() | 1);
+                break;
+            case KEYS_CLUSTERED:
+                keys[i] = (i + 1) << 12;
+                break;
+        }
+    }
+    /* Shuffle the sequential and clustered keys, too, so that the order that
+     * we touch them in doesn't favor any particular table layout. */
+    for (i = count; i > 1; i--) {
+        size_t  j = rng_next() % i;
+        uintptr_t  tmp = keys[i - 1];
+        keys[i - 1] = keys[j];
+        keys[j] = tmp;
+    }
+    return keys;
+}
+
+static void
+keys_free(uintptr_t *keys, size_t count)
+{
+    cork_cfree(keys, count, sizeof(uintptr_t));
+}
+
+
+/*-----------------------------------------------------------------------
+ * Hash tables
+ */
+
+struct hash_table_params {
+    unsigned int  flags;
+    size_t  size;
+    uintptr_t  *keys;
+};
+
+static struct cork_hash_table *
+hash_table_new(struct hash_table_params *p)
+{
+    return cork_pointer_hash_table_new
+        (0, p->flags | CORK_HASH_TABLE_FAST_HASH);
+}
+
+static void
+hash_table_fill(struct cork_hash_table *table, struct hash_table_params *p,
+                size_t count)
+{
+    size_t  i;
+    for (i = 0; i < count; i++) {
+        void  *key = (void *) p->keys[i];
+        cork_hash_table_put(table, key, key, NULL, NULL, NULL);
+    }
+}
+
+/* Each operation inserts one key; we start with a new, empty table every
+ * `size` operations. */
+static void
+bench_hash_table_insert(struct bench *b, void *params, size_t n)
+{
+    struct hash_table_params  *p = params;
+    while (n > 0) {
+        size_t  count = (n < p->size)? n: p->size;
+        struct cork_hash_table  *table = hash_table_new(p);
+        bench_start(b);
+        hash_table_fill(table, p, count);
+        bench_stop(b);
+        cork_hash_table_free(table);
+        n -= count;
+    }
+}
+
+/* Each operation looks up one key that's in the table. */
+static void
+bench_hash_table_lookup(struct bench *b, void *params, size_t n)
+{
+    struct hash_table_params  *p = params;
+    struct cork_hash_table  *table = hash_table_new(p);
+    uintptr_t  total = 0;
+    size_t  i;
+    hash_table_fill(table, p, p->size);
+    bench_start(b);
+    for (i = 0; i < n; i++) {
+        /* Visit the keys in a different order than we added them. */
+        size_t  index = (i * 7919) % p->size;
+        total += (uintptr_t)
+            cork_hash_table_get(table, (void *) p->keys[index]);
+    }
+    bench_stop(b);
+    sink = total;
+    cork_hash_table_free(table);
+}
+
+/* Each operation looks up one key that's not in the table. */
+static void
+bench_hash_table_miss(struct bench *b, void *params, size_t n)
+{
+    struct hash_table_params  *p = params;
+    struct cork_hash_table  *table = hash_table_new(p);
+    uintptr_t  total = 0;
+    size_t  i;
+    hash_table_fill(table, p, p->size / 2);
+    bench_start(b);
+    for (i = 0; i < n; i++) {
+        size_t  index = p->size / 2 + (i * 7919) % (p->size - p->size / 2);
+        total += (uintptr_t)
+            cork_hash_table_get(table, (void *) p->keys[index]);
+    }
+    bench_stop(b);
+    sink = total;
+    cork_hash_table_free(table);
+}
+
+/* Each operation deletes one key; we refill the table (untimed) whenever it's
+ * empty. */
+static void
+bench_hash_table_delete(struct bench *b, void *params, size_t n)
+{
+    struct hash_table_params  *p = params;
+    struct cork_hash_table  *table = hash_table_new(p);
+    while (n > 0) {
+        size_t  count = (n < p->size)? n: p->size;
+        size_t  i;
+        hash_table_fill(table, p, p->size);
+        bench_start(b);
+        for (i = 0; i < count; i++) {
+            cork_hash_table_delete
+                (table, (void *) p->keys[i], NULL, NULL);
+        }
+        bench_stop(b);
+        n -= count;
+    }
+    cork_hash_table_free(table);
+}
+
+static void
+bench_hash_tables(void)
+{
+    static const struct {
+        const char  *name;
+        unsigned int  flags;
+    } layouts[] = {
+        { "chained", 0 },
+        { "open", CORK_HASH_TABLE_OPEN_ADDRESSING }
+    };
+    static const size_t  sizes[] = { 1000, 100000 };
+    static const struct {
+        const char  *name;
+        bench_f  run;
+    } ops[] = {
+        { "insert", bench_hash_table_insert },
+        { "lookup", bench_hash_table_lookup },
+        { "miss", bench_hash_table_miss },
+        { "delete", bench_hash_table_delete }
+    };
+
+    size_t  layout;
+    size_t  size;
+    size_t  dist;
+    size_t  op;
+    struct cork_buffer  name = CORK_BUFFER_INIT();
+    struct hash_table_params  p;
+
+    for (layout = 0; layout < sizeof(layouts) / sizeof(layouts[0]);
+         layout++) {
+        for (dist = KEYS_SEQUENTIAL; dist <= KEYS_CLUSTERED; dist++) {
+            for (size = 0; size < sizeof(sizes) / sizeof(sizes[0]); size++) {
+                p.flags = layouts[layout].flags;
+                p.size = sizes[size];
+                p.keys = keys_new(dist, p.size);
+                for (op = 0; op < sizeof(ops) / sizeof(ops[0]); op++) {
+                    cork_buffer_printf
+                        (&name, "hash-table/%s/%s/%s/%zu",
+                         layouts[layout].name, ops[op].name,
+                         key_distribution_names[dist], p.size);
+                    bench_run(name.buf, ops[op].run, &p, 0);
+                }
+                keys_free(p.keys, p.size);
+            }
+        }
+    }
+    cork_buffer_done(&name);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Memory pools
+ */
+
+/* Each operation allocates an object and later frees it.  We keep a batch of
+ * objects alive at once, so that this isn't just a free-list ping-pong. */
+#define POOL_BATCH_SIZE  64
+
+static void
+bench_mempool(struct bench *b, void *params, size_t n)
+{
+    size_t  object_size = *(size_t *) params;
+    struct cork_mempool  *mp = cork_mempool_new_size(object_size);
+    void  *objects[POOL_BATCH_SIZE];
+    bench_start(b);
+    while (n > 0) {
+        size_t  count = (n < POOL_BATCH_SIZE)? n: POOL_BATCH_SIZE;
+        size_t  i;
+        for (i = 0; i < count; i++) {
+            objects[i] = cork_mempool_new_object(mp);
+        }
+        for (i = 0; i < count; i++) {
+            cork_mempool_free_object(mp, objects[i]);
+        }
+        n -= count;
+    }
+    bench_stop(b);
+    cork_mempool_free(mp);
+}
+
+static void
+bench_malloc(struct bench *b, void *params, size_t n)
+{
+    size_t  object_size = *(size_t *) params;
+    void  *objects[POOL_BATCH_SIZE];
+    bench_start(b);
+    while (n > 0) {
+        size_t  count = (n < POOL_BATCH_SIZE)? n: POOL_BATCH_SIZE;
+        size_t  i;
+        for (i = 0; i < count; i++) {
+            objects[i] = cork_malloc(object_size);
+        }
+        for (i = 0; i < count; i++) {
+            cork_free(objects[i], object_size);
+        }
+        n -= count;
+    }
+    bench_stop(b);
+}
+
+static void
+bench_allocators(void)
+{
+    static size_t  sizes[] = { 32, 256 };
+    struct cork_buffer  name = CORK_BUFFER_INIT();
+    size_t  i;
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        cork_buffer_printf(&name, "alloc/mempool/%zu", sizes[i]);
+        bench_run(name.buf, bench_mempool, &sizes[i], 0);
+        cork_buffer_printf(&name, "alloc/malloc/%zu", sizes[i]);
+        bench_run(name.buf, bench_malloc, &sizes[i], 0);
+    }
+    cork_buffer_done(&name);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Buffers
+ */
+
+/* We clear the buffer every so often, so that we measure appending rather
+ * than growing a huge buffer. */
+#define BUFFER_RESET_COUNT  4096
+
+static void
+bench_buffer_append(struct bench *b, void *params, size_t n)
+{
+    static const char  DATA[] = "0123456789abcdef";
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    size_t  i;
+    bench_start(b);
+    for (i = 0; i < n; i++) {
+        if (i % BUFFER_RESET_COUNT == 0) {
+            cork_buffer_clear(&buf);
+        }
+        cork_buffer_append(&buf, DATA, sizeof(DATA) - 1);
+    }
+    bench_stop(b);
+    cork_buffer_done(&buf);
+}
+
+static void
+bench_buffer_append_printf(struct bench *b, void *params, size_t n)
+{
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    size_t  i;
+    bench_start(b);
+    for (i = 0; i < n; i++) {
+        if (i % BUFFER_RESET_COUNT == 0) {
+            cork_buffer_clear(&buf);
+        }
+        cork_buffer_append_printf(&buf, "%zu:%s,", i, "value");
+    }
+    bench_stop(b);
+    cork_buffer_done(&buf);
+}
+
+static void
+bench_buffers(void)
+{
+    bench_run("buffer/append", bench_buffer_append, NULL, 16);
+    bench_run("buffer/append-printf", bench_buffer_append_printf, NULL, 0);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Slices
+ */
+
+struct slice_params {
+    struct cork_slice  slice;
+    bool  light;
+};
+
+/* Each operation makes a copy of a sub-slice and finishes it. */
+static void
+bench_slice_copy(struct bench *b, void *params, size_t n)
+{
+    struct slice_params  *p = params;
+    struct cork_slice  copy;
+    size_t  i;
+    bench_start(b);
+    for (i = 0; i < n; i++) {
+        size_t  offset = i % 16;
+        if (p->light) {
+            cork_slice_light_copy(&copy, &p->slice, offset, 16);
+        } else {
+            cork_slice_copy(&copy, &p->slice, offset, 16);
+        }
+        sink = (uintptr_t) copy.buf;
+        cork_slice_finish(&copy);
+    }
+    bench_stop(b);
+}
+
+static void
+bench_slices(void)
+{
+    static char  DATA[64] = "";
+    struct cork_managed_buffer  *mbuf;
+    struct slice_params  p;
+
+    cork_slice_init_static(&p.slice, DATA, sizeof(DATA));
+    p.light = false;
+    bench_run("slice/copy/static", bench_slice_copy, &p, 0);
+    p.light = true;
+    bench_run("slice/light-copy/static", bench_slice_copy, &p, 0);
+    cork_slice_finish(&p.slice);
+
+    mbuf = cork_managed_buffer_new_copy(DATA, sizeof(DATA));
+    cork_managed_buffer_slice_offset(&p.slice, mbuf, 0);
+    cork_managed_buffer_unref(mbuf);
+    p.light = false;
+    bench_run("slice/copy/managed", bench_slice_copy, &p, 0);
+    p.light = true;
+    bench_run("slice/light-copy/managed", bench_slice_copy, &p, 0);
+    cork_slice_finish(&p.slice);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Ring buffers
+ */
+
+#define RING_SIZE  1024
+
+/* Each operation adds one element and pops one, with the ring kept half
+ * full. */
+static void
+bench_ring_buffer(struct bench *b, void *params, size_t n)
+{
+    struct cork_ring_buffer  ring;
+    uintptr_t  total = 0;
+    size_t  i;
+    cork_ring_buffer_init(&ring, RING_SIZE);
+    for (i = 0; i < RING_SIZE / 2; i++) {
+        cork_ring_buffer_add(&ring, (void *) i);
+    }
+    bench_start(b);
+    for (i = 0; i < n; i++) {
+        cork_ring_buffer_add(&ring, (void *) i);
+        total += (uintptr_t) cork_ring_buffer_pop(&ring);
+    }
+    bench_stop(b);
+    sink = total;
+    cork_ring_buffer_done(&ring);
+}
+
+static void
+bench_typed_ring(struct bench *b, void *params, size_t n)
+{
+    cork_ring(uint64_t)  ring;
+    uint64_t  total = 0;
+    uint64_t  value = 0;
+    size_t  i;
+    cork_ring_init(&ring, RING_SIZE);
+    for (i = 0; i < RING_SIZE / 2; i++) {
+        cork_ring_add(&ring, i);
+    }
+    bench_start(b);
+    for (i = 0; i < n; i++) {
+        cork_ring_add(&ring, i);
+        cork_ring_pop(&ring, &value);
+        total += value;
+    }
+    bench_stop(b);
+    sink = total;
+    cork_ring_done(&ring);
+}
+
+static void
+bench_rings(void)
+{
+    bench_run("ring-buffer/pointers", bench_ring_buffer, NULL, 0);
+    bench_run("ring-buffer/typed", bench_typed_ring, NULL, 0);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Hashing
+ */
+
+enum hash_function {
+    HASH_DEFAULT,
+    HASH_FAST,
+    HASH_STABLE,
+    HASH_BIG
+};
+
+struct hash_params {
+    enum hash_function  function;
+    const void  *data;
+    size_t  length;
+};
+
+static void
+bench_hash(struct bench *b, void *params, size_t n)
+{
+    struct hash_params  *p = params;
+    cork_hash  total = 0;
+    size_t  i;
+    bench_start(b);
+    switch (p->function) {
+        case HASH_DEFAULT:
+            for (i = 0; i < n; i++) {
+                total += cork_hash_buffer(i, p->data, p->length);
+            }
+            break;
+        case HASH_FAST:
+            for (i = 0; i < n; i++) {
+                total += cork_fast_hash_buffer(i, p->data, p->length);
+            }
+            break;
+        case HASH_STABLE:
+            for (i = 0; i < n; i++) {
+                total += cork_stable_hash_buffer(i, p->data, p->length);
+            }
+            break;
+        case HASH_BIG:
+            for (i = 0; i < n; i++) {
+                cork_big_hash  seed = CORK_BIG_HASH_INIT();
+                cork_big_hash  hash;
+                cork_u128_be64(seed.u128, 0) = i;
+                hash = cork_big_hash_buffer(seed, p->data, p->length);
+                total += cork_u128_be32(hash.u128, 0);
+            }
+            break;
+    }
+    bench_stop(b);
+    sink = total;
+}
+
+static void
+bench_hashes(void)
+{
+    static const char  *names[] = { "default", "fast", "stable", "big" };
+    static const size_t  lengths[] = { 4, 16, 64, 256, 1024, 4096 };
+    struct cork_buffer  name = CORK_BUFFER_INIT();
+    uint8_t  *data;
+    size_t  max_length = lengths[sizeof(lengths) / sizeof(lengths[0]) - 1];
+    struct hash_params  p;
+    size_t  i;
+
+    data = cork_malloc(max_length);
+    rng_reset();
+    for (i = 0; i < max_length; i++) {
+        data[i] = (uint8_t) rng_next();
+    }
+    p.data = data;
+
+    for (p.function = HASH_DEFAULT; p.function <= HASH_BIG; p.function++) {
+        for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+            p.length = lengths[i];
+            cork_buffer_printf
+                (&name, "hash/%s/%zu", names[p.function], p.length);
+            bench_run(name.buf, bench_hash, &p, p.length);
+        }
+    }
+
+    cork_free(data, max_length);
+    cork_buffer_done(&name);
+}
+
+
+/*-----------------------------------------------------------------------
+ * IP addresses
+ */
+
+static const char  *IPV4_ADDRESSES[] = {
+    "0.0.0.0", "10.0.0.1", "127.0.0.1", "192.168.100.254",
+    "203.0.113.77", "255.255.255.255", "8.8.4.4", "172.16.31.9"
+};
+
+static const char  *IPV6_ADDRESSES[] = {
+    "::", "::1", "fe80::1", "2001:db8::ff00:42:8329",
+    "2001:0db8:85a3:0000:0000:8a2e:0370:7334", "::ffff:192.0.2.128",
+    "ff02::1:ff00:1", "2001:db8:1:2:3:4:5:6"
+};
+
+#define ADDRESS_COUNT  8
+
+/* Each operation parses one address. */
+static void
+bench_ip(struct bench *b, void *params, size_t n)
+{
+    const char  **addresses = params;
+    struct cork_ip  ip;
+    uintptr_t  total = 0;
+    size_t  i;
+    bench_start(b);
+    for (i = 0; i < n; i++) {
+        if (cork_ip_init(&ip, addresses[i % ADDRESS_COUNT]) == 0) {
+            total += ip.version;
+        }
+    }
+    bench_stop(b);
+    sink = total;
+}
+
+static void
+bench_ips(void)
+{
+    bench_run("ip/parse/ipv4", bench_ip, IPV4_ADDRESSES, 0);
+    bench_run("ip/parse/ipv6", bench_ip, IPV6_ADDRESSES, 0);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Contention harness
+ */
+
+/* Each contention benchmark runs the same workload in 1, 2, 4, ... threads at
+ * once, for min_time, and reports the total throughput along with the median
+ * and tail latencies.  We time operations in batches, since timing every
+ * single one would swamp the cheaper ones; the latencies are the time that
+ * each batch took, divided by the batch size. */
+#define THREAD_BATCH_SIZE  64
+
+/* The most latency samples that each thread keeps.  Once it has this many, it
+ * throws away every other one, and only keeps every other batch from then on,
+ * so the samples stay spread across the whole run. */
+#define THREAD_MAX_SAMPLES  16384
+
+struct thread_bench;
+
+struct bench_thread {
+    struct thread_bench  *bench;
+    size_t  index;
+    uint64_t  ops;
+    uint64_t  *samples;
+    size_t  sample_count;
+    size_t  sample_stride;
+    size_t  batch_count;
+};
+
+typedef void
+(*thread_bench_f)(struct bench_thread *t, void *params);
+
+struct thread_bench {
+    thread_bench_f  run;
+    void  *params;
+    volatile size_t  ready_count;
+    volatile int  started;
+    volatile int  stopped;
+};
+
+/* Call this before each batch.  The first call waits for every other thread
+ * to be ready, so that they all start at once. */
+static bool
+bench_thread_running(struct bench_thread *t)
+{
+    if (CORK_UNLIKELY(t->batch_count == 0 && t->ops == 0)) {
+        cork_atomic_fetch_add
+            (&t->bench->ready_count, 1, CORK_ATOMIC_RELEASE);
+        while (!cork_atomic_load(&t->bench->started, CORK_ATOMIC_ACQUIRE)) {
+            cork_pause();
+        }
+    }
+    return !cork_atomic_load(&t->bench->stopped, CORK_ATOMIC_RELAXED);
+}
+
+/* Call this after each batch of THREAD_BATCH_SIZE operations. */
+static void
+bench_thread_batch(struct bench_thread *t, uint64_t started_ns)
+{
+    uint64_t  elapsed = now_ns() - started_ns;
+    t->ops += THREAD_BATCH_SIZE;
+    if (t->batch_count++ % t->sample_stride != 0) {
+        return;
+    }
+    if (t->sample_count == THREAD_MAX_SAMPLES) {
+        size_t  i;
+        for (i = 0; i < THREAD_MAX_SAMPLES / 2; i++) {
+            t->samples[i] = t->samples[i * 2];
+        }
+        t->sample_count = THREAD_MAX_SAMPLES / 2;
+        t->sample_stride *= 2;
+    }
+    t->samples[t->sample_count++] = elapsed;
+}
+
+static int
+bench_thread__run(void *user_data)
+{
+    struct bench_thread  *t = user_data;
+    t->bench->run(t, t->bench->params);
+    return 0;
+}
+
+static int
+uint64_compare(const void *vv1, const void *vv2)
+{
+    const uint64_t  *v1 = vv1;
+    const uint64_t  *v2 = vv2;
+    return (*v1 < *v2)? -1: (*v1 > *v2)? 1: 0;
+}
+
+static double
+percentile_ns_per_op(const uint64_t *samples, size_t count, double p)
+{
+    size_t  index;
+    if (count == 0) {
+        return 0.0;
+    }
+    index = (size_t) (p * (count - 1));
+    return (double) samples[index] / THREAD_BATCH_SIZE;
+}
+
+static void
+sleep_ns(uint64_t ns)
+{
+    struct timespec  ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    while (nanosleep(&ts, &ts) == -1) {
+    }
+}
+
+static void
+thread_bench_run_one(const char *name, thread_bench_f run, void *params,
+                     size_t thread_count)
+{
+    struct thread_bench  bench;
+    struct bench_thread  *threads;
+    struct cork_thread  **handles;
+    uint64_t  *all_samples;
+    size_t  sample_count = 0;
+    uint64_t  total_ops = 0;
+    uint64_t  started_ns;
+    uint64_t  elapsed_ns;
+    double  ops_per_sec;
+    size_t  i;
+
+    bench.run = run;
+    bench.params = params;
+    bench.ready_count = 0;
+    bench.started = 0;
+    bench.stopped = 0;
+    threads = cork_calloc(thread_count, sizeof(struct bench_thread));
+    handles = cork_calloc(thread_count, sizeof(struct cork_thread *));
+
+    for (i = 0; i < thread_count; i++) {
+        struct bench_thread  *t = &threads[i];
+        t->bench = &bench;
+        t->index = i;
+        t->samples = cork_calloc(THREAD_MAX_SAMPLES, sizeof(uint64_t));
+        t->sample_stride = 1;
+        handles[i] = cork_thread_new("bench", t, NULL, bench_thread__run);
+        if (handles[i] == NULL || cork_thread_start(handles[i]) != 0) {
+            fprintf(stderr, "%s\n", cork_error_message());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    while (cork_atomic_load(&bench.ready_count, CORK_ATOMIC_ACQUIRE) <
+           thread_count) {
+        cork_pause();
+    }
+    started_ns = now_ns();
+    cork_atomic_store(&bench.started, 1, CORK_ATOMIC_RELEASE);
+    sleep_ns(min_time_ns);
+    cork_atomic_store(&bench.stopped, 1, CORK_ATOMIC_RELAXED);
+    for (i = 0; i < thread_count; i++) {
+        if (cork_thread_join(handles[i]) != 0) {
+            fprintf(stderr, "%s\n", cork_error_message());
+            exit(EXIT_FAILURE);
+        }
+    }
+    elapsed_ns = now_ns() - started_ns;
+
+    all_samples = cork_calloc
+        (thread_count * THREAD_MAX_SAMPLES, sizeof(uint64_t));
+    for (i = 0; i < thread_count; i++) {
+        struct bench_thread  *t = &threads[i];
+        total_ops += t->ops;
+        memcpy(all_samples + sample_count, t->samples,
+               t->sample_count * sizeof(uint64_t));
+        sample_count += t->sample_count;
+        cork_cfree(t->samples, THREAD_MAX_SAMPLES, sizeof(uint64_t));
+    }
+    qsort(all_samples, sample_count, sizeof(uint64_t), uint64_compare);
+
+    ops_per_sec = total_ops * 1e9 / elapsed_ns;
+    if (json_output) {
+        printf("{\"name\":\"%s\",\"threads\":%zu,\"ops_per_sec\":%.0f,"
+               "\"p50_ns\":%.3f,\"p99_ns\":%.3f,\"p999_ns\":%.3f}\n",
+               name, thread_count, ops_per_sec,
+               percentile_ns_per_op(all_samples, sample_count, 0.5),
+               percentile_ns_per_op(all_samples, sample_count, 0.99),
+               percentile_ns_per_op(all_samples, sample_count, 0.999));
+    } else {
+        printf("%s\t%zu\t%.0f\t%.3f\t%.3f\t%.3f\n",
+               name, thread_count, ops_per_sec,
+               percentile_ns_per_op(all_samples, sample_count, 0.5),
+               percentile_ns_per_op(all_samples, sample_count, 0.99),
+               percentile_ns_per_op(all_samples, sample_count, 0.999));
+    }
+    fflush(stdout);
+
+    cork_cfree(all_samples, thread_count * THREAD_MAX_SAMPLES,
+               sizeof(uint64_t));
+    cork_cfree(handles, thread_count, sizeof(struct cork_thread *));
+    cork_cfree(threads, thread_count, sizeof(struct bench_thread));
+}
+
+/* Runs with 1, 2, 4, ... threads, and then with max_threads, if that's not a
+ * power of two. */
+static void
+thread_bench_run(const char *name, thread_bench_f run, void *params)
+{
+    struct cork_buffer  full_name = CORK_BUFFER_INIT();
+    size_t  thread_count;
+    bool  done = false;
+
+    for (thread_count = 1; !done; thread_count *= 2) {
+        if (thread_count >= max_threads) {
+            thread_count = max_threads;
+            done = true;
+        }
+        cork_buffer_printf(&full_name, "%s/%zu", name, thread_count);
+        if (!bench_selected(full_name.buf)) {
+            continue;
+        }
+        if (list_only) {
+            printf("%s\n", (char *) full_name.buf);
+        } else {
+            thread_bench_run_one(full_name.buf, run, params, thread_count);
+        }
+    }
+    cork_buffer_done(&full_name);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Atomics
+ */
+
+#define CACHE_LINE_SIZE  64
+
+/* One counter per thread, each on its own cache line */
+struct padded_counter {
+    volatile size_t  value;
+    char  padding[CACHE_LINE_SIZE - sizeof(size_t)];
+};
+
+#define BENCH_MAX_THREADS  256
+
+static volatile size_t  shared_counter;
+static struct padded_counter  private_counters[BENCH_MAX_THREADS];
+
+static void
+bench_atomic_add_shared(struct bench_thread *t, void *params)
+{
+    size_t  i;
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            cork_atomic_fetch_add(&shared_counter, 1, CORK_ATOMIC_RELAXED);
+        }
+        bench_thread_batch(t, start);
+    }
+}
+
+static void
+bench_atomic_add_private(struct bench_thread *t, void *params)
+{
+    volatile size_t  *counter = &private_counters[t->index].value;
+    size_t  i;
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            cork_atomic_fetch_add(counter, 1, CORK_ATOMIC_RELAXED);
+        }
+        bench_thread_batch(t, start);
+    }
+}
+
+static void
+bench_atomic_cas_shared(struct bench_thread *t, void *params)
+{
+    size_t  i;
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            size_t  expected =
+                cork_atomic_load(&shared_counter, CORK_ATOMIC_RELAXED);
+            while (!cork_atomic_cas
+                   (&shared_counter, &expected, expected + 1,
+                    CORK_ATOMIC_ACQ_REL, CORK_ATOMIC_RELAXED)) {
+            }
+        }
+        bench_thread_batch(t, start);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Once and thread-local storage
+ */
+
+cork_once_barrier(bench_once);
+static volatile size_t  bench_once_count;
+
+static void
+bench_once_init(void)
+{
+    bench_once_count++;
+}
+
+/* Every call after the first one takes the already-initialized fast path, so
+ * this measures what every caller of a lazily initialized global pays. */
+static void
+bench_once(struct bench_thread *t, void *params)
+{
+    size_t  i;
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            cork_once(bench_once, bench_once_init());
+        }
+        bench_thread_batch(t, start);
+    }
+}
+
+cork_tls(size_t, bench_tls);
+cork_tls_fast(size_t, bench_tls_fast);
+
+static void
+bench_tls(struct bench_thread *t, void *params)
+{
+    size_t  i;
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            volatile size_t  *value = bench_tls_get();
+            (*value)++;
+        }
+        bench_thread_batch(t, start);
+    }
+}
+
+static void
+bench_tls_fast(struct bench_thread *t, void *params)
+{
+    size_t  i;
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            volatile size_t  *value = bench_tls_fast_get();
+            (*value)++;
+        }
+        bench_thread_batch(t, start);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Garbage collection and memory pools
+ */
+
+struct bench_gc_obj {
+    size_t  value;
+};
+
+static struct cork_gc_obj_iface  bench_gc_obj__gc = { NULL, NULL, NULL };
+
+/* Each thread churns the reference count of its own object, since gc objects
+ * belong to the thread that created them. */
+static void
+bench_gc_refcount(struct bench_thread *t, void *params)
+{
+    struct bench_gc_obj  *obj;
+    size_t  i;
+    cork_gc_init();
+    obj = cork_gc_new(bench_gc_obj);
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            cork_gc_incref(obj);
+            cork_gc_decref(obj);
+        }
+        bench_thread_batch(t, start);
+    }
+    cork_gc_decref(obj);
+    cork_gc_done();
+}
+
+static void
+bench_gc_alloc(struct bench_thread *t, void *params)
+{
+    size_t  i;
+    cork_gc_init();
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            struct bench_gc_obj  *obj = cork_gc_new(bench_gc_obj);
+            obj->value = i;
+            cork_gc_decref(obj);
+        }
+        bench_thread_batch(t, start);
+    }
+    cork_gc_done();
+}
+
+/* Each operation allocates an object from a pool that every thread shares,
+ * and later frees it. */
+static void
+bench_mempool_shared(struct bench_thread *t, void *params)
+{
+    struct cork_mempool  *mp = params;
+    void  *objects[THREAD_BATCH_SIZE];
+    size_t  i;
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            objects[i] = cork_mempool_new_object(mp);
+        }
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            cork_mempool_free_object(mp, objects[i]);
+        }
+        bench_thread_batch(t, start);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Concurrent data structures
+ */
+
+#define SHARED_TABLE_SIZE  10000
+
+static uintptr_t  *shared_keys;
+
+static void
+bench_concurrent_hash_table_read(struct bench_thread *t, void *params)
+{
+    struct cork_concurrent_hash_table  *table = params;
+    uintptr_t  total = 0;
+    size_t  next = t->index * 7919;
+    size_t  i;
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            unsigned int  ticket =
+                cork_concurrent_hash_table_read_begin(table);
+            void  *key = (void *) shared_keys[next++ % SHARED_TABLE_SIZE];
+            total += (uintptr_t) cork_concurrent_hash_table_get(table, key);
+            cork_concurrent_hash_table_read_end(table, ticket);
+        }
+        bench_thread_batch(t, start);
+    }
+    sink = total;
+}
+
+/* 90% lookups and 10% overwrites of existing keys */
+static void
+bench_sharded_hash_table_mixed(struct bench_thread *t, void *params)
+{
+    struct cork_sharded_hash_table  *table = params;
+    uintptr_t  total = 0;
+    size_t  next = t->index * 7919;
+    size_t  i;
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            void  *key = (void *) shared_keys[next++ % SHARED_TABLE_SIZE];
+            if (i % 10 == 0) {
+                cork_sharded_hash_table_put
+                    (table, key, key, NULL, NULL, NULL);
+            } else {
+                total += (uintptr_t) cork_sharded_hash_table_get(table, key);
+            }
+        }
+        bench_thread_batch(t, start);
+    }
+    sink = total;
+}
+
+/* Each operation adds an element to a ring that every thread shares, and pops
+ * one (not necessarily the same one). */
+static void
+bench_mpmc_ring_buffer(struct bench_thread *t, void *params)
+{
+    struct cork_mpmc_ring_buffer  *ring = params;
+    uintptr_t  total = 0;
+    size_t  i;
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            cork_mpmc_ring_buffer_add(ring, (void *) (i + 1));
+            total += (uintptr_t) cork_mpmc_ring_buffer_pop(ring);
+        }
+        bench_thread_batch(t, start);
+    }
+    sink = total;
+}
+
+/* Each thread starts out pushing its own item, but the items get shuffled
+ * between threads, so they have to outlive all of them. */
+static struct cork_stack_item  stack_items[BENCH_MAX_THREADS];
+
+/* Each operation pushes an item onto a stack that every thread shares, and
+ * pops one (not necessarily the same one). */
+static void
+bench_stack(struct bench_thread *t, void *params)
+{
+    struct cork_stack  *stack = params;
+    struct cork_stack_item  *popped = &stack_items[t->index];
+    size_t  i;
+    while (bench_thread_running(t)) {
+        uint64_t  start = now_ns();
+        for (i = 0; i < THREAD_BATCH_SIZE; i++) {
+            /* Whatever we popped last time is now ours to push. */
+            cork_stack_push(stack, popped);
+            while ((popped = cork_stack_pop(stack)) == NULL) {
+                cork_pause();
+            }
+        }
+        bench_thread_batch(t, start);
+    }
+}
+
+static void
+bench_contention(void)
+{
+    struct cork_mempool  *mp;
+    struct cork_concurrent_hash_table  *ctable;
+    struct cork_sharded_hash_table  *stable;
+    struct cork_mpmc_ring_buffer  ring;
+    struct cork_stack  stack = CORK_STACK_INIT;
+    size_t  i;
+
+    if (max_threads == 0) {
+        long  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        max_threads = (cpus < 1)? 1: cpus;
+    }
+    if (max_threads > BENCH_MAX_THREADS) {
+        max_threads = BENCH_MAX_THREADS;
+    }
+    if (!list_only && !json_output) {
+        printf("# name\tthreads\tops_per_sec\tp50_ns\tp99_ns\tp999_ns\n");
+    }
+
+    thread_bench_run("threads/atomic-add/shared",
+                     bench_atomic_add_shared, NULL);
+    thread_bench_run("threads/atomic-add/private",
+                     bench_atomic_add_private, NULL);
+    thread_bench_run("threads/atomic-cas/shared",
+                     bench_atomic_cas_shared, NULL);
+    thread_bench_run("threads/once", bench_once, NULL);
+    thread_bench_run("threads/tls", bench_tls, NULL);
+    thread_bench_run("threads/tls-fast", bench_tls_fast, NULL);
+    thread_bench_run("threads/gc/refcount", bench_gc_refcount, NULL);
+    thread_bench_run("threads/gc/alloc", bench_gc_alloc, NULL);
+
+    mp = cork_mempool_new_size(64);
+    cork_mempool_set_thread_cache(mp, CORK_MEMPOOL_DEFAULT_MAGAZINE_SIZE);
+    thread_bench_run("threads/mempool/thread-cache",
+                     bench_mempool_shared, mp);
+    cork_mempool_free(mp);
+
+    shared_keys = keys_new(KEYS_UNIFORM, SHARED_TABLE_SIZE);
+    ctable = cork_concurrent_hash_table_new(0, 0);
+    stable = cork_sharded_hash_table_new(0, 0, 0);
+    for (i = 0; i < SHARED_TABLE_SIZE; i++) {
+        void  *key = (void *) shared_keys[i];
+        cork_concurrent_hash_table_put(ctable, key, key, NULL, NULL, NULL);
+        cork_sharded_hash_table_put(stable, key, key, NULL, NULL, NULL);
+    }
+    thread_bench_run("threads/concurrent-hash-table/read",
+                     bench_concurrent_hash_table_read, ctable);
+    thread_bench_run("threads/sharded-hash-table/mixed",
+                     bench_sharded_hash_table_mixed, stable);
+    cork_concurrent_hash_table_free(ctable);
+    cork_sharded_hash_table_free(stable);
+    keys_free(shared_keys, SHARED_TABLE_SIZE);
+
+    cork_mpmc_ring_buffer_init(&ring, 1024);
+    thread_bench_run("threads/mpmc-ring-buffer",
+                     bench_mpmc_ring_buffer, &ring);
+    cork_mpmc_ring_buffer_done(&ring);
+
+    thread_bench_run("threads/stack", bench_stack, &stack);
+    cork_stack_done(&stack);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Main
+ */
+
+int
+main(int argc, char **argv)
+{
+    parse_options(argc, argv);
+    if (!list_only && !json_output) {
+        printf("# name\titerations\tns_per_op\tmb_per_sec\n");
+    }
+    bench_hash_tables();
+    bench_allocators();
+    bench_buffers();
+    bench_slices();
+    bench_rings();
+    bench_hashes();
+    bench_ips();
+    bench_contention();
+    return EXIT_SUCCESS;
+}
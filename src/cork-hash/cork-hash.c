@@ -7,12 +7,16 @@
  * ----------------------------------------------------------------------
  */
 
+#include <fcntl.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <libcork/core.h>
+#include <libcork/ds.h>
 
 enum cork_hash_type {
     CORK_HASH_BIG,
@@ -21,7 +25,13 @@ enum cork_hash_type {
 };
 
 static enum cork_hash_type  type = CORK_HASH_STABLE;
+static bool  type_given = false;
 static const char  *string = NULL;
+/* Where to read from in --file, --lines, and --bench mode; "-" is stdin.
+ * NULL means that we're hashing the command-line string. */
+static const char  *path = NULL;
+static bool  lines = false;
+static bool  bench = false;
 
 #define OPT_VERSION 1000
 
@@ -29,6 +39,9 @@ static struct option  opts[] = {
     { "big", no_argument, NULL, 'b' },
     { "fastest", no_argument, NULL, 'f' },
     { "stable", no_argument, NULL, 's' },
+    { "file", no_argument, NULL, 'F' },
+    { "lines", no_argument, NULL, 'l' },
+    { "bench", no_argument, NULL, 'B' },
     { "version", no_argument, NULL, OPT_VERSION },
     { NULL, 0, NULL, 0 }
 };
@@ -38,11 +51,18 @@ usage(void)
 {
     fprintf(stderr,
             "Usage: cork-hash [<options>] <string>\n"
+            "       cork-hash [<options>] --file [<path>]\n"
+            "       cork-hash [<options>] --lines [<path>]\n"
+            "       cork-hash [<options>] --bench [--lines] [<path>]\n"
             "\n"
             "Options:\n"
             "  -b, --big\n"
             "  -f, --fastest\n"
-            "  -s, --stable\n");
+            "  -s, --stable\n"
+            "  -F, --file   Hash the entire contents of a file (or stdin)\n"
+            "  -l, --lines  Hash each line of a file (or stdin) separately\n"
+            "  -B, --bench  Measure how fast each hash function is, on\n"
+            "               generated data or on the contents of a file\n");
 }
 
 static void
@@ -61,16 +81,29 @@ static void
 parse_options(int argc, char **argv)
 {
     int  ch;
-    while ((ch = getopt_long(argc, argv, "+bfs", opts, NULL)) != -1) {
+    while ((ch = getopt_long(argc, argv, "+bfsFlB", opts, NULL)) != -1) {
         switch (ch) {
             case 'b':
                 type = CORK_HASH_BIG;
+                type_given = true;
                 break;
             case 'f':
                 type = CORK_HASH_FASTEST;
+                type_given = true;
                 break;
             case 's':
                 type = CORK_HASH_STABLE;
+                type_given = true;
+                break;
+            case 'F':
+                path = "-";
+                break;
+            case 'l':
+                lines = true;
+                path = "-";
+                break;
+            case 'B':
+                bench = true;
                 break;
             case OPT_VERSION:
                 print_version();
@@ -81,6 +114,17 @@ parse_options(int argc, char **argv)
         }
     }
 
+    /* --bench on its own uses generated data, unless we're given a file. */
+    if (bench || path != NULL) {
+        if (optind == argc-1) {
+            path = argv[optind];
+        } else if (optind != argc) {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
     if (optind != argc-1) {
         usage();
         exit(EXIT_FAILURE);
@@ -89,31 +133,493 @@ parse_options(int argc, char **argv)
     string = argv[optind];
 }
 
-int
-main(int argc, char **argv)
+#define ri_check_exit(call) \
+    do { \
+        if ((call) != 0) { \
+            fprintf(stderr, "%s\n", cork_error_message()); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+
+/*-----------------------------------------------------------------------
+ * Printing hashes
+ */
+
+static void
+print_hash(cork_hash hash)
 {
-    parse_options(argc, argv);
+    printf("0x%08" PRIx32 "\n", hash);
+}
+
+static void
+print_big_hash(cork_big_hash hash)
+{
+    printf("%016" PRIx64 "%016" PRIx64 "\n",
+           cork_u128_be64(hash.u128, 0),
+           cork_u128_be64(hash.u128, 1));
+}
 
+/* Hashes a single buffer with the selected hash function. */
+static void
+print_buffer_hash(const void *buf, size_t size)
+{
     if (type == CORK_HASH_BIG) {
-        cork_big_hash  result = CORK_BIG_HASH_INIT();
-        result = cork_big_hash_buffer(result, string, strlen(string));
-        printf("%016" PRIx64 "%016" PRIx64 "\n",
-               cork_u128_be64(result.u128, 0),
-               cork_u128_be64(result.u128, 1));
+        cork_big_hash  seed = CORK_BIG_HASH_INIT();
+        print_big_hash(cork_big_hash_buffer(seed, buf, size));
+    } else if (type == CORK_HASH_FASTEST) {
+        print_hash(cork_hash_buffer(0, buf, size));
+    } else {
+        print_hash(cork_stable_hash_buffer(0, buf, size));
     }
+}
 
-    if (type == CORK_HASH_FASTEST) {
-        /* don't include NUL terminator in hash */
-        cork_hash  result = 0;
-        result = cork_hash_buffer(result, string, strlen(string));
-        printf("0x%08" PRIx32 "\n", result);
+
+/*-----------------------------------------------------------------------
+ * Reading input
+ */
+
+static void
+consume_input(struct cork_stream_consumer *consumer)
+{
+    if (strcmp(path, "-") == 0) {
+        ri_check_exit(cork_consume_fd(consumer, STDIN_FILENO));
+    } else {
+        ri_check_exit(cork_consume_file_from_path(consumer, path, O_RDONLY));
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Hashing an entire file
+ */
+
+/* Streams the file through an incremental hash state, so we never need to
+ * hold more than one chunk of it in memory.  The result is the same as hashing
+ * the entire file as a single string. */
+struct file_hasher {
+    struct cork_stream_consumer  parent;
+    struct cork_big_hash_state  big;
+    struct cork_hash_state  fastest;
+    struct cork_stable_hash_state  stable;
+};
+
+static int
+file_hasher__data(struct cork_stream_consumer *consumer,
+                  const void *buf, size_t size, bool is_first_chunk)
+{
+    struct file_hasher  *self =
+        cork_container_of(consumer, struct file_hasher, parent);
+    if (type == CORK_HASH_BIG) {
+        cork_big_hash_state_update(&self->big, buf, size);
+    } else if (type == CORK_HASH_FASTEST) {
+        cork_hash_state_update(&self->fastest, buf, size);
+    } else {
+        cork_stable_hash_state_update(&self->stable, buf, size);
+    }
+    return 0;
+}
+
+static int
+file_hasher__eof(struct cork_stream_consumer *consumer)
+{
+    struct file_hasher  *self =
+        cork_container_of(consumer, struct file_hasher, parent);
+    if (type == CORK_HASH_BIG) {
+        print_big_hash(cork_big_hash_state_final(&self->big));
+    } else if (type == CORK_HASH_FASTEST) {
+        print_hash(cork_hash_state_final(&self->fastest));
+    } else {
+        print_hash(cork_stable_hash_state_final(&self->stable));
     }
+    return 0;
+}
+
+static void
+hash_file(void)
+{
+    cork_big_hash  big_seed = CORK_BIG_HASH_INIT();
+    struct file_hasher  hasher;
+    hasher.parent.data = file_hasher__data;
+    hasher.parent.eof = file_hasher__eof;
+    hasher.parent.free = NULL;
+    cork_big_hash_state_init(&hasher.big, big_seed);
+    cork_hash_state_init(&hasher.fastest, 0);
+    cork_stable_hash_state_init(&hasher.stable, 0);
+    consume_input(&hasher.parent);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Hashing each line of a file
+ */
+
+/* The most keys that we hash at once with cork_hash_buffers */
+#define LINE_BATCH_SIZE  64
+
+/* Hashes each newline-separated key, printing one hash per line, in the same
+ * order as the keys.  Keys that fit within a single chunk of input are hashed
+ * in place, in batches; only keys that straddle two chunks are copied. */
+struct line_hasher {
+    struct cork_stream_consumer  parent;
+    /* A key that started in an earlier chunk */
+    struct cork_buffer  partial;
+    const void  *keys[LINE_BATCH_SIZE];
+    size_t  lengths[LINE_BATCH_SIZE];
+    size_t  count;
+};
+
+static void
+line_hasher_flush(struct line_hasher *self)
+{
+    cork_hash  hashes[LINE_BATCH_SIZE];
+    size_t  i;
+    if (self->count == 0) {
+        return;
+    }
+    if (type == CORK_HASH_BIG) {
+        for (i = 0; i < self->count; i++) {
+            print_buffer_hash(self->keys[i], self->lengths[i]);
+        }
+    } else {
+        if (type == CORK_HASH_FASTEST) {
+            cork_hash_buffers
+                (0, self->keys, self->lengths, self->count, hashes);
+        } else {
+            cork_stable_hash_buffers
+                (0, self->keys, self->lengths, self->count, hashes);
+        }
+        for (i = 0; i < self->count; i++) {
+            print_hash(hashes[i]);
+        }
+    }
+    self->count = 0;
+}
+
+static void
+line_hasher_add(struct line_hasher *self, const void *key, size_t length)
+{
+    self->keys[self->count] = key;
+    self->lengths[self->count] = length;
+    if (++self->count == LINE_BATCH_SIZE) {
+        line_hasher_flush(self);
+    }
+}
+
+static int
+line_hasher__data(struct cork_stream_consumer *consumer,
+                  const void *vbuf, size_t size, bool is_first_chunk)
+{
+    struct line_hasher  *self =
+        cork_container_of(consumer, struct line_hasher, parent);
+    const char  *buf = vbuf;
+    const char  *end = buf + size;
+
+    while (buf < end) {
+        const char  *newline = memchr(buf, '\n', end - buf);
+        if (newline == NULL) {
+            /* The rest of the chunk is the start of a key that we'll finish
+             * in a later chunk. */
+            cork_buffer_append(&self->partial, buf, end - buf);
+            break;
+        }
+        if (self->partial.size > 0) {
+            cork_buffer_append(&self->partial, buf, newline - buf);
+            line_hasher_flush(self);
+            print_buffer_hash(self->partial.buf, self->partial.size);
+            cork_buffer_clear(&self->partial);
+        } else {
+            line_hasher_add(self, buf, newline - buf);
+        }
+        buf = newline + 1;
+    }
+
+    /* The chunk is only valid until we return. */
+    line_hasher_flush(self);
+    return 0;
+}
+
+static int
+line_hasher__eof(struct cork_stream_consumer *consumer)
+{
+    struct line_hasher  *self =
+        cork_container_of(consumer, struct line_hasher, parent);
+    /* A final key without a trailing newline */
+    if (self->partial.size > 0) {
+        print_buffer_hash(self->partial.buf, self->partial.size);
+        cork_buffer_clear(&self->partial);
+    }
+    return 0;
+}
+
+static void
+hash_lines(void)
+{
+    struct line_hasher  hasher;
+    hasher.parent.data = line_hasher__data;
+    hasher.parent.eof = line_hasher__eof;
+    hasher.parent.free = NULL;
+    cork_buffer_init(&hasher.partial);
+    hasher.count = 0;
+    consume_input(&hasher.parent);
+    cork_buffer_done(&hasher.partial);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Benchmarks
+ */
+
+/* How long to hash each kind of input for */
+#define BENCH_TIME_NS  (250 * 1000 * 1000)
+
+/* A set of keys to hash, one at a time or in batches */
+struct bench_input {
+    const char  *name;
+    const void  **keys;
+    size_t  *lengths;
+    size_t  count;
+    size_t  total_size;
+};
+
+static const char  *type_names[] = { "big", "fastest", "stable" };
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec  ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static volatile cork_hash  sink;
+
+/* Hashes every key in the input once, either one at a time or in batches. */
+static void
+bench_pass(enum cork_hash_type t, const struct bench_input *input,
+           bool batched)
+{
+    cork_hash  hashes[LINE_BATCH_SIZE];
+    cork_hash  total = 0;
+    size_t  i;
+
+    if (batched) {
+        for (i = 0; i < input->count; i += LINE_BATCH_SIZE) {
+            size_t  count = input->count - i;
+            if (count > LINE_BATCH_SIZE) {
+                count = LINE_BATCH_SIZE;
+            }
+            if (t == CORK_HASH_FASTEST) {
+                cork_hash_buffers
+                    (0, input->keys + i, input->lengths + i, count, hashes);
+            } else {
+                cork_stable_hash_buffers
+                    (0, input->keys + i, input->lengths + i, count, hashes);
+            }
+            total += hashes[0];
+        }
+    } else {
+        for (i = 0; i < input->count; i++) {
+            if (t == CORK_HASH_BIG) {
+                cork_big_hash  seed = CORK_BIG_HASH_INIT();
+                cork_big_hash  hash = cork_big_hash_buffer
+                    (seed, input->keys[i], input->lengths[i]);
+                total += cork_u128_be32(hash.u128, 0);
+            } else if (t == CORK_HASH_FASTEST) {
+                total += cork_hash_buffer
+                    (0, input->keys[i], input->lengths[i]);
+            } else {
+                total += cork_stable_hash_buffer
+                    (0, input->keys[i], input->lengths[i]);
+            }
+        }
+    }
+    sink = total;
+}
+
+static void
+bench_input_run(const struct bench_input *input)
+{
+    enum cork_hash_type  t;
+    int  batched;
+
+    for (t = CORK_HASH_BIG; t <= CORK_HASH_STABLE; t++) {
+        if (type_given && t != type) {
+            continue;
+        }
+        /* There's no batched version of the big hash. */
+        for (batched = 0; batched <= (t != CORK_HASH_BIG); batched++) {
+            uint64_t  started = now_ns();
+            uint64_t  elapsed;
+            uint64_t  bytes = 0;
+            do {
+                bench_pass(t, input, batched);
+                bytes += input->total_size;
+                elapsed = now_ns() - started;
+            } while (elapsed < BENCH_TIME_NS);
+            printf("%s%s\t%s\t%zu\t%.3f\n",
+                   type_names[t], batched? "-batched": "", input->name,
+                   input->total_size / input->count,
+                   (double) bytes / elapsed);
+            fflush(stdout);
+        }
+    }
+}
+
+static void
+bench_input_init(struct bench_input *input, const char *name, size_t count)
+{
+    input->name = name;
+    input->keys = cork_calloc(count, sizeof(const void *));
+    input->lengths = cork_calloc(count, sizeof(size_t));
+    input->count = 0;
+    input->total_size = 0;
+}
+
+static void
+bench_input_add(struct bench_input *input, const void *key, size_t length)
+{
+    input->keys[input->count] = key;
+    input->lengths[input->count] = length;
+    input->count++;
+    input->total_size += length;
+}
+
+static void
+bench_input_done(struct bench_input *input, size_t count)
+{
+    cork_cfree(input->keys, count, sizeof(const void *));
+    cork_cfree(input->lengths, count, sizeof(size_t));
+}
+
+/* The size of the generated data that we carve keys out of */
+#define BENCH_DATA_SIZE  (4 * 1024 * 1024)
+
+static void
+bench_generated(void)
+{
+    static const size_t  lengths[] = { 4, 8, 16, 64, 256, 4096, 65536 };
+    static const char  *length_names[] = {
+        "fixed-4", "fixed-8", "fixed-16", "fixed-64", "fixed-256",
+        "fixed-4096", "fixed-65536"
+    };
+    uint8_t  *data = cork_malloc(BENCH_DATA_SIZE);
+    uint64_t  state = 0x5eed;
+    struct bench_input  input;
+    size_t  count;
+    size_t  offset;
+    size_t  i;
+
+    for (i = 0; i < BENCH_DATA_SIZE; i++) {
+        /* xorshift64 */
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        data[i] = (uint8_t) state;
+    }
+
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        count = BENCH_DATA_SIZE / lengths[i];
+        bench_input_init(&input, length_names[i], count);
+        for (offset = 0; input.count < count; offset += lengths[i]) {
+            bench_input_add(&input, data + offset, lengths[i]);
+        }
+        bench_input_run(&input);
+        bench_input_done(&input, count);
+    }
+
+    /* Short keys of varying lengths, like identifiers or hostnames */
+    count = BENCH_DATA_SIZE / 64;
+    bench_input_init(&input, "mixed-1-64", count);
+    for (offset = 0; input.count < count; ) {
+        size_t  length = 1 + data[offset] % 64;
+        bench_input_add(&input, data + offset, length);
+        offset += length;
+    }
+    bench_input_run(&input);
+    bench_input_done(&input, count);
+
+    cork_free(data, BENCH_DATA_SIZE);
+}
+
+static void
+bench_file(void)
+{
+    struct cork_buffer  contents = CORK_BUFFER_INIT();
+    struct bench_input  input;
+    int  fd;
+
+    if (strcmp(path, "-") == 0) {
+        fd = STDIN_FILENO;
+    } else if ((fd = open(path, O_RDONLY)) == -1) {
+        cork_system_error_set();
+        ri_check_exit(-1);
+    }
+    ri_check_exit(cork_buffer_append_fd(&contents, fd));
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+    if (contents.size == 0) {
+        fprintf(stderr, "Nothing to hash\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (lines) {
+        const char  *buf = contents.buf;
+        const char  *end = buf + contents.size;
+        /* Every key needs at least its newline, except for the last one. */
+        size_t  max_count = contents.size + 1;
+        bench_input_init(&input, "lines", max_count);
+        while (buf < end) {
+            const char  *newline = memchr(buf, '\n', end - buf);
+            if (newline == NULL) {
+                newline = end;
+            }
+            bench_input_add(&input, buf, newline - buf);
+            buf = newline + 1;
+        }
+        bench_input_run(&input);
+        bench_input_done(&input, max_count);
+    } else {
+        bench_input_init(&input, "file", 1);
+        bench_input_add(&input, contents.buf, contents.size);
+        bench_input_run(&input);
+        bench_input_done(&input, 1);
+    }
+
+    cork_buffer_done(&contents);
+}
+
+static void
+run_bench(void)
+{
+    printf("# hash\tinput\tavg_length\tgb_per_sec\n");
+    if (path == NULL) {
+        bench_generated();
+    } else {
+        bench_file();
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Main
+ */
+
+int
+main(int argc, char **argv)
+{
+    parse_options(argc, argv);
 
-    if (type == CORK_HASH_STABLE) {
+    if (bench) {
+        run_bench();
+    } else if (lines) {
+        hash_lines();
+    } else if (path != NULL) {
+        hash_file();
+    } else {
         /* don't include NUL terminator in hash */
-        cork_hash  result = 0;
-        result = cork_stable_hash_buffer(result, string, strlen(string));
-        printf("0x%08" PRIx32 "\n", result);
+        print_buffer_hash(string, strlen(string));
     }
 
     return EXIT_SUCCESS;
@@ -8,15 +8,22 @@
  * ----------------------------------------------------------------------
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "libcork/cli.h"
 #include "libcork/core.h"
 #include "libcork/ds.h"
 #include "libcork/os.h"
+#include "libcork/threads.h"
 
 
 #define streq(s1, s2)  (strcmp((s1), (s2)) == 0)
@@ -507,6 +514,7 @@ paths_run(int argc, char **argv)
  */
 
 static bool  only_files = false;
+static bool  parallel = false;
 static bool  shallow = false;
 static const char  *dir_path = NULL;
 
@@ -522,6 +530,13 @@ dir_options(int argc, char **argv)
             only_files = true;
             dir_path = argv[2];
             return 3;
+        } else if (streq(argv[1], "--parallel")) {
+            /* The callbacks can run in any order, so there's no point in
+             * printing the indented tree. */
+            only_files = true;
+            parallel = true;
+            dir_path = argv[2];
+            return 3;
         }
     }
 
@@ -596,17 +611,250 @@ static struct cork_dir_walker  walker = {
 static void
 dir_run(int argc, char **argv)
 {
-    ri_check_exit(cork_walk_directory(dir_path, &walker));
+    if (parallel) {
+        struct cork_thread_pool  *pool = cork_thread_pool_new(4);
+        ri_check_exit(cork_thread_pool_start(pool));
+        ri_check_exit(cork_walk_directory_parallel(dir_path, &walker, pool));
+        cork_thread_pool_free(pool);
+    } else {
+        ri_check_exit(cork_walk_directory(dir_path, &walker));
+    }
     exit(EXIT_SUCCESS);
 }
 
 static struct cork_command  dir =
     cork_leaf_command("dir", "Print the contents of a directory",
-                      "[--shallow] <path>",
+                      "[--shallow | --only-files | --parallel] <path>",
                       "Prints the contents of a directory.\n",
                       dir_options, dir_run);
 
 
+/*-----------------------------------------------------------------------
+ * Running tests in parallel
+ */
+
+/* cork-test run-tests */
+
+static long  run_tests_jobs = 0;
+static long  run_tests_slowest = 5;
+
+static int
+run_tests_options(int argc, char **argv);
+
+static void
+run_tests_run(int argc, char **argv);
+
+static struct cork_command  run_tests =
+    cork_leaf_command("run-tests", "Run test programs in parallel",
+                      "[-j <jobs>] [--slowest <count>] <program>...",
+                      "Runs each test program, several at a time, and prints "
+                      "how long\n"
+                      "each one took.  We only print a program's output if it "
+                      "fails.\n",
+                      run_tests_options, run_tests_run);
+
+static long
+run_tests_parse_count(const char *option, const char *value)
+{
+    char  *end;
+    long  result = strtol(value, &end, 10);
+    if (*value == '\0' || *end != '\0' || result < 0) {
+        fprintf(stderr, "Invalid count for %s: %s\n", option, value);
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+static int
+run_tests_options(int argc, char **argv)
+{
+    int  processed = 1;
+    for (argc--, argv++; argc >= 1; argc--, argv++, processed++) {
+        if ((streq(argv[0], "-j") || streq(argv[0], "--jobs"))) {
+            if (argc >= 2) {
+                run_tests_jobs = run_tests_parse_count(argv[0], argv[1]);
+                argc--, argv++, processed++;
+            } else {
+                cork_command_show_help(&run_tests, "Missing count for -j");
+                exit(EXIT_FAILURE);
+            }
+        } else if (streq(argv[0], "--slowest")) {
+            if (argc >= 2) {
+                run_tests_slowest = run_tests_parse_count(argv[0], argv[1]);
+                argc--, argv++, processed++;
+            } else {
+                cork_command_show_help
+                    (&run_tests, "Missing count for --slowest");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            return processed;
+        }
+    }
+    return processed;
+}
+
+struct test_run {
+    const char  *program;
+    pid_t  pid;
+    /* Where the program's stdout and stderr go */
+    FILE  *output;
+    uint64_t  start;
+    double  wall;
+    double  cpu;
+    bool  passed;
+};
+
+static double
+timeval_sec(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+static void
+test_run_start(struct test_run *run)
+{
+    fflush(stdout);
+    fflush(stderr);
+    rp_check_exit(run->output = tmpfile());
+    run->start = cork_monotonic_nsec();
+    run->pid = fork();
+    if (run->pid == -1) {
+        cork_system_error_set();
+        ri_check_exit(-1);
+    } else if (run->pid == 0) {
+        char  *argv[2];
+        argv[0] = (char *) run->program;
+        argv[1] = NULL;
+        dup2(fileno(run->output), STDOUT_FILENO);
+        dup2(fileno(run->output), STDERR_FILENO);
+        execvp(run->program, argv);
+        fprintf(stderr, "Cannot run %s: %s\n",
+                run->program, strerror(errno));
+        _exit(127);
+    }
+}
+
+static void
+test_run_finish(struct test_run *run, int status, const struct rusage *usage)
+{
+    int  ch;
+    run->wall = (cork_monotonic_nsec() - run->start) / 1000000000.0;
+    run->cpu = timeval_sec(&usage->ru_utime) + timeval_sec(&usage->ru_stime);
+    run->passed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    printf("%s %8.3fs wall %8.3fs cpu  %s\n",
+           run->passed? "PASS": "FAIL", run->wall, run->cpu, run->program);
+    if (!run->passed) {
+        fflush(stdout);
+        rewind(run->output);
+        while ((ch = getc(run->output)) != EOF) {
+            putc(ch, stderr);
+        }
+        if (WIFSIGNALED(status)) {
+            fprintf(stderr, "%s: killed by signal %d\n",
+                    run->program, WTERMSIG(status));
+        }
+        fflush(stderr);
+    }
+    fclose(run->output);
+}
+
+static int
+test_run_compare_wall(const void *vr1, const void *vr2)
+{
+    const struct test_run  *r1 = *(const struct test_run * const *) vr1;
+    const struct test_run  *r2 = *(const struct test_run * const *) vr2;
+    return (r1->wall < r2->wall) - (r1->wall > r2->wall);
+}
+
+static void
+run_tests_run(int argc, char **argv)
+{
+    struct test_run  *runs;
+    struct test_run  **by_wall;
+    size_t  count = argc;
+    size_t  started = 0;
+    size_t  finished = 0;
+    size_t  failed = 0;
+    size_t  running = 0;
+    size_t  i;
+    uint64_t  start;
+
+    if (argc == 0) {
+        cork_command_show_help(&run_tests, "Missing test programs");
+        exit(EXIT_FAILURE);
+    }
+
+    if (run_tests_jobs == 0) {
+        run_tests_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+        if (run_tests_jobs < 1) {
+            run_tests_jobs = 1;
+        }
+    }
+
+    runs = cork_calloc(count, sizeof(struct test_run));
+    for (i = 0; i < count; i++) {
+        runs[i].program = argv[i];
+    }
+
+    start = cork_monotonic_nsec();
+    while (finished < count) {
+        int  status;
+        struct rusage  usage;
+        pid_t  pid;
+
+        while (started < count && running < (size_t) run_tests_jobs) {
+            test_run_start(&runs[started++]);
+            running++;
+        }
+
+        pid = wait4(-1, &status, 0, &usage);
+        if (pid == -1) {
+            cork_system_error_set();
+            ri_check_exit(-1);
+        }
+        for (i = 0; i < started; i++) {
+            if (runs[i].pid == pid) {
+                test_run_finish(&runs[i], status, &usage);
+                if (!runs[i].passed) {
+                    failed++;
+                }
+                running--;
+                finished++;
+                break;
+            }
+        }
+    }
+
+    printf("\n%zu tests, %zu failed, %.3fs\n",
+           count, failed, (cork_monotonic_nsec() - start) / 1000000000.0);
+
+    if (run_tests_slowest > 0) {
+        size_t  slowest = run_tests_slowest;
+        if (slowest > count) {
+            slowest = count;
+        }
+        by_wall = cork_calloc(count, sizeof(struct test_run *));
+        for (i = 0; i < count; i++) {
+            by_wall[i] = &runs[i];
+        }
+        qsort(by_wall, count, sizeof(struct test_run *),
+              test_run_compare_wall);
+        printf("\nSlowest tests:\n");
+        for (i = 0; i < slowest; i++) {
+            printf("  %8.3fs wall %8.3fs cpu  %s\n",
+                   by_wall[i]->wall, by_wall[i]->cpu, by_wall[i]->program);
+        }
+        cork_cfree(by_wall, count, sizeof(struct test_run *));
+    }
+
+    cork_cfree(runs, count, sizeof(struct test_run));
+    if (failed > 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+
 /*-----------------------------------------------------------------------
  * Cleanup functions
  */
@@ -657,6 +905,7 @@ static struct cork_command  *root_subcommands[] = {
     &paths,
     &dir,
     &sub,
+    &run_tests,
     &cleanup,
     NULL
 };
@@ -16,7 +16,10 @@
 #include "libcork/core/attributes.h"
 #include "libcork/core/error.h"
 #include "libcork/core/types.h"
+#include "libcork/ds/buffer.h"
 #include "libcork/os/process.h"
+#include "libcork/threads/atomics.h"
+#include "libcork/threads/basics.h"
 
 
 /*-----------------------------------------------------------------------
@@ -280,6 +283,85 @@ cork_alloc_strfree(const struct cork_alloc *alloc, const char *str)
 }
 
 
+/*-----------------------------------------------------------------------
+ * Aligned allocations
+ */
+
+/* We ask the underlying allocator for enough extra space to be able to find
+ * an aligned address within it, and to store a pointer to the start of the
+ * underlying allocation just before the aligned address.  Alignments smaller
+ * than a pointer are rounded up so that this pointer is itself aligned. */
+
+static inline size_t
+cork_aligned_alignment(size_t alignment)
+{
+    assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+    return (alignment < sizeof(void *))? sizeof(void *): alignment;
+}
+
+static inline size_t
+cork_aligned_allocated_size(size_t size, size_t alignment)
+{
+    assert(size <= SIZE_MAX - alignment - sizeof(void *));
+    return size + alignment - 1 + sizeof(void *);
+}
+
+static inline void *
+cork_aligned_place(void *raw, size_t alignment)
+{
+    uintptr_t  address =
+        ((uintptr_t) raw + sizeof(void *) + alignment - 1) &
+        ~((uintptr_t) alignment - 1);
+    ((void **) address)[-1] = raw;
+    return (void *) address;
+}
+
+void *
+cork_alloc_aligned_malloc(const struct cork_alloc *alloc,
+                          size_t size, size_t alignment)
+{
+    void  *raw;
+    alignment = cork_aligned_alignment(alignment);
+    raw = cork_alloc_malloc
+        (alloc, cork_aligned_allocated_size(size, alignment));
+    return cork_aligned_place(raw, alignment);
+}
+
+void *
+cork_alloc_aligned_xmalloc(const struct cork_alloc *alloc,
+                           size_t size, size_t alignment)
+{
+    void  *raw;
+    alignment = cork_aligned_alignment(alignment);
+    raw = cork_alloc_xmalloc
+        (alloc, cork_aligned_allocated_size(size, alignment));
+    if (CORK_UNLIKELY(raw == NULL)) {
+        return NULL;
+    }
+    return cork_aligned_place(raw, alignment);
+}
+
+void *
+cork_alloc_aligned_calloc(const struct cork_alloc *alloc,
+                          size_t count, size_t size, size_t alignment)
+{
+    void  *ptr;
+    assert(size == 0 || count <= SIZE_MAX / size);
+    ptr = cork_alloc_aligned_malloc(alloc, count * size, alignment);
+    memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void
+cork_alloc_aligned_free(const struct cork_alloc *alloc, void *ptr,
+                        size_t size, size_t alignment)
+{
+    alignment = cork_aligned_alignment(alignment);
+    cork_alloc_free(alloc, ((void **) ptr)[-1],
+                    cork_aligned_allocated_size(size, alignment));
+}
+
+
 /*-----------------------------------------------------------------------
  * stdlib allocator
  */
@@ -419,3 +501,975 @@ cork_debug_alloc_new(const struct cork_alloc *parent)
     cork_alloc_set_free(debug, cork_debug_alloc__free);
     return debug;
 }
+
+
+/*-----------------------------------------------------------------------
+ * Arena allocator
+ */
+
+/* Every allocation from an arena is aligned to this many bytes. */
+#define CORK_ARENA_ALIGNMENT  16
+
+#define cork_arena_align(size) \
+    (((size) + (CORK_ARENA_ALIGNMENT - 1)) & \
+     ~((size_t) CORK_ARENA_ALIGNMENT - 1))
+
+struct cork_arena_chunk {
+    struct cork_arena_chunk  *next;
+    size_t  size;
+};
+
+/* The parent allocator might not give us memory that's as aligned as we'd
+ * like (the debug allocator, for instance, prepends a size header), so we
+ * leave room to align the start of each chunk's payload ourselves. */
+#define CORK_ARENA_CHUNK_HEADER_SIZE \
+    (sizeof(struct cork_arena_chunk) + CORK_ARENA_ALIGNMENT - 1)
+
+#define cork_arena_chunk_payload(chunk) \
+    ((char *) cork_arena_align((uintptr_t) ((chunk) + 1)))
+
+struct cork_arena {
+    struct cork_alloc  public;
+    size_t  chunk_size;
+    /* The chunk we're currently carving allocations out of is always at the
+     * head of this list. */
+    struct cork_arena_chunk  *chunks;
+    char  *next;
+    char  *end;
+    /* The start of the most recent allocation, which we can resize in
+     * place. */
+    char  *last;
+};
+
+#define cork_arena_from_alloc(alloc) \
+    (cork_container_of((alloc), struct cork_arena, public))
+
+static struct cork_arena_chunk *
+cork_arena_new_chunk(struct cork_arena *arena, size_t payload_size)
+{
+    size_t  size = CORK_ARENA_CHUNK_HEADER_SIZE + payload_size;
+    struct cork_arena_chunk  *chunk =
+        cork_alloc_xmalloc(arena->public.parent, size);
+    if (CORK_UNLIKELY(chunk == NULL)) {
+        return NULL;
+    }
+    chunk->size = size;
+    return chunk;
+}
+
+static void *
+cork_arena__xmalloc(const struct cork_alloc *alloc, size_t size)
+{
+    struct cork_arena  *arena =
+        (struct cork_arena *) cork_arena_from_alloc(alloc);
+    struct cork_arena_chunk  *chunk;
+    char  *result;
+
+    size = cork_arena_align(size);
+    if (CORK_LIKELY((size_t) (arena->end - arena->next) >= size)) {
+        result = arena->next;
+        arena->next += size;
+        arena->last = result;
+        return result;
+    }
+
+    if (size > arena->chunk_size / 4) {
+        /* Large allocations get a chunk of their own, so that we don't waste
+         * the rest of the current chunk.  We put it behind the current chunk
+         * so that we keep allocating from the current one. */
+        chunk = cork_arena_new_chunk(arena, size);
+        if (CORK_UNLIKELY(chunk == NULL)) {
+            return NULL;
+        }
+        if (arena->chunks == NULL) {
+            chunk->next = NULL;
+            arena->chunks = chunk;
+        } else {
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        }
+        return cork_arena_chunk_payload(chunk);
+    }
+
+    chunk = cork_arena_new_chunk(arena, arena->chunk_size);
+    if (CORK_UNLIKELY(chunk == NULL)) {
+        return NULL;
+    }
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    result = cork_arena_chunk_payload(chunk);
+    arena->next = result + size;
+    arena->end = ((char *) chunk) + chunk->size;
+    arena->last = result;
+    return result;
+}
+
+static void *
+cork_arena__xrealloc(const struct cork_alloc *alloc, void *ptr,
+                     size_t old_size, size_t new_size)
+{
+    struct cork_arena  *arena =
+        (struct cork_arena *) cork_arena_from_alloc(alloc);
+    void  *result;
+
+    /* If this is the most recent allocation, we can grow or shrink it in
+     * place, as long as it still fits in the current chunk. */
+    if (ptr != NULL && ptr == arena->last &&
+        (size_t) (arena->end - arena->last) >= cork_arena_align(new_size)) {
+        arena->next = arena->last + cork_arena_align(new_size);
+        return ptr;
+    }
+
+    result = cork_arena__xmalloc(alloc, new_size);
+    if (CORK_LIKELY(result != NULL) && ptr != NULL) {
+        memcpy(result, ptr, (new_size < old_size)? new_size: old_size);
+    }
+    return result;
+}
+
+static void
+cork_arena__free(const struct cork_alloc *alloc, void *ptr, size_t size)
+{
+    struct cork_arena  *arena =
+        (struct cork_arena *) cork_arena_from_alloc(alloc);
+    /* We only reclaim the most recent allocation; everything else is freed
+     * all at once when the arena is reset. */
+    if (ptr == arena->last && ptr != NULL) {
+        arena->next = arena->last;
+        arena->last = NULL;
+    }
+}
+
+struct cork_arena *
+cork_arena_new(const struct cork_alloc *parent, size_t chunk_size)
+{
+    struct cork_arena  *arena = cork_alloc_new(parent, struct cork_arena);
+    if (chunk_size == 0) {
+        chunk_size = CORK_ARENA_DEFAULT_CHUNK_SIZE;
+    }
+    arena->public.parent = parent;
+    arena->public.user_data = NULL;
+    arena->public.free_user_data = NULL;
+    arena->public.calloc = cork_alloc__default_calloc;
+    arena->public.malloc = cork_alloc__default_malloc;
+    arena->public.realloc = cork_alloc__default_realloc;
+    arena->public.xcalloc = cork_alloc__default_xcalloc;
+    arena->public.xmalloc = cork_arena__xmalloc;
+    arena->public.xrealloc = cork_arena__xrealloc;
+    arena->public.free = cork_arena__free;
+    arena->chunk_size = cork_arena_align(chunk_size);
+    arena->chunks = NULL;
+    arena->next = NULL;
+    arena->end = NULL;
+    arena->last = NULL;
+    return arena;
+}
+
+const struct cork_alloc *
+cork_arena_alloc(struct cork_arena *arena)
+{
+    return &arena->public;
+}
+
+static void
+cork_arena_free_chunks(struct cork_arena *arena,
+                       struct cork_arena_chunk *chunk)
+{
+    while (chunk != NULL) {
+        struct cork_arena_chunk  *next = chunk->next;
+        cork_alloc_free(arena->public.parent, chunk, chunk->size);
+        chunk = next;
+    }
+}
+
+void
+cork_arena_reset(struct cork_arena *arena)
+{
+    struct cork_arena_chunk  *chunk = arena->chunks;
+    if (chunk == NULL) {
+        return;
+    }
+
+    /* Keep the current chunk around (as long as it's a regular one) so that
+     * an arena that is reset for each request doesn't have to allocate a new
+     * chunk every time. */
+    cork_arena_free_chunks(arena, chunk->next);
+    chunk->next = NULL;
+    if (chunk->size == CORK_ARENA_CHUNK_HEADER_SIZE + arena->chunk_size) {
+        arena->next = cork_arena_chunk_payload(chunk);
+        arena->end = ((char *) chunk) + chunk->size;
+    } else {
+        cork_arena_free_chunks(arena, chunk);
+        arena->chunks = NULL;
+        arena->next = NULL;
+        arena->end = NULL;
+    }
+    arena->last = NULL;
+}
+
+void
+cork_arena_free(struct cork_arena *arena)
+{
+    cork_arena_free_chunks(arena, arena->chunks);
+    cork_alloc_delete(arena->public.parent, struct cork_arena, arena);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Slab allocator
+ */
+
+#define CORK_SLAB_CLASS_COUNT  20
+
+/* The size of each slab that we request from the parent allocator. */
+#define CORK_SLAB_SIZE  65536
+
+/* Each thread caches at most this many free objects of each size class. */
+#define CORK_SLAB_MAGAZINE_SIZE  32
+
+/* Each thread keeps track of its caches for this many slab allocators. */
+#define CORK_SLAB_THREAD_CACHE_SIZE  4
+
+#define CORK_SLAB_ALIGNMENT  16
+
+static const size_t  cork_slab_class_sizes[CORK_SLAB_CLASS_COUNT] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024
+};
+
+/* Maps (size + 15) / 16 to the smallest size class that can hold `size`
+ * bytes.  Filled in the first time that a slab allocator is created. */
+static unsigned char
+cork_slab_class_index[CORK_SLAB_ALLOC_MAX_SIZE / CORK_SLAB_ALIGNMENT + 1];
+
+#define cork_slab_class_of(size) \
+    (cork_slab_class_index \
+     [((size) + CORK_SLAB_ALIGNMENT - 1) / CORK_SLAB_ALIGNMENT])
+
+struct cork_slab_object {
+    struct cork_slab_object  *next;
+};
+
+struct cork_slab_block {
+    struct cork_slab_block  *next;
+};
+
+struct cork_slab_class {
+    size_t  size;
+    volatile int  lock;
+    struct cork_slab_object  *free_list;
+    /* The part of the most recent slab that we haven't carved into objects
+     * yet. */
+    char  *next;
+    char  *end;
+};
+
+struct cork_slab_magazine {
+    struct cork_slab_object  *free_list;
+    size_t  free_count;
+};
+
+/* A thread's private cache of free objects. */
+struct cork_slab_cache {
+    struct cork_slab_cache  *next;
+    const void  *owner;
+    struct cork_slab_magazine  magazines[CORK_SLAB_CLASS_COUNT];
+};
+
+struct cork_slab_alloc {
+    const struct cork_alloc  *parent;
+    unsigned int  id;
+    /* Protects blocks and caches */
+    volatile int  lock;
+    struct cork_slab_block  *blocks;
+    struct cork_slab_cache  *caches;
+    struct cork_slab_class  classes[CORK_SLAB_CLASS_COUNT];
+};
+
+static void
+cork_slab_lock(volatile int *lock)
+{
+    while (CORK_UNLIKELY(cork_int_cas(lock, 0, 1) != 0)) {
+        cork_pause();
+    }
+}
+
+static void
+cork_slab_unlock(volatile int *lock)
+{
+    CORK_ATTR_UNUSED int  prior = cork_int_cas(lock, 1, 0);
+    assert(prior == 1);
+}
+
+
+/* We can't use cork_tls directly, since without compiler support for
+ * thread-local storage, it would allocate each thread's cache from
+ * cork_allocator — which might be us! */
+
+struct cork_slab_thread_cache {
+    unsigned int  ids[CORK_SLAB_THREAD_CACHE_SIZE];
+    struct cork_slab_cache  *caches[CORK_SLAB_THREAD_CACHE_SIZE];
+    unsigned int  next_victim;
+};
+
+CORK_ATTR_UNUSED
+static struct cork_slab_thread_cache *
+cork_slab_thread_cache__allocate(void)
+{
+    struct cork_slab_thread_cache  *self =
+        calloc(1, sizeof(struct cork_slab_thread_cache));
+    if (CORK_UNLIKELY(self == NULL)) {
+        abort();
+    }
+    return self;
+}
+
+CORK_ATTR_UNUSED
+static void
+cork_slab_thread_cache__deallocate(void *self)
+{
+    free(self);
+}
+
+cork_tls_fast_with_alloc(struct cork_slab_thread_cache, cork_slab_thread_cache,
+                         cork_slab_thread_cache__allocate,
+                         cork_slab_thread_cache__deallocate);
+
+/* Allocator IDs are never reused, so a thread cache entry for an allocator
+ * that has since been freed can never match a live one. */
+static volatile unsigned int  cork_slab_last_id = 0;
+
+/* Finds or creates the current thread's cache in the allocator's list.  We
+ * identify threads by the address of their thread-local state; if a thread
+ * exits and a new one ends up with the same address, it adopts the old
+ * thread's cache, along with any free objects that were stranded in it. */
+static struct cork_slab_cache *
+cork_slab_claim_cache(struct cork_slab_alloc *slab,
+                      struct cork_slab_thread_cache *tls)
+{
+    struct cork_slab_cache  *cache;
+    unsigned int  slot;
+
+    cork_slab_lock(&slab->lock);
+    for (cache = slab->caches; cache != NULL; cache = cache->next) {
+        if (cache->owner == tls) {
+            break;
+        }
+    }
+    if (cache == NULL) {
+        cache = cork_alloc_new(slab->parent, struct cork_slab_cache);
+        memset(cache, 0, sizeof(struct cork_slab_cache));
+        cache->owner = tls;
+        cache->next = slab->caches;
+        slab->caches = cache;
+    }
+    cork_slab_unlock(&slab->lock);
+
+    for (slot = 0; slot < CORK_SLAB_THREAD_CACHE_SIZE; slot++) {
+        if (tls->ids[slot] == 0) {
+            break;
+        }
+    }
+    if (slot == CORK_SLAB_THREAD_CACHE_SIZE) {
+        slot = tls->next_victim;
+        tls->next_victim = (slot + 1) % CORK_SLAB_THREAD_CACHE_SIZE;
+    }
+    tls->ids[slot] = slab->id;
+    tls->caches[slot] = cache;
+    return cache;
+}
+
+static inline struct cork_slab_cache *
+cork_slab_get_cache(struct cork_slab_alloc *slab)
+{
+    struct cork_slab_thread_cache  *tls = cork_slab_thread_cache_get();
+    unsigned int  slot;
+    for (slot = 0; slot < CORK_SLAB_THREAD_CACHE_SIZE; slot++) {
+        if (tls->ids[slot] == slab->id) {
+            return tls->caches[slot];
+        }
+    }
+    return cork_slab_claim_cache(slab, tls);
+}
+
+
+/* Must hold the class's lock. */
+static bool
+cork_slab_class_grow(struct cork_slab_alloc *slab, struct cork_slab_class *cls)
+{
+    struct cork_slab_block  *block =
+        cork_alloc_xmalloc(slab->parent, CORK_SLAB_SIZE);
+    uintptr_t  start;
+    if (CORK_UNLIKELY(block == NULL)) {
+        return false;
+    }
+
+    cork_slab_lock(&slab->lock);
+    block->next = slab->blocks;
+    slab->blocks = block;
+    cork_slab_unlock(&slab->lock);
+
+    /* The parent allocator might not align its results as strictly as we'd
+     * like. */
+    start = (uintptr_t) (block + 1);
+    start = (start + CORK_SLAB_ALIGNMENT - 1) &
+        ~((uintptr_t) CORK_SLAB_ALIGNMENT - 1);
+    cls->next = (char *) start;
+    cls->end = ((char *) block) + CORK_SLAB_SIZE;
+    return true;
+}
+
+/* Moves half a magazine's worth of objects from the size class's shared free
+ * list (or from fresh slab space) into `magazine`. */
+static void
+cork_slab_refill_magazine(struct cork_slab_alloc *slab,
+                          struct cork_slab_class *cls,
+                          struct cork_slab_magazine *magazine)
+{
+    size_t  i;
+    cork_slab_lock(&cls->lock);
+    for (i = 0; i < CORK_SLAB_MAGAZINE_SIZE / 2; i++) {
+        struct cork_slab_object  *obj = cls->free_list;
+        if (obj != NULL) {
+            cls->free_list = obj->next;
+        } else {
+            if (CORK_UNLIKELY((size_t) (cls->end - cls->next) < cls->size)) {
+                if (CORK_UNLIKELY(!cork_slab_class_grow(slab, cls))) {
+                    break;
+                }
+            }
+            obj = (struct cork_slab_object *) cls->next;
+            cls->next += cls->size;
+        }
+        obj->next = magazine->free_list;
+        magazine->free_list = obj;
+    }
+    magazine->free_count += i;
+    cork_slab_unlock(&cls->lock);
+}
+
+/* Moves half of a full magazine's objects back into the size class's shared
+ * free list. */
+static void
+cork_slab_spill_magazine(struct cork_slab_class *cls,
+                         struct cork_slab_magazine *magazine)
+{
+    struct cork_slab_object  *head = magazine->free_list;
+    struct cork_slab_object  *tail = head;
+    size_t  i;
+    for (i = 1; i < CORK_SLAB_MAGAZINE_SIZE / 2; i++) {
+        tail = tail->next;
+    }
+    magazine->free_list = tail->next;
+    magazine->free_count -= CORK_SLAB_MAGAZINE_SIZE / 2;
+
+    cork_slab_lock(&cls->lock);
+    tail->next = cls->free_list;
+    cls->free_list = head;
+    cork_slab_unlock(&cls->lock);
+}
+
+static void *
+cork_slab_alloc__xmalloc(const struct cork_alloc *alloc, size_t size)
+{
+    struct cork_slab_alloc  *slab = alloc->user_data;
+    unsigned int  index;
+    struct cork_slab_magazine  *magazine;
+    struct cork_slab_object  *obj;
+
+    if (CORK_UNLIKELY(size > CORK_SLAB_ALLOC_MAX_SIZE)) {
+        return cork_alloc_xmalloc(slab->parent, size);
+    }
+
+    index = cork_slab_class_of(size);
+    magazine = &cork_slab_get_cache(slab)->magazines[index];
+    if (CORK_UNLIKELY(magazine->free_list == NULL)) {
+        cork_slab_refill_magazine(slab, &slab->classes[index], magazine);
+        if (CORK_UNLIKELY(magazine->free_list == NULL)) {
+            return NULL;
+        }
+    }
+    obj = magazine->free_list;
+    magazine->free_list = obj->next;
+    magazine->free_count--;
+    return obj;
+}
+
+static void
+cork_slab_alloc__free(const struct cork_alloc *alloc, void *ptr, size_t size)
+{
+    struct cork_slab_alloc  *slab = alloc->user_data;
+    unsigned int  index;
+    struct cork_slab_magazine  *magazine;
+    struct cork_slab_object  *obj = ptr;
+
+    if (CORK_UNLIKELY(size > CORK_SLAB_ALLOC_MAX_SIZE)) {
+        cork_alloc_free(slab->parent, ptr, size);
+        return;
+    }
+
+    index = cork_slab_class_of(size);
+    magazine = &cork_slab_get_cache(slab)->magazines[index];
+    obj->next = magazine->free_list;
+    magazine->free_list = obj;
+    magazine->free_count++;
+    if (CORK_UNLIKELY(magazine->free_count >= CORK_SLAB_MAGAZINE_SIZE)) {
+        cork_slab_spill_magazine(&slab->classes[index], magazine);
+    }
+}
+
+static void *
+cork_slab_alloc__xrealloc(const struct cork_alloc *alloc, void *ptr,
+                          size_t old_size, size_t new_size)
+{
+    struct cork_slab_alloc  *slab = alloc->user_data;
+    if (old_size > CORK_SLAB_ALLOC_MAX_SIZE &&
+        new_size > CORK_SLAB_ALLOC_MAX_SIZE) {
+        return cork_alloc_xrealloc(slab->parent, ptr, old_size, new_size);
+    }
+    /* If the old and new sizes are in the same size class, there's nothing to
+     * do. */
+    if (ptr != NULL && new_size <= CORK_SLAB_ALLOC_MAX_SIZE &&
+        old_size <= CORK_SLAB_ALLOC_MAX_SIZE &&
+        cork_slab_class_of(old_size) == cork_slab_class_of(new_size)) {
+        return ptr;
+    }
+    return cork_alloc__default_xrealloc(alloc, ptr, old_size, new_size);
+}
+
+static void
+cork_slab_alloc__free_user_data(void *user_data)
+{
+    struct cork_slab_alloc  *slab = user_data;
+    struct cork_slab_block  *block;
+    struct cork_slab_block  *next_block;
+    struct cork_slab_cache  *cache;
+    struct cork_slab_cache  *next_cache;
+
+    for (block = slab->blocks; block != NULL; block = next_block) {
+        next_block = block->next;
+        cork_alloc_free(slab->parent, block, CORK_SLAB_SIZE);
+    }
+    for (cache = slab->caches; cache != NULL; cache = next_cache) {
+        next_cache = cache->next;
+        cork_alloc_delete(slab->parent, struct cork_slab_cache, cache);
+    }
+    cork_alloc_delete(slab->parent, struct cork_slab_alloc, slab);
+}
+
+static void
+cork_slab_init_class_index(void)
+{
+    size_t  i;
+    unsigned char  index = 0;
+    for (i = 0; i < sizeof(cork_slab_class_index); i++) {
+        while (cork_slab_class_sizes[index] < i * CORK_SLAB_ALIGNMENT) {
+            index++;
+        }
+        cork_slab_class_index[i] = index;
+    }
+}
+
+struct cork_alloc *
+cork_slab_alloc_new(const struct cork_alloc *parent)
+{
+    struct cork_alloc  *alloc = cork_alloc_new_alloc(parent);
+    struct cork_slab_alloc  *slab;
+    size_t  i;
+
+    if (cork_slab_class_index[sizeof(cork_slab_class_index) - 1] == 0) {
+        cork_slab_init_class_index();
+    }
+
+    slab = cork_alloc_new(parent, struct cork_slab_alloc);
+    slab->parent = parent;
+    slab->id = cork_uint_atomic_add(&cork_slab_last_id, 1);
+    slab->lock = 0;
+    slab->blocks = NULL;
+    slab->caches = NULL;
+    for (i = 0; i < CORK_SLAB_CLASS_COUNT; i++) {
+        slab->classes[i].size = cork_slab_class_sizes[i];
+        slab->classes[i].lock = 0;
+        slab->classes[i].free_list = NULL;
+        slab->classes[i].next = NULL;
+        slab->classes[i].end = NULL;
+    }
+
+    cork_alloc_set_user_data(alloc, slab, cork_slab_alloc__free_user_data);
+    cork_alloc_set_xmalloc(alloc, cork_slab_alloc__xmalloc);
+    cork_alloc_set_xrealloc(alloc, cork_slab_alloc__xrealloc);
+    cork_alloc_set_free(alloc, cork_slab_alloc__free);
+    return alloc;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Statistics allocator
+ */
+
+/* Size classes hold allocations of up to 16 bytes, 32 bytes, ..., 16MB; the
+ * last one holds everything larger. */
+#define CORK_STATS_BUCKET_COUNT  22
+#define CORK_STATS_MIN_BUCKET_SIZE  16
+
+/* We can track this many distinct call sites; must be a power of 2. */
+#define CORK_STATS_SITE_COUNT  1024
+
+/* How far we'll probe into the call site table before giving up. */
+#define CORK_STATS_MAX_PROBES  16
+
+#if defined(__GNUC__)
+#define cork_stats_caller()  (__builtin_return_address(0))
+#else
+#define cork_stats_caller()  NULL
+#endif
+
+struct cork_stats_bucket {
+    volatile size_t  alloc_count;
+    volatile size_t  free_count;
+    volatile size_t  live_bytes;
+    volatile size_t  peak_bytes;
+};
+
+struct cork_stats_site {
+    void * volatile  address;
+    volatile size_t  count;
+    volatile size_t  bytes;
+};
+
+struct cork_stats_alloc {
+    const struct cork_alloc  *parent;
+    unsigned int  sample_rate;
+    volatile size_t  sample_tick;
+    volatile size_t  live_bytes;
+    volatile size_t  peak_bytes;
+    volatile size_t  realloc_count;
+    volatile size_t  realloc_copy_bytes;
+    /* The number of sampled allocations that we couldn't find room for in the
+     * call site table */
+    volatile size_t  dropped_samples;
+    struct cork_stats_bucket  buckets[CORK_STATS_BUCKET_COUNT];
+    struct cork_stats_site  sites[CORK_STATS_SITE_COUNT];
+};
+
+static unsigned int
+cork_stats_bucket_of(size_t size)
+{
+    unsigned int  index = 0;
+    size_t  limit = CORK_STATS_MIN_BUCKET_SIZE;
+    while (size > limit && index < CORK_STATS_BUCKET_COUNT - 1) {
+        limit <<= 1;
+        index++;
+    }
+    return index;
+}
+
+static void
+cork_stats_update_peak(volatile size_t *peak, size_t live)
+{
+    size_t  old_peak = *peak;
+    while (CORK_UNLIKELY(live > old_peak)) {
+        size_t  actual = cork_size_cas(peak, old_peak, live);
+        if (actual == old_peak) {
+            return;
+        }
+        old_peak = actual;
+    }
+}
+
+static void
+cork_stats_record_site(struct cork_stats_alloc *stats, void *site,
+                       size_t size)
+{
+    size_t  index =
+        ((size_t) ((uintptr_t) site >> 2) * 2654435761u) &
+        (CORK_STATS_SITE_COUNT - 1);
+    unsigned int  probe;
+    for (probe = 0; probe < CORK_STATS_MAX_PROBES; probe++) {
+        struct cork_stats_site  *entry = &stats->sites[index];
+        void  *address = entry->address;
+        if (address == NULL) {
+            address = cork_ptr_cas(&entry->address, NULL, site);
+            if (address == NULL) {
+                address = site;
+            }
+        }
+        if (address == site) {
+            cork_size_atomic_add(&entry->count, 1);
+            cork_size_atomic_add(&entry->bytes, size);
+            return;
+        }
+        index = (index + 1) & (CORK_STATS_SITE_COUNT - 1);
+    }
+    cork_size_atomic_add(&stats->dropped_samples, 1);
+}
+
+static struct cork_stats_bucket *
+cork_stats_add_live(struct cork_stats_alloc *stats, size_t size)
+{
+    struct cork_stats_bucket  *bucket =
+        &stats->buckets[cork_stats_bucket_of(size)];
+    cork_stats_update_peak
+        (&bucket->peak_bytes, cork_size_atomic_add(&bucket->live_bytes, size));
+    cork_stats_update_peak
+        (&stats->peak_bytes, cork_size_atomic_add(&stats->live_bytes, size));
+    return bucket;
+}
+
+static struct cork_stats_bucket *
+cork_stats_sub_live(struct cork_stats_alloc *stats, size_t size)
+{
+    struct cork_stats_bucket  *bucket =
+        &stats->buckets[cork_stats_bucket_of(size)];
+    cork_size_atomic_sub(&bucket->live_bytes, size);
+    cork_size_atomic_sub(&stats->live_bytes, size);
+    return bucket;
+}
+
+static void
+cork_stats_sample(struct cork_stats_alloc *stats, size_t size, void *site)
+{
+    if (cork_size_atomic_add(&stats->sample_tick, 1) % stats->sample_rate
+        == 0) {
+        cork_stats_record_site(stats, site, size);
+    }
+}
+
+static void
+cork_stats_record_new(struct cork_stats_alloc *stats, size_t size, void *site)
+{
+    struct cork_stats_bucket  *bucket = cork_stats_add_live(stats, size);
+    cork_size_atomic_add(&bucket->alloc_count, 1);
+    cork_stats_sample(stats, size, site);
+}
+
+static void
+cork_stats_record_free(struct cork_stats_alloc *stats, size_t size)
+{
+    struct cork_stats_bucket  *bucket = cork_stats_sub_live(stats, size);
+    cork_size_atomic_add(&bucket->free_count, 1);
+}
+
+/* A reallocation moves the allocation from one size class to another, but
+ * doesn't count as a separate allocation and free. */
+static void
+cork_stats_record_realloc(struct cork_stats_alloc *stats, void *ptr,
+                          size_t old_size, void *result, size_t new_size,
+                          void *site)
+{
+    if (ptr == NULL) {
+        cork_stats_record_new(stats, new_size, site);
+        return;
+    }
+    cork_size_atomic_add(&stats->realloc_count, 1);
+    if (result != ptr) {
+        cork_size_atomic_add
+            (&stats->realloc_copy_bytes,
+             (new_size < old_size)? new_size: old_size);
+    }
+    cork_stats_sub_live(stats, old_size);
+    cork_stats_add_live(stats, new_size);
+    cork_stats_sample(stats, new_size, site);
+}
+
+/* We override every method, instead of relying on the defaults, so that
+ * cork_stats_caller always refers to the code that called into the allocator
+ * interface.  That's the innermost caller that wasn't inlined: the static
+ * wrappers in allocator.h (cork_malloc, cork_alloc_malloc, and friends) are
+ * usually inlined when optimizing, but without inlining, every allocation
+ * made through one of them is attributed to the wrapper.
+ *
+ * We only record allocations that succeed, and a failed realloc leaves the
+ * original allocation alone, so we don't change its stats either. */
+
+static void *
+cork_stats_alloc__calloc(const struct cork_alloc *alloc,
+                         size_t count, size_t size)
+{
+    struct cork_stats_alloc  *stats = alloc->user_data;
+    void  *result = cork_alloc_calloc(stats->parent, count, size);
+    if (CORK_LIKELY(result != NULL)) {
+        cork_stats_record_new(stats, count * size, cork_stats_caller());
+    }
+    return result;
+}
+
+static void *
+cork_stats_alloc__xcalloc(const struct cork_alloc *alloc,
+                          size_t count, size_t size)
+{
+    struct cork_stats_alloc  *stats = alloc->user_data;
+    void  *result = cork_alloc_xcalloc(stats->parent, count, size);
+    if (CORK_LIKELY(result != NULL)) {
+        cork_stats_record_new(stats, count * size, cork_stats_caller());
+    }
+    return result;
+}
+
+static void *
+cork_stats_alloc__malloc(const struct cork_alloc *alloc, size_t size)
+{
+    struct cork_stats_alloc  *stats = alloc->user_data;
+    void  *result = cork_alloc_malloc(stats->parent, size);
+    if (CORK_LIKELY(result != NULL)) {
+        cork_stats_record_new(stats, size, cork_stats_caller());
+    }
+    return result;
+}
+
+static void *
+cork_stats_alloc__xmalloc(const struct cork_alloc *alloc, size_t size)
+{
+    struct cork_stats_alloc  *stats = alloc->user_data;
+    void  *result = cork_alloc_xmalloc(stats->parent, size);
+    if (CORK_LIKELY(result != NULL)) {
+        cork_stats_record_new(stats, size, cork_stats_caller());
+    }
+    return result;
+}
+
+static void *
+cork_stats_alloc__realloc(const struct cork_alloc *alloc, void *ptr,
+                          size_t old_size, size_t new_size)
+{
+    struct cork_stats_alloc  *stats = alloc->user_data;
+    void  *result = cork_alloc_realloc(stats->parent, ptr, old_size, new_size);
+    if (CORK_LIKELY(result != NULL)) {
+        cork_stats_record_realloc
+            (stats, ptr, old_size, result, new_size, cork_stats_caller());
+    }
+    return result;
+}
+
+static void *
+cork_stats_alloc__xrealloc(const struct cork_alloc *alloc, void *ptr,
+                           size_t old_size, size_t new_size)
+{
+    struct cork_stats_alloc  *stats = alloc->user_data;
+    void  *result =
+        cork_alloc_xrealloc(stats->parent, ptr, old_size, new_size);
+    if (CORK_LIKELY(result != NULL)) {
+        cork_stats_record_realloc
+            (stats, ptr, old_size, result, new_size, cork_stats_caller());
+    }
+    return result;
+}
+
+static void
+cork_stats_alloc__free(const struct cork_alloc *alloc, void *ptr, size_t size)
+{
+    struct cork_stats_alloc  *stats = alloc->user_data;
+    cork_alloc_free(stats->parent, ptr, size);
+    cork_stats_record_free(stats, size);
+}
+
+static void
+cork_stats_alloc__free_user_data(void *user_data)
+{
+    struct cork_stats_alloc  *stats = user_data;
+    cork_alloc_delete(stats->parent, struct cork_stats_alloc, stats);
+}
+
+struct cork_alloc *
+cork_stats_alloc_new(const struct cork_alloc *parent, unsigned int sample_rate)
+{
+    struct cork_alloc  *alloc = cork_alloc_new_alloc(parent);
+    struct cork_stats_alloc  *stats =
+        cork_alloc_new(parent, struct cork_stats_alloc);
+    memset(stats, 0, sizeof(struct cork_stats_alloc));
+    stats->parent = parent;
+    stats->sample_rate = (sample_rate == 0)?
+        CORK_STATS_ALLOC_DEFAULT_SAMPLE_RATE: sample_rate;
+
+    cork_alloc_set_user_data(alloc, stats, cork_stats_alloc__free_user_data);
+    cork_alloc_set_calloc(alloc, cork_stats_alloc__calloc);
+    cork_alloc_set_xcalloc(alloc, cork_stats_alloc__xcalloc);
+    cork_alloc_set_malloc(alloc, cork_stats_alloc__malloc);
+    cork_alloc_set_xmalloc(alloc, cork_stats_alloc__xmalloc);
+    cork_alloc_set_realloc(alloc, cork_stats_alloc__realloc);
+    cork_alloc_set_xrealloc(alloc, cork_stats_alloc__xrealloc);
+    cork_alloc_set_free(alloc, cork_stats_alloc__free);
+    return alloc;
+}
+
+void
+cork_stats_alloc_get(const struct cork_alloc *alloc,
+                     struct cork_alloc_stats *dest)
+{
+    struct cork_stats_alloc  *stats = alloc->user_data;
+    unsigned int  i;
+    dest->live_bytes = stats->live_bytes;
+    dest->peak_bytes = stats->peak_bytes;
+    dest->alloc_count = 0;
+    dest->free_count = 0;
+    for (i = 0; i < CORK_STATS_BUCKET_COUNT; i++) {
+        dest->alloc_count += stats->buckets[i].alloc_count;
+        dest->free_count += stats->buckets[i].free_count;
+    }
+    dest->realloc_count = stats->realloc_count;
+    dest->realloc_copy_bytes = stats->realloc_copy_bytes;
+}
+
+static int
+cork_stats_site_compare(const void *va, const void *vb)
+{
+    const struct cork_stats_site * const  *a = va;
+    const struct cork_stats_site * const  *b = vb;
+    /* Sort by decreasing number of bytes */
+    return ((*a)->bytes < (*b)->bytes) - ((*a)->bytes > (*b)->bytes);
+}
+
+void
+cork_stats_alloc_snapshot(const struct cork_alloc *alloc,
+                          struct cork_buffer *dest)
+{
+    struct cork_stats_alloc  *stats = alloc->user_data;
+    struct cork_alloc_stats  totals;
+    struct cork_stats_site  *sites[CORK_STATS_SITE_COUNT];
+    size_t  site_count = 0;
+    size_t  limit = CORK_STATS_MIN_BUCKET_SIZE;
+    size_t  i;
+
+    cork_stats_alloc_get(alloc, &totals);
+    cork_buffer_append_printf
+        (dest, "total: live %zu peak %zu allocs %zu frees %zu "
+         "reallocs %zu realloc-copied %zu\n",
+         totals.live_bytes, totals.peak_bytes,
+         totals.alloc_count, totals.free_count,
+         totals.realloc_count, totals.realloc_copy_bytes);
+
+    for (i = 0; i < CORK_STATS_BUCKET_COUNT; i++, limit <<= 1) {
+        struct cork_stats_bucket  *bucket = &stats->buckets[i];
+        if (bucket->alloc_count == 0) {
+            continue;
+        }
+        if (i == CORK_STATS_BUCKET_COUNT - 1) {
+            cork_buffer_append_printf(dest, "size > %zu:", limit >> 1);
+        } else {
+            cork_buffer_append_printf(dest, "size <= %zu:", limit);
+        }
+        cork_buffer_append_printf
+            (dest, " live %zu peak %zu allocs %zu frees %zu\n",
+             (size_t) bucket->live_bytes, (size_t) bucket->peak_bytes,
+             (size_t) bucket->alloc_count, (size_t) bucket->free_count);
+    }
+
+    for (i = 0; i < CORK_STATS_SITE_COUNT; i++) {
+        if (stats->sites[i].address != NULL) {
+            sites[site_count++] = &stats->sites[i];
+        }
+    }
+    qsort(sites, site_count, sizeof(struct cork_stats_site *),
+          cork_stats_site_compare);
+    for (i = 0; i < site_count; i++) {
+        cork_buffer_append_printf
+            (dest, "site %p: sampled allocs %zu bytes %zu (1 in %u)\n",
+             sites[i]->address, (size_t) sites[i]->count,
+             (size_t) sites[i]->bytes, stats->sample_rate);
+    }
+    if (stats->dropped_samples > 0) {
+        cork_buffer_append_printf
+            (dest, "dropped samples: %zu\n", (size_t) stats->dropped_samples);
+    }
+}
@@ -0,0 +1,114 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "libcork/config.h"
+#include "libcork/core/byte-order.h"
+#include "libcork/core/types.h"
+
+#if CORK_CONFIG_HAVE_AVX2
+#include <immintrin.h>
+#elif CORK_CONFIG_HAVE_SSSE3
+#include <tmmintrin.h>
+#elif CORK_CONFIG_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+
+/*-----------------------------------------------------------------------
+ * Swapping arrays
+ */
+
+/* Each of these swaps as many integers as it can with vector byte shuffles,
+ * and then handles the remainder one at a time.  The vector loops use
+ * unaligned loads and stores, and load each vector before storing it, so they
+ * work fine when dest == src. */
+
+#if CORK_CONFIG_HAVE_AVX2 || CORK_CONFIG_HAVE_SSSE3
+/* pshufb masks that reverse the bytes within each 2-, 4-, or 8-byte lane */
+#define CORK_BSWAP16_MASK \
+    14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1
+#define CORK_BSWAP32_MASK \
+    12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3
+#define CORK_BSWAP64_MASK \
+    8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7
+#endif
+
+#if CORK_CONFIG_HAVE_AVX2
+#define cork_bswap_vector_loop(MASK, dest, src, count, size) \
+    do { \
+        __m256i  mask = _mm256_set_epi8(MASK, MASK); \
+        size_t  per_vector = 32 / (size); \
+        while ((count) >= per_vector) { \
+            __m256i  v = _mm256_loadu_si256((const __m256i *) (src)); \
+            _mm256_storeu_si256 \
+                ((__m256i *) (dest), _mm256_shuffle_epi8(v, mask)); \
+            (src) += 32; \
+            (dest) += 32; \
+            (count) -= per_vector; \
+        } \
+    } while (0)
+
+#elif CORK_CONFIG_HAVE_SSSE3
+#define cork_bswap_vector_loop(MASK, dest, src, count, size) \
+    do { \
+        __m128i  mask = _mm_set_epi8(MASK); \
+        size_t  per_vector = 16 / (size); \
+        while ((count) >= per_vector) { \
+            __m128i  v = _mm_loadu_si128((const __m128i *) (src)); \
+            _mm_storeu_si128((__m128i *) (dest), _mm_shuffle_epi8(v, mask)); \
+            (src) += 16; \
+            (dest) += 16; \
+            (count) -= per_vector; \
+        } \
+    } while (0)
+
+#elif CORK_CONFIG_HAVE_NEON
+#define CORK_BSWAP16_MASK  vrev16q_u8
+#define CORK_BSWAP32_MASK  vrev32q_u8
+#define CORK_BSWAP64_MASK  vrev64q_u8
+#define cork_bswap_vector_loop(REV, dest, src, count, size) \
+    do { \
+        size_t  per_vector = 16 / (size); \
+        while ((count) >= per_vector) { \
+            uint8x16_t  v = vld1q_u8((const uint8_t *) (src)); \
+            vst1q_u8((uint8_t *) (dest), REV(v)); \
+            (src) += 16; \
+            (dest) += 16; \
+            (count) -= per_vector; \
+        } \
+    } while (0)
+
+#else
+#define cork_bswap_vector_loop(MASK, dest, src, count, size)  /* no-op */
+#endif
+
+
+#define cork_bswap_array_define(bits) \
+void \
+cork_bswap##bits##_array(void *vdest, const void *vsrc, size_t count) \
+{ \
+    uint8_t  *dest = vdest; \
+    const uint8_t  *src = vsrc; \
+    cork_bswap_vector_loop \
+        (CORK_BSWAP##bits##_MASK, dest, src, count, bits / 8); \
+    while (count-- > 0) { \
+        uint##bits##_t  value; \
+        memcpy(&value, src, sizeof(value)); \
+        value = CORK_SWAP_UINT##bits(value); \
+        memcpy(dest, &value, sizeof(value)); \
+        src += sizeof(value); \
+        dest += sizeof(value); \
+    } \
+}
+
+cork_bswap_array_define(16)
+cork_bswap_array_define(32)
+cork_bswap_array_define(64)
@@ -24,48 +24,70 @@
  * Life cycle
  */
 
-struct cork_error {
-    cork_error  code;
+/* Most errors are checked and then cleared without anyone ever looking at
+ * their messages.  So each thread's current error code lives directly in
+ * thread-local storage, and we only produce a message when someone asks for
+ * it.  System errors and static strings don't need any formatting at all
+ * until then; other messages are built in a per-thread pair of buffers that
+ * we only allocate the first time that a thread needs them. */
+
+enum cork_error_message_kind {
+    /* The message is in buffers->message */
+    CORK_ERROR_MESSAGE_BUFFER,
+    /* The message is static_message */
+    CORK_ERROR_MESSAGE_STATIC,
+    /* The message is strerror(code) */
+    CORK_ERROR_MESSAGE_ERRNO
+};
+
+struct cork_error_buffers {
     struct cork_buffer  *message;
     struct cork_buffer  *other;
     struct cork_buffer  buf1;
     struct cork_buffer  buf2;
-    struct cork_error  *next;
+    struct cork_error_buffers  *next;
 };
 
-static struct cork_error *
-cork_error_new(void)
+struct cork_error {
+    cork_error  code;
+    enum cork_error_message_kind  kind;
+    const char  *static_message;
+    struct cork_error_buffers  *buffers;
+};
+
+static struct cork_error_buffers *
+cork_error_buffers_new(void)
 {
-    struct cork_error  *error = cork_new(struct cork_error);
-    error->code = CORK_ERROR_NONE;
-    cork_buffer_init(&error->buf1);
-    cork_buffer_init(&error->buf2);
-    error->message = &error->buf1;
-    error->other = &error->buf2;
-    return error;
+    struct cork_error_buffers  *buffers = cork_new(struct cork_error_buffers);
+    cork_buffer_init(&buffers->buf1);
+    cork_buffer_init(&buffers->buf2);
+    buffers->message = &buffers->buf1;
+    buffers->other = &buffers->buf2;
+    return buffers;
 }
 
 static void
-cork_error_free(struct cork_error *error)
+cork_error_buffers_free(struct cork_error_buffers *buffers)
 {
-    cork_buffer_done(&error->buf1);
-    cork_buffer_done(&error->buf2);
-    cork_delete(struct cork_error, error);
+    cork_buffer_done(&buffers->buf1);
+    cork_buffer_done(&buffers->buf2);
+    cork_delete(struct cork_error_buffers, buffers);
 }
 
 
-static struct cork_error * volatile  errors;
+/* Every thread's buffers, so that we can free them at exit. */
+static struct cork_error_buffers * volatile  errors;
 
 cork_once_barrier(cork_error_list);
 
 static void
 cork_error_list_done(void)
 {
-    struct cork_error  *curr;
-    struct cork_error  *next;
+    struct cork_error_buffers  *curr;
+    struct cork_error_buffers  *next;
     for (curr = errors; curr != NULL; curr = next) {
         next = curr->next;
-        cork_error_free(curr);
+        cork_error_buffers_free(curr);
     }
 }
 
@@ -76,25 +98,37 @@ cork_error_list_init(void)
 }
 
 
-cork_tls(struct cork_error *, cork_error_);
+cork_tls_fast(struct cork_error, cork_error);
 
-static struct cork_error *
-cork_error_get(void)
+static struct cork_error_buffers *
+cork_error_get_buffers(struct cork_error *error)
 {
-    struct cork_error  **error_ptr = cork_error__get();
-    if (CORK_UNLIKELY(*error_ptr == NULL)) {
-        struct cork_error  *old_head;
-        struct cork_error  *error = cork_error_new();
+    if (CORK_UNLIKELY(error->buffers == NULL)) {
+        struct cork_error_buffers  *old_head;
+        struct cork_error_buffers  *buffers = cork_error_buffers_new();
         cork_once(cork_error_list, cork_error_list_init());
         do {
             old_head = errors;
-            error->next = old_head;
-        } while (cork_ptr_cas(&errors, old_head, error) != old_head);
-        *error_ptr = error;
-        return error;
-    } else {
-        return *error_ptr;
+            buffers->next = old_head;
+        } while (cork_ptr_cas(&errors, old_head, buffers) != old_head);
+        error->buffers = buffers;
     }
+    return error->buffers;
+}
+
+/* Makes sure that the current message is in the message buffer, so that we
+ * can add a prefix to it. */
+static struct cork_error_buffers *
+cork_error_format_message(struct cork_error *error)
+{
+    struct cork_error_buffers  *buffers = cork_error_get_buffers(error);
+    if (error->kind == CORK_ERROR_MESSAGE_STATIC) {
+        cork_buffer_set_string(buffers->message, error->static_message);
+    } else if (error->kind == CORK_ERROR_MESSAGE_ERRNO) {
+        cork_buffer_set_string(buffers->message, strerror(error->code));
+    }
+    error->kind = CORK_ERROR_MESSAGE_BUFFER;
+    return buffers;
 }
 
 
@@ -120,7 +154,14 @@ const char *
 cork_error_message(void)
 {
     struct cork_error  *error = cork_error_get();
-    return error->message->buf;
+    switch (error->kind) {
+        case CORK_ERROR_MESSAGE_STATIC:
+            return error->static_message;
+        case CORK_ERROR_MESSAGE_ERRNO:
+            return strerror(error->code);
+        default:
+            return cork_error_get_buffers(error)->message->buf;
+    }
 }
 
 void
@@ -128,7 +169,16 @@ cork_error_clear(void)
 {
     struct cork_error  *error = cork_error_get();
     error->code = CORK_ERROR_NONE;
-    cork_buffer_clear(error->message);
+    if (error->kind == CORK_ERROR_MESSAGE_BUFFER) {
+        /* A thread that has never had an error doesn't have any buffers to
+         * clear. */
+        if (error->buffers != NULL) {
+            cork_buffer_clear(error->buffers->message);
+        }
+    } else {
+        error->kind = CORK_ERROR_MESSAGE_STATIC;
+        error->static_message = "";
+    }
 }
 
 void
@@ -136,26 +186,41 @@ cork_error_set_printf(cork_error code, const char *format, ...)
 {
     va_list  args;
     struct cork_error  *error = cork_error_get();
+    struct cork_error_buffers  *buffers = cork_error_get_buffers(error);
     error->code = code;
+    error->kind = CORK_ERROR_MESSAGE_BUFFER;
     va_start(args, format);
-    cork_buffer_vprintf(error->message, format, args);
+    cork_buffer_vprintf(buffers->message, format, args);
     va_end(args);
 }
 
 void
 cork_error_set_string(cork_error code, const char *str)
+{
+    struct cork_error  *error = cork_error_get();
+    struct cork_error_buffers  *buffers = cork_error_get_buffers(error);
+    error->code = code;
+    error->kind = CORK_ERROR_MESSAGE_BUFFER;
+    cork_buffer_set_string(buffers->message, str);
+}
+
+void
+cork_error_set_static(cork_error code, const char *str)
 {
     struct cork_error  *error = cork_error_get();
     error->code = code;
-    cork_buffer_set_string(error->message, str);
+    error->kind = CORK_ERROR_MESSAGE_STATIC;
+    error->static_message = str;
 }
 
 void
 cork_error_set_vprintf(cork_error code, const char *format, va_list args)
 {
     struct cork_error  *error = cork_error_get();
+    struct cork_error_buffers  *buffers = cork_error_get_buffers(error);
     error->code = code;
-    cork_buffer_vprintf(error->message, format, args);
+    error->kind = CORK_ERROR_MESSAGE_BUFFER;
+    cork_buffer_vprintf(buffers->message, format, args);
 }
 
 void
@@ -163,38 +228,41 @@ cork_error_prefix_printf(const char *format, ...)
 {
     va_list  args;
     struct cork_error  *error = cork_error_get();
+    struct cork_error_buffers  *buffers = cork_error_format_message(error);
     struct cork_buffer  *temp;
     va_start(args, format);
-    cork_buffer_vprintf(error->other, format, args);
+    cork_buffer_vprintf(buffers->other, format, args);
     va_end(args);
-    cork_buffer_append_copy(error->other, error->message);
-    temp = error->other;
-    error->other = error->message;
-    error->message = temp;
+    cork_buffer_append_copy(buffers->other, buffers->message);
+    temp = buffers->other;
+    buffers->other = buffers->message;
+    buffers->message = temp;
 }
 
 void
 cork_error_prefix_string(const char *str)
 {
     struct cork_error  *error = cork_error_get();
+    struct cork_error_buffers  *buffers = cork_error_format_message(error);
     struct cork_buffer  *temp;
-    cork_buffer_set_string(error->other, str);
-    cork_buffer_append_copy(error->other, error->message);
-    temp = error->other;
-    error->other = error->message;
-    error->message = temp;
+    cork_buffer_set_string(buffers->other, str);
+    cork_buffer_append_copy(buffers->other, buffers->message);
+    temp = buffers->other;
+    buffers->other = buffers->message;
+    buffers->message = temp;
 }
 
 void
 cork_error_prefix_vprintf(const char *format, va_list args)
 {
     struct cork_error  *error = cork_error_get();
+    struct cork_error_buffers  *buffers = cork_error_format_message(error);
     struct cork_buffer  *temp;
-    cork_buffer_vprintf(error->other, format, args);
-    cork_buffer_append_copy(error->other, error->message);
-    temp = error->other;
-    error->other = error->message;
-    error->message = temp;
+    cork_buffer_vprintf(buffers->other, format, args);
+    cork_buffer_append_copy(buffers->other, buffers->message);
+    temp = buffers->other;
+    buffers->other = buffers->message;
+    buffers->message = temp;
 }
 
 
@@ -227,16 +295,20 @@ cork_error_prefix(const char *format, ...)
  * Built-in errors
  */
 
+/* We don't call strerror until someone asks for the message. */
+
 void
 cork_system_error_set_explicit(int err)
 {
-    cork_error_set_string(err, strerror(err));
+    struct cork_error  *error = cork_error_get();
+    error->code = err;
+    error->kind = CORK_ERROR_MESSAGE_ERRNO;
 }
 
 void
 cork_system_error_set(void)
 {
-    cork_error_set_string(errno, strerror(errno));
+    cork_system_error_set_explicit(errno);
 }
 
 void
@@ -7,11 +7,16 @@
  * ----------------------------------------------------------------------
  */
 
+#include <assert.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "libcork/config/config.h"
 #include "libcork/core/allocator.h"
+#include "libcork/core/attributes.h"
 #include "libcork/core/gc.h"
+#include "libcork/core/mempool.h"
+#include "libcork/core/trace.h"
 #include "libcork/core/types.h"
 #include "libcork/ds/dllist.h"
 #include "libcork/threads/basics.h"
@@ -33,20 +38,65 @@
  * GC context life cycle
  */
 
-#define ROOTS_SIZE  1024
-
 /* An internal structure allocated with every garbage-collected object. */
 struct cork_gc_header;
 
 /* A garbage collector context. */
 struct cork_gc {
+    bool  initialized;
     /* The number of used entries in roots. */
     size_t  root_count;
+    /* The number of entries that we've allocated for roots. */
+    size_t  root_size;
     /* The possible roots of garbage cycles */
-    struct cork_gc_header  *roots[ROOTS_SIZE];
+    struct cork_gc_header  **roots;
+    /* We automatically collect cycles when this many possible roots have
+     * accumulated.  If 0, we only collect when asked to. */
+    size_t  root_threshold;
+    struct cork_gc_stats  stats;
+
+    /* How many deferral scopes we're currently in */
+    unsigned int  defer_depth;
+    /* The "zero count table": objects whose reference count dropped to zero
+     * while inside a deferral scope.  They're only freed once we leave the
+     * outermost scope. */
+    struct cork_gc_header  **zct;
+    size_t  zct_count;
+    size_t  zct_size;
+
+    /* The members of garbage cycles that we've found during the current
+     * collection.  We don't free any of them until we've finished walking
+     * through all of them. */
+    struct cork_gc_header  **garbage;
+    size_t  garbage_count;
+    size_t  garbage_size;
 };
 
-cork_tls(struct cork_gc, cork_gc);
+cork_tls_fast(struct cork_gc, cork_gc);
+
+static struct cork_gc *
+cork_gc_context(void)
+{
+    struct cork_gc  *gc = cork_gc_get();
+    if (CORK_UNLIKELY(!gc->initialized)) {
+        gc->root_threshold = CORK_GC_DEFAULT_ROOT_THRESHOLD;
+        gc->initialized = true;
+    }
+    return gc;
+}
+
+/* The number of possible roots that cork_gc_step examines at a time.  An
+ * incremental step always finishes examining a batch, even if that takes
+ * longer than its budget. */
+#define CORK_GC_STEP_ROOT_COUNT  64
+
+static uint64_t
+cork_gc_now_ns(void)
+{
+    struct timespec  now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
 static void
 cork_gc_collect_cycles(struct cork_gc *gc);
@@ -58,8 +108,10 @@ cork_gc_collect_cycles(struct cork_gc *gc);
 
 struct cork_gc_header {
     /* The current reference count for this object, along with its color
-     * during the mark/sweep process. */
-    volatile int  ref_count_color;
+     * during the mark/sweep process.  Each garbage collector is confined to a
+     * single thread, and so are the objects that it manages, so this doesn't
+     * need to be atomic (or volatile). */
+    int  ref_count_color;
 
     /* The allocated size of this garbage-collected object (including
      * the header). */
@@ -72,28 +124,30 @@ struct cork_gc_header {
 /*
  * Structure of ref_count_color:
  *
- *   +-----+---+---+---+---+---+
- *   | ... | 4 | 3 | 2 | 1 | 0 |
- *   +-----+---+---+---+---+---+
- *      ref_count    |   color
- *                   |
- *        buffered --/
+ *   +-----+---+---+---+---+---+---+
+ *   | ... | 5 | 4 | 3 | 2 | 1 | 0 |
+ *   +-----+---+---+---+---+---+---+
+ *        ref_count    |   |   color
+ *                     |   |
+ *         deferred ---/   \--- buffered
  */
 
+#define CORK_GC_REF_COUNT_SHIFT  4
+
 #define cork_gc_ref_count_color(count, buffered, color) \
-    (((count) << 3) | ((buffered) << 2) | (color))
+    (((count) << CORK_GC_REF_COUNT_SHIFT) | ((buffered) << 2) | (color))
 
 #define cork_gc_get_ref_count(hdr) \
-    ((hdr)->ref_count_color >> 3)
+    ((hdr)->ref_count_color >> CORK_GC_REF_COUNT_SHIFT)
 
 #define cork_gc_inc_ref_count(hdr) \
     do { \
-        (hdr)->ref_count_color += (1 << 3); \
+        (hdr)->ref_count_color += (1 << CORK_GC_REF_COUNT_SHIFT); \
     } while (0)
 
 #define cork_gc_dec_ref_count(hdr) \
     do { \
-        (hdr)->ref_count_color -= (1 << 3); \
+        (hdr)->ref_count_color -= (1 << CORK_GC_REF_COUNT_SHIFT); \
     } while (0)
 
 #define cork_gc_get_color(hdr) \
@@ -114,12 +168,25 @@ struct cork_gc_header {
             ((hdr)->ref_count_color & ~0x4) | (((buffered) & 1) << 2); \
     } while (0)
 
+#define cork_gc_get_deferred(hdr) \
+    (((hdr)->ref_count_color & 0x8) != 0)
+
+#define cork_gc_set_deferred(hdr, deferred) \
+    do { \
+        (hdr)->ref_count_color = \
+            ((hdr)->ref_count_color & ~0x8) | (((deferred) & 1) << 3); \
+    } while (0)
+
 #define cork_gc_free(hdr) \
     do { \
         if ((hdr)->iface->free != NULL) { \
             (hdr)->iface->free(cork_gc_get_object((hdr))); \
         } \
-        cork_free((hdr), (hdr)->allocated_size); \
+        if ((hdr)->iface->pool != NULL) { \
+            cork_mempool_free_object((hdr)->iface->pool, (hdr)); \
+        } else { \
+            cork_free((hdr), (hdr)->allocated_size); \
+        } \
     } while (0)
 
 #define cork_gc_recurse(gc, hdr, recurser) \
@@ -151,21 +218,44 @@ enum cork_gc_color {
 void
 cork_gc_init(void)
 {
-    cork_gc_get();
+    cork_gc_context();
 }
 
 void
 cork_gc_done(void)
 {
-    cork_gc_collect_cycles(cork_gc_get());
+    struct cork_gc  *gc = cork_gc_context();
+    assert(gc->defer_depth == 0);
+    cork_gc_collect_cycles(gc);
+    if (gc->roots != NULL) {
+        cork_cfree(gc->roots, gc->root_size, sizeof(struct cork_gc_header *));
+        gc->roots = NULL;
+        gc->root_size = 0;
+    }
+    if (gc->zct != NULL) {
+        cork_cfree(gc->zct, gc->zct_size, sizeof(struct cork_gc_header *));
+        gc->zct = NULL;
+        gc->zct_size = 0;
+    }
+    if (gc->garbage != NULL) {
+        cork_cfree(gc->garbage, gc->garbage_size,
+                   sizeof(struct cork_gc_header *));
+        gc->garbage = NULL;
+        gc->garbage_size = 0;
+    }
 }
 
 void *
 cork_gc_alloc(size_t instance_size, struct cork_gc_obj_iface *iface)
 {
     size_t  full_size = instance_size + sizeof(struct cork_gc_header);
+    struct cork_gc_header  *header;
     DEBUG("Allocating %zu (%zu) bytes\n", instance_size, full_size);
-    struct cork_gc_header  *header = cork_malloc(full_size);
+    if (iface->pool != NULL) {
+        header = cork_mempool_new_object(iface->pool);
+    } else {
+        header = cork_malloc(full_size);
+    }
     DEBUG("  Result is %p[%p]\n", cork_gc_get_object(header), header);
     header->ref_count_color = cork_gc_ref_count_color(1, false, GC_BLACK);
     header->allocated_size = full_size;
@@ -173,15 +263,25 @@ cork_gc_alloc(size_t instance_size, struct cork_gc_obj_iface *iface)
     return cork_gc_get_object(header);
 }
 
+struct cork_mempool *
+cork_gc_mempool_new_size(size_t instance_size)
+{
+    return cork_mempool_new_size
+        (instance_size + sizeof(struct cork_gc_header));
+}
+
 void *
 cork_gc_incref(void *obj)
 {
     if (obj != NULL) {
         struct cork_gc_header  *header = cork_gc_get_header(obj);
-        cork_gc_inc_ref_count(header);
+        /* Increment the reference count and set the color to black in a
+         * single update. */
+        header->ref_count_color =
+            (header->ref_count_color + (1 << CORK_GC_REF_COUNT_SHIFT)) &
+            ~0x3;
         DEBUG("Incrementing %p -> %d\n",
               obj, cork_gc_get_ref_count(header));
-        cork_gc_set_color(header, GC_BLACK);
     }
     return obj;
 }
@@ -207,9 +307,17 @@ cork_gc_possible_root(struct cork_gc *gc, struct cork_gc_header *header)
         cork_gc_set_color(header, GC_PURPLE);
         if (!cork_gc_get_buffered(header)) {
             cork_gc_set_buffered(header, true);
-            if (gc->root_count >= ROOTS_SIZE) {
+            if (gc->root_threshold != 0 &&
+                gc->root_count >= gc->root_threshold) {
                 cork_gc_collect_cycles(gc);
             }
+            if (CORK_UNLIKELY(gc->root_count == gc->root_size)) {
+                size_t  new_size = (gc->root_size == 0)? 64: gc->root_size * 2;
+                gc->roots = cork_realloc
+                    (gc->roots, gc->root_size * sizeof(struct cork_gc_header *),
+                     new_size * sizeof(struct cork_gc_header *));
+                gc->root_size = new_size;
+            }
             gc->roots[gc->root_count++] = header;
         }
     } else {
@@ -218,19 +326,45 @@ cork_gc_possible_root(struct cork_gc *gc, struct cork_gc_header *header)
 }
 
 static void
-cork_gc_decref_step(struct cork_gc *gc, void *obj, void *ud)
+cork_gc_defer_release(struct cork_gc *gc, struct cork_gc_header *header)
 {
-    if (obj != NULL) {
-        struct cork_gc_header  *header = cork_gc_get_header(obj);
-        cork_gc_dec_ref_count(header);
-        DEBUG("Decrementing %p -> %d\n",
-              obj, cork_gc_get_ref_count(header));
-        if (cork_gc_get_ref_count(header) == 0) {
+    if (!cork_gc_get_deferred(header)) {
+        DEBUG("  Deferring release of %p\n", header);
+        if (CORK_UNLIKELY(gc->zct_count == gc->zct_size)) {
+            size_t  new_size = (gc->zct_size == 0)? 64: gc->zct_size * 2;
+            gc->zct = cork_realloc
+                (gc->zct, gc->zct_size * sizeof(struct cork_gc_header *),
+                 new_size * sizeof(struct cork_gc_header *));
+            gc->zct_size = new_size;
+        }
+        cork_gc_set_deferred(header, true);
+        gc->zct[gc->zct_count++] = header;
+    }
+}
+
+static void
+cork_gc_decref_header(struct cork_gc *gc, struct cork_gc_header *header)
+{
+    cork_gc_dec_ref_count(header);
+    DEBUG("Decrementing %p -> %d\n",
+          cork_gc_get_object(header), cork_gc_get_ref_count(header));
+    if (cork_gc_get_ref_count(header) == 0) {
+        if (CORK_UNLIKELY(gc->defer_depth > 0)) {
+            cork_gc_defer_release(gc, header);
+        } else {
             DEBUG("  Releasing %p\n", header);
             cork_gc_release(gc, header);
-        } else {
-            cork_gc_possible_root(gc, header);
         }
+    } else {
+        cork_gc_possible_root(gc, header);
+    }
+}
+
+static void
+cork_gc_decref_step(struct cork_gc *gc, void *obj, void *ud)
+{
+    if (obj != NULL) {
+        cork_gc_decref_header(gc, cork_gc_get_header(obj));
     }
 }
 
@@ -238,21 +372,46 @@ void
 cork_gc_decref(void *obj)
 {
     if (obj != NULL) {
-        struct cork_gc  *gc = cork_gc_get();
-        struct cork_gc_header  *header = cork_gc_get_header(obj);
-        cork_gc_dec_ref_count(header);
-        DEBUG("Decrementing %p -> %d\n",
-              obj, cork_gc_get_ref_count(header));
+        cork_gc_decref_header(cork_gc_context(), cork_gc_get_header(obj));
+    }
+}
+
+void
+cork_gc_defer_begin(void)
+{
+    cork_gc_context()->defer_depth++;
+}
+
+void
+cork_gc_defer_end(void)
+{
+    struct cork_gc  *gc = cork_gc_context();
+    size_t  i;
+    assert(gc->defer_depth > 0);
+    if (gc->defer_depth > 1) {
+        gc->defer_depth--;
+        return;
+    }
+
+    /* We stay inside of the scope while we process the table, so that any
+     * objects whose reference counts drop to zero as a result are appended to
+     * the table, instead of being released recursively.  Releasing an object
+     * can trigger a cycle collection, which looks at the rest of the table, so
+     * we clear each entry before we release it. */
+    DEBUG("Reconciling %zu deferred objects\n", gc->zct_count);
+    for (i = 0; i < gc->zct_count; i++) {
+        struct cork_gc_header  *header = gc->zct[i];
+        gc->zct[i] = NULL;
+        cork_gc_set_deferred(header, false);
         if (cork_gc_get_ref_count(header) == 0) {
             DEBUG("  Releasing %p\n", header);
             cork_gc_release(gc, header);
-        } else {
-            cork_gc_possible_root(gc, header);
         }
     }
+    gc->zct_count = 0;
+    gc->defer_depth = 0;
 }
 
-
 static void
 cork_gc_mark_gray_step(struct cork_gc *gc, void *obj, void *ud);
 
@@ -262,6 +421,7 @@ cork_gc_mark_gray(struct cork_gc *gc, struct cork_gc_header *header)
     if (cork_gc_get_color(header) != GC_GRAY) {
         DEBUG("      Setting color to gray\n");
         cork_gc_set_color(header, GC_GRAY);
+        gc->stats.objects_scanned++;
         cork_gc_recurse(gc, header, cork_gc_mark_gray_step);
     }
 }
@@ -278,11 +438,15 @@ cork_gc_mark_gray_step(struct cork_gc *gc, void *obj, void *ud)
     }
 }
 
+/* Each of these phases operates on the possible roots starting at index
+ * `first`.  The collector is correct for any subset of the roots, which lets us
+ * collect a few of them at a time. */
+
 static void
-cork_gc_mark_roots(struct cork_gc *gc)
+cork_gc_mark_roots(struct cork_gc *gc, size_t first)
 {
     size_t  i;
-    for (i = 0; i < gc->root_count; i++) {
+    for (i = first; i < gc->root_count; i++) {
         struct cork_gc_header  *header = gc->roots[i];
         if (cork_gc_get_color(header) == GC_PURPLE) {
             DEBUG("  Checking possible garbage cycle root %p\n",
@@ -299,6 +463,7 @@ cork_gc_mark_roots(struct cork_gc *gc)
                 cork_gc_get_ref_count(header) == 0) {
                 DEBUG("  Freeing %p\n", header);
                 cork_gc_free(header);
+                gc->stats.objects_freed++;
             }
         }
     }
@@ -352,10 +517,10 @@ cork_gc_scan(struct cork_gc *gc, void *obj, void *ud)
 }
 
 static void
-cork_gc_scan_roots(struct cork_gc *gc)
+cork_gc_scan_roots(struct cork_gc *gc, size_t first)
 {
     size_t  i;
-    for (i = 0; i < gc->root_count; i++) {
+    for (i = first; i < gc->root_count; i++) {
         if (gc->roots[i] != NULL) {
             void  *obj = cork_gc_get_object(gc->roots[i]);
             cork_gc_scan(gc, obj, NULL);
@@ -363,44 +528,141 @@ cork_gc_scan_roots(struct cork_gc *gc)
     }
 }
 
+static void
+cork_gc_add_garbage(struct cork_gc *gc, struct cork_gc_header *header)
+{
+    if (CORK_UNLIKELY(gc->garbage_count == gc->garbage_size)) {
+        size_t  new_size = (gc->garbage_size == 0)? 64: gc->garbage_size * 2;
+        gc->garbage = cork_realloc
+            (gc->garbage, gc->garbage_size * sizeof(struct cork_gc_header *),
+             new_size * sizeof(struct cork_gc_header *));
+        gc->garbage_size = new_size;
+    }
+    gc->garbage[gc->garbage_count++] = header;
+}
+
+/* A white object that's still buffered as a possible root is left alone
+ * (black, with a reference count of zero); whoever processes its root buffer
+ * entry will free it. */
 static void
 cork_gc_collect_white(struct cork_gc *gc, void *obj, void *ud)
 {
     if (obj != NULL) {
         struct cork_gc_header  *header = cork_gc_get_header(obj);
-        if (cork_gc_get_color(header) == GC_WHITE &&
-            !cork_gc_get_buffered(header)) {
+        if (cork_gc_get_color(header) == GC_WHITE) {
             DEBUG("  Releasing %p\n", obj);
             cork_gc_set_color(header, GC_BLACK);
             cork_gc_recurse(gc, header, cork_gc_collect_white);
-            DEBUG("  Freeing %p\n", header);
-            cork_gc_free(header);
+            if (!cork_gc_get_buffered(header)) {
+                cork_gc_add_garbage(gc, header);
+            }
         }
     }
 }
 
 static void
-cork_gc_collect_roots(struct cork_gc *gc)
+cork_gc_collect_roots(struct cork_gc *gc, size_t first)
 {
     size_t  i;
-    for (i = 0; i < gc->root_count; i++) {
+    for (i = first; i < gc->root_count; i++) {
         if (gc->roots[i] != NULL) {
             struct cork_gc_header  *header = gc->roots[i];
             void  *obj = cork_gc_get_object(header);
             cork_gc_set_buffered(header, false);
-            DEBUG("Collecting cycles from garbage root %p\n", obj);
-            cork_gc_collect_white(gc, obj, NULL);
+            if (cork_gc_get_color(header) == GC_WHITE) {
+                DEBUG("Collecting cycles from garbage root %p\n", obj);
+                cork_gc_collect_white(gc, obj, NULL);
+            } else if (cork_gc_get_ref_count(header) == 0) {
+                /* Already found via another root */
+                cork_gc_add_garbage(gc, header);
+            }
             gc->roots[i] = NULL;
         }
     }
-    gc->root_count = 0;
+    gc->root_count = first;
+
+    for (i = 0; i < gc->garbage_count; i++) {
+        DEBUG("  Freeing %p\n", gc->garbage[i]);
+        cork_gc_free(gc->garbage[i]);
+    }
+    gc->stats.objects_freed += gc->garbage_count;
+    gc->garbage_count = 0;
 }
 
+/* gc_collect(root_count, objects_freed, duration_ns) */
+cork_tracepoint(gc_collect);
+
 static void
-cork_gc_collect_cycles(struct cork_gc *gc)
+cork_gc_collect_batch(struct cork_gc *gc, size_t first)
 {
+    size_t  i;
+    size_t  root_count = gc->root_count - first;
+    size_t  objects_freed = gc->stats.objects_freed;
+    uint64_t  start = cork_gc_now_ns();
+    uint64_t  elapsed;
     DEBUG("Collecting garbage cycles\n");
-    cork_gc_mark_roots(gc);
-    cork_gc_scan_roots(gc);
-    cork_gc_collect_roots(gc);
+    gc->stats.collections++;
+    /* Objects in the zero count table might still be referenced from the
+     * stack, so we treat each of them as having one extra reference while we
+     * look for garbage.  Entries that cork_gc_defer_end has already processed
+     * are NULL. */
+    for (i = 0; i < gc->zct_count; i++) {
+        if (gc->zct[i] != NULL) {
+            cork_gc_inc_ref_count(gc->zct[i]);
+        }
+    }
+    cork_gc_mark_roots(gc, first);
+    cork_gc_scan_roots(gc, first);
+    cork_gc_collect_roots(gc, first);
+    for (i = 0; i < gc->zct_count; i++) {
+        if (gc->zct[i] != NULL) {
+            cork_gc_dec_ref_count(gc->zct[i]);
+        }
+    }
+    elapsed = cork_gc_now_ns() - start;
+    gc->stats.collection_ns += elapsed;
+    cork_trace3(gc_collect, root_count,
+                gc->stats.objects_freed - objects_freed, elapsed);
+}
+
+static void
+cork_gc_collect_cycles(struct cork_gc *gc)
+{
+    cork_gc_collect_batch(gc, 0);
+}
+
+void
+cork_gc_collect(void)
+{
+    cork_gc_collect_cycles(cork_gc_context());
+}
+
+bool
+cork_gc_step(uint64_t budget_ns)
+{
+    struct cork_gc  *gc = cork_gc_context();
+    uint64_t  start = cork_gc_now_ns();
+    while (gc->root_count > 0) {
+        size_t  first = (gc->root_count > CORK_GC_STEP_ROOT_COUNT)?
+            gc->root_count - CORK_GC_STEP_ROOT_COUNT: 0;
+        cork_gc_collect_batch(gc, first);
+        if (cork_gc_now_ns() - start >= budget_ns) {
+            break;
+        }
+    }
+    return gc->root_count > 0;
+}
+
+void
+cork_gc_set_root_threshold(size_t threshold)
+{
+    cork_gc_context()->root_threshold = threshold;
+}
+
+void
+cork_gc_get_stats(struct cork_gc_stats *dest)
+{
+    struct cork_gc  *gc = cork_gc_context();
+    *dest = gc->stats;
+    dest->possible_roots = gc->root_count;
 }
@@ -18,3 +18,441 @@
  *   cork_big_hash_buffer
  *   cork_stable_hash_buffer
  */
+
+
+/*-----------------------------------------------------------------------
+ * Incremental hashing
+ */
+
+#include <string.h>
+
+/* Each of the incremental hashes keeps any partial block in its tail buffer
+ * until the next update fills it.  Full blocks are mixed in exactly the same
+ * way as the one-shot macros in hash.h. */
+
+static inline uint32_t
+cork_murmur_x86_32_block(uint32_t h1, uint32_t k1)
+{
+    k1 *= 0xcc9e2d51;
+    k1 = CORK_ROTL32(k1,15);
+    k1 *= 0x1b873593;
+
+    h1 ^= k1;
+    h1 = CORK_ROTL32(h1,13);
+    return h1*5+0xe6546b64;
+}
+
+static inline uint32_t
+cork_murmur_read32(const uint8_t *src, bool little_endian)
+{
+    uint32_t  k;
+    memcpy(&k, src, sizeof(k));
+    return little_endian? CORK_UINT32_HOST_TO_LITTLE(k): k;
+}
+
+static void
+cork_murmur_x86_32_update(struct cork_stable_hash_state *state,
+                          const void *vsrc, size_t len, bool little_endian)
+{
+    const uint8_t  *src = vsrc;
+    size_t  tail_len = state->len & 3;
+    state->len += len;
+
+    if (tail_len > 0) {
+        size_t  needed = 4 - tail_len;
+        if (len < needed) {
+            memcpy(state->tail + tail_len, src, len);
+            return;
+        }
+        memcpy(state->tail + tail_len, src, needed);
+        state->h1 = cork_murmur_x86_32_block
+            (state->h1, cork_murmur_read32(state->tail, little_endian));
+        src += needed;
+        len -= needed;
+    }
+
+    for (; len >= 4; src += 4, len -= 4) {
+        state->h1 = cork_murmur_x86_32_block
+            (state->h1, cork_murmur_read32(src, little_endian));
+    }
+    memcpy(state->tail, src, len);
+}
+
+static cork_hash
+cork_murmur_x86_32_final(const struct cork_stable_hash_state *state)
+{
+    const uint8_t  *tail = state->tail;
+    uint32_t  h1 = state->h1;
+    uint32_t  c1 = 0xcc9e2d51;
+    uint32_t  c2 = 0x1b873593;
+    uint32_t  k1 = 0;
+
+    switch (state->len & 3) {
+        case 3: k1 ^= tail[2] << 16;
+        case 2: k1 ^= tail[1] << 8;
+        case 1: k1 ^= tail[0];
+                k1 *= c1; k1 = CORK_ROTL32(k1,15); k1 *= c2; h1 ^= k1;
+    };
+
+    h1 ^= state->len;
+    return cork_fmix32(h1);
+}
+
+void
+cork_stable_hash_state_init(struct cork_stable_hash_state *state,
+                            cork_hash seed)
+{
+    state->h1 = seed;
+    state->len = 0;
+}
+
+void
+cork_stable_hash_state_update(struct cork_stable_hash_state *state,
+                              const void *src, size_t len)
+{
+    cork_murmur_x86_32_update(state, src, len, true);
+}
+
+cork_hash
+cork_stable_hash_state_final(const struct cork_stable_hash_state *state)
+{
+    return cork_murmur_x86_32_final(state);
+}
+
+
+#if CORK_SIZEOF_POINTER == 8
+
+static inline void
+cork_murmur_x64_128_block(struct cork_big_hash_state *state,
+                          const uint8_t *src)
+{
+    uint64_t  c1 = UINT64_C(0x87c37b91114253d5);
+    uint64_t  c2 = UINT64_C(0x4cf5ad432745937f);
+    uint64_t  h1 = state->h.u64[0];
+    uint64_t  h2 = state->h.u64[1];
+    uint64_t  k1;
+    uint64_t  k2;
+    memcpy(&k1, src, sizeof(k1));
+    memcpy(&k2, src + 8, sizeof(k2));
+
+    k1 *= c1; k1  = CORK_ROTL64(k1,31); k1 *= c2; h1 ^= k1;
+    h1 = CORK_ROTL64(h1,27); h1 += h2; h1 = h1*5+0x52dce729;
+
+    k2 *= c2; k2  = CORK_ROTL64(k2,33); k2 *= c1; h2 ^= k2;
+    h2 = CORK_ROTL64(h2,31); h2 += h1; h2 = h2*5+0x38495ab5;
+
+    state->h.u64[0] = h1;
+    state->h.u64[1] = h2;
+}
+
+#define cork_murmur_128_block  cork_murmur_x64_128_block
+
+#else
+
+static inline void
+cork_murmur_x86_128_block(struct cork_big_hash_state *state,
+                          const uint8_t *src)
+{
+    uint32_t  c1 = 0x239b961b;
+    uint32_t  c2 = 0xab0e9789;
+    uint32_t  c3 = 0x38b34ae5;
+    uint32_t  c4 = 0xa1e38b93;
+    uint32_t  h1 = state->h.u32[0];
+    uint32_t  h2 = state->h.u32[1];
+    uint32_t  h3 = state->h.u32[2];
+    uint32_t  h4 = state->h.u32[3];
+    uint32_t  k1 = cork_murmur_read32(src, false);
+    uint32_t  k2 = cork_murmur_read32(src + 4, false);
+    uint32_t  k3 = cork_murmur_read32(src + 8, false);
+    uint32_t  k4 = cork_murmur_read32(src + 12, false);
+
+    k1 *= c1; k1  = CORK_ROTL32(k1,15); k1 *= c2; h1 ^= k1;
+    h1 = CORK_ROTL32(h1,19); h1 += h2; h1 = h1*5+0x561ccd1b;
+
+    k2 *= c2; k2  = CORK_ROTL32(k2,16); k2 *= c3; h2 ^= k2;
+    h2 = CORK_ROTL32(h2,17); h2 += h3; h2 = h2*5+0x0bcaa747;
+
+    k3 *= c3; k3  = CORK_ROTL32(k3,17); k3 *= c4; h3 ^= k3;
+    h3 = CORK_ROTL32(h3,15); h3 += h4; h3 = h3*5+0x96cd1c35;
+
+    k4 *= c4; k4  = CORK_ROTL32(k4,18); k4 *= c1; h4 ^= k4;
+    h4 = CORK_ROTL32(h4,13); h4 += h1; h4 = h4*5+0x32ac3b17;
+
+    state->h.u32[0] = h1;
+    state->h.u32[1] = h2;
+    state->h.u32[2] = h3;
+    state->h.u32[3] = h4;
+}
+
+#define cork_murmur_128_block  cork_murmur_x86_128_block
+
+#endif
+
+void
+cork_big_hash_state_init(struct cork_big_hash_state *state,
+                         cork_big_hash seed)
+{
+#if CORK_SIZEOF_POINTER == 8
+    state->h.u64[0] = cork_u128_be64(seed.u128, 0);
+    state->h.u64[1] = cork_u128_be64(seed.u128, 1);
+#else
+    state->h.u32[0] = cork_u128_be32(seed.u128, 0);
+    state->h.u32[1] = cork_u128_be32(seed.u128, 1);
+    state->h.u32[2] = cork_u128_be32(seed.u128, 2);
+    state->h.u32[3] = cork_u128_be32(seed.u128, 3);
+#endif
+    state->len = 0;
+}
+
+void
+cork_big_hash_state_update(struct cork_big_hash_state *state,
+                           const void *vsrc, size_t len)
+{
+    const uint8_t  *src = vsrc;
+    size_t  tail_len = state->len & 15;
+    state->len += len;
+
+    if (tail_len > 0) {
+        size_t  needed = 16 - tail_len;
+        if (len < needed) {
+            memcpy(state->tail + tail_len, src, len);
+            return;
+        }
+        memcpy(state->tail + tail_len, src, needed);
+        cork_murmur_128_block(state, state->tail);
+        src += needed;
+        len -= needed;
+    }
+
+    for (; len >= 16; src += 16, len -= 16) {
+        cork_murmur_128_block(state, src);
+    }
+    memcpy(state->tail, src, len);
+}
+
+cork_big_hash
+cork_big_hash_state_final(const struct cork_big_hash_state *state)
+{
+    const uint8_t  *tail = state->tail;
+    size_t  len = state->len;
+    cork_big_hash  result;
+
+#if CORK_SIZEOF_POINTER == 8
+    uint64_t  c1 = UINT64_C(0x87c37b91114253d5);
+    uint64_t  c2 = UINT64_C(0x4cf5ad432745937f);
+    uint64_t  h1 = state->h.u64[0];
+    uint64_t  h2 = state->h.u64[1];
+    uint64_t  k1 = 0;
+    uint64_t  k2 = 0;
+
+    switch (len & 15) {
+        case 15: k2 ^= (uint64_t) (tail[14]) << 48;
+        case 14: k2 ^= (uint64_t) (tail[13]) << 40;
+        case 13: k2 ^= (uint64_t) (tail[12]) << 32;
+        case 12: k2 ^= (uint64_t) (tail[11]) << 24;
+        case 11: k2 ^= (uint64_t) (tail[10]) << 16;
+        case 10: k2 ^= (uint64_t) (tail[ 9]) << 8;
+        case  9: k2 ^= (uint64_t) (tail[ 8]) << 0;
+                 k2 *= c2; k2 = CORK_ROTL64(k2,33); k2 *= c1; h2 ^= k2;
+
+        case  8: k1 ^= (uint64_t) (tail[ 7]) << 56;
+        case  7: k1 ^= (uint64_t) (tail[ 6]) << 48;
+        case  6: k1 ^= (uint64_t) (tail[ 5]) << 40;
+        case  5: k1 ^= (uint64_t) (tail[ 4]) << 32;
+        case  4: k1 ^= (uint64_t) (tail[ 3]) << 24;
+        case  3: k1 ^= (uint64_t) (tail[ 2]) << 16;
+        case  2: k1 ^= (uint64_t) (tail[ 1]) << 8;
+        case  1: k1 ^= (uint64_t) (tail[ 0]) << 0;
+                 k1 *= c1; k1 = CORK_ROTL64(k1,31); k1 *= c2; h1 ^= k1;
+    };
+
+    h1 ^= len; h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = cork_fmix64(h1);
+    h2 = cork_fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    result.u128 = cork_u128_from_64(h1, h2);
+#else
+    uint32_t  c1 = 0x239b961b;
+    uint32_t  c2 = 0xab0e9789;
+    uint32_t  c3 = 0x38b34ae5;
+    uint32_t  c4 = 0xa1e38b93;
+    uint32_t  h1 = state->h.u32[0];
+    uint32_t  h2 = state->h.u32[1];
+    uint32_t  h3 = state->h.u32[2];
+    uint32_t  h4 = state->h.u32[3];
+    uint32_t  k1 = 0;
+    uint32_t  k2 = 0;
+    uint32_t  k3 = 0;
+    uint32_t  k4 = 0;
+
+    switch (len & 15) {
+        case 15: k4 ^= tail[14] << 16;
+        case 14: k4 ^= tail[13] << 8;
+        case 13: k4 ^= tail[12] << 0;
+                 k4 *= c4; k4 = CORK_ROTL32(k4,18); k4 *= c1; h4 ^= k4;
+
+        case 12: k3 ^= tail[11] << 24;
+        case 11: k3 ^= tail[10] << 16;
+        case 10: k3 ^= tail[ 9] << 8;
+        case  9: k3 ^= tail[ 8] << 0;
+                 k3 *= c3; k3 = CORK_ROTL32(k3,17); k3 *= c4; h3 ^= k3;
+
+        case  8: k2 ^= tail[ 7] << 24;
+        case  7: k2 ^= tail[ 6] << 16;
+        case  6: k2 ^= tail[ 5] << 8;
+        case  5: k2 ^= tail[ 4] << 0;
+                 k2 *= c2; k2 = CORK_ROTL32(k2,16); k2 *= c3; h2 ^= k2;
+
+        case  4: k1 ^= tail[ 3] << 24;
+        case  3: k1 ^= tail[ 2] << 16;
+        case  2: k1 ^= tail[ 1] << 8;
+        case  1: k1 ^= tail[ 0] << 0;
+                 k1 *= c1; k1 = CORK_ROTL32(k1,15); k1 *= c2; h1 ^= k1;
+    };
+
+    h1 ^= len; h2 ^= len; h3 ^= len; h4 ^= len;
+    h1 += h2; h1 += h3; h1 += h4;
+    h2 += h1; h3 += h1; h4 += h1;
+    h1 = cork_fmix32(h1);
+    h2 = cork_fmix32(h2);
+    h3 = cork_fmix32(h3);
+    h4 = cork_fmix32(h4);
+    h1 += h2; h1 += h3; h1 += h4;
+    h2 += h1; h3 += h1; h4 += h1;
+    result.u128 = cork_u128_from_32(h1, h2, h3, h4);
+#endif
+
+    return result;
+}
+
+
+void
+cork_hash_state_init(struct cork_hash_state *state, cork_hash seed)
+{
+#if CORK_SIZEOF_POINTER == 8
+    cork_big_hash  big_seed = {cork_u128_from_32(seed, seed, seed, seed)};
+    cork_big_hash_state_init(&state->big, big_seed);
+#else
+    cork_stable_hash_state_init(&state->small, seed);
+#endif
+}
+
+void
+cork_hash_state_update(struct cork_hash_state *state,
+                       const void *src, size_t len)
+{
+#if CORK_SIZEOF_POINTER == 8
+    cork_big_hash_state_update(&state->big, src, len);
+#else
+    cork_murmur_x86_32_update(&state->small, src, len, false);
+#endif
+}
+
+cork_hash
+cork_hash_state_final(const struct cork_hash_state *state)
+{
+#if CORK_SIZEOF_POINTER == 8
+    cork_big_hash  hash = cork_big_hash_state_final(&state->big);
+    return cork_u128_be32(hash.u128, 0);
+#else
+    return cork_murmur_x86_32_final(&state->small);
+#endif
+}
+
+
+/*-----------------------------------------------------------------------
+ * Hashing several buffers at once
+ */
+
+/* We hash CORK_HASH_BUFFERS_LANES buffers at a time.  For as many blocks as
+ * every buffer in the group has, we mix one block into each lane's state
+ * before moving on to the next block, so that the CPU can overlap the lanes'
+ * multiply chains instead of waiting for each one in turn.  Whatever's left of
+ * each buffer (at most a block or two for short keys) goes through the
+ * ordinary incremental functions. */
+
+#define CORK_HASH_BUFFERS_LANES  4
+
+static inline void
+cork_stable_hash_state_block(struct cork_stable_hash_state *state,
+                             const uint8_t *src)
+{
+    state->h1 = cork_murmur_x86_32_block
+        (state->h1, cork_murmur_read32(src, true));
+    state->len += 4;
+}
+
+#if CORK_SIZEOF_POINTER == 8
+#define CORK_HASH_STATE_BLOCK_SIZE  16
+#else
+#define CORK_HASH_STATE_BLOCK_SIZE  4
+#endif
+
+static inline void
+cork_hash_state_block(struct cork_hash_state *state, const uint8_t *src)
+{
+#if CORK_SIZEOF_POINTER == 8
+    cork_murmur_128_block(&state->big, src);
+    state->big.len += 16;
+#else
+    state->small.h1 = cork_murmur_x86_32_block
+        (state->small.h1, cork_murmur_read32(src, false));
+    state->small.len += 4;
+#endif
+}
+
+#define cork_hash_buffers_define(NAME, STATE, BLOCK_SIZE, PREFIX) \
+void \
+NAME(cork_hash seed, const void * const *srcs, const size_t *lens, \
+     size_t count, cork_hash *out) \
+{ \
+    size_t  i; \
+    size_t  lane; \
+    \
+    for (i = 0; i + CORK_HASH_BUFFERS_LANES <= count; \
+         i += CORK_HASH_BUFFERS_LANES) { \
+        STATE  states[CORK_HASH_BUFFERS_LANES]; \
+        const uint8_t  *src[CORK_HASH_BUFFERS_LANES]; \
+        size_t  min_blocks = SIZE_MAX; \
+        size_t  block; \
+        \
+        for (lane = 0; lane < CORK_HASH_BUFFERS_LANES; lane++) { \
+            size_t  blocks = lens[i + lane] / (BLOCK_SIZE); \
+            PREFIX##_init(&states[lane], seed); \
+            src[lane] = srcs[i + lane]; \
+            if (blocks < min_blocks) { \
+                min_blocks = blocks; \
+            } \
+        } \
+        \
+        for (block = 0; block < min_blocks; block++) { \
+            for (lane = 0; lane < CORK_HASH_BUFFERS_LANES; lane++) { \
+                PREFIX##_block(&states[lane], src[lane]); \
+                src[lane] += (BLOCK_SIZE); \
+            } \
+        } \
+        \
+        for (lane = 0; lane < CORK_HASH_BUFFERS_LANES; lane++) { \
+            size_t  done = min_blocks * (BLOCK_SIZE); \
+            PREFIX##_update \
+                (&states[lane], src[lane], lens[i + lane] - done); \
+            out[i + lane] = PREFIX##_final(&states[lane]); \
+        } \
+    } \
+    \
+    for (; i < count; i++) { \
+        STATE  state; \
+        PREFIX##_init(&state, seed); \
+        PREFIX##_update(&state, srcs[i], lens[i]); \
+        out[i] = PREFIX##_final(&state); \
+    } \
+}
+
+cork_hash_buffers_define(cork_hash_buffers, struct cork_hash_state,
+                         CORK_HASH_STATE_BLOCK_SIZE, cork_hash_state)
+cork_hash_buffers_define(cork_stable_hash_buffers,
+                         struct cork_stable_hash_state,
+                         4, cork_stable_hash_state)
@@ -14,6 +14,7 @@
 #include "libcork/core/error.h"
 #include "libcork/core/net-addresses.h"
 #include "libcork/core/types.h"
+#include "libcork/ds/buffer.h"
 
 #ifndef CORK_IP_ADDRESS_DEBUG
 #define CORK_IP_ADDRESS_DEBUG 0
@@ -34,78 +35,222 @@
  * IP addresses
  */
 
+/* Rendering addresses is on the hot path for logging, so we write the digits
+ * directly instead of going through sprintf.  Each octet's decimal string
+ * lives in a 4-byte table entry (padded with NULs), with its length in the
+ * last byte, so that we can copy an entire entry with a single store. */
+
+static const char  CORK_IP_OCTET_STRINGS[256][4] = {
+    "0\0\0\1", "1\0\0\1", "2\0\0\1", "3\0\0\1", "4\0\0\1", "5\0\0\1",
+    "6\0\0\1", "7\0\0\1", "8\0\0\1", "9\0\0\1", "10\0\2", "11\0\2", "12\0\2",
+    "13\0\2", "14\0\2", "15\0\2", "16\0\2", "17\0\2", "18\0\2", "19\0\2",
+    "20\0\2", "21\0\2", "22\0\2", "23\0\2", "24\0\2", "25\0\2", "26\0\2",
+    "27\0\2", "28\0\2", "29\0\2", "30\0\2", "31\0\2", "32\0\2", "33\0\2",
+    "34\0\2", "35\0\2", "36\0\2", "37\0\2", "38\0\2", "39\0\2", "40\0\2",
+    "41\0\2", "42\0\2", "43\0\2", "44\0\2", "45\0\2", "46\0\2", "47\0\2",
+    "48\0\2", "49\0\2", "50\0\2", "51\0\2", "52\0\2", "53\0\2", "54\0\2",
+    "55\0\2", "56\0\2", "57\0\2", "58\0\2", "59\0\2", "60\0\2", "61\0\2",
+    "62\0\2", "63\0\2", "64\0\2", "65\0\2", "66\0\2", "67\0\2", "68\0\2",
+    "69\0\2", "70\0\2", "71\0\2", "72\0\2", "73\0\2", "74\0\2", "75\0\2",
+    "76\0\2", "77\0\2", "78\0\2", "79\0\2", "80\0\2", "81\0\2", "82\0\2",
+    "83\0\2", "84\0\2", "85\0\2", "86\0\2", "87\0\2", "88\0\2", "89\0\2",
+    "90\0\2", "91\0\2", "92\0\2", "93\0\2", "94\0\2", "95\0\2", "96\0\2",
+    "97\0\2", "98\0\2", "99\0\2", "100\3", "101\3", "102\3", "103\3", "104\3",
+    "105\3", "106\3", "107\3", "108\3", "109\3", "110\3", "111\3", "112\3",
+    "113\3", "114\3", "115\3", "116\3", "117\3", "118\3", "119\3", "120\3",
+    "121\3", "122\3", "123\3", "124\3", "125\3", "126\3", "127\3", "128\3",
+    "129\3", "130\3", "131\3", "132\3", "133\3", "134\3", "135\3", "136\3",
+    "137\3", "138\3", "139\3", "140\3", "141\3", "142\3", "143\3", "144\3",
+    "145\3", "146\3", "147\3", "148\3", "149\3", "150\3", "151\3", "152\3",
+    "153\3", "154\3", "155\3", "156\3", "157\3", "158\3", "159\3", "160\3",
+    "161\3", "162\3", "163\3", "164\3", "165\3", "166\3", "167\3", "168\3",
+    "169\3", "170\3", "171\3", "172\3", "173\3", "174\3", "175\3", "176\3",
+    "177\3", "178\3", "179\3", "180\3", "181\3", "182\3", "183\3", "184\3",
+    "185\3", "186\3", "187\3", "188\3", "189\3", "190\3", "191\3", "192\3",
+    "193\3", "194\3", "195\3", "196\3", "197\3", "198\3", "199\3", "200\3",
+    "201\3", "202\3", "203\3", "204\3", "205\3", "206\3", "207\3", "208\3",
+    "209\3", "210\3", "211\3", "212\3", "213\3", "214\3", "215\3", "216\3",
+    "217\3", "218\3", "219\3", "220\3", "221\3", "222\3", "223\3", "224\3",
+    "225\3", "226\3", "227\3", "228\3", "229\3", "230\3", "231\3", "232\3",
+    "233\3", "234\3", "235\3", "236\3", "237\3", "238\3", "239\3", "240\3",
+    "241\3", "242\3", "243\3", "244\3", "245\3", "246\3", "247\3", "248\3",
+    "249\3", "250\3", "251\3", "252\3", "253\3", "254\3", "255\3",
+};
+
+/* Two lowercase hex digits for every byte */
+static const char  CORK_IP_HEX_PAIRS[] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+static char *
+cork_ip_write_octet(char *dest, unsigned int octet)
+{
+    memcpy(dest, CORK_IP_OCTET_STRINGS[octet], 4);
+    return dest + CORK_IP_OCTET_STRINGS[octet][3];
+}
+
+static char *
+cork_ip_write_dotted_quad(char *dest, const uint8_t *src)
+{
+    dest = cork_ip_write_octet(dest, src[0]);
+    *dest++ = '.';
+    dest = cork_ip_write_octet(dest, src[1]);
+    *dest++ = '.';
+    dest = cork_ip_write_octet(dest, src[2]);
+    *dest++ = '.';
+    dest = cork_ip_write_octet(dest, src[3]);
+    *dest = '\0';
+    return dest;
+}
+
+static char *
+cork_ip_write_hextet(char *dest, unsigned int hextet)
+{
+    /* No leading zeroes */
+    unsigned int  high = hextet >> 8;
+    unsigned int  low = hextet & 0xff;
+    if (high != 0) {
+        if (high >= 0x10) {
+            *dest++ = CORK_IP_HEX_PAIRS[2*high];
+        }
+        *dest++ = CORK_IP_HEX_PAIRS[2*high + 1];
+        *dest++ = CORK_IP_HEX_PAIRS[2*low];
+    } else if (low >= 0x10) {
+        *dest++ = CORK_IP_HEX_PAIRS[2*low];
+    }
+    *dest++ = CORK_IP_HEX_PAIRS[2*low + 1];
+    return dest;
+}
+
+static char *
+cork_ip_write_ipv6(char *dest, const uint8_t *src)
+{
+    unsigned int  words[8];
+    unsigned int  zeroes = 0;
+    unsigned int  runs;
+    unsigned int  best_base = 8;
+    unsigned int  best_end = 8;
+    unsigned int  i;
+
+    for (i = 0; i < 8; i++) {
+        words[i] = (src[2*i] << 8) | src[2*i + 1];
+        if (words[i] == 0) {
+            zeroes |= 1 << i;
+        }
+    }
+
+    /* Find the longest run of zero hextets, which we compress to "::".  Bit i
+     * of runs is set if there's a run of zeroes starting at hextet i, so we
+     * keep shrinking it until it's about to become empty; its lowest bit is
+     * then the start of the first of the longest runs.  Per RFC 5952, we
+     * never compress a single zero hextet. */
+    runs = zeroes & (zeroes >> 1);
+    if (runs != 0) {
+        unsigned int  length = 2;
+        unsigned int  next;
+        while ((next = runs & (runs >> 1)) != 0) {
+            runs = next;
+            length++;
+        }
+        best_base = __builtin_ctz(runs);
+        best_end = best_base + length;
+    }
+
+    for (i = 0; i < 8; i++) {
+        if (i == best_base) {
+            *dest++ = ':';
+            i = best_end - 1;
+            continue;
+        }
+        /* Are we following an initial run of zeroes or any real hex? */
+        if (i != 0) {
+            *dest++ = ':';
+        }
+        /* Is this address an encapsulated IPv4? */
+        if (i == 6 && best_base == 0 &&
+            (best_end == 6 || (best_end == 5 && words[5] == 0xffff))) {
+            return cork_ip_write_dotted_quad(dest, src + 12);
+        }
+        dest = cork_ip_write_hextet(dest, words[i]);
+    }
+    /* Was it a trailing run of zeroes? */
+    if (best_end == 8 && best_base != 8) {
+        *dest++ = ':';
+    }
+    *dest = '\0';
+    return dest;
+}
+
 /*** IPv4 ***/
 
-static inline const char *
-cork_ipv4_parse(struct cork_ipv4 *addr, const char *str)
+/* Parses a dotted quad from the len bytes at str, which don't have to be
+ * NUL-terminated.  We don't set an error condition if the string isn't a
+ * valid address, so that callers that are trying several address types (or
+ * parsing a large batch of addresses) don't have to pay for one. */
+static inline bool
+cork_ipv4_parse(void *dest, const char *str, size_t len)
 {
-    const char  *ch;
-    bool  seen_digit_in_octet = false;
-    unsigned int  octets = 0;
-    unsigned int  digit = 0;
+    const char  *ch = str;
+    const char  *end = str + len;
+    unsigned int  octet;
     uint8_t  result[4];
 
-    for (ch = str; *ch != '\0'; ch++) {
-        DEBUG("%2u: %c\t", (unsigned int) (ch-str), *ch);
-        switch (*ch) {
-            case '0': case '1': case '2': case '3': case '4':
-            case '5': case '6': case '7': case '8': case '9':
-                seen_digit_in_octet = true;
-                digit *= 10;
-                digit += (*ch - '0');
-                DEBUG("digit = %u\n", digit);
-                if (CORK_UNLIKELY(digit > 255)) {
-                    DEBUG("\t");
-                    goto parse_error;
-                }
-                break;
+    for (octet = 0; octet < 4; octet++) {
+        const char  *octet_start;
+        unsigned int  value = 0;
 
-            case '.':
-                /* If this would be the fourth octet, it can't have a trailing
-                 * period. */
-                if (CORK_UNLIKELY(octets == 3)) {
-                    goto parse_error;
-                }
-                DEBUG("octet %u = %u\n", octets, digit);
-                result[octets] = digit;
-                digit = 0;
-                octets++;
-                seen_digit_in_octet = false;
-                break;
+        /* Every octet but the first must be preceded by a period. */
+        if (octet > 0) {
+            if (CORK_UNLIKELY(ch == end || *ch != '.')) {
+                return false;
+            }
+            ch++;
+        }
 
-            default:
-                /* Any other character is a parse error. */
-                goto parse_error;
+        /* Each octet can have any number of leading zeroes, but its value
+         * can't be larger than 255. */
+        octet_start = ch;
+        while (ch < end && (unsigned int) (*ch - '0') < 10) {
+            value = value * 10 + (*ch - '0');
+            if (CORK_UNLIKELY(value > 255)) {
+                return false;
+            }
+            ch++;
+        }
+        if (CORK_UNLIKELY(ch == octet_start)) {
+            return false;
         }
+        result[octet] = value;
     }
 
-    /* If we have a valid octet at the end, and that would be the fourth octet,
-     * then we've got a valid final parse. */
-    DEBUG("%2u:\t", (unsigned int) (ch-str));
-    if (CORK_LIKELY(seen_digit_in_octet && octets == 3)) {
-#if CORK_IP_ADDRESS_DEBUG
-        char  parsed_ipv4[CORK_IPV4_STRING_LENGTH];
-#endif
-        DEBUG("octet %u = %u\n", octets, digit);
-        result[octets] = digit;
-        cork_ipv4_copy(addr, result);
-#if CORK_IP_ADDRESS_DEBUG
-        cork_ipv4_to_raw_string(addr, parsed_ipv4);
-        DEBUG("\tParsed address: %s\n", parsed_ipv4);
-#endif
-        return ch;
+    /* There can't be anything after the fourth octet. */
+    if (CORK_UNLIKELY(ch != end)) {
+        return false;
     }
+    memcpy(dest, result, sizeof(result));
+    return true;
+}
 
-parse_error:
-    DEBUG("parse error\n");
-    cork_parse_error("Invalid IPv4 address: \"%s\"", str);
-    return NULL;
+int
+cork_ipv4_init_n(struct cork_ipv4 *addr, const char *str, size_t len)
+{
+    if (CORK_LIKELY(cork_ipv4_parse(addr, str, len))) {
+        return 0;
+    }
+    cork_parse_error("Invalid IPv4 address: \"%.*s\"", (int) len, str);
+    return -1;
 }
 
 int
 cork_ipv4_init(struct cork_ipv4 *addr, const char *str)
 {
-    return cork_ipv4_parse(addr, str) == NULL? -1: 0;
+    return cork_ipv4_init_n(addr, str, strlen(str));
 }
 
 bool
@@ -117,8 +262,13 @@ cork_ipv4_equal_(const struct cork_ipv4 *addr1, const struct cork_ipv4 *addr2)
 void
 cork_ipv4_to_raw_string(const struct cork_ipv4 *addr, char *dest)
 {
-    snprintf(dest, CORK_IPV4_STRING_LENGTH, "%u.%u.%u.%u",
-             addr->_.u8[0], addr->_.u8[1], addr->_.u8[2], addr->_.u8[3]);
+    cork_ip_write_dotted_quad(dest, addr->_.u8);
+}
+
+size_t
+cork_ipv4_format(const struct cork_ipv4 *addr, char *dest)
+{
+    return cork_ip_write_dotted_quad(dest, addr->_.u8) - dest;
 }
 
 bool
@@ -141,10 +291,14 @@ cork_ipv4_is_valid_network(const struct cork_ipv4 *addr,
 
 /*** IPv6 ***/
 
-int
-cork_ipv6_init(struct cork_ipv6 *addr, const char *str)
+/* Parses an IPv6 address from the len bytes at str, which don't have to be
+ * NUL-terminated.  Like cork_ipv4_parse, this doesn't set an error
+ * condition. */
+static bool
+cork_ipv6_parse(struct cork_ipv6 *addr, const char *str, size_t len)
 {
     const char  *ch;
+    const char  *end = str + len;
 
     uint16_t  digit = 0;
     unsigned int  before_count = 0;
@@ -160,7 +314,7 @@ cork_ipv6_init(struct cork_ipv6 *addr, const char *str)
     bool  double_colon_allowed = true;
     bool  just_saw_colon = false;
 
-    for (ch = str; *ch != '\0'; ch++) {
+    for (ch = str; ch < end; ch++) {
         DEBUG("%2u: %c\t", (unsigned int) (ch-str), *ch);
         switch (*ch) {
 #define process_digit(base) \
@@ -248,8 +402,9 @@ cork_ipv6_init(struct cork_ipv6 *addr, const char *str)
             {
                 /* If we see a period, then we must be in the middle of an IPv4
                  * address at the end of the IPv6 address. */
-                struct cork_ipv4  *ipv4 = (struct cork_ipv4 *) dest;
-                DEBUG("Detected IPv4 address %s\n", ch-digits_seen);
+                const char  *ipv4 = ch - digits_seen;
+                DEBUG("Detected IPv4 address %.*s\n",
+                      (int) (end - ipv4), ipv4);
 
                 /* Ensure that we have space for the two hextets that the IPv4
                  * address will take up. */
@@ -259,15 +414,14 @@ cork_ipv6_init(struct cork_ipv6 *addr, const char *str)
 
                 /* Parse the IPv4 address directly into our current hextet
                  * buffer. */
-                ch = cork_ipv4_parse(ipv4, ch - digits_seen);
-                if (CORK_LIKELY(ch != NULL)) {
+                if (CORK_LIKELY(cork_ipv4_parse(dest, ipv4, end - ipv4))) {
                     hextets_seen += 2;
                     digits_seen = 0;
                     another_required = false;
 
-                    /* ch now points at the NUL terminator, but we're about to
-                     * increment ch. */
-                    ch--;
+                    /* The IPv4 address runs to the end of the string, but
+                     * we're about to increment ch. */
+                    ch = end - 1;
                     break;
                 }
 
@@ -318,7 +472,7 @@ cork_ipv6_init(struct cork_ipv6 *addr, const char *str)
         cork_ipv6_to_raw_string(addr, parsed_result);
         DEBUG("\tParsed address: %s\n", parsed_result);
 #endif
-        return 0;
+        return true;
     } else if (hextets_seen == 8) {
         /* No double-colon, so we must have exactly eight hextets. */
 #if CORK_IP_ADDRESS_DEBUG
@@ -330,103 +484,46 @@ cork_ipv6_init(struct cork_ipv6 *addr, const char *str)
         cork_ipv6_to_raw_string(addr, parsed_result);
         DEBUG("\tParsed address: %s\n", parsed_result);
 #endif
-        return 0;
+        return true;
     }
 
 parse_error:
     DEBUG("parse error\n");
-    cork_parse_error("Invalid IPv6 address: \"%s\"", str);
+    return false;
+}
+
+int
+cork_ipv6_init_n(struct cork_ipv6 *addr, const char *str, size_t len)
+{
+    if (CORK_LIKELY(cork_ipv6_parse(addr, str, len))) {
+        return 0;
+    }
+    cork_parse_error("Invalid IPv6 address: \"%.*s\"", (int) len, str);
     return -1;
 }
 
+int
+cork_ipv6_init(struct cork_ipv6 *addr, const char *str)
+{
+    return cork_ipv6_init_n(addr, str, strlen(str));
+}
+
 bool
 cork_ipv6_equal_(const struct cork_ipv6 *addr1, const struct cork_ipv6 *addr2)
 {
     return cork_ipv6_equal(addr1, addr2);
 }
 
-#define NS_IN6ADDRSZ 16
-#define NS_INT16SZ 2
-
 void
 cork_ipv6_to_raw_string(const struct cork_ipv6 *addr, char *dest)
 {
-    const uint8_t  *src = addr->_.u8;
-
-    /*
-     * Note that int32_t and int16_t need only be "at least" large enough
-     * to contain a value of the specified size.  On some systems, like
-     * Crays, there is no such thing as an integer variable with 16 bits.
-     * Keep this in mind if you think this function should have been coded
-     * to use pointer overlays.  All the world's not a VAX.
-     */
-    char *tp;
-    struct { int base, len; } best, cur;
-    unsigned int words[NS_IN6ADDRSZ / NS_INT16SZ];
-    int i;
-
-    /*
-     * Preprocess:
-     *      Copy the input (bytewise) array into a wordwise array.
-     *      Find the longest run of 0x00's in src[] for :: shorthanding.
-     */
-    memset(words, '\0', sizeof words);
-    for (i = 0; i < NS_IN6ADDRSZ; i++)
-        words[i / 2] |= (src[i] << ((1 - (i % 2)) << 3));
-    best.base = -1;
-    best.len = 0;
-    cur.base = -1;
-    cur.len = 0;
-    for (i = 0; i < (NS_IN6ADDRSZ / NS_INT16SZ); i++) {
-        if (words[i] == 0) {
-            if (cur.base == -1)
-                cur.base = i, cur.len = 1;
-            else
-                cur.len++;
-        } else {
-            if (cur.base != -1) {
-                if (best.base == -1 || cur.len > best.len)
-                    best = cur;
-                cur.base = -1;
-            }
-        }
-    }
-    if (cur.base != -1) {
-        if (best.base == -1 || cur.len > best.len)
-            best = cur;
-    }
-    if (best.base != -1 && best.len < 2)
-        best.base = -1;
-
-    /*
-     * Format the result.
-     */
-    tp = dest;
-    for (i = 0; i < (NS_IN6ADDRSZ / NS_INT16SZ); i++) {
-        /* Are we inside the best run of 0x00's? */
-        if (best.base != -1 && i >= best.base &&
-            i < (best.base + best.len)) {
-            if (i == best.base)
-                *tp++ = ':';
-            continue;
-        }
-        /* Are we following an initial run of 0x00s or any real hex? */
-        if (i != 0)
-            *tp++ = ':';
-        /* Is this address an encapsulated IPv4? */
-        if (i == 6 && best.base == 0 &&
-            (best.len == 6 || (best.len == 5 && words[5] == 0xffff))) {
-            tp += sprintf(tp, "%u.%u.%u.%u",
-                          src[12], src[13], src[14], src[15]);
-            break;
-        }
-        tp += sprintf(tp, "%x", words[i]);
-    }
-    /* Was it a trailing run of 0x00's? */
-    if (best.base != -1 && (best.base + best.len) ==
-        (NS_IN6ADDRSZ / NS_INT16SZ))
-        *tp++ = ':';
-    *tp++ = '\0';
+    cork_ip_write_ipv6(dest, addr->_.u8);
+}
+
+size_t
+cork_ipv6_format(const struct cork_ipv6 *addr, char *dest)
+{
+    return cork_ip_write_ipv6(dest, addr->_.u8) - dest;
 }
 
 bool
@@ -452,8 +549,8 @@ cork_ipv6_is_valid_network(const struct cork_ipv6 *addr,
         cidr_mask[1] = UINT64_C(0xffffffffffffffff);
     }
 
-    return (CORK_UINT64_BIG_TO_HOST(addr->_.u64[0] & cidr_mask[0]) == 0) &&
-           (CORK_UINT64_BIG_TO_HOST(addr->_.u64[1] & cidr_mask[1]) == 0);
+    return (CORK_UINT64_BIG_TO_HOST(addr->_.u64[0]) & cidr_mask[0]) == 0 &&
+           (CORK_UINT64_BIG_TO_HOST(addr->_.u64[1]) & cidr_mask[1]) == 0;
 }
 
 
@@ -471,33 +568,63 @@ cork_ip_from_ipv6_(struct cork_ip *addr, const void *src)
     cork_ip_from_ipv6(addr, src);
 }
 
-int
-cork_ip_init(struct cork_ip *addr, const char *str)
+/* Every IPv6 address contains a colon, and no IPv4 address does, so we only
+ * have to try parsing one of them. */
+static inline bool
+cork_ip_parse(struct cork_ip *addr, const char *str, size_t len)
 {
-    int  rc;
-
-    /* Try IPv4 first */
-    rc = cork_ipv4_init(&addr->ip.v4, str);
-    if (rc == 0) {
-        /* successful parse */
-        addr->version = 4;
-        return 0;
+    if (memchr(str, ':', len) == NULL) {
+        if (CORK_LIKELY(cork_ipv4_parse(&addr->ip.v4, str, len))) {
+            addr->version = 4;
+            return true;
+        }
+    } else {
+        if (CORK_LIKELY(cork_ipv6_parse(&addr->ip.v6, str, len))) {
+            addr->version = 6;
+            return true;
+        }
     }
+    return false;
+}
 
-    /* Then try IPv6 */
-    cork_error_clear();
-    rc = cork_ipv6_init(&addr->ip.v6, str);
-    if (rc == 0) {
-        /* successful parse */
-        addr->version = 6;
+int
+cork_ip_init_n(struct cork_ip *addr, const char *str, size_t len)
+{
+    if (CORK_LIKELY(cork_ip_parse(addr, str, len))) {
         return 0;
     }
-
-    /* Parse error for both address types */
-    cork_parse_error("Invalid IP address: \"%s\"", str);
+    cork_parse_error("Invalid IP address: \"%.*s\"", (int) len, str);
     return -1;
 }
 
+int
+cork_ip_init(struct cork_ip *addr, const char *str)
+{
+    return cork_ip_init_n(addr, str, strlen(str));
+}
+
+int
+cork_ip_init_slices(struct cork_ip *addrs, const struct cork_slice *srcs,
+                    size_t count)
+{
+    int  rc = 0;
+    size_t  i;
+    for (i = 0; i < count; i++) {
+        if (CORK_UNLIKELY(!cork_ip_parse
+                          (&addrs[i], srcs[i].buf, srcs[i].size))) {
+            addrs[i].version = 0;
+            /* Only describe the first invalid address. */
+            if (rc == 0) {
+                cork_parse_error
+                    ("Invalid IP address: \"%.*s\"",
+                     (int) srcs[i].size, (const char *) srcs[i].buf);
+                rc = -1;
+            }
+        }
+    }
+    return rc;
+}
+
 bool
 cork_ip_equal_(const struct cork_ip *addr1, const struct cork_ip *addr2)
 {
@@ -522,6 +649,22 @@ cork_ip_to_raw_string(const struct cork_ip *addr, char *dest)
     }
 }
 
+size_t
+cork_ip_format(const struct cork_ip *addr, char *dest)
+{
+    switch (addr->version) {
+        case 4:
+            return cork_ipv4_format(&addr->ip.v4, dest);
+
+        case 6:
+            return cork_ipv6_format(&addr->ip.v6, dest);
+
+        default:
+            strncpy(dest, "<INVALID>", CORK_IP_STRING_LENGTH);
+            return sizeof("<INVALID>") - 1;
+    }
+}
+
 bool
 cork_ip_is_valid_network(const struct cork_ip *addr, unsigned int cidr_prefix)
 {
@@ -534,3 +677,44 @@ cork_ip_is_valid_network(const struct cork_ip *addr, unsigned int cidr_prefix)
             return false;
     }
 }
+
+
+/*-----------------------------------------------------------------------
+ * Appending to buffers
+ */
+
+void
+cork_buffer_append_ipv4(struct cork_buffer *buffer,
+                        const struct cork_ipv4 *addr)
+{
+    cork_buffer_ensure_size
+        (buffer, buffer->size + CORK_IPV4_STRING_LENGTH);
+    buffer->size = cork_ip_write_dotted_quad
+        (buffer->buf + buffer->size, addr->_.u8) - (char *) buffer->buf;
+}
+
+void
+cork_buffer_append_ipv6(struct cork_buffer *buffer,
+                        const struct cork_ipv6 *addr)
+{
+    cork_buffer_ensure_size
+        (buffer, buffer->size + CORK_IPV6_STRING_LENGTH);
+    buffer->size = cork_ip_write_ipv6
+        (buffer->buf + buffer->size, addr->_.u8) - (char *) buffer->buf;
+}
+
+void
+cork_buffer_append_ip(struct cork_buffer *buffer, const struct cork_ip *addr)
+{
+    switch (addr->version) {
+        case 4:
+            cork_buffer_append_ipv4(buffer, &addr->ip.v4);
+            return;
+        case 6:
+            cork_buffer_append_ipv6(buffer, &addr->ip.v6);
+            return;
+        default:
+            cork_buffer_append_literal(buffer, "<INVALID>");
+            return;
+    }
+}
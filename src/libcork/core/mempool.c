@@ -10,10 +10,14 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include "libcork/core/allocator.h"
 #include "libcork/core/callbacks.h"
 #include "libcork/core/mempool.h"
+#include "libcork/core/trace.h"
 #include "libcork/core/types.h"
 #include "libcork/helpers/errors.h"
+#include "libcork/threads/atomics.h"
+#include "libcork/threads/basics.h"
 
 
 #if !defined(CORK_DEBUG_MEMPOOL)
@@ -32,16 +36,47 @@
 struct cork_mempool {
     size_t  element_size;
     size_t  block_size;
+    /* The allocator that we get blocks from */
+    const struct cork_alloc  *alloc;
+    /* The allocator that we got the pool itself (and its magazines) from */
+    const struct cork_alloc  *self_alloc;
     struct cork_mempool_object  *free_list;
+    /* The number of objects in free_list */
+    size_t  free_count;
     /* The number of objects that have been given out by
      * cork_mempool_new but not returned via cork_mempool_free. */
     size_t  allocated_count;
     struct cork_mempool_block  *blocks;
+    size_t  block_count;
+    /* If nonzero, we'll automatically trim the pool whenever free_count
+     * reaches next_trim_count. */
+    size_t  max_free_count;
+    size_t  next_trim_count;
 
     void  *user_data;
     cork_free_f  free_user_data;
     cork_init_f  init_object;
     cork_done_f  done_object;
+
+    /* Only used for thread-cached pools.  In that case, free_list, blocks,
+     * and magazines are the shared "depot", and are protected by lock. */
+    unsigned int  id;
+    size_t  magazine_size;
+    volatile int  lock;
+    struct cork_mempool_magazine  *magazines;
+};
+
+/* A thread's private cache of free objects from a thread-cached pool. */
+struct cork_mempool_magazine {
+    struct cork_mempool_magazine  *next;
+    cork_thread_id  owner;
+    struct cork_mempool_object  *free_list;
+    size_t  free_count;
+    /* Objects allocated minus objects freed by the owning thread.  Since
+     * objects can be freed by a different thread than the one that allocated
+     * them, this can wrap around; only the sum across every magazine is
+     * meaningful. */
+    size_t  allocated_count;
 };
 
 struct cork_mempool_object {
@@ -65,45 +100,79 @@ struct cork_mempool_block {
 
 
 struct cork_mempool *
-cork_mempool_new_size_ex(size_t element_size, size_t block_size)
+cork_mempool_new_size_alloc(size_t element_size, size_t block_size,
+                            const struct cork_alloc *alloc)
 {
-    struct cork_mempool  *mp = cork_new(struct cork_mempool);
+    struct cork_mempool  *mp = cork_alloc_new(alloc, struct cork_mempool);
     mp->element_size = element_size;
     mp->block_size = block_size;
+    mp->alloc = alloc;
+    mp->self_alloc = alloc;
     mp->free_list = NULL;
+    mp->free_count = 0;
     mp->allocated_count = 0;
     mp->blocks = NULL;
+    mp->block_count = 0;
+    mp->max_free_count = 0;
+    mp->next_trim_count = 0;
     mp->user_data = NULL;
     mp->free_user_data = NULL;
     mp->init_object = NULL;
     mp->done_object = NULL;
+    mp->id = 0;
+    mp->magazine_size = 0;
+    mp->lock = 0;
+    mp->magazines = NULL;
     return mp;
 }
 
-void
-cork_mempool_free(struct cork_mempool *mp)
+struct cork_mempool *
+cork_mempool_new_size_ex(size_t element_size, size_t block_size)
 {
-    struct cork_mempool_block  *curr;
-    assert(mp->allocated_count == 0);
+    return cork_mempool_new_size_alloc
+        (element_size, block_size, cork_current_allocator());
+}
 
+static void
+cork_mempool_done_objects(struct cork_mempool *mp,
+                          struct cork_mempool_object *obj)
+{
     if (mp->done_object != NULL) {
-        struct cork_mempool_object  *obj;
-        for (obj = mp->free_list; obj != NULL; obj = obj->next_free) {
+        for (; obj != NULL; obj = obj->next_free) {
             mp->done_object
                 (mp->user_data, cork_mempool_get_object(obj));
         }
     }
+}
+
+void
+cork_mempool_free(struct cork_mempool *mp)
+{
+    struct cork_mempool_block  *curr;
+    struct cork_mempool_magazine  *magazine;
+    size_t  allocated_count = mp->allocated_count;
+
+    for (magazine = mp->magazines; magazine != NULL; ) {
+        struct cork_mempool_magazine  *next = magazine->next;
+        allocated_count += magazine->allocated_count;
+        cork_mempool_done_objects(mp, magazine->free_list);
+        cork_alloc_delete
+            (mp->self_alloc, struct cork_mempool_magazine, magazine);
+        magazine = next;
+    }
+    assert(allocated_count == 0);
+    cork_mempool_done_objects(mp, mp->free_list);
 
     for (curr = mp->blocks; curr != NULL; ) {
         struct cork_mempool_block  *next = curr->next_block;
-        cork_free(curr, mp->block_size);
+        cork_alloc_free(mp->alloc, curr, mp->block_size);
         /* Do this here instead of in the for statement to avoid
          * accessing the just-freed block. */
         curr = next;
     }
 
     cork_free_user_data(mp);
-    cork_delete(struct cork_mempool, mp);
+    cork_alloc_delete(mp->self_alloc, struct cork_mempool, mp);
 }
 
 
@@ -128,6 +197,14 @@ cork_mempool_set_done_object(struct cork_mempool *mp, cork_done_f done_object)
     mp->done_object = done_object;
 }
 
+void
+cork_mempool_set_allocator(struct cork_mempool *mp,
+                           const struct cork_alloc *alloc)
+{
+    assert(mp->blocks == NULL);
+    mp->alloc = alloc;
+}
+
 void
 cork_mempool_set_callbacks(struct cork_mempool *mp,
                            void *user_data, cork_free_f free_user_data,
@@ -140,6 +217,9 @@ cork_mempool_set_callbacks(struct cork_mempool *mp,
 }
 
 
+/* mempool_new_block(mp, element_size, block_size, duration_ns) */
+cork_tracepoint(mempool_new_block);
+
 /* If this function succeeds, then we guarantee that there will be at
  * least one object in mp->free_list. */
 static void
@@ -148,10 +228,12 @@ cork_mempool_new_block(struct cork_mempool *mp)
     /* Allocate the new block and add it to mp's block list. */
     struct cork_mempool_block  *block;
     void  *vblock;
+    uint64_t  start = cork_trace_start(mempool_new_block);
     DEBUG("Allocating new %zu-byte block\n", mp->block_size);
-    block = cork_malloc(mp->block_size);
+    block = cork_alloc_malloc(mp->alloc, mp->block_size);
     block->next_block = mp->blocks;
     mp->blocks = block;
+    mp->block_count++;
     vblock = block;
 
     /* Divide the block's memory region into a bunch of objects. */
@@ -167,21 +249,287 @@ cork_mempool_new_block(struct cork_mempool *mp)
         }
         obj->next_free = mp->free_list;
         mp->free_list = obj;
+        mp->free_count++;
+    }
+
+    cork_trace4(mempool_new_block, mp, mp->element_size, mp->block_size,
+                cork_trace_elapsed(start));
+}
+
+static void
+cork_mempool_trim_free_list(struct cork_mempool *mp);
+
+/* Adds a chain of `count` objects to the pool's own free list.  For
+ * thread-cached pools, you must hold the depot lock. */
+static void
+cork_mempool_add_free_objects(struct cork_mempool *mp,
+                              struct cork_mempool_object *head,
+                              struct cork_mempool_object *tail, size_t count)
+{
+    tail->next_free = mp->free_list;
+    mp->free_list = head;
+    mp->free_count += count;
+    if (CORK_UNLIKELY(mp->max_free_count != 0 &&
+                      mp->free_count >= mp->next_trim_count)) {
+        cork_mempool_trim_free_list(mp);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Thread caches
+ */
+
+/* Each thread keeps track of its magazines for this many pools; if a thread
+ * uses more pools than this, it will have to look up (or create) its magazine
+ * in the pool's depot more often. */
+#define CORK_MEMPOOL_THREAD_CACHE_SIZE  16
+
+struct cork_mempool_thread_cache {
+    unsigned int  ids[CORK_MEMPOOL_THREAD_CACHE_SIZE];
+    struct cork_mempool_magazine  *magazines[CORK_MEMPOOL_THREAD_CACHE_SIZE];
+    unsigned int  next_victim;
+};
+
+cork_tls_fast(struct cork_mempool_thread_cache, cork_mempool_thread_cache);
+
+/* Pool IDs are never reused, so a thread cache entry for a pool that has since
+ * been freed can never match a live pool, even one at the same address. */
+static volatile unsigned int  cork_mempool_last_id = 0;
+
+void
+cork_mempool_set_thread_cache(struct cork_mempool *mp, size_t magazine_size)
+{
+    assert(mp->blocks == NULL);
+    if (magazine_size == 0) {
+        magazine_size = CORK_MEMPOOL_DEFAULT_MAGAZINE_SIZE;
+    } else if (magazine_size < 2) {
+        magazine_size = 2;
+    }
+    mp->magazine_size = magazine_size;
+    mp->id = cork_uint_atomic_add(&cork_mempool_last_id, 1);
+}
+
+static void
+cork_mempool_lock(struct cork_mempool *mp)
+{
+    while (CORK_UNLIKELY(cork_int_cas(&mp->lock, 0, 1) != 0)) {
+        cork_pause();
+    }
+}
+
+static void
+cork_mempool_unlock(struct cork_mempool *mp)
+{
+    CORK_ATTR_UNUSED int  prior = cork_int_cas(&mp->lock, 1, 0);
+    assert(prior == 1);
+}
+
+/* Finds or creates the current thread's magazine in the pool's depot. */
+static struct cork_mempool_magazine *
+cork_mempool_claim_magazine(struct cork_mempool *mp,
+                            struct cork_mempool_thread_cache *cache)
+{
+    cork_thread_id  self = cork_current_thread_get_id();
+    struct cork_mempool_magazine  *magazine;
+    unsigned int  slot;
+
+    cork_mempool_lock(mp);
+    for (magazine = mp->magazines; magazine != NULL;
+         magazine = magazine->next) {
+        if (magazine->owner == self) {
+            break;
+        }
+    }
+    if (magazine == NULL) {
+        DEBUG("Creating magazine for thread %u\n", self);
+        magazine = cork_alloc_new
+            (mp->self_alloc, struct cork_mempool_magazine);
+        magazine->owner = self;
+        magazine->free_list = NULL;
+        magazine->free_count = 0;
+        magazine->allocated_count = 0;
+        magazine->next = mp->magazines;
+        mp->magazines = magazine;
+    }
+    cork_mempool_unlock(mp);
+
+    for (slot = 0; slot < CORK_MEMPOOL_THREAD_CACHE_SIZE; slot++) {
+        if (cache->ids[slot] == 0) {
+            break;
+        }
+    }
+    if (slot == CORK_MEMPOOL_THREAD_CACHE_SIZE) {
+        slot = cache->next_victim;
+        cache->next_victim =
+            (cache->next_victim + 1) % CORK_MEMPOOL_THREAD_CACHE_SIZE;
+    }
+    cache->ids[slot] = mp->id;
+    cache->magazines[slot] = magazine;
+    return magazine;
+}
+
+static inline struct cork_mempool_magazine *
+cork_mempool_get_magazine(struct cork_mempool *mp)
+{
+    struct cork_mempool_thread_cache  *cache =
+        cork_mempool_thread_cache_get();
+    unsigned int  slot;
+    for (slot = 0; slot < CORK_MEMPOOL_THREAD_CACHE_SIZE; slot++) {
+        if (cache->ids[slot] == mp->id) {
+            return cache->magazines[slot];
+        }
+    }
+    return cork_mempool_claim_magazine(mp, cache);
+}
+
+/* Moves half a magazine's worth of objects from the depot into `magazine`. */
+static void
+cork_mempool_refill_magazine(struct cork_mempool *mp,
+                             struct cork_mempool_magazine *magazine)
+{
+    size_t  i;
+    cork_mempool_lock(mp);
+    DEBUG("Refilling magazine for thread %u\n", magazine->owner);
+    for (i = 0; i < mp->magazine_size / 2; i++) {
+        struct cork_mempool_object  *obj;
+        if (CORK_UNLIKELY(mp->free_list == NULL)) {
+            cork_mempool_new_block(mp);
+        }
+        obj = mp->free_list;
+        mp->free_list = obj->next_free;
+        mp->free_count--;
+        obj->next_free = magazine->free_list;
+        magazine->free_list = obj;
     }
+    magazine->free_count += i;
+    cork_mempool_unlock(mp);
 }
 
+/* Moves half of a full magazine's objects back into the depot. */
+static void
+cork_mempool_spill_magazine(struct cork_mempool *mp,
+                            struct cork_mempool_magazine *magazine)
+{
+    struct cork_mempool_object  *head = magazine->free_list;
+    struct cork_mempool_object  *tail = head;
+    size_t  count = mp->magazine_size / 2;
+    size_t  i;
+    for (i = 1; i < count; i++) {
+        tail = tail->next_free;
+    }
+    magazine->free_list = tail->next_free;
+    magazine->free_count -= count;
+
+    cork_mempool_lock(mp);
+    DEBUG("Spilling magazine for thread %u\n", magazine->owner);
+    cork_mempool_add_free_objects(mp, head, tail, count);
+    cork_mempool_unlock(mp);
+}
+
+static void *
+cork_mempool_new_cached_object(struct cork_mempool *mp)
+{
+    struct cork_mempool_magazine  *magazine = cork_mempool_get_magazine(mp);
+    struct cork_mempool_object  *obj;
+    if (CORK_UNLIKELY(magazine->free_list == NULL)) {
+        cork_mempool_refill_magazine(mp, magazine);
+    }
+    obj = magazine->free_list;
+    magazine->free_list = obj->next_free;
+    magazine->free_count--;
+    magazine->allocated_count++;
+    return cork_mempool_get_object(obj);
+}
+
+static void
+cork_mempool_free_cached_object(struct cork_mempool *mp, void *ptr)
+{
+    struct cork_mempool_magazine  *magazine = cork_mempool_get_magazine(mp);
+    struct cork_mempool_object  *obj = cork_mempool_get_header(ptr);
+    obj->next_free = magazine->free_list;
+    magazine->free_list = obj;
+    magazine->free_count++;
+    magazine->allocated_count--;
+    if (CORK_UNLIKELY(magazine->free_count >= mp->magazine_size)) {
+        cork_mempool_spill_magazine(mp, magazine);
+    }
+}
+
+/* The pool might not outlive the thread, so we can't flush a thread's
+ * magazines automatically when it exits; the thread has to do it itself. */
+void
+cork_mempool_thread_flush(struct cork_mempool *mp)
+{
+    struct cork_mempool_thread_cache  *cache;
+    struct cork_mempool_magazine  *magazine = NULL;
+    struct cork_mempool_magazine  **prev;
+    cork_thread_id  self;
+    unsigned int  slot;
+
+    if (mp->id == 0) {
+        return;
+    }
+
+    cache = cork_mempool_thread_cache_get();
+    for (slot = 0; slot < CORK_MEMPOOL_THREAD_CACHE_SIZE; slot++) {
+        if (cache->ids[slot] == mp->id) {
+            cache->ids[slot] = 0;
+            cache->magazines[slot] = NULL;
+        }
+    }
+
+    self = cork_current_thread_get_id();
+    cork_mempool_lock(mp);
+    for (prev = &mp->magazines; *prev != NULL; prev = &(*prev)->next) {
+        if ((*prev)->owner == self) {
+            magazine = *prev;
+            *prev = magazine->next;
+            break;
+        }
+    }
+    if (magazine != NULL) {
+        DEBUG("Flushing magazine for thread %u\n", magazine->owner);
+        mp->allocated_count += magazine->allocated_count;
+        if (magazine->free_list != NULL) {
+            struct cork_mempool_object  *tail = magazine->free_list;
+            while (tail->next_free != NULL) {
+                tail = tail->next_free;
+            }
+            cork_mempool_add_free_objects
+                (mp, magazine->free_list, tail, magazine->free_count);
+        }
+    }
+    cork_mempool_unlock(mp);
+
+    if (magazine != NULL) {
+        cork_alloc_delete
+            (mp->self_alloc, struct cork_mempool_magazine, magazine);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Allocating objects
+ */
+
 void *
 cork_mempool_new_object(struct cork_mempool *mp)
 {
     struct cork_mempool_object  *obj;
     void  *ptr;
 
+    if (mp->id != 0) {
+        return cork_mempool_new_cached_object(mp);
+    }
+
     if (CORK_UNLIKELY(mp->free_list == NULL)) {
         cork_mempool_new_block(mp);
     }
 
     obj = mp->free_list;
     mp->free_list = obj->next_free;
+    mp->free_count--;
     mp->allocated_count++;
     ptr = cork_mempool_get_object(obj);
     return ptr;
@@ -190,9 +538,278 @@ cork_mempool_new_object(struct cork_mempool *mp)
 void
 cork_mempool_free_object(struct cork_mempool *mp, void *ptr)
 {
-    struct cork_mempool_object  *obj = cork_mempool_get_header(ptr);
+    struct cork_mempool_object  *obj;
+    if (mp->id != 0) {
+        cork_mempool_free_cached_object(mp, ptr);
+        return;
+    }
+
+    obj = cork_mempool_get_header(ptr);
     DEBUG("Returning %p[%p] to memory pool\n", ptr, obj);
-    obj->next_free = mp->free_list;
-    mp->free_list = obj;
     mp->allocated_count--;
+    cork_mempool_add_free_objects(mp, obj, obj, 1);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Allocating objects in bulk
+ */
+
+/* Moves up to `count` objects from the front of `free_list` into `ptrs`,
+ * returning how many we moved. */
+static size_t
+cork_mempool_take_objects(struct cork_mempool_object **free_list,
+                          void **ptrs, size_t count)
+{
+    struct cork_mempool_object  *obj = *free_list;
+    size_t  i;
+    for (i = 0; i < count && obj != NULL; i++) {
+        ptrs[i] = cork_mempool_get_object(obj);
+        obj = obj->next_free;
+    }
+    *free_list = obj;
+    return i;
+}
+
+/* Moves `count` objects from the pool's own free list into `ptrs`, allocating
+ * new blocks as needed. */
+static void
+cork_mempool_take_depot_objects(struct cork_mempool *mp,
+                                void **ptrs, size_t count)
+{
+    size_t  taken = 0;
+    while (taken < count) {
+        if (CORK_UNLIKELY(mp->free_list == NULL)) {
+            cork_mempool_new_block(mp);
+        }
+        taken += cork_mempool_take_objects
+            (&mp->free_list, ptrs + taken, count - taken);
+    }
+    mp->free_count -= count;
+}
+
+/* Links the given objects together into a chain, so that they can all be
+ * added to a free list at once.  Returns the last object in the chain. */
+static struct cork_mempool_object *
+cork_mempool_chain_objects(void **ptrs, size_t count)
+{
+    struct cork_mempool_object  *tail = cork_mempool_get_header(ptrs[0]);
+    size_t  i;
+    for (i = 1; i < count; i++) {
+        struct cork_mempool_object  *obj = cork_mempool_get_header(ptrs[i]);
+        tail->next_free = obj;
+        tail = obj;
+    }
+    return tail;
+}
+
+void
+cork_mempool_new_objects(struct cork_mempool *mp, void **ptrs, size_t count)
+{
+    if (mp->id != 0) {
+        struct cork_mempool_magazine  *magazine =
+            cork_mempool_get_magazine(mp);
+        size_t  taken = cork_mempool_take_objects
+            (&magazine->free_list, ptrs, count);
+        magazine->free_count -= taken;
+        magazine->allocated_count += count;
+        if (taken < count) {
+            cork_mempool_lock(mp);
+            cork_mempool_take_depot_objects(mp, ptrs + taken, count - taken);
+            cork_mempool_unlock(mp);
+        }
+        return;
+    }
+
+    DEBUG("Allocating %zu objects from memory pool\n", count);
+    cork_mempool_take_depot_objects(mp, ptrs, count);
+    mp->allocated_count += count;
+}
+
+void
+cork_mempool_free_objects(struct cork_mempool *mp, void **ptrs, size_t count)
+{
+    struct cork_mempool_object  *head;
+    struct cork_mempool_object  *tail;
+
+    if (count == 0) {
+        return;
+    }
+
+    head = cork_mempool_get_header(ptrs[0]);
+    tail = cork_mempool_chain_objects(ptrs, count);
+
+    if (mp->id != 0) {
+        struct cork_mempool_magazine  *magazine =
+            cork_mempool_get_magazine(mp);
+        magazine->allocated_count -= count;
+        if (magazine->free_count + count < mp->magazine_size) {
+            tail->next_free = magazine->free_list;
+            magazine->free_list = head;
+            magazine->free_count += count;
+        } else {
+            /* The magazine can't hold all of these, so send them straight to
+             * the depot. */
+            cork_mempool_lock(mp);
+            cork_mempool_add_free_objects(mp, head, tail, count);
+            cork_mempool_unlock(mp);
+        }
+        return;
+    }
+
+    DEBUG("Returning %zu objects to memory pool\n", count);
+    mp->allocated_count -= count;
+    cork_mempool_add_free_objects(mp, head, tail, count);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Releasing unused blocks
+ */
+
+struct cork_mempool_block_usage {
+    struct cork_mempool_block  *block;
+    size_t  free_count;
+};
+
+static int
+cork_mempool_block_usage_compare(const void *va, const void *vb)
+{
+    const struct cork_mempool_block_usage  *a = va;
+    const struct cork_mempool_block_usage  *b = vb;
+    return (a->block < b->block)? -1: (a->block > b->block)? 1: 0;
+}
+
+/* Returns the block that contains `obj`. */
+static struct cork_mempool_block_usage *
+cork_mempool_find_block(struct cork_mempool_block_usage *usage, size_t count,
+                        struct cork_mempool_object *obj)
+{
+    /* Find the last block that starts before obj. */
+    size_t  lo = 0;
+    size_t  hi = count;
+    while (hi - lo > 1) {
+        size_t  mid = lo + (hi - lo) / 2;
+        if ((void *) usage[mid].block <= (void *) obj) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return &usage[lo];
+}
+
+#define cork_mempool_block_object_count(mp) \
+    (((mp)->block_size - sizeof(struct cork_mempool_block)) / \
+     cork_mempool_object_size(mp))
+
+/* Frees every block whose objects are all in the pool's own free list.  We
+ * don't keep a live count in each block, since that would require every object
+ * to point back at its block; instead we count the free objects in each block
+ * when we trim.  For thread-cached pools, you must hold the depot lock. */
+static size_t
+cork_mempool_trim_blocks(struct cork_mempool *mp)
+{
+    struct cork_mempool_block_usage  *usage;
+    struct cork_mempool_block  *block;
+    struct cork_mempool_object  *obj;
+    struct cork_mempool_object  **prev;
+    struct cork_mempool_block  **prev_block;
+    size_t  per_block = cork_mempool_block_object_count(mp);
+    size_t  released = 0;
+    size_t  i;
+
+    if (mp->free_count < per_block || mp->block_count == 0) {
+        return 0;
+    }
+
+    /* Like the magazines, the scratch array is pool bookkeeping, so it comes
+     * from the same allocator as the pool itself. */
+    usage = cork_alloc_calloc
+        (mp->self_alloc, mp->block_count,
+         sizeof(struct cork_mempool_block_usage));
+    for (block = mp->blocks, i = 0; block != NULL;
+         block = block->next_block, i++) {
+        usage[i].block = block;
+    }
+    qsort(usage, mp->block_count, sizeof(struct cork_mempool_block_usage),
+          cork_mempool_block_usage_compare);
+
+    for (obj = mp->free_list; obj != NULL; obj = obj->next_free) {
+        cork_mempool_find_block(usage, mp->block_count, obj)->free_count++;
+    }
+    for (i = 0; i < mp->block_count; i++) {
+        if (usage[i].free_count == per_block) {
+            released++;
+        }
+    }
+
+    if (released > 0) {
+        DEBUG("Releasing %zu unused blocks\n", released);
+
+        /* Remove the objects in the unused blocks from the free list, keeping
+         * the rest in their current order. */
+        for (prev = &mp->free_list; (obj = *prev) != NULL; ) {
+            struct cork_mempool_block_usage  *u =
+                cork_mempool_find_block(usage, mp->block_count, obj);
+            if (u->free_count == per_block) {
+                *prev = obj->next_free;
+                mp->free_count--;
+                if (mp->done_object != NULL) {
+                    mp->done_object
+                        (mp->user_data, cork_mempool_get_object(obj));
+                }
+            } else {
+                prev = &obj->next_free;
+            }
+        }
+
+        for (prev_block = &mp->blocks; (block = *prev_block) != NULL; ) {
+            struct cork_mempool_block_usage  *u =
+                cork_mempool_find_block
+                (usage, mp->block_count, (void *) block);
+            if (u->free_count == per_block) {
+                *prev_block = block->next_block;
+                cork_alloc_free(mp->alloc, block, mp->block_size);
+            } else {
+                prev_block = &block->next_block;
+            }
+        }
+    }
+
+    cork_alloc_cfree(mp->self_alloc, usage, mp->block_count,
+                     sizeof(struct cork_mempool_block_usage));
+    mp->block_count -= released;
+    return released;
+}
+
+static void
+cork_mempool_trim_free_list(struct cork_mempool *mp)
+{
+    cork_mempool_trim_blocks(mp);
+    /* If the remaining free objects are scattered across blocks that are still
+     * in use, don't bother trying again until another max_free_count objects
+     * have been freed. */
+    mp->next_trim_count = mp->free_count + mp->max_free_count;
+}
+
+size_t
+cork_mempool_trim(struct cork_mempool *mp)
+{
+    size_t  released;
+    if (mp->id != 0) {
+        cork_mempool_lock(mp);
+        released = cork_mempool_trim_blocks(mp);
+        cork_mempool_unlock(mp);
+    } else {
+        released = cork_mempool_trim_blocks(mp);
+    }
+    return released;
+}
+
+void
+cork_mempool_set_max_free(struct cork_mempool *mp, size_t max_free_count)
+{
+    mp->max_free_count = max_free_count;
+    mp->next_trim_count = max_free_count;
 }
@@ -14,13 +14,122 @@
 #include "libcork/core/timestamp.h"
 #include "libcork/core/types.h"
 #include "libcork/helpers/errors.h"
+#include "libcork/threads/basics.h"
 
 void
 cork_timestamp_init_now(cork_timestamp *ts)
 {
+#if defined(CLOCK_REALTIME)
+    struct timespec  tp;
+    clock_gettime(CLOCK_REALTIME, &tp);
+    cork_timestamp_init_nsec(ts, tp.tv_sec, tp.tv_nsec);
+#else
     struct timeval  tp;
     gettimeofday(&tp, NULL);
     cork_timestamp_init_usec(ts, tp.tv_sec, tp.tv_usec);
+#endif
+}
+
+void
+cork_timestamp_init_monotonic(cork_timestamp *ts)
+{
+    struct timespec  tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    cork_timestamp_init_nsec(ts, tp.tv_sec, tp.tv_nsec);
+}
+
+void
+cork_timestamp_init_monotonic_coarse(cork_timestamp *ts)
+{
+    struct timespec  tp;
+#if defined(CLOCK_MONOTONIC_COARSE)
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &tp);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+#endif
+    cork_timestamp_init_nsec(ts, tp.tv_sec, tp.tv_nsec);
+}
+
+uint64_t
+cork_monotonic_nsec(void)
+{
+    struct timespec  tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return ((uint64_t) tp.tv_sec) * 1000000000 + tp.tv_nsec;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Cycle counters
+ */
+
+#define CORK_CYCLES_CALIBRATION_NSEC  10000000
+
+static uint64_t  cork_cycles_rate;
+cork_once_barrier(cork_cycles_calibration);
+
+static void
+cork_cycles_calibrate(void)
+{
+#if CORK_HAVE_CYCLE_COUNTER && defined(__aarch64__)
+    /* The generic timer tells us its own frequency. */
+    uint64_t  rate;
+    __asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r" (rate));
+    cork_cycles_rate = rate;
+#elif CORK_HAVE_CYCLE_COUNTER
+    /* Spin instead of sleeping, so that we don't depend on how quickly the
+     * scheduler wakes us back up. */
+    uint64_t  start_nsec = cork_monotonic_nsec();
+    uint64_t  start_cycles = cork_cycles_now();
+    uint64_t  end_nsec;
+    uint64_t  end_cycles;
+    do {
+        end_nsec = cork_monotonic_nsec();
+    } while (end_nsec - start_nsec < CORK_CYCLES_CALIBRATION_NSEC);
+    end_cycles = cork_cycles_now();
+    cork_cycles_rate = (uint64_t)
+        ((double) (end_cycles - start_cycles) * 1e9 /
+         (double) (end_nsec - start_nsec));
+#else
+    cork_cycles_rate = 1000000000;
+#endif
+}
+
+uint64_t
+cork_cycles_per_sec(void)
+{
+    cork_once(cork_cycles_calibration, cork_cycles_calibrate());
+    return cork_cycles_rate;
+}
+
+void
+cork_timestamp_init_cycles(cork_timestamp *ts, uint64_t cycles)
+{
+    uint64_t  rate = cork_cycles_per_sec();
+    uint64_t  sec = cycles / rate;
+    uint64_t  rem = cycles % rate;
+#if defined(__SIZEOF_INT128__)
+    uint64_t  gsec = (uint64_t) (((unsigned __int128) rem << 32) / rate);
+#else
+    /* rem << 32 would overflow for counters that tick faster than 4GHz, so
+     * drop a few bits of precision from both sides of the division. */
+    unsigned int  shift = 0;
+    uint64_t  gsec;
+    while ((rate >> shift) > UINT32_MAX) {
+        shift++;
+    }
+    gsec = ((rem >> shift) << 32) / (rate >> shift);
+#endif
+    cork_timestamp_init_gsec(ts, sec, gsec);
+}
+
+uint64_t
+cork_cycles_to_nsec(uint64_t cycles)
+{
+    uint64_t  rate = cork_cycles_per_sec();
+    uint64_t  sec = cycles / rate;
+    uint64_t  rem = cycles % rate;
+    return sec * 1000000000 + (uint64_t) ((double) rem * 1e9 / (double) rate);
 }
 
 
@@ -54,7 +163,7 @@ append_fractional(const cork_timestamp ts, unsigned int width,
     } else {
         uint64_t  denom = power_of_10(width);
         uint64_t  frac = cork_timestamp_gsec_to_units(ts, denom);
-        cork_buffer_append_printf(dest, "%0*" PRIu64, width, frac);
+        cork_buffer_append_u64_width(dest, frac, width);
         return 0;
     }
 }
@@ -91,32 +200,31 @@ cork_timestamp_format_parts(const cork_timestamp ts, struct tm *tm,
                 break;
 
             case 'Y':
-                cork_buffer_append_printf(dest, "%04d", tm->tm_year + 1900);
+                cork_buffer_append_u64_width(dest, tm->tm_year + 1900, 4);
                 break;
 
             case 'm':
-                cork_buffer_append_printf(dest, "%02d", tm->tm_mon + 1);
+                cork_buffer_append_u64_width(dest, tm->tm_mon + 1, 2);
                 break;
 
             case 'd':
-                cork_buffer_append_printf(dest, "%02d", tm->tm_mday);
+                cork_buffer_append_u64_width(dest, tm->tm_mday, 2);
                 break;
 
             case 'H':
-                cork_buffer_append_printf(dest, "%02d", tm->tm_hour);
+                cork_buffer_append_u64_width(dest, tm->tm_hour, 2);
                 break;
 
             case 'M':
-                cork_buffer_append_printf(dest, "%02d", tm->tm_min);
+                cork_buffer_append_u64_width(dest, tm->tm_min, 2);
                 break;
 
             case 'S':
-                cork_buffer_append_printf(dest, "%02d", tm->tm_sec);
+                cork_buffer_append_u64_width(dest, tm->tm_sec, 2);
                 break;
 
             case 's':
-                cork_buffer_append_printf
-                    (dest, "%" PRIu32, cork_timestamp_sec(ts));
+                cork_buffer_append_u64(dest, cork_timestamp_sec(ts));
                 break;
 
             case 'f':
@@ -160,3 +268,66 @@ cork_timestamp_format_local(const cork_timestamp ts, const char *format,
     localtime_r(&clock, &tm);
     return cork_timestamp_format_parts(ts, &tm, format, dest);
 }
+
+
+/* Converts a number of days since 1970-01-01 into a proleptic Gregorian
+ * calendar date, without needing gmtime_r.  See Howard Hinnant's "chrono-
+ * Compatible Low-Level Date Algorithms". */
+static void
+cork_civil_from_days(uint32_t days, unsigned int *year, unsigned int *month,
+                     unsigned int *day)
+{
+    uint32_t  z = days + 719468;
+    uint32_t  era = z / 146097;
+    uint32_t  doe = z - era * 146097;
+    uint32_t  yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    uint32_t  doy = doe - (365*yoe + yoe/4 - yoe/100);
+    uint32_t  mp = (5*doy + 2) / 153;
+    *day = doy - (153*mp + 2)/5 + 1;
+    *month = (mp < 10)? mp + 3: mp - 9;
+    *year = yoe + era * 400 + (*month <= 2);
+}
+
+void
+cork_buffer_append_timestamp_utc(struct cork_buffer *dest,
+                                 const cork_timestamp ts,
+                                 unsigned int frac_width)
+{
+    uint32_t  sec = cork_timestamp_sec(ts);
+    uint32_t  sec_of_day = sec % 86400;
+    unsigned int  year;
+    unsigned int  month;
+    unsigned int  day;
+
+    cork_civil_from_days(sec / 86400, &year, &month, &day);
+    cork_buffer_ensure_size
+        (dest, dest->size + sizeof("YYYY-MM-DDTHH:MM:SS.nnnnnnnnnZ"));
+    cork_buffer_append_u64_width(dest, year, 4);
+    cork_buffer_append(dest, "-", 1);
+    cork_buffer_append_u64_width(dest, month, 2);
+    cork_buffer_append(dest, "-", 1);
+    cork_buffer_append_u64_width(dest, day, 2);
+    cork_buffer_append(dest, "T", 1);
+    cork_buffer_append_u64_width(dest, sec_of_day / 3600, 2);
+    cork_buffer_append(dest, ":", 1);
+    cork_buffer_append_u64_width(dest, (sec_of_day / 60) % 60, 2);
+    cork_buffer_append(dest, ":", 1);
+    cork_buffer_append_u64_width(dest, sec_of_day % 60, 2);
+    if (frac_width > 0) {
+        uint64_t  denom;
+        uint64_t  frac;
+        if (frac_width > 9) {
+            frac_width = 9;
+        }
+        denom = power_of_10(frac_width);
+        frac = cork_timestamp_gsec_to_units(ts, denom);
+        /* Don't let rounding carry over into the next second, since we've
+         * already printed the seconds. */
+        if (frac >= denom) {
+            frac = denom - 1;
+        }
+        cork_buffer_append(dest, ".", 1);
+        cork_buffer_append_u64_width(dest, frac, frac_width);
+    }
+    cork_buffer_append(dest, "Z", 1);
+}
@@ -7,79 +7,133 @@
  * ----------------------------------------------------------------------
  */
 
-#include <string.h>
-#include <stdio.h>
-
 #include "libcork/core/types.h"
 #include "libcork/core/u128.h"
 
 
-/* From http://stackoverflow.com/questions/8023414/how-to-convert-a-128-bit-integer-to-a-decimal-ascii-string-in-c */
+static const char  CORK_U128_DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
 
-const char *
-cork_u128_to_decimal(char *dest, cork_u128 val)
-{
-    uint32_t  n[4];
-    char  *s = dest;
-    char  *p = dest;
-    unsigned int  i;
+static const char  CORK_U128_HEX_DIGITS[17] = "0123456789abcdef";
 
-    /* This algorithm assumes that n[3] is the MSW. */
-    n[3] = cork_u128_be32(val, 0);
-    n[2] = cork_u128_be32(val, 1);
-    n[1] = cork_u128_be32(val, 2);
-    n[0] = cork_u128_be32(val, 3);
+/* Writes the decimal digits of chunk into the bytes just before end, two at a
+ * time, padding with zeroes to at least min_digits.  Returns a pointer to the
+ * first digit written. */
+static char *
+cork_u128_write_chunk(char *end, uint64_t chunk, unsigned int min_digits)
+{
+    char  *p = end;
+    while (chunk >= 100) {
+        unsigned int  pair = (unsigned int) (chunk % 100) * 2;
+        chunk /= 100;
+        p -= 2;
+        p[0] = CORK_U128_DIGIT_PAIRS[pair];
+        p[1] = CORK_U128_DIGIT_PAIRS[pair + 1];
+    }
+    if (chunk >= 10) {
+        unsigned int  pair = (unsigned int) chunk * 2;
+        p -= 2;
+        p[0] = CORK_U128_DIGIT_PAIRS[pair];
+        p[1] = CORK_U128_DIGIT_PAIRS[pair + 1];
+    } else {
+        *--p = (char) ('0' + chunk);
+    }
+    while (p > end - min_digits) {
+        *--p = '0';
+    }
+    return p;
+}
 
-    memset(s, '0', CORK_U128_DECIMAL_LENGTH - 1);
-    s[CORK_U128_DECIMAL_LENGTH - 1] = '\0';
+/* We peel off the value's digits in chunks that fit into a uint64_t, and then
+ * render each chunk with 64-bit arithmetic.  With a native 128-bit type, each
+ * chunk is 19 digits (10^19 is the largest power of 10 that fits into 64
+ * bits), so it takes at most two 128-bit divisions.  Otherwise we do long
+ * division of the 32-bit limbs by 10^9. */
 
-    for (i = 0; i < 128; i++) {
-        unsigned int  j;
-        unsigned int carry;
+const char *
+cork_u128_to_decimal(char *dest, cork_u128 val)
+{
+    char  *p = &dest[CORK_U128_DECIMAL_LENGTH - 1];
+    *p = '\0';
 
-        carry = (n[3] >= 0x80000000);
-        /* Shift n[] left, doubling it */
-        n[3] = ((n[3] << 1) & 0xFFFFFFFF) + (n[2] >= 0x80000000);
-        n[2] = ((n[2] << 1) & 0xFFFFFFFF) + (n[1] >= 0x80000000);
-        n[1] = ((n[1] << 1) & 0xFFFFFFFF) + (n[0] >= 0x80000000);
-        n[0] = ((n[0] << 1) & 0xFFFFFFFF);
+    if (val._.be64.hi == 0) {
+        return cork_u128_write_chunk(p, val._.be64.lo, 1);
+    }
 
-        /* Add s[] to itself in decimal, doubling it */
-        for (j = CORK_U128_DECIMAL_LENGTH - 1; j-- > 0; ) {
-            s[j] += s[j] - '0' + carry;
-            carry = (s[j] > '9');
-            if (carry) {
-                s[j] -= 10;
+#if CORK_U128_HAVE_U128
+    {
+#define CORK_U128_CHUNK  UINT64_C(10000000000000000000)
+        cork_u128  rest = val;
+        while (rest._.be64.hi != 0 || rest._.be64.lo >= CORK_U128_CHUNK) {
+            uint64_t  chunk = (uint64_t) (rest._.u128 % CORK_U128_CHUNK);
+            rest._.u128 /= CORK_U128_CHUNK;
+            p = cork_u128_write_chunk(p, chunk, 19);
+        }
+        return cork_u128_write_chunk(p, rest._.be64.lo, 1);
+#undef CORK_U128_CHUNK
+    }
+#else
+    {
+#define CORK_U128_CHUNK  1000000000
+        uint32_t  n[4];
+        n[0] = cork_u128_be32(val, 0);
+        n[1] = cork_u128_be32(val, 1);
+        n[2] = cork_u128_be32(val, 2);
+        n[3] = cork_u128_be32(val, 3);
+        for (;;) {
+            uint64_t  rem = 0;
+            unsigned int  i;
+            for (i = 0; i < 4; i++) {
+                rem = (rem << 32) | n[i];
+                n[i] = (uint32_t) (rem / CORK_U128_CHUNK);
+                rem %= CORK_U128_CHUNK;
+            }
+            if ((n[0] | n[1] | n[2] | n[3]) == 0) {
+                return cork_u128_write_chunk(p, rem, 1);
             }
+            p = cork_u128_write_chunk(p, rem, 9);
         }
+#undef CORK_U128_CHUNK
     }
+#endif
+}
 
-    while ((p[0] == '0') && (p < &s[CORK_U128_DECIMAL_LENGTH - 2])) {
-        p++;
-    }
 
-    return p;
+static void
+cork_u128_write_hex64(char *dest, uint64_t value)
+{
+    unsigned int  i;
+    for (i = 16; i-- > 0; ) {
+        dest[i] = CORK_U128_HEX_DIGITS[value & 0x0f];
+        value >>= 4;
+    }
 }
 
-
 const char *
 cork_u128_to_hex(char *buf, cork_u128 val)
 {
-    uint64_t  hi = val._.be64.hi;
-    uint64_t  lo = val._.be64.lo;
-    if (hi == 0) {
-        snprintf(buf, CORK_U128_HEX_LENGTH, "%" PRIx64, lo);
-    } else {
-        snprintf(buf, CORK_U128_HEX_LENGTH, "%" PRIx64 "%016" PRIx64, hi, lo);
+    char  *p;
+    cork_u128_to_padded_hex(buf, val);
+    /* Skip any leading zeroes, but keep the last digit. */
+    for (p = buf; *p == '0' && p < &buf[CORK_U128_HEX_LENGTH - 2]; p++) {
     }
-    return buf;
+    return p;
 }
 
 const char *
 cork_u128_to_padded_hex(char *buf, cork_u128 val)
 {
-    uint64_t  hi = val._.be64.hi;
-    uint64_t  lo = val._.be64.lo;
-    snprintf(buf, CORK_U128_HEX_LENGTH, "%016" PRIx64 "%016" PRIx64, hi, lo);
+    cork_u128_write_hex64(buf, val._.be64.hi);
+    cork_u128_write_hex64(buf + 16, val._.be64.lo);
+    buf[CORK_U128_HEX_LENGTH - 1] = '\0';
     return buf;
 }
@@ -46,6 +46,8 @@ struct cork_array_priv {
     cork_done_f  done;
     cork_init_f  reuse;
     cork_done_f  remove;
+    /* A small array's inline storage, or NULL for a regular array */
+    void  *inline_items;
 };
 
 void
@@ -64,11 +66,55 @@ cork_raw_array_init(struct cork_raw_array *array, size_t element_size)
     array->priv->done = NULL;
     array->priv->reuse = NULL;
     array->priv->remove = NULL;
+    array->priv->inline_items = NULL;
+}
+
+void
+cork_raw_small_array_init(struct cork_raw_array *array, size_t element_size,
+                          size_t inline_count, void *inline_items)
+{
+    struct cork_raw_small_array  *small = (struct cork_raw_small_array *) array;
+    small->items = inline_items;
+    small->size = 0;
+    small->priv = NULL;
+    small->element_size = element_size;
+    small->inline_count = inline_count;
+}
+
+/* A small array doesn't allocate its priv block until it needs to spill onto
+ * the heap, or until you give it some callbacks.  Until then, its elements
+ * live in its inline storage, and don't need any callbacks. */
+static struct cork_array_priv *
+cork_raw_array_get_priv(struct cork_raw_array *array)
+{
+    if (CORK_UNLIKELY(array->priv == NULL)) {
+        struct cork_raw_small_array  *small =
+            (struct cork_raw_small_array *) array;
+        struct cork_array_priv  *priv = cork_new(struct cork_array_priv);
+        DEBUG("--- Array %p: Allocating priv for small array", array);
+        priv->allocated_count = small->inline_count;
+        priv->allocated_size = small->inline_count * small->element_size;
+        priv->element_size = small->element_size;
+        priv->initialized_count = small->size;
+        priv->user_data = NULL;
+        priv->free_user_data = NULL;
+        priv->init = NULL;
+        priv->done = NULL;
+        priv->reuse = NULL;
+        priv->remove = NULL;
+        priv->inline_items = small->items;
+        array->priv = priv;
+    }
+    return array->priv;
 }
 
 void
 cork_raw_array_done(struct cork_raw_array *array)
 {
+    if (array->priv == NULL) {
+        /* A small array that never left its inline storage */
+        return;
+    }
     if (array->priv->done != NULL) {
         size_t  i;
         char  *element = array->items;
@@ -77,7 +123,7 @@ cork_raw_array_done(struct cork_raw_array *array)
             element += array->priv->element_size;
         }
     }
-    if (array->items != NULL) {
+    if (array->items != NULL && array->items != array->priv->inline_items) {
         cork_free(array->items, array->priv->allocated_size);
     }
     cork_free_user_data(array->priv);
@@ -88,6 +134,7 @@ void
 cork_raw_array_set_callback_data(struct cork_raw_array *array,
                                  void *user_data, cork_free_f free_user_data)
 {
+    cork_raw_array_get_priv(array);
     array->priv->user_data = user_data;
     array->priv->free_user_data = free_user_data;
 }
@@ -95,37 +142,40 @@ cork_raw_array_set_callback_data(struct cork_raw_array *array,
 void
 cork_raw_array_set_init(struct cork_raw_array *array, cork_init_f init)
 {
-    array->priv->init = init;
+    cork_raw_array_get_priv(array)->init = init;
 }
 
 void
 cork_raw_array_set_done(struct cork_raw_array *array, cork_done_f done)
 {
-    array->priv->done = done;
+    cork_raw_array_get_priv(array)->done = done;
 }
 
 void
 cork_raw_array_set_reuse(struct cork_raw_array *array, cork_init_f reuse)
 {
-    array->priv->reuse = reuse;
+    cork_raw_array_get_priv(array)->reuse = reuse;
 }
 
 void
 cork_raw_array_set_remove(struct cork_raw_array *array, cork_done_f remove)
 {
-    array->priv->remove = remove;
+    cork_raw_array_get_priv(array)->remove = remove;
 }
 
 size_t
 cork_raw_array_element_size(const struct cork_raw_array *array)
 {
+    if (array->priv == NULL) {
+        return ((const struct cork_raw_small_array *) array)->element_size;
+    }
     return array->priv->element_size;
 }
 
 void
 cork_raw_array_clear(struct cork_raw_array *array)
 {
-    if (array->priv->remove != NULL) {
+    if (array->priv != NULL && array->priv->remove != NULL) {
         size_t  i;
         char  *element = array->items;
         for (i = 0; i < array->priv->initialized_count; i++) {
@@ -145,7 +195,8 @@ cork_raw_array_elements(const struct cork_raw_array *array)
 void *
 cork_raw_array_at(const struct cork_raw_array *array, size_t index)
 {
-    return ((char *) array->items) + (array->priv->element_size * index);
+    return ((char *) array->items) +
+        (cork_raw_array_element_size(array) * index);
 }
 
 size_t
@@ -165,6 +216,15 @@ cork_raw_array_ensure_size(struct cork_raw_array *array, size_t desired_count)
 {
     size_t  desired_size;
 
+    if (array->priv == NULL) {
+        struct cork_raw_small_array  *small =
+            (struct cork_raw_small_array *) array;
+        if (desired_count <= small->inline_count) {
+            return;
+        }
+        cork_raw_array_get_priv(array);
+    }
+
     DEBUG("--- Array %p: Ensure %zu %zu-byte elements",
           array, desired_count, array->priv->element_size);
     desired_size = desired_count * array->priv->element_size;
@@ -179,8 +239,16 @@ cork_raw_array_ensure_size(struct cork_raw_array *array, size_t desired_count)
 
         DEBUG("--- Array %p: Reallocating %zu->%zu bytes",
               array, array->priv->allocated_size, new_size);
-        array->items =
-            cork_realloc(array->items, array->priv->allocated_size, new_size);
+        if (array->priv->inline_items != NULL &&
+            array->items == array->priv->inline_items) {
+            /* A small array spilling out of its inline storage */
+            void  *items = cork_malloc(new_size);
+            memcpy(items, array->items, array->priv->allocated_size);
+            array->items = items;
+        } else {
+            array->items = cork_realloc
+                (array->items, array->priv->allocated_size, new_size);
+        }
 
         array->priv->allocated_count = new_count;
         array->priv->allocated_size = new_size;
@@ -192,10 +260,15 @@ cork_raw_array_append(struct cork_raw_array *array)
 {
     size_t  index;
     void  *element;
+    cork_raw_array_ensure_size(array, array->size + 1);
     index = array->size++;
-    cork_raw_array_ensure_size(array, array->size);
     element = cork_raw_array_at(array, index);
 
+    if (array->priv == NULL) {
+        /* A small array with no callbacks */
+        return element;
+    }
+
     /* Call the init or reset callback, depending on whether this entry has been
      * initialized before. */
 
@@ -220,6 +293,131 @@ cork_raw_array_append(struct cork_raw_array *array)
     return element;
 }
 
+void *
+cork_raw_array_append_n(struct cork_raw_array *array, const void *src,
+                        size_t count)
+{
+    size_t  index = array->size;
+    size_t  element_size = cork_raw_array_element_size(array);
+    void  *element;
+
+    DEBUG("--- Array %p: Appending %zu elements", array, count);
+    cork_raw_array_ensure_size(array, index + count);
+    array->size += count;
+    element = cork_raw_array_at(array, index);
+
+    if (array->priv != NULL) {
+        struct cork_array_priv  *priv = array->priv;
+        size_t  end = array->size;
+        size_t  reuse_end = (priv->initialized_count < end)?
+            priv->initialized_count: end;
+        size_t  i;
+
+        /* As with cork_raw_array_append, the new entries start with any that
+         * have been initialized before, followed by brand new ones. */
+        assert(index <= priv->initialized_count);
+        if (priv->reuse != NULL) {
+            for (i = index; i < reuse_end; i++) {
+                priv->reuse(priv->user_data, cork_raw_array_at(array, i));
+            }
+        }
+        if (end > priv->initialized_count) {
+            if (priv->init != NULL) {
+                for (i = reuse_end; i < end; i++) {
+                    priv->init(priv->user_data, cork_raw_array_at(array, i));
+                }
+            }
+            priv->initialized_count = end;
+        }
+    }
+
+    if (src != NULL && count > 0) {
+        memcpy(element, src, count * element_size);
+    }
+    return element;
+}
+
+/* Move the element at index from to index to, shifting the elements in
+ * between over by one to make room.  We treat elements as plain bytes
+ * (just like when we realloc the array), so callbacks aren't involved. */
+static void
+cork_raw_array_move(struct cork_raw_array *array, size_t from, size_t to)
+{
+    size_t  element_size = cork_raw_array_element_size(array);
+    char  *items = array->items;
+    char  stack_tmp[64];
+    char  *tmp;
+
+    if (from == to) {
+        return;
+    }
+    tmp = (element_size <= sizeof(stack_tmp))?
+        stack_tmp: cork_malloc(element_size);
+    memcpy(tmp, items + from * element_size, element_size);
+    if (from < to) {
+        memmove(items + from * element_size,
+                items + (from + 1) * element_size,
+                (to - from) * element_size);
+    } else {
+        memmove(items + (to + 1) * element_size,
+                items + to * element_size,
+                (from - to) * element_size);
+    }
+    memcpy(items + to * element_size, tmp, element_size);
+    if (tmp != stack_tmp) {
+        cork_free(tmp, element_size);
+    }
+}
+
+void *
+cork_raw_array_insert_at(struct cork_raw_array *array, size_t index)
+{
+    assert(index <= array->size);
+    /* Initialize a new entry at the end, and then move it into place. */
+    cork_raw_array_append(array);
+    cork_raw_array_move(array, array->size - 1, index);
+    return cork_raw_array_at(array, index);
+}
+
+static void
+cork_raw_array_remove_element(struct cork_raw_array *array, size_t index)
+{
+    if (array->priv != NULL && array->priv->remove != NULL) {
+        array->priv->remove
+            (array->priv->user_data, cork_raw_array_at(array, index));
+    }
+}
+
+void
+cork_raw_array_remove_at(struct cork_raw_array *array, size_t index)
+{
+    assert(index < array->size);
+    /* Move the removed entry just past the end, where it can be reused. */
+    cork_raw_array_remove_element(array, index);
+    cork_raw_array_move(array, index, array->size - 1);
+    array->size--;
+}
+
+void
+cork_raw_array_swap_remove(struct cork_raw_array *array, size_t index)
+{
+    size_t  last = array->size - 1;
+    assert(index < array->size);
+    cork_raw_array_remove_element(array, index);
+    if (index != last) {
+        size_t  element_size = cork_raw_array_element_size(array);
+        char  *a = cork_raw_array_at(array, index);
+        char  *b = cork_raw_array_at(array, last);
+        size_t  i;
+        for (i = 0; i < element_size; i++) {
+            char  tmp = a[i];
+            a[i] = b[i];
+            b[i] = tmp;
+        }
+    }
+    array->size--;
+}
+
 int
 cork_raw_array_copy(struct cork_raw_array *dest,
                     const struct cork_raw_array *src,
@@ -227,14 +425,21 @@ cork_raw_array_copy(struct cork_raw_array *dest,
 {
     size_t  i;
     size_t  reuse_count;
+    size_t  element_size = cork_raw_array_element_size(dest);
     char  *dest_element;
 
     DEBUG("--- Copying %zu elements (%zu bytes) from %p to %p",
-          src->size, src->size * dest->priv->element_size, src, dest);
-    assert(dest->priv->element_size == src->priv->element_size);
+          src->size, src->size * element_size, src, dest);
+    assert(element_size == cork_raw_array_element_size(src));
     cork_array_clear(dest);
     cork_array_ensure_size(dest, src->size);
 
+    if (dest->priv == NULL) {
+        /* A small array with no callbacks, whose inline storage is big enough
+         * for src */
+        goto copy_elements;
+    }
+
     /* Initialize enough elements to hold the contents of src */
     reuse_count = dest->priv->initialized_count;
     if (src->size < reuse_count) {
@@ -264,17 +469,18 @@ cork_raw_array_copy(struct cork_raw_array *dest,
         dest->priv->initialized_count = src->size;
     }
 
+copy_elements:
     /* If the caller provided a copy function, let it copy each element in turn.
      * Otherwise, bulk copy everything using memcpy. */
     if (copy == NULL) {
-        memcpy(dest->items, src->items, src->size * dest->priv->element_size);
+        memcpy(dest->items, src->items, src->size * element_size);
     } else {
         const char  *src_element = src->items;
         dest_element = dest->items;
         for (i = 0; i < src->size; i++) {
             rii_check(copy(user_data, dest_element, src_element));
-            dest_element += dest->priv->element_size;
-            src_element += dest->priv->element_size;
+            dest_element += element_size;
+            src_element += element_size;
         }
     }
 
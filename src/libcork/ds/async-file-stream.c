@@ -0,0 +1,415 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2012-2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "libcork/config.h"
+#include "libcork/core/allocator.h"
+#include "libcork/core/trace.h"
+#include "libcork/ds/stream.h"
+#include "libcork/helpers/errors.h"
+
+
+#if defined(CORK_HAVE_IO_URING) && CORK_HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+/*-----------------------------------------------------------------------
+ * A minimal io_uring wrapper
+ */
+
+/* We talk to the kernel directly, instead of depending on liburing, since we
+ * only need to submit reads and reap their completions. */
+
+struct cork_uring {
+    int  fd;
+    unsigned int  entries;
+
+    void  *sq_ring;
+    size_t  sq_ring_size;
+    unsigned int  *sq_tail;
+    unsigned int  *sq_mask;
+    unsigned int  *sq_array;
+    struct io_uring_sqe  *sqes;
+    size_t  sqes_size;
+
+    void  *cq_ring;
+    size_t  cq_ring_size;
+    unsigned int  *cq_head;
+    unsigned int  *cq_tail;
+    unsigned int  *cq_mask;
+    struct io_uring_cqe  *cqes;
+
+    /* The number of SQEs that we've filled in but not submitted yet */
+    unsigned int  pending;
+};
+
+static int
+cork_uring_init(struct cork_uring *ring, unsigned int entries)
+{
+    struct io_uring_params  params;
+    memset(ring, 0, sizeof(struct cork_uring));
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+    ring->entries = params.sq_entries;
+
+    ring->sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap
+        (NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        goto error;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap
+            (NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            goto error;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap
+        (NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto error;
+    }
+
+    ring->sq_tail = ring->sq_ring + params.sq_off.tail;
+    ring->sq_mask = ring->sq_ring + params.sq_off.ring_mask;
+    ring->sq_array = ring->sq_ring + params.sq_off.array;
+    ring->cq_head = ring->cq_ring + params.cq_off.head;
+    ring->cq_tail = ring->cq_ring + params.cq_off.tail;
+    ring->cq_mask = ring->cq_ring + params.cq_off.ring_mask;
+    ring->cqes = ring->cq_ring + params.cq_off.cqes;
+    return 0;
+
+error:
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+    }
+    if (ring->sq_ring != NULL) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    close(ring->fd);
+    return -1;
+}
+
+static void
+cork_uring_done(struct cork_uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+/* We use READV instead of READ, since it's been around since io_uring was
+ * first added to the kernel.  iov must remain valid until the read
+ * completes. */
+static void
+cork_uring_prep_readv(struct cork_uring *ring, int fd,
+                      const struct iovec *iov, off_t offset,
+                      uint64_t user_data)
+{
+    unsigned int  tail = *ring->sq_tail;
+    unsigned int  index = tail & *ring->sq_mask;
+    struct io_uring_sqe  *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t) iov;
+    sqe->len = 1;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    /* Make sure the kernel sees the SQE before it sees the new tail. */
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+}
+
+/* Submit any pending SQEs, and wait until there's at least one completion to
+ * reap. */
+static int
+cork_uring_submit_and_wait(struct cork_uring *ring)
+{
+    while (true) {
+        int  rc = syscall
+            (__NR_io_uring_enter, ring->fd, ring->pending, 1,
+             IORING_ENTER_GETEVENTS, NULL, 0);
+        if (rc >= 0) {
+            ring->pending -= rc;
+            return 0;
+        } else if (errno != EINTR) {
+            cork_system_error_set();
+            return -1;
+        }
+    }
+}
+
+/* Returns false if there aren't any completions to reap. */
+static bool
+cork_uring_reap(struct cork_uring *ring, uint64_t *user_data, int *res)
+{
+    unsigned int  head = *ring->cq_head;
+    struct io_uring_cqe  *cqe;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Asynchronous file producer
+ */
+
+/* Each slot holds one chunk of the file. */
+struct cork_async_read {
+    char  *buf;
+    struct iovec  iov;
+    off_t  offset;
+    /* How much of the chunk we've read so far */
+    size_t  filled;
+    /* When we submitted the current read, for the file_read tracepoint */
+    uint64_t  submitted;
+    bool  in_flight;
+    bool  eof;
+};
+
+struct cork_async_reader {
+    struct cork_uring  ring;
+    int  fd;
+    size_t  chunk_size;
+    size_t  depth;
+    struct cork_async_read  *reads;
+    /* The slot containing the next chunk to hand to the consumer */
+    size_t  head;
+    /* The offset of the next chunk that we haven't asked to read yet */
+    off_t  next_offset;
+    size_t  in_flight;
+};
+
+/* file_read(fd, bytes_read, duration_ns), the same as for the synchronous
+ * producers.  The duration is from when we submit a read until we reap its
+ * completion. */
+cork_tracepoint(file_read);
+
+static void
+cork_async_reader_submit(struct cork_async_reader *reader, size_t index)
+{
+    struct cork_async_read  *chunk = &reader->reads[index];
+    chunk->submitted = cork_trace_start(file_read);
+    chunk->iov.iov_base = chunk->buf + chunk->filled;
+    chunk->iov.iov_len = reader->chunk_size - chunk->filled;
+    cork_uring_prep_readv
+        (&reader->ring, reader->fd, &chunk->iov,
+         chunk->offset + chunk->filled, index);
+    chunk->in_flight = true;
+    reader->in_flight++;
+}
+
+static void
+cork_async_reader_start(struct cork_async_reader *reader, size_t index)
+{
+    struct cork_async_read  *chunk = &reader->reads[index];
+    chunk->offset = reader->next_offset;
+    chunk->filled = 0;
+    chunk->eof = false;
+    reader->next_offset += reader->chunk_size;
+    cork_async_reader_submit(reader, index);
+}
+
+/* Wait for at least one read to finish, and process every completion that's
+ * available. */
+static int
+cork_async_reader_wait(struct cork_async_reader *reader)
+{
+    uint64_t  index;
+    int  res;
+
+    rii_check(cork_uring_submit_and_wait(&reader->ring));
+    while (cork_uring_reap(&reader->ring, &index, &res)) {
+        struct cork_async_read  *chunk = &reader->reads[index];
+        chunk->in_flight = false;
+        reader->in_flight--;
+        cork_trace3(file_read, reader->fd, (res < 0)? -1: res,
+                    cork_trace_elapsed(chunk->submitted));
+        if (res == -EINTR || res == -EAGAIN) {
+            cork_async_reader_submit(reader, index);
+        } else if (res < 0) {
+            cork_system_error_set_explicit(-res);
+            return -1;
+        } else if (res == 0) {
+            chunk->eof = true;
+        } else {
+            chunk->filled += res;
+            /* A short read doesn't necessarily mean the end of the file, so
+             * read the rest of the chunk. */
+            if (chunk->filled < reader->chunk_size) {
+                cork_async_reader_submit(reader, index);
+            }
+        }
+    }
+    return 0;
+}
+
+/* Wait for every outstanding read, so that we can free their buffers. */
+static void
+cork_async_reader_drain(struct cork_async_reader *reader)
+{
+    while (reader->in_flight > 0) {
+        uint64_t  index;
+        int  res;
+        if (cork_uring_submit_and_wait(&reader->ring) != 0) {
+            return;
+        }
+        while (cork_uring_reap(&reader->ring, &index, &res)) {
+            reader->reads[index].in_flight = false;
+            reader->in_flight--;
+        }
+    }
+}
+
+static int
+cork_async_reader_run(struct cork_async_reader *reader,
+                      struct cork_stream_consumer *consumer)
+{
+    bool  first = true;
+    size_t  i;
+
+    for (i = 0; i < reader->depth; i++) {
+        cork_async_reader_start(reader, i);
+    }
+
+    while (true) {
+        struct cork_async_read  *chunk = &reader->reads[reader->head];
+        if (chunk->in_flight) {
+            rii_check(cork_async_reader_wait(reader));
+            continue;
+        }
+
+        /* The head chunk is finished, so it's now safe to hand it over; the
+         * chunks after it might still be in flight. */
+        if (chunk->filled > 0) {
+            rii_check(cork_stream_consumer_data
+                      (consumer, chunk->buf, chunk->filled, first));
+            first = false;
+        }
+        if (chunk->eof) {
+            /* Leave the file offset where a synchronous read loop would have
+             * left it. */
+            lseek(reader->fd, chunk->offset + chunk->filled, SEEK_SET);
+            return cork_stream_consumer_eof(consumer);
+        }
+        cork_async_reader_start(reader, reader->head);
+        reader->head = (reader->head + 1) % reader->depth;
+    }
+}
+
+int
+cork_consume_fd_async(struct cork_stream_consumer *consumer, int fd,
+                      size_t chunk_size, size_t depth)
+{
+    struct cork_async_reader  reader;
+    struct stat  info;
+    off_t  start;
+    size_t  i;
+    int  rc;
+
+    if (chunk_size == 0) {
+        chunk_size = CORK_CONSUME_ASYNC_DEFAULT_CHUNK_SIZE;
+    }
+    if (depth == 0) {
+        depth = CORK_CONSUME_ASYNC_DEFAULT_DEPTH;
+    }
+
+    /* We read at explicit offsets, which only makes sense for regular
+     * files.  For anything else, or if the kernel doesn't support io_uring,
+     * fall back on a synchronous read loop. */
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode) ||
+        (start = lseek(fd, 0, SEEK_CUR)) == -1 ||
+        cork_uring_init(&reader.ring, depth) == -1) {
+        return cork_consume_fd_ex(consumer, fd, chunk_size, chunk_size);
+    }
+
+    reader.fd = fd;
+    reader.chunk_size = chunk_size;
+    reader.depth = depth;
+    reader.reads = cork_calloc(depth, sizeof(struct cork_async_read));
+    reader.head = 0;
+    reader.next_offset = start;
+    reader.in_flight = 0;
+    for (i = 0; i < depth; i++) {
+        reader.reads[i].buf = cork_malloc(chunk_size);
+    }
+
+    rc = cork_async_reader_run(&reader, consumer);
+
+    cork_async_reader_drain(&reader);
+    for (i = 0; i < depth; i++) {
+        cork_free(reader.reads[i].buf, chunk_size);
+    }
+    cork_cfree(reader.reads, depth, sizeof(struct cork_async_read));
+    cork_uring_done(&reader.ring);
+    return rc;
+}
+
+
+#else /* !CORK_HAVE_IO_URING */
+
+int
+cork_consume_fd_async(struct cork_stream_consumer *consumer, int fd,
+                      size_t chunk_size, size_t depth)
+{
+    if (chunk_size == 0) {
+        chunk_size = CORK_CONSUME_ASYNC_DEFAULT_CHUNK_SIZE;
+    }
+    return cork_consume_fd_ex(consumer, fd, chunk_size, chunk_size);
+}
+
+#endif
@@ -7,10 +7,12 @@
  * ----------------------------------------------------------------------
  */
 
+#include <assert.h>
 #include <string.h>
 
 #include "libcork/core/allocator.h"
 #include "libcork/core/api.h"
+#include "libcork/core/byte-order.h"
 #include "libcork/core/types.h"
 #include "libcork/ds/bitset.h"
 
@@ -25,13 +27,22 @@ bytes_needed(size_t bit_count)
     return bytes_needed;
 }
 
+/* The number of 64-bit words that we allocate; this can be a bit more than
+ * byte_count. */
+static size_t
+words_needed(const struct cork_bitset *set)
+{
+    return (set->byte_count + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+}
+
+#define cork_bitset_words(set)  ((uint64_t *) (void *) (set)->bits)
+
 void
 cork_bitset_init(struct cork_bitset *set, size_t bit_count)
 {
     set->bit_count = bit_count;
     set->byte_count = bytes_needed(bit_count);
-    set->bits = cork_malloc(set->byte_count);
-    memset(set->bits, 0, set->byte_count);
+    set->bits = cork_calloc(words_needed(set), sizeof(uint64_t));
 }
 
 struct cork_bitset *
@@ -45,7 +56,7 @@ cork_bitset_new(size_t bit_count)
 void
 cork_bitset_done(struct cork_bitset *set)
 {
-    cork_free(set->bits, set->byte_count);
+    cork_cfree(set->bits, words_needed(set), sizeof(uint64_t));
 }
 
 void
@@ -58,5 +69,180 @@ cork_bitset_free(struct cork_bitset *set)
 void
 cork_bitset_clear(struct cork_bitset *set)
 {
-    memset(set->bits, 0, set->byte_count);
+    memset(set->bits, 0, words_needed(set) * sizeof(uint64_t));
 }
+
+
+/*-----------------------------------------------------------------------
+ * Bulk operations
+ */
+
+/* Bits are numbered in big-endian order within each byte, and bytes are in
+ * increasing order, so if we read a word as a big-endian integer, bit i of the
+ * set is bit 63 - (i % 64) of the integer.  We build masks in that "logical"
+ * order, and then swap them into the in-memory order. */
+
+#define CORK_BITSET_ALL_ONES  UINT64_C(0xffffffffffffffff)
+
+/* A mask of the bits in a word starting with bit start, in logical order */
+#define cork_bitset_mask_from(start) \
+    (CORK_BITSET_ALL_ONES >> ((start) % CORK_BITSET_WORD_BITS))
+
+static void
+cork_bitset_apply_mask(uint64_t *word, uint64_t logical_mask, bool value)
+{
+    uint64_t  mask = CORK_UINT64_HOST_TO_BIG(logical_mask);
+    if (value) {
+        *word |= mask;
+    } else {
+        *word &= ~mask;
+    }
+}
+
+void
+cork_bitset_set_range(struct cork_bitset *set, size_t start, size_t end,
+                      bool value)
+{
+    uint64_t  *words = cork_bitset_words(set);
+    size_t  first_word;
+    size_t  last_word;
+    uint64_t  first_mask;
+    uint64_t  last_mask;
+
+    assert(start <= end && end <= set->bit_count);
+    if (start == end) {
+        return;
+    }
+
+    first_word = start / CORK_BITSET_WORD_BITS;
+    last_word = (end - 1) / CORK_BITSET_WORD_BITS;
+    first_mask = cork_bitset_mask_from(start);
+    /* The bits before end, in the word that contains the last bit */
+    last_mask = ~(cork_bitset_mask_from(end - 1) >> 1);
+
+    if (first_word == last_word) {
+        cork_bitset_apply_mask(&words[first_word], first_mask & last_mask,
+                               value);
+        return;
+    }
+
+    cork_bitset_apply_mask(&words[first_word], first_mask, value);
+    memset(&words[first_word + 1], value? 0xff: 0,
+           (last_word - first_word - 1) * sizeof(uint64_t));
+    cork_bitset_apply_mask(&words[last_word], last_mask, value);
+}
+
+size_t
+cork_bitset_count(const struct cork_bitset *set)
+{
+    const uint64_t  *words = cork_bitset_words(set);
+    size_t  word_count = words_needed(set);
+    size_t  count = 0;
+    size_t  i;
+    for (i = 0; i < word_count; i++) {
+        count += __builtin_popcountll(words[i]);
+    }
+    return count;
+}
+
+size_t
+cork_bitset_find_next(const struct cork_bitset *set, size_t start)
+{
+    const uint64_t  *words = cork_bitset_words(set);
+    size_t  word_count = words_needed(set);
+    size_t  i;
+    uint64_t  word;
+
+    if (start >= set->bit_count) {
+        return set->bit_count;
+    }
+
+    i = start / CORK_BITSET_WORD_BITS;
+    word = CORK_UINT64_BIG_TO_HOST(words[i]) & cork_bitset_mask_from(start);
+    while (word == 0) {
+        if (++i == word_count) {
+            return set->bit_count;
+        }
+        word = CORK_UINT64_BIG_TO_HOST(words[i]);
+    }
+    /* The bits past bit_count are always 0, so this is in range. */
+    return i * CORK_BITSET_WORD_BITS + __builtin_clzll(word);
+}
+
+/* The set operations don't care about the order of the bits within a word, so
+ * we can process two words at a time with SSE2 or NEON when they're
+ * available. */
+
+#if CORK_CONFIG_HAVE_SSE2
+#include <emmintrin.h>
+
+#define cork_bitset_vector_op(name, vector_op) \
+static size_t \
+cork_bitset_vector_##name(uint64_t *dest, const uint64_t *src, size_t count) \
+{ \
+    size_t  i; \
+    for (i = 0; i + 2 <= count; i += 2) { \
+        __m128i  d = _mm_loadu_si128((const __m128i *) &dest[i]); \
+        __m128i  s = _mm_loadu_si128((const __m128i *) &src[i]); \
+        _mm_storeu_si128((__m128i *) &dest[i], vector_op); \
+    } \
+    return i; \
+}
+
+cork_bitset_vector_op(and, _mm_and_si128(d, s))
+cork_bitset_vector_op(or, _mm_or_si128(d, s))
+cork_bitset_vector_op(xor, _mm_xor_si128(d, s))
+/* _mm_andnot_si128 negates its first operand */
+cork_bitset_vector_op(andnot, _mm_andnot_si128(s, d))
+
+#elif CORK_CONFIG_HAVE_NEON
+#include <arm_neon.h>
+
+#define cork_bitset_vector_op(name, vector_op) \
+static size_t \
+cork_bitset_vector_##name(uint64_t *dest, const uint64_t *src, size_t count) \
+{ \
+    size_t  i; \
+    for (i = 0; i + 2 <= count; i += 2) { \
+        uint64x2_t  d = vld1q_u64(&dest[i]); \
+        uint64x2_t  s = vld1q_u64(&src[i]); \
+        vst1q_u64(&dest[i], vector_op); \
+    } \
+    return i; \
+}
+
+cork_bitset_vector_op(and, vandq_u64(d, s))
+cork_bitset_vector_op(or, vorrq_u64(d, s))
+cork_bitset_vector_op(xor, veorq_u64(d, s))
+/* vbicq_u64 clears the bits of its first operand that are set in its
+ * second */
+cork_bitset_vector_op(andnot, vbicq_u64(d, s))
+
+#else
+
+/* The compiler might still be able to vectorize the scalar loops. */
+#define cork_bitset_vector_and(dest, src, count)  ((size_t) 0)
+#define cork_bitset_vector_or(dest, src, count)  ((size_t) 0)
+#define cork_bitset_vector_xor(dest, src, count)  ((size_t) 0)
+#define cork_bitset_vector_andnot(dest, src, count)  ((size_t) 0)
+
+#endif
+
+#define cork_bitset_define_op(name, scalar_op) \
+void \
+cork_bitset_##name(struct cork_bitset *dest, const struct cork_bitset *src) \
+{ \
+    uint64_t  *d = cork_bitset_words(dest); \
+    const uint64_t  *s = cork_bitset_words(src); \
+    size_t  count = words_needed(dest); \
+    size_t  i; \
+    assert(dest->bit_count == src->bit_count); \
+    for (i = cork_bitset_vector_##name(d, s, count); i < count; i++) { \
+        scalar_op; \
+    } \
+}
+
+cork_bitset_define_op(and, d[i] &= s[i])
+cork_bitset_define_op(or, d[i] |= s[i])
+cork_bitset_define_op(xor, d[i] ^= s[i])
+cork_bitset_define_op(andnot, d[i] &= ~s[i])
@@ -0,0 +1,646 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/mempool.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/btree.h"
+
+
+/* Nodes are fairly large, so we allocate them in bigger blocks than the
+ * mempool's default. */
+#define CORK_RAW_BTREE_BLOCK_SIZE  65536
+
+/* Every node must have room for at least this many entries or keys. */
+#define CORK_RAW_BTREE_MIN_CAPACITY  8
+
+#define cork_raw_btree_align(size)  (((size) + 7) & ~((size_t) 7))
+
+/* Leaves, other than the root, never have fewer than half as many entries as
+ * they can hold.  Internal nodes never have fewer than (capacity - 1) / 2
+ * keys, which is what each half of a split node ends up with. */
+#define cork_raw_btree_leaf_min(tree)  ((tree)->leaf_capacity / 2)
+#define cork_raw_btree_internal_min(tree) \
+    (((tree)->internal_capacity - 1) / 2)
+
+#define cork_raw_btree_children(tree, node) \
+    ((struct cork_raw_btree_node **) \
+     (void *) ((char *) (node) + (tree)->children_offset))
+
+
+/*-----------------------------------------------------------------------
+ * Lifecycle
+ */
+
+void
+cork_raw_btree_init(struct cork_raw_btree *tree, size_t key_size,
+                    size_t value_size)
+{
+    size_t  ptr_size = sizeof(struct cork_raw_btree_node *);
+    size_t  leaf_entry = key_size + value_size;
+    size_t  internal_entry = key_size + ptr_size;
+    size_t  max_entry = (leaf_entry > internal_entry)?
+        leaf_entry: internal_entry;
+    size_t  node_size = CORK_RAW_BTREE_NODE_SIZE;
+
+    /* Make sure that every node holds enough entries, leaving a bit of space
+     * for the padding before a node's values or children. */
+    if (node_size < CORK_RAW_BTREE_HEADER_SIZE + ptr_size + 8 +
+                    CORK_RAW_BTREE_MIN_CAPACITY * max_entry) {
+        node_size = CORK_RAW_BTREE_HEADER_SIZE + ptr_size + 8 +
+                    CORK_RAW_BTREE_MIN_CAPACITY * max_entry;
+    }
+    node_size = cork_raw_btree_align(node_size);
+
+    tree->root = NULL;
+    tree->first = NULL;
+    tree->last = NULL;
+    tree->size = 0;
+    tree->height = 0;
+    tree->key_size = key_size;
+    tree->value_size = value_size;
+    tree->leaf_capacity =
+        (node_size - CORK_RAW_BTREE_HEADER_SIZE - 8) / leaf_entry;
+    tree->values_offset = cork_raw_btree_align
+        (CORK_RAW_BTREE_HEADER_SIZE + tree->leaf_capacity * key_size);
+    /* Internal nodes have one more child than they have keys. */
+    tree->internal_capacity =
+        (node_size - CORK_RAW_BTREE_HEADER_SIZE - 8 - ptr_size) /
+        internal_entry;
+    tree->children_offset = cork_raw_btree_align
+        (CORK_RAW_BTREE_HEADER_SIZE + tree->internal_capacity * key_size);
+    assert(tree->values_offset + tree->leaf_capacity * value_size <=
+           node_size);
+    assert(tree->children_offset +
+           (tree->internal_capacity + 1) * ptr_size <= node_size);
+    tree->nodes = cork_mempool_new_size_ex
+        (node_size, CORK_RAW_BTREE_BLOCK_SIZE);
+}
+
+static struct cork_raw_btree_node *
+cork_raw_btree_node_new(struct cork_raw_btree *tree, bool is_leaf)
+{
+    struct cork_raw_btree_node  *node = cork_mempool_new_object(tree->nodes);
+    node->prev = NULL;
+    node->next = NULL;
+    node->count = 0;
+    node->is_leaf = is_leaf;
+    return node;
+}
+
+static void
+cork_raw_btree_node_free(struct cork_raw_btree *tree,
+                         struct cork_raw_btree_node *node)
+{
+    cork_mempool_free_object(tree->nodes, node);
+}
+
+static void
+cork_raw_btree_free_subtree(struct cork_raw_btree *tree,
+                            struct cork_raw_btree_node *node)
+{
+    if (!node->is_leaf) {
+        size_t  i;
+        for (i = 0; i <= node->count; i++) {
+            cork_raw_btree_free_subtree
+                (tree, cork_raw_btree_child(tree, node, i));
+        }
+    }
+    cork_raw_btree_node_free(tree, node);
+}
+
+void
+cork_raw_btree_clear(struct cork_raw_btree *tree)
+{
+    if (tree->root != NULL) {
+        cork_raw_btree_free_subtree(tree, tree->root);
+    }
+    tree->root = NULL;
+    tree->first = NULL;
+    tree->last = NULL;
+    tree->size = 0;
+    tree->height = 0;
+}
+
+void
+cork_raw_btree_done(struct cork_raw_btree *tree)
+{
+    cork_raw_btree_clear(tree);
+    cork_mempool_free(tree->nodes);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Moving entries around
+ */
+
+/* Opens up a gap of count entries at index i of a leaf. */
+static void
+cork_raw_btree_leaf_shift_right(struct cork_raw_btree *tree,
+                                struct cork_raw_btree_node *leaf, size_t i,
+                                size_t count)
+{
+    size_t  moved = leaf->count - i;
+    memmove(cork_raw_btree_key(tree, leaf, i + count),
+            cork_raw_btree_key(tree, leaf, i), moved * tree->key_size);
+    memmove(cork_raw_btree_value(tree, leaf, i + count),
+            cork_raw_btree_value(tree, leaf, i), moved * tree->value_size);
+}
+
+/* Closes a gap of count entries at index i of a leaf. */
+static void
+cork_raw_btree_leaf_shift_left(struct cork_raw_btree *tree,
+                               struct cork_raw_btree_node *leaf, size_t i,
+                               size_t count)
+{
+    size_t  moved = leaf->count - i - count;
+    memmove(cork_raw_btree_key(tree, leaf, i),
+            cork_raw_btree_key(tree, leaf, i + count), moved * tree->key_size);
+    memmove(cork_raw_btree_value(tree, leaf, i),
+            cork_raw_btree_value(tree, leaf, i + count),
+            moved * tree->value_size);
+}
+
+/* Copies count entries from index src_i of src to index dest_i of dest. */
+static void
+cork_raw_btree_leaf_copy(struct cork_raw_btree *tree,
+                         struct cork_raw_btree_node *dest, size_t dest_i,
+                         struct cork_raw_btree_node *src, size_t src_i,
+                         size_t count)
+{
+    memcpy(cork_raw_btree_key(tree, dest, dest_i),
+           cork_raw_btree_key(tree, src, src_i), count * tree->key_size);
+    memcpy(cork_raw_btree_value(tree, dest, dest_i),
+           cork_raw_btree_value(tree, src, src_i), count * tree->value_size);
+}
+
+/* Opens up a gap of count keys at index i of an internal node, and a gap of
+ * count children at index child_i. */
+static void
+cork_raw_btree_internal_shift_right(struct cork_raw_btree *tree,
+                                    struct cork_raw_btree_node *node,
+                                    size_t i, size_t child_i, size_t count)
+{
+    struct cork_raw_btree_node  **children =
+        cork_raw_btree_children(tree, node);
+    memmove(cork_raw_btree_key(tree, node, i + count),
+            cork_raw_btree_key(tree, node, i),
+            (node->count - i) * tree->key_size);
+    memmove(children + child_i + count, children + child_i,
+            (node->count + 1 - child_i) * sizeof(*children));
+}
+
+/* Closes a gap of count keys at index i of an internal node, and a gap of
+ * count children at index child_i. */
+static void
+cork_raw_btree_internal_shift_left(struct cork_raw_btree *tree,
+                                   struct cork_raw_btree_node *node,
+                                   size_t i, size_t child_i, size_t count)
+{
+    struct cork_raw_btree_node  **children =
+        cork_raw_btree_children(tree, node);
+    memmove(cork_raw_btree_key(tree, node, i),
+            cork_raw_btree_key(tree, node, i + count),
+            (node->count - i - count) * tree->key_size);
+    memmove(children + child_i, children + child_i + count,
+            (node->count + 1 - child_i - count) * sizeof(*children));
+}
+
+static void
+cork_raw_btree_link_after(struct cork_raw_btree *tree,
+                          struct cork_raw_btree_node *leaf,
+                          struct cork_raw_btree_node *new_leaf)
+{
+    new_leaf->prev = leaf;
+    new_leaf->next = leaf->next;
+    if (leaf->next == NULL) {
+        tree->last = new_leaf;
+    } else {
+        leaf->next->prev = new_leaf;
+    }
+    leaf->next = new_leaf;
+}
+
+static void
+cork_raw_btree_unlink(struct cork_raw_btree *tree,
+                      struct cork_raw_btree_node *leaf)
+{
+    if (leaf->prev == NULL) {
+        tree->first = leaf->next;
+    } else {
+        leaf->prev->next = leaf->next;
+    }
+    if (leaf->next == NULL) {
+        tree->last = leaf->prev;
+    } else {
+        leaf->next->prev = leaf->prev;
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Insertion
+ */
+
+/* Adds key and right_child to the internal node at the given level of path,
+ * just after the child that the path passes through, splitting the node (and
+ * its ancestors) if needed. */
+static void
+cork_raw_btree_insert_child(struct cork_raw_btree *tree,
+                            struct cork_raw_btree_path *path,
+                            unsigned int level, const void *key,
+                            struct cork_raw_btree_node *right_child)
+{
+    struct cork_raw_btree_node  *node;
+    struct cork_raw_btree_node  *right;
+    size_t  index;
+    size_t  left_count;
+    size_t  right_count;
+
+    while (true) {
+        if (level == 0 && path->nodes[0] == NULL) {
+            /* We've split the root, so the tree gets taller. */
+            struct cork_raw_btree_node  *old_root = tree->root;
+            struct cork_raw_btree_node  *root =
+                cork_raw_btree_node_new(tree, false);
+            assert(tree->height < CORK_RAW_BTREE_MAX_HEIGHT);
+            memcpy(cork_raw_btree_key(tree, root, 0), key, tree->key_size);
+            cork_raw_btree_child(tree, root, 0) = old_root;
+            cork_raw_btree_child(tree, root, 1) = right_child;
+            root->count = 1;
+            tree->root = root;
+            tree->height++;
+            return;
+        }
+
+        node = path->nodes[level];
+        index = path->indexes[level];
+        if (node->count < tree->internal_capacity) {
+            cork_raw_btree_internal_shift_right
+                (tree, node, index, index + 1, 1);
+            memcpy(cork_raw_btree_key(tree, node, index), key,
+                   tree->key_size);
+            cork_raw_btree_child(tree, node, index + 1) = right_child;
+            node->count++;
+            return;
+        }
+
+        /* The node is full, so split it in two first.  The middle key moves
+         * up into the parent. */
+        right = cork_raw_btree_node_new(tree, false);
+        left_count = node->count / 2;
+        right_count = node->count - left_count - 1;
+        memcpy(cork_raw_btree_key(tree, right, 0),
+               cork_raw_btree_key(tree, node, left_count + 1),
+               right_count * tree->key_size);
+        memcpy(cork_raw_btree_children(tree, right),
+               cork_raw_btree_children(tree, node) + left_count + 1,
+               (right_count + 1) * sizeof(struct cork_raw_btree_node *));
+        right->count = right_count;
+        node->count = left_count;
+
+        /* Then add the new key to whichever half it belongs in.  The middle
+         * key is still in node's key array, just past its new count, and has
+         * to stay there until we've copied it into the parent. */
+        if (index <= left_count) {
+            /* Include the middle key in the shift, so that it ends up just
+             * past the end of node's keys again. */
+            node->count++;
+            cork_raw_btree_internal_shift_right
+                (tree, node, index, index + 1, 1);
+            memcpy(cork_raw_btree_key(tree, node, index), key,
+                   tree->key_size);
+            cork_raw_btree_child(tree, node, index + 1) = right_child;
+        } else {
+            index -= left_count + 1;
+            cork_raw_btree_internal_shift_right
+                (tree, right, index, index + 1, 1);
+            memcpy(cork_raw_btree_key(tree, right, index), key,
+                   tree->key_size);
+            cork_raw_btree_child(tree, right, index + 1) = right_child;
+            right->count++;
+        }
+
+        key = cork_raw_btree_key(tree, node, node->count);
+        right_child = right;
+        if (level == 0) {
+            path->nodes[0] = NULL;
+        } else {
+            level--;
+        }
+    }
+}
+
+void *
+cork_raw_btree_insert(struct cork_raw_btree *tree,
+                      struct cork_raw_btree_path *path, const void *key)
+{
+    struct cork_raw_btree_node  *leaf;
+    struct cork_raw_btree_node  *right;
+    size_t  index;
+    size_t  left_count;
+    void  *value;
+
+    if (tree->root == NULL) {
+        leaf = cork_raw_btree_node_new(tree, true);
+        tree->root = leaf;
+        tree->first = leaf;
+        tree->last = leaf;
+        tree->height = 1;
+        path->height = 1;
+        path->nodes[0] = leaf;
+        path->indexes[0] = 0;
+    }
+
+    tree->size++;
+    leaf = path->nodes[path->height - 1];
+    index = path->indexes[path->height - 1];
+    if (leaf->count < tree->leaf_capacity) {
+        cork_raw_btree_leaf_shift_right(tree, leaf, index, 1);
+        memcpy(cork_raw_btree_key(tree, leaf, index), key, tree->key_size);
+        leaf->count++;
+        return cork_raw_btree_value(tree, leaf, index);
+    }
+
+    /* The leaf is full, so split it in two, and then add the new entry to
+     * whichever half it belongs in. */
+    right = cork_raw_btree_node_new(tree, true);
+    left_count = leaf->count / 2;
+    cork_raw_btree_leaf_copy
+        (tree, right, 0, leaf, left_count, leaf->count - left_count);
+    right->count = leaf->count - left_count;
+    leaf->count = left_count;
+    cork_raw_btree_link_after(tree, leaf, right);
+
+    if (index > left_count) {
+        leaf = right;
+        index -= left_count;
+    }
+    cork_raw_btree_leaf_shift_right(tree, leaf, index, 1);
+    memcpy(cork_raw_btree_key(tree, leaf, index), key, tree->key_size);
+    leaf->count++;
+    value = cork_raw_btree_value(tree, leaf, index);
+
+    /* The first key of the new leaf separates it from the old one. */
+    if (path->height == 1) {
+        path->nodes[0] = NULL;
+        cork_raw_btree_insert_child
+            (tree, path, 0, cork_raw_btree_key(tree, right, 0), right);
+    } else {
+        cork_raw_btree_insert_child
+            (tree, path, path->height - 2,
+             cork_raw_btree_key(tree, right, 0), right);
+    }
+    return value;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Removal
+ */
+
+/* Removes key i and child i + 1 from an internal node. */
+static void
+cork_raw_btree_remove_child(struct cork_raw_btree *tree,
+                            struct cork_raw_btree_node *node, size_t i)
+{
+    cork_raw_btree_internal_shift_left(tree, node, i, i + 1, 1);
+    node->count--;
+}
+
+/* Fixes the node at the given level of path, which has too few entries, by
+ * borrowing an entry from one of its siblings or by merging it with one. */
+static void
+cork_raw_btree_rebalance(struct cork_raw_btree *tree,
+                         struct cork_raw_btree_path *path, unsigned int level)
+{
+    while (level > 0) {
+        struct cork_raw_btree_node  *node = path->nodes[level];
+        struct cork_raw_btree_node  *parent = path->nodes[level - 1];
+        size_t  index = path->indexes[level - 1];
+        struct cork_raw_btree_node  *left = (index > 0)?
+            cork_raw_btree_child(tree, parent, index - 1): NULL;
+        struct cork_raw_btree_node  *right = (index < parent->count)?
+            cork_raw_btree_child(tree, parent, index + 1): NULL;
+        size_t  min = node->is_leaf?
+            cork_raw_btree_leaf_min(tree): cork_raw_btree_internal_min(tree);
+        struct cork_raw_btree_node  *dest;
+        struct cork_raw_btree_node  *src;
+        size_t  sep;
+
+        if (node->count >= min) {
+            return;
+        }
+
+        if (left != NULL && left->count > min) {
+            /* Borrow the last entry of the left sibling. */
+            if (node->is_leaf) {
+                cork_raw_btree_leaf_shift_right(tree, node, 0, 1);
+                cork_raw_btree_leaf_copy
+                    (tree, node, 0, left, left->count - 1, 1);
+                memcpy(cork_raw_btree_key(tree, parent, index - 1),
+                       cork_raw_btree_key(tree, node, 0), tree->key_size);
+            } else {
+                cork_raw_btree_internal_shift_right(tree, node, 0, 0, 1);
+                memcpy(cork_raw_btree_key(tree, node, 0),
+                       cork_raw_btree_key(tree, parent, index - 1),
+                       tree->key_size);
+                cork_raw_btree_child(tree, node, 0) =
+                    cork_raw_btree_child(tree, left, left->count);
+                memcpy(cork_raw_btree_key(tree, parent, index - 1),
+                       cork_raw_btree_key(tree, left, left->count - 1),
+                       tree->key_size);
+            }
+            left->count--;
+            node->count++;
+            return;
+        }
+
+        if (right != NULL && right->count > min) {
+            /* Borrow the first entry of the right sibling. */
+            if (node->is_leaf) {
+                cork_raw_btree_leaf_copy(tree, node, node->count, right, 0, 1);
+                cork_raw_btree_leaf_shift_left(tree, right, 0, 1);
+                right->count--;
+                memcpy(cork_raw_btree_key(tree, parent, index),
+                       cork_raw_btree_key(tree, right, 0), tree->key_size);
+            } else {
+                memcpy(cork_raw_btree_key(tree, node, node->count),
+                       cork_raw_btree_key(tree, parent, index),
+                       tree->key_size);
+                cork_raw_btree_child(tree, node, node->count + 1) =
+                    cork_raw_btree_child(tree, right, 0);
+                memcpy(cork_raw_btree_key(tree, parent, index),
+                       cork_raw_btree_key(tree, right, 0), tree->key_size);
+                cork_raw_btree_internal_shift_left(tree, right, 0, 0, 1);
+                right->count--;
+            }
+            node->count++;
+            return;
+        }
+
+        /* Neither sibling can spare an entry, so merge with one of them.  We
+         * always merge the right node of the pair into the left one. */
+        if (left != NULL) {
+            dest = left;
+            src = node;
+            sep = index - 1;
+        } else {
+            dest = node;
+            src = right;
+            sep = index;
+        }
+
+        if (dest->is_leaf) {
+            cork_raw_btree_leaf_copy
+                (tree, dest, dest->count, src, 0, src->count);
+            dest->count += src->count;
+            cork_raw_btree_unlink(tree, src);
+        } else {
+            memcpy(cork_raw_btree_key(tree, dest, dest->count),
+                   cork_raw_btree_key(tree, parent, sep), tree->key_size);
+            memcpy(cork_raw_btree_key(tree, dest, dest->count + 1),
+                   cork_raw_btree_key(tree, src, 0),
+                   src->count * tree->key_size);
+            memcpy(cork_raw_btree_children(tree, dest) + dest->count + 1,
+                   cork_raw_btree_children(tree, src),
+                   (src->count + 1) * sizeof(struct cork_raw_btree_node *));
+            dest->count += src->count + 1;
+        }
+        cork_raw_btree_node_free(tree, src);
+        cork_raw_btree_remove_child(tree, parent, sep);
+        level--;
+    }
+
+    /* If the root is an internal node with a single child, that child becomes
+     * the new root. */
+    if (!tree->root->is_leaf && tree->root->count == 0) {
+        struct cork_raw_btree_node  *old_root = tree->root;
+        tree->root = cork_raw_btree_child(tree, old_root, 0);
+        tree->height--;
+        cork_raw_btree_node_free(tree, old_root);
+    }
+}
+
+void
+cork_raw_btree_remove(struct cork_raw_btree *tree,
+                      struct cork_raw_btree_path *path)
+{
+    struct cork_raw_btree_node  *leaf = path->nodes[path->height - 1];
+    size_t  index = path->indexes[path->height - 1];
+
+    cork_raw_btree_leaf_shift_left(tree, leaf, index, 1);
+    leaf->count--;
+    tree->size--;
+
+    if (path->height == 1) {
+        if (leaf->count == 0) {
+            cork_raw_btree_node_free(tree, leaf);
+            tree->root = NULL;
+            tree->first = NULL;
+            tree->last = NULL;
+            tree->height = 0;
+        }
+        return;
+    }
+    cork_raw_btree_rebalance(tree, path, path->height - 1);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Bulk loading
+ */
+
+void
+cork_raw_btree_bulk_load(struct cork_raw_btree *tree, const void *entries,
+                         size_t count, size_t entry_size, size_t key_offset,
+                         size_t value_offset)
+{
+    const char  *src = entries;
+    struct cork_raw_btree_node  **level_nodes;
+    /* The smallest key in each node's subtree */
+    const void  **level_keys;
+    size_t  level_count;
+    size_t  level_size;
+    size_t  i;
+
+    cork_raw_btree_clear(tree);
+    if (count == 0) {
+        return;
+    }
+
+    /* Spread the entries as evenly as we can across as few leaves as
+     * possible.  With more than one leaf, each one is at least half full. */
+    level_count = (count + tree->leaf_capacity - 1) / tree->leaf_capacity;
+    level_size = level_count;
+    level_nodes = cork_calloc
+        (level_size, sizeof(struct cork_raw_btree_node *));
+    level_keys = cork_calloc(level_size, sizeof(const void *));
+    for (i = 0; i < level_count; i++) {
+        struct cork_raw_btree_node  *leaf =
+            cork_raw_btree_node_new(tree, true);
+        size_t  leaf_count = count / level_count +
+            ((i < count % level_count)? 1: 0);
+        size_t  j;
+        for (j = 0; j < leaf_count; j++, src += entry_size) {
+            memcpy(cork_raw_btree_key(tree, leaf, j), src + key_offset,
+                   tree->key_size);
+            memcpy(cork_raw_btree_value(tree, leaf, j), src + value_offset,
+                   tree->value_size);
+        }
+        leaf->count = leaf_count;
+        if (i == 0) {
+            tree->first = leaf;
+        } else {
+            leaf->prev = level_nodes[i - 1];
+            level_nodes[i - 1]->next = leaf;
+        }
+        level_nodes[i] = leaf;
+        level_keys[i] = cork_raw_btree_key(tree, leaf, 0);
+    }
+    tree->last = level_nodes[level_count - 1];
+    tree->height = 1;
+
+    /* Then build each level of internal nodes from the one below it.  Each
+     * new level is shorter than the last, so we can build it in place. */
+    while (level_count > 1) {
+        size_t  fanout = tree->internal_capacity + 1;
+        size_t  child_count = level_count;
+        size_t  next = 0;
+        level_count = (child_count + fanout - 1) / fanout;
+        for (i = 0; i < level_count; i++) {
+            struct cork_raw_btree_node  *node =
+                cork_raw_btree_node_new(tree, false);
+            size_t  node_children = child_count / level_count +
+                ((i < child_count % level_count)? 1: 0);
+            const void  *min_key = level_keys[next];
+            size_t  j;
+            for (j = 0; j < node_children; j++, next++) {
+                cork_raw_btree_child(tree, node, j) = level_nodes[next];
+                if (j > 0) {
+                    memcpy(cork_raw_btree_key(tree, node, j - 1),
+                           level_keys[next], tree->key_size);
+                }
+            }
+            node->count = node_children - 1;
+            level_nodes[i] = node;
+            level_keys[i] = min_key;
+        }
+        tree->height++;
+        assert(tree->height <= CORK_RAW_BTREE_MAX_HEIGHT);
+    }
+
+    tree->root = level_nodes[0];
+    tree->size = count;
+    cork_cfree(level_nodes, level_size, sizeof(struct cork_raw_btree_node *));
+    cork_cfree(level_keys, level_size, sizeof(const void *));
+}
@@ -7,17 +7,30 @@
  * ----------------------------------------------------------------------
  */
 
+#include <assert.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "libcork/config/config.h"
 #include "libcork/core/allocator.h"
+#include "libcork/core/byte-order.h"
+#include "libcork/core/trace.h"
 #include "libcork/core/types.h"
 #include "libcork/ds/buffer.h"
 #include "libcork/ds/managed-buffer.h"
 #include "libcork/ds/stream.h"
 #include "libcork/helpers/errors.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define CORK_BUFFER_USE_SSE2  1
+#else
+#define CORK_BUFFER_USE_SSE2  0
+#endif
+
 
 void
 cork_buffer_init(struct cork_buffer *buffer)
@@ -73,10 +86,14 @@ cork_buffer_equal(const struct cork_buffer *buffer1,
 }
 
 
+/* buffer_grow(buffer, old_size, new_size, duration_ns) */
+cork_tracepoint(buffer_grow);
+
 static void
 cork_buffer_ensure_size_int(struct cork_buffer *buffer, size_t desired_size)
 {
     size_t  new_size;
+    uint64_t  start;
 
     if (CORK_LIKELY(buffer->allocated_size >= desired_size)) {
         return;
@@ -88,7 +105,10 @@ cork_buffer_ensure_size_int(struct cork_buffer *buffer, size_t desired_size)
         new_size = desired_size;
     }
 
+    start = cork_trace_start(buffer_grow);
     buffer->buf = cork_realloc(buffer->buf, buffer->allocated_size, new_size);
+    cork_trace4(buffer_grow, buffer, buffer->allocated_size, new_size,
+                cork_trace_elapsed(start));
     buffer->allocated_size = new_size;
 }
 
@@ -98,6 +118,41 @@ cork_buffer_ensure_size(struct cork_buffer *buffer, size_t desired_size)
     cork_buffer_ensure_size_int(buffer, desired_size);
 }
 
+void *
+cork_buffer_reserve(struct cork_buffer *buffer, size_t length)
+{
+    /* Leave room for the NUL terminator that cork_buffer_commit adds. */
+    cork_buffer_ensure_size_int(buffer, buffer->size + length + 1);
+    return buffer->buf + buffer->size;
+}
+
+void
+cork_buffer_commit(struct cork_buffer *buffer, size_t written)
+{
+    assert(buffer->size + written < buffer->allocated_size);
+    buffer->size += written;
+    ((char *) buffer->buf)[buffer->size] = '\0';
+}
+
+#define CORK_BUFFER_READ_SIZE  4096
+
+int
+cork_buffer_append_fd(struct cork_buffer *buffer, int fd)
+{
+    while (true) {
+        void  *dest = cork_buffer_reserve(buffer, CORK_BUFFER_READ_SIZE);
+        ssize_t  bytes_read = read(fd, dest, CORK_BUFFER_READ_SIZE);
+        if (bytes_read > 0) {
+            cork_buffer_commit(buffer, bytes_read);
+        } else if (bytes_read == 0) {
+            return 0;
+        } else if (errno != EINTR) {
+            cork_system_error_set();
+            return -1;
+        }
+    }
+}
+
 
 void
 cork_buffer_clear(struct cork_buffer *buffer)
@@ -124,6 +179,29 @@ cork_buffer_truncate(struct cork_buffer *buffer, size_t length)
 }
 
 
+void
+cork_buffer_adopt(struct cork_buffer *buffer, void *buf, size_t size,
+                  size_t allocated_size)
+{
+    cork_buffer_done(buffer);
+    buffer->buf = buf;
+    buffer->size = size;
+    buffer->allocated_size = allocated_size;
+    ((char *) buffer->buf)[size] = '\0';
+}
+
+void *
+cork_buffer_steal(struct cork_buffer *buffer, size_t *size,
+                  size_t *allocated_size)
+{
+    void  *buf = buffer->buf;
+    *size = buffer->size;
+    *allocated_size = buffer->allocated_size;
+    cork_buffer_init(buffer);
+    return buf;
+}
+
+
 void
 cork_buffer_set(struct cork_buffer *buffer, const void *src, size_t length)
 {
@@ -242,14 +320,62 @@ cork_buffer_append_indent(struct cork_buffer *buffer, size_t indent)
 #define to_hex(nybble) \
     ((nybble) < 10? '0' + (nybble): 'a' - 10 + (nybble))
 
+/* The length of the run at the start of chars that can appear unescaped in a
+ * C string literal. */
+static size_t
+cork_c_string_clean_run(const char *chars, size_t length)
+{
+    size_t  i = 0;
+#if CORK_BUFFER_USE_SSE2
+    /* Compare as signed bytes, so that anything >= 0x80 is less than 0x20. */
+    const __m128i  space = _mm_set1_epi8(0x20);
+    const __m128i  del = _mm_set1_epi8(0x7f);
+    const __m128i  quote = _mm_set1_epi8('"');
+    const __m128i  backslash = _mm_set1_epi8('\\');
+    for (; i + 16 <= length; i += 16) {
+        __m128i  x = _mm_loadu_si128((const __m128i *) (chars + i));
+        __m128i  bad = _mm_or_si128
+            (_mm_or_si128(_mm_cmplt_epi8(x, space), _mm_cmpeq_epi8(x, del)),
+             _mm_or_si128(_mm_cmpeq_epi8(x, quote),
+                          _mm_cmpeq_epi8(x, backslash)));
+        int  mask = _mm_movemask_epi8(bad);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        char  ch = chars[i];
+        if (!is_sprint(ch) || ch == '"' || ch == '\\') {
+            break;
+        }
+    }
+    return i;
+}
+
 void
 cork_buffer_append_c_string(struct cork_buffer *dest,
                             const char *chars, size_t length)
 {
-    size_t  i;
+    size_t  i = 0;
+    /* Most strings don't need many escapes, so reserve enough space for the
+     * unescaped string up front. */
+    cork_buffer_ensure_size_int(dest, dest->size + length + 3);
     cork_buffer_append(dest, "\"", 1);
-    for (i = 0; i < length; i++) {
-        char  ch = chars[i];
+    while (i < length) {
+        /* Copy over the longest run of characters that don't need escaping,
+         * and then escape the character after it. */
+        size_t  run = cork_c_string_clean_run(chars + i, length - i);
+        char  ch;
+        if (run > 0) {
+            cork_buffer_append(dest, chars + i, run);
+            i += run;
+            if (i == length) {
+                break;
+            }
+        }
+
+        ch = chars[i++];
         switch (ch) {
             case '\"':
                 cork_buffer_append_literal(dest, "\\\"");
@@ -273,11 +399,14 @@ cork_buffer_append_c_string(struct cork_buffer *dest,
                 cork_buffer_append_literal(dest, "\\v");
                 break;
             default:
-                if (is_sprint(ch)) {
-                    cork_buffer_append(dest, &chars[i], 1);
-                } else {
+                {
                     uint8_t  byte = ch;
-                    cork_buffer_append_printf(dest, "\\x%02" PRIx8, byte);
+                    char  escape[4];
+                    escape[0] = '\\';
+                    escape[1] = 'x';
+                    escape[2] = to_hex(byte >> 4);
+                    escape[3] = to_hex(byte & 0x0f);
+                    cork_buffer_append(dest, escape, sizeof(escape));
                 }
                 break;
         }
@@ -285,46 +414,86 @@ cork_buffer_append_c_string(struct cork_buffer *dest,
     cork_buffer_append(dest, "\"", 1);
 }
 
+/* Each line of a hex dump shows up to 16 bytes:
+ *
+ *   68 65 6c 6c 6f 0a 00 77 6f 72 6c 64 0d 80 68 65  |hello..world..he|
+ */
+#define CORK_HEX_DUMP_HEX_LENGTH  (3 * 16)
+#define CORK_HEX_DUMP_LINE_LENGTH  (CORK_HEX_DUMP_HEX_LENGTH + 2 + 16 + 1)
+
+/* Renders up to 16 bytes into line, returning the length of the result. */
+static size_t
+cork_hex_dump_line(char *line, const char *chars, size_t count)
+{
+    char  hex[2 * 16];
+    char  *print = line + CORK_HEX_DUMP_HEX_LENGTH + 2;
+    size_t  i;
+
+#if CORK_BUFFER_USE_SSE2
+    if (count == 16) {
+        /* Convert each nybble into a hex digit, and replace unprintable
+         * characters with '.', 16 bytes at a time. */
+        const __m128i  low_mask = _mm_set1_epi8(0x0f);
+        const __m128i  nine = _mm_set1_epi8(9);
+        const __m128i  zero = _mm_set1_epi8('0');
+        const __m128i  letter_offset = _mm_set1_epi8('a' - '0' - 10);
+        const __m128i  space = _mm_set1_epi8(0x20);
+        const __m128i  del = _mm_set1_epi8(0x7f);
+        const __m128i  dot = _mm_set1_epi8('.');
+        __m128i  x = _mm_loadu_si128((const __m128i *) chars);
+        __m128i  high = _mm_and_si128(_mm_srli_epi16(x, 4), low_mask);
+        __m128i  low = _mm_and_si128(x, low_mask);
+        __m128i  unprintable =
+            _mm_or_si128(_mm_cmplt_epi8(x, space), _mm_cmpeq_epi8(x, del));
+        high = _mm_add_epi8
+            (_mm_add_epi8(high, zero),
+             _mm_and_si128(_mm_cmpgt_epi8(high, nine), letter_offset));
+        low = _mm_add_epi8
+            (_mm_add_epi8(low, zero),
+             _mm_and_si128(_mm_cmpgt_epi8(low, nine), letter_offset));
+        _mm_storeu_si128((__m128i *) hex, _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128((__m128i *) (hex + 16), _mm_unpackhi_epi8(high, low));
+        _mm_storeu_si128
+            ((__m128i *) print,
+             _mm_or_si128(_mm_andnot_si128(unprintable, x),
+                          _mm_and_si128(unprintable, dot)));
+    } else
+#endif
+    {
+        for (i = 0; i < count; i++) {
+            uint8_t  u8 = chars[i];
+            hex[2*i] = to_hex(u8 >> 4);
+            hex[2*i + 1] = to_hex(u8 & 0x0f);
+            print[i] = is_sprint(chars[i])? chars[i]: '.';
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        line[3*i] = hex[2*i];
+        line[3*i + 1] = hex[2*i + 1];
+        line[3*i + 2] = ' ';
+    }
+    memset(line + 3*count, ' ', CORK_HEX_DUMP_HEX_LENGTH - 3*count);
+    line[CORK_HEX_DUMP_HEX_LENGTH] = ' ';
+    line[CORK_HEX_DUMP_HEX_LENGTH + 1] = '|';
+    print[count] = '|';
+    return CORK_HEX_DUMP_HEX_LENGTH + 2 + count + 1;
+}
+
 void
 cork_buffer_append_hex_dump(struct cork_buffer *dest, size_t indent,
                             const char *chars, size_t length)
 {
-    char  hex[3 * 16];
-    char  print[16];
-    char  *curr_hex = hex;
-    char  *curr_print = print;
+    char  line[CORK_HEX_DUMP_LINE_LENGTH];
     size_t  i;
-    size_t  column = 0;
-    for (i = 0; i < length; i++) {
-        char  ch = chars[i];
-        uint8_t  u8 = ch;
-        *curr_hex++ = to_hex(u8 >> 4);
-        *curr_hex++ = to_hex(u8 & 0x0f);
-        *curr_hex++ = ' ';
-        *curr_print++ = is_sprint(ch)? ch: '.';
-        if (column == 0 && i != 0) {
+    for (i = 0; i < length; i += 16) {
+        size_t  count = (length - i < 16)? length - i: 16;
+        if (i != 0) {
             cork_buffer_append_literal(dest, "\n");
             cork_buffer_append_indent(dest, indent);
-            column++;
-        } else if (column == 15) {
-            cork_buffer_append_printf
-                (dest, "%-48.*s", (int) (curr_hex - hex), hex);
-            cork_buffer_append_literal(dest, " |");
-            cork_buffer_append(dest, print, curr_print - print);
-            cork_buffer_append_literal(dest, "|");
-            curr_hex = hex;
-            curr_print = print;
-            column = 0;
-        } else {
-            column++;
         }
-    }
-
-    if (column > 0) {
-        cork_buffer_append_printf(dest, "%-48.*s", (int) (curr_hex - hex), hex);
-        cork_buffer_append_literal(dest, " |");
-        cork_buffer_append(dest, print, curr_print - print);
-        cork_buffer_append_literal(dest, "|");
+        cork_buffer_append
+            (dest, line, cork_hex_dump_line(line, chars + i, count));
     }
 }
 
@@ -332,16 +501,15 @@ void
 cork_buffer_append_multiline(struct cork_buffer *dest, size_t indent,
                              const char *chars, size_t length)
 {
-    size_t  i;
-    for (i = 0; i < length; i++) {
-        char  ch = chars[i];
-        if (ch == '\n') {
-            cork_buffer_append_literal(dest, "\n");
-            cork_buffer_append_indent(dest, indent);
-        } else {
-            cork_buffer_append(dest, &chars[i], 1);
-        }
+    const char  *end = chars + length;
+    const char  *newline;
+    while ((newline = memchr(chars, '\n', end - chars)) != NULL) {
+        cork_buffer_append(dest, chars, newline - chars);
+        cork_buffer_append_literal(dest, "\n");
+        cork_buffer_append_indent(dest, indent);
+        chars = newline + 1;
     }
+    cork_buffer_append(dest, chars, end - chars);
 }
 
 void
@@ -376,6 +544,523 @@ cork_buffer_append_binary(struct cork_buffer *dest, size_t indent,
 }
 
 
+/*-----------------------------------------------------------------------
+ * Formatting numbers
+ */
+
+/* These write their digits directly into the buffer's reserved space,
+ * without going through vsnprintf and parsing a format string. */
+
+static const char  cork_buffer_digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char  cork_buffer_hex_digits[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+};
+
+static unsigned int
+cork_u64_decimal_digits(uint64_t value)
+{
+    unsigned int  digits = 1;
+    while (value >= 10000) {
+        value /= 10000;
+        digits += 4;
+    }
+    if (value >= 1000) {
+        return digits + 3;
+    } else if (value >= 100) {
+        return digits + 2;
+    } else if (value >= 10) {
+        return digits + 1;
+    } else {
+        return digits;
+    }
+}
+
+/* Writes the decimal digits of value backwards, ending just before end. */
+static void
+cork_u64_write_decimal(char *end, uint64_t value)
+{
+    while (value >= 100) {
+        unsigned int  pair = (value % 100) * 2;
+        value /= 100;
+        *--end = cork_buffer_digit_pairs[pair + 1];
+        *--end = cork_buffer_digit_pairs[pair];
+    }
+    if (value >= 10) {
+        unsigned int  pair = value * 2;
+        *--end = cork_buffer_digit_pairs[pair + 1];
+        *--end = cork_buffer_digit_pairs[pair];
+    } else {
+        *--end = '0' + value;
+    }
+}
+
+void
+cork_buffer_append_u64_width(struct cork_buffer *buffer, uint64_t value,
+                             unsigned int width)
+{
+    unsigned int  digits = cork_u64_decimal_digits(value);
+    unsigned int  length = (digits < width)? width: digits;
+    char  *dest;
+    cork_buffer_ensure_size_int(buffer, buffer->size + length + 1);
+    dest = buffer->buf + buffer->size;
+    memset(dest, '0', length - digits);
+    cork_u64_write_decimal(dest + length, value);
+    buffer->size += length;
+    ((char *) buffer->buf)[buffer->size] = '\0';
+}
+
+void
+cork_buffer_append_u64(struct cork_buffer *buffer, uint64_t value)
+{
+    cork_buffer_append_u64_width(buffer, value, 0);
+}
+
+void
+cork_buffer_append_i64(struct cork_buffer *buffer, int64_t value)
+{
+    if (value < 0) {
+        cork_buffer_append(buffer, "-", 1);
+        /* Negate as unsigned so that INT64_MIN works, too. */
+        cork_buffer_append_u64_width(buffer, -(uint64_t) value, 0);
+    } else {
+        cork_buffer_append_u64_width(buffer, value, 0);
+    }
+}
+
+void
+cork_buffer_append_hex(struct cork_buffer *buffer, uint64_t value,
+                       unsigned int width)
+{
+    unsigned int  digits =
+        (value == 0)? 1: (64 - __builtin_clzll(value) + 3) / 4;
+    unsigned int  length = (digits < width)? width: digits;
+    char  *dest;
+    char  *end;
+    cork_buffer_ensure_size_int(buffer, buffer->size + length + 1);
+    dest = buffer->buf + buffer->size;
+    end = dest + length;
+    memset(dest, '0', length - digits);
+    do {
+        *--end = cork_buffer_hex_digits[value & 0x0f];
+        value >>= 4;
+    } while (value != 0);
+    buffer->size += length;
+    ((char *) buffer->buf)[buffer->size] = '\0';
+}
+
+
+/*-----------------------------------------------------------------------
+ * Formatting doubles
+ */
+
+/* We use the Grisu2 algorithm to find the shortest string of digits that
+ * reads back in as exactly the same double:
+ *
+ *   Loitsch, F.  "Printing floating-point numbers quickly and accurately with
+ *   integers."  Proc. PLDI 2010.
+ *
+ * A "diy_fp" is an unnormalized floating-point value f * 2^e with a 64-bit
+ * significand. */
+
+struct cork_diy_fp {
+    uint64_t  f;
+    int  e;
+};
+
+#define CORK_DOUBLE_SIGNIFICAND_SIZE  52
+#define CORK_DOUBLE_EXPONENT_BIAS  (0x3ff + CORK_DOUBLE_SIGNIFICAND_SIZE)
+#define CORK_DOUBLE_HIDDEN_BIT  UINT64_C(0x0010000000000000)
+#define CORK_DOUBLE_SIGNIFICAND_MASK  UINT64_C(0x000fffffffffffff)
+#define CORK_DOUBLE_EXPONENT_MASK  UINT64_C(0x7ff0000000000000)
+
+static struct cork_diy_fp
+cork_diy_fp_from_double(uint64_t bits)
+{
+    struct cork_diy_fp  result;
+    int  biased_e = (bits & CORK_DOUBLE_EXPONENT_MASK) >>
+        CORK_DOUBLE_SIGNIFICAND_SIZE;
+    uint64_t  significand = bits & CORK_DOUBLE_SIGNIFICAND_MASK;
+    if (biased_e != 0) {
+        result.f = significand + CORK_DOUBLE_HIDDEN_BIT;
+        result.e = biased_e - CORK_DOUBLE_EXPONENT_BIAS;
+    } else {
+        result.f = significand;
+        result.e = 1 - CORK_DOUBLE_EXPONENT_BIAS;
+    }
+    return result;
+}
+
+static struct cork_diy_fp
+cork_diy_fp_normalize(struct cork_diy_fp v)
+{
+    int  shift = __builtin_clzll(v.f);
+    v.f <<= shift;
+    v.e -= shift;
+    return v;
+}
+
+static struct cork_diy_fp
+cork_diy_fp_multiply(struct cork_diy_fp x, struct cork_diy_fp y)
+{
+    struct cork_diy_fp  result;
+    const uint64_t  M32 = 0xffffffff;
+    uint64_t  a = x.f >> 32;
+    uint64_t  b = x.f & M32;
+    uint64_t  c = y.f >> 32;
+    uint64_t  d = y.f & M32;
+    uint64_t  ac = a * c;
+    uint64_t  bc = b * c;
+    uint64_t  ad = a * d;
+    uint64_t  bd = b * d;
+    uint64_t  tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+    /* Round the lower 64 bits of the product */
+    tmp += UINT64_C(1) << 31;
+    result.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    result.e = x.e + y.e + 64;
+    return result;
+}
+
+/* The boundaries m- and m+ of v; every value strictly between them reads
+ * back in as v.  Both have the same exponent as the normalized m+. */
+static void
+cork_diy_fp_boundaries(struct cork_diy_fp v, struct cork_diy_fp *minus,
+                       struct cork_diy_fp *plus)
+{
+    struct cork_diy_fp  pl;
+    struct cork_diy_fp  mi;
+    pl.f = (v.f << 1) + 1;
+    pl.e = v.e - 1;
+    pl = cork_diy_fp_normalize(pl);
+    if (v.f == CORK_DOUBLE_HIDDEN_BIT) {
+        /* The next value down has a smaller exponent, so it's closer. */
+        mi.f = (v.f << 2) - 1;
+        mi.e = v.e - 2;
+    } else {
+        mi.f = (v.f << 1) - 1;
+        mi.e = v.e - 1;
+    }
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    *minus = mi;
+    *plus = pl;
+}
+
+/* Normalized approximations of 10^k for k = -348, -340, ..., 340 */
+static const uint64_t  cork_cached_powers_f[] = {
+    UINT64_C(0xfa8fd5a0081c0288), UINT64_C(0xbaaee17fa23ebf76),
+    UINT64_C(0x8b16fb203055ac76), UINT64_C(0xcf42894a5dce35ea),
+    UINT64_C(0x9a6bb0aa55653b2d), UINT64_C(0xe61acf033d1a45df),
+    UINT64_C(0xab70fe17c79ac6ca), UINT64_C(0xff77b1fcbebcdc4f),
+    UINT64_C(0xbe5691ef416bd60c), UINT64_C(0x8dd01fad907ffc3c),
+    UINT64_C(0xd3515c2831559a83), UINT64_C(0x9d71ac8fada6c9b5),
+    UINT64_C(0xea9c227723ee8bcb), UINT64_C(0xaecc49914078536d),
+    UINT64_C(0x823c12795db6ce57), UINT64_C(0xc21094364dfb5637),
+    UINT64_C(0x9096ea6f3848984f), UINT64_C(0xd77485cb25823ac7),
+    UINT64_C(0xa086cfcd97bf97f4), UINT64_C(0xef340a98172aace5),
+    UINT64_C(0xb23867fb2a35b28e), UINT64_C(0x84c8d4dfd2c63f3b),
+    UINT64_C(0xc5dd44271ad3cdba), UINT64_C(0x936b9fcebb25c996),
+    UINT64_C(0xdbac6c247d62a584), UINT64_C(0xa3ab66580d5fdaf6),
+    UINT64_C(0xf3e2f893dec3f126), UINT64_C(0xb5b5ada8aaff80b8),
+    UINT64_C(0x87625f056c7c4a8b), UINT64_C(0xc9bcff6034c13053),
+    UINT64_C(0x964e858c91ba2655), UINT64_C(0xdff9772470297ebd),
+    UINT64_C(0xa6dfbd9fb8e5b88f), UINT64_C(0xf8a95fcf88747d94),
+    UINT64_C(0xb94470938fa89bcf), UINT64_C(0x8a08f0f8bf0f156b),
+    UINT64_C(0xcdb02555653131b6), UINT64_C(0x993fe2c6d07b7fac),
+    UINT64_C(0xe45c10c42a2b3b06), UINT64_C(0xaa242499697392d3),
+    UINT64_C(0xfd87b5f28300ca0e), UINT64_C(0xbce5086492111aeb),
+    UINT64_C(0x8cbccc096f5088cc), UINT64_C(0xd1b71758e219652c),
+    UINT64_C(0x9c40000000000000), UINT64_C(0xe8d4a51000000000),
+    UINT64_C(0xad78ebc5ac620000), UINT64_C(0x813f3978f8940984),
+    UINT64_C(0xc097ce7bc90715b3), UINT64_C(0x8f7e32ce7bea5c70),
+    UINT64_C(0xd5d238a4abe98068), UINT64_C(0x9f4f2726179a2245),
+    UINT64_C(0xed63a231d4c4fb27), UINT64_C(0xb0de65388cc8ada8),
+    UINT64_C(0x83c7088e1aab65db), UINT64_C(0xc45d1df942711d9a),
+    UINT64_C(0x924d692ca61be758), UINT64_C(0xda01ee641a708dea),
+    UINT64_C(0xa26da3999aef774a), UINT64_C(0xf209787bb47d6b85),
+    UINT64_C(0xb454e4a179dd1877), UINT64_C(0x865b86925b9bc5c2),
+    UINT64_C(0xc83553c5c8965d3d), UINT64_C(0x952ab45cfa97a0b3),
+    UINT64_C(0xde469fbd99a05fe3), UINT64_C(0xa59bc234db398c25),
+    UINT64_C(0xf6c69a72a3989f5c), UINT64_C(0xb7dcbf5354e9bece),
+    UINT64_C(0x88fcf317f22241e2), UINT64_C(0xcc20ce9bd35c78a5),
+    UINT64_C(0x98165af37b2153df), UINT64_C(0xe2a0b5dc971f303a),
+    UINT64_C(0xa8d9d1535ce3b396), UINT64_C(0xfb9b7cd9a4a7443c),
+    UINT64_C(0xbb764c4ca7a44410), UINT64_C(0x8bab8eefb6409c1a),
+    UINT64_C(0xd01fef10a657842c), UINT64_C(0x9b10a4e5e9913129),
+    UINT64_C(0xe7109bfba19c0c9d), UINT64_C(0xac2820d9623bf429),
+    UINT64_C(0x80444b5e7aa7cf85), UINT64_C(0xbf21e44003acdd2d),
+    UINT64_C(0x8e679c2f5e44ff8f), UINT64_C(0xd433179d9c8cb841),
+    UINT64_C(0x9e19db92b4e31ba9), UINT64_C(0xeb96bf6ebadf77d9),
+    UINT64_C(0xaf87023b9bf0ee6b)
+};
+
+static const int16_t  cork_cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954,
+    -927, -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635,
+    -608, -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316,
+    -289, -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30, 56,
+    83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348, 375, 402, 428, 455,
+    481, 508, 534, 561, 588, 614, 641, 667, 694, 720, 747, 774, 800, 827, 853,
+    880, 907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static struct cork_diy_fp
+cork_cached_power(int e, int *K)
+{
+    /* Find a power of ten whose product with a value with binary exponent e
+     * has a binary exponent in [-60, -32]. */
+    struct cork_diy_fp  result;
+    double  dk = (-61 - e) * 0.30102999566398114 + 347;
+    int  k = (int) dk;
+    unsigned int  index;
+    if (dk - k > 0.0) {
+        k++;
+    }
+    index = (unsigned int) ((k >> 3) + 1);
+    *K = -(-348 + (int) (index << 3));
+    result.f = cork_cached_powers_f[index];
+    result.e = cork_cached_powers_e[index];
+    return result;
+}
+
+static const uint32_t  cork_pow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static void
+cork_grisu_round(char *digits, int length, uint64_t delta, uint64_t rest,
+                 uint64_t ten_kappa, uint64_t wp_w)
+{
+    /* Move the last digit down for as long as that brings us closer to the
+     * actual value, while staying within the rounding interval. */
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w ||
+            wp_w - rest > rest + ten_kappa - wp_w)) {
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static void
+cork_grisu_digit_gen(struct cork_diy_fp W, struct cork_diy_fp Mp,
+                     uint64_t delta, char *digits, int *length, int *K)
+{
+    struct cork_diy_fp  one;
+    uint64_t  wp_w = Mp.f - W.f;
+    uint32_t  p1;
+    uint64_t  p2;
+    int  kappa;
+
+    one.f = UINT64_C(1) << -Mp.e;
+    one.e = Mp.e;
+    p1 = (uint32_t) (Mp.f >> -one.e);
+    p2 = Mp.f & (one.f - 1);
+    kappa = cork_u64_decimal_digits(p1);
+    *length = 0;
+
+    /* The integral part */
+    while (kappa > 0) {
+        uint32_t  d = p1 / cork_pow10[kappa - 1];
+        uint64_t  tmp;
+        p1 %= cork_pow10[kappa - 1];
+        if (d != 0 || *length != 0) {
+            digits[(*length)++] = '0' + d;
+        }
+        kappa--;
+        tmp = ((uint64_t) p1 << -one.e) + p2;
+        if (tmp <= delta) {
+            *K += kappa;
+            cork_grisu_round(digits, *length, delta, tmp,
+                             (uint64_t) cork_pow10[kappa] << -one.e, wp_w);
+            return;
+        }
+    }
+
+    /* The fractional part */
+    while (true) {
+        char  d;
+        p2 *= 10;
+        delta *= 10;
+        d = (char) (p2 >> -one.e);
+        if (d != 0 || *length != 0) {
+            digits[(*length)++] = '0' + d;
+        }
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *K += kappa;
+            cork_grisu_round(digits, *length, delta, p2, one.f,
+                             wp_w * ((-kappa < 10)? cork_pow10[-kappa]: 0));
+            return;
+        }
+    }
+}
+
+/* Fills in the shortest digits for a positive, finite v, along with the
+ * decimal exponent K, so that v == digits * 10^K. */
+static void
+cork_grisu2(uint64_t bits, char *digits, int *length, int *K)
+{
+    struct cork_diy_fp  v = cork_diy_fp_from_double(bits);
+    struct cork_diy_fp  w_m;
+    struct cork_diy_fp  w_p;
+    struct cork_diy_fp  c_mk;
+    struct cork_diy_fp  W;
+    struct cork_diy_fp  Wp;
+    struct cork_diy_fp  Wm;
+    cork_diy_fp_boundaries(v, &w_m, &w_p);
+    c_mk = cork_cached_power(w_p.e, K);
+    W = cork_diy_fp_multiply(cork_diy_fp_normalize(v), c_mk);
+    Wp = cork_diy_fp_multiply(w_p, c_mk);
+    Wm = cork_diy_fp_multiply(w_m, c_mk);
+    Wm.f++;
+    Wp.f--;
+    cork_grisu_digit_gen(W, Wp, Wp.f - Wm.f, digits, length, K);
+}
+
+/* Lays out the digits from cork_grisu2 the same way that JavaScript does,
+ * using decimal notation for values in [1e-6, 1e21) and scientific notation
+ * otherwise.  Returns the length of the result. */
+static int
+cork_double_prettify(char *dest, const char *digits, int length, int k)
+{
+    /* The position of the decimal point, relative to the first digit */
+    int  kk = length + k;
+    char  *curr = dest;
+
+    if (k >= 0 && kk <= 21) {
+        /* An integer: 1234e7 -> 12340000000 */
+        memcpy(curr, digits, length);
+        memset(curr + length, '0', k);
+        return kk;
+    } else if (kk > 0 && kk <= 21) {
+        /* 1234e-2 -> 12.34 */
+        memcpy(curr, digits, kk);
+        curr[kk] = '.';
+        memcpy(curr + kk + 1, digits + kk, length - kk);
+        return length + 1;
+    } else if (kk > -6 && kk <= 0) {
+        /* 1234e-6 -> 0.001234 */
+        int  offset = 2 - kk;
+        curr[0] = '0';
+        curr[1] = '.';
+        memset(curr + 2, '0', offset - 2);
+        memcpy(curr + offset, digits, length);
+        return length + offset;
+    } else {
+        /* 1234e30 -> 1.234e+33 */
+        int  exponent = kk - 1;
+        *curr++ = digits[0];
+        if (length > 1) {
+            *curr++ = '.';
+            memcpy(curr, digits + 1, length - 1);
+            curr += length - 1;
+        }
+        *curr++ = 'e';
+        if (exponent < 0) {
+            *curr++ = '-';
+            exponent = -exponent;
+        } else {
+            *curr++ = '+';
+        }
+        curr += cork_u64_decimal_digits(exponent);
+        cork_u64_write_decimal(curr, exponent);
+        return curr - dest;
+    }
+}
+
+/* The longest result is a sign, "0.00000", and 17 digits. */
+#define CORK_DOUBLE_STRING_LENGTH  32
+
+void
+cork_buffer_append_double(struct cork_buffer *buffer, double value)
+{
+    union { double  d; uint64_t  u64; }  bits;
+    char  digits[24];
+    int  length;
+    int  K;
+    char  *dest;
+
+    bits.d = value;
+    if ((bits.u64 & CORK_DOUBLE_EXPONENT_MASK) == CORK_DOUBLE_EXPONENT_MASK) {
+        if ((bits.u64 & CORK_DOUBLE_SIGNIFICAND_MASK) != 0) {
+            cork_buffer_append_literal(buffer, "nan");
+        } else if (value < 0) {
+            cork_buffer_append_literal(buffer, "-inf");
+        } else {
+            cork_buffer_append_literal(buffer, "inf");
+        }
+        return;
+    }
+
+    cork_buffer_ensure_size_int
+        (buffer, buffer->size + CORK_DOUBLE_STRING_LENGTH + 1);
+    dest = buffer->buf + buffer->size;
+    if (bits.u64 >> 63) {
+        *dest++ = '-';
+        bits.u64 &= ~(UINT64_C(1) << 63);
+    }
+    if (bits.u64 == 0) {
+        *dest++ = '0';
+    } else {
+        cork_grisu2(bits.u64, digits, &length, &K);
+        dest += cork_double_prettify(dest, digits, length, K);
+    }
+    buffer->size = dest - (char *) buffer->buf;
+    *dest = '\0';
+}
+
+
+
+/*-----------------------------------------------------------------------
+ * Binary values
+ */
+
+#define cork_buffer_define_append_int(bits, name) \
+void \
+cork_buffer_append_##name##bits(struct cork_buffer *buffer, \
+                                uint##bits##_t value) \
+{ \
+    void  *dest = cork_buffer_reserve(buffer, bits / 8); \
+    cork_store_##name##bits(dest, value); \
+    cork_buffer_commit(buffer, bits / 8); \
+}
+
+cork_buffer_define_append_int(16, be)
+cork_buffer_define_append_int(32, be)
+cork_buffer_define_append_int(64, be)
+cork_buffer_define_append_int(16, le)
+cork_buffer_define_append_int(32, le)
+cork_buffer_define_append_int(64, le)
+
+void
+cork_buffer_append_varint(struct cork_buffer *buffer, uint64_t value)
+{
+    uint8_t  *start = cork_buffer_reserve(buffer, 10);
+    uint8_t  *dest = start;
+    while (value >= 0x80) {
+        *dest++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    *dest++ = (uint8_t) value;
+    cork_buffer_commit(buffer, dest - start);
+}
+
+void
+cork_buffer_append_prefixed_varint(struct cork_buffer *buffer,
+                                   const void *src, size_t length)
+{
+    cork_buffer_append_varint(buffer, length);
+    cork_buffer_append(buffer, src, length);
+}
+
+
 struct cork_buffer__managed_buffer {
     struct cork_managed_buffer  parent;
     struct cork_buffer  *buffer;
@@ -390,8 +1075,20 @@ cork_buffer__managed_free(struct cork_managed_buffer *vself)
     cork_delete(struct cork_buffer__managed_buffer, self);
 }
 
+static void
+cork_buffer__managed_steal(struct cork_managed_buffer *vself,
+                           struct cork_buffer *dest)
+{
+    struct cork_buffer__managed_buffer  *self =
+        cork_container_of(vself, struct cork_buffer__managed_buffer, parent);
+    *dest = *self->buffer;
+    cork_delete(struct cork_buffer, self->buffer);
+    cork_delete(struct cork_buffer__managed_buffer, self);
+}
+
 static struct cork_managed_buffer_iface  CORK_BUFFER__MANAGED_BUFFER = {
-    cork_buffer__managed_free
+    cork_buffer__managed_free,
+    cork_buffer__managed_steal
 };
 
 struct cork_managed_buffer *
@@ -427,19 +1124,80 @@ cork_buffer_to_slice(struct cork_buffer *buffer, struct cork_slice *slice)
 }
 
 
+bool
+cork_buffer_from_managed_buffer(struct cork_buffer *dest,
+                                struct cork_managed_buffer *src)
+{
+    if (!cork_managed_buffer_is_shared(src) && src->iface->steal != NULL) {
+        cork_buffer_done(dest);
+        src->iface->steal(src, dest);
+        return true;
+    }
+
+    cork_buffer_set(dest, src->buf, src->size);
+    cork_managed_buffer_unref(src);
+    return false;
+}
+
+
+bool
+cork_buffer_from_slice(struct cork_buffer *dest, struct cork_slice *src)
+{
+    struct cork_managed_buffer  *managed = cork_slice_get_managed_buffer(src);
+
+    /* If the slice holds the only reference to a buffer that we can take
+     * over, then we just have to move the sliced part to the front.  (A
+     * borrowed slice doesn't hold a reference at all.) */
+    if (managed != NULL && src->iface == &cork_slice__managed &&
+        !cork_managed_buffer_is_shared(managed) &&
+        managed->iface->steal != NULL) {
+        size_t  offset = src->buf - managed->buf;
+        size_t  size = src->size;
+        cork_buffer_done(dest);
+        managed->iface->steal(managed, dest);
+        cork_slice_clear(src);
+        if (offset > 0) {
+            memmove(dest->buf, dest->buf + offset, size);
+        }
+        if (dest->buf != NULL) {
+            dest->size = size;
+            ((char *) dest->buf)[size] = '\0';
+        }
+        return true;
+    }
+
+    cork_buffer_set(dest, src->buf, src->size);
+    cork_slice_finish(src);
+    return false;
+}
+
+
 struct cork_buffer__stream_consumer {
     struct cork_stream_consumer  consumer;
     struct cork_buffer  *buffer;
 };
 
 static int
-cork_buffer_stream_consumer_data(struct cork_stream_consumer *consumer,
-                                 const void *buf, size_t size,
-                                 bool is_first_chunk)
+cork_buffer_stream_consumer_data_vec(struct cork_stream_consumer *consumer,
+                                     const struct cork_slice *slices,
+                                     size_t count, bool is_first_chunk)
 {
     struct cork_buffer__stream_consumer  *bconsumer = cork_container_of
         (consumer, struct cork_buffer__stream_consumer, consumer);
-    cork_buffer_append(bconsumer->buffer, buf, size);
+    struct cork_buffer  *buffer = bconsumer->buffer;
+    size_t  total = 0;
+    size_t  i;
+    char  *dest;
+
+    for (i = 0; i < count; i++) {
+        total += slices[i].size;
+    }
+    dest = cork_buffer_reserve(buffer, total);
+    for (i = 0; i < count; i++) {
+        memcpy(dest, slices[i].buf, slices[i].size);
+        dest += slices[i].size;
+    }
+    cork_buffer_commit(buffer, total);
     return 0;
 }
 
@@ -463,7 +1221,8 @@ cork_buffer_to_stream_consumer(struct cork_buffer *buffer)
 {
     struct cork_buffer__stream_consumer  *bconsumer =
         cork_new(struct cork_buffer__stream_consumer);
-    bconsumer->consumer.data = cork_buffer_stream_consumer_data;
+    bconsumer->consumer.data = cork_stream_consumer_data_via_vec;
+    bconsumer->consumer.data_vec = cork_buffer_stream_consumer_data_vec;
     bconsumer->consumer.eof = cork_buffer_stream_consumer_eof;
     bconsumer->consumer.free = cork_buffer_stream_consumer_free;
     bconsumer->buffer = buffer;
@@ -0,0 +1,683 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/attributes.h"
+#include "libcork/core/callbacks.h"
+#include "libcork/core/hash.h"
+#include "libcork/core/timestamp.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/cache.h"
+#include "libcork/ds/hash-table.h"
+#include "libcork/threads/locks.h"
+
+
+/*-----------------------------------------------------------------------
+ * Bounded caches
+ */
+
+struct cork_cache_entry {
+    void  *key;
+    void  *value;
+    cork_hash64  hash;
+    /* 0 if the entry never expires */
+    cork_timestamp  expires;
+    bool  in_use;
+    bool  referenced;
+    /* Links together the unused entries */
+    struct cork_cache_entry  *next_free;
+};
+
+struct cork_cache {
+    /* Maps each key to its cork_cache_entry.  We always hand the index a
+     * precomputed hash, so it doesn't need to know our hash functions. */
+    struct cork_hash_table  *index;
+    struct cork_cache_entry  *entries;
+    struct cork_cache_entry  *free_list;
+    size_t  capacity;
+    size_t  size;
+    /* The next entry that the clock hand will look at */
+    size_t  hand;
+    void  *user_data;
+    cork_free_f  free_user_data;
+    cork_hash_f  hash;
+    /* If this isn't NULL, it overrides `hash`. */
+    cork_hash64_f  hash64;
+    cork_cache_evict_f  evict;
+    cork_cache_clock_f  clock;
+    struct cork_cache_stats  stats;
+};
+
+static cork_hash
+cork_cache__default_hash(void *user_data, const void *key)
+{
+    return cork_fast_hash_u64(0, (uint64_t) (uintptr_t) key);
+}
+
+static void
+cork_cache__default_clock(void *user_data, cork_timestamp *now)
+{
+    cork_timestamp_init_monotonic_coarse(now);
+}
+
+static inline cork_hash64
+cork_cache_hash_key(const struct cork_cache *cache, const void *key)
+{
+    if (cache->hash64 != NULL) {
+        return cache->hash64(cache->user_data, key);
+    } else {
+        cork_hash  hash = cache->hash(cache->user_data, key);
+        return ((cork_hash64) hash << 32) | hash;
+    }
+}
+
+static void
+cork_cache_init_free_list(struct cork_cache *cache)
+{
+    size_t  i;
+    /* Hand out the entries in order, so that a cache that never fills up
+     * stays compact. */
+    cache->free_list = NULL;
+    for (i = cache->capacity; i > 0; i--) {
+        struct cork_cache_entry  *entry = &cache->entries[i - 1];
+        entry->in_use = false;
+        entry->next_free = cache->free_list;
+        cache->free_list = entry;
+    }
+}
+
+struct cork_cache *
+cork_cache_new(size_t capacity)
+{
+    struct cork_cache  *cache = cork_new(struct cork_cache);
+    assert(capacity > 0);
+    cache->index = cork_hash_table_new
+        (capacity, CORK_HASH_TABLE_POOLED_ENTRIES);
+    cache->entries = cork_calloc(capacity, sizeof(struct cork_cache_entry));
+    cache->capacity = capacity;
+    cache->size = 0;
+    cache->hand = 0;
+    cache->user_data = NULL;
+    cache->free_user_data = NULL;
+    cache->hash = cork_cache__default_hash;
+    cache->hash64 = NULL;
+    cache->evict = NULL;
+    cache->clock = cork_cache__default_clock;
+    memset(&cache->stats, 0, sizeof(struct cork_cache_stats));
+    cork_cache_init_free_list(cache);
+    return cache;
+}
+
+void
+cork_cache_free(struct cork_cache *cache)
+{
+    cork_cache_clear(cache);
+    cork_hash_table_free(cache->index);
+    cork_cfree(cache->entries, cache->capacity,
+               sizeof(struct cork_cache_entry));
+    if (cache->free_user_data != NULL) {
+        cache->free_user_data(cache->user_data);
+    }
+    cork_delete(struct cork_cache, cache);
+}
+
+void
+cork_cache_set_user_data(struct cork_cache *cache,
+                         void *user_data, cork_free_f free_user_data)
+{
+    cache->user_data = user_data;
+    cache->free_user_data = free_user_data;
+    cork_hash_table_set_user_data(cache->index, user_data, NULL);
+}
+
+void
+cork_cache_set_equals(struct cork_cache *cache, cork_equals_f equals)
+{
+    cork_hash_table_set_equals(cache->index, equals);
+}
+
+void
+cork_cache_set_hash(struct cork_cache *cache, cork_hash_f hash)
+{
+    cache->hash = hash;
+    cache->hash64 = NULL;
+}
+
+void
+cork_cache_set_hash64(struct cork_cache *cache, cork_hash64_f hash)
+{
+    cache->hash64 = hash;
+}
+
+void
+cork_cache_set_evict(struct cork_cache *cache, cork_cache_evict_f evict)
+{
+    cache->evict = evict;
+}
+
+void
+cork_cache_set_clock(struct cork_cache *cache, cork_cache_clock_f clock)
+{
+    cache->clock = clock;
+}
+
+
+size_t
+cork_cache_size(const struct cork_cache *cache)
+{
+    return cache->size;
+}
+
+size_t
+cork_cache_capacity(const struct cork_cache *cache)
+{
+    return cache->capacity;
+}
+
+static inline bool
+cork_cache_entry_is_expired(struct cork_cache *cache,
+                            struct cork_cache_entry *entry,
+                            cork_timestamp *now)
+{
+    if (entry->expires == 0) {
+        return false;
+    }
+    /* Only ask for the time once per operation, and only if some entry
+     * actually has a time-to-live. */
+    if (*now == 0) {
+        cache->clock(cache->user_data, now);
+    }
+    return *now >= entry->expires;
+}
+
+/* Hands the entry's key and value to the evict callback and returns the entry
+ * to the free list.  The caller is responsible for removing it from the index
+ * first. */
+static void
+cork_cache_release_entry(struct cork_cache *cache,
+                         struct cork_cache_entry *entry,
+                         enum cork_cache_evict_reason reason)
+{
+    void  *key = entry->key;
+    void  *value = entry->value;
+    entry->in_use = false;
+    entry->key = NULL;
+    entry->value = NULL;
+    entry->next_free = cache->free_list;
+    cache->free_list = entry;
+    cache->size--;
+    if (cache->evict != NULL) {
+        cache->evict(cache->user_data, key, value, reason);
+    }
+}
+
+static void
+cork_cache_remove_entry(struct cork_cache *cache,
+                        struct cork_cache_entry *entry,
+                        enum cork_cache_evict_reason reason)
+{
+    cork_hash_table_delete_hash64
+        (cache->index, entry->hash, entry->key, NULL, NULL);
+    cork_cache_release_entry(cache, entry, reason);
+}
+
+/* Sweeps the clock hand around until it finds an entry to evict.  Every
+ * entry is in use whenever we need to do this, and the hand clears each
+ * referenced bit that it passes, so this makes at most two passes. */
+static void
+cork_cache_evict_one(struct cork_cache *cache, cork_timestamp *now)
+{
+    for (;;) {
+        struct cork_cache_entry  *entry = &cache->entries[cache->hand];
+        if (++cache->hand == cache->capacity) {
+            cache->hand = 0;
+        }
+        if (cork_cache_entry_is_expired(cache, entry, now)) {
+            cache->stats.expirations++;
+            cork_cache_remove_entry(cache, entry, CORK_CACHE_EXPIRED);
+            return;
+        } else if (entry->referenced) {
+            entry->referenced = false;
+        } else {
+            cache->stats.evictions++;
+            cork_cache_remove_entry(cache, entry, CORK_CACHE_EVICTED);
+            return;
+        }
+    }
+}
+
+void *
+cork_cache_get_hash64(struct cork_cache *cache, cork_hash64 hash,
+                      const void *key)
+{
+    struct cork_cache_entry  *entry;
+    cork_timestamp  now = 0;
+
+    entry = cork_hash_table_get_hash64(cache->index, hash, key);
+    if (CORK_UNLIKELY(entry == NULL)) {
+        cache->stats.misses++;
+        return NULL;
+    }
+    if (CORK_UNLIKELY(cork_cache_entry_is_expired(cache, entry, &now))) {
+        cache->stats.misses++;
+        cache->stats.expirations++;
+        cork_cache_remove_entry(cache, entry, CORK_CACHE_EXPIRED);
+        return NULL;
+    }
+    cache->stats.hits++;
+    entry->referenced = true;
+    return entry->value;
+}
+
+void *
+cork_cache_get(struct cork_cache *cache, const void *key)
+{
+    cork_hash64  hash = cork_cache_hash_key(cache, key);
+    return cork_cache_get_hash64(cache, hash, key);
+}
+
+void
+cork_cache_put_hash64(struct cork_cache *cache, cork_hash64 hash,
+                      void *key, void *value, cork_timestamp ttl)
+{
+    struct cork_cache_entry  *entry;
+    cork_timestamp  now = 0;
+
+    entry = cork_hash_table_get_hash64(cache->index, hash, key);
+    if (entry != NULL) {
+        void  *old_key = entry->key;
+        void  *old_value = entry->value;
+        /* The index entry still points at the old key, so replace it too. */
+        cork_hash_table_put_hash64
+            (cache->index, hash, key, entry, NULL, NULL, NULL);
+        entry->key = key;
+        entry->value = value;
+        entry->referenced = true;
+        if (cache->evict != NULL) {
+            cache->evict(cache->user_data, old_key, old_value,
+                         CORK_CACHE_REPLACED);
+        }
+    } else {
+        if (cache->size == cache->capacity) {
+            cork_cache_evict_one(cache, &now);
+        }
+        entry = cache->free_list;
+        cache->free_list = entry->next_free;
+        cache->size++;
+        entry->key = key;
+        entry->value = value;
+        entry->hash = hash;
+        entry->in_use = true;
+        /* New entries start out unreferenced, so that a burst of one-off
+         * keys can't push out entries that are actually being reused. */
+        entry->referenced = false;
+        cork_hash_table_put_hash64
+            (cache->index, hash, key, entry, NULL, NULL, NULL);
+    }
+
+    if (ttl == 0) {
+        entry->expires = 0;
+    } else {
+        if (now == 0) {
+            cache->clock(cache->user_data, &now);
+        }
+        entry->expires = now + ttl;
+    }
+}
+
+void
+cork_cache_put(struct cork_cache *cache, void *key, void *value,
+               cork_timestamp ttl)
+{
+    cork_hash64  hash = cork_cache_hash_key(cache, key);
+    cork_cache_put_hash64(cache, hash, key, value, ttl);
+}
+
+bool
+cork_cache_delete_hash64(struct cork_cache *cache, cork_hash64 hash,
+                         const void *key)
+{
+    void  *entry;
+    if (!cork_hash_table_delete_hash64
+        (cache->index, hash, key, NULL, &entry)) {
+        return false;
+    }
+    cork_cache_release_entry(cache, entry, CORK_CACHE_DELETED);
+    return true;
+}
+
+bool
+cork_cache_delete(struct cork_cache *cache, const void *key)
+{
+    cork_hash64  hash = cork_cache_hash_key(cache, key);
+    return cork_cache_delete_hash64(cache, hash, key);
+}
+
+void
+cork_cache_clear(struct cork_cache *cache)
+{
+    size_t  i;
+    cork_hash_table_clear(cache->index);
+    if (cache->evict != NULL) {
+        for (i = 0; i < cache->capacity; i++) {
+            struct cork_cache_entry  *entry = &cache->entries[i];
+            if (entry->in_use) {
+                cache->evict(cache->user_data, entry->key, entry->value,
+                             CORK_CACHE_DELETED);
+            }
+        }
+    }
+    cache->size = 0;
+    cache->hand = 0;
+    cork_cache_init_free_list(cache);
+}
+
+size_t
+cork_cache_remove_expired(struct cork_cache *cache)
+{
+    cork_timestamp  now = 0;
+    size_t  count = 0;
+    size_t  i;
+    for (i = 0; i < cache->capacity; i++) {
+        struct cork_cache_entry  *entry = &cache->entries[i];
+        if (entry->in_use && cork_cache_entry_is_expired(cache, entry, &now)) {
+            cache->stats.expirations++;
+            cork_cache_remove_entry(cache, entry, CORK_CACHE_EXPIRED);
+            count++;
+        }
+    }
+    return count;
+}
+
+void
+cork_cache_get_stats(const struct cork_cache *cache,
+                     struct cork_cache_stats *stats)
+{
+    *stats = cache->stats;
+}
+
+void
+cork_cache_reset_stats(struct cork_cache *cache)
+{
+    memset(&cache->stats, 0, sizeof(struct cork_cache_stats));
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sharded caches
+ */
+
+struct cork_sharded_cache_shard {
+    struct cork_mutex  lock;
+    struct cork_cache  *cache;
+    CORK_CACHELINE_PAD(pad, sizeof(struct cork_mutex) +
+                            sizeof(struct cork_cache *));
+};
+
+struct cork_sharded_cache {
+    struct cork_sharded_cache_shard  *shards;
+    size_t  shard_count;
+    /* log2 of shard_count */
+    unsigned int  shard_bits;
+    size_t  capacity;
+    void  *user_data;
+    cork_free_f  free_user_data;
+    cork_hash_f  hash;
+    cork_hash64_f  hash64;
+};
+
+static inline cork_hash64
+cork_sharded_cache_hash_key(const struct cork_sharded_cache *cache,
+                            const void *key)
+{
+    if (cache->hash64 != NULL) {
+        return cache->hash64(cache->user_data, key);
+    } else {
+        cork_hash  hash = cache->hash(cache->user_data, key);
+        return ((cork_hash64) hash << 32) | hash;
+    }
+}
+
+/* Shifting in two steps avoids an undefined 64-bit shift when there's only
+ * one shard. */
+static inline struct cork_sharded_cache_shard *
+cork_sharded_cache_shard(const struct cork_sharded_cache *cache,
+                         cork_hash64 hash)
+{
+    return &cache->shards[(hash >> (63 - cache->shard_bits)) >> 1];
+}
+
+struct cork_sharded_cache *
+cork_sharded_cache_new(size_t shard_count, size_t capacity)
+{
+    struct cork_sharded_cache  *cache = cork_new(struct cork_sharded_cache);
+    size_t  shard_capacity;
+    size_t  i;
+
+    if (shard_count == 0) {
+        shard_count = CORK_SHARDED_CACHE_DEFAULT_SHARD_COUNT;
+    }
+    cache->shard_count = 1;
+    cache->shard_bits = 0;
+    while (cache->shard_count < shard_count) {
+        cache->shard_count <<= 1;
+        cache->shard_bits++;
+    }
+
+    /* Round up, so that every shard can hold at least one entry. */
+    shard_capacity = (capacity + cache->shard_count - 1) / cache->shard_count;
+    if (shard_capacity == 0) {
+        shard_capacity = 1;
+    }
+    cache->capacity = shard_capacity * cache->shard_count;
+    cache->shards = cork_calloc
+        (cache->shard_count, sizeof(struct cork_sharded_cache_shard));
+    for (i = 0; i < cache->shard_count; i++) {
+        cork_mutex_init(&cache->shards[i].lock);
+        cache->shards[i].cache = cork_cache_new(shard_capacity);
+    }
+
+    cache->user_data = NULL;
+    cache->free_user_data = NULL;
+    cache->hash = cork_cache__default_hash;
+    cache->hash64 = NULL;
+    return cache;
+}
+
+void
+cork_sharded_cache_free(struct cork_sharded_cache *cache)
+{
+    size_t  i;
+    for (i = 0; i < cache->shard_count; i++) {
+        cork_cache_free(cache->shards[i].cache);
+        cork_mutex_done(&cache->shards[i].lock);
+    }
+    cork_cfree(cache->shards, cache->shard_count,
+               sizeof(struct cork_sharded_cache_shard));
+    if (cache->free_user_data != NULL) {
+        cache->free_user_data(cache->user_data);
+    }
+    cork_delete(struct cork_sharded_cache, cache);
+}
+
+void
+cork_sharded_cache_set_user_data(struct cork_sharded_cache *cache,
+                                 void *user_data, cork_free_f free_user_data)
+{
+    size_t  i;
+    cache->user_data = user_data;
+    cache->free_user_data = free_user_data;
+    for (i = 0; i < cache->shard_count; i++) {
+        cork_cache_set_user_data(cache->shards[i].cache, user_data, NULL);
+    }
+}
+
+void
+cork_sharded_cache_set_equals(struct cork_sharded_cache *cache,
+                              cork_equals_f equals)
+{
+    size_t  i;
+    for (i = 0; i < cache->shard_count; i++) {
+        cork_cache_set_equals(cache->shards[i].cache, equals);
+    }
+}
+
+void
+cork_sharded_cache_set_hash(struct cork_sharded_cache *cache,
+                            cork_hash_f hash)
+{
+    cache->hash = hash;
+    cache->hash64 = NULL;
+}
+
+void
+cork_sharded_cache_set_hash64(struct cork_sharded_cache *cache,
+                              cork_hash64_f hash)
+{
+    cache->hash64 = hash;
+}
+
+void
+cork_sharded_cache_set_evict(struct cork_sharded_cache *cache,
+                             cork_cache_evict_f evict)
+{
+    size_t  i;
+    for (i = 0; i < cache->shard_count; i++) {
+        cork_cache_set_evict(cache->shards[i].cache, evict);
+    }
+}
+
+void
+cork_sharded_cache_set_clock(struct cork_sharded_cache *cache,
+                             cork_cache_clock_f clock)
+{
+    size_t  i;
+    for (i = 0; i < cache->shard_count; i++) {
+        cork_cache_set_clock(cache->shards[i].cache, clock);
+    }
+}
+
+
+size_t
+cork_sharded_cache_size(struct cork_sharded_cache *cache)
+{
+    size_t  size = 0;
+    size_t  i;
+    for (i = 0; i < cache->shard_count; i++) {
+        struct cork_sharded_cache_shard  *shard = &cache->shards[i];
+        cork_mutex_lock(&shard->lock);
+        size += cork_cache_size(shard->cache);
+        cork_mutex_unlock(&shard->lock);
+    }
+    return size;
+}
+
+size_t
+cork_sharded_cache_capacity(struct cork_sharded_cache *cache)
+{
+    return cache->capacity;
+}
+
+void *
+cork_sharded_cache_get(struct cork_sharded_cache *cache, const void *key)
+{
+    cork_hash64  hash = cork_sharded_cache_hash_key(cache, key);
+    struct cork_sharded_cache_shard  *shard =
+        cork_sharded_cache_shard(cache, hash);
+    void  *value;
+    cork_mutex_lock(&shard->lock);
+    value = cork_cache_get_hash64(shard->cache, hash, key);
+    cork_mutex_unlock(&shard->lock);
+    return value;
+}
+
+void
+cork_sharded_cache_put(struct cork_sharded_cache *cache,
+                       void *key, void *value, cork_timestamp ttl)
+{
+    cork_hash64  hash = cork_sharded_cache_hash_key(cache, key);
+    struct cork_sharded_cache_shard  *shard =
+        cork_sharded_cache_shard(cache, hash);
+    cork_mutex_lock(&shard->lock);
+    cork_cache_put_hash64(shard->cache, hash, key, value, ttl);
+    cork_mutex_unlock(&shard->lock);
+}
+
+bool
+cork_sharded_cache_delete(struct cork_sharded_cache *cache, const void *key)
+{
+    cork_hash64  hash = cork_sharded_cache_hash_key(cache, key);
+    struct cork_sharded_cache_shard  *shard =
+        cork_sharded_cache_shard(cache, hash);
+    bool  result;
+    cork_mutex_lock(&shard->lock);
+    result = cork_cache_delete_hash64(shard->cache, hash, key);
+    cork_mutex_unlock(&shard->lock);
+    return result;
+}
+
+void
+cork_sharded_cache_clear(struct cork_sharded_cache *cache)
+{
+    size_t  i;
+    for (i = 0; i < cache->shard_count; i++) {
+        struct cork_sharded_cache_shard  *shard = &cache->shards[i];
+        cork_mutex_lock(&shard->lock);
+        cork_cache_clear(shard->cache);
+        cork_mutex_unlock(&shard->lock);
+    }
+}
+
+size_t
+cork_sharded_cache_remove_expired(struct cork_sharded_cache *cache)
+{
+    size_t  count = 0;
+    size_t  i;
+    for (i = 0; i < cache->shard_count; i++) {
+        struct cork_sharded_cache_shard  *shard = &cache->shards[i];
+        cork_mutex_lock(&shard->lock);
+        count += cork_cache_remove_expired(shard->cache);
+        cork_mutex_unlock(&shard->lock);
+    }
+    return count;
+}
+
+void
+cork_sharded_cache_get_stats(struct cork_sharded_cache *cache,
+                             struct cork_cache_stats *stats)
+{
+    size_t  i;
+    memset(stats, 0, sizeof(struct cork_cache_stats));
+    for (i = 0; i < cache->shard_count; i++) {
+        struct cork_sharded_cache_shard  *shard = &cache->shards[i];
+        struct cork_cache_stats  *shard_stats = &shard->cache->stats;
+        cork_mutex_lock(&shard->lock);
+        stats->hits += shard_stats->hits;
+        stats->misses += shard_stats->misses;
+        stats->evictions += shard_stats->evictions;
+        stats->expirations += shard_stats->expirations;
+        cork_mutex_unlock(&shard->lock);
+    }
+}
+
+void
+cork_sharded_cache_reset_stats(struct cork_sharded_cache *cache)
+{
+    size_t  i;
+    for (i = 0; i < cache->shard_count; i++) {
+        struct cork_sharded_cache_shard  *shard = &cache->shards[i];
+        cork_mutex_lock(&shard->lock);
+        cork_cache_reset_stats(shard->cache);
+        cork_mutex_unlock(&shard->lock);
+    }
+}
@@ -0,0 +1,436 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2011-2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/buffer.h"
+#include "libcork/ds/chunked-buffer.h"
+#include "libcork/ds/stream.h"
+#include "libcork/helpers/errors.h"
+
+
+/* The contents of each chunk immediately follow its header. */
+struct cork_chunked_buffer_chunk {
+    struct cork_chunked_buffer_chunk  *next;
+    /* The number of bytes of content in this chunk */
+    size_t  size;
+    /* The number of bytes of content that this chunk can hold */
+    size_t  allocated_size;
+};
+
+#define cork_chunked_buffer_chunk_data(chunk) \
+    ((char *) ((chunk) + 1))
+
+#define cork_chunked_buffer_chunk_avail(chunk) \
+    ((chunk)->allocated_size - (chunk)->size)
+
+
+void
+cork_chunked_buffer_init(struct cork_chunked_buffer *buffer)
+{
+    buffer->head = NULL;
+    buffer->tail = NULL;
+    buffer->size = 0;
+    buffer->chunk_count = 0;
+    buffer->chunk_size = CORK_CHUNKED_BUFFER_DEFAULT_CHUNK_SIZE;
+}
+
+struct cork_chunked_buffer *
+cork_chunked_buffer_new(void)
+{
+    struct cork_chunked_buffer  *buffer = cork_new(struct cork_chunked_buffer);
+    cork_chunked_buffer_init(buffer);
+    return buffer;
+}
+
+void
+cork_chunked_buffer_done(struct cork_chunked_buffer *buffer)
+{
+    cork_chunked_buffer_clear(buffer);
+}
+
+void
+cork_chunked_buffer_free(struct cork_chunked_buffer *buffer)
+{
+    cork_chunked_buffer_done(buffer);
+    cork_delete(struct cork_chunked_buffer, buffer);
+}
+
+void
+cork_chunked_buffer_set_chunk_size(struct cork_chunked_buffer *buffer,
+                                   size_t chunk_size)
+{
+    buffer->chunk_size = (chunk_size == 0)?
+        CORK_CHUNKED_BUFFER_DEFAULT_CHUNK_SIZE: chunk_size;
+}
+
+void
+cork_chunked_buffer_clear(struct cork_chunked_buffer *buffer)
+{
+    struct cork_chunked_buffer_chunk  *curr;
+    struct cork_chunked_buffer_chunk  *next;
+    for (curr = buffer->head; curr != NULL; curr = next) {
+        next = curr->next;
+        cork_free(curr, sizeof(struct cork_chunked_buffer_chunk) +
+                  curr->allocated_size);
+    }
+    buffer->head = NULL;
+    buffer->tail = NULL;
+    buffer->size = 0;
+    buffer->chunk_count = 0;
+}
+
+
+bool
+cork_chunked_buffer_equal(const struct cork_chunked_buffer *buffer1,
+                          const struct cork_chunked_buffer *buffer2)
+{
+    struct cork_chunked_buffer_chunk  *chunk1;
+    struct cork_chunked_buffer_chunk  *chunk2;
+    size_t  offset1 = 0;
+    size_t  offset2 = 0;
+
+    if (buffer1 == buffer2) {
+        return true;
+    }
+
+    if (buffer1->size != buffer2->size) {
+        return false;
+    }
+
+    /* The two buffers might split their contents into chunks differently, so
+     * compare them in runs that don't cross a chunk boundary in either. */
+    chunk1 = buffer1->head;
+    chunk2 = buffer2->head;
+    while (chunk1 != NULL && chunk2 != NULL) {
+        size_t  avail1 = chunk1->size - offset1;
+        size_t  avail2 = chunk2->size - offset2;
+        size_t  length = (avail1 < avail2)? avail1: avail2;
+        if (memcmp(cork_chunked_buffer_chunk_data(chunk1) + offset1,
+                   cork_chunked_buffer_chunk_data(chunk2) + offset2,
+                   length) != 0) {
+            return false;
+        }
+
+        offset1 += length;
+        if (offset1 == chunk1->size) {
+            chunk1 = chunk1->next;
+            offset1 = 0;
+        }
+        offset2 += length;
+        if (offset2 == chunk2->size) {
+            chunk2 = chunk2->next;
+            offset2 = 0;
+        }
+    }
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Adding data
+ */
+
+/* Add a new chunk to the end of the buffer that can hold at least
+ * min_size bytes. */
+static struct cork_chunked_buffer_chunk *
+cork_chunked_buffer_add_chunk(struct cork_chunked_buffer *buffer,
+                              size_t min_size)
+{
+    struct cork_chunked_buffer_chunk  *chunk;
+    size_t  allocated_size =
+        (min_size > buffer->chunk_size)? min_size: buffer->chunk_size;
+    chunk = cork_malloc(sizeof(struct cork_chunked_buffer_chunk) +
+                        allocated_size);
+    chunk->next = NULL;
+    chunk->size = 0;
+    chunk->allocated_size = allocated_size;
+    if (buffer->tail == NULL) {
+        buffer->head = chunk;
+    } else {
+        buffer->tail->next = chunk;
+    }
+    buffer->tail = chunk;
+    buffer->chunk_count++;
+    return chunk;
+}
+
+void
+cork_chunked_buffer_append(struct cork_chunked_buffer *buffer,
+                           const void *src, size_t length)
+{
+    struct cork_chunked_buffer_chunk  *chunk = buffer->tail;
+
+    /* Fill up whatever space is left in the last chunk, and then put
+     * everything else into a single new chunk.  Each byte is copied exactly
+     * once. */
+    if (chunk != NULL) {
+        size_t  avail = cork_chunked_buffer_chunk_avail(chunk);
+        size_t  to_copy = (length < avail)? length: avail;
+        memcpy(cork_chunked_buffer_chunk_data(chunk) + chunk->size,
+               src, to_copy);
+        chunk->size += to_copy;
+        buffer->size += to_copy;
+        src += to_copy;
+        length -= to_copy;
+    }
+
+    if (length > 0) {
+        chunk = cork_chunked_buffer_add_chunk(buffer, length);
+        memcpy(cork_chunked_buffer_chunk_data(chunk), src, length);
+        chunk->size = length;
+        buffer->size += length;
+    }
+}
+
+void
+cork_chunked_buffer_append_string(struct cork_chunked_buffer *buffer,
+                                  const char *str)
+{
+    cork_chunked_buffer_append(buffer, str, strlen(str));
+}
+
+void
+cork_chunked_buffer_append_vprintf(struct cork_chunked_buffer *buffer,
+                                   const char *format, va_list args)
+{
+    struct cork_chunked_buffer_chunk  *chunk = buffer->tail;
+    size_t  avail = (chunk == NULL)? 0: cork_chunked_buffer_chunk_avail(chunk);
+    size_t  format_size;
+    va_list  args1;
+
+    /* Try to format directly into the space left in the last chunk.  We
+     * don't keep chunks NUL-terminated, so vsnprintf can only use all but the
+     * last byte of that space. */
+    if (avail > 1) {
+        va_copy(args1, args);
+        format_size = vsnprintf
+            (cork_chunked_buffer_chunk_data(chunk) + chunk->size, avail,
+             format, args1);
+        va_end(args1);
+        if (format_size < avail) {
+            chunk->size += format_size;
+            buffer->size += format_size;
+            return;
+        }
+    } else {
+        va_copy(args1, args);
+        format_size = vsnprintf(NULL, 0, format, args1);
+        va_end(args1);
+    }
+
+    /* Otherwise format the whole result into a new chunk. */
+    chunk = cork_chunked_buffer_add_chunk(buffer, format_size + 1);
+    vsnprintf(cork_chunked_buffer_chunk_data(chunk), format_size + 1,
+              format, args);
+    chunk->size = format_size;
+    buffer->size += format_size;
+}
+
+void
+cork_chunked_buffer_append_printf(struct cork_chunked_buffer *buffer,
+                                  const char *format, ...)
+{
+    va_list  args;
+    va_start(args, format);
+    cork_chunked_buffer_append_vprintf(buffer, format, args);
+    va_end(args);
+}
+
+void
+cork_chunked_buffer_append_indent(struct cork_chunked_buffer *buffer,
+                                  size_t indent)
+{
+    while (indent > 0) {
+        struct cork_chunked_buffer_chunk  *chunk = buffer->tail;
+        size_t  avail;
+        size_t  to_fill;
+        if (chunk == NULL || cork_chunked_buffer_chunk_avail(chunk) == 0) {
+            chunk = cork_chunked_buffer_add_chunk(buffer, indent);
+        }
+        avail = cork_chunked_buffer_chunk_avail(chunk);
+        to_fill = (indent < avail)? indent: avail;
+        memset(cork_chunked_buffer_chunk_data(chunk) + chunk->size, ' ',
+               to_fill);
+        chunk->size += to_fill;
+        buffer->size += to_fill;
+        indent -= to_fill;
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Reading data
+ */
+
+void
+cork_chunked_buffer_iterator_init(const struct cork_chunked_buffer *buffer,
+                                  struct cork_chunked_buffer_iterator *iter)
+{
+    iter->curr = buffer->head;
+}
+
+bool
+cork_chunked_buffer_iterator_next(struct cork_chunked_buffer_iterator *iter,
+                                  struct cork_slice *dest)
+{
+    struct cork_chunked_buffer_chunk  *chunk = iter->curr;
+    if (chunk == NULL) {
+        return false;
+    }
+    cork_slice_init_static
+        (dest, cork_chunked_buffer_chunk_data(chunk), chunk->size);
+    iter->curr = chunk->next;
+    return true;
+}
+
+size_t
+cork_chunked_buffer_iterator_iovec(struct cork_chunked_buffer_iterator *iter,
+                                   struct iovec *iov, size_t count)
+{
+    size_t  i;
+    for (i = 0; i < count && iter->curr != NULL; i++) {
+        iov[i].iov_base = cork_chunked_buffer_chunk_data(iter->curr);
+        iov[i].iov_len = iter->curr->size;
+        iter->curr = iter->curr->next;
+    }
+    return i;
+}
+
+/* The number of iovecs that we pass to each writev call */
+#define CORK_CHUNKED_BUFFER_IOV_COUNT  64
+
+int
+cork_chunked_buffer_write_fd(const struct cork_chunked_buffer *buffer,
+                             int fd)
+{
+    struct cork_chunked_buffer_iterator  iter;
+    struct iovec  iov[CORK_CHUNKED_BUFFER_IOV_COUNT];
+    size_t  iov_count;
+
+    cork_chunked_buffer_iterator_init(buffer, &iter);
+    while ((iov_count = cork_chunked_buffer_iterator_iovec
+            (&iter, iov, CORK_CHUNKED_BUFFER_IOV_COUNT)) > 0) {
+        struct iovec  *curr = iov;
+        while (iov_count > 0) {
+            ssize_t  rc = writev(fd, curr, iov_count);
+            size_t  written;
+            if (rc == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                cork_system_error_set();
+                return -1;
+            }
+
+            /* Skip past whatever was written, which might end partway
+             * through one of the chunks. */
+            written = rc;
+            while (iov_count > 0 && written >= curr->iov_len) {
+                written -= curr->iov_len;
+                curr++;
+                iov_count--;
+            }
+            if (iov_count > 0) {
+                curr->iov_base = (char *) curr->iov_base + written;
+                curr->iov_len -= written;
+            }
+        }
+    }
+    return 0;
+}
+
+void
+cork_chunked_buffer_to_buffer(const struct cork_chunked_buffer *src,
+                              struct cork_buffer *dest)
+{
+    struct cork_chunked_buffer_chunk  *chunk;
+    cork_buffer_ensure_size(dest, dest->size + src->size + 1);
+    for (chunk = src->head; chunk != NULL; chunk = chunk->next) {
+        cork_buffer_append
+            (dest, cork_chunked_buffer_chunk_data(chunk), chunk->size);
+    }
+}
+
+int
+cork_chunked_buffer_to_consumer(const struct cork_chunked_buffer *buffer,
+                                struct cork_stream_consumer *consumer)
+{
+    struct cork_chunked_buffer_chunk  *chunk;
+    bool  first = true;
+    for (chunk = buffer->head; chunk != NULL; chunk = chunk->next) {
+        rii_check(cork_stream_consumer_data
+                  (consumer, cork_chunked_buffer_chunk_data(chunk),
+                   chunk->size, first));
+        first = false;
+    }
+    return cork_stream_consumer_eof(consumer);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Chunked buffer's stream consumer implementation
+ */
+
+struct cork_chunked_buffer__stream_consumer {
+    struct cork_stream_consumer  consumer;
+    struct cork_chunked_buffer  *buffer;
+};
+
+static int
+cork_chunked_buffer_stream_consumer_data_vec
+(struct cork_stream_consumer *consumer, const struct cork_slice *slices,
+ size_t count, bool is_first_chunk)
+{
+    struct cork_chunked_buffer__stream_consumer  *bconsumer =
+        cork_container_of
+        (consumer, struct cork_chunked_buffer__stream_consumer, consumer);
+    size_t  i;
+    for (i = 0; i < count; i++) {
+        cork_chunked_buffer_append
+            (bconsumer->buffer, slices[i].buf, slices[i].size);
+    }
+    return 0;
+}
+
+static int
+cork_chunked_buffer_stream_consumer_eof(struct cork_stream_consumer *consumer)
+{
+    return 0;
+}
+
+static void
+cork_chunked_buffer_stream_consumer_free(struct cork_stream_consumer *consumer)
+{
+    struct cork_chunked_buffer__stream_consumer  *bconsumer =
+        cork_container_of
+        (consumer, struct cork_chunked_buffer__stream_consumer, consumer);
+    cork_delete(struct cork_chunked_buffer__stream_consumer, bconsumer);
+}
+
+struct cork_stream_consumer *
+cork_chunked_buffer_to_stream_consumer(struct cork_chunked_buffer *buffer)
+{
+    struct cork_chunked_buffer__stream_consumer  *bconsumer =
+        cork_new(struct cork_chunked_buffer__stream_consumer);
+    bconsumer->consumer.data = cork_stream_consumer_data_via_vec;
+    bconsumer->consumer.data_vec =
+        cork_chunked_buffer_stream_consumer_data_vec;
+    bconsumer->consumer.eof = cork_chunked_buffer_stream_consumer_eof;
+    bconsumer->consumer.free = cork_chunked_buffer_stream_consumer_free;
+    bconsumer->buffer = buffer;
+    return &bconsumer->consumer;
+}
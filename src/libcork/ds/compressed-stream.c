@@ -0,0 +1,485 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2012-2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#if CORK_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#if CORK_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/error.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/compressed-stream.h"
+#include "libcork/ds/stream.h"
+#include "libcork/helpers/errors.h"
+
+
+/*-----------------------------------------------------------------------
+ * Shared helpers
+ */
+
+#if CORK_HAVE_ZSTD || CORK_HAVE_LZ4
+
+/* The state that every compressing and decompressing consumer needs: the
+ * consumer that we pass our output to, and an output buffer to fill in. */
+struct cork_codec_output {
+    struct cork_stream_consumer  *next;
+    bool  is_first_chunk;
+    void  *buf;
+    size_t  size;
+};
+
+static void
+cork_codec_output_init(struct cork_codec_output *output,
+                       struct cork_stream_consumer *next, size_t size)
+{
+    output->next = next;
+    output->is_first_chunk = true;
+    output->buf = cork_malloc(size);
+    output->size = size;
+}
+
+static void
+cork_codec_output_done(struct cork_codec_output *output)
+{
+    cork_free(output->buf, output->size);
+    cork_stream_consumer_free(output->next);
+}
+
+/* Pass the first size bytes of the output buffer on to the next consumer. */
+static int
+cork_codec_output_send(struct cork_codec_output *output, size_t size)
+{
+    if (size == 0) {
+        return 0;
+    }
+    rii_check(cork_stream_consumer_data
+              (output->next, output->buf, size, output->is_first_chunk));
+    output->is_first_chunk = false;
+    return 0;
+}
+
+#endif
+
+#define cork_codec_truncated_set(format) \
+    cork_error_set_printf \
+        (CORK_COMPRESSION_TRUNCATED, "Unexpected end of " format " stream")
+
+#define cork_codec_unsupported(next, format) \
+    do { \
+        cork_stream_consumer_free((next)); \
+        cork_error_set_printf \
+            (CORK_COMPRESSION_UNSUPPORTED, \
+             "libcork was built without " format " support"); \
+        return NULL; \
+    } while (0)
+
+
+/*-----------------------------------------------------------------------
+ * zstd
+ */
+
+#if CORK_HAVE_ZSTD
+
+static int
+cork_zstd_check(size_t rc)
+{
+    if (CORK_UNLIKELY(ZSTD_isError(rc))) {
+        cork_error_set_printf
+            (CORK_COMPRESSION_FAILED, "zstd error: %s", ZSTD_getErrorName(rc));
+        return -1;
+    }
+    return 0;
+}
+
+struct cork_zstd_compress_consumer {
+    struct cork_stream_consumer  parent;
+    struct cork_codec_output  output;
+    ZSTD_CCtx  *ctx;
+};
+
+/* Feed input through the compressor until it has all been consumed, or (for
+ * ZSTD_e_end) until the end of the frame has been written out. */
+static int
+cork_zstd_compress(struct cork_zstd_compress_consumer *self,
+                   const void *buf, size_t size, ZSTD_EndDirective mode)
+{
+    ZSTD_inBuffer  in = { buf, size, 0 };
+    size_t  remaining;
+    do {
+        ZSTD_outBuffer  out = { self->output.buf, self->output.size, 0 };
+        remaining = ZSTD_compressStream2(self->ctx, &out, &in, mode);
+        rii_check(cork_zstd_check(remaining));
+        rii_check(cork_codec_output_send(&self->output, out.pos));
+    } while (mode == ZSTD_e_end? remaining != 0: in.pos < in.size);
+    return 0;
+}
+
+static int
+cork_zstd_compress_consumer__data(struct cork_stream_consumer *vself,
+                                  const void *buf, size_t size,
+                                  bool is_first_chunk)
+{
+    struct cork_zstd_compress_consumer  *self =
+        cork_container_of(vself, struct cork_zstd_compress_consumer, parent);
+    return cork_zstd_compress(self, buf, size, ZSTD_e_continue);
+}
+
+static int
+cork_zstd_compress_consumer__eof(struct cork_stream_consumer *vself)
+{
+    struct cork_zstd_compress_consumer  *self =
+        cork_container_of(vself, struct cork_zstd_compress_consumer, parent);
+    rii_check(cork_zstd_compress(self, NULL, 0, ZSTD_e_end));
+    return cork_stream_consumer_eof(self->output.next);
+}
+
+static void
+cork_zstd_compress_consumer__free(struct cork_stream_consumer *vself)
+{
+    struct cork_zstd_compress_consumer  *self =
+        cork_container_of(vself, struct cork_zstd_compress_consumer, parent);
+    ZSTD_freeCCtx(self->ctx);
+    cork_codec_output_done(&self->output);
+    cork_delete(struct cork_zstd_compress_consumer, self);
+}
+
+struct cork_stream_consumer *
+cork_zstd_compress_consumer_new(struct cork_stream_consumer *next, int level)
+{
+    struct cork_zstd_compress_consumer  *self =
+        cork_new(struct cork_zstd_compress_consumer);
+    self->parent.data = cork_zstd_compress_consumer__data;
+    self->parent.eof = cork_zstd_compress_consumer__eof;
+    self->parent.free = cork_zstd_compress_consumer__free;
+    cork_codec_output_init(&self->output, next, ZSTD_CStreamOutSize());
+    self->ctx = ZSTD_createCCtx();
+    if (CORK_UNLIKELY(self->ctx == NULL)) {
+        cork_abort("Cannot allocate zstd %s context", "compression");
+    }
+    if (level != 0) {
+        size_t  rc =
+            ZSTD_CCtx_setParameter(self->ctx, ZSTD_c_compressionLevel, level);
+        if (CORK_UNLIKELY(cork_zstd_check(rc) != 0)) {
+            cork_zstd_compress_consumer__free(&self->parent);
+            return NULL;
+        }
+    }
+    return &self->parent;
+}
+
+
+struct cork_zstd_decompress_consumer {
+    struct cork_stream_consumer  parent;
+    struct cork_codec_output  output;
+    ZSTD_DCtx  *ctx;
+    /* Whether we're in the middle of a frame */
+    bool  in_frame;
+};
+
+static int
+cork_zstd_decompress_consumer__data(struct cork_stream_consumer *vself,
+                                    const void *buf, size_t size,
+                                    bool is_first_chunk)
+{
+    struct cork_zstd_decompress_consumer  *self =
+        cork_container_of(vself, struct cork_zstd_decompress_consumer, parent);
+    ZSTD_inBuffer  in = { buf, size, 0 };
+    ZSTD_outBuffer  out;
+    do {
+        size_t  rc;
+        out.dst = self->output.buf;
+        out.size = self->output.size;
+        out.pos = 0;
+        rc = ZSTD_decompressStream(self->ctx, &out, &in);
+        rii_check(cork_zstd_check(rc));
+        rii_check(cork_codec_output_send(&self->output, out.pos));
+        self->in_frame = (rc != 0);
+        /* A full output buffer means there might be more decompressed data
+         * waiting for us, even if we've consumed all of the input. */
+    } while (in.pos < in.size || out.pos == out.size);
+    return 0;
+}
+
+static int
+cork_zstd_decompress_consumer__eof(struct cork_stream_consumer *vself)
+{
+    struct cork_zstd_decompress_consumer  *self =
+        cork_container_of(vself, struct cork_zstd_decompress_consumer, parent);
+    if (CORK_UNLIKELY(self->in_frame)) {
+        cork_codec_truncated_set("zstd");
+        return -1;
+    }
+    return cork_stream_consumer_eof(self->output.next);
+}
+
+static void
+cork_zstd_decompress_consumer__free(struct cork_stream_consumer *vself)
+{
+    struct cork_zstd_decompress_consumer  *self =
+        cork_container_of(vself, struct cork_zstd_decompress_consumer, parent);
+    ZSTD_freeDCtx(self->ctx);
+    cork_codec_output_done(&self->output);
+    cork_delete(struct cork_zstd_decompress_consumer, self);
+}
+
+struct cork_stream_consumer *
+cork_zstd_decompress_consumer_new(struct cork_stream_consumer *next)
+{
+    struct cork_zstd_decompress_consumer  *self =
+        cork_new(struct cork_zstd_decompress_consumer);
+    self->parent.data = cork_zstd_decompress_consumer__data;
+    self->parent.eof = cork_zstd_decompress_consumer__eof;
+    self->parent.free = cork_zstd_decompress_consumer__free;
+    cork_codec_output_init(&self->output, next, ZSTD_DStreamOutSize());
+    self->ctx = ZSTD_createDCtx();
+    if (CORK_UNLIKELY(self->ctx == NULL)) {
+        cork_abort("Cannot allocate zstd %s context", "decompression");
+    }
+    self->in_frame = false;
+    return &self->parent;
+}
+
+#else /* !CORK_HAVE_ZSTD */
+
+struct cork_stream_consumer *
+cork_zstd_compress_consumer_new(struct cork_stream_consumer *next, int level)
+{
+    cork_codec_unsupported(next, "zstd");
+}
+
+struct cork_stream_consumer *
+cork_zstd_decompress_consumer_new(struct cork_stream_consumer *next)
+{
+    cork_codec_unsupported(next, "zstd");
+}
+
+#endif /* CORK_HAVE_ZSTD */
+
+
+/*-----------------------------------------------------------------------
+ * LZ4
+ */
+
+#if CORK_HAVE_LZ4
+
+/* We hand the LZ4 compressor at most this much input at a time, so that we
+ * can size our output buffer to hold the result of any single call. */
+#define CORK_LZ4_BLOCK_SIZE  65536
+
+static int
+cork_lz4_check(size_t rc)
+{
+    if (CORK_UNLIKELY(LZ4F_isError(rc))) {
+        cork_error_set_printf
+            (CORK_COMPRESSION_FAILED, "LZ4 error: %s", LZ4F_getErrorName(rc));
+        return -1;
+    }
+    return 0;
+}
+
+struct cork_lz4_compress_consumer {
+    struct cork_stream_consumer  parent;
+    struct cork_codec_output  output;
+    LZ4F_cctx  *ctx;
+    LZ4F_preferences_t  prefs;
+    /* Whether we've written out the frame header yet */
+    bool  started;
+};
+
+static int
+cork_lz4_compress_begin(struct cork_lz4_compress_consumer *self)
+{
+    if (!self->started) {
+        size_t  rc = LZ4F_compressBegin
+            (self->ctx, self->output.buf, self->output.size, &self->prefs);
+        rii_check(cork_lz4_check(rc));
+        rii_check(cork_codec_output_send(&self->output, rc));
+        self->started = true;
+    }
+    return 0;
+}
+
+static int
+cork_lz4_compress_consumer__data(struct cork_stream_consumer *vself,
+                                 const void *vbuf, size_t size,
+                                 bool is_first_chunk)
+{
+    struct cork_lz4_compress_consumer  *self =
+        cork_container_of(vself, struct cork_lz4_compress_consumer, parent);
+    const char  *buf = vbuf;
+    rii_check(cork_lz4_compress_begin(self));
+    while (size > 0) {
+        size_t  block_size = (size < CORK_LZ4_BLOCK_SIZE)?
+            size: CORK_LZ4_BLOCK_SIZE;
+        size_t  rc = LZ4F_compressUpdate
+            (self->ctx, self->output.buf, self->output.size,
+             buf, block_size, NULL);
+        rii_check(cork_lz4_check(rc));
+        rii_check(cork_codec_output_send(&self->output, rc));
+        buf += block_size;
+        size -= block_size;
+    }
+    return 0;
+}
+
+static int
+cork_lz4_compress_consumer__eof(struct cork_stream_consumer *vself)
+{
+    struct cork_lz4_compress_consumer  *self =
+        cork_container_of(vself, struct cork_lz4_compress_consumer, parent);
+    size_t  rc;
+    /* An empty input stream still needs a complete (empty) frame. */
+    rii_check(cork_lz4_compress_begin(self));
+    rc = LZ4F_compressEnd
+        (self->ctx, self->output.buf, self->output.size, NULL);
+    rii_check(cork_lz4_check(rc));
+    rii_check(cork_codec_output_send(&self->output, rc));
+    self->started = false;
+    return cork_stream_consumer_eof(self->output.next);
+}
+
+static void
+cork_lz4_compress_consumer__free(struct cork_stream_consumer *vself)
+{
+    struct cork_lz4_compress_consumer  *self =
+        cork_container_of(vself, struct cork_lz4_compress_consumer, parent);
+    if (self->ctx != NULL) {
+        LZ4F_freeCompressionContext(self->ctx);
+    }
+    cork_codec_output_done(&self->output);
+    cork_delete(struct cork_lz4_compress_consumer, self);
+}
+
+struct cork_stream_consumer *
+cork_lz4_compress_consumer_new(struct cork_stream_consumer *next, int level)
+{
+    struct cork_lz4_compress_consumer  *self =
+        cork_new(struct cork_lz4_compress_consumer);
+    size_t  rc;
+    self->parent.data = cork_lz4_compress_consumer__data;
+    self->parent.eof = cork_lz4_compress_consumer__eof;
+    self->parent.free = cork_lz4_compress_consumer__free;
+    memset(&self->prefs, 0, sizeof(self->prefs));
+    self->prefs.compressionLevel = level;
+    self->started = false;
+    self->ctx = NULL;
+    /* The output buffer must be able to hold the frame header, the result of
+     * compressing a full block, or the frame footer. */
+    cork_codec_output_init
+        (&self->output, next,
+         LZ4F_compressBound(CORK_LZ4_BLOCK_SIZE, &self->prefs) +
+         LZ4F_HEADER_SIZE_MAX);
+    rc = LZ4F_createCompressionContext(&self->ctx, LZ4F_VERSION);
+    if (CORK_UNLIKELY(cork_lz4_check(rc) != 0)) {
+        cork_lz4_compress_consumer__free(&self->parent);
+        return NULL;
+    }
+    return &self->parent;
+}
+
+
+struct cork_lz4_decompress_consumer {
+    struct cork_stream_consumer  parent;
+    struct cork_codec_output  output;
+    LZ4F_dctx  *ctx;
+    /* Whether we're in the middle of a frame */
+    bool  in_frame;
+};
+
+static int
+cork_lz4_decompress_consumer__data(struct cork_stream_consumer *vself,
+                                   const void *vbuf, size_t size,
+                                   bool is_first_chunk)
+{
+    struct cork_lz4_decompress_consumer  *self =
+        cork_container_of(vself, struct cork_lz4_decompress_consumer, parent);
+    const char  *buf = vbuf;
+    while (true) {
+        size_t  src_size = size;
+        size_t  dst_size = self->output.size;
+        size_t  rc = LZ4F_decompress
+            (self->ctx, self->output.buf, &dst_size, buf, &src_size, NULL);
+        rii_check(cork_lz4_check(rc));
+        rii_check(cork_codec_output_send(&self->output, dst_size));
+        self->in_frame = (rc != 0);
+        buf += src_size;
+        size -= src_size;
+        /* Keep going while there's input left, or while the decompressor
+         * might still be holding on to output that didn't fit. */
+        if (size == 0 && dst_size < self->output.size) {
+            return 0;
+        }
+    }
+}
+
+static int
+cork_lz4_decompress_consumer__eof(struct cork_stream_consumer *vself)
+{
+    struct cork_lz4_decompress_consumer  *self =
+        cork_container_of(vself, struct cork_lz4_decompress_consumer, parent);
+    if (CORK_UNLIKELY(self->in_frame)) {
+        cork_codec_truncated_set("LZ4");
+        return -1;
+    }
+    return cork_stream_consumer_eof(self->output.next);
+}
+
+static void
+cork_lz4_decompress_consumer__free(struct cork_stream_consumer *vself)
+{
+    struct cork_lz4_decompress_consumer  *self =
+        cork_container_of(vself, struct cork_lz4_decompress_consumer, parent);
+    if (self->ctx != NULL) {
+        LZ4F_freeDecompressionContext(self->ctx);
+    }
+    cork_codec_output_done(&self->output);
+    cork_delete(struct cork_lz4_decompress_consumer, self);
+}
+
+struct cork_stream_consumer *
+cork_lz4_decompress_consumer_new(struct cork_stream_consumer *next)
+{
+    struct cork_lz4_decompress_consumer  *self =
+        cork_new(struct cork_lz4_decompress_consumer);
+    size_t  rc;
+    self->parent.data = cork_lz4_decompress_consumer__data;
+    self->parent.eof = cork_lz4_decompress_consumer__eof;
+    self->parent.free = cork_lz4_decompress_consumer__free;
+    self->ctx = NULL;
+    self->in_frame = false;
+    cork_codec_output_init(&self->output, next, CORK_LZ4_BLOCK_SIZE);
+    rc = LZ4F_createDecompressionContext(&self->ctx, LZ4F_VERSION);
+    if (CORK_UNLIKELY(cork_lz4_check(rc) != 0)) {
+        cork_lz4_decompress_consumer__free(&self->parent);
+        return NULL;
+    }
+    return &self->parent;
+}
+
+#else /* !CORK_HAVE_LZ4 */
+
+struct cork_stream_consumer *
+cork_lz4_compress_consumer_new(struct cork_stream_consumer *next, int level)
+{
+    cork_codec_unsupported(next, "LZ4");
+}
+
+struct cork_stream_consumer *
+cork_lz4_decompress_consumer_new(struct cork_stream_consumer *next)
+{
+    cork_codec_unsupported(next, "LZ4");
+}
+
+#endif /* CORK_HAVE_LZ4 */
@@ -0,0 +1,618 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/callbacks.h"
+#include "libcork/core/hash.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/concurrent-hash-table.h"
+#include "libcork/threads/atomics.h"
+#include "libcork/threads/basics.h"
+
+#ifndef CORK_CONCURRENT_HASH_TABLE_DEBUG
+#define CORK_CONCURRENT_HASH_TABLE_DEBUG 0
+#endif
+
+#if CORK_CONCURRENT_HASH_TABLE_DEBUG
+#include <stdio.h>
+#define DEBUG(...) \
+    do { \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+    } while (0)
+#else
+#define DEBUG(...) /* nothing */
+#endif
+
+
+/*-----------------------------------------------------------------------
+ * Concurrent hash tables
+ */
+
+/* Readers traverse singly linked bin chains without taking any locks.  Writers
+ * never modify a node that's reachable by readers, except to update its `next`
+ * pointer when unlinking a successor; instead they build a new node and
+ * publish it with a single pointer store.  Resizing builds an entirely new bin
+ * array (with new nodes), and publishes it the same way.  Anything that a
+ * writer unlinks is "retired", and only freed once every reader that might
+ * still hold a reference to it has left its critical section.
+ *
+ * To detect that, readers register themselves in one of two counters,
+ * selected by the parity of the table's current epoch.  To wait for existing
+ * readers, a writer increments the epoch, and then waits for the counters of
+ * the previous parity to drain.  (A reader that reads the epoch, but doesn't
+ * register until after the writer has incremented it, will notice the change
+ * and try again.)  The counters are striped across cache lines by thread ID,
+ * so that readers on different cores don't contend with each other. */
+
+#define CORK_CONCURRENT_HASH_TABLE_READER_STRIPES  16
+
+/* The default initial number of bins to allocate in a new table. */
+#define CORK_CONCURRENT_HASH_TABLE_DEFAULT_INITIAL_SIZE  8
+
+/* The number of entries per bin to allow before increasing the number of bins.
+ * This is lower than for a regular hash table since readers pay for every
+ * pointer that they chase. */
+#define CORK_CONCURRENT_HASH_TABLE_MAX_DENSITY  2
+
+/* The number of times to spin while waiting for another thread before we give
+ * up the CPU. */
+#define CORK_CONCURRENT_HASH_TABLE_SPIN_COUNT  128
+
+/* The number of retired nodes to accumulate before we try to reclaim them. */
+#define CORK_CONCURRENT_HASH_TABLE_RETIRE_THRESHOLD  64
+
+struct cork_concurrent_hash_table_node {
+    struct cork_concurrent_hash_table_node * volatile  next;
+    cork_hash  hash;
+    void  *key;
+    void  *value;
+    /* Only used once the node has been retired */
+    struct cork_concurrent_hash_table_node  *next_retired;
+};
+
+struct cork_concurrent_hash_table_bins {
+    size_t  bin_count;
+    size_t  bin_mask;
+    struct cork_concurrent_hash_table_bins  *next_retired;
+    struct cork_concurrent_hash_table_node * volatile  bins[];
+};
+
+struct cork_concurrent_hash_table_readers {
+    volatile unsigned int  count[2];
+    char  padding[CORK_CACHELINE_SIZE -
+                  2 * sizeof(unsigned int)];
+};
+
+struct cork_concurrent_hash_table {
+    struct cork_concurrent_hash_table_readers
+        readers[CORK_CONCURRENT_HASH_TABLE_READER_STRIPES];
+    volatile unsigned int  epoch;
+    volatile int  writer_lock;
+    struct cork_concurrent_hash_table_bins * volatile  bins;
+    volatile size_t  entry_count;
+    struct cork_concurrent_hash_table_node  *retired_nodes;
+    struct cork_concurrent_hash_table_bins  *retired_bins;
+    size_t  retired_count;
+    void  *user_data;
+    cork_free_f  free_user_data;
+    cork_hash_f  hash;
+    cork_equals_f  equals;
+    cork_free_f  free_key;
+    cork_free_f  free_value;
+};
+
+/* Stores a pointer that readers might load, making sure that everything the
+ * pointer refers to is visible before the pointer itself is. */
+#define publish(dest, value) \
+    do { \
+        __sync_synchronize(); \
+        (dest) = (value); \
+    } while (0)
+
+static cork_hash
+cork_concurrent_hash_table__default_hash(void *user_data, const void *key)
+{
+    return (cork_hash) (uintptr_t) key;
+}
+
+static bool
+cork_concurrent_hash_table__default_equals(void *user_data,
+                                           const void *key1, const void *key2)
+{
+    return key1 == key2;
+}
+
+
+static struct cork_concurrent_hash_table_bins *
+cork_concurrent_hash_table_bins_new(size_t desired_count)
+{
+    struct cork_concurrent_hash_table_bins  *bins;
+    size_t  bin_count = 1;
+    while (bin_count < desired_count) {
+        bin_count <<= 1;
+    }
+    DEBUG("Allocate %zu bins", bin_count);
+    bins = cork_calloc
+        (1, sizeof(struct cork_concurrent_hash_table_bins) +
+         bin_count * sizeof(struct cork_concurrent_hash_table_node *));
+    bins->bin_count = bin_count;
+    bins->bin_mask = bin_count - 1;
+    bins->next_retired = NULL;
+    return bins;
+}
+
+static void
+cork_concurrent_hash_table_bins_free
+(struct cork_concurrent_hash_table_bins *bins)
+{
+    cork_free(bins,
+              sizeof(struct cork_concurrent_hash_table_bins) +
+              bins->bin_count *
+              sizeof(struct cork_concurrent_hash_table_node *));
+}
+
+static struct cork_concurrent_hash_table_node *
+cork_concurrent_hash_table_node_new(cork_hash hash, void *key, void *value)
+{
+    struct cork_concurrent_hash_table_node  *node =
+        cork_new(struct cork_concurrent_hash_table_node);
+    node->next = NULL;
+    node->hash = hash;
+    node->key = key;
+    node->value = value;
+    node->next_retired = NULL;
+    return node;
+}
+
+static void
+cork_concurrent_hash_table_node_free(struct cork_concurrent_hash_table_node
+                                     *node)
+{
+    cork_delete(struct cork_concurrent_hash_table_node, node);
+}
+
+
+struct cork_concurrent_hash_table *
+cork_concurrent_hash_table_new(size_t initial_size, unsigned int flags)
+{
+    struct cork_concurrent_hash_table  *table =
+        cork_new(struct cork_concurrent_hash_table);
+    memset(table->readers, 0, sizeof(table->readers));
+    table->epoch = 0;
+    table->writer_lock = 0;
+    table->entry_count = 0;
+    table->retired_nodes = NULL;
+    table->retired_bins = NULL;
+    table->retired_count = 0;
+    table->user_data = NULL;
+    table->free_user_data = NULL;
+    table->hash = cork_concurrent_hash_table__default_hash;
+    table->equals = cork_concurrent_hash_table__default_equals;
+    table->free_key = NULL;
+    table->free_value = NULL;
+    if (initial_size < CORK_CONCURRENT_HASH_TABLE_DEFAULT_INITIAL_SIZE) {
+        initial_size = CORK_CONCURRENT_HASH_TABLE_DEFAULT_INITIAL_SIZE;
+    }
+    table->bins = cork_concurrent_hash_table_bins_new(initial_size);
+    return table;
+}
+
+static void
+cork_concurrent_hash_table_reclaim(struct cork_concurrent_hash_table *table)
+{
+    struct cork_concurrent_hash_table_node  *node;
+    struct cork_concurrent_hash_table_bins  *bins;
+
+    DEBUG("Reclaim %zu retired nodes", table->retired_count);
+    for (node = table->retired_nodes; node != NULL; ) {
+        struct cork_concurrent_hash_table_node  *next = node->next_retired;
+        cork_concurrent_hash_table_node_free(node);
+        node = next;
+    }
+    for (bins = table->retired_bins; bins != NULL; ) {
+        struct cork_concurrent_hash_table_bins  *next = bins->next_retired;
+        cork_concurrent_hash_table_bins_free(bins);
+        bins = next;
+    }
+    table->retired_nodes = NULL;
+    table->retired_bins = NULL;
+    table->retired_count = 0;
+}
+
+void
+cork_concurrent_hash_table_free(struct cork_concurrent_hash_table *table)
+{
+    struct cork_concurrent_hash_table_bins  *bins = table->bins;
+    size_t  i;
+
+    /* There can't be any readers left, so everything can be freed right
+     * away. */
+    cork_concurrent_hash_table_reclaim(table);
+    for (i = 0; i < bins->bin_count; i++) {
+        struct cork_concurrent_hash_table_node  *node = bins->bins[i];
+        while (node != NULL) {
+            struct cork_concurrent_hash_table_node  *next = node->next;
+            if (table->free_key != NULL) {
+                table->free_key(node->key);
+            }
+            if (table->free_value != NULL) {
+                table->free_value(node->value);
+            }
+            cork_concurrent_hash_table_node_free(node);
+            node = next;
+        }
+    }
+    cork_concurrent_hash_table_bins_free(bins);
+    cork_free_user_data(table);
+    cork_delete(struct cork_concurrent_hash_table, table);
+}
+
+void
+cork_concurrent_hash_table_set_user_data
+(struct cork_concurrent_hash_table *table,
+ void *user_data, cork_free_f free_user_data)
+{
+    table->user_data = user_data;
+    table->free_user_data = free_user_data;
+}
+
+void
+cork_concurrent_hash_table_set_hash(struct cork_concurrent_hash_table *table,
+                                    cork_hash_f hash)
+{
+    table->hash = hash;
+}
+
+void
+cork_concurrent_hash_table_set_equals(struct cork_concurrent_hash_table *table,
+                                      cork_equals_f equals)
+{
+    table->equals = equals;
+}
+
+void
+cork_concurrent_hash_table_set_free_key
+(struct cork_concurrent_hash_table *table, cork_free_f free)
+{
+    table->free_key = free;
+}
+
+void
+cork_concurrent_hash_table_set_free_value
+(struct cork_concurrent_hash_table *table, cork_free_f free)
+{
+    table->free_value = free;
+}
+
+size_t
+cork_concurrent_hash_table_size(struct cork_concurrent_hash_table *table)
+{
+    return table->entry_count;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Readers
+ */
+
+unsigned int
+cork_concurrent_hash_table_read_begin(struct cork_concurrent_hash_table *table)
+{
+    unsigned int  stripe =
+        cork_current_thread_get_id() %
+        CORK_CONCURRENT_HASH_TABLE_READER_STRIPES;
+    struct cork_concurrent_hash_table_readers  *readers =
+        &table->readers[stripe];
+    while (true) {
+        unsigned int  parity = table->epoch & 1;
+        /* The atomic increment is a full barrier, so the second load of the
+         * epoch can't be reordered before it. */
+        cork_uint_atomic_add(&readers->count[parity], 1);
+        if (CORK_LIKELY((table->epoch & 1) == parity)) {
+            return (stripe << 1) | parity;
+        }
+        cork_uint_atomic_sub(&readers->count[parity], 1);
+    }
+}
+
+void
+cork_concurrent_hash_table_read_end(struct cork_concurrent_hash_table *table,
+                                    unsigned int ticket)
+{
+    unsigned int  stripe = ticket >> 1;
+    unsigned int  parity = ticket & 1;
+    cork_uint_atomic_sub(&table->readers[stripe].count[parity], 1);
+}
+
+static struct cork_concurrent_hash_table_node *
+cork_concurrent_hash_table_find(struct cork_concurrent_hash_table *table,
+                                cork_hash hash, const void *key)
+{
+    struct cork_concurrent_hash_table_bins  *bins = table->bins;
+    struct cork_concurrent_hash_table_node  *node;
+    DEBUG("(get) Search for key %p (hash 0x%08" PRIx32 ")", key, hash);
+    for (node = bins->bins[hash & bins->bin_mask];
+         node != NULL; node = node->next) {
+        if (node->hash == hash &&
+            table->equals(table->user_data, key, node->key)) {
+            DEBUG("  Match");
+            return node;
+        }
+    }
+    DEBUG("  Entry not found");
+    return NULL;
+}
+
+void *
+cork_concurrent_hash_table_get_hash(struct cork_concurrent_hash_table *table,
+                                    cork_hash hash, const void *key)
+{
+    struct cork_concurrent_hash_table_node  *node =
+        cork_concurrent_hash_table_find(table, hash, key);
+    return (node == NULL)? NULL: node->value;
+}
+
+void *
+cork_concurrent_hash_table_get(struct cork_concurrent_hash_table *table,
+                               const void *key)
+{
+    cork_hash  hash = table->hash(table->user_data, key);
+    return cork_concurrent_hash_table_get_hash(table, hash, key);
+}
+
+bool
+cork_concurrent_hash_table_contains(struct cork_concurrent_hash_table *table,
+                                    const void *key)
+{
+    cork_hash  hash = table->hash(table->user_data, key);
+    return cork_concurrent_hash_table_find(table, hash, key) != NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Writers
+ */
+
+static void
+cork_concurrent_hash_table_backoff(unsigned int *spins)
+{
+    if (++*spins < CORK_CONCURRENT_HASH_TABLE_SPIN_COUNT) {
+        cork_pause();
+    } else {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+static void
+cork_concurrent_hash_table_lock(struct cork_concurrent_hash_table *table)
+{
+    unsigned int  spins = 0;
+    while (CORK_UNLIKELY(cork_int_cas(&table->writer_lock, 0, 1) != 0)) {
+        cork_concurrent_hash_table_backoff(&spins);
+    }
+}
+
+static void
+cork_concurrent_hash_table_unlock(struct cork_concurrent_hash_table *table)
+{
+    CORK_ATTR_UNUSED int  prior = cork_int_cas(&table->writer_lock, 1, 0);
+    assert(prior == 1);
+}
+
+/* Must be called with the writer lock held. */
+static void
+cork_concurrent_hash_table_wait_for_readers
+(struct cork_concurrent_hash_table *table)
+{
+    unsigned int  parity = table->epoch & 1;
+    unsigned int  spins = 0;
+    size_t  i;
+    DEBUG("Wait for readers in epoch %u", table->epoch);
+    cork_uint_atomic_add(&table->epoch, 1);
+    for (i = 0; i < CORK_CONCURRENT_HASH_TABLE_READER_STRIPES; i++) {
+        while (table->readers[i].count[parity] != 0) {
+            cork_concurrent_hash_table_backoff(&spins);
+        }
+    }
+}
+
+static void
+cork_concurrent_hash_table_retire_node
+(struct cork_concurrent_hash_table *table,
+ struct cork_concurrent_hash_table_node *node)
+{
+    node->next_retired = table->retired_nodes;
+    table->retired_nodes = node;
+    table->retired_count++;
+}
+
+/* Must be called with the writer lock held. */
+static void
+cork_concurrent_hash_table_unlock_and_reclaim
+(struct cork_concurrent_hash_table *table)
+{
+    if (table->retired_count >= CORK_CONCURRENT_HASH_TABLE_RETIRE_THRESHOLD) {
+        cork_concurrent_hash_table_wait_for_readers(table);
+        cork_concurrent_hash_table_reclaim(table);
+    }
+    cork_concurrent_hash_table_unlock(table);
+}
+
+/* Must be called with the writer lock held. */
+static void
+cork_concurrent_hash_table_grow(struct cork_concurrent_hash_table *table)
+{
+    struct cork_concurrent_hash_table_bins  *old_bins = table->bins;
+    struct cork_concurrent_hash_table_bins  *new_bins =
+        cork_concurrent_hash_table_bins_new(old_bins->bin_count * 2);
+    size_t  i;
+
+    /* Readers might be traversing the old chains, so we can't relink the
+     * existing nodes; copy them into new chains instead. */
+    DEBUG("    Reached maximum density; rehash");
+    for (i = 0; i < old_bins->bin_count; i++) {
+        struct cork_concurrent_hash_table_node  *node;
+        for (node = old_bins->bins[i]; node != NULL; node = node->next) {
+            size_t  index = node->hash & new_bins->bin_mask;
+            struct cork_concurrent_hash_table_node  *copy =
+                cork_concurrent_hash_table_node_new
+                (node->hash, node->key, node->value);
+            copy->next = new_bins->bins[index];
+            new_bins->bins[index] = copy;
+        }
+    }
+    publish(table->bins, new_bins);
+
+    for (i = 0; i < old_bins->bin_count; i++) {
+        struct cork_concurrent_hash_table_node  *node = old_bins->bins[i];
+        while (node != NULL) {
+            struct cork_concurrent_hash_table_node  *next = node->next;
+            cork_concurrent_hash_table_retire_node(table, node);
+            node = next;
+        }
+    }
+    old_bins->next_retired = table->retired_bins;
+    table->retired_bins = old_bins;
+}
+
+void
+cork_concurrent_hash_table_put_hash(struct cork_concurrent_hash_table *table,
+                                    cork_hash hash, void *key, void *value,
+                                    bool *is_new,
+                                    void **old_key, void **old_value)
+{
+    struct cork_concurrent_hash_table_bins  *bins;
+    struct cork_concurrent_hash_table_node * volatile  *link;
+    struct cork_concurrent_hash_table_node  *node;
+    struct cork_concurrent_hash_table_node  *new_node;
+
+    cork_concurrent_hash_table_lock(table);
+    DEBUG("(put) Search for key %p (hash 0x%08" PRIx32 ")", key, hash);
+    bins = table->bins;
+    for (link = &bins->bins[hash & bins->bin_mask];
+         (node = *link) != NULL; link = &node->next) {
+        if (node->hash == hash &&
+            table->equals(table->user_data, key, node->key)) {
+            DEBUG("    Found existing entry; replacing");
+            if (old_key != NULL) {
+                *old_key = node->key;
+            }
+            if (old_value != NULL) {
+                *old_value = node->value;
+            }
+            if (is_new != NULL) {
+                *is_new = false;
+            }
+            new_node = cork_concurrent_hash_table_node_new(hash, key, value);
+            new_node->next = node->next;
+            publish(*link, new_node);
+            cork_concurrent_hash_table_retire_node(table, node);
+            cork_concurrent_hash_table_unlock_and_reclaim(table);
+            return;
+        }
+    }
+
+    DEBUG("  Entry not found");
+    if (table->entry_count / bins->bin_count >=
+        CORK_CONCURRENT_HASH_TABLE_MAX_DENSITY) {
+        cork_concurrent_hash_table_grow(table);
+        bins = table->bins;
+    }
+
+    DEBUG("    Allocate new entry");
+    link = &bins->bins[hash & bins->bin_mask];
+    new_node = cork_concurrent_hash_table_node_new(hash, key, value);
+    new_node->next = *link;
+    publish(*link, new_node);
+    table->entry_count++;
+    if (old_key != NULL) {
+        *old_key = NULL;
+    }
+    if (old_value != NULL) {
+        *old_value = NULL;
+    }
+    if (is_new != NULL) {
+        *is_new = true;
+    }
+    cork_concurrent_hash_table_unlock_and_reclaim(table);
+}
+
+void
+cork_concurrent_hash_table_put(struct cork_concurrent_hash_table *table,
+                               void *key, void *value,
+                               bool *is_new, void **old_key, void **old_value)
+{
+    cork_hash  hash = table->hash(table->user_data, key);
+    cork_concurrent_hash_table_put_hash
+        (table, hash, key, value, is_new, old_key, old_value);
+}
+
+bool
+cork_concurrent_hash_table_delete_hash
+(struct cork_concurrent_hash_table *table, cork_hash hash, const void *key,
+ void **deleted_key, void **deleted_value)
+{
+    struct cork_concurrent_hash_table_bins  *bins;
+    struct cork_concurrent_hash_table_node * volatile  *link;
+    struct cork_concurrent_hash_table_node  *node;
+
+    cork_concurrent_hash_table_lock(table);
+    DEBUG("(delete) Search for key %p (hash 0x%08" PRIx32 ")", key, hash);
+    bins = table->bins;
+    for (link = &bins->bins[hash & bins->bin_mask];
+         (node = *link) != NULL; link = &node->next) {
+        if (node->hash == hash &&
+            table->equals(table->user_data, key, node->key)) {
+            DEBUG("    Match");
+            if (deleted_key != NULL) {
+                *deleted_key = node->key;
+            }
+            if (deleted_value != NULL) {
+                *deleted_value = node->value;
+            }
+            /* Readers that are already looking at this node can still follow
+             * its next pointer, which we leave untouched. */
+            publish(*link, node->next);
+            table->entry_count--;
+            cork_concurrent_hash_table_retire_node(table, node);
+            cork_concurrent_hash_table_unlock_and_reclaim(table);
+            return true;
+        }
+    }
+
+    DEBUG("  Entry not found");
+    cork_concurrent_hash_table_unlock(table);
+    return false;
+}
+
+bool
+cork_concurrent_hash_table_delete(struct cork_concurrent_hash_table *table,
+                                  const void *key,
+                                  void **deleted_key, void **deleted_value)
+{
+    cork_hash  hash = table->hash(table->user_data, key);
+    return cork_concurrent_hash_table_delete_hash
+        (table, hash, key, deleted_key, deleted_value);
+}
+
+void
+cork_concurrent_hash_table_synchronize(struct cork_concurrent_hash_table *table)
+{
+    cork_concurrent_hash_table_lock(table);
+    cork_concurrent_hash_table_wait_for_readers(table);
+    cork_concurrent_hash_table_reclaim(table);
+    cork_concurrent_hash_table_unlock(table);
+}
@@ -0,0 +1,210 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+
+#include "libcork/core/types.h"
+#include "libcork/ds/concurrent-list.h"
+#include "libcork/threads/atomics.h"
+#include "libcork/threads/locks.h"
+
+
+/*-----------------------------------------------------------------------
+ * Concurrent stacks
+ */
+
+#if CORK_HAVE_ATOMIC_PAIR_CAS
+
+/* The two halves of the expected value don't have to be read together; if they
+ * tear, the first compare-and-swap fails and hands us a consistent copy. */
+#define cork_stack_read_top(stack, dest) \
+    do { \
+        (dest).second = cork_atomic_load_acquire(&(stack)->top.second); \
+        (dest).first = cork_atomic_load_acquire(&(stack)->top.first); \
+    } while (0)
+
+void
+cork_stack_push(struct cork_stack *stack, struct cork_stack_item *item)
+{
+    struct cork_atomic_pair  expected;
+    struct cork_atomic_pair  desired;
+    cork_stack_read_top(stack, expected);
+    desired.first = (uintptr_t) item;
+    do {
+        item->next = (struct cork_stack_item *) expected.first;
+        /* Pushes don't need a new version, since a push can't make a
+         * concurrent pop see a stale link. */
+        desired.second = expected.second;
+    } while (CORK_UNLIKELY(!cork_atomic_pair_cas
+                           (&stack->top, &expected, desired)));
+}
+
+struct cork_stack_item *
+cork_stack_pop(struct cork_stack *stack)
+{
+    struct cork_atomic_pair  expected;
+    struct cork_atomic_pair  desired;
+    cork_stack_read_top(stack, expected);
+    do {
+        struct cork_stack_item  *top =
+            (struct cork_stack_item *) expected.first;
+        if (top == NULL) {
+            return NULL;
+        }
+        /* If another thread pops top before our compare-and-swap, the version
+         * will have changed, so it doesn't matter that this link is stale. */
+        desired.first = (uintptr_t) top->next;
+        desired.second = expected.second + 1;
+    } while (CORK_UNLIKELY(!cork_atomic_pair_cas
+                           (&stack->top, &expected, desired)));
+    return (struct cork_stack_item *) expected.first;
+}
+
+struct cork_stack_item *
+cork_stack_pop_all(struct cork_stack *stack)
+{
+    struct cork_atomic_pair  expected;
+    struct cork_atomic_pair  desired;
+    cork_stack_read_top(stack, expected);
+    desired.first = 0;
+    do {
+        if (expected.first == 0) {
+            return NULL;
+        }
+        desired.second = expected.second + 1;
+    } while (CORK_UNLIKELY(!cork_atomic_pair_cas
+                           (&stack->top, &expected, desired)));
+    return (struct cork_stack_item *) expected.first;
+}
+
+bool
+cork_stack_is_empty(struct cork_stack *stack)
+{
+    return cork_atomic_load_acquire(&stack->top.first) == 0;
+}
+
+#else
+
+void
+cork_stack_push(struct cork_stack *stack, struct cork_stack_item *item)
+{
+    cork_mutex_lock(&stack->lock);
+    item->next = stack->top;
+    stack->top = item;
+    cork_mutex_unlock(&stack->lock);
+}
+
+struct cork_stack_item *
+cork_stack_pop(struct cork_stack *stack)
+{
+    struct cork_stack_item  *top;
+    cork_mutex_lock(&stack->lock);
+    top = stack->top;
+    if (top != NULL) {
+        stack->top = top->next;
+    }
+    cork_mutex_unlock(&stack->lock);
+    return top;
+}
+
+struct cork_stack_item *
+cork_stack_pop_all(struct cork_stack *stack)
+{
+    struct cork_stack_item  *top;
+    cork_mutex_lock(&stack->lock);
+    top = stack->top;
+    stack->top = NULL;
+    cork_mutex_unlock(&stack->lock);
+    return top;
+}
+
+bool
+cork_stack_is_empty(struct cork_stack *stack)
+{
+    return cork_atomic_load_acquire(&stack->top) == NULL;
+}
+
+#endif
+
+
+/*-----------------------------------------------------------------------
+ * Multi-producer, single-consumer queues
+ */
+
+/* The items form a singly linked list from tail (the oldest) to head (the
+ * newest).  A producer first swings head to point at its new item, and then
+ * links the previous head to it; in between those two steps, the list is
+ * broken, and the consumer can't see past the previous head.  The stub item
+ * makes sure that the list is never empty, so that a producer always has
+ * something to link onto. */
+
+void
+cork_mpsc_queue_init(struct cork_mpsc_queue *queue)
+{
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+}
+
+void
+cork_mpsc_queue_push(struct cork_mpsc_queue *queue,
+                     struct cork_mpsc_item *item)
+{
+    struct cork_mpsc_item  *prev;
+    item->next = NULL;
+    prev = cork_atomic_exchange(&queue->head, item, CORK_ATOMIC_ACQ_REL);
+    cork_atomic_store_release(&prev->next, item);
+}
+
+struct cork_mpsc_item *
+cork_mpsc_queue_pop(struct cork_mpsc_queue *queue)
+{
+    struct cork_mpsc_item  *tail = queue->tail;
+    struct cork_mpsc_item  *next = cork_atomic_load_acquire(&tail->next);
+
+    /* Skip over the stub if it's at the front of the queue. */
+    if (tail == &queue->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        queue->tail = next;
+        tail = next;
+        next = cork_atomic_load_acquire(&tail->next);
+    }
+
+    if (CORK_LIKELY(next != NULL)) {
+        queue->tail = next;
+        return tail;
+    }
+
+    /* tail looks like the last item.  If it isn't really, a producer is in the
+     * middle of linking something after it, and we can't pop tail until they've
+     * finished. */
+    if (tail != cork_atomic_load_acquire(&queue->head)) {
+        return NULL;
+    }
+
+    /* We can't pop the very last item, since producers link onto it, so put
+     * the stub back behind it first. */
+    cork_mpsc_queue_push(queue, &queue->stub);
+    next = cork_atomic_load_acquire(&tail->next);
+    if (next != NULL) {
+        queue->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+bool
+cork_mpsc_queue_is_empty(struct cork_mpsc_queue *queue)
+{
+    struct cork_mpsc_item  *tail = queue->tail;
+    return tail == &queue->stub &&
+        cork_atomic_load_acquire(&tail->next) == NULL;
+}
@@ -10,20 +10,133 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
+#include "libcork/core/allocator.h"
+#include "libcork/core/trace.h"
 #include "libcork/ds/stream.h"
 #include "libcork/helpers/errors.h"
 #include "libcork/helpers/posix.h"
 
 #define BUFFER_SIZE  4096
 
+/* The number of BUFFER_SIZE chunks that we try to fill before passing them to
+ * a consumer's data_vec method. */
+#define BUFFER_VEC_COUNT  4
+
+
+/*-----------------------------------------------------------------------
+ * Vectored data
+ */
+
+int
+cork_stream_consumer_data_vec(struct cork_stream_consumer *consumer,
+                              const struct cork_slice *slices, size_t count,
+                              bool is_first_chunk)
+{
+    size_t  i;
+    if (cork_stream_consumer_has_data_vec(consumer)) {
+        return consumer->data_vec(consumer, slices, count, is_first_chunk);
+    }
+    for (i = 0; i < count; i++) {
+        rii_check(cork_stream_consumer_data
+                  (consumer, slices[i].buf, slices[i].size,
+                   is_first_chunk && i == 0));
+    }
+    return 0;
+}
+
+int
+cork_stream_consumer_data_via_vec(struct cork_stream_consumer *consumer,
+                                  const void *buf, size_t size,
+                                  bool is_first_chunk)
+{
+    struct cork_slice  slice;
+    cork_slice_init_static(&slice, buf, size);
+    return consumer->data_vec(consumer, &slice, 1, is_first_chunk);
+}
+
 
 /*-----------------------------------------------------------------------
  * Producers
  */
 
+/* file_read(fd, bytes_read, duration_ns), for every read from a file.
+ * bytes_read is -1 if the read failed. */
+cork_tracepoint(file_read);
+
+static ssize_t
+cork_file_read(int fd, void *buf, size_t size)
+{
+    uint64_t  start = cork_trace_start(file_read);
+    ssize_t  bytes_read = read(fd, buf, size);
+    cork_trace3(file_read, fd, bytes_read, cork_trace_elapsed(start));
+    return bytes_read;
+}
+
+static ssize_t
+cork_file_readv(int fd, const struct iovec *iov, int count)
+{
+    uint64_t  start = cork_trace_start(file_read);
+    ssize_t  bytes_read = readv(fd, iov, count);
+    cork_trace3(file_read, fd, bytes_read, cork_trace_elapsed(start));
+    return bytes_read;
+}
+
+static size_t
+cork_file_fread(FILE *fp, void *buf, size_t size)
+{
+    uint64_t  start = cork_trace_start(file_read);
+    size_t  bytes_read = fread(buf, 1, size, fp);
+    cork_trace3(file_read, fileno(fp), (ssize_t) bytes_read,
+                cork_trace_elapsed(start));
+    return bytes_read;
+}
+
+/* Fill up as many chunks as we can with a single readv call, and pass all of
+ * them to the consumer at once. */
+static int
+cork_consume_fd_vec(struct cork_stream_consumer *consumer, int fd)
+{
+    char  buf[BUFFER_VEC_COUNT][BUFFER_SIZE];
+    struct iovec  iov[BUFFER_VEC_COUNT];
+    struct cork_slice  slices[BUFFER_VEC_COUNT];
+    ssize_t  bytes_read;
+    bool  first = true;
+    size_t  i;
+
+    for (i = 0; i < BUFFER_VEC_COUNT; i++) {
+        iov[i].iov_base = buf[i];
+        iov[i].iov_len = BUFFER_SIZE;
+    }
+
+    while (true) {
+        while ((bytes_read =
+                cork_file_readv(fd, iov, BUFFER_VEC_COUNT)) > 0) {
+            size_t  count = 0;
+            while (bytes_read > 0) {
+                size_t  size = (bytes_read < BUFFER_SIZE)?
+                    (size_t) bytes_read: BUFFER_SIZE;
+                cork_slice_init_static(&slices[count], buf[count], size);
+                bytes_read -= size;
+                count++;
+            }
+            rii_check(consumer->data_vec(consumer, slices, count, first));
+            first = false;
+        }
+
+        if (bytes_read == 0) {
+            return cork_stream_consumer_eof(consumer);
+        } else if (errno != EINTR) {
+            cork_system_error_set();
+            return -1;
+        }
+    }
+}
+
 int
 cork_consume_fd(struct cork_stream_consumer *consumer, int fd)
 {
@@ -31,8 +144,12 @@ cork_consume_fd(struct cork_stream_consumer *consumer, int fd)
     ssize_t  bytes_read;
     bool  first = true;
 
+    if (cork_stream_consumer_has_data_vec(consumer)) {
+        return cork_consume_fd_vec(consumer, fd);
+    }
+
     while (true) {
-        while ((bytes_read = read(fd, buf, BUFFER_SIZE)) > 0) {
+        while ((bytes_read = cork_file_read(fd, buf, BUFFER_SIZE)) > 0) {
             rii_check(cork_stream_consumer_data
                       (consumer, buf, bytes_read, first));
             first = false;
@@ -55,7 +172,7 @@ cork_consume_file(struct cork_stream_consumer *consumer, FILE *fp)
     bool  first = true;
 
     while (true) {
-        while ((bytes_read = fread(buf, 1, BUFFER_SIZE, fp)) > 0) {
+        while ((bytes_read = cork_file_fread(fp, buf, BUFFER_SIZE)) > 0) {
             rii_check(cork_stream_consumer_data
                       (consumer, buf, bytes_read, first));
             first = false;
@@ -70,13 +187,128 @@ cork_consume_file(struct cork_stream_consumer *consumer, FILE *fp)
     }
 }
 
+/* A heap-allocated read buffer that grows whenever a read fills it. */
+struct cork_read_buffer {
+    char  *buf;
+    size_t  size;
+    size_t  max_size;
+};
+
+static void
+cork_read_buffer_init(struct cork_read_buffer *rbuf, size_t size,
+                      size_t max_size)
+{
+    if (size == 0) {
+        size = BUFFER_SIZE;
+    }
+    rbuf->buf = cork_malloc(size);
+    rbuf->size = size;
+    rbuf->max_size = (max_size < size)? size: max_size;
+}
+
+static void
+cork_read_buffer_done(struct cork_read_buffer *rbuf)
+{
+    cork_free(rbuf->buf, rbuf->size);
+}
+
+static void
+cork_read_buffer_filled(struct cork_read_buffer *rbuf, size_t bytes_read)
+{
+    if (bytes_read == rbuf->size && rbuf->size < rbuf->max_size) {
+        /* We don't need to keep the current contents, so there's no reason
+         * to use cork_realloc. */
+        size_t  new_size = rbuf->size * 2;
+        if (new_size > rbuf->max_size) {
+            new_size = rbuf->max_size;
+        }
+        cork_free(rbuf->buf, rbuf->size);
+        rbuf->buf = cork_malloc(new_size);
+        rbuf->size = new_size;
+    }
+}
+
+static void
+cork_advise_sequential(int fd)
+{
+#if defined(POSIX_FADV_SEQUENTIAL)
+    /* This is only a hint, and fails for pipes and sockets, so we ignore any
+     * errors. */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+int
+cork_consume_fd_ex(struct cork_stream_consumer *consumer, int fd,
+                   size_t buffer_size, size_t max_buffer_size)
+{
+    struct cork_read_buffer  rbuf;
+    ssize_t  bytes_read;
+    bool  first = true;
+
+    cork_advise_sequential(fd);
+    cork_read_buffer_init(&rbuf, buffer_size, max_buffer_size);
+    while (true) {
+        while ((bytes_read = cork_file_read(fd, rbuf.buf, rbuf.size)) > 0) {
+            ei_check(cork_stream_consumer_data
+                     (consumer, rbuf.buf, bytes_read, first));
+            first = false;
+            cork_read_buffer_filled(&rbuf, bytes_read);
+        }
+
+        if (bytes_read == 0) {
+            cork_read_buffer_done(&rbuf);
+            return cork_stream_consumer_eof(consumer);
+        } else if (errno != EINTR) {
+            cork_system_error_set();
+            goto error;
+        }
+    }
+
+error:
+    cork_read_buffer_done(&rbuf);
+    return -1;
+}
+
+int
+cork_consume_file_ex(struct cork_stream_consumer *consumer, FILE *fp,
+                     size_t buffer_size, size_t max_buffer_size)
+{
+    struct cork_read_buffer  rbuf;
+    size_t  bytes_read;
+    bool  first = true;
+
+    cork_advise_sequential(fileno(fp));
+    cork_read_buffer_init(&rbuf, buffer_size, max_buffer_size);
+    while (true) {
+        while ((bytes_read = cork_file_fread(fp, rbuf.buf, rbuf.size)) > 0) {
+            ei_check(cork_stream_consumer_data
+                     (consumer, rbuf.buf, bytes_read, first));
+            first = false;
+            cork_read_buffer_filled(&rbuf, bytes_read);
+        }
+
+        if (feof(fp)) {
+            cork_read_buffer_done(&rbuf);
+            return cork_stream_consumer_eof(consumer);
+        } else if (errno != EINTR) {
+            cork_system_error_set();
+            goto error;
+        }
+    }
+
+error:
+    cork_read_buffer_done(&rbuf);
+    return -1;
+}
+
 int
 cork_consume_file_from_path(struct cork_stream_consumer *consumer,
                             const char *path, int flags)
 {
     int  fd;
     rii_check_posix(fd = open(path, flags));
-    ei_check(cork_consume_fd(consumer, fd));
+    ei_check(cork_consume_fd_async(consumer, fd, 0, 0));
     rii_check_posix(close(fd));
     return 0;
 
@@ -212,3 +444,181 @@ cork_file_from_path_consumer_new(const char *path, int flags)
     self->fd = fd;
     return &self->parent;
 }
+
+
+/*-----------------------------------------------------------------------
+ * Buffered fd consumer
+ */
+
+struct cork_buffered_fd_consumer {
+    struct cork_stream_consumer  parent;
+    int  fd;
+    enum cork_fd_sync_policy  sync_policy;
+    char  *buf;
+    size_t  size;
+    size_t  allocated_size;
+};
+
+/* The number of iovecs that we pass to each writev call */
+#define IOV_COUNT  64
+
+/* Write out all of the given iovecs, retrying after short writes.  The iovecs
+ * are modified in place. */
+static int
+cork_writev_all(int fd, struct iovec *iov, size_t iov_count)
+{
+    while (iov_count > 0) {
+        ssize_t  rc = writev
+            (fd, iov, (iov_count < IOV_COUNT)? iov_count: IOV_COUNT);
+        size_t  written;
+        if (rc == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cork_system_error_set();
+            return -1;
+        }
+
+        written = rc;
+        while (iov_count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+static int
+cork_buffered_fd_consumer_sync(struct cork_buffered_fd_consumer *self)
+{
+#if defined(__linux__)
+    rii_check_posix(fdatasync(self->fd));
+#else
+    rii_check_posix(fsync(self->fd));
+#endif
+    return 0;
+}
+
+static int
+cork_buffered_fd_consumer_drain(struct cork_buffered_fd_consumer *self)
+{
+    struct iovec  iov;
+    if (self->size == 0) {
+        return 0;
+    }
+    iov.iov_base = self->buf;
+    iov.iov_len = self->size;
+    self->size = 0;
+    return cork_writev_all(self->fd, &iov, 1);
+}
+
+static int
+cork_buffered_fd_consumer__data_vec(struct cork_stream_consumer *vself,
+                                    const struct cork_slice *slices,
+                                    size_t count, bool is_first)
+{
+    struct cork_buffered_fd_consumer  *self =
+        cork_container_of(vself, struct cork_buffered_fd_consumer, parent);
+    size_t  total = 0;
+    size_t  i;
+
+    for (i = 0; i < count; i++) {
+        total += slices[i].size;
+    }
+
+    if (self->size + total <= self->allocated_size) {
+        /* Everything fits into the buffer, so we can put off writing
+         * anything. */
+        for (i = 0; i < count; i++) {
+            memcpy(self->buf + self->size, slices[i].buf, slices[i].size);
+            self->size += slices[i].size;
+        }
+        return 0;
+    }
+
+    /* Otherwise write the buffered data and the new chunks together, without
+     * copying the new chunks first. */
+    while (count > 0) {
+        struct iovec  iov[IOV_COUNT];
+        size_t  iov_count = 0;
+        if (self->size > 0) {
+            iov[iov_count].iov_base = self->buf;
+            iov[iov_count].iov_len = self->size;
+            iov_count++;
+            self->size = 0;
+        }
+        while (count > 0 && iov_count < IOV_COUNT) {
+            iov[iov_count].iov_base = (void *) slices->buf;
+            iov[iov_count].iov_len = slices->size;
+            iov_count++;
+            slices++;
+            count--;
+        }
+        rii_check(cork_writev_all(self->fd, iov, iov_count));
+    }
+    return 0;
+}
+
+static int
+cork_buffered_fd_consumer__eof(struct cork_stream_consumer *vself)
+{
+    struct cork_buffered_fd_consumer  *self =
+        cork_container_of(vself, struct cork_buffered_fd_consumer, parent);
+    rii_check(cork_buffered_fd_consumer_drain(self));
+    if (self->sync_policy != CORK_FD_SYNC_NONE) {
+        rii_check(cork_buffered_fd_consumer_sync(self));
+    }
+    return 0;
+}
+
+static void
+cork_buffered_fd_consumer__free(struct cork_stream_consumer *vself)
+{
+    struct cork_buffered_fd_consumer  *self =
+        cork_container_of(vself, struct cork_buffered_fd_consumer, parent);
+    /* There's nowhere to report an error, but we'd rather not silently lose
+     * any data that's still buffered. */
+    if (cork_buffered_fd_consumer_drain(self) != 0) {
+        cork_error_clear();
+    }
+    cork_free(self->buf, self->allocated_size);
+    cork_delete(struct cork_buffered_fd_consumer, self);
+}
+
+struct cork_stream_consumer *
+cork_buffered_fd_consumer_new(int fd, size_t buffer_size,
+                              enum cork_fd_sync_policy sync_policy)
+{
+    struct cork_buffered_fd_consumer  *self =
+        cork_new(struct cork_buffered_fd_consumer);
+    if (buffer_size == 0) {
+        buffer_size = CORK_BUFFERED_FD_CONSUMER_DEFAULT_SIZE;
+    }
+    self->parent.data = cork_stream_consumer_data_via_vec;
+    self->parent.data_vec = cork_buffered_fd_consumer__data_vec;
+    self->parent.eof = cork_buffered_fd_consumer__eof;
+    self->parent.free = cork_buffered_fd_consumer__free;
+    self->fd = fd;
+    self->sync_policy = sync_policy;
+    self->buf = cork_malloc(buffer_size);
+    self->size = 0;
+    self->allocated_size = buffer_size;
+    return &self->parent;
+}
+
+int
+cork_buffered_fd_consumer_flush(struct cork_stream_consumer *vself)
+{
+    struct cork_buffered_fd_consumer  *self =
+        cork_container_of(vself, struct cork_buffered_fd_consumer, parent);
+    rii_check(cork_buffered_fd_consumer_drain(self));
+    if (self->sync_policy == CORK_FD_SYNC_ON_FLUSH) {
+        rii_check(cork_buffered_fd_consumer_sync(self));
+    }
+    return 0;
+}
@@ -0,0 +1,371 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/byte-order.h"
+#include "libcork/core/error.h"
+#include "libcork/core/hash.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/buffer.h"
+#include "libcork/ds/frozen-hash-table.h"
+#include "libcork/ds/hash-table.h"
+#include "libcork/ds/slice.h"
+#include "libcork/ds/stream.h"
+#include "libcork/helpers/errors.h"
+
+
+/*-----------------------------------------------------------------------
+ * Image format
+ */
+
+/* An image consists of a header, an array of slots, and a data section
+ * containing every key and value:
+ *
+ *   offset  size  field
+ *        0     8  magic ("CORKFHT1")
+ *        8     4  seed
+ *       12     4  reserved (0)
+ *       16     8  entry count
+ *       24     8  slot count (a power of two)
+ *       32     8  data size
+ *
+ * Each slot is:
+ *
+ *        0     4  hash of the key
+ *        4     4  key length
+ *        8     4  value length
+ *       12     4  reserved (0)
+ *       16     8  offset of the key within the data section, or UINT64_MAX if
+ *                 the slot is empty
+ *
+ * Keys are placed with linear probing, and there's always at least one empty
+ * slot.  Each value follows its key, and both start on an 8-byte boundary. */
+
+#define CORK_FROZEN_MAGIC  "CORKFHT1"
+#define CORK_FROZEN_MAGIC_SIZE  8
+#define CORK_FROZEN_HEADER_SIZE  40
+#define CORK_FROZEN_SLOT_SIZE  24
+#define CORK_FROZEN_EMPTY  UINT64_MAX
+#define CORK_FROZEN_SEED  0
+
+#define cork_frozen_align(size)  (((size) + 7) & ~((size_t) 7))
+
+
+/*-----------------------------------------------------------------------
+ * Freezing
+ */
+
+int
+cork_hash_table_freeze_string(void *user_data, const void *item,
+                              struct cork_buffer *dest)
+{
+    cork_buffer_append(dest, item, strlen(item));
+    return 0;
+}
+
+static void
+cork_frozen_pad(struct cork_buffer *data)
+{
+    static const uint8_t  ZEROES[8] = { 0 };
+    size_t  padded = cork_frozen_align(data->size);
+    cork_buffer_append(data, ZEROES, padded - data->size);
+}
+
+static int
+cork_frozen_add_entry(uint8_t *slots, size_t mask, struct cork_buffer *data,
+                      size_t key_offset, size_t key_len, size_t value_len)
+{
+    const uint8_t  *key = (const uint8_t *) data->buf + key_offset;
+    cork_hash  hash = cork_stable_hash_buffer(CORK_FROZEN_SEED, key, key_len);
+    size_t  index = hash & mask;
+
+    while (true) {
+        uint8_t  *slot = slots + index * CORK_FROZEN_SLOT_SIZE;
+        uint64_t  offset = cork_load_le64(slot + 16);
+        if (offset == CORK_FROZEN_EMPTY) {
+            cork_store_le32(slot, hash);
+            cork_store_le32(slot + 4, key_len);
+            cork_store_le32(slot + 8, value_len);
+            cork_store_le32(slot + 12, 0);
+            cork_store_le64(slot + 16, key_offset);
+            return 0;
+        }
+
+        if (cork_load_le32(slot) == hash &&
+            cork_load_le32(slot + 4) == key_len &&
+            memcmp((const uint8_t *) data->buf + offset, key, key_len) == 0) {
+            cork_error_set_printf
+                (CORK_FROZEN_HASH_TABLE_DUPLICATE_KEY,
+                 "Two hash table keys have the same frozen representation");
+            return -1;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+int
+cork_hash_table_freeze(struct cork_hash_table *table, void *user_data,
+                       cork_hash_table_freeze_f freeze_key,
+                       cork_hash_table_freeze_f freeze_value,
+                       struct cork_stream_consumer *dest)
+{
+    size_t  count = cork_hash_table_size(table);
+    size_t  slot_count;
+    size_t  slots_size;
+    size_t  i;
+    uint8_t  *slots;
+    uint8_t  header[CORK_FROZEN_HEADER_SIZE];
+    struct cork_buffer  data = CORK_BUFFER_INIT();
+    struct cork_hash_table_iterator  iter;
+    struct cork_hash_table_entry  *entry;
+
+    /* Keep the load factor at or below 3/4, which also guarantees an empty
+     * slot to end every probe sequence. */
+    slot_count = 8;
+    while (slot_count - slot_count / 4 <= count) {
+        slot_count <<= 1;
+    }
+    slots_size = slot_count * CORK_FROZEN_SLOT_SIZE;
+    slots = cork_malloc(slots_size);
+    memset(slots, 0, slots_size);
+    for (i = 0; i < slot_count; i++) {
+        cork_store_le64(slots + i * CORK_FROZEN_SLOT_SIZE + 16,
+                        CORK_FROZEN_EMPTY);
+    }
+
+    cork_hash_table_iterator_init(table, &iter);
+    while ((entry = cork_hash_table_iterator_next(&iter)) != NULL) {
+        size_t  key_offset;
+        size_t  key_len;
+        size_t  value_offset;
+        size_t  value_len;
+
+        key_offset = data.size;
+        ei_check(freeze_key(user_data, entry->key, &data));
+        key_len = data.size - key_offset;
+        cork_frozen_pad(&data);
+
+        value_offset = data.size;
+        if (freeze_value != NULL) {
+            ei_check(freeze_value(user_data, entry->value, &data));
+        }
+        value_len = data.size - value_offset;
+        cork_frozen_pad(&data);
+
+        if (key_len > UINT32_MAX || value_len > UINT32_MAX) {
+            cork_error_set_printf
+                (CORK_PARSE_ERROR, "Frozen hash table entry is too large");
+            goto error;
+        }
+        ei_check(cork_frozen_add_entry
+                 (slots, slot_count - 1, &data, key_offset, key_len,
+                  value_len));
+    }
+
+    memcpy(header, CORK_FROZEN_MAGIC, CORK_FROZEN_MAGIC_SIZE);
+    cork_store_le32(header + 8, CORK_FROZEN_SEED);
+    cork_store_le32(header + 12, 0);
+    cork_store_le64(header + 16, count);
+    cork_store_le64(header + 24, slot_count);
+    cork_store_le64(header + 32, data.size);
+
+    ei_check(cork_stream_consumer_data
+             (dest, header, CORK_FROZEN_HEADER_SIZE, true));
+    ei_check(cork_stream_consumer_data(dest, slots, slots_size, false));
+    if (data.size > 0) {
+        ei_check(cork_stream_consumer_data(dest, data.buf, data.size, false));
+    }
+    cork_free(slots, slots_size);
+    cork_buffer_done(&data);
+    return cork_stream_consumer_eof(dest);
+
+error:
+    cork_free(slots, slots_size);
+    cork_buffer_done(&data);
+    return -1;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Reading
+ */
+
+struct cork_frozen_hash_table {
+    struct cork_slice  backing;
+    const uint8_t  *slots;
+    const uint8_t  *data;
+    size_t  entry_count;
+    size_t  slot_count;
+    size_t  data_size;
+    cork_hash  seed;
+};
+
+struct cork_frozen_hash_table *
+cork_frozen_hash_table_open(const struct cork_slice *src)
+{
+    const uint8_t  *buf = src->buf;
+    size_t  size = src->size;
+    uint64_t  entry_count;
+    uint64_t  slot_count;
+    uint64_t  data_size;
+    size_t  slots_size;
+    struct cork_frozen_hash_table  *table;
+
+    if (size < CORK_FROZEN_HEADER_SIZE ||
+        memcmp(buf, CORK_FROZEN_MAGIC, CORK_FROZEN_MAGIC_SIZE) != 0) {
+        cork_parse_error("Invalid frozen hash table header");
+        return NULL;
+    }
+
+    entry_count = cork_load_le64(buf + 16);
+    slot_count = cork_load_le64(buf + 24);
+    data_size = cork_load_le64(buf + 32);
+    if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0 ||
+        entry_count >= slot_count) {
+        cork_parse_error("Invalid frozen hash table size");
+        return NULL;
+    }
+    if ((size - CORK_FROZEN_HEADER_SIZE) / CORK_FROZEN_SLOT_SIZE < slot_count) {
+        cork_parse_error("Frozen hash table is truncated");
+        return NULL;
+    }
+    slots_size = slot_count * CORK_FROZEN_SLOT_SIZE;
+    if (size - CORK_FROZEN_HEADER_SIZE - slots_size < data_size) {
+        cork_parse_error("Frozen hash table is truncated");
+        return NULL;
+    }
+
+    table = cork_new(struct cork_frozen_hash_table);
+    /* Some slices (like copy-once slices) move their content when you copy
+     * them, so we have to point into our own copy. */
+    if (cork_slice_copy(&table->backing, src, 0, size) != 0) {
+        cork_delete(struct cork_frozen_hash_table, table);
+        return NULL;
+    }
+    buf = table->backing.buf;
+    table->slots = buf + CORK_FROZEN_HEADER_SIZE;
+    table->data = table->slots + slots_size;
+    table->entry_count = entry_count;
+    table->slot_count = slot_count;
+    table->data_size = data_size;
+    table->seed = cork_load_le32(buf + 8);
+    return table;
+}
+
+void
+cork_frozen_hash_table_free(struct cork_frozen_hash_table *table)
+{
+    cork_slice_finish(&table->backing);
+    cork_delete(struct cork_frozen_hash_table, table);
+}
+
+size_t
+cork_frozen_hash_table_size(const struct cork_frozen_hash_table *table)
+{
+    return table->entry_count;
+}
+
+/* Fills in entry from a non-empty slot.  Returns false if the slot points
+ * outside of the data section, which can only happen in a corrupt image. */
+static bool
+cork_frozen_slot_entry(const struct cork_frozen_hash_table *table,
+                       const uint8_t *slot, uint64_t key_offset,
+                       struct cork_frozen_hash_table_entry *entry)
+{
+    size_t  key_len = cork_load_le32(slot + 4);
+    size_t  value_len = cork_load_le32(slot + 8);
+    uint64_t  value_offset;
+
+    if (key_offset > table->data_size ||
+        key_len > table->data_size - key_offset) {
+        return false;
+    }
+    value_offset = key_offset + cork_frozen_align(key_len);
+    if (value_offset > table->data_size ||
+        value_len > table->data_size - value_offset) {
+        return false;
+    }
+
+    entry->key = table->data + key_offset;
+    entry->key_len = key_len;
+    entry->value = table->data + value_offset;
+    entry->value_len = value_len;
+    return true;
+}
+
+const void *
+cork_frozen_hash_table_get(const struct cork_frozen_hash_table *table,
+                           const void *key, size_t key_len,
+                           size_t *value_len)
+{
+    cork_hash  hash = cork_stable_hash_buffer(table->seed, key, key_len);
+    size_t  mask = table->slot_count - 1;
+    size_t  index = hash & mask;
+    size_t  probes;
+
+    /* A valid image always has an empty slot, but we still bound the probe
+     * sequence in case this one doesn't. */
+    for (probes = 0; probes < table->slot_count; probes++) {
+        const uint8_t  *slot = table->slots + index * CORK_FROZEN_SLOT_SIZE;
+        uint64_t  offset = cork_load_le64(slot + 16);
+        struct cork_frozen_hash_table_entry  entry;
+
+        if (offset == CORK_FROZEN_EMPTY) {
+            return NULL;
+        }
+        if (cork_load_le32(slot) == hash &&
+            cork_load_le32(slot + 4) == key_len &&
+            cork_frozen_slot_entry(table, slot, offset, &entry) &&
+            memcmp(entry.key, key, key_len) == 0) {
+            if (value_len != NULL) {
+                *value_len = entry.value_len;
+            }
+            return entry.value;
+        }
+        index = (index + 1) & mask;
+    }
+    return NULL;
+}
+
+bool
+cork_frozen_hash_table_contains(const struct cork_frozen_hash_table *table,
+                                const void *key, size_t key_len)
+{
+    return cork_frozen_hash_table_get(table, key, key_len, NULL) != NULL;
+}
+
+void
+cork_frozen_hash_table_iterator_init
+(const struct cork_frozen_hash_table *table,
+ struct cork_frozen_hash_table_iterator *iterator)
+{
+    iterator->table = table;
+    iterator->index = 0;
+}
+
+bool
+cork_frozen_hash_table_iterator_next
+(struct cork_frozen_hash_table_iterator *iterator,
+ struct cork_frozen_hash_table_entry *entry)
+{
+    const struct cork_frozen_hash_table  *table = iterator->table;
+    while (iterator->index < table->slot_count) {
+        const uint8_t  *slot =
+            table->slots + iterator->index * CORK_FROZEN_SLOT_SIZE;
+        uint64_t  offset = cork_load_le64(slot + 16);
+        iterator->index++;
+        if (offset != CORK_FROZEN_EMPTY &&
+            cork_frozen_slot_entry(table, slot, offset, entry)) {
+            return true;
+        }
+    }
+    return false;
+}
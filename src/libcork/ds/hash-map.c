@@ -0,0 +1,76 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/hash-map.h"
+
+
+/* The smallest number of slots that we'll allocate */
+#define CORK_HASH_MAP_MIN_SLOTS  16
+
+/* We let the map fill up to 7/8 of its slots (counting tombstones) before
+ * growing. */
+#define CORK_HASH_MAP_MAX_LOAD(slot_count)  ((slot_count) - ((slot_count) / 8))
+
+void
+cork_raw_hash_map_init(struct cork_raw_hash_map *map)
+{
+    map->ctrl = NULL;
+    map->entries = NULL;
+    map->size = 0;
+    map->slot_count = 0;
+    map->growth_left = 0;
+}
+
+void
+cork_raw_hash_map_done(struct cork_raw_hash_map *map, size_t entry_size)
+{
+    if (map->slot_count > 0) {
+        cork_raw_hash_map_free_slots
+            (map->ctrl, map->entries, map->slot_count, entry_size);
+    }
+}
+
+void
+cork_raw_hash_map_clear(struct cork_raw_hash_map *map)
+{
+    if (map->slot_count > 0) {
+        memset(map->ctrl, CORK_HASH_MAP_CTRL_EMPTY, map->slot_count);
+    }
+    map->size = 0;
+    map->growth_left = CORK_HASH_MAP_MAX_LOAD(map->slot_count);
+}
+
+void
+cork_raw_hash_map_allocate(struct cork_raw_hash_map *map, size_t entry_size,
+                           size_t desired_count)
+{
+    size_t  slot_count = CORK_HASH_MAP_MIN_SLOTS;
+    while (CORK_HASH_MAP_MAX_LOAD(slot_count) < desired_count) {
+        slot_count <<= 1;
+    }
+    map->slot_count = slot_count;
+    map->growth_left = CORK_HASH_MAP_MAX_LOAD(slot_count);
+    map->entries = cork_calloc(slot_count, entry_size);
+    map->ctrl = cork_malloc(slot_count);
+    memset(map->ctrl, CORK_HASH_MAP_CTRL_EMPTY, slot_count);
+}
+
+void
+cork_raw_hash_map_free_slots(uint8_t *ctrl, void *entries, size_t slot_count,
+                             size_t entry_size)
+{
+    if (slot_count > 0) {
+        cork_cfree(entries, slot_count, entry_size);
+        cork_free(ctrl, slot_count);
+    }
+}
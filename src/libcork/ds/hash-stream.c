@@ -0,0 +1,66 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2012-2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/hash.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/stream.h"
+
+
+struct cork_big_hash_consumer {
+    struct cork_stream_consumer  parent;
+    struct cork_big_hash_state  state;
+    cork_big_hash  *dest;
+};
+
+static int
+cork_big_hash_consumer__data_vec(struct cork_stream_consumer *vself,
+                                 const struct cork_slice *slices,
+                                 size_t count, bool is_first_chunk)
+{
+    struct cork_big_hash_consumer  *self =
+        cork_container_of(vself, struct cork_big_hash_consumer, parent);
+    size_t  i;
+    for (i = 0; i < count; i++) {
+        cork_big_hash_state_update
+            (&self->state, slices[i].buf, slices[i].size);
+    }
+    return 0;
+}
+
+static int
+cork_big_hash_consumer__eof(struct cork_stream_consumer *vself)
+{
+    struct cork_big_hash_consumer  *self =
+        cork_container_of(vself, struct cork_big_hash_consumer, parent);
+    *self->dest = cork_big_hash_state_final(&self->state);
+    return 0;
+}
+
+static void
+cork_big_hash_consumer__free(struct cork_stream_consumer *vself)
+{
+    struct cork_big_hash_consumer  *self =
+        cork_container_of(vself, struct cork_big_hash_consumer, parent);
+    cork_delete(struct cork_big_hash_consumer, self);
+}
+
+struct cork_stream_consumer *
+cork_big_hash_consumer_new(cork_big_hash seed, cork_big_hash *dest)
+{
+    struct cork_big_hash_consumer  *self =
+        cork_new(struct cork_big_hash_consumer);
+    self->parent.data = cork_stream_consumer_data_via_vec;
+    self->parent.data_vec = cork_big_hash_consumer__data_vec;
+    self->parent.eof = cork_big_hash_consumer__eof;
+    self->parent.free = cork_big_hash_consumer__free;
+    cork_big_hash_state_init(&self->state, seed);
+    self->dest = dest;
+    return &self->parent;
+}
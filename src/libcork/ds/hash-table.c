@@ -7,11 +7,15 @@
  * ----------------------------------------------------------------------
  */
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "libcork/core/allocator.h"
 #include "libcork/core/callbacks.h"
 #include "libcork/core/hash.h"
+#include "libcork/core/mempool.h"
+#include "libcork/core/trace.h"
 #include "libcork/core/types.h"
 #include "libcork/ds/dllist.h"
 #include "libcork/ds/hash-table.h"
@@ -40,18 +44,43 @@
 struct cork_hash_table_entry_priv {
     struct cork_hash_table_entry  public;
     struct cork_dllist_item  in_bucket;
+    /* Must be last; CORK_HASH_TABLE_UNORDERED tables don't allocate it. */
     struct cork_dllist_item  insertion_order;
 };
 
+#define CORK_HASH_TABLE_UNORDERED_ENTRY_SIZE \
+    (offsetof(struct cork_hash_table_entry_priv, insertion_order))
+
 struct cork_hash_table {
     struct cork_dllist  *bins;
     struct cork_dllist  insertion_order;
     size_t  bin_count;
     size_t  bin_mask;
     size_t  entry_count;
+    /* The size of each separately allocated entry */
+    size_t  entry_size;
+    /* The initial size of the table, which we never shrink below */
+    size_t  min_size;
+    unsigned int  flags;
+    /* Only used while an incremental resize is in progress */
+    struct cork_dllist  *old_bins;
+    size_t  old_bin_count;
+    size_t  old_bin_mask;
+    size_t  migrate_index;
+    /* Only used for CORK_HASH_TABLE_OPEN_ADDRESSING tables */
+    struct cork_hash_table_entry  *slots;
+    uint8_t  *ctrl;
+    size_t  slot_count;
+    size_t  group_mask;
+    size_t  growth_left;
+    const struct cork_alloc  *alloc;
+    /* Only used for CORK_HASH_TABLE_POOLED_ENTRIES tables */
+    struct cork_mempool  *entry_pool;
     void  *user_data;
     cork_free_f  free_user_data;
     cork_hash_f  hash;
+    /* If this isn't NULL, it overrides `hash`. */
+    cork_hash64_f  hash64;
     cork_equals_f  equals;
     cork_free_f  free_key;
     cork_free_f  free_value;
@@ -70,6 +99,30 @@ cork_hash_table__default_equals(void *user_data,
     return key1 == key2;
 }
 
+/* Internally we only work with 64-bit hashes.  We widen a 32-bit hash by
+ * duplicating it, so that both the low bits (which select a bin or group) and
+ * the high bits (which open-addressed tables store in their control bytes)
+ * come from the original hash, just as they did before tables were 64-bit. */
+#define cork_hash_table_widen(hash)  (((cork_hash64) (hash) << 32) | (hash))
+
+static inline cork_hash64
+cork_hash_table_hash_key(const struct cork_hash_table *table, const void *key)
+{
+    if (table->hash64 != NULL) {
+        return table->hash64(table->user_data, key);
+    } else {
+        return cork_hash_table_widen(table->hash(table->user_data, key));
+    }
+}
+
+static inline void
+cork_hash_table_entry_set_hash(struct cork_hash_table_entry *entry,
+                               cork_hash64 hash)
+{
+    entry->hash = (cork_hash) hash;
+    entry->hash_high = (cork_hash) (hash >> 32);
+}
+
 
 /* The default initial number of bins to allocate in a new table. */
 #define CORK_HASH_TABLE_DEFAULT_INITIAL_SIZE  8
@@ -78,6 +131,11 @@ cork_hash_table__default_equals(void *user_data,
  * number of bins. */
 #define CORK_HASH_TABLE_MAX_DENSITY  5
 
+/* CORK_HASH_TABLE_AUTO_SHRINK tables shrink once fewer than 1 in this many
+ * bins (or slots) are in use.  When we shrink, we leave room for the table to
+ * double in size again before it has to grow. */
+#define CORK_HASH_TABLE_SHRINK_DENSITY  8
+
 /* Return a power-of-2 bin count that's at least as big as the given requested
  * size. */
 static inline size_t
@@ -94,7 +152,30 @@ cork_hash_table_new_size(size_t desired_count)
     return r;
 }
 
+/* The number of old bins to migrate into the new bin array during each
+ * operation on a table using CORK_HASH_TABLE_INCREMENTAL_RESIZE.  Since the
+ * bin count doubles when we resize, and we only resize once the density of
+ * the new bin array is exceeded, any value of at least 1 guarantees that a
+ * migration will finish before the next one needs to start. */
+#define CORK_HASH_TABLE_MIGRATE_BINS  4
+
 #define bin_index(table, hash)  ((hash) & (table)->bin_mask)
+#define is_ordered(table)  (!((table)->flags & CORK_HASH_TABLE_UNORDERED))
+
+/* Returns the bin that should contain a particular hash value.  If we're in the
+ * middle of an incremental resize, this might be an old bin that hasn't been
+ * migrated yet. */
+static inline struct cork_dllist *
+cork_hash_table_bin(const struct cork_hash_table *table, cork_hash64 hash)
+{
+    if (CORK_UNLIKELY(table->old_bins != NULL)) {
+        size_t  old_index = hash & table->old_bin_mask;
+        if (old_index >= table->migrate_index) {
+            return &table->old_bins[old_index];
+        }
+    }
+    return &table->bins[bin_index(table, hash)];
+}
 
 /* Allocates a new bins array in a hash table.  We overwrite the old
  * array, so make sure to stash it away somewhere safe first. */
@@ -107,21 +188,98 @@ cork_hash_table_allocate_bins(struct cork_hash_table *table,
     table->bin_count = cork_hash_table_new_size(desired_count);
     table->bin_mask = table->bin_count - 1;
     DEBUG("Allocate %zu bins", table->bin_count);
-    table->bins = cork_calloc(table->bin_count, sizeof(struct cork_dllist));
+    table->bins = cork_alloc_calloc
+        (table->alloc, table->bin_count, sizeof(struct cork_dllist));
     for (i = 0; i < table->bin_count; i++) {
         cork_dllist_init(&table->bins[i]);
     }
 }
 
 
+/* Moves every entry in `bin` into the appropriate bin of the table's current
+ * bin array. */
+static void
+cork_hash_table_migrate_bin(struct cork_hash_table *table,
+                            struct cork_dllist *bin)
+{
+    struct cork_dllist_item  *curr = cork_dllist_start(bin);
+    while (!cork_dllist_is_end(bin, curr)) {
+        struct cork_hash_table_entry_priv  *entry =
+            cork_container_of
+            (curr, struct cork_hash_table_entry_priv, in_bucket);
+        struct cork_dllist_item  *next = curr->next;
+        size_t  bin_index =
+            bin_index(table, cork_hash_table_entry_hash64(&entry->public));
+        DEBUG("      Rehash %p to bin %zu", entry, bin_index);
+        cork_dllist_add(&table->bins[bin_index], curr);
+        curr = next;
+    }
+}
+
+/* Moves every entry in an old bins array into the table's current bins, and
+ * then frees the old array. */
+static void
+cork_hash_table_move_bins(struct cork_hash_table *table,
+                          struct cork_dllist *old_bins, size_t old_bin_count)
+{
+    size_t  i;
+    if (old_bins == NULL) {
+        return;
+    }
+    for (i = 0; i < old_bin_count; i++) {
+        cork_hash_table_migrate_bin(table, &old_bins[i]);
+    }
+    cork_alloc_cfree(table->alloc, old_bins, old_bin_count,
+                     sizeof(struct cork_dllist));
+}
+
+static void
+cork_hash_table_free_old_bins(struct cork_hash_table *table)
+{
+    cork_alloc_cfree(table->alloc, table->old_bins, table->old_bin_count,
+                     sizeof(struct cork_dllist));
+    table->old_bins = NULL;
+    table->old_bin_count = 0;
+    table->old_bin_mask = 0;
+    table->migrate_index = 0;
+}
+
+/* Migrates up to `count` bins of an in-progress incremental resize. */
+static void
+cork_hash_table_migrate(struct cork_hash_table *table, size_t count)
+{
+    if (CORK_LIKELY(table->old_bins == NULL)) {
+        return;
+    }
+
+    while (count > 0 && table->migrate_index < table->old_bin_count) {
+        DEBUG("    Migrate bin %zu", table->migrate_index);
+        cork_hash_table_migrate_bin
+            (table, &table->old_bins[table->migrate_index]);
+        table->migrate_index++;
+        count--;
+    }
+
+    if (table->migrate_index == table->old_bin_count) {
+        DEBUG("    Finished incremental migration");
+        cork_hash_table_free_old_bins(table);
+    }
+}
+
 static struct cork_hash_table_entry_priv *
 cork_hash_table_new_entry(struct cork_hash_table *table,
-                          cork_hash hash, void *key, void *value)
+                          cork_hash64 hash, void *key, void *value)
 {
-    struct cork_hash_table_entry_priv  *entry =
-        cork_new(struct cork_hash_table_entry_priv);
-    cork_dllist_add(&table->insertion_order, &entry->insertion_order);
-    entry->public.hash = hash;
+    struct cork_hash_table_entry_priv  *entry;
+    if (table->entry_pool != NULL) {
+        entry = cork_mempool_new_object(table->entry_pool);
+    } else {
+        entry = cork_alloc_malloc(table->alloc, table->entry_size);
+    }
+    if (is_ordered(table)) {
+        cork_dllist_add(&table->insertion_order, &entry->insertion_order);
+    }
+    cork_hash_table_entry_set_hash(&entry->public, hash);
     entry->public.key = key;
     entry->public.value = value;
     return entry;
@@ -137,30 +295,429 @@ cork_hash_table_free_entry(struct cork_hash_table *table,
     if (table->free_value != NULL) {
         table->free_value(entry->public.value);
     }
-    cork_dllist_remove(&entry->insertion_order);
-    cork_delete(struct cork_hash_table_entry_priv, entry);
+    if (is_ordered(table)) {
+        cork_dllist_remove(&entry->insertion_order);
+    }
+    if (table->entry_pool != NULL) {
+        cork_mempool_free_object(table->entry_pool, entry);
+    } else {
+        cork_alloc_free(table->alloc, entry, table->entry_size);
+    }
+}
+
+/* Frees every entry in a bin, without bothering to unlink them from the bin
+ * itself. */
+static void
+cork_hash_table_free_bin_entries(struct cork_hash_table *table,
+                                 struct cork_dllist *bin)
+{
+    struct cork_dllist_item  *curr;
+    struct cork_dllist_item  *next;
+    cork_dllist_foreach_void(bin, curr, next) {
+        struct cork_hash_table_entry_priv  *entry =
+            cork_container_of(curr, struct cork_hash_table_entry_priv,
+                              in_bucket);
+        cork_hash_table_free_entry(table, entry);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Open addressing
+ */
+
+/* Open-addressed tables store their entries directly in a flat array of slots,
+ * with a separate array of one-byte control values describing each slot.  The
+ * slots are divided into groups of CORK_HASH_TABLE_GROUP_SIZE; a key's home
+ * group is selected by the low bits of its hash, and we use a triangular probe
+ * sequence over groups to resolve collisions.  A full slot's control byte
+ * holds the top 7 bits of its entry's 64-bit hash, which lets us rule out most
+ * non-matching slots without touching the slot array (or calling the equals
+ * callback) at all. */
+
+#define CORK_HASH_TABLE_GROUP_SIZE  16
+#define CORK_HASH_TABLE_CTRL_EMPTY    ((uint8_t) 0x80)
+#define CORK_HASH_TABLE_CTRL_DELETED  ((uint8_t) 0xfe)
+
+/* We let the table fill up to 7/8 of its slots (counting tombstones) before
+ * growing. */
+#define CORK_HASH_TABLE_MAX_LOAD(slot_count)  ((slot_count) - ((slot_count) / 8))
+
+#define is_open(table)  ((table)->flags & CORK_HASH_TABLE_OPEN_ADDRESSING)
+#define ctrl_is_full(c)  (((c) & 0x80) == 0)
+#define hash_h1(table, hash)  ((hash) & (table)->group_mask)
+#define hash_h2(hash)  ((uint8_t) ((hash) >> 57))
+
+/* The group matching functions each return a bitmask describing which slots in
+ * a group of control bytes match some condition.  Depending on which
+ * implementation we're using, each slot is represented by 1 or 4 bits of the
+ * mask (CORK_HASH_TABLE_GROUP_SHIFT is the log2 of this), with only the lowest
+ * bit of each slot's run ever set.  We use SSE2 or NEON to compare the entire
+ * group at once when available. */
+
+typedef uint64_t  cork_hash_table_group_mask;
+
+#if CORK_CONFIG_HAVE_SSE2
+#include <emmintrin.h>
+
+#define CORK_HASH_TABLE_GROUP_SHIFT  0
+
+static inline cork_hash_table_group_mask
+cork_hash_table_group_match(const uint8_t *group, uint8_t h2)
+{
+    __m128i  ctrl = _mm_loadu_si128((const __m128i *) group);
+    __m128i  match = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) h2));
+    return (uint16_t) _mm_movemask_epi8(match);
+}
+
+static inline cork_hash_table_group_mask
+cork_hash_table_group_match_available(const uint8_t *group)
+{
+    /* Empty and deleted slots are exactly the ones with the high bit set. */
+    __m128i  ctrl = _mm_loadu_si128((const __m128i *) group);
+    return (uint16_t) _mm_movemask_epi8(ctrl);
+}
+
+#elif CORK_CONFIG_HAVE_NEON
+#include <arm_neon.h>
+
+#define CORK_HASH_TABLE_GROUP_SHIFT  2
+
+/* NEON doesn't have a movemask instruction, but we can narrow each 16-bit lane
+ * of the comparison result to 8 bits, which gives us a 64-bit mask with 4 bits
+ * per slot. */
+static inline cork_hash_table_group_mask
+cork_hash_table_group_neon_mask(uint8x16_t match)
+{
+    uint8x8_t  narrowed = vshrn_n_u16(vreinterpretq_u16_u8(match), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0) &
+        UINT64_C(0x1111111111111111);
+}
+
+static inline cork_hash_table_group_mask
+cork_hash_table_group_match(const uint8_t *group, uint8_t h2)
+{
+    uint8x16_t  ctrl = vld1q_u8(group);
+    return cork_hash_table_group_neon_mask(vceqq_u8(ctrl, vdupq_n_u8(h2)));
+}
+
+static inline cork_hash_table_group_mask
+cork_hash_table_group_match_available(const uint8_t *group)
+{
+    uint8x16_t  ctrl = vld1q_u8(group);
+    return cork_hash_table_group_neon_mask
+        (vcltq_s8(vreinterpretq_s8_u8(ctrl), vdupq_n_s8(0)));
+}
+
+#else
+
+#define CORK_HASH_TABLE_GROUP_SHIFT  0
+
+static inline cork_hash_table_group_mask
+cork_hash_table_group_match(const uint8_t *group, uint8_t h2)
+{
+    cork_hash_table_group_mask  result = 0;
+    unsigned int  i;
+    for (i = 0; i < CORK_HASH_TABLE_GROUP_SIZE; i++) {
+        result |= (cork_hash_table_group_mask) (group[i] == h2) << i;
+    }
+    return result;
+}
+
+static inline cork_hash_table_group_mask
+cork_hash_table_group_match_available(const uint8_t *group)
+{
+    cork_hash_table_group_mask  result = 0;
+    unsigned int  i;
+    for (i = 0; i < CORK_HASH_TABLE_GROUP_SIZE; i++) {
+        result |= (cork_hash_table_group_mask) !ctrl_is_full(group[i]) << i;
+    }
+    return result;
+}
+
+#endif
+
+static inline cork_hash_table_group_mask
+cork_hash_table_group_match_empty(const uint8_t *group)
+{
+    return cork_hash_table_group_match(group, CORK_HASH_TABLE_CTRL_EMPTY);
+}
+
+#define group_mask_first(mask) \
+    ((size_t) __builtin_ctzll(mask) >> CORK_HASH_TABLE_GROUP_SHIFT)
+#define group_mask_next(mask)  ((mask) & ((mask) - 1))
+
+/* Return a power-of-2 slot count that can hold desired_count entries without
+ * exceeding the maximum load factor. */
+static inline size_t
+cork_hash_table_open_new_size(size_t desired_count)
+{
+    size_t  r = CORK_HASH_TABLE_GROUP_SIZE;
+    while (CORK_HASH_TABLE_MAX_LOAD(r) < desired_count) {
+        r <<= 1;
+    }
+    return r;
+}
+
+static void
+cork_hash_table_open_allocate_slots(struct cork_hash_table *table,
+                                    size_t desired_count)
+{
+    table->slot_count = cork_hash_table_open_new_size(desired_count);
+    table->group_mask = (table->slot_count / CORK_HASH_TABLE_GROUP_SIZE) - 1;
+    table->growth_left = CORK_HASH_TABLE_MAX_LOAD(table->slot_count);
+    DEBUG("Allocate %zu slots", table->slot_count);
+    table->slots = cork_alloc_calloc
+        (table->alloc, table->slot_count,
+         sizeof(struct cork_hash_table_entry));
+    table->ctrl = cork_alloc_malloc(table->alloc, table->slot_count);
+    memset(table->ctrl, CORK_HASH_TABLE_CTRL_EMPTY, table->slot_count);
+}
+
+static void
+cork_hash_table_open_free_slots(struct cork_hash_table *table)
+{
+    cork_alloc_cfree(table->alloc, table->slots, table->slot_count,
+                     sizeof(struct cork_hash_table_entry));
+    cork_alloc_free(table->alloc, table->ctrl, table->slot_count);
+}
+
+static void
+cork_hash_table_open_free_entry(struct cork_hash_table *table, size_t index)
+{
+    struct cork_hash_table_entry  *entry = &table->slots[index];
+    if (table->free_key != NULL) {
+        table->free_key(entry->key);
+    }
+    if (table->free_value != NULL) {
+        table->free_value(entry->value);
+    }
+}
+
+/* Returns the index of the slot containing `key`, or `SIZE_MAX` if the key
+ * isn't in the table. */
+static size_t
+cork_hash_table_open_find(const struct cork_hash_table *table,
+                          cork_hash64 hash, const void *key)
+{
+    size_t  group = hash_h1(table, hash);
+    size_t  step = 0;
+    uint8_t  h2 = hash_h2(hash);
+    DEBUG("(find) Search for key %p (hash 0x%016" PRIx64 ", group %zu)",
+          key, hash, group);
+
+    while (true) {
+        size_t  base = group * CORK_HASH_TABLE_GROUP_SIZE;
+        const uint8_t  *ctrl = &table->ctrl[base];
+        cork_hash_table_group_mask  match =
+            cork_hash_table_group_match(ctrl, h2);
+        while (match != 0) {
+            size_t  index = base + group_mask_first(match);
+            struct cork_hash_table_entry  *entry = &table->slots[index];
+            DEBUG("  Check slot %zu", index);
+            if (cork_hash_table_entry_hash64(entry) == hash &&
+                table->equals(table->user_data, key, entry->key)) {
+                DEBUG("  Match");
+                return index;
+            }
+            match = group_mask_next(match);
+        }
+
+        if (cork_hash_table_group_match_empty(ctrl) != 0) {
+            DEBUG("  Entry not found");
+            return SIZE_MAX;
+        }
+
+        step++;
+        group = (group + step) & table->group_mask;
+    }
+}
+
+/* Returns the index of the first empty or deleted slot in `hash`'s probe
+ * sequence. */
+static size_t
+cork_hash_table_open_find_available(const struct cork_hash_table *table,
+                                    cork_hash64 hash)
+{
+    size_t  group = hash_h1(table, hash);
+    size_t  step = 0;
+    while (true) {
+        size_t  base = group * CORK_HASH_TABLE_GROUP_SIZE;
+        cork_hash_table_group_mask  match =
+            cork_hash_table_group_match_available(&table->ctrl[base]);
+        if (match != 0) {
+            return base + group_mask_first(match);
+        }
+        step++;
+        group = (group + step) & table->group_mask;
+    }
+}
+
+/* hash_table_resize(table, old_size, new_size, duration_ns), where the sizes
+ * are bin counts for a chained table, and slot counts for an open addressing
+ * table.  For an incremental resize, the duration only covers allocating the
+ * new bins, since we migrate the entries a few at a time afterwards. */
+cork_tracepoint(hash_table_resize);
+
+static void
+cork_hash_table_open_resize(struct cork_hash_table *table, size_t desired_count)
+{
+    struct cork_hash_table_entry  *old_slots = table->slots;
+    uint8_t  *old_ctrl = table->ctrl;
+    size_t  old_slot_count = table->slot_count;
+    size_t  i;
+    uint64_t  start = cork_trace_start(hash_table_resize);
+
+    cork_hash_table_open_allocate_slots(table, desired_count);
+    DEBUG("    Rehash %zu slots into %zu", old_slot_count, table->slot_count);
+    for (i = 0; i < old_slot_count; i++) {
+        if (ctrl_is_full(old_ctrl[i])) {
+            struct cork_hash_table_entry  *entry = &old_slots[i];
+            size_t  index = cork_hash_table_open_find_available
+                (table, cork_hash_table_entry_hash64(entry));
+            table->ctrl[index] = old_ctrl[i];
+            table->slots[index] = *entry;
+        }
+    }
+    table->growth_left -= table->entry_count;
+
+    cork_alloc_cfree(table->alloc, old_slots, old_slot_count,
+                     sizeof(struct cork_hash_table_entry));
+    cork_alloc_free(table->alloc, old_ctrl, old_slot_count);
+    cork_trace4(hash_table_resize, table, old_slot_count, table->slot_count,
+                cork_trace_elapsed(start));
+}
+
+/* Claims a slot for a new entry with the given hash, which must not already be
+ * in the table.  Returns the index of the slot. */
+static size_t
+cork_hash_table_open_insert(struct cork_hash_table *table, cork_hash64 hash)
+{
+    size_t  index;
+    if (CORK_UNLIKELY((table->flags & CORK_HASH_TABLE_AUTO_SHRINK) &&
+                      table->entry_count <
+                      table->slot_count / CORK_HASH_TABLE_SHRINK_DENSITY &&
+                      table->slot_count >
+                      cork_hash_table_open_new_size(table->min_size))) {
+        size_t  desired_count = table->entry_count * 2;
+        if (desired_count < table->min_size) {
+            desired_count = table->min_size;
+        }
+        DEBUG("    Reached minimum density; shrink");
+        cork_hash_table_open_resize(table, desired_count);
+    }
+
+    index = cork_hash_table_open_find_available(table, hash);
+    if (CORK_UNLIKELY(table->growth_left == 0 &&
+                      table->ctrl[index] == CORK_HASH_TABLE_CTRL_EMPTY)) {
+        /* If most of the used slots are tombstones, we can reclaim them
+         * without growing the table. */
+        size_t  desired_count = CORK_HASH_TABLE_MAX_LOAD(table->slot_count);
+        if (table->entry_count >= table->slot_count / 2) {
+            desired_count++;
+        }
+        cork_hash_table_open_resize(table, desired_count);
+        index = cork_hash_table_open_find_available(table, hash);
+    }
+
+    if (table->ctrl[index] == CORK_HASH_TABLE_CTRL_EMPTY) {
+        table->growth_left--;
+    }
+    table->ctrl[index] = hash_h2(hash);
+    cork_hash_table_entry_set_hash(&table->slots[index], hash);
+    table->entry_count++;
+    return index;
+}
+
+static void
+cork_hash_table_open_remove(struct cork_hash_table *table, size_t index)
+{
+    /* If the slot's group still has an empty slot, then no probe sequence can
+     * have continued past this group, and we can mark the slot as empty
+     * instead of leaving a tombstone. */
+    size_t  base = index & ~((size_t) CORK_HASH_TABLE_GROUP_SIZE - 1);
+    if (cork_hash_table_group_match_empty(&table->ctrl[base]) != 0) {
+        table->ctrl[index] = CORK_HASH_TABLE_CTRL_EMPTY;
+        table->growth_left++;
+    } else {
+        table->ctrl[index] = CORK_HASH_TABLE_CTRL_DELETED;
+    }
+    table->entry_count--;
+}
+
+static void
+cork_hash_table_open_clear(struct cork_hash_table *table)
+{
+    size_t  i;
+    DEBUG("(clear) Remove all entries");
+    for (i = 0; i < table->slot_count; i++) {
+        if (ctrl_is_full(table->ctrl[i])) {
+            cork_hash_table_open_free_entry(table, i);
+        }
+    }
+    memset(table->ctrl, CORK_HASH_TABLE_CTRL_EMPTY, table->slot_count);
+    table->growth_left = CORK_HASH_TABLE_MAX_LOAD(table->slot_count);
+    table->entry_count = 0;
 }
 
 
 struct cork_hash_table *
-cork_hash_table_new(size_t initial_size, unsigned int flags)
+cork_hash_table_new_ex(size_t initial_size, unsigned int flags,
+                       const struct cork_alloc *alloc)
 {
-    struct cork_hash_table  *table = cork_new(struct cork_hash_table);
+    struct cork_hash_table  *table =
+        cork_alloc_new(alloc, struct cork_hash_table);
     table->entry_count = 0;
+    table->flags = flags;
+    table->alloc = alloc;
+    table->entry_pool = NULL;
+    table->old_bins = NULL;
+    table->old_bin_count = 0;
+    table->old_bin_mask = 0;
+    table->migrate_index = 0;
     table->user_data = NULL;
     table->free_user_data = NULL;
     table->hash = cork_hash_table__default_hash;
+    table->hash64 = NULL;
     table->equals = cork_hash_table__default_equals;
     table->free_key = NULL;
     table->free_value = NULL;
+    table->entry_size = is_ordered(table)?
+        sizeof(struct cork_hash_table_entry_priv):
+        CORK_HASH_TABLE_UNORDERED_ENTRY_SIZE;
     cork_dllist_init(&table->insertion_order);
     if (initial_size < CORK_HASH_TABLE_DEFAULT_INITIAL_SIZE) {
         initial_size = CORK_HASH_TABLE_DEFAULT_INITIAL_SIZE;
     }
-    cork_hash_table_allocate_bins(table, initial_size);
+    table->min_size = initial_size;
+    if (is_open(table)) {
+        table->bins = NULL;
+        table->bin_count = 0;
+        table->bin_mask = 0;
+        cork_hash_table_open_allocate_slots(table, initial_size);
+    } else {
+        table->slots = NULL;
+        table->ctrl = NULL;
+        table->slot_count = 0;
+        table->group_mask = 0;
+        table->growth_left = 0;
+        cork_hash_table_allocate_bins(table, initial_size);
+        if (flags & CORK_HASH_TABLE_POOLED_ENTRIES) {
+            table->entry_pool = cork_mempool_new_size_alloc
+                (table->entry_size, CORK_MEMPOOL_DEFAULT_BLOCK_SIZE,
+                 table->alloc);
+        }
+    }
     return table;
 }
 
+struct cork_hash_table *
+cork_hash_table_new(size_t initial_size, unsigned int flags)
+{
+    return cork_hash_table_new_ex
+        (initial_size, flags, cork_current_allocator());
+}
+
 void
 cork_hash_table_clear(struct cork_hash_table *table)
 {
@@ -168,33 +725,72 @@ cork_hash_table_clear(struct cork_hash_table *table)
     struct cork_dllist_item  *curr;
     struct cork_dllist_item  *next;
 
+    if (is_open(table)) {
+        cork_hash_table_open_clear(table);
+        if (table->flags & CORK_HASH_TABLE_AUTO_SHRINK) {
+            cork_hash_table_shrink_to_fit(table);
+        }
+        return;
+    }
+
     DEBUG("(clear) Remove all entries");
-    for (curr = cork_dllist_start(&table->insertion_order);
-         !cork_dllist_is_end(&table->insertion_order, curr);
-         curr = next) {
-        struct cork_hash_table_entry_priv  *entry =
-            cork_container_of
-            (curr, struct cork_hash_table_entry_priv, insertion_order);
-        next = curr->next;
-        cork_hash_table_free_entry(table, entry);
+    if (is_ordered(table)) {
+        for (curr = cork_dllist_start(&table->insertion_order);
+             !cork_dllist_is_end(&table->insertion_order, curr);
+             curr = next) {
+            struct cork_hash_table_entry_priv  *entry =
+                cork_container_of
+                (curr, struct cork_hash_table_entry_priv, insertion_order);
+            next = curr->next;
+            cork_hash_table_free_entry(table, entry);
+        }
+        cork_dllist_init(&table->insertion_order);
+    } else {
+        for (i = 0; i < table->bin_count; i++) {
+            cork_hash_table_free_bin_entries(table, &table->bins[i]);
+        }
+        if (table->old_bins != NULL) {
+            /* Bins before migrate_index have already been moved into the new
+             * bin array. */
+            for (i = table->migrate_index; i < table->old_bin_count; i++) {
+                cork_hash_table_free_bin_entries(table, &table->old_bins[i]);
+            }
+        }
     }
-    cork_dllist_init(&table->insertion_order);
 
     DEBUG("(clear) Clear bins");
+    if (table->old_bins != NULL) {
+        /* Every entry has already been freed, so there's nothing left in the
+         * old bins to migrate. */
+        cork_hash_table_free_old_bins(table);
+    }
     for (i = 0; i < table->bin_count; i++) {
         DEBUG("  Bin %zu", i);
         cork_dllist_init(&table->bins[i]);
     }
 
     table->entry_count = 0;
+    if (table->flags & CORK_HASH_TABLE_AUTO_SHRINK) {
+        cork_hash_table_shrink_to_fit(table);
+    }
 }
 
 void
 cork_hash_table_free(struct cork_hash_table *table)
 {
+    /* There's no point shrinking a table that we're about to free. */
+    table->flags &= ~CORK_HASH_TABLE_AUTO_SHRINK;
     cork_hash_table_clear(table);
-    cork_cfree(table->bins, table->bin_count, sizeof(struct cork_dllist));
-    cork_delete(struct cork_hash_table, table);
+    if (is_open(table)) {
+        cork_hash_table_open_free_slots(table);
+    } else {
+        cork_alloc_cfree(table->alloc, table->bins, table->bin_count,
+                         sizeof(struct cork_dllist));
+        if (table->entry_pool != NULL) {
+            cork_mempool_free(table->entry_pool);
+        }
+    }
+    cork_alloc_delete(table->alloc, struct cork_hash_table, table);
 }
 
 size_t
@@ -215,6 +811,13 @@ void
 cork_hash_table_set_hash(struct cork_hash_table *table, cork_hash_f hash)
 {
     table->hash = hash;
+    table->hash64 = NULL;
+}
+
+void
+cork_hash_table_set_hash64(struct cork_hash_table *table, cork_hash64_f hash)
+{
+    table->hash64 = hash;
 }
 
 void
@@ -239,34 +842,37 @@ cork_hash_table_set_free_value(struct cork_hash_table *table, cork_free_f free)
 void
 cork_hash_table_ensure_size(struct cork_hash_table *table, size_t desired_count)
 {
+    if (is_open(table)) {
+        if (desired_count > CORK_HASH_TABLE_MAX_LOAD(table->slot_count)) {
+            cork_hash_table_open_resize(table, desired_count);
+        }
+        return;
+    }
+
     if (desired_count > table->bin_count) {
-        struct cork_dllist  *old_bins = table->bins;
-        size_t  old_bin_count = table->bin_count;
+        struct cork_dllist  *old_bins;
+        size_t  old_bin_count;
+        uint64_t  start = cork_trace_start(hash_table_resize);
 
-        cork_hash_table_allocate_bins(table, desired_count);
+        /* Finish any incremental resize that's already in progress. */
+        cork_hash_table_migrate(table, SIZE_MAX);
 
-        if (old_bins != NULL) {
-            size_t  i;
-            for (i = 0; i < old_bin_count; i++) {
-                struct cork_dllist  *bin = &old_bins[i];
-                struct cork_dllist_item  *curr = cork_dllist_start(bin);
-                while (!cork_dllist_is_end(bin, curr)) {
-                    struct cork_hash_table_entry_priv  *entry =
-                        cork_container_of
-                        (curr, struct cork_hash_table_entry_priv, in_bucket);
-                    struct cork_dllist_item  *next = curr->next;
-
-                    size_t  bin_index = bin_index(table, entry->public.hash);
-                    DEBUG("      Rehash %p from bin %zu to bin %zu",
-                          entry, i, bin_index);
-                    cork_dllist_add(&table->bins[bin_index], curr);
-
-                    curr = next;
-                }
-            }
+        old_bins = table->bins;
+        old_bin_count = table->bin_count;
+        cork_hash_table_allocate_bins(table, desired_count);
 
-            cork_cfree(old_bins, old_bin_count, sizeof(struct cork_dllist));
+        if (table->flags & CORK_HASH_TABLE_INCREMENTAL_RESIZE) {
+            DEBUG("    Start incremental migration of %zu bins",
+                  old_bin_count);
+            table->old_bins = old_bins;
+            table->old_bin_count = old_bin_count;
+            table->old_bin_mask = old_bin_count - 1;
+            table->migrate_index = 0;
+        } else {
+            cork_hash_table_move_bins(table, old_bins, old_bin_count);
         }
+        cork_trace4(hash_table_resize, table, old_bin_count, table->bin_count,
+                    cork_trace_elapsed(start));
     }
 }
 
@@ -279,26 +885,171 @@ cork_hash_table_rehash(struct cork_hash_table *table)
 }
 
 
+/*-----------------------------------------------------------------------
+ * Shrinking
+ */
+
+/* Replaces a chained table's bins with a smaller array, all at once. */
+static void
+cork_hash_table_shrink_bins(struct cork_hash_table *table,
+                            size_t desired_count)
+{
+    struct cork_dllist  *old_bins;
+    size_t  old_bin_count;
+    uint64_t  start;
+
+    cork_hash_table_migrate(table, SIZE_MAX);
+    if (desired_count < table->min_size) {
+        desired_count = table->min_size;
+    }
+    if (cork_hash_table_new_size(desired_count) >= table->bin_count) {
+        return;
+    }
+
+    DEBUG("    Shrink %zu bins to hold %zu entries",
+          table->bin_count, desired_count);
+    start = cork_trace_start(hash_table_resize);
+    old_bins = table->bins;
+    old_bin_count = table->bin_count;
+    cork_hash_table_allocate_bins(table, desired_count);
+    cork_hash_table_move_bins(table, old_bins, old_bin_count);
+    cork_trace4(hash_table_resize, table, old_bin_count, table->bin_count,
+                cork_trace_elapsed(start));
+}
+
+/* Reallocates every entry of a pooled table from a brand new pool, so that
+ * the survivors of a big purge are packed into as few blocks as possible, and
+ * the old pool's blocks can all be freed.  We walk through the entries in
+ * insertion order (if we're keeping track of it) so that we can rebuild the
+ * insertion order list as we go. */
+static void
+cork_hash_table_compact_entries(struct cork_hash_table *table)
+{
+    struct cork_mempool  *old_pool = table->entry_pool;
+    struct cork_dllist_item  *curr;
+    struct cork_dllist_item  *next;
+    size_t  i;
+
+    DEBUG("    Compact %zu entries", table->entry_count);
+    cork_hash_table_migrate(table, SIZE_MAX);
+    table->entry_pool = cork_mempool_new_size_alloc
+        (table->entry_size, CORK_MEMPOOL_DEFAULT_BLOCK_SIZE, table->alloc);
+
+    if (is_ordered(table)) {
+        struct cork_dllist  *list = &table->insertion_order;
+        curr = cork_dllist_start(list);
+        cork_dllist_init(list);
+        for (i = 0; i < table->bin_count; i++) {
+            cork_dllist_init(&table->bins[i]);
+        }
+        /* The old entries' links are untouched, so the last one still points
+         * at the list's sentinel. */
+        for (; !cork_dllist_is_end(list, curr); curr = next) {
+            struct cork_hash_table_entry_priv  *old_entry =
+                cork_container_of
+                (curr, struct cork_hash_table_entry_priv, insertion_order);
+            struct cork_hash_table_entry_priv  *entry =
+                cork_mempool_new_object(table->entry_pool);
+            cork_hash64  hash = cork_hash_table_entry_hash64(&old_entry->public);
+            next = curr->next;
+            entry->public = old_entry->public;
+            cork_dllist_add(&table->bins[bin_index(table, hash)],
+                            &entry->in_bucket);
+            cork_dllist_add(list, &entry->insertion_order);
+            cork_mempool_free_object(old_pool, old_entry);
+        }
+    } else {
+        /* Each entry ends up back in the same bin, so we can rebuild each bin
+         * separately. */
+        for (i = 0; i < table->bin_count; i++) {
+            struct cork_dllist  *bin = &table->bins[i];
+            curr = cork_dllist_start(bin);
+            cork_dllist_init(bin);
+            for (; !cork_dllist_is_end(bin, curr); curr = next) {
+                struct cork_hash_table_entry_priv  *old_entry =
+                    cork_container_of
+                    (curr, struct cork_hash_table_entry_priv, in_bucket);
+                struct cork_hash_table_entry_priv  *entry =
+                    cork_mempool_new_object(table->entry_pool);
+                next = curr->next;
+                entry->public = old_entry->public;
+                cork_dllist_add(bin, &entry->in_bucket);
+                cork_mempool_free_object(old_pool, old_entry);
+            }
+        }
+    }
+
+    cork_mempool_free(old_pool);
+}
+
+void
+cork_hash_table_shrink_to_fit(struct cork_hash_table *table)
+{
+    size_t  desired_count = table->entry_count;
+    if (desired_count < table->min_size) {
+        desired_count = table->min_size;
+    }
+
+    if (is_open(table)) {
+        /* Rehashing also gets rid of any tombstones. */
+        if (cork_hash_table_open_new_size(desired_count) < table->slot_count ||
+            table->entry_count + table->growth_left <
+            CORK_HASH_TABLE_MAX_LOAD(table->slot_count)) {
+            DEBUG("(shrink) Shrink %zu slots to hold %zu entries",
+                  table->slot_count, desired_count);
+            cork_hash_table_open_resize(table, desired_count);
+        }
+        return;
+    }
+
+    DEBUG("(shrink) Shrink table with %zu entries", table->entry_count);
+    cork_hash_table_shrink_bins(table, desired_count);
+    if (table->entry_pool != NULL) {
+        cork_hash_table_compact_entries(table);
+    }
+}
+
+/* Called before adding an entry to a chained CORK_HASH_TABLE_AUTO_SHRINK
+ * table.  We don't shrink when deleting, since you're allowed to delete
+ * entries while iterating through the table. */
+static void
+cork_hash_table_maybe_shrink(struct cork_hash_table *table)
+{
+    if (CORK_UNLIKELY((table->flags & CORK_HASH_TABLE_AUTO_SHRINK) &&
+                      table->bin_count > table->min_size &&
+                      table->entry_count <
+                      table->bin_count / CORK_HASH_TABLE_SHRINK_DENSITY)) {
+        DEBUG("    Reached minimum density; shrink");
+        cork_hash_table_shrink_bins(table, table->entry_count * 2);
+        if (table->entry_pool != NULL) {
+            cork_mempool_trim(table->entry_pool);
+        }
+    }
+}
+
+
 struct cork_hash_table_entry *
-cork_hash_table_get_entry_hash(const struct cork_hash_table *table,
-                               cork_hash hash, const void *key)
+cork_hash_table_get_entry_hash64(const struct cork_hash_table *table,
+                                 cork_hash64 hash, const void *key)
 {
-    size_t  bin_index;
     struct cork_dllist  *bin;
     struct cork_dllist_item  *curr;
 
+    if (is_open(table)) {
+        size_t  index = cork_hash_table_open_find(table, hash, key);
+        return (index == SIZE_MAX)? NULL: &table->slots[index];
+    }
+
     if (table->bin_count == 0) {
         DEBUG("(get) Empty table when searching for key %p "
-              "(hash 0x%08" PRIx32 ")",
+              "(hash 0x%016" PRIx64 ")",
               key, hash);
         return NULL;
     }
 
-    bin_index = bin_index(table, hash);
-    DEBUG("(get) Search for key %p (hash 0x%08" PRIx32 ", bin %zu)",
-          key, hash, bin_index);
+    DEBUG("(get) Search for key %p (hash 0x%016" PRIx64 ")", key, hash);
 
-    bin = &table->bins[bin_index];
+    bin = cork_hash_table_bin(table, hash);
     curr = cork_dllist_start(bin);
     while (!cork_dllist_is_end(bin, curr)) {
         struct cork_hash_table_entry_priv  *entry =
@@ -318,19 +1069,27 @@ cork_hash_table_get_entry_hash(const struct cork_hash_table *table,
     return NULL;
 }
 
+struct cork_hash_table_entry *
+cork_hash_table_get_entry_hash(const struct cork_hash_table *table,
+                               cork_hash hash, const void *key)
+{
+    return cork_hash_table_get_entry_hash64
+        (table, cork_hash_table_widen(hash), key);
+}
+
 struct cork_hash_table_entry *
 cork_hash_table_get_entry(const struct cork_hash_table *table, const void *key)
 {
-    cork_hash  hash = table->hash(table->user_data, key);
-    return cork_hash_table_get_entry_hash(table, hash, key);
+    cork_hash64  hash = cork_hash_table_hash_key(table, key);
+    return cork_hash_table_get_entry_hash64(table, hash, key);
 }
 
 void *
-cork_hash_table_get_hash(const struct cork_hash_table *table,
-                         cork_hash hash, const void *key)
+cork_hash_table_get_hash64(const struct cork_hash_table *table,
+                           cork_hash64 hash, const void *key)
 {
     struct cork_hash_table_entry  *entry =
-        cork_hash_table_get_entry_hash(table, hash, key);
+        cork_hash_table_get_entry_hash64(table, hash, key);
     if (entry == NULL) {
         return NULL;
     } else {
@@ -339,6 +1098,14 @@ cork_hash_table_get_hash(const struct cork_hash_table *table,
     }
 }
 
+void *
+cork_hash_table_get_hash(const struct cork_hash_table *table,
+                         cork_hash hash, const void *key)
+{
+    return cork_hash_table_get_hash64
+        (table, cork_hash_table_widen(hash), key);
+}
+
 void *
 cork_hash_table_get(const struct cork_hash_table *table, const void *key)
 {
@@ -352,24 +1119,129 @@ cork_hash_table_get(const struct cork_hash_table *table, const void *key)
     }
 }
 
+/* The number of lookups that we have in flight at once in
+ * cork_hash_table_get_batch. */
+#define CORK_HASH_TABLE_BATCH_SIZE  16
+
+/* Starts loading the memory that a lookup for `hash` will touch first. */
+static inline void
+cork_hash_table_prefetch(const struct cork_hash_table *table, cork_hash64 hash)
+{
+    if (is_open(table)) {
+        size_t  base = hash_h1(table, hash) * CORK_HASH_TABLE_GROUP_SIZE;
+        CORK_PREFETCH(&table->ctrl[base]);
+        CORK_PREFETCH(&table->slots[base]);
+    } else {
+        CORK_PREFETCH(cork_hash_table_bin(table, hash));
+    }
+}
+
+/* At most one of hashes and hashes64 can be non-NULL. */
+static void
+cork_hash_table_get_batch_any(const struct cork_hash_table *table,
+                              const void * const *keys,
+                              const cork_hash *hashes,
+                              const cork_hash64 *hashes64,
+                              size_t count, void **results)
+{
+    cork_hash64  batch_hashes[CORK_HASH_TABLE_BATCH_SIZE];
+    size_t  start;
+
+    if (table->entry_count == 0) {
+        for (start = 0; start < count; start++) {
+            results[start] = NULL;
+        }
+        return;
+    }
+
+    for (start = 0; start < count; start += CORK_HASH_TABLE_BATCH_SIZE) {
+        size_t  batch_count = count - start;
+        size_t  i;
+        if (batch_count > CORK_HASH_TABLE_BATCH_SIZE) {
+            batch_count = CORK_HASH_TABLE_BATCH_SIZE;
+        }
+
+        /* First hash every key and prefetch the memory that each lookup will
+         * start with, so that the cache misses overlap with each other. */
+        DEBUG("(get_batch) Prefetch %zu keys", batch_count);
+        for (i = 0; i < batch_count; i++) {
+            if (hashes64 != NULL) {
+                batch_hashes[i] = hashes64[start + i];
+            } else if (hashes != NULL) {
+                batch_hashes[i] = cork_hash_table_widen(hashes[start + i]);
+            } else {
+                batch_hashes[i] =
+                    cork_hash_table_hash_key(table, keys[start + i]);
+            }
+            cork_hash_table_prefetch(table, batch_hashes[i]);
+        }
+
+        /* For chained tables, the bins only hold pointers to the entries, so
+         * prefetch the first entry in each bin as well. */
+        if (!is_open(table)) {
+            for (i = 0; i < batch_count; i++) {
+                struct cork_dllist  *bin =
+                    cork_hash_table_bin(table, batch_hashes[i]);
+                CORK_PREFETCH(cork_dllist_start(bin));
+            }
+        }
+
+        for (i = 0; i < batch_count; i++) {
+            results[start + i] = cork_hash_table_get_hash64
+                (table, batch_hashes[i], keys[start + i]);
+        }
+    }
+}
+
+void
+cork_hash_table_get_batch(const struct cork_hash_table *table,
+                          const void * const *keys, const cork_hash *hashes,
+                          size_t count, void **results)
+{
+    cork_hash_table_get_batch_any(table, keys, hashes, NULL, count, results);
+}
+
+void
+cork_hash_table_get_batch_hash64(const struct cork_hash_table *table,
+                                 const void * const *keys,
+                                 const cork_hash64 *hashes,
+                                 size_t count, void **results)
+{
+    cork_hash_table_get_batch_any(table, keys, NULL, hashes, count, results);
+}
+
 
 struct cork_hash_table_entry *
-cork_hash_table_get_or_create_hash(struct cork_hash_table *table,
-                                   cork_hash hash, void *key, bool *is_new)
+cork_hash_table_get_or_create_hash64(struct cork_hash_table *table,
+                                     cork_hash64 hash, void *key,
+                                     bool *is_new)
 {
     struct cork_hash_table_entry_priv  *entry;
-    size_t  bin_index;
+
+    if (is_open(table)) {
+        size_t  index = cork_hash_table_open_find(table, hash, key);
+        if (index == SIZE_MAX) {
+            DEBUG("    Claim new slot");
+            index = cork_hash_table_open_insert(table, hash);
+            table->slots[index].key = key;
+            table->slots[index].value = NULL;
+            *is_new = true;
+        } else {
+            *is_new = false;
+        }
+        return &table->slots[index];
+    }
+
+    cork_hash_table_migrate(table, CORK_HASH_TABLE_MIGRATE_BINS);
 
     if (table->bin_count > 0) {
         struct cork_dllist  *bin;
         struct cork_dllist_item  *curr;
 
-        bin_index = bin_index(table, hash);
-        DEBUG("(get_or_create) Search for key %p "
-              "(hash 0x%08" PRIx32 ", bin %zu)",
-              key, hash, bin_index);
+        DEBUG("(get_or_create) Search for key %p (hash 0x%016" PRIx64 ")",
+              key, hash);
 
-        bin = &table->bins[bin_index];
+        bin = cork_hash_table_bin(table, hash);
         curr = cork_dllist_start(bin);
         while (!cork_dllist_is_end(bin, curr)) {
             struct cork_hash_table_entry_priv  *entry =
@@ -393,54 +1265,89 @@ cork_hash_table_get_or_create_hash(struct cork_hash_table *table,
         if ((table->entry_count / table->bin_count) >
             CORK_HASH_TABLE_MAX_DENSITY) {
             cork_hash_table_rehash(table);
-            bin_index = bin_index(table, hash);
         }
     } else {
-        DEBUG("(get_or_create) Search for key %p (hash 0x%08" PRIx32 ")",
+        DEBUG("(get_or_create) Search for key %p (hash 0x%016" PRIx64 ")",
               key, hash);
         DEBUG("  Empty table");
         cork_hash_table_rehash(table);
-        bin_index = bin_index(table, hash);
     }
 
+    cork_hash_table_maybe_shrink(table);
     DEBUG("    Allocate new entry");
     entry = cork_hash_table_new_entry(table, hash, key, NULL);
     DEBUG("    Created new entry %p", entry);
 
-    DEBUG("    Add entry into bin %zu", bin_index);
-    cork_dllist_add(&table->bins[bin_index], &entry->in_bucket);
+    DEBUG("    Add entry into bin");
+    cork_dllist_add(cork_hash_table_bin(table, hash), &entry->in_bucket);
 
     table->entry_count++;
     *is_new = true;
     return &entry->public;
 }
 
+struct cork_hash_table_entry *
+cork_hash_table_get_or_create_hash(struct cork_hash_table *table,
+                                   cork_hash hash, void *key, bool *is_new)
+{
+    return cork_hash_table_get_or_create_hash64
+        (table, cork_hash_table_widen(hash), key, is_new);
+}
+
 struct cork_hash_table_entry *
 cork_hash_table_get_or_create(struct cork_hash_table *table,
                               void *key, bool *is_new)
 {
-    cork_hash  hash = table->hash(table->user_data, key);
-    return cork_hash_table_get_or_create_hash(table, hash, key, is_new);
+    cork_hash64  hash = cork_hash_table_hash_key(table, key);
+    return cork_hash_table_get_or_create_hash64(table, hash, key, is_new);
 }
 
 
 void
-cork_hash_table_put_hash(struct cork_hash_table *table,
-                         cork_hash hash, void *key, void *value,
-                         bool *is_new, void **old_key, void **old_value)
+cork_hash_table_put_hash64(struct cork_hash_table *table,
+                           cork_hash64 hash, void *key, void *value,
+                           bool *is_new, void **old_key, void **old_value)
 {
     struct cork_hash_table_entry_priv  *entry;
-    size_t  bin_index;
+
+    if (is_open(table)) {
+        size_t  index = cork_hash_table_open_find(table, hash, key);
+        bool  found = (index != SIZE_MAX);
+        if (found) {
+            DEBUG("    Found existing entry; overwriting");
+            if (old_key != NULL) {
+                *old_key = table->slots[index].key;
+            }
+            if (old_value != NULL) {
+                *old_value = table->slots[index].value;
+            }
+        } else {
+            DEBUG("    Claim new slot");
+            index = cork_hash_table_open_insert(table, hash);
+            if (old_key != NULL) {
+                *old_key = NULL;
+            }
+            if (old_value != NULL) {
+                *old_value = NULL;
+            }
+        }
+        table->slots[index].key = key;
+        table->slots[index].value = value;
+        if (is_new != NULL) {
+            *is_new = !found;
+        }
+        return;
+    }
+
+    cork_hash_table_migrate(table, CORK_HASH_TABLE_MIGRATE_BINS);
 
     if (table->bin_count > 0) {
         struct cork_dllist  *bin;
         struct cork_dllist_item  *curr;
 
-        bin_index = bin_index(table, hash);
-        DEBUG("(put) Search for key %p (hash 0x%08" PRIx32 ", bin %zu)",
-              key, hash, bin_index);
+        DEBUG("(put) Search for key %p (hash 0x%016" PRIx64 ")", key, hash);
 
-        bin = &table->bins[bin_index];
+        bin = cork_hash_table_bin(table, hash);
         curr = cork_dllist_start(bin);
         while (!cork_dllist_is_end(bin, curr)) {
             struct cork_hash_table_entry_priv  *entry =
@@ -476,22 +1383,21 @@ cork_hash_table_put_hash(struct cork_hash_table *table,
         if ((table->entry_count / table->bin_count) >
             CORK_HASH_TABLE_MAX_DENSITY) {
             cork_hash_table_rehash(table);
-            bin_index = bin_index(table, hash);
         }
     } else {
-        DEBUG("(put) Search for key %p (hash 0x%08" PRIx32 ")",
+        DEBUG("(put) Search for key %p (hash 0x%016" PRIx64 ")",
               key, hash);
         DEBUG("  Empty table");
         cork_hash_table_rehash(table);
-        bin_index = bin_index(table, hash);
     }
 
+    cork_hash_table_maybe_shrink(table);
     DEBUG("    Allocate new entry");
     entry = cork_hash_table_new_entry(table, hash, key, value);
     DEBUG("    Created new entry %p", entry);
 
-    DEBUG("    Add entry into bin %zu", bin_index);
-    cork_dllist_add(&table->bins[bin_index], &entry->in_bucket);
+    DEBUG("    Add entry into bin");
+    cork_dllist_add(cork_hash_table_bin(table, hash), &entry->in_bucket);
 
     table->entry_count++;
     if (old_key != NULL) {
@@ -505,13 +1411,23 @@ cork_hash_table_put_hash(struct cork_hash_table *table,
     }
 }
 
+void
+cork_hash_table_put_hash(struct cork_hash_table *table,
+                         cork_hash hash, void *key, void *value,
+                         bool *is_new, void **old_key, void **old_value)
+{
+    cork_hash_table_put_hash64
+        (table, cork_hash_table_widen(hash), key, value,
+         is_new, old_key, old_value);
+}
+
 void
 cork_hash_table_put(struct cork_hash_table *table,
                     void *key, void *value,
                     bool *is_new, void **old_key, void **old_value)
 {
-    cork_hash  hash = table->hash(table->user_data, key);
-    cork_hash_table_put_hash
+    cork_hash64  hash = cork_hash_table_hash_key(table, key);
+    cork_hash_table_put_hash64
         (table, hash, key, value, is_new, old_key, old_value);
 }
 
@@ -520,8 +1436,15 @@ void
 cork_hash_table_delete_entry(struct cork_hash_table *table,
                              struct cork_hash_table_entry *ventry)
 {
-    struct cork_hash_table_entry_priv  *entry =
-        cork_container_of(ventry, struct cork_hash_table_entry_priv, public);
+    struct cork_hash_table_entry_priv  *entry;
+    if (is_open(table)) {
+        size_t  index = ventry - table->slots;
+        cork_hash_table_open_remove(table, index);
+        cork_hash_table_open_free_entry(table, index);
+        return;
+    }
+
+    entry = cork_container_of(ventry, struct cork_hash_table_entry_priv, public);
     cork_dllist_remove(&entry->in_bucket);
     table->entry_count--;
     cork_hash_table_free_entry(table, entry);
@@ -529,26 +1452,41 @@ cork_hash_table_delete_entry(struct cork_hash_table *table,
 
 
 bool
-cork_hash_table_delete_hash(struct cork_hash_table *table,
-                            cork_hash hash, const void *key,
-                            void **deleted_key, void **deleted_value)
+cork_hash_table_delete_hash64(struct cork_hash_table *table,
+                              cork_hash64 hash, const void *key,
+                              void **deleted_key, void **deleted_value)
 {
-    size_t  bin_index;
     struct cork_dllist  *bin;
     struct cork_dllist_item  *curr;
 
+    if (is_open(table)) {
+        size_t  index = cork_hash_table_open_find(table, hash, key);
+        if (index == SIZE_MAX) {
+            return false;
+        }
+        if (deleted_key != NULL) {
+            *deleted_key = table->slots[index].key;
+        }
+        if (deleted_value != NULL) {
+            *deleted_value = table->slots[index].value;
+        }
+        cork_hash_table_open_remove(table, index);
+        cork_hash_table_open_free_entry(table, index);
+        return true;
+    }
+
+    cork_hash_table_migrate(table, CORK_HASH_TABLE_MIGRATE_BINS);
+
     if (table->bin_count == 0) {
         DEBUG("(delete) Empty table when searching for key %p "
-              "(hash 0x%08" PRIx32 ")",
+              "(hash 0x%016" PRIx64 ")",
               key, hash);
         return false;
     }
 
-    bin_index = bin_index(table, hash);
-    DEBUG("(delete) Search for key %p (hash 0x%08" PRIx32 ", bin %zu)",
-          key, hash, bin_index);
+    DEBUG("(delete) Search for key %p (hash 0x%016" PRIx64 ")", key, hash);
 
-    bin = &table->bins[bin_index];
+    bin = cork_hash_table_bin(table, hash);
     curr = cork_dllist_start(bin);
     while (!cork_dllist_is_end(bin, curr)) {
         struct cork_hash_table_entry_priv  *entry =
@@ -565,7 +1503,7 @@ cork_hash_table_delete_hash(struct cork_hash_table *table,
                 *deleted_value = entry->public.value;
             }
 
-            DEBUG("    Remove entry from hash bin %zu", bin_index);
+            DEBUG("    Remove entry from hash bin");
             cork_dllist_remove(curr);
             table->entry_count--;
 
@@ -581,12 +1519,21 @@ cork_hash_table_delete_hash(struct cork_hash_table *table,
     return false;
 }
 
+bool
+cork_hash_table_delete_hash(struct cork_hash_table *table,
+                            cork_hash hash, const void *key,
+                            void **deleted_key, void **deleted_value)
+{
+    return cork_hash_table_delete_hash64
+        (table, cork_hash_table_widen(hash), key, deleted_key, deleted_value);
+}
+
 bool
 cork_hash_table_delete(struct cork_hash_table *table, const void *key,
                        void **deleted_key, void **deleted_value)
 {
-    cork_hash  hash = table->hash(table->user_data, key);
-    return cork_hash_table_delete_hash
+    cork_hash64  hash = cork_hash_table_hash_key(table, key);
+    return cork_hash_table_delete_hash64
         (table, hash, key, deleted_key, deleted_value);
 }
 
@@ -598,6 +1545,55 @@ cork_hash_table_map(struct cork_hash_table *table, void *user_data,
     struct cork_dllist_item  *curr;
     DEBUG("Map across hash table");
 
+    if (is_open(table)) {
+        size_t  i;
+        for (i = 0; i < table->slot_count; i++) {
+            if (ctrl_is_full(table->ctrl[i])) {
+                enum cork_hash_table_map_result  result;
+                DEBUG("    Apply function to slot %zu", i);
+                result = map(user_data, &table->slots[i]);
+                if (result == CORK_HASH_TABLE_MAP_ABORT) {
+                    return;
+                } else if (result == CORK_HASH_TABLE_MAP_DELETE) {
+                    DEBUG("      Delete requested");
+                    cork_hash_table_open_remove(table, i);
+                    cork_hash_table_open_free_entry(table, i);
+                }
+            }
+        }
+        return;
+    }
+
+    if (!is_ordered(table)) {
+        size_t  i;
+        /* Finish any incremental resize first, so that every entry is in the
+         * current bin array. */
+        cork_hash_table_migrate(table, SIZE_MAX);
+        for (i = 0; i < table->bin_count; i++) {
+            struct cork_dllist  *bin = &table->bins[i];
+            struct cork_dllist_item  *next;
+            cork_dllist_foreach_void(bin, curr, next) {
+                struct cork_hash_table_entry_priv  *entry =
+                    cork_container_of
+                    (curr, struct cork_hash_table_entry_priv, in_bucket);
+                enum cork_hash_table_map_result  result;
+
+                DEBUG("    Apply function to entry %p", entry);
+                result = map(user_data, &entry->public);
+
+                if (result == CORK_HASH_TABLE_MAP_ABORT) {
+                    return;
+                } else if (result == CORK_HASH_TABLE_MAP_DELETE) {
+                    DEBUG("      Delete requested");
+                    cork_dllist_remove(curr);
+                    table->entry_count--;
+                    cork_hash_table_free_entry(table, entry);
+                }
+            }
+        }
+        return;
+    }
+
     curr = cork_dllist_start(&table->insertion_order);
     while (!cork_dllist_is_end(&table->insertion_order, curr)) {
         struct cork_hash_table_entry_priv  *entry =
@@ -630,9 +1626,28 @@ cork_hash_table_iterator_init(struct cork_hash_table *table,
 {
     DEBUG("Iterate through hash table");
     iterator->table = table;
-    iterator->priv = cork_dllist_start(&table->insertion_order);
+    if (is_open(table)) {
+        /* For open-addressed tables, priv holds the index of the next slot to
+         * check. */
+        iterator->priv = (void *) (uintptr_t) 0;
+    } else if (is_ordered(table)) {
+        iterator->priv = cork_dllist_start(&table->insertion_order);
+    } else {
+        /* For unordered tables, priv is the next item to return from one of
+         * the bins, or one of the bins' sentinels if we've reached the end of
+         * that bin.  Finishing any incremental resize first means that there
+         * is only one array of bins to walk through. */
+        cork_hash_table_migrate(table, SIZE_MAX);
+        iterator->priv = cork_dllist_start(&table->bins[0]);
+    }
 }
 
+/* Whether item is the sentinel of one of the table's bins, rather than an
+ * entry. */
+#define is_bin_sentinel(table, item) \
+    ((item) >= &(table)->bins[0].head && \
+     (item) < &(table)->bins[(table)->bin_count].head)
+
 
 struct cork_hash_table_entry *
 cork_hash_table_iterator_next(struct cork_hash_table_iterator *iterator)
@@ -641,6 +1656,36 @@ cork_hash_table_iterator_next(struct cork_hash_table_iterator *iterator)
     struct cork_dllist_item  *curr = iterator->priv;
     struct cork_hash_table_entry_priv  *entry;
 
+    if (is_open(table)) {
+        size_t  i;
+        for (i = (uintptr_t) iterator->priv; i < table->slot_count; i++) {
+            if (ctrl_is_full(table->ctrl[i])) {
+                DEBUG("    Return slot %zu", i);
+                iterator->priv = (void *) (uintptr_t) (i + 1);
+                return &table->slots[i];
+            }
+        }
+        iterator->priv = (void *) (uintptr_t) i;
+        return NULL;
+    }
+
+    if (!is_ordered(table)) {
+        while (is_bin_sentinel(table, curr)) {
+            /* The bins' sentinels are the first field of each bin. */
+            size_t  next_bin = (struct cork_dllist *) curr - table->bins + 1;
+            if (next_bin == table->bin_count) {
+                return NULL;
+            }
+            curr = cork_dllist_start(&table->bins[next_bin]);
+            iterator->priv = curr;
+        }
+        entry = cork_container_of
+            (curr, struct cork_hash_table_entry_priv, in_bucket);
+        DEBUG("    Return entry %p", entry);
+        iterator->priv = curr->next;
+        return &entry->public;
+    }
+
     if (cork_dllist_is_end(&table->insertion_order, curr)) {
         return NULL;
     }
@@ -657,33 +1702,143 @@ cork_hash_table_iterator_next(struct cork_hash_table_iterator *iterator)
  * Built-in key types
  */
 
-static cork_hash
-string_hash(void *user_data, const void *vk)
+cork_hash
+cork_string_hash(void *user_data, const void *vk)
 {
     const char  *k = vk;
     size_t  len = strlen(k);
     return cork_hash_buffer(0, k, len);
 }
 
-static bool
-string_equals(void *user_data, const void *vk1, const void *vk2)
+cork_hash
+cork_string_fast_hash(void *user_data, const void *vk)
+{
+    const char  *k = vk;
+    size_t  len = strlen(k);
+    return cork_fast_hash_buffer(0, k, len);
+}
+
+cork_hash64
+cork_string_hash64(void *user_data, const void *vk)
+{
+    const char  *k = vk;
+    size_t  len = strlen(k);
+    return cork_hash64_buffer(0, k, len);
+}
+
+bool
+cork_string_equals(void *user_data, const void *vk1, const void *vk2)
 {
     const char  *k1 = vk1;
     const char  *k2 = vk2;
     return strcmp(k1, k2) == 0;
 }
 
+cork_hash
+cork_uint32_fast_hash(void *user_data, const void *vk)
+{
+    const uint32_t  *k = vk;
+    return cork_fast_hash_u32(0, *k);
+}
+
+cork_hash64
+cork_uint32_hash64(void *user_data, const void *vk)
+{
+    const uint32_t  *k = vk;
+    return cork_wyhash_u32(0, *k);
+}
+
+bool
+cork_uint32_equals(void *user_data, const void *vk1, const void *vk2)
+{
+    const uint32_t  *k1 = vk1;
+    const uint32_t  *k2 = vk2;
+    return *k1 == *k2;
+}
+
+cork_hash
+cork_uint64_fast_hash(void *user_data, const void *vk)
+{
+    const uint64_t  *k = vk;
+    return cork_fast_hash_u64(0, *k);
+}
+
+cork_hash64
+cork_uint64_hash64(void *user_data, const void *vk)
+{
+    const uint64_t  *k = vk;
+    return cork_wyhash_u64(0, *k);
+}
+
+bool
+cork_uint64_equals(void *user_data, const void *vk1, const void *vk2)
+{
+    const uint64_t  *k1 = vk1;
+    const uint64_t  *k2 = vk2;
+    return *k1 == *k2;
+}
+
+cork_hash
+cork_u128_fast_hash(void *user_data, const void *vk)
+{
+    const cork_u128  *k = vk;
+    return cork_fast_hash_u128(0, *k);
+}
+
+cork_hash64
+cork_u128_hash64(void *user_data, const void *vk)
+{
+    const cork_u128  *k = vk;
+    return cork_wyhash_u128(0, *k);
+}
+
+bool
+cork_u128_equals(void *user_data, const void *vk1, const void *vk2)
+{
+    const cork_u128  *k1 = vk1;
+    const cork_u128  *k2 = vk2;
+    return cork_u128_eq(*k1, *k2);
+}
+
 struct cork_hash_table *
 cork_string_hash_table_new(size_t initial_size, unsigned int flags)
 {
     struct cork_hash_table  *table = cork_hash_table_new(initial_size, flags);
-    cork_hash_table_set_hash(table, string_hash);
-    cork_hash_table_set_equals(table, string_equals);
+    if (flags & CORK_HASH_TABLE_FAST_HASH) {
+        cork_hash_table_set_hash(table, cork_string_fast_hash);
+    } else {
+        cork_hash_table_set_hash(table, cork_string_hash);
+    }
+    cork_hash_table_set_equals(table, cork_string_equals);
     return table;
 }
 
+/* The default hash function just truncates the pointer, which is fine for
+ * chained tables.  An open-addressed table needs every bit of the hash to be
+ * mixed: the low bits choose a group, which would cluster on the pointers'
+ * alignment, and the high bits go into the control bytes, which would be the
+ * same for every pointer.  So open-addressed tables always get a mixing
+ * hash. */
+static cork_hash
+pointer_fast_hash(void *user_data, const void *k)
+{
+    return cork_fast_hash_u64(0, (uint64_t) (uintptr_t) k);
+}
+
+static cork_hash64
+pointer_hash64(void *user_data, const void *k)
+{
+    return cork_wyhash_u64(0, (uint64_t) (uintptr_t) k);
+}
+
 struct cork_hash_table *
 cork_pointer_hash_table_new(size_t initial_size, unsigned int flags)
 {
-    return cork_hash_table_new(initial_size, flags);
+    struct cork_hash_table  *table = cork_hash_table_new(initial_size, flags);
+    if (flags & CORK_HASH_TABLE_OPEN_ADDRESSING) {
+        cork_hash_table_set_hash64(table, pointer_hash64);
+    } else if (flags & CORK_HASH_TABLE_FAST_HASH) {
+        cork_hash_table_set_hash(table, pointer_fast_hash);
+    }
+    return table;
 }
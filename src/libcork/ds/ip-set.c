@@ -0,0 +1,468 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/byte-order.h"
+#include "libcork/core/error.h"
+#include "libcork/core/net-addresses.h"
+#include "libcork/core/types.h"
+#include "libcork/core/u128.h"
+#include "libcork/ds/array.h"
+#include "libcork/ds/buffer.h"
+#include "libcork/ds/ip-set.h"
+#include "libcork/ds/slice.h"
+#include "libcork/ds/sort.h"
+
+
+/*-----------------------------------------------------------------------
+ * Address ranges
+ */
+
+/* We store each IPv4 range as a single uint64_t, with the (host-order) start
+ * address in the upper 32 bits and the end address in the lower 32 bits.
+ * That's only 8 bytes per range, and sorting the ranges by start address is
+ * just a radix sort of the integers.  IPv6 ranges are compared as cork_u128s,
+ * so that every comparison looks at the whole address at once.  We store their
+ * endpoints as pairs of uint64_ts, though, since our arrays don't guarantee
+ * the 16-byte alignment that a native 128-bit integer needs. */
+
+#define cork_ip_set_v4_start(range)  ((uint32_t) ((range) >> 32))
+#define cork_ip_set_v4_end(range)    ((uint32_t) (range))
+#define cork_ip_set_v4_range(start, end) \
+    (((uint64_t) (start) << 32) | (uint64_t) (end))
+
+struct cork_ip_set_v6_range {
+    uint64_t  start[2];
+    uint64_t  end[2];
+};
+
+#define cork_ip_set_v6_start(range) \
+    (cork_u128_from_64((range).start[0], (range).start[1]))
+#define cork_ip_set_v6_end(range) \
+    (cork_u128_from_64((range).end[0], (range).end[1]))
+
+#define cork_ip_set_v6_less(a, b) \
+    (cork_u128_lt(cork_ip_set_v6_start(a), cork_ip_set_v6_start(b)))
+cork_sort_define(struct cork_ip_set_v6_range, cork_ip_set_sort_v6,
+                 cork_ip_set_v6_less)
+
+static inline uint32_t
+cork_ip_set_v4_value(const struct cork_ipv4 *addr)
+{
+    return CORK_UINT32_BIG_TO_HOST(addr->_.u32);
+}
+
+static inline cork_u128
+cork_ip_set_v6_value(const struct cork_ipv6 *addr)
+{
+    return cork_u128_from_64(CORK_UINT64_BIG_TO_HOST(addr->_.u64[0]),
+                             CORK_UINT64_BIG_TO_HOST(addr->_.u64[1]));
+}
+
+/* Whether a range starting at next can be merged into one ending at end */
+static inline bool
+cork_ip_set_v6_touches(cork_u128 end, cork_u128 next)
+{
+    cork_u128  one = cork_u128_from_64(0, 1);
+    return cork_u128_le(next, end) ||
+        cork_u128_eq(next, cork_u128_add(end, one));
+}
+
+
+/*-----------------------------------------------------------------------
+ * IP sets
+ */
+
+struct cork_ip_set {
+    /* The first v4_built (or v6_built) ranges are sorted and disjoint; any
+     * others have been added since the last build. */
+    cork_array(uint64_t)  v4;
+    cork_array(struct cork_ip_set_v6_range)  v6;
+    size_t  v4_built;
+    size_t  v6_built;
+};
+
+struct cork_ip_set *
+cork_ip_set_new(void)
+{
+    struct cork_ip_set  *set = cork_new(struct cork_ip_set);
+    cork_array_init(&set->v4);
+    cork_array_init(&set->v6);
+    set->v4_built = 0;
+    set->v6_built = 0;
+    return set;
+}
+
+void
+cork_ip_set_free(struct cork_ip_set *set)
+{
+    cork_array_done(&set->v4);
+    cork_array_done(&set->v6);
+    cork_delete(struct cork_ip_set, set);
+}
+
+static void
+cork_ip_set_add_v6(struct cork_ip_set *set, cork_u128 start, cork_u128 end)
+{
+    struct cork_ip_set_v6_range  *range = cork_array_append_get(&set->v6);
+    range->start[0] = cork_u128_be64(start, 0);
+    range->start[1] = cork_u128_be64(start, 1);
+    range->end[0] = cork_u128_be64(end, 0);
+    range->end[1] = cork_u128_be64(end, 1);
+}
+
+void
+cork_ip_set_add(struct cork_ip_set *set, const struct cork_ip *addr)
+{
+    if (addr->version == 4) {
+        uint32_t  value = cork_ip_set_v4_value(&addr->ip.v4);
+        cork_array_append(&set->v4, cork_ip_set_v4_range(value, value));
+    } else {
+        cork_u128  value = cork_ip_set_v6_value(&addr->ip.v6);
+        cork_ip_set_add_v6(set, value, value);
+    }
+}
+
+int
+cork_ip_set_add_network(struct cork_ip_set *set, const struct cork_ip *network,
+                        unsigned int prefix_len)
+{
+    if (CORK_UNLIKELY(!cork_ip_is_valid_network(network, prefix_len))) {
+        char  str[CORK_IP_STRING_LENGTH];
+        cork_ip_to_raw_string(network, str);
+        cork_error_set_printf
+            (CORK_IP_SET_INVALID_RANGE,
+             "Invalid network %s/%u", str, prefix_len);
+        return -1;
+    }
+
+    if (network->version == 4) {
+        uint32_t  start = cork_ip_set_v4_value(&network->ip.v4);
+        uint32_t  host_mask = (prefix_len == 0)? UINT32_MAX:
+            (UINT32_MAX >> 1) >> (prefix_len - 1);
+        cork_array_append
+            (&set->v4, cork_ip_set_v4_range(start, start | host_mask));
+    } else {
+        cork_u128  start = cork_ip_set_v6_value(&network->ip.v6);
+        uint64_t  high = cork_u128_be64(start, 0);
+        uint64_t  low = cork_u128_be64(start, 1);
+        if (prefix_len < 64) {
+            high |= (prefix_len == 0)? UINT64_MAX:
+                (UINT64_MAX >> 1) >> (prefix_len - 1);
+            low = UINT64_MAX;
+        } else if (prefix_len < 128) {
+            low |= (prefix_len == 64)? UINT64_MAX:
+                (UINT64_MAX >> 1) >> (prefix_len - 65);
+        }
+        cork_ip_set_add_v6(set, start, cork_u128_from_64(high, low));
+    }
+    return 0;
+}
+
+int
+cork_ip_set_add_range(struct cork_ip_set *set, const struct cork_ip *first,
+                      const struct cork_ip *last)
+{
+    if (CORK_UNLIKELY(first->version != last->version)) {
+        goto error;
+    }
+
+    if (first->version == 4) {
+        uint32_t  start = cork_ip_set_v4_value(&first->ip.v4);
+        uint32_t  end = cork_ip_set_v4_value(&last->ip.v4);
+        if (CORK_UNLIKELY(end < start)) {
+            goto error;
+        }
+        cork_array_append(&set->v4, cork_ip_set_v4_range(start, end));
+    } else {
+        cork_u128  start = cork_ip_set_v6_value(&first->ip.v6);
+        cork_u128  end = cork_ip_set_v6_value(&last->ip.v6);
+        if (CORK_UNLIKELY(cork_u128_lt(end, start))) {
+            goto error;
+        }
+        cork_ip_set_add_v6(set, start, end);
+    }
+    return 0;
+
+error:
+    {
+        char  first_str[CORK_IP_STRING_LENGTH];
+        char  last_str[CORK_IP_STRING_LENGTH];
+        cork_ip_to_raw_string(first, first_str);
+        cork_ip_to_raw_string(last, last_str);
+        cork_error_set_printf
+            (CORK_IP_SET_INVALID_RANGE,
+             "Invalid range %s-%s", first_str, last_str);
+        return -1;
+    }
+}
+
+void
+cork_ip_set_build(struct cork_ip_set *set)
+{
+    size_t  count;
+    size_t  out;
+    size_t  i;
+
+    /* IPv4 */
+    count = cork_array_size(&set->v4);
+    cork_sort_uint64(cork_array_elements(&set->v4), count);
+    for (i = 0, out = 0; i < count; i++) {
+        uint64_t  range = cork_array_at(&set->v4, i);
+        if (out > 0) {
+            uint64_t  *prev = &cork_array_at(&set->v4, out - 1);
+            uint32_t  prev_end = cork_ip_set_v4_end(*prev);
+            if ((uint64_t) cork_ip_set_v4_start(range) <=
+                (uint64_t) prev_end + 1) {
+                if (cork_ip_set_v4_end(range) > prev_end) {
+                    *prev = cork_ip_set_v4_range
+                        (cork_ip_set_v4_start(*prev),
+                         cork_ip_set_v4_end(range));
+                }
+                continue;
+            }
+        }
+        cork_array_at(&set->v4, out++) = range;
+    }
+    set->v4.size = out;
+    set->v4_built = out;
+
+    /* IPv6 */
+    count = cork_array_size(&set->v6);
+    cork_ip_set_sort_v6(cork_array_elements(&set->v6), count);
+    for (i = 0, out = 0; i < count; i++) {
+        struct cork_ip_set_v6_range  range = cork_array_at(&set->v6, i);
+        if (out > 0) {
+            struct cork_ip_set_v6_range  *prev =
+                &cork_array_at(&set->v6, out - 1);
+            if (cork_ip_set_v6_touches(cork_ip_set_v6_end(*prev),
+                                       cork_ip_set_v6_start(range))) {
+                if (cork_u128_gt(cork_ip_set_v6_end(range),
+                                 cork_ip_set_v6_end(*prev))) {
+                    prev->end[0] = range.end[0];
+                    prev->end[1] = range.end[1];
+                }
+                continue;
+            }
+        }
+        cork_array_at(&set->v6, out++) = range;
+    }
+    set->v6.size = out;
+    set->v6_built = out;
+}
+
+size_t
+cork_ip_set_range_count(const struct cork_ip_set *set)
+{
+    return set->v4_built + set->v6_built;
+}
+
+/* Each of these membership tests finds the last range that starts at or
+ * before the address, and then checks whether that range ends at or after
+ * it. */
+
+bool
+cork_ip_set_contains(const struct cork_ip_set *set, const struct cork_ip *addr)
+{
+    size_t  lo = 0;
+    size_t  hi;
+    if (addr->version == 4) {
+        const uint64_t  *ranges = cork_array_elements(&set->v4);
+        uint32_t  value = cork_ip_set_v4_value(&addr->ip.v4);
+        hi = set->v4_built;
+        while (lo < hi) {
+            size_t  mid = lo + (hi - lo) / 2;
+            if (cork_ip_set_v4_start(ranges[mid]) <= value) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo > 0 && value <= cork_ip_set_v4_end(ranges[lo - 1]);
+    } else {
+        const struct cork_ip_set_v6_range  *ranges =
+            cork_array_elements(&set->v6);
+        cork_u128  value = cork_ip_set_v6_value(&addr->ip.v6);
+        hi = set->v6_built;
+        while (lo < hi) {
+            size_t  mid = lo + (hi - lo) / 2;
+            if (cork_u128_le(cork_ip_set_v6_start(ranges[mid]), value)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo > 0 &&
+            cork_u128_le(value, cork_ip_set_v6_end(ranges[lo - 1]));
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Serialized IP sets
+ */
+
+/* A serialized set starts with a header:
+ *
+ *   magic     8 bytes   "cork-ips"
+ *   v4_count  8 bytes
+ *   v6_count  8 bytes
+ *
+ * followed by v4_count IPv4 ranges (a 4-byte start address and a 4-byte end
+ * address each), and then v6_count IPv6 ranges (16 bytes each for the start
+ * and end).  Everything is big-endian, and the ranges are sorted and
+ * disjoint, just like in a built cork_ip_set. */
+
+#define CORK_IP_SET_MAGIC  "cork-ips"
+#define CORK_IP_SET_MAGIC_SIZE  8
+#define CORK_IP_SET_HEADER_SIZE  24
+#define CORK_IP_SET_V4_SIZE  8
+#define CORK_IP_SET_V6_SIZE  32
+
+static void
+cork_ip_set_write_u64(uint8_t *dest, uint64_t value)
+{
+    value = CORK_UINT64_HOST_TO_BIG(value);
+    memcpy(dest, &value, sizeof(value));
+}
+
+static inline uint32_t
+cork_ip_set_read_u32(const uint8_t *src)
+{
+    uint32_t  value;
+    memcpy(&value, src, sizeof(value));
+    return CORK_UINT32_BIG_TO_HOST(value);
+}
+
+static inline uint64_t
+cork_ip_set_read_u64(const uint8_t *src)
+{
+    uint64_t  value;
+    memcpy(&value, src, sizeof(value));
+    return CORK_UINT64_BIG_TO_HOST(value);
+}
+
+static inline cork_u128
+cork_ip_set_read_u128(const uint8_t *src)
+{
+    return cork_u128_from_64
+        (cork_ip_set_read_u64(src), cork_ip_set_read_u64(src + 8));
+}
+
+void
+cork_ip_set_save(const struct cork_ip_set *set, struct cork_buffer *dest)
+{
+    uint8_t  header[CORK_IP_SET_HEADER_SIZE];
+    uint8_t  *out;
+    size_t  i;
+
+    memcpy(header, CORK_IP_SET_MAGIC, CORK_IP_SET_MAGIC_SIZE);
+    cork_ip_set_write_u64(header + 8, set->v4_built);
+    cork_ip_set_write_u64(header + 16, set->v6_built);
+    cork_buffer_append(dest, header, sizeof(header));
+
+    cork_buffer_ensure_size
+        (dest, dest->size + set->v4_built * CORK_IP_SET_V4_SIZE +
+         set->v6_built * CORK_IP_SET_V6_SIZE);
+    out = (uint8_t *) dest->buf + dest->size;
+    for (i = 0; i < set->v4_built; i++) {
+        uint64_t  range = cork_array_at(&set->v4, i);
+        cork_ip_set_write_u64(out, range);
+        out += CORK_IP_SET_V4_SIZE;
+    }
+    for (i = 0; i < set->v6_built; i++) {
+        const struct cork_ip_set_v6_range  *range =
+            &cork_array_at(&set->v6, i);
+        cork_ip_set_write_u64(out, range->start[0]);
+        cork_ip_set_write_u64(out + 8, range->start[1]);
+        cork_ip_set_write_u64(out + 16, range->end[0]);
+        cork_ip_set_write_u64(out + 24, range->end[1]);
+        out += CORK_IP_SET_V6_SIZE;
+    }
+    dest->size = out - (uint8_t *) dest->buf;
+}
+
+int
+cork_ip_set_view_init(struct cork_ip_set_view *view,
+                      const struct cork_slice *src)
+{
+    const uint8_t  *buf = src->buf;
+    size_t  size = src->size;
+    uint64_t  v4_count;
+    uint64_t  v6_count;
+
+    if (CORK_UNLIKELY(size < CORK_IP_SET_HEADER_SIZE ||
+                      memcmp(buf, CORK_IP_SET_MAGIC,
+                             CORK_IP_SET_MAGIC_SIZE) != 0)) {
+        cork_error_set_printf
+            (CORK_IP_SET_INVALID_FORMAT, "Not a serialized IP set");
+        return -1;
+    }
+
+    v4_count = cork_ip_set_read_u64(buf + 8);
+    v6_count = cork_ip_set_read_u64(buf + 16);
+    size -= CORK_IP_SET_HEADER_SIZE;
+    if (CORK_UNLIKELY(v4_count > size / CORK_IP_SET_V4_SIZE ||
+                      v6_count > (size - v4_count * CORK_IP_SET_V4_SIZE)
+                                 / CORK_IP_SET_V6_SIZE ||
+                      size != v4_count * CORK_IP_SET_V4_SIZE +
+                              v6_count * CORK_IP_SET_V6_SIZE)) {
+        cork_error_set_printf
+            (CORK_IP_SET_INVALID_FORMAT,
+             "Serialized IP set has the wrong size");
+        return -1;
+    }
+
+    view->v4 = buf + CORK_IP_SET_HEADER_SIZE;
+    view->v4_count = v4_count;
+    view->v6 = view->v4 + v4_count * CORK_IP_SET_V4_SIZE;
+    view->v6_count = v6_count;
+    return 0;
+}
+
+bool
+cork_ip_set_view_contains(const struct cork_ip_set_view *view,
+                          const struct cork_ip *addr)
+{
+    size_t  lo = 0;
+    size_t  hi;
+    if (addr->version == 4) {
+        uint32_t  value = cork_ip_set_v4_value(&addr->ip.v4);
+        hi = view->v4_count;
+        while (lo < hi) {
+            size_t  mid = lo + (hi - lo) / 2;
+            if (cork_ip_set_read_u32(view->v4 + mid * CORK_IP_SET_V4_SIZE)
+                <= value) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo > 0 &&
+            value <= cork_ip_set_read_u32
+                (view->v4 + (lo - 1) * CORK_IP_SET_V4_SIZE + 4);
+    } else {
+        cork_u128  value = cork_ip_set_v6_value(&addr->ip.v6);
+        hi = view->v6_count;
+        while (lo < hi) {
+            size_t  mid = lo + (hi - lo) / 2;
+            if (cork_u128_le(cork_ip_set_read_u128
+                             (view->v6 + mid * CORK_IP_SET_V6_SIZE), value)) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo > 0 &&
+            cork_u128_le(value, cork_ip_set_read_u128
+                         (view->v6 + (lo - 1) * CORK_IP_SET_V6_SIZE + 16));
+    }
+}
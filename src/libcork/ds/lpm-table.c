@@ -0,0 +1,341 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/attributes.h"
+#include "libcork/core/error.h"
+#include "libcork/core/net-addresses.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/array.h"
+#include "libcork/ds/lpm-table.h"
+#include "libcork/ds/sort.h"
+
+
+/*-----------------------------------------------------------------------
+ * Multibit tries
+ */
+
+/* Each trie entry is either 0 (no network contains this part of the address
+ * space), the index of a network plus 1, or CORK_LPM_CHILD combined with the
+ * index of a 256-entry chunk that covers the next byte of the address.  Before
+ * creating a child chunk, we copy its parent entry into every one of the
+ * chunk's entries ("leaf pushing"), so a lookup never has to remember a
+ * less-specific match on the way down. */
+
+#define CORK_LPM_ROOT_BITS  16
+#define CORK_LPM_ROOT_SIZE  (1 << CORK_LPM_ROOT_BITS)
+#define CORK_LPM_CHUNK_BITS  8
+#define CORK_LPM_CHUNK_SIZE  (1 << CORK_LPM_CHUNK_BITS)
+#define CORK_LPM_CHILD  UINT32_C(0x80000000)
+/* Stands for the root table when we're keeping track of which chunk we're
+ * in. */
+#define CORK_LPM_ROOT  UINT32_MAX
+
+struct cork_lpm_trie {
+    /* NULL if there aren't any networks of this IP version */
+    uint32_t  *root;
+    cork_array(uint32_t)  chunks;
+};
+
+static void
+cork_lpm_trie_init(struct cork_lpm_trie *trie)
+{
+    trie->root = NULL;
+    cork_array_init(&trie->chunks);
+}
+
+static void
+cork_lpm_trie_clear(struct cork_lpm_trie *trie)
+{
+    if (trie->root != NULL) {
+        cork_cfree(trie->root, CORK_LPM_ROOT_SIZE, sizeof(uint32_t));
+        trie->root = NULL;
+    }
+    cork_array_clear(&trie->chunks);
+}
+
+static void
+cork_lpm_trie_done(struct cork_lpm_trie *trie)
+{
+    cork_lpm_trie_clear(trie);
+    cork_array_done(&trie->chunks);
+}
+
+static uint32_t
+cork_lpm_trie_new_chunk(struct cork_lpm_trie *trie, uint32_t fill)
+{
+    uint32_t  chunk = cork_array_size(&trie->chunks) / CORK_LPM_CHUNK_SIZE;
+    uint32_t  *entries = cork_raw_array_append_n
+        (cork_array_to_raw(&trie->chunks), NULL, CORK_LPM_CHUNK_SIZE);
+    size_t  i;
+    for (i = 0; i < CORK_LPM_CHUNK_SIZE; i++) {
+        entries[i] = fill;
+    }
+    return chunk;
+}
+
+/* Chunks live in a single array, which can move when we add a new one, so we
+ * refer to them by index while building the trie. */
+static uint32_t *
+cork_lpm_trie_entries(struct cork_lpm_trie *trie, uint32_t chunk)
+{
+    if (chunk == CORK_LPM_ROOT) {
+        return trie->root;
+    } else {
+        return &cork_array_at
+            (&trie->chunks, (size_t) chunk * CORK_LPM_CHUNK_SIZE);
+    }
+}
+
+/* Networks must be added in order of increasing prefix length.  That means
+ * that none of the entries that a network covers can have a child chunk yet,
+ * since only a longer prefix would have created it. */
+static void
+cork_lpm_trie_add(struct cork_lpm_trie *trie, const uint8_t *addr,
+                  unsigned int prefix_len, uint32_t leaf)
+{
+    uint32_t  *entries;
+    uint32_t  chunk = CORK_LPM_ROOT;
+    size_t  index = (addr[0] << 8) | addr[1];
+    unsigned int  depth = CORK_LPM_ROOT_BITS;
+    unsigned int  byte = 2;
+    size_t  span;
+    size_t  i;
+
+    if (trie->root == NULL) {
+        trie->root = cork_calloc(CORK_LPM_ROOT_SIZE, sizeof(uint32_t));
+    }
+
+    while (prefix_len > depth) {
+        uint32_t  entry = cork_lpm_trie_entries(trie, chunk)[index];
+        if (!(entry & CORK_LPM_CHILD)) {
+            entry = cork_lpm_trie_new_chunk(trie, entry) | CORK_LPM_CHILD;
+            cork_lpm_trie_entries(trie, chunk)[index] = entry;
+        }
+        chunk = entry & ~CORK_LPM_CHILD;
+        index = addr[byte++];
+        depth += CORK_LPM_CHUNK_BITS;
+    }
+
+    /* The prefix ends somewhere within this level, so it covers every entry
+     * that shares the index's first (prefix_len - (depth - level bits)) bits.
+     * The host bits are already zero, so index is the first of them. */
+    entries = cork_lpm_trie_entries(trie, chunk);
+    span = (size_t) 1 << (depth - prefix_len);
+    for (i = index; i < index + span; i++) {
+        entries[i] = leaf;
+    }
+}
+
+static inline uint32_t
+cork_lpm_trie_find(const struct cork_lpm_trie *trie, const uint8_t *addr)
+{
+    const uint32_t  *chunks = cork_array_elements(&trie->chunks);
+    const uint8_t  *byte = addr + 2;
+    uint32_t  entry;
+    if (CORK_UNLIKELY(trie->root == NULL)) {
+        return 0;
+    }
+    entry = trie->root[(addr[0] << 8) | addr[1]];
+    while (entry & CORK_LPM_CHILD) {
+        entry = chunks[((size_t) (entry & ~CORK_LPM_CHILD)
+                        * CORK_LPM_CHUNK_SIZE) + *byte++];
+    }
+    return entry;
+}
+
+
+/*-----------------------------------------------------------------------
+ * LPM tables
+ */
+
+struct cork_lpm_network {
+    struct cork_ip  network;
+    unsigned int  prefix_len;
+    /* The order in which the networks were added, so that a later copy of the
+     * same network wins. */
+    size_t  seq;
+    void  *value;
+};
+
+struct cork_lpm_table {
+    cork_array(struct cork_lpm_network)  networks;
+    /* The value of each leaf in the tries, in the order that we sorted the
+     * networks into during the last build. */
+    cork_array(void *)  values;
+    struct cork_lpm_trie  v4;
+    struct cork_lpm_trie  v6;
+};
+
+struct cork_lpm_table *
+cork_lpm_table_new(void)
+{
+    struct cork_lpm_table  *table = cork_new(struct cork_lpm_table);
+    cork_array_init(&table->networks);
+    cork_array_init(&table->values);
+    cork_lpm_trie_init(&table->v4);
+    cork_lpm_trie_init(&table->v6);
+    return table;
+}
+
+void
+cork_lpm_table_free(struct cork_lpm_table *table)
+{
+    cork_array_done(&table->networks);
+    cork_array_done(&table->values);
+    cork_lpm_trie_done(&table->v4);
+    cork_lpm_trie_done(&table->v6);
+    cork_delete(struct cork_lpm_table, table);
+}
+
+int
+cork_lpm_table_add(struct cork_lpm_table *table, const struct cork_ip *network,
+                   unsigned int prefix_len, void *value)
+{
+    struct cork_lpm_network  *entry;
+    if (CORK_UNLIKELY(!cork_ip_is_valid_network(network, prefix_len))) {
+        char  str[CORK_IP_STRING_LENGTH];
+        cork_ip_to_raw_string(network, str);
+        cork_error_set_printf
+            (CORK_LPM_TABLE_INVALID_NETWORK,
+             "Invalid network %s/%u", str, prefix_len);
+        return -1;
+    }
+    entry = cork_array_append_get(&table->networks);
+    entry->network = *network;
+    entry->prefix_len = prefix_len;
+    entry->seq = cork_array_size(&table->networks) - 1;
+    entry->value = value;
+    return 0;
+}
+
+size_t
+cork_lpm_table_size(const struct cork_lpm_table *table)
+{
+    return cork_array_size(&table->networks);
+}
+
+static int
+cork_lpm_network__compare(void *user_data, const void *va, const void *vb)
+{
+    const struct cork_lpm_network  *a = va;
+    const struct cork_lpm_network  *b = vb;
+    if (a->prefix_len != b->prefix_len) {
+        return (a->prefix_len < b->prefix_len)? -1: 1;
+    }
+    return (a->seq < b->seq)? -1: (a->seq > b->seq)? 1: 0;
+}
+
+void
+cork_lpm_table_build(struct cork_lpm_table *table)
+{
+    size_t  count = cork_array_size(&table->networks);
+    size_t  i;
+
+    cork_lpm_trie_clear(&table->v4);
+    cork_lpm_trie_clear(&table->v6);
+    cork_array_clear(&table->values);
+    cork_array_ensure_size(&table->values, count);
+
+    cork_sort(cork_array_elements(&table->networks), count,
+              sizeof(struct cork_lpm_network), NULL,
+              cork_lpm_network__compare);
+    for (i = 0; i < count; i++) {
+        struct cork_lpm_network  *entry = &cork_array_at(&table->networks, i);
+        uint32_t  leaf = i + 1;
+        cork_array_append(&table->values, entry->value);
+        if (entry->network.version == 4) {
+            cork_lpm_trie_add(&table->v4, entry->network.ip.v4._.u8,
+                              entry->prefix_len, leaf);
+        } else {
+            cork_lpm_trie_add(&table->v6, entry->network.ip.v6._.u8,
+                              entry->prefix_len, leaf);
+        }
+    }
+}
+
+#define cork_lpm_table_value(table, leaf) \
+    ((leaf) == 0? NULL: cork_array_at(&(table)->values, (leaf) - 1))
+
+void *
+cork_lpm_table_lookup_ipv4(const struct cork_lpm_table *table,
+                           const struct cork_ipv4 *addr)
+{
+    uint32_t  leaf = cork_lpm_trie_find(&table->v4, addr->_.u8);
+    return cork_lpm_table_value(table, leaf);
+}
+
+void *
+cork_lpm_table_lookup_ipv6(const struct cork_lpm_table *table,
+                           const struct cork_ipv6 *addr)
+{
+    uint32_t  leaf = cork_lpm_trie_find(&table->v6, addr->_.u8);
+    return cork_lpm_table_value(table, leaf);
+}
+
+static inline uint32_t
+cork_lpm_table_find(const struct cork_lpm_table *table,
+                    const struct cork_ip *addr)
+{
+    switch (addr->version) {
+        case 4:
+            return cork_lpm_trie_find(&table->v4, addr->ip.v4._.u8);
+        case 6:
+            return cork_lpm_trie_find(&table->v6, addr->ip.v6._.u8);
+        default:
+            return 0;
+    }
+}
+
+void *
+cork_lpm_table_lookup(const struct cork_lpm_table *table,
+                      const struct cork_ip *addr)
+{
+    uint32_t  leaf = cork_lpm_table_find(table, addr);
+    return cork_lpm_table_value(table, leaf);
+}
+
+/* The root tables are too big to stay in cache, so we prefetch the root entry
+ * for an address a few iterations before we need it. */
+#define CORK_LPM_PREFETCH_DISTANCE  8
+
+static inline void
+cork_lpm_table_prefetch(const struct cork_lpm_table *table,
+                        const struct cork_ip *addr)
+{
+    const struct cork_lpm_trie  *trie =
+        (addr->version == 4)? &table->v4: &table->v6;
+    const uint8_t  *bytes =
+        (addr->version == 4)? addr->ip.v4._.u8: addr->ip.v6._.u8;
+    if (trie->root != NULL) {
+        CORK_PREFETCH(&trie->root[(bytes[0] << 8) | bytes[1]]);
+    }
+}
+
+void
+cork_lpm_table_lookup_batch(const struct cork_lpm_table *table,
+                            const struct cork_ip *addrs, size_t count,
+                            void **results)
+{
+    size_t  i;
+    for (i = 0; i < count && i < CORK_LPM_PREFETCH_DISTANCE; i++) {
+        cork_lpm_table_prefetch(table, &addrs[i]);
+    }
+    for (i = 0; i < count; i++) {
+        uint32_t  leaf;
+        if (i + CORK_LPM_PREFETCH_DISTANCE < count) {
+            cork_lpm_table_prefetch
+                (table, &addrs[i + CORK_LPM_PREFETCH_DISTANCE]);
+        }
+        leaf = cork_lpm_table_find(table, &addrs[i]);
+        results[i] = cork_lpm_table_value(table, leaf);
+    }
+}
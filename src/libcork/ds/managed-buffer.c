@@ -7,14 +7,24 @@
  * ----------------------------------------------------------------------
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "libcork/core/error.h"
+#include "libcork/core/mempool.h"
 #include "libcork/core/types.h"
+#include "libcork/ds/buffer.h"
 #include "libcork/ds/managed-buffer.h"
 #include "libcork/ds/slice.h"
 #include "libcork/helpers/errors.h"
+#include "libcork/helpers/posix.h"
+#include "libcork/threads/atomics.h"
 
 
 /*-----------------------------------------------------------------------
@@ -53,7 +63,8 @@ cork_managed_buffer_wrapped__free(struct cork_managed_buffer *vself)
 }
 
 static struct cork_managed_buffer_iface  CORK_MANAGED_BUFFER_WRAPPED = {
-    cork_managed_buffer_wrapped__free
+    cork_managed_buffer_wrapped__free,
+    NULL
 };
 
 struct cork_managed_buffer *
@@ -99,7 +110,8 @@ cork_managed_buffer_copied__free(struct cork_managed_buffer *vself)
 }
 
 static struct cork_managed_buffer_iface  CORK_MANAGED_BUFFER_COPIED = {
-    cork_managed_buffer_copied__free
+    cork_managed_buffer_copied__free,
+    NULL
 };
 
 struct cork_managed_buffer *
@@ -120,6 +132,203 @@ cork_managed_buffer_new_copy(const void *buf, size_t size)
 }
 
 
+struct cork_managed_buffer_pool {
+    struct cork_mempool  *mp;
+    size_t  buffer_size;
+};
+
+struct cork_managed_buffer_pooled {
+    struct cork_managed_buffer  parent;
+    struct cork_managed_buffer_pool  *pool;
+};
+
+#define CORK_MANAGED_BUFFER_POOLED_HEADER_SIZE \
+    (sizeof(struct cork_managed_buffer_pooled))
+
+/* Every element in the pool's mempool must be a multiple of the header's
+ * alignment, so that each header (and its atomic reference count) is
+ * aligned. */
+struct cork_managed_buffer_pooled_align {
+    char  c;
+    struct cork_managed_buffer_pooled  header;
+};
+
+#define CORK_MANAGED_BUFFER_POOLED_ALIGNMENT \
+    (offsetof(struct cork_managed_buffer_pooled_align, header))
+
+#define cork_managed_buffer_pooled_data(self) \
+    (((void *) (self)) + CORK_MANAGED_BUFFER_POOLED_HEADER_SIZE)
+
+/* Aim for at least this many buffers in each of the mempool's blocks. */
+#define CORK_MANAGED_BUFFER_POOL_BLOCK_COUNT  16
+
+static void
+cork_managed_buffer_pooled__free(struct cork_managed_buffer *vself)
+{
+    struct cork_managed_buffer_pooled  *self =
+        cork_container_of(vself, struct cork_managed_buffer_pooled, parent);
+    cork_mempool_free_object(self->pool->mp, self);
+}
+
+static struct cork_managed_buffer_iface  CORK_MANAGED_BUFFER_POOLED = {
+    cork_managed_buffer_pooled__free,
+    NULL
+};
+
+struct cork_managed_buffer_pool *
+cork_managed_buffer_pool_new(size_t buffer_size)
+{
+    struct cork_managed_buffer_pool  *pool =
+        cork_new(struct cork_managed_buffer_pool);
+    size_t  alignment = CORK_MANAGED_BUFFER_POOLED_ALIGNMENT;
+    size_t  element_size =
+        (CORK_MANAGED_BUFFER_POOLED_HEADER_SIZE + buffer_size +
+         alignment - 1) & ~(alignment - 1);
+    /* Leave room for the mempool's own per-object and per-block headers. */
+    size_t  block_size =
+        CORK_MANAGED_BUFFER_POOL_BLOCK_COUNT * (element_size + 16) + 64;
+    if (block_size < CORK_MEMPOOL_DEFAULT_BLOCK_SIZE) {
+        block_size = CORK_MEMPOOL_DEFAULT_BLOCK_SIZE;
+    }
+    pool->mp = cork_mempool_new_size_ex(element_size, block_size);
+    cork_mempool_set_thread_cache
+        (pool->mp, CORK_MEMPOOL_DEFAULT_MAGAZINE_SIZE);
+    pool->buffer_size = buffer_size;
+    return pool;
+}
+
+void
+cork_managed_buffer_pool_free(struct cork_managed_buffer_pool *pool)
+{
+    cork_mempool_free(pool->mp);
+    cork_delete(struct cork_managed_buffer_pool, pool);
+}
+
+size_t
+cork_managed_buffer_pool_buffer_size(struct cork_managed_buffer_pool *pool)
+{
+    return pool->buffer_size;
+}
+
+struct cork_managed_buffer *
+cork_managed_buffer_pool_new_buffer(struct cork_managed_buffer_pool *pool,
+                                    void **data)
+{
+    struct cork_managed_buffer_pooled  *self =
+        cork_mempool_new_object(pool->mp);
+    self->parent.buf = cork_managed_buffer_pooled_data(self);
+    self->parent.size = pool->buffer_size;
+    self->parent.ref_count = 1;
+    self->parent.iface = &CORK_MANAGED_BUFFER_POOLED;
+    self->pool = pool;
+    if (data != NULL) {
+        *data = (void *) self->parent.buf;
+    }
+    return &self->parent;
+}
+
+
+struct cork_managed_buffer_mmap {
+    struct cork_managed_buffer  parent;
+};
+
+static void
+cork_managed_buffer_mmap__free(struct cork_managed_buffer *vself)
+{
+    struct cork_managed_buffer_mmap  *self =
+        cork_container_of(vself, struct cork_managed_buffer_mmap, parent);
+    if (self->parent.size > 0) {
+        munmap((void *) self->parent.buf, self->parent.size);
+    }
+    cork_delete(struct cork_managed_buffer_mmap, self);
+}
+
+static struct cork_managed_buffer_iface  CORK_MANAGED_BUFFER_MMAP = {
+    cork_managed_buffer_mmap__free,
+    NULL
+};
+
+/* Some files (like the ones in /proc) claim to be empty, but still have
+ * contents when you read them, and can't be mapped. */
+static int
+cork_managed_buffer_read_fd(int fd, struct cork_buffer *dest)
+{
+    while (true) {
+        ssize_t  bytes_read;
+        cork_buffer_ensure_size(dest, dest->size + 4096);
+        bytes_read = read(fd, (char *) dest->buf + dest->size,
+                          dest->allocated_size - dest->size);
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cork_system_error_set();
+            return -1;
+        } else if (bytes_read == 0) {
+            return 0;
+        }
+        dest->size += bytes_read;
+    }
+}
+
+struct cork_managed_buffer *
+cork_managed_buffer_new_mmap(const char *path)
+{
+    int  fd;
+    struct stat  info;
+    void  *buf = NULL;
+    struct cork_managed_buffer_mmap  *self;
+
+    /* O_NONBLOCK keeps us from waiting for a writer if path is a FIFO; we
+     * reject those below anyway. */
+    rpi_check_posix(fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC));
+    ei_check_posix(fstat(fd, &info));
+    if (CORK_UNLIKELY(!S_ISREG(info.st_mode))) {
+        cork_error_set_printf
+            (EINVAL, "Cannot map %s: not a regular file", path);
+        goto error;
+    }
+
+    if (info.st_size == 0) {
+        /* You can't map an empty file.  If it really is empty, we represent
+         * it with an empty buffer that has nothing to unmap; otherwise we
+         * have to copy its contents. */
+        struct cork_buffer  contents = CORK_BUFFER_INIT();
+        if (CORK_UNLIKELY(cork_managed_buffer_read_fd(fd, &contents) == -1)) {
+            cork_buffer_done(&contents);
+            goto error;
+        }
+        if (contents.size > 0) {
+            struct cork_managed_buffer  *copy =
+                cork_managed_buffer_new_copy(contents.buf, contents.size);
+            cork_buffer_done(&contents);
+            close(fd);
+            return copy;
+        }
+        cork_buffer_done(&contents);
+    } else {
+        buf = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (buf == MAP_FAILED) {
+            cork_system_error_set();
+            goto error;
+        }
+    }
+    /* The mapping stays valid after we close the file. */
+    close(fd);
+
+    self = cork_new(struct cork_managed_buffer_mmap);
+    self->parent.buf = buf;
+    self->parent.size = info.st_size;
+    self->parent.ref_count = 1;
+    self->parent.iface = &CORK_MANAGED_BUFFER_MMAP;
+    return &self->parent;
+
+error:
+    close(fd);
+    return NULL;
+}
+
+
 static void
 cork_managed_buffer_free(struct cork_managed_buffer *self)
 {
@@ -140,7 +349,9 @@ cork_managed_buffer_ref(struct cork_managed_buffer *self)
           self->buf, self->size, old_count + 1);
     */
 
-    self->ref_count++;
+    /* Taking a new reference doesn't need to synchronize with anything; the
+     * caller must already hold a reference, so the buffer can't go away. */
+    cork_atomic_fetch_add(&self->ref_count, 1, CORK_ATOMIC_RELAXED);
     return self;
 }
 
@@ -154,14 +365,15 @@ cork_managed_buffer_unref(struct cork_managed_buffer *self)
           self->buf, self->size, old_count - 1);
     */
 
-    if (--self->ref_count == 0) {
+    /* The release makes sure that our own accesses to the buffer happen
+     * before whoever frees it; the acquire makes sure that the freeing thread
+     * sees everyone else's. */
+    if (cork_atomic_fetch_sub(&self->ref_count, 1, CORK_ATOMIC_ACQ_REL) == 1) {
         cork_managed_buffer_free(self);
     }
 }
 
 
-static struct cork_slice_iface  CORK_MANAGED_BUFFER__SLICE;
-
 static void
 cork_managed_buffer__slice_free(struct cork_slice *self)
 {
@@ -169,6 +381,7 @@ cork_managed_buffer__slice_free(struct cork_slice *self)
     cork_managed_buffer_unref(mbuf);
 }
 
+/* Full copies of both kinds of slice take out a new reference. */
 static int
 cork_managed_buffer__slice_copy(struct cork_slice *dest,
                                 const struct cork_slice *src,
@@ -177,15 +390,36 @@ cork_managed_buffer__slice_copy(struct cork_slice *dest,
     struct cork_managed_buffer  *mbuf = src->user_data;
     dest->buf = src->buf + offset;
     dest->size = length;
-    dest->iface = &CORK_MANAGED_BUFFER__SLICE;
+    dest->iface = &cork_slice__managed;
     dest->user_data = cork_managed_buffer_ref(mbuf);
     return 0;
 }
 
-static struct cork_slice_iface  CORK_MANAGED_BUFFER__SLICE = {
+/* Light copies of both kinds of slice are borrowed, since they can't outlive
+ * the slice that holds the reference. */
+static int
+cork_managed_buffer__slice_light_copy(struct cork_slice *dest,
+                                      const struct cork_slice *src,
+                                      size_t offset, size_t length)
+{
+    dest->buf = src->buf + offset;
+    dest->size = length;
+    dest->iface = &cork_slice__borrowed;
+    dest->user_data = src->user_data;
+    return 0;
+}
+
+struct cork_slice_iface  cork_slice__managed = {
     cork_managed_buffer__slice_free,
     cork_managed_buffer__slice_copy,
+    cork_managed_buffer__slice_light_copy,
+    NULL
+};
+
+struct cork_slice_iface  cork_slice__borrowed = {
+    NULL,
     cork_managed_buffer__slice_copy,
+    cork_managed_buffer__slice_light_copy,
     NULL
 };
 
@@ -206,7 +440,7 @@ cork_managed_buffer_slice(struct cork_slice *dest,
         */
         dest->buf = buffer->buf + offset;
         dest->size = length;
-        dest->iface = &CORK_MANAGED_BUFFER__SLICE;
+        dest->iface = &cork_slice__managed;
         dest->user_data = cork_managed_buffer_ref(buffer);
         return 0;
     }
@@ -224,6 +458,28 @@ cork_managed_buffer_slice(struct cork_slice *dest,
 }
 
 
+int
+cork_managed_buffer_slice_borrowed(struct cork_slice *dest,
+                                   struct cork_managed_buffer *buffer,
+                                   size_t offset, size_t length)
+{
+    if ((buffer != NULL) &&
+        (offset <= buffer->size) &&
+        ((offset + length) <= buffer->size)) {
+        dest->buf = buffer->buf + offset;
+        dest->size = length;
+        dest->iface = &cork_slice__borrowed;
+        dest->user_data = buffer;
+        return 0;
+    } else {
+        cork_slice_clear(dest);
+        cork_slice_invalid_slice_set
+            ((buffer == NULL)? 0: buffer->size, offset, length);
+        return -1;
+    }
+}
+
+
 int
 cork_managed_buffer_slice_offset(struct cork_slice *dest,
                                  struct cork_managed_buffer *buffer,
@@ -238,3 +494,73 @@ cork_managed_buffer_slice_offset(struct cork_slice *dest,
             (dest, buffer, offset, buffer->size - offset);
     }
 }
+
+
+struct cork_managed_buffer *
+cork_slice_get_managed_buffer(const struct cork_slice *slice)
+{
+    if (slice->iface == &cork_slice__managed ||
+        slice->iface == &cork_slice__borrowed) {
+        return slice->user_data;
+    } else {
+        return NULL;
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Memory-mapped files
+ */
+
+int
+cork_mmap_file_slice(const char *path, struct cork_slice *dest)
+{
+    struct cork_managed_buffer  *mbuf = cork_managed_buffer_new_mmap(path);
+    if (CORK_UNLIKELY(mbuf == NULL)) {
+        cork_slice_clear(dest);
+        return -1;
+    }
+    ei_check(cork_managed_buffer_slice_offset(dest, mbuf, 0));
+    /* The slice holds its own reference to the mapping. */
+    cork_managed_buffer_unref(mbuf);
+    return 0;
+
+error:
+    cork_managed_buffer_unref(mbuf);
+    return -1;
+}
+
+int
+cork_mmap_slice_advise(const struct cork_slice *slice,
+                       enum cork_mmap_advice advice)
+{
+    struct cork_managed_buffer  *mbuf = cork_slice_get_managed_buffer(slice);
+    uintptr_t  page_size;
+    uintptr_t  start;
+    uintptr_t  end;
+    int  posix_advice;
+
+    if (mbuf == NULL || mbuf->iface != &CORK_MANAGED_BUFFER_MMAP ||
+        slice->size == 0) {
+        return 0;
+    }
+
+    switch (advice) {
+        case CORK_MMAP_NORMAL:     posix_advice = MADV_NORMAL; break;
+        case CORK_MMAP_SEQUENTIAL: posix_advice = MADV_SEQUENTIAL; break;
+        case CORK_MMAP_RANDOM:     posix_advice = MADV_RANDOM; break;
+        case CORK_MMAP_WILLNEED:   posix_advice = MADV_WILLNEED; break;
+        case CORK_MMAP_DONTNEED:   posix_advice = MADV_DONTNEED; break;
+        default:
+            cork_system_error_set_explicit(EINVAL);
+            return -1;
+    }
+
+    /* madvise only works on whole pages, so round the slice outwards. */
+    page_size = sysconf(_SC_PAGESIZE);
+    start = ((uintptr_t) slice->buf) & ~(page_size - 1);
+    end = ((uintptr_t) slice->buf + slice->size + page_size - 1) &
+        ~(page_size - 1);
+    rii_check_posix(madvise((void *) start, end - start, posix_advice));
+    return 0;
+}
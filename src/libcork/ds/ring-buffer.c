@@ -8,10 +8,12 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "libcork/core/allocator.h"
 #include "libcork/core/types.h"
 #include "libcork/ds/ring-buffer.h"
+#include "libcork/threads/atomics.h"
 
 
 int
@@ -22,6 +24,7 @@ cork_ring_buffer_init(struct cork_ring_buffer *self, size_t size)
     self->size = 0;
     self->read_index = 0;
     self->write_index = 0;
+    self->mask = (size > 1 && (size & (size - 1)) == 0)? size - 1: 0;
     return 0;
 }
 
@@ -46,6 +49,22 @@ cork_ring_buffer_free(struct cork_ring_buffer *buf)
     cork_delete(struct cork_ring_buffer, buf);
 }
 
+/* Move an index forward by count elements, wrapping it around if needed.
+ * count can't be more than allocated_size. */
+static inline size_t
+cork_ring_buffer_advance(struct cork_ring_buffer *self, size_t index,
+                         size_t count)
+{
+    index += count;
+    if (self->mask != 0) {
+        return index & self->mask;
+    } else if (index >= self->allocated_size) {
+        return index - self->allocated_size;
+    } else {
+        return index;
+    }
+}
+
 int
 cork_ring_buffer_add(struct cork_ring_buffer *self, void *element)
 {
@@ -53,11 +72,9 @@ cork_ring_buffer_add(struct cork_ring_buffer *self, void *element)
         return -1;
     }
 
-    self->elements[self->write_index++] = element;
+    self->elements[self->write_index] = element;
+    self->write_index = cork_ring_buffer_advance(self, self->write_index, 1);
     self->size++;
-    if (self->write_index == self->allocated_size) {
-        self->write_index = 0;
-    }
     return 0;
 }
 
@@ -67,11 +84,9 @@ cork_ring_buffer_pop(struct cork_ring_buffer *self)
     if (cork_ring_buffer_is_empty(self)) {
         return NULL;
     } else {
-        void  *result = self->elements[self->read_index++];
+        void  *result = self->elements[self->read_index];
+        self->read_index = cork_ring_buffer_advance(self, self->read_index, 1);
         self->size--;
-        if (self->read_index == self->allocated_size) {
-            self->read_index = 0;
-        }
         return result;
     }
 }
@@ -85,3 +100,301 @@ cork_ring_buffer_peek(struct cork_ring_buffer *self)
         return self->elements[self->read_index];
     }
 }
+
+/* The elements between index and the end of the array, followed by any that
+ * wrap around to the beginning, make up at most two contiguous runs. */
+
+size_t
+cork_ring_buffer_add_many(struct cork_ring_buffer *self,
+                          void * const *elements, size_t count)
+{
+    size_t  available = self->allocated_size - self->size;
+    size_t  first_run;
+    if (count > available) {
+        count = available;
+    }
+    first_run = self->allocated_size - self->write_index;
+    if (first_run > count) {
+        first_run = count;
+    }
+    memcpy(&self->elements[self->write_index], elements,
+           first_run * sizeof(void *));
+    memcpy(&self->elements[0], elements + first_run,
+           (count - first_run) * sizeof(void *));
+    self->write_index =
+        cork_ring_buffer_advance(self, self->write_index, count);
+    self->size += count;
+    return count;
+}
+
+size_t
+cork_ring_buffer_pop_many(struct cork_ring_buffer *self,
+                          void **dest, size_t count)
+{
+    size_t  first_run;
+    if (count > self->size) {
+        count = self->size;
+    }
+    first_run = self->allocated_size - self->read_index;
+    if (first_run > count) {
+        first_run = count;
+    }
+    memcpy(dest, &self->elements[self->read_index],
+           first_run * sizeof(void *));
+    memcpy(dest + first_run, &self->elements[0],
+           (count - first_run) * sizeof(void *));
+    self->read_index = cork_ring_buffer_advance(self, self->read_index, count);
+    self->size -= count;
+    return count;
+}
+
+
+/* The typed and concurrent ring buffers all have power-of-two capacities, so
+ * that they can wrap their indices around with a mask. */
+
+static size_t
+cork_ring_buffer_round_size(size_t size)
+{
+    size_t  result = 2;
+    while (result < size) {
+        result <<= 1;
+    }
+    return result;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Type-checked ring buffers
+ */
+
+void
+cork_raw_ring_init(struct cork_raw_ring *ring, size_t element_size,
+                   size_t size)
+{
+    size = cork_ring_buffer_round_size(size);
+    ring->items = cork_calloc(size, element_size);
+    ring->size = 0;
+    ring->allocated_size = size;
+    ring->mask = size - 1;
+    ring->read_index = 0;
+    ring->write_index = 0;
+}
+
+void
+cork_raw_ring_done(struct cork_raw_ring *ring, size_t element_size)
+{
+    cork_cfree(ring->items, ring->allocated_size, element_size);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Concurrent ring buffers
+ */
+
+/* Both concurrent ring buffers use indices that increase forever, and only
+ * wrap them around when accessing the underlying array. */
+
+
+int
+cork_spsc_ring_buffer_init(struct cork_spsc_ring_buffer *self, size_t size)
+{
+    size = cork_ring_buffer_round_size(size);
+    self->elements = cork_calloc(size, sizeof(void *));
+    self->allocated_size = size;
+    self->mask = size - 1;
+    self->write_index = 0;
+    self->cached_read_index = 0;
+    self->read_index = 0;
+    self->cached_write_index = 0;
+    return 0;
+}
+
+struct cork_spsc_ring_buffer *
+cork_spsc_ring_buffer_new(size_t size)
+{
+    struct cork_spsc_ring_buffer  *buf =
+        cork_new(struct cork_spsc_ring_buffer);
+    cork_spsc_ring_buffer_init(buf, size);
+    return buf;
+}
+
+void
+cork_spsc_ring_buffer_done(struct cork_spsc_ring_buffer *self)
+{
+    cork_cfree(self->elements, self->allocated_size, sizeof(void *));
+}
+
+void
+cork_spsc_ring_buffer_free(struct cork_spsc_ring_buffer *buf)
+{
+    cork_spsc_ring_buffer_done(buf);
+    cork_delete(struct cork_spsc_ring_buffer, buf);
+}
+
+int
+cork_spsc_ring_buffer_add(struct cork_spsc_ring_buffer *self, void *element)
+{
+    size_t  write_index = self->write_index;
+    /* Only look at the consumer's index (and pull its cache line over) when
+     * our cached copy says that the buffer might be full. */
+    if (write_index - self->cached_read_index == self->allocated_size) {
+        self->cached_read_index = cork_atomic_load_acquire(&self->read_index);
+        if (write_index - self->cached_read_index == self->allocated_size) {
+            return -1;
+        }
+    }
+    self->elements[write_index & self->mask] = element;
+    cork_atomic_store_release(&self->write_index, write_index + 1);
+    return 0;
+}
+
+void *
+cork_spsc_ring_buffer_peek(struct cork_spsc_ring_buffer *self)
+{
+    size_t  read_index = self->read_index;
+    if (read_index == self->cached_write_index) {
+        self->cached_write_index =
+            cork_atomic_load_acquire(&self->write_index);
+        if (read_index == self->cached_write_index) {
+            return NULL;
+        }
+    }
+    return self->elements[read_index & self->mask];
+}
+
+void *
+cork_spsc_ring_buffer_pop(struct cork_spsc_ring_buffer *self)
+{
+    void  *result = cork_spsc_ring_buffer_peek(self);
+    if (result != NULL) {
+        cork_atomic_store_release(&self->read_index, self->read_index + 1);
+    }
+    return result;
+}
+
+
+int
+cork_mpmc_ring_buffer_init(struct cork_mpmc_ring_buffer *self, size_t size)
+{
+    size_t  i;
+    size = cork_ring_buffer_round_size(size);
+    self->cells =
+        cork_calloc(size, sizeof(struct cork_mpmc_ring_buffer_cell));
+    self->allocated_size = size;
+    self->mask = size - 1;
+    /* Cell i is ready for the producer that claims index i. */
+    for (i = 0; i < size; i++) {
+        self->cells[i].sequence = i;
+    }
+    self->write_index = 0;
+    self->read_index = 0;
+    return 0;
+}
+
+struct cork_mpmc_ring_buffer *
+cork_mpmc_ring_buffer_new(size_t size)
+{
+    struct cork_mpmc_ring_buffer  *buf =
+        cork_new(struct cork_mpmc_ring_buffer);
+    cork_mpmc_ring_buffer_init(buf, size);
+    return buf;
+}
+
+void
+cork_mpmc_ring_buffer_done(struct cork_mpmc_ring_buffer *self)
+{
+    cork_cfree(self->cells, self->allocated_size,
+               sizeof(struct cork_mpmc_ring_buffer_cell));
+}
+
+void
+cork_mpmc_ring_buffer_free(struct cork_mpmc_ring_buffer *buf)
+{
+    cork_mpmc_ring_buffer_done(buf);
+    cork_delete(struct cork_mpmc_ring_buffer, buf);
+}
+
+/* A cell's sequence number is the index of the producer that can fill it
+ * next, or one more than the index of the consumer that can empty it next.
+ * Comparing it with the index that we're trying to claim tells us whether
+ * the cell is ready for us, still in use from the previous lap, or was
+ * already claimed by another thread. */
+
+int
+cork_mpmc_ring_buffer_add(struct cork_mpmc_ring_buffer *self, void *element)
+{
+    struct cork_mpmc_ring_buffer_cell  *cell;
+    size_t  index = cork_atomic_load_acquire(&self->write_index);
+
+    while (true) {
+        size_t  sequence;
+        intptr_t  diff;
+        cell = &self->cells[index & self->mask];
+        sequence = cork_atomic_load_acquire(&cell->sequence);
+        diff = (intptr_t) sequence - (intptr_t) index;
+        if (diff == 0) {
+            size_t  old_index =
+                cork_size_cas(&self->write_index, index, index + 1);
+            if (old_index == index) {
+                break;
+            }
+            index = old_index;
+        } else if (diff < 0) {
+            /* The consumer for the previous lap hasn't emptied it yet. */
+            return -1;
+        } else {
+            index = cork_atomic_load_acquire(&self->write_index);
+        }
+    }
+
+    cell->element = element;
+    cork_atomic_store_release(&cell->sequence, index + 1);
+    return 0;
+}
+
+void *
+cork_mpmc_ring_buffer_pop(struct cork_mpmc_ring_buffer *self)
+{
+    struct cork_mpmc_ring_buffer_cell  *cell;
+    size_t  index = cork_atomic_load_acquire(&self->read_index);
+    void  *result;
+
+    while (true) {
+        size_t  sequence;
+        intptr_t  diff;
+        cell = &self->cells[index & self->mask];
+        sequence = cork_atomic_load_acquire(&cell->sequence);
+        diff = (intptr_t) sequence - (intptr_t) (index + 1);
+        if (diff == 0) {
+            size_t  old_index =
+                cork_size_cas(&self->read_index, index, index + 1);
+            if (old_index == index) {
+                break;
+            }
+            index = old_index;
+        } else if (diff < 0) {
+            /* No producer has filled this cell yet. */
+            return NULL;
+        } else {
+            index = cork_atomic_load_acquire(&self->read_index);
+        }
+    }
+
+    result = cell->element;
+    /* Hand the cell over to the producer for the next lap. */
+    cork_atomic_store_release(&cell->sequence, index + self->allocated_size);
+    return result;
+}
+
+void *
+cork_mpmc_ring_buffer_peek(struct cork_mpmc_ring_buffer *self)
+{
+    size_t  index = cork_atomic_load_acquire(&self->read_index);
+    struct cork_mpmc_ring_buffer_cell  *cell =
+        &self->cells[index & self->mask];
+    if (cork_atomic_load_acquire(&cell->sequence) == index + 1) {
+        return cell->element;
+    } else {
+        return NULL;
+    }
+}
@@ -0,0 +1,1320 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/byte-order.h"
+#include "libcork/core/error.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/buffer.h"
+#include "libcork/ds/roaring-bitmap.h"
+#include "libcork/ds/slice.h"
+
+
+/* This follows Chambi, Lemire, Kaser, and Godin, "Better bitmap performance
+ * with Roaring bitmaps" (2016), and Lemire et al., "Consistently faster and
+ * smaller compressed bitmaps with Roaring" (2016).
+ *
+ * Each container holds the lower 16 bits of the values that share the same
+ * upper 16 bits (its key).  An array container holds at most
+ * CORK_ROARING_ARRAY_MAX values, since at that point, a bitmap container
+ * takes up the same amount of space.  Whenever we modify a container, we
+ * switch between those two representations as needed.  Run containers are
+ * only created by cork_roaring_bitmap_add_range and
+ * cork_roaring_bitmap_run_optimize; we convert them back into an array or
+ * bitmap before modifying them. */
+
+#define CORK_ROARING_ARRAY_MAX  4096
+#define CORK_ROARING_BITMAP_WORDS  1024
+#define CORK_ROARING_CHUNK_SIZE  65536
+
+#define CORK_ROARING_ALL_ONES  UINT64_C(0xffffffffffffffff)
+
+/* These values are also used in the serialized form. */
+#define CORK_ROARING_ARRAY  1
+#define CORK_ROARING_BITMAP  2
+#define CORK_ROARING_RUN  3
+
+/* A run covers the values from start to start + length, inclusive. */
+struct cork_roaring_run {
+    uint16_t  start;
+    uint16_t  length;
+};
+
+struct cork_roaring_container {
+    uint16_t  key;
+    uint8_t  type;
+    /* False if data points into the slice that we were deserialized from, in
+     * which case we have to copy it before modifying it. */
+    bool  owned;
+    uint32_t  cardinality;
+    /* The number of values in an array container, or runs in a run
+     * container */
+    uint32_t  size;
+    /* The number of values or runs that data has room for */
+    uint32_t  capacity;
+    void  *data;
+};
+
+struct cork_roaring_bitmap {
+    /* Sorted by key */
+    struct cork_roaring_container  *containers;
+    size_t  count;
+    size_t  allocated;
+    /* The serialized form that non-owned containers point into, if any */
+    struct cork_slice  backing;
+};
+
+
+/*-----------------------------------------------------------------------
+ * Container storage
+ */
+
+static size_t
+cork_roaring_data_size(uint8_t type, uint32_t capacity)
+{
+    switch (type) {
+        case CORK_ROARING_ARRAY:
+            return capacity * sizeof(uint16_t);
+        case CORK_ROARING_BITMAP:
+            return CORK_ROARING_BITMAP_WORDS * sizeof(uint64_t);
+        case CORK_ROARING_RUN:
+            return capacity * sizeof(struct cork_roaring_run);
+        default:
+            return 0;
+    }
+}
+
+static void
+cork_roaring_container_done(struct cork_roaring_container *c)
+{
+    if (c->owned && c->data != NULL) {
+        cork_free(c->data, cork_roaring_data_size(c->type, c->capacity));
+    }
+    c->data = NULL;
+}
+
+/* Replace a container's contents with newly allocated data. */
+static void
+cork_roaring_container_replace(struct cork_roaring_container *c,
+                               uint8_t type, void *data, uint32_t size,
+                               uint32_t capacity, uint32_t cardinality)
+{
+    cork_roaring_container_done(c);
+    c->type = type;
+    c->owned = true;
+    c->data = data;
+    c->size = size;
+    c->capacity = capacity;
+    c->cardinality = cardinality;
+}
+
+static void
+cork_roaring_container_copy(struct cork_roaring_container *dest,
+                            const struct cork_roaring_container *src)
+{
+    uint32_t  capacity = (src->size == 0)? 1: src->size;
+    size_t  data_size = cork_roaring_data_size(src->type, capacity);
+    void  *data = cork_malloc(data_size);
+    memcpy(data, src->data, cork_roaring_data_size(src->type, src->size));
+    dest->data = NULL;
+    cork_roaring_container_replace
+        (dest, src->type, data, src->size, capacity, src->cardinality);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Searching within containers
+ */
+
+static uint32_t
+cork_roaring_bitmap_word_count(const uint64_t *words)
+{
+    uint32_t  count = 0;
+    size_t  i;
+    for (i = 0; i < CORK_ROARING_BITMAP_WORDS; i++) {
+        count += __builtin_popcountll(words[i]);
+    }
+    return count;
+}
+
+/* The index of the first value that is at least value */
+static uint32_t
+cork_roaring_array_lower_bound(const uint16_t *values, uint32_t size,
+                               uint32_t value)
+{
+    uint32_t  lo = 0;
+    uint32_t  hi = size;
+    while (lo < hi) {
+        uint32_t  mid = lo + (hi - lo) / 2;
+        if (values[mid] < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* The index of the first run that ends at or after value */
+static uint32_t
+cork_roaring_run_lower_bound(const struct cork_roaring_run *runs,
+                             uint32_t size, uint32_t value)
+{
+    uint32_t  lo = 0;
+    uint32_t  hi = size;
+    while (lo < hi) {
+        uint32_t  mid = lo + (hi - lo) / 2;
+        if ((uint32_t) runs[mid].start + runs[mid].length < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static bool
+cork_roaring_container_contains(const struct cork_roaring_container *c,
+                                uint16_t low)
+{
+    switch (c->type) {
+        case CORK_ROARING_ARRAY:
+        {
+            const uint16_t  *values = c->data;
+            uint32_t  i =
+                cork_roaring_array_lower_bound(values, c->size, low);
+            return i < c->size && values[i] == low;
+        }
+
+        case CORK_ROARING_BITMAP:
+        {
+            const uint64_t  *words = c->data;
+            return (words[low >> 6] >> (low & 63)) & 1;
+        }
+
+        case CORK_ROARING_RUN:
+        {
+            const struct cork_roaring_run  *runs = c->data;
+            uint32_t  i = cork_roaring_run_lower_bound(runs, c->size, low);
+            return i < c->size && runs[i].start <= low;
+        }
+
+        default:
+            return false;
+    }
+}
+
+/* Find the first value in a bitmap that's at least from.  Returns
+ * CORK_ROARING_CHUNK_SIZE if there isn't one.  If invert is true, we look for
+ * the first value that's *not* in the bitmap. */
+static uint32_t
+cork_roaring_bitmap_words_find_next(const uint64_t *words, uint32_t from,
+                                    bool invert)
+{
+    uint64_t  flip = invert? CORK_ROARING_ALL_ONES: 0;
+    uint32_t  i = from >> 6;
+    uint64_t  word;
+    if (from >= CORK_ROARING_CHUNK_SIZE) {
+        return CORK_ROARING_CHUNK_SIZE;
+    }
+    word = (words[i] ^ flip) & (CORK_ROARING_ALL_ONES << (from & 63));
+    while (word == 0) {
+        if (++i == CORK_ROARING_BITMAP_WORDS) {
+            return CORK_ROARING_CHUNK_SIZE;
+        }
+        word = words[i] ^ flip;
+    }
+    return (i << 6) + __builtin_ctzll(word);
+}
+
+static bool
+cork_roaring_container_find_next(const struct cork_roaring_container *c,
+                                 uint32_t from, uint16_t *dest)
+{
+    switch (c->type) {
+        case CORK_ROARING_ARRAY:
+        {
+            const uint16_t  *values = c->data;
+            uint32_t  i =
+                cork_roaring_array_lower_bound(values, c->size, from);
+            if (i < c->size) {
+                *dest = values[i];
+                return true;
+            }
+            return false;
+        }
+
+        case CORK_ROARING_BITMAP:
+        {
+            uint32_t  result =
+                cork_roaring_bitmap_words_find_next(c->data, from, false);
+            if (result < CORK_ROARING_CHUNK_SIZE) {
+                *dest = result;
+                return true;
+            }
+            return false;
+        }
+
+        case CORK_ROARING_RUN:
+        {
+            const struct cork_roaring_run  *runs = c->data;
+            uint32_t  i = cork_roaring_run_lower_bound(runs, c->size, from);
+            if (i < c->size) {
+                *dest = (runs[i].start > from)? runs[i].start: from;
+                return true;
+            }
+            return false;
+        }
+
+        default:
+            return false;
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Converting between container types
+ */
+
+/* Set the bits from start to end, inclusive. */
+static void
+cork_roaring_bitmap_words_set_range(uint64_t *words,
+                                    uint32_t start, uint32_t end)
+{
+    uint32_t  first = start >> 6;
+    uint32_t  last = end >> 6;
+    uint64_t  first_mask = CORK_ROARING_ALL_ONES << (start & 63);
+    uint64_t  last_mask = CORK_ROARING_ALL_ONES >> (63 - (end & 63));
+    uint32_t  i;
+    if (first == last) {
+        words[first] |= first_mask & last_mask;
+        return;
+    }
+    words[first] |= first_mask;
+    for (i = first + 1; i < last; i++) {
+        words[i] = CORK_ROARING_ALL_ONES;
+    }
+    words[last] |= last_mask;
+}
+
+static void
+cork_roaring_container_fill_words(const struct cork_roaring_container *c,
+                                  uint64_t *words)
+{
+    uint32_t  i;
+    switch (c->type) {
+        case CORK_ROARING_ARRAY:
+        {
+            const uint16_t  *values = c->data;
+            for (i = 0; i < c->size; i++) {
+                words[values[i] >> 6] |= UINT64_C(1) << (values[i] & 63);
+            }
+            break;
+        }
+
+        case CORK_ROARING_BITMAP:
+        {
+            const uint64_t  *src = c->data;
+            for (i = 0; i < CORK_ROARING_BITMAP_WORDS; i++) {
+                words[i] |= src[i];
+            }
+            break;
+        }
+
+        case CORK_ROARING_RUN:
+        {
+            const struct cork_roaring_run  *runs = c->data;
+            for (i = 0; i < c->size; i++) {
+                cork_roaring_bitmap_words_set_range
+                    (words, runs[i].start,
+                     (uint32_t) runs[i].start + runs[i].length);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+static void
+cork_roaring_container_to_bitmap(struct cork_roaring_container *c)
+{
+    uint64_t  *words =
+        cork_calloc(CORK_ROARING_BITMAP_WORDS, sizeof(uint64_t));
+    cork_roaring_container_fill_words(c, words);
+    cork_roaring_container_replace
+        (c, CORK_ROARING_BITMAP, words, 0, CORK_ROARING_BITMAP_WORDS,
+         c->cardinality);
+}
+
+static void
+cork_roaring_container_to_array(struct cork_roaring_container *c)
+{
+    uint32_t  capacity = (c->cardinality == 0)? 1: c->cardinality;
+    uint16_t  *values;
+    uint32_t  size = 0;
+    uint32_t  i;
+
+    assert(c->cardinality <= CORK_ROARING_ARRAY_MAX);
+    values = cork_malloc(capacity * sizeof(uint16_t));
+    switch (c->type) {
+        case CORK_ROARING_ARRAY:
+            memcpy(values, c->data, c->size * sizeof(uint16_t));
+            size = c->size;
+            break;
+
+        case CORK_ROARING_BITMAP:
+        {
+            const uint64_t  *words = c->data;
+            for (i = 0; i < CORK_ROARING_BITMAP_WORDS; i++) {
+                uint64_t  word = words[i];
+                while (word != 0) {
+                    values[size++] = (i << 6) + __builtin_ctzll(word);
+                    word &= word - 1;
+                }
+            }
+            break;
+        }
+
+        case CORK_ROARING_RUN:
+        {
+            const struct cork_roaring_run  *runs = c->data;
+            for (i = 0; i < c->size; i++) {
+                uint32_t  value = runs[i].start;
+                uint32_t  end = value + runs[i].length;
+                for (; value <= end; value++) {
+                    values[size++] = value;
+                }
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+    cork_roaring_container_replace
+        (c, CORK_ROARING_ARRAY, values, size, capacity, size);
+}
+
+/* Pick the right representation for a bitmap container whose cardinality has
+ * just changed. */
+static void
+cork_roaring_container_normalize(struct cork_roaring_container *c)
+{
+    if (c->type == CORK_ROARING_BITMAP &&
+        c->cardinality <= CORK_ROARING_ARRAY_MAX) {
+        cork_roaring_container_to_array(c);
+    }
+}
+
+/* Make sure that a container is an array or a bitmap, and that we own its
+ * data, so that we can modify it. */
+static void
+cork_roaring_container_make_mutable(struct cork_roaring_container *c)
+{
+    if (c->type == CORK_ROARING_RUN || !c->owned) {
+        if (c->cardinality <= CORK_ROARING_ARRAY_MAX) {
+            cork_roaring_container_to_array(c);
+        } else {
+            cork_roaring_container_to_bitmap(c);
+        }
+    }
+}
+
+static uint32_t
+cork_roaring_container_run_count(const struct cork_roaring_container *c)
+{
+    uint32_t  runs = 0;
+    uint32_t  i;
+    switch (c->type) {
+        case CORK_ROARING_ARRAY:
+        {
+            const uint16_t  *values = c->data;
+            for (i = 0; i < c->size; i++) {
+                if (i == 0 || values[i] != values[i - 1] + 1) {
+                    runs++;
+                }
+            }
+            return runs;
+        }
+
+        case CORK_ROARING_BITMAP:
+        {
+            /* A run starts at each set bit whose predecessor isn't set. */
+            const uint64_t  *words = c->data;
+            uint64_t  carry = 0;
+            for (i = 0; i < CORK_ROARING_BITMAP_WORDS; i++) {
+                uint64_t  word = words[i];
+                runs += __builtin_popcountll(word & ~((word << 1) | carry));
+                carry = word >> 63;
+            }
+            return runs;
+        }
+
+        case CORK_ROARING_RUN:
+            return c->size;
+
+        default:
+            return 0;
+    }
+}
+
+static void
+cork_roaring_container_to_run(struct cork_roaring_container *c,
+                              uint32_t run_count)
+{
+    struct cork_roaring_run  *runs =
+        cork_malloc(run_count * sizeof(struct cork_roaring_run));
+    uint32_t  size = 0;
+    uint32_t  i;
+
+    if (c->type == CORK_ROARING_ARRAY) {
+        const uint16_t  *values = c->data;
+        for (i = 0; i < c->size; i++) {
+            if (i == 0 || values[i] != values[i - 1] + 1) {
+                runs[size].start = values[i];
+                runs[size].length = 0;
+                size++;
+            } else {
+                runs[size - 1].length++;
+            }
+        }
+    } else {
+        const uint64_t  *words = c->data;
+        uint32_t  start =
+            cork_roaring_bitmap_words_find_next(words, 0, false);
+        while (start < CORK_ROARING_CHUNK_SIZE) {
+            uint32_t  end =
+                cork_roaring_bitmap_words_find_next(words, start, true);
+            runs[size].start = start;
+            runs[size].length = end - start - 1;
+            size++;
+            start = cork_roaring_bitmap_words_find_next(words, end, false);
+        }
+    }
+    assert(size == run_count);
+    cork_roaring_container_replace
+        (c, CORK_ROARING_RUN, runs, size, size, c->cardinality);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Modifying containers
+ */
+
+/* The caller must make the container mutable first. */
+static void
+cork_roaring_container_add(struct cork_roaring_container *c, uint16_t low)
+{
+    if (c->type == CORK_ROARING_ARRAY &&
+        c->size == CORK_ROARING_ARRAY_MAX) {
+        cork_roaring_container_to_bitmap(c);
+    }
+
+    if (c->type == CORK_ROARING_ARRAY) {
+        uint16_t  *values = c->data;
+        uint32_t  i = cork_roaring_array_lower_bound(values, c->size, low);
+        if (c->size == c->capacity) {
+            uint32_t  new_capacity = (c->capacity < 4)? 4: c->capacity * 2;
+            if (new_capacity > CORK_ROARING_ARRAY_MAX) {
+                new_capacity = CORK_ROARING_ARRAY_MAX;
+            }
+            if (values == NULL) {
+                values = cork_malloc(new_capacity * sizeof(uint16_t));
+            } else {
+                values = cork_realloc
+                    (values, c->capacity * sizeof(uint16_t),
+                     new_capacity * sizeof(uint16_t));
+            }
+            c->data = values;
+            c->capacity = new_capacity;
+        }
+        memmove(&values[i + 1], &values[i],
+                (c->size - i) * sizeof(uint16_t));
+        values[i] = low;
+        c->size++;
+    } else {
+        uint64_t  *words = c->data;
+        words[low >> 6] |= UINT64_C(1) << (low & 63);
+    }
+    c->cardinality++;
+}
+
+/* The caller must make the container mutable first. */
+static void
+cork_roaring_container_remove(struct cork_roaring_container *c, uint16_t low)
+{
+    if (c->type == CORK_ROARING_ARRAY) {
+        uint16_t  *values = c->data;
+        uint32_t  i = cork_roaring_array_lower_bound(values, c->size, low);
+        memmove(&values[i], &values[i + 1],
+                (c->size - i - 1) * sizeof(uint16_t));
+        c->size--;
+        c->cardinality--;
+    } else {
+        uint64_t  *words = c->data;
+        words[low >> 6] &= ~(UINT64_C(1) << (low & 63));
+        c->cardinality--;
+        cork_roaring_container_normalize(c);
+    }
+}
+
+static void
+cork_roaring_container_or(struct cork_roaring_container *dest,
+                          const struct cork_roaring_container *src)
+{
+    cork_roaring_container_make_mutable(dest);
+
+    if (dest->type == CORK_ROARING_ARRAY && src->type == CORK_ROARING_ARRAY &&
+        dest->size + src->size <= CORK_ROARING_ARRAY_MAX) {
+        const uint16_t  *d = dest->data;
+        const uint16_t  *s = src->data;
+        uint32_t  capacity = dest->size + src->size;
+        uint16_t  *values = cork_malloc(capacity * sizeof(uint16_t));
+        uint32_t  i = 0;
+        uint32_t  j = 0;
+        uint32_t  size = 0;
+        while (i < dest->size && j < src->size) {
+            if (d[i] < s[j]) {
+                values[size++] = d[i++];
+            } else if (s[j] < d[i]) {
+                values[size++] = s[j++];
+            } else {
+                values[size++] = d[i++];
+                j++;
+            }
+        }
+        while (i < dest->size) {
+            values[size++] = d[i++];
+        }
+        while (j < src->size) {
+            values[size++] = s[j++];
+        }
+        cork_roaring_container_replace
+            (dest, CORK_ROARING_ARRAY, values, size, capacity, size);
+        return;
+    }
+
+    if (dest->type == CORK_ROARING_ARRAY) {
+        cork_roaring_container_to_bitmap(dest);
+    }
+    cork_roaring_container_fill_words(src, dest->data);
+    dest->cardinality = cork_roaring_bitmap_word_count(dest->data);
+    cork_roaring_container_normalize(dest);
+}
+
+static void
+cork_roaring_container_and(struct cork_roaring_container *dest,
+                           const struct cork_roaring_container *src)
+{
+    cork_roaring_container_make_mutable(dest);
+
+    if (dest->type == CORK_ROARING_ARRAY) {
+        uint16_t  *values = dest->data;
+        uint32_t  size = 0;
+        uint32_t  i;
+        for (i = 0; i < dest->size; i++) {
+            if (cork_roaring_container_contains(src, values[i])) {
+                values[size++] = values[i];
+            }
+        }
+        dest->size = size;
+        dest->cardinality = size;
+    } else if (src->type == CORK_ROARING_ARRAY) {
+        const uint16_t  *s = src->data;
+        uint32_t  capacity = (src->size == 0)? 1: src->size;
+        uint16_t  *values = cork_malloc(capacity * sizeof(uint16_t));
+        uint32_t  size = 0;
+        uint32_t  i;
+        for (i = 0; i < src->size; i++) {
+            if (cork_roaring_container_contains(dest, s[i])) {
+                values[size++] = s[i];
+            }
+        }
+        cork_roaring_container_replace
+            (dest, CORK_ROARING_ARRAY, values, size, capacity, size);
+    } else {
+        uint64_t  *words = dest->data;
+        uint64_t  *mask = cork_calloc(CORK_ROARING_BITMAP_WORDS,
+                                      sizeof(uint64_t));
+        uint32_t  i;
+        cork_roaring_container_fill_words(src, mask);
+        for (i = 0; i < CORK_ROARING_BITMAP_WORDS; i++) {
+            words[i] &= mask[i];
+        }
+        cork_cfree(mask, CORK_ROARING_BITMAP_WORDS, sizeof(uint64_t));
+        dest->cardinality = cork_roaring_bitmap_word_count(words);
+        cork_roaring_container_normalize(dest);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Bitmaps
+ */
+
+struct cork_roaring_bitmap *
+cork_roaring_bitmap_new(void)
+{
+    struct cork_roaring_bitmap  *bitmap = cork_new(struct cork_roaring_bitmap);
+    bitmap->containers = NULL;
+    bitmap->count = 0;
+    bitmap->allocated = 0;
+    cork_slice_clear(&bitmap->backing);
+    return bitmap;
+}
+
+void
+cork_roaring_bitmap_clear(struct cork_roaring_bitmap *bitmap)
+{
+    size_t  i;
+    for (i = 0; i < bitmap->count; i++) {
+        cork_roaring_container_done(&bitmap->containers[i]);
+    }
+    bitmap->count = 0;
+    if (!cork_slice_is_empty(&bitmap->backing)) {
+        cork_slice_finish(&bitmap->backing);
+        cork_slice_clear(&bitmap->backing);
+    }
+}
+
+void
+cork_roaring_bitmap_free(struct cork_roaring_bitmap *bitmap)
+{
+    cork_roaring_bitmap_clear(bitmap);
+    if (bitmap->containers != NULL) {
+        cork_cfree(bitmap->containers, bitmap->allocated,
+                   sizeof(struct cork_roaring_container));
+    }
+    cork_delete(struct cork_roaring_bitmap, bitmap);
+}
+
+/* Returns the index of the first container whose key is at least key. */
+static size_t
+cork_roaring_bitmap_find(const struct cork_roaring_bitmap *bitmap,
+                         uint16_t key, bool *found)
+{
+    size_t  lo = 0;
+    size_t  hi = bitmap->count;
+    while (lo < hi) {
+        size_t  mid = lo + (hi - lo) / 2;
+        if (bitmap->containers[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = (lo < bitmap->count && bitmap->containers[lo].key == key);
+    return lo;
+}
+
+static void
+cork_roaring_bitmap_reserve(struct cork_roaring_bitmap *bitmap, size_t count)
+{
+    if (count > bitmap->allocated) {
+        size_t  new_allocated = (bitmap->allocated < 4)? 4: bitmap->allocated;
+        while (new_allocated < count) {
+            new_allocated *= 2;
+        }
+        if (bitmap->containers == NULL) {
+            bitmap->containers = cork_calloc
+                (new_allocated, sizeof(struct cork_roaring_container));
+        } else {
+            bitmap->containers = cork_realloc
+                (bitmap->containers,
+                 bitmap->allocated * sizeof(struct cork_roaring_container),
+                 new_allocated * sizeof(struct cork_roaring_container));
+        }
+        bitmap->allocated = new_allocated;
+    }
+}
+
+/* Insert an empty array container. */
+static struct cork_roaring_container *
+cork_roaring_bitmap_insert(struct cork_roaring_bitmap *bitmap, size_t index,
+                           uint16_t key)
+{
+    struct cork_roaring_container  *c;
+    cork_roaring_bitmap_reserve(bitmap, bitmap->count + 1);
+    memmove(&bitmap->containers[index + 1], &bitmap->containers[index],
+            (bitmap->count - index) * sizeof(struct cork_roaring_container));
+    bitmap->count++;
+    c = &bitmap->containers[index];
+    c->key = key;
+    c->type = CORK_ROARING_ARRAY;
+    c->owned = true;
+    c->cardinality = 0;
+    c->size = 0;
+    c->capacity = 0;
+    c->data = NULL;
+    return c;
+}
+
+static void
+cork_roaring_bitmap_remove_container(struct cork_roaring_bitmap *bitmap,
+                                     size_t index)
+{
+    cork_roaring_container_done(&bitmap->containers[index]);
+    memmove(&bitmap->containers[index], &bitmap->containers[index + 1],
+            (bitmap->count - index - 1) *
+            sizeof(struct cork_roaring_container));
+    bitmap->count--;
+}
+
+bool
+cork_roaring_bitmap_add(struct cork_roaring_bitmap *bitmap, uint32_t value)
+{
+    uint16_t  key = value >> 16;
+    uint16_t  low = value & 0xffff;
+    bool  found;
+    size_t  index = cork_roaring_bitmap_find(bitmap, key, &found);
+    struct cork_roaring_container  *c;
+    if (found) {
+        c = &bitmap->containers[index];
+        if (cork_roaring_container_contains(c, low)) {
+            return false;
+        }
+        cork_roaring_container_make_mutable(c);
+    } else {
+        c = cork_roaring_bitmap_insert(bitmap, index, key);
+    }
+    cork_roaring_container_add(c, low);
+    return true;
+}
+
+bool
+cork_roaring_bitmap_remove(struct cork_roaring_bitmap *bitmap, uint32_t value)
+{
+    uint16_t  key = value >> 16;
+    uint16_t  low = value & 0xffff;
+    bool  found;
+    size_t  index = cork_roaring_bitmap_find(bitmap, key, &found);
+    struct cork_roaring_container  *c;
+    if (!found) {
+        return false;
+    }
+    c = &bitmap->containers[index];
+    if (!cork_roaring_container_contains(c, low)) {
+        return false;
+    }
+    cork_roaring_container_make_mutable(c);
+    cork_roaring_container_remove(c, low);
+    if (c->cardinality == 0) {
+        cork_roaring_bitmap_remove_container(bitmap, index);
+    }
+    return true;
+}
+
+void
+cork_roaring_bitmap_add_range(struct cork_roaring_bitmap *bitmap,
+                              uint64_t start, uint64_t end)
+{
+    uint32_t  key;
+    uint32_t  first_key;
+    uint32_t  last_key;
+
+    assert(end <= (UINT64_C(1) << 32));
+    if (start >= end) {
+        return;
+    }
+
+    first_key = start >> 16;
+    last_key = (end - 1) >> 16;
+    for (key = first_key; key <= last_key; key++) {
+        uint32_t  lo = (key == first_key)? (start & 0xffff): 0;
+        uint32_t  hi = (key == last_key)? ((end - 1) & 0xffff): 0xffff;
+        bool  found;
+        size_t  index = cork_roaring_bitmap_find(bitmap, key, &found);
+        struct cork_roaring_container  *c;
+
+        if (!found) {
+            struct cork_roaring_run  *run =
+                cork_new(struct cork_roaring_run);
+            c = cork_roaring_bitmap_insert(bitmap, index, key);
+            run->start = lo;
+            run->length = hi - lo;
+            cork_roaring_container_replace
+                (c, CORK_ROARING_RUN, run, 1, 1, hi - lo + 1);
+        } else {
+            c = &bitmap->containers[index];
+            cork_roaring_container_make_mutable(c);
+            if (c->type == CORK_ROARING_ARRAY) {
+                cork_roaring_container_to_bitmap(c);
+            }
+            cork_roaring_bitmap_words_set_range(c->data, lo, hi);
+            c->cardinality = cork_roaring_bitmap_word_count(c->data);
+            cork_roaring_container_normalize(c);
+        }
+    }
+}
+
+bool
+cork_roaring_bitmap_contains(const struct cork_roaring_bitmap *bitmap,
+                             uint32_t value)
+{
+    bool  found;
+    size_t  index = cork_roaring_bitmap_find(bitmap, value >> 16, &found);
+    return found && cork_roaring_container_contains
+        (&bitmap->containers[index], value & 0xffff);
+}
+
+uint64_t
+cork_roaring_bitmap_count(const struct cork_roaring_bitmap *bitmap)
+{
+    uint64_t  count = 0;
+    size_t  i;
+    for (i = 0; i < bitmap->count; i++) {
+        count += bitmap->containers[i].cardinality;
+    }
+    return count;
+}
+
+bool
+cork_roaring_bitmap_find_next(const struct cork_roaring_bitmap *bitmap,
+                              uint64_t start, uint32_t *dest)
+{
+    uint32_t  key;
+    bool  found;
+    size_t  i;
+
+    if (start > UINT32_MAX) {
+        return false;
+    }
+    key = start >> 16;
+    for (i = cork_roaring_bitmap_find(bitmap, key, &found);
+         i < bitmap->count; i++) {
+        const struct cork_roaring_container  *c = &bitmap->containers[i];
+        uint32_t  from = (c->key == key)? (start & 0xffff): 0;
+        uint16_t  low;
+        if (cork_roaring_container_find_next(c, from, &low)) {
+            *dest = ((uint32_t) c->key << 16) | low;
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+cork_roaring_bitmap_or(struct cork_roaring_bitmap *dest,
+                       const struct cork_roaring_bitmap *src)
+{
+    size_t  i;
+    for (i = 0; i < src->count; i++) {
+        const struct cork_roaring_container  *s = &src->containers[i];
+        bool  found;
+        size_t  index = cork_roaring_bitmap_find(dest, s->key, &found);
+        if (found) {
+            cork_roaring_container_or(&dest->containers[index], s);
+        } else {
+            struct cork_roaring_container  *c =
+                cork_roaring_bitmap_insert(dest, index, s->key);
+            cork_roaring_container_copy(c, s);
+        }
+    }
+}
+
+void
+cork_roaring_bitmap_and(struct cork_roaring_bitmap *dest,
+                        const struct cork_roaring_bitmap *src)
+{
+    size_t  i = 0;
+    while (i < dest->count) {
+        struct cork_roaring_container  *c = &dest->containers[i];
+        bool  found;
+        size_t  index = cork_roaring_bitmap_find(src, c->key, &found);
+        if (found) {
+            cork_roaring_container_and(c, &src->containers[index]);
+        }
+        if (!found || c->cardinality == 0) {
+            cork_roaring_bitmap_remove_container(dest, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+void
+cork_roaring_bitmap_run_optimize(struct cork_roaring_bitmap *bitmap)
+{
+    size_t  i;
+    for (i = 0; i < bitmap->count; i++) {
+        struct cork_roaring_container  *c = &bitmap->containers[i];
+        uint32_t  run_count = cork_roaring_container_run_count(c);
+        size_t  run_size =
+            cork_roaring_data_size(CORK_ROARING_RUN, run_count);
+        size_t  other_size = (c->cardinality <= CORK_ROARING_ARRAY_MAX)?
+            cork_roaring_data_size(CORK_ROARING_ARRAY, c->cardinality):
+            cork_roaring_data_size(CORK_ROARING_BITMAP, 0);
+        if (c->type == CORK_ROARING_RUN) {
+            if (run_size > other_size) {
+                cork_roaring_container_make_mutable(c);
+            }
+        } else if (run_size < other_size) {
+            cork_roaring_container_to_run(c, run_count);
+        }
+    }
+}
+
+size_t
+cork_roaring_bitmap_memory_size(const struct cork_roaring_bitmap *bitmap)
+{
+    size_t  size = bitmap->allocated * sizeof(struct cork_roaring_container);
+    size_t  i;
+    for (i = 0; i < bitmap->count; i++) {
+        const struct cork_roaring_container  *c = &bitmap->containers[i];
+        size += cork_roaring_data_size(c->type, c->capacity);
+    }
+    return size;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Serialization
+ */
+
+#define CORK_ROARING_MAGIC  0x31425243  /* "CRB1" */
+#define CORK_ROARING_HEADER_SIZE  8
+#define CORK_ROARING_DESCRIPTOR_SIZE  8
+
+#define cork_roaring_pad(size)  (((size) + 7) & ~((size_t) 7))
+
+/* The number of values or runs that a container stores, or its cardinality
+ * for a bitmap container */
+#define cork_roaring_container_serialized_count(c) \
+    (((c)->type == CORK_ROARING_BITMAP)? (c)->cardinality: (c)->size)
+
+size_t
+cork_roaring_bitmap_serialized_size(const struct cork_roaring_bitmap *bitmap)
+{
+    size_t  size = CORK_ROARING_HEADER_SIZE +
+        bitmap->count * CORK_ROARING_DESCRIPTOR_SIZE;
+    size_t  i;
+    for (i = 0; i < bitmap->count; i++) {
+        const struct cork_roaring_container  *c = &bitmap->containers[i];
+        size += cork_roaring_pad(cork_roaring_data_size(c->type, c->size));
+    }
+    return size;
+}
+
+static void
+cork_roaring_append_u16(struct cork_buffer *dest, uint16_t value)
+{
+    value = CORK_UINT16_HOST_TO_LITTLE(value);
+    cork_buffer_append(dest, &value, sizeof(value));
+}
+
+static void
+cork_roaring_append_u32(struct cork_buffer *dest, uint32_t value)
+{
+    value = CORK_UINT32_HOST_TO_LITTLE(value);
+    cork_buffer_append(dest, &value, sizeof(value));
+}
+
+static void
+cork_roaring_append_data(struct cork_buffer *dest,
+                         const struct cork_roaring_container *c)
+{
+    static const uint8_t  zeroes[8] = { 0 };
+    size_t  data_size = cork_roaring_data_size(c->type, c->size);
+#if CORK_HOST_ENDIANNESS == CORK_LITTLE_ENDIAN
+    cork_buffer_append(dest, c->data, data_size);
+#else
+    uint32_t  i;
+    switch (c->type) {
+        case CORK_ROARING_ARRAY:
+        {
+            const uint16_t  *values = c->data;
+            for (i = 0; i < c->size; i++) {
+                cork_roaring_append_u16(dest, values[i]);
+            }
+            break;
+        }
+
+        case CORK_ROARING_BITMAP:
+        {
+            const uint64_t  *words = c->data;
+            for (i = 0; i < CORK_ROARING_BITMAP_WORDS; i++) {
+                uint64_t  word = CORK_UINT64_HOST_TO_LITTLE(words[i]);
+                cork_buffer_append(dest, &word, sizeof(word));
+            }
+            break;
+        }
+
+        case CORK_ROARING_RUN:
+        {
+            const struct cork_roaring_run  *runs = c->data;
+            for (i = 0; i < c->size; i++) {
+                cork_roaring_append_u16(dest, runs[i].start);
+                cork_roaring_append_u16(dest, runs[i].length);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+#endif
+    cork_buffer_append(dest, zeroes, cork_roaring_pad(data_size) - data_size);
+}
+
+void
+cork_roaring_bitmap_serialize(const struct cork_roaring_bitmap *bitmap,
+                              struct cork_buffer *dest)
+{
+    size_t  i;
+    cork_buffer_ensure_size
+        (dest, dest->size + cork_roaring_bitmap_serialized_size(bitmap) + 1);
+    cork_roaring_append_u32(dest, CORK_ROARING_MAGIC);
+    cork_roaring_append_u32(dest, bitmap->count);
+    for (i = 0; i < bitmap->count; i++) {
+        const struct cork_roaring_container  *c = &bitmap->containers[i];
+        uint8_t  type_and_reserved[2];
+        type_and_reserved[0] = c->type;
+        type_and_reserved[1] = 0;
+        cork_roaring_append_u16(dest, c->key);
+        cork_buffer_append(dest, type_and_reserved, 2);
+        cork_roaring_append_u32
+            (dest, cork_roaring_container_serialized_count(c));
+    }
+    for (i = 0; i < bitmap->count; i++) {
+        cork_roaring_append_data(dest, &bitmap->containers[i]);
+    }
+}
+
+static uint16_t
+cork_roaring_read_u16(const uint8_t *src)
+{
+    uint16_t  value;
+    memcpy(&value, src, sizeof(value));
+    return CORK_UINT16_LITTLE_TO_HOST(value);
+}
+
+static uint32_t
+cork_roaring_read_u32(const uint8_t *src)
+{
+    uint32_t  value;
+    memcpy(&value, src, sizeof(value));
+    return CORK_UINT32_LITTLE_TO_HOST(value);
+}
+
+/* Fill in a container's data from its serialized form, either by pointing at
+ * it directly, or by making a copy in host byte order. */
+static void
+cork_roaring_container_load(struct cork_roaring_container *c,
+                            const uint8_t *src, bool zero_copy)
+{
+    size_t  data_size = cork_roaring_data_size(c->type, c->size);
+    if (zero_copy) {
+        c->owned = false;
+        c->data = (void *) src;
+        c->capacity = c->size;
+    } else {
+        uint32_t  capacity = (c->type == CORK_ROARING_BITMAP)?
+            CORK_ROARING_BITMAP_WORDS: c->size;
+        uint32_t  i;
+        c->owned = true;
+        c->data = cork_malloc(data_size);
+        c->capacity = capacity;
+        switch (c->type) {
+            case CORK_ROARING_ARRAY:
+            case CORK_ROARING_RUN:
+            {
+                uint16_t  *values = c->data;
+                for (i = 0; i < data_size / sizeof(uint16_t); i++) {
+                    values[i] = cork_roaring_read_u16(src + 2 * i);
+                }
+                break;
+            }
+
+            case CORK_ROARING_BITMAP:
+            {
+                uint64_t  *words = c->data;
+                for (i = 0; i < CORK_ROARING_BITMAP_WORDS; i++) {
+                    uint64_t  word;
+                    memcpy(&word, src + 8 * i, sizeof(word));
+                    words[i] = CORK_UINT64_LITTLE_TO_HOST(word);
+                }
+                break;
+            }
+
+            default:
+                break;
+        }
+    }
+}
+
+/* Make sure that a container's contents are consistent with its descriptor,
+ * so that our other functions can trust them, and fill in its cardinality. */
+static int
+cork_roaring_container_check(struct cork_roaring_container *c)
+{
+    uint32_t  i;
+    switch (c->type) {
+        case CORK_ROARING_ARRAY:
+        {
+            const uint16_t  *values = c->data;
+            for (i = 1; i < c->size; i++) {
+                if (values[i] <= values[i - 1]) {
+                    cork_parse_error("Unsorted roaring bitmap array container");
+                    return -1;
+                }
+            }
+            c->cardinality = c->size;
+            return 0;
+        }
+
+        case CORK_ROARING_BITMAP:
+            if (cork_roaring_bitmap_word_count(c->data) != c->cardinality) {
+                cork_parse_error
+                    ("Roaring bitmap container has the wrong cardinality");
+                return -1;
+            }
+            return 0;
+
+        case CORK_ROARING_RUN:
+        {
+            const struct cork_roaring_run  *runs = c->data;
+            uint32_t  next = 0;
+            c->cardinality = 0;
+            for (i = 0; i < c->size; i++) {
+                uint32_t  end = (uint32_t) runs[i].start + runs[i].length;
+                if (runs[i].start < next || end >= CORK_ROARING_CHUNK_SIZE) {
+                    cork_parse_error("Invalid roaring bitmap run container");
+                    return -1;
+                }
+                c->cardinality += runs[i].length + 1;
+                next = end + 2;
+            }
+            return 0;
+        }
+
+        default:
+            return -1;
+    }
+}
+
+struct cork_roaring_bitmap *
+cork_roaring_bitmap_deserialize(const struct cork_slice *src)
+{
+    const uint8_t  *buf = src->buf;
+    size_t  size = src->size;
+    size_t  offset;
+    uint32_t  count;
+    uint32_t  i;
+    bool  zero_copy;
+    struct cork_roaring_bitmap  *bitmap;
+
+    if (size < CORK_ROARING_HEADER_SIZE ||
+        cork_roaring_read_u32(buf) != CORK_ROARING_MAGIC) {
+        cork_parse_error("Invalid roaring bitmap header");
+        return NULL;
+    }
+    count = cork_roaring_read_u32(buf + 4);
+    if (count > CORK_ROARING_CHUNK_SIZE ||
+        (size - CORK_ROARING_HEADER_SIZE) / CORK_ROARING_DESCRIPTOR_SIZE <
+        count) {
+        cork_parse_error("Roaring bitmap is truncated");
+        return NULL;
+    }
+
+    bitmap = cork_roaring_bitmap_new();
+    cork_roaring_bitmap_reserve(bitmap, count);
+
+    /* Some slices (like copy-once slices) move their content when you copy
+     * them, so we have to point our containers at our own copy. */
+    zero_copy = false;
+    if (CORK_HOST_ENDIANNESS == CORK_LITTLE_ENDIAN && count > 0) {
+        if (cork_slice_copy(&bitmap->backing, src, 0, size) != 0) {
+            goto error;
+        }
+        buf = bitmap->backing.buf;
+        zero_copy = ((uintptr_t) buf % sizeof(uint64_t)) == 0;
+        if (!zero_copy) {
+            buf = src->buf;
+            cork_slice_finish(&bitmap->backing);
+            cork_slice_clear(&bitmap->backing);
+        }
+    }
+    offset = CORK_ROARING_HEADER_SIZE + count * CORK_ROARING_DESCRIPTOR_SIZE;
+
+    for (i = 0; i < count; i++) {
+        const uint8_t  *descriptor =
+            buf + CORK_ROARING_HEADER_SIZE + i * CORK_ROARING_DESCRIPTOR_SIZE;
+        struct cork_roaring_container  *c = &bitmap->containers[i];
+        uint32_t  serialized_count = cork_roaring_read_u32(descriptor + 4);
+        size_t  data_size;
+
+        c->key = cork_roaring_read_u16(descriptor);
+        c->type = descriptor[2];
+        c->data = NULL;
+        if (i > 0 && c->key <= bitmap->containers[i - 1].key) {
+            cork_parse_error("Roaring bitmap containers are out of order");
+            goto error;
+        }
+        switch (c->type) {
+            case CORK_ROARING_ARRAY:
+                if (serialized_count == 0 ||
+                    serialized_count > CORK_ROARING_ARRAY_MAX) {
+                    goto invalid_count;
+                }
+                c->size = serialized_count;
+                break;
+
+            case CORK_ROARING_BITMAP:
+                if (serialized_count <= CORK_ROARING_ARRAY_MAX ||
+                    serialized_count > CORK_ROARING_CHUNK_SIZE) {
+                    goto invalid_count;
+                }
+                c->size = 0;
+                c->cardinality = serialized_count;
+                break;
+
+            case CORK_ROARING_RUN:
+                if (serialized_count == 0 ||
+                    serialized_count > CORK_ROARING_CHUNK_SIZE / 2) {
+                    goto invalid_count;
+                }
+                c->size = serialized_count;
+                break;
+
+            default:
+                cork_parse_error("Unknown roaring bitmap container type %u",
+                                 (unsigned int) c->type);
+                goto error;
+        }
+
+        data_size = cork_roaring_data_size(c->type, c->size);
+        if (size - offset < data_size) {
+            cork_parse_error("Roaring bitmap is truncated");
+            goto error;
+        }
+        cork_roaring_container_load(c, buf + offset, zero_copy);
+        /* Count the container now, so that we free it if it's invalid. */
+        bitmap->count++;
+        if (cork_roaring_container_check(c) != 0) {
+            goto error;
+        }
+        offset += cork_roaring_pad(data_size);
+        if (offset > size) {
+            offset = size;
+        }
+    }
+
+    return bitmap;
+
+invalid_count:
+    cork_parse_error("Invalid roaring bitmap container size");
+error:
+    cork_roaring_bitmap_free(bitmap);
+    return NULL;
+}
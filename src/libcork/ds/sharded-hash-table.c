@@ -0,0 +1,407 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/attributes.h"
+#include "libcork/core/callbacks.h"
+#include "libcork/core/hash.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/hash-table.h"
+#include "libcork/ds/sharded-hash-table.h"
+#include "libcork/threads/locks.h"
+
+
+/*-----------------------------------------------------------------------
+ * Sharded hash tables
+ */
+
+/* Each shard gets its own cache line, so that threads working on different
+ * shards don't fight over their locks. */
+struct cork_sharded_hash_table_shard {
+    struct cork_mutex  lock;
+    struct cork_hash_table  *table;
+    CORK_CACHELINE_PAD(pad, sizeof(struct cork_mutex) +
+                            sizeof(struct cork_hash_table *));
+};
+
+struct cork_sharded_hash_table {
+    struct cork_sharded_hash_table_shard  *shards;
+    size_t  shard_count;
+    /* log2 of shard_count */
+    unsigned int  shard_bits;
+    void  *user_data;
+    cork_free_f  free_user_data;
+    cork_hash_f  hash;
+    /* If this isn't NULL, it overrides `hash`. */
+    cork_hash64_f  hash64;
+};
+
+/* The default hash function spreads out pointer keys, since the shard is
+ * chosen by the hash's high bits. */
+static cork_hash
+cork_sharded_hash_table__default_hash(void *user_data, const void *key)
+{
+    return cork_fast_hash_u64(0, (uint64_t) (uintptr_t) key);
+}
+
+/* Like cork_hash_table, we widen a 32-bit hash by duplicating it, so that the
+ * high bits (which choose the shard) and the low bits (which choose the bin
+ * within the shard) both come from the original hash. */
+static inline cork_hash64
+cork_sharded_hash_table_hash_key(const struct cork_sharded_hash_table *table,
+                                 const void *key)
+{
+    if (table->hash64 != NULL) {
+        return table->hash64(table->user_data, key);
+    } else {
+        cork_hash  hash = table->hash(table->user_data, key);
+        return ((cork_hash64) hash << 32) | hash;
+    }
+}
+
+/* Shifting in two steps avoids an undefined 64-bit shift when there's only
+ * one shard. */
+static inline struct cork_sharded_hash_table_shard *
+cork_sharded_hash_table_shard(const struct cork_sharded_hash_table *table,
+                              cork_hash64 hash)
+{
+    return &table->shards[(hash >> (63 - table->shard_bits)) >> 1];
+}
+
+struct cork_sharded_hash_table *
+cork_sharded_hash_table_new(size_t shard_count, size_t initial_size,
+                            unsigned int flags)
+{
+    struct cork_sharded_hash_table  *table =
+        cork_new(struct cork_sharded_hash_table);
+    size_t  i;
+
+    if (shard_count == 0) {
+        shard_count = CORK_SHARDED_HASH_TABLE_DEFAULT_SHARD_COUNT;
+    }
+    table->shard_count = 1;
+    table->shard_bits = 0;
+    while (table->shard_count < shard_count) {
+        table->shard_count <<= 1;
+        table->shard_bits++;
+    }
+
+    /* Open-addressed tables store their entries inline, so there's nothing
+     * to pool. */
+    if (!(flags & CORK_HASH_TABLE_OPEN_ADDRESSING)) {
+        flags |= CORK_HASH_TABLE_POOLED_ENTRIES;
+    }
+    table->shards = cork_calloc
+        (table->shard_count, sizeof(struct cork_sharded_hash_table_shard));
+    for (i = 0; i < table->shard_count; i++) {
+        cork_mutex_init(&table->shards[i].lock);
+        table->shards[i].table = cork_hash_table_new
+            (initial_size / table->shard_count, flags);
+    }
+
+    table->user_data = NULL;
+    table->free_user_data = NULL;
+    table->hash = cork_sharded_hash_table__default_hash;
+    table->hash64 = NULL;
+    return table;
+}
+
+void
+cork_sharded_hash_table_free(struct cork_sharded_hash_table *table)
+{
+    size_t  i;
+    for (i = 0; i < table->shard_count; i++) {
+        cork_hash_table_free(table->shards[i].table);
+        cork_mutex_done(&table->shards[i].lock);
+    }
+    cork_cfree(table->shards, table->shard_count,
+               sizeof(struct cork_sharded_hash_table_shard));
+    if (table->free_user_data != NULL) {
+        table->free_user_data(table->user_data);
+    }
+    cork_delete(struct cork_sharded_hash_table, table);
+}
+
+size_t
+cork_sharded_hash_table_shard_count(struct cork_sharded_hash_table *table)
+{
+    return table->shard_count;
+}
+
+
+void
+cork_sharded_hash_table_set_user_data(struct cork_sharded_hash_table *table,
+                                      void *user_data,
+                                      cork_free_f free_user_data)
+{
+    size_t  i;
+    table->user_data = user_data;
+    table->free_user_data = free_user_data;
+    /* The shards only need the user data for the equals callback; we're the
+     * ones who free it. */
+    for (i = 0; i < table->shard_count; i++) {
+        cork_hash_table_set_user_data(table->shards[i].table, user_data, NULL);
+    }
+}
+
+void
+cork_sharded_hash_table_set_equals(struct cork_sharded_hash_table *table,
+                                   cork_equals_f equals)
+{
+    size_t  i;
+    for (i = 0; i < table->shard_count; i++) {
+        cork_hash_table_set_equals(table->shards[i].table, equals);
+    }
+}
+
+void
+cork_sharded_hash_table_set_free_key(struct cork_sharded_hash_table *table,
+                                     cork_free_f free)
+{
+    size_t  i;
+    for (i = 0; i < table->shard_count; i++) {
+        cork_hash_table_set_free_key(table->shards[i].table, free);
+    }
+}
+
+void
+cork_sharded_hash_table_set_free_value(struct cork_sharded_hash_table *table,
+                                       cork_free_f free)
+{
+    size_t  i;
+    for (i = 0; i < table->shard_count; i++) {
+        cork_hash_table_set_free_value(table->shards[i].table, free);
+    }
+}
+
+/* We always hand the shards a precomputed hash, so they don't need to know
+ * about the hash functions. */
+
+void
+cork_sharded_hash_table_set_hash(struct cork_sharded_hash_table *table,
+                                 cork_hash_f hash)
+{
+    table->hash = hash;
+    table->hash64 = NULL;
+}
+
+void
+cork_sharded_hash_table_set_hash64(struct cork_sharded_hash_table *table,
+                                   cork_hash64_f hash)
+{
+    table->hash64 = hash;
+}
+
+
+void *
+cork_sharded_hash_table_get_hash64(struct cork_sharded_hash_table *table,
+                                   cork_hash64 hash, const void *key)
+{
+    struct cork_sharded_hash_table_shard  *shard =
+        cork_sharded_hash_table_shard(table, hash);
+    void  *value;
+    cork_mutex_lock(&shard->lock);
+    value = cork_hash_table_get_hash64(shard->table, hash, key);
+    cork_mutex_unlock(&shard->lock);
+    return value;
+}
+
+void *
+cork_sharded_hash_table_get(struct cork_sharded_hash_table *table,
+                            const void *key)
+{
+    cork_hash64  hash = cork_sharded_hash_table_hash_key(table, key);
+    return cork_sharded_hash_table_get_hash64(table, hash, key);
+}
+
+bool
+cork_sharded_hash_table_contains(struct cork_sharded_hash_table *table,
+                                 const void *key)
+{
+    cork_hash64  hash = cork_sharded_hash_table_hash_key(table, key);
+    struct cork_sharded_hash_table_shard  *shard =
+        cork_sharded_hash_table_shard(table, hash);
+    struct cork_hash_table_entry  *entry;
+    cork_mutex_lock(&shard->lock);
+    entry = cork_hash_table_get_entry_hash64(shard->table, hash, key);
+    cork_mutex_unlock(&shard->lock);
+    return entry != NULL;
+}
+
+void
+cork_sharded_hash_table_put_hash64(struct cork_sharded_hash_table *table,
+                                   cork_hash64 hash, void *key, void *value,
+                                   bool *is_new,
+                                   void **old_key, void **old_value)
+{
+    struct cork_sharded_hash_table_shard  *shard =
+        cork_sharded_hash_table_shard(table, hash);
+    cork_mutex_lock(&shard->lock);
+    cork_hash_table_put_hash64
+        (shard->table, hash, key, value, is_new, old_key, old_value);
+    cork_mutex_unlock(&shard->lock);
+}
+
+void
+cork_sharded_hash_table_put(struct cork_sharded_hash_table *table,
+                            void *key, void *value,
+                            bool *is_new, void **old_key, void **old_value)
+{
+    cork_hash64  hash = cork_sharded_hash_table_hash_key(table, key);
+    cork_sharded_hash_table_put_hash64
+        (table, hash, key, value, is_new, old_key, old_value);
+}
+
+bool
+cork_sharded_hash_table_delete_hash64(struct cork_sharded_hash_table *table,
+                                      cork_hash64 hash, const void *key,
+                                      void **deleted_key, void **deleted_value)
+{
+    struct cork_sharded_hash_table_shard  *shard =
+        cork_sharded_hash_table_shard(table, hash);
+    bool  result;
+    cork_mutex_lock(&shard->lock);
+    result = cork_hash_table_delete_hash64
+        (shard->table, hash, key, deleted_key, deleted_value);
+    cork_mutex_unlock(&shard->lock);
+    return result;
+}
+
+bool
+cork_sharded_hash_table_delete(struct cork_sharded_hash_table *table,
+                               const void *key,
+                               void **deleted_key, void **deleted_value)
+{
+    cork_hash64  hash = cork_sharded_hash_table_hash_key(table, key);
+    return cork_sharded_hash_table_delete_hash64
+        (table, hash, key, deleted_key, deleted_value);
+}
+
+size_t
+cork_sharded_hash_table_size(struct cork_sharded_hash_table *table)
+{
+    size_t  size = 0;
+    size_t  i;
+    for (i = 0; i < table->shard_count; i++) {
+        struct cork_sharded_hash_table_shard  *shard = &table->shards[i];
+        cork_mutex_lock(&shard->lock);
+        size += cork_hash_table_size(shard->table);
+        cork_mutex_unlock(&shard->lock);
+    }
+    return size;
+}
+
+void
+cork_sharded_hash_table_clear(struct cork_sharded_hash_table *table)
+{
+    size_t  i;
+    for (i = 0; i < table->shard_count; i++) {
+        struct cork_sharded_hash_table_shard  *shard = &table->shards[i];
+        cork_mutex_lock(&shard->lock);
+        cork_hash_table_clear(shard->table);
+        cork_mutex_unlock(&shard->lock);
+    }
+}
+
+
+struct cork_hash_table_entry *
+cork_sharded_hash_table_lock_entry_hash64
+(struct cork_sharded_hash_table *table, cork_hash64 hash, void *key,
+ bool *is_new)
+{
+    struct cork_sharded_hash_table_shard  *shard =
+        cork_sharded_hash_table_shard(table, hash);
+    cork_mutex_lock(&shard->lock);
+    return cork_hash_table_get_or_create_hash64
+        (shard->table, hash, key, is_new);
+}
+
+struct cork_hash_table_entry *
+cork_sharded_hash_table_lock_entry(struct cork_sharded_hash_table *table,
+                                   void *key, bool *is_new)
+{
+    cork_hash64  hash = cork_sharded_hash_table_hash_key(table, key);
+    return cork_sharded_hash_table_lock_entry_hash64(table, hash, key, is_new);
+}
+
+void
+cork_sharded_hash_table_unlock_entry(struct cork_sharded_hash_table *table,
+                                     struct cork_hash_table_entry *entry)
+{
+    /* The entry remembers its own hash, which tells us which shard it's in. */
+    struct cork_sharded_hash_table_shard  *shard =
+        cork_sharded_hash_table_shard
+        (table, cork_hash_table_entry_hash64(entry));
+    cork_mutex_unlock(&shard->lock);
+}
+
+
+void
+cork_sharded_hash_table_map(struct cork_sharded_hash_table *table,
+                            void *user_data, cork_hash_table_map_f mapper)
+{
+    size_t  i;
+    for (i = 0; i < table->shard_count; i++) {
+        struct cork_sharded_hash_table_shard  *shard = &table->shards[i];
+        cork_mutex_lock(&shard->lock);
+        cork_hash_table_map(shard->table, user_data, mapper);
+        cork_mutex_unlock(&shard->lock);
+    }
+}
+
+void
+cork_sharded_hash_table_iterator_init
+(struct cork_sharded_hash_table *table,
+ struct cork_sharded_hash_table_iterator *iterator)
+{
+    iterator->table = table;
+    iterator->shard_index = 0;
+    cork_mutex_lock(&table->shards[0].lock);
+    cork_hash_table_iterator_init
+        (table->shards[0].table, &iterator->shard_iterator);
+}
+
+struct cork_hash_table_entry *
+cork_sharded_hash_table_iterator_next
+(struct cork_sharded_hash_table_iterator *iterator)
+{
+    struct cork_sharded_hash_table  *table = iterator->table;
+    while (iterator->shard_index < table->shard_count) {
+        struct cork_sharded_hash_table_shard  *shard;
+        struct cork_hash_table_entry  *entry =
+            cork_hash_table_iterator_next(&iterator->shard_iterator);
+        if (entry != NULL) {
+            return entry;
+        }
+
+        /* Move on to the next shard. */
+        cork_mutex_unlock(&table->shards[iterator->shard_index].lock);
+        iterator->shard_index++;
+        if (iterator->shard_index == table->shard_count) {
+            break;
+        }
+        shard = &table->shards[iterator->shard_index];
+        cork_mutex_lock(&shard->lock);
+        cork_hash_table_iterator_init(shard->table, &iterator->shard_iterator);
+    }
+    return NULL;
+}
+
+void
+cork_sharded_hash_table_iterator_done
+(struct cork_sharded_hash_table_iterator *iterator)
+{
+    struct cork_sharded_hash_table  *table = iterator->table;
+    if (iterator->shard_index < table->shard_count) {
+        cork_mutex_unlock(&table->shards[iterator->shard_index].lock);
+        iterator->shard_index = table->shard_count;
+    }
+}
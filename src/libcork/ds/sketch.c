@@ -0,0 +1,540 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/attributes.h"
+#include "libcork/core/byte-order.h"
+#include "libcork/core/error.h"
+#include "libcork/core/hash.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/buffer.h"
+#include "libcork/ds/sketch.h"
+#include "libcork/ds/slice.h"
+
+#if CORK_CONFIG_HAVE_AVX2
+#include <immintrin.h>
+#elif CORK_CONFIG_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+
+/*-----------------------------------------------------------------------
+ * Blocked Bloom filters
+ */
+
+#define CORK_BLOOM_WORDS_PER_BLOCK  8
+#define CORK_BLOOM_BLOCK_SIZE  (CORK_BLOOM_WORDS_PER_BLOCK * sizeof(uint64_t))
+#define CORK_BLOOM_BLOCK_BITS  (CORK_BLOOM_BLOCK_SIZE * 8)
+
+#define CORK_BLOOM_MAGIC  "CORKBLM1"
+#define CORK_BLOOM_MAGIC_SIZE  8
+#define CORK_BLOOM_HEADER_SIZE  24
+
+struct cork_bloom_filter {
+    /* Aligned to a cache line */
+    uint64_t  *blocks;
+    size_t  block_count;
+    cork_hash  seed;
+};
+
+/* Each of these odd constants turns the low 32 bits of a key's hash into a
+ * different bit position within one word of the block.  (They're the same
+ * salts used by the Parquet and Impala split-block Bloom filters.) */
+static const uint32_t  cork_bloom_salts[CORK_BLOOM_WORDS_PER_BLOCK] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+static inline uint64_t *
+cork_bloom_filter_block(const struct cork_bloom_filter *filter,
+                        cork_hash64 hash)
+{
+    /* Multiply-shift maps the high 32 bits of the hash onto [0, block_count)
+     * without needing a power-of-two number of blocks. */
+    uint64_t  index = ((hash >> 32) * (uint64_t) filter->block_count) >> 32;
+    return filter->blocks + index * CORK_BLOOM_WORDS_PER_BLOCK;
+}
+
+static inline void
+cork_bloom_filter_masks(cork_hash64 hash, uint64_t *masks)
+{
+    uint32_t  key = (uint32_t) hash;
+    unsigned int  i;
+    for (i = 0; i < CORK_BLOOM_WORDS_PER_BLOCK; i++) {
+        masks[i] = UINT64_C(1) << ((key * cork_bloom_salts[i]) >> 26);
+    }
+}
+
+static void
+cork_bloom_filter_allocate(struct cork_bloom_filter *filter,
+                           size_t block_count)
+{
+    filter->block_count = block_count;
+    filter->blocks = cork_aligned_calloc
+        (block_count, CORK_BLOOM_BLOCK_SIZE, CORK_CACHELINE_SIZE);
+}
+
+struct cork_bloom_filter *
+cork_bloom_filter_new(size_t expected_count, unsigned int bits_per_key,
+                      cork_hash seed)
+{
+    struct cork_bloom_filter  *filter = cork_new(struct cork_bloom_filter);
+    size_t  block_count;
+    if (expected_count == 0) {
+        expected_count = 1;
+    }
+    if (bits_per_key == 0) {
+        bits_per_key = 1;
+    }
+    block_count = (expected_count * bits_per_key + CORK_BLOOM_BLOCK_BITS - 1)
+                / CORK_BLOOM_BLOCK_BITS;
+    /* We choose blocks using the high 32 bits of the hash. */
+    assert(block_count <= UINT32_MAX);
+    cork_bloom_filter_allocate(filter, block_count);
+    filter->seed = seed;
+    return filter;
+}
+
+void
+cork_bloom_filter_free(struct cork_bloom_filter *filter)
+{
+    cork_aligned_free(filter->blocks,
+                      filter->block_count * CORK_BLOOM_BLOCK_SIZE,
+                      CORK_CACHELINE_SIZE);
+    cork_delete(struct cork_bloom_filter, filter);
+}
+
+void
+cork_bloom_filter_clear(struct cork_bloom_filter *filter)
+{
+    memset(filter->blocks, 0, filter->block_count * CORK_BLOOM_BLOCK_SIZE);
+}
+
+size_t
+cork_bloom_filter_byte_size(const struct cork_bloom_filter *filter)
+{
+    return filter->block_count * CORK_BLOOM_BLOCK_SIZE;
+}
+
+#if CORK_CONFIG_HAVE_AVX2
+
+/* Build all eight masks at once: multiply by the salts in 32-bit lanes, keep
+ * the top 6 bits of each product, and shift a 1 into place in 64-bit lanes. */
+static inline void
+cork_bloom_filter_masks_avx2(cork_hash64 hash, __m256i *lo, __m256i *hi)
+{
+    const __m256i  salts =
+        _mm256_loadu_si256((const __m256i *) cork_bloom_salts);
+    const __m256i  ones = _mm256_set1_epi64x(1);
+    __m256i  key = _mm256_set1_epi32((int) (uint32_t) hash);
+    __m256i  shifts = _mm256_srli_epi32(_mm256_mullo_epi32(key, salts), 26);
+    *lo = _mm256_sllv_epi64
+        (ones, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(shifts)));
+    *hi = _mm256_sllv_epi64
+        (ones, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(shifts, 1)));
+}
+
+void
+cork_bloom_filter_add_hash(struct cork_bloom_filter *filter, cork_hash64 hash)
+{
+    __m256i  *block = (__m256i *) cork_bloom_filter_block(filter, hash);
+    __m256i  lo;
+    __m256i  hi;
+    cork_bloom_filter_masks_avx2(hash, &lo, &hi);
+    _mm256_store_si256(block, _mm256_or_si256(_mm256_load_si256(block), lo));
+    _mm256_store_si256
+        (block + 1, _mm256_or_si256(_mm256_load_si256(block + 1), hi));
+}
+
+bool
+cork_bloom_filter_contains_hash(const struct cork_bloom_filter *filter,
+                                cork_hash64 hash)
+{
+    const __m256i  *block =
+        (const __m256i *) cork_bloom_filter_block(filter, hash);
+    __m256i  lo;
+    __m256i  hi;
+    cork_bloom_filter_masks_avx2(hash, &lo, &hi);
+    /* testc checks that every bit of the mask is also set in the block. */
+    return _mm256_testc_si256(_mm256_load_si256(block), lo) &&
+           _mm256_testc_si256(_mm256_load_si256(block + 1), hi);
+}
+
+#else
+
+void
+cork_bloom_filter_add_hash(struct cork_bloom_filter *filter, cork_hash64 hash)
+{
+    uint64_t  *block = cork_bloom_filter_block(filter, hash);
+    uint64_t  masks[CORK_BLOOM_WORDS_PER_BLOCK];
+    unsigned int  i;
+    cork_bloom_filter_masks(hash, masks);
+    for (i = 0; i < CORK_BLOOM_WORDS_PER_BLOCK; i++) {
+        block[i] |= masks[i];
+    }
+}
+
+#if CORK_CONFIG_HAVE_SSE2
+
+bool
+cork_bloom_filter_contains_hash(const struct cork_bloom_filter *filter,
+                                cork_hash64 hash)
+{
+    const __m128i  *block =
+        (const __m128i *) cork_bloom_filter_block(filter, hash);
+    uint64_t  masks[CORK_BLOOM_WORDS_PER_BLOCK] CORK_ATTR_ALIGNED(16);
+    __m128i  missing = _mm_setzero_si128();
+    unsigned int  i;
+    cork_bloom_filter_masks(hash, masks);
+    /* Collect any mask bits that aren't set in the block, and check that
+     * there aren't any. */
+    for (i = 0; i < CORK_BLOOM_WORDS_PER_BLOCK / 2; i++) {
+        __m128i  mask = _mm_load_si128((const __m128i *) masks + i);
+        missing = _mm_or_si128
+            (missing, _mm_andnot_si128(_mm_load_si128(block + i), mask));
+    }
+    return _mm_movemask_epi8
+        (_mm_cmpeq_epi8(missing, _mm_setzero_si128())) == 0xffff;
+}
+
+#else
+
+bool
+cork_bloom_filter_contains_hash(const struct cork_bloom_filter *filter,
+                                cork_hash64 hash)
+{
+    const uint64_t  *block = cork_bloom_filter_block(filter, hash);
+    uint64_t  masks[CORK_BLOOM_WORDS_PER_BLOCK];
+    uint64_t  missing = 0;
+    unsigned int  i;
+    cork_bloom_filter_masks(hash, masks);
+    for (i = 0; i < CORK_BLOOM_WORDS_PER_BLOCK; i++) {
+        missing |= masks[i] & ~block[i];
+    }
+    return missing == 0;
+}
+
+#endif
+#endif
+
+void
+cork_bloom_filter_add(struct cork_bloom_filter *filter,
+                      const void *src, size_t len)
+{
+    cork_bloom_filter_add_hash
+        (filter, cork_hash64_buffer(filter->seed, src, len));
+}
+
+bool
+cork_bloom_filter_contains(const struct cork_bloom_filter *filter,
+                           const void *src, size_t len)
+{
+    return cork_bloom_filter_contains_hash
+        (filter, cork_hash64_buffer(filter->seed, src, len));
+}
+
+int
+cork_bloom_filter_merge(struct cork_bloom_filter *dest,
+                        const struct cork_bloom_filter *src)
+{
+    size_t  word_count = dest->block_count * CORK_BLOOM_WORDS_PER_BLOCK;
+    size_t  i;
+    if (CORK_UNLIKELY(dest->block_count != src->block_count ||
+                      dest->seed != src->seed)) {
+        cork_error_set_printf
+            (CORK_SKETCH_MISMATCH,
+             "Can't merge Bloom filters with different sizes or seeds");
+        return -1;
+    }
+    for (i = 0; i < word_count; i++) {
+        dest->blocks[i] |= src->blocks[i];
+    }
+    return 0;
+}
+
+void
+cork_bloom_filter_save(const struct cork_bloom_filter *filter,
+                       struct cork_buffer *dest)
+{
+    uint8_t  header[CORK_BLOOM_HEADER_SIZE];
+    size_t  word_count = filter->block_count * CORK_BLOOM_WORDS_PER_BLOCK;
+    uint8_t  *out;
+    size_t  i;
+
+    memcpy(header, CORK_BLOOM_MAGIC, CORK_BLOOM_MAGIC_SIZE);
+    cork_store_be32(header + 8, filter->seed);
+    cork_store_be32(header + 12, 0);
+    cork_store_be64(header + 16, filter->block_count);
+    cork_buffer_append(dest, header, sizeof(header));
+
+    cork_buffer_ensure_size(dest, dest->size + word_count * sizeof(uint64_t));
+    out = (uint8_t *) dest->buf + dest->size;
+    for (i = 0; i < word_count; i++) {
+        cork_store_be64(out, filter->blocks[i]);
+        out += sizeof(uint64_t);
+    }
+    dest->size = out - (uint8_t *) dest->buf;
+}
+
+struct cork_bloom_filter *
+cork_bloom_filter_load(const struct cork_slice *src)
+{
+    const uint8_t  *buf = src->buf;
+    size_t  size = src->size;
+    uint64_t  block_count;
+    struct cork_bloom_filter  *filter;
+    size_t  word_count;
+    size_t  i;
+
+    if (CORK_UNLIKELY(size < CORK_BLOOM_HEADER_SIZE ||
+                      memcmp(buf, CORK_BLOOM_MAGIC,
+                             CORK_BLOOM_MAGIC_SIZE) != 0)) {
+        cork_parse_error("Not a serialized Bloom filter");
+        return NULL;
+    }
+    block_count = cork_load_be64(buf + 16);
+    size -= CORK_BLOOM_HEADER_SIZE;
+    if (CORK_UNLIKELY(block_count == 0 || block_count > UINT32_MAX ||
+                      size != block_count * CORK_BLOOM_BLOCK_SIZE)) {
+        cork_parse_error("Serialized Bloom filter has the wrong size");
+        return NULL;
+    }
+
+    filter = cork_new(struct cork_bloom_filter);
+    cork_bloom_filter_allocate(filter, block_count);
+    filter->seed = cork_load_be32(buf + 8);
+    buf += CORK_BLOOM_HEADER_SIZE;
+    word_count = block_count * CORK_BLOOM_WORDS_PER_BLOCK;
+    for (i = 0; i < word_count; i++) {
+        filter->blocks[i] = cork_load_be64(buf);
+        buf += sizeof(uint64_t);
+    }
+    return filter;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Count-min sketches
+ */
+
+#define CORK_COUNT_MIN_MAGIC  "CORKCMS1"
+#define CORK_COUNT_MIN_MAGIC_SIZE  8
+#define CORK_COUNT_MIN_HEADER_SIZE  32
+
+struct cork_count_min_sketch {
+    /* depth rows of width counters, one row after another */
+    uint32_t  *counters;
+    size_t  width;
+    unsigned int  depth;
+    cork_hash  seed;
+    uint64_t  total;
+};
+
+/* We derive each row's counter from a single 64-bit hash using double
+ * hashing, which is just as accurate as independent hash functions. */
+#define cork_count_min_sketch_foreach(sketch, hash, counter, body) \
+    do { \
+        uint32_t  __h1 = (uint32_t) (hash); \
+        uint32_t  __h2 = (uint32_t) ((hash) >> 32) | 1; \
+        size_t  __mask = (sketch)->width - 1; \
+        unsigned int  __row; \
+        for (__row = 0; __row < (sketch)->depth; __row++) { \
+            uint32_t  *counter = \
+                &(sketch)->counters[__row * (sketch)->width + \
+                                    ((__h1 + __row * __h2) & __mask)]; \
+            body \
+        } \
+    } while (0)
+
+static void
+cork_count_min_sketch_allocate(struct cork_count_min_sketch *sketch,
+                               size_t width, unsigned int depth)
+{
+    sketch->width = width;
+    sketch->depth = depth;
+    sketch->counters = cork_calloc(width * depth, sizeof(uint32_t));
+}
+
+struct cork_count_min_sketch *
+cork_count_min_sketch_new(size_t width, unsigned int depth, cork_hash seed)
+{
+    struct cork_count_min_sketch  *sketch =
+        cork_new(struct cork_count_min_sketch);
+    size_t  rounded = 1;
+    assert(depth >= 1 && depth <= CORK_COUNT_MIN_SKETCH_MAX_DEPTH);
+    /* Row offsets come from 32 bits of the hash. */
+    assert(width <= UINT32_MAX);
+    while (rounded < width) {
+        rounded <<= 1;
+    }
+    cork_count_min_sketch_allocate(sketch, rounded, depth);
+    sketch->seed = seed;
+    sketch->total = 0;
+    return sketch;
+}
+
+void
+cork_count_min_sketch_free(struct cork_count_min_sketch *sketch)
+{
+    cork_cfree(sketch->counters, sketch->width * sketch->depth,
+               sizeof(uint32_t));
+    cork_delete(struct cork_count_min_sketch, sketch);
+}
+
+void
+cork_count_min_sketch_clear(struct cork_count_min_sketch *sketch)
+{
+    memset(sketch->counters, 0,
+           sketch->width * sketch->depth * sizeof(uint32_t));
+    sketch->total = 0;
+}
+
+uint64_t
+cork_count_min_sketch_total(const struct cork_count_min_sketch *sketch)
+{
+    return sketch->total;
+}
+
+uint32_t
+cork_count_min_sketch_estimate_hash(const struct cork_count_min_sketch *sketch,
+                                    cork_hash64 hash)
+{
+    uint32_t  estimate = UINT32_MAX;
+    cork_count_min_sketch_foreach(sketch, hash, counter, {
+        if (*counter < estimate) {
+            estimate = *counter;
+        }
+    });
+    return estimate;
+}
+
+uint32_t
+cork_count_min_sketch_add_hash(struct cork_count_min_sketch *sketch,
+                               cork_hash64 hash, uint32_t count)
+{
+    uint32_t  estimate = cork_count_min_sketch_estimate_hash(sketch, hash);
+    /* Conservative update: the key's true count is at most its current
+     * estimate plus count, so no counter needs to go any higher than that. */
+    estimate = (count > UINT32_MAX - estimate)? UINT32_MAX: estimate + count;
+    cork_count_min_sketch_foreach(sketch, hash, counter, {
+        if (*counter < estimate) {
+            *counter = estimate;
+        }
+    });
+    sketch->total += count;
+    return estimate;
+}
+
+uint32_t
+cork_count_min_sketch_add(struct cork_count_min_sketch *sketch,
+                          const void *src, size_t len, uint32_t count)
+{
+    return cork_count_min_sketch_add_hash
+        (sketch, cork_hash64_buffer(sketch->seed, src, len), count);
+}
+
+uint32_t
+cork_count_min_sketch_estimate(const struct cork_count_min_sketch *sketch,
+                               const void *src, size_t len)
+{
+    return cork_count_min_sketch_estimate_hash
+        (sketch, cork_hash64_buffer(sketch->seed, src, len));
+}
+
+int
+cork_count_min_sketch_merge(struct cork_count_min_sketch *dest,
+                            const struct cork_count_min_sketch *src)
+{
+    size_t  counter_count = dest->width * dest->depth;
+    size_t  i;
+    if (CORK_UNLIKELY(dest->width != src->width ||
+                      dest->depth != src->depth || dest->seed != src->seed)) {
+        cork_error_set_printf
+            (CORK_SKETCH_MISMATCH,
+             "Can't merge count-min sketches with different shapes or seeds");
+        return -1;
+    }
+    for (i = 0; i < counter_count; i++) {
+        uint32_t  a = dest->counters[i];
+        uint32_t  b = src->counters[i];
+        dest->counters[i] = (b > UINT32_MAX - a)? UINT32_MAX: a + b;
+    }
+    dest->total += src->total;
+    return 0;
+}
+
+void
+cork_count_min_sketch_save(const struct cork_count_min_sketch *sketch,
+                           struct cork_buffer *dest)
+{
+    uint8_t  header[CORK_COUNT_MIN_HEADER_SIZE];
+    size_t  counter_count = sketch->width * sketch->depth;
+    uint8_t  *out;
+    size_t  i;
+
+    memcpy(header, CORK_COUNT_MIN_MAGIC, CORK_COUNT_MIN_MAGIC_SIZE);
+    cork_store_be32(header + 8, sketch->seed);
+    cork_store_be32(header + 12, sketch->depth);
+    cork_store_be64(header + 16, sketch->width);
+    cork_store_be64(header + 24, sketch->total);
+    cork_buffer_append(dest, header, sizeof(header));
+
+    cork_buffer_ensure_size
+        (dest, dest->size + counter_count * sizeof(uint32_t));
+    out = (uint8_t *) dest->buf + dest->size;
+    for (i = 0; i < counter_count; i++) {
+        cork_store_be32(out, sketch->counters[i]);
+        out += sizeof(uint32_t);
+    }
+    dest->size = out - (uint8_t *) dest->buf;
+}
+
+struct cork_count_min_sketch *
+cork_count_min_sketch_load(const struct cork_slice *src)
+{
+    const uint8_t  *buf = src->buf;
+    size_t  size = src->size;
+    uint32_t  depth;
+    uint64_t  width;
+    struct cork_count_min_sketch  *sketch;
+    size_t  counter_count;
+    size_t  i;
+
+    if (CORK_UNLIKELY(size < CORK_COUNT_MIN_HEADER_SIZE ||
+                      memcmp(buf, CORK_COUNT_MIN_MAGIC,
+                             CORK_COUNT_MIN_MAGIC_SIZE) != 0)) {
+        cork_parse_error("Not a serialized count-min sketch");
+        return NULL;
+    }
+    depth = cork_load_be32(buf + 12);
+    width = cork_load_be64(buf + 16);
+    size -= CORK_COUNT_MIN_HEADER_SIZE;
+    if (CORK_UNLIKELY(depth == 0 || depth > CORK_COUNT_MIN_SKETCH_MAX_DEPTH ||
+                      width == 0 || width > UINT32_MAX ||
+                      (width & (width - 1)) != 0 ||
+                      size != width * depth * sizeof(uint32_t))) {
+        cork_parse_error("Serialized count-min sketch has the wrong size");
+        return NULL;
+    }
+
+    sketch = cork_new(struct cork_count_min_sketch);
+    cork_count_min_sketch_allocate(sketch, width, depth);
+    sketch->seed = cork_load_be32(buf + 8);
+    sketch->total = cork_load_be64(buf + 24);
+    buf += CORK_COUNT_MIN_HEADER_SIZE;
+    counter_count = width * depth;
+    for (i = 0; i < counter_count; i++) {
+        sketch->counters[i] = cork_load_be32(buf);
+        buf += sizeof(uint32_t);
+    }
+    return sketch;
+}
@@ -8,8 +8,12 @@
  * ----------------------------------------------------------------------
  */
 
+#include <errno.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
+#include "libcork/core/allocator.h"
 #include "libcork/core/error.h"
 #include "libcork/core/types.h"
 #include "libcork/ds/managed-buffer.h"
@@ -59,7 +63,7 @@ cork_slice_copy(struct cork_slice *dest, const struct cork_slice *slice,
               offset, length,
               slice->buf + offset, length);
         */
-        return slice->iface->copy(dest, slice, offset, length);
+        return cork_slice__copy(dest, slice, offset, length);
     }
 
     else {
@@ -104,7 +108,7 @@ cork_slice_light_copy(struct cork_slice *dest, const struct cork_slice *slice,
               offset, length,
               slice->buf + offset, length);
         */
-        return slice->iface->light_copy(dest, slice, offset, length);
+        return cork_slice__light_copy(dest, slice, offset, length);
     }
 
     else {
@@ -189,7 +193,9 @@ cork_slice_finish(struct cork_slice *slice)
     DEBUG("Finalizing <%p:%zu>", dest->buf, dest->size);
     */
 
-    if (slice->iface != NULL && slice->iface->free != NULL) {
+    if (slice->iface == &cork_slice__managed) {
+        cork_managed_buffer_unref(slice->user_data);
+    } else if (slice->iface != NULL && slice->iface->free != NULL) {
         slice->iface->free(slice);
     }
 
@@ -217,20 +223,18 @@ cork_slice_equal(const struct cork_slice *slice1,
  * Slices of static content
  */
 
-static struct cork_slice_iface  cork_static_slice;
-
 static int
 cork_static_slice_copy(struct cork_slice *dest, const struct cork_slice *src,
                        size_t offset, size_t length)
 {
     dest->buf = src->buf + offset;
     dest->size = length;
-    dest->iface = &cork_static_slice;
+    dest->iface = &cork_slice__static;
     dest->user_data = NULL;
     return 0;
 }
 
-static struct cork_slice_iface  cork_static_slice = {
+struct cork_slice_iface  cork_slice__static = {
     NULL,
     cork_static_slice_copy,
     cork_static_slice_copy,
@@ -242,7 +246,7 @@ cork_slice_init_static(struct cork_slice *dest, const void *buf, size_t size)
 {
     dest->buf = buf;
     dest->size = size;
-    dest->iface = &cork_static_slice;
+    dest->iface = &cork_slice__static;
     dest->user_data = NULL;
 }
 
@@ -294,3 +298,274 @@ cork_slice_init_copy_once(struct cork_slice *dest, const void *buf, size_t size)
     dest->iface = &cork_copy_once_slice;
     dest->user_data = NULL;
 }
+
+
+/*-----------------------------------------------------------------------
+ * Slice vectors
+ */
+
+void
+cork_slice_vec_init(struct cork_slice_vec *vec)
+{
+    vec->slices = NULL;
+    vec->count = 0;
+    vec->allocated_count = 0;
+    vec->size = 0;
+}
+
+void
+cork_slice_vec_done(struct cork_slice_vec *vec)
+{
+    cork_slice_vec_clear(vec);
+    if (vec->slices != NULL) {
+        cork_free(vec->slices,
+                  vec->allocated_count * sizeof(struct cork_slice));
+        vec->slices = NULL;
+        vec->allocated_count = 0;
+    }
+}
+
+void
+cork_slice_vec_clear(struct cork_slice_vec *vec)
+{
+    size_t  i;
+    for (i = 0; i < vec->count; i++) {
+        cork_slice_finish(&vec->slices[i]);
+    }
+    vec->count = 0;
+    vec->size = 0;
+}
+
+static struct cork_slice *
+cork_slice_vec_push(struct cork_slice_vec *vec)
+{
+    if (vec->count == vec->allocated_count) {
+        size_t  new_count =
+            (vec->allocated_count == 0)? 8: vec->allocated_count * 2;
+        vec->slices = cork_realloc
+            (vec->slices, vec->allocated_count * sizeof(struct cork_slice),
+             new_count * sizeof(struct cork_slice));
+        vec->allocated_count = new_count;
+    }
+    return &vec->slices[vec->count++];
+}
+
+int
+cork_slice_vec_append(struct cork_slice_vec *vec,
+                      const struct cork_slice *slice)
+{
+    struct cork_slice  *dest = cork_slice_vec_push(vec);
+    if (CORK_UNLIKELY(cork_slice_copy_offset(dest, slice, 0) != 0)) {
+        vec->count--;
+        return -1;
+    }
+    vec->size += dest->size;
+    return 0;
+}
+
+void
+cork_slice_vec_append_move(struct cork_slice_vec *vec,
+                           struct cork_slice *slice)
+{
+    struct cork_slice  *dest = cork_slice_vec_push(vec);
+    *dest = *slice;
+    vec->size += dest->size;
+    cork_slice_clear(slice);
+}
+
+size_t
+cork_slice_vec_iovec(const struct cork_slice_vec *vec, size_t start,
+                     struct iovec *iov, size_t count)
+{
+    size_t  i;
+    for (i = 0; i < count && start + i < vec->count; i++) {
+        iov[i].iov_base = (void *) vec->slices[start + i].buf;
+        iov[i].iov_len = vec->slices[start + i].size;
+    }
+    return i;
+}
+
+/* The number of iovecs that we pass to each writev or sendmsg call */
+#define CORK_SLICE_VEC_IOV_COUNT  64
+
+static ssize_t
+cork_slice_vec__writev(int fd, struct iovec *iov, size_t iov_count,
+                       int flags)
+{
+    return writev(fd, iov, iov_count);
+}
+
+static ssize_t
+cork_slice_vec__sendmsg(int fd, struct iovec *iov, size_t iov_count,
+                        int flags)
+{
+    struct msghdr  msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov_count;
+    return sendmsg(fd, &msg, flags);
+}
+
+static int
+cork_slice_vec_write(const struct cork_slice_vec *vec, int fd, int flags,
+                     ssize_t (*write_iov)(int, struct iovec *, size_t, int))
+{
+    struct iovec  iov[CORK_SLICE_VEC_IOV_COUNT];
+    size_t  start = 0;
+    size_t  iov_count;
+
+    while ((iov_count = cork_slice_vec_iovec
+            (vec, start, iov, CORK_SLICE_VEC_IOV_COUNT)) > 0) {
+        struct iovec  *curr = iov;
+        start += iov_count;
+        while (iov_count > 0) {
+            ssize_t  rc = write_iov(fd, curr, iov_count, flags);
+            size_t  written;
+            if (rc == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                cork_system_error_set();
+                return -1;
+            }
+
+            /* Skip past whatever was written, which might end partway
+             * through one of the slices. */
+            written = rc;
+            while (iov_count > 0 && written >= curr->iov_len) {
+                written -= curr->iov_len;
+                curr++;
+                iov_count--;
+            }
+            if (iov_count > 0) {
+                curr->iov_base = (char *) curr->iov_base + written;
+                curr->iov_len -= written;
+            }
+        }
+    }
+    return 0;
+}
+
+int
+cork_slice_vec_write_fd(const struct cork_slice_vec *vec, int fd)
+{
+    return cork_slice_vec_write(vec, fd, 0, cork_slice_vec__writev);
+}
+
+int
+cork_slice_vec_sendmsg(const struct cork_slice_vec *vec, int fd, int flags)
+{
+    return cork_slice_vec_write(vec, fd, flags, cork_slice_vec__sendmsg);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Slice readers
+ */
+
+void
+cork_slice_reader_init(struct cork_slice_reader *reader,
+                       const struct cork_slice *slice)
+{
+    reader->slice = slice;
+    reader->pos = slice->buf;
+    reader->end = reader->pos + slice->size;
+}
+
+int
+cork_slice_reader_truncated(const struct cork_slice_reader *reader,
+                            size_t length)
+{
+    cork_error_set
+        (CORK_SLICE_ERROR, CORK_SLICE_TRUNCATED,
+         "Cannot read %zu bytes at offset %zu of %zu-byte slice",
+         length, cork_slice_reader_offset(reader), reader->slice->size);
+    return -1;
+}
+
+/* The longest valid 64-bit varint */
+#define CORK_VARINT_MAX_LENGTH  10
+
+int
+cork_slice_reader_varint(struct cork_slice_reader *reader, uint64_t *dest)
+{
+    const uint8_t  *pos = reader->pos;
+    const uint8_t  *end = reader->end;
+    uint64_t  result = 0;
+    unsigned int  shift = 0;
+
+    /* If there's room for the longest possible varint, we don't need to check
+     * the bounds for each byte. */
+    if (CORK_LIKELY((size_t) (end - pos) >= CORK_VARINT_MAX_LENGTH)) {
+        end = pos + CORK_VARINT_MAX_LENGTH;
+    }
+
+    while (pos < end) {
+        uint8_t  byte = *pos++;
+        result |= (uint64_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            if (CORK_UNLIKELY(shift == 63 && byte > 1)) {
+                break;
+            }
+            reader->pos = pos;
+            *dest = result;
+            return 0;
+        }
+        shift += 7;
+    }
+
+    if (pos - reader->pos < CORK_VARINT_MAX_LENGTH) {
+        return cork_slice_reader_truncated(reader, pos - reader->pos + 1);
+    }
+    cork_error_set
+        (CORK_SLICE_ERROR, CORK_SLICE_INVALID_VARINT,
+         "Varint at offset %zu of %zu-byte slice is too large",
+         cork_slice_reader_offset(reader), reader->slice->size);
+    return -1;
+}
+
+int
+cork_slice_reader_skip(struct cork_slice_reader *reader, size_t length)
+{
+    if (CORK_UNLIKELY(cork_slice_reader_remaining(reader) < length)) {
+        return cork_slice_reader_truncated(reader, length);
+    }
+    reader->pos += length;
+    return 0;
+}
+
+int
+cork_slice_reader_slice(struct cork_slice_reader *reader, size_t length,
+                        struct cork_slice *dest)
+{
+    if (CORK_UNLIKELY(cork_slice_reader_remaining(reader) < length)) {
+        cork_slice_clear(dest);
+        return cork_slice_reader_truncated(reader, length);
+    }
+    rii_check(cork_slice_light_copy_fast
+              (dest, reader->slice, cork_slice_reader_offset(reader), length));
+    reader->pos += length;
+    return 0;
+}
+
+#define cork_slice_reader_define_prefixed(name, type) \
+int \
+cork_slice_reader_prefixed_##name(struct cork_slice_reader *reader, \
+                                  struct cork_slice *dest) \
+{ \
+    const uint8_t  *start = reader->pos; \
+    type  length = 0; \
+    if (CORK_UNLIKELY(cork_slice_reader_##name(reader, &length) != 0)) { \
+        cork_slice_clear(dest); \
+        return -1; \
+    } \
+    if (CORK_UNLIKELY(cork_slice_reader_slice(reader, length, dest) != 0)) { \
+        reader->pos = start; \
+        return -1; \
+    } \
+    return 0; \
+}
+
+cork_slice_reader_define_prefixed(be16, uint16_t)
+cork_slice_reader_define_prefixed(be32, uint32_t)
+cork_slice_reader_define_prefixed(varint, uint64_t)
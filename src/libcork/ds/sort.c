@@ -0,0 +1,278 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/sort.h"
+
+
+/*-----------------------------------------------------------------------
+ * Integer sorting
+ */
+
+/* Below this many elements, the radix sort's fixed costs (clearing and
+ * scanning the histograms) outweigh its advantages. */
+#define CORK_RADIX_SORT_THRESHOLD  128
+
+cork_sort_define(uint32_t, cork_sort__uint32, CORK_SORT_LESS)
+cork_sort_define(uint64_t, cork_sort__uint64, CORK_SORT_LESS)
+
+/* We compute the histograms for every byte in a single pass, and then only
+ * scatter the elements once for each byte that isn't the same in every
+ * element. */
+#define cork_radix_sort_define(TYPE, NAME, SMALL_NAME) \
+void \
+NAME(TYPE *items, size_t count) \
+{ \
+    size_t  counts[sizeof(TYPE)][256]; \
+    TYPE  *tmp; \
+    TYPE  *src = items; \
+    TYPE  *dest; \
+    size_t  byte; \
+    size_t  i; \
+    \
+    if (count < CORK_RADIX_SORT_THRESHOLD) { \
+        SMALL_NAME(items, count); \
+        return; \
+    } \
+    \
+    memset(counts, 0, sizeof(counts)); \
+    for (i = 0; i < count; i++) { \
+        TYPE  value = items[i]; \
+        for (byte = 0; byte < sizeof(TYPE); byte++) { \
+            counts[byte][(value >> (8 * byte)) & 0xff]++; \
+        } \
+    } \
+    \
+    tmp = cork_malloc(count * sizeof(TYPE)); \
+    dest = tmp; \
+    for (byte = 0; byte < sizeof(TYPE); byte++) { \
+        unsigned int  shift = 8 * byte; \
+        size_t  *digit_counts = counts[byte]; \
+        size_t  offset = 0; \
+        TYPE  *swap; \
+        if (digit_counts[(src[0] >> shift) & 0xff] == count) { \
+            continue; \
+        } \
+        for (i = 0; i < 256; i++) { \
+            size_t  digit_count = digit_counts[i]; \
+            digit_counts[i] = offset; \
+            offset += digit_count; \
+        } \
+        for (i = 0; i < count; i++) { \
+            TYPE  value = src[i]; \
+            dest[digit_counts[(value >> shift) & 0xff]++] = value; \
+        } \
+        swap = src; \
+        src = dest; \
+        dest = swap; \
+    } \
+    \
+    if (src != items) { \
+        memcpy(items, src, count * sizeof(TYPE)); \
+    } \
+    cork_free(tmp, count * sizeof(TYPE)); \
+}
+
+cork_radix_sort_define(uint32_t, cork_sort_uint32, cork_sort__uint32)
+cork_radix_sort_define(uint64_t, cork_sort_uint64, cork_sort__uint64)
+
+
+/*-----------------------------------------------------------------------
+ * Generic sorting
+ */
+
+/* This is the same introsort as cork_sort_define, but since we don't know
+ * the element type, we only ever swap elements, rather than copying them into
+ * temporaries. */
+
+#define cork_sort__at(items, i, size)  ((char *) (items) + (i) * (size))
+#define cork_sort__less(a, b) \
+    (compare(user_data, (a), (b)) < 0)
+
+static void
+cork_sort__swap(void *va, void *vb, size_t size)
+{
+    char  *a = va;
+    char  *b = vb;
+    while (size >= sizeof(uint64_t)) {
+        uint64_t  tmp;
+        memcpy(&tmp, a, sizeof(uint64_t));
+        memcpy(a, b, sizeof(uint64_t));
+        memcpy(b, &tmp, sizeof(uint64_t));
+        a += sizeof(uint64_t);
+        b += sizeof(uint64_t);
+        size -= sizeof(uint64_t);
+    }
+    while (size > 0) {
+        char  tmp = *a;
+        *a++ = *b;
+        *b++ = tmp;
+        size--;
+    }
+}
+
+static void
+cork_sort__insertion(char *items, size_t count, size_t size,
+                     void *user_data, cork_compare_f compare)
+{
+    size_t  i;
+    for (i = 1; i < count; i++) {
+        size_t  j;
+        for (j = i; j > 0; j--) {
+            char  *curr = cork_sort__at(items, j, size);
+            char  *prev = curr - size;
+            if (!cork_sort__less(curr, prev)) {
+                break;
+            }
+            cork_sort__swap(curr, prev, size);
+        }
+    }
+}
+
+static void
+cork_sort__sift_down(char *items, size_t start, size_t count, size_t size,
+                     void *user_data, cork_compare_f compare)
+{
+    size_t  child;
+    while ((child = 2 * start + 1) < count) {
+        if (child + 1 < count &&
+            cork_sort__less(cork_sort__at(items, child, size),
+                            cork_sort__at(items, child + 1, size))) {
+            child++;
+        }
+        if (!cork_sort__less(cork_sort__at(items, start, size),
+                             cork_sort__at(items, child, size))) {
+            return;
+        }
+        cork_sort__swap(cork_sort__at(items, start, size),
+                        cork_sort__at(items, child, size), size);
+        start = child;
+    }
+}
+
+static void
+cork_sort__heapsort(char *items, size_t count, size_t size,
+                    void *user_data, cork_compare_f compare)
+{
+    size_t  i;
+    for (i = count / 2; i > 0; i--) {
+        cork_sort__sift_down(items, i - 1, count, size, user_data, compare);
+    }
+    for (i = count - 1; i > 0; i--) {
+        cork_sort__swap(items, cork_sort__at(items, i, size), size);
+        cork_sort__sift_down(items, 0, i, size, user_data, compare);
+    }
+}
+
+/* Moves the median of items[a], items[b], and items[c] into items[b]. */
+static void
+cork_sort__median3(char *items, size_t a, size_t b, size_t c, size_t size,
+                   void *user_data, cork_compare_f compare)
+{
+    char  *pa = cork_sort__at(items, a, size);
+    char  *pb = cork_sort__at(items, b, size);
+    char  *pc = cork_sort__at(items, c, size);
+    if (cork_sort__less(pb, pa)) {
+        cork_sort__swap(pa, pb, size);
+    }
+    if (cork_sort__less(pc, pb)) {
+        cork_sort__swap(pb, pc, size);
+        if (cork_sort__less(pb, pa)) {
+            cork_sort__swap(pa, pb, size);
+        }
+    }
+}
+
+static void
+cork_sort__introsort(char *items, size_t count, size_t size,
+                     unsigned int depth,
+                     void *user_data, cork_compare_f compare)
+{
+    while (count > CORK_SORT_INSERTION_THRESHOLD) {
+        size_t  mid = count / 2;
+        size_t  i;
+        size_t  j;
+
+        if (depth == 0) {
+            cork_sort__heapsort(items, count, size, user_data, compare);
+            return;
+        }
+        depth--;
+
+        /* Move the pivot to the front, where the partitioning loop won't
+         * touch it. */
+        cork_sort__median3
+            (items, 0, mid, count - 1, size, user_data, compare);
+        cork_sort__swap(items, cork_sort__at(items, mid, size), size);
+
+        i = 0;
+        j = count;
+        for (;;) {
+            do {
+                i++;
+            } while (i < count &&
+                     cork_sort__less(cork_sort__at(items, i, size), items));
+            do {
+                j--;
+            } while (cork_sort__less(items, cork_sort__at(items, j, size)));
+            if (i >= j) {
+                break;
+            }
+            cork_sort__swap(cork_sort__at(items, i, size),
+                            cork_sort__at(items, j, size), size);
+        }
+        cork_sort__swap(items, cork_sort__at(items, j, size), size);
+
+        /* Recurse into the smaller half, and loop on the larger one. */
+        if (j < count - j - 1) {
+            cork_sort__introsort(items, j, size, depth, user_data, compare);
+            items = cork_sort__at(items, j + 1, size);
+            count -= j + 1;
+        } else {
+            cork_sort__introsort
+                (cork_sort__at(items, j + 1, size), count - j - 1, size,
+                 depth, user_data, compare);
+            count = j;
+        }
+    }
+    cork_sort__insertion(items, count, size, user_data, compare);
+}
+
+void
+cork_sort(void *items, size_t count, size_t element_size,
+          void *user_data, cork_compare_f compare)
+{
+    unsigned int  depth = 0;
+    size_t  n;
+    for (n = count; n > 1; n >>= 1) {
+        depth += 2;
+    }
+    cork_sort__introsort
+        (items, count, element_size, depth, user_data, compare);
+}
+
+size_t
+cork_lower_bound(const void *items, size_t count, size_t element_size,
+                 const void *key, void *user_data, cork_compare_f compare)
+{
+    size_t  lo = 0;
+    size_t  hi = count;
+    while (lo < hi) {
+        size_t  mid = lo + (hi - lo) / 2;
+        if (cork_sort__less(cork_sort__at(items, mid, element_size), key)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
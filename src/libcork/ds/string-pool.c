@@ -0,0 +1,173 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/hash.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/concurrent-hash-table.h"
+#include "libcork/ds/string-pool.h"
+#include "libcork/threads/locks.h"
+
+
+/*-----------------------------------------------------------------------
+ * String pools
+ */
+
+/* Each interned string is stored in the arena immediately after one of these
+ * headers, so we can get from an interned string back to its length and hash
+ * without a lookup.  We also use the header as the key of the index; when
+ * looking up a string that might not be interned yet, we build a temporary
+ * header on the stack that points at the caller's buffer. */
+struct cork_string_pool_entry {
+    const char  *str;
+    size_t  length;
+    cork_hash  hash;
+};
+
+#define cork_string_pool_entry_of(str) \
+    ((struct cork_string_pool_entry *) \
+     ((char *) (str) - sizeof(struct cork_string_pool_entry)))
+
+struct cork_string_pool {
+    /* Only ever modified while holding lock; readers only touch the index. */
+    struct cork_concurrent_hash_table  *index;
+    struct cork_arena  *arena;
+    const struct cork_alloc  *alloc;
+    struct cork_mutex  lock;
+};
+
+static cork_hash
+cork_string_pool_entry__hash(void *user_data, const void *vkey)
+{
+    const struct cork_string_pool_entry  *key = vkey;
+    return cork_hash_buffer(0, key->str, key->length);
+}
+
+static bool
+cork_string_pool_entry__equals(void *user_data,
+                               const void *vkey1, const void *vkey2)
+{
+    const struct cork_string_pool_entry  *key1 = vkey1;
+    const struct cork_string_pool_entry  *key2 = vkey2;
+    return key1->length == key2->length &&
+        memcmp(key1->str, key2->str, key1->length) == 0;
+}
+
+struct cork_string_pool *
+cork_string_pool_new(void)
+{
+    struct cork_string_pool  *pool = cork_new(struct cork_string_pool);
+    pool->index = cork_concurrent_hash_table_new(0, 0);
+    cork_concurrent_hash_table_set_hash
+        (pool->index, cork_string_pool_entry__hash);
+    cork_concurrent_hash_table_set_equals
+        (pool->index, cork_string_pool_entry__equals);
+    pool->arena = cork_arena_new(cork_current_allocator(), 0);
+    pool->alloc = cork_arena_alloc(pool->arena);
+    cork_mutex_init(&pool->lock);
+    return pool;
+}
+
+void
+cork_string_pool_free(struct cork_string_pool *pool)
+{
+    /* The entries live in the arena, so the index doesn't free them. */
+    cork_concurrent_hash_table_free(pool->index);
+    cork_arena_free(pool->arena);
+    cork_mutex_done(&pool->lock);
+    cork_delete(struct cork_string_pool, pool);
+}
+
+static struct cork_string_pool_entry *
+cork_string_pool_lookup(struct cork_string_pool *pool,
+                        const struct cork_string_pool_entry *key)
+{
+    struct cork_string_pool_entry  *entry;
+    unsigned int  ticket = cork_concurrent_hash_table_read_begin(pool->index);
+    /* Entries are never removed or moved, so it's safe to use entry after the
+     * critical section ends. */
+    entry = cork_concurrent_hash_table_get_hash(pool->index, key->hash, key);
+    cork_concurrent_hash_table_read_end(pool->index, ticket);
+    return entry;
+}
+
+const char *
+cork_string_pool_find(struct cork_string_pool *pool,
+                      const void *buf, size_t len)
+{
+    struct cork_string_pool_entry  key;
+    struct cork_string_pool_entry  *entry;
+    key.str = buf;
+    key.length = len;
+    key.hash = cork_hash_buffer(0, buf, len);
+    entry = cork_string_pool_lookup(pool, &key);
+    return (entry == NULL)? NULL: entry->str;
+}
+
+const char *
+cork_string_pool_intern_n(struct cork_string_pool *pool,
+                          const void *buf, size_t len)
+{
+    struct cork_string_pool_entry  key;
+    struct cork_string_pool_entry  *entry;
+    char  *str;
+
+    key.str = buf;
+    key.length = len;
+    key.hash = cork_hash_buffer(0, buf, len);
+    entry = cork_string_pool_lookup(pool, &key);
+    if (CORK_LIKELY(entry != NULL)) {
+        return entry->str;
+    }
+
+    /* Another thread might have added the string while we weren't holding the
+     * lock, so check again before adding it ourselves. */
+    cork_mutex_lock(&pool->lock);
+    entry = cork_string_pool_lookup(pool, &key);
+    if (entry == NULL) {
+        entry = cork_alloc_malloc
+            (pool->alloc, sizeof(struct cork_string_pool_entry) + len + 1);
+        str = (char *) (entry + 1);
+        memcpy(str, buf, len);
+        str[len] = '\0';
+        entry->str = str;
+        entry->length = len;
+        entry->hash = key.hash;
+        cork_concurrent_hash_table_put_hash
+            (pool->index, key.hash, entry, entry, NULL, NULL, NULL);
+    }
+    cork_mutex_unlock(&pool->lock);
+    return entry->str;
+}
+
+const char *
+cork_string_pool_intern(struct cork_string_pool *pool, const char *str)
+{
+    return cork_string_pool_intern_n(pool, str, strlen(str));
+}
+
+size_t
+cork_string_pool_size(struct cork_string_pool *pool)
+{
+    return cork_concurrent_hash_table_size(pool->index);
+}
+
+size_t
+cork_interned_length(const char *str)
+{
+    return cork_string_pool_entry_of(str)->length;
+}
+
+cork_hash
+cork_interned_hash(const char *str)
+{
+    return cork_string_pool_entry_of(str)->hash;
+}
@@ -0,0 +1,329 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2012-2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <pthread.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/error.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/managed-buffer.h"
+#include "libcork/ds/slice.h"
+#include "libcork/ds/stream.h"
+#include "libcork/helpers/errors.h"
+#include "libcork/threads/basics.h"
+
+
+/*-----------------------------------------------------------------------
+ * Branch queues
+ */
+
+enum cork_tee_entry_kind {
+    CORK_TEE_DATA,
+    CORK_TEE_EOF,
+    /* Stop the worker thread without telling the branch about the end of
+     * the stream. */
+    CORK_TEE_STOP
+};
+
+struct cork_tee_entry {
+    enum cork_tee_entry_kind  kind;
+    struct cork_slice  slice;
+    bool  is_first_chunk;
+    struct cork_tee_entry  *next;
+};
+
+struct cork_tee_branch {
+    struct cork_stream_consumer  *consumer;
+    /* NULL if the branch processes chunks in the producer's thread */
+    struct cork_thread  *thread;
+    bool  joined;
+
+    /* The remaining fields are only used by threaded branches, and are
+     * protected by mutex. */
+    pthread_mutex_t  mutex;
+    pthread_cond_t  cond;
+    struct cork_tee_entry  *head;
+    struct cork_tee_entry  *tail;
+    size_t  queued;
+    /* Set by the worker thread if the branch returns an error.  The error
+     * itself is passed back when we join the thread. */
+    bool  failed;
+
+    struct cork_tee_branch  *next;
+};
+
+static void
+cork_tee_branch_push(struct cork_tee_branch *branch,
+                     struct cork_tee_entry *entry)
+{
+    pthread_mutex_lock(&branch->mutex);
+    /* Don't let a slow branch buffer up an unbounded amount of data. */
+    while (branch->queued >= CORK_TEE_CONSUMER_QUEUE_DEPTH &&
+           !branch->failed) {
+        pthread_cond_wait(&branch->cond, &branch->mutex);
+    }
+    entry->next = NULL;
+    if (branch->tail == NULL) {
+        branch->head = entry;
+    } else {
+        branch->tail->next = entry;
+    }
+    branch->tail = entry;
+    branch->queued++;
+    pthread_cond_broadcast(&branch->cond);
+    pthread_mutex_unlock(&branch->mutex);
+}
+
+static struct cork_tee_entry *
+cork_tee_branch_pop(struct cork_tee_branch *branch)
+{
+    struct cork_tee_entry  *entry;
+    pthread_mutex_lock(&branch->mutex);
+    while (branch->head == NULL) {
+        pthread_cond_wait(&branch->cond, &branch->mutex);
+    }
+    entry = branch->head;
+    branch->head = entry->next;
+    if (branch->head == NULL) {
+        branch->tail = NULL;
+    }
+    branch->queued--;
+    pthread_cond_broadcast(&branch->cond);
+    pthread_mutex_unlock(&branch->mutex);
+    return entry;
+}
+
+static bool
+cork_tee_branch_failed(struct cork_tee_branch *branch)
+{
+    bool  failed;
+    pthread_mutex_lock(&branch->mutex);
+    failed = branch->failed;
+    pthread_mutex_unlock(&branch->mutex);
+    return failed;
+}
+
+static int
+cork_tee_branch__run(void *user_data)
+{
+    struct cork_tee_branch  *branch = user_data;
+    bool  failed = false;
+
+    while (true) {
+        struct cork_tee_entry  *entry = cork_tee_branch_pop(branch);
+        enum cork_tee_entry_kind  kind = entry->kind;
+        int  rc = 0;
+
+        if (kind == CORK_TEE_DATA) {
+            /* Once the branch has failed, we throw away anything else that
+             * the producer managed to queue up. */
+            if (!failed) {
+                rc = cork_stream_consumer_data
+                    (branch->consumer, entry->slice.buf, entry->slice.size,
+                     entry->is_first_chunk);
+            }
+            cork_slice_finish(&entry->slice);
+        } else if (kind == CORK_TEE_EOF && !failed) {
+            rc = cork_stream_consumer_eof(branch->consumer);
+        }
+        cork_delete(struct cork_tee_entry, entry);
+
+        if (CORK_UNLIKELY(rc != 0)) {
+            failed = true;
+            pthread_mutex_lock(&branch->mutex);
+            branch->failed = true;
+            pthread_cond_broadcast(&branch->cond);
+            pthread_mutex_unlock(&branch->mutex);
+        }
+
+        if (kind != CORK_TEE_DATA) {
+            return failed? -1: 0;
+        }
+    }
+}
+
+/* Tell a threaded branch's worker to finish, and wait for it.  Any error from
+ * the worker is passed back here. */
+static int
+cork_tee_branch_join(struct cork_tee_branch *branch,
+                     enum cork_tee_entry_kind kind)
+{
+    struct cork_tee_entry  *entry = cork_new(struct cork_tee_entry);
+    entry->kind = kind;
+    cork_slice_clear(&entry->slice);
+    entry->is_first_chunk = false;
+    cork_tee_branch_push(branch, entry);
+    branch->joined = true;
+    return cork_thread_join(branch->thread);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Tee consumer
+ */
+
+struct cork_tee_consumer {
+    struct cork_stream_consumer  parent;
+    struct cork_tee_branch  *branches;
+    struct cork_tee_branch  *last_branch;
+    bool  has_threads;
+};
+
+static int
+cork_tee_consumer__data(struct cork_stream_consumer *vself,
+                        const void *buf, size_t size, bool is_first_chunk)
+{
+    struct cork_tee_consumer  *self =
+        cork_container_of(vself, struct cork_tee_consumer, parent);
+    struct cork_tee_branch  *branch;
+
+    /* Threaded branches share a single managed copy of the chunk, since buf
+     * is only valid until we return.  We hand those out first, so that they
+     * can run while we feed the other branches. */
+    if (self->has_threads) {
+        struct cork_managed_buffer  *mbuf;
+        rip_check(mbuf = cork_managed_buffer_new_copy(buf, size));
+        for (branch = self->branches; branch != NULL; branch = branch->next) {
+            struct cork_tee_entry  *entry;
+            if (branch->thread == NULL) {
+                continue;
+            }
+            if (CORK_UNLIKELY(branch->joined ||
+                              cork_tee_branch_failed(branch))) {
+                cork_managed_buffer_unref(mbuf);
+                if (!branch->joined) {
+                    /* Pass the branch's error back to our caller. */
+                    cork_tee_branch_join(branch, CORK_TEE_STOP);
+                } else {
+                    cork_error_set_printf
+                        (CORK_UNKNOWN_ERROR,
+                         "Tee consumer branch has already failed");
+                }
+                return -1;
+            }
+            entry = cork_new(struct cork_tee_entry);
+            entry->kind = CORK_TEE_DATA;
+            cork_managed_buffer_slice_offset(&entry->slice, mbuf, 0);
+            entry->is_first_chunk = is_first_chunk;
+            cork_tee_branch_push(branch, entry);
+        }
+        cork_managed_buffer_unref(mbuf);
+    }
+
+    for (branch = self->branches; branch != NULL; branch = branch->next) {
+        if (branch->thread == NULL) {
+            rii_check(cork_stream_consumer_data
+                      (branch->consumer, buf, size, is_first_chunk));
+        }
+    }
+    return 0;
+}
+
+static int
+cork_tee_consumer__eof(struct cork_stream_consumer *vself)
+{
+    struct cork_tee_consumer  *self =
+        cork_container_of(vself, struct cork_tee_consumer, parent);
+    struct cork_tee_branch  *branch;
+    int  rc = 0;
+
+    for (branch = self->branches; branch != NULL; branch = branch->next) {
+        if (branch->thread == NULL) {
+            if (rc == 0) {
+                rc = cork_stream_consumer_eof(branch->consumer);
+            }
+        } else if (!branch->joined) {
+            /* We always wait for every worker thread, but only report the
+             * first error that we encounter. */
+            if (cork_tee_branch_join(branch, CORK_TEE_EOF) != 0 && rc == 0) {
+                rc = -1;
+            }
+        }
+    }
+    return rc;
+}
+
+static void
+cork_tee_consumer__free(struct cork_stream_consumer *vself)
+{
+    struct cork_tee_consumer  *self =
+        cork_container_of(vself, struct cork_tee_consumer, parent);
+    struct cork_tee_branch  *branch;
+    struct cork_tee_branch  *next;
+
+    for (branch = self->branches; branch != NULL; branch = next) {
+        next = branch->next;
+        if (branch->thread != NULL) {
+            if (!branch->joined) {
+                if (cork_tee_branch_join(branch, CORK_TEE_STOP) != 0) {
+                    cork_error_clear();
+                }
+            }
+            pthread_cond_destroy(&branch->cond);
+            pthread_mutex_destroy(&branch->mutex);
+        }
+        cork_stream_consumer_free(branch->consumer);
+        cork_delete(struct cork_tee_branch, branch);
+    }
+    cork_delete(struct cork_tee_consumer, self);
+}
+
+struct cork_stream_consumer *
+cork_tee_consumer_new(void)
+{
+    struct cork_tee_consumer  *self = cork_new(struct cork_tee_consumer);
+    self->parent.data = cork_tee_consumer__data;
+    self->parent.eof = cork_tee_consumer__eof;
+    self->parent.free = cork_tee_consumer__free;
+    self->branches = NULL;
+    self->last_branch = NULL;
+    self->has_threads = false;
+    return &self->parent;
+}
+
+int
+cork_tee_consumer_add(struct cork_stream_consumer *vself,
+                      struct cork_stream_consumer *consumer, bool threaded)
+{
+    struct cork_tee_consumer  *self =
+        cork_container_of(vself, struct cork_tee_consumer, parent);
+    struct cork_tee_branch  *branch = cork_new(struct cork_tee_branch);
+    branch->consumer = consumer;
+    branch->thread = NULL;
+    branch->joined = false;
+    branch->head = NULL;
+    branch->tail = NULL;
+    branch->queued = 0;
+    branch->failed = false;
+    branch->next = NULL;
+
+    if (threaded) {
+        pthread_mutex_init(&branch->mutex, NULL);
+        pthread_cond_init(&branch->cond, NULL);
+        branch->thread = cork_thread_new
+            ("tee-branch", branch, NULL, cork_tee_branch__run);
+        if (CORK_UNLIKELY(cork_thread_start(branch->thread) != 0)) {
+            cork_thread_free(branch->thread);
+            pthread_cond_destroy(&branch->cond);
+            pthread_mutex_destroy(&branch->mutex);
+            cork_delete(struct cork_tee_branch, branch);
+            cork_stream_consumer_free(consumer);
+            return -1;
+        }
+        self->has_threads = true;
+    }
+
+    if (self->last_branch == NULL) {
+        self->branches = branch;
+    } else {
+        self->last_branch->next = branch;
+    }
+    self->last_branch = branch;
+    return 0;
+}
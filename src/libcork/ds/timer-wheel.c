@@ -0,0 +1,332 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/callbacks.h"
+#include "libcork/core/timestamp.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/dllist.h"
+#include "libcork/ds/timer-wheel.h"
+
+
+/*-----------------------------------------------------------------------
+ * Wheel layout
+ */
+
+#define CORK_TIMER_WHEEL_LEVEL_BITS  6
+#define CORK_TIMER_WHEEL_SLOT_COUNT  (1 << CORK_TIMER_WHEEL_LEVEL_BITS)
+#define CORK_TIMER_WHEEL_SLOT_MASK  (CORK_TIMER_WHEEL_SLOT_COUNT - 1)
+/* Enough levels to cover every 64-bit tick, so that no timer is ever out of
+ * range. */
+#define CORK_TIMER_WHEEL_LEVEL_COUNT \
+    ((64 + CORK_TIMER_WHEEL_LEVEL_BITS - 1) / CORK_TIMER_WHEEL_LEVEL_BITS)
+
+#define cork_timer_wheel_shift(level)  ((level) * CORK_TIMER_WHEEL_LEVEL_BITS)
+
+struct cork_timer_wheel {
+    struct cork_dllist  slots[CORK_TIMER_WHEEL_LEVEL_COUNT]
+                             [CORK_TIMER_WHEEL_SLOT_COUNT];
+    /* Which slots of each level might have timers in them.  A bit can be set
+     * for a slot whose timers have all been cancelled; we clear it the next
+     * time the slot comes due. */
+    uint64_t  occupied[CORK_TIMER_WHEEL_LEVEL_COUNT];
+    /* Timers that were scheduled for a tick that has already passed */
+    struct cork_dllist  due;
+    /* Every tick up to and including this one has been processed. */
+    uint64_t  current;
+    cork_timestamp  resolution;
+    size_t  size;
+    void  *user_data;
+    cork_free_f  free_user_data;
+    cork_timer_wheel_clock_f  clock;
+};
+
+/* A timer lives at the level of the highest bit where its tick differs from
+ * the current tick, in the slot given by its tick's bits at that level.  That
+ * slot comes due exactly when the current tick's bits above that level catch
+ * up with the timer's. */
+static void
+cork_timer_wheel_add(struct cork_timer_wheel *wheel, struct cork_timer *timer)
+{
+    uint64_t  tick = timer->tick;
+    uint64_t  diff;
+    unsigned int  level;
+    unsigned int  slot;
+
+    if (tick <= wheel->current) {
+        cork_dllist_add_to_tail(&wheel->due, &timer->item);
+        return;
+    }
+    diff = tick ^ wheel->current;
+    level = (63 - __builtin_clzll(diff)) / CORK_TIMER_WHEEL_LEVEL_BITS;
+    slot = (tick >> cork_timer_wheel_shift(level)) &
+        CORK_TIMER_WHEEL_SLOT_MASK;
+    cork_dllist_add_to_tail(&wheel->slots[level][slot], &timer->item);
+    wheel->occupied[level] |= UINT64_C(1) << slot;
+}
+
+static void
+cork_timer_wheel_unlink(struct cork_timer *timer)
+{
+    cork_dllist_remove(&timer->item);
+    timer->item.next = NULL;
+    timer->item.prev = NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Lifecycle
+ */
+
+static void
+cork_timer_wheel_default_clock(void *user_data, cork_timestamp *now)
+{
+    cork_timestamp_init_monotonic_coarse(now);
+}
+
+struct cork_timer_wheel *
+cork_timer_wheel_new(cork_timestamp resolution)
+{
+    struct cork_timer_wheel  *wheel = cork_new(struct cork_timer_wheel);
+    unsigned int  level;
+    unsigned int  slot;
+    for (level = 0; level < CORK_TIMER_WHEEL_LEVEL_COUNT; level++) {
+        for (slot = 0; slot < CORK_TIMER_WHEEL_SLOT_COUNT; slot++) {
+            cork_dllist_init(&wheel->slots[level][slot]);
+        }
+        wheel->occupied[level] = 0;
+    }
+    cork_dllist_init(&wheel->due);
+    wheel->current = 0;
+    wheel->resolution = (resolution == 0)?
+        CORK_TIMER_WHEEL_DEFAULT_RESOLUTION: resolution;
+    wheel->size = 0;
+    wheel->user_data = NULL;
+    wheel->free_user_data = NULL;
+    wheel->clock = cork_timer_wheel_default_clock;
+    return wheel;
+}
+
+static void
+cork_timer_wheel_unlink_list(struct cork_dllist *list)
+{
+    while (!cork_dllist_is_empty(list)) {
+        struct cork_timer  *timer = cork_container_of
+            (cork_dllist_start(list), struct cork_timer, item);
+        cork_timer_wheel_unlink(timer);
+    }
+}
+
+void
+cork_timer_wheel_free(struct cork_timer_wheel *wheel)
+{
+    unsigned int  level;
+    unsigned int  slot;
+    for (level = 0; level < CORK_TIMER_WHEEL_LEVEL_COUNT; level++) {
+        for (slot = 0; slot < CORK_TIMER_WHEEL_SLOT_COUNT; slot++) {
+            cork_timer_wheel_unlink_list(&wheel->slots[level][slot]);
+        }
+    }
+    cork_timer_wheel_unlink_list(&wheel->due);
+    cork_free_user_data(wheel);
+    cork_delete(struct cork_timer_wheel, wheel);
+}
+
+void
+cork_timer_wheel_set_user_data(struct cork_timer_wheel *wheel,
+                               void *user_data, cork_free_f free_user_data)
+{
+    cork_free_user_data(wheel);
+    wheel->user_data = user_data;
+    wheel->free_user_data = free_user_data;
+}
+
+void
+cork_timer_wheel_set_clock(struct cork_timer_wheel *wheel,
+                           cork_timer_wheel_clock_f clock)
+{
+    wheel->clock = clock;
+}
+
+size_t
+cork_timer_wheel_size(const struct cork_timer_wheel *wheel)
+{
+    return wheel->size;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Scheduling
+ */
+
+void
+cork_timer_wheel_schedule(struct cork_timer_wheel *wheel,
+                          struct cork_timer *timer, cork_timestamp expires)
+{
+    cork_timestamp  resolution = wheel->resolution;
+    if (cork_timer_is_scheduled(timer)) {
+        cork_timer_wheel_unlink(timer);
+    } else {
+        wheel->size++;
+    }
+    /* Round up, so that a timer never fires early. */
+    timer->expires = expires;
+    timer->tick = expires / resolution + ((expires % resolution) != 0);
+    cork_timer_wheel_add(wheel, timer);
+}
+
+bool
+cork_timer_wheel_cancel(struct cork_timer_wheel *wheel,
+                        struct cork_timer *timer)
+{
+    if (!cork_timer_is_scheduled(timer)) {
+        return false;
+    }
+    cork_timer_wheel_unlink(timer);
+    wheel->size--;
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Expiring timers
+ */
+
+/* Returns a mask of the slots at a level whose positions are in [start,
+ * end], where a position is a tick shifted down to that level. */
+static uint64_t
+cork_timer_wheel_slot_mask(uint64_t start, uint64_t end)
+{
+    uint64_t  count = end - start + 1;
+    unsigned int  first = start & CORK_TIMER_WHEEL_SLOT_MASK;
+    uint64_t  mask;
+    if (count >= CORK_TIMER_WHEEL_SLOT_COUNT) {
+        return UINT64_MAX;
+    }
+    mask = (UINT64_C(1) << count) - 1;
+    return (first == 0)? mask: (mask << first) | (mask >> (64 - first));
+}
+
+size_t
+cork_timer_wheel_advance(struct cork_timer_wheel *wheel, cork_timestamp now,
+                         cork_timer_wheel_fire_f fire)
+{
+    uint64_t  target = now / wheel->resolution;
+    struct cork_dllist  batch = CORK_DLLIST_INIT(batch);
+    struct cork_dllist  pending = CORK_DLLIST_INIT(pending);
+    size_t  count = 0;
+
+    if (!cork_dllist_is_empty(&wheel->due)) {
+        cork_dllist_add_list_to_tail(&batch, &wheel->due);
+    }
+
+    if (target > wheel->current) {
+        unsigned int  level;
+        for (level = 0; level < CORK_TIMER_WHEEL_LEVEL_COUNT; level++) {
+            unsigned int  shift = cork_timer_wheel_shift(level);
+            uint64_t  start = (wheel->current >> shift) + 1;
+            uint64_t  end = target >> shift;
+            uint64_t  bits;
+            if (end < start) {
+                /* The current tick hasn't moved into a new slot at this
+                 * level, so it hasn't at any higher level either. */
+                break;
+            }
+            bits = wheel->occupied[level] &
+                cork_timer_wheel_slot_mask(start, end);
+            wheel->occupied[level] &= ~bits;
+            while (bits != 0) {
+                unsigned int  slot = __builtin_ctzll(bits);
+                struct cork_dllist  *list = &wheel->slots[level][slot];
+                bits &= bits - 1;
+                if (!cork_dllist_is_empty(list)) {
+                    cork_dllist_add_list_to_tail(&pending, list);
+                }
+            }
+        }
+        wheel->current = target;
+
+        /* Everything in the slots that came due has either expired, or has to
+         * move down to a lower level. */
+        while (!cork_dllist_is_empty(&pending)) {
+            struct cork_timer  *timer = cork_container_of
+                (cork_dllist_start(&pending), struct cork_timer, item);
+            cork_dllist_remove(&timer->item);
+            if (timer->tick <= target) {
+                cork_dllist_add_to_tail(&batch, &timer->item);
+            } else {
+                cork_timer_wheel_add(wheel, timer);
+            }
+        }
+    }
+
+    /* The timers in the batch are still scheduled until they fire, so the
+     * callback can safely cancel any of them. */
+    while (!cork_dllist_is_empty(&batch)) {
+        struct cork_timer  *timer = cork_container_of
+            (cork_dllist_start(&batch), struct cork_timer, item);
+        cork_timer_wheel_unlink(timer);
+        wheel->size--;
+        count++;
+        fire(wheel->user_data, timer);
+    }
+    return count;
+}
+
+size_t
+cork_timer_wheel_poll(struct cork_timer_wheel *wheel,
+                      cork_timer_wheel_fire_f fire)
+{
+    cork_timestamp  now;
+    wheel->clock(wheel->user_data, &now);
+    return cork_timer_wheel_advance(wheel, now, fire);
+}
+
+bool
+cork_timer_wheel_next_expiration(const struct cork_timer_wheel *wheel,
+                                 cork_timestamp *when)
+{
+    uint64_t  best = UINT64_MAX;
+    unsigned int  level;
+
+    if (wheel->size == 0) {
+        return false;
+    }
+    if (!cork_dllist_is_empty(&wheel->due)) {
+        *when = wheel->current * wheel->resolution;
+        return true;
+    }
+
+    for (level = 0; level < CORK_TIMER_WHEEL_LEVEL_COUNT; level++) {
+        unsigned int  shift = cork_timer_wheel_shift(level);
+        uint64_t  current = wheel->current >> shift;
+        uint64_t  bits = wheel->occupied[level];
+        while (bits != 0) {
+            unsigned int  slot = __builtin_ctzll(bits);
+            uint64_t  position;
+            bits &= bits - 1;
+            if (cork_dllist_is_empty(&wheel->slots[level][slot])) {
+                continue;
+            }
+            /* The slot comes due at the first position after the current
+             * one with the same low bits. */
+            position = (current & ~(uint64_t) CORK_TIMER_WHEEL_SLOT_MASK) |
+                slot;
+            if (position <= current) {
+                position += CORK_TIMER_WHEEL_SLOT_COUNT;
+            }
+            if (position <= (UINT64_MAX >> shift) &&
+                (position << shift) < best) {
+                best = position << shift;
+            }
+        }
+    }
+    *when = best * wheel->resolution;
+    return true;
+}
@@ -19,50 +19,104 @@
 #include "libcork/core/attributes.h"
 #include "libcork/core/error.h"
 #include "libcork/core/types.h"
+#include "libcork/ds/array.h"
 #include "libcork/ds/buffer.h"
 #include "libcork/helpers/errors.h"
 #include "libcork/helpers/posix.h"
 #include "libcork/os/files.h"
+#include "libcork/threads/pool.h"
 
 
+/* We open each directory relative to its parent's fd, so that the kernel
+ * doesn't have to resolve the full path of every directory in the tree. */
 static int
-cork_walk_one_directory(struct cork_dir_walker *w, struct cork_buffer *path,
+cork_walk_open_directory(int parent_fd, const char *name, DIR **dir)
+{
+    int  fd;
+    rii_check_posix(fd = openat
+                    (parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (CORK_UNLIKELY((*dir = fdopendir(fd)) == NULL)) {
+        cork_system_error_set();
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+/* Figure out whether a directory entry is a subdirectory or a regular file.
+ * Most filesystems tell us in d_type, so we only have to stat (relative to the
+ * directory's fd) entries that are symlinks, which we follow, or whose type is
+ * unknown. */
+static int
+cork_walk_entry_type(DIR *dir, const struct dirent *entry, mode_t *type)
+{
+    struct stat  info;
+#if defined(DT_UNKNOWN)
+    switch (entry->d_type) {
+        case DT_DIR:
+            *type = S_IFDIR;
+            return 0;
+        case DT_REG:
+            *type = S_IFREG;
+            return 0;
+        case DT_LNK:
+        case DT_UNKNOWN:
+            break;
+        default:
+            *type = 0;
+            return 0;
+    }
+#endif
+    rii_check_posix(fstatat(dirfd(dir), entry->d_name, &info, 0));
+    *type = info.st_mode & S_IFMT;
+    return 0;
+}
+
+#define cork_walk_skip_entry(entry) \
+    ((entry)->d_name[0] == '.' && \
+     ((entry)->d_name[1] == '\0' || \
+      ((entry)->d_name[1] == '.' && (entry)->d_name[2] == '\0')))
+
+static int
+cork_walk_one_directory(struct cork_dir_walker *w, int parent_fd,
+                        const char *name, struct cork_buffer *path,
                         size_t root_path_size)
 {
     DIR  *dir = NULL;
     struct dirent  *entry;
     size_t  dir_path_size;
 
-    rip_check_posix(dir = opendir(path->buf));
+    rii_check(cork_walk_open_directory(parent_fd, name, &dir));
 
     cork_buffer_append(path, "/", 1);
     dir_path_size = path->size;
     errno = 0;
     while ((entry = readdir(dir)) != NULL) {
-        struct stat  info;
+        mode_t  type;
 
         /* Skip the "." and ".." entries */
-        if (strcmp(entry->d_name, ".") == 0 ||
-            strcmp(entry->d_name, "..") == 0) {
+        if (cork_walk_skip_entry(entry)) {
             continue;
         }
 
-        /* Stat the directory entry */
+        /* Find out what kind of entry this is */
         cork_buffer_append_string(path, entry->d_name);
-        ei_check_posix(stat(path->buf, &info));
+        ei_check(cork_walk_entry_type(dir, entry, &type));
 
         /* If the entry is a subdirectory, recurse into it. */
-        if (S_ISDIR(info.st_mode)) {
+        if (S_ISDIR(type)) {
             int  rc = cork_dir_walker_enter_directory
                 (w, path->buf, path->buf + root_path_size,
                  path->buf + dir_path_size);
             if (rc != CORK_SKIP_DIRECTORY) {
-                ei_check(cork_walk_one_directory(w, path, root_path_size));
+                ei_check(cork_walk_one_directory
+                         (w, dirfd(dir), (char *) path->buf + dir_path_size,
+                          path, root_path_size));
                 ei_check(cork_dir_walker_leave_directory
                          (w, path->buf, path->buf + root_path_size,
                           path->buf + dir_path_size));
             }
-        } else if (S_ISREG(info.st_mode)) {
+        } else if (S_ISREG(type)) {
             ei_check(cork_dir_walker_file
                      (w, path->buf, path->buf + root_path_size,
                       path->buf + dir_path_size));
@@ -101,22 +155,177 @@ error:
     return -1;
 }
 
+/* Seed the buffer with the directory's path, ensuring that there's no
+ * trailing '/' */
+static void
+cork_walk_root_path(struct cork_buffer *buf, const char *path)
+{
+    char  *p;
+    cork_buffer_append_string(buf, path);
+    p = buf->buf;
+    while (p[buf->size-1] == '/') {
+        buf->size--;
+        p[buf->size] = '\0';
+    }
+}
+
 int
 cork_walk_directory(const char *path, struct cork_dir_walker *w)
 {
     int  rc;
-    char  *p;
     struct cork_buffer  buf = CORK_BUFFER_INIT();
+    cork_walk_root_path(&buf, path);
+    rc = cork_walk_one_directory(w, AT_FDCWD, buf.buf, &buf, buf.size + 1);
+    cork_buffer_done(&buf);
+    return rc;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Parallel directory walks
+ */
+
+/* We read all of a directory's entries, and report its files, before handing
+ * its subdirectories to the pool.  That lets us close each directory before
+ * walking its children, so the number of open fds doesn't grow with the size
+ * of the tree; the cost is opening each subdirectory by its full path instead
+ * of relative to its parent. */
+
+struct cork_walk_parallel {
+    struct cork_dir_walker  *w;
+    struct cork_thread_pool  *pool;
+    size_t  root_path_size;
+};
 
-    /* Seed the buffer with the directory's path, ensuring that there's no
-     * trailing '/' */
-    cork_buffer_append_string(&buf, path);
-    p = buf.buf;
-    while (p[buf.size-1] == '/') {
-        buf.size--;
-        p[buf.size] = '\0';
+struct cork_walk_subdirs {
+    struct cork_walk_parallel  *pw;
+    struct cork_buffer  *path;
+    /* The names of the subdirectories, separated by NULs. */
+    struct cork_buffer  names;
+    cork_array(size_t)  offsets;
+};
+
+static int
+cork_walk_parallel_directory(struct cork_walk_parallel *pw,
+                             struct cork_buffer *path);
+
+static int
+cork_walk_parallel__subdirs(void *user_data, size_t start, size_t end)
+{
+    struct cork_walk_subdirs  *subdirs = user_data;
+    struct cork_walk_parallel  *pw = subdirs->pw;
+    struct cork_buffer  path = CORK_BUFFER_INIT();
+    size_t  dir_path_size = subdirs->path->size;
+    size_t  i;
+
+    cork_buffer_copy(&path, subdirs->path);
+    for (i = start; i < end; i++) {
+        const char  *name = (char *) subdirs->names.buf +
+            cork_array_at(&subdirs->offsets, i);
+        int  rc;
+        cork_buffer_truncate(&path, dir_path_size);
+        cork_buffer_append_string(&path, name);
+        rc = cork_dir_walker_enter_directory
+            (pw->w, path.buf, (char *) path.buf + pw->root_path_size,
+             (char *) path.buf + dir_path_size);
+        if (rc != CORK_SKIP_DIRECTORY) {
+            ei_check(cork_walk_parallel_directory(pw, &path));
+            ei_check(cork_dir_walker_leave_directory
+                     (pw->w, path.buf, (char *) path.buf + pw->root_path_size,
+                      (char *) path.buf + dir_path_size));
+        }
     }
-    rc = cork_walk_one_directory(w, &buf, buf.size + 1);
+    cork_buffer_done(&path);
+    return 0;
+
+error:
+    cork_buffer_done(&path);
+    return -1;
+}
+
+static int
+cork_walk_parallel_directory(struct cork_walk_parallel *pw,
+                             struct cork_buffer *path)
+{
+    DIR  *dir = NULL;
+    struct dirent  *entry;
+    struct cork_walk_subdirs  subdirs;
+    size_t  dir_path_size;
+    int  rc = -1;
+
+    rii_check(cork_walk_open_directory(AT_FDCWD, path->buf, &dir));
+
+    subdirs.pw = pw;
+    subdirs.path = path;
+    cork_buffer_init(&subdirs.names);
+    cork_array_init(&subdirs.offsets);
+
+    cork_buffer_append(path, "/", 1);
+    dir_path_size = path->size;
+    errno = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        mode_t  type;
+
+        if (cork_walk_skip_entry(entry)) {
+            continue;
+        }
+
+        ei_check(cork_walk_entry_type(dir, entry, &type));
+        if (S_ISDIR(type)) {
+            cork_array_append(&subdirs.offsets, subdirs.names.size);
+            cork_buffer_append(&subdirs.names, entry->d_name,
+                               strlen(entry->d_name) + 1);
+        } else if (S_ISREG(type)) {
+            cork_buffer_append_string(path, entry->d_name);
+            ei_check(cork_dir_walker_file
+                     (pw->w, path->buf, (char *) path->buf + pw->root_path_size,
+                      (char *) path->buf + dir_path_size));
+            cork_buffer_truncate(path, dir_path_size);
+        }
+
+        /* See cork_walk_one_directory for why we reset errno. */
+        errno = 0;
+    }
+
+    if (CORK_UNLIKELY(errno != 0)) {
+        cork_system_error_set();
+        goto error;
+    }
+
+    rc = closedir(dir);
+    dir = NULL;
+    if (CORK_UNLIKELY(rc == -1)) {
+        cork_system_error_set();
+        goto error;
+    }
+
+    rc = cork_thread_pool_parallel_for
+        (pw->pool, 0, cork_array_size(&subdirs.offsets), 1,
+         &subdirs, cork_walk_parallel__subdirs);
+
+error:
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    /* Remove the trailing '/' from the path buffer. */
+    cork_buffer_truncate(path, dir_path_size - 1);
+    cork_buffer_done(&subdirs.names);
+    cork_array_done(&subdirs.offsets);
+    return rc;
+}
+
+int
+cork_walk_directory_parallel(const char *path, struct cork_dir_walker *w,
+                             struct cork_thread_pool *pool)
+{
+    int  rc;
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_walk_parallel  pw;
+    cork_walk_root_path(&buf, path);
+    pw.w = w;
+    pw.pool = pool;
+    pw.root_path_size = buf.size + 1;
+    rc = cork_walk_parallel_directory(&pw, &buf);
     cork_buffer_done(&buf);
     return rc;
 }
@@ -60,6 +60,11 @@ cork_env_var_free(void *vvar)
 struct cork_env {
     struct cork_hash_table  *variables;
     struct cork_buffer  buffer;
+    /* A cached envp array, built by cork_env_envp, and thrown away whenever
+     * the environment changes.  The array and all of its "NAME=value" strings
+     * live in a single allocation of envp_size bytes. */
+    char  **envp;
+    size_t  envp_size;
 };
 
 struct cork_env *
@@ -69,9 +74,21 @@ cork_env_new(void)
     env->variables = cork_string_hash_table_new(0, 0);
     cork_hash_table_set_free_value(env->variables, cork_env_var_free);
     cork_buffer_init(&env->buffer);
+    env->envp = NULL;
+    env->envp_size = 0;
     return env;
 }
 
+static void
+cork_env_invalidate(struct cork_env *env)
+{
+    if (env->envp != NULL) {
+        cork_free(env->envp, env->envp_size);
+        env->envp = NULL;
+        env->envp_size = 0;
+    }
+}
+
 static void
 cork_env_add_internal(struct cork_env *env, const char *name, const char *value)
 {
@@ -81,6 +98,8 @@ cork_env_add_internal(struct cork_env *env, const char *name, const char *value)
         struct cork_env_var  *var = cork_env_var_new(name, value);
         void  *old_var;
 
+        cork_env_invalidate(env);
+
         cork_hash_table_put
             (env->variables, (void *) var->name, var, NULL, NULL, &old_var);
 
@@ -119,6 +138,7 @@ cork_env_clone_current(void)
 void
 cork_env_free(struct cork_env *env)
 {
+    cork_env_invalidate(env);
     cork_hash_table_free(env->variables);
     cork_buffer_done(&env->buffer);
     cork_delete(struct cork_env, env);
@@ -166,10 +186,10 @@ cork_env_remove(struct cork_env *env, const char *name)
     if (env == NULL) {
         unsetenv(name);
     } else {
-        void  *old_var;
-        cork_hash_table_delete(env->variables, (void *) name, NULL, &old_var);
-        if (old_var != NULL) {
-            cork_env_var_free(old_var);
+        /* The table's free_value callback frees the removed variable. */
+        if (cork_hash_table_delete(env->variables, (void *) name,
+                                   NULL, NULL)) {
+            cork_env_invalidate(env);
         }
     }
 }
@@ -205,3 +225,74 @@ cork_env_replace_current(struct cork_env *env)
     clearenv();
     cork_hash_table_map(env->variables, NULL, cork_env_set_vars);
 }
+
+
+struct cork_env_to_string_array {
+    struct cork_string_array  *dest;
+    struct cork_buffer  *buf;
+};
+
+static enum cork_hash_table_map_result
+cork_env_add_to_array(void *user_data, struct cork_hash_table_entry *entry)
+{
+    struct cork_env_to_string_array  *state = user_data;
+    struct cork_env_var  *var = entry->value;
+    cork_buffer_printf(state->buf, "%s=%s", var->name, var->value);
+    cork_string_array_append(state->dest, state->buf->buf);
+    return CORK_HASH_TABLE_MAP_CONTINUE;
+}
+
+void
+cork_env_to_string_array(struct cork_env *env, struct cork_string_array *dest)
+{
+    struct cork_env_to_string_array  state = { dest, &env->buffer };
+    cork_hash_table_map(env->variables, &state, cork_env_add_to_array);
+}
+
+char * const *
+cork_env_envp(struct cork_env *env)
+{
+    struct cork_hash_table_iterator  iter;
+    struct cork_hash_table_entry  *entry;
+    size_t  count;
+    size_t  size;
+    char  *dest;
+    char  **curr;
+
+    if (env == NULL) {
+        return environ;
+    }
+    if (env->envp != NULL) {
+        return env->envp;
+    }
+
+    /* Figure out how much space we need for the pointer array (including its
+     * NULL terminator) and all of the strings... */
+    count = cork_hash_table_size(env->variables);
+    size = (count + 1) * sizeof(char *);
+    cork_hash_table_iterator_init(env->variables, &iter);
+    while ((entry = cork_hash_table_iterator_next(&iter)) != NULL) {
+        struct cork_env_var  *var = entry->value;
+        /* The '=' and the NUL terminator */
+        size += strlen(var->name) + strlen(var->value) + 2;
+    }
+
+    /* ...and then fill them all in. */
+    env->envp = cork_malloc(size);
+    env->envp_size = size;
+    curr = env->envp;
+    dest = (char *) (env->envp + count + 1);
+    cork_hash_table_iterator_init(env->variables, &iter);
+    while ((entry = cork_hash_table_iterator_next(&iter)) != NULL) {
+        struct cork_env_var  *var = entry->value;
+        size_t  name_length = strlen(var->name);
+        size_t  value_length = strlen(var->value);
+        *curr++ = dest;
+        memcpy(dest, var->name, name_length);
+        dest[name_length] = '=';
+        memcpy(dest + name_length + 1, var->value, value_length + 1);
+        dest += name_length + value_length + 2;
+    }
+    *curr = NULL;
+    return env->envp;
+}
@@ -0,0 +1,762 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "libcork/config.h"
+#include "libcork/core/allocator.h"
+#include "libcork/core/callbacks.h"
+#include "libcork/core/error.h"
+#include "libcork/core/timestamp.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/timer-wheel.h"
+#include "libcork/helpers/errors.h"
+#include "libcork/helpers/posix.h"
+#include "libcork/os/event-loop.h"
+#include "libcork/threads/atomics.h"
+#include "libcork/threads/locks.h"
+
+#if CORK_HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif CORK_HAVE_KQUEUE
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+
+#if !defined(CORK_DEBUG_EVENT_LOOP)
+#define CORK_DEBUG_EVENT_LOOP  0
+#endif
+
+#if CORK_DEBUG_EVENT_LOOP
+#include <stdio.h>
+#define DEBUG(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define DEBUG(...) /* no debug messages */
+#endif
+
+
+/*-----------------------------------------------------------------------
+ * Event loops
+ */
+
+/* The most events that we retrieve from the kernel in a single batch */
+#define CORK_EVENT_LOOP_MAX_EVENTS  64
+
+struct cork_loop_task {
+    struct cork_loop_task  *next;
+    void  *user_data;
+    cork_free_f  free_user_data;
+    cork_run_f  run;
+};
+
+struct cork_event_loop {
+    /* The epoll or kqueue fd */
+    int  fd;
+#if CORK_HAVE_EPOLL
+    /* An eventfd that other threads write to, to wake us up */
+    int  wake_fd;
+    struct epoll_event  ready[CORK_EVENT_LOOP_MAX_EVENTS];
+#elif CORK_HAVE_KQUEUE
+    struct kevent  ready[CORK_EVENT_LOOP_MAX_EVENTS];
+#endif
+    /* The number of entries in ready that we haven't dispatched yet.  Removing
+     * a watch clears out any of its entries, so that it doesn't fire after
+     * it's been removed. */
+    size_t  ready_count;
+    struct cork_loop_fd  wake_watch;
+    struct cork_timer_wheel  *timers;
+    /* Set when a timer callback fails, so that we put the rest of the timers
+     * in the batch back, instead of firing them. */
+    bool  timer_failed;
+    cork_timestamp  now;
+    struct cork_mutex  tasks_lock;
+    struct cork_loop_task  *tasks;
+    struct cork_loop_task  **tasks_tail;
+    /* Whether someone has already woken us up since the last time we ran
+     * tasks, so that a burst of posts only costs one syscall. */
+    int  wake_pending;
+    int  stopping;
+    void  *user_data;
+    cork_free_f  free_user_data;
+};
+
+static int
+cork_event_loop_backend_init(struct cork_event_loop *loop);
+
+static void
+cork_event_loop_backend_done(struct cork_event_loop *loop);
+
+static int
+cork_event_loop_backend_update(struct cork_event_loop *loop,
+                               struct cork_loop_fd *watch, bool adding,
+                               unsigned int events);
+
+static int
+cork_event_loop_backend_remove(struct cork_event_loop *loop,
+                               struct cork_loop_fd *watch);
+
+static void
+cork_event_loop_backend_forget(struct cork_event_loop *loop,
+                               struct cork_loop_fd *watch);
+
+static int
+cork_event_loop_backend_wait(struct cork_event_loop *loop, int timeout_ms);
+
+static int
+cork_event_loop_backend_dispatch(struct cork_event_loop *loop);
+
+static void
+cork_event_loop_backend_wake(struct cork_event_loop *loop);
+
+
+static void
+cork_event_loop__fire(void *user_data, struct cork_timer *timer)
+{
+    struct cork_event_loop  *loop = user_data;
+    struct cork_loop_timer  *t =
+        cork_container_of(timer, struct cork_loop_timer, timer);
+    if (loop->timer_failed) {
+        /* This puts the timer into the wheel's list of timers that are
+         * already due, so that it fires in the next batch. */
+        cork_timer_wheel_schedule(loop->timers, timer, timer->expires);
+    } else if (CORK_UNLIKELY(t->callback(loop, t) != 0)) {
+        loop->timer_failed = true;
+    }
+}
+
+struct cork_event_loop *
+cork_event_loop_new(void)
+{
+    struct cork_event_loop  *loop = cork_new(struct cork_event_loop);
+    loop->ready_count = 0;
+    if (cork_event_loop_backend_init(loop) == -1) {
+        cork_delete(struct cork_event_loop, loop);
+        return NULL;
+    }
+    loop->timers = cork_timer_wheel_new(0);
+    cork_timer_wheel_set_user_data(loop->timers, loop, NULL);
+    loop->timer_failed = false;
+    cork_timestamp_init_monotonic(&loop->now);
+    cork_mutex_init(&loop->tasks_lock);
+    loop->tasks = NULL;
+    loop->tasks_tail = &loop->tasks;
+    loop->wake_pending = 0;
+    loop->stopping = 0;
+    loop->user_data = NULL;
+    loop->free_user_data = NULL;
+    return loop;
+}
+
+static void
+cork_loop_task_free(struct cork_loop_task *task)
+{
+    cork_free_user_data(task);
+    cork_delete(struct cork_loop_task, task);
+}
+
+void
+cork_event_loop_free(struct cork_event_loop *loop)
+{
+    struct cork_loop_task  *task = loop->tasks;
+    while (task != NULL) {
+        struct cork_loop_task  *next = task->next;
+        cork_loop_task_free(task);
+        task = next;
+    }
+    cork_mutex_done(&loop->tasks_lock);
+    cork_timer_wheel_free(loop->timers);
+    cork_event_loop_backend_done(loop);
+    cork_free_user_data(loop);
+    cork_delete(struct cork_event_loop, loop);
+}
+
+void
+cork_event_loop_set_user_data(struct cork_event_loop *loop,
+                              void *user_data, cork_free_f free_user_data)
+{
+    cork_free_user_data(loop);
+    loop->user_data = user_data;
+    loop->free_user_data = free_user_data;
+}
+
+void *
+cork_event_loop_user_data(struct cork_event_loop *loop)
+{
+    return loop->user_data;
+}
+
+cork_timestamp
+cork_event_loop_now(struct cork_event_loop *loop)
+{
+    return loop->now;
+}
+
+
+/*-----------------------------------------------------------------------
+ * File descriptors
+ */
+
+int
+cork_event_loop_add_fd(struct cork_event_loop *loop,
+                       struct cork_loop_fd *watch, unsigned int events)
+{
+    DEBUG("Adding fd %d (events 0x%x)\n", watch->fd, events);
+    rii_check(cork_event_loop_backend_update(loop, watch, true, events));
+    watch->events = events;
+    return 0;
+}
+
+int
+cork_event_loop_modify_fd(struct cork_event_loop *loop,
+                          struct cork_loop_fd *watch, unsigned int events)
+{
+    DEBUG("Changing fd %d to events 0x%x\n", watch->fd, events);
+    rii_check(cork_event_loop_backend_update(loop, watch, false, events));
+    watch->events = events;
+    return 0;
+}
+
+int
+cork_event_loop_remove_fd(struct cork_event_loop *loop,
+                          struct cork_loop_fd *watch)
+{
+    DEBUG("Removing fd %d\n", watch->fd);
+    cork_event_loop_backend_forget(loop, watch);
+    rii_check(cork_event_loop_backend_remove(loop, watch));
+    watch->events = 0;
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Timers
+ */
+
+void
+cork_event_loop_schedule(struct cork_event_loop *loop,
+                         struct cork_loop_timer *timer,
+                         cork_timestamp expires)
+{
+    cork_timer_wheel_schedule(loop->timers, &timer->timer, expires);
+}
+
+void
+cork_event_loop_schedule_after(struct cork_event_loop *loop,
+                               struct cork_loop_timer *timer,
+                               cork_timestamp delay)
+{
+    cork_timer_wheel_schedule(loop->timers, &timer->timer, loop->now + delay);
+}
+
+bool
+cork_event_loop_cancel(struct cork_event_loop *loop,
+                       struct cork_loop_timer *timer)
+{
+    return cork_timer_wheel_cancel(loop->timers, &timer->timer);
+}
+
+/* Returns how long we can wait before the next timer expires, in
+ * milliseconds, rounded up. */
+static int
+cork_event_loop_timer_timeout(struct cork_event_loop *loop, int timeout_ms)
+{
+    cork_timestamp  when;
+    cork_timestamp  delay;
+    uint64_t  ms;
+    if (!cork_timer_wheel_next_expiration(loop->timers, &when)) {
+        return timeout_ms;
+    }
+    if (when <= loop->now) {
+        return 0;
+    }
+    delay = when - loop->now;
+    ms = cork_timestamp_sec(delay) * 1000 +
+        (((delay & 0xffffffff) * 1000 + 0xffffffff) >> 32);
+    if (ms > INT_MAX) {
+        ms = INT_MAX;
+    }
+    if (timeout_ms < 0 || (int) ms < timeout_ms) {
+        return ms;
+    }
+    return timeout_ms;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Tasks
+ */
+
+static void
+cork_event_loop_wake(struct cork_event_loop *loop)
+{
+    if (cork_atomic_exchange(&loop->wake_pending, 1, CORK_ATOMIC_ACQ_REL)
+        == 0) {
+        cork_event_loop_backend_wake(loop);
+    }
+}
+
+void
+cork_event_loop_post(struct cork_event_loop *loop, void *user_data,
+                     cork_free_f free_user_data, cork_run_f run)
+{
+    struct cork_loop_task  *task = cork_new(struct cork_loop_task);
+    task->next = NULL;
+    task->user_data = user_data;
+    task->free_user_data = free_user_data;
+    task->run = run;
+    cork_mutex_lock(&loop->tasks_lock);
+    *loop->tasks_tail = task;
+    loop->tasks_tail = &task->next;
+    cork_mutex_unlock(&loop->tasks_lock);
+    cork_event_loop_wake(loop);
+}
+
+static int
+cork_event_loop_run_tasks(struct cork_event_loop *loop)
+{
+    struct cork_loop_task  *task;
+
+    /* Anything posted after we clear the flag might not be in this batch, and
+     * will wake us up again. */
+    cork_atomic_exchange(&loop->wake_pending, 0, CORK_ATOMIC_ACQ_REL);
+    cork_mutex_lock(&loop->tasks_lock);
+    task = loop->tasks;
+    loop->tasks = NULL;
+    loop->tasks_tail = &loop->tasks;
+    cork_mutex_unlock(&loop->tasks_lock);
+
+    while (task != NULL) {
+        struct cork_loop_task  *next = task->next;
+        int  rc = task->run(task->user_data);
+        cork_loop_task_free(task);
+        task = next;
+        if (CORK_UNLIKELY(rc != 0)) {
+            /* Put the rest of the batch back at the front of the queue. */
+            if (task != NULL) {
+                struct cork_loop_task  *last = task;
+                while (last->next != NULL) {
+                    last = last->next;
+                }
+                cork_mutex_lock(&loop->tasks_lock);
+                last->next = loop->tasks;
+                if (loop->tasks == NULL) {
+                    loop->tasks_tail = &last->next;
+                }
+                loop->tasks = task;
+                cork_mutex_unlock(&loop->tasks_lock);
+                cork_event_loop_wake(loop);
+            }
+            return rc;
+        }
+    }
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Running the loop
+ */
+
+int
+cork_event_loop_run_once(struct cork_event_loop *loop, int timeout_ms)
+{
+    timeout_ms = cork_event_loop_timer_timeout(loop, timeout_ms);
+    DEBUG("Waiting for %d ms\n", timeout_ms);
+    rii_check(cork_event_loop_backend_wait(loop, timeout_ms));
+    cork_timestamp_init_monotonic(&loop->now);
+
+    if (CORK_UNLIKELY(cork_event_loop_backend_dispatch(loop) != 0)) {
+        /* The wakeup might have been one of the events that we skipped, so
+         * make sure we don't miss any posted tasks. */
+        cork_event_loop_backend_wake(loop);
+        return -1;
+    }
+
+    loop->timer_failed = false;
+    cork_timer_wheel_advance(loop->timers, loop->now, cork_event_loop__fire);
+    if (CORK_UNLIKELY(loop->timer_failed)) {
+        loop->timer_failed = false;
+        cork_event_loop_backend_wake(loop);
+        return -1;
+    }
+
+    return cork_event_loop_run_tasks(loop);
+}
+
+int
+cork_event_loop_run(struct cork_event_loop *loop)
+{
+    while (cork_atomic_load_acquire(&loop->stopping) == 0) {
+        rii_check(cork_event_loop_run_once(loop, -1));
+    }
+    cork_atomic_store_release(&loop->stopping, 0);
+    return 0;
+}
+
+void
+cork_event_loop_stop(struct cork_event_loop *loop)
+{
+    cork_atomic_store_release(&loop->stopping, 1);
+    cork_event_loop_backend_wake(loop);
+}
+
+
+#if CORK_HAVE_EPOLL
+
+/*-----------------------------------------------------------------------
+ * epoll
+ */
+
+static int
+cork_event_loop__wake(struct cork_event_loop *loop, struct cork_loop_fd *watch,
+                      unsigned int events)
+{
+    uint64_t  count;
+    /* This only fails if we've already drained the counter. */
+    CORK_ATTR_UNUSED ssize_t  rc = read(loop->wake_fd, &count, sizeof(count));
+    return 0;
+}
+
+static uint32_t
+cork_event_loop_epoll_events(unsigned int events)
+{
+    return ((events & CORK_LOOP_READABLE)? EPOLLIN: 0) |
+           ((events & CORK_LOOP_WRITABLE)? EPOLLOUT: 0);
+}
+
+static int
+cork_event_loop_backend_init(struct cork_event_loop *loop)
+{
+    struct epoll_event  ev;
+    rii_check_posix(loop->fd = epoll_create1(EPOLL_CLOEXEC));
+    ei_check_posix(loop->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+    cork_loop_fd_init(&loop->wake_watch, loop->wake_fd, cork_event_loop__wake);
+    loop->wake_watch.events = CORK_LOOP_READABLE;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &loop->wake_watch;
+    if (epoll_ctl(loop->fd, EPOLL_CTL_ADD, loop->wake_fd, &ev) == -1) {
+        cork_system_error_set();
+        close(loop->wake_fd);
+        goto error;
+    }
+    return 0;
+
+error:
+    close(loop->fd);
+    return -1;
+}
+
+static void
+cork_event_loop_backend_done(struct cork_event_loop *loop)
+{
+    close(loop->wake_fd);
+    close(loop->fd);
+}
+
+static int
+cork_event_loop_backend_update(struct cork_event_loop *loop,
+                               struct cork_loop_fd *watch, bool adding,
+                               unsigned int events)
+{
+    struct epoll_event  ev;
+    ev.events = cork_event_loop_epoll_events(events);
+    ev.data.ptr = watch;
+    rii_check_posix(epoll_ctl
+                    (loop->fd, adding? EPOLL_CTL_ADD: EPOLL_CTL_MOD,
+                     watch->fd, &ev));
+    return 0;
+}
+
+static int
+cork_event_loop_backend_remove(struct cork_event_loop *loop,
+                               struct cork_loop_fd *watch)
+{
+    struct epoll_event  ev;
+    ev.events = 0;
+    ev.data.ptr = NULL;
+    rii_check_posix(epoll_ctl(loop->fd, EPOLL_CTL_DEL, watch->fd, &ev));
+    return 0;
+}
+
+static void
+cork_event_loop_backend_forget(struct cork_event_loop *loop,
+                               struct cork_loop_fd *watch)
+{
+    size_t  i;
+    for (i = 0; i < loop->ready_count; i++) {
+        if (loop->ready[i].data.ptr == watch) {
+            loop->ready[i].data.ptr = NULL;
+        }
+    }
+}
+
+static int
+cork_event_loop_backend_wait(struct cork_event_loop *loop, int timeout_ms)
+{
+    int  count = epoll_wait
+        (loop->fd, loop->ready, CORK_EVENT_LOOP_MAX_EVENTS, timeout_ms);
+    if (count == -1) {
+        if (errno == EINTR) {
+            count = 0;
+        } else {
+            cork_system_error_set();
+            return -1;
+        }
+    }
+    DEBUG("Got %d events\n", count);
+    loop->ready_count = count;
+    return 0;
+}
+
+static int
+cork_event_loop_backend_dispatch(struct cork_event_loop *loop)
+{
+    size_t  i;
+    for (i = 0; i < loop->ready_count; i++) {
+        struct cork_loop_fd  *watch = loop->ready[i].data.ptr;
+        uint32_t  ev = loop->ready[i].events;
+        unsigned int  events;
+        if (watch == NULL) {
+            continue;
+        }
+        events = ((ev & EPOLLIN)? CORK_LOOP_READABLE: 0) |
+                 ((ev & EPOLLOUT)? CORK_LOOP_WRITABLE: 0) |
+                 ((ev & (EPOLLERR | EPOLLHUP))? CORK_LOOP_HANGUP: 0);
+        if (CORK_UNLIKELY(watch->callback(loop, watch, events) != 0)) {
+            loop->ready_count = 0;
+            return -1;
+        }
+    }
+    loop->ready_count = 0;
+    return 0;
+}
+
+static void
+cork_event_loop_backend_wake(struct cork_event_loop *loop)
+{
+    uint64_t  one = 1;
+    /* This can only fail if the counter would overflow, in which case the
+     * loop is already awake. */
+    CORK_ATTR_UNUSED ssize_t  rc = write(loop->wake_fd, &one, sizeof(one));
+}
+
+#elif CORK_HAVE_KQUEUE
+
+/*-----------------------------------------------------------------------
+ * kqueue
+ */
+
+/* We use a user event to wake up the loop. */
+#define CORK_EVENT_LOOP_WAKE_IDENT  0
+
+static int
+cork_event_loop__wake(struct cork_event_loop *loop, struct cork_loop_fd *watch,
+                      unsigned int events)
+{
+    /* The event has EV_CLEAR set, so there's nothing to drain. */
+    return 0;
+}
+
+static int
+cork_event_loop_backend_init(struct cork_event_loop *loop)
+{
+    struct kevent  ev;
+    rii_check_posix(loop->fd = kqueue());
+    ei_check_posix(fcntl(loop->fd, F_SETFD, FD_CLOEXEC));
+    cork_loop_fd_init(&loop->wake_watch, -1, cork_event_loop__wake);
+    EV_SET(&ev, CORK_EVENT_LOOP_WAKE_IDENT, EVFILT_USER, EV_ADD | EV_CLEAR,
+           0, 0, &loop->wake_watch);
+    ei_check_posix(kevent(loop->fd, &ev, 1, NULL, 0, NULL));
+    return 0;
+
+error:
+    close(loop->fd);
+    return -1;
+}
+
+static void
+cork_event_loop_backend_done(struct cork_event_loop *loop)
+{
+    close(loop->fd);
+}
+
+static int
+cork_event_loop_backend_update(struct cork_event_loop *loop,
+                               struct cork_loop_fd *watch, bool adding,
+                               unsigned int events)
+{
+    /* kqueue has a separate filter for each kind of event, so we only have to
+     * change the ones that were added or removed. */
+    struct kevent  changes[2];
+    int  count = 0;
+    unsigned int  old_events = adding? 0: watch->events;
+    unsigned int  added = events & ~old_events;
+    unsigned int  removed = old_events & ~events;
+    if (added & CORK_LOOP_READABLE) {
+        EV_SET(&changes[count++], watch->fd, EVFILT_READ, EV_ADD, 0, 0, watch);
+    } else if (removed & CORK_LOOP_READABLE) {
+        EV_SET(&changes[count++], watch->fd, EVFILT_READ, EV_DELETE,
+               0, 0, NULL);
+    }
+    if (added & CORK_LOOP_WRITABLE) {
+        EV_SET(&changes[count++], watch->fd, EVFILT_WRITE, EV_ADD,
+               0, 0, watch);
+    } else if (removed & CORK_LOOP_WRITABLE) {
+        EV_SET(&changes[count++], watch->fd, EVFILT_WRITE, EV_DELETE,
+               0, 0, NULL);
+    }
+    if (count > 0) {
+        rii_check_posix(kevent(loop->fd, changes, count, NULL, 0, NULL));
+    }
+    return 0;
+}
+
+static int
+cork_event_loop_backend_remove(struct cork_event_loop *loop,
+                               struct cork_loop_fd *watch)
+{
+    return cork_event_loop_backend_update(loop, watch, false, 0);
+}
+
+static void
+cork_event_loop_backend_forget(struct cork_event_loop *loop,
+                               struct cork_loop_fd *watch)
+{
+    size_t  i;
+    for (i = 0; i < loop->ready_count; i++) {
+        if ((void *) loop->ready[i].udata == watch) {
+            loop->ready[i].udata = NULL;
+        }
+    }
+}
+
+static int
+cork_event_loop_backend_wait(struct cork_event_loop *loop, int timeout_ms)
+{
+    struct timespec  timeout;
+    int  count;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000;
+    count = kevent(loop->fd, NULL, 0, loop->ready, CORK_EVENT_LOOP_MAX_EVENTS,
+                   (timeout_ms < 0)? NULL: &timeout);
+    if (count == -1) {
+        if (errno == EINTR) {
+            count = 0;
+        } else {
+            cork_system_error_set();
+            return -1;
+        }
+    }
+    DEBUG("Got %d events\n", count);
+    loop->ready_count = count;
+    return 0;
+}
+
+static int
+cork_event_loop_backend_dispatch(struct cork_event_loop *loop)
+{
+    size_t  i;
+    for (i = 0; i < loop->ready_count; i++) {
+        struct kevent  *ev = &loop->ready[i];
+        struct cork_loop_fd  *watch = (void *) ev->udata;
+        unsigned int  events;
+        if (watch == NULL) {
+            continue;
+        }
+        events = ((ev->filter == EVFILT_READ)? CORK_LOOP_READABLE: 0) |
+                 ((ev->filter == EVFILT_WRITE)? CORK_LOOP_WRITABLE: 0) |
+                 ((ev->flags & (EV_EOF | EV_ERROR))? CORK_LOOP_HANGUP: 0);
+        if (CORK_UNLIKELY(watch->callback(loop, watch, events) != 0)) {
+            loop->ready_count = 0;
+            return -1;
+        }
+    }
+    loop->ready_count = 0;
+    return 0;
+}
+
+static void
+cork_event_loop_backend_wake(struct cork_event_loop *loop)
+{
+    struct kevent  ev;
+    EV_SET(&ev, CORK_EVENT_LOOP_WAKE_IDENT, EVFILT_USER, 0, NOTE_TRIGGER,
+           0, &loop->wake_watch);
+    kevent(loop->fd, &ev, 1, NULL, 0, NULL);
+}
+
+#else
+
+/*-----------------------------------------------------------------------
+ * Unsupported platforms
+ */
+
+static int
+cork_event_loop_backend_init(struct cork_event_loop *loop)
+{
+    cork_error_set_printf
+        (ENOSYS, "Event loops aren't supported on this platform");
+    return -1;
+}
+
+/* We can never create a loop on this platform, so none of the rest of these
+ * can be called. */
+
+static void
+cork_event_loop_backend_done(struct cork_event_loop *loop)
+{
+}
+
+static int
+cork_event_loop_backend_update(struct cork_event_loop *loop,
+                               struct cork_loop_fd *watch, bool adding,
+                               unsigned int events)
+{
+    cork_system_error_set_explicit(ENOSYS);
+    return -1;
+}
+
+static int
+cork_event_loop_backend_remove(struct cork_event_loop *loop,
+                               struct cork_loop_fd *watch)
+{
+    cork_system_error_set_explicit(ENOSYS);
+    return -1;
+}
+
+static void
+cork_event_loop_backend_forget(struct cork_event_loop *loop,
+                               struct cork_loop_fd *watch)
+{
+}
+
+static int
+cork_event_loop_backend_wait(struct cork_event_loop *loop, int timeout_ms)
+{
+    cork_system_error_set_explicit(ENOSYS);
+    return -1;
+}
+
+static int
+cork_event_loop_backend_dispatch(struct cork_event_loop *loop)
+{
+    return 0;
+}
+
+static void
+cork_event_loop_backend_wake(struct cork_event_loop *loop)
+{
+}
+
+#endif
@@ -15,6 +15,15 @@
 #include "libcork/os/subprocess.h"
 #include "libcork/helpers/errors.h"
 
+#if defined(__APPLE__)
+/* Apple doesn't provide access to the "environ" variable from a shared
+ * library; see env.c. */
+#include <crt_externs.h>
+#define environ  (*_NSGetEnviron())
+#else
+extern char  **environ;
+#endif
+
 #define ri_check_posix(call) \
     do { \
         while (true) { \
@@ -35,6 +44,8 @@
 
 struct cork_exec {
     const char  *program;
+    /* Always has a NULL terminator at the end, which isn't one of the
+     * parameters, so that we can pass it to exec directly. */
     struct cork_string_array  params;
     struct cork_env  *env;
     const char  *cwd;
@@ -47,6 +58,7 @@ cork_exec_new(const char *program)
     struct cork_exec  *exec = cork_new(struct cork_exec);
     exec->program = cork_strdup(program);
     cork_string_array_init(&exec->params);
+    cork_array_append(&exec->params, NULL);
     exec->env = NULL;
     exec->cwd = NULL;
     cork_buffer_init(&exec->description);
@@ -111,7 +123,7 @@ cork_exec_program(struct cork_exec *exec)
 size_t
 cork_exec_param_count(struct cork_exec *exec)
 {
-    return cork_array_size(&exec->params);
+    return cork_array_size(&exec->params) - 1;
 }
 
 const char *
@@ -125,11 +137,21 @@ cork_exec_add_param(struct cork_exec *exec, const char *param)
 {
     /* Don't add the first parameter to the description; that's a copy of the
      * program name, which we've already added. */
-    if (!cork_array_is_empty(&exec->params)) {
+    size_t  count = cork_exec_param_count(exec);
+    if (count > 0) {
         cork_buffer_append(&exec->description, " ", 1);
         cork_buffer_append_string(&exec->description, param);
     }
-    cork_array_append(&exec->params, cork_strdup(param));
+    /* Replace the NULL terminator with the new parameter, and add a new
+     * terminator after it. */
+    cork_array_at(&exec->params, count) = cork_strdup(param);
+    cork_array_append(&exec->params, NULL);
+}
+
+char * const *
+cork_exec_params(struct cork_exec *exec)
+{
+    return (char * const *) cork_array_elements(&exec->params);
 }
 
 struct cork_env *
@@ -165,15 +187,12 @@ cork_exec_set_cwd(struct cork_exec *exec, const char *directory)
 int
 cork_exec_run(struct cork_exec *exec)
 {
-    const char  **params;
-
-    /* Make sure the parameter array is NULL-terminated. */
-    cork_array_append(&exec->params, NULL);
-    params = cork_array_elements(&exec->params);
-
-    /* Fill in the requested environment */
+    /* Fill in the requested environment.  We're about to replace the
+     * current process, so there's no need to copy each variable into the
+     * environment with setenv; we can point environ at env's cached array
+     * directly. */
     if (exec->env != NULL) {
-        cork_env_replace_current(exec->env);
+        environ = (char **) cork_env_envp(exec->env);
     }
 
     /* Change the working directory, if requested */
@@ -182,7 +201,7 @@ cork_exec_run(struct cork_exec *exec)
     }
 
     /* Execute the new program */
-    ri_check_posix(execvp(exec->program, (char * const *) params));
+    ri_check_posix(execvp(exec->program, cork_exec_params(exec)));
 
     /* This is unreachable */
     return 0;
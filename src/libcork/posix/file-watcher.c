@@ -0,0 +1,927 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "libcork/config.h"
+#include "libcork/core/allocator.h"
+#include "libcork/core/attributes.h"
+#include "libcork/core/error.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/array.h"
+#include "libcork/ds/buffer.h"
+#include "libcork/ds/hash-table.h"
+#include "libcork/helpers/errors.h"
+#include "libcork/helpers/posix.h"
+#include "libcork/os/files.h"
+
+#if CORK_HAVE_INOTIFY
+#include <sys/inotify.h>
+#elif CORK_HAVE_KQUEUE
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+
+#if !defined(CORK_DEBUG_FILE_WATCHER)
+#define CORK_DEBUG_FILE_WATCHER  0
+#endif
+
+#if CORK_DEBUG_FILE_WATCHER
+#include <stdio.h>
+#define DEBUG(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define DEBUG(...) /* no debug messages */
+#endif
+
+
+#if CORK_HAVE_INOTIFY || CORK_HAVE_KQUEUE
+
+/*-----------------------------------------------------------------------
+ * Watches
+ */
+
+/* One file or directory that the kernel is watching for us.  Watches for the
+ * subdirectories of a recursive watch (and, with kqueue, for the files in a
+ * watched directory) share the root_path_size of the path that the caller
+ * asked for, so that we can report every event relative to it. */
+struct cork_file_watch {
+    /* The inotify watch descriptor, or the fd that we've registered with
+     * kqueue */
+    int  id;
+    struct cork_buffer  path;
+    size_t  root_path_size;
+    bool  is_root;
+    bool  recursive;
+#if CORK_HAVE_KQUEUE
+    bool  is_dir;
+    /* The sorted names of a directory's entries as of the last time we read
+     * it, so that we can tell which ones were created or deleted. */
+    struct cork_string_array  entries;
+#endif
+};
+
+struct cork_file_watcher {
+    /* The inotify or kqueue fd */
+    int  fd;
+    /* Owns the watches */
+    struct cork_hash_table  *by_id;
+    struct cork_hash_table  *by_path;
+    struct cork_buffer  event_path;
+    void  *user_data;
+    cork_file_event_f  callback;
+#if CORK_HAVE_INOTIFY
+    char  *buf;
+#endif
+};
+
+#define cork_file_watch_id_key(id)  ((void *) (intptr_t) (id))
+
+static void
+cork_file_watch__free(void *vwatch)
+{
+    struct cork_file_watch  *watch = vwatch;
+#if CORK_HAVE_KQUEUE
+    close(watch->id);
+    cork_array_done(&watch->entries);
+#endif
+    cork_buffer_done(&watch->path);
+    cork_delete(struct cork_file_watch, watch);
+}
+
+static struct cork_file_watch *
+cork_file_watch_new(int id, const char *path, size_t root_path_size,
+                    bool is_root, bool recursive)
+{
+    struct cork_file_watch  *watch = cork_new(struct cork_file_watch);
+    watch->id = id;
+    cork_buffer_init(&watch->path);
+    cork_buffer_set_string(&watch->path, path);
+    watch->root_path_size = root_path_size;
+    watch->is_root = is_root;
+    watch->recursive = recursive;
+#if CORK_HAVE_KQUEUE
+    watch->is_dir = false;
+    cork_string_array_init(&watch->entries);
+#endif
+    return watch;
+}
+
+static void
+cork_file_watcher_register(struct cork_file_watcher *w,
+                           struct cork_file_watch *watch)
+{
+    cork_hash_table_put
+        (w->by_id, cork_file_watch_id_key(watch->id), watch, NULL, NULL, NULL);
+    cork_hash_table_put
+        (w->by_path, watch->path.buf, watch, NULL, NULL, NULL);
+}
+
+/* Forgets about a watch, and frees it.  (This doesn't tell the kernel to stop
+ * watching the file; see cork_file_watcher_unwatch.) */
+static void
+cork_file_watcher_forget(struct cork_file_watcher *w,
+                         struct cork_file_watch *watch)
+{
+    /* If a file was deleted and recreated, its path might already belong to
+     * a newer watch. */
+    if (cork_hash_table_get(w->by_path, watch->path.buf) == watch) {
+        cork_hash_table_delete(w->by_path, watch->path.buf, NULL, NULL);
+    }
+    /* This frees the watch */
+    cork_hash_table_delete
+        (w->by_id, cork_file_watch_id_key(watch->id), NULL, NULL);
+}
+
+static void
+cork_file_watcher_unwatch(struct cork_file_watcher *w,
+                          struct cork_file_watch *watch);
+
+struct cork_file_watcher_subtree {
+    const char  *path;
+    size_t  path_size;
+    cork_array(struct cork_file_watch *)  found;
+};
+
+static enum cork_hash_table_map_result
+cork_file_watcher__find_subtree(void *user_data,
+                                struct cork_hash_table_entry *entry)
+{
+    struct cork_file_watcher_subtree  *subtree = user_data;
+    struct cork_file_watch  *watch = entry->value;
+    const char  *path = watch->path.buf;
+    if (memcmp(path, subtree->path, subtree->path_size) == 0 &&
+        (path[subtree->path_size] == '\0' ||
+         path[subtree->path_size] == '/')) {
+        cork_array_append(&subtree->found, watch);
+    }
+    return CORK_HASH_TABLE_MAP_CONTINUE;
+}
+
+/* Stop watching path, and everything beneath it. */
+static void
+cork_file_watcher_unwatch_tree(struct cork_file_watcher *w, const char *path)
+{
+    struct cork_file_watcher_subtree  subtree;
+    size_t  i;
+    subtree.path = path;
+    subtree.path_size = strlen(path);
+    cork_array_init(&subtree.found);
+    cork_hash_table_map(w->by_path, &subtree, cork_file_watcher__find_subtree);
+    for (i = 0; i < cork_array_size(&subtree.found); i++) {
+        struct cork_file_watch  *watch = cork_array_at(&subtree.found, i);
+        DEBUG("[watch] Unwatching %s\n", (char *) watch->path.buf);
+        cork_file_watcher_unwatch(w, watch);
+    }
+    cork_array_done(&subtree.found);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Reporting events
+ */
+
+/* Reports an event for name within the watched directory, or for the watched
+ * path itself if name is NULL. */
+static int
+cork_file_watcher_report(struct cork_file_watcher *w,
+                         const struct cork_file_watch *watch,
+                         const char *name, enum cork_file_event_type type)
+{
+    struct cork_file_event  event;
+    cork_buffer_copy(&w->event_path, &watch->path);
+    if (name != NULL) {
+        cork_buffer_append(&w->event_path, "/", 1);
+        cork_buffer_append_string(&w->event_path, name);
+    }
+    event.type = type;
+    event.full_path = w->event_path.buf;
+    if (w->event_path.size < watch->root_path_size) {
+        event.rel_path = "";
+    } else {
+        event.rel_path = event.full_path + watch->root_path_size;
+    }
+    DEBUG("[watch] Event %d for %s\n", (int) type, event.full_path);
+    return w->callback(w->user_data, &event);
+}
+
+static int
+cork_file_watcher_report_lost(struct cork_file_watcher *w)
+{
+    struct cork_file_event  event;
+    event.type = CORK_FILE_EVENTS_LOST;
+    event.full_path = NULL;
+    event.rel_path = NULL;
+    DEBUG("[watch] Lost events\n");
+    return w->callback(w->user_data, &event);
+}
+
+/* A file or directory that was created while we weren't looking (typically
+ * because it was created at the same time as its parent directory) might
+ * have been deleted again before we got to it.  That's not an error. */
+static int
+cork_file_watcher_ignore_vanished(int rc)
+{
+    if (rc != 0 &&
+        (cork_error_code() == ENOENT || cork_error_code() == ENOTDIR)) {
+        cork_error_clear();
+        return 0;
+    }
+    return rc;
+}
+
+#endif  /* CORK_HAVE_INOTIFY || CORK_HAVE_KQUEUE */
+
+
+#if CORK_HAVE_INOTIFY
+
+/*-----------------------------------------------------------------------
+ * inotify
+ */
+
+#define CORK_FILE_WATCHER_MASK \
+    (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+     IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/* Enough for many events at once; each one is 16 bytes plus the name. */
+#define CORK_FILE_WATCHER_BUF_SIZE  65536
+
+static void
+cork_file_watcher_unwatch(struct cork_file_watcher *w,
+                          struct cork_file_watch *watch)
+{
+    /* We'll receive an IN_IGNORED event for the watch descriptor, which
+     * we'll ignore because we've already forgotten about it. */
+    inotify_rm_watch(w->fd, watch->id);
+    cork_file_watcher_forget(w, watch);
+}
+
+static int
+cork_file_watcher_watch(struct cork_file_watcher *w, const char *path,
+                        size_t root_path_size, bool is_root, bool recursive)
+{
+    struct cork_file_watch  *watch;
+    int  wd;
+
+    DEBUG("[watch] Watching %s\n", path);
+    rii_check_posix(wd = inotify_add_watch
+                    (w->fd, path, CORK_FILE_WATCHER_MASK));
+    watch = cork_hash_table_get(w->by_id, cork_file_watch_id_key(wd));
+    if (watch != NULL) {
+        /* inotify gives us the same watch descriptor if we're already
+         * watching this file, possibly under a different name. */
+        if (is_root) {
+            watch->is_root = true;
+        }
+        return 0;
+    }
+
+    watch = cork_file_watch_new(wd, path, root_path_size, is_root, recursive);
+    cork_file_watcher_register(w, watch);
+    return 0;
+}
+
+/* Adds watches for every subdirectory of a recursively watched directory.
+ * If report is true, the subdirectory is new, so we also report everything
+ * that we find in it, since it was probably created before we could start
+ * watching it. */
+struct cork_file_watcher_scan {
+    struct cork_dir_walker  parent;
+    struct cork_file_watcher  *w;
+    size_t  root_path_size;
+    bool  report;
+};
+
+static int
+cork_file_watcher_scan_report(struct cork_file_watcher_scan *scan,
+                              const char *full_path,
+                              enum cork_file_event_type type)
+{
+    struct cork_file_event  event;
+    if (!scan->report) {
+        return 0;
+    }
+    event.type = type;
+    event.full_path = full_path;
+    event.rel_path = full_path + scan->root_path_size;
+    return scan->w->callback(scan->w->user_data, &event);
+}
+
+static int
+cork_file_watcher_scan__enter_directory(struct cork_dir_walker *walker,
+                                        const char *full_path,
+                                        const char *rel_path,
+                                        const char *base_name)
+{
+    struct cork_file_watcher_scan  *scan =
+        cork_container_of(walker, struct cork_file_watcher_scan, parent);
+    rii_check(cork_file_watcher_ignore_vanished
+              (cork_file_watcher_watch
+               (scan->w, full_path, scan->root_path_size, false, true)));
+    return cork_file_watcher_scan_report(scan, full_path, CORK_FILE_CREATED);
+}
+
+static int
+cork_file_watcher_scan__file(struct cork_dir_walker *walker,
+                             const char *full_path, const char *rel_path,
+                             const char *base_name)
+{
+    struct cork_file_watcher_scan  *scan =
+        cork_container_of(walker, struct cork_file_watcher_scan, parent);
+    return cork_file_watcher_scan_report(scan, full_path, CORK_FILE_CREATED);
+}
+
+static int
+cork_file_watcher_scan__leave_directory(struct cork_dir_walker *walker,
+                                        const char *full_path,
+                                        const char *rel_path,
+                                        const char *base_name)
+{
+    return 0;
+}
+
+static int
+cork_file_watcher_scan(struct cork_file_watcher *w, const char *path,
+                       size_t root_path_size, bool report)
+{
+    struct cork_file_watcher_scan  scan;
+    scan.parent.enter_directory = cork_file_watcher_scan__enter_directory;
+    scan.parent.file = cork_file_watcher_scan__file;
+    scan.parent.leave_directory = cork_file_watcher_scan__leave_directory;
+    scan.w = w;
+    scan.root_path_size = root_path_size;
+    scan.report = report;
+    return cork_walk_directory(path, &scan.parent);
+}
+
+static int
+cork_file_watcher_add_watch(struct cork_file_watcher *w, const char *path,
+                            size_t root_path_size, bool recursive)
+{
+    struct stat  info;
+    rii_check(cork_file_watcher_watch(w, path, root_path_size, true, recursive));
+    rii_check_posix(stat(path, &info));
+    if (recursive && S_ISDIR(info.st_mode)) {
+        rii_check(cork_file_watcher_scan(w, path, root_path_size, false));
+    }
+    return 0;
+}
+
+static int
+cork_file_watcher_handle(struct cork_file_watcher *w,
+                         const struct inotify_event *ev)
+{
+    struct cork_file_watch  *watch;
+    const char  *name = (ev->len > 0)? ev->name: NULL;
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+        return cork_file_watcher_report_lost(w);
+    }
+
+    watch = cork_hash_table_get(w->by_id, cork_file_watch_id_key(ev->wd));
+    if (watch == NULL) {
+        /* An event for a watch that we've already removed */
+        return 0;
+    }
+
+    if (ev->mask & IN_IGNORED) {
+        /* The kernel has removed the watch, because the file was deleted or
+         * its filesystem was unmounted. */
+        cork_file_watcher_forget(w, watch);
+        return 0;
+    }
+
+    if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+        /* If this is a subdirectory, we'll have already reported its deletion
+         * via an event for its parent directory. */
+        if (watch->is_root) {
+            rii_check(cork_file_watcher_report
+                      (w, watch, NULL, CORK_FILE_DELETED));
+        }
+        if (ev->mask & IN_MOVE_SELF) {
+            cork_file_watcher_unwatch_tree(w, watch->path.buf);
+        }
+        return 0;
+    }
+
+    if (name == NULL && !watch->is_root) {
+        /* A change to a subdirectory itself, which its parent reports for
+         * us. */
+        return 0;
+    }
+
+    if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+        rii_check(cork_file_watcher_report
+                  (w, watch, name, CORK_FILE_CREATED));
+        if ((ev->mask & IN_ISDIR) && watch->recursive) {
+            /* Make sure that we have a copy of the new directory's path that
+             * the callback can't overwrite. */
+            struct cork_buffer  path = CORK_BUFFER_INIT();
+            int  rc;
+            cork_buffer_copy(&path, &w->event_path);
+            rc = cork_file_watcher_ignore_vanished
+                (cork_file_watcher_watch
+                 (w, path.buf, watch->root_path_size, false, true));
+            if (rc == 0) {
+                rc = cork_file_watcher_ignore_vanished
+                    (cork_file_watcher_scan
+                     (w, path.buf, watch->root_path_size, true));
+            }
+            cork_buffer_done(&path);
+            return rc;
+        }
+        return 0;
+    }
+
+    if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        rii_check(cork_file_watcher_report
+                  (w, watch, name, CORK_FILE_DELETED));
+        if ((ev->mask & (IN_ISDIR | IN_MOVED_FROM)) ==
+            (IN_ISDIR | IN_MOVED_FROM) && watch->recursive) {
+            /* The kernel keeps watching a directory that's been moved, but
+             * we'd report its events under its old name. */
+            struct cork_buffer  path = CORK_BUFFER_INIT();
+            cork_buffer_copy(&path, &w->event_path);
+            cork_file_watcher_unwatch_tree(w, path.buf);
+            cork_buffer_done(&path);
+        }
+        return 0;
+    }
+
+    if (ev->mask & (IN_MODIFY | IN_ATTRIB)) {
+        return cork_file_watcher_report(w, watch, name, CORK_FILE_MODIFIED);
+    }
+
+    return 0;
+}
+
+static int
+cork_file_watcher_init(struct cork_file_watcher *w)
+{
+    rii_check_posix(w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+    w->buf = cork_malloc(CORK_FILE_WATCHER_BUF_SIZE);
+    return 0;
+}
+
+static void
+cork_file_watcher_done(struct cork_file_watcher *w)
+{
+    cork_free(w->buf, CORK_FILE_WATCHER_BUF_SIZE);
+}
+
+static int
+cork_file_watcher_dispatch(struct cork_file_watcher *w)
+{
+    while (true) {
+        ssize_t  bytes_read;
+        const char  *curr;
+        const char  *end;
+
+        bytes_read = read(w->fd, w->buf, CORK_FILE_WATCHER_BUF_SIZE);
+        if (bytes_read == -1) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return 0;
+            }
+            cork_system_error_set();
+            return -1;
+        }
+
+        curr = w->buf;
+        end = w->buf + bytes_read;
+        while (curr < end) {
+            const struct inotify_event  *ev = (const void *) curr;
+            rii_check(cork_file_watcher_handle(w, ev));
+            curr += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+
+#elif CORK_HAVE_KQUEUE
+
+/*-----------------------------------------------------------------------
+ * kqueue
+ */
+
+/* kqueue can only tell us that a directory has changed, so we keep a list of
+ * each directory's entries, and compare them to its new contents.  It also
+ * needs an open fd for every file that we want modification events for, so
+ * we watch each of the files in a watched directory, too. */
+
+#if defined(O_EVTONLY)
+#define CORK_FILE_WATCHER_OPEN_FLAGS  (O_EVTONLY | O_CLOEXEC)
+#else
+#define CORK_FILE_WATCHER_OPEN_FLAGS  (O_RDONLY | O_CLOEXEC)
+#endif
+
+#define CORK_FILE_WATCHER_NOTES \
+    (NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME)
+
+static void
+cork_file_watcher_unwatch(struct cork_file_watcher *w,
+                          struct cork_file_watch *watch)
+{
+    /* Closing the fd removes it from the kqueue. */
+    cork_file_watcher_forget(w, watch);
+}
+
+static int
+cork_file_watcher__compare_names(const void *va, const void *vb)
+{
+    const char * const  *a = va;
+    const char * const  *b = vb;
+    return strcmp(*a, *b);
+}
+
+/* Fills in entries with the sorted names of the directory's entries. */
+static int
+cork_file_watcher_read_entries(const char *path,
+                               struct cork_string_array *entries)
+{
+    DIR  *dir;
+    struct dirent  *entry;
+
+    rip_check_posix(dir = opendir(path));
+    errno = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") != 0 &&
+            strcmp(entry->d_name, "..") != 0) {
+            cork_string_array_append(entries, entry->d_name);
+        }
+        errno = 0;
+    }
+    if (CORK_UNLIKELY(errno != 0)) {
+        cork_system_error_set();
+        closedir(dir);
+        return -1;
+    }
+    closedir(dir);
+    qsort(cork_array_elements(entries), cork_array_size(entries),
+          sizeof(const char *), cork_file_watcher__compare_names);
+    return 0;
+}
+
+static int
+cork_file_watcher_watch(struct cork_file_watcher *w, const char *path,
+                        size_t root_path_size, bool is_root, bool recursive,
+                        bool report);
+
+/* Start watching an entry of a directory that we're watching.  Files always
+ * get their own watches, so that we can report when they're modified;
+ * subdirectories only do if we're watching the directory recursively. */
+static int
+cork_file_watcher_watch_entry(struct cork_file_watcher *w,
+                              struct cork_file_watch *dir, const char *name,
+                              bool report)
+{
+    struct cork_buffer  path = CORK_BUFFER_INIT();
+    struct stat  info;
+    int  rc;
+
+    cork_buffer_printf(&path, "%s/%s", (char *) dir->path.buf, name);
+    rc = lstat(path.buf, &info);
+    if (rc == -1) {
+        cork_system_error_set();
+    } else if (S_ISREG(info.st_mode) ||
+               (S_ISDIR(info.st_mode) && dir->recursive)) {
+        rc = cork_file_watcher_watch
+            (w, path.buf, dir->root_path_size, false, dir->recursive, report);
+    }
+    cork_buffer_done(&path);
+    return cork_file_watcher_ignore_vanished(rc);
+}
+
+static int
+cork_file_watcher_watch(struct cork_file_watcher *w, const char *path,
+                        size_t root_path_size, bool is_root, bool recursive,
+                        bool report)
+{
+    struct cork_file_watch  *watch;
+    struct kevent  change;
+    struct stat  info;
+    size_t  i;
+    int  fd;
+
+    if (cork_hash_table_get(w->by_path, path) != NULL) {
+        return 0;
+    }
+
+    DEBUG("[watch] Watching %s\n", path);
+    rii_check_posix(fd = open(path, CORK_FILE_WATCHER_OPEN_FLAGS));
+    if (fstat(fd, &info) == -1) {
+        cork_system_error_set();
+        close(fd);
+        return -1;
+    }
+    EV_SET(&change, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+           CORK_FILE_WATCHER_NOTES, 0, NULL);
+    if (kevent(w->fd, &change, 1, NULL, 0, NULL) == -1) {
+        cork_system_error_set();
+        close(fd);
+        return -1;
+    }
+
+    watch = cork_file_watch_new(fd, path, root_path_size, is_root, recursive);
+    cork_file_watcher_register(w, watch);
+
+    if (S_ISDIR(info.st_mode)) {
+        watch->is_dir = true;
+        rii_check(cork_file_watcher_read_entries(path, &watch->entries));
+        for (i = 0; i < cork_array_size(&watch->entries); i++) {
+            const char  *name = cork_array_at(&watch->entries, i);
+            if (report) {
+                rii_check(cork_file_watcher_report
+                          (w, watch, name, CORK_FILE_CREATED));
+            }
+            rii_check(cork_file_watcher_watch_entry(w, watch, name, report));
+        }
+    }
+    return 0;
+}
+
+static int
+cork_file_watcher_add_watch(struct cork_file_watcher *w, const char *path,
+                            size_t root_path_size, bool recursive)
+{
+    return cork_file_watcher_watch
+        (w, path, root_path_size, true, recursive, false);
+}
+
+/* Compare a directory's current contents to what we saw last time. */
+static int
+cork_file_watcher_rescan(struct cork_file_watcher *w,
+                         struct cork_file_watch *watch)
+{
+    struct cork_string_array  old_entries = watch->entries;
+    struct cork_string_array  *new_entries = &watch->entries;
+    size_t  i = 0;
+    size_t  j = 0;
+    int  rc;
+
+    cork_string_array_init(new_entries);
+    rc = cork_file_watcher_read_entries(watch->path.buf, new_entries);
+    if (rc != 0) {
+        cork_array_done(&old_entries);
+        return cork_file_watcher_ignore_vanished(rc);
+    }
+
+    /* Both lists are sorted, so we can merge them. */
+    while (i < cork_array_size(&old_entries) ||
+           j < cork_array_size(new_entries)) {
+        const char  *old_name = (i < cork_array_size(&old_entries))?
+            cork_array_at(&old_entries, i): NULL;
+        const char  *new_name = (j < cork_array_size(new_entries))?
+            cork_array_at(new_entries, j): NULL;
+        int  cmp;
+        if (old_name == NULL) {
+            cmp = 1;
+        } else if (new_name == NULL) {
+            cmp = -1;
+        } else {
+            cmp = strcmp(old_name, new_name);
+        }
+
+        if (cmp < 0) {
+            ei_check(cork_file_watcher_report
+                     (w, watch, old_name, CORK_FILE_DELETED));
+            cork_file_watcher_unwatch_tree(w, w->event_path.buf);
+            i++;
+        } else if (cmp > 0) {
+            ei_check(cork_file_watcher_report
+                     (w, watch, new_name, CORK_FILE_CREATED));
+            ei_check(cork_file_watcher_watch_entry(w, watch, new_name, true));
+            j++;
+        } else {
+            i++;
+            j++;
+        }
+    }
+
+    cork_array_done(&old_entries);
+    return 0;
+
+error:
+    cork_array_done(&old_entries);
+    return -1;
+}
+
+static int
+cork_file_watcher_handle(struct cork_file_watcher *w,
+                         const struct kevent *ev)
+{
+    struct cork_file_watch  *watch =
+        cork_hash_table_get(w->by_id, cork_file_watch_id_key(ev->ident));
+    if (watch == NULL) {
+        return 0;
+    }
+
+    if (ev->fflags & (NOTE_DELETE | NOTE_RENAME)) {
+        /* If this isn't the root, we'll report the deletion when we rescan
+         * its parent directory. */
+        if (watch->is_root) {
+            rii_check(cork_file_watcher_report
+                      (w, watch, NULL, CORK_FILE_DELETED));
+            cork_file_watcher_unwatch_tree(w, watch->path.buf);
+        }
+        return 0;
+    }
+
+    if (watch->is_dir) {
+        if (ev->fflags & NOTE_WRITE) {
+            return cork_file_watcher_rescan(w, watch);
+        }
+        return 0;
+    }
+
+    if (ev->fflags & (NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB)) {
+        return cork_file_watcher_report(w, watch, NULL, CORK_FILE_MODIFIED);
+    }
+    return 0;
+}
+
+static int
+cork_file_watcher_init(struct cork_file_watcher *w)
+{
+    rii_check_posix(w->fd = kqueue());
+    if (fcntl(w->fd, F_SETFD, FD_CLOEXEC) == -1) {
+        cork_system_error_set();
+        close(w->fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+cork_file_watcher_done(struct cork_file_watcher *w)
+{
+}
+
+static int
+cork_file_watcher_dispatch(struct cork_file_watcher *w)
+{
+    /* We retrieve one event at a time, since handling an event can close
+     * the fds of other watches, which removes any of their pending events
+     * from the kqueue. */
+    struct timespec  zero = { 0, 0 };
+    while (true) {
+        struct kevent  ev;
+        int  count = kevent(w->fd, NULL, 0, &ev, 1, &zero);
+        if (count == -1) {
+            if (errno == EINTR) {
+                return 0;
+            }
+            cork_system_error_set();
+            return -1;
+        } else if (count == 0) {
+            return 0;
+        }
+        rii_check(cork_file_watcher_handle(w, &ev));
+    }
+}
+
+#endif  /* CORK_HAVE_KQUEUE */
+
+
+#if CORK_HAVE_INOTIFY || CORK_HAVE_KQUEUE
+
+/*-----------------------------------------------------------------------
+ * File watchers
+ */
+
+struct cork_file_watcher *
+cork_file_watcher_new(void)
+{
+    struct cork_file_watcher  *w = cork_new(struct cork_file_watcher);
+    if (cork_file_watcher_init(w) == -1) {
+        cork_delete(struct cork_file_watcher, w);
+        return NULL;
+    }
+    w->by_id = cork_pointer_hash_table_new(0, 0);
+    cork_hash_table_set_free_value(w->by_id, cork_file_watch__free);
+    w->by_path = cork_string_hash_table_new(0, 0);
+    cork_buffer_init(&w->event_path);
+    w->user_data = NULL;
+    w->callback = NULL;
+    return w;
+}
+
+void
+cork_file_watcher_free(struct cork_file_watcher *w)
+{
+    /* Frees all of the watches first, since with kqueue, each one has an fd
+     * registered with the kqueue. */
+    cork_hash_table_free(w->by_path);
+    cork_hash_table_free(w->by_id);
+    cork_file_watcher_done(w);
+    close(w->fd);
+    cork_buffer_done(&w->event_path);
+    cork_delete(struct cork_file_watcher, w);
+}
+
+int
+cork_file_watcher_add(struct cork_file_watcher *w, const char *path,
+                      unsigned int flags)
+{
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    int  rc;
+
+    /* Make sure that there's no trailing '/', so that we can append entry
+     * names to the path. */
+    cork_buffer_set_string(&buf, path);
+    while (buf.size > 1 && ((char *) buf.buf)[buf.size - 1] == '/') {
+        cork_buffer_truncate(&buf, buf.size - 1);
+    }
+    rc = cork_file_watcher_add_watch
+        (w, buf.buf, buf.size + 1, (flags & CORK_FILE_RECURSIVE) != 0);
+    cork_buffer_done(&buf);
+    return rc;
+}
+
+int
+cork_file_watcher_fd(struct cork_file_watcher *w)
+{
+    return w->fd;
+}
+
+int
+cork_file_watcher_process(struct cork_file_watcher *w, int timeout_ms,
+                          void *user_data, cork_file_event_f callback)
+{
+    struct pollfd  pfd;
+    int  rc;
+
+    pfd.fd = w->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    rc = poll(&pfd, 1, timeout_ms);
+    if (rc == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        cork_system_error_set();
+        return -1;
+    } else if (rc == 0) {
+        return 0;
+    }
+
+    w->user_data = user_data;
+    w->callback = callback;
+    return cork_file_watcher_dispatch(w);
+}
+
+#else
+
+/*-----------------------------------------------------------------------
+ * Unsupported platforms
+ */
+
+struct cork_file_watcher *
+cork_file_watcher_new(void)
+{
+    cork_error_set_printf
+        (ENOSYS, "File watchers aren't supported on this platform");
+    return NULL;
+}
+
+void
+cork_file_watcher_free(struct cork_file_watcher *w)
+{
+}
+
+int
+cork_file_watcher_add(struct cork_file_watcher *w, const char *path,
+                      unsigned int flags)
+{
+    cork_system_error_set_explicit(ENOSYS);
+    return -1;
+}
+
+int
+cork_file_watcher_fd(struct cork_file_watcher *w)
+{
+    return -1;
+}
+
+int
+cork_file_watcher_process(struct cork_file_watcher *w, int timeout_ms,
+                          void *user_data, cork_file_event_f callback)
+{
+    cork_system_error_set_explicit(ENOSYS);
+    return -1;
+}
+
+#endif
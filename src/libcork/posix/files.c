@@ -7,9 +7,12 @@
  * ----------------------------------------------------------------------
  */
 
-#ifdef __GNU__
+/* We need _GNU_SOURCE for statx on Linux */
+#if defined(__GNU__) || defined(__linux__)
+#ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
+#endif
 #include <assert.h>
 #include <dirent.h>
 #include <errno.h>
@@ -24,10 +27,17 @@
 #include "libcork/core/types.h"
 #include "libcork/ds/array.h"
 #include "libcork/ds/buffer.h"
+#include "libcork/ds/hash-table.h"
 #include "libcork/helpers/errors.h"
 #include "libcork/helpers/posix.h"
 #include "libcork/os/files.h"
 #include "libcork/os/subprocess.h"
+#include "libcork/threads/pool.h"
+
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
 
 
 #if !defined(CORK_DEBUG_FILES)
@@ -281,6 +291,172 @@ cork_path_dirname(const struct cork_path *other)
 }
 
 
+/* These use the same rules as cork_path_set_basename and
+ * cork_path_set_dirname, but only point into the original path. */
+
+static const char *
+cork_path_str_last_slash(const char *given, size_t size)
+{
+    while (size > 0) {
+        if (given[--size] == '/') {
+            return given + size;
+        }
+    }
+    return NULL;
+}
+
+static void
+cork_path_str_basename_slice(const char *given, size_t size,
+                             struct cork_slice *dest)
+{
+    const char  *last_slash = cork_path_str_last_slash(given, size);
+    if (last_slash == NULL) {
+        cork_slice_init_static(dest, given, size);
+    } else {
+        size_t  offset = last_slash - given;
+        cork_slice_init_static(dest, last_slash + 1, size - offset - 1);
+    }
+}
+
+static void
+cork_path_str_dirname_slice(const char *given, size_t size,
+                            struct cork_slice *dest)
+{
+    const char  *last_slash = cork_path_str_last_slash(given, size);
+    if (last_slash == NULL) {
+        cork_slice_init_static(dest, given, 0);
+    } else {
+        size_t  offset = last_slash - given;
+        /* A special case for the immediate subdirectories of "/" */
+        cork_slice_init_static(dest, given, (offset == 0)? 1: offset);
+    }
+}
+
+void
+cork_path_basename_slice(const struct cork_path *path, struct cork_slice *dest)
+{
+    cork_path_str_basename_slice(path->given.buf, path->given.size, dest);
+}
+
+void
+cork_path_dirname_slice(const struct cork_path *path, struct cork_slice *dest)
+{
+    cork_path_str_dirname_slice(path->given.buf, path->given.size, dest);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Path builders
+ */
+
+static void
+cork_path_builder_ensure_size(struct cork_path_builder *builder, size_t size)
+{
+    size_t  new_size;
+    if (CORK_LIKELY(size < builder->allocated_size)) {
+        return;
+    }
+
+    new_size = builder->allocated_size * 2;
+    if (new_size <= size) {
+        new_size = size + 1;
+    }
+    if (builder->buf == builder->inline_buf) {
+        builder->buf = cork_malloc(new_size);
+        memcpy(builder->buf, builder->inline_buf, builder->size + 1);
+    } else {
+        builder->buf = cork_realloc
+            (builder->buf, builder->allocated_size, new_size);
+    }
+    builder->allocated_size = new_size;
+}
+
+void
+cork_path_builder_init(struct cork_path_builder *builder, const char *path)
+{
+    builder->buf = builder->inline_buf;
+    builder->size = 0;
+    builder->allocated_size = CORK_PATH_BUILDER_INLINE_SIZE;
+    builder->inline_buf[0] = '\0';
+    if (path != NULL) {
+        size_t  length = strlen(path);
+        cork_path_builder_ensure_size(builder, length);
+        memcpy(builder->buf, path, length + 1);
+        builder->size = length;
+    }
+}
+
+void
+cork_path_builder_done(struct cork_path_builder *builder)
+{
+    if (builder->buf != builder->inline_buf) {
+        cork_free(builder->buf, builder->allocated_size);
+    }
+}
+
+size_t
+cork_path_builder_push_n(struct cork_path_builder *builder,
+                         const char *more, size_t length)
+{
+    size_t  mark = builder->size;
+    if (length == 0) {
+        return mark;
+    }
+
+    if (more[0] == '/') {
+        /* An absolute path replaces the current contents, just like in
+         * cork_path_append. */
+        builder->size = 0;
+    } else if (builder->size > 0 && builder->buf[builder->size - 1] != '/') {
+        cork_path_builder_ensure_size(builder, builder->size + 1);
+        builder->buf[builder->size++] = '/';
+    }
+
+    cork_path_builder_ensure_size(builder, builder->size + length);
+    memcpy(builder->buf + builder->size, more, length);
+    builder->size += length;
+    builder->buf[builder->size] = '\0';
+    return mark;
+}
+
+size_t
+cork_path_builder_push(struct cork_path_builder *builder, const char *more)
+{
+    if (more == NULL) {
+        return builder->size;
+    }
+    return cork_path_builder_push_n(builder, more, strlen(more));
+}
+
+void
+cork_path_builder_restore(struct cork_path_builder *builder, size_t mark)
+{
+    assert(mark <= builder->size);
+    builder->size = mark;
+    builder->buf[mark] = '\0';
+}
+
+void
+cork_path_builder_basename_slice(const struct cork_path_builder *builder,
+                                 struct cork_slice *dest)
+{
+    cork_path_str_basename_slice(builder->buf, builder->size, dest);
+}
+
+void
+cork_path_builder_dirname_slice(const struct cork_path_builder *builder,
+                                struct cork_slice *dest)
+{
+    cork_path_str_dirname_slice(builder->buf, builder->size, dest);
+}
+
+struct cork_path *
+cork_path_builder_to_path(const struct cork_path_builder *builder)
+{
+    return cork_path_new_internal(builder->buf, builder->size);
+}
+
+
 /*-----------------------------------------------------------------------
  * Lists of paths
  */
@@ -373,7 +549,6 @@ cork_path_list_new(const char *str)
 
 struct cork_file {
     struct cork_path  *path;
-    struct stat  stat;
     enum cork_file_type  type;
     bool  has_stat;
 };
@@ -405,6 +580,12 @@ cork_file_reset(struct cork_file *file)
     file->has_stat = false;
 }
 
+void
+cork_file_invalidate(struct cork_file *file)
+{
+    cork_file_reset(file);
+}
+
 static void
 cork_file_done(struct cork_file *file)
 {
@@ -424,39 +605,76 @@ cork_file_path(struct cork_file *file)
     return file->path;
 }
 
+/* We only ever need a file's type, so where we can, we use statx and only ask
+ * for that.  (That lets network filesystems, in particular, skip fetching the
+ * rest of the file's attributes.)  Fills in mode, or returns -1 and leaves
+ * the reason in errno. */
+
+#if defined(STATX_TYPE)
+static volatile bool  cork_statx_unavailable = false;
+#endif
+
+static int
+cork_file_stat_mode(const char *path, mode_t *mode)
+{
+    struct stat  info;
+#if defined(STATX_TYPE)
+    if (CORK_LIKELY(!cork_statx_unavailable)) {
+        struct statx  stx;
+        if (statx(AT_FDCWD, path, 0, STATX_TYPE, &stx) == 0) {
+            *mode = stx.stx_mode;
+            return 0;
+        } else if (errno != ENOSYS) {
+            return -1;
+        }
+        /* The kernel (or seccomp filter) doesn't support statx. */
+        cork_statx_unavailable = true;
+    }
+#endif
+    if (stat(path, &info) == -1) {
+        return -1;
+    }
+    *mode = info.st_mode;
+    return 0;
+}
+
+static void
+cork_file_set_mode(struct cork_file *file, mode_t mode)
+{
+    if (S_ISREG(mode)) {
+        file->type = CORK_FILE_REGULAR;
+    } else if (S_ISDIR(mode)) {
+        file->type = CORK_FILE_DIRECTORY;
+    } else if (S_ISLNK(mode)) {
+        file->type = CORK_FILE_SYMLINK;
+    } else {
+        file->type = CORK_FILE_UNKNOWN;
+    }
+    file->has_stat = true;
+}
+
 static int
 cork_file_stat(struct cork_file *file)
 {
+    mode_t  mode;
+
     if (file->has_stat) {
         return 0;
-    } else {
-        int  rc;
-        rc = stat(cork_path_get(file->path), &file->stat);
-
-        if (rc == -1) {
-            if (errno == ENOENT || errno == ENOTDIR) {
-                file->type = CORK_FILE_MISSING;
-                file->has_stat = true;
-                return 0;
-            } else {
-                cork_system_error_set();
-                return -1;
-            }
-        }
+    }
 
-        if (S_ISREG(file->stat.st_mode)) {
-            file->type = CORK_FILE_REGULAR;
-        } else if (S_ISDIR(file->stat.st_mode)) {
-            file->type = CORK_FILE_DIRECTORY;
-        } else if (S_ISLNK(file->stat.st_mode)) {
-            file->type = CORK_FILE_SYMLINK;
+    if (cork_file_stat_mode(cork_path_get(file->path), &mode) == -1) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            file->type = CORK_FILE_MISSING;
+            file->has_stat = true;
+            return 0;
         } else {
-            file->type = CORK_FILE_UNKNOWN;
+            cork_system_error_set();
+            return -1;
         }
-
-        file->has_stat = true;
-        return 0;
     }
+
+    cork_file_set_mode(file, mode);
+    return 0;
 }
 
 int
@@ -467,6 +685,28 @@ cork_file_exists(struct cork_file *file, bool *exists)
     return 0;
 }
 
+/* Checks whether a path exists before we allocate anything for it, since
+ * most candidates in a path list usually don't.  Sets *dest to NULL if the
+ * path doesn't exist. */
+static int
+cork_file_new_if_exists(const struct cork_path_builder *path,
+                        struct cork_file **dest)
+{
+    mode_t  mode;
+    if (cork_file_stat_mode(cork_path_builder_get(path), &mode) == -1) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            *dest = NULL;
+            return 0;
+        } else {
+            cork_system_error_set();
+            return -1;
+        }
+    }
+    *dest = cork_file_new_from_path(cork_path_builder_to_path(path));
+    cork_file_set_mode(*dest, mode);
+    return 0;
+}
+
 int
 cork_file_type(struct cork_file *file, enum cork_file_type *type)
 {
@@ -484,26 +724,27 @@ cork_path_list_find_file(const struct cork_path_list *list,
     size_t  count = cork_path_list_size(list);
     struct cork_file  *file;
 
+    struct cork_path_builder  joined;
+
+    cork_path_builder_init(&joined, NULL);
     for (i = 0; i < count; i++) {
         const struct cork_path  *path = cork_path_list_get(list, i);
-        struct cork_path  *joined = cork_path_join(path, rel_path);
-        bool  exists;
-        file = cork_file_new_from_path(joined);
-        ei_check(cork_file_exists(file, &exists));
-        if (exists) {
+        cork_path_builder_restore(&joined, 0);
+        cork_path_builder_push(&joined, cork_path_get(path));
+        cork_path_builder_push(&joined, rel_path);
+        ei_check(cork_file_new_if_exists(&joined, &file));
+        if (file != NULL) {
+            cork_path_builder_done(&joined);
             return file;
-        } else {
-            cork_file_free(file);
         }
     }
 
     cork_error_set_printf
         (ENOENT, "%s not found in %s",
          rel_path, cork_path_list_to_string(list));
-    return NULL;
 
 error:
-    cork_file_free(file);
+    cork_path_builder_done(&joined);
     return NULL;
 }
 
@@ -537,6 +778,15 @@ cork_file_iterate_directory(struct cork_file *file,
         }
 
         cork_path_append(child_path, entry->d_name);
+#if defined(DT_UNKNOWN)
+        /* Most filesystems tell us the type of each entry, which saves us a
+         * stat.  We still have to follow symlinks, though. */
+        if (entry->d_type == DT_REG) {
+            cork_file_set_mode(&child_file, S_IFREG);
+        } else if (entry->d_type == DT_DIR) {
+            cork_file_set_mode(&child_file, S_IFDIR);
+        }
+#endif
         ei_check(cork_file_stat(&child_file));
 
         /* If the entry is a subdirectory, recurse into it. */
@@ -573,6 +823,58 @@ error:
     return -1;
 }
 
+/* Makes sure that all of the parents of path exist, creating any that don't.
+ * We temporarily truncate path at each parent in turn, so that we don't have
+ * to allocate anything. */
+static int
+cork_file_mkdir_parents(struct cork_path_builder *path, cork_file_mode mode)
+{
+    struct cork_slice  parent;
+    size_t  full_size = cork_path_builder_size(path);
+    char  saved;
+    mode_t  existing;
+
+    cork_path_builder_dirname_slice(path, &parent);
+    if (parent.size == 0) {
+        /* There is no parent; we're either at the filesystem root (for an
+         * absolute path) or the current directory (for a relative one).
+         * Either way, we can assume it already exists. */
+        return 0;
+    }
+
+    saved = path->buf[parent.size];
+    cork_path_builder_restore(path, parent.size);
+    DEBUG("  Checking parent %s\n", cork_path_builder_get(path));
+    if (cork_file_stat_mode(cork_path_builder_get(path), &existing) == 0) {
+        if (!S_ISDIR(existing)) {
+            DEBUG("  Exists and not a directory!\n");
+            cork_system_error_set_explicit(EEXIST);
+            goto error;
+        }
+    } else if (errno == ENOENT) {
+        ei_check(cork_file_mkdir_parents(path, mode));
+        DEBUG("  Creating %s\n", cork_path_builder_get(path));
+        /* Someone else might have created the parent in the meantime. */
+        if (mkdir(cork_path_builder_get(path), mode) == -1 &&
+            errno != EEXIST) {
+            cork_system_error_set();
+            goto error;
+        }
+    } else {
+        cork_system_error_set();
+        goto error;
+    }
+
+    path->buf[parent.size] = saved;
+    path->size = full_size;
+    return 0;
+
+error:
+    path->buf[parent.size] = saved;
+    path->size = full_size;
+    return -1;
+}
+
 static int
 cork_file_mkdir_one(struct cork_file *file, cork_file_mode mode,
                     unsigned int flags)
@@ -598,27 +900,18 @@ cork_file_mkdir_one(struct cork_file *file, cork_file_mode mode,
     /* If the caller asked for a recursive mkdir, then make sure the parent
      * directory exists. */
     if (flags & CORK_FILE_RECURSIVE) {
-        struct cork_path  *parent = cork_path_dirname(file->path);
-        DEBUG("  Checking parent %s\n", cork_path_get(parent));
-        if (parent->given.size == 0) {
-            /* There is no parent; we're either at the filesystem root (for an
-             * absolute path) or the current directory (for a relative one).
-             * Either way, we can assume it already exists. */
-            cork_path_free(parent);
-        } else {
-            int  rc;
-            struct cork_file  parent_file;
-            cork_file_init(&parent_file, parent);
-            rc = cork_file_mkdir_one
-                (&parent_file, mode, flags | CORK_FILE_PERMISSIVE);
-            cork_file_done(&parent_file);
-            rii_check(rc);
-        }
+        int  rc;
+        struct cork_path_builder  path;
+        cork_path_builder_init(&path, cork_path_get(file->path));
+        rc = cork_file_mkdir_parents(&path, mode);
+        cork_path_builder_done(&path);
+        rii_check(rc);
     }
 
     /* Create the directory already! */
     DEBUG("  Creating %s\n", cork_path_get(file->path));
     rii_check_posix(mkdir(cork_path_get(file->path), mode));
+    file->type = CORK_FILE_DIRECTORY;
     return 0;
 }
 
@@ -629,18 +922,189 @@ cork_file_mkdir(struct cork_file *file, cork_file_mode mode,
     return cork_file_mkdir_one(file, mode, flags);
 }
 
+/*-----------------------------------------------------------------------
+ * Directory trees
+ */
+
+/* We remove and copy directory trees using fds for each directory, so that
+ * the kernel never has to resolve more than one path component at a time.
+ * We handle every other kind of entry as soon as we see it, but save a
+ * directory's subdirectories until afterwards, so that we can hand them to a
+ * thread pool if the caller gave us one.  We never follow symlinks within a
+ * tree. */
+
+struct cork_file_tree_op {
+    struct cork_thread_pool  *pool;
+    unsigned int  flags;
+};
+
+struct cork_file_subdirs {
+    struct cork_file_tree_op  *op;
+    int  src_fd;
+    int  dest_fd;
+    /* The names of the subdirectories, separated by NULs */
+    struct cork_buffer  names;
+    cork_array(size_t)  offsets;
+};
+
+static void
+cork_file_subdirs_init(struct cork_file_subdirs *subdirs,
+                       struct cork_file_tree_op *op, int src_fd, int dest_fd)
+{
+    subdirs->op = op;
+    subdirs->src_fd = src_fd;
+    subdirs->dest_fd = dest_fd;
+    cork_buffer_init(&subdirs->names);
+    cork_array_init(&subdirs->offsets);
+}
+
+static void
+cork_file_subdirs_done(struct cork_file_subdirs *subdirs)
+{
+    cork_buffer_done(&subdirs->names);
+    cork_array_done(&subdirs->offsets);
+}
+
+static void
+cork_file_subdirs_add(struct cork_file_subdirs *subdirs, const char *name)
+{
+    cork_array_append(&subdirs->offsets, subdirs->names.size);
+    cork_buffer_append(&subdirs->names, name, strlen(name) + 1);
+}
+
+#define cork_file_subdirs_name(subdirs, i) \
+    ((const char *) (subdirs)->names.buf + \
+     cork_array_at(&(subdirs)->offsets, (i)))
+
+static int
+cork_file_subdirs_run(struct cork_file_subdirs *subdirs,
+                      cork_parallel_for_f body)
+{
+    size_t  count = cork_array_size(&subdirs->offsets);
+    if (subdirs->op->pool == NULL) {
+        return body(subdirs, 0, count);
+    } else {
+        return cork_thread_pool_parallel_for
+            (subdirs->op->pool, 0, count, 1, subdirs, body);
+    }
+}
+
+#define cork_file_skip_entry(entry) \
+    ((entry)->d_name[0] == '.' && \
+     ((entry)->d_name[1] == '\0' || \
+      ((entry)->d_name[1] == '.' && (entry)->d_name[2] == '\0')))
+
 static int
-cork_file_remove_iterator(struct cork_file *file, const char *rel_name,
-                          void *user_data)
+cork_file_open_dir_at(int parent_fd, const char *name, DIR **dir)
 {
-    unsigned int  *flags = user_data;
-    return cork_file_remove(file, *flags);
+    int  fd;
+    rii_check_posix(fd = openat
+                    (parent_fd, name,
+                     O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+    if (CORK_UNLIKELY((*dir = fdopendir(fd)) == NULL)) {
+        cork_system_error_set();
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+/* Whether a directory entry is a real directory (and not a symlink to one).
+ * We only have to stat the entry if the filesystem doesn't tell us. */
+static int
+cork_file_entry_is_dir(DIR *dir, const struct dirent *entry, bool *is_dir)
+{
+    struct stat  info;
+#if defined(DT_UNKNOWN)
+    if (entry->d_type != DT_UNKNOWN) {
+        *is_dir = (entry->d_type == DT_DIR);
+        return 0;
+    }
+#endif
+    rii_check_posix(fstatat
+                    (dirfd(dir), entry->d_name, &info, AT_SYMLINK_NOFOLLOW));
+    *is_dir = S_ISDIR(info.st_mode);
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Removing files
+ */
+
+static int
+cork_file_remove_tree(struct cork_file_tree_op *op, int parent_fd,
+                      const char *name);
+
+static int
+cork_file_remove__subdirs(void *user_data, size_t start, size_t end)
+{
+    struct cork_file_subdirs  *subdirs = user_data;
+    size_t  i;
+    for (i = start; i < end; i++) {
+        rii_check(cork_file_remove_tree
+                  (subdirs->op, subdirs->src_fd,
+                   cork_file_subdirs_name(subdirs, i)));
+    }
+    return 0;
+}
+
+static int
+cork_file_remove_tree(struct cork_file_tree_op *op, int parent_fd,
+                      const char *name)
+{
+    DIR  *dir;
+    struct dirent  *entry;
+    struct cork_file_subdirs  subdirs;
+    int  rc;
+
+    DEBUG("rm -r %s\n", name);
+    rii_check(cork_file_open_dir_at(parent_fd, name, &dir));
+    cork_file_subdirs_init(&subdirs, op, dirfd(dir), -1);
+
+    errno = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        bool  is_dir;
+        if (cork_file_skip_entry(entry)) {
+            continue;
+        }
+        ei_check(cork_file_entry_is_dir(dir, entry, &is_dir));
+        if (is_dir) {
+            cork_file_subdirs_add(&subdirs, entry->d_name);
+        } else {
+            ei_check_posix(unlinkat(dirfd(dir), entry->d_name, 0));
+        }
+        /* See cork_file_iterate_directory for why we reset errno. */
+        errno = 0;
+    }
+
+    if (CORK_UNLIKELY(errno != 0)) {
+        cork_system_error_set();
+        goto error;
+    }
+
+    ei_check(cork_file_subdirs_run(&subdirs, cork_file_remove__subdirs));
+    cork_file_subdirs_done(&subdirs);
+    rc = closedir(dir);
+    if (CORK_UNLIKELY(rc == -1)) {
+        cork_system_error_set();
+        return -1;
+    }
+    rii_check_posix(unlinkat(parent_fd, name, AT_REMOVEDIR));
+    return 0;
+
+error:
+    cork_file_subdirs_done(&subdirs);
+    closedir(dir);
+    return -1;
 }
 
 int
-cork_file_remove(struct cork_file *file, unsigned int flags)
+cork_file_remove_parallel(struct cork_file *file, unsigned int flags,
+                          struct cork_thread_pool *pool)
 {
-    DEBUG("rm %s\n", cork_path_get(file->path));
+    const char  *path = cork_path_get(file->path);
+    DEBUG("rm %s\n", path);
     rii_check(cork_file_stat(file));
 
     if (file->type == CORK_FILE_MISSING) {
@@ -651,21 +1115,437 @@ cork_file_remove(struct cork_file *file, unsigned int flags)
             return -1;
         }
     } else if (file->type == CORK_FILE_DIRECTORY) {
-        if (flags & CORK_FILE_RECURSIVE) {
+        struct stat  info;
+        rii_check_posix(lstat(path, &info));
+        if (S_ISLNK(info.st_mode)) {
+            /* Remove the symlink, and not the directory that it points
+             * to. */
+            rii_check_posix(unlink(path));
+        } else if (flags & CORK_FILE_RECURSIVE) {
             /* The user asked that we delete the contents of the directory
-             * first. */
-            rii_check(cork_file_iterate_directory
-                      (file, cork_file_remove_iterator, &flags));
+             * too. */
+            struct cork_file_tree_op  op;
+            op.pool = pool;
+            op.flags = flags;
+            rii_check(cork_file_remove_tree(&op, AT_FDCWD, path));
+        } else {
+            rii_check_posix(rmdir(path));
         }
-
-        rii_check_posix(rmdir(cork_path_get(file->path)));
+        file->type = CORK_FILE_MISSING;
         return 0;
     } else {
-        rii_check(unlink(cork_path_get(file->path)));
+        rii_check_posix(unlink(path));
+        file->type = CORK_FILE_MISSING;
         return 0;
     }
 }
 
+int
+cork_file_remove(struct cork_file *file, unsigned int flags)
+{
+    return cork_file_remove_parallel(file, flags, NULL);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Copying files
+ */
+
+#if defined(__GLIBC__) && defined(__linux__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define CORK_FILE_HAVE_COPY_FILE_RANGE  1
+#else
+#define CORK_FILE_HAVE_COPY_FILE_RANGE  0
+#endif
+
+#define CORK_FILE_COPY_BUFFER_SIZE  65536
+
+/* Copy the rest of in to out.  If the filesystem supports reflinks, the copy
+ * shares all of its blocks with the original.  Otherwise we ask the kernel to
+ * copy the data for us, and only read and write it ourselves if we can't. */
+static int
+cork_file_copy_data(int in, int out)
+{
+    char  *buf;
+    ssize_t  bytes_read;
+
+#if defined(FICLONE)
+    if (ioctl(out, FICLONE, in) == 0) {
+        return 0;
+    }
+#endif
+
+#if CORK_FILE_HAVE_COPY_FILE_RANGE
+    while (true) {
+        ssize_t  copied = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+        if (copied == 0) {
+            return 0;
+        } else if (copied == -1) {
+            if (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+                errno == EOPNOTSUPP || errno == EPERM) {
+                /* Both files' offsets are wherever the kernel stopped, so we
+                 * can pick up from there. */
+                break;
+            }
+            cork_system_error_set();
+            return -1;
+        }
+    }
+#endif
+
+    buf = cork_malloc(CORK_FILE_COPY_BUFFER_SIZE);
+    while ((bytes_read = read(in, buf, CORK_FILE_COPY_BUFFER_SIZE)) != 0) {
+        ssize_t  written = 0;
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            goto error;
+        }
+        while (written < bytes_read) {
+            ssize_t  rc = write(out, buf + written, bytes_read - written);
+            if (rc == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                goto error;
+            }
+            written += rc;
+        }
+    }
+    cork_free(buf, CORK_FILE_COPY_BUFFER_SIZE);
+    return 0;
+
+error:
+    cork_system_error_set();
+    cork_free(buf, CORK_FILE_COPY_BUFFER_SIZE);
+    return -1;
+}
+
+static int
+cork_file_copy_regular(struct cork_file_tree_op *op, int src_fd,
+                       const char *src_name, int dest_fd, const char *dest_name,
+                       const struct stat *info)
+{
+    int  in;
+    int  out;
+    int  create_flags =
+        O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC;
+
+    rii_check_posix(in = openat(src_fd, src_name, O_RDONLY | O_CLOEXEC));
+    /* We never open an existing file for writing, since it might be a symlink
+     * (or a hard link) that redirects the copy somewhere else.  If we're
+     * allowed to overwrite it, we replace it instead. */
+    out = openat(dest_fd, dest_name, create_flags, info->st_mode & 07777);
+    if (out == -1 && errno == EEXIST && (op->flags & CORK_FILE_PERMISSIVE) &&
+        unlinkat(dest_fd, dest_name, 0) == 0) {
+        out = openat(dest_fd, dest_name, create_flags, info->st_mode & 07777);
+    }
+    if (CORK_UNLIKELY(out == -1)) {
+        cork_system_error_set();
+        close(in);
+        return -1;
+    }
+    if (CORK_UNLIKELY(cork_file_copy_data(in, out) == -1)) {
+        close(in);
+        close(out);
+        return -1;
+    }
+    close(in);
+    rii_check_posix(close(out));
+    return 0;
+}
+
+static int
+cork_file_copy_symlink(struct cork_file_tree_op *op, int src_fd,
+                       const char *src_name, int dest_fd, const char *dest_name,
+                       const struct stat *info)
+{
+    struct cork_buffer  target = CORK_BUFFER_INIT();
+    ssize_t  length;
+
+    /* st_size is the length of the link's target, but it can be 0 for some
+     * special filesystems, so we might need to try bigger buffers. */
+    cork_buffer_ensure_size(&target, info->st_size + 1);
+    while ((length = readlinkat
+            (src_fd, src_name, target.buf, target.allocated_size))
+           == (ssize_t) target.allocated_size) {
+        cork_buffer_ensure_size(&target, target.allocated_size * 2);
+    }
+    if (length == -1) {
+        goto error;
+    }
+    ((char *) target.buf)[length] = '\0';
+    if (symlinkat(target.buf, dest_fd, dest_name) == -1) {
+        if (errno != EEXIST || !(op->flags & CORK_FILE_PERMISSIVE)) {
+            goto error;
+        }
+        if (unlinkat(dest_fd, dest_name, 0) == -1 ||
+            symlinkat(target.buf, dest_fd, dest_name) == -1) {
+            goto error;
+        }
+    }
+    cork_buffer_done(&target);
+    return 0;
+
+error:
+    cork_system_error_set();
+    cork_buffer_done(&target);
+    return -1;
+}
+
+static int
+cork_file_copy_tree(struct cork_file_tree_op *op, int src_parent_fd,
+                    const char *src_name, int dest_parent_fd,
+                    const char *dest_name, const struct stat *info);
+
+static int
+cork_file_copy__subdirs(void *user_data, size_t start, size_t end)
+{
+    struct cork_file_subdirs  *subdirs = user_data;
+    size_t  i;
+    for (i = start; i < end; i++) {
+        const char  *name = cork_file_subdirs_name(subdirs, i);
+        struct stat  info;
+        rii_check_posix(fstatat
+                        (subdirs->src_fd, name, &info, AT_SYMLINK_NOFOLLOW));
+        rii_check(cork_file_copy_tree
+                  (subdirs->op, subdirs->src_fd, name,
+                   subdirs->dest_fd, name, &info));
+    }
+    return 0;
+}
+
+static int
+cork_file_copy_tree(struct cork_file_tree_op *op, int src_parent_fd,
+                    const char *src_name, int dest_parent_fd,
+                    const char *dest_name, const struct stat *info)
+{
+    DIR  *dir;
+    struct dirent  *entry;
+    struct cork_file_subdirs  subdirs;
+    int  dest_fd;
+    bool  created = true;
+
+    DEBUG("cp -r %s %s\n", src_name, dest_name);
+    /* Open the source first, so that we don't create anything if we can't
+     * read it. */
+    rii_check(cork_file_open_dir_at(src_parent_fd, src_name, &dir));
+    /* Only we can touch the new directory while we're filling it in; it gets
+     * the source directory's mode once we're done.  That also lets us copy
+     * directories that aren't writable. */
+    if (mkdirat(dest_parent_fd, dest_name, S_IRWXU) == -1) {
+        if (errno != EEXIST || !(op->flags & CORK_FILE_PERMISSIVE)) {
+            cork_system_error_set();
+            closedir(dir);
+            return -1;
+        }
+        created = false;
+    }
+    dest_fd = openat(dest_parent_fd, dest_name,
+                     O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (CORK_UNLIKELY(dest_fd == -1)) {
+        cork_system_error_set();
+        closedir(dir);
+        return -1;
+    }
+    if (!created && CORK_UNLIKELY(fchmod(dest_fd, S_IRWXU) == -1)) {
+        cork_system_error_set();
+        close(dest_fd);
+        closedir(dir);
+        return -1;
+    }
+    cork_file_subdirs_init(&subdirs, op, dirfd(dir), dest_fd);
+
+    errno = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        struct stat  child;
+        if (cork_file_skip_entry(entry)) {
+            continue;
+        }
+
+        /* We need the mode of every entry anyway, so there's no point in
+         * looking at d_type. */
+        ei_check_posix(fstatat
+                       (dirfd(dir), entry->d_name, &child,
+                        AT_SYMLINK_NOFOLLOW));
+        if (S_ISDIR(child.st_mode)) {
+            cork_file_subdirs_add(&subdirs, entry->d_name);
+        } else if (S_ISREG(child.st_mode)) {
+            ei_check(cork_file_copy_regular
+                     (op, dirfd(dir), entry->d_name,
+                      dest_fd, entry->d_name, &child));
+        } else if (S_ISLNK(child.st_mode)) {
+            ei_check(cork_file_copy_symlink
+                     (op, dirfd(dir), entry->d_name,
+                      dest_fd, entry->d_name, &child));
+        } else {
+            cork_error_set_printf
+                (EINVAL, "Cannot copy special file %s", entry->d_name);
+            goto error;
+        }
+
+        /* See cork_file_iterate_directory for why we reset errno. */
+        errno = 0;
+    }
+
+    if (CORK_UNLIKELY(errno != 0)) {
+        cork_system_error_set();
+        goto error;
+    }
+
+    ei_check(cork_file_subdirs_run(&subdirs, cork_file_copy__subdirs));
+    ei_check_posix(fchmod(dest_fd, info->st_mode & 07777));
+    cork_file_subdirs_done(&subdirs);
+    closedir(dir);
+    rii_check_posix(close(dest_fd));
+    return 0;
+
+error:
+    cork_file_subdirs_done(&subdirs);
+    closedir(dir);
+    close(dest_fd);
+    return -1;
+}
+
+/* Make sure that dest isn't src, or inside of it, since then a recursive copy
+ * would never finish.  We compare the device and inode of each of dest's
+ * ancestors, so that symlinks and bind mounts can't hide the loop.  If dest
+ * doesn't exist yet, we start from its parent. */
+static int
+cork_file_copy_check_dest(const char *src_path, const struct stat *src_info,
+                          struct cork_file *dest)
+{
+    struct stat  info;
+    dev_t  prev_dev = 0;
+    ino_t  prev_ino = 0;
+    int  fd;
+
+    fd = open(cork_path_get(dest->path),
+              O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        struct cork_path  *parent = cork_path_dirname(dest->path);
+        const char  *parent_path = cork_path_get(parent);
+        fd = open((parent_path[0] == '\0')? ".": parent_path,
+                  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        cork_path_free(parent);
+        if (fd == -1) {
+            /* The copy itself will report a better error. */
+            return 0;
+        }
+    }
+
+    while (true) {
+        int  parent_fd;
+        if (CORK_UNLIKELY(fstat(fd, &info) == -1)) {
+            cork_system_error_set();
+            close(fd);
+            return -1;
+        }
+        if (info.st_dev == src_info->st_dev &&
+            info.st_ino == src_info->st_ino) {
+            close(fd);
+            cork_error_set_printf
+                (EINVAL, "Cannot copy %s into itself", src_path);
+            return -1;
+        }
+        if (info.st_dev == prev_dev && info.st_ino == prev_ino) {
+            /* The root directory is its own parent. */
+            close(fd);
+            return 0;
+        }
+        prev_dev = info.st_dev;
+        prev_ino = info.st_ino;
+        parent_fd = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        close(fd);
+        if (CORK_UNLIKELY(parent_fd == -1)) {
+            cork_system_error_set();
+            return -1;
+        }
+        fd = parent_fd;
+    }
+}
+
+/* Removes whatever a failed copy created at dest, keeping the copy's error. */
+static void
+cork_file_copy_clean_up(struct cork_file_tree_op *op, const char *dest_path,
+                        bool is_dir)
+{
+    cork_error  code = cork_error_code();
+    struct cork_buffer  message = CORK_BUFFER_INIT();
+    cork_buffer_set_string(&message, cork_error_message());
+    DEBUG("Removing partial copy %s\n", dest_path);
+    if (is_dir) {
+        cork_file_remove_tree(op, AT_FDCWD, dest_path);
+    } else {
+        unlink(dest_path);
+    }
+    cork_error_set_string(code, message.buf);
+    cork_buffer_done(&message);
+}
+
+int
+cork_file_copy_parallel(struct cork_file *src, struct cork_file *dest,
+                        unsigned int flags, struct cork_thread_pool *pool)
+{
+    struct cork_file_tree_op  op;
+    struct stat  info;
+    struct stat  dest_info;
+    const char  *src_path = cork_path_get(src->path);
+    const char  *dest_path = cork_path_get(dest->path);
+    bool  dest_existed;
+    int  src_fd;
+    int  rc;
+
+    DEBUG("cp %s %s\n", src_path, dest_path);
+    op.pool = pool;
+    op.flags = flags;
+    /* Like the regular file case, we follow src if it's a symlink.  (Symlinks
+     * inside of a directory are copied as symlinks.) */
+    rii_check_posix(stat(src_path, &info));
+    dest_existed = (lstat(dest_path, &dest_info) == 0 || errno != ENOENT);
+    if (S_ISDIR(info.st_mode)) {
+        if (!(flags & CORK_FILE_RECURSIVE)) {
+            cork_system_error_set_explicit(EISDIR);
+            return -1;
+        }
+        rii_check_posix(src_fd = open
+                        (src_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (CORK_UNLIKELY(fstat(src_fd, &info) == -1)) {
+            cork_system_error_set();
+            close(src_fd);
+            return -1;
+        }
+        if (CORK_UNLIKELY(cork_file_copy_check_dest(src_path, &info, dest)
+                          == -1)) {
+            close(src_fd);
+            return -1;
+        }
+        rc = cork_file_copy_tree
+            (&op, src_fd, ".", AT_FDCWD, dest_path, &info);
+        close(src_fd);
+    } else if (S_ISREG(info.st_mode)) {
+        rc = cork_file_copy_regular
+            (&op, AT_FDCWD, src_path, AT_FDCWD, dest_path, &info);
+    } else {
+        cork_error_set_printf
+            (EINVAL, "Cannot copy special file %s", src_path);
+        return -1;
+    }
+    if (rc == -1 && !dest_existed) {
+        cork_file_copy_clean_up(&op, dest_path, S_ISDIR(info.st_mode));
+    }
+    cork_file_reset(dest);
+    return rc;
+}
+
+int
+cork_file_copy(struct cork_file *src, struct cork_file *dest,
+               unsigned int flags)
+{
+    return cork_file_copy_parallel(src, dest, flags, NULL);
+}
+
 
 /*-----------------------------------------------------------------------
  * Lists of files
@@ -730,6 +1610,17 @@ cork_file_list_new(struct cork_path_list *path_list)
 }
 
 
+int
+cork_file_list_stat(struct cork_file_list *list)
+{
+    size_t  i;
+    for (i = 0; i < cork_array_size(&list->array); i++) {
+        rii_check(cork_file_stat(cork_array_at(&list->array, i)));
+    }
+    return 0;
+}
+
+
 struct cork_file_list *
 cork_path_list_find_files(const struct cork_path_list *path_list,
                           const char *rel_path)
@@ -739,24 +1630,130 @@ cork_path_list_find_files(const struct cork_path_list *path_list,
     struct cork_file_list  *list = cork_file_list_new_empty();
     struct cork_file  *file;
 
+    struct cork_path_builder  joined;
+
+    cork_path_builder_init(&joined, NULL);
     for (i = 0; i < count; i++) {
         const struct cork_path  *path = cork_path_list_get(path_list, i);
-        struct cork_path  *joined = cork_path_join(path, rel_path);
-        bool  exists;
-        file = cork_file_new_from_path(joined);
-        ei_check(cork_file_exists(file, &exists));
-        if (exists) {
+        cork_path_builder_restore(&joined, 0);
+        cork_path_builder_push(&joined, cork_path_get(path));
+        cork_path_builder_push(&joined, rel_path);
+        ei_check(cork_file_new_if_exists(&joined, &file));
+        if (file != NULL) {
             cork_file_list_add(list, file);
-        } else {
-            cork_file_free(file);
         }
     }
 
+    cork_path_builder_done(&joined);
     return list;
 
 error:
+    cork_path_builder_done(&joined);
     cork_file_list_free(list);
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * File caches
+ */
+
+struct cork_file_cache {
+    /* Each key is the path of the corresponding cork_file, which owns it. */
+    struct cork_hash_table  *files;
+};
+
+static void
+cork_file_cache__free_file(void *vfile)
+{
+    struct cork_file  *file = vfile;
     cork_file_free(file);
+}
+
+struct cork_file_cache *
+cork_file_cache_new(void)
+{
+    struct cork_file_cache  *cache = cork_new(struct cork_file_cache);
+    cache->files = cork_string_hash_table_new(0, 0);
+    cork_hash_table_set_free_value(cache->files, cork_file_cache__free_file);
+    return cache;
+}
+
+void
+cork_file_cache_free(struct cork_file_cache *cache)
+{
+    cork_hash_table_free(cache->files);
+    cork_delete(struct cork_file_cache, cache);
+}
+
+struct cork_file *
+cork_file_cache_get(struct cork_file_cache *cache, const char *path)
+{
+    struct cork_file  *file = cork_hash_table_get(cache->files, path);
+    if (file == NULL) {
+        file = cork_file_new(path);
+        cork_hash_table_put
+            (cache->files, (void *) cork_path_get(file->path), file,
+             NULL, NULL, NULL);
+    }
+    return file;
+}
+
+void
+cork_file_cache_invalidate(struct cork_file_cache *cache, const char *path)
+{
+    struct cork_file  *file = cork_hash_table_get(cache->files, path);
+    if (file != NULL) {
+        cork_file_reset(file);
+    }
+}
+
+static enum cork_hash_table_map_result
+cork_file_cache__invalidate(void *user_data,
+                            struct cork_hash_table_entry *entry)
+{
+    struct cork_file  *file = entry->value;
+    cork_file_reset(file);
+    return CORK_HASH_TABLE_MAP_CONTINUE;
+}
+
+void
+cork_file_cache_invalidate_all(struct cork_file_cache *cache)
+{
+    cork_hash_table_map(cache->files, NULL, cork_file_cache__invalidate);
+}
+
+struct cork_file *
+cork_file_cache_find_file(struct cork_file_cache *cache,
+                          const struct cork_path_list *list,
+                          const char *rel_path)
+{
+    size_t  i;
+    size_t  count = cork_path_list_size(list);
+    struct cork_path_builder  joined;
+
+    cork_path_builder_init(&joined, NULL);
+    for (i = 0; i < count; i++) {
+        struct cork_file  *file;
+        bool  exists;
+        cork_path_builder_restore(&joined, 0);
+        cork_path_builder_push
+            (&joined, cork_path_get(cork_path_list_get(list, i)));
+        cork_path_builder_push(&joined, rel_path);
+        file = cork_file_cache_get(cache, cork_path_builder_get(&joined));
+        ei_check(cork_file_exists(file, &exists));
+        if (exists) {
+            cork_path_builder_done(&joined);
+            return file;
+        }
+    }
+
+    cork_error_set_printf
+        (ENOENT, "%s not found in %s",
+         rel_path, cork_path_list_to_string(list));
+
+error:
+    cork_path_builder_done(&joined);
     return NULL;
 }
 
@@ -0,0 +1,294 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1
+#endif
+
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/attributes.h"
+#include "libcork/core/types.h"
+
+
+#if !defined(CORK_DEBUG_PAGE_ALLOC)
+#define CORK_DEBUG_PAGE_ALLOC  0
+#endif
+
+#if CORK_DEBUG_PAGE_ALLOC
+#include <stdio.h>
+#define DEBUG(...) fprintf(stderr, __VA_ARGS__)
+#else
+#define DEBUG(...) /* no debug messages */
+#endif
+
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS  MAP_ANON
+#endif
+
+/* The size of a huge page on the platforms that we care about. */
+#define CORK_PAGE_ALLOC_HUGE_PAGE_SIZE  (2 * 1024 * 1024)
+
+struct cork_page_alloc {
+    const struct cork_alloc  *parent;
+    size_t  threshold;
+    unsigned int  flags;
+    /* Large allocations are rounded up to a multiple of this size. */
+    size_t  granularity;
+};
+
+#define cork_page_alloc_round(pa, size) \
+    (((size) + (pa)->granularity - 1) & ~((pa)->granularity - 1))
+
+
+/*-----------------------------------------------------------------------
+ * NUMA placement
+ */
+
+#if defined(__linux__) && defined(SYS_getcpu) && defined(SYS_mbind)
+
+/* From <numaif.h>, which isn't installed everywhere */
+#define CORK_MPOL_PREFERRED  1
+
+#define CORK_PAGE_ALLOC_MAX_NODES  1024
+#define CORK_ULONG_BITS  (sizeof(unsigned long) * 8)
+
+/* This is only a hint, so we ignore any errors. */
+static void
+cork_page_alloc_bind_local(void *ptr, size_t size)
+{
+    unsigned int  cpu;
+    unsigned int  node;
+    unsigned long  nodemask[CORK_PAGE_ALLOC_MAX_NODES / CORK_ULONG_BITS];
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 ||
+        node >= CORK_PAGE_ALLOC_MAX_NODES) {
+        return;
+    }
+    memset(nodemask, 0, sizeof(nodemask));
+    nodemask[node / CORK_ULONG_BITS] = 1UL << (node % CORK_ULONG_BITS);
+    DEBUG("Preferring NUMA node %u for %zu bytes\n", node, size);
+    syscall(SYS_mbind, ptr, size, CORK_MPOL_PREFERRED,
+            nodemask, (unsigned long) CORK_PAGE_ALLOC_MAX_NODES + 1, 0);
+}
+
+#else
+
+static void
+cork_page_alloc_bind_local(void *ptr, size_t size)
+{
+    /* Without an explicit policy, most kernels will place a page on the node
+     * of the thread that first touches it anyway. */
+}
+
+#endif
+
+
+/*-----------------------------------------------------------------------
+ * Mapping memory
+ */
+
+static void *
+cork_page_alloc_map_explicit(size_t size)
+{
+#if defined(MAP_HUGETLB)
+    void  *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+        return ptr;
+    }
+    DEBUG("No explicit huge pages available for %zu bytes\n", size);
+#endif
+    return NULL;
+}
+
+/* Maps a region that's aligned to a huge page boundary, so that the kernel can
+ * back all of it with transparent huge pages. */
+static void *
+cork_page_alloc_map_aligned(size_t size)
+{
+    size_t  padded_size = size + CORK_PAGE_ALLOC_HUGE_PAGE_SIZE;
+    char  *base;
+    char  *ptr;
+    size_t  head;
+
+    base = mmap(NULL, padded_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (CORK_UNLIKELY(base == MAP_FAILED)) {
+        return NULL;
+    }
+
+    /* Trim the unaligned parts off of each end of the mapping. */
+    ptr = (char *)
+        (((uintptr_t) base + CORK_PAGE_ALLOC_HUGE_PAGE_SIZE - 1) &
+         ~((uintptr_t) CORK_PAGE_ALLOC_HUGE_PAGE_SIZE - 1));
+    head = ptr - base;
+    if (head > 0) {
+        munmap(base, head);
+    }
+    munmap(ptr + size, CORK_PAGE_ALLOC_HUGE_PAGE_SIZE - head);
+
+#if defined(MADV_HUGEPAGE)
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    return ptr;
+}
+
+static void *
+cork_page_alloc_map(struct cork_page_alloc *pa, size_t size)
+{
+    void  *ptr = NULL;
+
+    if (pa->flags & CORK_PAGE_ALLOC_EXPLICIT_HUGE_PAGES) {
+        ptr = cork_page_alloc_map_explicit(size);
+    }
+    if (ptr == NULL) {
+        if (pa->flags & (CORK_PAGE_ALLOC_HUGE_PAGES |
+                         CORK_PAGE_ALLOC_EXPLICIT_HUGE_PAGES)) {
+            ptr = cork_page_alloc_map_aligned(size);
+        } else {
+            ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (CORK_UNLIKELY(ptr == MAP_FAILED)) {
+                ptr = NULL;
+            }
+        }
+    }
+
+    /* A NUMA policy only affects pages that haven't been faulted in yet, so we
+     * have to set it before anyone touches the memory. */
+    if (ptr != NULL && (pa->flags & CORK_PAGE_ALLOC_LOCAL_NODE)) {
+        cork_page_alloc_bind_local(ptr, size);
+    }
+    DEBUG("Mapped %zu bytes at %p\n", size, ptr);
+    return ptr;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Allocator methods
+ */
+
+static void *
+cork_page_alloc__xmalloc(const struct cork_alloc *alloc, size_t size)
+{
+    struct cork_page_alloc  *pa = alloc->user_data;
+    if (size < pa->threshold) {
+        return cork_alloc_xmalloc(pa->parent, size);
+    }
+    return cork_page_alloc_map(pa, cork_page_alloc_round(pa, size));
+}
+
+static void *
+cork_page_alloc__xcalloc(const struct cork_alloc *alloc,
+                         size_t count, size_t size)
+{
+    struct cork_page_alloc  *pa = alloc->user_data;
+    size_t  total;
+    if (CORK_UNLIKELY(size != 0 && count > SIZE_MAX / size)) {
+        return NULL;
+    }
+    total = count * size;
+    if (total < pa->threshold) {
+        return cork_alloc_xcalloc(pa->parent, count, size);
+    }
+    /* Fresh mappings are already zeroed, so we don't have to touch (and fault
+     * in) every page. */
+    return cork_page_alloc_map(pa, cork_page_alloc_round(pa, total));
+}
+
+static void
+cork_page_alloc__free(const struct cork_alloc *alloc, void *ptr, size_t size)
+{
+    struct cork_page_alloc  *pa = alloc->user_data;
+    if (size < pa->threshold) {
+        cork_alloc_free(pa->parent, ptr, size);
+        return;
+    }
+    DEBUG("Unmapping %zu bytes at %p\n", size, ptr);
+    munmap(ptr, cork_page_alloc_round(pa, size));
+}
+
+static void *
+cork_page_alloc__xrealloc(const struct cork_alloc *alloc, void *ptr,
+                          size_t old_size, size_t new_size)
+{
+    struct cork_page_alloc  *pa = alloc->user_data;
+    void  *result;
+
+    if (ptr == NULL) {
+        return cork_page_alloc__xmalloc(alloc, new_size);
+    }
+
+    if (old_size < pa->threshold && new_size < pa->threshold) {
+        return cork_alloc_xrealloc(pa->parent, ptr, old_size, new_size);
+    }
+
+    if (old_size >= pa->threshold && new_size >= pa->threshold) {
+        size_t  old_mapped = cork_page_alloc_round(pa, old_size);
+        size_t  new_mapped = cork_page_alloc_round(pa, new_size);
+        if (old_mapped == new_mapped) {
+            return ptr;
+        }
+#if defined(__linux__) && defined(MREMAP_MAYMOVE)
+        /* Let the kernel move the pages instead of copying them.  The new
+         * mapping keeps the old one's NUMA policy. */
+        result = mremap(ptr, old_mapped, new_mapped, MREMAP_MAYMOVE);
+        if (result != MAP_FAILED) {
+            return result;
+        }
+#endif
+    }
+
+    result = cork_page_alloc__xmalloc(alloc, new_size);
+    if (CORK_LIKELY(result != NULL)) {
+        memcpy(result, ptr, (new_size < old_size)? new_size: old_size);
+        cork_page_alloc__free(alloc, ptr, old_size);
+    }
+    return result;
+}
+
+static void
+cork_page_alloc__free_user_data(void *user_data)
+{
+    struct cork_page_alloc  *pa = user_data;
+    cork_alloc_delete(pa->parent, struct cork_page_alloc, pa);
+}
+
+struct cork_alloc *
+cork_page_alloc_new(const struct cork_alloc *parent, size_t threshold,
+                    unsigned int flags)
+{
+    struct cork_alloc  *alloc = cork_alloc_new_alloc(parent);
+    struct cork_page_alloc  *pa = cork_alloc_new(parent, struct cork_page_alloc);
+    pa->parent = parent;
+    pa->threshold =
+        (threshold == 0)? CORK_PAGE_ALLOC_DEFAULT_THRESHOLD: threshold;
+    pa->flags = flags;
+    if (flags & (CORK_PAGE_ALLOC_HUGE_PAGES |
+                 CORK_PAGE_ALLOC_EXPLICIT_HUGE_PAGES)) {
+        pa->granularity = CORK_PAGE_ALLOC_HUGE_PAGE_SIZE;
+    } else {
+        pa->granularity = sysconf(_SC_PAGESIZE);
+    }
+
+    cork_alloc_set_user_data(alloc, pa, cork_page_alloc__free_user_data);
+    cork_alloc_set_xmalloc(alloc, cork_page_alloc__xmalloc);
+    cork_alloc_set_xcalloc(alloc, cork_page_alloc__xcalloc);
+    cork_alloc_set_xrealloc(alloc, cork_page_alloc__xrealloc);
+    cork_alloc_set_free(alloc, cork_page_alloc__free);
+    return alloc;
+}
@@ -7,18 +7,27 @@
  * ----------------------------------------------------------------------
  */
 
+/* For posix_spawn_file_actions_addchdir_np */
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1
+#endif
+
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
-#include <sys/select.h>
+#include <spawn.h>
+#include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "libcork/core.h"
+#include "libcork/core/trace.h"
 #include "libcork/ds.h"
+#include "libcork/os/event-loop.h"
 #include "libcork/os/subprocess.h"
-#include "libcork/threads/basics.h"
 #include "libcork/helpers/errors.h"
 #include "libcork/helpers/posix.h"
 
@@ -39,12 +48,27 @@
  * Subprocess groups
  */
 
-#define BUF_SIZE  4096
-
 struct cork_subprocess_group {
     cork_array(struct cork_subprocess *)  subprocesses;
+    /* Reused each time we wait for any of the subprocesses' pipes */
+    struct pollfd  *pollfds;
+    size_t  pollfds_size;
+    /* If we're attached to an event loop, the subprocesses whose pipes have
+     * all been closed, but which haven't exited yet.  We poll for them to
+     * exit with a timer. */
+    struct cork_event_loop  *loop;
+    struct cork_dllist  exiting;
+    struct cork_loop_timer  reap_timer;
+    unsigned int  spin_count;
+    size_t  remaining;
+    void  *user_data;
+    cork_subprocess_group_done_f  done;
 };
 
+static int
+cork_subprocess_group__reap(struct cork_event_loop *loop,
+                            struct cork_loop_timer *timer);
+
 struct cork_subprocess_group *
 cork_subprocess_group_new(void)
 {
@@ -52,13 +76,29 @@ cork_subprocess_group_new(void)
         cork_new(struct cork_subprocess_group);
     cork_pointer_array_init
         (&group->subprocesses, (cork_free_f) cork_subprocess_free);
+    group->pollfds = NULL;
+    group->pollfds_size = 0;
+    group->loop = NULL;
+    cork_dllist_init(&group->exiting);
+    cork_loop_timer_init(&group->reap_timer, cork_subprocess_group__reap);
+    group->spin_count = 0;
+    group->remaining = 0;
+    group->user_data = NULL;
+    group->done = NULL;
     return group;
 }
 
 void
 cork_subprocess_group_free(struct cork_subprocess_group *group)
 {
+    /* Freeing the subprocesses removes their pipes from the loop. */
+    if (group->loop != NULL) {
+        cork_event_loop_cancel(group->loop, &group->reap_timer);
+    }
     cork_array_done(&group->subprocesses);
+    if (group->pollfds != NULL) {
+        cork_cfree(group->pollfds, group->pollfds_size, sizeof(struct pollfd));
+    }
     cork_delete(struct cork_subprocess_group, group);
 }
 
@@ -70,28 +110,117 @@ cork_subprocess_group_add(struct cork_subprocess_group *group,
 }
 
 
+/*-----------------------------------------------------------------------
+ * Read buffers
+ */
+
+/* We start off reading 4KB at a time, and double that (up to the default
+ * capacity of a Linux pipe) whenever a read fills the whole buffer, so that a
+ * chatty subprocess doesn't need one syscall for every 4KB of output. */
+#define CORK_SUBPROCESS_MIN_READ_SIZE  4096
+#define CORK_SUBPROCESS_MAX_READ_SIZE  65536
+
+/* We read into a managed buffer, and hand consumers slices of it.  A consumer
+ * that wants to hold on to the data can make a copy of its slice, which only
+ * takes a new reference to the chunk.  If anyone still has a reference after
+ * the consumer returns, we leave the chunk to them and read into a new one;
+ * otherwise we reuse it for the next read. */
+struct cork_read_buffer {
+    struct cork_managed_buffer  *mbuf;
+    char  *buf;
+    size_t  size;
+};
+
+static void
+cork_read_buffer__free(void *buf, size_t size)
+{
+    cork_free(buf, size);
+}
+
+static void
+cork_read_buffer_new_chunk(struct cork_read_buffer *rbuf, size_t size)
+{
+    rbuf->size = size;
+    rbuf->buf = cork_malloc(size);
+    rbuf->mbuf = cork_managed_buffer_new
+        (rbuf->buf, size, cork_read_buffer__free);
+}
+
+static void
+cork_read_buffer_init(struct cork_read_buffer *rbuf)
+{
+    cork_read_buffer_new_chunk(rbuf, CORK_SUBPROCESS_MIN_READ_SIZE);
+}
+
+static void
+cork_read_buffer_done(struct cork_read_buffer *rbuf)
+{
+    cork_managed_buffer_unref(rbuf->mbuf);
+}
+
+/* Called after we've passed the current chunk to a consumer. */
+static void
+cork_read_buffer_next(struct cork_read_buffer *rbuf, bool filled)
+{
+    size_t  size = rbuf->size;
+    if (filled && size < CORK_SUBPROCESS_MAX_READ_SIZE) {
+        size *= 2;
+    } else if (!cork_managed_buffer_is_shared(rbuf->mbuf)) {
+        return;
+    }
+    /* We don't need to keep the old contents, so there's no need to
+     * realloc. */
+    cork_managed_buffer_unref(rbuf->mbuf);
+    cork_read_buffer_new_chunk(rbuf, size);
+}
+
+
 /*-----------------------------------------------------------------------
  * Pipes (parent reads)
  */
 
 struct cork_read_pipe {
     struct cork_stream_consumer  *consumer;
+    /* If not -1, the child writes directly to this fd, and we don't create a
+     * pipe at all. */
+    int  dest_fd;
     int  fds[2];
     bool  first;
+    /* If our group is attached to an event loop, we watch the read end of the
+     * pipe with it. */
+    struct cork_event_loop  *loop;
+    struct cork_loop_fd  watch;
+    struct cork_subprocess  *sub;
 };
 
 static void
 cork_read_pipe_init(struct cork_read_pipe *p, struct cork_stream_consumer *consumer)
 {
     p->consumer = consumer;
+    p->dest_fd = -1;
     p->fds[0] = -1;
     p->fds[1] = -1;
+    p->loop = NULL;
+    p->sub = NULL;
+}
+
+/* We have to stop watching the pipe before we close it. */
+static int
+cork_read_pipe_detach(struct cork_read_pipe *p)
+{
+    if (p->loop != NULL) {
+        struct cork_event_loop  *loop = p->loop;
+        p->loop = NULL;
+        rii_check(cork_event_loop_remove_fd(loop, &p->watch));
+    }
+    return 0;
 }
 
 static int
 cork_read_pipe_close_read(struct cork_read_pipe *p)
 {
     if (p->fds[0] != -1) {
+        rii_check(cork_read_pipe_detach(p));
         DEBUG("Closing read pipe %d\n", p->fds[0]);
         rii_check_posix(close(p->fds[0]));
         p->fds[0] = -1;
@@ -126,7 +255,7 @@ cork_read_pipe_done(struct cork_read_pipe *p)
 static int
 cork_read_pipe_open(struct cork_read_pipe *p)
 {
-    if (p->consumer != NULL) {
+    if (p->consumer != NULL && p->dest_fd == -1) {
         int  flags;
 
         /* We want the read end of the pipe to be non-blocking. */
@@ -134,9 +263,9 @@ cork_read_pipe_open(struct cork_read_pipe *p)
         rii_check_posix(pipe(p->fds));
         DEBUG("[read]   Got read=%d write=%d\n", p->fds[0], p->fds[1]);
         DEBUG("[read]   Setting non-blocking flag on read pipe\n");
-        ei_check_posix(flags = fcntl(p->fds[0], F_GETFD));
+        ei_check_posix(flags = fcntl(p->fds[0], F_GETFL));
         flags |= O_NONBLOCK;
-        ei_check_posix(fcntl(p->fds[0], F_SETFD, flags));
+        ei_check_posix(fcntl(p->fds[0], F_SETFL, flags));
     }
 
     p->first = true;
@@ -152,12 +281,17 @@ cork_read_pipe_dup(struct cork_read_pipe *p, int fd)
 {
     if (p->fds[1] != -1) {
         rii_check_posix(dup2(p->fds[1], fd));
+    } else if (p->dest_fd != -1 && p->dest_fd != fd) {
+        rii_check_posix(dup2(p->dest_fd, fd));
     }
     return 0;
 }
 
+/* Reads everything that's currently available from the pipe, until the read
+ * would block. */
 static int
-cork_read_pipe_read(struct cork_read_pipe *p, char *buf, bool *progress)
+cork_read_pipe_read(struct cork_read_pipe *p, struct cork_read_buffer *rbuf,
+                    bool *progress)
 {
     if (p->fds[0] == -1) {
         return 0;
@@ -165,7 +299,7 @@ cork_read_pipe_read(struct cork_read_pipe *p, char *buf, bool *progress)
 
     do {
         DEBUG("[read] Reading from pipe %d\n", p->fds[0]);
-        ssize_t  bytes_read = read(p->fds[0], buf, BUF_SIZE);
+        ssize_t  bytes_read = read(p->fds[0], rbuf->buf, rbuf->size);
         if (bytes_read == -1) {
             if (errno == EAGAIN) {
                 /* We've exhausted all of the data currently available. */
@@ -186,15 +320,31 @@ cork_read_pipe_read(struct cork_read_pipe *p, char *buf, bool *progress)
             DEBUG("[read]   End of stream\n");
             *progress = true;
             rii_check(cork_stream_consumer_eof(p->consumer));
+            rii_check(cork_read_pipe_detach(p));
             rii_check_posix(close(p->fds[0]));
             p->fds[0] = -1;
             return 0;
         } else {
             DEBUG("[read]   Got %zd bytes\n", bytes_read);
             *progress = true;
-            rii_check(cork_stream_consumer_data
-                      (p->consumer, buf, bytes_read, p->first));
+            /* Only consumers that have opted into data_vec get a slice of the
+             * managed buffer; everyone else gets the plain data method. */
+            if (cork_stream_consumer_has_data_vec(p->consumer)) {
+                struct cork_slice  slice;
+                int  rc;
+                rii_check(cork_managed_buffer_slice
+                          (&slice, rbuf->mbuf, 0, bytes_read));
+                rc = p->consumer->data_vec(p->consumer, &slice, 1, p->first);
+                cork_slice_finish(&slice);
+                if (CORK_UNLIKELY(rc != 0)) {
+                    return rc;
+                }
+            } else {
+                rii_check(cork_stream_consumer_data
+                          (p->consumer, rbuf->buf, bytes_read, p->first));
+            }
             p->first = false;
+            cork_read_buffer_next(rbuf, (size_t) bytes_read == rbuf->size);
         }
     } while (true);
 }
@@ -205,6 +355,19 @@ cork_read_pipe_is_finished(struct cork_read_pipe *p)
     return p->fds[0] == -1;
 }
 
+/* Adds the pipe's read end to a list of file descriptors to poll. */
+static void
+cork_read_pipe_add_pollfd(struct cork_read_pipe *p, struct pollfd *fds,
+                          size_t *count)
+{
+    if (p->fds[0] != -1) {
+        fds[*count].fd = p->fds[0];
+        fds[*count].events = POLLIN;
+        fds[*count].revents = 0;
+        (*count)++;
+    }
+}
+
 
 /*-----------------------------------------------------------------------
  * Pipes (parent writes)
@@ -315,7 +478,13 @@ struct cork_subprocess {
     cork_free_f  free_user_data;
     cork_run_f  run;
     int  *exit_code;
-    char  buf[BUF_SIZE];
+    struct cork_read_buffer  buf;
+    struct cork_subprocess_group  *group;
+    /* In the group's exiting list */
+    struct cork_dllist_item  exiting_item;
+    /* When we started the child, if the subprocess_reap tracepoint was
+     * enabled at the time */
+    uint64_t  start_ns;
 };
 
 struct cork_subprocess *
@@ -330,10 +499,13 @@ cork_subprocess_new(void *user_data, cork_free_f free_user_data,
     cork_read_pipe_init(&self->stdout_pipe, stdout_consumer);
     cork_read_pipe_init(&self->stderr_pipe, stderr_consumer);
     self->pid = 0;
+    self->start_ns = 0;
     self->user_data = user_data;
     self->free_user_data = free_user_data;
     self->run = run;
     self->exit_code = exit_code;
+    cork_read_buffer_init(&self->buf);
+    self->group = NULL;
     return self;
 }
 
@@ -344,6 +516,7 @@ cork_subprocess_free(struct cork_subprocess *self)
     cork_write_pipe_done(&self->stdin_pipe);
     cork_read_pipe_done(&self->stdout_pipe);
     cork_read_pipe_done(&self->stderr_pipe);
+    cork_read_buffer_done(&self->buf);
     cork_delete(struct cork_subprocess, self);
 }
 
@@ -353,6 +526,18 @@ cork_subprocess_stdin(struct cork_subprocess *self)
     return &self->stdin_pipe.consumer;
 }
 
+void
+cork_subprocess_set_stdout_fd(struct cork_subprocess *self, int fd)
+{
+    self->stdout_pipe.dest_fd = fd;
+}
+
+void
+cork_subprocess_set_stderr_fd(struct cork_subprocess *self, int fd)
+{
+    self->stderr_pipe.dest_fd = fd;
+}
+
 
 /*-----------------------------------------------------------------------
  * Executing another program
@@ -385,14 +570,237 @@ cork_subprocess_new_exec(struct cork_exec *exec,
 }
 
 
+/*-----------------------------------------------------------------------
+ * Spawning subprocesses
+ */
+
+/* If the subprocess is just going to exec another program, we use
+ * posix_spawn instead of fork.  That uses vfork (or the equivalent) under the
+ * covers on most platforms, so the time it takes doesn't depend on how much
+ * memory the parent has mapped.  We can only do that if there's a spawn file
+ * action that can change into the requested working directory. */
+
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define CORK_SUBPROCESS_HAVE_ADDCHDIR  1
+#else
+#define CORK_SUBPROCESS_HAVE_ADDCHDIR  0
+#endif
+
+static bool
+cork_subprocess_can_spawn(struct cork_subprocess *self)
+{
+    if (self->run != cork_exec__run) {
+        return false;
+    }
+#if CORK_SUBPROCESS_HAVE_ADDCHDIR
+    return true;
+#else
+    return cork_exec_cwd(self->user_data) == NULL;
+#endif
+}
+
+/* Mirror what the child does after a fork: dup the child's end of each pipe
+ * onto the right standard stream, and close all of the other pipe fds. */
+static int
+cork_subprocess_add_pipe_actions(posix_spawn_file_actions_t *actions,
+                                 int child_fd, int parent_fd, int target)
+{
+    int  rc;
+    if (parent_fd != -1) {
+        rc = posix_spawn_file_actions_addclose(actions, parent_fd);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    if (child_fd != -1 && child_fd != target) {
+        rc = posix_spawn_file_actions_adddup2(actions, child_fd, target);
+        if (rc != 0) {
+            return rc;
+        }
+        return posix_spawn_file_actions_addclose(actions, child_fd);
+    }
+    return 0;
+}
+
+/* A destination fd belongs to the caller, so unlike a pipe, we leave the
+ * child's copy of it open. */
+static int
+cork_subprocess_add_read_pipe_actions(posix_spawn_file_actions_t *actions,
+                                      struct cork_read_pipe *p, int target)
+{
+    if (p->fds[1] == -1 && p->dest_fd != -1) {
+        if (p->dest_fd == target) {
+            return 0;
+        }
+        return posix_spawn_file_actions_adddup2(actions, p->dest_fd, target);
+    }
+    return cork_subprocess_add_pipe_actions
+        (actions, p->fds[1], p->fds[0], target);
+}
+
+/* posix_spawnp searches the parent's PATH, but a forked child execs after
+ * installing its own environment, and so searches the PATH in that
+ * environment.  If the exec has its own environment, we do that search
+ * ourselves, and spawn the program at the path that we find.  (Like execvp, we
+ * use a default search path if the environment doesn't define PATH.)  Any
+ * relative PATH entries are relative to the child's working directory.  We
+ * build absolute paths to check, since the parent is still in its own working
+ * directory, and the child would otherwise apply a relative cwd twice. */
+
+#define CORK_SUBPROCESS_DEFAULT_PATH  "/bin:/usr/bin"
+
+static int
+cork_subprocess_find_program(struct cork_exec *exec, struct cork_buffer *dest)
+{
+    const char  *program = cork_exec_program(exec);
+    const char  *cwd = cork_exec_cwd(exec);
+    const char  *path = cork_env_get(cork_exec_env(exec), "PATH");
+    struct cork_buffer  base = CORK_BUFFER_INIT();
+    const char  *dir;
+    int  rc = ENOENT;
+
+    if (path == NULL) {
+        path = CORK_SUBPROCESS_DEFAULT_PATH;
+    }
+
+    /* The child's working directory, as an absolute path */
+    if (cwd == NULL || cwd[0] != '/') {
+        cork_buffer_ensure_size(&base, PATH_MAX);
+        if (getcwd(base.buf, PATH_MAX) == NULL) {
+            rc = errno;
+            cork_buffer_done(&base);
+            return rc;
+        }
+        base.size = strlen(base.buf);
+    }
+    if (cwd != NULL && cwd[0] == '/') {
+        cork_buffer_set_string(&base, cwd);
+    } else if (cwd != NULL) {
+        cork_buffer_append_printf(&base, "/%s", cwd);
+    }
+
+    for (dir = path; ; ) {
+        const char  *end = strchr(dir, ':');
+        size_t  dir_size = (end == NULL)? strlen(dir): (size_t) (end - dir);
+
+        cork_buffer_clear(dest);
+        if (dir_size == 0 || dir[0] != '/') {
+            cork_buffer_append_copy(dest, &base);
+            cork_buffer_append(dest, "/", 1);
+        }
+        if (dir_size == 0) {
+            /* An empty entry means the working directory. */
+            cork_buffer_append(dest, ".", 1);
+        } else {
+            cork_buffer_append(dest, dir, dir_size);
+        }
+        cork_buffer_append(dest, "/", 1);
+        cork_buffer_append_string(dest, program);
+
+        if (access(dest->buf, X_OK) == 0) {
+            rc = 0;
+            break;
+        }
+        if (errno == EACCES) {
+            rc = EACCES;
+        }
+
+        if (end == NULL) {
+            break;
+        }
+        dir = end + 1;
+    }
+
+    cork_buffer_done(&base);
+    return rc;
+}
+
+static int
+cork_subprocess_spawn(struct cork_subprocess *self)
+{
+    struct cork_exec  *exec = self->user_data;
+    posix_spawn_file_actions_t  actions;
+    struct cork_buffer  program = CORK_BUFFER_INIT();
+    pid_t  pid;
+    int  rc;
+
+    rc = posix_spawn_file_actions_init(&actions);
+    if (rc != 0) {
+        goto done;
+    }
+    rc = cork_subprocess_add_pipe_actions
+        (&actions, self->stdin_pipe.fds[0], self->stdin_pipe.fds[1],
+         STDIN_FILENO);
+    if (rc == 0) {
+        rc = cork_subprocess_add_read_pipe_actions
+            (&actions, &self->stdout_pipe, STDOUT_FILENO);
+    }
+    if (rc == 0) {
+        rc = cork_subprocess_add_read_pipe_actions
+            (&actions, &self->stderr_pipe, STDERR_FILENO);
+    }
+#if CORK_SUBPROCESS_HAVE_ADDCHDIR
+    if (rc == 0 && cork_exec_cwd(exec) != NULL) {
+        rc = posix_spawn_file_actions_addchdir_np
+            (&actions, cork_exec_cwd(exec));
+    }
+#endif
+
+    if (rc == 0) {
+        DEBUG("Spawning %s\n", cork_exec_description(exec));
+        /* The exec and its environment cache their argv and envp arrays, so
+         * we don't have to build new copies for every child. */
+        if (cork_exec_env(exec) == NULL) {
+            rc = posix_spawnp
+                (&pid, cork_exec_program(exec), &actions, NULL,
+                 cork_exec_params(exec), cork_env_envp(NULL));
+        } else if (strchr(cork_exec_program(exec), '/') != NULL) {
+            rc = posix_spawn
+                (&pid, cork_exec_program(exec), &actions, NULL,
+                 cork_exec_params(exec), cork_env_envp(cork_exec_env(exec)));
+        } else {
+            rc = cork_subprocess_find_program(exec, &program);
+            if (rc == 0) {
+                DEBUG("  Found %s\n", (char *) program.buf);
+                rc = posix_spawn
+                    (&pid, program.buf, &actions, NULL,
+                     cork_exec_params(exec),
+                     cork_env_envp(cork_exec_env(exec)));
+            }
+        }
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    cork_buffer_done(&program);
+
+done:
+    if (rc != 0) {
+        errno = rc;
+        cork_system_error_set();
+        return -1;
+    }
+    DEBUG("  Child PID=%d\n", (int) pid);
+    self->pid = pid;
+    return 0;
+}
+
+
 /*-----------------------------------------------------------------------
  * Running subprocesses
  */
 
+/* subprocess_spawn(pid, duration_ns) */
+cork_tracepoint(subprocess_spawn);
+
+/* subprocess_reap(pid, status, lifetime_ns) */
+cork_tracepoint(subprocess_reap);
+
 int
 cork_subprocess_start(struct cork_subprocess *self)
 {
     pid_t  pid;
+    uint64_t  start = cork_trace_start(subprocess_spawn);
+    self->start_ns = cork_trace_start(subprocess_reap);
 
     /* Create the stdout and stderr pipes. */
     if (cork_write_pipe_open(&self->stdin_pipe) == -1) {
@@ -408,6 +816,22 @@ cork_subprocess_start(struct cork_subprocess *self)
         return -1;
     }
 
+    /* If we can't spawn the program (because it doesn't exist, for instance),
+     * fall back on forking, so that the child reports the error on its stderr
+     * and exits with an error code, just like it would if we forked. */
+    if (cork_subprocess_can_spawn(self)) {
+        if (cork_subprocess_spawn(self) == 0) {
+            cork_write_pipe_close_read(&self->stdin_pipe);
+            cork_read_pipe_close_write(&self->stdout_pipe);
+            cork_read_pipe_close_write(&self->stderr_pipe);
+            cork_trace2(subprocess_spawn, (int) self->pid,
+                        cork_trace_elapsed(start));
+            return 0;
+        }
+        DEBUG("Cannot spawn child process: %s\n", cork_error_message());
+        cork_error_clear();
+    }
+
     /* Fork the child process. */
     DEBUG("Forking child process\n");
     pid = fork();
@@ -453,6 +877,7 @@ cork_subprocess_start(struct cork_subprocess *self)
         cork_write_pipe_close_read(&self->stdin_pipe);
         cork_read_pipe_close_write(&self->stdout_pipe);
         cork_read_pipe_close_write(&self->stderr_pipe);
+        cork_trace2(subprocess_spawn, (int) pid, cork_trace_elapsed(start));
         return 0;
     }
 }
@@ -464,6 +889,8 @@ cork_subprocess_reap(struct cork_subprocess *self, int flags, bool *progress)
     int  status;
     rii_check_posix(pid = waitpid(self->pid, &status, flags));
     if (pid == self->pid) {
+        cork_trace3(subprocess_reap, pid, status,
+                    cork_trace_elapsed(self->start_ns));
         *progress = true;
         self->pid = 0;
         if (self->exit_code != NULL) {
@@ -494,51 +921,39 @@ cork_subprocess_is_finished(struct cork_subprocess *self)
         && cork_read_pipe_is_finished(&self->stderr_pipe);
 }
 
-#if defined(__APPLE__)
-#include <pthread.h>
-#define THREAD_YIELD   pthread_yield_np
-#elif defined(__linux__) || defined(BSD) || defined(__FreeBSD_kernel__) || defined(__GNU__)
-#include <sched.h>
-#define THREAD_YIELD   sched_yield
-#else
-#error "Unknown thread yield implementation"
-#endif
-
-static void
-cork_subprocess_yield(unsigned int *spin_count)
-{
-    /* Adapted from
-     * http://www.1024cores.net/home/lock-free-algorithms/tricks/spinning */
-
-    if (*spin_count < 10) {
-        /* Spin-wait */
-        cork_pause();
-    } else if (*spin_count < 20) {
-        /* A more intense spin-wait */
-        int  i;
-        for (i = 0; i < 50; i++) {
-            cork_pause();
-        }
-    } else if (*spin_count < 22) {
-        THREAD_YIELD();
-    } else if (*spin_count < 24) {
-        usleep(0);
-    } else if (*spin_count < 50) {
-        usleep(1);
-    } else if (*spin_count < 75) {
-        usleep((*spin_count - 49) * 1000);
-    } else {
-        usleep(25000);
+/* Once there's nothing left to read, we block in poll until one of the pipes
+ * has data, or until a timeout that backs off from 1ms to 25ms.  (We can't
+ * poll for the subprocess exiting, so the timeout is how long it might take
+ * us to notice a subprocess that exits without closing its output pipes
+ * first.) */
+static int
+cork_subprocess_poll(struct pollfd *fds, size_t count,
+                     unsigned int *spin_count)
+{
+    int  timeout = (*spin_count < 5)? (1 << *spin_count): 25;
+    DEBUG("Polling %zu pipes for %d ms\n", count, timeout);
+    if (poll(fds, count, timeout) == -1 && errno != EINTR) {
+        cork_system_error_set();
+        return -1;
     }
-
     (*spin_count)++;
+    return 0;
+}
+
+static size_t
+cork_subprocess_add_pollfds(struct cork_subprocess *self, struct pollfd *fds)
+{
+    size_t  count = 0;
+    cork_read_pipe_add_pollfd(&self->stdout_pipe, fds, &count);
+    cork_read_pipe_add_pollfd(&self->stderr_pipe, fds, &count);
+    return count;
 }
 
 static int
 cork_subprocess_drain_(struct cork_subprocess *self, bool *progress)
 {
-    rii_check(cork_read_pipe_read(&self->stdout_pipe, self->buf, progress));
-    rii_check(cork_read_pipe_read(&self->stderr_pipe, self->buf, progress));
+    rii_check(cork_read_pipe_read(&self->stdout_pipe, &self->buf, progress));
+    rii_check(cork_read_pipe_read(&self->stderr_pipe, &self->buf, progress));
     if (self->pid > 0) {
         return cork_subprocess_reap(self, WNOHANG, progress);
     } else {
@@ -562,8 +977,12 @@ cork_subprocess_wait(struct cork_subprocess *self)
     while (!cork_subprocess_is_finished(self)) {
         progress = false;
         rii_check(cork_subprocess_drain_(self, &progress));
-        if (!progress) {
-            cork_subprocess_yield(&spin_count);
+        if (progress) {
+            spin_count = 0;
+        } else {
+            struct pollfd  fds[2];
+            size_t  count = cork_subprocess_add_pollfds(self, fds);
+            rii_check(cork_subprocess_poll(fds, count, &spin_count));
         }
     }
     return 0;
@@ -654,9 +1073,175 @@ cork_subprocess_group_wait(struct cork_subprocess_group *group)
     while (!cork_subprocess_group_is_finished(group)) {
         progress = false;
         rii_check(cork_subprocess_group_drain_(group, &progress));
-        if (!progress) {
-            cork_subprocess_yield(&spin_count);
+        if (progress) {
+            spin_count = 0;
+        } else {
+            size_t  count = 0;
+            size_t  needed = 2 * cork_array_size(&group->subprocesses);
+            size_t  i;
+            if (group->pollfds_size < needed) {
+                if (group->pollfds != NULL) {
+                    cork_cfree(group->pollfds, group->pollfds_size,
+                               sizeof(struct pollfd));
+                }
+                group->pollfds_size = needed;
+                group->pollfds = cork_calloc(needed, sizeof(struct pollfd));
+            }
+            for (i = 0; i < cork_array_size(&group->subprocesses); i++) {
+                struct cork_subprocess  *sub =
+                    cork_array_at(&group->subprocesses, i);
+                count += cork_subprocess_add_pollfds
+                    (sub, group->pollfds + count);
+            }
+            rii_check(cork_subprocess_poll
+                      (group->pollfds, count, &spin_count));
+        }
+    }
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Running subprocess groups in an event loop
+ */
+
+static int
+cork_subprocess_group_check_done(struct cork_subprocess_group *group)
+{
+    if (group->loop == NULL || group->remaining > 0) {
+        return 0;
+    }
+    DEBUG("Subprocess group finished in event loop\n");
+    cork_event_loop_cancel(group->loop, &group->reap_timer);
+    group->loop = NULL;
+    return group->done(group->user_data, group);
+}
+
+static void
+cork_subprocess_group_schedule_reap(struct cork_subprocess_group *group)
+{
+    unsigned int  delay_ms =
+        (group->spin_count < 5)? (1 << group->spin_count): 25;
+    cork_timestamp  delay;
+    cork_timestamp_init_msec(&delay, 0, delay_ms);
+    cork_event_loop_schedule_after(group->loop, &group->reap_timer, delay);
+    group->spin_count++;
+}
+
+/* Once both of a subprocess's pipes have been closed, the only thing left to
+ * wait for is the process itself.  It has usually exited by then; if not, we
+ * poll for it with the same backoff as cork_subprocess_wait. */
+static int
+cork_subprocess_check_exited(struct cork_subprocess *sub)
+{
+    struct cork_subprocess_group  *group = sub->group;
+    bool  progress = false;
+    if (!cork_read_pipe_is_finished(&sub->stdout_pipe) ||
+        !cork_read_pipe_is_finished(&sub->stderr_pipe)) {
+        return 0;
+    }
+    if (sub->pid > 0) {
+        rii_check(cork_subprocess_reap(sub, WNOHANG, &progress));
+    }
+    if (sub->pid > 0) {
+        cork_dllist_add_to_tail(&group->exiting, &sub->exiting_item);
+        if (!cork_loop_timer_is_scheduled(&group->reap_timer)) {
+            group->spin_count = 0;
+            cork_subprocess_group_schedule_reap(group);
+        }
+    } else {
+        group->remaining--;
+    }
+    return 0;
+}
+
+static int
+cork_subprocess_group__reap(struct cork_event_loop *loop,
+                            struct cork_loop_timer *timer)
+{
+    struct cork_subprocess_group  *group =
+        cork_container_of(timer, struct cork_subprocess_group, reap_timer);
+    struct cork_dllist_item  *curr;
+    struct cork_dllist_item  *next;
+    struct cork_subprocess  *sub;
+    bool  progress = false;
+    cork_dllist_foreach(&group->exiting, curr, next,
+                        struct cork_subprocess, sub, exiting_item) {
+        /* cork_subprocess_abort might have already reaped it. */
+        if (sub->pid > 0) {
+            rii_check(cork_subprocess_reap(sub, WNOHANG, &progress));
+        }
+        if (sub->pid == 0) {
+            cork_dllist_remove(&sub->exiting_item);
+            group->remaining--;
         }
     }
+    if (!cork_dllist_is_empty(&group->exiting)) {
+        if (progress) {
+            group->spin_count = 0;
+        }
+        cork_subprocess_group_schedule_reap(group);
+    }
+    return cork_subprocess_group_check_done(group);
+}
+
+static int
+cork_read_pipe__ready(struct cork_event_loop *loop, struct cork_loop_fd *watch,
+                      unsigned int events)
+{
+    struct cork_read_pipe  *p =
+        cork_container_of(watch, struct cork_read_pipe, watch);
+    struct cork_subprocess  *sub = p->sub;
+    bool  progress = false;
+    rii_check(cork_read_pipe_read(p, &sub->buf, &progress));
+    if (cork_read_pipe_is_finished(p)) {
+        rii_check(cork_subprocess_check_exited(sub));
+        /* This might free the group, and this pipe along with it. */
+        return cork_subprocess_group_check_done(sub->group);
+    }
+    return 0;
+}
+
+static int
+cork_read_pipe_attach(struct cork_read_pipe *p, struct cork_subprocess *sub,
+                      struct cork_event_loop *loop)
+{
+    if (p->fds[0] == -1) {
+        return 0;
+    }
+    p->sub = sub;
+    cork_loop_fd_init(&p->watch, p->fds[0], cork_read_pipe__ready);
+    rii_check(cork_event_loop_add_fd(loop, &p->watch, CORK_LOOP_READABLE));
+    p->loop = loop;
+    return 0;
+}
+
+int
+cork_subprocess_group_attach(struct cork_subprocess_group *group,
+                             struct cork_event_loop *loop, void *user_data,
+                             cork_subprocess_group_done_f done)
+{
+    size_t  i;
+    DEBUG("Attaching subprocess group to event loop\n");
+    group->loop = loop;
+    group->user_data = user_data;
+    group->done = done;
+    group->remaining = 0;
+    for (i = 0; i < cork_array_size(&group->subprocesses); i++) {
+        struct cork_subprocess  *sub = cork_array_at(&group->subprocesses, i);
+        sub->group = group;
+        if (cork_subprocess_is_finished(sub)) {
+            continue;
+        }
+        group->remaining++;
+        rii_check(cork_read_pipe_attach(&sub->stdout_pipe, sub, loop));
+        rii_check(cork_read_pipe_attach(&sub->stderr_pipe, sub, loop));
+        rii_check(cork_subprocess_check_exited(sub));
+    }
+    /* Always call done from the loop, even if everything has already
+     * finished. */
+    if (group->remaining == 0) {
+        cork_event_loop_schedule(loop, &group->reap_timer, 0);
+    }
     return 0;
 }
@@ -0,0 +1,139 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/timestamp.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/buffer.h"
+#include "libcork/threads/atomics.h"
+#include "libcork/threads/basics.h"
+#include "libcork/threads/coarse-clock.h"
+
+
+/* Each thread remembers the most recent string that it formatted, and which
+ * clock and tick it came from.  Strings that don't fit into the cache are
+ * reformatted every time. */
+
+#define CORK_COARSE_CLOCK_CACHE_SIZE  64
+
+struct cork_coarse_clock_cache {
+    size_t  id;
+    cork_timestamp  ts;
+    size_t  size;
+    char  buf[CORK_COARSE_CLOCK_CACHE_SIZE];
+};
+
+cork_tls(struct cork_coarse_clock_cache, cork_coarse_clock_cache);
+
+static volatile size_t  cork_coarse_clock_last_id = 0;
+
+
+void
+cork_coarse_clock_tick(struct cork_coarse_clock *clock)
+{
+    cork_timestamp  now;
+    cork_timestamp  monotonic;
+    cork_timestamp_init_now(&now);
+    cork_timestamp_init_monotonic(&monotonic);
+    cork_atomic_store(&clock->now, now, CORK_ATOMIC_RELAXED);
+    cork_atomic_store(&clock->monotonic, monotonic, CORK_ATOMIC_RELAXED);
+}
+
+struct cork_coarse_clock *
+cork_coarse_clock_new(unsigned int interval_msec, const char *format)
+{
+    struct cork_coarse_clock  *clock =
+        cork_cacheline_new(struct cork_coarse_clock);
+    assert(interval_msec > 0);
+    clock->interval_msec = interval_msec;
+    clock->format = cork_strdup(format);
+    clock->id = cork_size_atomic_add(&cork_coarse_clock_last_id, 1);
+    clock->stopping = 0;
+    clock->ticker = NULL;
+    cork_coarse_clock_tick(clock);
+    return clock;
+}
+
+static int
+cork_coarse_clock__run(void *user_data)
+{
+    struct cork_coarse_clock  *clock = user_data;
+    struct timespec  interval;
+    interval.tv_sec = clock->interval_msec / 1000;
+    interval.tv_nsec = (clock->interval_msec % 1000) * 1000000;
+    while (!cork_atomic_load_acquire(&clock->stopping)) {
+        nanosleep(&interval, NULL);
+        cork_coarse_clock_tick(clock);
+    }
+    return 0;
+}
+
+int
+cork_coarse_clock_start(struct cork_coarse_clock *clock)
+{
+    assert(clock->ticker == NULL);
+    clock->ticker = cork_thread_new
+        ("coarse-clock", clock, NULL, cork_coarse_clock__run);
+    if (CORK_UNLIKELY(cork_thread_start(clock->ticker) != 0)) {
+        cork_thread_free(clock->ticker);
+        clock->ticker = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void
+cork_coarse_clock_free(struct cork_coarse_clock *clock)
+{
+    struct cork_coarse_clock_cache  *cache = cork_coarse_clock_cache_get();
+    if (clock->ticker != NULL) {
+        CORK_ATTR_UNUSED int  rc;
+        cork_atomic_store_release(&clock->stopping, 1);
+        rc = cork_thread_join(clock->ticker);
+        assert(rc == 0);
+    }
+    if (cache->id == clock->id) {
+        cache->id = 0;
+    }
+    cork_strfree(clock->format);
+    cork_cacheline_delete(struct cork_coarse_clock, clock);
+}
+
+int
+cork_coarse_clock_format_utc(struct cork_coarse_clock *clock,
+                             struct cork_buffer *dest)
+{
+    struct cork_coarse_clock_cache  *cache = cork_coarse_clock_cache_get();
+    cork_timestamp  now = cork_coarse_clock_now(clock);
+    size_t  start;
+
+    if (CORK_LIKELY(cache->id == clock->id && cache->ts == now)) {
+        cork_buffer_append(dest, cache->buf, cache->size);
+        return 0;
+    }
+
+    start = dest->size;
+    if (CORK_UNLIKELY(cork_timestamp_format_utc(now, clock->format, dest))) {
+        cache->id = 0;
+        return -1;
+    }
+    if (dest->size - start <= CORK_COARSE_CLOCK_CACHE_SIZE) {
+        cache->id = clock->id;
+        cache->ts = now;
+        cache->size = dest->size - start;
+        memcpy(cache->buf, (char *) dest->buf + start, cache->size);
+    } else {
+        cache->id = 0;
+    }
+    return 0;
+}
@@ -0,0 +1,439 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <assert.h>
+#include <sched.h>
+#include <sys/types.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/types.h"
+#include "libcork/threads/atomics.h"
+#include "libcork/threads/basics.h"
+#include "libcork/threads/epoch.h"
+#include "libcork/threads/locks.h"
+
+
+/* This is Fraser's epoch-based reclamation scheme.  The domain has a global
+ * epoch counter, and each record says whether its thread is in a critical
+ * section, and if so, which epoch it saw when it entered.  The global epoch
+ * can only advance once every active thread has seen the current value.
+ *
+ * An object that's deferred during epoch e might still be visible to threads
+ * that entered during epoch e (or e-1, which were still active when the epoch
+ * advanced to e).  Once the global epoch reaches e+2, all of those threads
+ * must have left their critical sections, and the object is safe to free.
+ * That means that each thread only needs three lists of deferred objects,
+ * indexed by epoch mod 3. */
+
+#define CORK_EPOCH_BUCKETS  3
+
+struct cork_epoch_entry {
+    void  *ptr;
+    /* If NULL, we free ptr with cork_free. */
+    cork_free_f  free_ptr;
+    size_t  size;
+    /* Only used for entries that have been orphaned */
+    size_t  epoch;
+    struct cork_epoch_entry  *next;
+};
+
+struct cork_epoch_bucket {
+    size_t  epoch;
+    struct cork_epoch_entry  *head;
+    size_t  count;
+};
+
+struct cork_epoch_record {
+    /* (epoch << 1) | 1 while the thread is in a critical section, 0
+     * otherwise.  This is the only field that other threads look at, so it
+     * gets a cache line to itself. */
+    volatile size_t  state;
+    char  pad[CORK_CACHELINE_SIZE - sizeof(size_t)];
+
+    /* The thread that's using this record, or 0 if it's free */
+    volatile cork_thread_id  owner;
+    /* The remaining fields are only touched by the owner. */
+    unsigned int  nesting;
+    size_t  pending;
+    struct cork_epoch_bucket  buckets[CORK_EPOCH_BUCKETS];
+    /* Never changes once the record has been added to the domain */
+    struct cork_epoch_record  *next;
+};
+
+struct cork_epoch {
+    volatile size_t  epoch;
+    char  pad[CORK_CACHELINE_SIZE - sizeof(size_t)];
+    struct cork_epoch_record * volatile  records;
+    /* Lets the thread-local cache notice a domain that has been freed and
+     * replaced by a new one at the same address. */
+    size_t  id;
+    /* Objects deferred by threads that have called cork_epoch_thread_done */
+    struct cork_mutex  orphans_mutex;
+    struct cork_epoch_entry * volatile  orphans;
+};
+
+static volatile size_t  cork_epoch_last_id = 0;
+
+struct cork_epoch_cache {
+    size_t  id;
+    struct cork_epoch_record  *record;
+};
+
+cork_tls(struct cork_epoch_cache, cork_epoch_cache);
+
+
+/*-----------------------------------------------------------------------
+ * Deferred objects
+ */
+
+static void
+cork_epoch_entry_free(struct cork_epoch_entry *entry)
+{
+    if (entry->free_ptr == NULL) {
+        cork_free(entry->ptr, entry->size);
+    } else {
+        entry->free_ptr(entry->ptr);
+    }
+    cork_delete(struct cork_epoch_entry, entry);
+}
+
+static void
+cork_epoch_bucket_free(struct cork_epoch_record *record,
+                       struct cork_epoch_bucket *bucket)
+{
+    struct cork_epoch_entry  *entry;
+    struct cork_epoch_entry  *next;
+    for (entry = bucket->head; entry != NULL; entry = next) {
+        next = entry->next;
+        cork_epoch_entry_free(entry);
+    }
+    record->pending -= bucket->count;
+    bucket->head = NULL;
+    bucket->count = 0;
+}
+
+/* Free everything in the current thread's record that is safe to free, given
+ * that the global epoch has reached current. */
+static void
+cork_epoch_record_reclaim(struct cork_epoch_record *record, size_t current)
+{
+    size_t  i;
+    for (i = 0; i < CORK_EPOCH_BUCKETS; i++) {
+        struct cork_epoch_bucket  *bucket = &record->buckets[i];
+        if (bucket->head != NULL && bucket->epoch + 2 <= current) {
+            cork_epoch_bucket_free(record, bucket);
+        }
+    }
+}
+
+static void
+cork_epoch_orphans_reclaim(struct cork_epoch *epoch, size_t current)
+{
+    struct cork_epoch_entry  *entry;
+    struct cork_epoch_entry  *next;
+    struct cork_epoch_entry  *kept = NULL;
+
+    /* Other threads peek at the list without holding the mutex, so we only
+     * ever update it with atomic stores. */
+    if (cork_atomic_load_acquire(&epoch->orphans) == NULL ||
+        !cork_mutex_try_lock(&epoch->orphans_mutex)) {
+        return;
+    }
+
+    for (entry = epoch->orphans; entry != NULL; entry = next) {
+        next = entry->next;
+        if (entry->epoch + 2 <= current) {
+            cork_epoch_entry_free(entry);
+        } else {
+            entry->next = kept;
+            kept = entry;
+        }
+    }
+    cork_atomic_store_release(&epoch->orphans, kept);
+    cork_mutex_unlock(&epoch->orphans_mutex);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Participation records
+ */
+
+static struct cork_epoch_record *
+cork_epoch_record_new(void)
+{
+    struct cork_epoch_record  *record = cork_new(struct cork_epoch_record);
+    size_t  i;
+    record->state = 0;
+    record->owner = 0;
+    record->nesting = 0;
+    record->pending = 0;
+    for (i = 0; i < CORK_EPOCH_BUCKETS; i++) {
+        record->buckets[i].epoch = 0;
+        record->buckets[i].head = NULL;
+        record->buckets[i].count = 0;
+    }
+    record->next = NULL;
+    return record;
+}
+
+static void
+cork_epoch_record_free(struct cork_epoch_record *record)
+{
+    size_t  i;
+    for (i = 0; i < CORK_EPOCH_BUCKETS; i++) {
+        cork_epoch_bucket_free(record, &record->buckets[i]);
+    }
+    cork_delete(struct cork_epoch_record, record);
+}
+
+static struct cork_epoch_record *
+cork_epoch_record_claim(struct cork_epoch *epoch)
+{
+    cork_thread_id  me = cork_current_thread_get_id();
+    struct cork_epoch_record  *record;
+    struct cork_epoch_record  *head;
+
+    /* The thread-local cache only holds one record, so we might already
+     * have one in this domain. */
+    for (record = cork_atomic_load_acquire(&epoch->records);
+         record != NULL; record = record->next) {
+        if (cork_atomic_load(&record->owner, CORK_ATOMIC_RELAXED) == me) {
+            return record;
+        }
+    }
+
+    /* Reuse a record that's been released by some other thread. */
+    for (record = cork_atomic_load_acquire(&epoch->records);
+         record != NULL; record = record->next) {
+        cork_thread_id  expected = 0;
+        if (cork_atomic_load(&record->owner, CORK_ATOMIC_RELAXED) == 0 &&
+            cork_atomic_cas(&record->owner, &expected, me,
+                            CORK_ATOMIC_ACQUIRE, CORK_ATOMIC_RELAXED)) {
+            return record;
+        }
+    }
+
+    record = cork_epoch_record_new();
+    record->owner = me;
+    head = cork_atomic_load(&epoch->records, CORK_ATOMIC_RELAXED);
+    do {
+        record->next = head;
+    } while (!cork_atomic_cas(&epoch->records, &head, record,
+                              CORK_ATOMIC_RELEASE, CORK_ATOMIC_RELAXED));
+    return record;
+}
+
+static struct cork_epoch_record *
+cork_epoch_record_get(struct cork_epoch *epoch)
+{
+    struct cork_epoch_cache  *cache = cork_epoch_cache_get();
+    if (CORK_UNLIKELY(cache->id != epoch->id)) {
+        cache->record = cork_epoch_record_claim(epoch);
+        cache->id = epoch->id;
+    }
+    return cache->record;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Epoch domains
+ */
+
+struct cork_epoch *
+cork_epoch_new(void)
+{
+    struct cork_epoch  *epoch = cork_new(struct cork_epoch);
+    /* Start at 2 so that bucket epochs of 0 never look recent. */
+    epoch->epoch = 2;
+    epoch->records = NULL;
+    epoch->id = cork_size_atomic_add(&cork_epoch_last_id, 1);
+    cork_mutex_init(&epoch->orphans_mutex);
+    epoch->orphans = NULL;
+    return epoch;
+}
+
+void
+cork_epoch_free(struct cork_epoch *epoch)
+{
+    struct cork_epoch_record  *record;
+    struct cork_epoch_record  *next_record;
+    struct cork_epoch_entry  *entry;
+    struct cork_epoch_entry  *next_entry;
+    struct cork_epoch_cache  *cache = cork_epoch_cache_get();
+
+    for (record = epoch->records; record != NULL; record = next_record) {
+        next_record = record->next;
+        assert(record->nesting == 0);
+        cork_epoch_record_free(record);
+    }
+    for (entry = epoch->orphans; entry != NULL; entry = next_entry) {
+        next_entry = entry->next;
+        cork_epoch_entry_free(entry);
+    }
+    if (cache->id == epoch->id) {
+        cache->id = 0;
+        cache->record = NULL;
+    }
+    cork_mutex_done(&epoch->orphans_mutex);
+    cork_delete(struct cork_epoch, epoch);
+}
+
+void
+cork_epoch_enter(struct cork_epoch *epoch)
+{
+    struct cork_epoch_record  *record = cork_epoch_record_get(epoch);
+    if (record->nesting++ == 0) {
+        size_t  current = cork_atomic_load(&epoch->epoch, CORK_ATOMIC_RELAXED);
+        cork_atomic_store(&record->state, (current << 1) | 1,
+                          CORK_ATOMIC_RELAXED);
+        /* Our reads of the data structure can't be moved before we announce
+         * ourselves. */
+        cork_atomic_fence(CORK_ATOMIC_SEQ_CST);
+    }
+}
+
+void
+cork_epoch_exit(struct cork_epoch *epoch)
+{
+    struct cork_epoch_record  *record = cork_epoch_record_get(epoch);
+    assert(record->nesting > 0);
+    if (--record->nesting == 0) {
+        cork_atomic_store_release(&record->state, 0);
+    }
+}
+
+/* Advance the global epoch if every active thread has seen its current value.
+ * Returns the value of the global epoch afterwards. */
+static size_t
+cork_epoch_try_advance(struct cork_epoch *epoch)
+{
+    struct cork_epoch_record  *record;
+    size_t  current;
+
+    cork_atomic_fence(CORK_ATOMIC_SEQ_CST);
+    current = cork_atomic_load_acquire(&epoch->epoch);
+    for (record = cork_atomic_load_acquire(&epoch->records);
+         record != NULL; record = record->next) {
+        size_t  state = cork_atomic_load_acquire(&record->state);
+        if ((state & 1) != 0 && (state >> 1) != current) {
+            return current;
+        }
+    }
+
+    /* If this fails, someone else has already advanced the epoch. */
+    if (!cork_atomic_cas(&epoch->epoch, &current, current + 1,
+                         CORK_ATOMIC_ACQ_REL, CORK_ATOMIC_ACQUIRE)) {
+        return current;
+    }
+    return current + 1;
+}
+
+static void
+cork_epoch_defer_entry(struct cork_epoch *epoch,
+                       struct cork_epoch_entry *entry)
+{
+    struct cork_epoch_record  *record = cork_epoch_record_get(epoch);
+    size_t  current = cork_atomic_load_acquire(&epoch->epoch);
+    struct cork_epoch_bucket  *bucket =
+        &record->buckets[current % CORK_EPOCH_BUCKETS];
+
+    /* Anything left over in this bucket is from at least three epochs ago,
+     * so it's definitely safe to free. */
+    if (bucket->epoch != current) {
+        cork_epoch_bucket_free(record, bucket);
+        bucket->epoch = current;
+    }
+
+    entry->next = bucket->head;
+    bucket->head = entry;
+    bucket->count++;
+    if (++record->pending >= CORK_EPOCH_RECLAIM_THRESHOLD) {
+        cork_epoch_reclaim(epoch);
+    }
+}
+
+void
+cork_epoch_defer(struct cork_epoch *epoch, void *ptr, cork_free_f free_ptr)
+{
+    struct cork_epoch_entry  *entry = cork_new(struct cork_epoch_entry);
+    entry->ptr = ptr;
+    entry->free_ptr = free_ptr;
+    entry->size = 0;
+    cork_epoch_defer_entry(epoch, entry);
+}
+
+void
+cork_epoch_defer_free(struct cork_epoch *epoch, void *ptr, size_t size)
+{
+    struct cork_epoch_entry  *entry = cork_new(struct cork_epoch_entry);
+    entry->ptr = ptr;
+    entry->free_ptr = NULL;
+    entry->size = size;
+    cork_epoch_defer_entry(epoch, entry);
+}
+
+void
+cork_epoch_reclaim(struct cork_epoch *epoch)
+{
+    struct cork_epoch_record  *record = cork_epoch_record_get(epoch);
+    size_t  current = cork_epoch_try_advance(epoch);
+    cork_epoch_record_reclaim(record, current);
+    cork_epoch_orphans_reclaim(epoch, current);
+}
+
+void
+cork_epoch_synchronize(struct cork_epoch *epoch)
+{
+    struct cork_epoch_record  *record = cork_epoch_record_get(epoch);
+    size_t  target = cork_atomic_load_acquire(&epoch->epoch) + 2;
+    size_t  current;
+    unsigned int  spins = 0;
+
+    assert(record->nesting == 0);
+    while ((ssize_t) ((current = cork_epoch_try_advance(epoch)) - target) < 0) {
+        if (++spins < CORK_MUTEX_SPIN_COUNT) {
+            cork_pause();
+        } else {
+            spins = 0;
+            sched_yield();
+        }
+    }
+    cork_epoch_record_reclaim(record, current);
+    cork_epoch_orphans_reclaim(epoch, current);
+}
+
+void
+cork_epoch_thread_done(struct cork_epoch *epoch)
+{
+    struct cork_epoch_cache  *cache = cork_epoch_cache_get();
+    struct cork_epoch_record  *record = cork_epoch_record_get(epoch);
+    size_t  i;
+
+    assert(record->nesting == 0);
+    cork_mutex_lock(&epoch->orphans_mutex);
+    for (i = 0; i < CORK_EPOCH_BUCKETS; i++) {
+        struct cork_epoch_bucket  *bucket = &record->buckets[i];
+        struct cork_epoch_entry  *entry;
+        struct cork_epoch_entry  *next;
+        for (entry = bucket->head; entry != NULL; entry = next) {
+            next = entry->next;
+            entry->epoch = bucket->epoch;
+            entry->next = epoch->orphans;
+            cork_atomic_store_release(&epoch->orphans, entry);
+        }
+        bucket->head = NULL;
+        bucket->count = 0;
+    }
+    record->pending = 0;
+    cork_mutex_unlock(&epoch->orphans_mutex);
+
+    cork_atomic_store_release(&record->owner, 0);
+    cache->id = 0;
+    cache->record = NULL;
+}
@@ -0,0 +1,571 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+
+#if defined(__linux)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__APPLE__) && defined(__MACH__)
+/* These are private, but they're what libc++ and the Swift runtime use to
+ * get futex-like waits on Mac OS X. */
+#define CORK_UL_COMPARE_AND_WAIT  1
+#define CORK_ULF_WAKE_ALL  0x00000100
+#define CORK_ULF_NO_ERRNO  0x01000000
+extern int
+__ulock_wait(uint32_t operation, void *addr, uint64_t value,
+             uint32_t timeout_us);
+extern int
+__ulock_wake(uint32_t operation, void *addr, uint64_t wake_value);
+#endif
+
+#include "libcork/core/types.h"
+#include "libcork/threads/atomics.h"
+#include "libcork/threads/basics.h"
+#include "libcork/threads/locks.h"
+
+
+/*-----------------------------------------------------------------------
+ * Parking
+ */
+
+/* Sleep for as long as *addr contains value.  This can return early, so
+ * callers must recheck whatever they were waiting for. */
+static void
+cork_lock_park(volatile int *addr, int value)
+{
+#if defined(__linux)
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#elif defined(__APPLE__) && defined(__MACH__)
+    __ulock_wait(CORK_UL_COMPARE_AND_WAIT | CORK_ULF_NO_ERRNO,
+                 (void *) addr, (uint32_t) value, 0);
+#else
+    sched_yield();
+#endif
+}
+
+static void
+cork_lock_unpark(volatile int *addr, int count)
+{
+#if defined(__linux)
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#elif defined(__APPLE__) && defined(__MACH__)
+    __ulock_wake(CORK_UL_COMPARE_AND_WAIT | CORK_ULF_NO_ERRNO |
+                 (count > 1? CORK_ULF_WAKE_ALL: 0), (void *) addr, 0);
+#endif
+}
+
+
+/* The same, but with a timeout.  A NULL deadline means to wait forever.
+ * Returns false if the deadline has passed. */
+
+struct cork_lock_deadline {
+    struct timespec  end;
+};
+
+static void
+cork_lock_deadline_init(struct cork_lock_deadline *deadline,
+                        unsigned int timeout_ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, &deadline->end);
+    deadline->end.tv_sec += timeout_ms / 1000;
+    deadline->end.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (deadline->end.tv_nsec >= 1000000000) {
+        deadline->end.tv_sec++;
+        deadline->end.tv_nsec -= 1000000000;
+    }
+}
+
+/* Fills in how long we have left until the deadline, returning false if
+ * there isn't any time left. */
+static bool
+cork_lock_deadline_remaining(const struct cork_lock_deadline *deadline,
+                             struct timespec *remaining)
+{
+    struct timespec  now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining->tv_sec = deadline->end.tv_sec - now.tv_sec;
+    remaining->tv_nsec = deadline->end.tv_nsec - now.tv_nsec;
+    if (remaining->tv_nsec < 0) {
+        remaining->tv_sec--;
+        remaining->tv_nsec += 1000000000;
+    }
+    return remaining->tv_sec > 0 ||
+        (remaining->tv_sec == 0 && remaining->tv_nsec > 0);
+}
+
+static bool
+cork_lock_park_until(volatile int *addr, int value,
+                     const struct cork_lock_deadline *deadline)
+{
+    struct timespec  remaining;
+    if (deadline == NULL) {
+        cork_lock_park(addr, value);
+        return true;
+    }
+    if (!cork_lock_deadline_remaining(deadline, &remaining)) {
+        return false;
+    }
+#if defined(__linux)
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, &remaining, NULL, 0);
+#elif defined(__APPLE__) && defined(__MACH__)
+    {
+        uint64_t  us = (uint64_t) remaining.tv_sec * 1000000 +
+            remaining.tv_nsec / 1000;
+        __ulock_wait(CORK_UL_COMPARE_AND_WAIT | CORK_ULF_NO_ERRNO,
+                     (void *) addr, (uint32_t) value,
+                     (us == 0)? 1: (us > UINT32_MAX)? UINT32_MAX: us);
+    }
+#else
+    sched_yield();
+#endif
+    /* We recheck the deadline on the next call, so a timeout looks just like
+     * a spurious wakeup. */
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Mutexes
+ */
+
+/* This is the second mutex from Drepper's "Futexes are tricky".  We only make
+ * a system call to unlock the mutex if some other thread might be asleep
+ * waiting for it. */
+
+bool
+cork_mutex_try_lock(struct cork_mutex *mutex)
+{
+    int  expected = 0;
+    return cork_atomic_cas(&mutex->state, &expected, 1,
+                           CORK_ATOMIC_ACQUIRE, CORK_ATOMIC_RELAXED);
+}
+
+void
+cork_mutex_lock(struct cork_mutex *mutex)
+{
+    unsigned int  spins;
+    int  state;
+
+    if (CORK_LIKELY(cork_mutex_try_lock(mutex))) {
+        return;
+    }
+
+    for (spins = 0; spins < CORK_MUTEX_SPIN_COUNT; spins++) {
+        cork_pause();
+        if (cork_atomic_load(&mutex->state, CORK_ATOMIC_RELAXED) == 0 &&
+            cork_mutex_try_lock(mutex)) {
+            return;
+        }
+    }
+
+    /* Mark the mutex as contended before we go to sleep, so that whoever
+     * holds it knows to wake us up. */
+    state = cork_atomic_exchange(&mutex->state, 2, CORK_ATOMIC_ACQUIRE);
+    while (state != 0) {
+        cork_lock_park(&mutex->state, 2);
+        state = cork_atomic_exchange(&mutex->state, 2, CORK_ATOMIC_ACQUIRE);
+    }
+}
+
+void
+cork_mutex_unlock(struct cork_mutex *mutex)
+{
+    int  prior = cork_atomic_exchange(&mutex->state, 0, CORK_ATOMIC_RELEASE);
+    assert(prior != 0);
+    if (CORK_UNLIKELY(prior == 2)) {
+        cork_lock_unpark(&mutex->state, 1);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Reader-writer locks
+ */
+
+static void
+cork_rwlock_backoff(unsigned int *spins)
+{
+    if (++*spins < CORK_MUTEX_SPIN_COUNT) {
+        cork_pause();
+    } else {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+/* Each thread always uses the same reader counter, so we don't have to pass
+ * anything from cork_rwlock_read_lock to cork_rwlock_read_unlock. */
+static struct cork_rwlock_stripe *
+cork_rwlock_current_stripe(struct cork_rwlock *lock)
+{
+    return &lock->readers
+        [cork_current_thread_get_id() % CORK_RWLOCK_READER_STRIPES];
+}
+
+void
+cork_rwlock_init(struct cork_rwlock *lock)
+{
+    size_t  i;
+    for (i = 0; i < CORK_RWLOCK_READER_STRIPES; i++) {
+        lock->readers[i].count = 0;
+    }
+    lock->writer = 0;
+    cork_mutex_init(&lock->writer_mutex);
+}
+
+void
+cork_rwlock_read_lock(struct cork_rwlock *lock)
+{
+    struct cork_rwlock_stripe  *stripe = cork_rwlock_current_stripe(lock);
+    while (true) {
+        unsigned int  spins = 0;
+        /* Announce ourselves before checking for a writer; the writer does
+         * the opposite, so at least one of us will see the other. */
+        cork_atomic_fetch_add(&stripe->count, 1, CORK_ATOMIC_SEQ_CST);
+        if (CORK_LIKELY(!cork_atomic_load(&lock->writer,
+                                          CORK_ATOMIC_SEQ_CST))) {
+            return;
+        }
+
+        /* Get out of the writer's way until it's done. */
+        cork_atomic_fetch_sub(&stripe->count, 1, CORK_ATOMIC_RELEASE);
+        while (true) {
+            int  writer = cork_atomic_load_acquire(&lock->writer);
+            if (writer == 0) {
+                break;
+            } else if (spins < CORK_MUTEX_SPIN_COUNT) {
+                cork_pause();
+                spins++;
+            } else {
+                /* Let the writer know that it has to wake us up. */
+                if (writer == 1) {
+                    cork_atomic_cas(&lock->writer, &writer, 2,
+                                    CORK_ATOMIC_RELAXED, CORK_ATOMIC_RELAXED);
+                }
+                cork_lock_park(&lock->writer, 2);
+            }
+        }
+    }
+}
+
+void
+cork_rwlock_read_unlock(struct cork_rwlock *lock)
+{
+    struct cork_rwlock_stripe  *stripe = cork_rwlock_current_stripe(lock);
+    cork_atomic_fetch_sub(&stripe->count, 1, CORK_ATOMIC_RELEASE);
+}
+
+void
+cork_rwlock_write_lock(struct cork_rwlock *lock)
+{
+    unsigned int  spins = 0;
+    size_t  i;
+    cork_mutex_lock(&lock->writer_mutex);
+    cork_atomic_store(&lock->writer, 1, CORK_ATOMIC_SEQ_CST);
+    for (i = 0; i < CORK_RWLOCK_READER_STRIPES; i++) {
+        while (cork_atomic_load(&lock->readers[i].count,
+                                CORK_ATOMIC_SEQ_CST) != 0) {
+            cork_rwlock_backoff(&spins);
+        }
+    }
+}
+
+void
+cork_rwlock_write_unlock(struct cork_rwlock *lock)
+{
+    int  prior = cork_atomic_exchange(&lock->writer, 0, CORK_ATOMIC_RELEASE);
+    if (CORK_UNLIKELY(prior == 2)) {
+        cork_lock_unpark(&lock->writer, INT_MAX);
+    }
+    cork_mutex_unlock(&lock->writer_mutex);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Events
+ */
+
+/* state is 0 if the event isn't set, 1 if it is, and 2 if it isn't set and
+ * someone might be asleep waiting for it.  We only wake anyone up if we
+ * replace a 2.  When an auto-reset event is consumed by a thread that had to
+ * go to sleep, it resets the event to 2 rather than 0, since other threads
+ * might still be asleep too. */
+
+void
+cork_event_init(struct cork_event *event, bool manual_reset)
+{
+    event->state = 0;
+    event->manual_reset = manual_reset;
+}
+
+void
+cork_event_set(struct cork_event *event)
+{
+    int  prior = cork_atomic_exchange(&event->state, 1, CORK_ATOMIC_RELEASE);
+    if (CORK_UNLIKELY(prior == 2)) {
+        cork_lock_unpark(&event->state, event->manual_reset? INT_MAX: 1);
+    }
+}
+
+void
+cork_event_reset(struct cork_event *event)
+{
+    int  expected = 1;
+    cork_atomic_cas(&event->state, &expected, 0,
+                    CORK_ATOMIC_RELAXED, CORK_ATOMIC_RELAXED);
+}
+
+bool
+cork_event_is_set(struct cork_event *event)
+{
+    return cork_atomic_load_acquire(&event->state) == 1;
+}
+
+/* Returns whether the event was set, consuming it if it's an auto-reset
+ * event.  consumed is the state we leave an auto-reset event in. */
+static bool
+cork_event_check(struct cork_event *event, int consumed)
+{
+    int  expected = 1;
+    if (event->manual_reset) {
+        return cork_atomic_load_acquire(&event->state) == 1;
+    }
+    return cork_atomic_cas(&event->state, &expected, consumed,
+                           CORK_ATOMIC_ACQUIRE, CORK_ATOMIC_RELAXED);
+}
+
+bool
+cork_event_try_wait(struct cork_event *event)
+{
+    return cork_event_check(event, 0);
+}
+
+static bool
+cork_event_wait_until(struct cork_event *event,
+                      const struct cork_lock_deadline *deadline)
+{
+    unsigned int  spins;
+
+    if (CORK_LIKELY(cork_event_check(event, 0))) {
+        return true;
+    }
+    for (spins = 0; spins < CORK_MUTEX_SPIN_COUNT; spins++) {
+        cork_pause();
+        if (cork_event_check(event, 0)) {
+            return true;
+        }
+    }
+
+    while (true) {
+        int  state = 0;
+        if (cork_event_check(event, 2)) {
+            return true;
+        }
+        /* Let whoever sets the event know that they have to wake us up. */
+        if (!cork_atomic_cas(&event->state, &state, 2,
+                             CORK_ATOMIC_RELAXED, CORK_ATOMIC_RELAXED) &&
+            state != 2) {
+            continue;
+        }
+        if (!cork_lock_park_until(&event->state, 2, deadline)) {
+            return false;
+        }
+    }
+}
+
+void
+cork_event_wait(struct cork_event *event)
+{
+    cork_event_wait_until(event, NULL);
+}
+
+bool
+cork_event_timed_wait(struct cork_event *event, unsigned int timeout_ms)
+{
+    struct cork_lock_deadline  deadline;
+    if (CORK_LIKELY(cork_event_check(event, 0))) {
+        return true;
+    }
+    cork_lock_deadline_init(&deadline, timeout_ms);
+    return cork_event_wait_until(event, &deadline);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Semaphores
+ */
+
+/* Posters only make a system call if someone has said that they might be
+ * asleep.  A waiter announces itself before going to sleep, and a poster
+ * bumps the count before looking for waiters, so at least one of them will
+ * see the other. */
+
+void
+cork_semaphore_init(struct cork_semaphore *sem, unsigned int count)
+{
+    sem->count = count;
+    sem->waiters = 0;
+}
+
+bool
+cork_semaphore_try_wait(struct cork_semaphore *sem)
+{
+    int  count = cork_atomic_load(&sem->count, CORK_ATOMIC_RELAXED);
+    while (count > 0) {
+        if (cork_atomic_cas(&sem->count, &count, count - 1,
+                            CORK_ATOMIC_ACQUIRE, CORK_ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+cork_semaphore_wait_until(struct cork_semaphore *sem,
+                          const struct cork_lock_deadline *deadline)
+{
+    unsigned int  spins;
+
+    for (spins = 0; spins < CORK_MUTEX_SPIN_COUNT; spins++) {
+        if (cork_semaphore_try_wait(sem)) {
+            return true;
+        }
+        cork_pause();
+    }
+
+    while (true) {
+        bool  in_time;
+        if (cork_semaphore_try_wait(sem)) {
+            return true;
+        }
+        cork_atomic_fetch_add(&sem->waiters, 1, CORK_ATOMIC_SEQ_CST);
+        if (cork_atomic_load(&sem->count, CORK_ATOMIC_SEQ_CST) > 0) {
+            cork_atomic_fetch_sub(&sem->waiters, 1, CORK_ATOMIC_RELAXED);
+            continue;
+        }
+        in_time = cork_lock_park_until(&sem->count, 0, deadline);
+        cork_atomic_fetch_sub(&sem->waiters, 1, CORK_ATOMIC_RELAXED);
+        if (!in_time) {
+            return false;
+        }
+    }
+}
+
+void
+cork_semaphore_wait(struct cork_semaphore *sem)
+{
+    cork_semaphore_wait_until(sem, NULL);
+}
+
+bool
+cork_semaphore_timed_wait(struct cork_semaphore *sem, unsigned int timeout_ms)
+{
+    struct cork_lock_deadline  deadline;
+    if (CORK_LIKELY(cork_semaphore_try_wait(sem))) {
+        return true;
+    }
+    cork_lock_deadline_init(&deadline, timeout_ms);
+    return cork_semaphore_wait_until(sem, &deadline);
+}
+
+void
+cork_semaphore_post(struct cork_semaphore *sem, unsigned int count)
+{
+    cork_atomic_fetch_add(&sem->count, (int) count, CORK_ATOMIC_SEQ_CST);
+    if (CORK_UNLIKELY(cork_atomic_load(&sem->waiters,
+                                       CORK_ATOMIC_SEQ_CST) > 0)) {
+        cork_lock_unpark(&sem->count, (count > INT_MAX)? INT_MAX: count);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Parking threads
+ */
+
+/* state is 0 if there's no permit, 1 if there is, and -1 if the owner is
+ * asleep waiting for one. */
+
+cork_tls_fast(struct cork_parker, cork_parker);
+
+struct cork_parker *
+cork_parker_current(void)
+{
+    return cork_parker_get();
+}
+
+static bool
+cork_parker_park_until(struct cork_parker *parker,
+                       const struct cork_lock_deadline *deadline)
+{
+    unsigned int  spins;
+    int  state;
+
+    if (CORK_LIKELY(cork_atomic_exchange
+                    (&parker->state, 0, CORK_ATOMIC_ACQUIRE) == 1)) {
+        return true;
+    }
+    for (spins = 0; spins < CORK_MUTEX_SPIN_COUNT; spins++) {
+        cork_pause();
+        if (cork_atomic_load(&parker->state, CORK_ATOMIC_RELAXED) == 1 &&
+            cork_atomic_exchange(&parker->state, 0, CORK_ATOMIC_ACQUIRE)
+            == 1) {
+            return true;
+        }
+    }
+
+    /* Only the parker's owner ever changes it from 1 back to 0, so if this
+     * fails, the permit must have just arrived. */
+    state = 0;
+    if (!cork_atomic_cas(&parker->state, &state, -1,
+                         CORK_ATOMIC_ACQUIRE, CORK_ATOMIC_ACQUIRE)) {
+        cork_atomic_store(&parker->state, 0, CORK_ATOMIC_RELAXED);
+        return true;
+    }
+    while (cork_atomic_load_acquire(&parker->state) == -1) {
+        if (!cork_lock_park_until(&parker->state, -1, deadline)) {
+            /* Give up, unless the permit arrives while we're leaving. */
+            return cork_atomic_exchange
+                (&parker->state, 0, CORK_ATOMIC_ACQUIRE) == 1;
+        }
+    }
+    cork_atomic_store(&parker->state, 0, CORK_ATOMIC_RELAXED);
+    return true;
+}
+
+void
+cork_parker_park(struct cork_parker *parker)
+{
+    cork_parker_park_until(parker, NULL);
+}
+
+bool
+cork_parker_timed_park(struct cork_parker *parker, unsigned int timeout_ms)
+{
+    struct cork_lock_deadline  deadline;
+    cork_lock_deadline_init(&deadline, timeout_ms);
+    return cork_parker_park_until(parker, &deadline);
+}
+
+void
+cork_parker_unpark(struct cork_parker *parker)
+{
+    int  prior = cork_atomic_exchange(&parker->state, 1, CORK_ATOMIC_RELEASE);
+    if (prior == -1) {
+        cork_lock_unpark(&parker->state, 1);
+    }
+}
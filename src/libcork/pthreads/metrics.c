@@ -0,0 +1,765 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/attributes.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/array.h"
+#include "libcork/ds/buffer.h"
+#include "libcork/threads/atomics.h"
+#include "libcork/threads/basics.h"
+#include "libcork/threads/locks.h"
+#include "libcork/threads/metrics.h"
+
+
+/* Each thread has its own shard of every registry that it uses.  A shard
+ * holds a separate array of 64-bit cells for each metric, which only the
+ * owning thread ever writes to, so recording a value is just a couple of
+ * relaxed loads and stores.  We only allocate a metric's cells once a thread
+ * actually updates it.  To find them, we use the metric's ID as an index into
+ * a two-level table, whose levels are also allocated on demand.  Nothing is
+ * ever removed from a shard, so readers can walk the table without any
+ * locking, as long as each pointer is published with a release store.
+ *
+ * When a thread is done with a registry, it gives up its shard, and some
+ * other thread can claim it later on.  The cells keep their values, so nothing
+ * that the first thread recorded is lost. */
+
+#define CORK_METRICS_BLOCK_BITS  8
+#define CORK_METRICS_BLOCK_SIZE  (1 << CORK_METRICS_BLOCK_BITS)
+#define CORK_METRICS_BLOCK_MASK  (CORK_METRICS_BLOCK_SIZE - 1)
+#define CORK_METRICS_MAX_BLOCKS  256
+#define CORK_METRICS_MAX_METRICS \
+    (CORK_METRICS_MAX_BLOCKS * CORK_METRICS_BLOCK_SIZE)
+
+enum cork_metric_type {
+    CORK_METRIC_COUNTER,
+    CORK_METRIC_HISTOGRAM
+};
+
+struct cork_metric {
+    struct cork_metrics  *metrics;
+    enum cork_metric_type  type;
+    size_t  id;
+    size_t  cell_count;
+    const char  *name;
+    const char  *help;
+};
+
+struct cork_counter {
+    struct cork_metric  parent;
+};
+
+/* A histogram's cells hold the sum of the recorded values, the bitwise
+ * complement of the smallest value (so that a zero cell means "nothing
+ * recorded yet"), the largest value, and then the bucket counts. */
+#define CORK_HISTOGRAM_SUM  0
+#define CORK_HISTOGRAM_INVERTED_MIN  1
+#define CORK_HISTOGRAM_MAX  2
+#define CORK_HISTOGRAM_BUCKETS  3
+
+struct cork_histogram {
+    struct cork_metric  parent;
+    uint64_t  max_value;
+    unsigned int  precision;
+    size_t  bucket_count;
+};
+
+struct cork_metrics_block {
+    uint64_t * volatile  cells[CORK_METRICS_BLOCK_SIZE];
+};
+
+struct cork_metrics_shard {
+    /* The thread that's using this shard, or 0 if it's free */
+    volatile cork_thread_id  owner;
+    struct cork_metrics_block * volatile  blocks[CORK_METRICS_MAX_BLOCKS];
+    /* Never changes once the shard has been added to the registry */
+    struct cork_metrics_shard  *next;
+};
+
+struct cork_metrics {
+    struct cork_metrics_shard * volatile  shards;
+    /* Lets the thread-local cache notice a registry that has been freed and
+     * replaced by a new one at the same address. */
+    size_t  id;
+    /* Protects the list of metrics.  Recording values never needs it. */
+    struct cork_mutex  mutex;
+    cork_array(struct cork_metric *)  metrics;
+};
+
+static volatile size_t  cork_metrics_last_id = 0;
+
+struct cork_metrics_cache {
+    size_t  id;
+    struct cork_metrics_shard  *shard;
+};
+
+cork_tls(struct cork_metrics_cache, cork_metrics_cache);
+
+
+/*-----------------------------------------------------------------------
+ * Shards
+ */
+
+static struct cork_metrics_shard *
+cork_metrics_shard_new(void)
+{
+    struct cork_metrics_shard  *shard = cork_new(struct cork_metrics_shard);
+    memset(shard, 0, sizeof(struct cork_metrics_shard));
+    return shard;
+}
+
+static void
+cork_metrics_shard_free(struct cork_metrics *metrics,
+                        struct cork_metrics_shard *shard)
+{
+    size_t  i;
+    size_t  j;
+    for (i = 0; i < CORK_METRICS_MAX_BLOCKS; i++) {
+        struct cork_metrics_block  *block = shard->blocks[i];
+        if (block == NULL) {
+            continue;
+        }
+        for (j = 0; j < CORK_METRICS_BLOCK_SIZE; j++) {
+            if (block->cells[j] != NULL) {
+                struct cork_metric  *metric = cork_array_at
+                    (&metrics->metrics, (i << CORK_METRICS_BLOCK_BITS) | j);
+                cork_aligned_free(block->cells[j],
+                                  metric->cell_count * sizeof(uint64_t),
+                                  CORK_CACHELINE_SIZE);
+            }
+        }
+        cork_delete(struct cork_metrics_block, block);
+    }
+    cork_delete(struct cork_metrics_shard, shard);
+}
+
+static struct cork_metrics_shard *
+cork_metrics_shard_claim(struct cork_metrics *metrics)
+{
+    cork_thread_id  me = cork_current_thread_get_id();
+    struct cork_metrics_shard  *shard;
+    struct cork_metrics_shard  *head;
+
+    /* The thread-local cache only holds one shard, so we might already have
+     * one in this registry. */
+    for (shard = cork_atomic_load_acquire(&metrics->shards);
+         shard != NULL; shard = shard->next) {
+        if (cork_atomic_load(&shard->owner, CORK_ATOMIC_RELAXED) == me) {
+            return shard;
+        }
+    }
+
+    /* Reuse a shard that's been released by some other thread. */
+    for (shard = cork_atomic_load_acquire(&metrics->shards);
+         shard != NULL; shard = shard->next) {
+        cork_thread_id  expected = 0;
+        if (cork_atomic_load(&shard->owner, CORK_ATOMIC_RELAXED) == 0 &&
+            cork_atomic_cas(&shard->owner, &expected, me,
+                            CORK_ATOMIC_ACQUIRE, CORK_ATOMIC_RELAXED)) {
+            return shard;
+        }
+    }
+
+    shard = cork_metrics_shard_new();
+    shard->owner = me;
+    head = cork_atomic_load(&metrics->shards, CORK_ATOMIC_RELAXED);
+    do {
+        shard->next = head;
+    } while (!cork_atomic_cas(&metrics->shards, &head, shard,
+                              CORK_ATOMIC_RELEASE, CORK_ATOMIC_RELAXED));
+    return shard;
+}
+
+static struct cork_metrics_shard *
+cork_metrics_shard_get(struct cork_metrics *metrics)
+{
+    struct cork_metrics_cache  *cache = cork_metrics_cache_get();
+    if (CORK_UNLIKELY(cache->id != metrics->id)) {
+        cache->shard = cork_metrics_shard_claim(metrics);
+        cache->id = metrics->id;
+    }
+    return cache->shard;
+}
+
+/* Only the shard's owner can call this. */
+static uint64_t *
+cork_metrics_shard_allocate_cells(struct cork_metrics_shard *shard,
+                                  struct cork_metric *metric)
+{
+    size_t  block_index = metric->id >> CORK_METRICS_BLOCK_BITS;
+    struct cork_metrics_block  *block = shard->blocks[block_index];
+    uint64_t  *cells;
+    if (block == NULL) {
+        block = cork_new(struct cork_metrics_block);
+        memset(block, 0, sizeof(struct cork_metrics_block));
+        cork_atomic_store_release(&shard->blocks[block_index], block);
+    }
+    cells = cork_aligned_calloc
+        (metric->cell_count, sizeof(uint64_t), CORK_CACHELINE_SIZE);
+    cork_atomic_store_release
+        (&block->cells[metric->id & CORK_METRICS_BLOCK_MASK], cells);
+    return cells;
+}
+
+/* Returns the current thread's cells for metric. */
+static uint64_t *
+cork_metric_local_cells(struct cork_metric *metric)
+{
+    struct cork_metrics_shard  *shard = cork_metrics_shard_get(metric->metrics);
+    struct cork_metrics_block  *block =
+        shard->blocks[metric->id >> CORK_METRICS_BLOCK_BITS];
+    uint64_t  *cells;
+    if (CORK_UNLIKELY(block == NULL)) {
+        return cork_metrics_shard_allocate_cells(shard, metric);
+    }
+    cells = block->cells[metric->id & CORK_METRICS_BLOCK_MASK];
+    if (CORK_UNLIKELY(cells == NULL)) {
+        return cork_metrics_shard_allocate_cells(shard, metric);
+    }
+    return cells;
+}
+
+/* Returns a shard's cells for metric, or NULL if the shard's threads have
+ * never updated it.  Any thread can call this. */
+static uint64_t *
+cork_metric_shard_cells(struct cork_metric *metric,
+                        struct cork_metrics_shard *shard)
+{
+    struct cork_metrics_block  *block = cork_atomic_load_acquire
+        (&shard->blocks[metric->id >> CORK_METRICS_BLOCK_BITS]);
+    if (block == NULL) {
+        return NULL;
+    }
+    return cork_atomic_load_acquire
+        (&block->cells[metric->id & CORK_METRICS_BLOCK_MASK]);
+}
+
+/* The owner is the only thread that writes to a cell, so it doesn't need an
+ * atomic read-modify-write; the atomic store just makes sure that readers
+ * never see a torn value. */
+#define cork_metric_cell_get(cell) \
+    (cork_atomic_load((cell), CORK_ATOMIC_RELAXED))
+#define cork_metric_cell_set(cell, value) \
+    (cork_atomic_store((cell), (value), CORK_ATOMIC_RELAXED))
+#define cork_metric_cell_add(cell, delta) \
+    (cork_metric_cell_set((cell), *(cell) + (delta)))
+
+
+/*-----------------------------------------------------------------------
+ * Registries
+ */
+
+struct cork_metrics *
+cork_metrics_new(void)
+{
+    struct cork_metrics  *metrics = cork_new(struct cork_metrics);
+    metrics->shards = NULL;
+    metrics->id = cork_size_atomic_add(&cork_metrics_last_id, 1);
+    cork_mutex_init(&metrics->mutex);
+    cork_array_init(&metrics->metrics);
+    return metrics;
+}
+
+static void
+cork_metric_free(struct cork_metric *metric)
+{
+    cork_strfree(metric->name);
+    cork_strfree(metric->help);
+    switch (metric->type) {
+        case CORK_METRIC_COUNTER:
+            cork_delete(struct cork_counter, metric);
+            break;
+        case CORK_METRIC_HISTOGRAM:
+            cork_delete(struct cork_histogram, metric);
+            break;
+        default:
+            break;
+    }
+}
+
+void
+cork_metrics_free(struct cork_metrics *metrics)
+{
+    struct cork_metrics_shard  *shard;
+    struct cork_metrics_shard  *next;
+    struct cork_metrics_cache  *cache = cork_metrics_cache_get();
+    size_t  i;
+
+    for (shard = metrics->shards; shard != NULL; shard = next) {
+        next = shard->next;
+        cork_metrics_shard_free(metrics, shard);
+    }
+    for (i = 0; i < cork_array_size(&metrics->metrics); i++) {
+        cork_metric_free(cork_array_at(&metrics->metrics, i));
+    }
+    if (cache->id == metrics->id) {
+        cache->id = 0;
+        cache->shard = NULL;
+    }
+    cork_array_done(&metrics->metrics);
+    cork_mutex_done(&metrics->mutex);
+    cork_delete(struct cork_metrics, metrics);
+}
+
+void
+cork_metrics_thread_done(struct cork_metrics *metrics)
+{
+    struct cork_metrics_cache  *cache = cork_metrics_cache_get();
+    struct cork_metrics_shard  *shard;
+    if (cache->id == metrics->id) {
+        shard = cache->shard;
+        cache->id = 0;
+        cache->shard = NULL;
+    } else {
+        cork_thread_id  me = cork_current_thread_get_id();
+        for (shard = cork_atomic_load_acquire(&metrics->shards);
+             shard != NULL; shard = shard->next) {
+            if (cork_atomic_load(&shard->owner, CORK_ATOMIC_RELAXED) == me) {
+                break;
+            }
+        }
+        if (shard == NULL) {
+            return;
+        }
+    }
+    /* Whoever claims the shard next must see all of our writes to it. */
+    cork_atomic_store_release(&shard->owner, 0);
+}
+
+static void
+cork_metrics_add(struct cork_metrics *metrics, struct cork_metric *metric,
+                 enum cork_metric_type type, const char *name,
+                 const char *help, size_t cell_count)
+{
+    metric->metrics = metrics;
+    metric->type = type;
+    metric->cell_count = cell_count;
+    metric->name = cork_strdup(name);
+    metric->help = cork_strdup((help == NULL)? "": help);
+    cork_mutex_lock(&metrics->mutex);
+    metric->id = cork_array_size(&metrics->metrics);
+    assert(metric->id < CORK_METRICS_MAX_METRICS);
+    cork_array_append(&metrics->metrics, metric);
+    cork_mutex_unlock(&metrics->mutex);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Counters
+ */
+
+struct cork_counter *
+cork_metrics_add_counter(struct cork_metrics *metrics,
+                         const char *name, const char *help)
+{
+    struct cork_counter  *counter = cork_new(struct cork_counter);
+    cork_metrics_add(metrics, &counter->parent, CORK_METRIC_COUNTER,
+                     name, help, 1);
+    return counter;
+}
+
+void
+cork_counter_add(struct cork_counter *counter, uint64_t delta)
+{
+    uint64_t  *cells = cork_metric_local_cells(&counter->parent);
+    cork_metric_cell_add(&cells[0], delta);
+}
+
+uint64_t
+cork_counter_get(struct cork_counter *counter)
+{
+    struct cork_metrics_shard  *shard;
+    uint64_t  result = 0;
+    for (shard = cork_atomic_load_acquire(&counter->parent.metrics->shards);
+         shard != NULL; shard = shard->next) {
+        uint64_t  *cells = cork_metric_shard_cells(&counter->parent, shard);
+        if (cells != NULL) {
+            result += cork_metric_cell_get(&cells[0]);
+        }
+    }
+    return result;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Histograms
+ */
+
+/* Values smaller than 2^precision each get their own bucket.  Above that, a
+ * value whose highest set bit is b falls into one of the 2^precision buckets
+ * for that power of two, chosen by the precision bits just below b.  This
+ * numbering is chosen so that the two cases line up, and the bucket index is
+ * increasing in the value. */
+
+static size_t
+cork_histogram_bucket_index(unsigned int precision, uint64_t value)
+{
+    unsigned int  shift;
+    if (value < ((uint64_t) 1 << precision)) {
+        return value;
+    }
+    shift = (63 - __builtin_clzll(value)) - precision;
+    return ((size_t) (shift + 1) << precision) +
+        (size_t) ((value >> shift) - ((uint64_t) 1 << precision));
+}
+
+static uint64_t
+cork_histogram_bucket_highest(unsigned int precision, size_t index)
+{
+    size_t  sub_bucket_count = (size_t) 1 << precision;
+    unsigned int  shift;
+    uint64_t  mantissa;
+    if (index < sub_bucket_count) {
+        return index;
+    }
+    shift = (index >> precision) - 1;
+    mantissa = (index & (sub_bucket_count - 1)) + sub_bucket_count;
+    /* This wraps around to UINT64_MAX for the very last bucket. */
+    return ((mantissa + 1) << shift) - 1;
+}
+
+struct cork_histogram *
+cork_metrics_add_histogram(struct cork_metrics *metrics,
+                           const char *name, const char *help,
+                           uint64_t max_value, unsigned int precision)
+{
+    struct cork_histogram  *histogram = cork_new(struct cork_histogram);
+    assert(precision > 0 && precision <= CORK_HISTOGRAM_MAX_PRECISION);
+    histogram->max_value = max_value;
+    histogram->precision = precision;
+    histogram->bucket_count =
+        cork_histogram_bucket_index(precision, max_value) + 1;
+    cork_metrics_add(metrics, &histogram->parent, CORK_METRIC_HISTOGRAM,
+                     name, help,
+                     CORK_HISTOGRAM_BUCKETS + histogram->bucket_count);
+    return histogram;
+}
+
+void
+cork_histogram_record(struct cork_histogram *histogram, uint64_t value)
+{
+    uint64_t  *cells = cork_metric_local_cells(&histogram->parent);
+    uint64_t  clamped =
+        (value > histogram->max_value)? histogram->max_value: value;
+    size_t  index = cork_histogram_bucket_index(histogram->precision, clamped);
+    cork_metric_cell_add(&cells[CORK_HISTOGRAM_SUM], value);
+    if (~clamped > cells[CORK_HISTOGRAM_INVERTED_MIN]) {
+        cork_metric_cell_set(&cells[CORK_HISTOGRAM_INVERTED_MIN], ~clamped);
+    }
+    if (clamped > cells[CORK_HISTOGRAM_MAX]) {
+        cork_metric_cell_set(&cells[CORK_HISTOGRAM_MAX], clamped);
+    }
+    cork_metric_cell_add(&cells[CORK_HISTOGRAM_BUCKETS + index], 1);
+}
+
+void
+cork_histogram_snapshot_init(struct cork_histogram_snapshot *snapshot)
+{
+    snapshot->count = 0;
+    snapshot->sum = 0;
+    snapshot->min = 0;
+    snapshot->max = 0;
+    snapshot->precision = 0;
+    snapshot->bucket_count = 0;
+    snapshot->buckets = NULL;
+}
+
+void
+cork_histogram_snapshot_done(struct cork_histogram_snapshot *snapshot)
+{
+    if (snapshot->buckets != NULL) {
+        cork_cfree(snapshot->buckets, snapshot->bucket_count,
+                   sizeof(uint64_t));
+    }
+}
+
+void
+cork_histogram_get_snapshot(struct cork_histogram *histogram,
+                            struct cork_histogram_snapshot *snapshot)
+{
+    struct cork_metrics_shard  *shard;
+    uint64_t  inverted_min = 0;
+    size_t  i;
+
+    if (snapshot->bucket_count != histogram->bucket_count) {
+        cork_histogram_snapshot_done(snapshot);
+        snapshot->bucket_count = histogram->bucket_count;
+        snapshot->buckets =
+            cork_calloc(histogram->bucket_count, sizeof(uint64_t));
+    } else {
+        memset(snapshot->buckets, 0,
+               histogram->bucket_count * sizeof(uint64_t));
+    }
+    snapshot->precision = histogram->precision;
+    snapshot->count = 0;
+    snapshot->sum = 0;
+    snapshot->max = 0;
+
+    for (shard = cork_atomic_load_acquire(&histogram->parent.metrics->shards);
+         shard != NULL; shard = shard->next) {
+        uint64_t  *cells = cork_metric_shard_cells(&histogram->parent, shard);
+        uint64_t  value;
+        if (cells == NULL) {
+            continue;
+        }
+        snapshot->sum += cork_metric_cell_get(&cells[CORK_HISTOGRAM_SUM]);
+        value = cork_metric_cell_get(&cells[CORK_HISTOGRAM_INVERTED_MIN]);
+        if (value > inverted_min) {
+            inverted_min = value;
+        }
+        value = cork_metric_cell_get(&cells[CORK_HISTOGRAM_MAX]);
+        if (value > snapshot->max) {
+            snapshot->max = value;
+        }
+        for (i = 0; i < histogram->bucket_count; i++) {
+            value = cork_metric_cell_get(&cells[CORK_HISTOGRAM_BUCKETS + i]);
+            snapshot->buckets[i] += value;
+            snapshot->count += value;
+        }
+    }
+
+    /* The count comes from the buckets, so that percentiles are consistent
+     * with it, even if some other thread is recording values right now. */
+    snapshot->min = (snapshot->count == 0)? 0: ~inverted_min;
+    if (snapshot->count == 0) {
+        snapshot->max = 0;
+    }
+}
+
+uint64_t
+cork_histogram_snapshot_percentile
+(const struct cork_histogram_snapshot *snapshot, double percentile)
+{
+    uint64_t  rank;
+    uint64_t  seen = 0;
+    size_t  i;
+
+    if (snapshot->count == 0) {
+        return 0;
+    }
+    if (percentile <= 0.0) {
+        return snapshot->min;
+    }
+    if (percentile >= 100.0) {
+        return snapshot->max;
+    }
+
+    /* The rank (counting from 1) of the value we're looking for */
+    rank = (uint64_t) (percentile / 100.0 * (double) snapshot->count);
+    if ((double) rank < percentile / 100.0 * (double) snapshot->count) {
+        rank++;
+    }
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (i = 0; i < snapshot->bucket_count; i++) {
+        seen += snapshot->buckets[i];
+        if (seen >= rank) {
+            uint64_t  result =
+                cork_histogram_bucket_highest(snapshot->precision, i);
+            if (result > snapshot->max) {
+                return snapshot->max;
+            } else if (result < snapshot->min) {
+                return snapshot->min;
+            }
+            return result;
+        }
+    }
+    return snapshot->max;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Exporting
+ */
+
+static const double  cork_metrics_export_percentiles[] = {
+    50.0, 90.0, 99.0, 99.9
+};
+
+#define CORK_METRICS_EXPORT_PERCENTILE_COUNT \
+    (sizeof(cork_metrics_export_percentiles) / \
+     sizeof(cork_metrics_export_percentiles[0]))
+
+static void
+cork_histogram_export_text(struct cork_histogram *histogram,
+                           struct cork_histogram_snapshot *snapshot,
+                           struct cork_buffer *dest)
+{
+    size_t  i;
+    cork_histogram_get_snapshot(histogram, snapshot);
+    cork_buffer_append_string(dest, histogram->parent.name);
+    cork_buffer_append_literal(dest, " count=");
+    cork_buffer_append_u64(dest, snapshot->count);
+    cork_buffer_append_literal(dest, " sum=");
+    cork_buffer_append_u64(dest, snapshot->sum);
+    cork_buffer_append_literal(dest, " min=");
+    cork_buffer_append_u64(dest, snapshot->min);
+    for (i = 0; i < CORK_METRICS_EXPORT_PERCENTILE_COUNT; i++) {
+        double  percentile = cork_metrics_export_percentiles[i];
+        cork_buffer_append_literal(dest, " p");
+        cork_buffer_append_double(dest, percentile);
+        cork_buffer_append_literal(dest, "=");
+        cork_buffer_append_u64
+            (dest, cork_histogram_snapshot_percentile(snapshot, percentile));
+    }
+    cork_buffer_append_literal(dest, " max=");
+    cork_buffer_append_u64(dest, snapshot->max);
+    cork_buffer_append_literal(dest, "\n");
+}
+
+void
+cork_metrics_export_text(struct cork_metrics *metrics,
+                         struct cork_buffer *dest)
+{
+    struct cork_histogram_snapshot  snapshot;
+    size_t  i;
+    cork_histogram_snapshot_init(&snapshot);
+    cork_mutex_lock(&metrics->mutex);
+    for (i = 0; i < cork_array_size(&metrics->metrics); i++) {
+        struct cork_metric  *metric = cork_array_at(&metrics->metrics, i);
+        switch (metric->type) {
+            case CORK_METRIC_COUNTER:
+                cork_buffer_append_string(dest, metric->name);
+                cork_buffer_append_literal(dest, " ");
+                cork_buffer_append_u64
+                    (dest, cork_counter_get((struct cork_counter *) metric));
+                cork_buffer_append_literal(dest, "\n");
+                break;
+            case CORK_METRIC_HISTOGRAM:
+                cork_histogram_export_text
+                    ((struct cork_histogram *) metric, &snapshot, dest);
+                break;
+            default:
+                break;
+        }
+    }
+    cork_mutex_unlock(&metrics->mutex);
+    cork_histogram_snapshot_done(&snapshot);
+}
+
+static void
+cork_metric_export_prometheus_header(struct cork_metric *metric,
+                                     const char *type,
+                                     struct cork_buffer *dest)
+{
+    const char  *ch;
+    cork_buffer_append_literal(dest, "# HELP ");
+    cork_buffer_append_string(dest, metric->name);
+    cork_buffer_append_literal(dest, " ");
+    /* HELP lines can't contain raw backslashes or newlines. */
+    for (ch = metric->help; *ch != '\0'; ch++) {
+        if (*ch == '\\') {
+            cork_buffer_append_literal(dest, "\\\\");
+        } else if (*ch == '\n') {
+            cork_buffer_append_literal(dest, "\\n");
+        } else {
+            cork_buffer_append(dest, ch, 1);
+        }
+    }
+    cork_buffer_append_literal(dest, "\n# TYPE ");
+    cork_buffer_append_string(dest, metric->name);
+    cork_buffer_append_literal(dest, " ");
+    cork_buffer_append_string(dest, type);
+    cork_buffer_append_literal(dest, "\n");
+}
+
+static void
+cork_histogram_export_prometheus_bucket(struct cork_histogram *histogram,
+                                        const char *bound, uint64_t count,
+                                        struct cork_buffer *dest)
+{
+    cork_buffer_append_string(dest, histogram->parent.name);
+    cork_buffer_append_literal(dest, "_bucket{le=\"");
+    cork_buffer_append_string(dest, bound);
+    cork_buffer_append_literal(dest, "\"} ");
+    cork_buffer_append_u64(dest, count);
+    cork_buffer_append_literal(dest, "\n");
+}
+
+/* Prometheus needs the same bucket boundaries in every scrape, and a few
+ * thousand of them would be far too many, so we coarsen our buckets into one
+ * per power of two.  Each boundary is 2^k - 1, the highest value in one of
+ * our buckets, so the cumulative counts are exact. */
+static void
+cork_histogram_export_prometheus(struct cork_histogram *histogram,
+                                 struct cork_histogram_snapshot *snapshot,
+                                 struct cork_buffer *dest)
+{
+    struct cork_buffer  bound = CORK_BUFFER_INIT();
+    uint64_t  cumulative = 0;
+    size_t  next_index = 0;
+    unsigned int  k;
+
+    cork_histogram_get_snapshot(histogram, snapshot);
+    cork_metric_export_prometheus_header(&histogram->parent, "histogram", dest);
+    for (k = 0; k < 64; k++) {
+        uint64_t  upper = ((uint64_t) 1 << k) - 1;
+        size_t  last_index;
+        if (upper >= histogram->max_value) {
+            break;
+        }
+        last_index = cork_histogram_bucket_index(histogram->precision, upper);
+        for (; next_index <= last_index; next_index++) {
+            cumulative += snapshot->buckets[next_index];
+        }
+        cork_buffer_clear(&bound);
+        cork_buffer_append_u64(&bound, upper);
+        cork_histogram_export_prometheus_bucket
+            (histogram, bound.buf, cumulative, dest);
+    }
+    cork_histogram_export_prometheus_bucket
+        (histogram, "+Inf", snapshot->count, dest);
+
+    cork_buffer_append_string(dest, histogram->parent.name);
+    cork_buffer_append_literal(dest, "_sum ");
+    cork_buffer_append_u64(dest, snapshot->sum);
+    cork_buffer_append_literal(dest, "\n");
+    cork_buffer_append_string(dest, histogram->parent.name);
+    cork_buffer_append_literal(dest, "_count ");
+    cork_buffer_append_u64(dest, snapshot->count);
+    cork_buffer_append_literal(dest, "\n");
+    cork_buffer_done(&bound);
+}
+
+void
+cork_metrics_export_prometheus(struct cork_metrics *metrics,
+                               struct cork_buffer *dest)
+{
+    struct cork_histogram_snapshot  snapshot;
+    size_t  i;
+    cork_histogram_snapshot_init(&snapshot);
+    cork_mutex_lock(&metrics->mutex);
+    for (i = 0; i < cork_array_size(&metrics->metrics); i++) {
+        struct cork_metric  *metric = cork_array_at(&metrics->metrics, i);
+        switch (metric->type) {
+            case CORK_METRIC_COUNTER:
+                cork_metric_export_prometheus_header(metric, "counter", dest);
+                cork_buffer_append_string(dest, metric->name);
+                cork_buffer_append_literal(dest, " ");
+                cork_buffer_append_u64
+                    (dest, cork_counter_get((struct cork_counter *) metric));
+                cork_buffer_append_literal(dest, "\n");
+                break;
+            case CORK_METRIC_HISTOGRAM:
+                cork_histogram_export_prometheus
+                    ((struct cork_histogram *) metric, &snapshot, dest);
+                break;
+            default:
+                break;
+        }
+    }
+    cork_mutex_unlock(&metrics->mutex);
+    cork_histogram_snapshot_done(&snapshot);
+}
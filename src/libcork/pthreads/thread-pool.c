@@ -0,0 +1,908 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/error.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/buffer.h"
+#include "libcork/ds/sort.h"
+#include "libcork/threads/atomics.h"
+#include "libcork/threads/basics.h"
+#include "libcork/threads/pool.h"
+
+
+/*-----------------------------------------------------------------------
+ * Tasks
+ */
+
+struct cork_task {
+    void  *user_data;
+    cork_free_f  free_user_data;
+    cork_run_f  run;
+    struct cork_task  *continuation;
+    /* The number of tasks that have this task as their continuation, and
+     * that haven't finished yet. */
+    volatile size_t  pending;
+    /* Used to link together tasks that are submitted from outside of the
+     * pool. */
+    struct cork_task  *next;
+};
+
+struct cork_task *
+cork_task_new(void *user_data, cork_free_f free_user_data, cork_run_f run)
+{
+    struct cork_task  *self = cork_new(struct cork_task);
+    self->user_data = user_data;
+    self->free_user_data = free_user_data;
+    self->run = run;
+    self->continuation = NULL;
+    self->pending = 0;
+    self->next = NULL;
+    return self;
+}
+
+void
+cork_task_free(struct cork_task *self)
+{
+    cork_free_user_data(self);
+    cork_delete(struct cork_task, self);
+}
+
+void
+cork_task_then(struct cork_task *self, struct cork_task *continuation)
+{
+    assert(self->continuation == NULL);
+    self->continuation = continuation;
+    cork_size_atomic_add(&continuation->pending, 1);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Work-stealing deques
+ */
+
+/* This is the deque described in [1], with the memory orderings from [2].
+ * The owning worker pushes and takes tasks at the bottom of the deque; other
+ * threads steal them from the top.  Only the owner ever writes to bottom, so
+ * the owner only has to race with thieves when there's a single task left.
+ *
+ * top and bottom only ever increase (apart from the owner's temporary
+ * decrement of bottom in take), so we can use them directly as indexes into
+ * the circular array.  They start at 1 so that the owner's decrement can never
+ * wrap around.
+ *
+ * When the array fills up, the owner replaces it with a larger one.  A thief
+ * might still be reading from the old array, so we keep retired arrays around
+ * until the pool is freed.
+ *
+ * [1] Chase and Lev, "Dynamic circular work-stealing deque", SPAA 2005.
+ * [2] Lê, Pop, Cohen, and Zappa Nardelli, "Correct and efficient
+ *     work-stealing for weak memory models", PPoPP 2013. */
+
+#define CORK_TASK_DEQUE_INITIAL_SIZE  64
+
+struct cork_task_deque_array {
+    struct cork_task  **items;
+    size_t  size;
+    struct cork_task_deque_array  *retired;
+};
+
+struct cork_task_deque {
+    volatile size_t  top;
+    char  pad0[CORK_CACHELINE_SIZE - sizeof(size_t)];
+    volatile size_t  bottom;
+    struct cork_task_deque_array * volatile  array;
+    char  pad1[CORK_CACHELINE_SIZE - sizeof(size_t) - sizeof(void *)];
+};
+
+static struct cork_task_deque_array *
+cork_task_deque_array_new(size_t size)
+{
+    struct cork_task_deque_array  *self =
+        cork_new(struct cork_task_deque_array);
+    self->items = cork_calloc(size, sizeof(struct cork_task *));
+    self->size = size;
+    self->retired = NULL;
+    return self;
+}
+
+static void
+cork_task_deque_array_free(struct cork_task_deque_array *self)
+{
+    cork_cfree(self->items, self->size, sizeof(struct cork_task *));
+    cork_delete(struct cork_task_deque_array, self);
+}
+
+static void
+cork_task_deque_init(struct cork_task_deque *deque)
+{
+    deque->top = 1;
+    deque->bottom = 1;
+    deque->array = cork_task_deque_array_new(CORK_TASK_DEQUE_INITIAL_SIZE);
+}
+
+static void
+cork_task_deque_done(struct cork_task_deque *deque)
+{
+    struct cork_task_deque_array  *array = deque->array;
+    while (array != NULL) {
+        struct cork_task_deque_array  *retired = array->retired;
+        cork_task_deque_array_free(array);
+        array = retired;
+    }
+}
+
+static bool
+cork_task_deque_is_empty(struct cork_task_deque *deque)
+{
+    size_t  top = cork_atomic_load_acquire(&deque->top);
+    size_t  bottom = cork_atomic_load_acquire(&deque->bottom);
+    return (ssize_t) (bottom - top) <= 0;
+}
+
+static struct cork_task_deque_array *
+cork_task_deque_grow(struct cork_task_deque *deque,
+                     struct cork_task_deque_array *array,
+                     size_t top, size_t bottom)
+{
+    struct cork_task_deque_array  *new_array =
+        cork_task_deque_array_new(array->size * 2);
+    size_t  i;
+    for (i = top; i != bottom; i++) {
+        new_array->items[i & (new_array->size - 1)] =
+            cork_atomic_load_acquire(&array->items[i & (array->size - 1)]);
+    }
+    new_array->retired = array;
+    cork_atomic_store_release(&deque->array, new_array);
+    return new_array;
+}
+
+/* Can only be called by the deque's owner. */
+static void
+cork_task_deque_push(struct cork_task_deque *deque, struct cork_task *task)
+{
+    size_t  bottom = deque->bottom;
+    size_t  top = cork_atomic_load_acquire(&deque->top);
+    struct cork_task_deque_array  *array = deque->array;
+    if (CORK_UNLIKELY(bottom - top >= array->size)) {
+        array = cork_task_deque_grow(deque, array, top, bottom);
+    }
+    cork_atomic_store_release(&array->items[bottom & (array->size - 1)], task);
+    cork_atomic_store_release(&deque->bottom, bottom + 1);
+}
+
+/* Can only be called by the deque's owner. */
+static struct cork_task *
+cork_task_deque_take(struct cork_task_deque *deque)
+{
+    size_t  bottom = deque->bottom - 1;
+    struct cork_task_deque_array  *array = deque->array;
+    size_t  top;
+    struct cork_task  *task;
+
+    cork_atomic_store_release(&deque->bottom, bottom);
+    __sync_synchronize();
+    top = cork_atomic_load_acquire(&deque->top);
+
+    if (CORK_UNLIKELY((ssize_t) (bottom - top) < 0)) {
+        /* The deque was already empty. */
+        cork_atomic_store_release(&deque->bottom, bottom + 1);
+        return NULL;
+    }
+
+    task = cork_atomic_load_acquire(&array->items[bottom & (array->size - 1)]);
+    if (bottom == top) {
+        /* This is the last task, so we have to race any thieves for it. */
+        if (cork_size_cas(&deque->top, top, top + 1) != top) {
+            task = NULL;
+        }
+        cork_atomic_store_release(&deque->bottom, bottom + 1);
+    }
+    return task;
+}
+
+/* Can be called from any thread.  Returns NULL if the deque is empty, or if
+ * we lose a race with the owner or another thief. */
+static struct cork_task *
+cork_task_deque_steal(struct cork_task_deque *deque)
+{
+    size_t  top = cork_atomic_load_acquire(&deque->top);
+    size_t  bottom;
+    __sync_synchronize();
+    bottom = cork_atomic_load_acquire(&deque->bottom);
+
+    if ((ssize_t) (bottom - top) > 0) {
+        struct cork_task_deque_array  *array =
+            cork_atomic_load_acquire(&deque->array);
+        struct cork_task  *task =
+            cork_atomic_load_acquire(&array->items[top & (array->size - 1)]);
+        if (cork_size_cas(&deque->top, top, top + 1) != top) {
+            return NULL;
+        }
+        return task;
+    }
+    return NULL;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Thread pools
+ */
+
+struct cork_thread_pool_worker {
+    struct cork_task_deque  deque;
+    struct cork_thread_pool  *pool;
+    struct cork_thread  *thread;
+    size_t  index;
+    /* Used to choose which worker to steal from */
+    unsigned int  seed;
+};
+
+struct cork_thread_pool {
+    size_t  worker_count;
+    struct cork_thread_pool_worker  *workers;
+    bool  started;
+    /* If non-empty, we pin each worker to one of these CPUs */
+    unsigned int  *cpus;
+    size_t  cpu_count;
+
+    /* The number of tasks that have been submitted but haven't finished */
+    volatile size_t  outstanding;
+    /* The number of threads waiting on cond */
+    volatile size_t  sleeping;
+    volatile int  stopping;
+
+    /* The remaining fields are protected by mutex. */
+    pthread_mutex_t  mutex;
+    pthread_cond_t  cond;
+    /* Tasks submitted from threads that aren't one of our workers */
+    struct cork_task  *injected_head;
+    struct cork_task  *injected_tail;
+    volatile size_t  injected_count;
+    /* The first error reported by any task */
+    cork_error  error_code;
+    struct cork_buffer  error_message;
+};
+
+cork_tls_fast(struct cork_thread_pool_worker *,
+              cork_thread_pool_current_worker);
+
+static struct cork_thread_pool_worker *
+cork_thread_pool_current_worker(struct cork_thread_pool *pool)
+{
+    struct cork_thread_pool_worker  *worker =
+        *cork_thread_pool_current_worker_get();
+    return (worker != NULL && worker->pool == pool)? worker: NULL;
+}
+
+/* Wake up any threads that are sleeping in cork_thread_pool_idle.  The caller
+ * must have already published whatever it is that they're waiting for. */
+static void
+cork_thread_pool_notify(struct cork_thread_pool *pool)
+{
+    __sync_synchronize();
+    if (cork_atomic_load_acquire(&pool->sleeping) > 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+static bool
+cork_thread_pool_has_work(struct cork_thread_pool *pool)
+{
+    size_t  i;
+    if (cork_atomic_load_acquire(&pool->injected_count) > 0) {
+        return true;
+    }
+    for (i = 0; i < pool->worker_count; i++) {
+        if (!cork_task_deque_is_empty(&pool->workers[i].deque)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Sleep until there might be more work to do, or until counter (if given)
+ * reaches 0. */
+static void
+cork_thread_pool_idle(struct cork_thread_pool *pool, volatile size_t *counter)
+{
+    pthread_mutex_lock(&pool->mutex);
+    /* This is a full barrier, which pairs with the one in
+     * cork_thread_pool_notify.  Either we'll see the new work here, or the
+     * notifier will see that we're sleeping. */
+    cork_size_atomic_add(&pool->sleeping, 1);
+    if (!cork_atomic_load_acquire(&pool->stopping) &&
+        (counter == NULL || cork_atomic_load_acquire(counter) != 0) &&
+        !cork_thread_pool_has_work(pool)) {
+        pthread_cond_wait(&pool->cond, &pool->mutex);
+    }
+    cork_size_atomic_sub(&pool->sleeping, 1);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static struct cork_task *
+cork_thread_pool_find_task(struct cork_thread_pool *pool,
+                           struct cork_thread_pool_worker *worker)
+{
+    struct cork_task  *task;
+    size_t  start = 0;
+    size_t  i;
+
+    if (worker != NULL) {
+        task = cork_task_deque_take(&worker->deque);
+        if (task != NULL) {
+            return task;
+        }
+        /* A cheap xorshift, so that idle workers don't all pick on the same
+         * victim. */
+        worker->seed ^= worker->seed << 13;
+        worker->seed ^= worker->seed >> 17;
+        worker->seed ^= worker->seed << 5;
+        start = worker->seed;
+    }
+
+    if (cork_atomic_load_acquire(&pool->injected_count) > 0) {
+        pthread_mutex_lock(&pool->mutex);
+        task = pool->injected_head;
+        if (task != NULL) {
+            pool->injected_head = task->next;
+            if (pool->injected_head == NULL) {
+                pool->injected_tail = NULL;
+            }
+            cork_atomic_store_release
+                (&pool->injected_count, pool->injected_count - 1);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        if (task != NULL) {
+            return task;
+        }
+    }
+
+    for (i = 0; i < pool->worker_count; i++) {
+        struct cork_thread_pool_worker  *victim =
+            &pool->workers[(start + i) % pool->worker_count];
+        if (victim != worker) {
+            task = cork_task_deque_steal(&victim->deque);
+            if (task != NULL) {
+                return task;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void
+cork_thread_pool_record_error(struct cork_thread_pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->error_code == CORK_ERROR_NONE) {
+        if (CORK_LIKELY(cork_error_occurred())) {
+            pool->error_code = cork_error_code();
+            cork_buffer_set_string(&pool->error_message, cork_error_message());
+        } else {
+            pool->error_code = CORK_UNKNOWN_ERROR;
+            cork_buffer_set_string(&pool->error_message, "Unknown error");
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    cork_error_clear();
+}
+
+static void
+cork_thread_pool_run_task(struct cork_thread_pool *pool,
+                          struct cork_task *task)
+{
+    struct cork_task  *continuation = task->continuation;
+    if (CORK_UNLIKELY(task->run(task->user_data) != 0)) {
+        cork_thread_pool_record_error(pool);
+    }
+    cork_task_free(task);
+
+    /* Submit the continuation before we mark this task as finished, so that
+     * the outstanding count can't drop to 0 in between. */
+    if (continuation != NULL &&
+        cork_size_atomic_sub(&continuation->pending, 1) == 0) {
+        cork_thread_pool_submit(pool, continuation);
+    }
+
+    if (cork_size_atomic_sub(&pool->outstanding, 1) == 0) {
+        cork_thread_pool_notify(pool);
+    }
+}
+
+/* The number of times an idle worker looks for work before going to sleep */
+#define CORK_THREAD_POOL_SPIN_COUNT  64
+
+static int
+cork_thread_pool_worker__run(void *user_data)
+{
+    struct cork_thread_pool_worker  *worker = user_data;
+    struct cork_thread_pool  *pool = worker->pool;
+    unsigned int  spins = 0;
+
+    *cork_thread_pool_current_worker_get() = worker;
+    while (!cork_atomic_load_acquire(&pool->stopping)) {
+        struct cork_task  *task = cork_thread_pool_find_task(pool, worker);
+        if (task != NULL) {
+            cork_thread_pool_run_task(pool, task);
+            spins = 0;
+        } else if (spins < CORK_THREAD_POOL_SPIN_COUNT) {
+            cork_pause();
+            spins++;
+        } else {
+            cork_thread_pool_idle(pool, NULL);
+            spins = 0;
+        }
+    }
+    *cork_thread_pool_current_worker_get() = NULL;
+    return 0;
+}
+
+struct cork_thread_pool *
+cork_thread_pool_new(size_t worker_count)
+{
+    struct cork_thread_pool  *pool = cork_new(struct cork_thread_pool);
+    size_t  i;
+
+    if (worker_count == 0) {
+        long  cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = (cpu_count > 0)? (size_t) cpu_count: 1;
+    }
+
+    pool->worker_count = worker_count;
+    pool->workers =
+        cork_calloc(worker_count, sizeof(struct cork_thread_pool_worker));
+    for (i = 0; i < worker_count; i++) {
+        struct cork_thread_pool_worker  *worker = &pool->workers[i];
+        cork_task_deque_init(&worker->deque);
+        worker->pool = pool;
+        worker->thread = NULL;
+        worker->index = i;
+        worker->seed = (unsigned int) (i * 2654435761u) | 1;
+    }
+
+    pool->started = false;
+    pool->cpus = NULL;
+    pool->cpu_count = 0;
+    pool->outstanding = 0;
+    pool->sleeping = 0;
+    pool->stopping = 0;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->injected_head = NULL;
+    pool->injected_tail = NULL;
+    pool->injected_count = 0;
+    pool->error_code = CORK_ERROR_NONE;
+    cork_buffer_init(&pool->error_message);
+    return pool;
+}
+
+static void
+cork_thread_pool_stop(struct cork_thread_pool *pool)
+{
+    size_t  i;
+
+    pthread_mutex_lock(&pool->mutex);
+    cork_atomic_store_release(&pool->stopping, 1);
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (i = 0; i < pool->worker_count; i++) {
+        struct cork_thread_pool_worker  *worker = &pool->workers[i];
+        if (worker->thread != NULL) {
+            if (cork_thread_join(worker->thread) != 0) {
+                cork_error_clear();
+            }
+            worker->thread = NULL;
+        }
+    }
+}
+
+void
+cork_thread_pool_free(struct cork_thread_pool *pool)
+{
+    size_t  i;
+
+    /* Any tasks that are still outstanding hold on to resources that we need
+     * to free. */
+    if (cork_thread_pool_wait(pool) != 0) {
+        cork_error_clear();
+    }
+    cork_thread_pool_stop(pool);
+
+    for (i = 0; i < pool->worker_count; i++) {
+        cork_task_deque_done(&pool->workers[i].deque);
+    }
+    cork_cfree(pool->workers, pool->worker_count,
+               sizeof(struct cork_thread_pool_worker));
+    if (pool->cpus != NULL) {
+        cork_cfree(pool->cpus, pool->cpu_count, sizeof(unsigned int));
+    }
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    cork_buffer_done(&pool->error_message);
+    cork_delete(struct cork_thread_pool, pool);
+}
+
+size_t
+cork_thread_pool_worker_count(struct cork_thread_pool *pool)
+{
+    return pool->worker_count;
+}
+
+void
+cork_thread_pool_set_affinity(struct cork_thread_pool *pool,
+                              const unsigned int *cpus, size_t cpu_count)
+{
+    assert(!pool->started);
+    if (pool->cpus != NULL) {
+        cork_cfree(pool->cpus, pool->cpu_count, sizeof(unsigned int));
+        pool->cpus = NULL;
+    }
+    pool->cpu_count = cpu_count;
+    if (cpu_count > 0) {
+        pool->cpus = cork_calloc(cpu_count, sizeof(unsigned int));
+        memcpy(pool->cpus, cpus, cpu_count * sizeof(unsigned int));
+    }
+}
+
+int
+cork_thread_pool_start(struct cork_thread_pool *pool)
+{
+    size_t  i;
+
+    assert(!pool->started);
+    for (i = 0; i < pool->worker_count; i++) {
+        struct cork_thread_pool_worker  *worker = &pool->workers[i];
+        worker->thread = cork_thread_new
+            ("pool-worker", worker, NULL, cork_thread_pool_worker__run);
+        if (pool->cpu_count > 0) {
+            cork_thread_set_affinity
+                (worker->thread, &pool->cpus[i % pool->cpu_count], 1);
+        }
+        if (CORK_UNLIKELY(cork_thread_start(worker->thread) != 0)) {
+            cork_thread_free(worker->thread);
+            worker->thread = NULL;
+            cork_thread_pool_stop(pool);
+            return -1;
+        }
+    }
+    pool->started = true;
+    return 0;
+}
+
+void
+cork_thread_pool_submit(struct cork_thread_pool *pool, struct cork_task *task)
+{
+    struct cork_thread_pool_worker  *worker =
+        cork_thread_pool_current_worker(pool);
+
+    cork_size_atomic_add(&pool->outstanding, 1);
+    if (worker != NULL) {
+        cork_task_deque_push(&worker->deque, task);
+    } else {
+        pthread_mutex_lock(&pool->mutex);
+        task->next = NULL;
+        if (pool->injected_tail == NULL) {
+            pool->injected_head = task;
+        } else {
+            pool->injected_tail->next = task;
+        }
+        pool->injected_tail = task;
+        cork_atomic_store_release
+            (&pool->injected_count, pool->injected_count + 1);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    cork_thread_pool_notify(pool);
+}
+
+int
+cork_thread_pool_wait(struct cork_thread_pool *pool)
+{
+    assert(cork_thread_pool_current_worker(pool) == NULL);
+
+    while (cork_atomic_load_acquire(&pool->outstanding) != 0) {
+        struct cork_task  *task = cork_thread_pool_find_task(pool, NULL);
+        if (task != NULL) {
+            cork_thread_pool_run_task(pool, task);
+        } else {
+            cork_thread_pool_idle(pool, &pool->outstanding);
+        }
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    if (CORK_UNLIKELY(pool->error_code != CORK_ERROR_NONE)) {
+        cork_error_set_string
+            (pool->error_code, (char *) pool->error_message.buf);
+        pool->error_code = CORK_ERROR_NONE;
+        pthread_mutex_unlock(&pool->mutex);
+        return -1;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Parallel loops
+ */
+
+struct cork_parallel_for {
+    struct cork_thread_pool  *pool;
+    size_t  grain_size;
+    void  *user_data;
+    cork_parallel_for_f  body;
+    /* The number of subranges that haven't finished yet */
+    volatile size_t  remaining;
+    volatile int  failed;
+    /* Only filled in by the first subrange to fail */
+    cork_error  error_code;
+    struct cork_buffer  error_message;
+};
+
+struct cork_parallel_range {
+    struct cork_parallel_for  *loop;
+    size_t  start;
+    size_t  end;
+};
+
+static int
+cork_parallel_range__run(void *user_data);
+
+static void
+cork_parallel_range__free(void *user_data)
+{
+    struct cork_parallel_range  *range = user_data;
+    cork_delete(struct cork_parallel_range, range);
+}
+
+static void
+cork_parallel_for_run_range(struct cork_parallel_for *loop,
+                            size_t start, size_t end)
+{
+    struct cork_thread_pool  *pool = loop->pool;
+
+    /* Split off the upper half of the range until what's left is small
+     * enough to run ourselves.  Thieves steal from the other end of our
+     * deque, so they'll get the largest pieces. */
+    while (end - start > loop->grain_size) {
+        size_t  mid = start + (end - start) / 2;
+        struct cork_parallel_range  *range =
+            cork_new(struct cork_parallel_range);
+        range->loop = loop;
+        range->start = mid;
+        range->end = end;
+        cork_size_atomic_add(&loop->remaining, 1);
+        cork_thread_pool_submit
+            (pool, cork_task_new
+             (range, cork_parallel_range__free, cork_parallel_range__run));
+        end = mid;
+    }
+
+    if (CORK_LIKELY(!cork_atomic_load_acquire(&loop->failed))) {
+        if (CORK_UNLIKELY(loop->body(loop->user_data, start, end) != 0)) {
+            if (cork_int_cas(&loop->failed, 0, 1) == 0) {
+                if (CORK_LIKELY(cork_error_occurred())) {
+                    loop->error_code = cork_error_code();
+                    cork_buffer_set_string
+                        (&loop->error_message, cork_error_message());
+                } else {
+                    loop->error_code = CORK_UNKNOWN_ERROR;
+                    cork_buffer_set_string
+                        (&loop->error_message, "Unknown error");
+                }
+            }
+            cork_error_clear();
+        }
+    }
+
+    /* loop might be freed as soon as this reaches 0, so we can't touch it
+     * afterwards. */
+    if (cork_size_atomic_sub(&loop->remaining, 1) == 0) {
+        cork_thread_pool_notify(pool);
+    }
+}
+
+static int
+cork_parallel_range__run(void *user_data)
+{
+    struct cork_parallel_range  *range = user_data;
+    cork_parallel_for_run_range(range->loop, range->start, range->end);
+    return 0;
+}
+
+int
+cork_thread_pool_parallel_for(struct cork_thread_pool *pool,
+                              size_t start, size_t end, size_t grain_size,
+                              void *user_data, cork_parallel_for_f body)
+{
+    struct cork_thread_pool_worker  *worker =
+        cork_thread_pool_current_worker(pool);
+    struct cork_parallel_for  loop;
+
+    if (start >= end) {
+        return 0;
+    }
+
+    loop.pool = pool;
+    loop.grain_size = (grain_size == 0)? 1: grain_size;
+    loop.user_data = user_data;
+    loop.body = body;
+    loop.remaining = 1;
+    loop.failed = 0;
+    loop.error_code = CORK_ERROR_NONE;
+    cork_buffer_init(&loop.error_message);
+
+    cork_parallel_for_run_range(&loop, start, end);
+
+    /* Help out with the rest of the subranges (or anything else in the pool)
+     * until they've all finished. */
+    while (cork_atomic_load_acquire(&loop.remaining) != 0) {
+        struct cork_task  *task = cork_thread_pool_find_task(pool, worker);
+        if (task != NULL) {
+            cork_thread_pool_run_task(pool, task);
+        } else {
+            cork_thread_pool_idle(pool, &loop.remaining);
+        }
+    }
+
+    if (CORK_UNLIKELY(loop.failed)) {
+        cork_error_set_string
+            (loop.error_code, (char *) loop.error_message.buf);
+        cork_buffer_done(&loop.error_message);
+        return -1;
+    }
+    cork_buffer_done(&loop.error_message);
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Parallel sorting
+ */
+
+/* We sort one chunk for each worker (plus the calling thread) in parallel,
+ * and then merge pairs of sorted runs in parallel, ping-ponging between items
+ * and a temporary buffer.  The last few merge passes have less parallelism
+ * than the first, but each pass is a linear scan, so they're still cheap
+ * compared to the initial sorts. */
+
+struct cork_parallel_sort {
+    char  *src;
+    char  *dest;
+    size_t  count;
+    size_t  element_size;
+    /* The length of each of the sorted runs in src */
+    size_t  width;
+    void  *user_data;
+    cork_compare_f  compare;
+};
+
+static int
+cork_parallel_sort__sort(void *user_data, size_t start, size_t end)
+{
+    struct cork_parallel_sort  *sort = user_data;
+    size_t  i;
+    for (i = start; i < end; i++) {
+        size_t  lo = i * sort->width;
+        size_t  hi = lo + sort->width;
+        if (hi > sort->count) {
+            hi = sort->count;
+        }
+        if (lo < hi) {
+            cork_sort(sort->src + lo * sort->element_size, hi - lo,
+                      sort->element_size, sort->user_data, sort->compare);
+        }
+    }
+    return 0;
+}
+
+static void
+cork_parallel_sort__merge_one(struct cork_parallel_sort *sort,
+                              size_t lo, size_t mid, size_t hi)
+{
+    size_t  size = sort->element_size;
+    const char  *left = sort->src + lo * size;
+    const char  *left_end = sort->src + mid * size;
+    const char  *right = left_end;
+    const char  *right_end = sort->src + hi * size;
+    char  *dest = sort->dest + lo * size;
+
+    while (left < left_end && right < right_end) {
+        /* Take from the left run on ties, so that merging is stable. */
+        if (sort->compare(sort->user_data, right, left) < 0) {
+            memcpy(dest, right, size);
+            right += size;
+        } else {
+            memcpy(dest, left, size);
+            left += size;
+        }
+        dest += size;
+    }
+    memcpy(dest, left, left_end - left);
+    dest += left_end - left;
+    memcpy(dest, right, right_end - right);
+}
+
+static int
+cork_parallel_sort__merge(void *user_data, size_t start, size_t end)
+{
+    struct cork_parallel_sort  *sort = user_data;
+    size_t  i;
+    for (i = start; i < end; i++) {
+        size_t  lo = 2 * i * sort->width;
+        size_t  mid = lo + sort->width;
+        size_t  hi = mid + sort->width;
+        if (mid > sort->count) {
+            mid = sort->count;
+        }
+        if (hi > sort->count) {
+            hi = sort->count;
+        }
+        cork_parallel_sort__merge_one(sort, lo, mid, hi);
+    }
+    return 0;
+}
+
+int
+cork_thread_pool_parallel_sort(struct cork_thread_pool *pool,
+                               void *items, size_t count, size_t element_size,
+                               void *user_data, cork_compare_f compare)
+{
+    struct cork_parallel_sort  sort;
+    size_t  chunk_count = 1;
+    size_t  thread_count = cork_thread_pool_worker_count(pool) + 1;
+    char  *tmp;
+    int  rc;
+
+    if (count < CORK_PARALLEL_SORT_THRESHOLD || thread_count < 2) {
+        cork_sort(items, count, element_size, user_data, compare);
+        return 0;
+    }
+
+    while (chunk_count < thread_count) {
+        chunk_count *= 2;
+    }
+    tmp = cork_malloc(count * element_size);
+    sort.src = items;
+    sort.dest = tmp;
+    sort.count = count;
+    sort.element_size = element_size;
+    sort.width = (count + chunk_count - 1) / chunk_count;
+    sort.user_data = user_data;
+    sort.compare = compare;
+
+    rc = cork_thread_pool_parallel_for
+        (pool, 0, chunk_count, 1, &sort, cork_parallel_sort__sort);
+    while (rc == 0 && sort.width < count) {
+        size_t  pair_count = (count + 2 * sort.width - 1) / (2 * sort.width);
+        char  *swap;
+        rc = cork_thread_pool_parallel_for
+            (pool, 0, pair_count, 1, &sort, cork_parallel_sort__merge);
+        swap = sort.src;
+        sort.src = sort.dest;
+        sort.dest = swap;
+        sort.width *= 2;
+    }
+
+    if (rc == 0 && sort.src != (char *) items) {
+        memcpy(items, sort.src, count * element_size);
+    }
+    cork_free(tmp, count * element_size);
+    return rc;
+}
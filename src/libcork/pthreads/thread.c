@@ -15,13 +15,27 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <pthread.h>
+#include <sched.h>
+
+#if defined(__FreeBSD__)
+#include <pthread_np.h>
+#endif
+
+#if defined(__linux)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include "libcork/core/allocator.h"
 #include "libcork/core/error.h"
 #include "libcork/core/types.h"
+#include "libcork/ds/array.h"
 #include "libcork/ds/buffer.h"
 #include "libcork/threads/basics.h"
 
@@ -43,6 +57,15 @@ struct cork_thread {
     struct cork_buffer  error_message;
     bool  started;
     bool  joined;
+
+    /* Attributes that we apply when the thread starts.  A stack size of 0
+     * and an empty CPU list mean to use the system defaults. */
+    size_t  stack_size;
+    unsigned int  *cpus;
+    size_t  cpu_count;
+    int  numa_node;
+    enum cork_thread_sched_policy  policy;
+    int  priority;
 };
 
 struct cork_thread_descriptor {
@@ -93,12 +116,21 @@ cork_thread_new(const char *name,
     cork_buffer_init(&self->error_message);
     self->started = false;
     self->joined = false;
+    self->stack_size = 0;
+    self->cpus = NULL;
+    self->cpu_count = 0;
+    self->numa_node = -1;
+    self->policy = CORK_THREAD_SCHED_DEFAULT;
+    self->priority = 0;
     return self;
 }
 
 static void
 cork_thread_free_private(struct cork_thread *self)
 {
+    if (self->cpus != NULL) {
+        cork_cfree(self->cpus, self->cpu_count, sizeof(unsigned int));
+    }
     cork_strfree(self->name);
     cork_free_user_data(self);
     cork_buffer_done(&self->error_message);
@@ -124,29 +156,263 @@ cork_thread_get_id(struct cork_thread *self)
     return self->id;
 }
 
+
+
+/*-----------------------------------------------------------------------
+ * Thread attributes
+ */
+
+void
+cork_thread_set_stack_size(struct cork_thread *self, size_t stack_size)
+{
+    assert(!self->started);
+    self->stack_size = stack_size;
+}
+
+void
+cork_thread_set_affinity(struct cork_thread *self,
+                         const unsigned int *cpus, size_t cpu_count)
+{
+    assert(!self->started);
+    if (self->cpus != NULL) {
+        cork_cfree(self->cpus, self->cpu_count, sizeof(unsigned int));
+        self->cpus = NULL;
+    }
+    self->cpu_count = cpu_count;
+    if (cpu_count > 0) {
+        self->cpus = cork_calloc(cpu_count, sizeof(unsigned int));
+        memcpy(self->cpus, cpus, cpu_count * sizeof(unsigned int));
+    }
+}
+
+#if defined(__linux)
+typedef cork_array(unsigned int)  cork_cpu_array;
+
+/* Parses a Linux CPU list, such as "0-3,8,10-11", into an array of CPU
+ * numbers. */
+static int
+cork_thread_parse_cpu_list(const char *list, cork_cpu_array *cpus)
+{
+    const char  *curr = list;
+    while (*curr != '\0' && *curr != '\n') {
+        char  *end;
+        unsigned long  first;
+        unsigned long  last;
+        first = strtoul(curr, &end, 10);
+        if (end == curr) {
+            goto error;
+        }
+        last = first;
+        if (*end == '-') {
+            curr = end + 1;
+            last = strtoul(curr, &end, 10);
+            if (end == curr || last < first) {
+                goto error;
+            }
+        }
+        for (; first <= last; first++) {
+            cork_array_append(cpus, (unsigned int) first);
+        }
+        curr = end;
+        if (*curr == ',') {
+            curr++;
+        }
+    }
+    return 0;
+
+error:
+    cork_error_set_printf(EINVAL, "Invalid CPU list %s", list);
+    return -1;
+}
+#endif
+
+int
+cork_thread_set_numa_node(struct cork_thread *self, unsigned int node)
+{
+#if defined(__linux)
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    cork_cpu_array  cpus;
+    char  line[4096];
+    FILE  *fp;
+
+    assert(!self->started);
+    cork_buffer_printf(&buf, "/sys/devices/system/node/node%u/cpulist", node);
+    fp = fopen(buf.buf, "r");
+    if (fp == NULL) {
+        cork_error_set_printf
+            (errno, "Cannot read CPUs of NUMA node %u: %s",
+             node, strerror(errno));
+        cork_buffer_done(&buf);
+        return -1;
+    }
+    cork_buffer_done(&buf);
+    if (fgets(line, sizeof(line), fp) == NULL) {
+        line[0] = '\0';
+    }
+    fclose(fp);
+
+    cork_array_init(&cpus);
+    if (cork_thread_parse_cpu_list(line, &cpus) == -1) {
+        cork_array_done(&cpus);
+        return -1;
+    }
+    cork_thread_set_affinity(self, cpus.items, cork_array_size(&cpus));
+    cork_array_done(&cpus);
+    self->numa_node = node;
+    return 0;
+#else
+    cork_error_set_printf
+        (ENOSYS, "Cannot bind threads to NUMA nodes on this platform");
+    return -1;
+#endif
+}
+
+void
+cork_thread_set_scheduling(struct cork_thread *self,
+                           enum cork_thread_sched_policy policy, int priority)
+{
+    assert(!self->started);
+    self->policy = policy;
+    self->priority = priority;
+}
+
+static int
+cork_thread_apply_attributes(struct cork_thread *self, pthread_attr_t *attr)
+{
+    int  rc;
+
+    if (self->stack_size != 0) {
+        rc = pthread_attr_setstacksize(attr, self->stack_size);
+        if (CORK_UNLIKELY(rc != 0)) {
+            goto error;
+        }
+    }
+
+    if (self->cpu_count > 0) {
+#if defined(__linux) && defined(__GLIBC__)
+        size_t  i;
+        cpu_set_t  set;
+        CPU_ZERO(&set);
+        for (i = 0; i < self->cpu_count; i++) {
+            if (CORK_UNLIKELY(self->cpus[i] >= CPU_SETSIZE)) {
+                rc = EINVAL;
+                goto error;
+            }
+            CPU_SET(self->cpus[i], &set);
+        }
+        rc = pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+        if (CORK_UNLIKELY(rc != 0)) {
+            goto error;
+        }
+#else
+        cork_error_set_printf
+            (ENOSYS, "Cannot set CPU affinity of threads on this platform");
+        return -1;
+#endif
+    }
+
+    if (self->policy != CORK_THREAD_SCHED_DEFAULT) {
+        int  policy;
+        struct sched_param  param;
+        switch (self->policy) {
+            case CORK_THREAD_SCHED_FIFO:
+                policy = SCHED_FIFO;
+                break;
+            case CORK_THREAD_SCHED_RR:
+                policy = SCHED_RR;
+                break;
+            default:
+                policy = SCHED_OTHER;
+                break;
+        }
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = self->priority;
+        if (CORK_UNLIKELY((rc = pthread_attr_setinheritsched
+                           (attr, PTHREAD_EXPLICIT_SCHED)) != 0 ||
+                          (rc = pthread_attr_setschedpolicy
+                           (attr, policy)) != 0 ||
+                          (rc = pthread_attr_setschedparam
+                           (attr, &param)) != 0)) {
+            goto error;
+        }
+    }
+
+    return 0;
+
+error:
+    cork_system_error_set_explicit(rc);
+    return -1;
+}
+
 #define PTHREADS_MAX_THREAD_NAME_LENGTH  16
 
+/* Attributes that a thread has to apply to itself once it's running. */
+static int
+cork_thread_apply_own_attributes(struct cork_thread *self)
+{
+#if (defined(__linux) && defined(__GLIBC__) && \
+     (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 12))) || \
+    (defined(__APPLE__) && defined(__MACH__)) || defined(__FreeBSD__)
+    /* We name the thread before running its body, so that the name is
+     * visible to debuggers and profilers for the thread's whole life.
+     * pthread_setname_np isn't available on versions of glibc earlier than
+     * 2.12, and names can only be 15 characters long. */
+    char  thread_name[PTHREADS_MAX_THREAD_NAME_LENGTH];
+    strncpy(thread_name, self->name, PTHREADS_MAX_THREAD_NAME_LENGTH);
+    thread_name[PTHREADS_MAX_THREAD_NAME_LENGTH - 1] = '\0';
+#if defined(__APPLE__) && defined(__MACH__)
+    /* On Mac OS X, we can only name the current thread. */
+    pthread_setname_np(thread_name);
+#elif defined(__FreeBSD__)
+    pthread_set_name_np(pthread_self(), thread_name);
+#else
+    pthread_setname_np(pthread_self(), thread_name);
+#endif
+#endif
+
+#if defined(__linux) && defined(SYS_set_mempolicy)
+    if (self->numa_node >= 0) {
+        /* Prefer to allocate memory from the thread's NUMA node.  (This is
+         * MPOL_PREFERRED; we don't want to depend on libnuma just for its
+         * name.) */
+        unsigned long  mask[16];
+        unsigned int  node = self->numa_node;
+        if (CORK_UNLIKELY(node >= sizeof(mask) * 8)) {
+            cork_system_error_set_explicit(EINVAL);
+            return -1;
+        }
+        memset(mask, 0, sizeof(mask));
+        mask[node / (sizeof(unsigned long) * 8)] |=
+            1UL << (node % (sizeof(unsigned long) * 8));
+        if (CORK_UNLIKELY(syscall(SYS_set_mempolicy, 1, mask,
+                                  sizeof(mask) * 8 + 1) == -1)) {
+            cork_system_error_set();
+            return -1;
+        }
+    }
+#endif
+
+    return 0;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Running threads
+ */
+
 static void *
 cork_thread_pthread_run(void *vself)
 {
     int  rc;
     struct cork_thread  *self = vself;
     struct cork_thread_descriptor  *desc = cork_thread_descriptor_get();
-#if defined(__APPLE__) && defined(__MACH__)
-    char  thread_name[PTHREADS_MAX_THREAD_NAME_LENGTH];
-#endif
 
     desc->current_thread = self;
     desc->id = self->id;
-    rc = self->run(self->user_data);
-
-#if defined(__APPLE__) && defined(__MACH__)
-    /* On Mac OS X, we set the name of the current thread, not of an arbitrary
-     * thread of our choosing. */
-    strncpy(thread_name, self->name, PTHREADS_MAX_THREAD_NAME_LENGTH);
-    thread_name[PTHREADS_MAX_THREAD_NAME_LENGTH - 1] = '\0';
-    pthread_setname_np(thread_name);
-#endif
+    rc = cork_thread_apply_own_attributes(self);
+    if (CORK_LIKELY(rc == 0)) {
+        rc = self->run(self->user_data);
+    }
 
     /* If an error occurred in the body of the thread, save the error into the
      * cork_thread object so that we can propagate that error when some calls
@@ -169,27 +435,25 @@ cork_thread_start(struct cork_thread *self)
 {
     int  rc;
     pthread_t  thread_id;
-#if defined(__linux) && ((__GLIBC__ >= 2) && (__GLIBC_MINOR__ >= 12))
-    char  thread_name[PTHREADS_MAX_THREAD_NAME_LENGTH];
-#endif
+    pthread_attr_t  attr;
 
     assert(!self->started);
 
-    rc = pthread_create(&thread_id, NULL, cork_thread_pthread_run, self);
+    rc = pthread_attr_init(&attr);
+    if (CORK_UNLIKELY(rc != 0)) {
+        cork_system_error_set_explicit(rc);
+        return -1;
+    }
+    if (CORK_UNLIKELY(cork_thread_apply_attributes(self, &attr) == -1)) {
+        pthread_attr_destroy(&attr);
+        return -1;
+    }
+    rc = pthread_create(&thread_id, &attr, cork_thread_pthread_run, self);
+    pthread_attr_destroy(&attr);
     if (CORK_UNLIKELY(rc != 0)) {
         cork_system_error_set_explicit(rc);
         return -1;
     }
-
-#if defined(__linux) && ((__GLIBC__ >= 2) && (__GLIBC_MINOR__ >= 12))
-    /* On Linux we choose which thread to name via an explicit thread ID.
-     * However, pthread_setname_np() isn't supported on versions of glibc
-     * earlier than 2.12. So we need to check for a MINOR version of 12 or
-     * higher. */
-    strncpy(thread_name, self->name, PTHREADS_MAX_THREAD_NAME_LENGTH);
-    thread_name[PTHREADS_MAX_THREAD_NAME_LENGTH - 1] = '\0';
-    pthread_setname_np(thread_id, thread_name);
-#endif
 
     self->thread_id = thread_id;
     self->started = true;
@@ -8,3 +8,20 @@ Make sure that our stable hash is really stable.
   0x0b0628ee
   $ cork-hash "A longer string"
   0x53a2c885
+
+Hashing a file, or stdin, gives the same result as hashing its contents as a
+string.
+
+  $ printf foo | cork-hash --file
+  0xf6a5c420
+  $ printf "A longer string" > input.txt
+  $ cork-hash --file input.txt
+  0x53a2c885
+
+We can also hash each line separately.
+
+  $ printf "foo\nbar\ntests.h\nA longer string" | cork-hash --lines
+  0xf6a5c420
+  0x450e998d
+  0x0b0628ee
+  0x53a2c885
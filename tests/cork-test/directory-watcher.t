@@ -46,6 +46,39 @@ no guarantee in what order the directory walker will encounter the files.
   d3/c
   d3/s1/s2/a
 
+The parallel walker should find exactly the same files.  Symbolic links are
+followed, just like any other entry.
+
+  $ cork-test dir --parallel test3 | sort
+  d2/a
+  d2/b
+  d3/a
+  d3/b
+  d3/c
+  d3/s1/s2/a
+  $ ln -s d2 test3/link
+  $ ln -s ../d3/a test3/d1/link
+  $ cork-test dir --only-files test3 | sort
+  d1/link
+  d2/a
+  d2/b
+  d3/a
+  d3/b
+  d3/c
+  d3/s1/s2/a
+  link/a
+  link/b
+  $ cork-test dir --parallel test3 | sort
+  d1/link
+  d2/a
+  d2/b
+  d3/a
+  d3/b
+  d3/c
+  d3/s1/s2/a
+  link/a
+  link/b
+
 Test what happens when the directory doesn't exit.
 
   $ cork-test dir missing
@@ -57,3 +90,6 @@ Test what happens when the directory doesn't exit.
   $ cork-test dir --shallow missing
   No such file or directory
   [1]
+  $ cork-test dir --parallel missing
+  No such file or directory
+  [1]
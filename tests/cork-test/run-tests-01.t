@@ -0,0 +1,4 @@
+  $ cork-test run-tests -j 1 --slowest 0 true
+  PASS +[0-9.]+s wall +[0-9.]+s cpu  true (re)
+  
+  1 tests, 0 failed, [0-9.]+s (re)
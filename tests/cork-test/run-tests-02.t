@@ -0,0 +1,9 @@
+  $ cork-test run-tests -j 2 --slowest 1 true false
+  [A-Z]{4} +[0-9.]+s wall +[0-9.]+s cpu  (true|false) (re)
+  [A-Z]{4} +[0-9.]+s wall +[0-9.]+s cpu  (true|false) (re)
+  
+  2 tests, 1 failed, [0-9.]+s (re)
+  
+  Slowest tests:
+     +[0-9.]+s wall +[0-9.]+s cpu  (true|false) (re)
+  [1]
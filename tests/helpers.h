@@ -11,8 +11,13 @@
 #ifndef TESTS_HELPERS_H
 #define TESTS_HELPERS_H
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "libcork/core/allocator.h"
+#include "libcork/core/attributes.h"
 #include "libcork/core/error.h"
+#include "libcork/core/timestamp.h"
 
 
 /*-----------------------------------------------------------------------
@@ -93,4 +98,65 @@ setup_allocator(void)
                  (char *) (what), (char *) (expected), (char *) (actual)))
 
 
+
+/*-----------------------------------------------------------------------
+ * Performance assertions
+ */
+
+/* fail_unless_fast runs its body iterations times, using i (which you
+ * declare) as the loop counter, and fails the test if it takes longer than
+ * max_ns nanoseconds per iteration.  We take the fastest of a few runs, so
+ * that one unlucky context switch doesn't cause a spurious failure.  The
+ * limits should be generous; they're meant to catch algorithmic regressions,
+ * not to benchmark anything.  (Use cork-bench for that.)
+ *
+ * We already loosen the limits for sanitizer builds and for the debug
+ * allocator.  For anything else that slows the tests down, like valgrind, you
+ * can scale the limits by setting CORK_TEST_PERF_SCALE (for instance, to 10);
+ * set it to 0 to skip the performance assertions completely. */
+
+#define PERF_RUNS  5
+
+CORK_ATTR_UNUSED
+static double
+perf_scale(void)
+{
+    const char  *scale = getenv("CORK_TEST_PERF_SCALE");
+    double  result = (scale == NULL)? 1.0: atof(scale);
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+    result *= 10;
+#endif
+#if CORK_EMBEDDED_TEST
+    /* The embedded tests use the debug allocator */
+    result *= 2;
+#endif
+    return result;
+}
+
+#define fail_unless_fast(what, max_ns, i, iterations, ...) \
+    do { \
+        double  __scale = perf_scale(); \
+        if (__scale > 0) { \
+            double  __best = 0; \
+            size_t  __run; \
+            for (__run = 0; __run < PERF_RUNS; __run++) { \
+                uint64_t  __start = cork_monotonic_nsec(); \
+                double  __ns; \
+                for ((i) = 0; (i) < (iterations); (i)++) { \
+                    __VA_ARGS__; \
+                } \
+                __ns = (double) (cork_monotonic_nsec() - __start) / \
+                    (iterations); \
+                if (__run == 0 || __ns < __best) { \
+                    __best = __ns; \
+                } \
+            } \
+            fprintf(stderr, "[perf: %s: %.1f ns]\n", (what), __best); \
+            fail_unless(__best <= (max_ns) * __scale, \
+                        "%s too slow (limit %.1f ns, got %.1f ns)", \
+                        (what), (double) (max_ns) * __scale, __best); \
+        } \
+    } while (0)
+
+
 #endif /* TESTS_HELPERS_H */
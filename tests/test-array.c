@@ -280,6 +280,159 @@ START_TEST(test_array_callbacks)
 END_TEST
 
 
+/*-----------------------------------------------------------------------
+ * Bulk operations
+ */
+
+#define check_contents(arr, ...) \
+    do { \
+        unsigned int  __expected[] = { __VA_ARGS__ }; \
+        size_t  __count = sizeof(__expected) / sizeof(__expected[0]); \
+        size_t  __i; \
+        fail_unless_equal("Array size", "%zu", __count, \
+                          cork_array_size(arr)); \
+        for (__i = 0; __i < __count; __i++) { \
+            fail_unless_equal("Array element", "%u", __expected[__i], \
+                              cork_array_at(arr, __i)); \
+        } \
+    } while (0)
+
+START_TEST(test_array_bulk)
+{
+    DESCRIBE_TEST;
+    struct callback_counts  counts;
+    test_array  array;
+    cork_small_array(unsigned int, 4)  small;
+    static const unsigned int  src[] = { 1, 2, 3, 4, 5 };
+
+    test_array_init(&array, &counts);
+    cork_array_append_n(&array, src, 5);
+    check_contents(&array, 1, 2, 3, 4, 5);
+    check_counts(&counts, 5, 0, 0, 0);
+
+    cork_array_insert_at(&array, 0, 10);
+    cork_array_insert_at(&array, 3, 11);
+    cork_array_insert_at(&array, 7, 12);
+    *cork_array_insert_at_get(&array, 1) = 13;
+    check_contents(&array, 10, 13, 1, 2, 11, 3, 4, 5, 12);
+    check_counts(&counts, 9, 0, 0, 0);
+
+    cork_array_remove_at(&array, 0);
+    cork_array_remove_at(&array, 3);
+    cork_array_remove_at(&array, 6);
+    check_contents(&array, 13, 1, 2, 3, 4, 5);
+    check_counts(&counts, 9, 0, 0, 3);
+
+    cork_array_swap_remove(&array, 1);
+    cork_array_swap_remove(&array, 4);
+    check_contents(&array, 13, 5, 2, 3);
+    check_counts(&counts, 9, 0, 0, 5);
+
+    /* The removed entries are reused before we initialize new ones. */
+    cork_array_append_n(&array, src, 5);
+    check_contents(&array, 13, 5, 2, 3, 1, 2, 3, 4, 5);
+    check_counts(&counts, 9, 0, 5, 5);
+    cork_array_append_n(&array, NULL, 2);
+    fail_unless_equal("Array size", "%zu", (size_t) 11,
+                      cork_array_size(&array));
+    check_counts(&counts, 11, 0, 5, 5);
+    cork_array_done(&array);
+    check_counts(&counts, 11, 11, 5, 5);
+
+    /* Small arrays can spill in the middle of a bulk operation. */
+    cork_small_array_init(&small);
+    cork_array_append_n(&small, src, 3);
+    cork_array_insert_at(&small, 1, 20);
+    check_contents(&small, 1, 20, 2, 3);
+    cork_array_insert_at(&small, 0, 21);
+    cork_array_append_n(&small, src + 3, 2);
+    check_contents(&small, 21, 1, 20, 2, 3, 4, 5);
+    cork_array_swap_remove(&small, 0);
+    cork_array_remove_at(&small, 1);
+    check_contents(&small, 5, 20, 2, 3, 4);
+    cork_array_done(&small);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Small arrays
+ */
+
+START_TEST(test_small_array)
+{
+    DESCRIBE_TEST;
+    cork_small_array(int64_t, 3)  array;
+    cork_small_array(int64_t, 3)  small_copy;
+    cork_array(int64_t)  copy;
+    struct callback_counts  counts;
+    cork_small_array(unsigned int, 2)  callbacks;
+
+    cork_small_array_init(&array);
+    fail_unless_equal("Inline count", "%zu", (size_t) 3,
+                      cork_small_array_inline_count(&array));
+    test_sum(&array, 0);
+    add_element (1, 1);
+    add_element0(2, 2, int64_t);
+    add_element (3, 3);
+    test_sum(&array, 6);
+    /* We shouldn't have allocated anything yet. */
+    fail_unless(array.priv == NULL, "Small array shouldn't have a priv block");
+    fail_unless(array.items == array.inline_items,
+                "Small array should use its inline storage");
+
+    /* Copying into a small array that's big enough stays inline. */
+    cork_small_array_init(&small_copy);
+    fail_if_error(cork_array_copy(&small_copy, &array, NULL, NULL));
+    test_sum(&small_copy, 6);
+    fail_unless(small_copy.priv == NULL,
+                "Small array shouldn't have a priv block");
+
+    /* Then spill onto the heap. */
+    add_element (4, 4);
+    add_element0(5, 5, int64_t);
+    add_element (6, 6);
+    test_sum(&array, 21);
+    fail_unless(array.items != array.inline_items,
+                "Small array should have spilled onto the heap");
+
+    cork_array_init(&copy);
+    fail_if_error(cork_array_copy(&copy, &array, NULL, NULL));
+    test_sum(&copy, 21);
+    fail_if_error(cork_array_copy(&small_copy, &copy, NULL, NULL));
+    test_sum(&small_copy, 21);
+
+    cork_array_clear(&array);
+    add_element (10, 1);
+    test_sum(&array, 10);
+
+    cork_array_done(&array);
+    cork_array_done(&small_copy);
+    cork_array_done(&copy);
+
+    /* Callbacks work the same as for regular arrays. */
+    memset(&counts, 0, sizeof(struct callback_counts));
+    cork_small_array_init(&callbacks);
+    cork_array_set_callback_data(&callbacks, &counts, NULL);
+    cork_array_set_init(&callbacks, test_array__init);
+    cork_array_set_done(&callbacks, test_array__done);
+    cork_array_set_reuse(&callbacks, test_array__reuse);
+    cork_array_set_remove(&callbacks, test_array__remove);
+    cork_array_append(&callbacks, 0);
+    cork_array_append(&callbacks, 1);
+    check_counts(&counts, 2, 0, 0, 0);
+    cork_array_append(&callbacks, 2);
+    check_counts(&counts, 3, 0, 0, 0);
+    cork_array_clear(&callbacks);
+    check_counts(&counts, 3, 0, 0, 3);
+    cork_array_append(&callbacks, 0);
+    check_counts(&counts, 3, 0, 1, 3);
+    cork_array_done(&callbacks);
+    check_counts(&counts, 3, 3, 1, 3);
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -296,6 +449,8 @@ test_suite()
     tcase_add_test(tc_ds, test_array_int64_t);
     tcase_add_test(tc_ds, test_array_string);
     tcase_add_test(tc_ds, test_array_callbacks);
+    tcase_add_test(tc_ds, test_array_bulk);
+    tcase_add_test(tc_ds, test_small_array);
     suite_add_tcase(s, tc_ds);
 
     return s;
@@ -81,6 +81,158 @@ START_TEST(test_bitset)
 END_TEST
 
 
+/* We check the bulk operations against the per-bit macros. */
+
+static size_t
+test_bitset_count_slowly(const struct cork_bitset *set)
+{
+    size_t  count = 0;
+    size_t  i;
+    for (i = 0; i < set->bit_count; i++) {
+        count += cork_bitset_get(set, i);
+    }
+    return count;
+}
+
+static void
+test_bitset_fill_randomly(struct cork_bitset *set, uint32_t *seed)
+{
+    size_t  i;
+    for (i = 0; i < set->bit_count; i++) {
+        *seed = *seed * 1103515245 + 12345;
+        cork_bitset_set(set, i, (*seed >> 16) % 3 == 0);
+    }
+}
+
+static void
+test_bitset_range(size_t bit_count, size_t start, size_t end)
+{
+    struct cork_bitset  *set = cork_bitset_new(bit_count);
+    size_t  i;
+
+    cork_bitset_set_range(set, start, end, true);
+    for (i = 0; i < bit_count; i++) {
+        fail_unless(cork_bitset_get(set, i) == (i >= start && i < end),
+                    "Unexpected value for bit %zu in [%zu, %zu)",
+                    i, start, end);
+    }
+    fail_unless_equal("Count", "%zu", end - start, cork_bitset_count(set));
+    fail_unless_equal("First set bit", "%zu",
+                      (start == end)? bit_count: start,
+                      cork_bitset_find_first(set));
+
+    cork_bitset_set_range(set, 0, bit_count, true);
+    cork_bitset_set_range(set, start, end, false);
+    fail_unless_equal("Count", "%zu", bit_count - (end - start),
+                      cork_bitset_count(set));
+    fail_unless_equal("Count", "%zu", test_bitset_count_slowly(set),
+                      cork_bitset_count(set));
+    cork_bitset_free(set);
+}
+
+START_TEST(test_bitset_ranges)
+{
+    DESCRIBE_TEST;
+    test_bitset_range(1, 0, 0);
+    test_bitset_range(1, 0, 1);
+    test_bitset_range(13, 3, 11);
+    test_bitset_range(64, 0, 64);
+    test_bitset_range(64, 63, 64);
+    test_bitset_range(65, 1, 65);
+    test_bitset_range(200, 7, 7);
+    test_bitset_range(200, 64, 128);
+    test_bitset_range(200, 10, 190);
+    test_bitset_range(65537, 31, 65500);
+}
+END_TEST
+
+START_TEST(test_bitset_iteration)
+{
+    DESCRIBE_TEST;
+    static const size_t  sizes[] = { 1, 63, 64, 65, 1000, 65537 };
+    uint32_t  seed = 0;
+    size_t  i;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        struct cork_bitset  *set = cork_bitset_new(sizes[i]);
+        size_t  expected = 0;
+        size_t  count = 0;
+        size_t  bit;
+
+        fail_unless_equal("First set bit", "%zu", sizes[i],
+                          cork_bitset_find_first(set));
+        test_bitset_fill_randomly(set, &seed);
+        cork_bitset_foreach(set, bit) {
+            while (!cork_bitset_get(set, expected)) {
+                expected++;
+            }
+            fail_unless_equal("Next set bit", "%zu", expected, bit);
+            expected++;
+            count++;
+        }
+        fail_unless_equal("Count", "%zu", test_bitset_count_slowly(set),
+                          count);
+        fail_unless_equal("Count", "%zu", count, cork_bitset_count(set));
+        cork_bitset_free(set);
+    }
+}
+END_TEST
+
+START_TEST(test_bitset_set_algebra)
+{
+    DESCRIBE_TEST;
+    static const size_t  sizes[] = { 1, 64, 100, 128, 1000, 65537 };
+    uint32_t  seed = 1;
+    size_t  i;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t  bit_count = sizes[i];
+        struct cork_bitset  *a = cork_bitset_new(bit_count);
+        struct cork_bitset  *b = cork_bitset_new(bit_count);
+        struct cork_bitset  *and_ = cork_bitset_new(bit_count);
+        struct cork_bitset  *or_ = cork_bitset_new(bit_count);
+        struct cork_bitset  *xor_ = cork_bitset_new(bit_count);
+        struct cork_bitset  *andnot = cork_bitset_new(bit_count);
+        size_t  bit;
+
+        test_bitset_fill_randomly(a, &seed);
+        test_bitset_fill_randomly(b, &seed);
+        cork_bitset_or(and_, a);
+        cork_bitset_and(and_, b);
+        cork_bitset_or(or_, a);
+        cork_bitset_or(or_, b);
+        cork_bitset_or(xor_, a);
+        cork_bitset_xor(xor_, b);
+        cork_bitset_or(andnot, a);
+        cork_bitset_andnot(andnot, b);
+
+        for (bit = 0; bit < bit_count; bit++) {
+            bool  in_a = cork_bitset_get(a, bit);
+            bool  in_b = cork_bitset_get(b, bit);
+            fail_unless(cork_bitset_get(and_, bit) == (in_a && in_b),
+                        "Unexpected AND result for bit %zu", bit);
+            fail_unless(cork_bitset_get(or_, bit) == (in_a || in_b),
+                        "Unexpected OR result for bit %zu", bit);
+            fail_unless(cork_bitset_get(xor_, bit) == (in_a != in_b),
+                        "Unexpected XOR result for bit %zu", bit);
+            fail_unless(cork_bitset_get(andnot, bit) == (in_a && !in_b),
+                        "Unexpected ANDNOT result for bit %zu", bit);
+        }
+        fail_unless_equal("Count", "%zu",
+                          cork_bitset_count(and_) + cork_bitset_count(xor_),
+                          cork_bitset_count(or_));
+
+        cork_bitset_free(a);
+        cork_bitset_free(b);
+        cork_bitset_free(and_);
+        cork_bitset_free(or_);
+        cork_bitset_free(xor_);
+        cork_bitset_free(andnot);
+    }
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -93,6 +245,9 @@ test_suite()
     TCase  *tc_ds = tcase_create("bits");
     tcase_set_timeout(tc_ds, 20.0);
     tcase_add_test(tc_ds, test_bitset);
+    tcase_add_test(tc_ds, test_bitset_ranges);
+    tcase_add_test(tc_ds, test_bitset_iteration);
+    tcase_add_test(tc_ds, test_bitset_set_algebra);
     suite_add_tcase(s, tc_ds);
 
     return s;
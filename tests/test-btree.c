@@ -0,0 +1,562 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <check.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/error.h"
+#include "libcork/core/timestamp.h"
+#include "libcork/core/types.h"
+#include "libcork/core/u128.h"
+#include "libcork/ds/array.h"
+#include "libcork/ds/btree.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Helpers
+ */
+
+CORK_BTREE_DEFINE(uint64_tree, uint64_t, uint64_t, cork_btree_uint64_lt);
+
+struct test_big_value {
+    uint64_t  id;
+    char  padding[120];
+};
+
+CORK_BTREE_DEFINE(big_tree, uint32_t, struct test_big_value,
+                  cork_btree_uint32_lt);
+
+static uint64_t
+test_random(uint64_t *state)
+{
+    /* xorshift64 */
+    uint64_t  x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* Checks the structural invariants of a subtree, and returns the number of
+ * entries in it.  Every key must be in [*lo, *hi) when the bounds aren't
+ * NULL. */
+static size_t
+check_subtree(const struct cork_raw_btree *tree,
+              const struct cork_raw_btree_node *node, unsigned int depth,
+              const uint64_t *lo, const uint64_t *hi)
+{
+    size_t  i;
+    size_t  count = 0;
+    uint64_t  key;
+    uint64_t  prev_key = 0;
+
+    if (node != tree->root) {
+        size_t  min = node->is_leaf?
+            tree->leaf_capacity / 2: (tree->internal_capacity - 1) / 2;
+        fail_unless(node->count >= min, "Node is underfull (%u < %zu)",
+                    (unsigned int) node->count, min);
+    }
+    fail_unless(node->count <= (node->is_leaf?
+                                tree->leaf_capacity: tree->internal_capacity),
+                "Node is overfull");
+    fail_unless((depth == tree->height) == (bool) node->is_leaf,
+                "Leaves are at different depths");
+
+    for (i = 0; i < node->count; i++) {
+        memcpy(&key, cork_raw_btree_key(tree, node, i), sizeof(key));
+        fail_if(i > 0 && key <= prev_key, "Node keys are out of order");
+        fail_if(lo != NULL && key < *lo, "Key is below its subtree's bound");
+        fail_if(hi != NULL && key >= *hi, "Key is above its subtree's bound");
+        prev_key = key;
+    }
+
+    if (node->is_leaf) {
+        return node->count;
+    }
+    for (i = 0; i <= node->count; i++) {
+        uint64_t  child_lo;
+        uint64_t  child_hi;
+        const uint64_t  *clo = lo;
+        const uint64_t  *chi = hi;
+        if (i > 0) {
+            memcpy(&child_lo, cork_raw_btree_key(tree, node, i - 1),
+                   sizeof(child_lo));
+            clo = &child_lo;
+        }
+        if (i < node->count) {
+            memcpy(&child_hi, cork_raw_btree_key(tree, node, i),
+                   sizeof(child_hi));
+            chi = &child_hi;
+        }
+        count += check_subtree
+            (tree, cork_raw_btree_child(tree, node, i), depth + 1, clo, chi);
+    }
+    return count;
+}
+
+static void
+check_tree(const struct uint64_tree *tree)
+{
+    const struct cork_raw_btree  *raw = &tree->raw;
+    const struct cork_raw_btree_node  *leaf;
+    const struct cork_raw_btree_node  *prev = NULL;
+    size_t  count = 0;
+
+    if (raw->root == NULL) {
+        fail_unless_equal("Tree size", "%zu", (size_t) 0, raw->size);
+        fail_unless(raw->first == NULL && raw->last == NULL,
+                    "Empty tree shouldn't have any leaves");
+        return;
+    }
+    fail_unless_equal("Tree size", "%zu", raw->size,
+                      check_subtree(raw, raw->root, 1, NULL, NULL));
+    for (leaf = raw->first; leaf != NULL; leaf = leaf->next) {
+        fail_unless(leaf->prev == prev, "Leaf links are inconsistent");
+        count += leaf->count;
+        prev = leaf;
+    }
+    fail_unless(raw->last == prev, "Last leaf is wrong");
+    fail_unless_equal("Leaf entry count", "%zu", raw->size, count);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Basic operations
+ */
+
+START_TEST(test_btree_basics)
+{
+    struct uint64_tree  tree;
+    struct cork_btree_iterator  iter;
+    uint64_t  key;
+    uint64_t  *value;
+    uint64_t  deleted;
+    bool  is_new;
+
+    DESCRIBE_TEST;
+    uint64_tree_init(&tree);
+    fail_unless_equal("Tree size", "%zu", (size_t) 0, uint64_tree_size(&tree));
+    fail_unless(uint64_tree_get(&tree, 1) == NULL, "Empty tree has an entry");
+    fail_if(uint64_tree_delete(&tree, 1, NULL), "Empty tree deleted an entry");
+    uint64_tree_first(&tree, &iter);
+    fail_if(uint64_tree_next(&tree, &iter, &key, &value),
+            "Empty tree has an entry");
+    uint64_tree_lower_bound(&tree, 1, &iter);
+    fail_if(uint64_tree_prev(&tree, &iter, &key, &value),
+            "Empty tree has an entry");
+
+    uint64_tree_put(&tree, 10, 100);
+    uint64_tree_put(&tree, 30, 300);
+    uint64_tree_put(&tree, 20, 200);
+    fail_unless_equal("Tree size", "%zu", (size_t) 3, uint64_tree_size(&tree));
+    fail_if((value = uint64_tree_get(&tree, 20)) == NULL, "Missing key 20");
+    fail_unless_equal("Value", "%" PRIu64, (uint64_t) 200, *value);
+    fail_unless(uint64_tree_contains(&tree, 30), "Missing key 30");
+    fail_if(uint64_tree_contains(&tree, 25), "Unexpected key 25");
+
+    /* Replacing a value */
+    value = uint64_tree_get_or_create(&tree, 20, &is_new);
+    fail_if(is_new, "Key 20 should already exist");
+    *value = 201;
+    uint64_tree_put(&tree, 30, 301);
+    fail_unless_equal("Tree size", "%zu", (size_t) 3, uint64_tree_size(&tree));
+    fail_unless_equal("Value", "%" PRIu64, (uint64_t) 201,
+                      *uint64_tree_get(&tree, 20));
+    fail_unless_equal("Value", "%" PRIu64, (uint64_t) 301,
+                      *uint64_tree_get(&tree, 30));
+
+    /* Range queries */
+    uint64_tree_lower_bound(&tree, 20, &iter);
+    fail_unless(uint64_tree_next(&tree, &iter, &key, NULL) && key == 20,
+                "lower_bound(20) should start at 20");
+    uint64_tree_upper_bound(&tree, 20, &iter);
+    fail_unless(uint64_tree_next(&tree, &iter, &key, NULL) && key == 30,
+                "upper_bound(20) should start at 30");
+    fail_if(uint64_tree_next(&tree, &iter, &key, NULL),
+            "Should be at the end of the tree");
+    fail_unless(uint64_tree_prev(&tree, &iter, &key, NULL) && key == 30,
+                "prev should return 30 again");
+    uint64_tree_upper_bound(&tree, 25, &iter);
+    fail_unless(uint64_tree_prev(&tree, &iter, &key, &value) && key == 20 &&
+                *value == 201, "Floor of 25 should be 20");
+    uint64_tree_lower_bound(&tree, 5, &iter);
+    fail_if(uint64_tree_prev(&tree, &iter, &key, NULL),
+            "Nothing should come before 10");
+    uint64_tree_lower_bound(&tree, 35, &iter);
+    fail_if(uint64_tree_next(&tree, &iter, &key, NULL),
+            "Nothing should come after 30");
+    uint64_tree_last(&tree, &iter);
+    fail_unless(uint64_tree_prev(&tree, &iter, &key, NULL) && key == 30,
+                "Last entry should be 30");
+
+    fail_unless(uint64_tree_delete(&tree, 10, &deleted), "Couldn't delete 10");
+    fail_unless_equal("Deleted value", "%" PRIu64, (uint64_t) 100, deleted);
+    fail_if(uint64_tree_delete(&tree, 10, NULL), "Deleted 10 twice");
+    fail_unless(uint64_tree_delete(&tree, 20, NULL), "Couldn't delete 20");
+    fail_unless(uint64_tree_delete(&tree, 30, NULL), "Couldn't delete 30");
+    fail_unless_equal("Tree size", "%zu", (size_t) 0, uint64_tree_size(&tree));
+    check_tree(&tree);
+
+    uint64_tree_put(&tree, 1, 1);
+    uint64_tree_clear(&tree);
+    fail_unless_equal("Tree size", "%zu", (size_t) 0, uint64_tree_size(&tree));
+    uint64_tree_done(&tree);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Randomized operations
+ */
+
+#define RANDOM_KEY_RANGE  4096
+#define RANDOM_OP_COUNT  40000
+
+START_TEST(test_btree_random)
+{
+    struct uint64_tree  tree;
+    struct cork_btree_iterator  iter;
+    uint64_t  *expected;
+    bool  *present;
+    uint64_t  state = 0x123456789abcdefULL;
+    uint64_t  key;
+    uint64_t  *value;
+    uint64_t  prev_key = 0;
+    size_t  size = 0;
+    size_t  count;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    uint64_tree_init(&tree);
+    expected = cork_calloc(RANDOM_KEY_RANGE, sizeof(uint64_t));
+    present = cork_calloc(RANDOM_KEY_RANGE, sizeof(bool));
+
+    for (i = 0; i < RANDOM_OP_COUNT; i++) {
+        uint64_t  r = test_random(&state);
+        key = (r >> 8) % RANDOM_KEY_RANGE;
+        /* Bias towards inserts for the first half and deletes for the second,
+         * so that the tree grows tall and then shrinks back down. */
+        if ((r & 0xff) < ((i < RANDOM_OP_COUNT / 2)? 180: 60)) {
+            if (!present[key]) {
+                size++;
+            }
+            present[key] = true;
+            expected[key] = r;
+            uint64_tree_put(&tree, key, r);
+        } else {
+            uint64_t  deleted;
+            bool  found = uint64_tree_delete(&tree, key, &deleted);
+            fail_unless(found == present[key],
+                        "Unexpected delete result for %" PRIu64, key);
+            if (found) {
+                fail_unless_equal("Deleted value", "%" PRIu64,
+                                  expected[key], deleted);
+                present[key] = false;
+                size--;
+            }
+        }
+        if (i % 1000 == 0) {
+            check_tree(&tree);
+        }
+    }
+    check_tree(&tree);
+    fail_unless_equal("Tree size", "%zu", size, uint64_tree_size(&tree));
+
+    for (key = 0; key < RANDOM_KEY_RANGE; key++) {
+        value = uint64_tree_get(&tree, key);
+        fail_unless((value != NULL) == present[key],
+                    "Unexpected lookup result for %" PRIu64, key);
+        if (value != NULL) {
+            fail_unless_equal("Value", "%" PRIu64, expected[key], *value);
+        }
+    }
+
+    /* Forward and backward iteration visit every key in order. */
+    count = 0;
+    uint64_tree_first(&tree, &iter);
+    while (uint64_tree_next(&tree, &iter, &key, &value)) {
+        fail_if(count > 0 && key <= prev_key, "Keys are out of order");
+        fail_unless(present[key], "Unexpected key %" PRIu64, key);
+        prev_key = key;
+        count++;
+    }
+    fail_unless_equal("Forward count", "%zu", size, count);
+    count = 0;
+    while (uint64_tree_prev(&tree, &iter, &key, &value)) {
+        fail_if(count > 0 && key >= prev_key, "Keys are out of order");
+        prev_key = key;
+        count++;
+    }
+    fail_unless_equal("Backward count", "%zu", size, count);
+
+    /* Delete everything that's left. */
+    for (key = 0; key < RANDOM_KEY_RANGE; key++) {
+        fail_unless(uint64_tree_delete(&tree, key, NULL) == present[key],
+                    "Unexpected delete result for %" PRIu64, key);
+    }
+    check_tree(&tree);
+    fail_unless_equal("Tree size", "%zu", (size_t) 0, uint64_tree_size(&tree));
+
+    cork_cfree(expected, RANDOM_KEY_RANGE, sizeof(uint64_t));
+    cork_cfree(present, RANDOM_KEY_RANGE, sizeof(bool));
+    uint64_tree_done(&tree);
+}
+END_TEST
+
+START_TEST(test_btree_sequential)
+{
+    struct uint64_tree  tree;
+    uint64_t  key;
+    const uint64_t  count = 20000;
+
+    DESCRIBE_TEST;
+    uint64_tree_init(&tree);
+    /* Ascending and descending inserts always split the same edge of the
+     * tree. */
+    for (key = 0; key < count; key++) {
+        uint64_tree_put(&tree, key * 2, key);
+    }
+    for (key = count; key > 0; key--) {
+        uint64_tree_put(&tree, key * 2 - 1, key);
+    }
+    check_tree(&tree);
+    fail_unless_equal("Tree size", "%zu", (size_t) count * 2,
+                      uint64_tree_size(&tree));
+    for (key = 0; key < count * 2; key += 2) {
+        fail_unless(uint64_tree_delete(&tree, key, NULL),
+                    "Couldn't delete %" PRIu64, key);
+    }
+    check_tree(&tree);
+    for (key = count * 2 - 1; key < count * 2; key -= 2) {
+        fail_unless(uint64_tree_delete(&tree, key, NULL),
+                    "Couldn't delete %" PRIu64, key);
+    }
+    check_tree(&tree);
+    fail_unless_equal("Tree size", "%zu", (size_t) 0, uint64_tree_size(&tree));
+    uint64_tree_done(&tree);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Bulk loading
+ */
+
+static void
+test_bulk_load_count(size_t count)
+{
+    struct uint64_tree  tree;
+    struct cork_btree_iterator  iter;
+    cork_array(struct uint64_tree_entry)  entries;
+    struct uint64_tree_entry  entry;
+    uint64_t  key;
+    uint64_t  *value;
+    size_t  i;
+
+    cork_array_init(&entries);
+    for (i = 0; i < count; i++) {
+        entry.key = i * 3;
+        entry.value = i;
+        cork_array_append(&entries, entry);
+    }
+
+    uint64_tree_init(&tree);
+    /* Any existing entries are replaced */
+    uint64_tree_put(&tree, 1, 1);
+    fail_if_error(uint64_tree_bulk_load
+                  (&tree, cork_array_elements(&entries),
+                   cork_array_size(&entries)));
+    check_tree(&tree);
+    fail_unless_equal("Tree size", "%zu", count, uint64_tree_size(&tree));
+
+    i = 0;
+    uint64_tree_first(&tree, &iter);
+    while (uint64_tree_next(&tree, &iter, &key, &value)) {
+        fail_unless_equal("Key", "%" PRIu64, (uint64_t) i * 3, key);
+        fail_unless_equal("Value", "%" PRIu64, (uint64_t) i, *value);
+        i++;
+    }
+    fail_unless_equal("Entry count", "%zu", count, i);
+
+    /* The tree can still be modified after a bulk load. */
+    for (i = 0; i < count; i++) {
+        uint64_tree_put(&tree, i * 3 + 1, i);
+    }
+    check_tree(&tree);
+    for (i = 0; i < count; i += 2) {
+        fail_unless(uint64_tree_delete(&tree, i * 3, NULL),
+                    "Couldn't delete %zu", i * 3);
+    }
+    check_tree(&tree);
+
+    uint64_tree_done(&tree);
+    cork_array_done(&entries);
+}
+
+START_TEST(test_btree_bulk_load)
+{
+    struct uint64_tree  tree;
+    struct uint64_tree_entry  unsorted[3] = { { 1, 1 }, { 3, 3 }, { 2, 2 } };
+    struct uint64_tree_entry  duplicates[2] = { { 1, 1 }, { 1, 2 } };
+
+    DESCRIBE_TEST;
+    test_bulk_load_count(0);
+    test_bulk_load_count(1);
+    test_bulk_load_count(30);
+    test_bulk_load_count(31);
+    test_bulk_load_count(1000);
+    test_bulk_load_count(100000);
+
+    uint64_tree_init(&tree);
+    uint64_tree_put(&tree, 5, 5);
+    fail_unless_error(uint64_tree_bulk_load(&tree, unsorted, 3),
+                      "Shouldn't bulk load unsorted entries");
+    fail_unless_error(uint64_tree_bulk_load(&tree, duplicates, 2),
+                      "Shouldn't bulk load duplicate entries");
+    fail_unless_equal("Tree size", "%zu", (size_t) 1, uint64_tree_size(&tree));
+    uint64_tree_done(&tree);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Other key and value types
+ */
+
+START_TEST(test_btree_big_values)
+{
+    struct big_tree  tree;
+    struct test_big_value  value;
+    struct test_big_value  *found;
+    uint32_t  key;
+
+    DESCRIBE_TEST;
+    big_tree_init(&tree);
+    fail_unless(tree.raw.leaf_capacity >= 8, "Leaves are too small");
+    memset(&value, 0, sizeof(value));
+    for (key = 0; key < 1000; key++) {
+        value.id = key * 7;
+        big_tree_put(&tree, 999 - key, value);
+    }
+    for (key = 0; key < 1000; key++) {
+        fail_if((found = big_tree_get(&tree, key)) == NULL,
+                "Missing key %" PRIu32, key);
+        fail_unless_equal("Value", "%" PRIu64, (uint64_t) (999 - key) * 7,
+                          found->id);
+    }
+    for (key = 0; key < 1000; key += 3) {
+        fail_unless(big_tree_delete(&tree, key, NULL),
+                    "Couldn't delete %" PRIu32, key);
+    }
+    fail_unless_equal("Tree size", "%zu", (size_t) 666,
+                      big_tree_size(&tree));
+    big_tree_done(&tree);
+}
+END_TEST
+
+START_TEST(test_btree_builtin_types)
+{
+    struct cork_uint64_btree  u64_tree;
+    struct cork_u128_btree  u128_tree;
+    struct cork_timestamp_btree  ts_tree;
+    struct cork_btree_iterator  iter;
+    cork_u128  key;
+    cork_u128  found;
+    cork_timestamp  ts;
+    void  **value;
+    int  a = 1;
+    int  b = 2;
+    int  c = 3;
+
+    DESCRIBE_TEST;
+    cork_uint64_btree_init(&u64_tree);
+    cork_uint64_btree_put(&u64_tree, UINT64_MAX, &a);
+    cork_uint64_btree_put(&u64_tree, 0, &b);
+    fail_if((value = cork_uint64_btree_get(&u64_tree, UINT64_MAX)) == NULL,
+            "Missing key");
+    fail_unless(*value == &a, "Unexpected value");
+    cork_uint64_btree_done(&u64_tree);
+
+    /* u128 keys compare as 128-bit integers, so the high word matters
+     * most. */
+    cork_u128_btree_init(&u128_tree);
+    cork_u128_btree_put(&u128_tree, cork_u128_from_64(1, 0), &a);
+    cork_u128_btree_put(&u128_tree, cork_u128_from_64(0, UINT64_MAX), &b);
+    cork_u128_btree_put(&u128_tree, cork_u128_from_64(2, 5), &c);
+    key = cork_u128_from_64(1, 1);
+    cork_u128_btree_upper_bound(&u128_tree, key, &iter);
+    fail_unless(cork_u128_btree_prev(&u128_tree, &iter, &found, &value),
+                "Missing floor entry");
+    fail_unless(cork_u128_eq(found, cork_u128_from_64(1, 0)) && *value == &a,
+                "Unexpected floor entry");
+    fail_unless(cork_u128_btree_prev(&u128_tree, &iter, &found, &value),
+                "Missing previous entry");
+    fail_unless(*value == &b, "Unexpected previous entry");
+    cork_u128_btree_first(&u128_tree, &iter);
+    fail_unless(cork_u128_btree_next(&u128_tree, &iter, &found, &value) &&
+                *value == &b, "Unexpected first entry");
+    cork_u128_btree_done(&u128_tree);
+
+    cork_timestamp_btree_init(&ts_tree);
+    cork_timestamp_init_sec(&ts, 100);
+    cork_timestamp_btree_put(&ts_tree, ts, &a);
+    cork_timestamp_init_sec(&ts, 50);
+    cork_timestamp_btree_put(&ts_tree, ts, &b);
+    cork_timestamp_init_sec(&ts, 60);
+    cork_timestamp_btree_lower_bound(&ts_tree, ts, &iter);
+    fail_unless(cork_timestamp_btree_next(&ts_tree, &iter, &ts, &value) &&
+                *value == &a, "Unexpected timestamp entry");
+    fail_unless_equal("Seconds", "%" PRIu32, (uint32_t) 100,
+                      cork_timestamp_sec(ts));
+    cork_timestamp_btree_done(&ts_tree);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("btree");
+
+    TCase  *tc_ds = tcase_create("btree");
+    tcase_add_test(tc_ds, test_btree_basics);
+    tcase_add_test(tc_ds, test_btree_random);
+    tcase_add_test(tc_ds, test_btree_sequential);
+    tcase_add_test(tc_ds, test_btree_bulk_load);
+    tcase_add_test(tc_ds, test_btree_big_values);
+    tcase_add_test(tc_ds, test_btree_builtin_types);
+    suite_add_tcase(s, tc_ds);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    setup_allocator();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -8,14 +8,18 @@
  * ----------------------------------------------------------------------
  */
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <check.h>
 
 #include "libcork/core/types.h"
 #include "libcork/ds/buffer.h"
+#include "libcork/ds/chunked-buffer.h"
+#include "libcork/ds/compressed-stream.h"
 #include "libcork/ds/managed-buffer.h"
 #include "libcork/ds/stream.h"
 
@@ -139,6 +143,44 @@ START_TEST(test_buffer_append)
 END_TEST
 
 
+START_TEST(test_buffer_reserve)
+{
+    struct cork_buffer  buffer = CORK_BUFFER_INIT();
+    struct cork_buffer  expected = CORK_BUFFER_INIT();
+    char  *dest;
+    int  fds[2];
+    size_t  i;
+
+    cork_buffer_set_literal(&buffer, "abc");
+    dest = cork_buffer_reserve(&buffer, 10);
+    memcpy(dest, "defg", 4);
+    cork_buffer_commit(&buffer, 4);
+    fail_unless_streq("Buffer", "abcdefg", buffer.buf);
+    fail_unless_equal("Buffer size", "%zu", (size_t) 7, buffer.size);
+
+    /* Committing nothing leaves the buffer alone */
+    cork_buffer_reserve(&buffer, 100);
+    cork_buffer_commit(&buffer, 0);
+    fail_unless_streq("Buffer", "abcdefg", buffer.buf);
+
+    /* Read more than a single chunk's worth of data from a pipe */
+    for (i = 0; i < 1000; i++) {
+        cork_buffer_append_printf(&expected, "line %zu\n", i);
+    }
+    fail_if(pipe(fds) == -1, "Cannot create pipe");
+    fail_unless(write(fds[1], expected.buf, expected.size) ==
+                (ssize_t) expected.size, "Cannot write to pipe");
+    close(fds[1]);
+    cork_buffer_clear(&buffer);
+    fail_if_error(cork_buffer_append_fd(&buffer, fds[0]));
+    close(fds[0]);
+    check_buffers(&buffer, &expected);
+
+    cork_buffer_done(&buffer);
+    cork_buffer_done(&expected);
+}
+END_TEST
+
 START_TEST(test_buffer_slicing)
 {
     static char  SRC[] =
@@ -238,6 +280,585 @@ check_c_string_(const char *content, size_t length,
 #define check_c_string(c)  (check_c_string_(c, sizeof(c) - 1, #c))
 #define check_c_string_ex(c, e)  (check_c_string_(c, sizeof(c) - 1, e))
 
+START_TEST(test_buffer_stream_vec)
+{
+    struct cork_buffer  buffer1 = CORK_BUFFER_INIT();
+    struct cork_buffer  buffer2 = CORK_BUFFER_INIT();
+    struct cork_stream_consumer  *consumer;
+    struct cork_slice  slices[3];
+    int  fds[2];
+    size_t  i;
+
+    cork_slice_init_static(&slices[0], "abcd", 4);
+    cork_slice_init_static(&slices[1], "", 0);
+    cork_slice_init_static(&slices[2], "efg", 3);
+
+    /* A consumer that implements data_vec directly */
+    cork_buffer_set_literal(&buffer1, "000");
+    fail_if_error(consumer = cork_buffer_to_stream_consumer(&buffer1));
+    fail_if_error(cork_stream_consumer_data_vec(consumer, slices, 3, true));
+    fail_if_error(cork_stream_consumer_data_vec(consumer, slices, 1, false));
+    /* Its data method is implemented in terms of data_vec */
+    fail_unless(cork_stream_consumer_has_data_vec(consumer),
+                "Buffer consumer should opt into data_vec");
+    fail_if_error(cork_stream_consumer_data(consumer, "hi", 2, false));
+    fail_if_error(cork_stream_consumer_eof(consumer));
+    cork_stream_consumer_free(consumer);
+    fail_unless_streq("Buffer", "000abcdefgabcdhi", buffer1.buf);
+
+    /* A consumer that only implements data */
+    fail_if(pipe(fds) == -1, "Cannot create pipe");
+    fail_if_error(consumer = cork_fd_consumer_new(fds[1]));
+    fail_if_error(cork_stream_consumer_data_vec(consumer, slices, 3, true));
+    fail_if_error(cork_stream_consumer_eof(consumer));
+    cork_stream_consumer_free(consumer);
+    close(fds[1]);
+    fail_if_error(cork_buffer_append_fd(&buffer2, fds[0]));
+    close(fds[0]);
+    fail_unless_streq("Buffer", "abcdefg", buffer2.buf);
+
+    /* cork_consume_fd hands over several chunks at a time */
+    cork_buffer_clear(&buffer2);
+    for (i = 0; i < 3000; i++) {
+        cork_buffer_append_printf(&buffer2, "line %zu\n", i);
+    }
+    fail_if(pipe(fds) == -1, "Cannot create pipe");
+    fail_unless(write(fds[1], buffer2.buf, buffer2.size) ==
+                (ssize_t) buffer2.size, "Cannot write to pipe");
+    close(fds[1]);
+    cork_buffer_clear(&buffer1);
+    fail_if_error(consumer = cork_buffer_to_stream_consumer(&buffer1));
+    fail_if_error(cork_consume_fd(consumer, fds[0]));
+    cork_stream_consumer_free(consumer);
+    close(fds[0]);
+    check_buffers(&buffer1, &buffer2);
+
+    cork_buffer_done(&buffer1);
+    cork_buffer_done(&buffer2);
+}
+END_TEST
+
+/* A consumer that records the largest chunk it has seen */
+struct chunk_size_consumer {
+    struct cork_stream_consumer  parent;
+    struct cork_buffer  buf;
+    size_t  max_chunk_size;
+};
+
+static int
+chunk_size_consumer__data(struct cork_stream_consumer *vself,
+                          const void *buf, size_t size, bool is_first_chunk)
+{
+    struct chunk_size_consumer  *self =
+        cork_container_of(vself, struct chunk_size_consumer, parent);
+    if (size > self->max_chunk_size) {
+        self->max_chunk_size = size;
+    }
+    cork_buffer_append(&self->buf, buf, size);
+    return 0;
+}
+
+static int
+chunk_size_consumer__eof(struct cork_stream_consumer *vself)
+{
+    return 0;
+}
+
+static void
+chunk_size_consumer_init(struct chunk_size_consumer *self)
+{
+    self->parent.data = chunk_size_consumer__data;
+    self->parent.eof = chunk_size_consumer__eof;
+    self->parent.free = NULL;
+    cork_buffer_init(&self->buf);
+    self->max_chunk_size = 0;
+}
+
+START_TEST(test_buffer_stream_vec_opt_in)
+{
+    struct chunk_size_consumer  consumer;
+    struct cork_slice  slices[2];
+    int  fds[2];
+
+    /* A consumer that hasn't opted into data_vec might not initialize it at
+     * all, just like a consumer that was compiled against an older version of
+     * the header.  We must never call it. */
+    chunk_size_consumer_init(&consumer);
+    memset(&consumer.parent.data_vec, 0xa5, sizeof(consumer.parent.data_vec));
+    fail_if(cork_stream_consumer_has_data_vec(&consumer.parent),
+            "Consumer shouldn't opt into data_vec");
+
+    cork_slice_init_static(&slices[0], "abcd", 4);
+    cork_slice_init_static(&slices[1], "efg", 3);
+    fail_if_error(cork_stream_consumer_data_vec
+                  (&consumer.parent, slices, 2, true));
+    fail_unless_equal("Chunk size", "%zu",
+                      (size_t) 4, consumer.max_chunk_size);
+
+    fail_if(pipe(fds) == -1, "Cannot create pipe");
+    fail_unless(write(fds[1], "hij", 3) == 3, "Cannot write to pipe");
+    close(fds[1]);
+    fail_if_error(cork_consume_fd(&consumer.parent, fds[0]));
+    close(fds[0]);
+    fail_unless_equal("Buffer size", "%zu", (size_t) 10, consumer.buf.size);
+    fail_unless(memcmp(consumer.buf.buf, "abcdefghij", 10) == 0,
+                "Unexpected consumer contents");
+    cork_buffer_done(&consumer.buf);
+}
+END_TEST
+
+START_TEST(test_buffer_consume_adaptive)
+{
+    struct cork_buffer  expected = CORK_BUFFER_INIT();
+    struct chunk_size_consumer  consumer;
+    char  path[] = "/tmp/libcork-consume-XXXXXX";
+    int  fd;
+    FILE  *fp;
+    size_t  i;
+
+    for (i = 0; i < 20000; i++) {
+        cork_buffer_append_printf(&expected, "line %zu\n", i);
+    }
+    fail_if((fd = mkstemp(path)) == -1, "Cannot create temporary file");
+    fail_unless(write(fd, expected.buf, expected.size) ==
+                (ssize_t) expected.size, "Cannot write temporary file");
+
+    /* The read buffer grows from 1000 bytes up to (but not past) 8192 */
+    chunk_size_consumer_init(&consumer);
+    fail_if(lseek(fd, 0, SEEK_SET) == -1, "Cannot rewind temporary file");
+    fail_if_error(cork_consume_fd_ex(&consumer.parent, fd, 1000, 8192));
+    check_buffers(&consumer.buf, &expected);
+    fail_unless_equal("Chunk size", "%zu",
+                      (size_t) 8192, consumer.max_chunk_size);
+    cork_buffer_done(&consumer.buf);
+    close(fd);
+
+    chunk_size_consumer_init(&consumer);
+    fail_if((fp = fopen(path, "r")) == NULL, "Cannot open temporary file");
+    fail_if_error(cork_consume_file_ex(&consumer.parent, fp, 100, 100));
+    check_buffers(&consumer.buf, &expected);
+    fail_unless_equal("Chunk size", "%zu",
+                      (size_t) 100, consumer.max_chunk_size);
+    cork_buffer_done(&consumer.buf);
+    fclose(fp);
+
+    chunk_size_consumer_init(&consumer);
+    fail_if_error(cork_consume_file_from_path
+                  (&consumer.parent, path, O_RDONLY));
+    check_buffers(&consumer.buf, &expected);
+    cork_buffer_done(&consumer.buf);
+
+    unlink(path);
+    cork_buffer_done(&expected);
+}
+END_TEST
+
+START_TEST(test_buffer_consume_async)
+{
+    struct cork_buffer  expected = CORK_BUFFER_INIT();
+    struct chunk_size_consumer  consumer;
+    char  path[] = "/tmp/libcork-consume-XXXXXX";
+    int  fd;
+    int  fds[2];
+    size_t  i;
+
+    for (i = 0; i < 20000; i++) {
+        cork_buffer_append_printf(&expected, "line %zu\n", i);
+    }
+    fail_if((fd = mkstemp(path)) == -1, "Cannot create temporary file");
+    fail_unless(write(fd, expected.buf, expected.size) ==
+                (ssize_t) expected.size, "Cannot write temporary file");
+
+    /* Chunks must arrive in order, even with several reads outstanding, and
+     * the last chunk won't be full. */
+    chunk_size_consumer_init(&consumer);
+    fail_if(lseek(fd, 0, SEEK_SET) == -1, "Cannot rewind temporary file");
+    fail_if_error(cork_consume_fd_async(&consumer.parent, fd, 1000, 3));
+    check_buffers(&consumer.buf, &expected);
+    fail_unless_equal("Chunk size", "%zu",
+                      (size_t) 1000, consumer.max_chunk_size);
+    fail_unless_equal("File offset", "%ld", (long) expected.size,
+                      (long) lseek(fd, 0, SEEK_CUR));
+    cork_buffer_done(&consumer.buf);
+
+    /* Start partway through the file */
+    chunk_size_consumer_init(&consumer);
+    fail_if(lseek(fd, 10, SEEK_SET) == -1, "Cannot seek temporary file");
+    fail_if_error(cork_consume_fd_async(&consumer.parent, fd, 0, 0));
+    fail_unless_equal("Buffer size", "%zu",
+                      expected.size - 10, consumer.buf.size);
+    fail_unless(memcmp(consumer.buf.buf, expected.buf + 10,
+                       consumer.buf.size) == 0, "Unexpected contents");
+    cork_buffer_done(&consumer.buf);
+    close(fd);
+    unlink(path);
+
+    /* Pipes fall back on synchronous reads */
+    cork_buffer_clear(&expected);
+    cork_buffer_append_literal(&expected, "hello world");
+    fail_if(pipe(fds) == -1, "Cannot create pipe");
+    fail_unless(write(fds[1], expected.buf, expected.size) ==
+                (ssize_t) expected.size, "Cannot write to pipe");
+    close(fds[1]);
+    chunk_size_consumer_init(&consumer);
+    fail_if_error(cork_consume_fd_async(&consumer.parent, fds[0], 4, 2));
+    check_buffers(&consumer.buf, &expected);
+    cork_buffer_done(&consumer.buf);
+    close(fds[0]);
+
+    cork_buffer_done(&expected);
+}
+END_TEST
+
+static void
+check_file_contents(int fd, const char *expected, size_t expected_size)
+{
+    struct cork_buffer  actual = CORK_BUFFER_INIT();
+    fail_if(lseek(fd, 0, SEEK_SET) == -1, "Cannot rewind temporary file");
+    fail_if_error(cork_buffer_append_fd(&actual, fd));
+    fail_unless(actual.size == expected_size &&
+                memcmp(actual.buf, expected, expected_size) == 0,
+                "Unexpected file contents: got %zu:%s, expected %zu:%s",
+                actual.size, (char *) actual.buf, expected_size, expected);
+    cork_buffer_done(&actual);
+}
+
+START_TEST(test_buffer_buffered_fd_consumer)
+{
+    struct cork_buffer  expected = CORK_BUFFER_INIT();
+    struct cork_stream_consumer  *consumer;
+    struct cork_slice  slices[2];
+    char  path[] = "/tmp/libcork-consumer-XXXXXX";
+    int  fd;
+    int  write_fd;
+    size_t  i;
+
+    fail_if((fd = mkstemp(path)) == -1, "Cannot create temporary file");
+    fail_if((write_fd = open(path, O_WRONLY | O_APPEND)) == -1,
+            "Cannot open temporary file");
+    fail_if_error(consumer = cork_buffered_fd_consumer_new
+                  (write_fd, 16, CORK_FD_SYNC_ON_FLUSH));
+
+    /* Small chunks stay in the buffer until we flush them */
+    fail_if_error(cork_stream_consumer_data(consumer, "abc", 3, true));
+    fail_if_error(cork_stream_consumer_data(consumer, "def", 3, false));
+    check_file_contents(fd, "", 0);
+    fail_if_error(cork_buffered_fd_consumer_flush(consumer));
+    check_file_contents(fd, "abcdef", 6);
+    cork_buffer_append_literal(&expected, "abcdef");
+
+    /* A chunk that doesn't fit is written along with the buffered data */
+    fail_if_error(cork_stream_consumer_data(consumer, "ghi", 3, false));
+    fail_if_error(cork_stream_consumer_data
+                  (consumer, "0123456789abcdefghij", 20, false));
+    cork_buffer_append_literal(&expected, "ghi0123456789abcdefghij");
+    check_file_contents(fd, expected.buf, expected.size);
+
+    /* So are lots of tiny chunks */
+    for (i = 0; i < 1000; i++) {
+        char  ch = 'a' + (i % 26);
+        fail_if_error(cork_stream_consumer_data(consumer, &ch, 1, false));
+        cork_buffer_append(&expected, &ch, 1);
+    }
+    cork_slice_init_static(&slices[0], "xy", 2);
+    cork_slice_init_static(&slices[1], "z0123456789abcdefghij", 21);
+    fail_if_error(cork_stream_consumer_data_vec(consumer, slices, 2, false));
+    cork_buffer_append_literal(&expected, "xyz0123456789abcdefghij");
+    fail_if_error(cork_stream_consumer_data(consumer, "end", 3, false));
+    cork_buffer_append_literal(&expected, "end");
+
+    fail_if_error(cork_stream_consumer_eof(consumer));
+    check_file_contents(fd, expected.buf, expected.size);
+    cork_stream_consumer_free(consumer);
+
+    /* Freeing the consumer writes out anything that's still buffered */
+    fail_if_error(consumer = cork_buffered_fd_consumer_new
+                  (write_fd, 0, CORK_FD_SYNC_NONE));
+    fail_if_error(cork_stream_consumer_data(consumer, "!", 1, true));
+    cork_buffer_append_literal(&expected, "!");
+    cork_stream_consumer_free(consumer);
+    check_file_contents(fd, expected.buf, expected.size);
+
+    close(write_fd);
+    close(fd);
+    unlink(path);
+    cork_buffer_done(&expected);
+}
+END_TEST
+
+/* A consumer that fails once it has seen a few chunks */
+struct failing_consumer {
+    struct cork_stream_consumer  parent;
+    size_t  chunks_left;
+};
+
+static int
+failing_consumer__data(struct cork_stream_consumer *vself,
+                       const void *buf, size_t size, bool is_first_chunk)
+{
+    struct failing_consumer  *self =
+        cork_container_of(vself, struct failing_consumer, parent);
+    if (self->chunks_left == 0) {
+        cork_error_set_printf(CORK_UNKNOWN_ERROR, "Too many chunks");
+        return -1;
+    }
+    self->chunks_left--;
+    return 0;
+}
+
+static void
+failing_consumer__free(struct cork_stream_consumer *vself)
+{
+    struct failing_consumer  *self =
+        cork_container_of(vself, struct failing_consumer, parent);
+    cork_delete(struct failing_consumer, self);
+}
+
+static struct cork_stream_consumer *
+failing_consumer_new(size_t chunks_left)
+{
+    struct failing_consumer  *self = cork_new(struct failing_consumer);
+    self->parent.data = failing_consumer__data;
+    self->parent.eof = chunk_size_consumer__eof;
+    self->parent.free = failing_consumer__free;
+    self->chunks_left = chunks_left;
+    return &self->parent;
+}
+
+START_TEST(test_buffer_tee_consumer)
+{
+    struct cork_buffer  expected = CORK_BUFFER_INIT();
+    struct cork_buffer  buffer1 = CORK_BUFFER_INIT();
+    struct cork_buffer  buffer2 = CORK_BUFFER_INIT();
+    struct cork_chunked_buffer  buffer3 = CORK_CHUNKED_BUFFER_INIT();
+    struct cork_buffer  flat = CORK_BUFFER_INIT();
+    struct cork_stream_consumer  *tee;
+    size_t  i;
+    int  rc;
+
+    fail_if_error(tee = cork_tee_consumer_new());
+    fail_if_error(cork_tee_consumer_add
+                  (tee, cork_buffer_to_stream_consumer(&buffer1), false));
+    fail_if_error(cork_tee_consumer_add
+                  (tee, cork_buffer_to_stream_consumer(&buffer2), true));
+    fail_if_error(cork_tee_consumer_add
+                  (tee, cork_chunked_buffer_to_stream_consumer(&buffer3),
+                   true));
+    for (i = 0; i < 1000; i++) {
+        struct cork_buffer  chunk = CORK_BUFFER_INIT();
+        cork_buffer_append_printf(&chunk, "chunk %zu\n", i);
+        fail_if_error(cork_stream_consumer_data
+                      (tee, chunk.buf, chunk.size, i == 0));
+        cork_buffer_append_copy(&expected, &chunk);
+        cork_buffer_done(&chunk);
+    }
+    fail_if_error(cork_stream_consumer_eof(tee));
+    cork_stream_consumer_free(tee);
+
+    check_buffers(&buffer1, &expected);
+    check_buffers(&buffer2, &expected);
+    cork_chunked_buffer_to_buffer(&buffer3, &flat);
+    check_buffers(&flat, &expected);
+
+    /* An error in a threaded branch is passed back to the producer */
+    fail_if_error(tee = cork_tee_consumer_new());
+    fail_if_error(cork_tee_consumer_add(tee, failing_consumer_new(3), true));
+    rc = 0;
+    for (i = 0; i < 1000 && rc == 0; i++) {
+        rc = cork_stream_consumer_data(tee, "abc", 3, i == 0);
+    }
+    if (rc == 0) {
+        rc = cork_stream_consumer_eof(tee);
+    }
+    fail_unless(rc == -1, "Tee consumer should fail");
+    fail_unless_streq("Error", "Error from thread tee-branch: Too many chunks",
+                      cork_error_message());
+    cork_error_clear();
+    cork_stream_consumer_free(tee);
+
+    /* Freeing a tee before the end of the stream stops its threads */
+    fail_if_error(tee = cork_tee_consumer_new());
+    cork_buffer_clear(&buffer2);
+    fail_if_error(cork_tee_consumer_add
+                  (tee, cork_buffer_to_stream_consumer(&buffer2), true));
+    fail_if_error(cork_stream_consumer_data(tee, "abc", 3, true));
+    cork_stream_consumer_free(tee);
+
+    cork_buffer_done(&expected);
+    cork_buffer_done(&buffer1);
+    cork_buffer_done(&buffer2);
+    cork_chunked_buffer_done(&buffer3);
+    cork_buffer_done(&flat);
+}
+END_TEST
+
+START_TEST(test_buffer_hash_consumer)
+{
+    struct cork_buffer  src = CORK_BUFFER_INIT();
+    cork_big_hash  seed = {cork_u128_from_64(1, 2)};
+    cork_big_hash  expected;
+    cork_big_hash  actual = CORK_BIG_HASH_INIT();
+    struct cork_stream_consumer  *consumer;
+    struct cork_slice  slices[2];
+    size_t  i;
+
+    for (i = 0; i < 1000; i++) {
+        cork_buffer_append_printf(&src, "line %zu\n", i);
+    }
+    expected = cork_big_hash_buffer(seed, src.buf, src.size);
+
+    /* Deliver the data in differently sized chunks, some of them in a
+     * single vectored call. */
+    consumer = cork_big_hash_consumer_new(seed, &actual);
+    fail_if_error(cork_stream_consumer_data(consumer, src.buf, 5, true));
+    cork_slice_init_static(&slices[0], (char *) src.buf + 5, 100);
+    cork_slice_init_static(&slices[1], (char *) src.buf + 105, 3);
+    fail_if_error(cork_stream_consumer_data_vec(consumer, slices, 2, false));
+    cork_slice_finish(&slices[0]);
+    cork_slice_finish(&slices[1]);
+    fail_if_error(cork_stream_consumer_data
+                  (consumer, (char *) src.buf + 108, src.size - 108, false));
+    fail_if_error(cork_stream_consumer_eof(consumer));
+    cork_stream_consumer_free(consumer);
+    fail_unless(cork_big_hash_equal(expected, actual), "Hashes don't match");
+
+    cork_buffer_done(&src);
+}
+END_TEST
+
+typedef struct cork_stream_consumer *
+(*compress_consumer_new_f)(struct cork_stream_consumer *next, int level);
+
+typedef struct cork_stream_consumer *
+(*decompress_consumer_new_f)(struct cork_stream_consumer *next);
+
+/* Feed src into consumer in chunks of varying sizes. */
+static int
+feed_consumer(struct cork_stream_consumer *consumer,
+              const struct cork_buffer *src, size_t size)
+{
+    static const size_t  chunk_sizes[] = { 1, 7, 4096, 100000, 333 };
+    const char  *buf = src->buf;
+    size_t  offset = 0;
+    size_t  i = 0;
+    while (offset < size) {
+        size_t  chunk_size = chunk_sizes[i++ % 5];
+        if (chunk_size > size - offset) {
+            chunk_size = size - offset;
+        }
+        if (cork_stream_consumer_data
+                (consumer, buf + offset, chunk_size, offset == 0) != 0) {
+            return -1;
+        }
+        offset += chunk_size;
+    }
+    return cork_stream_consumer_eof(consumer);
+}
+
+static void
+test_codec(compress_consumer_new_f compress_new,
+           decompress_consumer_new_f decompress_new, bool supported)
+{
+    struct cork_buffer  plain = CORK_BUFFER_INIT();
+    struct cork_buffer  compressed = CORK_BUFFER_INIT();
+    struct cork_buffer  result = CORK_BUFFER_INIT();
+    struct cork_stream_consumer  *consumer;
+    size_t  i;
+
+    if (!supported) {
+        consumer = compress_new
+            (cork_buffer_to_stream_consumer(&compressed), 0);
+        fail_unless(consumer == NULL,
+                    "Shouldn't be able to create compressor");
+        fail_unless_equal("Error code", "0x%08" PRIx32,
+                          CORK_COMPRESSION_UNSUPPORTED, cork_error_code());
+        cork_error_clear();
+        fail_unless_error(decompress_new
+                          (cork_buffer_to_stream_consumer(&result)),
+                          "Shouldn't be able to create decompressor");
+        return;
+    }
+
+    for (i = 0; i < 50000; i++) {
+        cork_buffer_append_printf(&plain, "line %zu\n", i);
+    }
+
+    fail_if_error(consumer = compress_new
+                  (cork_buffer_to_stream_consumer(&compressed), 0));
+    fail_if_error(feed_consumer(consumer, &plain, plain.size));
+    cork_stream_consumer_free(consumer);
+    fail_unless(compressed.size < plain.size, "Data should be compressed");
+
+    fail_if_error(consumer = decompress_new
+                  (cork_buffer_to_stream_consumer(&result)));
+    fail_if_error(feed_consumer(consumer, &compressed, compressed.size));
+    cork_stream_consumer_free(consumer);
+    check_buffers(&result, &plain);
+
+    /* A stream that ends in the middle of a frame */
+    cork_buffer_clear(&result);
+    fail_if_error(consumer = decompress_new
+                  (cork_buffer_to_stream_consumer(&result)));
+    fail_unless(feed_consumer(consumer, &compressed, compressed.size / 2)
+                == -1, "Truncated stream should fail");
+    fail_unless_equal("Error code", "0x%08" PRIx32,
+                      CORK_COMPRESSION_TRUNCATED, cork_error_code());
+    cork_error_clear();
+    cork_stream_consumer_free(consumer);
+
+    /* Data that isn't compressed at all */
+    fail_if_error(consumer = decompress_new
+                  (cork_buffer_to_stream_consumer(&result)));
+    fail_unless(feed_consumer(consumer, &plain, plain.size) == -1,
+                "Uncompressed data should fail");
+    fail_unless_equal("Error code", "0x%08" PRIx32,
+                      CORK_COMPRESSION_FAILED, cork_error_code());
+    cork_error_clear();
+    cork_stream_consumer_free(consumer);
+
+    /* An empty stream still round-trips */
+    cork_buffer_clear(&compressed);
+    cork_buffer_clear(&result);
+    fail_if_error(consumer = compress_new
+                  (cork_buffer_to_stream_consumer(&compressed), 1));
+    fail_if_error(cork_stream_consumer_eof(consumer));
+    cork_stream_consumer_free(consumer);
+    fail_if(compressed.size == 0, "Empty stream should still have a frame");
+    fail_if_error(consumer = decompress_new
+                  (cork_buffer_to_stream_consumer(&result)));
+    fail_if_error(feed_consumer(consumer, &compressed, compressed.size));
+    cork_stream_consumer_free(consumer);
+    fail_unless_equal("Result size", "%zu", (size_t) 0, result.size);
+
+    cork_buffer_done(&plain);
+    cork_buffer_done(&compressed);
+    cork_buffer_done(&result);
+}
+
+START_TEST(test_buffer_zstd_consumer)
+{
+#if CORK_HAVE_ZSTD
+    test_codec(cork_zstd_compress_consumer_new,
+               cork_zstd_decompress_consumer_new, true);
+#else
+    test_codec(cork_zstd_compress_consumer_new,
+               cork_zstd_decompress_consumer_new, false);
+#endif
+}
+END_TEST
+
+START_TEST(test_buffer_lz4_consumer)
+{
+#if CORK_HAVE_LZ4
+    test_codec(cork_lz4_compress_consumer_new,
+               cork_lz4_decompress_consumer_new, true);
+#else
+    test_codec(cork_lz4_compress_consumer_new,
+               cork_lz4_decompress_consumer_new, false);
+#endif
+}
+END_TEST
+
 START_TEST(test_buffer_c_string)
 {
     check_c_string("");
@@ -249,6 +870,112 @@ START_TEST(test_buffer_c_string)
 END_TEST
 
 
+/* A byte-at-a-time reference version of cork_buffer_append_c_string */
+static void
+reference_c_string(struct cork_buffer *dest, const char *chars, size_t length)
+{
+    size_t  i;
+    cork_buffer_append_literal(dest, "\"");
+    for (i = 0; i < length; i++) {
+        uint8_t  ch = chars[i];
+        switch (ch) {
+            case '"':  cork_buffer_append_literal(dest, "\\\""); break;
+            case '\\': cork_buffer_append_literal(dest, "\\\\"); break;
+            case '\f': cork_buffer_append_literal(dest, "\\f"); break;
+            case '\n': cork_buffer_append_literal(dest, "\\n"); break;
+            case '\r': cork_buffer_append_literal(dest, "\\r"); break;
+            case '\t': cork_buffer_append_literal(dest, "\\t"); break;
+            case '\v': cork_buffer_append_literal(dest, "\\v"); break;
+            default:
+                if (ch >= 0x20 && ch <= 0x7e) {
+                    cork_buffer_append(dest, &chars[i], 1);
+                } else {
+                    cork_buffer_append_printf(dest, "\\x%02x", ch);
+                }
+                break;
+        }
+    }
+    cork_buffer_append_literal(dest, "\"");
+}
+
+START_TEST(test_buffer_c_string_long)
+{
+    struct cork_buffer  actual = CORK_BUFFER_INIT();
+    struct cork_buffer  expected = CORK_BUFFER_INIT();
+    char  src[300];
+    size_t  i;
+    size_t  offset;
+
+    /* Every byte value, plus long clean runs with escapes at every possible
+     * position within a 16-byte block. */
+    for (i = 0; i < sizeof(src); i++) {
+        src[i] = (i < 256)? (char) i: 'a' + (i % 26);
+    }
+    for (offset = 0; offset < 40; offset++) {
+        cork_buffer_append_c_string(&actual, src + offset,
+                                    sizeof(src) - offset);
+        reference_c_string(&expected, src + offset, sizeof(src) - offset);
+        fail_unless_streq("C strings", expected.buf, actual.buf);
+        cork_buffer_clear(&actual);
+        cork_buffer_clear(&expected);
+    }
+
+    memset(src, 'x', sizeof(src));
+    for (offset = 0; offset < 40; offset++) {
+        src[offset + 100] = '"';
+        cork_buffer_append_c_string(&actual, src, sizeof(src));
+        reference_c_string(&expected, src, sizeof(src));
+        fail_unless_streq("C strings", expected.buf, actual.buf);
+        cork_buffer_clear(&actual);
+        cork_buffer_clear(&expected);
+        src[offset + 100] = 'x';
+    }
+
+    cork_buffer_done(&actual);
+    cork_buffer_done(&expected);
+}
+END_TEST
+
+START_TEST(test_buffer_hex_dump_long)
+{
+    struct cork_buffer  actual = CORK_BUFFER_INIT();
+    struct cork_buffer  expected = CORK_BUFFER_INIT();
+    char  src[256];
+    size_t  i;
+
+    for (i = 0; i < sizeof(src); i++) {
+        src[i] = (char) (255 - i);
+    }
+    cork_buffer_append_hex_dump(&actual, 1, src, 40);
+
+    /* Build up the expected output a line at a time */
+    for (i = 0; i < 40; i += 16) {
+        size_t  j;
+        size_t  count = (40 - i < 16)? 40 - i: 16;
+        size_t  hex_start;
+        if (i != 0) {
+            cork_buffer_append_literal(&expected, "\n ");
+        }
+        hex_start = expected.size;
+        for (j = 0; j < count; j++) {
+            cork_buffer_append_printf(&expected, "%02x ", (uint8_t) src[i+j]);
+        }
+        cork_buffer_append_indent(&expected, 48 - (expected.size - hex_start));
+        cork_buffer_append_literal(&expected, " |");
+        for (j = 0; j < count; j++) {
+            uint8_t  ch = src[i+j];
+            cork_buffer_append_printf
+                (&expected, "%c", (ch >= 0x20 && ch <= 0x7e)? ch: '.');
+        }
+        cork_buffer_append_literal(&expected, "|");
+    }
+    fail_unless_streq("Hex dumps", expected.buf, actual.buf);
+
+    cork_buffer_done(&actual);
+    cork_buffer_done(&expected);
+}
+END_TEST
+
 static void
 check_pretty_print_(size_t indent, const char *content, size_t length,
                     const char *expected)
@@ -310,6 +1037,202 @@ START_TEST(test_buffer_pretty_print)
 END_TEST
 
 
+START_TEST(test_buffer_steal)
+{
+    struct cork_buffer  buffer1 = CORK_BUFFER_INIT();
+    struct cork_buffer  buffer2 = CORK_BUFFER_INIT();
+    void  *buf;
+    size_t  size;
+    size_t  allocated_size;
+
+    cork_buffer_set_string(&buffer1, "abcdefgh");
+    buf = cork_buffer_steal(&buffer1, &size, &allocated_size);
+    fail_unless_equal("Stolen size", "%zu", (size_t) 8, size);
+    fail_unless_equal("Buffer size", "%zu", (size_t) 0, buffer1.size);
+    fail_unless(buffer1.buf == NULL, "Buffer should be empty");
+
+    cork_buffer_set_string(&buffer2, "old contents");
+    cork_buffer_adopt(&buffer2, buf, size, allocated_size);
+    fail_unless(buffer2.buf == buf, "Buffer should reuse adopted memory");
+    check_buffer(&buffer2, "abcdefgh");
+
+    cork_buffer_done(&buffer1);
+    cork_buffer_done(&buffer2);
+}
+END_TEST
+
+START_TEST(test_buffer_zero_copy)
+{
+    struct cork_buffer  *src;
+    struct cork_buffer  dest = CORK_BUFFER_INIT();
+    struct cork_managed_buffer  *managed;
+    struct cork_slice  slice1;
+    struct cork_slice  slice2;
+    const void  *buf;
+
+    /* Managed buffer -> buffer, with a single reference */
+    src = cork_buffer_new();
+    cork_buffer_set_string(src, "abcdefgh");
+    buf = src->buf;
+    managed = cork_buffer_to_managed_buffer(src);
+    fail_if(cork_managed_buffer_is_shared(managed),
+            "Managed buffer shouldn't be shared");
+    fail_unless(cork_buffer_from_managed_buffer(&dest, managed),
+                "Shouldn't have to copy managed buffer");
+    fail_unless(dest.buf == buf, "Should reuse managed buffer's memory");
+    check_buffer(&dest, "abcdefgh");
+
+    /* Slice -> buffer, with a single reference */
+    src = cork_buffer_new();
+    cork_buffer_set_string(src, "0123456789");
+    buf = src->buf;
+    fail_if_error(cork_buffer_to_slice(src, &slice1));
+    fail_if_error(cork_slice_slice(&slice1, 2, 5));
+    fail_unless(cork_buffer_from_slice(&dest, &slice1),
+                "Shouldn't have to copy slice");
+    fail_unless(dest.buf == buf, "Should reuse slice's memory");
+    fail_unless(cork_slice_is_empty(&slice1), "Slice should be cleared");
+    check_buffer(&dest, "23456");
+    fail_unless(strcmp(dest.buf, "23456") == 0, "Unexpected buffer contents");
+
+    /* Slice -> buffer, when the data is shared */
+    src = cork_buffer_new();
+    cork_buffer_set_string(src, "0123456789");
+    fail_if_error(cork_buffer_to_slice(src, &slice1));
+    fail_if_error(cork_slice_copy(&slice2, &slice1, 0, 4));
+    fail_if(cork_buffer_from_slice(&dest, &slice1),
+            "Should have to copy shared slice");
+    check_buffer(&dest, "0123456789");
+    fail_unless(cork_buffer_from_slice(&dest, &slice2),
+                "Shouldn't have to copy slice");
+    check_buffer(&dest, "0123");
+
+    /* Slices that aren't backed by a managed buffer are always copied */
+    cork_slice_init_static(&slice1, "static", 6);
+    fail_if(cork_buffer_from_slice(&dest, &slice1),
+            "Should have to copy static slice");
+    check_buffer(&dest, "static");
+
+    cork_buffer_done(&dest);
+}
+END_TEST
+
+
+static void
+check_formatted(struct cork_buffer *buf, const char *expected)
+{
+    fail_unless(strcmp(buf->buf, expected) == 0 &&
+                buf->size == strlen(expected),
+                "Unexpected formatted value: got %zu:%s, expected %s",
+                buf->size, (char *) buf->buf, expected);
+    cork_buffer_clear(buf);
+}
+
+START_TEST(test_buffer_append_integers)
+{
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+
+    cork_buffer_append_u64(&buf, 0);
+    check_formatted(&buf, "0");
+    cork_buffer_append_u64(&buf, 9);
+    check_formatted(&buf, "9");
+    cork_buffer_append_u64(&buf, 10);
+    check_formatted(&buf, "10");
+    cork_buffer_append_u64(&buf, 1234567890);
+    check_formatted(&buf, "1234567890");
+    cork_buffer_append_u64(&buf, UINT64_MAX);
+    check_formatted(&buf, "18446744073709551615");
+    cork_buffer_append_u64_width(&buf, 42, 5);
+    check_formatted(&buf, "00042");
+    cork_buffer_append_u64_width(&buf, 123456, 3);
+    check_formatted(&buf, "123456");
+
+    cork_buffer_append_i64(&buf, -1);
+    check_formatted(&buf, "-1");
+    cork_buffer_append_i64(&buf, 100);
+    check_formatted(&buf, "100");
+    cork_buffer_append_i64(&buf, INT64_MIN);
+    check_formatted(&buf, "-9223372036854775808");
+    cork_buffer_append_i64(&buf, INT64_MAX);
+    check_formatted(&buf, "9223372036854775807");
+
+    cork_buffer_append_hex(&buf, 0, 0);
+    check_formatted(&buf, "0");
+    cork_buffer_append_hex(&buf, 0xdeadbeef, 0);
+    check_formatted(&buf, "deadbeef");
+    cork_buffer_append_hex(&buf, 0x1f, 4);
+    check_formatted(&buf, "001f");
+    cork_buffer_append_hex(&buf, UINT64_MAX, 0);
+    check_formatted(&buf, "ffffffffffffffff");
+
+    /* Appending keeps the existing contents */
+    cork_buffer_append_literal(&buf, "x=");
+    cork_buffer_append_u64(&buf, 17);
+    cork_buffer_append_literal(&buf, ",y=");
+    cork_buffer_append_i64(&buf, -17);
+    check_formatted(&buf, "x=17,y=-17");
+
+    cork_buffer_done(&buf);
+}
+END_TEST
+
+START_TEST(test_buffer_append_double)
+{
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    size_t  i;
+    uint64_t  bits = UINT64_C(0x123456789abcdef);
+
+#define check_double(value, expected) \
+    do { \
+        cork_buffer_append_double(&buf, (value)); \
+        check_formatted(&buf, (expected)); \
+    } while (0)
+
+    check_double(0.0, "0");
+    check_double(-0.0, "-0");
+    check_double(1.0, "1");
+    check_double(-2.5, "-2.5");
+    check_double(0.1, "0.1");
+    check_double(1.0 / 3.0, "0.3333333333333333");
+    check_double(123456789012.0, "123456789012");
+    check_double(1e21, "1e+21");
+    check_double(1.5e300, "1.5e+300");
+    check_double(0.000001, "0.000001");
+    check_double(1.25e-7, "1.25e-7");
+    check_double(5e-324, "5e-324");
+    check_double(1.7976931348623157e308, "1.7976931348623157e+308");
+    check_double(1.0 / 0.0, "inf");
+    check_double(-1.0 / 0.0, "-inf");
+    check_double(0.0 / 0.0, "nan");
+
+#undef check_double
+
+    /* Every result should read back in as exactly the same value. */
+    for (i = 0; i < 10000; i++) {
+        union { uint64_t  u64; double  d; }  value;
+        double  parsed;
+        /* A simple xorshift generator gives us a spread of bit patterns */
+        bits ^= bits << 13;
+        bits ^= bits >> 7;
+        bits ^= bits << 17;
+        value.u64 = bits;
+        if (value.d != value.d || value.d - value.d != 0.0) {
+            /* Skip NaNs and infinities */
+            continue;
+        }
+        cork_buffer_append_double(&buf, value.d);
+        parsed = strtod(buf.buf, NULL);
+        fail_unless(parsed == value.d,
+                    "%s doesn't round-trip (got %.17g)",
+                    (char *) buf.buf, parsed);
+        cork_buffer_clear(&buf);
+    }
+
+    cork_buffer_done(&buf);
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -322,10 +1245,26 @@ test_suite()
     TCase  *tc_buffer = tcase_create("buffer");
     tcase_add_test(tc_buffer, test_buffer);
     tcase_add_test(tc_buffer, test_buffer_append);
+    tcase_add_test(tc_buffer, test_buffer_reserve);
     tcase_add_test(tc_buffer, test_buffer_slicing);
     tcase_add_test(tc_buffer, test_buffer_stream);
+    tcase_add_test(tc_buffer, test_buffer_stream_vec);
+    tcase_add_test(tc_buffer, test_buffer_stream_vec_opt_in);
+    tcase_add_test(tc_buffer, test_buffer_consume_adaptive);
+    tcase_add_test(tc_buffer, test_buffer_consume_async);
+    tcase_add_test(tc_buffer, test_buffer_buffered_fd_consumer);
+    tcase_add_test(tc_buffer, test_buffer_tee_consumer);
+    tcase_add_test(tc_buffer, test_buffer_hash_consumer);
+    tcase_add_test(tc_buffer, test_buffer_zstd_consumer);
+    tcase_add_test(tc_buffer, test_buffer_lz4_consumer);
     tcase_add_test(tc_buffer, test_buffer_c_string);
+    tcase_add_test(tc_buffer, test_buffer_c_string_long);
+    tcase_add_test(tc_buffer, test_buffer_hex_dump_long);
     tcase_add_test(tc_buffer, test_buffer_pretty_print);
+    tcase_add_test(tc_buffer, test_buffer_steal);
+    tcase_add_test(tc_buffer, test_buffer_zero_copy);
+    tcase_add_test(tc_buffer, test_buffer_append_integers);
+    tcase_add_test(tc_buffer, test_buffer_append_double);
     suite_add_tcase(s, tc_buffer);
 
     return s;
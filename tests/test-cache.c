@@ -0,0 +1,435 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/hash.h"
+#include "libcork/core/timestamp.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/cache.h"
+#include "libcork/threads/basics.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Helpers
+ */
+
+/* Keys and values are both heap-allocated uint64_t's.  The user data keeps
+ * track of the fake clock and of which entries have been handed back to
+ * us. */
+
+struct cache_state {
+    cork_timestamp  now;
+    size_t  evicted;
+    size_t  expired;
+    size_t  replaced;
+    size_t  deleted;
+};
+
+static uint64_t *
+uint64__new(uint64_t v)
+{
+    uint64_t  *result = cork_new(uint64_t);
+    *result = v;
+    return result;
+}
+
+static cork_hash
+uint64__hash(void *user_data, const void *vkey)
+{
+    const uint64_t  *key = vkey;
+    return cork_fast_hash_u64(0, *key);
+}
+
+static bool
+uint64__equals(void *user_data, const void *va, const void *vb)
+{
+    const uint64_t  *a = va;
+    const uint64_t  *b = vb;
+    return *a == *b;
+}
+
+static void
+cache_state__evict(void *user_data, void *key, void *value,
+                   enum cork_cache_evict_reason reason)
+{
+    struct cache_state  *state = user_data;
+    switch (reason) {
+        case CORK_CACHE_EVICTED: state->evicted++; break;
+        case CORK_CACHE_EXPIRED: state->expired++; break;
+        case CORK_CACHE_REPLACED: state->replaced++; break;
+        case CORK_CACHE_DELETED: state->deleted++; break;
+    }
+    cork_delete(uint64_t, key);
+    cork_delete(uint64_t, value);
+}
+
+static void
+cache_state__clock(void *user_data, cork_timestamp *now)
+{
+    struct cache_state  *state = user_data;
+    *now = state->now;
+}
+
+static struct cork_cache *
+test_cache_new(size_t capacity, struct cache_state *state)
+{
+    struct cork_cache  *cache = cork_cache_new(capacity);
+    memset(state, 0, sizeof(struct cache_state));
+    cork_timestamp_init_sec(&state->now, 1000);
+    cork_cache_set_user_data(cache, state, NULL);
+    cork_cache_set_hash(cache, uint64__hash);
+    cork_cache_set_equals(cache, uint64__equals);
+    cork_cache_set_evict(cache, cache_state__evict);
+    cork_cache_set_clock(cache, cache_state__clock);
+    return cache;
+}
+
+static void
+test_cache_put(struct cork_cache *cache, uint64_t key, uint64_t value,
+               cork_timestamp ttl)
+{
+    cork_cache_put(cache, uint64__new(key), uint64__new(value), ttl);
+}
+
+static void
+test_cache_get(struct cork_cache *cache, uint64_t key, uint64_t expected)
+{
+    uint64_t  *value = cork_cache_get(cache, &key);
+    fail_if(value == NULL, "Couldn't find %" PRIu64 " in cache", key);
+    fail_unless_equal("Cached value", "%" PRIu64, expected, *value);
+}
+
+static void
+test_cache_missing(struct cork_cache *cache, uint64_t key)
+{
+    fail_unless(cork_cache_get(cache, &key) == NULL,
+                "Shouldn't find %" PRIu64 " in cache", key);
+}
+
+
+/*-----------------------------------------------------------------------
+ * Bounded caches
+ */
+
+START_TEST(test_cache_basics)
+{
+    struct cork_cache  *cache;
+    struct cache_state  state;
+    struct cork_cache_stats  stats;
+    uint64_t  key;
+
+    DESCRIBE_TEST;
+    cache = test_cache_new(4, &state);
+    fail_unless_equal("Capacity", "%zu", (size_t) 4,
+                      cork_cache_capacity(cache));
+    test_cache_missing(cache, 1);
+
+    test_cache_put(cache, 1, 10, 0);
+    test_cache_put(cache, 2, 20, 0);
+    test_cache_get(cache, 1, 10);
+    test_cache_get(cache, 2, 20);
+    fail_unless_equal("Size", "%zu", (size_t) 2, cork_cache_size(cache));
+
+    test_cache_put(cache, 1, 11, 0);
+    test_cache_get(cache, 1, 11);
+    fail_unless_equal("Replaced", "%zu", (size_t) 1, state.replaced);
+    fail_unless_equal("Size", "%zu", (size_t) 2, cork_cache_size(cache));
+
+    key = 2;
+    fail_unless(cork_cache_delete(cache, &key), "Couldn't delete 2");
+    fail_if(cork_cache_delete(cache, &key), "Shouldn't delete 2 twice");
+    fail_unless_equal("Deleted", "%zu", (size_t) 1, state.deleted);
+    test_cache_missing(cache, 2);
+
+    cork_cache_get_stats(cache, &stats);
+    fail_unless_equal("Hits", "%" PRIu64, (uint64_t) 3, stats.hits);
+    fail_unless_equal("Misses", "%" PRIu64, (uint64_t) 2, stats.misses);
+    fail_unless_equal("Evictions", "%" PRIu64, (uint64_t) 0, stats.evictions);
+    cork_cache_reset_stats(cache);
+    cork_cache_get_stats(cache, &stats);
+    fail_unless_equal("Hits", "%" PRIu64, (uint64_t) 0, stats.hits);
+
+    test_cache_put(cache, 3, 30, 0);
+    cork_cache_clear(cache);
+    fail_unless_equal("Size", "%zu", (size_t) 0, cork_cache_size(cache));
+    fail_unless_equal("Deleted", "%zu", (size_t) 3, state.deleted);
+    test_cache_missing(cache, 1);
+
+    /* Freeing the cache hands back the remaining entries. */
+    test_cache_put(cache, 4, 40, 0);
+    cork_cache_free(cache);
+    fail_unless_equal("Deleted", "%zu", (size_t) 4, state.deleted);
+}
+END_TEST
+
+START_TEST(test_cache_eviction)
+{
+    struct cork_cache  *cache;
+    struct cache_state  state;
+    struct cork_cache_stats  stats;
+    uint64_t  i;
+
+    DESCRIBE_TEST;
+    cache = test_cache_new(4, &state);
+    for (i = 0; i < 4; i++) {
+        test_cache_put(cache, i, i, 0);
+    }
+
+    /* Keys 0 and 2 have been used since they were added, so the clock hand
+     * should skip over them and evict 1 and then 3. */
+    test_cache_get(cache, 0, 0);
+    test_cache_get(cache, 2, 2);
+    test_cache_put(cache, 4, 4, 0);
+    fail_unless_equal("Evicted", "%zu", (size_t) 1, state.evicted);
+    test_cache_missing(cache, 1);
+    test_cache_put(cache, 5, 5, 0);
+    test_cache_missing(cache, 3);
+    test_cache_get(cache, 0, 0);
+    test_cache_get(cache, 2, 2);
+    test_cache_get(cache, 4, 4);
+    test_cache_get(cache, 5, 5);
+    fail_unless_equal("Size", "%zu", (size_t) 4, cork_cache_size(cache));
+
+    /* Churn through lots of keys without ever growing past the capacity. */
+    for (i = 100; i < 1100; i++) {
+        test_cache_put(cache, i, i, 0);
+        fail_unless(cork_cache_size(cache) <= 4, "Cache grew too large");
+    }
+    test_cache_get(cache, 1099, 1099);
+    cork_cache_get_stats(cache, &stats);
+    fail_unless_equal("Evictions", "%" PRIu64, (uint64_t) 1002,
+                      stats.evictions);
+    fail_unless_equal("Evicted", "%zu", (size_t) 1002, state.evicted);
+    cork_cache_free(cache);
+}
+END_TEST
+
+START_TEST(test_cache_ttl)
+{
+    struct cork_cache  *cache;
+    struct cache_state  state;
+    struct cork_cache_stats  stats;
+    cork_timestamp  ttl;
+
+    DESCRIBE_TEST;
+    cache = test_cache_new(4, &state);
+    cork_timestamp_init_sec(&ttl, 10);
+    test_cache_put(cache, 1, 10, ttl);
+    test_cache_put(cache, 2, 20, 0);
+    test_cache_put(cache, 3, 30, ttl);
+    test_cache_put(cache, 4, 40, ttl);
+
+    state.now += ttl / 2;
+    test_cache_get(cache, 1, 10);
+    /* Replacing an entry restarts its time-to-live. */
+    test_cache_put(cache, 3, 31, ttl);
+
+    state.now += ttl / 2;
+    test_cache_missing(cache, 1);
+    test_cache_get(cache, 2, 20);
+    test_cache_get(cache, 3, 31);
+    fail_unless_equal("Expired", "%zu", (size_t) 1, state.expired);
+
+    fail_unless_equal("Removed", "%zu", (size_t) 1,
+                      cork_cache_remove_expired(cache));
+    fail_unless_equal("Size", "%zu", (size_t) 2, cork_cache_size(cache));
+    fail_unless_equal("Expired", "%zu", (size_t) 2, state.expired);
+
+    /* The clock hand evicts expired entries before unreferenced ones. */
+    test_cache_put(cache, 5, 50, 0);
+    test_cache_put(cache, 6, 60, 0);
+    test_cache_get(cache, 5, 50);
+    test_cache_get(cache, 6, 60);
+    state.now += ttl;
+    test_cache_put(cache, 7, 70, 0);
+    test_cache_missing(cache, 3);
+    test_cache_get(cache, 2, 20);
+    fail_unless_equal("Evicted", "%zu", (size_t) 0, state.evicted);
+
+    cork_cache_get_stats(cache, &stats);
+    fail_unless_equal("Expirations", "%" PRIu64, (uint64_t) 3,
+                      stats.expirations);
+    cork_cache_free(cache);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Sharded caches
+ */
+
+#define SHARDED_THREAD_COUNT  4
+#define SHARDED_KEY_COUNT  2000
+#define SHARDED_ROUNDS  10
+
+static void
+uint64__evict(void *user_data, void *key, void *value,
+              enum cork_cache_evict_reason reason)
+{
+    cork_delete(uint64_t, key);
+    cork_delete(uint64_t, value);
+}
+
+static struct cork_sharded_cache *
+test_sharded_cache_new(size_t shard_count, size_t capacity)
+{
+    struct cork_sharded_cache  *cache =
+        cork_sharded_cache_new(shard_count, capacity);
+    cork_sharded_cache_set_hash(cache, uint64__hash);
+    cork_sharded_cache_set_equals(cache, uint64__equals);
+    cork_sharded_cache_set_evict(cache, uint64__evict);
+    return cache;
+}
+
+START_TEST(test_sharded_cache)
+{
+    struct cork_sharded_cache  *cache;
+    struct cork_cache_stats  stats;
+    uint64_t  *value;
+    uint64_t  i;
+
+    DESCRIBE_TEST;
+    cache = test_sharded_cache_new(3, 400);
+    fail_unless_equal("Capacity", "%zu", (size_t) 400,
+                      cork_sharded_cache_capacity(cache));
+    for (i = 0; i < 50; i++) {
+        cork_sharded_cache_put(cache, uint64__new(i), uint64__new(i * 2), 0);
+    }
+    for (i = 0; i < 50; i++) {
+        value = cork_sharded_cache_get(cache, &i);
+        fail_if(value == NULL, "Couldn't find %" PRIu64 " in cache", i);
+        fail_unless_equal("Cached value", "%" PRIu64, i * 2, *value);
+    }
+    i = 0;
+    fail_unless(cork_sharded_cache_delete(cache, &i), "Couldn't delete 0");
+    fail_unless(cork_sharded_cache_get(cache, &i) == NULL,
+                "Shouldn't find 0 in cache");
+    fail_unless_equal("Size", "%zu", (size_t) 49,
+                      cork_sharded_cache_size(cache));
+
+    for (i = 1000; i < 2000; i++) {
+        cork_sharded_cache_put(cache, uint64__new(i), uint64__new(i), 0);
+    }
+    fail_unless(cork_sharded_cache_size(cache) <= 400, "Cache grew too large");
+    cork_sharded_cache_get_stats(cache, &stats);
+    fail_unless_equal("Hits", "%" PRIu64, (uint64_t) 50, stats.hits);
+    fail_unless_equal("Misses", "%" PRIu64, (uint64_t) 1, stats.misses);
+    fail_unless_equal("Evictions", "%" PRIu64,
+                      (uint64_t) (1049 - cork_sharded_cache_size(cache)),
+                      stats.evictions);
+
+    cork_sharded_cache_clear(cache);
+    fail_unless_equal("Size", "%zu", (size_t) 0,
+                      cork_sharded_cache_size(cache));
+    cork_sharded_cache_free(cache);
+}
+END_TEST
+
+struct sharded_worker {
+    struct cork_sharded_cache  *cache;
+    uint64_t  seed;
+};
+
+static int
+sharded_worker__run(void *vself)
+{
+    struct sharded_worker  *self = vself;
+    uint64_t  round;
+    uint64_t  i;
+    for (round = 0; round < SHARDED_ROUNDS; round++) {
+        for (i = 0; i < SHARDED_KEY_COUNT; i++) {
+            uint64_t  key = cork_fast_hash_u64(self->seed + round, i) % 4096;
+            if (cork_sharded_cache_get(self->cache, &key) == NULL) {
+                cork_sharded_cache_put
+                    (self->cache, uint64__new(key), uint64__new(key), 0);
+            }
+        }
+    }
+    return 0;
+}
+
+START_TEST(test_sharded_cache_threads)
+{
+    struct cork_sharded_cache  *cache;
+    struct sharded_worker  workers[SHARDED_THREAD_COUNT];
+    struct cork_thread  *threads[SHARDED_THREAD_COUNT];
+    struct cork_cache_stats  stats;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    cache = test_sharded_cache_new(0, 1024);
+    for (i = 0; i < SHARDED_THREAD_COUNT; i++) {
+        workers[i].cache = cache;
+        workers[i].seed = i * SHARDED_ROUNDS;
+        fail_if_error(threads[i] = cork_thread_new
+                      ("worker", &workers[i], NULL, sharded_worker__run));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    for (i = 0; i < SHARDED_THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+
+    fail_unless(cork_sharded_cache_size(cache) <= 1024, "Cache grew too large");
+    cork_sharded_cache_get_stats(cache, &stats);
+    fail_unless_equal("Lookups", "%" PRIu64,
+                      (uint64_t) SHARDED_THREAD_COUNT * SHARDED_ROUNDS *
+                      SHARDED_KEY_COUNT,
+                      stats.hits + stats.misses);
+    cork_sharded_cache_free(cache);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("cache");
+
+    TCase  *tc_ds = tcase_create("cache");
+    tcase_add_test(tc_ds, test_cache_basics);
+    tcase_add_test(tc_ds, test_cache_eviction);
+    tcase_add_test(tc_ds, test_cache_ttl);
+    tcase_add_test(tc_ds, test_sharded_cache);
+    suite_add_tcase(s, tc_ds);
+
+    TCase  *tc_concurrent = tcase_create("concurrent");
+    tcase_set_timeout(tc_concurrent, 20.0);
+    tcase_add_test(tc_concurrent, test_sharded_cache_threads);
+    suite_add_tcase(s, tc_concurrent);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    setup_allocator();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,200 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2009-2014, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license
+ * details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include "libcork/core/types.h"
+#include "libcork/ds/buffer.h"
+#include "libcork/ds/chunked-buffer.h"
+#include "libcork/ds/slice.h"
+#include "libcork/ds/stream.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Chunked buffers
+ */
+
+static void
+check_chunked_buffer(const struct cork_chunked_buffer *buf,
+                     const char *expected)
+{
+    struct cork_buffer  flat = CORK_BUFFER_INIT();
+    size_t  expected_len = strlen(expected);
+    cork_chunked_buffer_to_buffer(buf, &flat);
+    fail_unless(flat.size == expected_len &&
+                memcmp(flat.buf, expected, expected_len) == 0,
+                "Unexpected buffer content: got %zu:%s, expected %zu:%s",
+                flat.size, (char *) flat.buf, expected_len, expected);
+    fail_unless_equal("Buffer size", "%zu", expected_len, buf->size);
+    cork_buffer_done(&flat);
+}
+
+START_TEST(test_chunked_buffer_append)
+{
+    struct cork_chunked_buffer  buffer1;
+    struct cork_chunked_buffer  *buffer2;
+    struct cork_buffer  src = CORK_BUFFER_INIT();
+
+    cork_chunked_buffer_init(&buffer1);
+    cork_chunked_buffer_set_chunk_size(&buffer1, 4);
+    cork_chunked_buffer_append(&buffer1, "abcd", 4);
+    cork_chunked_buffer_append(&buffer1, "efg", 3);
+    cork_chunked_buffer_append_string(&buffer1, "hij");
+    cork_chunked_buffer_append_literal(&buffer1, "kl");
+    check_chunked_buffer(&buffer1, "abcdefghijkl");
+    fail_unless_equal("Chunk count", "%zu", (size_t) 3, buffer1.chunk_count);
+
+    /* A buffer with differently sized chunks but the same contents */
+    buffer2 = cork_chunked_buffer_new();
+    cork_buffer_set_string(&src, "abcdefghijkl");
+    cork_chunked_buffer_append_copy(buffer2, &src);
+    fail_unless_equal("Chunk count", "%zu", (size_t) 1, buffer2->chunk_count);
+    fail_unless(cork_chunked_buffer_equal(&buffer1, buffer2),
+                "Buffers should be equal");
+    cork_chunked_buffer_append_literal(buffer2, "m");
+    fail_if(cork_chunked_buffer_equal(&buffer1, buffer2),
+            "Buffers shouldn't be equal");
+
+    cork_chunked_buffer_clear(&buffer1);
+    check_chunked_buffer(&buffer1, "");
+    cork_chunked_buffer_append_indent(&buffer1, 6);
+    cork_chunked_buffer_append_literal(&buffer1, "x");
+    check_chunked_buffer(&buffer1, "      x");
+
+    cork_chunked_buffer_done(&buffer1);
+    cork_chunked_buffer_free(buffer2);
+    cork_buffer_done(&src);
+}
+END_TEST
+
+START_TEST(test_chunked_buffer_printf)
+{
+    struct cork_chunked_buffer  buffer = CORK_CHUNKED_BUFFER_INIT();
+    cork_chunked_buffer_set_chunk_size(&buffer, 8);
+    cork_chunked_buffer_append_printf(&buffer, "%d", 12);
+    cork_chunked_buffer_append_printf(&buffer, "%s", "abcd");
+    /* Doesn't fit into the space left in the first chunk */
+    cork_chunked_buffer_append_printf(&buffer, "[%s]", "a longer string");
+    cork_chunked_buffer_append_printf(&buffer, "%d", 3);
+    check_chunked_buffer(&buffer, "12abcd[a longer string]3");
+    cork_chunked_buffer_done(&buffer);
+}
+END_TEST
+
+START_TEST(test_chunked_buffer_iterate)
+{
+    struct cork_chunked_buffer  buffer = CORK_CHUNKED_BUFFER_INIT();
+    struct cork_chunked_buffer_iterator  iter;
+    struct cork_slice  slice;
+    struct iovec  iov[2];
+    size_t  count = 0;
+    size_t  size = 0;
+
+    cork_chunked_buffer_set_chunk_size(&buffer, 4);
+    cork_chunked_buffer_append(&buffer, "abcdefghij", 10);
+    cork_chunked_buffer_append(&buffer, "kl", 2);
+    cork_chunked_buffer_append(&buffer, "mnopq", 5);
+
+    cork_chunked_buffer_iterator_init(&buffer, &iter);
+    while (cork_chunked_buffer_iterator_next(&iter, &slice)) {
+        count++;
+        size += slice.size;
+        cork_slice_finish(&slice);
+    }
+    fail_unless_equal("Chunk count", "%zu", buffer.chunk_count, count);
+    fail_unless_equal("Total size", "%zu", (size_t) 17, size);
+
+    cork_chunked_buffer_iterator_init(&buffer, &iter);
+    fail_unless_equal("iovec count", "%zu", (size_t) 2,
+                      cork_chunked_buffer_iterator_iovec(&iter, iov, 2));
+    fail_unless_equal("iovec size", "%zu", (size_t) 10, iov[0].iov_len);
+    fail_unless(memcmp(iov[1].iov_base, "kl", 2) == 0,
+                "Unexpected iovec contents");
+    fail_unless_equal("iovec count", "%zu", (size_t) 1,
+                      cork_chunked_buffer_iterator_iovec(&iter, iov, 2));
+    fail_unless_equal("iovec count", "%zu", (size_t) 0,
+                      cork_chunked_buffer_iterator_iovec(&iter, iov, 2));
+
+    cork_chunked_buffer_done(&buffer);
+}
+END_TEST
+
+START_TEST(test_chunked_buffer_write_fd)
+{
+    struct cork_chunked_buffer  buffer = CORK_CHUNKED_BUFFER_INIT();
+    struct cork_chunked_buffer  result = CORK_CHUNKED_BUFFER_INIT();
+    struct cork_stream_consumer  *consumer;
+    int  fds[2];
+    size_t  i;
+
+    /* More chunks than fit into a single writev call */
+    cork_chunked_buffer_set_chunk_size(&buffer, 16);
+    for (i = 0; i < 200; i++) {
+        cork_chunked_buffer_append_printf(&buffer, "line %zu\n", i);
+    }
+
+    fail_if(pipe(fds) == -1, "Cannot create pipe");
+    fail_if_error(cork_chunked_buffer_write_fd(&buffer, fds[1]));
+    close(fds[1]);
+
+    consumer = cork_chunked_buffer_to_stream_consumer(&result);
+    fail_if_error(cork_consume_fd(consumer, fds[0]));
+    close(fds[0]);
+    cork_stream_consumer_free(consumer);
+    fail_unless(cork_chunked_buffer_equal(&buffer, &result),
+                "Buffers should be equal");
+
+    cork_chunked_buffer_done(&buffer);
+    cork_chunked_buffer_done(&result);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("chunked-buffer");
+
+    TCase  *tc_buffer = tcase_create("chunked-buffer");
+    tcase_add_test(tc_buffer, test_chunked_buffer_append);
+    tcase_add_test(tc_buffer, test_chunked_buffer_printf);
+    tcase_add_test(tc_buffer, test_chunked_buffer_iterate);
+    tcase_add_test(tc_buffer, test_chunked_buffer_write_fd);
+    suite_add_tcase(s, tc_buffer);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    setup_allocator();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -8,23 +8,29 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include <check.h>
 
 #include "libcork/config.h"
+#include "libcork/core/allocator.h"
 #include "libcork/core/byte-order.h"
 #include "libcork/core/error.h"
 #include "libcork/core/hash.h"
 #include "libcork/core/id.h"
 #include "libcork/core/net-addresses.h"
 #include "libcork/core/timestamp.h"
+#include "libcork/core/trace.h"
 #include "libcork/core/types.h"
 #include "libcork/core/u128.h"
+#include "libcork/ds/buffer.h"
 #include "libcork/os/subprocess.h"
+#include "libcork/threads/basics.h"
 
 #include "helpers.h"
 
@@ -139,6 +145,342 @@ START_TEST(test_string)
 END_TEST
 
 
+/*-----------------------------------------------------------------------
+ * Allocators
+ */
+
+START_TEST(test_arena)
+{
+    DESCRIBE_TEST;
+    struct cork_arena  *arena = cork_arena_new(cork_allocator, 1024);
+    const struct cork_alloc  *alloc = cork_arena_alloc(arena);
+    char  *small[100];
+    char  *big;
+    char  *grown;
+    size_t  i;
+
+    for (i = 0; i < 100; i++) {
+        small[i] = cork_alloc_malloc(alloc, 20);
+        fail_unless(((uintptr_t) small[i] % 16) == 0,
+                    "Arena allocation %zu isn't aligned", i);
+        memset(small[i], (int) i, 20);
+    }
+    big = cork_alloc_calloc(alloc, 1, 4096);
+    for (i = 0; i < 4096; i++) {
+        fail_unless(big[i] == 0, "Arena calloc isn't zeroed");
+    }
+    for (i = 0; i < 100; i++) {
+        size_t  j;
+        for (j = 0; j < 20; j++) {
+            fail_unless(small[i][j] == (char) i,
+                        "Arena allocation %zu was overwritten", i);
+        }
+        cork_alloc_free(alloc, small[i], 20);
+    }
+
+    /* The most recent allocation can be resized in place. */
+    grown = cork_alloc_malloc(alloc, 16);
+    memcpy(grown, "0123456789abcde", 16);
+    fail_unless(cork_alloc_realloc(alloc, grown, 16, 64) == grown,
+                "Last arena allocation should be resized in place");
+    grown = cork_alloc_realloc(alloc, grown, 64, 4096);
+    fail_unless(strcmp(grown, "0123456789abcde") == 0,
+                "Reallocated contents don't match");
+
+    cork_arena_reset(arena);
+    small[0] = cork_alloc_malloc(alloc, 20);
+    fail_if(small[0] == NULL, "Cannot allocate after reset");
+    cork_arena_reset(arena);
+    cork_arena_free(arena);
+}
+END_TEST
+
+
+static void
+test_slab_alloc_sizes(const struct cork_alloc *alloc, unsigned int seed)
+{
+    /* Allocate enough objects of each size to force the thread cache to
+     * refill from, and spill back into, the shared slabs. */
+    static const size_t  sizes[] = { 0, 1, 16, 17, 100, 128, 129, 1000, 1024,
+                                     1025, 5000 };
+    char  *objects[200];
+    size_t  i;
+    size_t  j;
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t  size = sizes[i];
+        for (j = 0; j < 200; j++) {
+            objects[j] = cork_alloc_malloc(alloc, size);
+            /* Larger allocations come straight from the parent allocator,
+             * which has its own alignment rules. */
+            fail_unless(size > CORK_SLAB_ALLOC_MAX_SIZE ||
+                        ((uintptr_t) objects[j] % 16) == 0,
+                        "Slab allocation of %zu bytes isn't aligned", size);
+            memset(objects[j], (int) (j + seed), size);
+        }
+        for (j = 0; j < 200; j++) {
+            size_t  k;
+            for (k = 0; k < size; k++) {
+                fail_unless(objects[j][k] == (char) (j + seed),
+                            "Slab allocation of %zu bytes was overwritten",
+                            size);
+            }
+            cork_alloc_free(alloc, objects[j], size);
+        }
+    }
+}
+
+START_TEST(test_slab_alloc)
+{
+    DESCRIBE_TEST;
+    struct cork_alloc  *alloc = cork_slab_alloc_new(cork_allocator);
+    char  *ptr;
+    char  *grown;
+
+    test_slab_alloc_sizes(alloc, 0);
+
+    /* Reallocating within a size class doesn't move anything. */
+    ptr = cork_alloc_malloc(alloc, 20);
+    fail_unless(cork_alloc_realloc(alloc, ptr, 20, 30) == ptr,
+                "Reallocation within a size class shouldn't move");
+    memcpy(ptr, "0123456789abcde", 16);
+    grown = cork_alloc_realloc(alloc, ptr, 30, 2000);
+    fail_unless(strcmp(grown, "0123456789abcde") == 0,
+                "Reallocated contents don't match");
+    ptr = cork_alloc_realloc(alloc, grown, 2000, 40);
+    fail_unless(strcmp(ptr, "0123456789abcde") == 0,
+                "Reallocated contents don't match");
+    cork_alloc_free(alloc, ptr, 40);
+}
+END_TEST
+
+static int
+test_slab_alloc__run(void *user_data)
+{
+    const struct cork_alloc  *alloc = user_data;
+    test_slab_alloc_sizes(alloc, (unsigned int) cork_current_thread_get_id());
+    return 0;
+}
+
+START_TEST(test_slab_alloc_threads)
+{
+    DESCRIBE_TEST;
+    struct cork_alloc  *alloc = cork_slab_alloc_new(cork_allocator);
+    struct cork_thread  *threads[4];
+    size_t  i;
+    for (i = 0; i < 4; i++) {
+        fail_if_error(threads[i] = cork_thread_new
+                      ("slab", alloc, NULL, test_slab_alloc__run));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    test_slab_alloc_sizes(alloc, 100);
+    for (i = 0; i < 4; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+}
+END_TEST
+
+START_TEST(test_stats_alloc)
+{
+    DESCRIBE_TEST;
+    struct cork_alloc  *alloc = cork_stats_alloc_new(cork_allocator, 1);
+    struct cork_alloc_stats  stats;
+    struct cork_buffer  snapshot = CORK_BUFFER_INIT();
+    void  *small = cork_alloc_malloc(alloc, 10);
+    void  *medium = cork_alloc_calloc(alloc, 10, 10);
+    void  *large = cork_alloc_malloc(alloc, 5000);
+
+    cork_stats_alloc_get(alloc, &stats);
+    fail_unless_equal("Live bytes", "%zu", 5110, stats.live_bytes);
+    fail_unless_equal("Allocations", "%zu", 3, stats.alloc_count);
+
+    cork_alloc_free(alloc, large, 5000);
+    small = cork_alloc_realloc(alloc, small, 10, 20);
+    cork_stats_alloc_get(alloc, &stats);
+    fail_unless_equal("Live bytes", "%zu", 120, stats.live_bytes);
+    fail_unless_equal("Peak bytes", "%zu", 5110, stats.peak_bytes);
+    fail_unless_equal("Frees", "%zu", 1, stats.free_count);
+    fail_unless_equal("Reallocations", "%zu", 1, stats.realloc_count);
+
+    cork_stats_alloc_snapshot(alloc, &snapshot);
+    fail_if(strstr(snapshot.buf, "size <= 16: live 0 peak 10") == NULL,
+            "Unexpected snapshot:\n%s", (char *) snapshot.buf);
+    fail_if(strstr(snapshot.buf, "size <= 8192: live 0 peak 5000") == NULL,
+            "Unexpected snapshot:\n%s", (char *) snapshot.buf);
+    fail_if(strstr(snapshot.buf, "site ") == NULL,
+            "Unexpected snapshot:\n%s", (char *) snapshot.buf);
+    cork_buffer_done(&snapshot);
+
+    cork_alloc_free(alloc, small, 20);
+    cork_alloc_free(alloc, medium, 100);
+    cork_stats_alloc_get(alloc, &stats);
+    fail_unless_equal("Live bytes", "%zu", 0, stats.live_bytes);
+}
+END_TEST
+
+/* An allocator that fails every request while failing_alloc_fails is set. */
+static bool  failing_alloc_fails = false;
+
+static void *
+failing_alloc__malloc(const struct cork_alloc *alloc, size_t size)
+{
+    return failing_alloc_fails? NULL: cork_alloc_malloc(alloc->parent, size);
+}
+
+static void *
+failing_alloc__calloc(const struct cork_alloc *alloc,
+                      size_t count, size_t size)
+{
+    return failing_alloc_fails? NULL:
+        cork_alloc_calloc(alloc->parent, count, size);
+}
+
+static void *
+failing_alloc__realloc(const struct cork_alloc *alloc, void *ptr,
+                       size_t old_size, size_t new_size)
+{
+    return failing_alloc_fails? NULL:
+        cork_alloc_realloc(alloc->parent, ptr, old_size, new_size);
+}
+
+static void
+failing_alloc__free(const struct cork_alloc *alloc, void *ptr, size_t size)
+{
+    cork_alloc_free(alloc->parent, ptr, size);
+}
+
+START_TEST(test_stats_alloc_failures)
+{
+    DESCRIBE_TEST;
+    struct cork_alloc  *parent = cork_alloc_new_alloc(cork_allocator);
+    struct cork_alloc  *alloc;
+    struct cork_alloc_stats  stats;
+    char  block[10];
+
+    cork_alloc_set_calloc(parent, failing_alloc__calloc);
+    cork_alloc_set_malloc(parent, failing_alloc__malloc);
+    cork_alloc_set_realloc(parent, failing_alloc__realloc);
+    cork_alloc_set_free(parent, failing_alloc__free);
+    alloc = cork_stats_alloc_new(parent, 1);
+    failing_alloc_fails = true;
+
+    /* Failed allocations aren't counted... */
+    fail_unless(cork_alloc_malloc(alloc, 10) == NULL, "malloc should fail");
+    fail_unless(cork_alloc_calloc(alloc, 10, 10) == NULL,
+                "calloc should fail");
+    fail_unless(cork_alloc_realloc(alloc, NULL, 0, 10) == NULL,
+                "realloc should fail");
+    cork_stats_alloc_get(alloc, &stats);
+    fail_unless_equal("Live bytes", "%zu", 0, stats.live_bytes);
+    fail_unless_equal("Peak bytes", "%zu", 0, stats.peak_bytes);
+    fail_unless_equal("Allocations", "%zu", 0, stats.alloc_count);
+
+    /* ...and a failed realloc leaves the original allocation's stats alone.
+     * (The parent never sees this block, so it doesn't matter that it's on
+     * the stack.) */
+    fail_unless(cork_alloc_realloc(alloc, block, 10, 20) == NULL,
+                "realloc should fail");
+    cork_stats_alloc_get(alloc, &stats);
+    fail_unless_equal("Live bytes", "%zu", 0, stats.live_bytes);
+    fail_unless_equal("Reallocations", "%zu", 0, stats.realloc_count);
+    fail_unless_equal("Frees", "%zu", 0, stats.free_count);
+    failing_alloc_fails = false;
+}
+END_TEST
+
+START_TEST(test_page_alloc)
+{
+    DESCRIBE_TEST;
+    struct cork_alloc  *alloc = cork_page_alloc_new
+        (cork_allocator, 4096,
+         CORK_PAGE_ALLOC_HUGE_PAGES | CORK_PAGE_ALLOC_LOCAL_NODE);
+    size_t  large_size = 3 * 1024 * 1024;
+    char  *small = cork_alloc_malloc(alloc, 100);
+    char  *large = cork_alloc_malloc(alloc, large_size);
+    char  *zeroed = cork_alloc_calloc(alloc, 5, 1024 * 1024);
+    size_t  i;
+
+    fail_unless(((uintptr_t) large % (2 * 1024 * 1024)) == 0,
+                "Huge page allocation isn't aligned");
+    memset(small, 'a', 100);
+    large[0] = 'b';
+    large[large_size - 1] = 'c';
+    for (i = 0; i < 5 * 1024 * 1024; i += 4096) {
+        fail_unless(zeroed[i] == 0, "Page allocation isn't zeroed");
+    }
+
+    large = cork_alloc_realloc(alloc, large, large_size, 3 * large_size);
+    fail_unless(large[0] == 'b' && large[large_size - 1] == 'c',
+                "Reallocated contents don't match");
+    large = cork_alloc_realloc(alloc, large, 3 * large_size, 100);
+    fail_unless(large[0] == 'b', "Reallocated contents don't match");
+    small = cork_alloc_realloc(alloc, small, 100, large_size);
+    fail_unless(small[99] == 'a', "Reallocated contents don't match");
+
+    cork_alloc_free(alloc, small, large_size);
+    cork_alloc_free(alloc, large, 100);
+    cork_alloc_cfree(alloc, zeroed, 5, 1024 * 1024);
+}
+END_TEST
+
+struct test_cacheline_counter {
+    unsigned int  value;
+} CORK_ATTR_CACHELINE_ALIGNED;
+
+struct test_cacheline_padded {
+    unsigned int  value;
+    CORK_CACHELINE_PAD(pad, sizeof(unsigned int));
+};
+
+START_TEST(test_aligned_alloc)
+{
+    DESCRIBE_TEST;
+    static const size_t  alignments[] = {
+        1, 2, 8, 16, 64, CORK_CACHELINE_SIZE, 4096
+    };
+    struct test_cacheline_counter  *counter;
+    struct test_cacheline_counter  counters[2];
+    size_t  i;
+
+    fail_unless(CORK_CACHELINE_ROUND(1) == CORK_CACHELINE_SIZE,
+                "Unexpected rounded cache line size");
+    fail_unless(CORK_CACHELINE_ROUND(CORK_CACHELINE_SIZE + 1) ==
+                2 * CORK_CACHELINE_SIZE,
+                "Unexpected rounded cache line size");
+    fail_unless(sizeof(struct test_cacheline_counter) == CORK_CACHELINE_SIZE,
+                "Aligned struct has wrong size");
+    fail_unless(sizeof(struct test_cacheline_padded) == CORK_CACHELINE_SIZE,
+                "Padded struct has wrong size");
+    fail_unless(((uintptr_t) &counters[1] - (uintptr_t) &counters[0]) ==
+                CORK_CACHELINE_SIZE,
+                "Aligned structs share a cache line");
+
+    for (i = 0; i < sizeof(alignments) / sizeof(alignments[0]); i++) {
+        size_t  alignment = alignments[i];
+        char  *buf = cork_aligned_malloc(100, alignment);
+        char  *zeroed = cork_aligned_calloc(10, 100, alignment);
+        size_t  j;
+        fail_unless(((uintptr_t) buf % alignment) == 0,
+                    "Allocation isn't aligned to %zu bytes", alignment);
+        fail_unless(((uintptr_t) zeroed % alignment) == 0,
+                    "Allocation isn't aligned to %zu bytes", alignment);
+        memset(buf, 'a', 100);
+        for (j = 0; j < 10 * 100; j++) {
+            fail_unless(zeroed[j] == 0, "Aligned allocation isn't zeroed");
+        }
+        cork_aligned_free(buf, 100, alignment);
+        cork_aligned_free(zeroed, 10 * 100, alignment);
+    }
+
+    counter = cork_cacheline_new(struct test_cacheline_counter);
+    fail_unless(((uintptr_t) counter % CORK_CACHELINE_SIZE) == 0,
+                "Allocation isn't aligned to a cache line");
+    fail_unless(counter->value == 0, "Cache line allocation isn't zeroed");
+    counter->value = 1;
+    cork_cacheline_delete(struct test_cacheline_counter, counter);
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Endianness
  */
@@ -203,6 +545,96 @@ START_TEST(test_endianness)
 }
 END_TEST
 
+START_TEST(test_endianness_unaligned)
+{
+    uint8_t  buf[9] = { 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+
+    DESCRIBE_TEST;
+    fail_unless_equal("Big-endian 16-bit load", "0x%04" PRIx16,
+                      0x0102, cork_load_be16(buf + 1));
+    fail_unless_equal("Big-endian 32-bit load", "0x%08" PRIx32,
+                      0x01020304, cork_load_be32(buf + 1));
+    fail_unless_equal("Big-endian 64-bit load", "0x%016" PRIx64,
+                      UINT64_C(0x0102030405060708), cork_load_be64(buf + 1));
+    fail_unless_equal("Little-endian 16-bit load", "0x%04" PRIx16,
+                      0x0201, cork_load_le16(buf + 1));
+    fail_unless_equal("Little-endian 32-bit load", "0x%08" PRIx32,
+                      0x04030201, cork_load_le32(buf + 1));
+    fail_unless_equal("Little-endian 64-bit load", "0x%016" PRIx64,
+                      UINT64_C(0x0807060504030201), cork_load_le64(buf + 1));
+
+    cork_store_be32(buf + 1, 0x0a0b0c0d);
+    fail_unless(buf[1] == 0x0a && buf[4] == 0x0d,
+                "Unexpected big-endian 32-bit store");
+    cork_store_le64(buf + 1, UINT64_C(0x1112131415161718));
+    fail_unless(buf[0] == 0 && buf[1] == 0x18 && buf[8] == 0x11,
+                "Unexpected little-endian 64-bit store");
+    cork_store_be16(buf + 7, 0x2122);
+    fail_unless(buf[7] == 0x21 && buf[8] == 0x22,
+                "Unexpected big-endian 16-bit store");
+}
+END_TEST
+
+START_TEST(test_endianness_arrays)
+{
+#define MAX_COUNT  100
+    DESCRIBE_TEST;
+
+    /* Try lots of counts so that we test both the vectorized loops and the
+     * leftovers, and an odd offset so that nothing is aligned. */
+#define TEST_ARRAY(bits) \
+    { \
+        uint8_t  src[MAX_COUNT * 8 + 2]; \
+        uint8_t  dest[MAX_COUNT * 8 + 2]; \
+        size_t  count; \
+        size_t  i; \
+        for (i = 0; i < sizeof(src); i++) { \
+            src[i] = (uint8_t) (i * 7 + 3); \
+        } \
+        for (count = 0; count <= MAX_COUNT; count++) { \
+            memset(dest, 0xee, sizeof(dest)); \
+            cork_bswap##bits##_array(dest + 1, src + 1, count); \
+            for (i = 0; i < count; i++) { \
+                uint##bits##_t  expected; \
+                uint##bits##_t  actual; \
+                memcpy(&expected, src + 1 + i * (bits / 8), bits / 8); \
+                memcpy(&actual, dest + 1 + i * (bits / 8), bits / 8); \
+                fail_unless(actual == CORK_SWAP_UINT##bits(expected), \
+                            "Unexpected " #bits "-bit swap at %zu of %zu", \
+                            i, count); \
+            } \
+            fail_unless(dest[1 + count * (bits / 8)] == 0xee, \
+                        "Swapping %zu " #bits "-bit values overran", \
+                        count); \
+        } \
+        \
+        memcpy(dest, src, sizeof(src)); \
+        cork_bswap##bits##_array_in_place(dest + 1, MAX_COUNT); \
+        for (i = 0; i < MAX_COUNT; i++) { \
+            fail_unless(cork_load_be##bits(dest + 1 + i * (bits / 8)) == \
+                        cork_load_le##bits(src + 1 + i * (bits / 8)), \
+                        "Unexpected in-place " #bits "-bit swap at %zu", i); \
+        } \
+        CORK_UINT##bits##_BIG_TO_HOST_ARRAY(dest + 1, src + 1, MAX_COUNT); \
+        for (i = 0; i < MAX_COUNT; i++) { \
+            uint##bits##_t  actual; \
+            memcpy(&actual, dest + 1 + i * (bits / 8), bits / 8); \
+            fail_unless(actual == \
+                        cork_load_be##bits(src + 1 + i * (bits / 8)), \
+                        "Unexpected big-to-host " #bits "-bit value at %zu", \
+                        i); \
+        } \
+    }
+
+    TEST_ARRAY(16);
+    TEST_ARRAY(32);
+    TEST_ARRAY(64);
+
+#undef TEST_ARRAY
+#undef MAX_COUNT
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * Built-in errors
@@ -235,7 +667,41 @@ START_TEST(test_system_error)
     fail_unless(cork_error_code() == ENOMEM,
                 "Expected a system error");
     printf("Got error: %s\n", cork_error_message());
+    fail_unless_streq("Error messages", strerror(ENOMEM), cork_error_message());
+    cork_error_prefix_string("Oh no: ");
+    cork_error_prefix_printf("%s", "Really, ");
+    fail_unless_equal("Error code", "%" PRIu32, (cork_error) ENOMEM,
+                      cork_error_code());
+    cork_error_clear();
+    fail_unless_streq("Error messages", "", cork_error_message());
+}
+END_TEST
+
+START_TEST(test_static_error)
+{
+    char  expected[256];
+    DESCRIBE_TEST;
     cork_error_clear();
+    cork_error_set_static(CORK_UNKNOWN_ERROR, "Something broke");
+    fail_unless(cork_error_occurred(), "Expected an error");
+    fail_unless_streq("Error messages", "Something broke",
+                      cork_error_message());
+    cork_error_prefix_printf("%d: ", 17);
+    fail_unless_streq("Error messages", "17: Something broke",
+                      cork_error_message());
+
+    /* Messages can switch between formatted, static, and system errors. */
+    cork_error_set_printf(CORK_UNKNOWN_ERROR, "%s", "formatted");
+    fail_unless_streq("Error messages", "formatted", cork_error_message());
+    cork_system_error_set_explicit(EINVAL);
+    snprintf(expected, sizeof(expected), "Oops: %s", strerror(EINVAL));
+    cork_error_prefix_string("Oops: ");
+    fail_unless_streq("Error messages", expected, cork_error_message());
+    cork_error_set_static(CORK_UNKNOWN_ERROR, "static");
+    fail_unless_streq("Error messages", "static", cork_error_message());
+    cork_error_clear();
+    fail_if(cork_error_occurred(), "Expected no error");
+    fail_unless_streq("Error messages", "", cork_error_message());
 }
 END_TEST
 
@@ -400,6 +866,148 @@ START_TEST(test_hash)
 }
 END_TEST
 
+START_TEST(test_hash_fast)
+{
+    DESCRIBE_TEST;
+
+    /* The test vectors from the wyhash distribution */
+    static const char  *BUFS[] = {
+        "",
+        "a",
+        "abc",
+        "message digest",
+        "abcdefghijklmnopqrstuvwxyz",
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+        "1234567890123456789012345678901234567890"
+        "1234567890123456789012345678901234567890"
+    };
+    static const uint64_t  EXPECTED[] = {
+        UINT64_C(0x0409638ee2bde459),
+        UINT64_C(0xa8412d091b5fe0a9),
+        UINT64_C(0x32dd92e4b2915153),
+        UINT64_C(0x8619124089a3a16b),
+        UINT64_C(0x7a43afb61d7f5f40),
+        UINT64_C(0xff42329b90e50d58),
+        UINT64_C(0xc39cab13b115aad3)
+    };
+    uint32_t  val32 = 1234;
+    uint64_t  val64 = UINT64_C(0x0123456789abcdef);
+    cork_u128  val128 = cork_u128_from_64(1234, 5678);
+    size_t  i;
+
+    for (i = 0; i < sizeof(BUFS) / sizeof(BUFS[0]); i++) {
+        fail_unless_equal("Hash", "0x%016" PRIx64, EXPECTED[i],
+                          cork_wyhash(i, BUFS[i], strlen(BUFS[i])));
+        fail_unless_equal("Hash", "0x%08" PRIx32, (cork_hash) EXPECTED[i],
+                          cork_fast_hash_buffer(i, BUFS[i], strlen(BUFS[i])));
+    }
+
+    /* The fixed-size variants should match the general-purpose function. */
+    fail_unless_equal("Hash", "0x%016" PRIx64,
+                      cork_wyhash(0x1234, &val32, sizeof(val32)),
+                      cork_wyhash_u32(0x1234, val32));
+    fail_unless_equal("Hash", "0x%016" PRIx64,
+                      cork_wyhash(0x1234, &val64, sizeof(val64)),
+                      cork_wyhash_u64(0x1234, val64));
+    fail_unless_equal("Hash", "0x%016" PRIx64,
+                      cork_wyhash(0x1234, &val128, sizeof(val128)),
+                      cork_wyhash_u128(0x1234, val128));
+    fail_unless_equal("Hash", "0x%08" PRIx32,
+                      cork_fast_hash_variable(0x1234, val64),
+                      cork_fast_hash_u64(0x1234, val64));
+}
+END_TEST
+
+START_TEST(test_hash_incremental)
+{
+    DESCRIBE_TEST;
+
+    /* Hash every prefix of a buffer, split at every possible point, and make
+     * sure that we get the same result as the one-shot functions. */
+    static const char  BUF[] =
+        "this is a much longer test string in the hopes that we have to "
+        "go through a few iterations of the hashing loop";
+    cork_big_hash  big_seed = {cork_u128_from_64(1234, 5678)};
+    size_t  len;
+    size_t  split;
+
+    for (len = 0; len < sizeof(BUF); len++) {
+        cork_hash  expected = cork_hash_buffer(0x1234, BUF, len);
+        cork_hash  stable_expected = cork_stable_hash_buffer(0x1234, BUF, len);
+        cork_big_hash  big_expected = cork_big_hash_buffer(big_seed, BUF, len);
+
+        for (split = 0; split <= len; split++) {
+            struct cork_hash_state  state;
+            struct cork_stable_hash_state  stable_state;
+            struct cork_big_hash_state  big_state;
+            cork_big_hash  big_actual;
+
+            cork_hash_state_init(&state, 0x1234);
+            cork_hash_state_update(&state, BUF, split);
+            cork_hash_state_update(&state, BUF + split, len - split);
+            fail_unless_equal("Hash", "0x%08" PRIx32,
+                              expected, cork_hash_state_final(&state));
+
+            cork_stable_hash_state_init(&stable_state, 0x1234);
+            cork_stable_hash_state_update(&stable_state, BUF, split);
+            cork_stable_hash_state_update
+                (&stable_state, BUF + split, len - split);
+            fail_unless_equal("Stable hash", "0x%08" PRIx32,
+                              stable_expected,
+                              cork_stable_hash_state_final(&stable_state));
+
+            cork_big_hash_state_init(&big_state, big_seed);
+            cork_big_hash_state_update(&big_state, BUF, split);
+            cork_big_hash_state_update(&big_state, BUF + split, len - split);
+            big_actual = cork_big_hash_state_final(&big_state);
+            fail_unless(cork_big_hash_equal(big_expected, big_actual),
+                        "Big hash mismatch for %zu bytes split at %zu",
+                        len, split);
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_hash_buffers)
+{
+    DESCRIBE_TEST;
+
+    /* Hash every prefix of a buffer in a single batch, so that each group of
+     * lanes has a mix of lengths, and make sure that we get the same results
+     * as hashing each one separately. */
+    static const char  BUF[] =
+        "this is a much longer test string in the hopes that we have to "
+        "go through a few iterations of the hashing loop";
+    const void  *srcs[sizeof(BUF)];
+    size_t  lens[sizeof(BUF)];
+    cork_hash  hashes[sizeof(BUF)];
+    cork_hash  stable_hashes[sizeof(BUF)];
+    size_t  count;
+    size_t  i;
+
+    for (i = 0; i < sizeof(BUF); i++) {
+        srcs[i] = BUF + i % 3;
+        lens[i] = (i * 37) % (sizeof(BUF) - 3);
+    }
+
+    /* Try every batch size, so that we test the leftover buffers that don't
+     * fill up a whole group. */
+    for (count = 0; count <= sizeof(BUF); count++) {
+        cork_hash_buffers(0x1234, srcs, lens, count, hashes);
+        cork_stable_hash_buffers(0x1234, srcs, lens, count, stable_hashes);
+        for (i = 0; i < count; i++) {
+            fail_unless_equal("Hash", "0x%08" PRIx32,
+                              cork_hash_buffer(0x1234, srcs[i], lens[i]),
+                              hashes[i]);
+            fail_unless_equal("Stable hash", "0x%08" PRIx32,
+                              cork_stable_hash_buffer
+                              (0x1234, srcs[i], lens[i]),
+                              stable_hashes[i]);
+        }
+    }
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * IP addresses
@@ -456,6 +1064,11 @@ END_TEST
     good("2001:0:0:1:0:0:0:1", "2001:0:0:1::1"); \
     good("2001:db8:0:0:1:0:0:1", "2001:db8::1:0:0:1"); \
     good("0:1:A:B:C:D:E:F", "0:1:a:b:c:d:e:f"); \
+    good("1:0:0:2:0:0:0:3", "1:0:0:2::3"); \
+    good("1:0:0:2:0:0:3:4", "1::2:0:0:3:4"); \
+    good("0:0:1:0:0:0:0:0", "0:0:1::"); \
+    good("10:100:1000:abcd:0:0:0:0", "10:100:1000:abcd::"); \
+    good("::1.2.3.4", "::1.2.3.4"); \
 
 START_TEST(test_ipv4_address)
 {
@@ -493,6 +1106,23 @@ START_TEST(test_ipv4_address)
 #undef GOOD
 #undef BAD
 
+    /* Every possible octet value */
+    {
+        struct cork_ipv4  addr;
+        unsigned int  octet;
+        for (octet = 0; octet < 256; octet++) {
+            char  expected[CORK_IPV4_STRING_LENGTH];
+            char  actual[CORK_IPV4_STRING_LENGTH];
+            uint8_t  src[4] = { octet, 255 - octet, octet / 2, 7 };
+            snprintf(expected, sizeof(expected), "%u.%u.%u.%u",
+                     src[0], src[1], src[2], src[3]);
+            cork_ipv4_copy(&addr, src);
+            fail_unless_equal("Formatted length", "%zu", strlen(expected),
+                              cork_ipv4_format(&addr, actual));
+            fail_unless_streq("Formatted address", expected, actual);
+        }
+    }
+
     struct cork_ipv4  addr4;
     unsigned int  ipv4_cidr_good = 30;
     unsigned int  ipv4_cidr_bad_value = 24;
@@ -565,6 +1195,12 @@ START_TEST(test_ipv6_address)
     fail_if(cork_ipv6_is_valid_network(&addr6, ipv6_cidr_bad_range),
             "IPv6 CIDR check should fail for %u",
             ipv6_cidr_bad_range);
+
+    cork_ipv6_init(&addr6, "2001:db8::");
+    fail_unless(cork_ipv6_is_valid_network(&addr6, 32),
+                "Bad CIDR block 32");
+    fail_if(cork_ipv6_is_valid_network(&addr6, 16),
+            "IPv6 CIDR check should fail for 16");
 }
 END_TEST
 
@@ -589,6 +1225,20 @@ START_TEST(test_ip_address)
         cork_ip_init(&addr2, normalized); \
         fail_unless(cork_ip_equal(&addr, &addr2), \
                     "IP instances should be equal"); \
+        fail_unless_equal("Formatted length", "%zu", strlen(normalized), \
+                          cork_ip_format(&addr, actual)); \
+        fail_unless_streq("Formatted address", normalized, actual); \
+        \
+        struct cork_buffer  buf = CORK_BUFFER_INIT(); \
+        cork_buffer_append_literal(&buf, "<"); \
+        cork_buffer_append_ip(&buf, &addr); \
+        cork_buffer_append_literal(&buf, ">"); \
+        fail_unless(buf.size == strlen(normalized) + 2 && \
+                    memcmp(buf.buf + 1, normalized, buf.size - 2) == 0, \
+                    "Unexpected appended representation: " \
+                    "got \"%s\", expected \"<%s>\"", \
+                    (char *) buf.buf, normalized); \
+        cork_buffer_done(&buf); \
     }
 
 #define BAD(str, unused) \
@@ -628,6 +1278,72 @@ START_TEST(test_ip_address)
 }
 END_TEST
 
+START_TEST(test_ip_address_n)
+{
+    DESCRIBE_TEST;
+    /* Enough room for every test case in IPV4_TESTS and IPV6_TESTS, each
+     * followed by a trailing digit that isn't part of the address. */
+    char  strs[64][CORK_IP_STRING_LENGTH + 8];
+    struct cork_slice  slices[64];
+    const char  *expected[64];
+    struct cork_ip  addrs[64];
+    size_t  count = 0;
+    size_t  i;
+
+#define ADD(str, normalized) \
+    { \
+        size_t  len = strlen(str); \
+        memcpy(strs[count], str, len); \
+        strs[count][len] = '9'; \
+        cork_slice_init_static(&slices[count], strs[count], len); \
+        expected[count] = normalized; \
+        count++; \
+    }
+#define GOOD(str, normalized)  ADD(str, normalized)
+#define BAD(str, unused)  ADD(str, NULL)
+
+    IPV4_TESTS(GOOD, BAD);
+    IPV6_TESTS(GOOD, BAD);
+
+#undef ADD
+#undef GOOD
+#undef BAD
+
+    /* Parse each address separately... */
+    for (i = 0; i < count; i++) {
+        struct cork_ip  addr;
+        char  actual[CORK_IP_STRING_LENGTH];
+        if (expected[i] == NULL) {
+            fail_unless_error
+                (cork_ip_init_n(&addr, slices[i].buf, slices[i].size),
+                 "Shouldn't be able to initialize IP address from \"%.*s\"",
+                 (int) slices[i].size, (const char *) slices[i].buf);
+        } else {
+            fail_if_error(cork_ip_init_n
+                          (&addr, slices[i].buf, slices[i].size));
+            cork_ip_to_raw_string(&addr, actual);
+            fail_unless_streq("Address", expected[i], actual);
+        }
+    }
+
+    /* ...and all at once. */
+    fail_unless_error(cork_ip_init_slices(addrs, slices, count),
+                      "Should have found some invalid addresses");
+    for (i = 0; i < count; i++) {
+        if (expected[i] == NULL) {
+            fail_unless_equal("Version", "%u", 0, addrs[i].version);
+        } else {
+            char  actual[CORK_IP_STRING_LENGTH];
+            cork_ip_to_raw_string(&addrs[i], actual);
+            fail_unless_streq("Address", expected[i], actual);
+        }
+    }
+
+    /* A batch with only valid addresses doesn't produce an error. */
+    fail_if_error(cork_ip_init_slices(addrs, slices, 4));
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * Timestamps
@@ -779,6 +1495,88 @@ START_TEST(test_timestamp_format)
 }
 END_TEST
 
+static void
+test_timestamp_rfc3339(cork_timestamp ts, unsigned int frac_width,
+                       const char *expected)
+{
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    cork_buffer_append_timestamp_utc(&buf, ts, frac_width);
+    fail_unless_streq("Timestamps", expected, buf.buf);
+    cork_buffer_done(&buf);
+}
+
+START_TEST(test_timestamp_append)
+{
+    cork_timestamp  ts;
+    DESCRIBE_TEST;
+
+    cork_timestamp_init_sec(&ts, 0);
+    test_timestamp_rfc3339(ts, 0, "1970-01-01T00:00:00Z");
+    cork_timestamp_init_sec(&ts, 700000000);
+    test_timestamp_rfc3339(ts, 0, "1992-03-07T20:26:40Z");
+    cork_timestamp_init_sec(&ts, 951782400);
+    test_timestamp_rfc3339(ts, 0, "2000-02-29T00:00:00Z");
+    cork_timestamp_init_sec(&ts, 4294967295u);
+    test_timestamp_rfc3339(ts, 0, "2106-02-07T06:28:15Z");
+
+    /* Fractional seconds never round up into the next second */
+    cork_timestamp_init_nsec(&ts, 1305180745, 999999999);
+    test_timestamp_rfc3339(ts, 3, "2011-05-12T06:12:25.999Z");
+    cork_timestamp_init_nsec(&ts, 1305180745, 123456789);
+    test_timestamp_rfc3339(ts, 1, "2011-05-12T06:12:25.1Z");
+    test_timestamp_rfc3339(ts, 9, "2011-05-12T06:12:25.123456789Z");
+    test_timestamp_rfc3339(ts, 12, "2011-05-12T06:12:25.123456789Z");
+}
+END_TEST
+
+START_TEST(test_timestamp_clocks)
+{
+    DESCRIBE_TEST;
+    cork_timestamp  before;
+    cork_timestamp  after;
+    cork_timestamp  elapsed;
+    uint64_t  start_nsec;
+    uint64_t  start_cycles;
+    uint64_t  end_cycles;
+    uint64_t  elapsed_nsec;
+    uint64_t  cycles_nsec;
+    struct timespec  delay = { 0, 20000000 };
+
+    cork_timestamp_init_now(&before);
+    fail_unless(cork_timestamp_sec(before) > 1300000000,
+                "Current time is too early");
+
+    cork_timestamp_init_monotonic(&before);
+    cork_timestamp_init_monotonic_coarse(&after);
+    cork_timestamp_init_monotonic(&after);
+    fail_unless(after >= before, "Monotonic clock went backwards");
+
+    fail_unless(cork_cycles_per_sec() > 0, "Cycle counter doesn't tick");
+    start_nsec = cork_monotonic_nsec();
+    start_cycles = cork_cycles_now();
+    nanosleep(&delay, NULL);
+    end_cycles = cork_cycles_now();
+    elapsed_nsec = cork_monotonic_nsec() - start_nsec;
+    fail_unless(end_cycles > start_cycles, "Cycle counter went backwards");
+
+    /* The cycle counter should agree with the monotonic clock, give or take
+     * a few percent. */
+    cycles_nsec = cork_cycles_to_nsec(end_cycles - start_cycles);
+    fail_unless(cycles_nsec + elapsed_nsec / 20 >= elapsed_nsec &&
+                cycles_nsec <= elapsed_nsec + elapsed_nsec / 20,
+                "Cycle counter measured %" PRIu64 "ns instead of %" PRIu64
+                "ns", cycles_nsec, elapsed_nsec);
+    cork_timestamp_init_cycles(&elapsed, end_cycles - start_cycles);
+    fail_unless(cork_timestamp_sec(elapsed) == 0 &&
+                cork_timestamp_msec(elapsed) >= 20 &&
+                cork_timestamp_msec(elapsed) < 1000,
+                "Unexpected elapsed time %" PRIu64 "ms",
+                cork_timestamp_msec(elapsed));
+    cork_timestamp_init_cycles(&elapsed, 3 * cork_cycles_per_sec() + 1);
+    fail_unless_equal("Seconds", "%" PRIu32, 3, cork_timestamp_sec(elapsed));
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * 128-bit integers
@@ -907,6 +1705,43 @@ START_TEST(test_u128_print)
         "10000000000000000",
         "00000000000000010000000000000000"
     );
+    /* 10^19 and 10^38, on either side of the chunk boundaries */
+    test_one_u128_print_from_64(
+        0, UINT64_C(9999999999999999999),
+        "9999999999999999999",
+        "8ac7230489e7ffff",
+        "00000000000000008ac7230489e7ffff"
+    );
+    test_one_u128_print_from_64(
+        0, UINT64_C(10000000000000000000),
+        "10000000000000000000",
+        "8ac7230489e80000",
+        "00000000000000008ac7230489e80000"
+    );
+    test_one_u128_print_from_64(
+        UINT64_C(0x4b3b4ca85a86c47a), UINT64_C(0x098a223fffffffff),
+        "99999999999999999999999999999999999999",
+        "4b3b4ca85a86c47a098a223fffffffff",
+        "4b3b4ca85a86c47a098a223fffffffff"
+    );
+    test_one_u128_print_from_64(
+        UINT64_C(0x4b3b4ca85a86c47a), UINT64_C(0x098a224000000000),
+        "100000000000000000000000000000000000000",
+        "4b3b4ca85a86c47a098a224000000000",
+        "4b3b4ca85a86c47a098a224000000000"
+    );
+    test_one_u128_print_from_64(
+        UINT64_C(0x0000000000000005), UINT64_C(0x6bc75e2d63100000),
+        "100000000000000000000",
+        "56bc75e2d63100000",
+        "00000000000000056bc75e2d63100000"
+    );
+    test_one_u128_print_from_64(
+        UINT64_C(0xffffffffffffffff), UINT64_C(0xffffffffffffffff),
+        "340282366920938463463374607431768211455",
+        "ffffffffffffffffffffffffffffffff",
+        "ffffffffffffffffffffffffffffffff"
+    );
 }
 END_TEST
 
@@ -1073,6 +1908,43 @@ START_TEST(test_uid)
 END_TEST
 
 
+/*-----------------------------------------------------------------------
+ * Tracepoints
+ */
+
+cork_tracepoint(test_trace);
+
+static unsigned int  trace_argument_count = 0;
+
+static uint64_t
+trace_argument(void)
+{
+    trace_argument_count++;
+    return 1;
+}
+
+START_TEST(test_trace)
+{
+    DESCRIBE_TEST;
+    /* Nothing is attached to the tracepoint, so we shouldn't read the clock,
+     * or evaluate any of the tracepoint's arguments. */
+    uint64_t  start = cork_trace_start(test_trace);
+    fail_if(cork_trace_enabled(test_trace), "Tracepoint is enabled");
+    fail_unless_equal("Trace start", "%" PRIu64, (uint64_t) 0, start);
+    fail_unless_equal("Trace elapsed", "%" PRIu64,
+                      (uint64_t) 0, cork_trace_elapsed(start));
+    cork_trace1(test_trace, trace_argument());
+    cork_trace2(test_trace, trace_argument(), trace_argument());
+    cork_trace3(test_trace, trace_argument(), trace_argument(),
+                cork_trace_elapsed(start));
+    cork_trace4(test_trace, trace_argument(), trace_argument(),
+                trace_argument(), cork_trace_elapsed(start));
+    fail_unless_equal("Evaluated arguments", "%u",
+                      0, trace_argument_count);
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -1092,28 +1964,47 @@ test_suite()
     tcase_add_test(tc_string, test_string);
     suite_add_tcase(s, tc_string);
 
+    TCase  *tc_allocators = tcase_create("allocators");
+    tcase_add_test(tc_allocators, test_arena);
+    tcase_add_test(tc_allocators, test_slab_alloc);
+    tcase_add_test(tc_allocators, test_slab_alloc_threads);
+    tcase_add_test(tc_allocators, test_stats_alloc);
+    tcase_add_test(tc_allocators, test_stats_alloc_failures);
+    tcase_add_test(tc_allocators, test_page_alloc);
+    tcase_add_test(tc_allocators, test_aligned_alloc);
+    suite_add_tcase(s, tc_allocators);
+
     TCase  *tc_endianness = tcase_create("endianness");
     tcase_add_test(tc_endianness, test_endianness);
+    tcase_add_test(tc_endianness, test_endianness_unaligned);
+    tcase_add_test(tc_endianness, test_endianness_arrays);
     suite_add_tcase(s, tc_endianness);
 
     TCase  *tc_errors = tcase_create("errors");
     tcase_add_test(tc_errors, test_error_prefix);
     tcase_add_test(tc_errors, test_system_error);
+    tcase_add_test(tc_errors, test_static_error);
     suite_add_tcase(s, tc_errors);
 
     TCase  *tc_hash = tcase_create("hash");
     tcase_add_test(tc_hash, test_hash);
+    tcase_add_test(tc_hash, test_hash_fast);
+    tcase_add_test(tc_hash, test_hash_incremental);
+    tcase_add_test(tc_hash, test_hash_buffers);
     suite_add_tcase(s, tc_hash);
 
     TCase  *tc_addresses = tcase_create("net-addresses");
     tcase_add_test(tc_addresses, test_ipv4_address);
     tcase_add_test(tc_addresses, test_ipv6_address);
     tcase_add_test(tc_addresses, test_ip_address);
+    tcase_add_test(tc_addresses, test_ip_address_n);
     suite_add_tcase(s, tc_addresses);
 
     TCase  *tc_timestamp = tcase_create("timestamp");
     tcase_add_test(tc_timestamp, test_timestamp);
     tcase_add_test(tc_timestamp, test_timestamp_format);
+    tcase_add_test(tc_timestamp, test_timestamp_append);
+    tcase_add_test(tc_timestamp, test_timestamp_clocks);
     suite_add_tcase(s, tc_timestamp);
 
     TCase  *tc_u128 = tcase_create("u128");
@@ -1133,6 +2024,10 @@ test_suite()
     tcase_add_test(tc_uid, test_uid);
     suite_add_tcase(s, tc_uid);
 
+    TCase  *tc_trace = tcase_create("trace");
+    tcase_add_test(tc_trace, test_trace);
+    suite_add_tcase(s, tc_trace);
+
     return s;
 }
 
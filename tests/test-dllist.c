@@ -13,9 +13,12 @@
 
 #include <check.h>
 
+#include "libcork/core/allocator.h"
 #include "libcork/core/types.h"
 #include "libcork/ds/buffer.h"
+#include "libcork/ds/concurrent-list.h"
 #include "libcork/ds/dllist.h"
+#include "libcork/threads/basics.h"
 
 #include "helpers.h"
 
@@ -161,6 +164,343 @@ START_TEST(test_dllist_append)
 }
 END_TEST
 
+START_TEST(test_dllist_splice)
+{
+    struct cork_dllist  list1 = CORK_DLLIST_INIT(list1);
+    struct cork_dllist  list2 = CORK_DLLIST_INIT(list2);
+    struct int64_item  items[6];
+    size_t  i;
+
+    for (i = 0; i < 6; i++) {
+        items[i].value = i + 1;
+    }
+    cork_dllist_add_to_tail(&list1, &items[0].element);
+    cork_dllist_add_to_tail(&list1, &items[1].element);
+    cork_dllist_add_to_tail(&list1, &items[2].element);
+
+    /* Splicing an empty list doesn't change anything */
+    cork_dllist_splice_after(&items[1].element, &list2);
+    check_int64_list(&list1, "1,2,3");
+    check_int64_list(&list2, "");
+
+    cork_dllist_add_to_tail(&list2, &items[3].element);
+    cork_dllist_add_to_tail(&list2, &items[4].element);
+    cork_dllist_splice_after(&items[0].element, &list2);
+    check_int64_list(&list1, "1,4,5,2,3");
+    fail_unless(cork_dllist_is_empty(&list2), "Expected empty list");
+
+    cork_dllist_add_to_tail(&list2, &items[5].element);
+    cork_dllist_splice_before(&items[0].element, &list2);
+    check_int64_list(&list1, "6,1,4,5,2,3");
+    fail_unless(cork_dllist_is_empty(&list2), "Expected empty list");
+
+    /* Splicing before the sentinel appends to the list. */
+    cork_dllist_remove(&items[5].element);
+    cork_dllist_add_to_tail(&list2, &items[5].element);
+    cork_dllist_splice_before(&list1.head, &list2);
+    check_int64_list(&list1, "1,4,5,2,3,6");
+}
+END_TEST
+
+START_TEST(test_counted_dllist)
+{
+    struct cork_counted_dllist  list1 = CORK_COUNTED_DLLIST_INIT(list1);
+    struct cork_counted_dllist  list2;
+    struct int64_item  items[6];
+    size_t  i;
+
+    cork_counted_dllist_init(&list2);
+    for (i = 0; i < 6; i++) {
+        items[i].value = i + 1;
+    }
+    fail_unless(cork_counted_dllist_is_empty(&list1), "Expected empty list");
+    fail_unless_equal("List size", "%zu", (size_t) 0,
+                      cork_counted_dllist_size(&list1));
+
+    cork_counted_dllist_add(&list1, &items[0].element);
+    cork_counted_dllist_add_to_head(&list1, &items[1].element);
+    cork_counted_dllist_add_to_tail(&list1, &items[2].element);
+    cork_counted_dllist_add_after(&list1, &items[1].element,
+                                  &items[3].element);
+    cork_counted_dllist_add_before(&list1, &items[2].element,
+                                   &items[4].element);
+    check_int64_list(&list1.list, "2,4,1,5,3");
+    fail_unless_equal("List size", "%zu", (size_t) 5,
+                      cork_counted_dllist_size(&list1));
+    fail_unless_equal("List size", "%zu", cork_counted_dllist_size(&list1),
+                      cork_dllist_size(&list1.list));
+
+    cork_counted_dllist_remove(&list1, &items[3].element);
+    cork_counted_dllist_remove(&list1, &items[1].element);
+    check_int64_list(&list1.list, "1,5,3");
+    fail_unless_equal("List size", "%zu", (size_t) 3,
+                      cork_counted_dllist_size(&list1));
+
+    cork_counted_dllist_add(&list2, &items[1].element);
+    cork_counted_dllist_add(&list2, &items[3].element);
+    cork_counted_dllist_add_list_to_head(&list1, &list2);
+    check_int64_list(&list1.list, "2,4,1,5,3");
+    fail_unless_equal("List size", "%zu", (size_t) 5,
+                      cork_counted_dllist_size(&list1));
+    fail_unless(cork_counted_dllist_is_empty(&list2), "Expected empty list");
+    fail_unless(cork_dllist_is_empty(&list2.list), "Expected empty list");
+
+    cork_counted_dllist_remove(&list1, &items[1].element);
+    cork_counted_dllist_add(&list2, &items[1].element);
+    cork_counted_dllist_add(&list2, &items[5].element);
+    cork_counted_dllist_splice_after(&list1, &items[0].element, &list2);
+    check_int64_list(&list1.list, "4,1,2,6,5,3");
+    fail_unless_equal("List size", "%zu", (size_t) 6,
+                      cork_counted_dllist_size(&list1));
+
+    cork_counted_dllist_remove(&list1, &items[2].element);
+    cork_counted_dllist_add(&list2, &items[2].element);
+    cork_counted_dllist_splice_before(&list1, &items[3].element, &list2);
+    check_int64_list(&list1.list, "3,4,1,2,6,5");
+
+    cork_counted_dllist_remove(&list1, &items[4].element);
+    cork_counted_dllist_add(&list2, &items[4].element);
+    cork_counted_dllist_add_list_to_tail(&list1, &list2);
+    check_int64_list(&list1.list, "3,4,1,2,6,5");
+    fail_unless_equal("List size", "%zu", (size_t) 6,
+                      cork_counted_dllist_size(&list1));
+    fail_unless_equal("List size", "%zu", (size_t) 0,
+                      cork_counted_dllist_size(&list2));
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Concurrent stacks and queues
+ */
+
+#define CONCURRENT_THREAD_COUNT  4
+#define CONCURRENT_ITEM_COUNT  10000
+
+struct test_stack_item {
+    size_t  value;
+    struct cork_stack_item  item;
+};
+
+START_TEST(test_stack)
+{
+    struct cork_stack  stack = CORK_STACK_INIT;
+    struct test_stack_item  items[3];
+    struct cork_stack_item  *curr;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    fail_unless(cork_stack_is_empty(&stack), "Stack should be empty");
+    fail_unless(cork_stack_pop(&stack) == NULL, "Stack should be empty");
+    fail_unless(cork_stack_pop_all(&stack) == NULL, "Stack should be empty");
+
+    for (i = 0; i < 3; i++) {
+        items[i].value = i;
+        cork_stack_push(&stack, &items[i].item);
+    }
+    fail_if(cork_stack_is_empty(&stack), "Stack shouldn't be empty");
+    for (i = 3; i > 0; i--) {
+        curr = cork_stack_pop(&stack);
+        fail_if(curr == NULL, "Stack shouldn't be empty");
+        fail_unless_equal("Popped value", "%zu", i - 1,
+                          cork_container_of(curr, struct test_stack_item,
+                                            item)->value);
+    }
+    fail_unless(cork_stack_pop(&stack) == NULL, "Stack should be empty");
+
+    for (i = 0; i < 3; i++) {
+        cork_stack_push(&stack, &items[i].item);
+    }
+    curr = cork_stack_pop_all(&stack);
+    fail_unless(cork_stack_is_empty(&stack), "Stack should be empty");
+    for (i = 3; i > 0; i--) {
+        fail_if(curr == NULL, "Popped list is too short");
+        fail_unless_equal("Popped value", "%zu", i - 1,
+                          cork_container_of(curr, struct test_stack_item,
+                                            item)->value);
+        curr = curr->next;
+    }
+    fail_unless(curr == NULL, "Popped list is too long");
+    cork_stack_done(&stack);
+}
+END_TEST
+
+/* Each thread repeatedly pops an item and pushes it back, which gives the ABA
+ * problem lots of chances to show up. */
+static int
+test_stack_churn(void *user_data)
+{
+    struct cork_stack  *stack = user_data;
+    size_t  i;
+    for (i = 0; i < CONCURRENT_ITEM_COUNT; i++) {
+        struct cork_stack_item  *curr = cork_stack_pop(stack);
+        if (curr != NULL) {
+            struct test_stack_item  *item =
+                cork_container_of(curr, struct test_stack_item, item);
+            item->value++;
+            cork_stack_push(stack, curr);
+        }
+    }
+    return 0;
+}
+
+START_TEST(test_stack_threaded)
+{
+#define STACK_SIZE  16
+    struct cork_stack  stack;
+    struct test_stack_item  items[STACK_SIZE];
+    struct cork_thread  *threads[CONCURRENT_THREAD_COUNT];
+    struct cork_stack_item  *curr;
+    bool  seen[STACK_SIZE] = { false };
+    size_t  total = 0;
+    size_t  count = 0;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    cork_stack_init(&stack);
+    for (i = 0; i < STACK_SIZE; i++) {
+        items[i].value = 0;
+        cork_stack_push(&stack, &items[i].item);
+    }
+    for (i = 0; i < CONCURRENT_THREAD_COUNT; i++) {
+        fail_if_error(threads[i] = cork_thread_new
+                      ("stack", &stack, NULL, test_stack_churn));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    for (i = 0; i < CONCURRENT_THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+
+    /* Every item should still be on the stack exactly once, and every pop
+     * should have found an item, since there are more items than threads. */
+    while ((curr = cork_stack_pop(&stack)) != NULL) {
+        struct test_stack_item  *item =
+            cork_container_of(curr, struct test_stack_item, item);
+        size_t  index = item - items;
+        fail_if(seen[index], "Item %zu is on the stack twice", index);
+        seen[index] = true;
+        total += item->value;
+        count++;
+    }
+    fail_unless_equal("Stack size", "%zu", (size_t) STACK_SIZE, count);
+    fail_unless_equal("Pop count", "%zu",
+                      (size_t) CONCURRENT_THREAD_COUNT * CONCURRENT_ITEM_COUNT,
+                      total);
+    cork_stack_done(&stack);
+#undef STACK_SIZE
+}
+END_TEST
+
+struct test_mpsc_item {
+    size_t  producer;
+    size_t  value;
+    struct cork_mpsc_item  item;
+};
+
+struct test_mpsc_producer {
+    size_t  index;
+    struct cork_mpsc_queue  *queue;
+    struct test_mpsc_item  *items;
+};
+
+static int
+test_mpsc_produce(void *user_data)
+{
+    struct test_mpsc_producer  *producer = user_data;
+    size_t  i;
+    for (i = 0; i < CONCURRENT_ITEM_COUNT; i++) {
+        producer->items[i].producer = producer->index;
+        producer->items[i].value = i;
+        cork_mpsc_queue_push(producer->queue, &producer->items[i].item);
+    }
+    return 0;
+}
+
+START_TEST(test_mpsc_queue)
+{
+    struct cork_mpsc_queue  queue;
+    struct test_mpsc_item  items[3];
+    struct cork_mpsc_item  *curr;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    cork_mpsc_queue_init(&queue);
+    fail_unless(cork_mpsc_queue_is_empty(&queue), "Queue should be empty");
+    fail_unless(cork_mpsc_queue_pop(&queue) == NULL, "Queue should be empty");
+
+    /* Interleave pushes and pops so that the stub moves around. */
+    for (i = 0; i < 3; i++) {
+        items[i].value = i;
+        cork_mpsc_queue_push(&queue, &items[i].item);
+    }
+    fail_if(cork_mpsc_queue_is_empty(&queue), "Queue shouldn't be empty");
+    for (i = 0; i < 3; i++) {
+        curr = cork_mpsc_queue_pop(&queue);
+        fail_if(curr == NULL, "Queue shouldn't be empty");
+        fail_unless_equal("Popped value", "%zu", i,
+                          cork_container_of(curr, struct test_mpsc_item,
+                                            item)->value);
+        cork_mpsc_queue_push(&queue, curr);
+    }
+    for (i = 0; i < 3; i++) {
+        curr = cork_mpsc_queue_pop(&queue);
+        fail_if(curr == NULL, "Queue shouldn't be empty");
+        fail_unless_equal("Popped value", "%zu", i,
+                          cork_container_of(curr, struct test_mpsc_item,
+                                            item)->value);
+    }
+    fail_unless(cork_mpsc_queue_is_empty(&queue), "Queue should be empty");
+    fail_unless(cork_mpsc_queue_pop(&queue) == NULL, "Queue should be empty");
+    cork_mpsc_queue_done(&queue);
+}
+END_TEST
+
+START_TEST(test_mpsc_queue_threaded)
+{
+    struct cork_mpsc_queue  queue;
+    struct test_mpsc_producer  producers[CONCURRENT_THREAD_COUNT];
+    struct cork_thread  *threads[CONCURRENT_THREAD_COUNT];
+    size_t  next_values[CONCURRENT_THREAD_COUNT] = { 0 };
+    size_t  received = 0;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    cork_mpsc_queue_init(&queue);
+    for (i = 0; i < CONCURRENT_THREAD_COUNT; i++) {
+        producers[i].index = i;
+        producers[i].queue = &queue;
+        producers[i].items = cork_calloc
+            (CONCURRENT_ITEM_COUNT, sizeof(struct test_mpsc_item));
+        fail_if_error(threads[i] = cork_thread_new
+                      ("producer", &producers[i], NULL, test_mpsc_produce));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+
+    /* Items from each producer should arrive in the order they were pushed. */
+    while (received < CONCURRENT_THREAD_COUNT * CONCURRENT_ITEM_COUNT) {
+        struct cork_mpsc_item  *curr = cork_mpsc_queue_pop(&queue);
+        struct test_mpsc_item  *item;
+        if (curr == NULL) {
+            cork_pause();
+            continue;
+        }
+        item = cork_container_of(curr, struct test_mpsc_item, item);
+        fail_unless_equal("Next value", "%zu",
+                          next_values[item->producer], item->value);
+        next_values[item->producer]++;
+        received++;
+    }
+    fail_unless(cork_mpsc_queue_pop(&queue) == NULL, "Queue should be empty");
+
+    for (i = 0; i < CONCURRENT_THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+        cork_cfree(producers[i].items, CONCURRENT_ITEM_COUNT,
+                   sizeof(struct test_mpsc_item));
+    }
+    cork_mpsc_queue_done(&queue);
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * Testing harness
@@ -174,8 +514,18 @@ test_suite()
     TCase  *tc_ds = tcase_create("dllist");
     tcase_add_test(tc_ds, test_dllist);
     tcase_add_test(tc_ds, test_dllist_append);
+    tcase_add_test(tc_ds, test_dllist_splice);
+    tcase_add_test(tc_ds, test_counted_dllist);
     suite_add_tcase(s, tc_ds);
 
+    TCase  *tc_concurrent = tcase_create("concurrent");
+    tcase_set_timeout(tc_concurrent, 20.0);
+    tcase_add_test(tc_concurrent, test_stack);
+    tcase_add_test(tc_concurrent, test_stack_threaded);
+    tcase_add_test(tc_concurrent, test_mpsc_queue);
+    tcase_add_test(tc_concurrent, test_mpsc_queue_threaded);
+    suite_add_tcase(s, tc_concurrent);
+
     return s;
 }
 
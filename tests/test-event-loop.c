@@ -0,0 +1,457 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include "libcork/core.h"
+#include "libcork/ds.h"
+#include "libcork/os.h"
+#include "libcork/threads.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Helpers
+ */
+
+struct test_pipe {
+    struct cork_loop_fd  watch;
+    int  fds[2];
+    unsigned int  fired;
+    unsigned int  last_events;
+    /* If non-NULL, removed from the loop the first time this pipe fires */
+    struct test_pipe  *victim;
+    bool  fail;
+};
+
+static int
+test_pipe__ready(struct cork_event_loop *loop, struct cork_loop_fd *watch,
+                 unsigned int events)
+{
+    struct test_pipe  *p = cork_container_of(watch, struct test_pipe, watch);
+    p->fired++;
+    p->last_events = events;
+    if (p->victim != NULL) {
+        fail_if_error(cork_event_loop_remove_fd(loop, &p->victim->watch));
+        p->victim = NULL;
+    }
+    if (p->fail) {
+        cork_error_set_printf(EINVAL, "Pipe failed");
+        return -1;
+    }
+    return 0;
+}
+
+static void
+test_pipe_init(struct test_pipe *p)
+{
+    fail_if(pipe(p->fds) == -1, "Cannot create pipe");
+    cork_loop_fd_init(&p->watch, p->fds[0], test_pipe__ready);
+    p->fired = 0;
+    p->last_events = 0;
+    p->victim = NULL;
+    p->fail = false;
+}
+
+static void
+test_pipe_done(struct test_pipe *p)
+{
+    if (p->fds[0] != -1) {
+        close(p->fds[0]);
+    }
+    if (p->fds[1] != -1) {
+        close(p->fds[1]);
+    }
+}
+
+static void
+test_pipe_write(struct test_pipe *p)
+{
+    fail_unless(write(p->fds[1], "x", 1) == 1, "Cannot write to pipe");
+}
+
+static void
+test_pipe_read(struct test_pipe *p)
+{
+    char  c;
+    fail_unless(read(p->fds[0], &c, 1) == 1, "Cannot read from pipe");
+}
+
+static struct cork_event_loop *
+test_loop_new(void)
+{
+    struct cork_event_loop  *loop;
+    fail_if_error(loop = cork_event_loop_new());
+    return loop;
+}
+
+
+/*-----------------------------------------------------------------------
+ * File descriptors
+ */
+
+START_TEST(test_event_loop_fds)
+{
+    struct cork_event_loop  *loop = test_loop_new();
+    struct test_pipe  p1;
+    struct test_pipe  p2;
+
+    DESCRIBE_TEST;
+    test_pipe_init(&p1);
+    test_pipe_init(&p2);
+    fail_if_error(cork_event_loop_add_fd
+                  (loop, &p1.watch, CORK_LOOP_READABLE));
+    fail_if_error(cork_event_loop_add_fd
+                  (loop, &p2.watch, CORK_LOOP_READABLE));
+
+    /* Nothing is ready yet */
+    fail_if_error(cork_event_loop_run_once(loop, 0));
+    fail_unless_equal("Fire count", "%u", 0, p1.fired);
+
+    /* Watches are level-triggered */
+    test_pipe_write(&p1);
+    fail_if_error(cork_event_loop_run_once(loop, 1000));
+    fail_unless_equal("Fire count", "%u", 1, p1.fired);
+    fail_unless_equal("Fire count", "%u", 0, p2.fired);
+    fail_unless(p1.last_events & CORK_LOOP_READABLE,
+                "Pipe should be readable");
+    fail_if_error(cork_event_loop_run_once(loop, 1000));
+    fail_unless_equal("Fire count", "%u", 2, p1.fired);
+    test_pipe_read(&p1);
+    fail_if_error(cork_event_loop_run_once(loop, 0));
+    fail_unless_equal("Fire count", "%u", 2, p1.fired);
+
+    /* Removed watches, and watches that aren't waiting for anything, don't
+     * fire. */
+    test_pipe_write(&p1);
+    fail_if_error(cork_event_loop_modify_fd(loop, &p1.watch, 0));
+    fail_if_error(cork_event_loop_run_once(loop, 0));
+    fail_unless_equal("Fire count", "%u", 2, p1.fired);
+    fail_if_error(cork_event_loop_remove_fd(loop, &p1.watch));
+    fail_if_error(cork_event_loop_run_once(loop, 0));
+    fail_unless_equal("Fire count", "%u", 2, p1.fired);
+    fail_if_error(cork_event_loop_add_fd(loop, &p1.watch, 0));
+    fail_if_error(cork_event_loop_modify_fd
+                  (loop, &p1.watch, CORK_LOOP_READABLE));
+    fail_if_error(cork_event_loop_run_once(loop, 1000));
+    fail_unless_equal("Fire count", "%u", 3, p1.fired);
+
+    /* Removing a watch from another watch's callback in the same batch */
+    test_pipe_write(&p2);
+    p1.victim = &p2;
+    p2.victim = &p1;
+    fail_if_error(cork_event_loop_run_once(loop, 1000));
+    fail_unless_equal("Fire count", "%u", 4, p1.fired + p2.fired);
+    if (p1.watch.events != 0) {
+        fail_if_error(cork_event_loop_remove_fd(loop, &p1.watch));
+    }
+    if (p2.watch.events != 0) {
+        fail_if_error(cork_event_loop_remove_fd(loop, &p2.watch));
+    }
+    test_pipe_done(&p2);
+
+    /* A hung-up pipe */
+    test_pipe_init(&p2);
+    fail_if_error(cork_event_loop_add_fd
+                  (loop, &p2.watch, CORK_LOOP_READABLE));
+    close(p2.fds[1]);
+    p2.fds[1] = -1;
+    fail_if_error(cork_event_loop_run_once(loop, 1000));
+    fail_unless_equal("Fire count", "%u", 1, p2.fired);
+    fail_unless(p2.last_events & CORK_LOOP_HANGUP, "Pipe should be hung up");
+
+    /* A failing callback */
+    p2.fail = true;
+    fail_unless_error(cork_event_loop_run_once(loop, 1000), "Pipe failed");
+    fail_if_error(cork_event_loop_remove_fd(loop, &p2.watch));
+
+    cork_event_loop_free(loop);
+    test_pipe_done(&p1);
+    test_pipe_done(&p2);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Timers
+ */
+
+struct test_timer {
+    struct cork_loop_timer  timer;
+    unsigned int  fired;
+    cork_timestamp  fired_at;
+    unsigned int  repeat;
+    bool  fail;
+};
+
+static int
+test_timer__fire(struct cork_event_loop *loop, struct cork_loop_timer *timer)
+{
+    struct test_timer  *t = cork_container_of(timer, struct test_timer, timer);
+    t->fired++;
+    t->fired_at = cork_event_loop_now(loop);
+    fail_unless(t->fired_at >= t->timer.timer.expires, "Timer fired early");
+    if (t->fired < t->repeat) {
+        cork_timestamp  delay;
+        cork_timestamp_init_msec(&delay, 0, 1);
+        cork_event_loop_schedule_after(loop, timer, delay);
+    }
+    if (t->fail) {
+        cork_error_set_printf(EINVAL, "Timer failed");
+        return -1;
+    }
+    return 0;
+}
+
+static void
+test_timer_init(struct test_timer *t)
+{
+    cork_loop_timer_init(&t->timer, test_timer__fire);
+    t->fired = 0;
+    t->fired_at = 0;
+    t->repeat = 1;
+    t->fail = false;
+}
+
+START_TEST(test_event_loop_timers)
+{
+    struct cork_event_loop  *loop = test_loop_new();
+    struct test_timer  t1;
+    struct test_timer  t2;
+    struct test_timer  t3;
+    cork_timestamp  delay;
+
+    DESCRIBE_TEST;
+    test_timer_init(&t1);
+    test_timer_init(&t2);
+    test_timer_init(&t3);
+
+    /* The loop sleeps until the next timer */
+    cork_timestamp_init_msec(&delay, 0, 20);
+    cork_event_loop_schedule_after(loop, &t1.timer, delay);
+    cork_timestamp_init_msec(&delay, 0, 10);
+    cork_event_loop_schedule_after(loop, &t2.timer, delay);
+    cork_timestamp_init_sec(&delay, 100);
+    cork_event_loop_schedule_after(loop, &t3.timer, delay);
+    while (t1.fired == 0) {
+        fail_if_error(cork_event_loop_run_once(loop, -1));
+    }
+    fail_unless_equal("Fire count", "%u", 1, t2.fired);
+    fail_unless(t2.fired_at <= t1.fired_at, "Timers fired out of order");
+    fail_unless(cork_event_loop_cancel(loop, &t3.timer),
+                "Couldn't cancel timer");
+    fail_unless_equal("Fire count", "%u", 0, t3.fired);
+
+    /* A timer that reschedules itself */
+    t1.fired = 0;
+    t1.repeat = 5;
+    cork_event_loop_schedule(loop, &t1.timer, 0);
+    while (t1.fired < 5) {
+        fail_if_error(cork_event_loop_run_once(loop, -1));
+    }
+    fail_if(cork_loop_timer_is_scheduled(&t1.timer),
+            "Timer should be finished");
+
+    /* A failing timer leaves the rest of the batch for next time */
+    t1.fired = 0;
+    t1.repeat = 1;
+    t1.fail = true;
+    t2.fired = 0;
+    t2.fail = true;
+    cork_event_loop_schedule(loop, &t1.timer, 0);
+    cork_event_loop_schedule(loop, &t2.timer, 0);
+    fail_unless_error(cork_event_loop_run_once(loop, -1), "Timer failed");
+    fail_unless_equal("Fire count", "%u", 1, t1.fired + t2.fired);
+    fail_unless_error(cork_event_loop_run_once(loop, -1), "Timer failed");
+    fail_unless_equal("Fire count", "%u", 2, t1.fired + t2.fired);
+
+    /* Freeing the loop cancels any remaining timers */
+    cork_event_loop_schedule_after(loop, &t3.timer, delay);
+    cork_event_loop_free(loop);
+    fail_if(cork_loop_timer_is_scheduled(&t3.timer),
+            "Timer should be cancelled");
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Tasks
+ */
+
+struct test_task_state {
+    struct cork_event_loop  *loop;
+    size_t  run_count;
+    size_t  free_count;
+    size_t  stop_after;
+};
+
+static int
+test_task__run(void *user_data)
+{
+    struct test_task_state  *state = user_data;
+    state->run_count++;
+    if (state->run_count == state->stop_after) {
+        cork_event_loop_stop(state->loop);
+    }
+    return 0;
+}
+
+static int
+test_task__fail(void *user_data)
+{
+    struct test_task_state  *state = user_data;
+    state->run_count++;
+    cork_error_set_printf(EINVAL, "Task failed");
+    return -1;
+}
+
+static void
+test_task__free(void *user_data)
+{
+    struct test_task_state  *state = user_data;
+    state->free_count++;
+}
+
+#define THREAD_COUNT  4
+#define TASKS_PER_THREAD  1000
+
+static int
+test_poster__run(void *user_data)
+{
+    struct test_task_state  *state = user_data;
+    size_t  i;
+    for (i = 0; i < TASKS_PER_THREAD; i++) {
+        cork_event_loop_post
+            (state->loop, state, test_task__free, test_task__run);
+    }
+    return 0;
+}
+
+START_TEST(test_event_loop_tasks)
+{
+    struct cork_event_loop  *loop = test_loop_new();
+    struct test_task_state  state;
+    struct cork_thread  *threads[THREAD_COUNT];
+    size_t  i;
+
+    DESCRIBE_TEST;
+    state.loop = loop;
+    state.run_count = 0;
+    state.free_count = 0;
+    state.stop_after = 0;
+
+    /* Tasks run in the next batch */
+    cork_event_loop_post(loop, &state, test_task__free, test_task__run);
+    cork_event_loop_post(loop, &state, test_task__free, test_task__run);
+    fail_if_error(cork_event_loop_run_once(loop, -1));
+    fail_unless_equal("Run count", "%zu", (size_t) 2, state.run_count);
+    fail_unless_equal("Free count", "%zu", (size_t) 2, state.free_count);
+
+    /* A failing task leaves the rest for next time */
+    cork_event_loop_post(loop, &state, test_task__free, test_task__fail);
+    cork_event_loop_post(loop, &state, test_task__free, test_task__run);
+    fail_unless_error(cork_event_loop_run_once(loop, -1), "Task failed");
+    fail_unless_equal("Run count", "%zu", (size_t) 3, state.run_count);
+    fail_if_error(cork_event_loop_run_once(loop, -1));
+    fail_unless_equal("Run count", "%zu", (size_t) 4, state.run_count);
+
+    /* Other threads can post tasks, and wake up the loop */
+    state.run_count = 0;
+    state.stop_after = THREAD_COUNT * TASKS_PER_THREAD;
+    for (i = 0; i < THREAD_COUNT; i++) {
+        fail_if_error(threads[i] = cork_thread_new
+                      ("poster", &state, NULL, test_poster__run));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    fail_if_error(cork_event_loop_run(loop));
+    for (i = 0; i < THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+    fail_unless_equal("Run count", "%zu",
+                      (size_t) THREAD_COUNT * TASKS_PER_THREAD,
+                      state.run_count);
+
+    /* Freeing the loop frees pending tasks without running them */
+    state.run_count = 0;
+    state.free_count = 0;
+    cork_event_loop_post(loop, &state, test_task__free, test_task__run);
+    cork_event_loop_free(loop);
+    fail_unless_equal("Run count", "%zu", (size_t) 0, state.run_count);
+    fail_unless_equal("Free count", "%zu", (size_t) 1, state.free_count);
+}
+END_TEST
+
+static int
+test_stopper__run(void *user_data)
+{
+    struct cork_event_loop  *loop = user_data;
+    usleep(10000);
+    cork_event_loop_stop(loop);
+    return 0;
+}
+
+START_TEST(test_event_loop_stop)
+{
+    struct cork_event_loop  *loop = test_loop_new();
+    struct cork_thread  *thread;
+
+    DESCRIBE_TEST;
+    /* Stopping from another thread wakes up a loop that has nothing else to
+     * wait for. */
+    fail_if_error(thread = cork_thread_new
+                  ("stopper", loop, NULL, test_stopper__run));
+    fail_if_error(cork_thread_start(thread));
+    fail_if_error(cork_event_loop_run(loop));
+    fail_if_error(cork_thread_join(thread));
+    cork_event_loop_free(loop);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("event-loop");
+
+    TCase  *tc_event_loop = tcase_create("event-loop");
+    tcase_add_test(tc_event_loop, test_event_loop_fds);
+    tcase_add_test(tc_event_loop, test_event_loop_timers);
+    tcase_add_test(tc_event_loop, test_event_loop_tasks);
+    tcase_add_test(tc_event_loop, test_event_loop_stop);
+    suite_add_tcase(s, tc_event_loop);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    setup_allocator();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
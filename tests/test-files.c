@@ -11,12 +11,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <check.h>
 
+#include "libcork/config.h"
 #include "libcork/core/types.h"
 #include "libcork/ds/buffer.h"
 #include "libcork/os/files.h"
+#include "libcork/threads/pool.h"
 
 #include "helpers.h"
 
@@ -35,6 +39,16 @@ verify_path_content(struct cork_path *path, const char *expected)
     fail_unless_streq("Paths", expected, cork_path_get(path));
 }
 
+void
+verify_slice_content(const struct cork_slice *slice, const char *expected)
+{
+    size_t  expected_size = strlen(expected);
+    fail_unless(slice->size == expected_size &&
+                memcmp(slice->buf, expected, expected_size) == 0,
+                "Paths don't match (expected \"%s\", got \"%.*s\")",
+                expected, (int) slice->size, (const char *) slice->buf);
+}
+
 void
 test_path(const char *p, const char *expected)
 {
@@ -76,6 +90,7 @@ test_join(const char *p1, const char *p2, const char *expected)
     struct cork_path  *path1;
     struct cork_path  *path2;
     struct cork_path  *actual;
+    struct cork_path_builder  builder;
 
     fprintf(stderr, "join(\"%s\", \"%s\") ?= \"%s\"\n",
             (p1 == NULL)? "": p1,
@@ -104,6 +119,12 @@ test_join(const char *p1, const char *p2, const char *expected)
     verify_path_content(actual, expected);
     cork_path_free(actual);
 
+    /* Try cork_path_builder_push */
+    cork_path_builder_init(&builder, p1);
+    cork_path_builder_push(&builder, p2);
+    fail_unless_streq("Paths", expected, cork_path_builder_get(&builder));
+    cork_path_builder_done(&builder);
+
     /* Try cork_path_append_path */
     actual = cork_path_new(p1);
     path2 = cork_path_new(p2);
@@ -141,6 +162,8 @@ test_basename(const char *p, const char *expected)
 {
     struct cork_path  *path;
     struct cork_path  *actual;
+    struct cork_path_builder  builder;
+    struct cork_slice  slice;
 
     fprintf(stderr, "basename(\"%s\") ?= \"%s\"\n",
             (p == NULL)? "": p,
@@ -158,6 +181,18 @@ test_basename(const char *p, const char *expected)
     cork_path_set_basename(actual);
     verify_path_content(actual, expected);
     cork_path_free(actual);
+
+    /* Try cork_path_basename_slice */
+    path = cork_path_new(p);
+    cork_path_basename_slice(path, &slice);
+    verify_slice_content(&slice, expected);
+    cork_path_free(path);
+
+    /* Try cork_path_builder_basename_slice */
+    cork_path_builder_init(&builder, p);
+    cork_path_builder_basename_slice(&builder, &slice);
+    verify_slice_content(&slice, expected);
+    cork_path_builder_done(&builder);
 }
 
 START_TEST(test_path_basename_01)
@@ -184,6 +219,8 @@ test_dirname(const char *p, const char *expected)
 {
     struct cork_path  *path;
     struct cork_path  *actual;
+    struct cork_path_builder  builder;
+    struct cork_slice  slice;
 
     fprintf(stderr, "dirname(\"%s\") ?= \"%s\"\n",
             (p == NULL)? "": p,
@@ -201,6 +238,18 @@ test_dirname(const char *p, const char *expected)
     cork_path_set_dirname(actual);
     verify_path_content(actual, expected);
     cork_path_free(actual);
+
+    /* Try cork_path_dirname_slice */
+    path = cork_path_new(p);
+    cork_path_dirname_slice(path, &slice);
+    verify_slice_content(&slice, expected);
+    cork_path_free(path);
+
+    /* Try cork_path_builder_dirname_slice */
+    cork_path_builder_init(&builder, p);
+    cork_path_builder_dirname_slice(&builder, &slice);
+    verify_slice_content(&slice, expected);
+    cork_path_builder_done(&builder);
 }
 
 START_TEST(test_path_dirname_01)
@@ -223,6 +272,46 @@ START_TEST(test_path_dirname_01)
 END_TEST
 
 
+START_TEST(test_path_builder_01)
+{
+    struct cork_path_builder  builder;
+    struct cork_buffer  expected = CORK_BUFFER_INIT();
+    struct cork_path  *path;
+    size_t  marks[100];
+    size_t  i;
+
+    DESCRIBE_TEST;
+    cork_path_builder_init(&builder, "/a");
+    fail_unless_equal("Mark", "%zu", (size_t) 2,
+                      cork_path_builder_push(&builder, "b"));
+    fail_unless_streq("Paths", "/a/b", cork_path_builder_get(&builder));
+    cork_path_builder_push_n(&builder, "cdef", 2);
+    fail_unless_streq("Paths", "/a/b/cd", cork_path_builder_get(&builder));
+    cork_path_builder_restore(&builder, 2);
+    fail_unless_streq("Paths", "/a", cork_path_builder_get(&builder));
+
+    /* Push enough components that the builder has to move its content out
+     * of its inline buffer, and then pop them all back off again. */
+    cork_buffer_set_string(&expected, "/a");
+    for (i = 0; i < 100; i++) {
+        marks[i] = cork_path_builder_push(&builder, "component");
+        cork_buffer_append_string(&expected, "/component");
+    }
+    fail_unless_streq("Paths", expected.buf, cork_path_builder_get(&builder));
+    path = cork_path_builder_to_path(&builder);
+    verify_path_content(path, expected.buf);
+    cork_path_free(path);
+    for (i = 100; i > 0; i--) {
+        cork_path_builder_restore(&builder, marks[i - 1]);
+    }
+    fail_unless_streq("Paths", "/a", cork_path_builder_get(&builder));
+
+    cork_path_builder_done(&builder);
+    cork_buffer_done(&expected);
+}
+END_TEST
+
+
 void
 test_relative_child(const char *p, const char *f, const char *expected)
 {
@@ -371,6 +460,472 @@ START_TEST(test_file_exists_01)
 END_TEST
 
 
+static void
+touch_file(const char *path)
+{
+    FILE  *fp = fopen(path, "w");
+    fail_if(fp == NULL, "Cannot create %s", path);
+    fclose(fp);
+}
+
+static void
+test_file_type(struct cork_file *file, enum cork_file_type expected)
+{
+    enum cork_file_type  actual;
+    fail_if_error(cork_file_type(file, &actual));
+    fail_unless_equal("File type", "%d", (int) expected, (int) actual);
+}
+
+START_TEST(test_file_cache_01)
+{
+    char  dir[] = "/tmp/cork-test-files-XXXXXX";
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_file_cache  *cache;
+    struct cork_file  *file;
+    struct cork_file  *subdir;
+    struct cork_path_list  *list;
+    struct cork_file_list  *files;
+
+    DESCRIBE_TEST;
+    fail_if(mkdtemp(dir) == NULL, "Cannot create temporary directory");
+    cache = cork_file_cache_new();
+
+    /* Files are shared, and their metadata is cached until it's
+     * invalidated. */
+    cork_buffer_printf(&buf, "%s/a", dir);
+    file = cork_file_cache_get(cache, buf.buf);
+    fail_unless(cork_file_cache_get(cache, buf.buf) == file,
+                "Cache should return the same file for the same path");
+    test_file_type(file, CORK_FILE_MISSING);
+    touch_file(buf.buf);
+    test_file_type(file, CORK_FILE_MISSING);
+    cork_file_cache_invalidate(cache, buf.buf);
+    test_file_type(file, CORK_FILE_REGULAR);
+
+    /* mkdir and remove keep the cache up to date. */
+    cork_buffer_printf(&buf, "%s/b", dir);
+    subdir = cork_file_cache_get(cache, buf.buf);
+    test_file_type(subdir, CORK_FILE_MISSING);
+    fail_if_error(cork_file_mkdir(subdir, 0755, 0));
+    test_file_type(subdir, CORK_FILE_DIRECTORY);
+    cork_buffer_printf(&buf, "%s/b/c", dir);
+    touch_file(buf.buf);
+
+    /* The first directory doesn't contain c, but the second one does. */
+    cork_buffer_printf(&buf, "%s:%s/b", dir, dir);
+    list = cork_path_list_new(buf.buf);
+    fail_if_error(file = cork_file_cache_find_file(cache, list, "c"));
+    cork_buffer_printf(&buf, "%s/b/c", dir);
+    fail_unless_streq("Found file", buf.buf,
+                      cork_path_get(cork_file_path(file)));
+    fail_unless(cork_file_cache_get(cache, buf.buf) == file,
+                "Cache should own the file that it found");
+    fail_unless_error(cork_file_cache_find_file(cache, list, "d"),
+                      "Shouldn't be able to find a missing file");
+
+    files = cork_file_list_new(list);
+    fail_if_error(cork_file_list_stat(files));
+    test_file_type(cork_file_list_get(files, 0), CORK_FILE_DIRECTORY);
+    test_file_type(cork_file_list_get(files, 1), CORK_FILE_DIRECTORY);
+    cork_file_list_free(files);
+    cork_path_list_free(list);
+
+    fail_if_error(cork_file_remove(subdir, CORK_FILE_RECURSIVE));
+    test_file_type(subdir, CORK_FILE_MISSING);
+    cork_file_cache_invalidate_all(cache);
+    test_file_type(file, CORK_FILE_MISSING);
+
+    cork_buffer_printf(&buf, "%s", dir);
+    fail_if_error(cork_file_remove
+                  (cork_file_cache_get(cache, buf.buf), CORK_FILE_RECURSIVE));
+    cork_file_cache_free(cache);
+    cork_buffer_done(&buf);
+}
+END_TEST
+
+static void
+write_file(struct cork_buffer *path, const char *dir, const char *name,
+           const char *content)
+{
+    FILE  *fp;
+    cork_buffer_printf(path, "%s/%s", dir, name);
+    fp = fopen(path->buf, "w");
+    fail_if(fp == NULL, "Cannot create %s", (char *) path->buf);
+    fputs(content, fp);
+    fclose(fp);
+}
+
+static void
+test_file_content(const char *dir, const char *name, const char *expected)
+{
+    struct cork_buffer  path = CORK_BUFFER_INIT();
+    char  actual[64];
+    size_t  size;
+    FILE  *fp;
+    cork_buffer_printf(&path, "%s/%s", dir, name);
+    fp = fopen(path.buf, "r");
+    fail_if(fp == NULL, "Cannot open %s", (char *) path.buf);
+    size = fread(actual, 1, sizeof(actual) - 1, fp);
+    actual[size] = '\0';
+    fclose(fp);
+    fail_unless_streq("File content", expected, actual);
+    cork_buffer_done(&path);
+}
+
+static void
+test_copied_tree(const char *dir, const char *name)
+{
+    struct cork_buffer  path = CORK_BUFFER_INIT();
+    char  target[64];
+    ssize_t  length;
+    cork_buffer_printf(&path, "%s/%s", dir, name);
+    test_file_content(path.buf, "a", "first");
+    test_file_content(path.buf, "sub/b", "second");
+    test_file_content(path.buf, "sub/deep/c", "third");
+    cork_buffer_append_printf(&path, "/link");
+    length = readlink(path.buf, target, sizeof(target) - 1);
+    fail_if(length == -1, "Symlink should have been copied as a symlink");
+    target[length] = '\0';
+    fail_unless_streq("Symlink target", "../outside", target);
+    cork_buffer_done(&path);
+}
+
+START_TEST(test_file_copy_01)
+{
+    char  dir[] = "/tmp/cork-test-copy-XXXXXX";
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_buffer  buf2 = CORK_BUFFER_INIT();
+    struct cork_thread_pool  *pool;
+    struct cork_file  *src;
+    struct cork_file  *dest;
+    struct cork_file  *file;
+
+    DESCRIBE_TEST;
+    fail_if(mkdtemp(dir) == NULL, "Cannot create temporary directory");
+    cork_buffer_printf(&buf, "%s/src/sub/deep", dir);
+    file = cork_file_new(buf.buf);
+    fail_if_error(cork_file_mkdir(file, 0755, CORK_FILE_RECURSIVE));
+    cork_file_free(file);
+    cork_buffer_printf(&buf, "%s/outside", dir);
+    fail_if(mkdir(buf.buf, 0755) == -1, "Cannot create %s", (char *) buf.buf);
+    write_file(&buf, dir, "outside/keep", "keep");
+    write_file(&buf, dir, "src/a", "first");
+    write_file(&buf, dir, "src/sub/b", "second");
+    write_file(&buf, dir, "src/sub/deep/c", "third");
+    cork_buffer_printf(&buf, "%s/src/link", dir);
+    fail_if(symlink("../outside", buf.buf) == -1, "Cannot create symlink");
+
+    cork_buffer_printf(&buf, "%s/src", dir);
+    src = cork_file_new(buf.buf);
+    cork_buffer_printf(&buf, "%s/dest", dir);
+    dest = cork_file_new(buf.buf);
+
+    /* Directories can only be copied recursively, and copies can only
+     * overwrite existing files if they're permissive. */
+    fail_unless_error(cork_file_copy(src, dest, 0),
+                      "Shouldn't be able to copy a directory by default");
+    fail_if_error(cork_file_copy(src, dest, CORK_FILE_RECURSIVE));
+    test_file_type(dest, CORK_FILE_DIRECTORY);
+    test_copied_tree(dir, "dest");
+    fail_unless_error(cork_file_copy(src, dest, CORK_FILE_RECURSIVE),
+                      "Shouldn't be able to overwrite a copy");
+    write_file(&buf, dir, "dest/sub/b", "changed");
+    fail_if_error(cork_file_copy
+                  (src, dest, CORK_FILE_RECURSIVE | CORK_FILE_PERMISSIVE));
+    test_copied_tree(dir, "dest");
+
+    /* Single files */
+    cork_buffer_printf(&buf, "%s/src/a", dir);
+    file = cork_file_new(buf.buf);
+    cork_buffer_printf(&buf2, "%s/dest/d", dir);
+    cork_file_free(dest);
+    dest = cork_file_new(buf2.buf);
+    fail_if_error(cork_file_copy(file, dest, 0));
+    test_file_content(dir, "dest/d", "first");
+    cork_file_free(file);
+    cork_file_free(dest);
+
+    /* Parallel copies and removals */
+    pool = cork_thread_pool_new(4);
+    fail_if_error(cork_thread_pool_start(pool));
+    cork_buffer_printf(&buf, "%s/dest2", dir);
+    dest = cork_file_new(buf.buf);
+    fail_if_error(cork_file_copy_parallel
+                  (src, dest, CORK_FILE_RECURSIVE, pool));
+    test_copied_tree(dir, "dest2");
+    fail_if_error(cork_file_remove_parallel
+                  (dest, CORK_FILE_RECURSIVE, pool));
+    test_file_type(dest, CORK_FILE_MISSING);
+    cork_file_free(dest);
+    cork_thread_pool_free(pool);
+
+    /* Removing a tree doesn't follow the symlinks inside of it. */
+    cork_buffer_printf(&buf, "%s/dest", dir);
+    dest = cork_file_new(buf.buf);
+    fail_if_error(cork_file_remove(dest, CORK_FILE_RECURSIVE));
+    test_file_type(dest, CORK_FILE_MISSING);
+    test_file_content(dir, "outside/keep", "keep");
+    cork_file_free(dest);
+
+    cork_file_free(src);
+    cork_buffer_printf(&buf, "%s", dir);
+    file = cork_file_new(buf.buf);
+    fail_if_error(cork_file_remove(file, CORK_FILE_RECURSIVE));
+    cork_file_free(file);
+    cork_buffer_done(&buf);
+    cork_buffer_done(&buf2);
+}
+END_TEST
+
+START_TEST(test_file_copy_02)
+{
+    char  dir[] = "/tmp/cork-test-copy-XXXXXX";
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_file  *src;
+    struct cork_file  *dest;
+    struct cork_file  *file;
+    struct stat  info;
+
+    DESCRIBE_TEST;
+    fail_if(mkdtemp(dir) == NULL, "Cannot create temporary directory");
+    cork_buffer_printf(&buf, "%s/src/sub", dir);
+    file = cork_file_new(buf.buf);
+    fail_if_error(cork_file_mkdir(file, 0755, CORK_FILE_RECURSIVE));
+    cork_file_free(file);
+    cork_buffer_printf(&buf, "%s/outside", dir);
+    fail_if(mkdir(buf.buf, 0755) == -1, "Cannot create %s", (char *) buf.buf);
+    write_file(&buf, dir, "outside/keep", "keep");
+    write_file(&buf, dir, "src/a", "first");
+    write_file(&buf, dir, "src/sub/b", "second");
+
+    cork_buffer_printf(&buf, "%s/src", dir);
+    src = cork_file_new(buf.buf);
+
+    /* A symlink planted in the destination doesn't redirect the copy. */
+    cork_buffer_printf(&buf, "%s/dest", dir);
+    fail_if(mkdir(buf.buf, 0755) == -1, "Cannot create %s", (char *) buf.buf);
+    cork_buffer_printf(&buf, "%s/dest/a", dir);
+    fail_if(symlink("../outside/keep", buf.buf) == -1,
+            "Cannot create symlink");
+    dest = cork_file_new(buf.buf);
+    cork_buffer_printf(&buf, "%s/src/a", dir);
+    file = cork_file_new(buf.buf);
+    fail_unless_error(cork_file_copy(file, dest, 0),
+                      "Shouldn't be able to overwrite a symlink");
+    test_file_content(dir, "outside/keep", "keep");
+    cork_file_free(file);
+    cork_file_free(dest);
+    cork_buffer_printf(&buf, "%s/dest", dir);
+    dest = cork_file_new(buf.buf);
+    fail_if_error(cork_file_copy
+                  (src, dest, CORK_FILE_RECURSIVE | CORK_FILE_PERMISSIVE));
+    test_file_content(dir, "outside/keep", "keep");
+    test_file_content(dir, "dest/a", "first");
+    cork_buffer_printf(&buf, "%s/dest/a", dir);
+    fail_if(lstat(buf.buf, &info) == -1, "Cannot stat %s", (char *) buf.buf);
+    fail_unless(S_ISREG(info.st_mode), "Copy should replace the symlink");
+    cork_file_free(dest);
+
+    /* We can copy read-only directories, and the copies end up with the
+     * same mode, even if we copy over them again. */
+    cork_buffer_printf(&buf, "%s/src/sub", dir);
+    fail_if(chmod(buf.buf, 0555) == -1, "Cannot chmod %s", (char *) buf.buf);
+    cork_buffer_printf(&buf, "%s/dest2", dir);
+    dest = cork_file_new(buf.buf);
+    fail_if_error(cork_file_copy(src, dest, CORK_FILE_RECURSIVE));
+    fail_if_error(cork_file_copy
+                  (src, dest, CORK_FILE_RECURSIVE | CORK_FILE_PERMISSIVE));
+    test_file_content(dir, "dest2/sub/b", "second");
+    cork_buffer_printf(&buf, "%s/dest2/sub", dir);
+    fail_if(stat(buf.buf, &info) == -1, "Cannot stat %s", (char *) buf.buf);
+    fail_unless_equal("Directory mode", "0%o", 0555, info.st_mode & 07777);
+    fail_if(chmod(buf.buf, 0755) == -1, "Cannot chmod %s", (char *) buf.buf);
+    cork_buffer_printf(&buf, "%s/src/sub", dir);
+    fail_if(chmod(buf.buf, 0755) == -1, "Cannot chmod %s", (char *) buf.buf);
+    cork_file_free(dest);
+
+    /* We can't copy a directory into itself. */
+    cork_buffer_printf(&buf, "%s/src/sub/inner", dir);
+    dest = cork_file_new(buf.buf);
+    fail_unless_error(cork_file_copy(src, dest, CORK_FILE_RECURSIVE),
+                      "Shouldn't be able to copy a directory into itself");
+    test_file_type(dest, CORK_FILE_MISSING);
+    cork_file_free(dest);
+    fail_unless_error(cork_file_copy
+                      (src, src, CORK_FILE_RECURSIVE | CORK_FILE_PERMISSIVE),
+                      "Shouldn't be able to copy a directory onto itself");
+    test_file_content(dir, "src/a", "first");
+
+    cork_file_free(src);
+    cork_buffer_printf(&buf, "%s", dir);
+    file = cork_file_new(buf.buf);
+    fail_if_error(cork_file_remove(file, CORK_FILE_RECURSIVE));
+    cork_file_free(file);
+    cork_buffer_done(&buf);
+}
+END_TEST
+
+START_TEST(test_file_copy_03)
+{
+    char  dir[] = "/tmp/cork-test-copy-XXXXXX";
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_file  *src;
+    struct cork_file  *dest;
+    struct cork_file  *file;
+    struct stat  info;
+
+    DESCRIBE_TEST;
+    fail_if(mkdtemp(dir) == NULL, "Cannot create temporary directory");
+    cork_buffer_printf(&buf, "%s/src/sub", dir);
+    file = cork_file_new(buf.buf);
+    fail_if_error(cork_file_mkdir(file, 0755, CORK_FILE_RECURSIVE));
+    cork_file_free(file);
+    write_file(&buf, dir, "src/a", "first");
+    write_file(&buf, dir, "src/sub/b", "second");
+    cork_buffer_printf(&buf, "%s/link", dir);
+    fail_if(symlink("src", buf.buf) == -1, "Cannot create symlink");
+
+    /* If the source is a symlink to a directory, we copy the directory. */
+    src = cork_file_new(buf.buf);
+    cork_buffer_printf(&buf, "%s/dest", dir);
+    dest = cork_file_new(buf.buf);
+    fail_if_error(cork_file_copy(src, dest, CORK_FILE_RECURSIVE));
+    test_file_content(dir, "dest/a", "first");
+    test_file_content(dir, "dest/sub/b", "second");
+    fail_if(lstat(buf.buf, &info) == -1, "Cannot stat %s", (char *) buf.buf);
+    fail_unless(S_ISDIR(info.st_mode), "Copy should be a directory");
+    fail_unless_equal("Directory mode", "0%o", 0755, info.st_mode & 07777);
+    cork_file_free(dest);
+
+    /* A copy that fails doesn't leave a partial destination behind. */
+    cork_buffer_printf(&buf, "%s/src/sub/fifo", dir);
+    fail_if(mkfifo(buf.buf, 0600) == -1, "Cannot create FIFO");
+    cork_buffer_printf(&buf, "%s/dest2", dir);
+    dest = cork_file_new(buf.buf);
+    fail_unless_error(cork_file_copy(src, dest, CORK_FILE_RECURSIVE),
+                      "Shouldn't be able to copy a FIFO");
+    test_file_type(dest, CORK_FILE_MISSING);
+    cork_file_free(dest);
+
+    cork_file_free(src);
+    cork_buffer_printf(&buf, "%s", dir);
+    file = cork_file_new(buf.buf);
+    fail_if_error(cork_file_remove(file, CORK_FILE_RECURSIVE));
+    cork_file_free(file);
+    cork_buffer_done(&buf);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * File watchers
+ */
+
+#if CORK_HAVE_INOTIFY || CORK_HAVE_KQUEUE
+
+/* Records each event as a line in a buffer */
+static int
+record_event(void *user_data, const struct cork_file_event *event)
+{
+    static const char  *types = "CMDL";
+    struct cork_buffer  *events = user_data;
+    cork_buffer_append_printf
+        (events, "%c %s\n", types[event->type],
+         (event->rel_path == NULL)? "": event->rel_path);
+    return 0;
+}
+
+/* Waits until the watcher has reported the expected events.  We might also
+ * see other events, depending on the platform; for instance, Linux reports
+ * both a creation and a modification when you write to a new file. */
+static void
+test_events(struct cork_file_watcher *watcher, const char *expected)
+{
+    struct cork_buffer  events = CORK_BUFFER_INIT();
+    const char  *curr = expected;
+    size_t  i;
+
+    cork_buffer_set(&events, "", 0);
+    for (i = 0; i < 100 && *curr != '\0'; i++) {
+        const char  *line_end;
+        fail_if_error(cork_file_watcher_process
+                      (watcher, 50, &events, record_event));
+        while (*curr != '\0' &&
+               (line_end = strchr(curr, '\n')) != NULL) {
+            struct cork_buffer  line = CORK_BUFFER_INIT();
+            bool  found;
+            cork_buffer_set(&line, curr, line_end - curr + 1);
+            found = strstr(events.buf, line.buf) != NULL;
+            cork_buffer_done(&line);
+            if (!found) {
+                break;
+            }
+            curr = line_end + 1;
+        }
+    }
+    fail_unless(*curr == '\0', "Missing events:\n%sgot:\n%s",
+                curr, (char *) events.buf);
+    cork_buffer_done(&events);
+}
+
+START_TEST(test_file_watcher_01)
+{
+    char  dir[] = "/tmp/cork-test-watcher-XXXXXX";
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_file_watcher  *watcher;
+    struct cork_file  *file;
+    FILE  *fp;
+
+    DESCRIBE_TEST;
+    fail_if(mkdtemp(dir) == NULL, "Cannot create temporary directory");
+    cork_buffer_printf(&buf, "%s/existing", dir);
+    fail_unless(mkdir(buf.buf, 0755) == 0, "Cannot create %s",
+                (char *) buf.buf);
+    fail_if_error(watcher = cork_file_watcher_new());
+    fail_if(cork_file_watcher_fd(watcher) == -1, "Watcher should have an fd");
+    fail_if_error(cork_file_watcher_add(watcher, dir, CORK_FILE_RECURSIVE));
+
+    cork_buffer_printf(&buf, "%s/a", dir);
+    touch_file(buf.buf);
+    test_events(watcher, "C a\n");
+
+    cork_buffer_printf(&buf, "%s/a", dir);
+    fp = fopen(buf.buf, "a");
+    fail_if(fp == NULL, "Cannot open %s", (char *) buf.buf);
+    fputs("hello\n", fp);
+    fclose(fp);
+    test_events(watcher, "M a\n");
+
+    /* Subdirectories that existed beforehand, and ones created since, are
+     * both watched. */
+    cork_buffer_printf(&buf, "%s/existing/b", dir);
+    touch_file(buf.buf);
+    cork_buffer_printf(&buf, "%s/new", dir);
+    fail_unless(mkdir(buf.buf, 0755) == 0, "Cannot create %s",
+                (char *) buf.buf);
+    test_events(watcher, "C existing/b\nC new\n");
+    cork_buffer_printf(&buf, "%s/new/c", dir);
+    touch_file(buf.buf);
+    test_events(watcher, "C new/c\n");
+
+    cork_buffer_printf(&buf, "%s/a", dir);
+    fail_unless(unlink(buf.buf) == 0, "Cannot remove %s", (char *) buf.buf);
+    test_events(watcher, "D a\n");
+
+    /* Removing the watched directory itself */
+    file = cork_file_new(dir);
+    fail_if_error(cork_file_remove(file, CORK_FILE_RECURSIVE));
+    cork_file_free(file);
+    test_events(watcher, "D new/c\nD new\nD \n");
+
+    cork_file_watcher_free(watcher);
+    cork_buffer_done(&buf);
+}
+END_TEST
+
+#endif
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -386,6 +941,7 @@ test_suite()
     tcase_add_test(tc_path, test_path_join_02);
     tcase_add_test(tc_path, test_path_basename_01);
     tcase_add_test(tc_path, test_path_dirname_01);
+    tcase_add_test(tc_path, test_path_builder_01);
     tcase_add_test(tc_path, test_path_relative_child_01);
     tcase_add_test(tc_path, test_path_set_absolute_01);
     suite_add_tcase(s, tc_path);
@@ -396,8 +952,18 @@ test_suite()
 
     TCase  *tc_file = tcase_create("file");
     tcase_add_test(tc_file, test_file_exists_01);
+    tcase_add_test(tc_file, test_file_cache_01);
+    tcase_add_test(tc_file, test_file_copy_01);
+    tcase_add_test(tc_file, test_file_copy_02);
+    tcase_add_test(tc_file, test_file_copy_03);
     suite_add_tcase(s, tc_file);
 
+#if CORK_HAVE_INOTIFY || CORK_HAVE_KQUEUE
+    TCase  *tc_file_watcher = tcase_create("file-watcher");
+    tcase_add_test(tc_file_watcher, test_file_watcher_01);
+    suite_add_tcase(s, tc_file_watcher);
+#endif
+
     return s;
 }
 
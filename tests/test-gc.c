@@ -15,6 +15,7 @@
 
 #include "libcork/core/attributes.h"
 #include "libcork/core/gc.h"
+#include "libcork/core/mempool.h"
 #include "libcork/core/types.h"
 #include "libcork/helpers/gc.h"
 
@@ -122,6 +123,264 @@ START_TEST(test_gc_cyclic_02)
 }
 END_TEST
 
+static size_t  freed_count;
+
+_free_(counted_tree) {
+    freed_count++;
+}
+
+#define counted_tree__recurse  tree__recurse
+_gc_(counted_tree);
+
+static struct tree *
+counted_tree_new(int id, struct tree *l, struct tree *r)
+{
+    struct tree  *self = cork_gc_new_iface(struct tree, &counted_tree__gc);
+    self->id = id;
+    self->left = cork_gc_incref(l);
+    self->right = cork_gc_incref(r);
+    return self;
+}
+
+START_TEST(test_gc_deferred_01)
+{
+    DESCRIBE_TEST;
+    struct tree  *t0;
+    struct tree  *t1;
+    struct tree  *t2;
+    cork_gc_init();
+    freed_count = 0;
+
+    t1 = counted_tree_new(1, NULL, NULL);
+    t2 = counted_tree_new(2, NULL, NULL);
+    t0 = counted_tree_new(0, t1, t2);
+    cork_gc_decref(t1);
+    cork_gc_decref(t2);
+
+    cork_gc_defer_begin();
+    /* Borrow a reference to one of the children, and then release the whole
+     * tree.  Nothing should be freed until the end of the scope. */
+    t1 = t0->left;
+    cork_gc_decref(t0);
+    fail_unless_equal("Freed objects", "%zu", (size_t) 0, freed_count);
+    fail_unless_equal("Tree ID", "%d", 1, t1->id);
+
+    /* Nested scopes don't release anything when they end. */
+    cork_gc_defer_begin();
+    cork_gc_defer_end();
+    fail_unless_equal("Freed objects", "%zu", (size_t) 0, freed_count);
+
+    /* An object that gains a new reference inside the scope survives. */
+    t2 = cork_gc_incref(t0->right);
+    cork_gc_defer_end();
+    fail_if(freed_count == 0, "Tree should be freed at end of scope");
+    fail_unless_equal("Tree ID", "%d", 2, t2->id);
+    cork_gc_decref(t2);
+    cork_gc_done();
+    fail_unless_equal("Freed objects", "%zu", (size_t) 3, freed_count);
+}
+END_TEST
+
+START_TEST(test_gc_deferred_02)
+{
+    DESCRIBE_TEST;
+    struct tree  *t0;
+    struct tree  *t1;
+    cork_gc_init();
+    freed_count = 0;
+
+    /* Deferred objects that are part of a garbage cycle are collected once
+     * the scope ends. */
+    t1 = counted_tree_new(1, NULL, NULL);
+    t0 = counted_tree_new(0, t1, NULL);
+    t1->left = cork_gc_incref(t0);
+    cork_gc_defer_begin();
+    cork_gc_decref(t1);
+    cork_gc_decref(t0);
+    cork_gc_defer_end();
+    cork_gc_done();
+    fail_unless_equal("Freed objects", "%zu", (size_t) 2, freed_count);
+}
+END_TEST
+
+START_TEST(test_gc_deferred_03)
+{
+    DESCRIBE_TEST;
+    struct tree  *x;
+    struct tree  *c;
+    struct tree  *d;
+    struct tree  *a;
+    cork_gc_init();
+    freed_count = 0;
+
+    /* Releasing a deferred object can create new possible roots, which can
+     * trigger a collection while we're still reconciling the zero count
+     * table.  That collection must not touch the objects that we've already
+     * freed. */
+    cork_gc_set_root_threshold(1);
+    x = counted_tree_new(0, NULL, NULL);
+    c = counted_tree_new(1, NULL, NULL);
+    d = counted_tree_new(2, NULL, NULL);
+    a = counted_tree_new(3, c, d);
+    cork_gc_defer_begin();
+    cork_gc_decref(x);
+    cork_gc_decref(a);
+    cork_gc_defer_end();
+    fail_unless_equal("Freed objects", "%zu", (size_t) 2, freed_count);
+    fail_unless_equal("Tree ID", "%d", 1, c->id);
+    fail_unless_equal("Tree ID", "%d", 2, d->id);
+    cork_gc_decref(c);
+    cork_gc_decref(d);
+    cork_gc_set_root_threshold(CORK_GC_DEFAULT_ROOT_THRESHOLD);
+    cork_gc_done();
+    fail_unless_equal("Freed objects", "%zu", (size_t) 4, freed_count);
+}
+END_TEST
+
+START_TEST(test_gc_collect_01)
+{
+    DESCRIBE_TEST;
+    struct cork_gc_stats  before;
+    struct cork_gc_stats  after;
+    size_t  i;
+    cork_gc_init();
+    freed_count = 0;
+
+    /* With automatic collection turned off, the root buffer has to grow to
+     * hold every possible root. */
+    cork_gc_set_root_threshold(0);
+    cork_gc_get_stats(&before);
+    for (i = 0; i < 2000; i++) {
+        struct tree  *t1 = counted_tree_new(1, NULL, NULL);
+        struct tree  *t0 = counted_tree_new(0, t1, NULL);
+        t1->left = cork_gc_incref(t0);
+        cork_gc_decref(t1);
+        cork_gc_decref(t0);
+    }
+    cork_gc_get_stats(&after);
+    fail_unless_equal("Collections", "%zu",
+                      before.collections, after.collections);
+    fail_unless_equal("Possible roots", "%zu", (size_t) 4000,
+                      after.possible_roots);
+    fail_unless_equal("Freed objects", "%zu", (size_t) 0, freed_count);
+
+    cork_gc_collect();
+    cork_gc_get_stats(&after);
+    fail_unless_equal("Collections", "%zu",
+                      before.collections + 1, after.collections);
+    fail_unless_equal("Possible roots", "%zu", (size_t) 0,
+                      after.possible_roots);
+    fail_unless_equal("Freed objects", "%zu", (size_t) 4000, freed_count);
+    fail_unless_equal("Freed objects", "%zu",
+                      before.objects_freed + 4000, after.objects_freed);
+    fail_unless(after.objects_scanned >= before.objects_scanned + 4000,
+                "Should have scanned every object");
+
+    cork_gc_set_root_threshold(CORK_GC_DEFAULT_ROOT_THRESHOLD);
+    cork_gc_done();
+}
+END_TEST
+
+START_TEST(test_gc_step_01)
+{
+    DESCRIBE_TEST;
+    struct cork_gc_stats  stats;
+    size_t  i;
+    size_t  step_count = 0;
+    cork_gc_init();
+    freed_count = 0;
+
+    cork_gc_set_root_threshold(0);
+    for (i = 0; i < 2000; i++) {
+        struct tree  *t1 = counted_tree_new(1, NULL, NULL);
+        struct tree  *t0 = counted_tree_new(0, t1, NULL);
+        t1->left = cork_gc_incref(t0);
+        cork_gc_decref(t1);
+        cork_gc_decref(t0);
+    }
+
+    /* With a zero budget, each step only examines one batch of roots. */
+    while (cork_gc_step(0)) {
+        step_count++;
+    }
+    fail_unless(step_count > 1, "Should need more than one step");
+    cork_gc_get_stats(&stats);
+    fail_unless_equal("Possible roots", "%zu", (size_t) 0,
+                      stats.possible_roots);
+    fail_unless_equal("Freed objects", "%zu", (size_t) 4000, freed_count);
+    fail_if(cork_gc_step(0), "Shouldn't have any roots left");
+
+    cork_gc_set_root_threshold(CORK_GC_DEFAULT_ROOT_THRESHOLD);
+    cork_gc_done();
+}
+END_TEST
+
+START_TEST(test_gc_step_02)
+{
+    DESCRIBE_TEST;
+    struct tree  *first;
+    struct tree  *prev;
+    size_t  i;
+    cork_gc_init();
+    freed_count = 0;
+
+    /* A single large cycle whose members are spread across several batches
+     * of possible roots. */
+    cork_gc_set_root_threshold(0);
+    first = prev = counted_tree_new(0, NULL, NULL);
+    for (i = 1; i < 300; i++) {
+        struct tree  *curr = counted_tree_new(i, NULL, NULL);
+        prev->left = curr;
+        prev = curr;
+    }
+    prev->left = cork_gc_incref(first);
+    prev = first;
+    for (i = 0; i < 300; i++) {
+        struct tree  *next = prev->left;
+        cork_gc_incref(next);
+        cork_gc_decref(prev);
+        prev = next;
+    }
+    cork_gc_decref(prev);
+
+    while (cork_gc_step(0)) {
+    }
+    fail_unless_equal("Freed objects", "%zu", (size_t) 300, freed_count);
+
+    cork_gc_set_root_threshold(CORK_GC_DEFAULT_ROOT_THRESHOLD);
+    cork_gc_done();
+}
+END_TEST
+
+START_TEST(test_gc_pooled_01)
+{
+    DESCRIBE_TEST;
+    struct cork_mempool  *pool;
+    size_t  i;
+    cork_gc_init();
+    freed_count = 0;
+
+    pool = cork_gc_mempool_new(struct tree);
+    counted_tree__gc.pool = pool;
+    for (i = 0; i < 500; i++) {
+        struct tree  *t1 = counted_tree_new(1, NULL, NULL);
+        struct tree  *t2 = counted_tree_new(2, NULL, NULL);
+        struct tree  *t0 = counted_tree_new(0, t1, t2);
+        t1->left = cork_gc_incref(t0);
+        cork_gc_decref(t1);
+        cork_gc_decref(t2);
+        cork_gc_decref(t0);
+    }
+    cork_gc_collect();
+    fail_unless_equal("Freed objects", "%zu", (size_t) 1500, freed_count);
+
+    cork_gc_done();
+    counted_tree__gc.pool = NULL;
+    /* This aborts if any of the pooled objects weren't returned to the pool. */
+    cork_mempool_free(pool);
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * Testing harness
@@ -136,6 +395,13 @@ test_suite()
     tcase_add_test(tc_gc, test_gc_acyclic_01);
     tcase_add_test(tc_gc, test_gc_cyclic_01);
     tcase_add_test(tc_gc, test_gc_cyclic_02);
+    tcase_add_test(tc_gc, test_gc_deferred_01);
+    tcase_add_test(tc_gc, test_gc_deferred_02);
+    tcase_add_test(tc_gc, test_gc_deferred_03);
+    tcase_add_test(tc_gc, test_gc_collect_01);
+    tcase_add_test(tc_gc, test_gc_step_01);
+    tcase_add_test(tc_gc, test_gc_step_02);
+    tcase_add_test(tc_gc, test_gc_pooled_01);
     suite_add_tcase(s, tc_gc);
 
     return s;
@@ -10,14 +10,26 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <check.h>
 
 #include "libcork/core/allocator.h"
+#include "libcork/core/byte-order.h"
 #include "libcork/core/hash.h"
 #include "libcork/core/types.h"
 #include "libcork/ds/buffer.h"
+#include "libcork/ds/concurrent-hash-table.h"
+#include "libcork/ds/frozen-hash-table.h"
+#include "libcork/ds/hash-map.h"
 #include "libcork/ds/hash-table.h"
+#include "libcork/ds/managed-buffer.h"
+#include "libcork/ds/sharded-hash-table.h"
+#include "libcork/ds/slice.h"
+#include "libcork/ds/stream.h"
+#include "libcork/threads/atomics.h"
+#include "libcork/threads/basics.h"
 
 #include "helpers.h"
 
@@ -54,6 +66,12 @@ uint64__hash(void *user_data, const void *velement)
     return (cork_hash) *element;
 }
 
+static cork_hash
+uint64__murmur_hash(void *user_data, const void *velement)
+{
+    return cork_hash_buffer(0, velement, sizeof(uint64_t));
+}
+
 static enum cork_hash_table_map_result
 uint64_sum(void *vsum, struct cork_hash_table_entry *entry)
 {
@@ -136,7 +154,8 @@ test_iterator_to_string(struct cork_hash_table *table, const char *expected)
     cork_buffer_done(&buf);
 }
 
-START_TEST(test_uint64_hash_table)
+static void
+test_uint64_hash_table_flags(unsigned int flags)
 {
     struct cork_hash_table  *table;
     uint64_t  key, *key_ptr, *old_key;
@@ -145,7 +164,7 @@ START_TEST(test_uint64_hash_table)
     bool  is_new;
     struct cork_hash_table_entry  *entry;
 
-    table = cork_hash_table_new(0, 0);
+    table = cork_hash_table_new(0, flags);
     cork_hash_table_set_hash(table, uint64__hash);
     cork_hash_table_set_equals(table, uint64__equals);
     cork_hash_table_set_free_key(table, uint64__free);
@@ -263,6 +282,597 @@ START_TEST(test_uint64_hash_table)
     /* And we're done, so let's free everything. */
     cork_hash_table_free(table);
 }
+
+START_TEST(test_uint64_hash_table)
+{
+    test_uint64_hash_table_flags(0);
+}
+END_TEST
+
+START_TEST(test_uint64_open_hash_table)
+{
+    test_uint64_hash_table_flags(CORK_HASH_TABLE_OPEN_ADDRESSING);
+}
+END_TEST
+
+START_TEST(test_uint64_unordered_hash_table)
+{
+    test_uint64_hash_table_flags(CORK_HASH_TABLE_UNORDERED);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Larger tables
+ */
+
+#define BULK_COUNT  10000
+
+static uint64_t *
+uint64__new(uint64_t v)
+{
+    uint64_t  *result = cork_new(uint64_t);
+    *result = v;
+    return result;
+}
+
+static enum cork_hash_table_map_result
+uint64_delete_odd(void *user_data, struct cork_hash_table_entry *entry)
+{
+    uint64_t  *key = entry->key;
+    return (*key % 2 == 1)?
+        CORK_HASH_TABLE_MAP_DELETE: CORK_HASH_TABLE_MAP_CONTINUE;
+}
+
+/* Use a batch size that isn't a multiple of the table's internal batch size. */
+#define LOOKUP_BATCH_SIZE  37
+
+/* Checks that a batch lookup of every key (and a few past the end) finds
+ * exactly the entries whose keys are 2 mod 4, or nothing if the table should be
+ * empty. */
+static void
+test_batch_lookup(struct cork_hash_table *table, cork_hash_f hash,
+                  bool precompute_hashes, bool empty)
+{
+    uint64_t  key_values[LOOKUP_BATCH_SIZE];
+    const void  *keys[LOOKUP_BATCH_SIZE];
+    cork_hash  hashes[LOOKUP_BATCH_SIZE];
+    void  *results[LOOKUP_BATCH_SIZE];
+    uint64_t  i;
+
+    for (i = 0; i < BULK_COUNT + LOOKUP_BATCH_SIZE; i += LOOKUP_BATCH_SIZE) {
+        size_t  j;
+        for (j = 0; j < LOOKUP_BATCH_SIZE; j++) {
+            key_values[j] = i + j;
+            keys[j] = &key_values[j];
+            hashes[j] = hash(NULL, keys[j]);
+        }
+        cork_hash_table_get_batch
+            (table, keys, precompute_hashes? hashes: NULL,
+             LOOKUP_BATCH_SIZE, results);
+        for (j = 0; j < LOOKUP_BATCH_SIZE; j++) {
+            uint64_t  key = key_values[j];
+            uint64_t  *value = results[j];
+            if (!empty && key < BULK_COUNT && key % 4 == 2) {
+                fail_if(value == NULL, "Missing entry %" PRIu64, key);
+                fail_unless_equal("Entry value", "%" PRIu64, key * 2, *value);
+            } else {
+                fail_unless(value == NULL, "Unexpected entry %" PRIu64, key);
+            }
+        }
+    }
+}
+
+static void
+test_bulk_hash_table_flags(unsigned int flags)
+{
+    struct cork_hash_table  *table;
+    cork_hash_f  hash;
+    uint64_t  i;
+    uint64_t  key;
+    uint64_t  expected_sum;
+
+    table = cork_hash_table_new(0, flags);
+    /* Use a real hash function so that we exercise collisions within groups
+     * as well as across them. */
+    hash = (flags & CORK_HASH_TABLE_FAST_HASH)?
+        cork_uint64_fast_hash: uint64__murmur_hash;
+    cork_hash_table_set_hash(table, hash);
+    cork_hash_table_set_equals(table, uint64__equals);
+    cork_hash_table_set_free_key(table, uint64__free);
+    cork_hash_table_set_free_value(table, uint64__free);
+
+    expected_sum = 0;
+    for (i = 0; i < BULK_COUNT; i++) {
+        bool  is_new;
+        uint64_t  *value;
+        cork_hash_table_put
+            (table, uint64__new(i), uint64__new(i * 2), &is_new, NULL, NULL);
+        fail_unless(is_new, "Entry %" PRIu64 " should be new", i);
+        expected_sum += i * 2;
+        /* Make sure that earlier entries are still visible, even in the middle
+         * of a resize. */
+        key = i / 2;
+        fail_if((value = cork_hash_table_get(table, &key)) == NULL,
+                "Missing entry %" PRIu64, key);
+        fail_unless_equal("Entry value", "%" PRIu64, key * 2, *value);
+    }
+    fail_unless_equal("Table size", "%zu",
+                      (size_t) BULK_COUNT, cork_hash_table_size(table));
+    test_map_sum(table, expected_sum);
+    test_iterator_sum(table, expected_sum);
+
+    for (i = 0; i < BULK_COUNT; i++) {
+        uint64_t  *value;
+        key = i;
+        fail_if((value = cork_hash_table_get(table, &key)) == NULL,
+                "Missing entry %" PRIu64, i);
+        fail_unless_equal("Entry value", "%" PRIu64, i * 2, *value);
+    }
+    key = BULK_COUNT;
+    fail_unless(cork_hash_table_get(table, &key) == NULL,
+                "Unexpected entry %" PRIu64, key);
+
+    /* Delete every odd entry via map, and every multiple of four directly. */
+    cork_hash_table_map(table, NULL, uint64_delete_odd);
+    for (i = 0; i < BULK_COUNT; i += 4) {
+        key = i;
+        fail_unless(cork_hash_table_delete(table, &key, NULL, NULL),
+                    "Couldn't delete entry %" PRIu64, i);
+    }
+    expected_sum = 0;
+    for (i = 2; i < BULK_COUNT; i += 4) {
+        expected_sum += i * 2;
+    }
+    fail_unless_equal("Table size", "%zu",
+                      (size_t) BULK_COUNT / 4, cork_hash_table_size(table));
+    test_map_sum(table, expected_sum);
+    test_iterator_sum(table, expected_sum);
+    test_batch_lookup(table, hash, false, false);
+    test_batch_lookup(table, hash, true, false);
+
+    /* Churn through many deletions and insertions to make sure that we
+     * recover tombstones without growing without bound. */
+    for (i = BULK_COUNT; i < BULK_COUNT * 10; i++) {
+        key = i - 1;
+        cork_hash_table_put
+            (table, uint64__new(i), uint64__new(0), NULL, NULL, NULL);
+        if (i > BULK_COUNT) {
+            fail_unless(cork_hash_table_delete(table, &key, NULL, NULL),
+                        "Couldn't delete entry %" PRIu64, key);
+        }
+    }
+    fail_unless_equal("Table size", "%zu",
+                      (size_t) BULK_COUNT / 4 + 1,
+                      cork_hash_table_size(table));
+    test_map_sum(table, expected_sum);
+
+    cork_hash_table_clear(table);
+    fail_unless_equal("Table size", "%zu",
+                      (size_t) 0, cork_hash_table_size(table));
+    test_iterator_sum(table, 0);
+    test_batch_lookup(table, hash, false, true);
+    cork_hash_table_free(table);
+}
+
+START_TEST(test_bulk_hash_table)
+{
+    test_bulk_hash_table_flags(0);
+}
+END_TEST
+
+START_TEST(test_bulk_incremental_hash_table)
+{
+    test_bulk_hash_table_flags(CORK_HASH_TABLE_INCREMENTAL_RESIZE);
+}
+END_TEST
+
+START_TEST(test_bulk_open_hash_table)
+{
+    test_bulk_hash_table_flags(CORK_HASH_TABLE_OPEN_ADDRESSING);
+}
+END_TEST
+
+START_TEST(test_bulk_pooled_hash_table)
+{
+    test_bulk_hash_table_flags(CORK_HASH_TABLE_POOLED_ENTRIES);
+}
+END_TEST
+
+START_TEST(test_bulk_unordered_hash_table)
+{
+    test_bulk_hash_table_flags(CORK_HASH_TABLE_UNORDERED);
+    test_bulk_hash_table_flags
+        (CORK_HASH_TABLE_UNORDERED | CORK_HASH_TABLE_INCREMENTAL_RESIZE);
+    test_bulk_hash_table_flags
+        (CORK_HASH_TABLE_UNORDERED | CORK_HASH_TABLE_POOLED_ENTRIES);
+}
+END_TEST
+
+START_TEST(test_bulk_fast_hash_table)
+{
+    test_bulk_hash_table_flags(CORK_HASH_TABLE_FAST_HASH);
+    test_bulk_hash_table_flags
+        (CORK_HASH_TABLE_FAST_HASH | CORK_HASH_TABLE_OPEN_ADDRESSING);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * 64-bit hashes
+ */
+
+static void
+test_hash64_table_flags(unsigned int flags)
+{
+    struct cork_hash_table  *table;
+    struct cork_hash_table_entry  *entry;
+    const void  *keys[BULK_COUNT];
+    cork_hash64  hashes[BULK_COUNT];
+    void  *results[BULK_COUNT];
+    uint64_t  key_values[BULK_COUNT];
+    uint64_t  i;
+    bool  is_new;
+
+    table = cork_hash_table_new(0, flags);
+    cork_hash_table_set_hash64(table, cork_uint64_hash64);
+    cork_hash_table_set_equals(table, cork_uint64_equals);
+    cork_hash_table_set_free_key(table, uint64__free);
+    cork_hash_table_set_free_value(table, uint64__free);
+
+    for (i = 0; i < BULK_COUNT; i++) {
+        key_values[i] = i;
+        keys[i] = &key_values[i];
+        hashes[i] = cork_uint64_hash64(NULL, &key_values[i]);
+        if (i % 2 == 0) {
+            cork_hash_table_put
+                (table, uint64__new(i), uint64__new(i * 2),
+                 &is_new, NULL, NULL);
+        } else {
+            cork_hash_table_put_hash64
+                (table, hashes[i], uint64__new(i), uint64__new(i * 2),
+                 &is_new, NULL, NULL);
+        }
+        fail_unless(is_new, "Entry %" PRIu64 " should be new", i);
+    }
+    fail_unless_equal("Table size", "%zu", (size_t) BULK_COUNT,
+                      cork_hash_table_size(table));
+
+    /* Entries remember the full 64-bit hash, and the low bits are visible
+     * through the 32-bit field. */
+    for (i = 0; i < BULK_COUNT; i++) {
+        fail_if((entry = cork_hash_table_get_entry_hash64
+                 (table, hashes[i], &key_values[i])) == NULL,
+                "Missing entry %" PRIu64, i);
+        fail_unless_equal("Entry hash", "0x%016" PRIx64, hashes[i],
+                          cork_hash_table_entry_hash64(entry));
+        fail_unless_equal("Entry hash", "0x%08" PRIx32,
+                          (cork_hash) hashes[i], entry->hash);
+        fail_unless(cork_hash_table_get(table, &key_values[i]) ==
+                    entry->value, "Unexpected value for %" PRIu64, i);
+    }
+
+    cork_hash_table_get_batch_hash64
+        (table, keys, hashes, BULK_COUNT, results);
+    for (i = 0; i < BULK_COUNT; i++) {
+        fail_if(results[i] == NULL, "Missing entry %" PRIu64, i);
+        fail_unless_equal("Entry value", "%" PRIu64, i * 2,
+                          *(uint64_t *) results[i]);
+    }
+
+    for (i = 0; i < BULK_COUNT; i += 2) {
+        fail_unless(cork_hash_table_delete_hash64
+                    (table, hashes[i], &key_values[i], NULL, NULL),
+                    "Couldn't delete %" PRIu64, i);
+    }
+    fail_unless_equal("Table size", "%zu", (size_t) BULK_COUNT / 2,
+                      cork_hash_table_size(table));
+    for (i = 0; i < BULK_COUNT; i++) {
+        fail_unless((cork_hash_table_get_hash64
+                     (table, hashes[i], &key_values[i]) == NULL) ==
+                    (i % 2 == 0), "Unexpected entry for %" PRIu64, i);
+    }
+
+    cork_hash_table_free(table);
+}
+
+START_TEST(test_hash64_table)
+{
+    test_hash64_table_flags(0);
+    test_hash64_table_flags(CORK_HASH_TABLE_INCREMENTAL_RESIZE);
+    test_hash64_table_flags(CORK_HASH_TABLE_OPEN_ADDRESSING);
+}
+END_TEST
+
+START_TEST(test_hash64_compatibility)
+{
+    struct cork_hash_table  *table;
+    struct cork_hash_table_entry  *entry;
+    uint64_t  key = 42;
+    cork_hash  hash = uint64__murmur_hash(NULL, &key);
+    bool  is_new;
+
+    /* With a 32-bit hash function, the 32-bit and 64-bit APIs can be mixed,
+     * as long as 32-bit hashes are widened by duplicating them. */
+    table = cork_hash_table_new(0, CORK_HASH_TABLE_OPEN_ADDRESSING);
+    cork_hash_table_set_hash(table, uint64__murmur_hash);
+    cork_hash_table_set_equals(table, uint64__equals);
+    entry = cork_hash_table_get_or_create(table, &key, &is_new);
+    fail_unless(is_new, "Entry should be new");
+    entry->value = &key;
+    fail_unless_equal("Entry hash", "0x%08" PRIx32, hash, entry->hash);
+    fail_unless_equal("Entry hash", "0x%08" PRIx32, hash, entry->hash_high);
+    fail_unless(cork_hash_table_get_hash(table, hash, &key) == &key,
+                "Couldn't find entry by 32-bit hash");
+    fail_unless(cork_hash_table_get_hash64
+                (table, ((cork_hash64) hash << 32) | hash, &key) == &key,
+                "Couldn't find entry by widened hash");
+    cork_hash_table_free(table);
+}
+END_TEST
+
+
+/* An allocator that keeps track of how much memory is currently allocated from
+ * it. */
+
+static size_t  counting_alloc_bytes = 0;
+
+static void *
+counting_alloc__xmalloc(const struct cork_alloc *alloc, size_t size)
+{
+    counting_alloc_bytes += size;
+    return cork_alloc_xmalloc(alloc->parent, size);
+}
+
+static void
+counting_alloc__free(const struct cork_alloc *alloc, void *ptr, size_t size)
+{
+    counting_alloc_bytes -= size;
+    cork_alloc_free(alloc->parent, ptr, size);
+}
+
+static void
+test_hash_table_allocator_flags(unsigned int flags)
+{
+    struct cork_alloc  *alloc = cork_alloc_new_alloc(cork_allocator);
+    struct cork_hash_table  *table;
+    uint64_t  i;
+
+    cork_alloc_set_xmalloc(alloc, counting_alloc__xmalloc);
+    cork_alloc_set_free(alloc, counting_alloc__free);
+    counting_alloc_bytes = 0;
+
+    table = cork_hash_table_new_ex(0, flags, alloc);
+    cork_hash_table_set_hash(table, uint64__murmur_hash);
+    cork_hash_table_set_equals(table, uint64__equals);
+    cork_hash_table_set_free_key(table, uint64__free);
+    cork_hash_table_set_free_value(table, uint64__free);
+    fail_if(counting_alloc_bytes == 0, "Table should use custom allocator");
+    for (i = 0; i < BULK_COUNT; i++) {
+        cork_hash_table_put
+            (table, uint64__new(i), uint64__new(i), NULL, NULL, NULL);
+    }
+    for (i = 0; i < BULK_COUNT; i += 2) {
+        uint64_t  key = i;
+        fail_unless(cork_hash_table_delete(table, &key, NULL, NULL),
+                    "Couldn't delete entry %" PRIu64, key);
+    }
+    fail_unless_equal("Table size", "%zu", (size_t) BULK_COUNT / 2,
+                      cork_hash_table_size(table));
+    cork_hash_table_free(table);
+    fail_unless_equal("Allocated bytes", "%zu", (size_t) 0,
+                      counting_alloc_bytes);
+}
+
+START_TEST(test_hash_table_allocator)
+{
+    test_hash_table_allocator_flags(0);
+    test_hash_table_allocator_flags(CORK_HASH_TABLE_INCREMENTAL_RESIZE);
+    test_hash_table_allocator_flags(CORK_HASH_TABLE_OPEN_ADDRESSING);
+    test_hash_table_allocator_flags(CORK_HASH_TABLE_POOLED_ENTRIES);
+    test_hash_table_allocator_flags
+        (CORK_HASH_TABLE_POOLED_ENTRIES | CORK_HASH_TABLE_INCREMENTAL_RESIZE);
+}
+END_TEST
+
+/* Fills up a table, deletes 90% of its entries, and makes sure that shrinking
+ * the table gives back most of its memory without losing any entries. */
+static void
+test_hash_table_shrink_flags(unsigned int flags, bool auto_shrink)
+{
+    struct cork_alloc  *alloc = cork_alloc_new_alloc(cork_allocator);
+    struct cork_hash_table  *table;
+    struct cork_hash_table_iterator  iterator;
+    struct cork_hash_table_entry  *entry;
+    uint64_t  expected_sum = 0;
+    uint64_t  last_key = 0;
+    size_t  peak_bytes;
+    uint64_t  i;
+
+    cork_alloc_set_xmalloc(alloc, counting_alloc__xmalloc);
+    cork_alloc_set_free(alloc, counting_alloc__free);
+    counting_alloc_bytes = 0;
+
+    if (auto_shrink) {
+        flags |= CORK_HASH_TABLE_AUTO_SHRINK;
+    }
+    table = cork_hash_table_new_ex(0, flags, alloc);
+    cork_hash_table_set_hash(table, uint64__murmur_hash);
+    cork_hash_table_set_equals(table, uint64__equals);
+    cork_hash_table_set_free_key(table, uint64__free);
+    cork_hash_table_set_free_value(table, uint64__free);
+    for (i = 0; i < BULK_COUNT; i++) {
+        cork_hash_table_put
+            (table, uint64__new(i), uint64__new(i), NULL, NULL, NULL);
+    }
+    peak_bytes = counting_alloc_bytes;
+
+    for (i = 0; i < BULK_COUNT; i++) {
+        if (i % 10 == 0) {
+            expected_sum += i;
+        } else {
+            uint64_t  key = i;
+            fail_unless(cork_hash_table_delete(table, &key, NULL, NULL),
+                        "Couldn't delete entry %" PRIu64, key);
+        }
+    }
+
+    if (auto_shrink) {
+        /* Tables shrink the next time you add something. */
+        cork_hash_table_put
+            (table, uint64__new(BULK_COUNT), uint64__new(BULK_COUNT),
+             NULL, NULL, NULL);
+        expected_sum += BULK_COUNT;
+        fail_unless(counting_alloc_bytes < peak_bytes / 2,
+                    "Table should have shrunk (%zu bytes, peak %zu)",
+                    counting_alloc_bytes, peak_bytes);
+    } else {
+        cork_hash_table_shrink_to_fit(table);
+        fail_unless(counting_alloc_bytes < peak_bytes / 4,
+                    "Table should have shrunk (%zu bytes, peak %zu)",
+                    counting_alloc_bytes, peak_bytes);
+    }
+
+    fail_unless_equal("Table size", "%zu",
+                      (size_t) BULK_COUNT / 10 + auto_shrink,
+                      cork_hash_table_size(table));
+    for (i = 0; i < BULK_COUNT; i += 10) {
+        uint64_t  *value;
+        uint64_t  key = i;
+        fail_if((value = cork_hash_table_get(table, &key)) == NULL,
+                "Missing entry %" PRIu64, key);
+        fail_unless_equal("Entry value", "%" PRIu64, i, *value);
+    }
+    test_map_sum(table, expected_sum);
+    test_iterator_sum(table, expected_sum);
+
+    /* Shrinking doesn't change the order of ordered tables. */
+    if (!(flags & (CORK_HASH_TABLE_OPEN_ADDRESSING |
+                   CORK_HASH_TABLE_UNORDERED))) {
+        cork_hash_table_iterator_init(table, &iterator);
+        while ((entry = cork_hash_table_iterator_next(&iterator)) != NULL) {
+            uint64_t  key = *(uint64_t *) entry->key;
+            fail_unless(key == 0 || key > last_key,
+                        "Entry %" PRIu64 " out of order", key);
+            last_key = key;
+        }
+    }
+
+    /* The table keeps working after it shrinks. */
+    for (i = 1; i < BULK_COUNT; i += 10) {
+        cork_hash_table_put
+            (table, uint64__new(i), uint64__new(i), NULL, NULL, NULL);
+        expected_sum += i;
+    }
+    test_map_sum(table, expected_sum);
+
+    if (auto_shrink) {
+        cork_hash_table_clear(table);
+        fail_unless(counting_alloc_bytes < peak_bytes / 8,
+                    "Table should have shrunk (%zu bytes, peak %zu)",
+                    counting_alloc_bytes, peak_bytes);
+    }
+    cork_hash_table_free(table);
+    fail_unless_equal("Allocated bytes", "%zu", (size_t) 0,
+                      counting_alloc_bytes);
+}
+
+START_TEST(test_hash_table_shrink)
+{
+    test_hash_table_shrink_flags(0, false);
+    test_hash_table_shrink_flags(CORK_HASH_TABLE_INCREMENTAL_RESIZE, false);
+    test_hash_table_shrink_flags(CORK_HASH_TABLE_OPEN_ADDRESSING, false);
+    test_hash_table_shrink_flags(CORK_HASH_TABLE_POOLED_ENTRIES, false);
+    test_hash_table_shrink_flags
+        (CORK_HASH_TABLE_POOLED_ENTRIES | CORK_HASH_TABLE_UNORDERED, false);
+    test_hash_table_shrink_flags(0, true);
+    test_hash_table_shrink_flags(CORK_HASH_TABLE_INCREMENTAL_RESIZE, true);
+    test_hash_table_shrink_flags(CORK_HASH_TABLE_OPEN_ADDRESSING, true);
+    test_hash_table_shrink_flags(CORK_HASH_TABLE_UNORDERED, true);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Performance
+ */
+
+#define PERF_KEY_COUNT  10000
+
+static void
+test_hash_table_speed_flags(unsigned int flags, const char *name)
+{
+    struct cork_hash_table  *table;
+    char  what[64];
+    size_t  found = 0;
+    size_t  missed = 0;
+    size_t  i;
+
+    table = cork_pointer_hash_table_new(0, flags);
+    for (i = 1; i <= PERF_KEY_COUNT; i++) {
+        void  *key = (void *) (uintptr_t) (i * 7919);
+        fail_if_error(cork_hash_table_put
+                      (table, key, key, NULL, NULL, NULL));
+    }
+
+    /* These limits are far above what a lookup actually costs; they only
+     * fail if lookups stop being constant-time. */
+    snprintf(what, sizeof(what), "%s lookup", name);
+    fail_unless_fast(what, 1000, i, PERF_KEY_COUNT, {
+        void  *key = (void *) (uintptr_t) ((i + 1) * 7919);
+        found += (cork_hash_table_get(table, key) != NULL);
+    });
+    /* Every run should find every key. */
+    fail_unless(found % PERF_KEY_COUNT == 0, "Missing entries");
+
+    snprintf(what, sizeof(what), "%s miss", name);
+    fail_unless_fast(what, 1000, i, PERF_KEY_COUNT, {
+        void  *key = (void *) (uintptr_t) ((i + 1) * 7919 + 1);
+        missed += (cork_hash_table_get(table, key) != NULL);
+    });
+    fail_unless_equal("Unexpected entries", "%zu", (size_t) 0, missed);
+
+    cork_hash_table_free(table);
+}
+
+START_TEST(test_hash_table_speed)
+{
+    DESCRIBE_TEST;
+    test_hash_table_speed_flags(0, "chained");
+    test_hash_table_speed_flags(CORK_HASH_TABLE_OPEN_ADDRESSING, "open");
+}
+END_TEST
+
+/* Real pointers that all share the same alignment, and whose high bits are
+ * all the same. */
+struct aligned_key {
+    char  pad[64];
+};
+
+static struct aligned_key  aligned_keys[PERF_KEY_COUNT];
+
+START_TEST(test_pointer_hash_table_aligned)
+{
+    struct cork_hash_table  *table;
+    size_t  found = 0;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    table = cork_pointer_hash_table_new(0, CORK_HASH_TABLE_OPEN_ADDRESSING);
+    for (i = 0; i < PERF_KEY_COUNT; i++) {
+        fail_if_error(cork_hash_table_put
+                      (table, &aligned_keys[i], &aligned_keys[i],
+                       NULL, NULL, NULL));
+    }
+    /* A lookup takes a few nanoseconds with a mixing hash, and hundreds if
+     * every key lands in the same few groups with the same control byte, so
+     * this limit is tighter than the others. */
+    fail_unless_fast("aligned pointer lookup", 100, i, PERF_KEY_COUNT, {
+        found += (cork_hash_table_get(table, &aligned_keys[i]) != NULL);
+    });
+    fail_unless(found % PERF_KEY_COUNT == 0, "Missing entries");
+    cork_hash_table_free(table);
+}
 END_TEST
 
 
@@ -270,13 +880,14 @@ END_TEST
  * String hash tables
  */
 
-START_TEST(test_string_hash_table)
+static void
+test_string_hash_table_flags(unsigned int flags)
 {
     struct cork_hash_table  *table;
     char  key[256];
     void  *value;
 
-    table = cork_string_hash_table_new(0, 0);
+    table = cork_string_hash_table_new(0, flags);
 
     fail_if_error(cork_hash_table_put
                   (table, "key1", (void *) (uintptr_t) 1, NULL, NULL, NULL));
@@ -296,6 +907,14 @@ START_TEST(test_string_hash_table)
 
     cork_hash_table_free(table);
 }
+
+START_TEST(test_string_hash_table)
+{
+    test_string_hash_table_flags(0);
+    test_string_hash_table_flags(CORK_HASH_TABLE_FAST_HASH);
+    test_string_hash_table_flags
+        (CORK_HASH_TABLE_FAST_HASH | CORK_HASH_TABLE_OPEN_ADDRESSING);
+}
 END_TEST
 
 
@@ -303,14 +922,15 @@ END_TEST
  * Pointer hash tables
  */
 
-START_TEST(test_pointer_hash_table)
+static void
+test_pointer_hash_table_flags(unsigned int flags)
 {
     struct cork_hash_table  *table;
     int  key1;
     int  key2;
     void  *value;
 
-    table = cork_pointer_hash_table_new(0, 0);
+    table = cork_pointer_hash_table_new(0, flags);
 
     fail_if_error(cork_hash_table_put
                   (table, &key1, (void *) (uintptr_t) 1, NULL, NULL, NULL));
@@ -328,6 +948,883 @@ START_TEST(test_pointer_hash_table)
 
     cork_hash_table_free(table);
 }
+
+START_TEST(test_pointer_hash_table)
+{
+    test_pointer_hash_table_flags(0);
+    test_pointer_hash_table_flags(CORK_HASH_TABLE_FAST_HASH);
+    test_pointer_hash_table_flags(CORK_HASH_TABLE_OPEN_ADDRESSING);
+    test_pointer_hash_table_flags
+        (CORK_HASH_TABLE_OPEN_ADDRESSING | CORK_HASH_TABLE_FAST_HASH);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Concurrent hash tables
+ */
+
+START_TEST(test_concurrent_hash_table)
+{
+    struct cork_concurrent_hash_table  *table;
+    unsigned int  ticket;
+    uint64_t  key;
+    uint64_t  *value;
+    void  *old_key;
+    void  *old_value;
+    bool  is_new;
+    uint64_t  i;
+
+    DESCRIBE_TEST;
+    table = cork_concurrent_hash_table_new(0, 0);
+    cork_concurrent_hash_table_set_hash(table, uint64__murmur_hash);
+    cork_concurrent_hash_table_set_equals(table, uint64__equals);
+    cork_concurrent_hash_table_set_free_key(table, uint64__free);
+    cork_concurrent_hash_table_set_free_value(table, uint64__free);
+
+    for (i = 0; i < BULK_COUNT; i++) {
+        cork_concurrent_hash_table_put
+            (table, uint64__new(i), uint64__new(i * 2), &is_new, NULL, NULL);
+        fail_unless(is_new, "Entry %" PRIu64 " should be new", i);
+    }
+    fail_unless_equal("Table size", "%zu", (size_t) BULK_COUNT,
+                      cork_concurrent_hash_table_size(table));
+
+    ticket = cork_concurrent_hash_table_read_begin(table);
+    for (i = 0; i < BULK_COUNT; i++) {
+        key = i;
+        value = cork_concurrent_hash_table_get(table, &key);
+        fail_if(value == NULL, "Missing entry %" PRIu64, i);
+        fail_unless_equal("Value", "%" PRIu64, i * 2, *value);
+    }
+    key = BULK_COUNT;
+    fail_if(cork_concurrent_hash_table_contains(table, &key),
+            "Unexpected entry %" PRIu64, key);
+    cork_concurrent_hash_table_read_end(table, ticket);
+
+    key = 5;
+    cork_concurrent_hash_table_put
+        (table, uint64__new(5), uint64__new(50), &is_new, &old_key, &old_value);
+    fail_if(is_new, "Entry 5 should not be new");
+    fail_unless_equal("Old value", "%" PRIu64, 10, *(uint64_t *) old_value);
+    cork_concurrent_hash_table_synchronize(table);
+    uint64__free(old_key);
+    uint64__free(old_value);
+
+    ticket = cork_concurrent_hash_table_read_begin(table);
+    value = cork_concurrent_hash_table_get(table, &key);
+    fail_unless_equal("Value", "%" PRIu64, 50, *value);
+    cork_concurrent_hash_table_read_end(table, ticket);
+
+    fail_unless(cork_concurrent_hash_table_delete
+                (table, &key, &old_key, &old_value),
+                "Couldn't delete entry 5");
+    fail_if(cork_concurrent_hash_table_delete(table, &key, NULL, NULL),
+            "Shouldn't be able to delete entry 5 twice");
+    cork_concurrent_hash_table_synchronize(table);
+    uint64__free(old_key);
+    uint64__free(old_value);
+    fail_unless_equal("Table size", "%zu", (size_t) BULK_COUNT - 1,
+                      cork_concurrent_hash_table_size(table));
+
+    cork_concurrent_hash_table_free(table);
+}
+END_TEST
+
+
+#define CONCURRENT_READER_COUNT  4
+#define CONCURRENT_STABLE_COUNT  500
+#define CONCURRENT_EXTRA_COUNT  1000
+#define CONCURRENT_ROUNDS  4
+
+struct concurrent_reader {
+    struct cork_concurrent_hash_table  *table;
+    volatile int  *done;
+    uint64_t  lookups;
+};
+
+static int
+concurrent_reader__run(void *vself)
+{
+    struct concurrent_reader  *self = vself;
+    while (!*self->done) {
+        unsigned int  ticket;
+        uint64_t  i;
+        ticket = cork_concurrent_hash_table_read_begin(self->table);
+        for (i = 0; i < CONCURRENT_STABLE_COUNT; i++) {
+            uint64_t  *value = cork_concurrent_hash_table_get(self->table, &i);
+            /* The writer only ever replaces these entries, so they must always
+             * be present, and their values always have the same parity as
+             * their keys. */
+            if (value == NULL || *value % 2 != i % 2) {
+                cork_concurrent_hash_table_read_end(self->table, ticket);
+                return -1;
+            }
+            self->lookups++;
+        }
+        cork_concurrent_hash_table_read_end(self->table, ticket);
+    }
+    return 0;
+}
+
+START_TEST(test_concurrent_hash_table_threads)
+{
+    struct cork_concurrent_hash_table  *table;
+    struct concurrent_reader  readers[CONCURRENT_READER_COUNT];
+    struct cork_thread  *threads[CONCURRENT_READER_COUNT];
+    static void
+        *retired[(CONCURRENT_STABLE_COUNT + CONCURRENT_EXTRA_COUNT) * 2];
+    volatile int  done = 0;
+    uint64_t  round;
+    uint64_t  i;
+
+    DESCRIBE_TEST;
+    table = cork_concurrent_hash_table_new(0, 0);
+    cork_concurrent_hash_table_set_hash(table, uint64__murmur_hash);
+    cork_concurrent_hash_table_set_equals(table, uint64__equals);
+    cork_concurrent_hash_table_set_free_key(table, uint64__free);
+    cork_concurrent_hash_table_set_free_value(table, uint64__free);
+    for (i = 0; i < CONCURRENT_STABLE_COUNT; i++) {
+        cork_concurrent_hash_table_put
+            (table, uint64__new(i), uint64__new(i), NULL, NULL, NULL);
+    }
+
+    for (i = 0; i < CONCURRENT_READER_COUNT; i++) {
+        readers[i].table = table;
+        readers[i].done = &done;
+        readers[i].lookups = 0;
+        fail_if_error(threads[i] = cork_thread_new
+                      ("reader", &readers[i], NULL, concurrent_reader__run));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+
+    for (round = 1; round <= CONCURRENT_ROUNDS; round++) {
+        /* Replace every stable entry, and add and remove a batch of extra
+         * entries to force the table to grow while the readers are active.
+         * We can only free the replaced keys and values once the readers
+         * are done with them. */
+        size_t  retired_count = 0;
+        for (i = 0; i < CONCURRENT_STABLE_COUNT; i++) {
+            cork_concurrent_hash_table_put
+                (table, uint64__new(i), uint64__new(i + round * 2), NULL,
+                 &retired[retired_count], &retired[retired_count + 1]);
+            retired_count += 2;
+        }
+        for (i = 0; i < CONCURRENT_EXTRA_COUNT; i++) {
+            cork_concurrent_hash_table_put
+                (table, uint64__new(CONCURRENT_STABLE_COUNT + i),
+                 uint64__new(0), NULL, NULL, NULL);
+        }
+        for (i = 0; i < CONCURRENT_EXTRA_COUNT; i++) {
+            uint64_t  key = CONCURRENT_STABLE_COUNT + i;
+            fail_unless(cork_concurrent_hash_table_delete
+                        (table, &key, &retired[retired_count],
+                         &retired[retired_count + 1]),
+                        "Couldn't delete entry %" PRIu64, key);
+            retired_count += 2;
+        }
+        cork_concurrent_hash_table_synchronize(table);
+        for (i = 0; i < retired_count; i++) {
+            uint64__free(retired[i]);
+        }
+    }
+
+    done = 1;
+    for (i = 0; i < CONCURRENT_READER_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+    fail_unless_equal("Table size", "%zu", (size_t) CONCURRENT_STABLE_COUNT,
+                      cork_concurrent_hash_table_size(table));
+    cork_concurrent_hash_table_free(table);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Sharded hash tables
+ */
+
+static struct cork_sharded_hash_table *
+sharded_hash_table_new(size_t shard_count, unsigned int flags)
+{
+    struct cork_sharded_hash_table  *table =
+        cork_sharded_hash_table_new(shard_count, 0, flags);
+    cork_sharded_hash_table_set_hash(table, uint64__murmur_hash);
+    cork_sharded_hash_table_set_equals(table, uint64__equals);
+    cork_sharded_hash_table_set_free_key(table, uint64__free);
+    cork_sharded_hash_table_set_free_value(table, uint64__free);
+    return table;
+}
+
+static void
+test_sharded_hash_table_flags(size_t shard_count, unsigned int flags)
+{
+    struct cork_sharded_hash_table  *table;
+    struct cork_sharded_hash_table_iterator  iter;
+    struct cork_hash_table_entry  *entry;
+    uint64_t  key;
+    uint64_t  *value;
+    uint64_t  sum;
+    uint64_t  i;
+    bool  is_new;
+
+    table = sharded_hash_table_new(shard_count, flags);
+    for (i = 0; i < BULK_COUNT; i++) {
+        cork_sharded_hash_table_put
+            (table, uint64__new(i), uint64__new(i), &is_new, NULL, NULL);
+        fail_unless(is_new, "Entry %" PRIu64 " should be new", i);
+    }
+    fail_unless_equal("Table size", "%zu", (size_t) BULK_COUNT,
+                      cork_sharded_hash_table_size(table));
+
+    for (i = 0; i < BULK_COUNT; i++) {
+        value = cork_sharded_hash_table_get(table, &i);
+        fail_if(value == NULL, "Couldn't find entry %" PRIu64, i);
+        fail_unless_equal("Value", "%" PRIu64, i, *value);
+    }
+    key = BULK_COUNT;
+    fail_if(cork_sharded_hash_table_contains(table, &key),
+            "Shouldn't find entry %" PRIu64, key);
+
+    sum = 0;
+    cork_sharded_hash_table_map(table, &sum, uint64_sum);
+    fail_unless_equal("Sum", "%" PRIu64,
+                      (uint64_t) BULK_COUNT * (BULK_COUNT - 1) / 2, sum);
+
+    sum = 0;
+    cork_sharded_hash_table_iterator_init(table, &iter);
+    while ((entry = cork_sharded_hash_table_iterator_next(&iter)) != NULL) {
+        value = entry->value;
+        sum += *value;
+    }
+    cork_sharded_hash_table_iterator_done(&iter);
+    fail_unless_equal("Sum", "%" PRIu64,
+                      (uint64_t) BULK_COUNT * (BULK_COUNT - 1) / 2, sum);
+
+    /* Stopping an iterator early must release its shard. */
+    cork_sharded_hash_table_iterator_init(table, &iter);
+    fail_if(cork_sharded_hash_table_iterator_next(&iter) == NULL,
+            "Iterator should find an entry");
+    cork_sharded_hash_table_iterator_done(&iter);
+
+    key = 0;
+    entry = cork_sharded_hash_table_lock_entry(table, &key, &is_new);
+    fail_if(is_new, "Entry 0 shouldn't be new");
+    value = entry->value;
+    *value = 100;
+    cork_sharded_hash_table_unlock_entry(table, entry);
+    value = cork_sharded_hash_table_get(table, &key);
+    fail_unless_equal("Value", "%" PRIu64, (uint64_t) 100, *value);
+
+    for (i = 0; i < BULK_COUNT; i += 2) {
+        fail_unless(cork_sharded_hash_table_delete(table, &i, NULL, NULL),
+                    "Couldn't delete entry %" PRIu64, i);
+    }
+    fail_unless_equal("Table size", "%zu", (size_t) BULK_COUNT / 2,
+                      cork_sharded_hash_table_size(table));
+
+    cork_sharded_hash_table_clear(table);
+    fail_unless_equal("Table size", "%zu", (size_t) 0,
+                      cork_sharded_hash_table_size(table));
+    cork_sharded_hash_table_iterator_init(table, &iter);
+    fail_unless(cork_sharded_hash_table_iterator_next(&iter) == NULL,
+                "Iterator shouldn't find any entries");
+
+    cork_sharded_hash_table_free(table);
+}
+
+START_TEST(test_sharded_hash_table)
+{
+    struct cork_sharded_hash_table  *table;
+    DESCRIBE_TEST;
+
+    table = cork_sharded_hash_table_new(5, 0, 0);
+    fail_unless_equal("Shard count", "%zu", (size_t) 8,
+                      cork_sharded_hash_table_shard_count(table));
+    cork_sharded_hash_table_free(table);
+
+    test_sharded_hash_table_flags(0, 0);
+    test_sharded_hash_table_flags(1, 0);
+    test_sharded_hash_table_flags(5, CORK_HASH_TABLE_UNORDERED);
+    test_sharded_hash_table_flags(16, CORK_HASH_TABLE_OPEN_ADDRESSING);
+}
+END_TEST
+
+
+#define SHARDED_WRITER_COUNT  4
+#define SHARDED_WRITER_KEYS  2000
+#define SHARDED_ROUNDS  4
+
+struct sharded_writer {
+    struct cork_sharded_hash_table  *table;
+    uint64_t  first_key;
+};
+
+static int
+sharded_writer__run(void *vself)
+{
+    struct sharded_writer  *self = vself;
+    uint64_t  round;
+    uint64_t  i;
+
+    for (round = 0; round < SHARDED_ROUNDS; round++) {
+        for (i = 0; i < SHARDED_WRITER_KEYS; i++) {
+            cork_sharded_hash_table_put
+                (self->table, uint64__new(self->first_key + i),
+                 uint64__new(1), NULL, NULL, NULL);
+        }
+        for (i = 0; i < SHARDED_WRITER_KEYS; i++) {
+            uint64_t  key = self->first_key + i;
+            if (!cork_sharded_hash_table_delete
+                (self->table, &key, NULL, NULL)) {
+                return -1;
+            }
+        }
+    }
+
+    /* Leave one last copy of each key behind, and bump a shared counter
+     * through the locked-entry interface. */
+    for (i = 0; i < SHARDED_WRITER_KEYS; i++) {
+        cork_sharded_hash_table_put
+            (self->table, uint64__new(self->first_key + i), uint64__new(1),
+             NULL, NULL, NULL);
+    }
+    for (i = 0; i < SHARDED_WRITER_KEYS; i++) {
+        uint64_t  key = (uint64_t) -1;
+        struct cork_hash_table_entry  *entry;
+        bool  is_new;
+        entry = cork_sharded_hash_table_lock_entry(self->table, &key, &is_new);
+        if (is_new) {
+            entry->key = uint64__new(key);
+            entry->value = uint64__new(0);
+        }
+        (*(uint64_t *) entry->value)++;
+        cork_sharded_hash_table_unlock_entry(self->table, entry);
+    }
+    return 0;
+}
+
+START_TEST(test_sharded_hash_table_threads)
+{
+    struct cork_sharded_hash_table  *table;
+    struct sharded_writer  writers[SHARDED_WRITER_COUNT];
+    struct cork_thread  *threads[SHARDED_WRITER_COUNT];
+    uint64_t  key;
+    uint64_t  *value;
+    uint64_t  sum;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    table = sharded_hash_table_new(0, 0);
+    for (i = 0; i < SHARDED_WRITER_COUNT; i++) {
+        writers[i].table = table;
+        writers[i].first_key = i * SHARDED_WRITER_KEYS;
+        fail_if_error(threads[i] = cork_thread_new
+                      ("writer", &writers[i], NULL, sharded_writer__run));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    for (i = 0; i < SHARDED_WRITER_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+
+    fail_unless_equal("Table size", "%zu",
+                      (size_t) SHARDED_WRITER_COUNT * SHARDED_WRITER_KEYS + 1,
+                      cork_sharded_hash_table_size(table));
+    key = (uint64_t) -1;
+    value = cork_sharded_hash_table_get(table, &key);
+    fail_if(value == NULL, "Couldn't find counter entry");
+    fail_unless_equal("Counter", "%" PRIu64,
+                      (uint64_t) SHARDED_WRITER_COUNT * SHARDED_WRITER_KEYS,
+                      *value);
+    sum = 0;
+    cork_sharded_hash_table_map(table, &sum, uint64_sum);
+    fail_unless_equal("Sum", "%" PRIu64,
+                      (uint64_t) SHARDED_WRITER_COUNT * SHARDED_WRITER_KEYS * 2,
+                      sum);
+    cork_sharded_hash_table_free(table);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Frozen hash tables
+ */
+
+static int
+uint64__freeze(void *user_data, const void *vi, struct cork_buffer *dest)
+{
+    cork_buffer_append_le64(dest, *(const uint64_t *) vi);
+    return 0;
+}
+
+static int
+uint64__freeze_constant(void *user_data, const void *vi,
+                        struct cork_buffer *dest)
+{
+    cork_buffer_append_le64(dest, 0);
+    return 0;
+}
+
+static struct cork_frozen_hash_table *
+freeze_and_open(struct cork_hash_table *table,
+                cork_hash_table_freeze_f freeze_key,
+                cork_hash_table_freeze_f freeze_value,
+                struct cork_buffer *image)
+{
+    struct cork_stream_consumer  *consumer;
+    struct cork_frozen_hash_table  *frozen;
+    struct cork_slice  slice;
+
+    cork_buffer_clear(image);
+    consumer = cork_buffer_to_stream_consumer(image);
+    fail_if_error(cork_hash_table_freeze
+                  (table, NULL, freeze_key, freeze_value, consumer));
+    cork_stream_consumer_free(consumer);
+    cork_slice_init_static(&slice, image->buf, image->size);
+    fail_if_error(frozen = cork_frozen_hash_table_open(&slice));
+    cork_slice_finish(&slice);
+    return frozen;
+}
+
+#define FROZEN_ENTRY_COUNT  1000
+
+START_TEST(test_frozen_hash_table)
+{
+    struct cork_hash_table  *table;
+    struct cork_frozen_hash_table  *frozen;
+    struct cork_frozen_hash_table_iterator  iter;
+    struct cork_frozen_hash_table_entry  entry;
+    struct cork_buffer  image = CORK_BUFFER_INIT();
+    uint8_t  key[8];
+    const void  *value;
+    size_t  value_len;
+    uint64_t  sum;
+    size_t  count;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    table = cork_hash_table_new(0, 0);
+    cork_hash_table_set_hash(table, uint64__hash);
+    cork_hash_table_set_equals(table, uint64__equals);
+    cork_hash_table_set_free_key(table, uint64__free);
+    cork_hash_table_set_free_value(table, uint64__free);
+
+    /* An empty table */
+    frozen = freeze_and_open(table, uint64__freeze, uint64__freeze, &image);
+    fail_unless_equal("Frozen size", "%zu", (size_t) 0,
+                      cork_frozen_hash_table_size(frozen));
+    cork_store_le64(key, 0);
+    fail_if(cork_frozen_hash_table_contains(frozen, key, sizeof(key)),
+            "Empty frozen table shouldn't contain anything");
+    cork_frozen_hash_table_iterator_init(frozen, &iter);
+    fail_if(cork_frozen_hash_table_iterator_next(&iter, &entry),
+            "Empty frozen table shouldn't have any entries");
+    cork_frozen_hash_table_free(frozen);
+
+    for (i = 0; i < FROZEN_ENTRY_COUNT; i++) {
+        cork_hash_table_put
+            (table, uint64__new(i), uint64__new(i * 3), NULL, NULL, NULL);
+    }
+    frozen = freeze_and_open(table, uint64__freeze, uint64__freeze, &image);
+    /* The image doesn't depend on the original table */
+    cork_hash_table_free(table);
+
+    fail_unless_equal("Frozen size", "%zu", (size_t) FROZEN_ENTRY_COUNT,
+                      cork_frozen_hash_table_size(frozen));
+    for (i = 0; i < FROZEN_ENTRY_COUNT; i++) {
+        cork_store_le64(key, i);
+        fail_if((value = cork_frozen_hash_table_get
+                 (frozen, key, sizeof(key), &value_len)) == NULL,
+                "Missing frozen key %zu", i);
+        fail_unless_equal("Value length", "%zu", (size_t) 8, value_len);
+        fail_unless((uintptr_t) value % 8 == 0, "Value isn't aligned");
+        fail_unless_equal("Value", "%" PRIu64, (uint64_t) i * 3,
+                          cork_load_le64(value));
+    }
+    cork_store_le64(key, FROZEN_ENTRY_COUNT);
+    fail_if(cork_frozen_hash_table_contains(frozen, key, sizeof(key)),
+            "Unexpected frozen key");
+    fail_if(cork_frozen_hash_table_contains(frozen, key, 4),
+            "Unexpected short frozen key");
+
+    count = 0;
+    sum = 0;
+    cork_frozen_hash_table_iterator_init(frozen, &iter);
+    while (cork_frozen_hash_table_iterator_next(&iter, &entry)) {
+        fail_unless_equal("Key length", "%zu", (size_t) 8, entry.key_len);
+        fail_unless_equal("Value", "%" PRIu64,
+                          cork_load_le64(entry.key) * 3,
+                          cork_load_le64(entry.value));
+        sum += cork_load_le64(entry.value);
+        count++;
+    }
+    fail_unless_equal("Entry count", "%zu", (size_t) FROZEN_ENTRY_COUNT, count);
+    fail_unless_equal("Sum", "%" PRIu64,
+                      (uint64_t) 3 * FROZEN_ENTRY_COUNT *
+                      (FROZEN_ENTRY_COUNT - 1) / 2, sum);
+    cork_frozen_hash_table_free(frozen);
+    cork_buffer_done(&image);
+}
+END_TEST
+
+START_TEST(test_frozen_string_hash_table)
+{
+    struct cork_hash_table  *table;
+    struct cork_frozen_hash_table  *frozen;
+    struct cork_buffer  image = CORK_BUFFER_INIT();
+    const char  *value;
+    size_t  value_len;
+
+    DESCRIBE_TEST;
+    table = cork_string_hash_table_new(0, 0);
+    cork_hash_table_put(table, "alpha", "one", NULL, NULL, NULL);
+    cork_hash_table_put(table, "beta", "two", NULL, NULL, NULL);
+    cork_hash_table_put(table, "", "empty", NULL, NULL, NULL);
+    frozen = freeze_and_open
+        (table, cork_hash_table_freeze_string, cork_hash_table_freeze_string,
+         &image);
+
+    fail_unless_equal("Frozen size", "%zu", (size_t) 3,
+                      cork_frozen_hash_table_size(frozen));
+    fail_if((value = cork_frozen_hash_table_get
+             (frozen, "beta", 4, &value_len)) == NULL, "Missing beta");
+    fail_unless(value_len == 3 && memcmp(value, "two", 3) == 0,
+                "Unexpected value for beta");
+    fail_if((value = cork_frozen_hash_table_get
+             (frozen, "", 0, &value_len)) == NULL, "Missing empty key");
+    fail_unless(value_len == 5 && memcmp(value, "empty", 5) == 0,
+                "Unexpected value for empty key");
+    fail_if(cork_frozen_hash_table_contains(frozen, "alph", 4),
+            "Unexpected prefix key");
+    cork_frozen_hash_table_free(frozen);
+
+    /* Keys without values */
+    frozen = freeze_and_open
+        (table, cork_hash_table_freeze_string, NULL, &image);
+    fail_if((value = cork_frozen_hash_table_get
+             (frozen, "alpha", 5, &value_len)) == NULL, "Missing alpha");
+    fail_unless_equal("Value length", "%zu", (size_t) 0, value_len);
+    cork_frozen_hash_table_free(frozen);
+
+    cork_hash_table_free(table);
+    cork_buffer_done(&image);
+}
+END_TEST
+
+START_TEST(test_frozen_hash_table_mmap)
+{
+    struct cork_hash_table  *table;
+    struct cork_frozen_hash_table  *frozen;
+    struct cork_stream_consumer  *consumer;
+    struct cork_buffer  image = CORK_BUFFER_INIT();
+    struct cork_slice  slice;
+    char  path[] = "/tmp/libcork-frozen-XXXXXX";
+    int  fd;
+    uint8_t  key[8];
+    const void  *value;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    table = cork_hash_table_new(0, CORK_HASH_TABLE_OPEN_ADDRESSING);
+    cork_hash_table_set_hash(table, uint64__hash);
+    cork_hash_table_set_equals(table, uint64__equals);
+    cork_hash_table_set_free_key(table, uint64__free);
+    cork_hash_table_set_free_value(table, uint64__free);
+    for (i = 0; i < FROZEN_ENTRY_COUNT; i++) {
+        cork_hash_table_put
+            (table, uint64__new(i), uint64__new(i + 1), NULL, NULL, NULL);
+    }
+    consumer = cork_buffer_to_stream_consumer(&image);
+    fail_if_error(cork_hash_table_freeze
+                  (table, NULL, uint64__freeze, uint64__freeze, consumer));
+    cork_stream_consumer_free(consumer);
+
+    fail_if((fd = mkstemp(path)) == -1, "Cannot create temporary file");
+    fail_unless(write(fd, image.buf, image.size) == (ssize_t) image.size,
+                "Cannot write temporary file");
+    close(fd);
+
+    fail_if_error(cork_mmap_file_slice(path, &slice));
+    fail_if_error(frozen = cork_frozen_hash_table_open(&slice));
+    /* The table keeps the mapping alive */
+    cork_slice_finish(&slice);
+    unlink(path);
+    fail_unless_equal("Frozen size", "%zu", (size_t) FROZEN_ENTRY_COUNT,
+                      cork_frozen_hash_table_size(frozen));
+    for (i = 0; i < FROZEN_ENTRY_COUNT; i++) {
+        cork_store_le64(key, i);
+        fail_if((value = cork_frozen_hash_table_get
+                 (frozen, key, sizeof(key), NULL)) == NULL,
+                "Missing frozen key %zu", i);
+        fail_unless_equal("Value", "%" PRIu64, (uint64_t) i + 1,
+                          cork_load_le64(value));
+    }
+    cork_frozen_hash_table_free(frozen);
+
+    /* Two keys that freeze to the same bytes */
+    consumer = cork_buffer_to_stream_consumer(&image);
+    fail_unless_error(cork_hash_table_freeze
+                      (table, NULL, uint64__freeze_constant, uint64__freeze,
+                       consumer),
+                      "Shouldn't freeze duplicate keys");
+    cork_stream_consumer_free(consumer);
+
+    cork_hash_table_free(table);
+    cork_buffer_done(&image);
+}
+END_TEST
+
+START_TEST(test_frozen_hash_table_bad_image)
+{
+    struct cork_hash_table  *table;
+    struct cork_frozen_hash_table  *frozen;
+    struct cork_buffer  image = CORK_BUFFER_INIT();
+    struct cork_slice  slice;
+    uint8_t  *buf;
+    size_t  size;
+
+    DESCRIBE_TEST;
+    table = cork_string_hash_table_new(0, 0);
+    cork_hash_table_put(table, "alpha", "one", NULL, NULL, NULL);
+    frozen = freeze_and_open
+        (table, cork_hash_table_freeze_string, cork_hash_table_freeze_string,
+         &image);
+    cork_frozen_hash_table_free(frozen);
+    cork_hash_table_free(table);
+    buf = image.buf;
+    size = image.size;
+
+    /* Truncated images */
+    cork_slice_init_static(&slice, buf, 16);
+    fail_unless_error(cork_frozen_hash_table_open(&slice),
+                      "Shouldn't open a truncated header");
+    cork_slice_init_static(&slice, buf, size - 1);
+    fail_unless_error(cork_frozen_hash_table_open(&slice),
+                      "Shouldn't open a truncated image");
+
+    /* Bad magic */
+    buf[0] ^= 0xff;
+    cork_slice_init_static(&slice, buf, size);
+    fail_unless_error(cork_frozen_hash_table_open(&slice),
+                      "Shouldn't open an image with a bad magic");
+    buf[0] ^= 0xff;
+
+    /* A slot count that isn't a power of two */
+    cork_store_le64(buf + 24, 7);
+    cork_slice_init_static(&slice, buf, size);
+    fail_unless_error(cork_frozen_hash_table_open(&slice),
+                      "Shouldn't open an image with a bad slot count");
+    cork_store_le64(buf + 24, 8);
+
+    /* A slot that points outside of the data section is treated as missing */
+    cork_store_le64(buf + 40 + 16, 1000);
+    cork_store_le64(buf + 40 + 24 + 16, 1000);
+    cork_store_le64(buf + 40 + 48 + 16, 1000);
+    cork_store_le64(buf + 40 + 72 + 16, 1000);
+    cork_store_le64(buf + 40 + 96 + 16, 1000);
+    cork_store_le64(buf + 40 + 120 + 16, 1000);
+    cork_store_le64(buf + 40 + 144 + 16, 1000);
+    cork_store_le64(buf + 40 + 168 + 16, 1000);
+    cork_slice_init_static(&slice, buf, size);
+    fail_if_error(frozen = cork_frozen_hash_table_open(&slice));
+    fail_if(cork_frozen_hash_table_contains(frozen, "alpha", 5),
+            "Shouldn't find a corrupt entry");
+    cork_frozen_hash_table_free(frozen);
+
+    cork_buffer_done(&image);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Type-specialized hash maps
+ */
+
+CORK_HASH_MAP_DEFINE(test_uint64_map, uint64_t, uint64_t,
+                     cork_hash_map_uint64_hash, cork_hash_map_uint64_equals);
+
+CORK_HASH_MAP_DEFINE(test_ipv4_map, struct cork_ipv4, unsigned int,
+                     cork_hash_map_ipv4_hash, cork_hash_map_ipv4_equals);
+
+CORK_HASH_MAP_DEFINE(test_string_map, const char *, size_t,
+                     cork_hash_map_string_hash, cork_hash_map_string_equals);
+
+/* A deliberately terrible hash function, so that every key collides */
+#define constant_hash(key)  ((cork_hash64) 0)
+
+CORK_HASH_MAP_DEFINE(test_collision_map, uint64_t, uint64_t,
+                     constant_hash, cork_hash_map_uint64_equals);
+
+START_TEST(test_uint64_hash_map)
+{
+#define ENTRY_COUNT  10000
+    struct test_uint64_map  map;
+    struct test_uint64_map_entry  *entry;
+    uint64_t  *value;
+    uint64_t  deleted;
+    uint64_t  sum = 0;
+    size_t  count = 0;
+    size_t  iter = 0;
+    bool  is_new;
+    uint64_t  i;
+
+    DESCRIBE_TEST;
+    test_uint64_map_init(&map);
+    fail_unless(test_uint64_map_get(&map, 0) == NULL, "Map should be empty");
+    fail_if(test_uint64_map_delete(&map, 0, NULL), "Map should be empty");
+    fail_unless(test_uint64_map_next(&map, &iter) == NULL,
+                "Map should be empty");
+
+    for (i = 0; i < ENTRY_COUNT; i++) {
+        test_uint64_map_put(&map, i, i * 2);
+    }
+    fail_unless_equal("Map size", "%zu", (size_t) ENTRY_COUNT,
+                      test_uint64_map_size(&map));
+    for (i = 0; i < ENTRY_COUNT; i++) {
+        value = test_uint64_map_get(&map, i);
+        fail_if(value == NULL, "Missing key %" PRIu64, i);
+        fail_unless_equal("Value", "%" PRIu64, i * 2, *value);
+    }
+    fail_unless(test_uint64_map_get(&map, ENTRY_COUNT) == NULL,
+                "Unexpected key");
+
+    /* Replace existing values */
+    value = test_uint64_map_get_or_create(&map, 5, &is_new);
+    fail_if(is_new, "Key 5 should already exist");
+    *value = 100;
+    test_uint64_map_put(&map, 6, 101);
+    fail_unless_equal("Value", "%" PRIu64, (uint64_t) 100,
+                      *test_uint64_map_get(&map, 5));
+    fail_unless_equal("Value", "%" PRIu64, (uint64_t) 101,
+                      *test_uint64_map_get(&map, 6));
+    fail_unless_equal("Map size", "%zu", (size_t) ENTRY_COUNT,
+                      test_uint64_map_size(&map));
+    test_uint64_map_put(&map, 5, 10);
+    test_uint64_map_put(&map, 6, 12);
+
+    /* Delete the odd keys, and make sure the even ones survive. */
+    for (i = 1; i < ENTRY_COUNT; i += 2) {
+        fail_unless(test_uint64_map_delete(&map, i, &deleted),
+                    "Couldn't delete key %" PRIu64, i);
+        fail_unless_equal("Deleted value", "%" PRIu64, i * 2, deleted);
+    }
+    fail_if(test_uint64_map_delete(&map, 1, NULL), "Key 1 should be gone");
+    fail_unless_equal("Map size", "%zu", (size_t) ENTRY_COUNT / 2,
+                      test_uint64_map_size(&map));
+    for (i = 0; i < ENTRY_COUNT; i++) {
+        fail_unless(test_uint64_map_contains(&map, i) == (i % 2 == 0),
+                    "Unexpected result for key %" PRIu64, i);
+    }
+
+    /* Reinserting fills in the tombstones. */
+    for (i = 1; i < ENTRY_COUNT; i += 2) {
+        value = test_uint64_map_get_or_create(&map, i, &is_new);
+        fail_unless(is_new, "Key %" PRIu64 " should be new", i);
+        *value = i * 2;
+    }
+    while ((entry = test_uint64_map_next(&map, &iter)) != NULL) {
+        fail_unless_equal("Value", "%" PRIu64, entry->key * 2, entry->value);
+        sum += entry->key;
+        count++;
+    }
+    fail_unless_equal("Entry count", "%zu", (size_t) ENTRY_COUNT, count);
+    fail_unless_equal("Key sum", "%" PRIu64,
+                      (uint64_t) ENTRY_COUNT * (ENTRY_COUNT - 1) / 2, sum);
+
+    test_uint64_map_clear(&map);
+    fail_unless_equal("Map size", "%zu", (size_t) 0,
+                      test_uint64_map_size(&map));
+    fail_unless(test_uint64_map_get(&map, 0) == NULL, "Map should be empty");
+    test_uint64_map_ensure_size(&map, ENTRY_COUNT);
+    test_uint64_map_put(&map, 1, 2);
+    fail_unless_equal("Value", "%" PRIu64, (uint64_t) 2,
+                      *test_uint64_map_get(&map, 1));
+    test_uint64_map_done(&map);
+#undef ENTRY_COUNT
+}
+END_TEST
+
+START_TEST(test_collision_hash_map)
+{
+#define ENTRY_COUNT  100
+    struct test_collision_map  map;
+    uint64_t  round;
+    uint64_t  i;
+
+    DESCRIBE_TEST;
+    test_collision_map_init(&map);
+    /* Churning through the same slots over and over fills the map with
+     * tombstones, which have to be reclaimed. */
+    for (round = 0; round < 20; round++) {
+        for (i = 0; i < ENTRY_COUNT; i++) {
+            test_collision_map_put(&map, round * ENTRY_COUNT + i, i);
+        }
+        for (i = 0; i < ENTRY_COUNT; i++) {
+            uint64_t  *value =
+                test_collision_map_get(&map, round * ENTRY_COUNT + i);
+            fail_if(value == NULL, "Missing key");
+            fail_unless_equal("Value", "%" PRIu64, i, *value);
+        }
+        for (i = 0; i < ENTRY_COUNT; i++) {
+            fail_unless(test_collision_map_delete
+                        (&map, round * ENTRY_COUNT + i, NULL),
+                        "Couldn't delete key");
+        }
+        fail_unless_equal("Map size", "%zu", (size_t) 0,
+                          test_collision_map_size(&map));
+    }
+    fail_unless(map.slot_count <= 512, "Map shouldn't grow without bound");
+    test_collision_map_done(&map);
+#undef ENTRY_COUNT
+}
+END_TEST
+
+START_TEST(test_ipv4_hash_map)
+{
+    struct test_ipv4_map  map;
+    struct cork_ipv4  addr;
+    unsigned int  *value;
+
+    DESCRIBE_TEST;
+    test_ipv4_map_init(&map);
+    fail_if_error(cork_ipv4_init(&addr, "192.168.1.1"));
+    test_ipv4_map_put(&map, addr, 1);
+    fail_if_error(cork_ipv4_init(&addr, "10.0.0.1"));
+    test_ipv4_map_put(&map, addr, 2);
+    fail_unless_equal("Map size", "%zu", (size_t) 2,
+                      test_ipv4_map_size(&map));
+
+    fail_if_error(cork_ipv4_init(&addr, "192.168.1.1"));
+    fail_if((value = test_ipv4_map_get(&map, addr)) == NULL, "Missing key");
+    fail_unless_equal("Value", "%u", 1, *value);
+    fail_if_error(cork_ipv4_init(&addr, "10.0.0.1"));
+    fail_if((value = test_ipv4_map_get(&map, addr)) == NULL, "Missing key");
+    fail_unless_equal("Value", "%u", 2, *value);
+    fail_if_error(cork_ipv4_init(&addr, "10.0.0.2"));
+    fail_unless(test_ipv4_map_get(&map, addr) == NULL, "Unexpected key");
+    test_ipv4_map_done(&map);
+}
+END_TEST
+
+START_TEST(test_string_hash_map)
+{
+    struct test_string_map  map;
+    char  key[] = "key";
+    size_t  *value;
+
+    DESCRIBE_TEST;
+    test_string_map_init(&map);
+    test_string_map_put(&map, "key", 1);
+    test_string_map_put(&map, "another key", 2);
+    /* Keys are compared by contents, not by address */
+    fail_if((value = test_string_map_get(&map, key)) == NULL, "Missing key");
+    fail_unless_equal("Value", "%zu", (size_t) 1, *value);
+    fail_if((value = test_string_map_get(&map, "another key")) == NULL,
+            "Missing key");
+    fail_unless_equal("Value", "%zu", (size_t) 2, *value);
+    fail_unless(test_string_map_get(&map, "no key") == NULL, "Unexpected key");
+    test_string_map_done(&map);
+}
 END_TEST
 
 
@@ -342,8 +1839,34 @@ test_suite()
 
     TCase  *tc_ds = tcase_create("hash_table");
     tcase_add_test(tc_ds, test_uint64_hash_table);
+    tcase_add_test(tc_ds, test_uint64_open_hash_table);
+    tcase_add_test(tc_ds, test_uint64_unordered_hash_table);
+    tcase_add_test(tc_ds, test_bulk_hash_table);
+    tcase_add_test(tc_ds, test_bulk_incremental_hash_table);
+    tcase_add_test(tc_ds, test_bulk_open_hash_table);
+    tcase_add_test(tc_ds, test_bulk_pooled_hash_table);
+    tcase_add_test(tc_ds, test_bulk_unordered_hash_table);
+    tcase_add_test(tc_ds, test_bulk_fast_hash_table);
+    tcase_add_test(tc_ds, test_hash64_table);
+    tcase_add_test(tc_ds, test_hash64_compatibility);
+    tcase_add_test(tc_ds, test_hash_table_allocator);
+    tcase_add_test(tc_ds, test_hash_table_shrink);
+    tcase_add_test(tc_ds, test_hash_table_speed);
+    tcase_add_test(tc_ds, test_pointer_hash_table_aligned);
     tcase_add_test(tc_ds, test_string_hash_table);
     tcase_add_test(tc_ds, test_pointer_hash_table);
+    tcase_add_test(tc_ds, test_concurrent_hash_table);
+    tcase_add_test(tc_ds, test_concurrent_hash_table_threads);
+    tcase_add_test(tc_ds, test_sharded_hash_table);
+    tcase_add_test(tc_ds, test_sharded_hash_table_threads);
+    tcase_add_test(tc_ds, test_frozen_hash_table);
+    tcase_add_test(tc_ds, test_frozen_string_hash_table);
+    tcase_add_test(tc_ds, test_frozen_hash_table_mmap);
+    tcase_add_test(tc_ds, test_frozen_hash_table_bad_image);
+    tcase_add_test(tc_ds, test_uint64_hash_map);
+    tcase_add_test(tc_ds, test_collision_hash_map);
+    tcase_add_test(tc_ds, test_ipv4_hash_map);
+    tcase_add_test(tc_ds, test_string_hash_map);
     suite_add_tcase(s, tc_ds);
 
     return s;
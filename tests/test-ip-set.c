@@ -0,0 +1,273 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "libcork/core.h"
+#include "libcork/ds.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Helpers
+ */
+
+static void
+add_addr(struct cork_ip_set *set, const char *str)
+{
+    struct cork_ip  addr;
+    fail_if_error(cork_ip_init(&addr, str));
+    cork_ip_set_add(set, &addr);
+}
+
+static void
+add_network(struct cork_ip_set *set, const char *str, unsigned int prefix_len)
+{
+    struct cork_ip  network;
+    fail_if_error(cork_ip_init(&network, str));
+    fail_if_error(cork_ip_set_add_network(set, &network, prefix_len));
+}
+
+static void
+add_range(struct cork_ip_set *set, const char *first_str, const char *last_str)
+{
+    struct cork_ip  first;
+    struct cork_ip  last;
+    fail_if_error(cork_ip_init(&first, first_str));
+    fail_if_error(cork_ip_init(&last, last_str));
+    fail_if_error(cork_ip_set_add_range(set, &first, &last));
+}
+
+/* Check an address against both the set and its serialized form */
+static void
+test_contains(const struct cork_ip_set *set,
+              const struct cork_ip_set_view *view,
+              const char *str, bool expected)
+{
+    struct cork_ip  addr;
+    fail_if_error(cork_ip_init(&addr, str));
+    fail_unless(cork_ip_set_contains(set, &addr) == expected,
+                "Set should%s contain %s", expected? "": "n't", str);
+    fail_unless(cork_ip_set_view_contains(view, &addr) == expected,
+                "Serialized set should%s contain %s",
+                expected? "": "n't", str);
+}
+
+
+/*-----------------------------------------------------------------------
+ * IP sets
+ */
+
+START_TEST(test_ip_set)
+{
+    struct cork_ip_set  *set;
+    struct cork_ip_set_view  view;
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_slice  slice;
+    struct cork_ip  first;
+    struct cork_ip  last;
+
+    DESCRIBE_TEST;
+    set = cork_ip_set_new();
+
+    add_addr(set, "10.0.0.5");
+    add_network(set, "10.0.1.0", 24);
+    /* Adjacent to the previous network, so they should be merged */
+    add_network(set, "10.0.2.0", 23);
+    add_range(set, "10.0.3.200", "10.0.4.10");
+    add_addr(set, "10.0.4.11");
+    add_addr(set, "255.255.255.255");
+    add_network(set, "2001:db8::", 32);
+    add_network(set, "2001:db8:1::", 48);
+    add_range(set, "fe80::1", "fe80::ffff");
+    add_addr(set, "fe80::1:0");
+    add_addr(set, "::1");
+
+    /* Nothing is visible until we build the set. */
+    cork_buffer_clear(&buf);
+    cork_ip_set_save(set, &buf);
+    cork_slice_init_static(&slice, buf.buf, buf.size);
+    fail_if_error(cork_ip_set_view_init(&view, &slice));
+    test_contains(set, &view, "10.0.0.5", false);
+
+    cork_ip_set_build(set);
+    fail_unless_equal("Range count", "%zu", (size_t) 6,
+                      cork_ip_set_range_count(set));
+    cork_buffer_clear(&buf);
+    cork_ip_set_save(set, &buf);
+    cork_slice_init_static(&slice, buf.buf, buf.size);
+    fail_if_error(cork_ip_set_view_init(&view, &slice));
+
+    test_contains(set, &view, "10.0.0.4", false);
+    test_contains(set, &view, "10.0.0.5", true);
+    test_contains(set, &view, "10.0.0.6", false);
+    test_contains(set, &view, "10.0.0.255", false);
+    test_contains(set, &view, "10.0.1.0", true);
+    test_contains(set, &view, "10.0.3.255", true);
+    test_contains(set, &view, "10.0.4.11", true);
+    test_contains(set, &view, "10.0.4.12", false);
+    test_contains(set, &view, "255.255.255.254", false);
+    test_contains(set, &view, "255.255.255.255", true);
+    test_contains(set, &view, "0.0.0.0", false);
+    test_contains(set, &view, "::", false);
+    test_contains(set, &view, "::1", true);
+    test_contains(set, &view, "2001:db7:ffff:ffff:ffff:ffff:ffff:ffff", false);
+    test_contains(set, &view, "2001:db8::", true);
+    test_contains(set, &view, "2001:db8:1:2::3", true);
+    test_contains(set, &view, "2001:db8:ffff:ffff:ffff:ffff:ffff:ffff", true);
+    test_contains(set, &view, "2001:db9::", false);
+    test_contains(set, &view, "fe80::", false);
+    test_contains(set, &view, "fe80::1", true);
+    test_contains(set, &view, "fe80::1:0", true);
+    test_contains(set, &view, "fe80::1:1", false);
+    /* IPv4 addresses don't match IPv6 ranges */
+    test_contains(set, &view, "::ffff:10.0.0.5", false);
+
+    /* Adding everything merges all of the ranges for that version */
+    add_network(set, "0.0.0.0", 0);
+    cork_ip_set_build(set);
+    fail_unless_equal("Range count", "%zu", (size_t) 4,
+                      cork_ip_set_range_count(set));
+    cork_buffer_clear(&buf);
+    cork_ip_set_save(set, &buf);
+    cork_slice_init_static(&slice, buf.buf, buf.size);
+    fail_if_error(cork_ip_set_view_init(&view, &slice));
+    test_contains(set, &view, "0.0.0.0", true);
+    test_contains(set, &view, "192.168.0.1", true);
+    test_contains(set, &view, "fe80::", false);
+
+    /* Invalid ranges */
+    cork_ip_init(&first, "10.0.0.2");
+    cork_ip_init(&last, "10.0.0.1");
+    fail_unless_error(cork_ip_set_add_range(set, &first, &last),
+                      "Shouldn't be able to add a backwards range");
+    cork_ip_init(&last, "::1");
+    fail_unless_error(cork_ip_set_add_range(set, &first, &last),
+                      "Shouldn't be able to add a mixed-version range");
+    fail_unless_error(cork_ip_set_add_network(set, &first, 24),
+                      "Shouldn't be able to add a network with host bits");
+
+    /* Invalid serialized sets */
+    cork_slice_init_static(&slice, buf.buf, buf.size - 1);
+    fail_unless_error(cork_ip_set_view_init(&view, &slice),
+                      "Shouldn't be able to read a truncated set");
+    cork_slice_init_static(&slice, "not an IP set at all", 20);
+    fail_unless_error(cork_ip_set_view_init(&view, &slice),
+                      "Shouldn't be able to read garbage");
+
+    cork_buffer_done(&buf);
+    cork_ip_set_free(set);
+}
+END_TEST
+
+START_TEST(test_ip_set_random)
+{
+#define RANGE_COUNT  2000
+#define LOOKUP_COUNT  10000
+    struct cork_ip_set  *set;
+    struct cork_ip_set_view  view;
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_slice  slice;
+    uint32_t  *starts;
+    uint32_t  *ends;
+    uint32_t  seed = 1;
+    size_t  i;
+    size_t  j;
+
+    DESCRIBE_TEST;
+    set = cork_ip_set_new();
+    starts = cork_calloc(RANGE_COUNT, sizeof(uint32_t));
+    ends = cork_calloc(RANGE_COUNT, sizeof(uint32_t));
+
+    /* Small ranges packed into a small part of the address space, so that
+     * lots of them overlap or are adjacent. */
+    for (i = 0; i < RANGE_COUNT; i++) {
+        struct cork_ip  first;
+        struct cork_ip  last;
+        seed = seed * 1103515245 + 12345;
+        starts[i] = 0x0a000000 + (seed >> 8) % 100000;
+        seed = seed * 1103515245 + 12345;
+        ends[i] = starts[i] + (seed >> 16) % 40;
+        first.version = 4;
+        first.ip.v4._.u32 = CORK_UINT32_HOST_TO_BIG(starts[i]);
+        last.version = 4;
+        last.ip.v4._.u32 = CORK_UINT32_HOST_TO_BIG(ends[i]);
+        fail_if_error(cork_ip_set_add_range(set, &first, &last));
+    }
+    cork_ip_set_build(set);
+    cork_ip_set_save(set, &buf);
+    cork_slice_init_static(&slice, buf.buf, buf.size);
+    fail_if_error(cork_ip_set_view_init(&view, &slice));
+
+    for (i = 0; i < LOOKUP_COUNT; i++) {
+        struct cork_ip  addr;
+        uint32_t  value = 0x0a000000 - 10 + i * 11;
+        bool  expected = false;
+        for (j = 0; j < RANGE_COUNT; j++) {
+            if (starts[j] <= value && value <= ends[j]) {
+                expected = true;
+                break;
+            }
+        }
+        addr.version = 4;
+        addr.ip.v4._.u32 = CORK_UINT32_HOST_TO_BIG(value);
+        fail_unless(cork_ip_set_contains(set, &addr) == expected,
+                    "Unexpected result for 0x%08" PRIx32, value);
+        fail_unless(cork_ip_set_view_contains(&view, &addr) == expected,
+                    "Unexpected serialized result for 0x%08" PRIx32, value);
+    }
+
+    cork_cfree(starts, RANGE_COUNT, sizeof(uint32_t));
+    cork_cfree(ends, RANGE_COUNT, sizeof(uint32_t));
+    cork_buffer_done(&buf);
+    cork_ip_set_free(set);
+#undef RANGE_COUNT
+#undef LOOKUP_COUNT
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("ip_set");
+
+    TCase  *tc_ds = tcase_create("ip_set");
+    tcase_set_timeout(tc_ds, 20.0);
+    tcase_add_test(tc_ds, test_ip_set);
+    tcase_add_test(tc_ds, test_ip_set_random);
+    suite_add_tcase(s, tc_ds);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    setup_allocator();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
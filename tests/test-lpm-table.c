@@ -0,0 +1,308 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "libcork/core.h"
+#include "libcork/ds.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Helpers
+ */
+
+#define value(i)  ((void *) (uintptr_t) (i))
+
+static void
+add_network(struct cork_lpm_table *table, const char *str,
+            unsigned int prefix_len, uintptr_t v)
+{
+    struct cork_ip  network;
+    fail_if_error(cork_ip_init(&network, str));
+    fail_if_error(cork_lpm_table_add(table, &network, prefix_len, value(v)));
+}
+
+static void
+test_lookup(struct cork_lpm_table *table, const char *str, uintptr_t expected)
+{
+    struct cork_ip  addr;
+    fail_if_error(cork_ip_init(&addr, str));
+    fail_unless(cork_lpm_table_lookup(table, &addr) == value(expected),
+                "Unexpected value for %s (expected %lu, got %lu)",
+                str, (unsigned long) expected,
+                (unsigned long) (uintptr_t) cork_lpm_table_lookup
+                (table, &addr));
+}
+
+/* A simple xorshift generator, so that the test is repeatable */
+static uint64_t
+next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static bool
+network_contains(const struct cork_ip *network, unsigned int prefix_len,
+                 const struct cork_ip *addr)
+{
+    const uint8_t  *n;
+    const uint8_t  *a;
+    unsigned int  full_bytes = prefix_len / 8;
+    unsigned int  extra_bits = prefix_len % 8;
+    if (network->version != addr->version) {
+        return false;
+    }
+    n = (network->version == 4)? network->ip.v4._.u8: network->ip.v6._.u8;
+    a = (addr->version == 4)? addr->ip.v4._.u8: addr->ip.v6._.u8;
+    if (memcmp(n, a, full_bytes) != 0) {
+        return false;
+    }
+    if (extra_bits > 0) {
+        uint8_t  mask = 0xff << (8 - extra_bits);
+        return (n[full_bytes] & mask) == (a[full_bytes] & mask);
+    }
+    return true;
+}
+
+
+/*-----------------------------------------------------------------------
+ * LPM tables
+ */
+
+START_TEST(test_lpm_table_basic)
+{
+    struct cork_lpm_table  *table;
+    struct cork_ip  addr;
+
+    DESCRIBE_TEST;
+    table = cork_lpm_table_new();
+
+    /* Nothing matches an empty table. */
+    cork_lpm_table_build(table);
+    test_lookup(table, "10.0.0.1", 0);
+    test_lookup(table, "::1", 0);
+
+    add_network(table, "10.0.0.0", 8, 1);
+    add_network(table, "10.1.0.0", 16, 2);
+    add_network(table, "10.1.2.0", 24, 3);
+    add_network(table, "10.1.2.128", 25, 4);
+    add_network(table, "10.1.2.129", 32, 5);
+    add_network(table, "192.168.0.0", 15, 6);
+    add_network(table, "2001:db8::", 32, 7);
+    add_network(table, "2001:db8:1::", 48, 8);
+    add_network(table, "2001:db8:1::1", 128, 9);
+    fail_unless_equal("Size", "%zu", (size_t) 9, cork_lpm_table_size(table));
+
+    /* Networks aren't visible until we build the table. */
+    test_lookup(table, "10.0.0.1", 0);
+    cork_lpm_table_build(table);
+
+    test_lookup(table, "9.255.255.255", 0);
+    test_lookup(table, "10.0.0.1", 1);
+    test_lookup(table, "10.255.255.255", 1);
+    test_lookup(table, "10.1.0.0", 2);
+    test_lookup(table, "10.1.3.0", 2);
+    test_lookup(table, "10.1.2.0", 3);
+    test_lookup(table, "10.1.2.127", 3);
+    test_lookup(table, "10.1.2.128", 4);
+    test_lookup(table, "10.1.2.129", 5);
+    test_lookup(table, "10.1.2.130", 4);
+    test_lookup(table, "11.0.0.0", 0);
+    test_lookup(table, "192.168.0.1", 6);
+    test_lookup(table, "192.169.255.255", 6);
+    test_lookup(table, "192.170.0.0", 0);
+    test_lookup(table, "2001:db8::1", 7);
+    test_lookup(table, "2001:db8:1::2", 8);
+    test_lookup(table, "2001:db8:1::1", 9);
+    test_lookup(table, "2001:db9::", 0);
+    /* IPv4 addresses don't match IPv6 networks, even mapped ones */
+    test_lookup(table, "::ffff:10.0.0.1", 0);
+
+    /* A default route, and a replacement for an existing network */
+    add_network(table, "0.0.0.0", 0, 10);
+    add_network(table, "10.1.0.0", 16, 11);
+    cork_lpm_table_build(table);
+    test_lookup(table, "11.0.0.0", 10);
+    test_lookup(table, "10.1.3.0", 11);
+    test_lookup(table, "10.1.2.0", 3);
+    test_lookup(table, "2001:db9::", 0);
+
+    /* Invalid networks */
+    cork_ip_init(&addr, "10.0.0.1");
+    fail_unless_error(cork_lpm_table_add(table, &addr, 8, value(12)),
+                      "Shouldn't be able to add a network with host bits");
+    fail_unless_error(cork_lpm_table_add(table, &addr, 33, value(12)),
+                      "Shouldn't be able to add a prefix that's too long");
+    fail_unless_equal("Size", "%zu", (size_t) 11, cork_lpm_table_size(table));
+
+    cork_lpm_table_free(table);
+}
+END_TEST
+
+START_TEST(test_lpm_table_random)
+{
+#define NETWORK_COUNT  500
+#define LOOKUP_COUNT  5000
+    struct cork_lpm_table  *table;
+    struct cork_ip  *networks;
+    unsigned int  *prefix_lens;
+    struct cork_ip  *addrs;
+    void  **results;
+    uint64_t  state = 12345;
+    size_t  i;
+    size_t  j;
+
+    DESCRIBE_TEST;
+    table = cork_lpm_table_new();
+    networks = cork_calloc(NETWORK_COUNT, sizeof(struct cork_ip));
+    prefix_lens = cork_calloc(NETWORK_COUNT, sizeof(unsigned int));
+    addrs = cork_calloc(LOOKUP_COUNT, sizeof(struct cork_ip));
+    results = cork_calloc(LOOKUP_COUNT, sizeof(void *));
+
+    /* Keep the networks close together (the first byte is always 10 or 0x20)
+     * so that they nest within each other. */
+    for (i = 0; i < NETWORK_COUNT; i++) {
+        uint64_t  r = next_random(&state);
+        struct cork_ip  *network = &networks[i];
+        uint8_t  *bytes;
+        unsigned int  max_len;
+        unsigned int  byte;
+        if (r & 1) {
+            network->version = 4;
+            network->ip.v4._.u32 = (uint32_t) next_random(&state);
+            bytes = network->ip.v4._.u8;
+            max_len = 32;
+            bytes[0] = 10;
+        } else {
+            network->version = 6;
+            network->ip.v6._.u64[0] = next_random(&state);
+            network->ip.v6._.u64[1] = next_random(&state);
+            bytes = network->ip.v6._.u8;
+            max_len = 128;
+            bytes[0] = 0x20;
+        }
+        prefix_lens[i] = (r >> 8) % (max_len + 1);
+        if (prefix_lens[i] > 40 && max_len == 128) {
+            /* Keep most IPv6 networks short so that they overlap. */
+            prefix_lens[i] = 40 + prefix_lens[i] % 24;
+        }
+        /* Clear out the host bits. */
+        for (byte = 0; byte < max_len / 8; byte++) {
+            unsigned int  start = byte * 8;
+            if (start >= prefix_lens[i]) {
+                bytes[byte] = 0;
+            } else if (start + 8 > prefix_lens[i]) {
+                bytes[byte] &= 0xff << (8 - (prefix_lens[i] - start));
+            }
+        }
+        fail_if_error(cork_lpm_table_add
+                      (table, network, prefix_lens[i], value(i + 1)));
+    }
+    cork_lpm_table_build(table);
+
+    /* Look up addresses near the networks, and make sure that we get the same
+     * answer as a linear scan. */
+    for (i = 0; i < LOOKUP_COUNT; i++) {
+        struct cork_ip  *addr = &addrs[i];
+        const struct cork_ip  *base =
+            &networks[next_random(&state) % NETWORK_COUNT];
+        *addr = *base;
+        if (addr->version == 4) {
+            addr->ip.v4._.u8[3] ^= next_random(&state);
+            if (i % 3 == 0) {
+                addr->ip.v4._.u8[2] ^= next_random(&state);
+            }
+        } else {
+            addr->ip.v6._.u8[15] ^= next_random(&state);
+            addr->ip.v6._.u8[6] ^= next_random(&state) & 0x0f;
+            if (i % 3 == 0) {
+                addr->ip.v6._.u8[4] ^= next_random(&state);
+            }
+        }
+    }
+    cork_lpm_table_lookup_batch(table, addrs, LOOKUP_COUNT, results);
+
+    for (i = 0; i < LOOKUP_COUNT; i++) {
+        void  *expected = NULL;
+        int  best_len = -1;
+        for (j = 0; j < NETWORK_COUNT; j++) {
+            if ((int) prefix_lens[j] >= best_len &&
+                network_contains(&networks[j], prefix_lens[j], &addrs[i])) {
+                best_len = prefix_lens[j];
+                expected = value(j + 1);
+            }
+        }
+        fail_unless(cork_lpm_table_lookup(table, &addrs[i]) == expected,
+                    "Unexpected lookup result for address %zu", i);
+        fail_unless(results[i] == expected,
+                    "Unexpected batch lookup result for address %zu", i);
+        if (addrs[i].version == 4) {
+            fail_unless(cork_lpm_table_lookup_ipv4
+                        (table, &addrs[i].ip.v4) == expected,
+                        "Unexpected IPv4 lookup result for address %zu", i);
+        } else {
+            fail_unless(cork_lpm_table_lookup_ipv6
+                        (table, &addrs[i].ip.v6) == expected,
+                        "Unexpected IPv6 lookup result for address %zu", i);
+        }
+    }
+
+    cork_cfree(networks, NETWORK_COUNT, sizeof(struct cork_ip));
+    cork_cfree(prefix_lens, NETWORK_COUNT, sizeof(unsigned int));
+    cork_cfree(addrs, LOOKUP_COUNT, sizeof(struct cork_ip));
+    cork_cfree(results, LOOKUP_COUNT, sizeof(void *));
+    cork_lpm_table_free(table);
+#undef NETWORK_COUNT
+#undef LOOKUP_COUNT
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("lpm_table");
+
+    TCase  *tc_ds = tcase_create("lpm_table");
+    tcase_set_timeout(tc_ds, 20.0);
+    tcase_add_test(tc_ds, test_lpm_table_basic);
+    tcase_add_test(tc_ds, test_lpm_table_random);
+    suite_add_tcase(s, tc_ds);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    setup_allocator();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -7,8 +7,12 @@
  * ----------------------------------------------------------------------
  */
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <check.h>
 
@@ -17,6 +21,7 @@
 #include "libcork/ds/managed-buffer.h"
 #include "libcork/ds/slice.h"
 #include "libcork/helpers/errors.h"
+#include "libcork/threads/basics.h"
 
 #include "helpers.h"
 
@@ -291,6 +296,213 @@ START_TEST(test_slice_equals_02)
 END_TEST
 
 
+/*-----------------------------------------------------------------------
+ * Pooled managed buffers
+ */
+
+START_TEST(test_pooled_buffer)
+{
+    static char  BUF[] = "abcdefghijklmnop";
+    struct cork_managed_buffer_pool  *pool;
+    struct cork_managed_buffer  *mbuf;
+    struct cork_managed_buffer  *recycled;
+    struct cork_slice  slice;
+    struct cork_slice  copy;
+    void  *data;
+
+    pool = cork_managed_buffer_pool_new(2048);
+    fail_unless_equal("Buffer size", "%zu", (size_t) 2048,
+                      cork_managed_buffer_pool_buffer_size(pool));
+
+    mbuf = cork_managed_buffer_pool_new_buffer(pool, &data);
+    fail_unless(data == mbuf->buf, "Unexpected payload pointer");
+    fail_unless_equal("Buffer size", "%zu", (size_t) 2048, mbuf->size);
+    /* The whole payload is writable, and we can shrink it afterwards. */
+    memset(data, 'x', 2048);
+    memcpy(data, BUF, sizeof(BUF) - 1);
+    mbuf->size = sizeof(BUF) - 1;
+
+    fail_if_error(cork_managed_buffer_slice(&slice, mbuf, 4, 6));
+    fail_unless(cork_slice_get_managed_buffer(&slice) == mbuf,
+                "Slice should refer to its pooled buffer");
+    fail_unless_error(cork_managed_buffer_slice(&copy, mbuf, 10, 10),
+                      "Shouldn't be able to slice past the shrunken size");
+    cork_slice_finish(&copy);
+    cork_managed_buffer_unref(mbuf);
+
+    /* The slice keeps the buffer alive after we drop our own reference. */
+    fail_if_error(cork_slice_copy(&copy, &slice, 1, 4));
+    cork_slice_finish(&slice);
+    fail_unless(memcmp(copy.buf, "fghi", 4) == 0,
+                "Unexpected slice contents");
+    cork_slice_finish(&copy);
+
+    /* Once the last reference is gone, the next buffer reuses its memory. */
+    recycled = cork_managed_buffer_pool_new_buffer(pool, NULL);
+    fail_unless(recycled == mbuf, "Pooled buffer should be recycled");
+    fail_unless_equal("Buffer size", "%zu", (size_t) 2048, recycled->size);
+    fail_unless_equal("Reference count", "%d", 1, recycled->ref_count);
+    cork_managed_buffer_unref(recycled);
+
+    cork_managed_buffer_pool_free(pool);
+}
+END_TEST
+
+START_TEST(test_pooled_buffer_alignment)
+{
+    struct cork_managed_buffer_pool  *pool;
+    struct cork_managed_buffer  *mbufs[8];
+    size_t  i;
+
+    /* Buffers whose size isn't a multiple of the pointer size must still
+     * give us aligned buffer objects. */
+    pool = cork_managed_buffer_pool_new(1501);
+    for (i = 0; i < 8; i++) {
+        mbufs[i] = cork_managed_buffer_pool_new_buffer(pool, NULL);
+        fail_unless(((uintptr_t) mbufs[i] % sizeof(void *)) == 0,
+                    "Pooled buffer %zu is misaligned", i);
+    }
+    for (i = 0; i < 8; i++) {
+        cork_managed_buffer_unref(mbufs[i]);
+    }
+    cork_managed_buffer_pool_free(pool);
+}
+END_TEST
+
+#define POOL_THREAD_COUNT  4
+#define POOL_BUFFERS_PER_THREAD  10000
+#define POOL_BUFFERS_IN_FLIGHT  32
+
+static int
+test_pooled_buffer__run(void *user_data)
+{
+    struct cork_managed_buffer_pool  *pool = user_data;
+    struct cork_slice  slices[POOL_BUFFERS_IN_FLIGHT];
+    size_t  i;
+
+    for (i = 0; i < POOL_BUFFERS_IN_FLIGHT; i++) {
+        cork_slice_clear(&slices[i]);
+    }
+
+    for (i = 0; i < POOL_BUFFERS_PER_THREAD; i++) {
+        struct cork_slice  *slice = &slices[i % POOL_BUFFERS_IN_FLIGHT];
+        struct cork_managed_buffer  *mbuf;
+        unsigned char  *data;
+        cork_slice_finish(slice);
+        mbuf = cork_managed_buffer_pool_new_buffer(pool, (void **) &data);
+        data[0] = (unsigned char) i;
+        data[mbuf->size - 1] = (unsigned char) i;
+        rii_check(cork_managed_buffer_slice_offset(slice, mbuf, 0));
+        cork_managed_buffer_unref(mbuf);
+    }
+
+    for (i = 0; i < POOL_BUFFERS_IN_FLIGHT; i++) {
+        cork_slice_finish(&slices[i]);
+    }
+    return 0;
+}
+
+START_TEST(test_pooled_buffer_threads)
+{
+    struct cork_managed_buffer_pool  *pool;
+    struct cork_thread  *threads[POOL_THREAD_COUNT];
+    size_t  i;
+
+    pool = cork_managed_buffer_pool_new(1500);
+    for (i = 0; i < POOL_THREAD_COUNT; i++) {
+        fail_if_error(threads[i] = cork_thread_new
+                      ("receiver", pool, NULL, test_pooled_buffer__run));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    for (i = 0; i < POOL_THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+    cork_managed_buffer_pool_free(pool);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Memory-mapped files
+ */
+
+START_TEST(test_mmap_slice)
+{
+    static char  BUF[] = "abcdefghijklmnop";
+    char  path[] = "/tmp/libcork-mmap-XXXXXX";
+    int  fd;
+    struct cork_slice  slice;
+    struct cork_slice  copy;
+    struct cork_managed_buffer  *mbuf;
+
+    fail_if((fd = mkstemp(path)) == -1, "Cannot create temporary file");
+    fail_unless(write(fd, BUF, sizeof(BUF) - 1) ==
+                (ssize_t) (sizeof(BUF) - 1), "Cannot write temporary file");
+    close(fd);
+
+    fail_if_error(cork_mmap_file_slice(path, &slice));
+    fail_unless_equal("Slice size", "%zu", sizeof(BUF) - 1, slice.size);
+    fail_unless(memcmp(slice.buf, BUF, slice.size) == 0,
+                "Unexpected slice contents");
+    fail_if_error(cork_mmap_slice_advise(&slice, CORK_MMAP_SEQUENTIAL));
+
+    /* Copies share the same mapping */
+    fail_if_error(cork_slice_copy(&copy, &slice, 4, 6));
+    mbuf = cork_slice_get_managed_buffer(&slice);
+    fail_unless(mbuf == cork_slice_get_managed_buffer(&copy),
+                "Slices should share a mapping");
+    fail_unless_equal("Reference count", "%d", 2, mbuf->ref_count);
+    /* The copy outlives the original slice */
+    cork_slice_finish(&slice);
+    fail_if_error(cork_mmap_slice_advise(&copy, CORK_MMAP_WILLNEED));
+    fail_unless(memcmp(copy.buf, "efghij", 6) == 0,
+                "Unexpected slice contents");
+    cork_slice_finish(&copy);
+
+    /* Empty files work, too */
+    fail_if((fd = open(path, O_WRONLY | O_TRUNC)) == -1,
+            "Cannot truncate temporary file");
+    close(fd);
+    fail_if_error(cork_mmap_file_slice(path, &slice));
+    fail_unless_equal("Slice size", "%zu", (size_t) 0, slice.size);
+    fail_if_error(cork_mmap_slice_advise(&slice, CORK_MMAP_RANDOM));
+    cork_slice_finish(&slice);
+
+    unlink(path);
+    fail_unless_error(cork_mmap_file_slice(path, &slice),
+                      "Shouldn't be able to map a missing file");
+}
+END_TEST
+
+START_TEST(test_mmap_special_files)
+{
+    char  path[] = "/tmp/libcork-mmap-XXXXXX";
+    struct cork_slice  slice;
+
+    /* We can't map anything that isn't a regular file, and we don't block
+     * waiting for a writer to open a FIFO. */
+    fail_if(mkdtemp(path) == NULL, "Cannot create temporary directory");
+    fail_unless_error(cork_mmap_file_slice(path, &slice),
+                      "Shouldn't be able to map a directory");
+    rmdir(path);
+    fail_if(mkfifo(path, 0600) == -1, "Cannot create FIFO");
+    fail_unless_error(cork_mmap_file_slice(path, &slice),
+                      "Shouldn't be able to map a FIFO");
+    unlink(path);
+
+    /* Files that claim to be empty, but aren't, are read instead of
+     * mapped. */
+    if (access("/proc/self/status", R_OK) == 0) {
+        fail_if_error(cork_mmap_file_slice("/proc/self/status", &slice));
+        fail_if(slice.size == 0, "/proc/self/status shouldn't be empty");
+        fail_unless(memcmp(slice.buf, "Name:", 5) == 0,
+                    "Unexpected /proc/self/status contents");
+        cork_slice_finish(&slice);
+    }
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -319,6 +531,17 @@ test_suite()
     tcase_add_test(tc_slice_equality, test_slice_equals_02);
     suite_add_tcase(s, tc_slice_equality);
 
+    TCase  *tc_pool = tcase_create("pool");
+    tcase_add_test(tc_pool, test_pooled_buffer);
+    tcase_add_test(tc_pool, test_pooled_buffer_alignment);
+    tcase_add_test(tc_pool, test_pooled_buffer_threads);
+    suite_add_tcase(s, tc_pool);
+
+    TCase  *tc_mmap = tcase_create("mmap");
+    tcase_add_test(tc_mmap, test_mmap_slice);
+    tcase_add_test(tc_mmap, test_mmap_special_files);
+    suite_add_tcase(s, tc_mmap);
+
     return s;
 }
 
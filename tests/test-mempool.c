@@ -14,8 +14,10 @@
 
 #include <check.h>
 
+#include "libcork/core/allocator.h"
 #include "libcork/core/mempool.h"
 #include "libcork/core/types.h"
+#include "libcork/threads/basics.h"
 
 #include "helpers.h"
 
@@ -131,6 +133,320 @@ START_TEST(test_mempool_reuse_01)
 END_TEST
 
 
+#define BULK_COUNT  100
+
+static void
+test_mempool_bulk(struct cork_mempool *mp)
+{
+    int64_t  *objects[BULK_COUNT];
+    size_t  i;
+    size_t  j;
+
+    cork_mempool_new_objects(mp, (void **) objects, BULK_COUNT);
+    for (i = 0; i < BULK_COUNT; i++) {
+        fail_if(objects[i] == NULL, "Cannot allocate object #%zu", i);
+        *objects[i] = i;
+    }
+    for (i = 0; i < BULK_COUNT; i++) {
+        fail_unless(*objects[i] == (int64_t) i,
+                    "Unexpected value %" PRId64, *objects[i]);
+        for (j = 0; j < i; j++) {
+            fail_if(objects[i] == objects[j],
+                    "Object #%zu allocated twice", i);
+        }
+    }
+
+    /* Free some of the objects individually, and the rest in bulk. */
+    for (i = 0; i < 10; i++) {
+        cork_mempool_free_object(mp, objects[i]);
+    }
+    cork_mempool_free_objects(mp, (void **) &objects[10], BULK_COUNT - 10);
+
+    cork_mempool_new_objects(mp, (void **) objects, BULK_COUNT);
+    cork_mempool_free_objects(mp, (void **) objects, BULK_COUNT);
+    cork_mempool_free_objects(mp, (void **) objects, 0);
+    cork_mempool_free(mp);
+}
+
+START_TEST(test_mempool_bulk_01)
+{
+    DESCRIBE_TEST;
+    test_mempool_bulk(cork_mempool_new_ex(int64_t, 64));
+}
+END_TEST
+
+START_TEST(test_mempool_bulk_02)
+{
+    struct cork_mempool  *mp;
+    DESCRIBE_TEST;
+    mp = cork_mempool_new_ex(int64_t, 64);
+    cork_mempool_set_thread_cache(mp, 16);
+    test_mempool_bulk(mp);
+}
+END_TEST
+
+
+START_TEST(test_mempool_trim_01)
+{
+    DESCRIBE_TEST;
+    size_t  done_call_count = 0;
+    size_t  per_block = OBJECTS_PER_BLOCK(BLOCK_SIZE, sizeof(int64_t));
+    struct cork_mempool  *mp;
+    int64_t  *objects[BULK_COUNT];
+    size_t  i;
+
+    mp = cork_mempool_new_ex(int64_t, BLOCK_SIZE);
+    cork_mempool_set_user_data(mp, &done_call_count, NULL);
+    cork_mempool_set_init_object(mp, int64_init);
+    cork_mempool_set_done_object(mp, int64_done);
+    fail_unless_equal("Trimmed blocks", "%zu", (size_t) 0,
+                      cork_mempool_trim(mp));
+
+    cork_mempool_new_objects(mp, (void **) objects, BULK_COUNT);
+    fail_unless_equal("Trimmed blocks", "%zu", (size_t) 0,
+                      cork_mempool_trim(mp));
+
+    /* Keep one object allocated, which should pin its block. */
+    cork_mempool_free_objects(mp, (void **) &objects[1], BULK_COUNT - 1);
+    i = cork_mempool_trim(mp);
+    fail_if(i == 0, "Should have trimmed some blocks");
+    fail_unless_equal("done_object calls", "%zu", i * per_block,
+                      done_call_count);
+    fail_unless_equal("Trimmed blocks", "%zu", (size_t) 0,
+                      cork_mempool_trim(mp));
+
+    /* The remaining objects should still be usable. */
+    fail_unless(*objects[0] == 12, "Unexpected value %" PRId64, *objects[0]);
+    cork_mempool_free_object(mp, objects[0]);
+    fail_unless_equal("Trimmed blocks", "%zu", (size_t) 1,
+                      cork_mempool_trim(mp));
+    cork_mempool_new_objects(mp, (void **) objects, BULK_COUNT);
+    for (i = 0; i < BULK_COUNT; i++) {
+        fail_unless(*objects[i] == 12,
+                    "Unexpected value %" PRId64, *objects[i]);
+    }
+    cork_mempool_free_objects(mp, (void **) objects, BULK_COUNT);
+    cork_mempool_free(mp);
+}
+END_TEST
+
+START_TEST(test_mempool_trim_02)
+{
+    DESCRIBE_TEST;
+    size_t  done_call_count = 0;
+    struct cork_mempool  *mp;
+    int64_t  *objects[BULK_COUNT];
+    size_t  i;
+
+    mp = cork_mempool_new_ex(int64_t, BLOCK_SIZE);
+    cork_mempool_set_user_data(mp, &done_call_count, NULL);
+    cork_mempool_set_done_object(mp, int64_done);
+    cork_mempool_set_max_free(mp, 10);
+
+    cork_mempool_new_objects(mp, (void **) objects, BULK_COUNT);
+    for (i = 0; i < BULK_COUNT; i++) {
+        cork_mempool_free_object(mp, objects[i]);
+    }
+    /* Automatic trimming should have freed most of the blocks already. */
+    fail_if(done_call_count == 0, "Should have trimmed some blocks");
+    fail_unless(done_call_count > BULK_COUNT - 20,
+                "Should have trimmed more blocks (%zu objects)",
+                done_call_count);
+    cork_mempool_free(mp);
+}
+END_TEST
+
+START_TEST(test_mempool_allocator_01)
+{
+    DESCRIBE_TEST;
+    struct cork_alloc  *alloc = cork_stats_alloc_new(cork_allocator, 0);
+    struct cork_alloc_stats  stats;
+    struct cork_mempool  *mp;
+    int64_t  *objects[BULK_COUNT];
+
+    mp = cork_mempool_new_ex(int64_t, BLOCK_SIZE);
+    cork_mempool_set_allocator(mp, alloc);
+    cork_mempool_new_objects(mp, (void **) objects, BULK_COUNT);
+    cork_stats_alloc_get(alloc, &stats);
+    fail_if(stats.alloc_count == 0, "Blocks should come from the allocator");
+    fail_unless_equal("Live bytes", "%zu", stats.alloc_count * BLOCK_SIZE,
+                      stats.live_bytes);
+
+    /* Trimming and freeing the pool return blocks to the same allocator. */
+    cork_mempool_free_objects(mp, (void **) objects, BULK_COUNT);
+    fail_if(cork_mempool_trim(mp) == 0, "Should have trimmed some blocks");
+    cork_mempool_free(mp);
+    cork_stats_alloc_get(alloc, &stats);
+    fail_unless_equal("Live bytes", "%zu", (size_t) 0, stats.live_bytes);
+}
+END_TEST
+
+START_TEST(test_mempool_allocator_02)
+{
+    DESCRIBE_TEST;
+    struct cork_alloc  *alloc = cork_stats_alloc_new(cork_allocator, 0);
+    struct cork_alloc_stats  stats;
+    struct cork_mempool  *mp;
+    int64_t  *objects[BULK_COUNT];
+    size_t  alloc_count;
+
+    /* The pool itself comes from the allocator, too. */
+    mp = cork_mempool_new_size_alloc(sizeof(int64_t), BLOCK_SIZE, alloc);
+    cork_stats_alloc_get(alloc, &stats);
+    fail_unless_equal("Allocations", "%zu", (size_t) 1, stats.alloc_count);
+    fail_if(stats.live_bytes == 0, "Pool should come from the allocator");
+    cork_mempool_new_objects(mp, (void **) objects, BULK_COUNT);
+    cork_stats_alloc_get(alloc, &stats);
+    fail_if(stats.alloc_count == 1, "Blocks should come from the allocator");
+    cork_mempool_free_objects(mp, (void **) objects, BULK_COUNT);
+
+    /* So does the scratch space that trimming uses. */
+    cork_stats_alloc_get(alloc, &stats);
+    alloc_count = stats.alloc_count;
+    fail_if(cork_mempool_trim(mp) == 0, "Should have trimmed some blocks");
+    cork_stats_alloc_get(alloc, &stats);
+    fail_unless_equal("Allocations", "%zu", alloc_count + 1,
+                      stats.alloc_count);
+    cork_mempool_free(mp);
+    cork_stats_alloc_get(alloc, &stats);
+    fail_unless_equal("Live bytes", "%zu", (size_t) 0, stats.live_bytes);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Thread-cached memory pools
+ */
+
+#define THREAD_COUNT  4
+#define THREAD_OBJECT_COUNT  1000
+
+struct mempool_thread {
+    struct cork_mempool  *mp;
+    /* Objects allocated by another thread, which this thread should free */
+    int64_t  **foreign;
+    int64_t  *objects[THREAD_OBJECT_COUNT];
+};
+
+static int
+mempool_thread__run(void *vself)
+{
+    struct mempool_thread  *self = vself;
+    size_t  round;
+    size_t  i;
+
+    for (i = 0; i < THREAD_OBJECT_COUNT; i++) {
+        cork_mempool_free_object(self->mp, self->foreign[i]);
+    }
+
+    for (round = 0; round < 10; round++) {
+        for (i = 0; i < THREAD_OBJECT_COUNT; i++) {
+            self->objects[i] = cork_mempool_new_object(self->mp);
+            *self->objects[i] = i;
+        }
+        for (i = 0; i < THREAD_OBJECT_COUNT; i++) {
+            if (*self->objects[i] != (int64_t) i) {
+                return -1;
+            }
+            cork_mempool_free_object(self->mp, self->objects[i]);
+        }
+    }
+    return 0;
+}
+
+START_TEST(test_mempool_threads_01)
+{
+    DESCRIBE_TEST;
+    struct cork_mempool  *mp;
+    struct mempool_thread  threads[THREAD_COUNT];
+    struct cork_thread  *ts[THREAD_COUNT];
+    static int64_t  *foreign[THREAD_COUNT][THREAD_OBJECT_COUNT];
+    size_t  i;
+    size_t  j;
+
+    mp = cork_mempool_new_ex(int64_t, 256);
+    cork_mempool_set_thread_cache(mp, 16);
+
+    /* Allocate some objects in this thread, which the other threads will
+     * free. */
+    for (i = 0; i < THREAD_COUNT; i++) {
+        for (j = 0; j < THREAD_OBJECT_COUNT; j++) {
+            fail_if((foreign[i][j] = cork_mempool_new_object(mp)) == NULL,
+                    "Cannot allocate object #%zu", j);
+        }
+    }
+
+    for (i = 0; i < THREAD_COUNT; i++) {
+        threads[i].mp = mp;
+        threads[i].foreign = foreign[i];
+        fail_if_error(ts[i] = cork_thread_new
+                      ("mempool", &threads[i], NULL, mempool_thread__run));
+        fail_if_error(cork_thread_start(ts[i]));
+    }
+    for (i = 0; i < THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(ts[i]));
+    }
+
+    cork_mempool_free(mp);
+}
+END_TEST
+
+#define SHORT_THREAD_COUNT  100
+
+static int
+mempool_short_thread__run(void *vself)
+{
+    struct mempool_thread  *self = vself;
+    size_t  i;
+    for (i = 0; i < THREAD_OBJECT_COUNT; i++) {
+        self->objects[i] = cork_mempool_new_object(self->mp);
+    }
+    for (i = 0; i < THREAD_OBJECT_COUNT; i++) {
+        cork_mempool_free_object(self->mp, self->objects[i]);
+    }
+    cork_mempool_thread_flush(self->mp);
+    return 0;
+}
+
+START_TEST(test_mempool_threads_02)
+{
+    DESCRIBE_TEST;
+    struct cork_alloc  *alloc = cork_stats_alloc_new(cork_allocator, 0);
+    struct cork_alloc_stats  stats;
+    struct cork_mempool  *mp;
+    struct mempool_thread  thread;
+    size_t  first_live_bytes = 0;
+    size_t  i;
+
+    /* Threads that flush their magazines before exiting don't strand any
+     * objects, so the pool doesn't grow no matter how many of them use it. */
+    mp = cork_mempool_new_size_alloc(sizeof(int64_t), 256, alloc);
+    cork_mempool_set_thread_cache(mp, 64);
+    thread.mp = mp;
+    for (i = 0; i < SHORT_THREAD_COUNT; i++) {
+        struct cork_thread  *t;
+        fail_if_error(t = cork_thread_new
+                      ("mempool", &thread, NULL, mempool_short_thread__run));
+        fail_if_error(cork_thread_start(t));
+        fail_if_error(cork_thread_join(t));
+        cork_stats_alloc_get(alloc, &stats);
+        if (i == 0) {
+            first_live_bytes = stats.live_bytes;
+        }
+        fail_unless_equal("Live bytes after thread", "%zu",
+                          first_live_bytes, stats.live_bytes);
+    }
+
+    /* The flushed objects are all back in the depot, so we can trim every
+     * block. */
+    fail_if(cork_mempool_trim(mp) == 0, "Should have trimmed some blocks");
+    cork_mempool_free(mp);
+    cork_stats_alloc_get(alloc, &stats);
+    fail_unless_equal("Live bytes", "%zu", (size_t) 0, stats.live_bytes);
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -149,6 +465,14 @@ test_suite()
     tcase_add_test_raise_signal(tc_mempool, test_mempool_fail_01, SIGABRT);
 #endif
     tcase_add_test(tc_mempool, test_mempool_reuse_01);
+    tcase_add_test(tc_mempool, test_mempool_bulk_01);
+    tcase_add_test(tc_mempool, test_mempool_bulk_02);
+    tcase_add_test(tc_mempool, test_mempool_trim_01);
+    tcase_add_test(tc_mempool, test_mempool_trim_02);
+    tcase_add_test(tc_mempool, test_mempool_allocator_01);
+    tcase_add_test(tc_mempool, test_mempool_allocator_02);
+    tcase_add_test(tc_mempool, test_mempool_threads_01);
+    tcase_add_test(tc_mempool, test_mempool_threads_02);
     suite_add_tcase(s, tc_mempool);
 
     return s;
@@ -7,14 +7,18 @@
  * ----------------------------------------------------------------------
  */
 
+#include <sched.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 #include <check.h>
 
+#include "libcork/core/allocator.h"
 #include "libcork/core/types.h"
 #include "libcork/ds/ring-buffer.h"
+#include "libcork/threads/atomics.h"
+#include "libcork/threads/basics.h"
 
 #include "helpers.h"
 
@@ -114,6 +118,323 @@ START_TEST(test_ring_buffer_2)
 END_TEST
 
 
+static void
+test_ring_buffer_many(size_t size)
+{
+    struct cork_ring_buffer  buf;
+    void  *src[16];
+    void  *dest[16];
+    intptr_t  next_added = 1;
+    intptr_t  next_popped = 1;
+    size_t  round;
+    size_t  i;
+
+    cork_ring_buffer_init(&buf, size);
+    /* Move a varying number of elements in each round, so that the runs we
+     * copy wrap around the end of the array at different places. */
+    for (round = 0; round < 50; round++) {
+        size_t  add_count = (round % 7) + 1;
+        size_t  pop_count = (round % 5) + 1;
+        size_t  added;
+        size_t  popped;
+        size_t  expected_added = size - buf.size;
+        if (expected_added > add_count) {
+            expected_added = add_count;
+        }
+        for (i = 0; i < add_count; i++) {
+            src[i] = (void *) (next_added + i);
+        }
+        added = cork_ring_buffer_add_many(&buf, src, add_count);
+        fail_unless_equal("Added count", "%zu", expected_added, added);
+        next_added += added;
+
+        /* Mix in some single-element operations too. */
+        if (round % 3 == 0 && !cork_ring_buffer_is_empty(&buf)) {
+            intptr_t  element = (intptr_t) cork_ring_buffer_pop(&buf);
+            fail_unless_equal("Popped element", "%" PRIdPTR,
+                              next_popped, element);
+            next_popped++;
+        }
+
+        popped = cork_ring_buffer_pop_many(&buf, dest, pop_count);
+        fail_unless(popped <= pop_count, "Popped too many elements");
+        for (i = 0; i < popped; i++) {
+            fail_unless_equal("Popped element", "%" PRIdPTR,
+                              next_popped, (intptr_t) dest[i]);
+            next_popped++;
+        }
+        fail_unless_equal("Size", "%zu",
+                          (size_t) (next_added - next_popped), buf.size);
+    }
+
+    cork_ring_buffer_done(&buf);
+}
+
+START_TEST(test_ring_buffer_batch)
+{
+    /* A power-of-two capacity, which uses masking */
+    test_ring_buffer_many(8);
+    /* And one that doesn't */
+    test_ring_buffer_many(5);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Type-checked ring buffers
+ */
+
+struct descriptor {
+    uint64_t  offset;
+    uint32_t  length;
+    uint32_t  flags;
+};
+
+START_TEST(test_typed_ring_buffer)
+{
+    cork_ring(struct descriptor)  ring;
+    struct descriptor  desc;
+    struct descriptor  *slot;
+    uint64_t  next_added = 0;
+    uint64_t  next_popped = 0;
+    size_t  round;
+
+    /* Rounded up to 8 */
+    cork_ring_init(&ring, 5);
+    fail_unless_equal("Capacity", "%zu", (size_t) 8, ring.allocated_size);
+    fail_unless(cork_ring_peek(&ring) == NULL,
+                "Shouldn't be able to peek into empty ring buffer");
+    fail_unless(cork_ring_pop(&ring, &desc) == -1,
+                "Shouldn't be able to pop from empty ring buffer");
+
+    for (round = 0; round < 100; round++) {
+        /* Fill the ring up, alternating between the two ways of adding */
+        while (!cork_ring_is_full(&ring)) {
+            if (next_added % 2 == 0) {
+                desc.offset = next_added;
+                desc.length = (uint32_t) next_added * 2;
+                desc.flags = 0;
+                fail_if(cork_ring_add(&ring, desc) != 0,
+                        "Cannot add to ring buffer");
+            } else {
+                fail_if((slot = cork_ring_add_get(&ring)) == NULL,
+                        "Cannot add to ring buffer");
+                slot->offset = next_added;
+                slot->length = (uint32_t) next_added * 2;
+                slot->flags = 1;
+            }
+            next_added++;
+        }
+        fail_unless(cork_ring_add(&ring, desc) == -1,
+                    "Shouldn't be able to add to full ring buffer");
+        fail_unless(cork_ring_add_get(&ring) == NULL,
+                    "Shouldn't be able to add to full ring buffer");
+
+        /* Then drain part of it, so that we wrap around at different
+         * places each time. */
+        fail_if((slot = cork_ring_peek(&ring)) == NULL,
+                "Cannot peek into ring buffer");
+        fail_unless_equal("Offset", "%" PRIu64, next_popped, slot->offset);
+        cork_ring_skip(&ring);
+        next_popped++;
+        while (cork_ring_size(&ring) > round % 7) {
+            fail_if(cork_ring_pop(&ring, &desc) != 0,
+                    "Cannot pop from ring buffer");
+            fail_unless_equal("Offset", "%" PRIu64, next_popped, desc.offset);
+            fail_unless_equal("Length", "%" PRIu32,
+                              (uint32_t) next_popped * 2, desc.length);
+            fail_unless_equal("Flags", "%" PRIu32,
+                              (uint32_t) (next_popped % 2), desc.flags);
+            next_popped++;
+        }
+    }
+
+    cork_ring_clear(&ring);
+    fail_unless(cork_ring_is_empty(&ring), "Ring buffer should be empty");
+    cork_ring_done(&ring);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Concurrent ring buffers
+ */
+
+#define CONCURRENT_COUNT  100000
+
+/* The same sequence of operations works for both kinds of concurrent ring
+ * buffer when there's only one thread. */
+#define test_concurrent_ring_buffer(type) \
+    do { \
+        struct cork_##type##_ring_buffer  buf; \
+        intptr_t  i; \
+        /* Rounded up to 4 */ \
+        cork_##type##_ring_buffer_init(&buf, 3); \
+        fail_unless_equal("Size", "%zu", (size_t) 4, buf.allocated_size); \
+        fail_unless(cork_##type##_ring_buffer_peek(&buf) == NULL, \
+                    "Shouldn't be able to peek into empty ring buffer"); \
+        for (i = 1; i <= 4; i++) { \
+            fail_if(cork_##type##_ring_buffer_add(&buf, (void *) i) != 0, \
+                    "Cannot add to ring buffer"); \
+        } \
+        fail_if(cork_##type##_ring_buffer_add(&buf, (void *) 5) == 0, \
+                "Shouldn't be able to add to ring buffer"); \
+        /* Go around the ring a few times */ \
+        for (i = 1; i <= 20; i++) { \
+            fail_unless(((intptr_t) cork_##type##_ring_buffer_peek(&buf)) \
+                        == i, "Unexpected head of ring buffer (peek)"); \
+            fail_unless(((intptr_t) cork_##type##_ring_buffer_pop(&buf)) \
+                        == i, "Unexpected head of ring buffer (pop)"); \
+            fail_if(cork_##type##_ring_buffer_add(&buf, (void *) (i + 4)) \
+                    != 0, "Cannot add to ring buffer"); \
+        } \
+        for (i = 21; i <= 24; i++) { \
+            fail_unless(((intptr_t) cork_##type##_ring_buffer_pop(&buf)) \
+                        == i, "Unexpected head of ring buffer (pop)"); \
+        } \
+        fail_unless(cork_##type##_ring_buffer_pop(&buf) == NULL, \
+                    "Shouldn't be able to pop from ring buffer"); \
+        cork_##type##_ring_buffer_done(&buf); \
+    } while (0)
+
+START_TEST(test_spsc_ring_buffer)
+{
+    test_concurrent_ring_buffer(spsc);
+}
+END_TEST
+
+START_TEST(test_mpmc_ring_buffer)
+{
+    test_concurrent_ring_buffer(mpmc);
+}
+END_TEST
+
+
+static int
+spsc_producer__run(void *user_data)
+{
+    struct cork_spsc_ring_buffer  *buf = user_data;
+    intptr_t  i;
+    for (i = 1; i <= CONCURRENT_COUNT; i++) {
+        while (cork_spsc_ring_buffer_add(buf, (void *) i) != 0) {
+            sched_yield();
+        }
+    }
+    return 0;
+}
+
+START_TEST(test_spsc_ring_buffer_threaded)
+{
+    struct cork_spsc_ring_buffer  *buf = cork_spsc_ring_buffer_new(64);
+    struct cork_thread  *producer;
+    intptr_t  expected = 1;
+
+    producer = cork_thread_new("producer", buf, NULL, spsc_producer__run);
+    fail_if_error(cork_thread_start(producer));
+    while (expected <= CONCURRENT_COUNT) {
+        void  *element = cork_spsc_ring_buffer_pop(buf);
+        if (element == NULL) {
+            sched_yield();
+        } else {
+            fail_unless_equal("Element", "%" PRIdPTR,
+                              expected, (intptr_t) element);
+            expected++;
+        }
+    }
+    fail_if_error(cork_thread_join(producer));
+    fail_unless(cork_spsc_ring_buffer_pop(buf) == NULL,
+                "Ring buffer should be empty");
+    cork_spsc_ring_buffer_free(buf);
+}
+END_TEST
+
+
+#define MPMC_THREAD_COUNT  4
+
+struct mpmc_thread {
+    struct cork_mpmc_ring_buffer  *buf;
+    /* Producers add the values start+1 through start+CONCURRENT_COUNT */
+    intptr_t  start;
+    /* Shared between all of the consumers */
+    volatile size_t  *popped;
+    /* The sum of the values that a consumer popped */
+    intptr_t  sum;
+};
+
+static int
+mpmc_producer__run(void *user_data)
+{
+    struct mpmc_thread  *self = user_data;
+    intptr_t  i;
+    for (i = 1; i <= CONCURRENT_COUNT; i++) {
+        void  *element = (void *) (self->start + i);
+        while (cork_mpmc_ring_buffer_add(self->buf, element) != 0) {
+            sched_yield();
+        }
+    }
+    return 0;
+}
+
+static int
+mpmc_consumer__run(void *user_data)
+{
+    struct mpmc_thread  *self = user_data;
+    size_t  total = MPMC_THREAD_COUNT * CONCURRENT_COUNT;
+    while (cork_atomic_load_acquire(self->popped) < total) {
+        void  *element = cork_mpmc_ring_buffer_pop(self->buf);
+        if (element == NULL) {
+            sched_yield();
+        } else {
+            self->sum += (intptr_t) element;
+            cork_size_atomic_add(self->popped, 1);
+        }
+    }
+    return 0;
+}
+
+START_TEST(test_mpmc_ring_buffer_threaded)
+{
+    struct cork_mpmc_ring_buffer  *buf = cork_mpmc_ring_buffer_new(64);
+    struct mpmc_thread  producers[MPMC_THREAD_COUNT];
+    struct mpmc_thread  consumers[MPMC_THREAD_COUNT];
+    struct cork_thread  *threads[2 * MPMC_THREAD_COUNT];
+    volatile size_t  popped = 0;
+    intptr_t  expected = 0;
+    intptr_t  sum = 0;
+    size_t  i;
+
+    for (i = 0; i < MPMC_THREAD_COUNT; i++) {
+        intptr_t  start = i * CONCURRENT_COUNT;
+        producers[i].buf = buf;
+        producers[i].start = start;
+        /* The sum of start+1 .. start+CONCURRENT_COUNT */
+        expected += start * CONCURRENT_COUNT +
+            (intptr_t) CONCURRENT_COUNT * (CONCURRENT_COUNT + 1) / 2;
+        consumers[i].buf = buf;
+        consumers[i].popped = &popped;
+        consumers[i].sum = 0;
+        threads[2*i] = cork_thread_new
+            ("producer", &producers[i], NULL, mpmc_producer__run);
+        threads[2*i + 1] = cork_thread_new
+            ("consumer", &consumers[i], NULL, mpmc_consumer__run);
+    }
+    for (i = 0; i < 2 * MPMC_THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    for (i = 0; i < 2 * MPMC_THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+    for (i = 0; i < MPMC_THREAD_COUNT; i++) {
+        sum += consumers[i].sum;
+    }
+    fail_unless_equal("Sum", "%" PRIdPTR, expected, sum);
+    fail_unless(cork_mpmc_ring_buffer_pop(buf) == NULL,
+                "Ring buffer should be empty");
+    cork_mpmc_ring_buffer_free(buf);
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -126,8 +447,18 @@ test_suite()
     TCase  *tc_ds = tcase_create("ring_buffer");
     tcase_add_test(tc_ds, test_ring_buffer_1);
     tcase_add_test(tc_ds, test_ring_buffer_2);
+    tcase_add_test(tc_ds, test_ring_buffer_batch);
+    tcase_add_test(tc_ds, test_typed_ring_buffer);
     suite_add_tcase(s, tc_ds);
 
+    TCase  *tc_concurrent = tcase_create("concurrent");
+    tcase_set_timeout(tc_concurrent, 20.0);
+    tcase_add_test(tc_concurrent, test_spsc_ring_buffer);
+    tcase_add_test(tc_concurrent, test_mpmc_ring_buffer);
+    tcase_add_test(tc_concurrent, test_spsc_ring_buffer_threaded);
+    tcase_add_test(tc_concurrent, test_mpmc_ring_buffer_threaded);
+    suite_add_tcase(s, tc_concurrent);
+
     return s;
 }
 
@@ -0,0 +1,372 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "libcork/core/types.h"
+#include "libcork/ds/bitset.h"
+#include "libcork/ds/buffer.h"
+#include "libcork/ds/roaring-bitmap.h"
+#include "libcork/ds/slice.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Helpers
+ */
+
+/* We compare each roaring bitmap against a cork_bitset that covers the first
+ * few chunks of the 32-bit range. */
+#define TEST_BIT_COUNT  (4 * 65536)
+
+static void
+check_against_bitset(const struct cork_roaring_bitmap *bitmap,
+                     const struct cork_bitset *expected)
+{
+    size_t  i;
+    uint32_t  value;
+    size_t  next = 0;
+    for (i = 0; i < expected->bit_count; i++) {
+        fail_unless(cork_roaring_bitmap_contains(bitmap, i) ==
+                    cork_bitset_get(expected, i),
+                    "Unexpected value for bit %zu", i);
+    }
+    fail_unless_equal("Count", "%" PRIu64,
+                      (uint64_t) cork_bitset_count(expected),
+                      cork_roaring_bitmap_count(bitmap));
+    cork_roaring_bitmap_foreach(bitmap, value) {
+        next = cork_bitset_find_next(expected, next);
+        fail_unless_equal("Next value", "%zu", next, (size_t) value);
+        next++;
+    }
+    fail_unless_equal("Last value", "%zu", expected->bit_count,
+                      cork_bitset_find_next(expected, next));
+}
+
+/* Fills in chunks with different densities, so that we get a mix of array
+ * and bitmap containers. */
+static void
+fill_randomly(struct cork_roaring_bitmap *bitmap, struct cork_bitset *expected,
+              uint32_t *seed)
+{
+    size_t  i;
+    for (i = 0; i < expected->bit_count; i++) {
+        unsigned int  modulus = ((i >> 16) % 2 == 0)? 3: 97;
+        *seed = *seed * 1103515245 + 12345;
+        if ((*seed >> 16) % modulus == 0) {
+            cork_roaring_bitmap_add(bitmap, i);
+            cork_bitset_set(expected, i, true);
+        }
+    }
+}
+
+static struct cork_roaring_bitmap *
+round_trip(const struct cork_roaring_bitmap *bitmap)
+{
+    /* The slice takes control of buf. */
+    struct cork_buffer  *buf = cork_buffer_new();
+    struct cork_slice  slice;
+    struct cork_roaring_bitmap  *result;
+    cork_roaring_bitmap_serialize(bitmap, buf);
+    fail_unless_equal("Serialized size", "%zu",
+                      cork_roaring_bitmap_serialized_size(bitmap), buf->size);
+    fail_if_error(cork_buffer_to_slice(buf, &slice));
+    fail_if_error(result = cork_roaring_bitmap_deserialize(&slice));
+    /* The bitmap keeps its own reference to the serialized content. */
+    cork_slice_finish(&slice);
+    return result;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Roaring bitmaps
+ */
+
+START_TEST(test_roaring_bitmap)
+{
+    struct cork_roaring_bitmap  *bitmap = cork_roaring_bitmap_new();
+    struct cork_bitset  *expected = cork_bitset_new(TEST_BIT_COUNT);
+    uint32_t  seed = 0;
+    uint32_t  value;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    fail_if(cork_roaring_bitmap_find_next(bitmap, 0, &value),
+            "Empty bitmap shouldn't have any values");
+    fail_unless(cork_roaring_bitmap_add(bitmap, 12), "Should add 12");
+    fail_if(cork_roaring_bitmap_add(bitmap, 12), "Shouldn't add 12 twice");
+    fail_unless(cork_roaring_bitmap_add(bitmap, UINT32_MAX),
+                "Should add UINT32_MAX");
+    fail_unless(cork_roaring_bitmap_find_next(bitmap, 13, &value),
+                "Should find UINT32_MAX");
+    fail_unless_equal("Next value", "%" PRIu32, UINT32_MAX, value);
+    fail_unless(cork_roaring_bitmap_remove(bitmap, 12), "Should remove 12");
+    fail_if(cork_roaring_bitmap_remove(bitmap, 12),
+            "Shouldn't remove 12 twice");
+    fail_unless(cork_roaring_bitmap_remove(bitmap, UINT32_MAX),
+                "Should remove UINT32_MAX");
+    fail_unless_equal("Count", "%" PRIu64, (uint64_t) 0,
+                      cork_roaring_bitmap_count(bitmap));
+
+    /* Add and then remove enough values to push a container past the
+     * array/bitmap threshold in both directions. */
+    fill_randomly(bitmap, expected, &seed);
+    check_against_bitset(bitmap, expected);
+    for (i = 0; i < TEST_BIT_COUNT; i += 2) {
+        fail_unless(cork_roaring_bitmap_remove(bitmap, i) ==
+                    cork_bitset_get(expected, i),
+                    "Unexpected remove result for bit %zu", i);
+        cork_bitset_set(expected, i, false);
+    }
+    check_against_bitset(bitmap, expected);
+
+    cork_roaring_bitmap_clear(bitmap);
+    cork_bitset_clear(expected);
+    check_against_bitset(bitmap, expected);
+
+    cork_roaring_bitmap_free(bitmap);
+    cork_bitset_free(expected);
+}
+END_TEST
+
+START_TEST(test_roaring_bitmap_ranges)
+{
+    struct cork_roaring_bitmap  *bitmap = cork_roaring_bitmap_new();
+    struct cork_bitset  *expected = cork_bitset_new(TEST_BIT_COUNT);
+    size_t  small_size;
+    uint32_t  value;
+
+    DESCRIBE_TEST;
+    cork_roaring_bitmap_add(bitmap, 5);
+    cork_bitset_set(expected, 5, true);
+    cork_roaring_bitmap_add_range(bitmap, 100, 70000);
+    cork_bitset_set_range(expected, 100, 70000, true);
+    cork_roaring_bitmap_add_range(bitmap, 200000, 200010);
+    cork_bitset_set_range(expected, 200000, 200010, true);
+    check_against_bitset(bitmap, expected);
+
+    /* Modifying a run container should convert it back. */
+    cork_roaring_bitmap_remove(bitmap, 200005);
+    cork_bitset_set(expected, 200005, false);
+    cork_roaring_bitmap_add(bitmap, 200020);
+    cork_bitset_set(expected, 200020, true);
+    check_against_bitset(bitmap, expected);
+
+    /* Ranges up to the very end of the 32-bit space */
+    cork_roaring_bitmap_add_range(bitmap, UINT64_C(0xfffffff0),
+                                  UINT64_C(0x100000000));
+    fail_unless(cork_roaring_bitmap_contains(bitmap, UINT32_MAX),
+                "Should contain UINT32_MAX");
+    fail_unless(cork_roaring_bitmap_find_next
+                (bitmap, UINT64_C(0x10000000), &value),
+                "Should find the last range");
+    fail_unless_equal("Next value", "%" PRIu32, 0xfffffff0, value);
+    fail_unless_equal("Count", "%" PRIu64,
+                      (uint64_t) cork_bitset_count(expected) + 16,
+                      cork_roaring_bitmap_count(bitmap));
+    cork_roaring_bitmap_free(bitmap);
+
+    /* A dense bitmap with a few runs should shrink a lot. */
+    bitmap = cork_roaring_bitmap_new();
+    cork_bitset_clear(expected);
+    for (value = 0; value < TEST_BIT_COUNT; value++) {
+        if ((value / 1000) % 2 == 0) {
+            cork_roaring_bitmap_add(bitmap, value);
+            cork_bitset_set(expected, value, true);
+        }
+    }
+    small_size = cork_roaring_bitmap_memory_size(bitmap);
+    cork_roaring_bitmap_run_optimize(bitmap);
+    fail_unless(cork_roaring_bitmap_memory_size(bitmap) < small_size / 10,
+                "Run containers should be smaller");
+    check_against_bitset(bitmap, expected);
+
+    cork_roaring_bitmap_free(bitmap);
+    cork_bitset_free(expected);
+}
+END_TEST
+
+START_TEST(test_roaring_bitmap_set_algebra)
+{
+    uint32_t  seed = 0;
+    size_t  round;
+
+    DESCRIBE_TEST;
+    for (round = 0; round < 4; round++) {
+        struct cork_roaring_bitmap  *a = cork_roaring_bitmap_new();
+        struct cork_roaring_bitmap  *b = cork_roaring_bitmap_new();
+        struct cork_roaring_bitmap  *and_ = cork_roaring_bitmap_new();
+        struct cork_roaring_bitmap  *or_ = cork_roaring_bitmap_new();
+        struct cork_bitset  *a_bits = cork_bitset_new(TEST_BIT_COUNT);
+        struct cork_bitset  *b_bits = cork_bitset_new(TEST_BIT_COUNT);
+        struct cork_bitset  *and_bits = cork_bitset_new(TEST_BIT_COUNT);
+
+        fill_randomly(a, a_bits, &seed);
+        fill_randomly(b, b_bits, &seed);
+        if (round % 2 == 1) {
+            cork_roaring_bitmap_add_range(b, 1000, 150000);
+            cork_bitset_set_range(b_bits, 1000, 150000, true);
+        }
+        if (round >= 2) {
+            cork_roaring_bitmap_run_optimize(b);
+        }
+
+        cork_roaring_bitmap_or(and_, a);
+        cork_roaring_bitmap_and(and_, b);
+        cork_roaring_bitmap_or(or_, a);
+        cork_roaring_bitmap_or(or_, b);
+        check_against_bitset(a, a_bits);
+        check_against_bitset(b, b_bits);
+
+        cork_bitset_or(and_bits, a_bits);
+        cork_bitset_and(and_bits, b_bits);
+        check_against_bitset(and_, and_bits);
+        cork_bitset_or(a_bits, b_bits);
+        check_against_bitset(or_, a_bits);
+
+        /* Intersecting in the other direction should give the same result. */
+        cork_roaring_bitmap_and(b, a);
+        check_against_bitset(b, and_bits);
+
+        cork_roaring_bitmap_free(a);
+        cork_roaring_bitmap_free(b);
+        cork_roaring_bitmap_free(and_);
+        cork_roaring_bitmap_free(or_);
+        cork_bitset_free(a_bits);
+        cork_bitset_free(b_bits);
+        cork_bitset_free(and_bits);
+    }
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Serialization
+ */
+
+START_TEST(test_roaring_bitmap_serialize)
+{
+    struct cork_roaring_bitmap  *bitmap = cork_roaring_bitmap_new();
+    struct cork_roaring_bitmap  *copy;
+    struct cork_roaring_bitmap  *copy2;
+    struct cork_bitset  *expected = cork_bitset_new(TEST_BIT_COUNT);
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_slice  slice;
+    uint32_t  seed = 0;
+
+    DESCRIBE_TEST;
+    copy = round_trip(bitmap);
+    check_against_bitset(copy, expected);
+    cork_roaring_bitmap_free(copy);
+
+    fill_randomly(bitmap, expected, &seed);
+    cork_roaring_bitmap_add_range(bitmap, 3 * 65536 + 10, 3 * 65536 + 5000);
+    cork_bitset_set_range(expected, 3 * 65536 + 10, 3 * 65536 + 5000, true);
+    cork_roaring_bitmap_run_optimize(bitmap);
+    copy = round_trip(bitmap);
+    check_against_bitset(copy, expected);
+
+    /* A copy-once slice moves its content when we copy it. */
+    cork_roaring_bitmap_serialize(bitmap, &buf);
+    cork_slice_init_copy_once(&slice, buf.buf, buf.size);
+    fail_if_error(copy2 = cork_roaring_bitmap_deserialize(&slice));
+    cork_slice_finish(&slice);
+    memset(buf.buf, 0, buf.size);
+    check_against_bitset(copy2, expected);
+    cork_roaring_bitmap_free(copy2);
+    cork_buffer_clear(&buf);
+
+    /* Modifying a deserialized bitmap copies the containers that change. */
+    cork_roaring_bitmap_add(copy, 1);
+    cork_roaring_bitmap_remove(copy, 65536 + 1000);
+    cork_roaring_bitmap_add(copy, 3 * 65536 + 5);
+    cork_bitset_set(expected, 1, true);
+    cork_bitset_set(expected, 65536 + 1000, false);
+    cork_bitset_set(expected, 3 * 65536 + 5, true);
+    check_against_bitset(copy, expected);
+    cork_roaring_bitmap_free(copy);
+
+    /* Each of these corrupts the serialized form. */
+#define check_invalid(offset, value) \
+    do { \
+        struct cork_buffer  bad = CORK_BUFFER_INIT(); \
+        cork_buffer_copy(&bad, &buf); \
+        ((uint8_t *) bad.buf)[offset] = (value); \
+        cork_slice_init_static(&slice, bad.buf, bad.size); \
+        fail_unless_error(cork_roaring_bitmap_deserialize(&slice), \
+                          "Shouldn't deserialize a corrupt bitmap"); \
+        cork_slice_finish(&slice); \
+        cork_buffer_done(&bad); \
+    } while (0)
+
+    cork_roaring_bitmap_serialize(bitmap, &buf);
+    /* Bad magic number */
+    check_invalid(0, 'X');
+    /* Wrong container count */
+    check_invalid(5, 1);
+    /* Out-of-order keys */
+    check_invalid(8, 2);
+    /* Unknown container type */
+    check_invalid(10, 9);
+    /* Wrong cardinality for the first (bitmap) container */
+    check_invalid(12, 0xff);
+    /* Truncated */
+    cork_slice_init_static(&slice, buf.buf, buf.size - 8);
+    fail_unless_error(cork_roaring_bitmap_deserialize(&slice), \
+                          "Shouldn't deserialize a corrupt bitmap");
+    cork_slice_finish(&slice);
+#undef check_invalid
+
+    cork_buffer_done(&buf);
+    cork_roaring_bitmap_free(bitmap);
+    cork_bitset_free(expected);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("roaring-bitmap");
+
+    TCase  *tc_ds = tcase_create("roaring-bitmap");
+    tcase_set_timeout(tc_ds, 20.0);
+    tcase_add_test(tc_ds, test_roaring_bitmap);
+    tcase_add_test(tc_ds, test_roaring_bitmap_ranges);
+    tcase_add_test(tc_ds, test_roaring_bitmap_set_algebra);
+    tcase_add_test(tc_ds, test_roaring_bitmap_serialize);
+    suite_add_tcase(s, tc_ds);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    setup_allocator();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,343 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <check.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/error.h"
+#include "libcork/core/hash.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/buffer.h"
+#include "libcork/ds/sketch.h"
+#include "libcork/ds/slice.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Blocked Bloom filters
+ */
+
+#define BLOOM_COUNT  10000
+
+static size_t
+count_bloom_false_positives(const struct cork_bloom_filter *filter)
+{
+    size_t  false_positives = 0;
+    uint64_t  i;
+    for (i = BLOOM_COUNT; i < BLOOM_COUNT * 11; i++) {
+        if (cork_bloom_filter_contains(filter, &i, sizeof(i))) {
+            false_positives++;
+        }
+    }
+    return false_positives;
+}
+
+START_TEST(test_bloom_filter)
+{
+    struct cork_bloom_filter  *filter;
+    size_t  false_positives;
+    uint64_t  i;
+
+    DESCRIBE_TEST;
+    filter = cork_bloom_filter_new(BLOOM_COUNT, 10, 0);
+    fail_unless_equal("Filter size", "%zu", (size_t) 12544,
+                      cork_bloom_filter_byte_size(filter));
+    for (i = 0; i < BLOOM_COUNT; i++) {
+        fail_if(cork_bloom_filter_contains(filter, &i, sizeof(i)),
+                "Empty filter shouldn't contain %" PRIu64, i);
+    }
+
+    for (i = 0; i < BLOOM_COUNT; i++) {
+        cork_bloom_filter_add(filter, &i, sizeof(i));
+    }
+    /* There are never any false negatives. */
+    for (i = 0; i < BLOOM_COUNT; i++) {
+        fail_unless(cork_bloom_filter_contains(filter, &i, sizeof(i)),
+                    "Filter should contain %" PRIu64, i);
+    }
+    /* With 10 bits per key we expect a false positive rate of about 1%. */
+    false_positives = count_bloom_false_positives(filter);
+    fprintf(stderr, "Bloom filter false positives: %zu/%u\n",
+            false_positives, BLOOM_COUNT * 10);
+    fail_unless(false_positives < BLOOM_COUNT * 10 / 25,
+                "Too many false positives: %zu", false_positives);
+
+    cork_bloom_filter_clear(filter);
+    i = 0;
+    fail_if(cork_bloom_filter_contains(filter, &i, sizeof(i)),
+            "Cleared filter shouldn't contain 0");
+    cork_bloom_filter_free(filter);
+}
+END_TEST
+
+START_TEST(test_bloom_filter_hash)
+{
+    struct cork_bloom_filter  *filter;
+    uint64_t  i;
+
+    DESCRIBE_TEST;
+    /* The _hash variants skip the filter's own hashing. */
+    filter = cork_bloom_filter_new(1, 1, 0);
+    fail_unless_equal("Filter size", "%zu", (size_t) 64,
+                      cork_bloom_filter_byte_size(filter));
+    for (i = 0; i < 64; i++) {
+        cork_bloom_filter_add_hash(filter, cork_hash64_variable(17, i));
+    }
+    for (i = 0; i < 64; i++) {
+        fail_unless(cork_bloom_filter_contains_hash
+                    (filter, cork_hash64_variable(17, i)),
+                    "Filter should contain %" PRIu64, i);
+    }
+    cork_bloom_filter_free(filter);
+}
+END_TEST
+
+START_TEST(test_bloom_filter_merge)
+{
+    struct cork_bloom_filter  *f1;
+    struct cork_bloom_filter  *f2;
+    struct cork_bloom_filter  *f3;
+    uint64_t  i;
+
+    DESCRIBE_TEST;
+    f1 = cork_bloom_filter_new(BLOOM_COUNT, 10, 0);
+    f2 = cork_bloom_filter_new(BLOOM_COUNT, 10, 0);
+    f3 = cork_bloom_filter_new(BLOOM_COUNT, 10, 1);
+    for (i = 0; i < BLOOM_COUNT; i++) {
+        cork_bloom_filter_add((i % 2 == 0)? f1: f2, &i, sizeof(i));
+    }
+    fail_if_error(cork_bloom_filter_merge(f1, f2));
+    for (i = 0; i < BLOOM_COUNT; i++) {
+        fail_unless(cork_bloom_filter_contains(f1, &i, sizeof(i)),
+                    "Merged filter should contain %" PRIu64, i);
+    }
+    fail_unless_error(cork_bloom_filter_merge(f1, f3),
+                      "Shouldn't merge filters with different seeds");
+    cork_bloom_filter_free(f1);
+    cork_bloom_filter_free(f2);
+    cork_bloom_filter_free(f3);
+}
+END_TEST
+
+START_TEST(test_bloom_filter_save)
+{
+    struct cork_bloom_filter  *filter;
+    struct cork_bloom_filter  *loaded;
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_slice  slice;
+    uint64_t  i;
+
+    DESCRIBE_TEST;
+    filter = cork_bloom_filter_new(BLOOM_COUNT, 10, 42);
+    for (i = 0; i < BLOOM_COUNT; i++) {
+        cork_bloom_filter_add(filter, &i, sizeof(i));
+    }
+
+    cork_bloom_filter_save(filter, &buf);
+    fail_unless_equal("Serialized size", "%zu",
+                      cork_bloom_filter_byte_size(filter) + 24, buf.size);
+    cork_slice_init_static(&slice, buf.buf, buf.size);
+    fail_if_error(loaded = cork_bloom_filter_load(&slice));
+    for (i = 0; i < BLOOM_COUNT; i++) {
+        fail_unless(cork_bloom_filter_contains(loaded, &i, sizeof(i)),
+                    "Loaded filter should contain %" PRIu64, i);
+    }
+    fail_unless_equal("False positives", "%zu",
+                      count_bloom_false_positives(filter),
+                      count_bloom_false_positives(loaded));
+    fail_if_error(cork_bloom_filter_merge(filter, loaded));
+    cork_bloom_filter_free(loaded);
+
+    /* Truncated and corrupt filters */
+    cork_slice_init_static(&slice, buf.buf, buf.size);
+    slice.size--;
+    fail_unless_error(cork_bloom_filter_load(&slice),
+                      "Shouldn't load an invalid filter");
+    slice.size = 8;
+    fail_unless_error(cork_bloom_filter_load(&slice),
+                      "Shouldn't load an invalid filter");
+    ((char *) buf.buf)[0] = 'X';
+    cork_slice_init_static(&slice, buf.buf, buf.size);
+    fail_unless_error(cork_bloom_filter_load(&slice),
+                      "Shouldn't load an invalid filter");
+
+    cork_buffer_done(&buf);
+    cork_bloom_filter_free(filter);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Count-min sketches
+ */
+
+START_TEST(test_count_min_sketch)
+{
+    struct cork_count_min_sketch  *sketch;
+    uint64_t  i;
+    uint64_t  key;
+    uint64_t  total_error = 0;
+
+    DESCRIBE_TEST;
+    sketch = cork_count_min_sketch_new(4000, 4, 0);
+    key = 0;
+    fail_unless_equal("Estimate", "%" PRIu32, (uint32_t) 0,
+                      cork_count_min_sketch_estimate
+                      (sketch, &key, sizeof(key)));
+
+    /* A Zipf-ish distribution: key i appears 10000/i times. */
+    for (i = 1; i <= 10000; i++) {
+        cork_count_min_sketch_add(sketch, &i, sizeof(i), 10000 / i);
+    }
+    for (i = 1; i <= 10000; i++) {
+        uint32_t  estimate =
+            cork_count_min_sketch_estimate(sketch, &i, sizeof(i));
+        fail_unless(estimate >= 10000 / i,
+                    "Estimate for %" PRIu64 " is too small: %" PRIu32,
+                    i, estimate);
+        total_error += estimate - 10000 / i;
+        if (i <= 10) {
+            /* Heavy hitters should be nearly exact. */
+            fail_unless(estimate - 10000 / i < 10000 / i / 10,
+                        "Estimate for %" PRIu64 " is too large: %" PRIu32,
+                        i, estimate);
+        }
+    }
+    fprintf(stderr, "Count-min sketch total error: %" PRIu64
+            " over %" PRIu64 " additions\n",
+            total_error, cork_count_min_sketch_total(sketch));
+    fail_unless(total_error < cork_count_min_sketch_total(sketch),
+                "Estimates are too large overall");
+
+    cork_count_min_sketch_clear(sketch);
+    fail_unless_equal("Total", "%" PRIu64, (uint64_t) 0,
+                      cork_count_min_sketch_total(sketch));
+    i = 1;
+    fail_unless_equal("Estimate", "%" PRIu32, (uint32_t) 0,
+                      cork_count_min_sketch_estimate(sketch, &i, sizeof(i)));
+    cork_count_min_sketch_free(sketch);
+}
+END_TEST
+
+START_TEST(test_count_min_sketch_saturate)
+{
+    struct cork_count_min_sketch  *sketch;
+    cork_hash64  hash = 0x0123456789abcdefULL;
+
+    DESCRIBE_TEST;
+    sketch = cork_count_min_sketch_new(16, 2, 0);
+    fail_unless_equal("Estimate", "%" PRIu32, (uint32_t) 5,
+                      cork_count_min_sketch_add_hash(sketch, hash, 5));
+    fail_unless_equal("Estimate", "%" PRIu32, UINT32_MAX,
+                      cork_count_min_sketch_add_hash
+                      (sketch, hash, UINT32_MAX - 1));
+    fail_unless_equal("Estimate", "%" PRIu32, UINT32_MAX,
+                      cork_count_min_sketch_estimate_hash(sketch, hash));
+    fail_unless_equal("Total", "%" PRIu64, (uint64_t) UINT32_MAX + 4,
+                      cork_count_min_sketch_total(sketch));
+    cork_count_min_sketch_free(sketch);
+}
+END_TEST
+
+START_TEST(test_count_min_sketch_merge_save)
+{
+    struct cork_count_min_sketch  *s1;
+    struct cork_count_min_sketch  *s2;
+    struct cork_count_min_sketch  *s3;
+    struct cork_count_min_sketch  *loaded;
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_slice  slice;
+    uint64_t  i;
+
+    DESCRIBE_TEST;
+    s1 = cork_count_min_sketch_new(256, 4, 7);
+    s2 = cork_count_min_sketch_new(256, 4, 7);
+    s3 = cork_count_min_sketch_new(512, 4, 7);
+    for (i = 0; i < 100; i++) {
+        cork_count_min_sketch_add(s1, &i, sizeof(i), 1);
+        cork_count_min_sketch_add(s2, &i, sizeof(i), 2);
+    }
+    fail_if_error(cork_count_min_sketch_merge(s1, s2));
+    fail_unless_error(cork_count_min_sketch_merge(s1, s3),
+                      "Shouldn't merge sketches with different widths");
+    fail_unless_equal("Total", "%" PRIu64, (uint64_t) 300,
+                      cork_count_min_sketch_total(s1));
+    for (i = 0; i < 100; i++) {
+        fail_unless(cork_count_min_sketch_estimate(s1, &i, sizeof(i)) >= 3,
+                    "Merged estimate for %" PRIu64 " is too small", i);
+    }
+
+    cork_count_min_sketch_save(s1, &buf);
+    fail_unless_equal("Serialized size", "%zu",
+                      (size_t) 32 + 256 * 4 * 4, buf.size);
+    cork_slice_init_static(&slice, buf.buf, buf.size);
+    fail_if_error(loaded = cork_count_min_sketch_load(&slice));
+    for (i = 0; i < 200; i++) {
+        fail_unless_equal("Loaded estimate", "%" PRIu32,
+                          cork_count_min_sketch_estimate(s1, &i, sizeof(i)),
+                          cork_count_min_sketch_estimate
+                          (loaded, &i, sizeof(i)));
+    }
+    fail_unless_equal("Total", "%" PRIu64, (uint64_t) 300,
+                      cork_count_min_sketch_total(loaded));
+    fail_if_error(cork_count_min_sketch_merge(loaded, s2));
+    cork_count_min_sketch_free(loaded);
+    slice.size--;
+    fail_unless_error(cork_count_min_sketch_load(&slice),
+                      "Shouldn't load an invalid sketch");
+
+    cork_buffer_done(&buf);
+    cork_count_min_sketch_free(s1);
+    cork_count_min_sketch_free(s2);
+    cork_count_min_sketch_free(s3);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("sketch");
+
+    TCase  *tc_ds = tcase_create("sketch");
+    tcase_add_test(tc_ds, test_bloom_filter);
+    tcase_add_test(tc_ds, test_bloom_filter_hash);
+    tcase_add_test(tc_ds, test_bloom_filter_merge);
+    tcase_add_test(tc_ds, test_bloom_filter_save);
+    tcase_add_test(tc_ds, test_count_min_sketch);
+    tcase_add_test(tc_ds, test_count_min_sketch_saturate);
+    tcase_add_test(tc_ds, test_count_min_sketch_merge_save);
+    suite_add_tcase(s, tc_ds);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    setup_allocator();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -10,9 +10,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 #include <check.h>
 
+#include "libcork/ds/buffer.h"
+#include "libcork/ds/managed-buffer.h"
 #include "libcork/ds/slice.h"
 
 #include "helpers.h"
@@ -103,6 +107,270 @@ START_TEST(test_copy_once_slice)
 END_TEST
 
 
+/*-----------------------------------------------------------------------
+ * Managed and borrowed slices
+ */
+
+START_TEST(test_borrowed_slice)
+{
+    static char  SRC[] = "Here is some text.";
+    size_t  SRC_LEN = sizeof(SRC) - 1;
+
+    struct cork_managed_buffer  *mbuf;
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_slice  slice;
+    struct cork_slice  copy1;
+    struct cork_slice  lcopy1;
+    struct cork_slice  lcopy2;
+    struct cork_slice  borrowed;
+
+    fail_if_error(mbuf = cork_managed_buffer_new_copy(SRC, SRC_LEN));
+    fail_if_error(cork_managed_buffer_slice_offset(&slice, mbuf, 0));
+    fail_unless_equal("Reference count", "%d", 2, mbuf->ref_count);
+
+    /* Light copies (and light copies of those) don't take out a reference. */
+    fail_if_error(cork_slice_light_copy(&lcopy1, &slice, 8, 9));
+    fail_if_error(cork_slice_light_copy_fast(&lcopy2, &lcopy1, 5, 4));
+    fail_unless_equal("Reference count", "%d", 2, mbuf->ref_count);
+    fail_unless(cork_slice_get_managed_buffer(&lcopy2) == mbuf,
+                "Borrowed slice should refer to its managed buffer");
+    fail_unless(memcmp(lcopy2.buf, "text", 4) == 0,
+                "Unexpected slice contents");
+    fail_if_error(cork_slice_slice(&lcopy1, 0, 4));
+    fail_unless(memcmp(lcopy1.buf, "some", 4) == 0,
+                "Unexpected slice contents");
+
+    /* A full copy of a borrowed slice takes out its own reference, and so can
+     * outlive everything else. */
+    fail_if_error(cork_slice_copy(&copy1, &lcopy1, 1, 3));
+    fail_unless_equal("Reference count", "%d", 3, mbuf->ref_count);
+    cork_slice_finish(&lcopy2);
+    cork_slice_finish(&lcopy1);
+    cork_slice_finish(&slice);
+    cork_managed_buffer_unref(mbuf);
+    fail_unless_equal("Reference count", "%d", 1, mbuf->ref_count);
+
+    /* We can't steal a buffer out from under a borrowed slice, since it
+     * doesn't hold the reference. */
+    fail_if_error(cork_managed_buffer_slice_borrowed(&borrowed, mbuf, 0, 2));
+    fail_unless_equal("Reference count", "%d", 1, mbuf->ref_count);
+    cork_buffer_from_slice(&buf, &borrowed);
+    fail_unless(strcmp(buf.buf, "He") == 0, "Unexpected buffer contents");
+    fail_unless(memcmp(copy1.buf, "ome", 3) == 0,
+                "Unexpected slice contents");
+    fail_unless_error(cork_managed_buffer_slice_borrowed
+                      (&borrowed, mbuf, 2, SRC_LEN),
+                      "Shouldn't be able to borrow past the end");
+    cork_slice_finish(&borrowed);
+
+    /* Static slices don't need any references, either. */
+    cork_slice_init_static(&slice, SRC, SRC_LEN);
+    fail_if_error(cork_slice_copy_offset_fast(&lcopy1, &slice, 13));
+    fail_unless(memcmp(lcopy1.buf, "text.", 5) == 0,
+                "Unexpected slice contents");
+    cork_slice_finish(&lcopy1);
+    cork_slice_finish(&slice);
+
+    cork_slice_finish(&copy1);
+    cork_buffer_done(&buf);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Slice vectors
+ */
+
+static void
+check_read_fd(int fd, const struct cork_buffer *expected)
+{
+    struct cork_buffer  actual = CORK_BUFFER_INIT();
+    fail_if_error(cork_buffer_append_fd(&actual, fd));
+    fail_unless(cork_buffer_equal(&actual, expected),
+                "Unexpected contents: got %zu:%s, expected %zu:%s",
+                actual.size, (char *) actual.buf,
+                expected->size, (char *) expected->buf);
+    cork_buffer_done(&actual);
+}
+
+START_TEST(test_slice_vec)
+{
+    static char  HEADER[] = "header:";
+    struct cork_slice_vec  vec = CORK_SLICE_VEC_INIT();
+    struct cork_buffer  expected = CORK_BUFFER_INIT();
+    struct cork_managed_buffer  *mbuf;
+    struct cork_slice  slice;
+    struct iovec  iov[4];
+    int  fds[2];
+    size_t  i;
+
+    /* More slices than fit into a single writev call, most of which share a
+     * single managed buffer. */
+    fail_if_error(mbuf = cork_managed_buffer_new_copy("0123456789", 10));
+    for (i = 0; i < 100; i++) {
+        cork_slice_init_static(&slice, HEADER, sizeof(HEADER) - 1);
+        cork_slice_vec_append_move(&vec, &slice);
+        fail_if_error(cork_managed_buffer_slice(&slice, mbuf, i % 10, 1));
+        fail_if_error(cork_slice_vec_append(&vec, &slice));
+        cork_slice_finish(&slice);
+        cork_buffer_append_printf(&expected, "%s%zu", HEADER, i % 10);
+    }
+    fail_unless_equal("Slice count", "%zu", (size_t) 200, vec.count);
+    fail_unless_equal("Vector size", "%zu", expected.size, vec.size);
+    fail_unless_equal("Reference count", "%d", 101, mbuf->ref_count);
+
+    fail_unless_equal("iovec count", "%zu", (size_t) 4,
+                      cork_slice_vec_iovec(&vec, 0, iov, 4));
+    fail_unless_equal("iovec count", "%zu", (size_t) 2,
+                      cork_slice_vec_iovec(&vec, 198, iov, 4));
+    fail_unless(memcmp(iov[1].iov_base, "9", 1) == 0,
+                "Unexpected iovec contents");
+
+    fail_if(pipe(fds) == -1, "Cannot create pipe");
+    fail_if_error(cork_slice_vec_write_fd(&vec, fds[1]));
+    close(fds[1]);
+    check_read_fd(fds[0], &expected);
+    close(fds[0]);
+
+    fail_if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1,
+            "Cannot create socket pair");
+    fail_if_error(cork_slice_vec_sendmsg(&vec, fds[1], 0));
+    close(fds[1]);
+    check_read_fd(fds[0], &expected);
+    close(fds[0]);
+
+    cork_slice_vec_clear(&vec);
+    fail_unless_equal("Vector size", "%zu", (size_t) 0, vec.size);
+    fail_unless_equal("Reference count", "%d", 1, mbuf->ref_count);
+    cork_managed_buffer_unref(mbuf);
+    cork_slice_vec_done(&vec);
+    cork_buffer_done(&expected);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Slice readers
+ */
+
+START_TEST(test_slice_reader)
+{
+    static const uint64_t  VARINTS[] = {
+        0, 1, 0x7f, 0x80, 0x3fff, 0x4000, UINT32_MAX,
+        UINT64_C(0x7fffffffffffffff), UINT64_MAX
+    };
+    static const size_t  VARINT_COUNT = sizeof(VARINTS) / sizeof(VARINTS[0]);
+    static const uint8_t  OVERLONG[] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x02
+    };
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+    struct cork_slice  slice;
+    struct cork_slice  sub;
+    struct cork_slice_reader  reader;
+    uint8_t  u8 = 0;
+    uint16_t  u16 = 0;
+    uint32_t  u32 = 0;
+    uint64_t  u64 = 0;
+    size_t  i;
+
+    cork_buffer_append(&buf, "\x2a", 1);
+    cork_buffer_append_be16(&buf, 0x0102);
+    cork_buffer_append_be32(&buf, 0x01020304);
+    cork_buffer_append_be64(&buf, UINT64_C(0x0102030405060708));
+    cork_buffer_append_le16(&buf, 0x0102);
+    cork_buffer_append_le32(&buf, 0x01020304);
+    cork_buffer_append_le64(&buf, UINT64_C(0x0102030405060708));
+    for (i = 0; i < VARINT_COUNT; i++) {
+        cork_buffer_append_varint(&buf, VARINTS[i]);
+    }
+    cork_buffer_append_prefixed_varint(&buf, "hello", 5);
+    cork_buffer_append_be16(&buf, 3);
+    cork_buffer_append(&buf, "abc", 3);
+    cork_buffer_append_be32(&buf, 0);
+    cork_buffer_append_be32(&buf, 100);
+    cork_buffer_append(&buf, "xyz", 3);
+
+    cork_slice_init_static(&slice, buf.buf, buf.size);
+    cork_slice_reader_init(&reader, &slice);
+    fail_if_error(cork_slice_reader_u8(&reader, &u8));
+    fail_unless_equal("u8", "0x%02" PRIx8, 0x2a, u8);
+    fail_if_error(cork_slice_reader_be16(&reader, &u16));
+    fail_unless_equal("be16", "0x%04" PRIx16, 0x0102, u16);
+    fail_if_error(cork_slice_reader_be32(&reader, &u32));
+    fail_unless_equal("be32", "0x%08" PRIx32, 0x01020304, u32);
+    fail_if_error(cork_slice_reader_be64(&reader, &u64));
+    fail_unless_equal("be64", "0x%016" PRIx64,
+                      UINT64_C(0x0102030405060708), u64);
+
+    /* One bounds check for the whole batch of little-endian values */
+    fail_if_error(cork_slice_reader_require(&reader, 14));
+    fail_unless_equal("le16", "0x%04" PRIx16,
+                      0x0102, cork_slice_reader_le16_fast(&reader));
+    fail_unless_equal("le32", "0x%08" PRIx32,
+                      0x01020304, cork_slice_reader_le32_fast(&reader));
+    fail_unless_equal("le64", "0x%016" PRIx64, UINT64_C(0x0102030405060708),
+                      cork_slice_reader_le64_fast(&reader));
+    fail_unless_equal("Offset", "%zu", (size_t) 29,
+                      cork_slice_reader_offset(&reader));
+
+    for (i = 0; i < VARINT_COUNT; i++) {
+        fail_if_error(cork_slice_reader_varint(&reader, &u64));
+        fail_unless_equal("Varint", "%" PRIu64, VARINTS[i], u64);
+    }
+
+    /* Sub-slices point into the original buffer. */
+    fail_if_error(cork_slice_reader_prefixed_varint(&reader, &sub));
+    fail_unless_equal("Sub-slice size", "%zu", (size_t) 5, sub.size);
+    fail_unless(memcmp(sub.buf, "hello", 5) == 0,
+                "Unexpected sub-slice contents");
+    fail_unless((const uint8_t *) sub.buf ==
+                (const uint8_t *) buf.buf + cork_slice_reader_offset(&reader) - 5,
+                "Sub-slice should not be a copy");
+    cork_slice_finish(&sub);
+    fail_if_error(cork_slice_reader_prefixed_be16(&reader, &sub));
+    fail_unless(sub.size == 3 && memcmp(sub.buf, "abc", 3) == 0,
+                "Unexpected sub-slice contents");
+    cork_slice_finish(&sub);
+    fail_if_error(cork_slice_reader_prefixed_be32(&reader, &sub));
+    fail_unless_equal("Sub-slice size", "%zu", (size_t) 0, sub.size);
+    cork_slice_finish(&sub);
+
+    /* The last prefix is longer than what's left, so the reader shouldn't
+     * move. */
+    i = cork_slice_reader_offset(&reader);
+    fail_unless_error(cork_slice_reader_prefixed_be32(&reader, &sub),
+                      "Shouldn't be able to read a truncated sub-slice");
+    fail_unless_equal("Offset", "%zu", i, cork_slice_reader_offset(&reader));
+    fail_unless_error(cork_slice_reader_be64(&reader, &u64),
+                      "Shouldn't be able to read past the end");
+    fail_unless_error(cork_slice_reader_require(&reader, 8),
+                      "Shouldn't be able to require past the end");
+    fail_if_error(cork_slice_reader_skip(&reader, 4));
+    fail_if_error(cork_slice_reader_slice(&reader, 3, &sub));
+    fail_unless(memcmp(sub.buf, "xyz", 3) == 0,
+                "Unexpected sub-slice contents");
+    cork_slice_finish(&sub);
+    fail_unless(cork_slice_reader_is_empty(&reader), "Reader should be empty");
+    fail_unless_error(cork_slice_reader_u8(&reader, &u8),
+                      "Shouldn't be able to read from an empty reader");
+
+    /* Bad varints */
+    cork_slice_init_static(&slice, OVERLONG, sizeof(OVERLONG));
+    cork_slice_reader_init(&reader, &slice);
+    fail_unless_error(cork_slice_reader_varint(&reader, &u64),
+                      "Shouldn't be able to read a varint over 64 bits");
+    fail_unless_equal("Offset", "%zu", (size_t) 0,
+                      cork_slice_reader_offset(&reader));
+    cork_slice_init_static(&slice, OVERLONG, 3);
+    cork_slice_reader_init(&reader, &slice);
+    fail_unless_error(cork_slice_reader_varint(&reader, &u64),
+                      "Shouldn't be able to read a truncated varint");
+
+    cork_buffer_done(&buf);
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -115,6 +383,9 @@ test_suite()
     TCase  *tc_slice = tcase_create("slice");
     tcase_add_test(tc_slice, test_static_slice);
     tcase_add_test(tc_slice, test_copy_once_slice);
+    tcase_add_test(tc_slice, test_borrowed_slice);
+    tcase_add_test(tc_slice, test_slice_vec);
+    tcase_add_test(tc_slice, test_slice_reader);
     suite_add_tcase(s, tc_slice);
 
     return s;
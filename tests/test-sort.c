@@ -0,0 +1,260 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/array.h"
+#include "libcork/ds/sort.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Helpers
+ */
+
+cork_sort_define(uint32_t, sort_uint32, CORK_SORT_LESS)
+
+#define GREATER(a, b)  ((a) > (b))
+cork_sort_define(int64_t, sort_int64_descending, GREATER)
+
+/* The inputs that we sort: each one has its own way of filling in an element
+ * given its index. */
+enum test_pattern {
+    TEST_RANDOM,
+    TEST_SORTED,
+    TEST_REVERSED,
+    TEST_EQUAL,
+    TEST_SAWTOOTH,
+    TEST_FEW_VALUES,
+    TEST_PATTERN_COUNT
+};
+
+static const size_t  test_sizes[] = {
+    0, 1, 2, 3, 15, 16, 17, 100, 129, 1000, 10000
+};
+
+static uint32_t
+test_value(enum test_pattern pattern, size_t i, size_t count, uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    switch (pattern) {
+        case TEST_RANDOM:
+            return *seed;
+        case TEST_SORTED:
+            return i;
+        case TEST_REVERSED:
+            return count - i;
+        case TEST_EQUAL:
+            return 7;
+        case TEST_SAWTOOTH:
+            return i % 37;
+        case TEST_FEW_VALUES:
+        default:
+            return (*seed >> 16) % 4;
+    }
+}
+
+static int
+uint32__compare(void *user_data, const void *va, const void *vb)
+{
+    const uint32_t  *a = va;
+    const uint32_t  *b = vb;
+    size_t  *calls = user_data;
+    if (calls != NULL) {
+        (*calls)++;
+    }
+    return (*a < *b)? -1: (*a > *b)? 1: 0;
+}
+
+static int
+uint32__qsort_compare(const void *va, const void *vb)
+{
+    return uint32__compare(NULL, va, vb);
+}
+
+static void
+check_sorted(const uint32_t *actual, const uint32_t *expected, size_t count)
+{
+    size_t  i;
+    for (i = 0; i < count; i++) {
+        fail_unless_equal("Sorted value", "%" PRIu32, expected[i], actual[i]);
+    }
+}
+
+
+/*-----------------------------------------------------------------------
+ * Sorting
+ */
+
+START_TEST(test_sort_typed)
+{
+    uint32_t  seed = 0;
+    size_t  size_index;
+    unsigned int  pattern;
+
+    DESCRIBE_TEST;
+    for (size_index = 0;
+         size_index < sizeof(test_sizes) / sizeof(test_sizes[0]);
+         size_index++) {
+        size_t  count = test_sizes[size_index];
+        uint32_t  *expected = cork_calloc(count + 1, sizeof(uint32_t));
+        uint32_t  *typed = cork_calloc(count + 1, sizeof(uint32_t));
+        uint32_t  *radix = cork_calloc(count + 1, sizeof(uint32_t));
+        uint32_t  *generic = cork_calloc(count + 1, sizeof(uint32_t));
+        for (pattern = 0; pattern < TEST_PATTERN_COUNT; pattern++) {
+            size_t  i;
+            for (i = 0; i < count; i++) {
+                expected[i] = test_value(pattern, i, count, &seed);
+            }
+            memcpy(typed, expected, count * sizeof(uint32_t));
+            memcpy(radix, expected, count * sizeof(uint32_t));
+            memcpy(generic, expected, count * sizeof(uint32_t));
+            qsort(expected, count, sizeof(uint32_t), uint32__qsort_compare);
+
+            sort_uint32(typed, count);
+            check_sorted(typed, expected, count);
+            cork_sort_uint32(radix, count);
+            check_sorted(radix, expected, count);
+            cork_sort(generic, count, sizeof(uint32_t),
+                      NULL, uint32__compare);
+            check_sorted(generic, expected, count);
+        }
+        cork_cfree(expected, count + 1, sizeof(uint32_t));
+        cork_cfree(typed, count + 1, sizeof(uint32_t));
+        cork_cfree(radix, count + 1, sizeof(uint32_t));
+        cork_cfree(generic, count + 1, sizeof(uint32_t));
+    }
+}
+END_TEST
+
+START_TEST(test_sort_uint64)
+{
+    uint64_t  seed = 1;
+    size_t  count = 5000;
+    uint64_t  *items = cork_calloc(count, sizeof(uint64_t));
+    size_t  i;
+
+    DESCRIBE_TEST;
+    for (i = 0; i < count; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        /* Leave some bytes the same in every element. */
+        items[i] = seed & UINT64_C(0xff00ffff00ff00ff);
+    }
+    cork_sort_uint64(items, count);
+    for (i = 1; i < count; i++) {
+        fail_unless(items[i - 1] <= items[i],
+                    "Elements %zu and %zu are out of order", i - 1, i);
+    }
+    cork_cfree(items, count, sizeof(uint64_t));
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Searching
+ */
+
+START_TEST(test_sort_search)
+{
+    cork_array(uint32_t)  array;
+    struct cork_raw_array  *raw = cork_array_to_raw(&array);
+    cork_array(int64_t)  descending;
+    uint32_t  key;
+    size_t  calls = 0;
+
+    DESCRIBE_TEST;
+    cork_array_init(&array);
+    for (key = 0; key < 200; key++) {
+        cork_array_append(&array, (key * 7919) % 200 * 2);
+    }
+    cork_array_sort(&array, sort_uint32);
+    for (key = 0; key < 200; key++) {
+        fail_unless_equal("Sorted value", "%" PRIu32,
+                          key * 2, cork_array_at(&array, key));
+    }
+
+    /* Every even key is present; odd keys sort between them. */
+    for (key = 0; key < 402; key++) {
+        size_t  expected = (key < 400)? (key + 1) / 2: 200;
+        fail_unless_equal("Lower bound", "%zu", expected,
+                          cork_array_lower_bound(&array, sort_uint32, key));
+        fail_unless_equal("Lower bound", "%zu", expected,
+                          cork_raw_array_lower_bound
+                          (raw, &key, &calls, uint32__compare));
+        fail_unless(cork_array_contains(&array, sort_uint32, key) ==
+                    (key % 2 == 0 && key < 400),
+                    "Unexpected contains result for %" PRIu32, key);
+    }
+    fail_unless(calls > 0, "Should have called the comparator");
+    fail_unless_equal("Lower bound", "%zu", (size_t) 0,
+                      sort_uint32_lower_bound(NULL, 0, 5));
+
+    /* A sort with a different ordering */
+    cork_array_init(&descending);
+    for (key = 0; key < 100; key++) {
+        cork_array_append(&descending, (int64_t) key - 50);
+    }
+    cork_array_sort(&descending, sort_int64_descending);
+    fail_unless_equal("First value", "%" PRId64, (int64_t) 49,
+                      cork_array_at(&descending, 0));
+    fail_unless_equal("Last value", "%" PRId64, (int64_t) -50,
+                      cork_array_at(&descending, 99));
+    fail_unless_equal("Lower bound", "%zu", (size_t) 49,
+                      cork_array_lower_bound
+                      (&descending, sort_int64_descending, 0));
+
+    cork_array_done(&array);
+    cork_array_done(&descending);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("sort");
+
+    TCase  *tc_ds = tcase_create("sort");
+    tcase_set_timeout(tc_ds, 20.0);
+    tcase_add_test(tc_ds, test_sort_typed);
+    tcase_add_test(tc_ds, test_sort_uint64);
+    tcase_add_test(tc_ds, test_sort_search);
+    suite_add_tcase(s, tc_ds);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    setup_allocator();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
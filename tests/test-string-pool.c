@@ -0,0 +1,255 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/error.h"
+#include "libcork/core/hash.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/string-pool.h"
+#include "libcork/threads/basics.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * String pools
+ */
+
+START_TEST(test_string_pool)
+{
+    struct cork_string_pool  *pool;
+    const char  *foo;
+    const char  *bar;
+    const char  *empty;
+    const char  *embedded;
+    char  buf[32];
+
+    DESCRIBE_TEST;
+    pool = cork_string_pool_new();
+    fail_unless_equal("Pool size", "%zu", (size_t) 0,
+                      cork_string_pool_size(pool));
+    fail_unless(cork_string_pool_find(pool, "foo", 3) == NULL,
+                "Shouldn't find a string that hasn't been interned");
+
+    foo = cork_string_pool_intern(pool, "foo");
+    bar = cork_string_pool_intern(pool, "bar");
+    fail_unless(foo != bar, "Different strings should be different");
+    fail_unless_streq("Interned string", "foo", foo);
+    fail_unless_streq("Interned string", "bar", bar);
+
+    /* Interning a copy should give us back the same pointer. */
+    strcpy(buf, "foo");
+    fail_unless(cork_string_pool_intern(pool, buf) == foo,
+                "Equal strings should be interned to the same pointer");
+    fail_unless(cork_string_pool_intern_n(pool, "foobar", 3) == foo,
+                "Equal strings should be interned to the same pointer");
+    fail_unless(cork_string_pool_find(pool, "bar", 3) == bar,
+                "Should find an interned string");
+    fail_unless_equal("Pool size", "%zu", (size_t) 2,
+                      cork_string_pool_size(pool));
+
+    fail_unless_equal("Length", "%zu", (size_t) 3, cork_interned_length(foo));
+    fail_unless_equal("Hash", "%" PRIu32, cork_hash_buffer(0, "foo", 3),
+                      cork_interned_hash(foo));
+
+    empty = cork_string_pool_intern(pool, "");
+    fail_unless_equal("Length", "%zu", (size_t) 0,
+                      cork_interned_length(empty));
+    fail_unless_streq("Interned string", "", empty);
+
+    /* Strings can contain NULs, and are still NUL-terminated. */
+    embedded = cork_string_pool_intern_n(pool, "foo\0bar", 7);
+    fail_unless(embedded != foo, "Embedded NUL shouldn't truncate string");
+    fail_unless_equal("Length", "%zu", (size_t) 7,
+                      cork_interned_length(embedded));
+    fail_unless(memcmp(embedded, "foo\0bar", 8) == 0,
+                "Unexpected interned contents");
+    fail_unless_equal("Pool size", "%zu", (size_t) 4,
+                      cork_string_pool_size(pool));
+
+    cork_string_pool_free(pool);
+}
+END_TEST
+
+#define STRING_POOL_COUNT  10000
+
+START_TEST(test_string_pool_many)
+{
+    struct cork_string_pool  *pool;
+    const char  **interned;
+    char  buf[32];
+    char  big[100000];
+    const char  *big_interned;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    pool = cork_string_pool_new();
+    interned = cork_calloc(STRING_POOL_COUNT, sizeof(const char *));
+    for (i = 0; i < STRING_POOL_COUNT; i++) {
+        snprintf(buf, sizeof(buf), "host-%zu.example.com", i);
+        interned[i] = cork_string_pool_intern(pool, buf);
+    }
+
+    /* Strings larger than an arena chunk get their own chunk. */
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    big_interned = cork_string_pool_intern(pool, big);
+    fail_unless_streq("Interned string", big, big_interned);
+
+    for (i = 0; i < STRING_POOL_COUNT; i++) {
+        snprintf(buf, sizeof(buf), "host-%zu.example.com", i);
+        fail_unless(cork_string_pool_intern(pool, buf) == interned[i],
+                    "Pointer for %s changed", buf);
+        fail_unless_streq("Interned string", buf, interned[i]);
+    }
+    fail_unless(cork_string_pool_intern(pool, big) == big_interned,
+                "Pointer for big string changed");
+    fail_unless_equal("Pool size", "%zu", (size_t) STRING_POOL_COUNT + 1,
+                      cork_string_pool_size(pool));
+
+    cork_cfree(interned, STRING_POOL_COUNT, sizeof(const char *));
+    cork_string_pool_free(pool);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Concurrent string pools
+ */
+
+#define STRING_POOL_THREAD_COUNT  4
+#define STRING_POOL_DISTINCT  1000
+#define STRING_POOL_ITERATIONS  20000
+
+struct cork_test_string_pool {
+    struct cork_string_pool  *pool;
+    /* Every thread fills in its own row, so that we can compare them. */
+    const char  *interned[STRING_POOL_THREAD_COUNT][STRING_POOL_DISTINCT];
+};
+
+struct cork_test_string_pool_thread {
+    struct cork_test_string_pool  *test;
+    size_t  index;
+};
+
+static int
+cork_test_string_pool__run(void *user_data)
+{
+    struct cork_test_string_pool_thread  *thread = user_data;
+    struct cork_test_string_pool  *test = thread->test;
+    size_t  i;
+    for (i = 0; i < STRING_POOL_ITERATIONS; i++) {
+        /* Each thread walks through the strings in a different order.  The
+         * strides are coprime with the number of strings, so every thread
+         * visits all of them. */
+        static const size_t  strides[] = { 1, 3, 7, 9 };
+        size_t  which = (i * strides[thread->index]) % STRING_POOL_DISTINCT;
+        char  buf[32];
+        const char  *interned;
+        snprintf(buf, sizeof(buf), "field-%zu", which);
+        interned = cork_string_pool_intern(test->pool, buf);
+        if (strcmp(interned, buf) != 0) {
+            cork_error_set_printf
+                (ENOENT, "Unexpected interned string %s for %s",
+                 interned, buf);
+            return -1;
+        }
+        if (test->interned[thread->index][which] == NULL) {
+            test->interned[thread->index][which] = interned;
+        } else if (test->interned[thread->index][which] != interned) {
+            cork_error_set_printf
+                (ENOENT, "Pointer for %s changed", buf);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+START_TEST(test_string_pool_threads)
+{
+    struct cork_test_string_pool  *test;
+    struct cork_test_string_pool_thread  args[STRING_POOL_THREAD_COUNT];
+    struct cork_thread  *threads[STRING_POOL_THREAD_COUNT];
+    size_t  i;
+    size_t  j;
+
+    DESCRIBE_TEST;
+    test = cork_new(struct cork_test_string_pool);
+    memset(test, 0, sizeof(struct cork_test_string_pool));
+    test->pool = cork_string_pool_new();
+
+    for (i = 0; i < STRING_POOL_THREAD_COUNT; i++) {
+        args[i].test = test;
+        args[i].index = i;
+        fail_if_error(threads[i] = cork_thread_new
+                      ("string-pool", &args[i], NULL,
+                       cork_test_string_pool__run));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    for (i = 0; i < STRING_POOL_THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+
+    fail_unless_equal("Pool size", "%zu", (size_t) STRING_POOL_DISTINCT,
+                      cork_string_pool_size(test->pool));
+    for (j = 0; j < STRING_POOL_DISTINCT; j++) {
+        for (i = 1; i < STRING_POOL_THREAD_COUNT; i++) {
+            fail_unless(test->interned[i][j] == test->interned[0][j],
+                        "Threads disagree about string %zu", j);
+        }
+    }
+
+    cork_string_pool_free(test->pool);
+    cork_delete(struct cork_test_string_pool, test);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("string-pool");
+
+    TCase  *tc_ds = tcase_create("string-pool");
+    tcase_set_timeout(tc_ds, 20.0);
+    tcase_add_test(tc_ds, test_string_pool);
+    tcase_add_test(tc_ds, test_string_pool_many);
+    tcase_add_test(tc_ds, test_string_pool_threads);
+    suite_add_tcase(s, tc_ds);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    setup_allocator();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -8,10 +8,13 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <check.h>
 
@@ -106,6 +109,7 @@ struct spec {
     struct cork_stream_consumer  *verify_stdout;
     struct cork_stream_consumer  *verify_stderr;
     int  exit_code;
+    const char  *cwd;
 };
 
 static struct cork_env *
@@ -126,8 +130,31 @@ test_env(struct env *env_spec)
     return env;
 }
 
+static int
+test_group__done(void *user_data, struct cork_subprocess_group *group)
+{
+    struct cork_event_loop  *loop = user_data;
+    fail_unless(cork_subprocess_group_is_finished(group),
+                "Subprocess group should be finished");
+    cork_event_loop_stop(loop);
+    return 0;
+}
+
+/* Waits for the group with an event loop instead of
+ * cork_subprocess_group_wait. */
+static void
+test_group_wait_in_loop(struct cork_subprocess_group *group)
+{
+    struct cork_event_loop  *loop;
+    fail_if_error(loop = cork_event_loop_new());
+    fail_if_error(cork_subprocess_group_attach
+                  (group, loop, loop, test_group__done));
+    fail_if_error(cork_event_loop_run(loop));
+    cork_event_loop_free(loop);
+}
+
 static void
-test_subprocesses_(size_t spec_count, struct spec **specs)
+test_subprocesses_(size_t spec_count, struct spec **specs, bool in_loop)
 {
     size_t  i;
     struct cork_subprocess_group  *group = cork_subprocess_group_new();
@@ -144,6 +171,9 @@ test_subprocesses_(size_t spec_count, struct spec **specs)
         fail_if_error(exec = cork_exec_new_with_param_array
                       (spec->program, spec->params));
         cork_exec_set_env(exec, env);
+        if (spec->cwd != NULL) {
+            cork_exec_set_cwd(exec, spec->cwd);
+        }
         fail_if_error(sub = cork_subprocess_new_exec
                       (exec, spec->verify_stdout, spec->verify_stderr,
                        &spec->exit_code));
@@ -151,7 +181,11 @@ test_subprocesses_(size_t spec_count, struct spec **specs)
     }
 
     fail_if_error(cork_subprocess_group_start(group));
-    fail_if_error(cork_subprocess_group_wait(group));
+    if (in_loop) {
+        test_group_wait_in_loop(group);
+    } else {
+        fail_if_error(cork_subprocess_group_wait(group));
+    }
 
     for (i = 0; i < spec_count; i++) {
         struct spec  *spec = specs[i];
@@ -165,7 +199,10 @@ test_subprocesses_(size_t spec_count, struct spec **specs)
 }
 
 #define test_subprocesses(specs) \
-    test_subprocesses_(sizeof(specs) / sizeof(specs[0]), specs)
+    test_subprocesses_(sizeof(specs) / sizeof(specs[0]), specs, false)
+
+#define test_subprocesses_in_loop(specs) \
+    test_subprocesses_(sizeof(specs) / sizeof(specs[0]), specs, true)
 
 
 /*-----------------------------------------------------------------------
@@ -242,6 +279,402 @@ START_TEST(test_subprocess_exit_code_01)
 END_TEST
 
 
+START_TEST(test_subprocess_cwd_01)
+{
+    static char  *params[] = { "pwd", NULL };
+    struct spec  spec = { "pwd", params, NULL, "/\n", "", 0 };
+    struct spec  *specs[] = { &spec };
+    DESCRIBE_TEST;
+    spec.cwd = "/";
+    test_subprocesses(specs);
+}
+END_TEST
+
+
+START_TEST(test_subprocess_missing_program_01)
+{
+    struct cork_exec  *exec;
+    struct cork_subprocess  *sub;
+    int  exit_code = 0;
+
+    DESCRIBE_TEST;
+    exec = cork_exec_new_with_params("/nonexistent/cork-test-program", NULL);
+    sub = cork_subprocess_new_exec(exec, NULL, NULL, &exit_code);
+    fail_if_error(cork_subprocess_start(sub));
+    fail_if_error(cork_subprocess_wait(sub));
+    fail_unless_equal("Exit code", "%d", EXIT_FAILURE, exit_code);
+    cork_subprocess_free(sub);
+}
+END_TEST
+
+
+static void
+test_write_script(struct cork_buffer *path, const char *dir,
+                  const char *name, const char *output)
+{
+    FILE  *script;
+    cork_buffer_printf(path, "%s/%s", dir, name);
+    fail_if((script = fopen(path->buf, "w")) == NULL,
+            "Cannot create test script");
+    fprintf(script, "#!/bin/sh\necho %s\n", output);
+    fclose(script);
+    fail_if(chmod(path->buf, 0755) == -1, "Cannot make script executable");
+}
+
+/* The program is found using the PATH in the child's environment, not our
+ * own, even when we can spawn the child instead of forking it. */
+START_TEST(test_subprocess_env_path_01)
+{
+    static char  *params[] = { "echo", "hello", "world", NULL };
+    char  dir[] = "/tmp/cork-test-subprocess-XXXXXX";
+    struct cork_buffer  program = CORK_BUFFER_INIT();
+    struct cork_buffer  path = CORK_BUFFER_INIT();
+    struct env  env[] = { { "PATH", NULL }, { NULL } };
+    struct spec  spec = { "echo", params, env, "child PATH\n", "", 0 };
+    struct spec  *specs[] = { &spec };
+    char  saved_cwd[PATH_MAX];
+
+    DESCRIBE_TEST;
+    fail_if(mkdtemp(dir) == NULL, "Cannot create temporary directory");
+    test_write_script(&program, dir, "echo", "child PATH");
+    cork_buffer_printf(&path, "%s/sub", dir);
+    fail_if(mkdir(path.buf, 0700) == -1, "Cannot create directory");
+    test_write_script(&program, dir, "sub/echo", "child PATH");
+    cork_buffer_printf(&path, "%s/sub/sub", dir);
+    fail_if(mkdir(path.buf, 0700) == -1, "Cannot create directory");
+    test_write_script(&program, dir, "sub/sub/echo", "wrong PATH");
+
+    cork_buffer_printf(&path, "%s:/bin:/usr/bin", dir);
+    env[0].value = path.buf;
+    test_subprocesses(specs);
+
+    /* Relative PATH entries are relative to the child's working directory. */
+    env[0].value = ".:/bin:/usr/bin";
+    spec.cwd = dir;
+    test_subprocesses(specs);
+
+    /* ...even if the working directory is itself relative, in which case it
+     * must only be applied once. */
+    fail_if(getcwd(saved_cwd, sizeof(saved_cwd)) == NULL,
+            "Cannot get working directory");
+    fail_if(chdir(dir) == -1, "Cannot change working directory");
+    spec.cwd = "sub";
+    test_subprocesses(specs);
+    fail_if(chdir(saved_cwd) == -1, "Cannot restore working directory");
+
+    cork_buffer_printf(&program, "%s/sub/sub/echo", dir);
+    unlink(program.buf);
+    cork_buffer_printf(&program, "%s/sub/sub", dir);
+    rmdir(program.buf);
+    cork_buffer_printf(&program, "%s/sub/echo", dir);
+    unlink(program.buf);
+    cork_buffer_printf(&program, "%s/sub", dir);
+    rmdir(program.buf);
+    cork_buffer_printf(&program, "%s/echo", dir);
+    unlink(program.buf);
+    rmdir(dir);
+    cork_buffer_done(&program);
+    cork_buffer_done(&path);
+}
+END_TEST
+
+
+/* Enough output that we have to grow the read buffer, and read from the pipe
+ * many times. */
+START_TEST(test_subprocess_large_output_01)
+{
+    static char  *params[] = {
+        "sh", "-c", "yes abcdefghi | head -n 50000", NULL
+    };
+    struct cork_buffer  expected = CORK_BUFFER_INIT();
+    struct spec  spec = { "sh", params, NULL, NULL, "", 0 };
+    struct spec  *specs[] = { &spec };
+    size_t  i;
+
+    DESCRIBE_TEST;
+    for (i = 0; i < 50000; i++) {
+        cork_buffer_append_literal(&expected, "abcdefghi\n");
+    }
+    spec.expected_stdout = expected.buf;
+    test_subprocesses(specs);
+    test_subprocesses_in_loop(specs);
+    cork_buffer_done(&expected);
+}
+END_TEST
+
+
+/* A consumer that holds on to every slice that it's given, without copying
+ * any data.  That's only safe if the slices are backed by managed buffers. */
+struct keep_consumer {
+    struct cork_stream_consumer  parent;
+    cork_array(struct cork_slice)  slices;
+};
+
+static int
+keep_consumer__data_vec(struct cork_stream_consumer *vself,
+                        const struct cork_slice *slices, size_t count,
+                        bool is_first)
+{
+    struct keep_consumer  *self =
+        cork_container_of(vself, struct keep_consumer, parent);
+    size_t  i;
+    for (i = 0; i < count; i++) {
+        struct cork_slice  *copy = cork_array_append_get(&self->slices);
+        fail_if(cork_slice_get_managed_buffer(&slices[i]) == NULL,
+                "Subprocess output should be in managed buffers");
+        fail_if_error(cork_slice_copy
+                      (copy, &slices[i], 0, slices[i].size));
+    }
+    return 0;
+}
+
+static int
+keep_consumer__eof(struct cork_stream_consumer *vself)
+{
+    return 0;
+}
+
+START_TEST(test_subprocess_managed_output_01)
+{
+    static char  *params[] = {
+        "sh", "-c", "yes abcdefghi | head -n 50000", NULL
+    };
+    struct keep_consumer  consumer;
+    struct cork_buffer  expected = CORK_BUFFER_INIT();
+    struct cork_buffer  actual = CORK_BUFFER_INIT();
+    struct cork_exec  *exec;
+    struct cork_subprocess  *sub;
+    int  exit_code = -1;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    consumer.parent.data = cork_stream_consumer_data_via_vec;
+    consumer.parent.data_vec = keep_consumer__data_vec;
+    consumer.parent.eof = keep_consumer__eof;
+    consumer.parent.free = NULL;
+    cork_array_init(&consumer.slices);
+
+    exec = cork_exec_new_with_param_array("sh", params);
+    sub = cork_subprocess_new_exec(exec, &consumer.parent, NULL, &exit_code);
+    fail_if_error(cork_subprocess_start(sub));
+    fail_if_error(cork_subprocess_wait(sub));
+    fail_unless_equal("Exit code", "%d", 0, exit_code);
+    cork_subprocess_free(sub);
+
+    /* The slices must still be valid after the subprocess is gone. */
+    for (i = 0; i < 50000; i++) {
+        cork_buffer_append_literal(&expected, "abcdefghi\n");
+    }
+    for (i = 0; i < cork_array_size(&consumer.slices); i++) {
+        struct cork_slice  *slice = &cork_array_at(&consumer.slices, i);
+        cork_buffer_append(&actual, slice->buf, slice->size);
+        cork_slice_finish(slice);
+    }
+    fail_unless(cork_buffer_equal(&expected, &actual),
+                "Unexpected subprocess output");
+
+    cork_array_done(&consumer.slices);
+    cork_buffer_done(&expected);
+    cork_buffer_done(&actual);
+}
+END_TEST
+
+START_TEST(test_subprocess_plain_output_01)
+{
+    static char  *params[] = { "sh", "-c", "echo hello; echo world", NULL };
+    struct cork_stream_consumer  *consumer;
+    struct cork_exec  *exec;
+    struct cork_subprocess  *sub;
+    int  exit_code = -1;
+
+    /* A consumer that hasn't opted into data_vec might not have initialized
+     * it at all; its output must go through the plain data method. */
+    DESCRIBE_TEST;
+    consumer = verify_consumer_new("stdout", "hello\nworld\n");
+    memset(&consumer->data_vec, 0xa5, sizeof(consumer->data_vec));
+    exec = cork_exec_new_with_param_array("sh", params);
+    sub = cork_subprocess_new_exec(exec, consumer, NULL, &exit_code);
+    fail_if_error(cork_subprocess_start(sub));
+    fail_if_error(cork_subprocess_wait(sub));
+    fail_unless_equal("Exit code", "%d", 0, exit_code);
+    cork_subprocess_free(sub);
+    cork_stream_consumer_free(consumer);
+}
+END_TEST
+
+
+static int
+print_hello(void *user_data)
+{
+    printf("hello from a forked child\n");
+    fflush(stdout);
+    return 0;
+}
+
+/* Read back everything that a subprocess wrote into a temporary file. */
+static void
+test_stdout_fd(struct cork_subprocess *sub, const char *expected)
+{
+    char  path[] = "/tmp/cork-test-subprocess-XXXXXX";
+    char  actual[256];
+    ssize_t  bytes_read;
+    int  fd;
+
+    fail_if((fd = mkstemp(path)) == -1, "Cannot create temporary file");
+    unlink(path);
+    cork_subprocess_set_stdout_fd(sub, fd);
+    fail_if_error(cork_subprocess_start(sub));
+    fail_if_error(cork_subprocess_wait(sub));
+    cork_subprocess_free(sub);
+
+    fail_if(lseek(fd, 0, SEEK_SET) == -1, "Cannot rewind temporary file");
+    fail_if((bytes_read = read(fd, actual, sizeof(actual) - 1)) == -1,
+            "Cannot read temporary file");
+    actual[bytes_read] = '\0';
+    close(fd);
+    fail_unless_streq("Subprocess output", expected, actual);
+}
+
+START_TEST(test_subprocess_stdout_fd_01)
+{
+    struct cork_exec  *exec;
+    struct cork_stream_consumer  *verify_stdout =
+        verify_consumer_new("stdout", "");
+
+    DESCRIBE_TEST;
+    /* The consumer shouldn't see any output. */
+    exec = cork_exec_new_with_params("echo", "hello", "world", NULL);
+    test_stdout_fd
+        (cork_subprocess_new_exec(exec, verify_stdout, NULL, NULL),
+         "hello world\n");
+    cork_stream_consumer_free(verify_stdout);
+
+    /* And the same when we fork instead of spawning. */
+    test_stdout_fd
+        (cork_subprocess_new(NULL, NULL, print_hello, NULL, NULL, NULL),
+         "hello from a forked child\n");
+}
+END_TEST
+
+
+/* More pipes than fit into an fd_set */
+START_TEST(test_subprocess_group_large_01)
+{
+#define SUBPROCESS_COUNT  400
+    struct spec  *specs[SUBPROCESS_COUNT];
+    size_t  i;
+
+    DESCRIBE_TEST;
+    for (i = 0; i < SUBPROCESS_COUNT; i++) {
+        specs[i] = cork_new(struct spec);
+        *specs[i] = (i % 2 == 0)? echo_01: false_01;
+    }
+    test_subprocesses_(SUBPROCESS_COUNT, specs, false);
+    test_subprocesses_(SUBPROCESS_COUNT, specs, true);
+    for (i = 0; i < SUBPROCESS_COUNT; i++) {
+        cork_delete(struct spec, specs[i]);
+    }
+#undef SUBPROCESS_COUNT
+}
+END_TEST
+
+
+START_TEST(test_subprocess_group_loop_01)
+{
+    struct cork_subprocess_group  *group;
+    struct cork_exec  *exec;
+    int  exit_code = -1;
+    struct spec  *specs[] = { &echo_01, &echo_02, &echo_03, &false_01 };
+
+    DESCRIBE_TEST;
+    test_subprocesses_in_loop(specs);
+
+    /* A subprocess without any pipes, so that we have to poll for it to
+     * exit. */
+    group = cork_subprocess_group_new();
+    exec = cork_exec_new_with_params("sh", "-c", "sleep 0.1; exit 3", NULL);
+    cork_subprocess_group_add
+        (group, cork_subprocess_new_exec(exec, NULL, NULL, &exit_code));
+    fail_if_error(cork_subprocess_group_start(group));
+    test_group_wait_in_loop(group);
+    fail_unless_equal("Exit code", "%d", 3, exit_code);
+    cork_subprocess_group_free(group);
+
+    /* An empty group finishes straight away */
+    group = cork_subprocess_group_new();
+    test_group_wait_in_loop(group);
+    cork_subprocess_group_free(group);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Environments and parameters
+ */
+
+START_TEST(test_env_envp)
+{
+    struct cork_env  *env;
+    char * const  *envp;
+
+    DESCRIBE_TEST;
+    env = cork_env_new();
+    envp = cork_env_envp(env);
+    fail_unless(envp[0] == NULL, "Empty environment should be empty");
+
+    cork_env_add(env, "CORK_TEST_A", "a");
+    cork_env_add_printf(env, "CORK_TEST_B", "%d", 2);
+    envp = cork_env_envp(env);
+    fail_unless_streq("Variable", "CORK_TEST_A=a", envp[0]);
+    fail_unless_streq("Variable", "CORK_TEST_B=2", envp[1]);
+    fail_unless(envp[2] == NULL, "Missing NULL terminator");
+    /* We should reuse the cached array until the environment changes. */
+    fail_unless(cork_env_envp(env) == envp, "Should reuse envp array");
+
+    cork_env_add(env, "CORK_TEST_A", "replaced");
+    envp = cork_env_envp(env);
+    fail_unless_streq("Variable", "CORK_TEST_A=replaced", envp[0]);
+    fail_unless_streq("Variable", "CORK_TEST_B=2", envp[1]);
+    fail_unless(envp[2] == NULL, "Missing NULL terminator");
+
+    cork_env_remove(env, "CORK_TEST_A");
+    envp = cork_env_envp(env);
+    fail_unless_streq("Variable", "CORK_TEST_B=2", envp[0]);
+    fail_unless(envp[1] == NULL, "Missing NULL terminator");
+
+    /* Removing a variable that isn't there doesn't change anything. */
+    cork_env_remove(env, "CORK_TEST_C");
+    fail_unless(cork_env_envp(env) == envp, "Should reuse envp array");
+    cork_env_free(env);
+}
+END_TEST
+
+START_TEST(test_exec_params)
+{
+    struct cork_exec  *exec;
+    char * const  *params;
+
+    DESCRIBE_TEST;
+    exec = cork_exec_new("echo");
+    params = cork_exec_params(exec);
+    fail_unless(params[0] == NULL, "New exec should have no parameters");
+
+    cork_exec_add_param(exec, "echo");
+    cork_exec_add_param(exec, "hello");
+    fail_unless_equal("Parameter count", "%zu",
+                      (size_t) 2, cork_exec_param_count(exec));
+    fail_unless_streq("Description", "echo hello",
+                      cork_exec_description(exec));
+    params = cork_exec_params(exec);
+    fail_unless_streq("Parameter", "echo", params[0]);
+    fail_unless_streq("Parameter", "hello", params[1]);
+    fail_unless(params[2] == NULL, "Missing NULL terminator");
+    fail_unless_streq("Parameter", "hello", cork_exec_param(exec, 1));
+    cork_exec_free(exec);
+}
+END_TEST
+
+
 /*-----------------------------------------------------------------------
  * Testing harness
  */
@@ -252,11 +685,23 @@ test_suite()
     Suite  *s = suite_create("subprocess");
 
     TCase  *tc_subprocess = tcase_create("subprocess");
+    tcase_set_timeout(tc_subprocess, 20.0);
     tcase_add_test(tc_subprocess, test_subprocess_01);
     tcase_add_test(tc_subprocess, test_subprocess_02);
     tcase_add_test(tc_subprocess, test_subprocess_03);
     tcase_add_test(tc_subprocess, test_subprocess_group_01);
     tcase_add_test(tc_subprocess, test_subprocess_exit_code_01);
+    tcase_add_test(tc_subprocess, test_subprocess_cwd_01);
+    tcase_add_test(tc_subprocess, test_subprocess_missing_program_01);
+    tcase_add_test(tc_subprocess, test_subprocess_env_path_01);
+    tcase_add_test(tc_subprocess, test_subprocess_large_output_01);
+    tcase_add_test(tc_subprocess, test_subprocess_managed_output_01);
+    tcase_add_test(tc_subprocess, test_subprocess_plain_output_01);
+    tcase_add_test(tc_subprocess, test_subprocess_stdout_fd_01);
+    tcase_add_test(tc_subprocess, test_subprocess_group_large_01);
+    tcase_add_test(tc_subprocess, test_subprocess_group_loop_01);
+    tcase_add_test(tc_subprocess, test_env_envp);
+    tcase_add_test(tc_subprocess, test_exec_params);
     suite_add_tcase(s, tc_subprocess);
 
     return s;
@@ -7,17 +7,33 @@
  * ----------------------------------------------------------------------
  */
 
+#if defined(__linux)
+/* We need this for sched_getaffinity and pthread_getname_np. */
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1
+#endif
+#endif
+
 #include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
 #include <check.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 #include "libcork/core/allocator.h"
 #include "libcork/core/types.h"
 #include "libcork/threads/atomics.h"
 #include "libcork/threads/basics.h"
+#include "libcork/threads/coarse-clock.h"
+#include "libcork/threads/epoch.h"
+#include "libcork/threads/locks.h"
+#include "libcork/threads/metrics.h"
+#include "libcork/threads/pool.h"
 
 #include "helpers.h"
 
@@ -65,6 +81,8 @@ END_TEST
 test_atomic(int,  int,          "%d");
 test_atomic(uint, unsigned int, "%u");
 test_atomic(size, size_t,       "%zu");
+test_atomic(int64,  int64_t,  "%" PRId64);
+test_atomic(uint64, uint64_t, "%" PRIu64);
 
 START_TEST(test_atomic_ptr)
 {
@@ -84,6 +102,106 @@ START_TEST(test_atomic_ptr)
 }
 END_TEST
 
+START_TEST(test_atomic_ordered)
+{
+    DESCRIBE_TEST;
+    volatile unsigned int  val = 0;
+    unsigned int  expected;
+    uint64_t  v0 = 0;
+    uint64_t * volatile  ptr = NULL;
+
+    cork_atomic_store(&val, 0x0f, CORK_ATOMIC_RELAXED);
+    fail_unless_equal("load", "%u", 0x0f,
+                      cork_atomic_load(&val, CORK_ATOMIC_RELAXED));
+    fail_unless_equal("fetch_or", "%u", 0x0f,
+                      cork_atomic_fetch_or(&val, 0xf0, CORK_ATOMIC_ACQ_REL));
+    fail_unless_equal("fetch_and", "%u", 0xff,
+                      cork_atomic_fetch_and(&val, 0x3c, CORK_ATOMIC_RELEASE));
+    fail_unless_equal("fetch_xor", "%u", 0x3c,
+                      cork_atomic_fetch_xor(&val, 0x0f, CORK_ATOMIC_ACQUIRE));
+    fail_unless_equal("fetch_add", "%u", 0x33,
+                      cork_atomic_fetch_add(&val, 2, CORK_ATOMIC_RELAXED));
+    fail_unless_equal("fetch_sub", "%u", 0x35,
+                      cork_atomic_fetch_sub(&val, 5, CORK_ATOMIC_SEQ_CST));
+    fail_unless_equal("exchange", "%u", 0x30,
+                      cork_atomic_exchange(&val, 7, CORK_ATOMIC_ACQ_REL));
+    fail_unless_equal("load", "%u", 7, cork_atomic_load_acquire(&val));
+
+    expected = 6;
+    fail_if(cork_atomic_cas(&val, &expected, 8,
+                            CORK_ATOMIC_ACQ_REL, CORK_ATOMIC_ACQUIRE),
+            "CAS should fail");
+    fail_unless_equal("expected", "%u", 7, expected);
+    fail_unless(cork_atomic_cas(&val, &expected, 8,
+                                CORK_ATOMIC_ACQ_REL, CORK_ATOMIC_ACQUIRE),
+                "CAS should succeed");
+    fail_unless_equal("val", "%u", 8, val);
+
+    cork_atomic_store_release(&ptr, &v0);
+    fail_unless_equal("ptr", "%p", &v0,
+                      cork_atomic_exchange(&ptr, NULL, CORK_ATOMIC_SEQ_CST));
+    fail_unless_equal("ptr", "%p", NULL, ptr);
+}
+END_TEST
+
+#if CORK_HAVE_ATOMIC_PAIR_CAS
+#define PAIR_THREAD_COUNT  4
+#define PAIR_ITERATIONS  20000
+
+static int
+cork_test_pair__run(void *user_data)
+{
+    volatile struct cork_atomic_pair  *pair = user_data;
+    size_t  i;
+    for (i = 0; i < PAIR_ITERATIONS; i++) {
+        struct cork_atomic_pair  expected = { pair->first, pair->second };
+        struct cork_atomic_pair  desired;
+        do {
+            desired.first = expected.first + 1;
+            desired.second = expected.second + 2;
+        } while (!cork_atomic_pair_cas(pair, &expected, desired));
+    }
+    return 0;
+}
+
+START_TEST(test_atomic_pair)
+{
+    DESCRIBE_TEST;
+    struct cork_atomic_pair  pair = { 1, 2 };
+    struct cork_atomic_pair  expected = { 1, 3 };
+    struct cork_atomic_pair  desired = { 4, 5 };
+    struct cork_thread  *threads[PAIR_THREAD_COUNT];
+    size_t  i;
+
+    /* A mismatch in either half makes the swap fail */
+    fail_if(cork_atomic_pair_cas(&pair, &expected, desired),
+            "Pair CAS should fail");
+    fail_unless_equal("first", "%" PRIuPTR, 1, expected.first);
+    fail_unless_equal("second", "%" PRIuPTR, 2, expected.second);
+    fail_unless(cork_atomic_pair_cas(&pair, &expected, desired),
+                "Pair CAS should succeed");
+    fail_unless_equal("first", "%" PRIuPTR, 4, pair.first);
+    fail_unless_equal("second", "%" PRIuPTR, 5, pair.second);
+
+    /* Both halves are always updated together */
+    pair.first = 0;
+    pair.second = 0;
+    for (i = 0; i < PAIR_THREAD_COUNT; i++) {
+        fail_if_error(threads[i] = cork_thread_new
+                      ("pair", &pair, NULL, cork_test_pair__run));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    for (i = 0; i < PAIR_THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+    fail_unless_equal("first", "%" PRIuPTR,
+                      PAIR_THREAD_COUNT * PAIR_ITERATIONS, pair.first);
+    fail_unless_equal("second", "%" PRIuPTR,
+                      2 * PAIR_THREAD_COUNT * PAIR_ITERATIONS, pair.second);
+}
+END_TEST
+#endif
+
 
 /*-----------------------------------------------------------------------
  * Once
@@ -281,6 +399,1105 @@ START_TEST(test_threads_error_01)
 }
 END_TEST
 
+struct cork_attr_thread {
+    char  name[16];
+    int  cpu_count;
+    bool  on_cpu_0;
+    size_t  stack_size;
+};
+
+static int
+cork_attr_thread__run(void *vself)
+{
+    CORK_ATTR_UNUSED struct cork_attr_thread  *self = vself;
+#if defined(__linux) && defined(__GLIBC__)
+    cpu_set_t  set;
+    pthread_attr_t  attr;
+    fail_unless(sched_getaffinity(0, sizeof(set), &set) == 0,
+                "Cannot get affinity");
+    self->cpu_count = CPU_COUNT(&set);
+    self->on_cpu_0 = CPU_ISSET(0, &set);
+    pthread_getname_np(pthread_self(), self->name, sizeof(self->name));
+    fail_unless(pthread_getattr_np(pthread_self(), &attr) == 0,
+                "Cannot get thread attributes");
+    pthread_attr_getstacksize(&attr, &self->stack_size);
+    pthread_attr_destroy(&attr);
+#endif
+    return 0;
+}
+
+START_TEST(test_threads_attributes_01)
+{
+    struct cork_thread  *t1;
+    struct cork_attr_thread  result;
+    unsigned int  cpus[] = { 0 };
+    unsigned int  bad_cpus[] = { 1u << 30 };
+
+    DESCRIBE_TEST;
+    memset(&result, 0, sizeof(result));
+    fail_if_error(t1 = cork_thread_new
+                  ("attributes-thread-with-a-long-name", &result, NULL,
+                   cork_attr_thread__run));
+    cork_thread_set_stack_size(t1, 4 * 1024 * 1024);
+    cork_thread_set_affinity(t1, cpus, 1);
+    cork_thread_set_scheduling(t1, CORK_THREAD_SCHED_OTHER, 0);
+    fail_if_error(cork_thread_start(t1));
+    fail_if_error(cork_thread_join(t1));
+#if defined(__linux) && defined(__GLIBC__)
+    fail_unless_equal("CPU count", "%d", 1, result.cpu_count);
+    fail_unless(result.on_cpu_0, "Thread should be pinned to CPU 0");
+    fail_unless_streq("Thread name", "attributes-thre", result.name);
+    fail_unless(result.stack_size >= 4 * 1024 * 1024,
+                "Thread should have a bigger stack");
+#endif
+
+    /* A CPU that can't exist */
+    fail_if_error(t1 = cork_thread_new
+                  ("test", &result, NULL, cork_attr_thread__run));
+    cork_thread_set_affinity(t1, bad_cpus, 1);
+    fail_unless_error(cork_thread_start(t1),
+                      "Shouldn't be able to pin a thread to a missing CPU");
+    cork_thread_free(t1);
+
+    /* NUMA nodes */
+    fail_if_error(t1 = cork_thread_new
+                  ("test", &result, NULL, cork_attr_thread__run));
+    fail_unless_error(cork_thread_set_numa_node(t1, 100000),
+                      "Shouldn't be able to bind a thread to a missing node");
+#if defined(__linux) && defined(__GLIBC__)
+    if (access("/sys/devices/system/node/node0/cpulist", R_OK) == 0) {
+        memset(&result, 0, sizeof(result));
+        fail_if_error(cork_thread_set_numa_node(t1, 0));
+        fail_if_error(cork_thread_start(t1));
+        fail_if_error(cork_thread_join(t1));
+        fail_unless(result.cpu_count > 0, "Thread should have some CPUs");
+        t1 = NULL;
+    }
+#endif
+    if (t1 != NULL) {
+        cork_thread_free(t1);
+    }
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Locks
+ */
+
+#define LOCK_THREAD_COUNT  4
+#define LOCK_ITERATIONS  50000
+
+struct cork_test_locks {
+    struct cork_mutex  mutex;
+    struct cork_rwlock  rwlock;
+    /* Only modified while holding the lock, so these don't need to be
+     * atomic. */
+    size_t  count;
+    size_t  first;
+    size_t  second;
+    volatile size_t  mismatches;
+};
+
+static int
+cork_test_mutex__run(void *user_data)
+{
+    struct cork_test_locks  *locks = user_data;
+    size_t  i;
+    for (i = 0; i < LOCK_ITERATIONS; i++) {
+        cork_mutex_lock(&locks->mutex);
+        locks->count++;
+        cork_mutex_unlock(&locks->mutex);
+    }
+    return 0;
+}
+
+static int
+cork_test_rwlock__run(void *user_data)
+{
+    struct cork_test_locks  *locks = user_data;
+    size_t  i;
+    for (i = 0; i < LOCK_ITERATIONS; i++) {
+        if (i % 16 == 0) {
+            cork_rwlock_write_lock(&locks->rwlock);
+            locks->first++;
+            locks->second++;
+            cork_rwlock_write_unlock(&locks->rwlock);
+        } else {
+            cork_rwlock_read_lock(&locks->rwlock);
+            if (locks->first != locks->second) {
+                cork_size_atomic_add(&locks->mismatches, 1);
+            }
+            cork_rwlock_read_unlock(&locks->rwlock);
+        }
+    }
+    return 0;
+}
+
+static void
+test_lock_threads(struct cork_test_locks *locks, cork_run_f run)
+{
+    struct cork_thread  *threads[LOCK_THREAD_COUNT];
+    size_t  i;
+    for (i = 0; i < LOCK_THREAD_COUNT; i++) {
+        fail_if_error(threads[i] = cork_thread_new("lock", locks, NULL, run));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    for (i = 0; i < LOCK_THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+}
+
+START_TEST(test_mutex)
+{
+    DESCRIBE_TEST;
+    struct cork_test_locks  locks = { CORK_MUTEX_INIT, CORK_RWLOCK_INIT };
+
+    fail_unless(cork_mutex_try_lock(&locks.mutex), "Should get the mutex");
+    fail_if(cork_mutex_try_lock(&locks.mutex), "Mutex should be locked");
+    cork_mutex_unlock(&locks.mutex);
+
+    test_lock_threads(&locks, cork_test_mutex__run);
+    fail_unless_equal("Count", "%zu",
+                      LOCK_THREAD_COUNT * LOCK_ITERATIONS, locks.count);
+    cork_mutex_done(&locks.mutex);
+}
+END_TEST
+
+START_TEST(test_rwlock)
+{
+    DESCRIBE_TEST;
+    struct cork_test_locks  locks;
+    size_t  writes = (LOCK_ITERATIONS + 15) / 16;
+
+    cork_rwlock_init(&locks.rwlock);
+    locks.first = 0;
+    locks.second = 0;
+    locks.mismatches = 0;
+
+    /* Several readers at once */
+    cork_rwlock_read_lock(&locks.rwlock);
+    cork_rwlock_read_lock(&locks.rwlock);
+    cork_rwlock_read_unlock(&locks.rwlock);
+    cork_rwlock_read_unlock(&locks.rwlock);
+
+    test_lock_threads(&locks, cork_test_rwlock__run);
+    fail_unless_equal("Writes", "%zu", LOCK_THREAD_COUNT * writes, locks.first);
+    fail_unless_equal("Writes", "%zu", locks.first, locks.second);
+    fail_unless_equal("Mismatches", "%zu", 0, locks.mismatches);
+    cork_rwlock_done(&locks.rwlock);
+}
+END_TEST
+
+
+#define PING_PONG_ROUNDS  10000
+
+struct cork_test_ping_pong {
+    struct cork_event  ping_event;
+    struct cork_event  pong_event;
+    struct cork_parker  ping_parker;
+    struct cork_parker  pong_parker;
+    struct cork_semaphore  sem;
+    struct cork_event  start;
+    volatile size_t  count;
+};
+
+static int
+cork_test_event__run(void *user_data)
+{
+    struct cork_test_ping_pong  *pp = user_data;
+    size_t  i;
+    for (i = 0; i < PING_PONG_ROUNDS; i++) {
+        cork_event_wait(&pp->ping_event);
+        pp->count++;
+        cork_event_set(&pp->pong_event);
+    }
+    return 0;
+}
+
+static int
+cork_test_parker__run(void *user_data)
+{
+    struct cork_test_ping_pong  *pp = user_data;
+    size_t  i;
+    for (i = 0; i < PING_PONG_ROUNDS; i++) {
+        cork_parker_park(&pp->ping_parker);
+        pp->count++;
+        cork_parker_unpark(&pp->pong_parker);
+    }
+    return 0;
+}
+
+static int
+cork_test_semaphore__run(void *user_data)
+{
+    struct cork_test_ping_pong  *pp = user_data;
+    size_t  i;
+    cork_event_wait(&pp->start);
+    for (i = 0; i < PING_PONG_ROUNDS; i++) {
+        cork_semaphore_wait(&pp->sem);
+        cork_size_atomic_add(&pp->count, 1);
+    }
+    return 0;
+}
+
+START_TEST(test_event)
+{
+    struct cork_test_ping_pong  pp;
+    struct cork_event  manual = CORK_EVENT_INIT(true);
+    struct cork_thread  *thread;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    fail_if(cork_event_try_wait(&manual), "Event shouldn't be set");
+    fail_if(cork_event_timed_wait(&manual, 10), "Event shouldn't be set");
+    cork_event_set(&manual);
+    fail_unless(cork_event_try_wait(&manual), "Event should be set");
+    fail_unless(cork_event_timed_wait(&manual, 10), "Event should be set");
+    fail_unless(cork_event_is_set(&manual), "Event should stay set");
+    cork_event_reset(&manual);
+    fail_if(cork_event_is_set(&manual), "Event should be reset");
+
+    /* Auto-reset events are consumed by each wait. */
+    cork_event_init(&pp.ping_event, false);
+    cork_event_init(&pp.pong_event, false);
+    cork_event_set(&pp.ping_event);
+    fail_unless(cork_event_try_wait(&pp.ping_event), "Event should be set");
+    fail_if(cork_event_try_wait(&pp.ping_event), "Event should be reset");
+
+    pp.count = 0;
+    fail_if_error(thread = cork_thread_new
+                  ("event", &pp, NULL, cork_test_event__run));
+    fail_if_error(cork_thread_start(thread));
+    for (i = 0; i < PING_PONG_ROUNDS; i++) {
+        cork_event_set(&pp.ping_event);
+        cork_event_wait(&pp.pong_event);
+        fail_unless_equal("Count", "%zu", i + 1, pp.count);
+    }
+    fail_if_error(cork_thread_join(thread));
+    cork_event_done(&manual);
+}
+END_TEST
+
+START_TEST(test_semaphore)
+{
+    struct cork_test_ping_pong  pp;
+    struct cork_thread  *threads[LOCK_THREAD_COUNT];
+    size_t  i;
+
+    DESCRIBE_TEST;
+    cork_semaphore_init(&pp.sem, 2);
+    fail_unless(cork_semaphore_try_wait(&pp.sem), "Should get semaphore");
+    fail_unless(cork_semaphore_timed_wait(&pp.sem, 10), "Should get semaphore");
+    fail_if(cork_semaphore_try_wait(&pp.sem), "Semaphore should be empty");
+    fail_if(cork_semaphore_timed_wait(&pp.sem, 10),
+            "Semaphore should be empty");
+
+    pp.count = 0;
+    cork_event_init(&pp.start, true);
+    for (i = 0; i < LOCK_THREAD_COUNT; i++) {
+        fail_if_error(threads[i] = cork_thread_new
+                      ("semaphore", &pp, NULL, cork_test_semaphore__run));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    cork_event_set(&pp.start);
+    for (i = 0; i < LOCK_THREAD_COUNT * PING_PONG_ROUNDS; i++) {
+        cork_semaphore_post(&pp.sem, 1);
+    }
+    for (i = 0; i < LOCK_THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+    fail_unless_equal("Count", "%zu",
+                      (size_t) LOCK_THREAD_COUNT * PING_PONG_ROUNDS, pp.count);
+    fail_if(cork_semaphore_try_wait(&pp.sem), "Semaphore should be empty");
+    cork_semaphore_done(&pp.sem);
+}
+END_TEST
+
+START_TEST(test_parker)
+{
+    struct cork_test_ping_pong  pp;
+    struct cork_parker  *current = cork_parker_current();
+    struct cork_thread  *thread;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    fail_if(cork_parker_timed_park(current, 10), "Shouldn't have a permit");
+    /* Permits don't accumulate, and don't need anyone to be waiting. */
+    cork_parker_unpark(current);
+    cork_parker_unpark(current);
+    fail_unless(cork_parker_timed_park(current, 10), "Should have a permit");
+    fail_if(cork_parker_timed_park(current, 10), "Shouldn't have a permit");
+
+    cork_parker_init(&pp.ping_parker);
+    cork_parker_init(&pp.pong_parker);
+    pp.count = 0;
+    fail_if_error(thread = cork_thread_new
+                  ("parker", &pp, NULL, cork_test_parker__run));
+    fail_if_error(cork_thread_start(thread));
+    for (i = 0; i < PING_PONG_ROUNDS; i++) {
+        cork_parker_unpark(&pp.ping_parker);
+        cork_parker_park(&pp.pong_parker);
+        fail_unless_equal("Count", "%zu", i + 1, pp.count);
+    }
+    fail_if_error(cork_thread_join(thread));
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Epoch-based reclamation
+ */
+
+static volatile size_t  epoch_freed;
+
+static void
+cork_test_epoch__free(void *ptr)
+{
+    cork_size_atomic_add(&epoch_freed, 1);
+    cork_delete(int, ptr);
+}
+
+struct cork_test_epoch_reader {
+    struct cork_epoch  *epoch;
+    volatile int  entered;
+    volatile int  may_exit;
+};
+
+static int
+cork_test_epoch_reader__run(void *user_data)
+{
+    struct cork_test_epoch_reader  *reader = user_data;
+    cork_epoch_enter(reader->epoch);
+    cork_atomic_store_release(&reader->entered, 1);
+    while (!cork_atomic_load_acquire(&reader->may_exit)) {
+        cork_pause();
+    }
+    cork_epoch_exit(reader->epoch);
+    cork_epoch_thread_done(reader->epoch);
+    return 0;
+}
+
+START_TEST(test_epoch)
+{
+    DESCRIBE_TEST;
+    struct cork_epoch  *epoch;
+    struct cork_test_epoch_reader  reader;
+    struct cork_thread  *thread;
+    size_t  i;
+
+    epoch_freed = 0;
+    fail_if_error(epoch = cork_epoch_new());
+
+    /* With no readers, everything can be freed right away. */
+    cork_epoch_enter(epoch);
+    cork_epoch_enter(epoch);
+    cork_epoch_defer(epoch, cork_new(int), cork_test_epoch__free);
+    cork_epoch_exit(epoch);
+    cork_epoch_exit(epoch);
+    cork_epoch_defer_free(epoch, cork_malloc(32), 32);
+    cork_epoch_synchronize(epoch);
+    fail_unless_equal("Freed", "%zu", 1, epoch_freed);
+
+    /* A reader that's in a critical section holds everything back. */
+    reader.epoch = epoch;
+    reader.entered = 0;
+    reader.may_exit = 0;
+    fail_if_error(thread = cork_thread_new
+                  ("reader", &reader, NULL, cork_test_epoch_reader__run));
+    fail_if_error(cork_thread_start(thread));
+    while (!cork_atomic_load_acquire(&reader.entered)) {
+        cork_pause();
+    }
+    for (i = 0; i < 10 * CORK_EPOCH_RECLAIM_THRESHOLD; i++) {
+        cork_epoch_defer(epoch, cork_new(int), cork_test_epoch__free);
+        cork_epoch_reclaim(epoch);
+    }
+    fail_unless_equal("Freed", "%zu", 1, epoch_freed);
+    cork_atomic_store_release(&reader.may_exit, 1);
+    fail_if_error(cork_thread_join(thread));
+    cork_epoch_synchronize(epoch);
+    fail_unless_equal("Freed", "%zu",
+                      1 + 10 * CORK_EPOCH_RECLAIM_THRESHOLD, epoch_freed);
+
+    /* Anything left over is freed along with the domain. */
+    cork_epoch_defer(epoch, cork_new(int), cork_test_epoch__free);
+    cork_epoch_free(epoch);
+    fail_unless_equal("Freed", "%zu",
+                      2 + 10 * CORK_EPOCH_RECLAIM_THRESHOLD, epoch_freed);
+}
+END_TEST
+
+/* A Treiber stack, whose nodes are freed via an epoch domain.  Without the
+ * domain, a pop could read the next pointer of a node that some other thread
+ * has already popped and freed. */
+
+#define EPOCH_THREAD_COUNT  4
+#define EPOCH_ITERATIONS  20000
+
+struct cork_test_stack_node {
+    struct cork_test_stack_node  *next;
+    size_t  value;
+};
+
+struct cork_test_stack {
+    struct cork_epoch  *epoch;
+    struct cork_test_stack_node * volatile  head;
+    volatile size_t  popped;
+};
+
+static void
+cork_test_stack_push(struct cork_test_stack *stack, size_t value)
+{
+    struct cork_test_stack_node  *node =
+        cork_new(struct cork_test_stack_node);
+    struct cork_test_stack_node  *head =
+        cork_atomic_load(&stack->head, CORK_ATOMIC_RELAXED);
+    node->value = value;
+    do {
+        node->next = head;
+    } while (!cork_atomic_cas(&stack->head, &head, node,
+                              CORK_ATOMIC_RELEASE, CORK_ATOMIC_RELAXED));
+}
+
+static bool
+cork_test_stack_pop(struct cork_test_stack *stack)
+{
+    struct cork_test_stack_node  *head;
+    cork_epoch_enter(stack->epoch);
+    head = cork_atomic_load_acquire(&stack->head);
+    while (head != NULL &&
+           !cork_atomic_cas(&stack->head, &head, head->next,
+                            CORK_ATOMIC_ACQUIRE, CORK_ATOMIC_ACQUIRE)) {
+    }
+    cork_epoch_exit(stack->epoch);
+    if (head == NULL) {
+        return false;
+    }
+    cork_epoch_defer_free
+        (stack->epoch, head, sizeof(struct cork_test_stack_node));
+    return true;
+}
+
+static int
+cork_test_stack__run(void *user_data)
+{
+    struct cork_test_stack  *stack = user_data;
+    size_t  i;
+    for (i = 0; i < EPOCH_ITERATIONS; i++) {
+        cork_test_stack_push(stack, i);
+        if (i % 2 == 1) {
+            if (cork_test_stack_pop(stack)) {
+                cork_size_atomic_add(&stack->popped, 1);
+            }
+            if (cork_test_stack_pop(stack)) {
+                cork_size_atomic_add(&stack->popped, 1);
+            }
+        }
+    }
+    cork_epoch_thread_done(stack->epoch);
+    return 0;
+}
+
+START_TEST(test_epoch_stack)
+{
+    DESCRIBE_TEST;
+    struct cork_test_stack  stack;
+    struct cork_thread  *threads[EPOCH_THREAD_COUNT];
+    size_t  remaining = 0;
+    size_t  i;
+
+    fail_if_error(stack.epoch = cork_epoch_new());
+    stack.head = NULL;
+    stack.popped = 0;
+    for (i = 0; i < EPOCH_THREAD_COUNT; i++) {
+        fail_if_error(threads[i] = cork_thread_new
+                      ("stack", &stack, NULL, cork_test_stack__run));
+        fail_if_error(cork_thread_start(threads[i]));
+    }
+    for (i = 0; i < EPOCH_THREAD_COUNT; i++) {
+        fail_if_error(cork_thread_join(threads[i]));
+    }
+
+    /* A pop can find the stack empty, so there might be some left over. */
+    while (cork_test_stack_pop(&stack)) {
+        remaining++;
+    }
+    fail_unless_equal("Nodes", "%zu", EPOCH_THREAD_COUNT * EPOCH_ITERATIONS,
+                      stack.popped + remaining);
+    cork_epoch_free(stack.epoch);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Thread pools
+ */
+
+struct cork_test_pool_task {
+    struct cork_thread_pool  *pool;
+    volatile size_t  *counter;
+    /* If nonzero, submit two child tasks with depth - 1 */
+    unsigned int  depth;
+    /* If non-NULL, store the counter's current value here */
+    size_t  *snapshot;
+};
+
+static int
+cork_test_pool_task__run(void *vself);
+
+static void
+cork_test_pool_task__free(void *vself)
+{
+    struct cork_test_pool_task  *self = vself;
+    cork_delete(struct cork_test_pool_task, self);
+}
+
+static struct cork_task *
+cork_test_pool_task_new(struct cork_thread_pool *pool,
+                        volatile size_t *counter, unsigned int depth,
+                        size_t *snapshot)
+{
+    struct cork_test_pool_task  *self = cork_new(struct cork_test_pool_task);
+    self->pool = pool;
+    self->counter = counter;
+    self->depth = depth;
+    self->snapshot = snapshot;
+    return cork_task_new
+        (self, cork_test_pool_task__free, cork_test_pool_task__run);
+}
+
+static int
+cork_test_pool_task__run(void *vself)
+{
+    struct cork_test_pool_task  *self = vself;
+    if (self->snapshot != NULL) {
+        *self->snapshot = cork_atomic_load_acquire(self->counter);
+        return 0;
+    }
+    cork_size_atomic_add(self->counter, 1);
+    if (self->depth > 0) {
+        cork_thread_pool_submit
+            (self->pool, cork_test_pool_task_new
+             (self->pool, self->counter, self->depth - 1, NULL));
+        cork_thread_pool_submit
+            (self->pool, cork_test_pool_task_new
+             (self->pool, self->counter, self->depth - 1, NULL));
+    }
+    return 0;
+}
+
+static int
+cork_test_pool_error__run(void *user_data)
+{
+    cork_system_error_set_explicit(ENOMEM);
+    return -1;
+}
+
+static void
+test_thread_pool(size_t worker_count, bool start)
+{
+    struct cork_thread_pool  *pool;
+    struct cork_task  *continuation;
+    volatile size_t  counter = 0;
+    size_t  snapshot = 0;
+    size_t  i;
+
+    fail_if_error(pool = cork_thread_pool_new(worker_count));
+    if (start) {
+        fail_if_error(cork_thread_pool_start(pool));
+    }
+
+    /* Independent tasks */
+    for (i = 0; i < 1000; i++) {
+        cork_thread_pool_submit
+            (pool, cork_test_pool_task_new(pool, &counter, 0, NULL));
+    }
+    fail_if_error(cork_thread_pool_wait(pool));
+    fail_unless_equal("Task count", "%zu", 1000, counter);
+
+    /* Tasks that submit more tasks from within the pool */
+    counter = 0;
+    cork_thread_pool_submit
+        (pool, cork_test_pool_task_new(pool, &counter, 10, NULL));
+    fail_if_error(cork_thread_pool_wait(pool));
+    fail_unless_equal("Task count", "%zu", 2047, counter);
+
+    /* A continuation that waits for several tasks */
+    counter = 0;
+    continuation = cork_test_pool_task_new(pool, &counter, 0, &snapshot);
+    {
+        struct cork_task  *tasks[16];
+        for (i = 0; i < 16; i++) {
+            tasks[i] = cork_test_pool_task_new(pool, &counter, 3, NULL);
+            cork_task_then(tasks[i], continuation);
+        }
+        for (i = 0; i < 16; i++) {
+            cork_thread_pool_submit(pool, tasks[i]);
+        }
+    }
+    fail_if_error(cork_thread_pool_wait(pool));
+    /* The continuation only waits for the tasks it's attached to, and not for
+     * the children that they submit, so all we know is that it saw at least
+     * the 16 parents. */
+    fail_unless(snapshot >= 16, "Continuation ran too early (%zu)", snapshot);
+    fail_unless_equal("Task count", "%zu", 16 * 15, counter);
+
+    /* Errors are passed back from cork_thread_pool_wait */
+    cork_thread_pool_submit
+        (pool, cork_task_new(NULL, NULL, cork_test_pool_error__run));
+    cork_thread_pool_submit
+        (pool, cork_test_pool_task_new(pool, &counter, 0, NULL));
+    fail_unless_error(cork_thread_pool_wait(pool));
+    fail_if_error(cork_thread_pool_wait(pool));
+
+    cork_thread_pool_free(pool);
+}
+
+START_TEST(test_thread_pool_tasks)
+{
+    DESCRIBE_TEST;
+    test_thread_pool(1, true);
+    test_thread_pool(4, true);
+    test_thread_pool(0, true);
+    /* Without any workers, the waiting thread runs everything itself. */
+    test_thread_pool(4, false);
+}
+END_TEST
+
+
+#define PARALLEL_FOR_SIZE  100000
+
+struct cork_test_parallel_for {
+    struct cork_thread_pool  *pool;
+    volatile unsigned int  *visited;
+    /* Fail when we reach this index */
+    size_t  fail_at;
+    /* Run a nested loop over this many indices for each index */
+    size_t  nested;
+};
+
+static int
+cork_test_parallel_for__body(void *user_data, size_t start, size_t end)
+{
+    struct cork_test_parallel_for  *self = user_data;
+    size_t  i;
+    for (i = start; i < end; i++) {
+        if (i == self->fail_at) {
+            cork_error_set_printf(CORK_UNKNOWN_ERROR, "Failed at %zu", i);
+            return -1;
+        }
+        if (self->nested > 0) {
+            struct cork_test_parallel_for  inner = *self;
+            inner.visited = self->visited + i * self->nested;
+            inner.nested = 0;
+            inner.fail_at = SIZE_MAX;
+            if (cork_thread_pool_parallel_for
+                (self->pool, 0, self->nested, 4,
+                 &inner, cork_test_parallel_for__body) != 0) {
+                return -1;
+            }
+        } else {
+            cork_uint_atomic_add(&self->visited[i], 1);
+        }
+    }
+    return 0;
+}
+
+static void
+test_parallel_for(size_t worker_count, size_t grain_size)
+{
+    struct cork_thread_pool  *pool;
+    struct cork_test_parallel_for  loop;
+    volatile unsigned int  *visited;
+    size_t  i;
+
+    visited = cork_calloc(PARALLEL_FOR_SIZE, sizeof(unsigned int));
+    fail_if_error(pool = cork_thread_pool_new(worker_count));
+    fail_if_error(cork_thread_pool_start(pool));
+
+    loop.pool = pool;
+    loop.visited = visited;
+    loop.fail_at = SIZE_MAX;
+    loop.nested = 0;
+    fail_if_error(cork_thread_pool_parallel_for
+                  (pool, 0, PARALLEL_FOR_SIZE, grain_size,
+                   &loop, cork_test_parallel_for__body));
+    for (i = 0; i < PARALLEL_FOR_SIZE; i++) {
+        fail_unless(visited[i] == 1,
+                    "Index %zu visited %u times", i, visited[i]);
+    }
+
+    /* Nested loops, which split the same array into 1000 chunks of 100 */
+    loop.nested = 100;
+    fail_if_error(cork_thread_pool_parallel_for
+                  (pool, 0, PARALLEL_FOR_SIZE / 100, 8,
+                   &loop, cork_test_parallel_for__body));
+    for (i = 0; i < PARALLEL_FOR_SIZE; i++) {
+        fail_unless(visited[i] == 2,
+                    "Index %zu visited %u times", i, visited[i]);
+    }
+
+    /* Empty ranges don't call the body at all */
+    loop.nested = 0;
+    loop.fail_at = 0;
+    fail_if_error(cork_thread_pool_parallel_for
+                  (pool, 10, 10, grain_size,
+                   &loop, cork_test_parallel_for__body));
+
+    loop.fail_at = PARALLEL_FOR_SIZE / 3;
+    fail_unless_error(cork_thread_pool_parallel_for
+                      (pool, 0, PARALLEL_FOR_SIZE, grain_size,
+                       &loop, cork_test_parallel_for__body));
+
+    cork_thread_pool_free(pool);
+    cork_cfree((void *) visited, PARALLEL_FOR_SIZE, sizeof(unsigned int));
+}
+
+START_TEST(test_thread_pool_parallel_for)
+{
+    DESCRIBE_TEST;
+    test_parallel_for(1, 1);
+    test_parallel_for(4, 0);
+    test_parallel_for(4, 1000);
+    test_parallel_for(0, 100);
+}
+END_TEST
+
+
+#if defined(__linux) && defined(__GLIBC__)
+static int
+test_pinned_worker(void *user_data, size_t start, size_t end)
+{
+    volatile int  *unpinned = user_data;
+    cpu_set_t  set;
+    /* The test thread helps run chunks too, but it isn't pinned. */
+    if (cork_current_thread_get() == NULL) {
+        return 0;
+    }
+    fail_unless(sched_getaffinity(0, sizeof(set), &set) == 0,
+                "Cannot get affinity");
+    if (CPU_COUNT(&set) != 1 || !CPU_ISSET(0, &set)) {
+        *unpinned = 1;
+    }
+    return 0;
+}
+
+START_TEST(test_thread_pool_affinity)
+{
+    struct cork_thread_pool  *pool;
+    unsigned int  cpus[] = { 0 };
+    volatile int  unpinned = 0;
+
+    DESCRIBE_TEST;
+    fail_if_error(pool = cork_thread_pool_new(2));
+    cork_thread_pool_set_affinity(pool, cpus, 1);
+    fail_if_error(cork_thread_pool_start(pool));
+    fail_if_error(cork_thread_pool_parallel_for
+                  (pool, 0, 1000, 1, (void *) &unpinned, test_pinned_worker));
+    cork_thread_pool_free(pool);
+    fail_unless(unpinned == 0, "Workers should be pinned to CPU 0");
+}
+END_TEST
+#endif
+
+
+#define PARALLEL_SORT_SIZE  100003
+
+struct cork_test_record {
+    uint32_t  key;
+    uint32_t  index;
+};
+
+static int
+cork_test_record__compare(void *user_data, const void *va, const void *vb)
+{
+    const struct cork_test_record  *a = va;
+    const struct cork_test_record  *b = vb;
+    return (a->key < b->key)? -1: (a->key > b->key)? 1: 0;
+}
+
+static void
+test_parallel_sort(size_t worker_count, size_t count)
+{
+    struct cork_thread_pool  *pool;
+    struct cork_test_record  *records;
+    size_t  *seen;
+    uint32_t  seed = 0;
+    size_t  i;
+
+    records = cork_calloc(count + 1, sizeof(struct cork_test_record));
+    seen = cork_calloc(count + 1, sizeof(size_t));
+    for (i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        records[i].key = (seed >> 8) % (count / 2 + 1);
+        records[i].index = i;
+    }
+
+    fail_if_error(pool = cork_thread_pool_new(worker_count));
+    fail_if_error(cork_thread_pool_start(pool));
+    fail_if_error(cork_thread_pool_parallel_sort
+                  (pool, records, count, sizeof(struct cork_test_record),
+                   NULL, cork_test_record__compare));
+    cork_thread_pool_free(pool);
+
+    for (i = 0; i < count; i++) {
+        if (i > 0) {
+            fail_unless(records[i - 1].key <= records[i].key,
+                        "Elements %zu and %zu are out of order", i - 1, i);
+        }
+        seen[records[i].index]++;
+    }
+    for (i = 0; i < count; i++) {
+        fail_unless(seen[i] == 1, "Record %zu appears %zu times", i, seen[i]);
+    }
+
+    cork_cfree(records, count + 1, sizeof(struct cork_test_record));
+    cork_cfree(seen, count + 1, sizeof(size_t));
+}
+
+START_TEST(test_thread_pool_parallel_sort)
+{
+    DESCRIBE_TEST;
+    test_parallel_sort(4, 10);
+    test_parallel_sort(1, PARALLEL_SORT_SIZE);
+    test_parallel_sort(4, PARALLEL_SORT_SIZE);
+    test_parallel_sort(0, PARALLEL_SORT_SIZE);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Metrics
+ */
+
+#define METRICS_THREAD_COUNT  4
+#define METRICS_ITERATIONS  10000
+
+struct cork_test_metrics {
+    struct cork_metrics  *metrics;
+    struct cork_counter  *counter;
+    struct cork_histogram  *histogram;
+};
+
+static int
+cork_test_metrics__run(void *user_data)
+{
+    struct cork_test_metrics  *test = user_data;
+    size_t  i;
+    for (i = 0; i < METRICS_ITERATIONS; i++) {
+        cork_counter_inc(test->counter);
+        cork_histogram_record(test->histogram, i % 100);
+    }
+    cork_metrics_thread_done(test->metrics);
+    return 0;
+}
+
+START_TEST(test_metrics_threads)
+{
+    DESCRIBE_TEST;
+    struct cork_test_metrics  test;
+    struct cork_thread  *threads[METRICS_THREAD_COUNT];
+    struct cork_histogram_snapshot  snapshot;
+    size_t  round;
+    size_t  i;
+
+    test.metrics = cork_metrics_new();
+    test.counter = cork_metrics_add_counter
+        (test.metrics, "requests_total", "Number of requests");
+    test.histogram = cork_metrics_add_histogram
+        (test.metrics, "request_latency", NULL, 1000, 4);
+    cork_histogram_snapshot_init(&snapshot);
+
+    /* The second round of threads reuses the first round's shards, but
+     * shouldn't lose any of the values in them. */
+    for (round = 1; round <= 2; round++) {
+        for (i = 0; i < METRICS_THREAD_COUNT; i++) {
+            fail_if_error(threads[i] = cork_thread_new
+                          ("metrics", &test, NULL, cork_test_metrics__run));
+            fail_if_error(cork_thread_start(threads[i]));
+        }
+        for (i = 0; i < METRICS_THREAD_COUNT; i++) {
+            fail_if_error(cork_thread_join(threads[i]));
+        }
+        fail_unless_equal("Counter", "%" PRIu64,
+                          (uint64_t) round * METRICS_THREAD_COUNT *
+                          METRICS_ITERATIONS,
+                          cork_counter_get(test.counter));
+    }
+
+    cork_histogram_get_snapshot(test.histogram, &snapshot);
+    fail_unless_equal("Count", "%" PRIu64,
+                      (uint64_t) 2 * METRICS_THREAD_COUNT * METRICS_ITERATIONS,
+                      snapshot.count);
+    fail_unless_equal("Sum", "%" PRIu64,
+                      (uint64_t) 2 * METRICS_THREAD_COUNT *
+                      (METRICS_ITERATIONS / 100) * 4950,
+                      snapshot.sum);
+    fail_unless_equal("Min", "%" PRIu64, 0, snapshot.min);
+    fail_unless_equal("Max", "%" PRIu64, 99, snapshot.max);
+
+    cork_histogram_snapshot_done(&snapshot);
+    cork_metrics_free(test.metrics);
+}
+END_TEST
+
+START_TEST(test_metrics_histogram)
+{
+    DESCRIBE_TEST;
+    struct cork_metrics  *metrics = cork_metrics_new();
+    struct cork_histogram  *histogram = cork_metrics_add_histogram
+        (metrics, "latency_ns", "Latency", UINT64_C(1000000000), 3);
+    struct cork_histogram  *wide = cork_metrics_add_histogram
+        (metrics, "wide", "Everything", UINT64_MAX, 2);
+    struct cork_histogram_snapshot  snapshot;
+    uint64_t  value;
+
+    cork_histogram_snapshot_init(&snapshot);
+    cork_histogram_get_snapshot(histogram, &snapshot);
+    fail_unless_equal("Count", "%" PRIu64, 0, snapshot.count);
+    fail_unless_equal("p50", "%" PRIu64, 0,
+                      cork_histogram_snapshot_percentile(&snapshot, 50));
+
+    /* Small values are recorded exactly. */
+    for (value = 1; value <= 8; value++) {
+        cork_histogram_record(histogram, value);
+    }
+    cork_histogram_get_snapshot(histogram, &snapshot);
+    fail_unless_equal("Count", "%" PRIu64, 8, snapshot.count);
+    fail_unless_equal("Sum", "%" PRIu64, 36, snapshot.sum);
+    fail_unless_equal("Min", "%" PRIu64, 1, snapshot.min);
+    fail_unless_equal("Max", "%" PRIu64, 8, snapshot.max);
+    fail_unless_equal("p0", "%" PRIu64, 1,
+                      cork_histogram_snapshot_percentile(&snapshot, 0));
+    fail_unless_equal("p50", "%" PRIu64, 4,
+                      cork_histogram_snapshot_percentile(&snapshot, 50));
+    fail_unless_equal("p75", "%" PRIu64, 6,
+                      cork_histogram_snapshot_percentile(&snapshot, 75));
+    fail_unless_equal("p100", "%" PRIu64, 8,
+                      cork_histogram_snapshot_percentile(&snapshot, 100));
+
+    /* Larger values are within 1/8 of the actual value. */
+    for (value = 0; value < 92; value++) {
+        cork_histogram_record(histogram, 1000000);
+    }
+    cork_histogram_get_snapshot(histogram, &snapshot);
+    value = cork_histogram_snapshot_percentile(&snapshot, 50);
+    fail_unless(value >= 1000000 && value <= 1000000 + 1000000 / 8,
+                "Unexpected p50 %" PRIu64, value);
+    fail_unless_equal("p99", "%" PRIu64, 1000000,
+                      cork_histogram_snapshot_percentile(&snapshot, 99));
+
+    /* Values above the maximum are clamped. */
+    cork_histogram_record(histogram, UINT64_C(5000000000));
+    cork_histogram_get_snapshot(histogram, &snapshot);
+    fail_unless_equal("Max", "%" PRIu64, UINT64_C(1000000000), snapshot.max);
+    fail_unless_equal("Sum", "%" PRIu64,
+                      36 + 92 * UINT64_C(1000000) + UINT64_C(5000000000),
+                      snapshot.sum);
+
+    /* The very last bucket works, too. */
+    cork_histogram_record(wide, UINT64_MAX);
+    cork_histogram_record(wide, 0);
+    cork_histogram_get_snapshot(wide, &snapshot);
+    fail_unless_equal("Min", "%" PRIu64, 0, snapshot.min);
+    fail_unless_equal("p100", "%" PRIu64, UINT64_MAX,
+                      cork_histogram_snapshot_percentile(&snapshot, 100));
+
+    cork_histogram_snapshot_done(&snapshot);
+    cork_metrics_free(metrics);
+}
+END_TEST
+
+START_TEST(test_metrics_export)
+{
+    DESCRIBE_TEST;
+    struct cork_metrics  *metrics = cork_metrics_new();
+    struct cork_counter  *counter = cork_metrics_add_counter
+        (metrics, "hits_total", "Cache hits\\misses\nsecond line");
+    struct cork_histogram  *histogram = cork_metrics_add_histogram
+        (metrics, "size", "Sizes", 10, 2);
+    struct cork_buffer  buf = CORK_BUFFER_INIT();
+
+    cork_counter_add(counter, 12);
+    cork_counter_inc(counter);
+    cork_histogram_record(histogram, 2);
+    cork_histogram_record(histogram, 5);
+
+    cork_metrics_export_text(metrics, &buf);
+    fail_unless_streq("Text export",
+        "hits_total 13\n"
+        "size count=2 sum=7 min=2 p50=2 p90=5 p99=5 p99.9=5 max=5\n",
+        buf.buf);
+
+    cork_buffer_clear(&buf);
+    cork_metrics_export_prometheus(metrics, &buf);
+    fail_unless_streq("Prometheus export",
+        "# HELP hits_total Cache hits\\\\misses\\nsecond line\n"
+        "# TYPE hits_total counter\n"
+        "hits_total 13\n"
+        "# HELP size Sizes\n"
+        "# TYPE size histogram\n"
+        "size_bucket{le=\"0\"} 0\n"
+        "size_bucket{le=\"1\"} 0\n"
+        "size_bucket{le=\"3\"} 1\n"
+        "size_bucket{le=\"7\"} 2\n"
+        "size_bucket{le=\"+Inf\"} 2\n"
+        "size_sum 7\n"
+        "size_count 2\n",
+        buf.buf);
+
+    cork_buffer_done(&buf);
+    cork_metrics_free(metrics);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Coarse clocks
+ */
+
+START_TEST(test_coarse_clock)
+{
+    DESCRIBE_TEST;
+    struct cork_coarse_clock  *clock;
+    struct cork_buffer  buf1 = CORK_BUFFER_INIT();
+    struct cork_buffer  buf2 = CORK_BUFFER_INIT();
+    cork_timestamp  start;
+    cork_timestamp  now;
+    cork_timestamp  monotonic;
+
+    clock = cork_coarse_clock_new(1, "%Y-%m-%dT%H:%M:%S.%3fZ");
+    start = cork_coarse_clock_now(clock);
+    monotonic = cork_coarse_clock_monotonic(clock);
+    cork_timestamp_init_now(&now);
+    fail_unless(start != 0 && start <= now, "Clock wasn't initialized");
+
+    /* Until it starts ticking, the clock stays put, and so does its cached
+     * string. */
+    fail_if_error(cork_coarse_clock_format_utc(clock, &buf1));
+    fail_if_error(cork_coarse_clock_format_utc(clock, &buf2));
+    fail_unless_equal("Formatted length", "%zu",
+                      sizeof("YYYY-MM-DDTHH:MM:SS.mmmZ") - 1, buf1.size);
+    fail_unless_streq("Cached string", buf1.buf, buf2.buf);
+    cork_buffer_clear(&buf2);
+    cork_buffer_append_timestamp_utc(&buf2, start, 3);
+    fail_unless_streq("Formatted string", buf2.buf, buf1.buf);
+
+    fail_if_error(cork_coarse_clock_start(clock));
+    while (cork_coarse_clock_monotonic(clock) == monotonic) {
+        cork_pause();
+    }
+    fail_unless(cork_coarse_clock_now(clock) >= start,
+                "Clock went backwards");
+    fail_unless(cork_coarse_clock_monotonic(clock) > monotonic,
+                "Clock went backwards");
+    cork_coarse_clock_free(clock);
+    cork_buffer_done(&buf1);
+    cork_buffer_done(&buf2);
+}
+END_TEST
+
 
 /*-----------------------------------------------------------------------
  * Testing harness
@@ -295,7 +1512,13 @@ test_suite()
     tcase_add_test(tc_atomic, test_atomic_int);
     tcase_add_test(tc_atomic, test_atomic_uint);
     tcase_add_test(tc_atomic, test_atomic_size);
+    tcase_add_test(tc_atomic, test_atomic_int64);
+    tcase_add_test(tc_atomic, test_atomic_uint64);
     tcase_add_test(tc_atomic, test_atomic_ptr);
+    tcase_add_test(tc_atomic, test_atomic_ordered);
+#if CORK_HAVE_ATOMIC_PAIR_CAS
+    tcase_add_test(tc_atomic, test_atomic_pair);
+#endif
     suite_add_tcase(s, tc_atomic);
 
     TCase  *tc_basics = tcase_create("basics");
@@ -310,8 +1533,46 @@ test_suite()
     tcase_add_test(tc_threads, test_threads_03);
     tcase_add_test(tc_threads, test_threads_04);
     tcase_add_test(tc_threads, test_threads_error_01);
+    tcase_add_test(tc_threads, test_threads_attributes_01);
     suite_add_tcase(s, tc_threads);
 
+    TCase  *tc_locks = tcase_create("locks");
+    tcase_set_timeout(tc_locks, 20.0);
+    tcase_add_test(tc_locks, test_mutex);
+    tcase_add_test(tc_locks, test_event);
+    tcase_add_test(tc_locks, test_semaphore);
+    tcase_add_test(tc_locks, test_parker);
+    tcase_add_test(tc_locks, test_rwlock);
+    suite_add_tcase(s, tc_locks);
+
+    TCase  *tc_epoch = tcase_create("epoch");
+    tcase_set_timeout(tc_epoch, 20.0);
+    tcase_add_test(tc_epoch, test_epoch);
+    tcase_add_test(tc_epoch, test_epoch_stack);
+    suite_add_tcase(s, tc_epoch);
+
+    TCase  *tc_pool = tcase_create("pool");
+    tcase_set_timeout(tc_pool, 20.0);
+    tcase_add_test(tc_pool, test_thread_pool_tasks);
+    tcase_add_test(tc_pool, test_thread_pool_parallel_for);
+    tcase_add_test(tc_pool, test_thread_pool_parallel_sort);
+#if defined(__linux) && defined(__GLIBC__)
+    tcase_add_test(tc_pool, test_thread_pool_affinity);
+#endif
+    suite_add_tcase(s, tc_pool);
+
+    TCase  *tc_metrics = tcase_create("metrics");
+    tcase_set_timeout(tc_metrics, 20.0);
+    tcase_add_test(tc_metrics, test_metrics_threads);
+    tcase_add_test(tc_metrics, test_metrics_histogram);
+    tcase_add_test(tc_metrics, test_metrics_export);
+    suite_add_tcase(s, tc_metrics);
+
+    TCase  *tc_coarse_clock = tcase_create("coarse-clock");
+    tcase_set_timeout(tc_coarse_clock, 20.0);
+    tcase_add_test(tc_coarse_clock, test_coarse_clock);
+    suite_add_tcase(s, tc_coarse_clock);
+
     return s;
 }
 
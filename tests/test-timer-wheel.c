@@ -0,0 +1,398 @@
+/* -*- coding: utf-8 -*-
+ * ----------------------------------------------------------------------
+ * Copyright © 2015, RedJack, LLC.
+ * All rights reserved.
+ *
+ * Please see the COPYING file in this distribution for license details.
+ * ----------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <check.h>
+
+#include "libcork/core/allocator.h"
+#include "libcork/core/timestamp.h"
+#include "libcork/core/types.h"
+#include "libcork/ds/timer-wheel.h"
+
+#include "helpers.h"
+
+
+/*-----------------------------------------------------------------------
+ * Helpers
+ */
+
+/* 1ms ticks, counted directly in cork_timestamp units to make the
+ * arithmetic easy to follow. */
+#define TICK  ((cork_timestamp) 1000)
+
+struct test_timer {
+    struct cork_timer  timer;
+    unsigned int  id;
+    unsigned int  fired;
+    cork_timestamp  fired_at;
+};
+
+struct test_state {
+    cork_timestamp  now;
+    size_t  fired;
+    /* Optional behavior for the fire callback */
+    struct test_timer  *cancel_on_fire;
+    cork_timestamp  reschedule_interval;
+    struct cork_timer_wheel  *wheel;
+};
+
+static void
+test_fire(void *user_data, struct cork_timer *timer)
+{
+    struct test_state  *state = user_data;
+    struct test_timer  *t =
+        cork_container_of(timer, struct test_timer, timer);
+    fail_if(cork_timer_is_scheduled(timer),
+            "Timer should be unscheduled when it fires");
+    t->fired++;
+    t->fired_at = state->now;
+    state->fired++;
+    if (state->cancel_on_fire != NULL) {
+        cork_timer_wheel_cancel(state->wheel, &state->cancel_on_fire->timer);
+        state->cancel_on_fire = NULL;
+    }
+    if (state->reschedule_interval != 0) {
+        cork_timer_wheel_schedule
+            (state->wheel, timer, timer->expires + state->reschedule_interval);
+    }
+}
+
+static size_t
+test_advance(struct cork_timer_wheel *wheel, struct test_state *state,
+             cork_timestamp now)
+{
+    state->now = now;
+    return cork_timer_wheel_advance(wheel, now, test_fire);
+}
+
+static struct cork_timer_wheel *
+test_wheel_new(struct test_state *state)
+{
+    struct cork_timer_wheel  *wheel = cork_timer_wheel_new(TICK);
+    memset(state, 0, sizeof(*state));
+    state->wheel = wheel;
+    cork_timer_wheel_set_user_data(wheel, state, NULL);
+    return wheel;
+}
+
+
+/*-----------------------------------------------------------------------
+ * Basic operations
+ */
+
+START_TEST(test_timer_wheel_basics)
+{
+    struct test_state  state;
+    struct cork_timer_wheel  *wheel = test_wheel_new(&state);
+    struct test_timer  timers[4];
+    cork_timestamp  when;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    for (i = 0; i < 4; i++) {
+        cork_timer_init(&timers[i].timer);
+        timers[i].id = i;
+        timers[i].fired = 0;
+    }
+    fail_if(cork_timer_wheel_next_expiration(wheel, &when),
+            "Empty wheel shouldn't have an expiration");
+
+    cork_timer_wheel_schedule(wheel, &timers[0].timer, 5 * TICK);
+    cork_timer_wheel_schedule(wheel, &timers[1].timer, 5 * TICK + 1);
+    cork_timer_wheel_schedule(wheel, &timers[2].timer, 100 * TICK);
+    cork_timer_wheel_schedule(wheel, &timers[3].timer, 70000 * TICK);
+    fail_unless(cork_timer_is_scheduled(&timers[0].timer),
+                "Timer should be scheduled");
+    fail_unless_equal("Wheel size", "%zu", (size_t) 4,
+                      cork_timer_wheel_size(wheel));
+    fail_unless(cork_timer_wheel_next_expiration(wheel, &when),
+                "Wheel should have an expiration");
+    fail_unless(when <= 5 * TICK, "Next expiration is too late");
+
+    /* Nothing has expired yet */
+    fail_unless_equal("Fired", "%zu", (size_t) 0,
+                      test_advance(wheel, &state, 5 * TICK - 1));
+    /* Timers never fire early, and a timer that expires partway through a
+     * tick fires at the end of that tick. */
+    fail_unless_equal("Fired", "%zu", (size_t) 1,
+                      test_advance(wheel, &state, 5 * TICK));
+    fail_unless_equal("Timer 0", "%u", 1, timers[0].fired);
+    fail_if(cork_timer_is_scheduled(&timers[0].timer),
+            "Fired timer should be unscheduled");
+    /* The next expiration is the end of the tick that timer 1 expires in,
+     * since that's when it can fire. */
+    fail_unless(cork_timer_wheel_next_expiration(wheel, &when),
+                "Wheel should have an expiration");
+    fail_unless_equal("Next expiration", "%" PRIu64,
+                      (uint64_t) (6 * TICK), (uint64_t) when);
+    fail_unless_equal("Fired", "%zu", (size_t) 1,
+                      test_advance(wheel, &state, 6 * TICK));
+    fail_unless_equal("Timer 1", "%u", 1, timers[1].fired);
+
+    /* Cancel one, and reschedule another */
+    fail_unless(cork_timer_wheel_cancel(wheel, &timers[2].timer),
+                "Couldn't cancel timer");
+    fail_if(cork_timer_wheel_cancel(wheel, &timers[2].timer),
+            "Cancelled timer twice");
+    cork_timer_wheel_schedule(wheel, &timers[3].timer, 200 * TICK);
+    fail_unless_equal("Wheel size", "%zu", (size_t) 1,
+                      cork_timer_wheel_size(wheel));
+    fail_unless_equal("Fired", "%zu", (size_t) 0,
+                      test_advance(wheel, &state, 199 * TICK));
+    fail_unless_equal("Fired", "%zu", (size_t) 1,
+                      test_advance(wheel, &state, 100000 * TICK));
+    fail_unless_equal("Timer 2", "%u", 0, timers[2].fired);
+    fail_unless_equal("Timer 3", "%u", 1, timers[3].fired);
+
+    /* A timer in the past fires on the next advance, even if time doesn't
+     * move. */
+    cork_timer_wheel_schedule(wheel, &timers[0].timer, 10 * TICK);
+    fail_unless(cork_timer_wheel_next_expiration(wheel, &when),
+                "Wheel should have an expiration");
+    fail_unless(when <= 100000 * TICK, "Next expiration is too late");
+    fail_unless_equal("Fired", "%zu", (size_t) 1,
+                      test_advance(wheel, &state, 100000 * TICK));
+    fail_unless_equal("Timer 0", "%u", 2, timers[0].fired);
+    fail_unless_equal("Wheel size", "%zu", (size_t) 0,
+                      cork_timer_wheel_size(wheel));
+
+    /* Freeing the wheel unschedules its timers */
+    cork_timer_wheel_schedule(wheel, &timers[1].timer, 200000 * TICK);
+    cork_timer_wheel_free(wheel);
+    fail_if(cork_timer_is_scheduled(&timers[1].timer),
+            "Timer should be unscheduled when its wheel is freed");
+}
+END_TEST
+
+START_TEST(test_timer_wheel_callbacks)
+{
+    struct test_state  state;
+    struct cork_timer_wheel  *wheel = test_wheel_new(&state);
+    struct test_timer  periodic;
+    struct test_timer  victim;
+
+    DESCRIBE_TEST;
+    cork_timer_init(&periodic.timer);
+    periodic.fired = 0;
+    cork_timer_init(&victim.timer);
+    victim.fired = 0;
+
+    /* A periodic timer reschedules itself from its callback, and only fires
+     * once per advance. */
+    state.reschedule_interval = 10 * TICK;
+    cork_timer_wheel_schedule(wheel, &periodic.timer, 10 * TICK);
+    fail_unless_equal("Fired", "%zu", (size_t) 1,
+                      test_advance(wheel, &state, 35 * TICK));
+    fail_unless(cork_timer_is_scheduled(&periodic.timer),
+                "Periodic timer should still be scheduled");
+    fail_unless_equal("Fired", "%zu", (size_t) 1,
+                      test_advance(wheel, &state, 35 * TICK));
+    fail_unless_equal("Fired", "%zu", (size_t) 1,
+                      test_advance(wheel, &state, 35 * TICK));
+    fail_unless_equal("Fired", "%zu", (size_t) 0,
+                      test_advance(wheel, &state, 35 * TICK));
+    fail_unless_equal("Periodic count", "%u", 3, periodic.fired);
+    cork_timer_wheel_cancel(wheel, &periodic.timer);
+    state.reschedule_interval = 0;
+
+    /* A callback can cancel another timer from the same batch. */
+    cork_timer_wheel_schedule(wheel, &periodic.timer, 40 * TICK);
+    cork_timer_wheel_schedule(wheel, &victim.timer, 40 * TICK);
+    state.cancel_on_fire = &victim;
+    fail_unless_equal("Fired", "%zu", (size_t) 1,
+                      test_advance(wheel, &state, 40 * TICK));
+    fail_unless_equal("Victim count", "%u", 0, victim.fired);
+    fail_unless_equal("Wheel size", "%zu", (size_t) 0,
+                      cork_timer_wheel_size(wheel));
+
+    cork_timer_wheel_free(wheel);
+}
+END_TEST
+
+static void
+test_clock(void *user_data, cork_timestamp *now)
+{
+    struct test_state  *state = user_data;
+    *now = state->now;
+}
+
+START_TEST(test_timer_wheel_poll)
+{
+    struct test_state  state;
+    struct cork_timer_wheel  *wheel = test_wheel_new(&state);
+    struct test_timer  timer;
+
+    DESCRIBE_TEST;
+    cork_timer_init(&timer.timer);
+    timer.fired = 0;
+    cork_timer_wheel_set_clock(wheel, test_clock);
+    state.now = 1000 * TICK;
+    cork_timer_wheel_schedule(wheel, &timer.timer, state.now + 50 * TICK);
+    fail_unless_equal("Fired", "%zu", (size_t) 0,
+                      cork_timer_wheel_poll(wheel, test_fire));
+    state.now += 50 * TICK;
+    fail_unless_equal("Fired", "%zu", (size_t) 1,
+                      cork_timer_wheel_poll(wheel, test_fire));
+    cork_timer_wheel_free(wheel);
+
+    /* The default clock is the monotonic one */
+    wheel = cork_timer_wheel_new(0);
+    cork_timer_init(&timer.timer);
+    cork_timer_wheel_schedule(wheel, &timer.timer, 0);
+    cork_timer_wheel_set_user_data(wheel, &state, NULL);
+    fail_unless_equal("Fired", "%zu", (size_t) 1,
+                      cork_timer_wheel_poll(wheel, test_fire));
+    cork_timer_wheel_free(wheel);
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Randomized operations
+ */
+
+#define RANDOM_TIMER_COUNT  20000
+
+static uint64_t
+test_random(uint64_t *state)
+{
+    /* xorshift64 */
+    uint64_t  x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+START_TEST(test_timer_wheel_random)
+{
+    struct test_state  state;
+    struct cork_timer_wheel  *wheel = test_wheel_new(&state);
+    struct test_timer  *timers;
+    bool  *cancelled;
+    uint64_t  rng = 0x9e3779b97f4a7c15ULL;
+    cork_timestamp  now = 12345 * TICK + 17;
+    cork_timestamp  prev_now;
+    size_t  expected = 0;
+    size_t  i;
+
+    DESCRIBE_TEST;
+    timers = cork_calloc(RANDOM_TIMER_COUNT, sizeof(struct test_timer));
+    cancelled = cork_calloc(RANDOM_TIMER_COUNT, sizeof(bool));
+    test_advance(wheel, &state, now);
+
+    for (i = 0; i < RANDOM_TIMER_COUNT; i++) {
+        uint64_t  r = test_random(&rng);
+        /* Spread the expirations across several orders of magnitude, so that
+         * the timers land on every level of the wheel. */
+        unsigned int  magnitude = r % 28;
+        cork_timestamp  delay = (r >> 8) & ((UINT64_C(1) << magnitude) - 1);
+        cork_timer_init(&timers[i].timer);
+        timers[i].id = i;
+        cork_timer_wheel_schedule(wheel, &timers[i].timer, now + delay * 37);
+    }
+    /* Cancel some of them, and reschedule others. */
+    for (i = 0; i < RANDOM_TIMER_COUNT; i += 7) {
+        cork_timer_wheel_cancel(wheel, &timers[i].timer);
+        cancelled[i] = true;
+    }
+    for (i = 3; i < RANDOM_TIMER_COUNT; i += 7) {
+        cork_timer_wheel_schedule
+            (wheel, &timers[i].timer, timers[i].timer.expires / 2 + now);
+    }
+    for (i = 0; i < RANDOM_TIMER_COUNT; i++) {
+        expected += !cancelled[i];
+    }
+    fail_unless_equal("Wheel size", "%zu", expected,
+                      cork_timer_wheel_size(wheel));
+
+    while (cork_timer_wheel_size(wheel) > 0) {
+        cork_timestamp  when;
+        uint64_t  r = test_random(&rng);
+        fail_unless(cork_timer_wheel_next_expiration(wheel, &when),
+                    "Wheel should have an expiration");
+        /* Every pending timer can fire at or after the lower bound, which
+         * is no later than the end of the tick that the timer expires in. */
+        i = r % RANDOM_TIMER_COUNT;
+        fail_unless(!cork_timer_is_scheduled(&timers[i].timer) ||
+                    when <= (timers[i].timer.expires + TICK - 1) / TICK * TICK,
+                    "Next expiration is too late");
+        prev_now = now;
+        /* Sometimes jump straight to the next expiration, and sometimes take
+         * steps of random sizes. */
+        if (r % 4 == 0 && when > now) {
+            now = when;
+        } else {
+            now += (r >> 8) % (1 << (r % 26));
+        }
+        if (test_advance(wheel, &state, now) == 0) {
+            continue;
+        }
+        /* Check every timer that just fired */
+        for (i = 0; i < RANDOM_TIMER_COUNT; i++) {
+            if (timers[i].fired > 0 && timers[i].fired_at == now &&
+                now != prev_now) {
+                fail_unless(timers[i].timer.expires <= now,
+                            "Timer %zu fired early", i);
+                fail_unless(timers[i].timer.expires + TICK > prev_now,
+                            "Timer %zu fired late", i);
+            }
+        }
+    }
+
+    for (i = 0; i < RANDOM_TIMER_COUNT; i++) {
+        fail_unless_equal("Fire count", "%u", cancelled[i]? 0: 1,
+                          timers[i].fired);
+    }
+    fail_unless_equal("Fired", "%zu", expected, state.fired);
+
+    cork_timer_wheel_free(wheel);
+    cork_cfree(timers, RANDOM_TIMER_COUNT, sizeof(struct test_timer));
+    cork_cfree(cancelled, RANDOM_TIMER_COUNT, sizeof(bool));
+}
+END_TEST
+
+
+/*-----------------------------------------------------------------------
+ * Testing harness
+ */
+
+Suite *
+test_suite()
+{
+    Suite  *s = suite_create("timer-wheel");
+
+    TCase  *tc_ds = tcase_create("timer-wheel");
+    tcase_add_test(tc_ds, test_timer_wheel_basics);
+    tcase_add_test(tc_ds, test_timer_wheel_callbacks);
+    tcase_add_test(tc_ds, test_timer_wheel_poll);
+    tcase_add_test(tc_ds, test_timer_wheel_random);
+    suite_add_tcase(s, tc_ds);
+
+    return s;
+}
+
+
+int
+main(int argc, const char **argv)
+{
+    int  number_failed;
+    Suite  *suite = test_suite();
+    SRunner  *runner = srunner_create(suite);
+
+    setup_allocator();
+    srunner_run_all(runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0)? EXIT_SUCCESS: EXIT_FAILURE;
+}